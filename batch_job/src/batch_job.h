@@ -35,6 +35,7 @@ struct batch_job {
 	struct jx *envlist;          /**< JSON formatted environment list */ 
 	struct batch_job_info *info; /**< Stores the info struct created by batch_queue. */
 	char *hash;                  /**< Checksum based on CMD, input contents, and output names. */
+	double priority;             /**< Relative priority, higher first, for systems that order their own tasks. */
 };
 
 /** Create a batch_job struct.
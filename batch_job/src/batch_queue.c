@@ -10,13 +10,17 @@ See the file COPYING for details.
 
 #include "debug.h"
 #include "itable.h"
+#include "list.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
 #include <sys/stat.h>
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 extern const struct batch_queue_module batch_queue_amazon;
 extern const struct batch_queue_module batch_queue_cluster;
@@ -43,6 +47,7 @@ static struct batch_queue_module batch_queue_unknown = {
 		NULL,
 		NULL,
 		NULL,
+		NULL,
 };
 
 #define BATCH_JOB_SYSTEMS "local, vine, wq, condor, uge (sge), pbs, lsf, torque, moab, slurm, amazon, k8s, dryrun"
@@ -64,6 +69,327 @@ const struct batch_queue_module *const batch_queue_modules[] = {
 		&batch_queue_k8s,
 		&batch_queue_unknown};
 
+/*
+Jobs given to batch_queue_submit_async are submitted by a thread of the queue,
+so that the caller is not blocked by a slow batch system.  The modules are not
+thread safe, so every call into the module is made holding module_lock, and
+the thread only takes it for the duration of each submission.  The other
+fields are protected by mutex, and the cond is signalled when a submission
+is queued or completed.  Since the caller may change the options of the
+queue while a job waits, each submission carries a copy of the options
+as they were when it was queued.
+*/
+
+struct batch_queue_async {
+	pthread_t thread;
+	int thread_started;
+	int shutdown;
+	pthread_mutex_t module_lock;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct list *queued;
+	struct list *done;
+	int running;
+	struct batch_queue_submission *current;
+};
+
+struct batch_queue_submission {
+	struct batch_job *job;
+	struct hash_table *options;
+	batch_queue_id_t jobid;
+};
+
+static struct batch_queue_submission *batch_queue_submission_create(struct batch_queue *q, struct batch_job *job)
+{
+	struct batch_queue_submission *s = xxmalloc(sizeof(*s));
+	s->job = job;
+	s->options = hash_table_create(0, 0);
+	s->jobid = -1;
+
+	char *key;
+	char *value;
+	HASH_TABLE_ITERATE(q->options, key, value)
+	{
+		hash_table_insert(s->options, key, xxstrdup(value));
+	}
+
+	return s;
+}
+
+static void batch_queue_submission_delete(struct batch_queue_submission *s)
+{
+	hash_table_clear(s->options, free);
+	hash_table_delete(s->options);
+	free(s);
+}
+
+static void batch_queue_async_init(struct batch_queue *q)
+{
+	struct batch_queue_async *a = xxmalloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	pthread_mutex_init(&a->module_lock, 0);
+	pthread_mutex_init(&a->mutex, 0);
+	pthread_cond_init(&a->cond, 0);
+	a->queued = list_create();
+	a->done = list_create();
+	q->async = a;
+}
+
+static void *batch_queue_async_thread(void *arg)
+{
+	struct batch_queue *q = arg;
+	struct batch_queue_async *a = q->async;
+
+	pthread_mutex_lock(&a->mutex);
+	while (!a->shutdown) {
+		struct batch_queue_submission *s = list_pop_head(a->queued);
+		if (!s) {
+			pthread_cond_wait(&a->cond, &a->mutex);
+			continue;
+		}
+		a->running = 1;
+		pthread_mutex_unlock(&a->mutex);
+
+		pthread_mutex_lock(&a->module_lock);
+		a->current = s;
+		s->jobid = q->module->submit(q, s->job);
+		a->current = 0;
+
+		debug(D_BATCH, "background submission of task %d returned %" PRIbjid, s->job->taskid, s->jobid);
+
+		/* Report the submission before the module can report the job as complete. */
+		pthread_mutex_lock(&a->mutex);
+		pthread_mutex_unlock(&a->module_lock);
+		a->running = 0;
+		list_push_tail(a->done, s);
+		pthread_cond_broadcast(&a->cond);
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	return 0;
+}
+
+/* The options of the submission in progress, if called by the submitting thread. */
+
+static struct hash_table *batch_queue_async_options(struct batch_queue *q)
+{
+	struct batch_queue_async *a = q->async;
+
+	if (a && a->thread_started && a->current && pthread_equal(pthread_self(), a->thread))
+		return a->current->options;
+
+	return 0;
+}
+
+/*
+Take the module lock, giving up at stoptime, so that waiting on one queue
+is never held up for longer than asked by a submission in progress.
+*/
+
+static int batch_queue_async_lock(struct batch_queue *q, time_t stoptime)
+{
+	struct batch_queue_async *a = q->async;
+
+	if (!a)
+		return 1;
+
+	if (stoptime == 0) {
+		pthread_mutex_lock(&a->module_lock);
+		return 1;
+	}
+
+	if (stoptime <= time(0))
+		return pthread_mutex_trylock(&a->module_lock) == 0;
+
+	struct timespec ts;
+	ts.tv_sec = stoptime;
+	ts.tv_nsec = 0;
+	return pthread_mutex_timedlock(&a->module_lock, &ts) == 0;
+}
+
+static void batch_queue_async_unlock(struct batch_queue *q)
+{
+	if (q->async)
+		pthread_mutex_unlock(&q->async->module_lock);
+}
+
+static void batch_queue_async_delete(struct batch_queue *q)
+{
+	struct batch_queue_async *a = q->async;
+	struct batch_queue_submission *s;
+
+	if (!a)
+		return;
+
+	pthread_mutex_lock(&a->mutex);
+	a->shutdown = 1;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->mutex);
+
+	if (a->thread_started)
+		pthread_join(a->thread, 0);
+
+	/* The jobs themselves belong to the caller. */
+	while ((s = list_pop_head(a->queued)))
+		batch_queue_submission_delete(s);
+	while ((s = list_pop_head(a->done)))
+		batch_queue_submission_delete(s);
+	list_delete(a->queued);
+	list_delete(a->done);
+
+	pthread_cond_destroy(&a->cond);
+	pthread_mutex_destroy(&a->mutex);
+	pthread_mutex_destroy(&a->module_lock);
+	free(a);
+	q->async = 0;
+}
+
+/*
+Wait for a job, in slices of at most a second, so that the module lock is
+released regularly for the submitting thread.  Returns early, as if timed
+out, when a submission completes, so that the caller can collect it.
+*/
+
+static batch_queue_id_t batch_queue_async_wait(struct batch_queue *q, struct batch_job_info *info, time_t stoptime)
+{
+	struct batch_queue_async *a = q->async;
+
+	while (1) {
+		pthread_mutex_lock(&a->mutex);
+		int active = list_size(a->queued) + a->running;
+		pthread_mutex_unlock(&a->mutex);
+
+		time_t slice;
+		if (active) {
+			slice = time(0) - 1;
+		} else if (stoptime > 0 && stoptime <= time(0) + 1) {
+			slice = stoptime;
+		} else {
+			slice = time(0) + 1;
+		}
+
+		if (!batch_queue_async_lock(q, stoptime))
+			return -1;
+		batch_queue_id_t jobid = q->module->wait(q, info, slice);
+		batch_queue_async_unlock(q);
+
+		if (jobid > 0)
+			return jobid;
+
+		pthread_mutex_lock(&a->mutex);
+		active = list_size(a->queued) + a->running;
+		int done = list_size(a->done);
+
+		if (done > 0) {
+			jobid = -1;
+		} else if (jobid == 0 && !active) {
+			jobid = 0;
+		} else if (stoptime > 0 && time(0) >= stoptime) {
+			jobid = -1;
+		} else {
+			if (active) {
+				struct timespec ts;
+				ts.tv_sec = time(0) + 1;
+				if (stoptime > 0 && stoptime < ts.tv_sec)
+					ts.tv_sec = stoptime;
+				ts.tv_nsec = 0;
+				pthread_cond_timedwait(&a->cond, &a->mutex, &ts);
+			}
+			pthread_mutex_unlock(&a->mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&a->mutex);
+		return jobid;
+	}
+}
+
+int batch_queue_submit_async(struct batch_queue *q, struct batch_job *bt)
+{
+	if (!batch_queue_supports_feature(q, "async_submit")) {
+		/* Submit now, and report it like any other. */
+		if (!q->async)
+			batch_queue_async_init(q);
+		struct batch_queue_submission *s = batch_queue_submission_create(q, bt);
+		s->jobid = q->module->submit(q, bt);
+		pthread_mutex_lock(&q->async->mutex);
+		list_push_tail(q->async->done, s);
+		pthread_mutex_unlock(&q->async->mutex);
+		return 1;
+	}
+
+	if (!q->async)
+		batch_queue_async_init(q);
+
+	struct batch_queue_async *a = q->async;
+
+	if (!a->thread_started) {
+		if (pthread_create(&a->thread, 0, batch_queue_async_thread, q) != 0) {
+			debug(D_BATCH, "couldn't start submission thread: %s", strerror(errno));
+			return 0;
+		}
+		a->thread_started = 1;
+	}
+
+	struct batch_queue_submission *s = batch_queue_submission_create(q, bt);
+
+	pthread_mutex_lock(&a->mutex);
+	list_push_tail(a->queued, s);
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->mutex);
+
+	return 1;
+}
+
+struct batch_job *batch_queue_wait_submitted(struct batch_queue *q, batch_queue_id_t *jobid, time_t stoptime)
+{
+	struct batch_queue_async *a = q->async;
+	struct batch_queue_submission *s;
+
+	if (!a)
+		return 0;
+
+	pthread_mutex_lock(&a->mutex);
+	while (!(s = list_pop_head(a->done))) {
+		if (!list_size(a->queued) && !a->running)
+			break;
+		if (stoptime == 0) {
+			pthread_cond_wait(&a->cond, &a->mutex);
+		} else if (stoptime > time(0)) {
+			struct timespec ts;
+			ts.tv_sec = stoptime;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&a->cond, &a->mutex, &ts);
+		} else {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	if (!s)
+		return 0;
+
+	struct batch_job *bt = s->job;
+	*jobid = s->jobid;
+	batch_queue_submission_delete(s);
+
+	return bt;
+}
+
+int batch_queue_submit_pending(struct batch_queue *q)
+{
+	struct batch_queue_async *a = q->async;
+
+	if (!a)
+		return 0;
+
+	pthread_mutex_lock(&a->mutex);
+	int count = list_size(a->queued) + list_size(a->done) + a->running;
+	pthread_mutex_unlock(&a->mutex);
+
+	return count;
+}
+
 struct batch_queue *batch_queue_create(batch_queue_type_t type, const char *ssl_key_file, const char *ssl_cert_file)
 {
 	int i;
@@ -78,6 +404,7 @@ struct batch_queue *batch_queue_create(batch_queue_type_t type, const char *ssl_
 	q->tv_file_table = 0;
 	q->tv_manager = 0;
 	q->wq_manager = 0;
+	q->async = 0;
 
 	batch_queue_set_feature(q, "local_job_queue", "yes");
 	batch_queue_set_feature(q, "absolute_path", "yes");
@@ -113,6 +440,7 @@ void batch_queue_delete(struct batch_queue *q)
 	if (q) {
 		debug(D_BATCH, "deleting queue %p", q);
 
+		batch_queue_async_delete(q);
 		q->module->free(q);
 
 		hash_table_clear(q->options, free);
@@ -128,7 +456,8 @@ void batch_queue_delete(struct batch_queue *q)
 
 const char *batch_queue_get_option(struct batch_queue *q, const char *what)
 {
-	return hash_table_lookup(q->options, what);
+	struct hash_table *options = batch_queue_async_options(q);
+	return hash_table_lookup(options ? options : q->options, what);
 }
 
 int batch_queue_option_is_yes(struct batch_queue *q, const char *what)
@@ -173,6 +502,9 @@ int batch_queue_port(struct batch_queue *q)
 
 void batch_queue_set_option(struct batch_queue *q, const char *what, const char *value)
 {
+	/* The submitting thread may be inside the module, which option_update also enters. */
+	batch_queue_async_lock(q, 0);
+
 	char *current = hash_table_remove(q->options, what);
 	if (value) {
 		hash_table_insert(q->options, what, xxstrdup(value));
@@ -182,6 +514,8 @@ void batch_queue_set_option(struct batch_queue *q, const char *what, const char
 	}
 	free(current);
 	q->module->option_update(q, what, value);
+
+	batch_queue_async_unlock(q);
 }
 
 void batch_queue_set_feature(struct batch_queue *q, const char *what, const char *value)
@@ -229,22 +563,80 @@ const char *batch_queue_type_string()
 
 batch_queue_id_t batch_queue_submit(struct batch_queue *q, struct batch_job *bt)
 {
-	return q->module->submit(q, bt);
+	batch_queue_async_lock(q, 0);
+	batch_queue_id_t jobid = q->module->submit(q, bt);
+	batch_queue_async_unlock(q);
+	return jobid;
+}
+
+int batch_queue_submit_many(struct batch_queue *q, struct batch_job **bts, int count, batch_queue_id_t *jobids)
+{
+	int i;
+
+	if (q->module->submit_many) {
+		batch_queue_async_lock(q, 0);
+		i = q->module->submit_many(q, bts, count, jobids);
+		batch_queue_async_unlock(q);
+		return i;
+	}
+
+	for (i = 0; i < count; i++) {
+		jobids[i] = -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		jobids[i] = batch_queue_submit(q, bts[i]);
+		if (jobids[i] <= 0) {
+			jobids[i] = -1;
+			break;
+		}
+	}
+
+	return i;
 }
 
 batch_queue_id_t batch_queue_wait(struct batch_queue *q, struct batch_job_info *info)
 {
-	return q->module->wait(q, info, 0);
+	return batch_queue_wait_timeout(q, info, 0);
 }
 
 batch_queue_id_t batch_queue_wait_timeout(struct batch_queue *q, struct batch_job_info *info, time_t stoptime)
 {
+	if (q->async)
+		return batch_queue_async_wait(q, info, stoptime);
+
 	return q->module->wait(q, info, stoptime);
 }
 
+int batch_queue_wait_many(struct batch_queue *q, batch_queue_id_t *jobids, struct batch_job_info *infos, int max, time_t stoptime)
+{
+	if(max < 1)
+		return 0;
+
+	batch_queue_id_t jobid = batch_queue_wait_timeout(q, &infos[0], stoptime);
+	if(jobid <= 0)
+		return jobid < 0 ? -1 : 0;
+
+	jobids[0] = jobid;
+	int count = 1;
+
+	/* A stoptime in the past checks for a completed job without blocking. */
+	while(count < max) {
+		jobid = batch_queue_wait_timeout(q, &infos[count], time(0) - 1);
+		if(jobid <= 0)
+			break;
+		jobids[count++] = jobid;
+	}
+
+	return count;
+}
+
 int batch_queue_remove(struct batch_queue *q, batch_queue_id_t jobid)
 {
-	return q->module->remove(q, jobid);
+	batch_queue_async_lock(q, 0);
+	int result = q->module->remove(q, jobid);
+	batch_queue_async_unlock(q);
+	return result;
 }
 
 /* vim: set noexpandtab tabstop=8: */
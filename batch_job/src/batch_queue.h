@@ -100,6 +100,47 @@ Zero is not a valid batch job id and indicates an internal failure.
 */
 batch_queue_id_t batch_queue_submit(struct batch_queue *q, struct batch_job *task );
 
+/** Submit many batch jobs at once.
+Batch systems that accept many jobs in one request, such as HTCondor, submit them together,
+which is much faster than submitting each one in turn. Others submit each job in turn,
+stopping at the first failure.
+@param q The queue to submit to.
+@param tasks The job descriptions to submit.
+@param count The number of jobs to submit.
+@param jobids Filled in with the identifier of each job, or a negative number if the job was not submitted.
+@return The number of jobs submitted, which are always the first ones given.
+*/
+int batch_queue_submit_many(struct batch_queue *q, struct batch_job **tasks, int count, batch_queue_id_t *jobids );
+
+/** Submit a batch job in the background.
+The job is submitted by a thread of the queue, so that a slow batch system
+does not block the caller, which collects the result later with @ref batch_queue_wait_submitted.
+The options of the queue at the time of this call apply to the job, even if they are changed before it is submitted.
+The job must not be modified or deleted until it is collected.
+Queues without the feature "async_submit" submit the job immediately, and report it in the same way.
+@param q The queue to submit to.
+@param task The job description to submit.
+@return One if the job was accepted for submission, zero otherwise.
+*/
+int batch_queue_submit_async(struct batch_queue *q, struct batch_job *task );
+
+/** Collect a job submitted in the background.
+While submissions are in progress, the wait functions return as if they had timed out
+whenever one of them completes, so that the caller can collect it with this function.
+@param q The queue of the job.
+@param jobid Filled in with the result of the submission, as returned by @ref batch_queue_submit.
+@param stoptime An absolute time at which to stop waiting.  If less than or equal to the current time,
+this function checks for a completed submission without blocking.  If zero, wait as long as any submission is in progress.
+@return The job given to @ref batch_queue_submit_async, or null if none completed.
+*/
+struct batch_job *batch_queue_wait_submitted(struct batch_queue *q, batch_queue_id_t *jobid, time_t stoptime);
+
+/** Count the jobs submitted in the background that have not been collected.
+@param q The queue of interest.
+@return The number of jobs given to @ref batch_queue_submit_async and not yet returned by @ref batch_queue_wait_submitted.
+*/
+int batch_queue_submit_pending(struct batch_queue *q);
+
 /** Wait for any batch job to complete.
 Blocks until a batch job completes.
  * Note Submit may return 0 as a valid jobid. As of 04/18 wait will not return 0 as a valid jobid. 
@@ -126,6 +167,22 @@ If less than zero, the operation timed out or was interrupted by a system event,
 */
 batch_queue_id_t batch_queue_wait_timeout(struct batch_queue *q, struct batch_job_info *info, time_t stoptime);
 
+/** Wait for any number of batch jobs to complete, with a timeout.
+Blocks until at least one batch job completes or the current time exceeds stoptime,
+and then collects every other job that has already completed, without blocking,
+up to the given maximum.  This allows the caller to handle a burst of completions
+in a single pass.
+@param q The queue to wait on.
+@param jobids An array of at least max elements to be filled in with the jobids of the completed jobs.
+@param infos An array of at least max @ref batch_job_info structures to be filled in with the details of the completed jobs.
+@param max The maximum number of jobs to return.
+@param stoptime An absolute time at which to stop waiting for the first job, as in @ref batch_queue_wait_timeout.
+@return If greater than zero, the number of completed jobs returned.
+If equal to zero, there were no more jobs to wait for.
+If less than zero, the operation timed out or was interrupted by a system event, but may be tried again.
+*/
+int batch_queue_wait_many(struct batch_queue *q, batch_queue_id_t *jobids, struct batch_job_info *infos, int max, time_t stoptime);
+
 /** Remove a batch job.
 This call will start the removal process.
 You must still call @ref batch_queue_wait to wait for the removal to complete.
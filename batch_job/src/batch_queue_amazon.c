@@ -819,6 +819,7 @@ static int batch_queue_amazon_create(struct batch_queue *q)
 	batch_queue_set_feature(q, "output_directories", "true");
 	batch_queue_set_feature(q, "batch_log_name", "%s.amazonlog");
 	batch_queue_set_feature(q, "autosize", "yes");
+	batch_queue_set_feature(q, "async_submit", "yes");
 	batch_queue_set_feature(q, "remote_rename", "%s=%s");
 	batch_queue_set_option(q, "experimental", "yes");
 	return 0;
@@ -840,4 +841,6 @@ const struct batch_queue_module batch_queue_amazon = {
 		batch_queue_amazon_submit,
 		batch_queue_amazon_wait,
 		batch_queue_amazon_remove,
+
+		NULL,
 };
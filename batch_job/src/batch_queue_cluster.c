@@ -37,6 +37,17 @@ int batch_queue_disable_heartbeat = 0;
 static int heartbeat_rate = 30; // in seconds. rate at which hearbeats are written to the log.
 static int heartbeat_max = 120; // in seconds. maximum wait for a heartbeat before giving up on the job.
 
+/*
+Each job of a SLURM job array is known by the id of the array and its index,
+which are combined into one job id.  SLURM job ids have 32 bits, so a flag
+above them keeps array jobs apart from single jobs.
+*/
+#define CLUSTER_ARRAY_MAX 1000
+#define CLUSTER_ARRAY_FLAG ((batch_queue_id_t)1 << 52)
+#define CLUSTER_ARRAY_JOBID(array, index) (CLUSTER_ARRAY_FLAG + ((batch_queue_id_t)(array) << 20) + (index))
+#define CLUSTER_ARRAY_ID(jobid) (((jobid) - CLUSTER_ARRAY_FLAG) >> 20)
+#define CLUSTER_ARRAY_INDEX(jobid) ((jobid) & ((1 << 20) - 1))
+
 /*
 Principle of operation:
 Each batch job that we submit uses a wrapper file.
@@ -79,6 +90,7 @@ static int setup_batch_wrapper(struct batch_queue *q, const char *sysname)
 
 	if (q->type == BATCH_QUEUE_TYPE_SLURM) {
 		fprintf(file, "[ -n \"${SLURM_JOB_ID}\" ] && JOB_ID=`echo ${SLURM_JOB_ID} | cut -d . -f 1`\n");
+		fprintf(file, "[ -n \"${SLURM_ARRAY_TASK_ID}\" ] && JOB_ID=$((%" PRIbjid " + (SLURM_ARRAY_JOB_ID << 20) + SLURM_ARRAY_TASK_ID))\n", CLUSTER_ARRAY_FLAG);
 	} else if (q->type == BATCH_QUEUE_TYPE_LSF) {
 		fprintf(file, "[ -n \"${LSB_JOBID}\" ] && JOB_ID=`echo ${LSB_JOBID} | cut -d . -f 1`\n");
 	} else {
@@ -199,16 +211,15 @@ static char *cluster_set_resource_string(struct batch_queue *q, const struct rms
 	return resources_str;
 }
 
-static batch_queue_id_t batch_queue_cluster_submit(struct batch_queue *q, struct batch_job *j)
-{
-	batch_queue_id_t jobid;
-	struct batch_job_info *info;
-	const char *options = hash_table_lookup(q->options, "batch-options");
+/*
+Build the command that submits job j, after setting up its environment.
+If count is more than one, the command submits count copies of the job
+as a job array.
+*/
 
-	if (!setup_batch_wrapper(q, cluster_name)) {
-		debug(D_NOTICE | D_BATCH, "couldn't setup wrapper file: %s", strerror(errno));
-		return -1;
-	}
+static char *cluster_submit_command(struct batch_queue *q, struct batch_job *j, int count)
+{
+	const char *options = batch_queue_get_option(q, "batch-options");
 
 	char *cluster_resources = cluster_set_resource_string(q, j->resources);
 
@@ -271,27 +282,40 @@ static batch_queue_id_t batch_queue_cluster_submit(struct batch_queue *q, struct
 
 	const char *cluster_stdout_redirect = batch_queue_option_is_yes(q, "keep-wrapper-stdout") ? "" : "-o /dev/null";
 
+	char *array_option = count > 1 ? string_format("--array=0-%d", count - 1) : xxstrdup("");
+
 	/*
 	Note that dot-slash is needed in front of the wrapper command
 	b/c some batch systems perform a PATH search on the executable.
 	*/
 
-	char *command = string_format("%s %s %s %s %s %s %s ./%s.wrapper",
+	char *command = string_format("%s %s %s %s %s %s %s %s ./%s.wrapper",
 			cluster_submit_cmd,
 			cluster_resources,
 			cluster_options,
 			cluster_stdout_redirect,
 			cluster_jobname_var,
 			jobname,
+			array_option,
 			options ? options : "",
 			cluster_name);
 
+	free(array_option);
 	free(jobname);
 	free(cluster_resources);
+
+	return command;
+}
+
+/* Run a submit command, and return the job id that it reports. */
+
+static batch_queue_id_t cluster_run_submit_command(const char *command)
+{
+	batch_queue_id_t jobid;
+
 	debug(D_BATCH, "%s", command);
 
 	FILE *file = popen(command, "r");
-	free(command);
 	if (!file) {
 		debug(D_BATCH, "couldn't submit job: %s", strerror(errno));
 		return -1;
@@ -300,12 +324,7 @@ static batch_queue_id_t batch_queue_cluster_submit(struct batch_queue *q, struct
 	char line[BATCH_JOB_LINE_MAX] = "";
 	while (fgets(line, sizeof(line), file)) {
 		if (sscanf(line, "Your job %" SCNbjid, &jobid) == 1 || sscanf(line, "Submitted batch job %" SCNbjid, &jobid) == 1 || sscanf(line, "Job <%" SCNbjid "> is submitted", &jobid) == 1 || sscanf(line, "%" SCNbjid, &jobid) == 1) {
-			debug(D_BATCH, "job %" PRIbjid " submitted", jobid);
 			pclose(file);
-			info = malloc(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			info->submitted = time(0);
-			itable_insert(q->job_table, jobid, info);
 			return jobid;
 		}
 	}
@@ -319,6 +338,98 @@ static batch_queue_id_t batch_queue_cluster_submit(struct batch_queue *q, struct
 	return -1;
 }
 
+static void cluster_add_job(struct batch_queue *q, batch_queue_id_t jobid)
+{
+	struct batch_job_info *info = malloc(sizeof(*info));
+	memset(info, 0, sizeof(*info));
+	info->submitted = time(0);
+	itable_insert(q->job_table, jobid, info);
+}
+
+static batch_queue_id_t batch_queue_cluster_submit(struct batch_queue *q, struct batch_job *j)
+{
+	if (!setup_batch_wrapper(q, cluster_name)) {
+		debug(D_NOTICE | D_BATCH, "couldn't setup wrapper file: %s", strerror(errno));
+		return -1;
+	}
+
+	char *command = cluster_submit_command(q, j, 1);
+	batch_queue_id_t jobid = cluster_run_submit_command(command);
+	free(command);
+
+	if (jobid < 0)
+		return -1;
+
+	debug(D_BATCH, "job %" PRIbjid " submitted", jobid);
+	cluster_add_job(q, jobid);
+	return jobid;
+}
+
+/*
+Jobs that run the same command with the same environment and resources,
+such as the workers started by a factory, are submitted to SLURM as one job
+array, so that a burst of jobs costs one sbatch instead of one each.
+*/
+
+static int cluster_jobs_identical(struct batch_queue *q, struct batch_job *a, struct batch_job *b)
+{
+	if (strcmp(a->command, b->command) || !jx_equals(a->envlist, b->envlist))
+		return 0;
+
+	char *ra = cluster_set_resource_string(q, a->resources);
+	char *rb = cluster_set_resource_string(q, b->resources);
+	int same = !strcmp(ra, rb);
+	free(ra);
+	free(rb);
+
+	return same;
+}
+
+static int batch_queue_cluster_submit_many(struct batch_queue *q, struct batch_job **tasks, int count, batch_queue_id_t *jobids)
+{
+	int submitted = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		jobids[i] = -1;
+	}
+
+	if (!setup_batch_wrapper(q, cluster_name)) {
+		debug(D_NOTICE | D_BATCH, "couldn't setup wrapper file: %s", strerror(errno));
+		return 0;
+	}
+
+	while (submitted < count) {
+		int n = 1;
+		while (submitted + n < count && n < CLUSTER_ARRAY_MAX && cluster_jobs_identical(q, tasks[submitted], tasks[submitted + n])) {
+			n++;
+		}
+
+		char *command = cluster_submit_command(q, tasks[submitted], n);
+		batch_queue_id_t jobid = cluster_run_submit_command(command);
+		free(command);
+
+		if (jobid < 0)
+			break;
+
+		if (n == 1) {
+			debug(D_BATCH, "job %" PRIbjid " submitted", jobid);
+			jobids[submitted] = jobid;
+			cluster_add_job(q, jobid);
+		} else {
+			debug(D_BATCH, "job array %" PRIbjid " of %d jobs submitted", jobid, n);
+			for (i = 0; i < n; i++) {
+				jobids[submitted + i] = CLUSTER_ARRAY_JOBID(jobid, i);
+				cluster_add_job(q, jobids[submitted + i]);
+			}
+		}
+
+		submitted += n;
+	}
+
+	return submitted;
+}
+
 static batch_queue_id_t batch_queue_cluster_wait(struct batch_queue *q, struct batch_job_info *info_out, time_t stoptime)
 {
 	struct batch_job_info *info;
@@ -408,7 +519,12 @@ static int batch_queue_cluster_remove(struct batch_queue *q, batch_queue_id_t jo
 	info->exited_normally = 0;
 	info->exit_signal = 1;
 
-	char *command = string_format("%s %" PRIbjid, cluster_remove_cmd, jobid);
+	char *command;
+	if (jobid >= CLUSTER_ARRAY_FLAG) {
+		command = string_format("%s %" PRIbjid "_%" PRIbjid, cluster_remove_cmd, CLUSTER_ARRAY_ID(jobid), CLUSTER_ARRAY_INDEX(jobid));
+	} else {
+		command = string_format("%s %" PRIbjid, cluster_remove_cmd, jobid);
+	}
 	system(command);
 	free(command);
 
@@ -417,6 +533,8 @@ static int batch_queue_cluster_remove(struct batch_queue *q, batch_queue_id_t jo
 
 static int batch_queue_cluster_create(struct batch_queue *q)
 {
+	batch_queue_set_feature(q, "async_submit", "yes");
+
 	if (cluster_name)
 		free(cluster_name);
 	if (cluster_submit_cmd)
@@ -528,6 +646,8 @@ const struct batch_queue_module batch_queue_cluster = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_moab = {
@@ -542,6 +662,8 @@ const struct batch_queue_module batch_queue_moab = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_uge = {
@@ -556,6 +678,8 @@ const struct batch_queue_module batch_queue_uge = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 /* retained sge keyword for backwards compatibility after sge->uge name change. */
@@ -571,6 +695,8 @@ const struct batch_queue_module batch_queue_sge = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_pbs = {
@@ -585,6 +711,8 @@ const struct batch_queue_module batch_queue_pbs = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_lsf = {
@@ -599,6 +727,8 @@ const struct batch_queue_module batch_queue_lsf = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_torque = {
@@ -613,6 +743,8 @@ const struct batch_queue_module batch_queue_torque = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		NULL,
 };
 
 const struct batch_queue_module batch_queue_slurm = {
@@ -627,6 +759,8 @@ const struct batch_queue_module batch_queue_slurm = {
 		batch_queue_cluster_submit,
 		batch_queue_cluster_wait,
 		batch_queue_cluster_remove,
+
+		batch_queue_cluster_submit_many,
 };
 
 /* vim: set noexpandtab tabstop=8: */
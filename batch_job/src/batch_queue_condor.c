@@ -8,6 +8,9 @@ See the file COPYING for details.
 #include "batch_queue_internal.h"
 #include "debug.h"
 #include "itable.h"
+#include "jx.h"
+#include "list.h"
+#include "macros.h"
 #include "path.h"
 #include "process.h"
 #include "stringtools.h"
@@ -19,6 +22,13 @@ See the file COPYING for details.
 #include <string.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/inotify.h>
+#endif
 
 static int setup_condor_wrapper(const char *wrapperfile)
 {
@@ -43,7 +53,7 @@ static int setup_condor_wrapper(const char *wrapperfile)
 
 static char *blacklisted_expression(struct batch_queue *q)
 {
-	const char *blacklisted = hash_table_lookup(q->options, "workers-blacklisted");
+	const char *blacklisted = batch_queue_get_option(q, "workers-blacklisted");
 	static char *last_blacklist = NULL;
 
 	if (!blacklisted)
@@ -85,41 +95,27 @@ static char *blacklisted_expression(struct batch_queue *q)
 	return result;
 }
 
-static batch_queue_id_t batch_queue_condor_submit(struct batch_queue *q, struct batch_job *bt)
-{
-	FILE *file;
-	int njobs;
-	int jobid;
-	const char *options = hash_table_lookup(q->options, "batch-options");
+/*
+Jobs submitted together are queued as the procs of one cluster,
+so the id of each job combines its cluster and its proc.  The proc
+is kept in the high bits, so that the first job of a cluster has the
+id of the cluster, as every job did before clusters were submitted,
+and the ids recorded in older logs still name the same jobs.
+*/
 
-	if (setup_condor_wrapper("condor.sh") < 0) {
-		debug(D_BATCH, "could not create condor.sh: %s", strerror(errno));
-		return -1;
-	}
+#define CONDOR_PROC_SHIFT 40
+#define CONDOR_PROCS_PER_CLUSTER 1000000
 
-	file = fopen("condor.submit", "w");
-	if (!file) {
-		debug(D_BATCH, "could not create condor.submit: %s", strerror(errno));
-		return -1;
-	}
+#define CONDOR_JOBID(cluster, proc) ((batch_queue_id_t)(cluster) + ((batch_queue_id_t)(proc) << CONDOR_PROC_SHIFT))
+#define CONDOR_CLUSTER(jobid) ((jobid) & (((batch_queue_id_t)1 << CONDOR_PROC_SHIFT) - 1))
+#define CONDOR_PROC(jobid) ((jobid) >> CONDOR_PROC_SHIFT)
 
+/* The settings shared by every job in a submit file. */
+
+static void condor_write_header(struct batch_queue *q, FILE *file)
+{
 	fprintf(file, "universe = vanilla\n");
 	fprintf(file, "executable = condor.sh\n");
-	char *escaped = string_escape_condor(bt->command);
-	fprintf(file, "arguments = %s\n", escaped);
-	free(escaped);
-
-	/* Add the input files to the transfer list. */
-	if (bt->input_files) {
-		fprintf(file, "transfer_input_files = ");
-		struct batch_file *bf;
-		LIST_ITERATE(bt->input_files, bf)
-		{
-			fprintf(file, "%s, ", bf->inner_name);
-		}
-		/* XXX do we have to worry about a trailing comma? */
-		fprintf(file, "\n");
-	}
 
 	// Note that we do not use transfer_output_files, because that causes the job
 	// to get stuck in a system hold if the files are not created.
@@ -154,10 +150,33 @@ static batch_queue_id_t batch_queue_condor_submit(struct batch_queue *q, struct
 	*/
 
 	fprintf(file, "getenv = true\n");
+}
 
-	if (bt->envlist) {
-		jx_export(bt->envlist);
+/*
+The settings of one job, followed by its queue statement.
+Settings carry over to the next queue statement in the same file,
+so every job sets all of its own.
+*/
+
+static void condor_write_job(struct batch_queue *q, FILE *file, struct batch_job *bt)
+{
+	const char *options = batch_queue_get_option(q, "batch-options");
+
+	char *escaped = string_escape_condor(bt->command);
+	fprintf(file, "arguments = %s\n", escaped);
+	free(escaped);
+
+	/* Add the input files to the transfer list. */
+	fprintf(file, "transfer_input_files = ");
+	if (bt->input_files) {
+		struct batch_file *bf;
+		LIST_ITERATE(bt->input_files, bf)
+		{
+			fprintf(file, "%s, ", bf->inner_name);
+		}
+		/* XXX do we have to worry about a trailing comma? */
 	}
+	fprintf(file, "\n");
 
 	/* set same deafults as condor_submit_workers */
 	int64_t cores = 1;
@@ -182,14 +201,14 @@ static batch_queue_id_t batch_queue_condor_submit(struct batch_queue *q, struct
 		fprintf(file, "request_disk   = ifThenElse((%" PRId64 ") > TotalSlotDisk, (%" PRId64 "), TotalSlotDisk)\n", disk, disk);
 		if (gpus > 0) {
 			fprintf(file, "request_gpus   = ifThenElse((%" PRId64 ") > TotalSlotGpus, (%" PRId64 "), TotalSlotGpus)\n", gpus, gpus);
+		} else {
+			fprintf(file, "request_gpus   = 0\n");
 		}
 	} else {
 		fprintf(file, "request_cpus = %" PRId64 "\n", cores);
 		fprintf(file, "request_memory = %" PRId64 "\n", memory);
 		fprintf(file, "request_disk = %" PRId64 "\n", disk);
-		if (gpus > 0) {
-			fprintf(file, "request_gpus = %" PRId64 "\n", gpus);
-		}
+		fprintf(file, "request_gpus = %" PRId64 "\n", gpus);
 	}
 
 	if (options) {
@@ -200,153 +219,352 @@ static batch_queue_id_t batch_queue_condor_submit(struct batch_queue *q, struct
 	}
 
 	fprintf(file, "queue\n");
+}
+
+/*
+Submit jobs as the procs of one cluster, with a single call to condor_submit.
+All of the jobs must have the same environment.
+Returns the number of jobs submitted, which are the first ones given.
+*/
+
+static int condor_submit_cluster(struct batch_queue *q, struct batch_job **tasks, int count, batch_queue_id_t *jobids)
+{
+	FILE *file;
+	int njobs;
+	batch_queue_id_t cluster;
+	int i;
+
+	file = fopen("condor.submit", "w");
+	if (!file) {
+		debug(D_BATCH, "could not create condor.submit: %s", strerror(errno));
+		return 0;
+	}
+
+	condor_write_header(q, file);
+	for (i = 0; i < count; i++) {
+		condor_write_job(q, file, tasks[i]);
+	}
 	fclose(file);
 
+	if (tasks[0]->envlist) {
+		jx_export(tasks[0]->envlist);
+	}
+
 	file = popen("condor_submit condor.submit", "r");
 	if (!file)
-		return -1;
+		return 0;
 
 	char line[BATCH_JOB_LINE_MAX];
 	while (fgets(line, sizeof(line), file)) {
-		if (sscanf(line, "%d job(s) submitted to cluster %d", &njobs, &jobid) == 2) {
+		if (sscanf(line, "%d job(s) submitted to cluster %" SCNbjid, &njobs, &cluster) == 2) {
 			pclose(file);
-			debug(D_BATCH, "job %d submitted to condor", jobid);
-			struct batch_job_info *info;
-			info = malloc(sizeof(*info));
-			memset(info, 0, sizeof(*info));
-			info->submitted = time(0);
-			itable_insert(q->job_table, jobid, info);
-			return jobid;
+			njobs = MIN(njobs, count);
+			debug(D_BATCH, "%d jobs submitted to condor as cluster %" PRIbjid, njobs, cluster);
+			for (i = 0; i < njobs; i++) {
+				struct batch_job_info *info;
+				info = malloc(sizeof(*info));
+				memset(info, 0, sizeof(*info));
+				info->submitted = time(0);
+				jobids[i] = CONDOR_JOBID(cluster, i);
+				itable_insert(q->job_table, jobids[i], info);
+			}
+			return njobs;
 		}
 	}
 
 	pclose(file);
-	debug(D_BATCH, "failed to submit job to condor!");
-	return -1;
+	debug(D_BATCH, "failed to submit %d jobs to condor!", count);
+	return 0;
 }
 
-static batch_queue_id_t batch_queue_condor_wait(struct batch_queue *q, struct batch_job_info *info_out, time_t stoptime)
+/*
+Submit many jobs with as few calls to condor_submit as possible:
+consecutive jobs with the same environment share one submit file.
+*/
+
+static int batch_queue_condor_submit_many(struct batch_queue *q, struct batch_job **tasks, int count, batch_queue_id_t *jobids)
 {
-	static FILE *logfile = 0;
+	int submitted = 0;
+	int i;
 
-	if (!logfile) {
-		logfile = fopen(q->logfile, "r");
-		if (!logfile) {
-			debug(D_NOTICE, "couldn't open logfile %s: %s\n", q->logfile, strerror(errno));
-			return -1;
+	for (i = 0; i < count; i++) {
+		jobids[i] = -1;
+	}
+
+	if (setup_condor_wrapper("condor.sh") < 0) {
+		debug(D_BATCH, "could not create condor.sh: %s", strerror(errno));
+		return 0;
+	}
+
+	while (submitted < count) {
+		int n = 1;
+		while (submitted + n < count && n < CONDOR_PROCS_PER_CLUSTER && jx_equals(tasks[submitted]->envlist, tasks[submitted + n]->envlist)) {
+			n++;
 		}
+
+		int actual = condor_submit_cluster(q, tasks + submitted, n, jobids + submitted);
+		submitted += actual;
+		if (actual < n)
+			break;
 	}
 
-	time_t current;
+	return submitted;
+}
+
+static batch_queue_id_t batch_queue_condor_submit(struct batch_queue *q, struct batch_job *bt)
+{
+	batch_queue_id_t jobid;
+
+	if (batch_queue_condor_submit_many(q, &bt, 1, &jobid) != 1)
+		return -1;
+
+	debug(D_BATCH, "job %" PRIbjid " submitted to condor", jobid);
+	return jobid;
+}
+
+/*
+The job log is read incrementally: each call reads only what was appended
+since the last, and parses it one complete line at a time, so that an event
+that is still being written is never parsed in part.  All of the completions
+found are kept, and returned by the following calls to wait without reading
+the log again, so that batch_queue_wait_many collects them all at once.
+On Linux, the reader sleeps until inotify reports a change to the log,
+rather than polling it every second.
+*/
+
+/* Check the log at least this often, in case its filesystem does not report changes. */
+#define CONDOR_LOG_CHECK_INTERVAL 5
+
+struct condor_completion {
+	batch_queue_id_t jobid;
+	struct batch_job_info info;
+};
+
+struct condor_log_reader {
+	int fd;
+	int notify_fd;
+	char pending[BATCH_JOB_LINE_MAX];
+	int pending_length;
+	struct batch_job_info *termination; /* The job whose termination status is on the next line, if any. */
+	batch_queue_id_t termination_jobid;
+	struct list *completed;
+};
+
+static struct condor_log_reader *condor_log_reader_create(const char *logfile)
+{
+	int fd = open(logfile, O_RDONLY);
+	if (fd < 0) {
+		debug(D_NOTICE, "couldn't open logfile %s: %s\n", logfile, strerror(errno));
+		return 0;
+	}
+
+	struct condor_log_reader *r = xxcalloc(1, sizeof(*r));
+	r->fd = fd;
+	r->notify_fd = -1;
+	r->completed = list_create();
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	r->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (r->notify_fd >= 0 && inotify_add_watch(r->notify_fd, logfile, IN_MODIFY) < 0) {
+		debug(D_BATCH, "couldn't watch logfile %s: %s", logfile, strerror(errno));
+		close(r->notify_fd);
+		r->notify_fd = -1;
+	}
+#endif
+
+	return r;
+}
+
+static void condor_log_reader_complete(struct condor_log_reader *r, batch_queue_id_t jobid, struct batch_job_info *info)
+{
+	struct condor_completion *c = xxmalloc(sizeof(*c));
+	c->jobid = jobid;
+	memcpy(&c->info, info, sizeof(*info));
+	list_push_tail(r->completed, c);
+	free(info);
+}
+
+static void condor_log_reader_line(struct batch_queue *q, struct condor_log_reader *r, const char *line, int current_year)
+{
+	int type, proc, subproc;
+	int logcode, exitcode;
+	batch_queue_id_t cluster, jobid;
+	struct batch_job_info *info;
 	struct tm tm;
 
+	/* The line after a termination event gives its status. */
+	if (r->termination) {
+		info = r->termination;
+		jobid = r->termination_jobid;
+		r->termination = 0;
+
+		if (sscanf(line, " (%d) Normal termination (return value %d)", &logcode, &exitcode) == 2) {
+			debug(D_BATCH, "job %" PRIbjid " completed normally with status %d.", jobid, exitcode);
+			info->exited_normally = 1;
+			info->exit_code = exitcode;
+		} else if (sscanf(line, " (%d) Abnormal termination (signal %d)", &logcode, &exitcode) == 2) {
+			debug(D_BATCH, "job %" PRIbjid " completed abnormally with signal %d.", jobid, exitcode);
+			info->exited_normally = 0;
+			info->exit_signal = exitcode;
+		} else {
+			debug(D_BATCH, "job %" PRIbjid " completed with unknown status.", jobid);
+			info->exited_normally = 0;
+			info->exit_signal = 0;
+		}
+
+		condor_log_reader_complete(r, jobid, info);
+		return;
+	}
+
+	/*
+		HTCondor job log lines come in one of two flavors:
+
+			005 (312.000.000) 2020-03-28 23:01:04
+		or
+
+			005 (312.000.000) 03/28 23:01:02
+	*/
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = current_year;
+
+	if (!(sscanf(line, "%d (%" SCNbjid ".%d.%d) %d/%d %d:%d:%d", &type, &cluster, &proc, &subproc, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 9) &&
+			!(sscanf(line, "%d (%" SCNbjid ".%d.%d) %d-%d-%d %d:%d:%d", &type, &cluster, &proc, &subproc, &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 10)) {
+		return;
+	}
+
+	jobid = CONDOR_JOBID(cluster, proc);
+
+	tm.tm_year = tm.tm_year - 1900;
+	tm.tm_isdst = 0;
+
+	time_t current = mktime(&tm);
+
+	info = itable_lookup(q->job_table, jobid);
+	if (!info) {
+		info = malloc(sizeof(*info));
+		memset(info, 0, sizeof(*info));
+		itable_insert(q->job_table, jobid, info);
+	}
+
+	debug(D_BATCH, "line: %s", line);
+
+	if (type == 0) {
+		info->submitted = current;
+	} else if (type == 1) {
+		info->started = current;
+		debug(D_BATCH, "job %" PRIbjid " running now", jobid);
+	} else if (type == 9) {
+		itable_remove(q->job_table, jobid);
+
+		info->finished = current;
+		info->exited_normally = 0;
+		info->exit_signal = SIGKILL;
+
+		debug(D_BATCH, "job %" PRIbjid " was removed", jobid);
+
+		condor_log_reader_complete(r, jobid, info);
+	} else if (type == 5) {
+		itable_remove(q->job_table, jobid);
+
+		info->finished = current;
+		r->termination = info;
+		r->termination_jobid = jobid;
+	}
+}
+
+/* Parse every complete line appended to the log since the last call. */
+
+static void condor_log_reader_read(struct batch_queue *q, struct condor_log_reader *r)
+{
 	/* Obtain current year, in case HTCondor log lines do not provide a year.
 	   Note that this fallback may give the incorrect year for jobs that run
 	   when the year turns. However, we just need some value to give to a
 	   mktime below, and the current year is preferable than some fixed value.
 	   */
-	time(&current);
-	tm = *localtime(&current);
+	time_t now = time(0);
+	struct tm tm = *localtime(&now);
 	int current_year = tm.tm_year + 1900;
 
 	while (1) {
-		/*
-		   Note: clearerr is necessary to clear any cached end-of-file condition,
-		   otherwise some implementations of fgets (i.e. darwin) will read to end
-		   of file once and then never look for any more data.
-		 */
-
-		clearerr(logfile);
-
-		char line[BATCH_JOB_LINE_MAX];
-		while (fgets(line, sizeof(line), logfile)) {
-			int type, proc, subproc;
-			batch_queue_id_t jobid;
-
-			struct batch_job_info *info;
-			int logcode, exitcode;
-
-			/*
-				HTCondor job log lines come in one of two flavors:
-
-					005 (312.000.000) 2020-03-28 23:01:04
-				or
-
-					005 (312.000.000) 03/28 23:01:02
-			*/
-			tm.tm_year = current_year;
-
-			if ((sscanf(line, "%d (%" SCNbjid ".%d.%d) %d/%d %d:%d:%d", &type, &jobid, &proc, &subproc, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 9) ||
-					(sscanf(line, "%d (%" SCNbjid ".%d.%d) %d-%d-%d %d:%d:%d", &type, &jobid, &proc, &subproc, &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 10)) {
-
-				tm.tm_year = tm.tm_year - 1900;
-				tm.tm_isdst = 0;
-
-				current = mktime(&tm);
-
-				info = itable_lookup(q->job_table, jobid);
-				if (!info) {
-					info = malloc(sizeof(*info));
-					memset(info, 0, sizeof(*info));
-					itable_insert(q->job_table, jobid, info);
-				}
-
-				debug(D_BATCH, "line: %s", line);
-
-				if (type == 0) {
-					info->submitted = current;
-				} else if (type == 1) {
-					info->started = current;
-					debug(D_BATCH, "job %" PRIbjid " running now", jobid);
-				} else if (type == 9) {
-					itable_remove(q->job_table, jobid);
-
-					info->finished = current;
-					info->exited_normally = 0;
-					info->exit_signal = SIGKILL;
-
-					debug(D_BATCH, "job %" PRIbjid " was removed", jobid);
-
-					memcpy(info_out, info, sizeof(*info));
-					free(info);
-					return jobid;
-				} else if (type == 5) {
-					itable_remove(q->job_table, jobid);
-
-					info->finished = current;
-
-					fgets(line, sizeof(line), logfile);
-					if (sscanf(line, " (%d) Normal termination (return value %d)", &logcode, &exitcode) == 2) {
-						debug(D_BATCH, "job %" PRIbjid " completed normally with status %d.", jobid, exitcode);
-						info->exited_normally = 1;
-						info->exit_code = exitcode;
-					} else if (sscanf(line, " (%d) Abnormal termination (signal %d)", &logcode, &exitcode) == 2) {
-						debug(D_BATCH, "job %" PRIbjid " completed abnormally with signal %d.", jobid, exitcode);
-						info->exited_normally = 0;
-						info->exit_signal = exitcode;
-					} else {
-						debug(D_BATCH, "job %" PRIbjid " completed with unknown status.", jobid);
-						info->exited_normally = 0;
-						info->exit_signal = 0;
-					}
-
-					memcpy(info_out, info, sizeof(*info));
-					free(info);
-					return jobid;
-				}
+		ssize_t actual = read(r->fd, r->pending + r->pending_length, sizeof(r->pending) - 1 - r->pending_length);
+		if (actual <= 0)
+			break;
+
+		r->pending_length += actual;
+		r->pending[r->pending_length] = 0;
+
+		char *line = r->pending;
+		char *newline;
+		while ((newline = strchr(line, '\n'))) {
+			*newline = 0;
+			condor_log_reader_line(q, r, line, current_year);
+			line = newline + 1;
+		}
+
+		r->pending_length -= line - r->pending;
+		if (r->pending_length == (int)sizeof(r->pending) - 1) {
+			/* A line too long for the buffer can't be an event, so drop it. */
+			r->pending_length = 0;
+		}
+		memmove(r->pending, line, r->pending_length);
+	}
+}
+
+/* Sleep until the log changes, or the timeout passes. */
+
+static void condor_log_reader_sleep(struct condor_log_reader *r, int timeout)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if (r->notify_fd >= 0) {
+		struct pollfd pfd;
+		pfd.fd = r->notify_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout * 1000) > 0) {
+			char buffer[4096];
+			while (read(r->notify_fd, buffer, sizeof(buffer)) > 0) {
 			}
 		}
+		return;
+	}
+#endif
+	sleep(1);
+}
+
+static batch_queue_id_t batch_queue_condor_wait(struct batch_queue *q, struct batch_job_info *info_out, time_t stoptime)
+{
+	static struct condor_log_reader *reader = 0;
+
+	if (!reader) {
+		reader = condor_log_reader_create(q->logfile);
+		if (!reader)
+			return -1;
+	}
+
+	while (1) {
+		condor_log_reader_read(q, reader);
+
+		struct condor_completion *c = list_pop_head(reader->completed);
+		if (c) {
+			batch_queue_id_t jobid = c->jobid;
+			memcpy(info_out, &c->info, sizeof(*info_out));
+			free(c);
+			return jobid;
+		}
 
-		if (itable_size(q->job_table) <= 0)
+		if (itable_size(q->job_table) <= 0 && !reader->termination)
 			return 0;
 
-		if (stoptime != 0 && time(0) >= stoptime)
+		time_t now = time(0);
+		if (stoptime != 0 && now >= stoptime)
 			return -1;
 
 		if (process_pending())
 			return -1;
 
-		sleep(1);
+		int timeout = CONDOR_LOG_CHECK_INTERVAL;
+		if (stoptime != 0)
+			timeout = MIN(timeout, stoptime - now);
+		condor_log_reader_sleep(reader, timeout);
 	}
 
 	return -1;
@@ -354,7 +572,7 @@ static batch_queue_id_t batch_queue_condor_wait(struct batch_queue *q, struct ba
 
 static int batch_queue_condor_remove(struct batch_queue *q, batch_queue_id_t jobid)
 {
-	char *command = string_format("condor_rm %" PRIbjid, jobid);
+	char *command = string_format("condor_rm %" PRIbjid ".%" PRIbjid, CONDOR_CLUSTER(jobid), CONDOR_PROC(jobid));
 
 	debug(D_BATCH, "%s", command);
 	FILE *file = popen(command, "r");
@@ -376,6 +594,7 @@ static int batch_queue_condor_create(struct batch_queue *q)
 	strncpy(q->logfile, "condor.logfile", sizeof(q->logfile));
 	batch_queue_set_feature(q, "output_directories", NULL);
 	batch_queue_set_feature(q, "batch_log_name", "%s.condorlog");
+	batch_queue_set_feature(q, "async_submit", "yes");
 	batch_queue_set_feature(q, "autosize", "yes");
 
 	return 0;
@@ -397,6 +616,8 @@ const struct batch_queue_module batch_queue_condor = {
 		batch_queue_condor_submit,
 		batch_queue_condor_wait,
 		batch_queue_condor_remove,
+
+		batch_queue_condor_submit_many,
 };
 
 /* vim: set noexpandtab tabstop=8: */
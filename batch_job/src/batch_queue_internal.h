@@ -33,6 +33,9 @@ struct batch_queue_module {
 	batch_queue_id_t (*submit) (struct batch_queue *Q, struct batch_job *bt );
 	batch_queue_id_t (*wait) (struct batch_queue *Q, struct batch_job_info *info, time_t stoptime);
 	int (*remove) (struct batch_queue *Q, batch_queue_id_t id);
+
+	/* Optional: submit many jobs in one request to the batch system. */
+	int (*submit_many) (struct batch_queue *Q, struct batch_job **bts, int count, batch_queue_id_t *ids);
 };
 
 struct batch_queue {
@@ -46,6 +49,7 @@ struct batch_queue {
 	struct vine_manager *tv_manager;
 	struct work_queue   *wq_manager;
 	const struct batch_queue_module *module;
+	struct batch_queue_async *async;
 };
 
 #define batch_queue_stub_create(name)  static int batch_queue_##name##_create (struct batch_queue *Q) { return 0; }
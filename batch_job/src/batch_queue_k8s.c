@@ -1,5 +1,6 @@
 #include "batch_queue.h"
 #include "batch_queue_internal.h"
+#include "batch_queue_k8s_api.h"
 #include "debug.h"
 #include "process.h"
 #include "macros.h"
@@ -23,12 +24,24 @@
 
 #define MAX_BUF_SIZE 4096
 
+/* How long a single request to the kubernetes api may take. */
+#define K8S_API_STOPTIME 60
+
 static cctools_uuid_t *mf_uuid = NULL;
 static const char *k8s_image = NULL;
-static const char *resources_block = "";
 static int count = 1;
 static struct itable *k8s_job_info_table = NULL;
 
+/*
+If the k8s-api option is set, pods are created, watched, and deleted
+through the kubernetes api instead of running kubectl for each one.
+Running the task inside a pod still uses the script below.
+*/
+static struct k8s_api *k8s_api = NULL;
+static struct k8s_watch *k8s_pod_watch = NULL;
+static struct itable *k8s_pid_table = NULL;
+static struct list *k8s_failed_pods = NULL;
+
 static const char *k8s_script =
 #include "batch_queue_k8s_script.c"
 
@@ -79,6 +92,8 @@ typedef struct k8s_job_info {
 	int is_failed;
 	char *failed_info;
 	int exit_code;
+	struct jx *envlist;
+	pid_t pid;
 } k8s_job_info;
 
 static k8s_job_info *create_k8s_job_info(int job_id, const char *cmd,
@@ -91,10 +106,23 @@ static k8s_job_info *create_k8s_job_info(int job_id, const char *cmd,
 	new_job_info->extra_output_files = xxstrdup(extra_output_files);
 	new_job_info->is_running = 0;
 	new_job_info->is_failed = 0;
+	new_job_info->failed_info = NULL;
+	new_job_info->envlist = NULL;
+	new_job_info->pid = 0;
 
 	return new_job_info;
 }
 
+static void delete_k8s_job_info(k8s_job_info *job_info)
+{
+	free(job_info->cmd);
+	free(job_info->extra_input_files);
+	free(job_info->extra_output_files);
+	free(job_info->failed_info);
+	jx_delete(job_info->envlist);
+	free(job_info);
+}
+
 struct allocatable_resources {
 	double cpu;
 	double mem;
@@ -106,9 +134,23 @@ static struct allocatable_resources *batch_queue_k8s_get_allocatable_resources()
 	double min_mem = DBL_MAX;
 
 	char *get_nodes_info_cmd = "kubectl get nodes -o json";
-	FILE *cmd_fp = popen(get_nodes_info_cmd, "r");
-	if (cmd_fp == NULL) {
-		return NULL;
+	FILE *cmd_fp = NULL;
+	struct jx *cmd_oup;
+
+	if (k8s_api) {
+		int status;
+		cmd_oup = k8s_api_request(k8s_api, "GET", "/api/v1/nodes", NULL, &status, time(0) + K8S_API_STOPTIME);
+		if (!cmd_oup || status != 200) {
+			debug(D_BATCH, "couldn't list the nodes of the cluster: status %d", status);
+			jx_delete(cmd_oup);
+			return NULL;
+		}
+	} else {
+		cmd_fp = popen(get_nodes_info_cmd, "r");
+		if (cmd_fp == NULL) {
+			return NULL;
+		}
+		cmd_oup = jx_parse_stream(cmd_fp);
 	}
 
 	// The format of "kubectl get nodes -o json" is
@@ -133,7 +175,6 @@ static struct allocatable_resources *batch_queue_k8s_get_allocatable_resources()
 	//    ...
 	// }
 
-	struct jx *cmd_oup = jx_parse_stream(cmd_fp);
 	struct jx *node_lst = jx_lookup(cmd_oup, "items");
 	struct jx *node_info;
 	for (void *i = NULL; (node_info = jx_iterate_array(node_lst, &i));) {
@@ -185,10 +226,12 @@ static struct allocatable_resources *batch_queue_k8s_get_allocatable_resources()
 
 	jx_delete(cmd_oup);
 
-	int st = pclose(cmd_fp);
-	if (!WIFEXITED(st)) {
-		debug(D_BATCH, "command %s terminated abnormally\n", get_nodes_info_cmd);
-		return NULL;
+	if (cmd_fp) {
+		int st = pclose(cmd_fp);
+		if (!WIFEXITED(st)) {
+			debug(D_BATCH, "command %s terminated abnormally\n", get_nodes_info_cmd);
+			return NULL;
+		}
 	}
 
 	struct allocatable_resources *min_resource = malloc(sizeof(*min_resource));
@@ -198,28 +241,138 @@ static struct allocatable_resources *batch_queue_k8s_get_allocatable_resources()
 	return min_resource;
 }
 
-static batch_queue_id_t batch_queue_k8s_submit_old(struct batch_queue *q, const char *cmd,
+/* Set up the state shared by all jobs, the first time a job is submitted. */
+
+static void batch_queue_k8s_init(struct batch_queue *q)
+{
+	if (mf_uuid != NULL)
+		return;
+
+	mf_uuid = malloc(sizeof(*mf_uuid));
+	cctools_uuid_create(mf_uuid);
+	// The pod id cannot include upper case
+	string_tolower(mf_uuid->str);
+
+	k8s_job_info_table = itable_create(0);
+
+	if ((k8s_image = batch_queue_get_option(q, "k8s-image")) == NULL) {
+		debug(D_BATCH, "No Docker image specified, will use %s by default", default_docker_image);
+		k8s_image = default_docker_image;
+		// fatal("Please specify the container image by using \"--k8s-image\"");
+	}
+
+	const char *api_url = batch_queue_get_option(q, "k8s-api");
+	if (api_url) {
+		k8s_api = k8s_api_create(api_url);
+		if (!k8s_api) {
+			fatal("couldn't use the kubernetes api at %s", api_url);
+		}
+		k8s_pid_table = itable_create(0);
+		k8s_failed_pods = list_create();
+	}
+}
+
+static int batch_queue_k8s_write_script()
+{
+	if (access(k8s_script_file_name, F_OK | X_OK) == -1) {
+		debug(D_BATCH, "Generating k8s script...");
+		FILE *f = fopen(k8s_script_file_name, "w");
+		if (!f) {
+			return -1;
+		}
+		fprintf(f, "%s", k8s_script);
+		fclose(f);
+		// Execute permissions
+		chmod(k8s_script_file_name, 0755);
+	}
+	return 0;
+}
+
+static char *batch_queue_k8s_pod_spec(struct batch_queue *q, int job_id, const char *pod_id, const struct rmsummary *resources)
+{
+	double cores = 0.0;
+	double memory = 0.0;
+
+	if (resources) {
+		cores = resources->cores > -1 ? (double)resources->cores : cores;
+		memory = resources->memory > -1 ? (double)resources->memory : memory;
+	}
+
+	if (batch_queue_get_option(q, "autosize")) {
+		struct allocatable_resources *min_resource = batch_queue_k8s_get_allocatable_resources();
+		if (min_resource) {
+			debug(D_BATCH, "Allocatable cpu: %f, Allocatable memory: %f", min_resource->cpu, min_resource->mem);
+			// there are always 0.4 cpu used by daemon containers
+			cores = min_resource->cpu - 0.4;
+			// transfer from Ki to Mi
+			memory = min_resource->mem / 1000;
+			free(min_resource);
+		}
+	}
+
+	char *resources_block;
+	if (cores != 0.0 && memory != 0.0) {
+		char *k8s_cpu = string_format("%f", cores);
+		char *k8s_memory = string_format("%fMi", memory);
+		resources_block = string_format(resource_tmpl, k8s_cpu, k8s_memory);
+		free(k8s_cpu);
+		free(k8s_memory);
+	} else {
+		resources_block = xxstrdup("");
+	}
+
+	char *spec = string_format(k8s_config_tmpl, mf_uuid->str, pod_id, pod_id, k8s_image, resources_block, job_id, pod_id);
+	free(resources_block);
+	return spec;
+}
+
+static batch_queue_id_t batch_queue_k8s_submit_api(struct batch_queue *q, const char *cmd,
 		const char *extra_input_files, const char *extra_output_files, struct jx *envlist,
 		const struct rmsummary *resources)
 {
+	if (batch_queue_k8s_write_script() == -1) {
+		return -1;
+	}
 
-	if (mf_uuid == NULL) {
-		mf_uuid = malloc(sizeof(*mf_uuid));
-		cctools_uuid_create(mf_uuid);
-		// The pod id cannot include upper case
-		string_tolower(mf_uuid->str);
+	int job_id = count++;
+	char *pod_id = string_format("%s-%d", mf_uuid->str, job_id);
+	char *spec = batch_queue_k8s_pod_spec(q, job_id, pod_id, resources);
+	char *path = string_format("/api/v1/namespaces/%s/pods", k8s_api_namespace(k8s_api));
+
+	int status;
+	struct jx *response = k8s_api_request(k8s_api, "POST", path, spec, &status, time(0) + K8S_API_STOPTIME);
+	jx_delete(response);
+	free(path);
+	free(spec);
+
+	if (status != 200 && status != 201) {
+		debug(D_BATCH, "couldn't create pod %s: status %d", pod_id, status);
+		free(pod_id);
+		return -1;
 	}
 
-	if (k8s_job_info_table == NULL)
-		k8s_job_info_table = itable_create(0);
+	debug(D_BATCH, "started job %d: %s in pod %s", job_id, cmd, pod_id);
+	free(pod_id);
 
-	if (k8s_image == NULL) {
-		if ((k8s_image = batch_queue_get_option(q, "k8s-image")) == NULL) {
-			debug(D_BATCH, "No Docker image specified, will use %s by default", default_docker_image);
-			k8s_image = default_docker_image;
-			// fatal("Please specify the container image by using \"--k8s-image\"");
-		}
+	struct batch_job_info *info = calloc(1, sizeof(*info));
+	info->submitted = time(0);
+	info->started = time(0);
+	itable_insert(q->job_table, job_id, info);
+
+	k8s_job_info *curr_job_info = create_k8s_job_info(job_id, cmd, extra_input_files, extra_output_files);
+	if (envlist) {
+		curr_job_info->envlist = jx_copy(envlist);
 	}
+	itable_insert(k8s_job_info_table, job_id, curr_job_info);
+
+	return job_id;
+}
+
+static batch_queue_id_t batch_queue_k8s_submit_old(struct batch_queue *q, const char *cmd,
+		const char *extra_input_files, const char *extra_output_files, struct jx *envlist,
+		const struct rmsummary *resources)
+{
+	batch_queue_k8s_init(q);
 
 	if (access(kubectl_failed_log, F_OK | X_OK) == -1) {
 		FILE *f = fopen(kubectl_failed_log, "w");
@@ -230,6 +383,10 @@ static batch_queue_id_t batch_queue_k8s_submit_old(struct batch_queue *q, const
 		fclose(f);
 	}
 
+	if (k8s_api) {
+		return batch_queue_k8s_submit_api(q, cmd, extra_input_files, extra_output_files, envlist, resources);
+	}
+
 	fflush(NULL);
 	pid_t pid = fork();
 
@@ -259,54 +416,15 @@ static batch_queue_id_t batch_queue_k8s_submit_old(struct batch_queue *q, const
 
 		FILE *fd = fopen(k8s_config_fn, "w+");
 		if (!fd) {
-			return -1;
-		}
-
-		double cores = 0.0;
-		double memory = 0.0;
-
-		if (resources) {
-			cores = resources->cores > -1 ? (double)resources->cores : cores;
-			memory = resources->memory > -1 ? (double)resources->memory : memory;
-		}
-
-		if (batch_queue_get_option(q, "autosize")) {
-			struct allocatable_resources *min_resource = batch_queue_k8s_get_allocatable_resources();
-			debug(D_BATCH, "Allocatable cpu: %f, Allocatable memory: %f", min_resource->cpu, min_resource->mem);
-			// there are always 0.4 cpu used by daemon containers
-			cores = min_resource->cpu - 0.4;
-			// transfer from Ki to Mi
-			memory = min_resource->mem / 1000;
-			free(min_resource);
-		}
-
-		if (cores != 0.0 && memory != 0.0) {
-			char *k8s_cpu, *k8s_memory;
-
-			k8s_cpu = string_format("%f", cores);
-			k8s_memory = string_format("%fMi", memory);
-
-			resources_block = string_format(resource_tmpl,
-					k8s_cpu,
-					k8s_memory,
-					k8s_cpu,
-					k8s_memory);
+			_exit(127);
 		}
 
-		fprintf(fd, k8s_config_tmpl, mf_uuid->str, pod_id, pod_id, k8s_image, resources_block, job_id, pod_id);
+		fprintf(fd, "%s", batch_queue_k8s_pod_spec(q, job_id, pod_id, resources));
 
 		fclose(fd);
 
-		if (access(k8s_script_file_name, F_OK | X_OK) == -1) {
-			debug(D_BATCH, "Generating k8s script...");
-			FILE *f = fopen(k8s_script_file_name, "w");
-			if (!f) {
-				return -1;
-			}
-			fprintf(f, "%s", k8s_script);
-			fclose(f);
-			// Execute permissions
-			chmod(k8s_script_file_name, 0755);
+		if (batch_queue_k8s_write_script() == -1) {
+			_exit(127);
 		}
 
 		char *job_id_str = string_format("%d", job_id);
@@ -349,8 +467,39 @@ static batch_queue_id_t batch_queue_k8s_submit(struct batch_queue *q, struct bat
 	return jobid;
 }
 
+/* Stop the task of a job, if it is running, and delete its pod through the api. */
+
+static void batch_queue_k8s_api_delete_job(int job_id)
+{
+	k8s_job_info *curr_job_info = itable_remove(k8s_job_info_table, job_id);
+	if (curr_job_info) {
+		list_remove(k8s_failed_pods, curr_job_info);
+		if (curr_job_info->pid > 0) {
+			itable_remove(k8s_pid_table, curr_job_info->pid);
+			process_kill_waitpid(curr_job_info->pid, 5);
+		}
+		delete_k8s_job_info(curr_job_info);
+	}
+
+	char *path = string_format("/api/v1/namespaces/%s/pods/%s-%d", k8s_api_namespace(k8s_api), mf_uuid->str, job_id);
+	int status;
+	struct jx *response = k8s_api_request(k8s_api, "DELETE", path, NULL, &status, time(0) + K8S_API_STOPTIME);
+	if (status == 200 || status == 202) {
+		debug(D_BATCH, "Successfully delete pods %s-%d", mf_uuid->str, job_id);
+	} else {
+		debug(D_BATCH, "Failed to remove pods %s-%d: status %d", mf_uuid->str, job_id, status);
+	}
+	jx_delete(response);
+	free(path);
+}
+
 static int batch_queue_k8s_remove(struct batch_queue *q, batch_queue_id_t jobid)
 {
+	if (k8s_api) {
+		batch_queue_k8s_api_delete_job(jobid);
+		return 0;
+	}
+
 
 	pid_t pid = fork();
 	char *pod_id = string_format("%s-%d", mf_uuid->str, (int)jobid);
@@ -418,6 +567,35 @@ static void batch_queue_k8s_handle_complete_task(char *pod_id, int job_id,
 	}
 }
 
+/* Start the script that runs the task of a job inside its pod. */
+
+static void batch_queue_k8s_exec_task(const char *pod_id, k8s_job_info *curr_k8s_job_info)
+{
+	fflush(NULL);
+	pid_t pid = fork();
+
+	if (pid > 0) {
+
+		curr_k8s_job_info->is_running = 1;
+		curr_k8s_job_info->pid = pid;
+		debug(D_BATCH, "run job %d: %s in pod %s with pid %ld", curr_k8s_job_info->job_id, curr_k8s_job_info->cmd, pod_id, (long)pid);
+
+	} else if (pid == 0) {
+
+		if (curr_k8s_job_info->envlist) {
+			jx_export(curr_k8s_job_info->envlist);
+		}
+
+		char *job_id_str = string_format("%d", curr_k8s_job_info->job_id);
+		execlp("/bin/sh", "sh", k8s_script_file_name, "exec", pod_id, job_id_str, curr_k8s_job_info->extra_input_files, curr_k8s_job_info->cmd, curr_k8s_job_info->extra_output_files, (char *)NULL);
+		_exit(127);
+
+	} else {
+
+		fatal("couldn't create new process: %s\n", strerror(errno));
+	}
+}
+
 static k8s_job_info *batch_queue_k8s_get_kubectl_failed_task()
 {
 	FILE *kubectl_failed_fp = fopen(kubectl_failed_log, "r");
@@ -433,7 +611,7 @@ static k8s_job_info *batch_queue_k8s_get_kubectl_failed_task()
 		job_id_int = atoi(job_id);
 		free(job_id);
 		k8s_job_info *curr_job_info = itable_lookup(k8s_job_info_table, job_id_int);
-		if (curr_job_info->is_failed == 0) {
+		if (curr_job_info && curr_job_info->is_failed == 0) {
 			curr_job_info->is_failed = 1;
 			pch = strtok(NULL, ",");
 			failed_info = xxstrdup(pch);
@@ -527,9 +705,142 @@ static int batch_queue_k8s_gen_running_pod_lst(struct list **running_pod_lst,
 	return 0;
 }
 
+static batch_queue_id_t batch_queue_k8s_api_complete_task(struct batch_queue *q, k8s_job_info *curr_k8s_job_info,
+		int exited_normally, int exit_code, struct batch_job_info *info_out)
+{
+	int job_id = curr_k8s_job_info->job_id;
+
+	struct batch_job_info *info = itable_remove(q->job_table, job_id);
+	info->finished = time(0);
+	info->exited_normally = exited_normally;
+	info->exit_code = exit_code;
+	if (exited_normally && exit_code == 0) {
+		debug(D_BATCH, "%d successfully complete.", job_id);
+	} else {
+		debug(D_BATCH, "%d is failed to execute.", job_id);
+	}
+	memcpy(info_out, info, sizeof(*info));
+	free(info);
+
+	batch_queue_k8s_api_delete_job(job_id);
+
+	return job_id;
+}
+
+/* Track the phase of a pod from a watch event, and start the task once the pod is running. */
+
+static void batch_queue_k8s_api_handle_event(struct jx *event)
+{
+	const char *type = jx_lookup_string(event, "type");
+	struct jx *pod = jx_lookup(event, "object");
+	const char *pod_id = jx_lookup_string(jx_lookup(pod, "metadata"), "name");
+	const char *phase = jx_lookup_string(jx_lookup(pod, "status"), "phase");
+
+	if (!type || !pod_id || !phase || !strcmp(type, "DELETED")) {
+		return;
+	}
+
+	const char *dash = strrchr(pod_id, '-');
+	if (!dash) {
+		return;
+	}
+
+	k8s_job_info *curr_k8s_job_info = itable_lookup(k8s_job_info_table, atoi(dash + 1));
+	if (!curr_k8s_job_info || curr_k8s_job_info->is_failed) {
+		return;
+	}
+
+	debug(D_BATCH, "%s is %s", pod_id, phase);
+
+	if (!strcmp(phase, "Running")) {
+		if (curr_k8s_job_info->is_running == 0) {
+			batch_queue_k8s_exec_task(pod_id, curr_k8s_job_info);
+			itable_insert(k8s_pid_table, curr_k8s_job_info->pid, curr_k8s_job_info);
+		}
+	} else if (!strcmp(phase, "Failed")) {
+		curr_k8s_job_info->is_failed = 1;
+		curr_k8s_job_info->exit_code = 1;
+		list_push_tail(k8s_failed_pods, curr_k8s_job_info);
+	}
+}
+
+/*
+Rather than listing the pods with kubectl every few seconds, watch the
+pods of this workflow, which reports each change of phase as it happens.
+A job is complete when the script running its task exits.
+*/
+
+static batch_queue_id_t batch_queue_k8s_api_wait(struct batch_queue *q,
+		struct batch_job_info *info_out, time_t stoptime)
+{
+	while (1) {
+		if (itable_size(q->job_table) == 0) {
+			return 0;
+		}
+
+		k8s_job_info *curr_k8s_job_info = batch_queue_k8s_get_kubectl_failed_task();
+		if (curr_k8s_job_info) {
+			return batch_queue_k8s_api_complete_task(q, curr_k8s_job_info, 1, curr_k8s_job_info->exit_code, info_out);
+		}
+
+		curr_k8s_job_info = list_pop_head(k8s_failed_pods);
+		if (curr_k8s_job_info) {
+			return batch_queue_k8s_api_complete_task(q, curr_k8s_job_info, 1, curr_k8s_job_info->exit_code, info_out);
+		}
+
+		uint64_t pid;
+		ITABLE_ITERATE(k8s_pid_table, pid, curr_k8s_job_info)
+		{
+			struct process_info *p = process_waitpid(pid, 0);
+			if (p) {
+				itable_remove(k8s_pid_table, pid);
+				curr_k8s_job_info->pid = 0;
+
+				int exited_normally = WIFEXITED(p->status);
+				int exit_code = exited_normally ? WEXITSTATUS(p->status) : WTERMSIG(p->status);
+				free(p);
+
+				return batch_queue_k8s_api_complete_task(q, curr_k8s_job_info, exited_normally, exit_code, info_out);
+			}
+		}
+
+		// Wake up at least once a second to notice scripts that have exited.
+		time_t wait_until = time(0) + 1;
+		if (stoptime != 0) {
+			wait_until = MIN(wait_until, stoptime);
+		}
+
+		if (!k8s_pod_watch || k8s_watch_closed(k8s_pod_watch)) {
+			k8s_watch_delete(k8s_pod_watch);
+			char *path = string_format("/api/v1/namespaces/%s/pods?labelSelector=app%%3D%s&watch=true", k8s_api_namespace(k8s_api), mf_uuid->str);
+			k8s_pod_watch = k8s_api_watch(k8s_api, path, time(0) + K8S_API_STOPTIME);
+			free(path);
+		}
+
+		if (k8s_pod_watch) {
+			struct jx *event = k8s_watch_next(k8s_pod_watch, wait_until);
+			while (event) {
+				batch_queue_k8s_api_handle_event(event);
+				jx_delete(event);
+				event = k8s_watch_next(k8s_pod_watch, 0);
+			}
+		} else {
+			sleep(1);
+		}
+
+		if (stoptime != 0 && time(0) >= stoptime) {
+			return -1;
+		}
+	}
+}
+
 static batch_queue_id_t batch_queue_k8s_wait(struct batch_queue *q,
 		struct batch_job_info *info_out, time_t stoptime)
 {
+	if (k8s_api) {
+		return batch_queue_k8s_api_wait(q, info_out, stoptime);
+	}
+
 	/*
 	 * There are 5 states for a k8s job
 	 * 1. pod_created
@@ -630,22 +941,7 @@ static batch_queue_id_t batch_queue_k8s_wait(struct batch_queue *q,
 				// then fork/exec to run the job
 
 				if (curr_k8s_job_info->is_running == 0) {
-					pid_t pid = fork();
-
-					if (pid > 0) {
-
-						curr_k8s_job_info->is_running = 1;
-						debug(D_BATCH, "run job %s: %s in pod %s with pid %ld", curr_job_id, curr_k8s_job_info->cmd, curr_pod_id, (long)pid);
-
-					} else if (pid == 0) {
-
-						execlp("/bin/sh", "sh", k8s_script_file_name, "exec", curr_pod_id, curr_job_id, curr_k8s_job_info->extra_input_files, curr_k8s_job_info->cmd, curr_k8s_job_info->extra_output_files, (char *)NULL);
-						_exit(127);
-
-					} else {
-
-						fatal("couldn't create new process: %s\n", strerror(errno));
-					}
+					batch_queue_k8s_exec_task(curr_pod_id, curr_k8s_job_info);
 				}
 
 			} else if (strcmp(task_state, "job_done") == 0) {
@@ -678,12 +974,31 @@ static int batch_queue_k8s_create(struct batch_queue *q)
 	strncpy(q->logfile, "k8s.log", sizeof(q->logfile));
 	batch_queue_set_feature(q, "batch_log_name", "%s.k8slog");
 	batch_queue_set_feature(q, "batch_log_transactions", "%s.tr");
+	batch_queue_set_feature(q, "async_submit", "yes");
 	batch_queue_set_option(q, "experimental", "yes");
 	return 0;
 }
 
 static int batch_queue_k8s_free(struct batch_queue *q)
 {
+	if (!mf_uuid) {
+		return 0;
+	}
+
+	if (k8s_api) {
+		k8s_watch_delete(k8s_pod_watch);
+		k8s_api_delete(k8s_api);
+		itable_delete(k8s_pid_table);
+		list_delete(k8s_failed_pods);
+		k8s_pod_watch = NULL;
+		k8s_api = NULL;
+
+		char *cmd_rm_tmp_files = string_format("rm -f %s %s", k8s_script_file_name, kubectl_failed_log);
+		system(cmd_rm_tmp_files);
+		free(cmd_rm_tmp_files);
+		return 0;
+	}
+
 	char *cmd_rm_tmp_files = string_format("rm %s-*.json %s %s",
 			mf_uuid->str,
 			k8s_script_file_name,
@@ -707,6 +1022,8 @@ const struct batch_queue_module batch_queue_k8s = {
 		batch_queue_k8s_submit,
 		batch_queue_k8s_wait,
 		batch_queue_k8s_remove,
+
+		NULL,
 };
 
 /* vim: set noexpandtab tabstop=8: */
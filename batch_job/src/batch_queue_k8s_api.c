@@ -0,0 +1,439 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "batch_queue_k8s_api.h"
+
+#include "buffer.h"
+#include "copy_stream.h"
+#include "debug.h"
+#include "domain_name_cache.h"
+#include "jx_parse.h"
+#include "link.h"
+#include "macros.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define K8S_API_LINE_MAX 4096
+
+/* How long to wait for the rest of a response once it has started. */
+#define K8S_API_TIMEOUT 30
+
+#define K8S_IN_CLUSTER_DIR "/var/run/secrets/kubernetes.io/serviceaccount"
+
+struct k8s_api {
+	char *host;
+	int port;
+	int tls;
+	char *token;
+	char *ca_file; /* Authorities to verify the server with, if any. */
+	char *namespace;
+	struct link *link;
+};
+
+struct k8s_watch {
+	struct link *link;
+	int chunked;
+	int closed;
+	char *data; /* Received but not yet returned, up to an incomplete line. */
+	size_t length;
+};
+
+struct k8s_response {
+	int status;
+	int chunked;
+	int64_t length;
+	int close;
+};
+
+static char *k8s_api_read_file(const char *path)
+{
+	char *data = 0;
+	size_t length;
+
+	if (copy_file_to_buffer(path, &data, &length) < 0)
+		return 0;
+
+	string_chomp(data);
+	return data;
+}
+
+struct k8s_api *k8s_api_create(const char *url)
+{
+	struct k8s_api *a = xxcalloc(1, sizeof(*a));
+	char host[K8S_API_LINE_MAX];
+
+	if (!strcmp(url, "in-cluster")) {
+		const char *h = getenv("KUBERNETES_SERVICE_HOST");
+		const char *p = getenv("KUBERNETES_SERVICE_PORT");
+		if (!h || !p) {
+			debug(D_BATCH, "KUBERNETES_SERVICE_HOST and KUBERNETES_SERVICE_PORT are not set, not running in a cluster?");
+			k8s_api_delete(a);
+			return 0;
+		}
+		a->host = xxstrdup(h);
+		a->port = atoi(p);
+		a->tls = 1;
+		a->ca_file = xxstrdup(K8S_IN_CLUSTER_DIR "/ca.crt");
+		a->token = k8s_api_read_file(K8S_IN_CLUSTER_DIR "/token");
+		a->namespace = k8s_api_read_file(K8S_IN_CLUSTER_DIR "/namespace");
+		if (!a->token) {
+			debug(D_BATCH, "couldn't read the service account token: %s", strerror(errno));
+			k8s_api_delete(a);
+			return 0;
+		}
+	} else {
+		if (sscanf(url, "http://%[^:/]:%d", host, &a->port) == 2) {
+			a->tls = 0;
+		} else if (sscanf(url, "https://%[^:/]:%d", host, &a->port) == 2) {
+			a->tls = 1;
+		} else if (sscanf(url, "http://%[^:/]", host) == 1) {
+			a->tls = 0;
+			a->port = 80;
+		} else if (sscanf(url, "https://%[^:/]", host) == 1) {
+			a->tls = 1;
+			a->port = 443;
+		} else {
+			debug(D_BATCH, "malformed kubernetes api url: %s", url);
+			k8s_api_delete(a);
+			return 0;
+		}
+		a->host = xxstrdup(host);
+	}
+
+	if (!a->namespace)
+		a->namespace = xxstrdup("default");
+
+	return a;
+}
+
+void k8s_api_delete(struct k8s_api *a)
+{
+	if (!a)
+		return;
+	if (a->link)
+		link_close(a->link);
+	free(a->host);
+	free(a->token);
+	free(a->ca_file);
+	free(a->namespace);
+	free(a);
+}
+
+const char *k8s_api_namespace(struct k8s_api *a)
+{
+	return a->namespace;
+}
+
+static struct link *k8s_api_connect(struct k8s_api *a, time_t stoptime)
+{
+	char addr[LINK_ADDRESS_MAX];
+
+	if (!domain_name_cache_lookup(a->host, addr)) {
+		debug(D_BATCH, "couldn't look up kubernetes api server %s", a->host);
+		return 0;
+	}
+
+	struct link *link = link_connect(addr, a->port, stoptime);
+	if (!link) {
+		debug(D_BATCH, "couldn't connect to kubernetes api server %s port %d: %s", a->host, a->port, strerror(errno));
+		return 0;
+	}
+
+	/* The service account token is only ever sent to a server verified against the cluster's authority. */
+	if (a->tls && link_ssl_wrap_connect_verify(link, a->host, a->ca_file) <= 0) {
+		debug(D_BATCH, "couldn't start tls with kubernetes api server %s", a->host);
+		link_close(link);
+		return 0;
+	}
+
+	return link;
+}
+
+static int k8s_api_send(struct k8s_api *a, struct link *link, const char *method, const char *path, const char *body, time_t stoptime)
+{
+	buffer_t B;
+	buffer_init(&B);
+	buffer_abortonfailure(&B, 1);
+
+	buffer_printf(&B, "%s %s HTTP/1.1\r\n", method, path);
+	buffer_printf(&B, "Host: %s:%d\r\n", a->host, a->port);
+	buffer_putliteral(&B, "Accept: application/json\r\n");
+	if (a->token)
+		buffer_printf(&B, "Authorization: Bearer %s\r\n", a->token);
+	if (body) {
+		buffer_putliteral(&B, "Content-Type: application/json\r\n");
+		buffer_printf(&B, "Content-Length: %zu\r\n", strlen(body));
+	}
+	buffer_putliteral(&B, "\r\n");
+	if (body)
+		buffer_putstring(&B, body);
+
+	debug(D_BATCH, "%s %s", method, path);
+	ssize_t result = link_putlstring(link, buffer_tostring(&B), buffer_pos(&B), stoptime);
+
+	buffer_free(&B);
+	return result >= 0;
+}
+
+static int k8s_api_read_headers(struct link *link, struct k8s_response *r, time_t stoptime)
+{
+	char line[K8S_API_LINE_MAX];
+
+	memset(r, 0, sizeof(*r));
+	r->length = -1;
+
+	if (!link_readline(link, line, sizeof(line), stoptime))
+		return 0;
+	if (sscanf(line, "HTTP/%*d.%*d %d", &r->status) != 1)
+		return 0;
+
+	while (1) {
+		if (!link_readline(link, line, sizeof(line), stoptime))
+			return 0;
+		if (!line[0])
+			break;
+		if (!strncasecmp(line, "Content-Length:", 15)) {
+			r->length = atoll(line + 15);
+		} else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strstr(line + 18, "chunked")) {
+			r->chunked = 1;
+		} else if (!strncasecmp(line, "Connection:", 11) && strstr(line + 11, "close")) {
+			r->close = 1;
+		}
+	}
+
+	return 1;
+}
+
+/* Read one chunk of a chunked body, returning its size, zero at the end, or -1 on error. */
+
+static int64_t k8s_api_read_chunk(struct link *link, buffer_t *out, time_t stoptime)
+{
+	char line[K8S_API_LINE_MAX];
+
+	if (!link_readline(link, line, sizeof(line), stoptime))
+		return -1;
+
+	int64_t size = strtoll(line, 0, 16);
+	if (size < 0)
+		return -1;
+
+	if (size == 0) {
+		/* Skip any trailers, up to the final empty line. */
+		do {
+			if (!link_readline(link, line, sizeof(line), stoptime))
+				return -1;
+		} while (line[0]);
+		return 0;
+	}
+
+	char *data = xxmalloc(size);
+	if (link_read(link, data, size, stoptime) != size) {
+		free(data);
+		return -1;
+	}
+	buffer_putlstring(out, data, size);
+	free(data);
+
+	/* The chunk ends with CRLF. */
+	if (!link_readline(link, line, sizeof(line), stoptime))
+		return -1;
+
+	return size;
+}
+
+static int k8s_api_read_body(struct link *link, struct k8s_response *r, buffer_t *out, time_t stoptime)
+{
+	if (r->chunked) {
+		int64_t size;
+		while ((size = k8s_api_read_chunk(link, out, stoptime)) > 0) {
+		}
+		return size == 0;
+	} else if (r->length >= 0) {
+		char *data = xxmalloc(r->length + 1);
+		ssize_t actual = link_read(link, data, r->length, stoptime);
+		if (actual == r->length)
+			buffer_putlstring(out, data, actual);
+		free(data);
+		return actual == r->length;
+	} else {
+		/* The body ends when the server closes the connection. */
+		char data[K8S_API_LINE_MAX];
+		ssize_t actual;
+		while ((actual = link_read(link, data, sizeof(data), stoptime)) > 0) {
+			buffer_putlstring(out, data, actual);
+		}
+		r->close = 1;
+		return 1;
+	}
+}
+
+struct jx *k8s_api_request(struct k8s_api *a, const char *method, const char *path, const char *body, int *status, time_t stoptime)
+{
+	struct k8s_response r;
+	int attempt;
+
+	*status = 0;
+
+	/* A connection kept from a previous request may have been closed by the server, so try once more on a new one. */
+	for (attempt = 0; attempt < 2; attempt++) {
+		int reused = a->link != 0;
+
+		if (!a->link) {
+			a->link = k8s_api_connect(a, stoptime);
+			if (!a->link)
+				return 0;
+		}
+
+		if (k8s_api_send(a, a->link, method, path, body, stoptime) && k8s_api_read_headers(a->link, &r, stoptime))
+			break;
+
+		link_close(a->link);
+		a->link = 0;
+
+		if (!reused)
+			return 0;
+	}
+
+	if (attempt == 2)
+		return 0;
+
+	buffer_t B;
+	buffer_init(&B);
+
+	int ok = k8s_api_read_body(a->link, &r, &B, MAX(stoptime, time(0) + K8S_API_TIMEOUT));
+	if (!ok || r.close) {
+		link_close(a->link);
+		a->link = 0;
+	}
+
+	struct jx *j = 0;
+	if (ok) {
+		*status = r.status;
+		j = jx_parse_string(buffer_tostring(&B));
+		debug(D_BATCH, "%s %s: %d", method, path, r.status);
+	}
+
+	buffer_free(&B);
+	return j;
+}
+
+struct k8s_watch *k8s_api_watch(struct k8s_api *a, const char *path, time_t stoptime)
+{
+	struct k8s_response r;
+
+	struct link *link = k8s_api_connect(a, stoptime);
+	if (!link)
+		return 0;
+
+	if (!k8s_api_send(a, link, "GET", path, 0, stoptime) || !k8s_api_read_headers(link, &r, stoptime) || r.status != 200) {
+		debug(D_BATCH, "couldn't watch %s: status %d", path, r.status);
+		link_close(link);
+		return 0;
+	}
+
+	struct k8s_watch *w = xxcalloc(1, sizeof(*w));
+	w->link = link;
+	w->chunked = r.chunked;
+	return w;
+}
+
+/* Remove and return the first complete line received, if any. */
+
+static char *k8s_watch_line(struct k8s_watch *w)
+{
+	char *newline = w->data ? memchr(w->data, '\n', w->length) : 0;
+	if (!newline)
+		return 0;
+
+	size_t n = newline - w->data;
+	char *line = xxmalloc(n + 1);
+	memcpy(line, w->data, n);
+	line[n] = 0;
+
+	w->length -= n + 1;
+	memmove(w->data, newline + 1, w->length);
+	return line;
+}
+
+/* Wait until the watch has data to read, or stoptime passes. */
+
+static int k8s_watch_ready(struct k8s_watch *w, time_t stoptime)
+{
+	if (!link_buffer_empty(w->link) || link_usleep(w->link, 0, 1, 0))
+		return 1;
+
+	while (time(0) < stoptime) {
+		if (link_usleep(w->link, 500000, 1, 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+struct jx *k8s_watch_next(struct k8s_watch *w, time_t stoptime)
+{
+	while (1) {
+		char *line;
+		while ((line = k8s_watch_line(w))) {
+			struct jx *event = line[0] ? jx_parse_string(line) : 0;
+			free(line);
+			if (event)
+				return event;
+		}
+
+		if (w->closed || !k8s_watch_ready(w, stoptime))
+			return 0;
+
+		/* Each event is sent at once, so the rest of it follows promptly. */
+		time_t read_stoptime = time(0) + K8S_API_TIMEOUT;
+
+		buffer_t B;
+		buffer_init(&B);
+
+		if (w->chunked) {
+			if (k8s_api_read_chunk(w->link, &B, read_stoptime) <= 0)
+				w->closed = 1;
+		} else {
+			char data[K8S_API_LINE_MAX];
+			ssize_t actual = link_read_avail(w->link, data, sizeof(data), read_stoptime);
+			if (actual > 0) {
+				buffer_putlstring(&B, data, actual);
+			} else {
+				w->closed = 1;
+			}
+		}
+
+		size_t n = buffer_pos(&B);
+		if (n > 0) {
+			w->data = xxrealloc(w->data, w->length + n);
+			memcpy(w->data + w->length, buffer_tostring(&B), n);
+			w->length += n;
+		}
+		buffer_free(&B);
+	}
+}
+
+int k8s_watch_closed(struct k8s_watch *w)
+{
+	return w->closed;
+}
+
+void k8s_watch_delete(struct k8s_watch *w)
+{
+	if (!w)
+		return;
+	link_close(w->link);
+	free(w->data);
+	free(w);
+}
+
+/* vim: set noexpandtab tabstop=8: */
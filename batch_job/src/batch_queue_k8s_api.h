@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef BATCH_QUEUE_K8S_API_H
+#define BATCH_QUEUE_K8S_API_H
+
+#include "jx.h"
+
+#include <time.h>
+
+/*
+A minimal client of the Kubernetes REST API, so that the k8s batch queue
+can create, watch, and delete pods without running kubectl for each one.
+Requests share one connection, which is opened again if it breaks.
+*/
+
+struct k8s_api;
+struct k8s_watch;
+
+/*
+Connect to the API server given by url, such as http://127.0.0.1:8001
+for a local "kubectl proxy".  If url is "in-cluster", use the service
+account of the pod we are running in, over TLS to a server verified
+with the certificate authority of the cluster.
+Returns null if the configuration is incomplete.
+*/
+
+struct k8s_api *k8s_api_create(const char *url);
+
+void k8s_api_delete(struct k8s_api *a);
+
+/* The namespace in which pods are created. */
+
+const char *k8s_api_namespace(struct k8s_api *a);
+
+/*
+Send a request with an optional JSON body, and return the parsed response,
+which the caller must delete.  The HTTP status is stored in status, or
+zero if the server could not be reached.
+*/
+
+struct jx *k8s_api_request(struct k8s_api *a, const char *method, const char *path, const char *body, int *status, time_t stoptime);
+
+/* Start watching the objects at path, on a connection of its own. */
+
+struct k8s_watch *k8s_api_watch(struct k8s_api *a, const char *path, time_t stoptime);
+
+/*
+Return the next event of a watch, as an object with "type" and "object",
+or null if none arrives before stoptime.  If the watch was closed by the
+server, k8s_watch_closed is true afterwards.
+*/
+
+struct jx *k8s_watch_next(struct k8s_watch *w, time_t stoptime);
+
+int k8s_watch_closed(struct k8s_watch *w);
+
+void k8s_watch_delete(struct k8s_watch *w);
+
+#endif
+
+/* vim: set noexpandtab tabstop=8: */
@@ -6,11 +6,13 @@ See the file COPYING for details.
 
 #include "batch_queue.h"
 #include "batch_queue_internal.h"
+#include "cpu_allocator.h"
 #include "debug.h"
 #include "process.h"
 #include "macros.h"
 #include "stringtools.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -25,10 +27,48 @@ See the file COPYING for details.
 #include <sys/prctl.h>
 #endif
 
+/*
+With the option "cpu-affinity", each job that asks for a number of cores
+is bound to that many cpus of its own, preferably on one numa node, so
+that concurrent jobs do not compete for the same cores and caches.
+Jobs that do not ask for cores, or that do not fit, run anywhere.
+The cpus are shared by all local queues, since they run on the same host.
+*/
+
+static struct cpu_allocator *local_cpus = 0;
+static struct itable *local_job_cpus = 0;
+
+static char *batch_queue_local_alloc_cpus(struct batch_job *bt)
+{
+	if (!local_cpus || !bt->resources || bt->resources->cores <= 0)
+		return 0;
+
+	int cores = ceil(bt->resources->cores);
+	char *cpus = cpu_allocator_alloc(local_cpus, cores);
+	if (!cpus)
+		debug(D_BATCH, "only %d of %d cpus are free, so the job will not be bound to %d of them", cpu_allocator_available(local_cpus), cpu_allocator_total(local_cpus), cores);
+
+	return cpus;
+}
+
+static void batch_queue_local_release_cpus(batch_queue_id_t jobid)
+{
+	if (!local_job_cpus)
+		return;
+
+	char *cpus = itable_remove(local_job_cpus, jobid);
+	if (cpus) {
+		cpu_allocator_release(local_cpus, cpus);
+		free(cpus);
+	}
+}
+
 static batch_queue_id_t batch_queue_local_submit(struct batch_queue *q, struct batch_job *bt)
 {
 	batch_queue_id_t jobid;
 
+	char *cpus = batch_queue_local_alloc_cpus(bt);
+
 	fflush(NULL);
 	jobid = fork();
 	if (jobid > 0) {
@@ -38,11 +78,23 @@ static batch_queue_id_t batch_queue_local_submit(struct batch_queue *q, struct b
 		info->submitted = time(0);
 		info->started = time(0);
 		itable_insert(q->job_table, jobid, info);
+		if (cpus) {
+			debug(D_BATCH, "process %" PRIbjid " is bound to cpus %s", jobid, cpus);
+			itable_insert(local_job_cpus, jobid, cpus);
+		}
 		return jobid;
 	} else if (jobid < 0) {
 		debug(D_BATCH, "couldn't create new process: %s\n", strerror(errno));
+		if (cpus) {
+			cpu_allocator_release(local_cpus, cpus);
+			free(cpus);
+		}
 		return -1;
 	} else {
+		if (cpus) {
+			cpu_allocator_bind(local_cpus, cpus);
+		}
+
 		if (bt->envlist) {
 			jx_export(bt->envlist);
 		}
@@ -93,6 +145,8 @@ static batch_queue_id_t batch_queue_local_wait(struct batch_queue *q, struct bat
 
 			memcpy(info_out, info, sizeof(*info));
 
+			batch_queue_local_release_cpus(p->pid);
+
 			int jobid = p->pid;
 			free(p);
 			free(info);
@@ -110,7 +164,9 @@ static batch_queue_id_t batch_queue_local_wait(struct batch_queue *q, struct bat
 static int batch_queue_local_remove(struct batch_queue *q, batch_queue_id_t jobid)
 {
 	int max_wait = 5; // maximum seconds we wish to wait for a given process
-	process_kill_waitpid(jobid, max_wait);
+	if (process_kill_waitpid(jobid, max_wait)) {
+		batch_queue_local_release_cpus(jobid);
+	}
 	return 0;
 }
 
@@ -120,9 +176,21 @@ static int batch_queue_local_create(struct batch_queue *q)
 	return 0;
 }
 
+static void batch_queue_local_option_update(struct batch_queue *q, const char *what, const char *value)
+{
+	if (!strcmp(what, "cpu-affinity") && value && !strcmp(value, "yes") && !local_cpus) {
+		local_cpus = cpu_allocator_create();
+		if (local_cpus) {
+			local_job_cpus = itable_create(0);
+			debug(D_BATCH, "binding local jobs to %d cpus", cpu_allocator_total(local_cpus));
+		} else {
+			debug(D_NOTICE, "couldn't find the cpus of this host, so local jobs will not be bound to cpus");
+		}
+	}
+}
+
 batch_queue_stub_free(local);
 batch_queue_stub_port(local);
-batch_queue_stub_option_update(local);
 
 const struct batch_queue_module batch_queue_local = {
 		BATCH_QUEUE_TYPE_LOCAL,
@@ -136,6 +204,8 @@ const struct batch_queue_module batch_queue_local = {
 		batch_queue_local_submit,
 		batch_queue_local_wait,
 		batch_queue_local_remove,
+
+		NULL,
 };
 
 /* vim: set noexpandtab tabstop=8: */
@@ -84,7 +84,7 @@ static batch_queue_id_t batch_queue_vine_submit(struct batch_queue *q, struct ba
 
 	vine_cache_level_t caching_flag = VINE_CACHE_LEVEL_WORKFLOW;
 
-	const char *caching_option = hash_table_lookup(q->options, "caching");
+	const char *caching_option = batch_queue_get_option(q, "caching");
 	if (!strcmp(caching_option, "task")) {
 		caching_flag = VINE_CACHE_LEVEL_TASK;
 	} else if (!strcmp(caching_option, "workflow")) {
@@ -113,6 +113,10 @@ static batch_queue_id_t batch_queue_vine_submit(struct batch_queue *q, struct ba
 		vine_task_set_resources(t, bt->resources);
 	}
 
+	if (bt->priority) {
+		vine_task_set_priority(t, bt->priority);
+	}
+
 	return vine_submit(q->tv_manager, t);
 }
 
@@ -281,6 +285,8 @@ const struct batch_queue_module batch_queue_vine = {
 		batch_queue_vine_submit,
 		batch_queue_vine_wait,
 		batch_queue_vine_remove,
+
+		NULL,
 };
 
 /* vim: set noexpandtab tabstop=8: */
@@ -56,7 +56,7 @@ static batch_queue_id_t batch_queue_wq_submit(struct batch_queue *q, struct batc
 
 	int caching_flag = WORK_QUEUE_CACHE;
 
-	const char *caching_option = hash_table_lookup(q->options, "caching");
+	const char *caching_option = batch_queue_get_option(q, "caching");
 	if (!strcmp(caching_option, "never")) {
 		caching_flag = WORK_QUEUE_NOCACHE;
 	} else {
@@ -79,6 +79,10 @@ static batch_queue_id_t batch_queue_wq_submit(struct batch_queue *q, struct batc
 		work_queue_task_specify_resources(t, bt->resources);
 	}
 
+	if (bt->priority) {
+		work_queue_task_specify_priority(t, bt->priority);
+	}
+
 	work_queue_submit(q->wq_manager, t);
 
 	return t->taskid;
@@ -268,6 +272,8 @@ const struct batch_queue_module batch_queue_wq = {
 		batch_queue_wq_submit,
 		batch_queue_wq_wait,
 		batch_queue_wq_remove,
+
+		NULL,
 };
 
 /* vim: set noexpandtab tabstop=8: */
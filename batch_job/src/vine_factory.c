@@ -6,6 +6,7 @@ See the file COPYING for details.
 
 #include "vine_catalog.h"
 #include "vine_protocol.h"
+#include "taskvine.h"
 
 #include "cctools.h"
 #include "batch_queue.h"
@@ -80,6 +81,7 @@ static int tasks_per_worker = -1;
 static int autosize = 0;
 static int worker_timeout = 300;
 static int consider_capacity = 0;
+static int predictive = 0;
 static int debug_workers = 0;
 
 static char *project_regex = 0;
@@ -95,6 +97,7 @@ static char *resource_args=0;
 static int abort_flag = 0;
 static pid_t initial_ppid = 0;
 static const char *scratch_dir = 0;
+static const char *stage_dir = 0;
 static char *config_file = 0;
 static char *amazon_config = NULL;
 static char *condor_requirements = NULL;
@@ -206,6 +209,211 @@ int manager_workers_capacity(struct jx *j) {
 	return capacity;
 }
 
+/*
+In predictive mode, the factory does not size the pool by the tasks
+present right now, but by the tasks it expects to be present when
+a worker submitted now has connected.  For each manager, it follows
+the rate at which tasks arrive and, for each category, the rate at
+which tasks complete, from which the duration of a task follows.
+Together with the time that workers take to connect after they are
+submitted, these give the tasks expected at the end of the horizon.
+*/
+
+struct manager_forecast {
+	time_t last_update;
+	int64_t tasks_seen;
+	double arrival_rate;
+	struct hash_table *categories;
+};
+
+struct category_forecast {
+	int64_t tasks_done;
+	double completion_rate;
+};
+
+/* Weight of each new sample in the moving averages of the forecast. */
+#define FORECAST_SMOOTHING 0.3
+
+static struct hash_table *manager_forecasts = NULL;
+
+/* Submission times of the workers that have not yet connected, oldest first. */
+static struct list *workers_pending = NULL;
+static double worker_startup_latency = -1;
+
+static int forecast_target = 0;
+static time_t forecast_below_since = 0;
+
+static double forecast_average(double average, double sample)
+{
+	if(average < 0) {
+		return sample;
+	}
+	return average + FORECAST_SMOOTHING * (sample - average);
+}
+
+static double forecast_latency()
+{
+	return worker_startup_latency < 0 ? factory_period : worker_startup_latency;
+}
+
+/* Record the submission of count workers at the current time. */
+
+static void forecast_workers_submitted(int count)
+{
+	if(!workers_pending) {
+		workers_pending = list_create();
+	}
+
+	time_t now = time(0);
+	int i;
+	for(i = 0; i < count; i++) {
+		time_t *t = xxmalloc(sizeof(*t));
+		*t = now;
+		list_push_tail(workers_pending, t);
+	}
+}
+
+/*
+Workers connect roughly in the order in which they were submitted,
+so when fewer are waiting than before, the oldest ones have connected.
+*/
+
+static void forecast_workers_waiting(int waiting)
+{
+	if(!workers_pending) {
+		return;
+	}
+
+	time_t now = time(0);
+	while(list_size(workers_pending) > MAX(waiting, 0)) {
+		time_t *t = list_pop_head(workers_pending);
+		worker_startup_latency = forecast_average(worker_startup_latency, now - *t);
+		free(t);
+	}
+
+	debug(D_VINE, "worker startup latency: %.0f s", forecast_latency());
+}
+
+/*
+Update the completion rate of a category, and return how many of its
+running tasks are expected to complete within the horizon.
+*/
+
+static double forecast_category(struct manager_forecast *f, const char *name, int64_t running, int64_t done, double dt, double horizon)
+{
+	struct category_forecast *cf = hash_table_lookup(f->categories, name);
+	if(!cf) {
+		cf = xxcalloc(1, sizeof(*cf));
+		cf->completion_rate = -1;
+		cf->tasks_done = done;
+		hash_table_insert(f->categories, name, cf);
+		return 0;
+	}
+
+	if(dt > 0) {
+		cf->completion_rate = forecast_average(cf->completion_rate, MAX(0, done - cf->tasks_done) / dt);
+		cf->tasks_done = done;
+	}
+
+	if(running < 1 || cf->completion_rate <= 0) {
+		return 0;
+	}
+
+	double duration = running / cf->completion_rate;
+	debug(D_VINE, "category %s: %" PRId64 " tasks running, %.0f s per task", name, running, duration);
+
+	return running * MIN(1.0, horizon / duration);
+}
+
+/*
+Return the tasks expected at the end of the horizon, given the tasks
+present now, of which running are on workers.
+*/
+
+static int forecast_tasks(struct jx *j, int tasks_now, int running)
+{
+	const char *host = jx_lookup_string(j, "name");
+	const int port = jx_lookup_integer(j, "port");
+	const int64_t tasks_seen = jx_lookup_integer(j, "tasks_waiting") + jx_lookup_integer(j, "tasks_on_workers") + jx_lookup_integer(j, "tasks_complete");
+
+	if(!manager_forecasts) {
+		manager_forecasts = hash_table_create(0, 0);
+	}
+
+	char *key = string_format("%s:%d", host ? host : "", port);
+	struct manager_forecast *f = hash_table_lookup(manager_forecasts, key);
+	if(!f) {
+		f = xxcalloc(1, sizeof(*f));
+		f->arrival_rate = -1;
+		f->categories = hash_table_create(0, 0);
+		hash_table_insert(manager_forecasts, key, f);
+	}
+	free(key);
+
+	time_t now = time(0);
+	double dt = f->last_update > 0 ? now - f->last_update : 0;
+
+	if(dt > 0) {
+		f->arrival_rate = forecast_average(f->arrival_rate, MAX(0, tasks_seen - f->tasks_seen) / dt);
+	}
+	f->tasks_seen = tasks_seen;
+	f->last_update = now;
+
+	/* Workers submitted now are of use after they connect, and until the next cycle. */
+	double horizon = forecast_latency() + factory_period;
+
+	double completions = 0;
+	struct jx *categories = jx_lookup(j, "categories");
+	if(categories) {
+		struct jx *c;
+		for(void *i = NULL; (c = jx_iterate_array(categories, &i));) {
+			const char *name = jx_lookup_string(c, "category");
+			if(name) {
+				completions += forecast_category(f, name, jx_lookup_integer(c, "tasks_on_workers"), jx_lookup_integer(c, "tasks_done"), dt, horizon);
+			}
+		}
+	} else {
+		/* Managers that report to the catalog do not list their categories. */
+		completions = forecast_category(f, "", jx_lookup_integer(j, "tasks_on_workers"), jx_lookup_integer(j, "tasks_complete"), dt, horizon);
+	}
+	completions = MIN(completions, running);
+
+	double arrivals = MAX(f->arrival_rate, 0) * horizon;
+	int expected = MAX(0, (int)ceil(tasks_now + arrivals - completions));
+
+	debug(D_VINE, "%s:%d tasks now: %d arriving: %.1f/s completing within %.0f s: %.1f expected: %d", host, port, tasks_now, MAX(f->arrival_rate, 0), horizon, completions, expected);
+
+	return expected;
+}
+
+/*
+Follow an increase of the target at once, but a decrease only once it has
+lasted for two horizons, so that a pause between bursts does not let the
+pool drain just before it is needed again.
+*/
+
+static int forecast_hold(int needed)
+{
+	time_t now = time(0);
+	int hold = 2 * (forecast_latency() + factory_period);
+
+	if(needed >= forecast_target) {
+		forecast_target = needed;
+		forecast_below_since = 0;
+	} else if(!forecast_below_since) {
+		forecast_below_since = now;
+	} else if(now - forecast_below_since >= hold) {
+		forecast_target = needed;
+		forecast_below_since = 0;
+	}
+
+	if(forecast_target > needed) {
+		debug(D_VINE, "holding target of %d workers for up to %d s", forecast_target, hold);
+	}
+
+	return forecast_target;
+}
+
 int manager_workers_needed_by_resource(struct jx *j) {
 	int tasks_total_cores  = jx_lookup_integer(j, "tasks_total_cores");
 	int tasks_total_memory = jx_lookup_integer(j, "tasks_total_memory");
@@ -359,6 +567,10 @@ static int count_workers_needed( struct list *managers_list, int only_not_runnin
 			need = tw + tl + tr;
 		}
 
+		if(predictive) {
+			need = forecast_tasks(j, need, only_not_running ? 0 : tr);
+		}
+
 		// enforce many tasks per worker
 		if(tasks_per_worker > 0) {
 			need = DIV_INT_ROUND_UP(need, tasks_per_worker);
@@ -436,7 +648,7 @@ static char * make_features_string( struct hash_table *features_table )
 	return str;
 }
 
-static int submit_worker( struct batch_queue *queue )
+static struct batch_job *create_worker_job( struct batch_queue *queue )
 {
 	char *cmd;
 
@@ -519,15 +731,11 @@ static int submit_worker( struct batch_queue *queue )
 	
 	debug(D_VINE,"submitting worker: %s",cmd);
 
-	int status = batch_queue_submit(queue,task);
-
-	batch_job_delete(task);
-	
 	free(worker_log_file);
 	free(debug_worker_options);
 	free(cmd);
 
-	return status;
+	return task;
 }
 
 static void update_blocked_hosts( struct batch_queue *queue, struct list *managers_list ) {
@@ -574,19 +782,38 @@ static void update_blocked_hosts( struct batch_queue *queue, struct list *manage
 	buffer_free(&b);
 }
 
+/*
+Submit all of the workers in one request if the batch system allows it,
+which is much faster than one at a time, e.g. with HTCondor.
+*/
+
 static int submit_workers( struct batch_queue *queue, struct itable *job_table, int count )
 {
 	int i;
+
+	if(count<1) return 0;
+
+	struct batch_job **tasks = xxmalloc(count*sizeof(*tasks));
+	batch_queue_id_t *jobids = xxmalloc(count*sizeof(*jobids));
+
 	for(i=0;i<count;i++) {
-		int jobid = submit_worker(queue);
-		if(jobid>0) {
-			debug(D_VINE,"worker job %d submitted",jobid);
-			itable_insert(job_table,jobid,(void*)1);
-		} else {
-			break;
+		tasks[i] = create_worker_job(queue);
+	}
+
+	int submitted = batch_queue_submit_many(queue,tasks,count,jobids);
+
+	for(i=0;i<count;i++) {
+		if(i<submitted) {
+			debug(D_VINE,"worker job %"PRIbjid" submitted",jobids[i]);
+			itable_insert(job_table,jobids[i],(void*)1);
 		}
+		batch_job_delete(tasks[i]);
 	}
-	return i;
+
+	free(tasks);
+	free(jobids);
+
+	return submitted;
 }
 
 void remove_all_workers( struct batch_queue *queue, struct itable *job_table )
@@ -794,6 +1021,7 @@ int read_config_file(const char *config_file) {
 	assign_new_value(new_workers_min, workers_min, min-workers, int, JX_INTEGER, integer_value)
 	assign_new_value(new_workers_per_cycle, workers_per_cycle, workers-per-cycle, int, JX_INTEGER, integer_value)
 	assign_new_value(new_consider_capacity, consider_capacity, capacity, int, JX_INTEGER, integer_value)
+	assign_new_value(new_predictive, predictive, predictive, int, JX_INTEGER, integer_value)
 	assign_new_value(new_worker_timeout, worker_timeout, timeout, int, JX_INTEGER, integer_value)
 
 	assign_new_value(new_num_cores_option, resources->cores, cores,    int, JX_INTEGER, integer_value)
@@ -863,6 +1091,7 @@ int read_config_file(const char *config_file) {
 	autosize         = new_autosize_option;
 	factory_timeout  = new_factory_timeout_option;
 	consider_capacity = new_consider_capacity;
+	predictive = new_predictive;
 
 	resources->cores  = new_num_cores_option;
 	resources->memory = new_num_memory_option;
@@ -1033,6 +1262,10 @@ static void mainloop( struct batch_queue *queue )
 
 		debug(D_VINE,"raw workers needed: %d", workers_needed);
 
+		if(predictive) {
+			workers_needed = forecast_hold(workers_needed);
+		}
+
 		if(workers_needed > workers_max) {
 			debug(D_VINE,"applying maximum of %d workers",workers_max);
 			workers_needed = workers_max;
@@ -1063,6 +1296,10 @@ static void mainloop( struct batch_queue *queue )
 			debug(D_VINE,"waiting for %d previously submitted workers to connect", workers_waiting_to_connect);
 		}
 
+		if(predictive) {
+			forecast_workers_waiting(workers_waiting_to_connect);
+		}
+
 		// Apply workers_per_cycle. Never have more than workers_per_cycle waiting to connect.
 		if(workers_per_cycle > 0 && (new_workers_needed + workers_waiting_to_connect) > workers_per_cycle) {
 			debug(D_VINE,"applying maximum workers per cycle of %d",workers_per_cycle);
@@ -1086,7 +1323,11 @@ static void mainloop( struct batch_queue *queue )
 
 		if(new_workers_needed > 0) {
 			debug(D_VINE,"submitting %d new workers to reach target",new_workers_needed);
-			workers_submitted += submit_workers(queue,job_table,new_workers_needed);
+			int submitted = submit_workers(queue,job_table,new_workers_needed);
+			workers_submitted += submitted;
+			if(predictive) {
+				forecast_workers_submitted(submitted);
+			}
 		} else if(new_workers_needed < 0) {
 			debug(D_VINE,"too many workers, will wait for some to exit");
 		} else {
@@ -1135,6 +1376,63 @@ static void mainloop( struct batch_queue *queue )
 /* Add a wrapper command around the worker executable. */
 /* Note that multiple wrappers can be nested. */
 
+/*
+With --stage-dir, each worker runs inside this script, which keeps a
+directory on each execution host that is shared by all of the workers
+that land there.  Poncho environments are unpacked there once per host,
+and files that a worker caches forever are kept there, so that the next
+workers on the host start with them already in their caches, and the
+manager does not send them again.  Files are shared by hard links, so
+the workspace of each worker is placed in the same directory.
+*/
+
+static const char *stage_script =
+"#!/bin/sh\n"
+"stage=$1\n"
+"shift\n"
+"if ! mkdir -p \"$stage/cache\" \"$stage/poncho\"\n"
+"then\n"
+"	exec \"$@\"\n"
+"fi\n"
+"export PONCHO_UNPACK_PREFIX=\"$stage/poncho\"\n"
+"workspace=\"$stage/worker-$$\"\n"
+"mkdir -p \"$workspace/cache\"\n"
+"for meta in \"$stage\"/cache/*.meta\n"
+"do\n"
+"	[ -f \"$meta\" ] || continue\n"
+"	name=$(basename \"$meta\" .meta)\n"
+"	cp -al \"$stage/cache/$name\" \"$workspace/cache/$name\" && cp -l \"$meta\" \"$workspace/cache/$name.meta\"\n"
+"done\n"
+"\"$@\" --workspace \"$workspace\" --keep-workspace\n"
+"status=$?\n"
+"for meta in \"$workspace\"/cache/*.meta\n"
+"do\n"
+"	[ -f \"$meta\" ] || continue\n"
+"	name=$(basename \"$meta\" .meta)\n"
+"	[ -e \"$stage/cache/$name.meta\" ] && continue\n"
+"	grep -q '^cache_level %d' \"$meta\" || continue\n"
+"	tmp=\"$stage/cache/.$name.$$\"\n"
+"	rm -rf \"$stage/cache/$name\"\n"
+"	cp -al \"$workspace/cache/$name\" \"$tmp\" && mv -T \"$tmp\" \"$stage/cache/$name\" && cp -l \"$meta\" \"$tmp.meta\" && mv -T \"$tmp.meta\" \"$stage/cache/$name.meta\"\n"
+"	rm -rf \"$tmp\" \"$tmp.meta\"\n"
+"done\n"
+"rm -rf \"$workspace\"\n"
+"exit $status\n";
+
+static int setup_stage_script( const char *filename )
+{
+	FILE *file = fopen(filename,"w");
+	if(!file) {
+		return 0;
+	}
+
+	fprintf(file,stage_script,VINE_CACHE_LEVEL_FOREVER);
+	fchmod(fileno(file),0755);
+	fclose(file);
+
+	return 1;
+}
+
 void add_wrapper_command( const char *cmd )
 {
 	if(!wrapper_command) {
@@ -1189,6 +1487,7 @@ static void show_help(const char *cmd)
 	printf(" %-30s Exit after no manager seen in <n> seconds.\n", "--factory-timeout");
 	printf(" %-30s Average tasks per worker (default=one per core).\n", "--tasks-per-worker");
 	printf(" %-30s Use worker capacity reported by managers.\n","-c,--capacity");
+	printf(" %-30s Submit workers ahead of the expected demand.\n","--predictive");
 
 	printf("\nResource management options:\n");
 	printf(" %-30s Set the number of cores requested per worker.\n", "--cores=<n>");
@@ -1205,6 +1504,7 @@ static void show_help(const char *cmd)
 	printf(" %-30s Wrap factory with this command prefix.\n","--wrapper");
 	printf(" %-30s Add this input file needed by the wrapper.\n","--wrapper-input");
 	printf(" %-30s Run each worker inside this poncho environment.\n","--poncho-env=<file.tar.gz>");
+	printf(" %-30s Share environments and cached files between workers on the same host in this directory.\n","--stage-dir=<dir>");
 
 	printf("\nOptions specific to batch systems:\n");
 	printf(" %-30s Generic batch system options.\n", "-B,--batch-options=<options>");
@@ -1243,6 +1543,8 @@ enum{   LONG_OPT_CORES = 255,
 		LONG_OPT_DEBUG_WORKERS,
 		LONG_OPT_DISABLE_AFS_CHECK,
 		LONG_OPT_SINGLE_SHOT,
+		LONG_OPT_PREDICTIVE,
+		LONG_OPT_STAGE_DIR,
 };
 
 static const struct option long_options[] = {
@@ -1278,9 +1580,11 @@ static const struct option long_options[] = {
 	{"parent-death", no_argument, 0, LONG_OPT_PARENT_DEATH},
 	{"password", required_argument, 0, 'P'},
 	{"poncho-env", required_argument, 0, LONG_OPT_PONCHO_ENV},
+	{"predictive", no_argument, 0, LONG_OPT_PREDICTIVE},
 	{"python-env", required_argument, 0, LONG_OPT_PONCHO_ENV}, // backwards compatibility
 	{"python-package", required_argument, 0, LONG_OPT_PONCHO_ENV}, // backwards compatibility
 	{"scratch-dir", required_argument, 0, 'S' },
+	{"stage-dir", required_argument, 0, LONG_OPT_STAGE_DIR},
 	{"tasks-per-worker", required_argument, 0, LONG_OPT_TASKS_PER_WORKER},
 	{"timeout", required_argument, 0, 't'},
 	{"version", no_argument, 0, 'v'},
@@ -1425,6 +1729,9 @@ int main(int argc, char *argv[])
 			case LONG_OPT_WRAPPER:
 				add_wrapper_command(optarg);
 				break;
+			case LONG_OPT_STAGE_DIR:
+				stage_dir = optarg;
+				break;
 			case LONG_OPT_WRAPPER_INPUT:
 				add_wrapper_input(optarg);
 				break;
@@ -1444,6 +1751,9 @@ int main(int argc, char *argv[])
 			case 'c':
 				consider_capacity = 1;
 				break;
+			case LONG_OPT_PREDICTIVE:
+				predictive = 1;
+				break;
 			case 'd':
 				if (!debug_flags_set(optarg)) {
 					fprintf(stderr, "Unknown debug flag: %s\n", optarg);
@@ -1655,6 +1965,18 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if(stage_dir) {
+		// The staging script is the outermost wrapper, so that it can pass the workspace to the worker.
+		if(!setup_stage_script("vine_stage.sh")) {
+			fprintf(stderr,"vine_factory: couldn't create vine_stage.sh: %s\n",strerror(errno));
+			return 1;
+		}
+		list_push_tail(wrapper_inputs,xxstrdup("vine_stage.sh"));
+		char *cmd = string_format("./vine_stage.sh %s",stage_dir);
+		add_wrapper_command(cmd);
+		free(cmd);
+	}
+
 	signal(SIGINT, handle_abort);
 	signal(SIGQUIT, handle_abort);
 	signal(SIGTERM, handle_abort);
@@ -96,6 +96,7 @@ static char *resource_args=0;
 static int abort_flag = 0;
 static pid_t initial_ppid = 0;
 static const char *scratch_dir = 0;
+static const char *stage_dir = 0;
 static char *config_file = 0;
 static char *amazon_config = NULL;
 static char *condor_requirements = NULL;
@@ -235,6 +236,18 @@ int manager_workers_needed_by_resource(struct jx *j) {
 	return needed;
 }
 
+int manager_workers_needed_by_makespan(struct jx *j, int need) {
+	int tasks_needed_cores = jx_lookup_integer(j, "tasks_needed_cores");
+
+	if(tasks_needed_cores < 1) {
+		return need;
+	}
+
+	const int cores = resources->cores > 0 ? resources->cores : 1;
+
+	return MAX(1, DIV_INT_ROUND_UP(tasks_needed_cores, cores));
+}
+
 struct list* do_direct_query( const char *manager_host, int manager_port )
 {
 	const char * query_string = "queue";
@@ -360,6 +373,10 @@ static int count_workers_needed( struct list *managers_list, int only_not_runnin
 		// consider if tasks declared resources...
 		need = MAX(need, manager_workers_needed_by_resource(j));
 
+		// if the manager predicts the cores that complete its tasks within
+		// its target makespan, do not start more workers than that.
+		need = MIN(need, manager_workers_needed_by_makespan(j, need));
+
 		if(consider_capacity && capacity > 0) {
 			need = MIN(need, capacity);
 		}
@@ -428,7 +445,7 @@ static char * make_features_string( struct hash_table *features_table )
 	return str;
 }
 
-static int submit_worker( struct batch_queue *queue )
+static struct batch_job *create_worker_job( struct batch_queue *queue )
 {
 	char *cmd;
 	char *worker;
@@ -515,14 +532,10 @@ static int submit_worker( struct batch_queue *queue )
 	
 	debug(D_WQ,"submitting worker: %s",cmd);
 
-	int status = batch_queue_submit(queue,task);
-
-	batch_job_delete(task);
-	
 	free(cmd);
 	free(worker);
 
-	return status;
+	return task;
 }
 
 static void update_blocked_hosts( struct batch_queue *queue, struct list *managers_list ) {
@@ -569,19 +582,38 @@ static void update_blocked_hosts( struct batch_queue *queue, struct list *manage
 	buffer_free(&b);
 }
 
+/*
+Submit all of the workers in one request if the batch system allows it,
+which is much faster than one at a time, e.g. with HTCondor.
+*/
+
 static int submit_workers( struct batch_queue *queue, struct itable *job_table, int count )
 {
 	int i;
+
+	if(count<1) return 0;
+
+	struct batch_job **tasks = xxmalloc(count*sizeof(*tasks));
+	batch_queue_id_t *jobids = xxmalloc(count*sizeof(*jobids));
+
 	for(i=0;i<count;i++) {
-		int jobid = submit_worker(queue);
-		if(jobid>0) {
-			debug(D_WQ,"worker job %d submitted",jobid);
-			itable_insert(job_table,jobid,(void*)1);
-		} else {
-			break;
+		tasks[i] = create_worker_job(queue);
+	}
+
+	int submitted = batch_queue_submit_many(queue,tasks,count,jobids);
+
+	for(i=0;i<count;i++) {
+		if(i<submitted) {
+			debug(D_WQ,"worker job %"PRIbjid" submitted",jobids[i]);
+			itable_insert(job_table,jobids[i],(void*)1);
 		}
+		batch_job_delete(tasks[i]);
 	}
-	return i;
+
+	free(tasks);
+	free(jobids);
+
+	return submitted;
 }
 
 void remove_all_workers( struct batch_queue *queue, struct itable *job_table )
@@ -1198,6 +1230,7 @@ static void show_help(const char *cmd)
 	printf(" %-30s Add this input file needed by the wrapper.\n","--wrapper-input");
 	printf(" %-30s Use runos tool to create environment (ND only).\n","--runos=<img>");
 	printf(" %-30s Run each worker inside this poncho environment.\n","--poncho-env=<file.tar.gz>");
+	printf(" %-30s Share unpacked environments between workers on the same host in this directory.\n","--stage-dir=<dir>");
 
 	printf("\nOptions specific to batch systems:\n");
 	printf(" %-30s Generic batch system options.\n", "-B,--batch-options=<options>");
@@ -1206,6 +1239,7 @@ static void show_help(const char *cmd)
 	printf(" %-30s Set requirements for the workers as Condor jobs.\n", "--condor-requirements");
 	printf(" %-30s Container image for Kubernetes.\n", "--k8s-image");
 	printf(" %-30s Container image with worker for Kubernetes.\n", "--k8s-worker-image");
+	printf(" %-30s Manage pods through the Kubernetes API at this url.\n", "--k8s-api");
 
 }
 
@@ -1226,6 +1260,8 @@ enum{   LONG_OPT_CORES = 255,
 		LONG_OPT_WORKER_BINARY,
 		LONG_OPT_K8S_IMAGE,
 		LONG_OPT_K8S_WORKER_IMAGE,
+		LONG_OPT_K8S_API,
+		LONG_OPT_STAGE_DIR,
 		LONG_OPT_CATALOG,
 		LONG_OPT_ENVIRONMENT_VARIABLE,
 		LONG_OPT_RUN_AS_MANAGER,
@@ -1261,6 +1297,7 @@ static const struct option long_options[] = {
 	{"help", no_argument, 0, 'h'},
 	{"k8s-image", required_argument, 0, LONG_OPT_K8S_IMAGE},
 	{"k8s-worker-image", required_argument, 0, LONG_OPT_K8S_WORKER_IMAGE},
+	{"k8s-api", required_argument, 0, LONG_OPT_K8S_API},
 	{"manager-name", required_argument, 0, 'M'},
 	{"master-name", required_argument, 0, 'M'},
 	{"max-workers", required_argument, 0, 'W'},
@@ -1274,6 +1311,7 @@ static const struct option long_options[] = {
 	{"run-factory-as-manager", no_argument, 0, LONG_OPT_RUN_AS_MANAGER},
 	{"runos", required_argument, 0, LONG_OPT_RUN_OS},
 	{"scratch-dir", required_argument, 0, 'S' },
+	{"stage-dir", required_argument, 0, LONG_OPT_STAGE_DIR},
 	{"tasks-per-worker", required_argument, 0, LONG_OPT_TASKS_PER_WORKER},
 	{"timeout", required_argument, 0, 't'},
 	{"version", no_argument, 0, 'v'},
@@ -1290,6 +1328,7 @@ static const struct option long_options[] = {
 int main(int argc, char *argv[])
 {
 	char *k8s_image = NULL;
+	char *k8s_api = NULL;
 
 	wrapper_inputs = list_create();
 
@@ -1437,6 +1476,9 @@ int main(int argc, char *argv[])
 			case 'S':
 				scratch_dir = optarg;
 				break;
+			case LONG_OPT_STAGE_DIR:
+				stage_dir = optarg;
+				break;
 			case 'c':
 				consider_capacity = 1;
 				break;
@@ -1465,6 +1507,9 @@ int main(int argc, char *argv[])
 				k8s_image = xxstrdup(optarg);
 				k8s_worker_image = 1;
 				break;
+			case LONG_OPT_K8S_API:
+				k8s_api = xxstrdup(optarg);
+				break;
 			case LONG_OPT_CATALOG:
 				catalog_host = xxstrdup(optarg);
 				break;
@@ -1654,6 +1699,13 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if(stage_dir) {
+		/* poncho_package_run unpacks each environment once under this prefix, and locks it against other workers on the host. */
+		char *cmd = string_format("env PONCHO_UNPACK_PREFIX=%s/poncho",stage_dir);
+		add_wrapper_command(cmd);
+		free(cmd);
+	}
+
 	signal(SIGINT, handle_abort);
 	signal(SIGQUIT, handle_abort);
 	signal(SIGTERM, handle_abort);
@@ -1681,6 +1733,7 @@ int main(int argc, char *argv[])
 
 	if(batch_queue_type == BATCH_QUEUE_TYPE_K8S) {
 		batch_queue_set_option(queue, "k8s-image", k8s_image);
+		batch_queue_set_option(queue, "k8s-api", k8s_api);
 	}
 
 	mainloop( queue );
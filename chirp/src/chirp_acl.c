@@ -76,6 +76,219 @@ out:
 	return rc == 0 ? 1 : 0;
 }
 
+/*
+Parsed ACL and ticket files are kept in memory so that repeated checks in
+the same directory do not reread them. An entry is reused only while the
+file keeps the same inode, size, mtime and ctime. A file changed within
+the second it was loaded cannot be told apart from a later change in that
+second, so such an entry is reloaded until the second has passed.
+*/
+
+#define CHIRP_ACL_CACHE_MAX 4096
+
+struct file_stamp {
+	INT64_T dev;
+	INT64_T ino;
+	INT64_T size;
+	INT64_T mtime;
+	INT64_T ctime;
+	time_t loaded;
+};
+
+struct acl_cache_entry {
+	struct file_stamp stamp;
+	int nentries;
+	struct acl_cache_subject {
+		char *subject;
+		int flags;
+	} *entries;
+};
+
+struct ticket_cache_entry {
+	struct file_stamp stamp;
+	struct chirp_ticket ct;
+};
+
+static struct hash_table *acl_cache = NULL;
+static struct hash_table *ticket_cache = NULL;
+
+static int file_stamp_get(const char *path, int local, struct file_stamp *s)
+{
+	if(local) {
+		struct stat info;
+		if(stat(path, &info) == -1)
+			return 0;
+		s->dev = info.st_dev;
+		s->ino = info.st_ino;
+		s->size = info.st_size;
+		s->mtime = info.st_mtime;
+		s->ctime = info.st_ctime;
+	} else {
+		struct chirp_stat info;
+		if(cfs->stat(path, &info) == -1)
+			return 0;
+		s->dev = info.cst_dev;
+		s->ino = info.cst_ino;
+		s->size = info.cst_size;
+		s->mtime = info.cst_mtime;
+		s->ctime = info.cst_ctime;
+	}
+	s->loaded = time(0);
+	return 1;
+}
+
+static int file_stamp_valid(const struct file_stamp *cached, const struct file_stamp *current)
+{
+	return cached->dev == current->dev && cached->ino == current->ino && cached->size == current->size && cached->mtime == current->mtime && cached->ctime == current->ctime && cached->mtime < cached->loaded && cached->ctime < cached->loaded;
+}
+
+static void acl_cache_entry_delete(void *x)
+{
+	struct acl_cache_entry *e = x;
+	int i;
+	if(!e)
+		return;
+	for(i = 0; i < e->nentries; i++)
+		free(e->entries[i].subject);
+	free(e->entries);
+	free(e);
+}
+
+static void ticket_cache_entry_delete(void *x)
+{
+	struct ticket_cache_entry *e = x;
+	if(!e)
+		return;
+	chirp_ticket_free(&e->ct);
+	free(e);
+}
+
+static void acl_cache_forget(const char *aclpath)
+{
+	if(acl_cache)
+		acl_cache_entry_delete(hash_table_remove(acl_cache, aclpath));
+}
+
+static void ticket_cache_forget(const char *ticket_filename)
+{
+	if(ticket_cache)
+		ticket_cache_entry_delete(hash_table_remove(ticket_cache, ticket_filename));
+}
+
+/* Return the parsed contents of the ACL file at aclpath, or null if it cannot be read. */
+static struct acl_cache_entry *acl_cache_load(const char *aclpath, int local)
+{
+	struct file_stamp stamp;
+	struct acl_cache_entry *e;
+	CHIRP_FILE *file;
+	char subject[CHIRP_LINE_MAX];
+	int flags;
+
+	if(!acl_cache)
+		acl_cache = hash_table_create(0, 0);
+
+	if(!file_stamp_get(aclpath, local, &stamp)) {
+		acl_cache_forget(aclpath);
+		return NULL;
+	}
+
+	e = hash_table_lookup(acl_cache, aclpath);
+	if(e && file_stamp_valid(&e->stamp, &stamp))
+		return e;
+	acl_cache_forget(aclpath);
+
+	file = local ? cfs_fopen_local(aclpath, "r") : cfs_fopen(aclpath, "r");
+	if(!file)
+		return NULL;
+
+	e = xxcalloc(1, sizeof(*e));
+	e->stamp = stamp;
+	while(chirp_acl_read(file, subject, &flags)) {
+		e->entries = xxrealloc(e->entries, sizeof(*e->entries) * (e->nentries + 1));
+		e->entries[e->nentries].subject = xxstrdup(subject);
+		e->entries[e->nentries].flags = flags;
+		e->nentries++;
+	}
+	cfs_fclose(file);
+
+	if(hash_table_size(acl_cache) >= CHIRP_ACL_CACHE_MAX)
+		hash_table_clear(acl_cache, acl_cache_entry_delete);
+	hash_table_insert(acl_cache, aclpath, e);
+
+	return e;
+}
+
+/* Find the ACL in effect for dirname, following the same search as chirp_acl_open. */
+static struct acl_cache_entry *acl_cache_lookup(const char *dirname)
+{
+	char dirpath[CHIRP_PATH_MAX];
+
+	strcpy(dirpath, dirname);
+
+	while(1) {
+		char aclpath[CHIRP_PATH_MAX];
+		struct acl_cache_entry *e;
+
+		string_nformat(aclpath, sizeof(aclpath), "%s/%s", dirpath, CHIRP_ACL_BASE_NAME);
+		e = acl_cache_load(aclpath, 0);
+		if(e)
+			return e;
+
+		if(!acl_inherit_default_mode)
+			break;
+		if(!strcmp(dirpath, "/"))
+			break;
+
+		char *slash = strrchr(dirpath, '/');
+		if(slash == dirpath || slash == 0) {
+			strcpy(dirpath, "/");
+		} else {
+			*slash = 0;
+		}
+	}
+
+	return strlen(default_acl) ? acl_cache_load(default_acl, 1) : NULL;
+}
+
+/* Return the valid, unexpired ticket stored in ticket_filename, or null. */
+static const struct chirp_ticket *ticket_cache_lookup(const char *ticket_filename)
+{
+	struct file_stamp stamp;
+	struct ticket_cache_entry *e;
+
+	if(!ticket_cache)
+		ticket_cache = hash_table_create(0, 0);
+
+	if(!file_stamp_get(ticket_filename, 0, &stamp)) {
+		ticket_cache_forget(ticket_filename);
+		return NULL;
+	}
+
+	e = hash_table_lookup(ticket_cache, ticket_filename);
+	if(!e || !file_stamp_valid(&e->stamp, &stamp)) {
+		char filename[CHIRP_PATH_MAX];
+
+		ticket_cache_forget(ticket_filename);
+
+		e = xxcalloc(1, sizeof(*e));
+		e->stamp = stamp;
+		strcpy(filename, ticket_filename);
+		if(!ticket_read(filename, &e->ct)) {
+			ticket_cache_entry_delete(e);
+			return NULL;
+		}
+
+		if(hash_table_size(ticket_cache) >= CHIRP_ACL_CACHE_MAX)
+			hash_table_clear(ticket_cache, ticket_cache_entry_delete);
+		hash_table_insert(ticket_cache, ticket_filename, e);
+	}
+
+	if(e->ct.expiration <= time(0))
+		return NULL;
+
+	return &e->ct;
+}
+
 static int ticket_write(const char *ticket_filename, struct chirp_ticket *ct)
 {
 	int result;
@@ -97,6 +310,7 @@ static int ticket_write(const char *ticket_filename, struct chirp_ticket *ct)
 	if(result)
 		return (errno = EACCES, -1);
 
+	ticket_cache_forget(ticket_filename);
 	return cfs->rename(tmp, ticket_filename);
 }
 
@@ -109,10 +323,6 @@ If the rights cannot be obtained, returns zero with errno set appropriately.
 
 static int do_chirp_acl_get(const char *dirname, const char *subject, int *totalflags)
 {
-	CHIRP_FILE *aclfile;
-	char aclsubject[CHIRP_LINE_MAX];
-	int aclflags;
-
 	errno = 0;
 	*totalflags = 0;
 
@@ -121,44 +331,57 @@ static int do_chirp_acl_get(const char *dirname, const char *subject, int *total
 	 */
 	const char *digest;
 	if(chirp_ticket_isticketsubject(subject, &digest)) {
-		/* open the ticket file, read the public key */
+		/* look up the ticket file, read the public key */
 		char ticket_filename[CHIRP_PATH_MAX];
-		struct chirp_ticket ct;
+		const struct chirp_ticket *ct;
 		chirp_ticket_filename(ticket_filename, subject, NULL);
-		if(!ticket_read(ticket_filename, &ct))
-			return 0;
-		if(!do_chirp_acl_get(dirname, ct.subject, totalflags)) {
-			chirp_ticket_free(&ct);
+		ct = ticket_cache_lookup(ticket_filename);
+		if(!ct)
 			return 0;
-		}
+		/* copy the owner, a nested lookup may replace the cached ticket */
+		char *owner = xxstrdup(ct->subject);
+		size_t nrights = ct->nrights;
+		struct chirp_ticket_rights *rights = xxmalloc(sizeof(*rights) * nrights);
 		size_t i;
+		for(i = 0; i < nrights; i++) {
+			rights[i].directory = xxstrdup(ct->rights[i].directory);
+			rights[i].acl = xxstrdup(ct->rights[i].acl);
+		}
+		int found = do_chirp_acl_get(dirname, owner, totalflags);
 		size_t longest = 0;
 		int mask = 0;
-		for(i = 0; i < ct.nrights; i++) {
+		for(i = 0; i < nrights; i++) {
 			char where[CHIRP_PATH_MAX];
-			path_collapse(ct.rights[i].directory, where, 1);
+			path_collapse(rights[i].directory, where, 1);
 
 			if(strncmp(dirname, where, strlen(where)) == 0) {
 				if(strlen(where) > longest) {
 					longest = strlen(where);
-					mask = chirp_acl_text_to_flags(ct.rights[i].acl);
+					mask = chirp_acl_text_to_flags(rights[i].acl);
 				}
 			}
+			free(rights[i].directory);
+			free(rights[i].acl);
 		}
+		free(rights);
+		free(owner);
+		if(!found)
+			return 0;
 		*totalflags &= mask;
 	} else {
-		aclfile = chirp_acl_open(dirname);
-		if(aclfile) {
-			while(chirp_acl_read(aclfile, aclsubject, &aclflags)) {
+		struct acl_cache_entry *acl = acl_cache_lookup(dirname);
+		if(acl) {
+			int i;
+			for(i = 0; i < acl->nentries; i++) {
+				const char *aclsubject = acl->entries[i].subject;
 				if(string_match(aclsubject, subject)) {
-					*totalflags |= aclflags;
+					*totalflags |= acl->entries[i].flags;
 				} else if(!strncmp(aclsubject, "group:", 6)) {
 					if(chirp_group_lookup(aclsubject, subject)) {
-						*totalflags |= aclflags;
+						*totalflags |= acl->entries[i].flags;
 					}
 				}
 			}
-			chirp_acl_close(aclfile);
 		} else {
 			return 0;
 		}
@@ -327,15 +550,13 @@ int chirp_acl_check_link(const char *filename, const char *subject, int flags)
 char *chirp_acl_ticket_callback(const char *digest)
 {
 	char path[CHIRP_PATH_MAX];
-	struct chirp_ticket ct;
+	const struct chirp_ticket *ct;
 
 	chirp_ticket_filename(path, NULL, digest);
 
-	if(ticket_read(path, &ct)) {
-		char *ticket = xxstrdup(ct.ticket);
-		chirp_ticket_free(&ct);
-		return ticket;
-	}
+	ct = ticket_cache_lookup(path);
+	if(ct)
+		return xxstrdup(ct->ticket);
 
 	return NULL;
 }
@@ -364,6 +585,7 @@ int chirp_acl_ticket_delete(const char *subject, const char *ticket_subject)
 
 	if(strcmp(esubject, ct.subject) == 0 || strcmp(chirp_super_user, subject) == 0) {
 		status = cfs->unlink(ticket_filename);
+		ticket_cache_forget(ticket_filename);
 	} else {
 		errno = EACCES;
 		status = -1;
@@ -581,15 +803,15 @@ int chirp_acl_whoami(const char *subject, char **esubject)
 {
 	const char *digest;
 	if(chirp_ticket_isticketsubject(subject, &digest)) {
-		/* open the ticket file */
-		struct chirp_ticket ct;
+		/* look up the ticket file */
+		const struct chirp_ticket *ct;
 		char ticket_filename[CHIRP_PATH_MAX];
 
 		chirp_ticket_filename(ticket_filename, subject, NULL);
-		if(!ticket_read(ticket_filename, &ct))
+		ct = ticket_cache_lookup(ticket_filename);
+		if(!ct)
 			return 0;
-		*esubject = xxstrdup(ct.subject);
-		chirp_ticket_free(&ct);
+		*esubject = xxstrdup(ct->subject);
 		return 1;
 	} else {
 		*esubject = xxstrdup(subject);
@@ -666,6 +888,7 @@ int chirp_acl_set(const char *dirname, const char *subject, int flags, int reset
 		result = -1;
 	} else {
 		result = cfs->rename(newaclname, aclname);
+		acl_cache_forget(aclname);
 		if(result < 0) {
 			cfs->unlink(newaclname);
 			errno = EACCES;
@@ -892,6 +1115,7 @@ int chirp_acl_init_root(const char *path)
 	username_get(username);
 
 	string_nformat(aclpath, sizeof(aclpath), "%s/%s", path, CHIRP_ACL_BASE_NAME);
+	acl_cache_forget(aclpath);
 	file = cfs_fopen(aclpath, "w");
 	if(file) {
 		cfs_fprintf(file, "unix:%s %s\n", username, chirp_acl_flags_to_text(CHIRP_ACL_READ | CHIRP_ACL_WRITE | CHIRP_ACL_DELETE | CHIRP_ACL_LIST | CHIRP_ACL_ADMIN));
@@ -920,6 +1144,7 @@ int chirp_acl_init_copy(const char *path)
 
 	oldfile = chirp_acl_open(oldpath);
 	if(oldfile) {
+		acl_cache_forget(newpath);
 		newfile = cfs_fopen(newpath, "w");
 		if(newfile) {
 			while(chirp_acl_read(oldfile, subject, &flags)) {
@@ -977,6 +1202,7 @@ int chirp_acl_init_reserve(const char *path, const char *subject)
 		newflags = CHIRP_ACL_READ | CHIRP_ACL_WRITE | CHIRP_ACL_LIST | CHIRP_ACL_DELETE | CHIRP_ACL_ADMIN;
 
 	string_nformat(aclpath, sizeof(aclpath), "%s/%s", path, CHIRP_ACL_BASE_NAME);
+	acl_cache_forget(aclpath);
 	file = cfs_fopen(aclpath, "w");
 	if(file) {
 		cfs_fprintf(file, "%s %s\n", subject, chirp_acl_flags_to_text(newflags));
@@ -45,18 +45,39 @@ See the file COPYING for details.
  */
 
 
+/* Allocation changes are stored at least this often while a client is busy. */
+#define ALLOC_FLUSH_INTERVAL 1
+
+/*
+The journal names every allocation that may have changes which were never
+stored, for instance because the process making them was killed.  Each
+process appends the name of an allocation once, the first time it changes
+it, so the journal costs no I/O per write.  At startup, only the allocations
+named in the journal are recounted, and the full recovery scan is done only
+when there is no journal at all.
+*/
+#define ALLOC_JOURNAL "/.__alloc_journal"
+
 static int alloc_enabled = 0;
 static struct hash_table *alloc_table = 0;
 static time_t last_flush_time = 0;
 static int recovery_in_progress = 0;
 static struct hash_table *root_table = 0;
+static struct hash_table *journal_table = 0;
+
+/*
+Allocation states are read without holding a lock between requests.
+Changes accumulate in pending and are added to the stored state in
+one locked read-modify-write when the state is flushed.
+*/
 
 struct alloc_state {
-	int fd;
+	char *path;
 	INT64_T size;
 	INT64_T inuse;
 	INT64_T avail;
-	INT64_T dirty;
+	INT64_T pending;
+	int reset;
 };
 
 /*
@@ -76,6 +97,33 @@ static INT64_T space_consumed(INT64_T filesize)
 	return blocks * block_size;
 }
 
+static void alloc_journal_note(const char *path)
+{
+	struct chirp_stat info;
+	char buffer[CHIRP_PATH_MAX+1];
+	int fd;
+
+	if(recovery_in_progress || hash_table_lookup(journal_table, path))
+		return;
+
+	fd = cfs->open(ALLOC_JOURNAL, O_WRONLY|O_CREAT, S_IRUSR|S_IWUSR);
+	if(fd == -1) {
+		debug(D_ALLOC, "couldn't open %s: %s", ALLOC_JOURNAL, strerror(errno));
+		return;
+	}
+
+	if(cfs->lockf(fd, F_LOCK, 0) == 0) {
+		if(cfs->fstat(fd, &info) == 0) {
+			string_nformat(buffer, sizeof(buffer), "%s\n", path);
+			cfs->pwrite(fd, buffer, strlen(buffer), info.cst_size);
+		}
+		cfs->lockf(fd, F_ULOCK, 0);
+	}
+	cfs->close(fd);
+
+	hash_table_insert(journal_table, path, (void *) 1);
+}
+
 static void alloc_state_update(struct alloc_state *a, INT64_T change)
 {
 	if(change != 0) {
@@ -83,52 +131,54 @@ static void alloc_state_update(struct alloc_state *a, INT64_T change)
 		if(a->inuse < 0)
 			a->inuse = 0;
 		a->avail = a->size - a->inuse;
-		a->dirty = 1;
+		a->pending += change;
+		alloc_journal_note(a->path);
 	}
 }
 
-static struct alloc_state *alloc_state_load(const char *path)
+static int alloc_state_read(int fd, INT64_T *size, INT64_T *inuse)
 {
-	struct alloc_state *s = xxmalloc(sizeof(*s));
-	char statename[CHIRP_PATH_MAX];
 	char buffer[4096]; /* any .__alloc file is smaller than this */
 
-	debug(D_ALLOC, "locking %s", path);
-
-	string_nformat(statename, sizeof(statename), "%s/.__alloc", path);
+	memset(buffer, 0, sizeof(buffer));
+	INT64_T result = cfs->pread(fd, buffer, sizeof(buffer), 0);
+	assert(0 < result && result < (INT64_T)sizeof(buffer));
+	result = sscanf(buffer, "%" SCNd64 " %" SCNd64, size, inuse);
+	assert(result == 2);
 
-	s->fd = cfs->open(statename, O_RDWR, S_IRUSR|S_IWUSR);
-	if(s->fd == -1) {
-		free(s);
-		return 0;
-	}
+	return 0;
+}
 
-	if(cfs->lockf(s->fd, F_TLOCK, 0)) {
-		debug(D_ALLOC, "lock of %s blocked; flushing outstanding locks", path);
-		chirp_alloc_flush();
-		debug(D_ALLOC, "locking %s (retry)", path);
+static struct alloc_state *alloc_state_load(const char *path)
+{
+	struct alloc_state *s;
+	char statename[CHIRP_PATH_MAX];
+	INT64_T size, inuse;
+	int fd;
 
-		if(cfs->lockf(s->fd, F_LOCK, 0)) {
-			debug(D_ALLOC, "lock of %s failed: %s", path, strerror(errno));
-			cfs->close(s->fd);
-			free(s);
-			return 0;
-		}
-	}
+	debug(D_ALLOC, "loading %s", path);
 
-	memset(buffer, 0, sizeof(buffer));
-	INT64_T result = cfs->pread(s->fd, buffer, sizeof(buffer), 0);
-	assert(0 < result && result < (INT64_T)sizeof(buffer));
-	result = sscanf(buffer, "%" SCNd64 " %" SCNd64, &s->size, &s->inuse);
-	assert(result == 2);
+	string_nformat(statename, sizeof(statename), "%s/.__alloc", path);
 
-	s->dirty = 0;
+	fd = cfs->open(statename, O_RDWR, S_IRUSR|S_IWUSR);
+	if(fd == -1)
+		return 0;
 
-	if(recovery_in_progress) {
-		s->inuse = 0;
-		s->dirty = 1;
+	if(cfs->lockf(fd, F_LOCK, 0)) {
+		debug(D_ALLOC, "lock of %s failed: %s", path, strerror(errno));
+		cfs->close(fd);
+		return 0;
 	}
-
+	alloc_state_read(fd, &size, &inuse);
+	cfs->lockf(fd, F_ULOCK, 0);
+	cfs->close(fd);
+
+	s = xxmalloc(sizeof(*s));
+	s->path = xxstrdup(path);
+	s->size = size;
+	s->inuse = inuse;
+	s->pending = 0;
+	s->reset = 0;
 	s->avail = s->size - s->inuse;
 
 	return s;
@@ -136,20 +186,51 @@ static struct alloc_state *alloc_state_load(const char *path)
 
 static void alloc_state_save(const char *path, struct alloc_state *s)
 {
-	if(s->dirty) {
-		debug(D_ALLOC, "storing %s", path);
-	} else {
+	char statename[CHIRP_PATH_MAX];
+	char buffer[4096];
+	INT64_T size, inuse;
+	int fd;
+
+	if(!s->pending && !s->reset) {
 		debug(D_ALLOC, "freeing %s", path);
+		goto out;
 	}
 
-	if(s->dirty) {
-		char buffer[4096];
-		cfs->ftruncate(s->fd, 0);
-		string_nformat(buffer, sizeof(buffer), "%" PRId64 "\n%" PRId64 "\n", s->size, s->inuse);
-		int64_t result = cfs->pwrite(s->fd, buffer, strlen(buffer), 0);
-		assert(result == (int64_t) strlen(buffer));
+	debug(D_ALLOC, "storing %s", path);
+
+	string_nformat(statename, sizeof(statename), "%s/.__alloc", path);
+
+	fd = cfs->open(statename, O_RDWR, S_IRUSR|S_IWUSR);
+	if(fd == -1) {
+		debug(D_ALLOC, "couldn't open %s: %s", statename, strerror(errno));
+		goto out;
+	}
+
+	if(cfs->lockf(fd, F_LOCK, 0)) {
+		debug(D_ALLOC, "lock of %s failed: %s", path, strerror(errno));
+		cfs->close(fd);
+		goto out;
+	}
+
+	if(s->reset) {
+		size = s->size;
+		inuse = s->inuse;
+	} else {
+		/* other processes may have stored changes since this state was loaded */
+		alloc_state_read(fd, &size, &inuse);
+		inuse = MAX(inuse + s->pending, 0);
 	}
-	cfs->close(s->fd);
+
+	string_nformat(buffer, sizeof(buffer), "%" PRId64 "\n%" PRId64 "\n", size, inuse);
+	int64_t result = cfs->pwrite(fd, buffer, strlen(buffer), 0);
+	assert(result == (int64_t) strlen(buffer));
+	cfs->ftruncate(fd, strlen(buffer));
+
+	cfs->lockf(fd, F_ULOCK, 0);
+	cfs->close(fd);
+
+out:
+	free(s->path);
 	free(s);
 }
 
@@ -248,17 +329,15 @@ static struct alloc_state *alloc_state_cache(const char *path)
 	return alloc_state_cache_exact(dirname);
 }
 
-static void recover(const char *path)
+static void recover(const char *path, int deep);
+
+static void recover_dir(struct alloc_state *a, const char *path, int deep)
 {
 	char newpath[CHIRP_PATH_MAX];
-	struct alloc_state *a, *b;
+	struct alloc_state *b;
 	struct chirp_dir *dir;
 	struct chirp_dirent *d;
 
-	a = alloc_state_cache_exact(path);
-	if(!a)
-		fatal("couldn't open alloc state in %s: %s", path, strerror(errno));
-
 	dir = cfs->opendir(path);
 	if(!dir)
 		fatal("couldn't open %s: %s\n", path, strerror(errno));
@@ -274,10 +353,16 @@ static void recover(const char *path)
 		string_nformat(newpath, sizeof(newpath), "%s/%s", path, d->name);
 
 		if(S_ISDIR(d->info.cst_mode)) {
-			recover(newpath);
 			b = alloc_state_cache_exact(newpath);
-			if(a != b)
+			if(!b)
+				fatal("couldn't open alloc state in %s: %s", newpath, strerror(errno));
+			if(a == b) {
+				recover_dir(a, newpath, deep);
+			} else {
+				if(deep)
+					recover(newpath, deep);
 				alloc_state_update(a, b->size);
+			}
 		} else if(S_ISREG(d->info.cst_mode)) {
 			alloc_state_update(a, space_consumed(d->info.cst_size));
 		} else {
@@ -286,16 +371,64 @@ static void recover(const char *path)
 	}
 
 	cfs->closedir(dir);
+}
+
+/*
+Recount the space in use by the allocation rooted at path.
+Nested allocations are charged at their full size,
+and are recounted themselves only if deep is set.
+*/
+
+static void recover(const char *path, int deep)
+{
+	struct alloc_state *a;
+
+	a = alloc_state_cache_exact(path);
+	if(!a)
+		fatal("couldn't open alloc state in %s: %s", path, strerror(errno));
+
+	a->inuse = 0;
+	a->avail = a->size;
+	a->pending = 0;
+	a->reset = 1;
+
+	recover_dir(a, path, deep);
 
 	debug(D_ALLOC, "%s (%sB)", path, string_metric(a->inuse, -1, 0));
 }
 
-int chirp_alloc_init(INT64_T size)
+/*
+Recount each allocation named in the journal.
+Names of allocations which have since been removed are ignored.
+*/
+
+static void recover_journal(void)
 {
-	struct alloc_state *a;
-	time_t start, stop;
-	INT64_T inuse, avail;
+	struct hash_table *seen = hash_table_create(0, 0);
+	char line[CHIRP_PATH_MAX];
+	CHIRP_FILE *file;
+
+	file = cfs_fopen(ALLOC_JOURNAL, "r");
+	if(!file)
+		fatal("couldn't open %s: %s", ALLOC_JOURNAL, strerror(errno));
+
+	while(cfs_fgets(line, sizeof(line), file)) {
+		string_chomp(line);
+		if(!line[0] || hash_table_lookup(seen, line))
+			continue;
+		hash_table_insert(seen, line, (void *) 1);
+
+		char *root = alloc_state_root_cached(line);
+		if(root && !strcmp(root, line))
+			recover(line, 0);
+	}
+
+	cfs_fclose(file);
+	hash_table_delete(seen);
+}
 
+int chirp_alloc_init(INT64_T size)
+{
 	alloc_enabled = 0;
 	if(size == 0) {
 		return 0;
@@ -304,32 +437,76 @@ int chirp_alloc_init(INT64_T size)
 	}
 
 	alloc_enabled = 1;
-	recovery_in_progress = 1;
 
 	assert(alloc_table == NULL);
 	alloc_table = hash_table_create(0, 0);
 	assert(root_table == NULL);
 	root_table = hash_table_create(0, 0);
+	assert(journal_table == NULL);
+	journal_table = hash_table_create(0, 0);
 
-	debug(D_ALLOC, "### begin allocation recovery scan ###");
+	return 0;
+}
 
-	if(!alloc_state_create("/", size)) {
-		debug(D_ALLOC, "couldn't create allocation in `/': %s\n", strerror(errno));
-		return -1;
-	}
+int chirp_alloc_recover(INT64_T size)
+{
+	struct alloc_state *a;
+	time_t start, stop;
+	INT64_T inuse, avail;
+	int fd;
 
-	a = alloc_state_cache_exact("/");
-	if(!a) {
-		debug(D_ALLOC, "couldn't find allocation in `/': %s\n", strerror(errno));
-		return -1;
-	}
+	if(!alloc_enabled)
+		return 0;
+
+	recovery_in_progress = 1;
 
 	start = time(0);
-	recover("/");
+
+	if(cfs_file_size("/.__alloc") >= 0 && cfs_file_size(ALLOC_JOURNAL) >= 0) {
+		debug(D_ALLOC, "### begin allocation journal recovery ###");
+
+		a = alloc_state_cache_exact("/");
+		if(!a) {
+			debug(D_ALLOC, "couldn't find allocation in `/': %s\n", strerror(errno));
+			return -1;
+		}
+
+		/* the root may be given a new size at every startup */
+		a->size = size;
+		a->avail = a->size - a->inuse;
+		a->reset = 1;
+
+		recover_journal();
+	} else {
+		debug(D_ALLOC, "### begin allocation recovery scan ###");
+
+		if(!alloc_state_create("/", size)) {
+			debug(D_ALLOC, "couldn't create allocation in `/': %s\n", strerror(errno));
+			return -1;
+		}
+
+		a = alloc_state_cache_exact("/");
+		if(!a) {
+			debug(D_ALLOC, "couldn't find allocation in `/': %s\n", strerror(errno));
+			return -1;
+		}
+
+		recover("/", 1);
+	}
+
 	size = a->size;
 	inuse = a->inuse;
 	avail = a->avail;
 	chirp_alloc_flush();
+
+	/* everything is now stored, so start a new journal */
+	fd = cfs->open(ALLOC_JOURNAL, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if(fd == -1) {
+		debug(D_ALLOC, "couldn't create %s: %s\n", ALLOC_JOURNAL, strerror(errno));
+		return -1;
+	}
+	cfs->close(fd);
+
 	stop = time(0);
 
 	debug(D_ALLOC, "### allocation recovery took %d seconds ###", (int) (stop-start) );
@@ -396,6 +573,11 @@ INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 	}
 
 	debug(D_ALLOC, "path `%s' change = %" PRId64, path, change);
+
+	/* store batched changes, and pick up those of other processes, from time to time */
+	if(hash_table_size(alloc_table) && time(0) - last_flush_time >= ALLOC_FLUSH_INTERVAL)
+		chirp_alloc_flush();
+
 	a = alloc_state_cache(path);
 	if(a) {
 		/* FIXME this won't work with symlinks, problem existed before probably */
@@ -409,6 +591,13 @@ INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 			} else {
 				INT64_T alloc_change = space_consumed(change) - space_consumed(*current);
 				debug(D_ALLOC, "path `%s' actual change = %" PRId64 " from current = %" PRId64, path, alloc_change, *current);
+				if(a->avail < alloc_change) {
+					/* this view may be stale, so look again before refusing */
+					chirp_alloc_flush();
+					a = alloc_state_cache(path);
+					if(!a)
+						return -1;
+				}
 				if(a->avail >= alloc_change) {
 					alloc_state_update(a, alloc_change);
 					result = 0;
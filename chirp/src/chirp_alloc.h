@@ -13,6 +13,7 @@ See the file COPYING for details.
 #include <sys/types.h>
 
 int    chirp_alloc_init(INT64_T size);
+int    chirp_alloc_recover(INT64_T size);
 void   chirp_alloc_flush(void);
 int    chirp_alloc_flush_needed(void);
 time_t chirp_alloc_last_flush_time(void);
@@ -5,20 +5,32 @@ This software is distributed under the GNU General Public License.
 See the file COPYING for details.
 */
 
+#include "chirp_client.h"
 #include "chirp_reli.h"
 
 #include "auth_all.h"
+#include "debug.h"
 #include "full_io.h"
 #include "getopt_aux.h"
+#include "jx.h"
+#include "jx_pretty_print.h"
+#include "macros.h"
+#include "quantile_sketch.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
 
 #include <fcntl.h>
 #include <unistd.h>
 
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include <errno.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,10 +115,27 @@ int do_stat(const char *file, struct stat *buf)
 	}
 }
 
+/*
+chirp_server opens existing files with O_DIRECT, which only allows transfers
+of whole blocks of the underlying filesystem at offsets aligned to them.
+Every read and write of the benchmark is sized and placed in multiples of
+BENCHMARK_ALIGN, from a buffer aligned to it.
+*/
+
+#define BENCHMARK_ALIGN 4096
+
+static char *alloc_aligned(size_t size)
+{
+	void *buffer;
+	if(posix_memalign(&buffer, BENCHMARK_ALIGN, size) != 0)
+		return 0;
+	return buffer;
+}
+
 int do_bandwidth(const char *file, int bytes, int blocksize, int do_write)
 {
 	int offset = 0;
-	char *buffer = malloc(blocksize);
+	char *buffer = alloc_aligned(blocksize);
 	int i;
 	int rc;
 
@@ -185,24 +214,17 @@ void print_total()
 		n = n;\
 	} while (0)
 
-int main(int argc, char *argv[])
+static int legacy_main(int argc, char *argv[])
 {
 	int rc;
 	int bwloops;
 	char *fname;
-	char data[8192];
+	char *data;
 	int runtime;
 	struct stat buf;
 	struct timeval start, stop;
 	int filesize = 16 * 1024 * 1024;
 
-	if(argc != 6) {
-		printf("use: %s <host> <file> <loops> <cycles> <bwloops>\n", argv[0]);
-		return -1;
-	}
-
-	auth_register_all();
-
 	host = argv[1];
 	fname = argv[2];
 	loops = atoi(argv[3]);
@@ -217,12 +239,18 @@ int main(int argc, char *argv[])
 	RUN_LOOP("getpid", getpid());
 #endif
 
+	data = alloc_aligned(8192);
+	if(!data) {
+		perror("chirp_benchmark");
+		return -1;
+	}
+
 	rc = do_open(fname, O_WRONLY | O_CREAT | O_TRUNC | do_sync, 0777);
 	if(rc < 0) {
 		perror(fname);
 		return -1;
 	}
-	memset(data, -1, sizeof(data));
+	memset(data, -1, 8192);
 	RUN_LOOP("write1", do_pwrite(data, 1, n));
 	RUN_LOOP("write8", do_pwrite(data, 8192, n*8192));
 	do_close();
@@ -232,7 +260,7 @@ int main(int argc, char *argv[])
 		perror(fname);
 		return -1;
 	}
-	RUN_LOOP("read1", do_pread(data, 1, n));
+	RUN_LOOP("read4", do_pread(data, BENCHMARK_ALIGN, n*BENCHMARK_ALIGN));
 	RUN_LOOP("read8", do_pread(data, 8192, n*8192));
 	do_close();
 
@@ -258,4 +286,764 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
+/*
+The suite mode runs a set of workloads against a directory on the server,
+each one from several client processes with several threads each, where
+every thread holds its own connection.  Each operation is timed, and the
+report gives the throughput and the latency percentiles of each workload.
+*/
+
+#define SUITE_PREAD_SIZE BENCHMARK_ALIGN
+#define SUITE_CREATE_SIZE BENCHMARK_ALIGN
+
+static const char *suite_host = 0;
+static const char *suite_dir = 0;
+static int suite_clients = 1;
+static int suite_threads = 4;
+static int64_t suite_ops = 1000;
+static int64_t suite_files = 100;
+static int64_t suite_file_size = 64 * MEGA;
+static int64_t suite_block_size = 1 * MEGA;
+static int suite_acl_entries = 100;
+static int suite_timeout = 60;
+
+#define SUITE_STOPTIME (time(NULL) + suite_timeout)
+
+struct suite_thread {
+	struct chirp_client *client;
+	int client_id;
+	int thread_id;
+	const struct suite_workload *workload;
+	INT64_T fd;
+	char *buffer;
+	unsigned int seed;
+	pthread_t thread;
+
+	/* Results sent back to the parent. */
+	struct suite_result {
+		int64_t ops;
+		int64_t bytes;
+		int64_t errors;
+		int64_t nlatencies;
+		timestamp_t start;
+		timestamp_t end;
+	} result;
+	double *latencies;
+};
+
+struct suite_workload {
+	const char *name;
+	/* Run once in the parent, before the clients start. */
+	int (*setup)(void);
+	/* Number of operations of each thread. */
+	int64_t (*nops)(void);
+	/* Run once in each thread, before and after the timed operations. */
+	int (*begin)(struct suite_thread *t);
+	void (*end)(struct suite_thread *t);
+	/* Returns the bytes transferred, or -1 on failure. */
+	int64_t (*op)(struct suite_thread *t, int64_t i);
+};
+
+static void suite_path(char *path, const char *fmt, ...)
+{
+	va_list args;
+	int n = snprintf(path, CHIRP_PATH_MAX, "%s/", suite_dir);
+	if(n >= CHIRP_PATH_MAX)
+		return;
+
+	va_start(args, fmt);
+	vsnprintf(path + n, CHIRP_PATH_MAX - n, fmt, args);
+	va_end(args);
+}
+
+static int setup_dir(const char *name)
+{
+	char path[CHIRP_PATH_MAX];
+	suite_path(path, "%s", name);
+
+	if(chirp_reli_mkdir(suite_host, path, 0755, SUITE_STOPTIME) < 0 && errno != EEXIST) {
+		fprintf(stderr, "chirp_benchmark: couldn't create %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+/* Create a file of the given size, unless it already exists with that size. */
+static int setup_file(const char *path, int64_t size)
+{
+	struct chirp_stat info;
+	if(chirp_reli_stat(suite_host, path, &info, SUITE_STOPTIME) == 0 && info.cst_size == size)
+		return 1;
+
+	struct chirp_file *file = chirp_reli_open(suite_host, path, O_WRONLY | O_CREAT | O_TRUNC, 0644, SUITE_STOPTIME);
+	if(!file) {
+		fprintf(stderr, "chirp_benchmark: couldn't create %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	char *buffer = alloc_aligned(suite_block_size);
+	if(!buffer) {
+		chirp_reli_close(file, SUITE_STOPTIME);
+		return 0;
+	}
+	memset(buffer, 'x', suite_block_size);
+
+	int ok = 1;
+	int64_t offset;
+	for(offset = 0; offset < size; offset += suite_block_size) {
+		int64_t length = MIN(suite_block_size, size - offset);
+		if(chirp_reli_pwrite(file, buffer, length, offset, SUITE_STOPTIME) != length) {
+			fprintf(stderr, "chirp_benchmark: couldn't write %s: %s\n", path, strerror(errno));
+			ok = 0;
+			break;
+		}
+	}
+
+	free(buffer);
+	chirp_reli_close(file, SUITE_STOPTIME);
+	return ok;
+}
+
+static int setup_files(const char *dir)
+{
+	char path[CHIRP_PATH_MAX];
+	int64_t i;
+
+	if(!setup_dir(dir))
+		return 0;
+
+	for(i = 0; i < suite_files; i++) {
+		suite_path(path, "%s/file.%" PRId64, dir, i);
+		if(!setup_file(path, 0))
+			return 0;
+	}
+	return 1;
+}
+
+static int64_t nops_fixed(void)
+{
+	return suite_ops;
+}
+
+static int64_t nops_blocks(void)
+{
+	return suite_file_size / suite_block_size;
+}
+
+static int begin_buffer(struct suite_thread *t)
+{
+	t->buffer = alloc_aligned(suite_block_size);
+	if(!t->buffer)
+		return 0;
+	memset(t->buffer, 'x', suite_block_size);
+	return 1;
+}
+
+static void end_buffer(struct suite_thread *t)
+{
+	free(t->buffer);
+	t->buffer = 0;
+}
+
+static int64_t open_close(struct suite_thread *t, const char *path)
+{
+	struct chirp_stat info;
+	INT64_T fd = chirp_client_open(t->client, path, O_RDONLY, 0, &info, SUITE_STOPTIME);
+	if(fd < 0)
+		return -1;
+	return chirp_client_close(t->client, fd, SUITE_STOPTIME) < 0 ? -1 : 0;
+}
+
+/* stat: stat of existing files. */
+
+static int setup_stat(void)
+{
+	return setup_files("meta");
+}
+
+static int64_t op_stat(struct suite_thread *t, int64_t i)
+{
+	char path[CHIRP_PATH_MAX];
+	struct chirp_stat info;
+
+	suite_path(path, "meta/file.%" PRId64, i % suite_files);
+	return chirp_client_stat(t->client, path, &info, SUITE_STOPTIME) < 0 ? -1 : 0;
+}
+
+/* open: open and close of existing files. */
+
+static int64_t op_open(struct suite_thread *t, int64_t i)
+{
+	char path[CHIRP_PATH_MAX];
+	suite_path(path, "meta/file.%" PRId64, i % suite_files);
+	return open_close(t, path);
+}
+
+/* create: create, write and close of small files, each thread in its own directory. */
+
+static int setup_create(void)
+{
+	return setup_dir("create");
+}
+
+static int begin_create(struct suite_thread *t)
+{
+	char path[CHIRP_PATH_MAX];
+	suite_path(path, "create/%d.%d", t->client_id, t->thread_id);
+
+	if(chirp_client_mkdir(t->client, path, 0755, SUITE_STOPTIME) < 0 && errno != EEXIST)
+		return 0;
+	return begin_buffer(t);
+}
+
+static int64_t op_create(struct suite_thread *t, int64_t i)
+{
+	char path[CHIRP_PATH_MAX];
+	struct chirp_stat info;
+
+	suite_path(path, "create/%d.%d/file.%" PRId64, t->client_id, t->thread_id, i);
+
+	INT64_T fd = chirp_client_open(t->client, path, O_WRONLY | O_CREAT | O_TRUNC, 0644, &info, SUITE_STOPTIME);
+	if(fd < 0)
+		return -1;
+
+	int64_t length = MIN(SUITE_CREATE_SIZE, suite_block_size);
+	INT64_T result = chirp_client_pwrite(t->client, fd, t->buffer, length, 0, SUITE_STOPTIME);
+
+	if(chirp_client_close(t->client, fd, SUITE_STOPTIME) < 0 || result != length)
+		return -1;
+	return length;
+}
+
+/* write and read: sequential transfer of a large file per thread. */
+
+static int setup_write(void)
+{
+	return setup_dir("seq");
+}
+
+static int setup_read(void)
+{
+	char path[CHIRP_PATH_MAX];
+	int c, t;
+
+	if(!setup_dir("seq"))
+		return 0;
+
+	for(c = 0; c < suite_clients; c++) {
+		for(t = 0; t < suite_threads; t++) {
+			suite_path(path, "seq/%d.%d", c, t);
+			if(!setup_file(path, suite_file_size))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static int begin_seq(struct suite_thread *t, int flags)
+{
+	char path[CHIRP_PATH_MAX];
+	struct chirp_stat info;
+
+	suite_path(path, "seq/%d.%d", t->client_id, t->thread_id);
+	t->fd = chirp_client_open(t->client, path, flags, 0644, &info, SUITE_STOPTIME);
+	if(t->fd < 0)
+		return 0;
+	return begin_buffer(t);
+}
+
+static int begin_write(struct suite_thread *t)
+{
+	return begin_seq(t, O_WRONLY | O_CREAT | O_TRUNC);
+}
+
+static int begin_read(struct suite_thread *t)
+{
+	return begin_seq(t, O_RDONLY);
+}
+
+static void end_fd(struct suite_thread *t)
+{
+	chirp_client_close(t->client, t->fd, SUITE_STOPTIME);
+	end_buffer(t);
+}
+
+static int64_t op_write(struct suite_thread *t, int64_t i)
+{
+	INT64_T result = chirp_client_pwrite(t->client, t->fd, t->buffer, suite_block_size, i * suite_block_size, SUITE_STOPTIME);
+	return result == suite_block_size ? result : -1;
+}
+
+static int64_t op_read(struct suite_thread *t, int64_t i)
+{
+	INT64_T result = chirp_client_pread(t->client, t->fd, t->buffer, suite_block_size, i * suite_block_size, SUITE_STOPTIME);
+	return result == suite_block_size ? result : -1;
+}
+
+/* pread: small reads at random offsets of one shared file. */
+
+static int setup_pread(void)
+{
+	char path[CHIRP_PATH_MAX];
+	suite_path(path, "pread.data");
+	return setup_file(path, suite_file_size);
+}
+
+static int begin_pread(struct suite_thread *t)
+{
+	char path[CHIRP_PATH_MAX];
+	struct chirp_stat info;
+
+	suite_path(path, "pread.data");
+	t->fd = chirp_client_open(t->client, path, O_RDONLY, 0, &info, SUITE_STOPTIME);
+	if(t->fd < 0)
+		return 0;
+	t->seed = t->client_id * 1000 + t->thread_id;
+	return begin_buffer(t);
+}
+
+static int64_t op_pread(struct suite_thread *t, int64_t i)
+{
+	int64_t blocks = MAX(suite_file_size / SUITE_PREAD_SIZE, 1);
+	int64_t offset = (rand_r(&t->seed) % blocks) * SUITE_PREAD_SIZE;
+
+	INT64_T result = chirp_client_pread(t->client, t->fd, t->buffer, SUITE_PREAD_SIZE, offset, SUITE_STOPTIME);
+	return result < 0 ? -1 : result;
+}
+
+/* acl: open and close of files in a directory with a long access control list. */
+
+static int setup_acl(void)
+{
+	char path[CHIRP_PATH_MAX];
+	char subject[CHIRP_LINE_MAX];
+	int i;
+
+	if(!setup_files("acl"))
+		return 0;
+
+	suite_path(path, "acl");
+	for(i = 0; i < suite_acl_entries; i++) {
+		snprintf(subject, sizeof(subject), "hostname:benchmark-%d.invalid", i);
+		if(chirp_reli_setacl(suite_host, path, subject, "rl", SUITE_STOPTIME) < 0) {
+			fprintf(stderr, "chirp_benchmark: couldn't set acl of %s: %s\n", path, strerror(errno));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int64_t op_acl(struct suite_thread *t, int64_t i)
+{
+	char path[CHIRP_PATH_MAX];
+	suite_path(path, "acl/file.%" PRId64, i % suite_files);
+	return open_close(t, path);
+}
+
+static const struct suite_workload suite_workloads[] = {
+	{"stat", setup_stat, nops_fixed, 0, 0, op_stat},
+	{"open", setup_stat, nops_fixed, 0, 0, op_open},
+	{"create", setup_create, nops_fixed, begin_create, end_buffer, op_create},
+	{"write", setup_write, nops_blocks, begin_write, end_fd, op_write},
+	{"read", setup_read, nops_blocks, begin_read, end_fd, op_read},
+	{"pread", setup_pread, nops_fixed, begin_pread, end_fd, op_pread},
+	{"acl", setup_acl, nops_fixed, 0, 0, op_acl},
+	{0, 0, 0, 0, 0, 0},
+};
+
+static void *suite_thread_main(void *arg)
+{
+	struct suite_thread *t = arg;
+	const struct suite_workload *w = t->workload;
+	int64_t nops = w->nops();
+	int64_t i;
+
+	t->latencies = malloc(MAX(nops, 1) * sizeof(double));
+
+	if(!t->client || (w->begin && !w->begin(t))) {
+		t->result.errors = nops;
+		return 0;
+	}
+
+	t->result.start = timestamp_get();
+
+	for(i = 0; i < nops; i++) {
+		timestamp_t start = timestamp_get();
+		int64_t bytes = w->op(t, i);
+		timestamp_t end = timestamp_get();
+
+		if(bytes < 0) {
+			t->result.errors++;
+		} else {
+			t->result.ops++;
+			t->result.bytes += bytes;
+			t->latencies[t->result.nlatencies++] = end - start;
+		}
+	}
+
+	t->result.end = timestamp_get();
+
+	if(w->end)
+		w->end(t);
+
+	return 0;
+}
+
+/*
+Each client process connects all of its threads, tells the parent it is
+ready, and then waits until the parent starts all clients at once.  The
+results of each thread are written back to the parent through a pipe.
+*/
+
+static void suite_client_main(const struct suite_workload *w, int client_id, int report_fd, int go_fd)
+{
+	struct suite_thread *threads = calloc(suite_threads, sizeof(*threads));
+	char c;
+	int i;
+
+	for(i = 0; i < suite_threads; i++) {
+		struct suite_thread *t = &threads[i];
+		t->client_id = client_id;
+		t->thread_id = i;
+		t->workload = w;
+		t->client = chirp_client_connect(suite_host, 1, SUITE_STOPTIME);
+		if(!t->client)
+			fprintf(stderr, "chirp_benchmark: couldn't connect to %s: %s\n", suite_host, strerror(errno));
+	}
+
+	c = 'r';
+	full_write(report_fd, &c, 1);
+	full_read(go_fd, &c, 1);
+
+	for(i = 0; i < suite_threads; i++)
+		pthread_create(&threads[i].thread, 0, suite_thread_main, &threads[i]);
+
+	for(i = 0; i < suite_threads; i++) {
+		struct suite_thread *t = &threads[i];
+		pthread_join(t->thread, 0);
+		full_write(report_fd, &t->result, sizeof(t->result));
+		full_write(report_fd, t->latencies, t->result.nlatencies * sizeof(double));
+		if(t->client)
+			chirp_client_disconnect(t->client);
+	}
+
+	_exit(0);
+}
+
+static struct jx *suite_run_workload(const struct suite_workload *w)
+{
+	int go[2];
+	int *reports = calloc(suite_clients, sizeof(int));
+	pid_t *pids = calloc(suite_clients, sizeof(pid_t));
+	int i, n;
+
+	if(pipe(go) < 0)
+		fatal("couldn't create pipe: %s", strerror(errno));
+
+	for(i = 0; i < suite_clients; i++) {
+		int report[2];
+		if(pipe(report) < 0)
+			fatal("couldn't create pipe: %s", strerror(errno));
+
+		fflush(NULL);
+		pids[i] = fork();
+		if(pids[i] < 0) {
+			fatal("couldn't fork: %s", strerror(errno));
+		} else if(pids[i] == 0) {
+			close(report[0]);
+			close(go[1]);
+			suite_client_main(w, i, report[1], go[0]);
+		}
+
+		close(report[1]);
+		reports[i] = report[0];
+	}
+	close(go[0]);
+
+	/* Start all clients at once, after all have connected. */
+	char c;
+	for(i = 0; i < suite_clients; i++)
+		full_read(reports[i], &c, 1);
+	for(i = 0; i < suite_clients; i++)
+		full_write(go[1], "g", 1);
+	close(go[1]);
+
+	struct quantile_sketch *sketch = quantile_sketch_create(0.01, 0);
+	int64_t ops = 0, bytes = 0, errors = 0;
+	timestamp_t start = 0, end = 0;
+	double max = 0, sum = 0;
+
+	for(i = 0; i < suite_clients; i++) {
+		for(n = 0; n < suite_threads; n++) {
+			struct suite_result result;
+			if(full_read(reports[i], &result, sizeof(result)) != sizeof(result)) {
+				errors += w->nops();
+				continue;
+			}
+
+			ops += result.ops;
+			bytes += result.bytes;
+			errors += result.errors;
+			if(result.ops > 0) {
+				if(!start || result.start < start)
+					start = result.start;
+				if(result.end > end)
+					end = result.end;
+			}
+
+			int64_t k;
+			for(k = 0; k < result.nlatencies; k++) {
+				double latency;
+				if(full_read(reports[i], &latency, sizeof(latency)) != sizeof(latency))
+					break;
+				quantile_sketch_insert(sketch, latency);
+				sum += latency;
+				max = MAX(max, latency);
+			}
+		}
+		close(reports[i]);
+		waitpid(pids[i], 0, 0);
+	}
+
+	double elapsed = (end - start) / (double)USECOND;
+	double ops_per_second = elapsed > 0 ? ops / elapsed : 0;
+	double mb_per_second = elapsed > 0 ? bytes / elapsed / MEGA : 0;
+	double p50 = quantile_sketch_quantile(sketch, 0.50);
+	double p90 = quantile_sketch_quantile(sketch, 0.90);
+	double p99 = quantile_sketch_quantile(sketch, 0.99);
+
+	printf("%-8s %10" PRId64 " %7" PRId64 " %8.2f %10.1f %9.2f %9.0f %9.0f %9.0f %9.0f\n", w->name, ops, errors, elapsed, ops_per_second, mb_per_second, p50, p90, p99, max);
+	fflush(stdout);
+
+	/* Keys are inserted in reverse so that they print in this order. */
+	struct jx *latency = jx_object(0);
+	jx_insert_double(latency, "mean", ops > 0 ? sum / ops : 0);
+	jx_insert_double(latency, "max", max);
+	jx_insert_double(latency, "p99", p99);
+	jx_insert_double(latency, "p90", p90);
+	jx_insert_double(latency, "p50", p50);
+
+	struct jx *j = jx_object(0);
+	jx_insert(j, jx_string("latency_us"), latency);
+	jx_insert_double(j, "mb_per_second", mb_per_second);
+	jx_insert_double(j, "ops_per_second", ops_per_second);
+	jx_insert_double(j, "elapsed", elapsed);
+	jx_insert_integer(j, "bytes", bytes);
+	jx_insert_integer(j, "errors", errors);
+	jx_insert_integer(j, "ops", ops);
+	jx_insert_string(j, "workload", w->name);
+
+	quantile_sketch_delete(sketch);
+	free(reports);
+	free(pids);
+	return j;
+}
+
+static const struct suite_workload *suite_lookup(const char *name)
+{
+	const struct suite_workload *w;
+	for(w = suite_workloads; w->name; w++) {
+		if(!strcmp(w->name, name))
+			return w;
+	}
+	return 0;
+}
+
+static void show_help(const char *cmd)
+{
+	const struct suite_workload *w;
+
+	printf("use: %s [options] <host[:port]> <dir>\n", cmd);
+	printf("  or %s <host|unix> <file> <loops> <cycles> <bwloops>\n", cmd);
+	printf("\n");
+	printf("Run a suite of workloads in <dir> on a Chirp server, from several clients at once.\n");
+	printf("Where options are:\n");
+	printf(" %-30s Workloads to run, separated by commas. (default: all)\n", "-w,--workloads=<list>");
+	printf(" %-30s Number of client processes. (default: %d)\n", "-c,--clients=<n>", suite_clients);
+	printf(" %-30s Number of threads in each client. (default: %d)\n", "-t,--threads=<n>", suite_threads);
+	printf(" %-30s Operations of each thread. (default: %" PRId64 ")\n", "-n,--ops=<n>", suite_ops);
+	printf(" %-30s Number of files of the metadata workloads. (default: %" PRId64 ")\n", "-f,--files=<n>", suite_files);
+	printf(" %-30s Size of the large files, a multiple of the block size. (default: %" PRId64 "MB)\n", "-s,--file-size=<size>", suite_file_size / MEGA);
+	printf(" %-30s Block size of sequential transfers, a multiple of 4KB. (default: %" PRId64 "MB)\n", "-b,--block-size=<size>", suite_block_size / MEGA);
+	printf(" %-30s Entries in the access control list of the acl workload. (default: %d)\n", "-a,--acl-entries=<n>", suite_acl_entries);
+	printf(" %-30s Write a report in JSON to this file.\n", "-j,--json=<file>");
+	printf(" %-30s Keep the files in <dir> when done.\n", "-k,--keep");
+	printf(" %-30s Timeout of each operation in seconds. (default: %d)\n", "-T,--timeout=<secs>", suite_timeout);
+	printf(" %-30s Show this help screen.\n", "-h,--help");
+	printf("\n");
+	printf("The workloads are:");
+	for(w = suite_workloads; w->name; w++)
+		printf(" %s", w->name);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *workloads = 0;
+	const char *json_file = 0;
+	int keep = 0;
+	signed char ch;
+
+	auth_register_all();
+
+	/* The original micro-benchmark takes exactly five positional arguments. */
+	if(argc == 6 && argv[1][0] != '-')
+		return legacy_main(argc, argv);
+
+	static const struct option long_options[] = {
+		{"workloads", required_argument, 0, 'w'},
+		{"clients", required_argument, 0, 'c'},
+		{"threads", required_argument, 0, 't'},
+		{"ops", required_argument, 0, 'n'},
+		{"files", required_argument, 0, 'f'},
+		{"file-size", required_argument, 0, 's'},
+		{"block-size", required_argument, 0, 'b'},
+		{"acl-entries", required_argument, 0, 'a'},
+		{"json", required_argument, 0, 'j'},
+		{"keep", no_argument, 0, 'k'},
+		{"timeout", required_argument, 0, 'T'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}};
+
+	while((ch = getopt_long(argc, argv, "w:c:t:n:f:s:b:a:j:kT:h", long_options, NULL)) > -1) {
+		switch (ch) {
+		case 'w':
+			workloads = optarg;
+			break;
+		case 'c':
+			suite_clients = atoi(optarg);
+			break;
+		case 't':
+			suite_threads = atoi(optarg);
+			break;
+		case 'n':
+			suite_ops = atoll(optarg);
+			break;
+		case 'f':
+			suite_files = atoll(optarg);
+			break;
+		case 's':
+			suite_file_size = string_metric_parse(optarg);
+			break;
+		case 'b':
+			suite_block_size = string_metric_parse(optarg);
+			break;
+		case 'a':
+			suite_acl_entries = atoi(optarg);
+			break;
+		case 'j':
+			json_file = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		case 'T':
+			suite_timeout = atoi(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(argc - optind != 2) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	if(suite_clients < 1 || suite_threads < 1 || suite_ops < 1 || suite_files < 1 || suite_block_size < 1 || suite_file_size < suite_block_size) {
+		fprintf(stderr, "chirp_benchmark: clients, threads, ops, files and block size must be positive, and the file size at least one block.\n");
+		return 1;
+	}
+
+	if(suite_block_size % BENCHMARK_ALIGN || suite_file_size % suite_block_size) {
+		fprintf(stderr, "chirp_benchmark: the block size must be a multiple of %d bytes, and the file size a multiple of the block size.\n", BENCHMARK_ALIGN);
+		return 1;
+	}
+
+	suite_host = argv[optind];
+	suite_dir = argv[optind + 1];
+
+	const struct suite_workload *selected[sizeof(suite_workloads) / sizeof(suite_workloads[0])];
+	int nselected = 0;
+
+	if(workloads) {
+		char *list = xxstrdup(workloads);
+		char *name;
+		for(name = strtok(list, ","); name; name = strtok(0, ",")) {
+			const struct suite_workload *w = suite_lookup(name);
+			if(!w) {
+				fprintf(stderr, "chirp_benchmark: unknown workload: %s\n", name);
+				return 1;
+			}
+			if(nselected < (int)(sizeof(selected) / sizeof(selected[0])) - 1)
+				selected[nselected++] = w;
+		}
+		free(list);
+	} else {
+		const struct suite_workload *w;
+		for(w = suite_workloads; w->name; w++)
+			selected[nselected++] = w;
+	}
+
+	if(chirp_reli_mkdir(suite_host, suite_dir, 0755, SUITE_STOPTIME) < 0 && errno != EEXIST) {
+		fprintf(stderr, "chirp_benchmark: couldn't create %s on %s: %s\n", suite_dir, suite_host, strerror(errno));
+		return 1;
+	}
+
+	printf("%-8s %10s %7s %8s %10s %9s %9s %9s %9s %9s\n", "workload", "ops", "errors", "time(s)", "ops/s", "MB/s", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+
+	struct jx *results = jx_array(0);
+	int64_t errors = 0;
+	int i;
+
+	for(i = 0; i < nselected; i++) {
+		const struct suite_workload *w = selected[i];
+		if(!w->setup()) {
+			fprintf(stderr, "chirp_benchmark: couldn't set up workload %s\n", w->name);
+			errors++;
+			continue;
+		}
+		struct jx *result = suite_run_workload(w);
+		errors += jx_lookup_integer(result, "errors");
+		jx_array_append(results, result);
+	}
+
+	if(!keep)
+		chirp_reli_rmall(suite_host, suite_dir, SUITE_STOPTIME);
+
+	if(json_file) {
+		struct jx *j = jx_object(0);
+		jx_insert(j, jx_string("workloads"), results);
+		jx_insert_integer(j, "timeout", suite_timeout);
+		jx_insert_integer(j, "acl_entries", suite_acl_entries);
+		jx_insert_integer(j, "block_size", suite_block_size);
+		jx_insert_integer(j, "file_size", suite_file_size);
+		jx_insert_integer(j, "files", suite_files);
+		jx_insert_integer(j, "ops", suite_ops);
+		jx_insert_integer(j, "threads", suite_threads);
+		jx_insert_integer(j, "clients", suite_clients);
+		jx_insert_string(j, "dir", suite_dir);
+		jx_insert_string(j, "host", suite_host);
+
+		FILE *file = fopen(json_file, "w");
+		if(!file) {
+			fprintf(stderr, "chirp_benchmark: couldn't write %s: %s\n", json_file, strerror(errno));
+			jx_delete(j);
+			return 1;
+		}
+		jx_pretty_print_stream(j, file);
+		fprintf(file, "\n");
+		fclose(file);
+		jx_delete(j);
+	} else {
+		jx_delete(results);
+	}
+
+	return errors > 0 ? 1 : 0;
+}
+
 /* vim: set noexpandtab tabstop=8: */
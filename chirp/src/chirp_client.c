@@ -1415,26 +1415,52 @@ INT64_T chirp_client_fstat(struct chirp_client * c, INT64_T fd, struct chirp_sta
 	return result;
 }
 
-INT64_T chirp_client_stat(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+INT64_T chirp_client_stat_begin(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
 {
 	char safepath[CHIRP_LINE_MAX];
 	chirp_encode(c, path, safepath, sizeof(safepath));
-	INT64_T result = simple_command(c, stoptime, "stat %s\n", safepath);
+	return send_command(c, stoptime, "stat %s\n", safepath);
+}
+
+INT64_T chirp_client_stat_finish(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+{
+	INT64_T result = get_result(c, stoptime);
 	if(result >= 0)
 		result = get_stat_result(c, path, info, stoptime);
 	return result;
 }
 
-INT64_T chirp_client_lstat(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+INT64_T chirp_client_stat(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+{
+	INT64_T result = chirp_client_stat_begin(c, path, info, stoptime);
+	if(result >= 0)
+		return chirp_client_stat_finish(c, path, info, stoptime);
+	return result;
+}
+
+INT64_T chirp_client_lstat_begin(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
 {
 	char safepath[CHIRP_LINE_MAX];
 	chirp_encode(c, path, safepath, sizeof(safepath));
-	INT64_T result = simple_command(c, stoptime, "lstat %s\n", safepath);
+	return send_command(c, stoptime, "lstat %s\n", safepath);
+}
+
+INT64_T chirp_client_lstat_finish(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+{
+	INT64_T result = get_result(c, stoptime);
 	if(result >= 0)
 		result = get_stat_result(c, path, info, stoptime);
 	return result;
 }
 
+INT64_T chirp_client_lstat(struct chirp_client * c, const char *path, struct chirp_stat * info, time_t stoptime)
+{
+	INT64_T result = chirp_client_lstat_begin(c, path, info, stoptime);
+	if(result >= 0)
+		return chirp_client_lstat_finish(c, path, info, stoptime);
+	return result;
+}
+
 INT64_T chirp_client_fstatfs(struct chirp_client * c, INT64_T fd, struct chirp_statfs * info, time_t stoptime)
 {
 	INT64_T result = simple_command(c, stoptime, "fstatfs %lld\n", fd);
@@ -129,6 +129,10 @@ INT64_T chirp_client_fsync_begin(struct chirp_client *c, INT64_T fd, time_t stop
 INT64_T chirp_client_fsync_finish(struct chirp_client *c, INT64_T fd, time_t stoptime);
 INT64_T chirp_client_fstat_begin(struct chirp_client *c, INT64_T fd, struct chirp_stat *buf, time_t stoptime);
 INT64_T chirp_client_fstat_finish(struct chirp_client *c, INT64_T fd, struct chirp_stat *buf, time_t stoptime);
+INT64_T chirp_client_stat_begin(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
+INT64_T chirp_client_stat_finish(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
+INT64_T chirp_client_lstat_begin(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
+INT64_T chirp_client_lstat_finish(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
 
 INT64_T chirp_client_job_create(struct chirp_client *c, const char *json, chirp_jobid_t *id, time_t stoptime);
 INT64_T chirp_client_job_commit(struct chirp_client *c, chirp_jobid_t id, time_t stoptime);
@@ -23,6 +23,9 @@ The -X option will delete the directory from all of the named hosts.
 #include "macros.h"
 #include "random.h"
 #include "getopt_aux.h"
+#include "itable.h"
+#include "list.h"
+#include "xxmalloc.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,6 +36,8 @@ The -X option will delete the directory from all of the named hosts.
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
 
 static int timeout = 300;
 static int overall_timeout = 3600;
@@ -50,11 +55,26 @@ static char *failure_matrix = 0;
 static int failure_matrix_size = 0;
 static char *failure_matrix_filename = 0;
 
-const double threshold = .2;
+/* A target is given up on after this many failed transfers to it. */
+#define TARGET_FAILURES_MAX 3
 
-static double *bw_matrix = 0;
-static int bw_matrix_size = 400;
+/* A single transfer process moves items until it has moved this much data. */
+#define TRANSFER_BATCH_BYTES (256*1024*1024)
+
+/* Smaller items say more about latency than bandwidth, so are not measured. */
+#define BANDWIDTH_MIN_BYTES (1024*1024)
+
+/* Weight of the newest measurement in the running bandwidth estimates. */
+#define BANDWIDTH_ALPHA 0.5
 
+/*
+The bandwidth matrix holds the estimated throughput (MB/s) from each host
+to each other host, seeded from the measurements of earlier runs and
+updated as transfers complete.  Zero means nothing is known.
+*/
+
+static double *bw_matrix = 0;
+static int bw_matrix_size = 0;
 
 static void bw_matrix_init(int n)
 {
@@ -73,18 +93,13 @@ static double bw_matrix_get(int s, int t)
 	return bw_matrix[s * bw_matrix_size + t];
 }
 
-static double bw_find_max(int s)
+static double bw_update(double old, double sample)
 {
-	int max = 0, i;
-	for(i = 0; i < bw_matrix_size; i++) {
-		if(max < bw_matrix_get(s, i))
-			max = bw_matrix_get(s, i);
-	}
-	return max;
+	if(old <= 0)
+		return sample;
+	return BANDWIDTH_ALPHA * sample + (1 - BANDWIDTH_ALPHA) * old;
 }
 
-
-
 static int compute_stoptime()
 {
 	return MIN(time(0) + timeout, overall_stoptime);
@@ -133,36 +148,396 @@ static void failure_matrix_print()
 	fclose(file);
 }
 
+/*
+The source path is divided into items: each entry of the source directory,
+or the source file itself.  Items are moved independently by third party
+transfer, so a host that has received some items can forward them to
+others before it has the rest.
+*/
+
+#define ITEM_MISSING 0
+#define ITEM_MOVING  1
+#define ITEM_PRESENT 2
+
+struct item_info {
+	char *path;
+	INT64_T size;
+	int copies;
+};
+
 typedef enum {
 	TARGET_STATE_FRESH,
-	TARGET_STATE_RECEIVING,
-	TARGET_STATE_SENDING,
-	TARGET_STATE_IDLE,
+	TARGET_STATE_COMPLETE,
 	TARGET_STATE_FAILED
 } target_state_t;
 
-
-
-struct m_server_info {
-	char *name;
-	int cid;
-	int index;
-	double max;
-	int status;
+struct target_info {
+	const char *name;
+	target_state_t state;
+	pid_t send_pid;
+	pid_t recv_pid;
+	char *items;
+	int items_present;
+	int failures;
+	double bandwidth;
 };
 
-struct server_info {
-	char *name;
-	int cid;
+struct transfer_info {
+	pid_t pid;
+	int source;
+	int target;
+	int *items;
+	int nitems;
+	INT64_T bytes;
+	timestamp_t start;
 };
 
-struct target_info {
-	const char *name;
-	target_state_t state;
+/* Sent by a transfer process to the parent as each item is done. */
+struct transfer_report {
 	pid_t pid;
-	int cid;
+	int item;
+	int error;
+	INT64_T bytes;
+	timestamp_t elapsed;
 };
 
+static struct item_info *items = 0;
+static int nitems = 0;
+static int items_allocated = 0;
+static struct target_info *targets = 0;
+static int ntargets = 0;
+static struct itable *transfer_table = 0;
+static int report_pipe[2];
+static const char *sourcepath = 0;
+static FILE *history = 0;
+
+static void add_item(const char *path, INT64_T size)
+{
+	if(nitems == items_allocated) {
+		items_allocated = MAX(items_allocated * 2, 64);
+		items = realloc(items, sizeof(*items) * items_allocated);
+		if(!items)
+			fatal("out of memory");
+	}
+	items[nitems].path = xxstrdup(path);
+	items[nitems].size = size;
+	items[nitems].copies = 1;
+	nitems++;
+}
+
+static void add_dir_item(const char *name, struct chirp_stat *info, void *arg)
+{
+	char path[CHIRP_PATH_MAX];
+
+	if(!strcmp(name, ".") || !strcmp(name, "..") || !strncmp(name, ".__", 3))
+		return;
+
+	string_nformat(path, sizeof(path), "%s/%s", sourcepath, name);
+	add_item(path, info->cst_size);
+}
+
+/* Read the measurements of earlier runs, one "source target MB/s" per line. */
+static void history_load(const char *filename)
+{
+	char source[CHIRP_LINE_MAX];
+	char target[CHIRP_LINE_MAX];
+	double bw;
+	FILE *file;
+	int s, t;
+
+	file = fopen(filename, "r");
+	if(!file)
+		return;
+
+	while(fscanf(file, "%1023s %1023s %lf", source, target, &bw) == 3) {
+		for(s = 0; s < ntargets; s++)
+			if(!strcmp(targets[s].name, source))
+				break;
+		for(t = 0; t < ntargets; t++)
+			if(!strcmp(targets[t].name, target))
+				break;
+		if(s < ntargets && t < ntargets && bw > 0)
+			bw_matrix_set(s, t, bw_update(bw_matrix_get(s, t), bw));
+	}
+
+	fclose(file);
+}
+
+/*
+The expected throughput from s to t: measured on that link if possible,
+otherwise the measured output of s, otherwise the average of all hosts,
+so that unknown hosts are neither favored nor starved.
+*/
+
+static double link_bandwidth(int s, int t)
+{
+	double total = 0;
+	int known = 0;
+	int i;
+
+	if(bw_matrix_get(s, t) > 0)
+		return bw_matrix_get(s, t);
+	if(targets[s].bandwidth > 0)
+		return targets[s].bandwidth;
+
+	for(i = 0; i < ntargets; i++) {
+		if(targets[i].bandwidth > 0) {
+			total += targets[i].bandwidth;
+			known++;
+		}
+	}
+
+	return known ? total / known : 1;
+}
+
+static int can_send(int s, int t)
+{
+	int i;
+
+	for(i = 0; i < nitems; i++) {
+		if(targets[s].items[i] == ITEM_PRESENT && targets[t].items[i] == ITEM_MISSING)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+Pick the idle pair with the fastest expected link, preferring
+sources which hold more of the data when links are equal.
+*/
+
+static int choose_transfer(int *source, int *target)
+{
+	double best = -1;
+	int s, t;
+
+	for(t = 1; t < ntargets; t++) {
+		if(targets[t].state != TARGET_STATE_FRESH || targets[t].recv_pid)
+			continue;
+		for(s = 0; s < ntargets; s++) {
+			if(s == t || targets[s].state == TARGET_STATE_FAILED || targets[s].send_pid || !targets[s].items_present)
+				continue;
+			if(failure_matrix_get(s, t) == FAILURE_MARK_FAILED)
+				continue;
+
+			double bw = link_bandwidth(s, t);
+			if(bw < best || (bw == best && targets[s].items_present <= targets[*source].items_present))
+				continue;
+			if(!can_send(s, t))
+				continue;
+
+			best = bw;
+			*source = s;
+			*target = t;
+		}
+	}
+
+	return best >= 0;
+}
+
+static int compare_rarity(const void *a, const void *b)
+{
+	return items[*(const int *) a].copies - items[*(const int *) b].copies;
+}
+
+static void acl_line_save(const char *line, void *arg)
+{
+	list_push_tail(arg, xxstrdup(line));
+}
+
+static void report_send(int item, int error, INT64_T bytes, timestamp_t elapsed)
+{
+	struct transfer_report r;
+
+	r.pid = getpid();
+	r.item = item;
+	r.error = error;
+	r.bytes = bytes;
+	r.elapsed = elapsed;
+
+	/* smaller than PIPE_BUF, so reports from several processes do not interleave */
+	if(write(report_pipe[1], &r, sizeof(r)) != sizeof(r))
+		debug(D_NOTICE, "couldn't send report: %s", strerror(errno));
+}
+
+/* Runs in the transfer process: move each item of the batch in turn. */
+static int transfer_run(struct transfer_info *x)
+{
+	const char *sname = targets[x->source].name;
+	const char *tname = targets[x->target].name;
+	int i;
+
+	if(strcmp(items[0].path, sourcepath)) {
+		/* the directory holding the items must exist before they can be sent */
+		if(chirp_reli_mkdir(tname, sourcepath, 0700, compute_stoptime()) < 0 && errno != EEXIST) {
+			report_send(x->items[0], errno, 0, 0);
+			return errno;
+		}
+	}
+
+	for(i = 0; i < x->nitems; i++) {
+		struct item_info *item = &items[x->items[i]];
+		timestamp_t start = timestamp_get();
+		INT64_T result = chirp_reli_thirdput(sname, item->path, tname, item->path, compute_stoptime());
+		timestamp_t elapsed = MAX(timestamp_get() - start, 1);
+
+		if(result < 0) {
+			int save_errno = errno;
+			report_send(x->items[i], save_errno, 0, elapsed);
+			return save_errno;
+		}
+
+		report_send(x->items[i], 0, result, elapsed);
+	}
+
+	return 0;
+}
+
+static int transfer_start(int source, int target)
+{
+	struct transfer_info *x;
+	INT64_T bytes = 0;
+	int *candidates;
+	int ncandidates = 0;
+	int i;
+
+	candidates = malloc(sizeof(int) * nitems);
+	for(i = 0; i < nitems; i++) {
+		if(targets[source].items[i] == ITEM_PRESENT && targets[target].items[i] == ITEM_MISSING)
+			candidates[ncandidates++] = i;
+	}
+
+	/* send the rarest items first, so that they spread the fastest */
+	qsort(candidates, ncandidates, sizeof(int), compare_rarity);
+
+	x = malloc(sizeof(*x));
+	x->source = source;
+	x->target = target;
+	x->items = candidates;
+	x->nitems = 0;
+	x->bytes = 0;
+	x->start = timestamp_get();
+
+	while(x->nitems < ncandidates && bytes < TRANSFER_BATCH_BYTES) {
+		bytes += items[candidates[x->nitems]].size;
+		x->nitems++;
+	}
+
+	fflush(0);
+	x->pid = fork();
+	if(x->pid == 0) {
+		close(report_pipe[0]);
+		fflush(0);
+		_exit(transfer_run(x));
+	} else if(x->pid < 0) {
+		fprintf(stderr, "chirp_distribute: %s\n", strerror(errno));
+		free(x->items);
+		free(x);
+		return 0;
+	}
+
+	for(i = 0; i < x->nitems; i++)
+		targets[target].items[x->items[i]] = ITEM_MOVING;
+
+	targets[source].send_pid = x->pid;
+	targets[target].recv_pid = x->pid;
+	itable_insert(transfer_table, x->pid, x);
+
+	return 1;
+}
+
+static void transfer_report_process(struct transfer_report *r)
+{
+	struct transfer_info *x = itable_lookup(transfer_table, r->pid);
+	if(!x || r->error)
+		return;
+
+	struct target_info *t = &targets[x->target];
+	if(t->items[r->item] != ITEM_MOVING)
+		return;
+
+	t->items[r->item] = ITEM_PRESENT;
+	t->items_present++;
+	items[r->item].copies++;
+	x->bytes += r->bytes;
+
+	if(r->bytes >= BANDWIDTH_MIN_BYTES) {
+		/* bytes per microsecond is MB/s */
+		double bw = r->bytes / (double) r->elapsed;
+		bw_matrix_set(x->source, x->target, bw_update(bw_matrix_get(x->source, x->target), bw));
+		targets[x->source].bandwidth = bw_update(targets[x->source].bandwidth, bw);
+		if(history)
+			fprintf(history, "%s %s %.1lf\n", targets[x->source].name, t->name, bw);
+	}
+}
+
+static void transfer_reports_read(void)
+{
+	struct transfer_report r;
+
+	while(read(report_pipe[0], &r, sizeof(r)) == sizeof(r))
+		transfer_report_process(&r);
+}
+
+static void transfer_finish(pid_t pid, int status)
+{
+	struct transfer_info *x = itable_remove(transfer_table, pid);
+	struct target_info *s, *t;
+	timestamp_t elapsed;
+	int error_code;
+	int i;
+
+	if(!x)
+		return;
+
+	s = &targets[x->source];
+	t = &targets[x->target];
+	s->send_pid = 0;
+	t->recv_pid = 0;
+
+	/* items not reported as done are sent again later */
+	for(i = 0; i < x->nitems; i++) {
+		if(t->items[x->items[i]] == ITEM_MOVING)
+			t->items[x->items[i]] = ITEM_MISSING;
+	}
+
+	if(WIFEXITED(status)) {
+		error_code = WEXITSTATUS(status);
+	} else {
+		error_code = EINTR;
+	}
+
+	elapsed = MAX(timestamp_get() - x->start, 1);
+
+	if(error_code == 0) {
+		failure_matrix_set(x->source, x->target, FAILURE_MARK_SUCCESS);
+		if(detail_mode) {
+			printf("%u   %s -> %s   %d items, %.2lf secs, %.1lf MB/sec\n", (unsigned) time(0), s->name, t->name, x->nitems, elapsed / 1000000.0, x->bytes / (double) elapsed);
+		}
+		if(t->items_present == nitems) {
+			t->state = TARGET_STATE_COMPLETE;
+			transfers_complete++;
+			if(confirm_mode) {
+				printf("YES %s\n", t->name);
+			}
+		}
+	} else {
+		failure_matrix_set(x->source, x->target, FAILURE_MARK_FAILED);
+		t->failures++;
+		if(error_code == ECONNRESET || t->failures >= TARGET_FAILURES_MAX) {
+			t->state = TARGET_STATE_FAILED;
+		}
+		if(detail_mode) {
+			printf("%u   %s -> %s    failed: %s\n", (unsigned) time(0), s->name, t->name, strerror(error_code));
+		}
+	}
+
+	fflush(0);
+	free(x->items);
+	free(x);
+}
+
 static void show_help()
 {
 	fprintf(stdout, "Use: chirp_distribute [options] <sourcehost> <sourcepath> <host1> <host2> ...\n");
@@ -183,27 +558,22 @@ static void show_help()
 	fprintf(stdout, " %-30s This message.\n", "-h,--help");
 	fprintf(stdout, "\nchirp_distribute copies a directory from one host to many hosts\n");
 	fprintf(stdout, "by creating a spanning tree and then transferring data in parallel\n");
-	fprintf(stdout, "using third party transfer.  The path of each newly created copy\n");
-	fprintf(stdout, "is printed on stdout.  The -X option deletes all but one copy.\n\n");
+	fprintf(stdout, "using third party transfer.  Each entry of the directory is sent\n");
+	fprintf(stdout, "separately, so hosts forward data as soon as they receive it, and\n");
+	fprintf(stdout, "the fastest measured links are used first.  The path of each newly\n");
+	fprintf(stdout, "created copy is printed on stdout.  The -X option deletes all but one copy.\n\n");
 }
 
 int main(int argc, char *argv[])
 {
 	INT64_T result;
 	signed char c;
-	char *sourcehost, *sourcepath;
-	struct target_info *targets;
-	struct server_info *servers;
-	int ntargets;
-	int i, j;
+	char *sourcehost;
+	int i;
 	pid_t pid;
 	int nprocs = 0;
 	char *tickets = NULL;
 
-	int length;		//, start_time, end_time;
-	int server_count = 0;
-	int cluster_count = 0;
-
 	random_init();
 
 	debug_config(argv[0]);
@@ -374,459 +744,142 @@ int main(int argc, char *argv[])
 
 		return 0;
 	}
-	//open output file to create cluster file
-	char outRe[80];
-	sprintf(outRe, "%s/out.txt", home_dir);
-	char clusterFile[80];
-	sprintf(clusterFile, "%s/cluster.txt", home_dir);
-
-
-	FILE *out = fopen(clusterFile, "w");
-	float d;
-	char ar1[100];
-	char ar2[100];
-	int c_count = 0;
-	struct m_server_info temp_sever;
-	struct m_server_info *m_servers = malloc(sizeof(struct m_server_info) * 400);
-	bw_matrix_init(400);
-	FILE *fp = fopen(outRe, "r");
-	//process output file
-	if(fp != NULL)
-		while(fscanf(fp, "%s %s %f", ar1, ar2, &d) != EOF) {
-			int s = 0, t = 0;
-			int test = 0;
-			int length;
-			for(i = 0; i < 100; i++) {
-				if(ar1[i] == '\0')
-					break;
-			}
-			temp_sever.name = malloc(sizeof(char) * (i + 1));
-			for(j = 0; j <= i; j++) {
-				temp_sever.name[j] = ar1[j];
-			}
-
-			for(j = 0; j < c_count; j++) {
-				if(strlen(m_servers[j].name) > strlen(temp_sever.name))
-					length = strlen(temp_sever.name);
-				else
-					length = strlen(m_servers[j].name);
-
-				if(!strncmp(temp_sever.name, m_servers[j].name, length)) {
-					test = 1;
-					s = j;
-					break;
-				}
-			}
-			if(test == 0) {
-				m_servers[c_count].name = malloc(sizeof(char) * (i + 1));
-				for(j = 0; j <= i; j++) {
-					m_servers[c_count].name[j] = temp_sever.name[j];
-				}
-				m_servers[c_count].cid = 0;
-				m_servers[c_count].index = c_count;
-				t = c_count;
-				c_count++;
-			}
-
-			for(i = 0; i < 100; i++) {
-				if(ar2[i] == '\0')
-					break;
-			}
-			temp_sever.name = malloc(sizeof(char) * (i + 1));
-			for(j = 0; j <= i; j++) {
-				temp_sever.name[j] = ar2[j];
-			}
-
-			for(j = 0; j < c_count; j++) {
-				if(strlen(m_servers[j].name) > strlen(temp_sever.name))
-					length = strlen(temp_sever.name);
-				else
-					length = strlen(m_servers[j].name);
 
-				if(!strncmp(temp_sever.name, m_servers[j].name, length)) {
-					test = 1;
-					t = j;
-					break;
-				}
-			}
-			if(test == 0) {
-				m_servers[c_count].name = malloc(sizeof(char) * (i + 1));
-				for(j = 0; j <= i; j++) {
-					m_servers[c_count].name[j] = temp_sever.name[j];
-				}
-				m_servers[c_count].index = c_count;
-				m_servers[c_count].cid = 0;
-				t = c_count;
-				c_count++;
-			}
-			//printf("%d %d\n",s,t);
-
-			if(bw_matrix_get(s, t) < d) {
-				bw_matrix_set(s, t, d);
-				bw_matrix_set(t, s, d);
-			}
-		}
-
-	if(fp != NULL)
-		fclose(fp);
-	int stack[1000];
-	int bottom = -1;
-	int count = 0;
-
-	int save_i = 0;
-	double max = 0;
-	int test = 1;
-	//create cluster file
-	while(test) {
-		max = 0;
-		bottom = -1;
-		for(i = 0; i < c_count; i++) {
-			if(max < bw_find_max(i)) {
-				max = bw_find_max(i);
-				save_i = i;
-			}
-		}
-		if(max == 0) {
-			test = 0;
-			break;
-		}
-
-		count++;
-		fprintf(out, "Cluster %d bw %2.1f : ", count, max);
-		fprintf(out, "%s_XXX", m_servers[save_i].name);
-		for(i = 0; i < c_count; i++) {
-			if(bw_matrix_get(save_i, i) > threshold * max) {
-				m_servers[save_i].cid = count;
-				m_servers[i].cid = count;
-				bottom++;
-				stack[bottom] = i;
-			}
-		}
-
-		for(j = 0; j < c_count; j++) {
-			bw_matrix_set(save_i, j, 0);
-			bw_matrix_set(j, save_i, 0);
-		}
+	targets = calloc(ntargets, sizeof(*targets));
+	targets[0].name = sourcehost;
+	for(i = 1; i < ntargets; i++) {
+		targets[i].name = argv[optind + 1 + i];
+		targets[i].state = TARGET_STATE_FRESH;
+	}
 
-		while(bottom >= 0) {
-			i = stack[bottom];
-			fprintf(out, ",%s_XXX", m_servers[i].name);
-			bottom--;
-			for(j = 0; j < c_count; j++) {
-				if(bw_matrix_get(i, j) > threshold * max) {
-					m_servers[j].cid = count;
-					bottom++;
-					stack[bottom] = j;
-				}
-			}
-			for(j = 0; j < c_count; j++) {
-				bw_matrix_set(i, j, 0);
-				bw_matrix_set(j, i, 0);
-			}
+	if(result >= 0 && S_ISDIR(buf.cst_mode)) {
+		if(chirp_reli_getlongdir(sourcehost, sourcepath, add_dir_item, 0, compute_stoptime()) < 0) {
+			fprintf(stderr, "chirp_distribute: couldn't list %s: %s\n", sourcepath, strerror(errno));
+			return 1;
 		}
-		fprintf(out, "\n\n");
 	}
 
+	if(nitems == 0) {
+		/* a plain file, or an empty directory, is moved as a single item */
+		add_item(sourcepath, result >= 0 ? buf.cst_size : 0);
+	}
 
-	if(out != NULL)
-		fclose(out);
-
-	targets = malloc(sizeof(struct target_info) * ntargets);
-	servers = malloc(sizeof(struct server_info) * 400);
-
-	/***read in chirp server with cluster information***/
-	char temp[4000];
-	char t_name[40];
-	int name_count = 0;
+	for(i = 0; i < ntargets; i++) {
+		targets[i].items = calloc(nitems, sizeof(char));
+	}
+	memset(targets[0].items, ITEM_PRESENT, nitems);
+	targets[0].items_present = nitems;
+	targets[0].state = TARGET_STATE_COMPLETE;
 
-	test = 0;
-	out = fopen(outRe, "a");
+	bw_matrix_init(ntargets);
 
-	/*
-	   char outR[15];
-	   sprintf(outR, "%i", start_time);
-	   FILE *outResult = fopen(outR,"w");
-	 */
+	char history_file[CHIRP_PATH_MAX];
+	string_nformat(history_file, sizeof(history_file), "%s/out.txt", home_dir);
+	history_load(history_file);
+	if(detail_mode) {
+		history = fopen(history_file, "a");
+	}
 
-	fp = fopen(clusterFile, "r");
-	if(fp != NULL) {
-		while(fgets(temp, 4000, fp) != NULL) {
-			name_count = 0;
+	transfer_table = itable_create(0);
 
-			if(strlen(temp) > 10)
-				cluster_count = cluster_count + 1;
-			for(i = 0; i < (int) strlen(temp); i++) {
-				if((test != 0) && (temp[i] != '_') && (temp[i] != ' ')) {
-					t_name[name_count] = temp[i];
-					name_count++;
-				}
+	if(pipe(report_pipe) < 0)
+		fatal("couldn't create pipe: %s", strerror(errno));
+	fcntl(report_pipe[0], F_SETFL, O_NONBLOCK);
 
-				if(temp[i] == ':')
-					test = 1;
-				if(temp[i] == '_') {
-					test = 0;
-					t_name[name_count] = '\0';
-					name_count++;
-				}
-				if(temp[i] == ',') {
-					test = 1;
-					servers[server_count].name = malloc(sizeof(char) * (name_count));
+	while(1) {
+		int source = 0, target = 0, status;
 
-					for(j = 0; j < name_count; j++) {
-						servers[server_count].name[j] = t_name[j];
-					}
-					servers[server_count].cid = cluster_count;
-					name_count = 0;
-					server_count++;
-				}
-			}
-		}
-	}
-	//set inital cluster state
-	int c_State[cluster_count];
-	for(i = 0; i < cluster_count; i++) {
-		c_State[i] = -1;	//-1: cluster does not have files, does not need files
-	}
-
-
-	targets[0].name = sourcehost;
-	targets[0].state = TARGET_STATE_IDLE;
-
-	test = 0;
-	for(j = 0; j < server_count; j++) {
-		if(strlen(servers[j].name) > strlen(targets[0].name))
-			length = strlen(targets[0].name);
-		else
-			length = strlen(servers[j].name);
-
-		if(!strncmp(targets[0].name, servers[j].name, length)) {
-			targets[0].cid = servers[j].cid;
-			c_State[targets[0].cid] = 1;
-			test = 1;
+		if(time(0) >= overall_stoptime) {
+			printf("Stopping because time expired.\n");
 			break;
 		}
-	}
-	if(test == 0) {
-		targets[0].cid = 0;	//unknow servers will be considered in cluster #0
-		c_State[targets[0].cid] = 1;
-	}
 
-	for(i = 1; i < ntargets; i++) {
-		if(i != 0) {
-			targets[i].name = argv[optind + 1 + i];
-			targets[i].state = TARGET_STATE_FRESH;
+		if(transfers_needed && transfers_complete >= transfers_needed) {
+			printf("Stopping because enough transfers have been completed.\n");
+			break;
 		}
 
-		test = 0;
-		for(j = 0; j < server_count; j++) {
-			if(strlen(servers[j].name) > strlen(targets[i].name))
-				length = strlen(targets[i].name);
-			else
-				length = strlen(servers[j].name);
-
-			if(!strncmp(targets[i].name, servers[j].name, length)) {
-				targets[i].cid = servers[j].cid;
-				if(c_State[targets[i].cid] == -1)
-					c_State[targets[i].cid] = 0;	//0 does not have files, need files
-				test = 1;
+		while(nprocs < maxprocs && choose_transfer(&source, &target)) {
+			chirp_reli_cleanup_before_fork();
+			if(!transfer_start(source, target)) {
 				break;
 			}
+			nprocs++;
+			source = target = 0;
 		}
-		if(test == 0)
-			targets[i].cid = 0;	//unknow servers will be considered in cluster #0
-	}
 
-	if(detail_mode) {
-		printf("%u   start -> %s    0 secs, 0 MB/sec\n", (unsigned) time(0), sourcehost);
-	}
+		if(nprocs == 0)
+			break;
 
+		struct pollfd pfd;
+		pfd.fd = report_pipe[0];
+		pfd.events = POLLIN;
+		poll(&pfd, 1, 1000);
 
-	while(time(0) < overall_stoptime) {
-		int source = -1;
-		int target = -1;
+		transfer_reports_read();
 
-		if(transfers_needed != 0 && transfers_complete >= transfers_needed) {
-			for(i = 1; i < ntargets; i++) {
-				if(targets[i].state == TARGET_STATE_SENDING) {
-					kill(targets[i].pid, SIGKILL);
-				}
-			}
-			break;
-		}
-
-		for(i = 0; i <= ntargets - 1; i++) {	//(i=(ntargets-1);i>=0;i--) {
-			if(targets[i].state == TARGET_STATE_IDLE) {
-				source = i;
-				break;
-			}
+		while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			/* collect the last reports of this transfer before finishing it */
+			transfer_reports_read();
+			transfer_finish(pid, status);
+			nprocs--;
 		}
+	}
 
-		if(source != -1) {
-			int freshtargets = 0;
-			target = -1;
-			for(i = 1; i < ntargets; i++) {
-				if(targets[i].state == TARGET_STATE_FRESH) {
-					freshtargets++;
-					if(c_State[targets[i].cid] == 0) {	//cluster does not have files
-						if(failure_matrix_get(source, i) != FAILURE_MARK_FAILED) {
-							c_State[targets[i].cid] = 2;	//cluster is receving files
-							target = i;
-
-							if(!strncmp(targets[target].name, sourcehost, strlen(sourcehost)))
-								printf("New cluster %s, %s, %s \n", targets[source].name, sourcehost, targets[target].name);
-							break;
-						}
-					}
-				}
-			}
-			if(target == -1)
-				for(i = 1; i < ntargets; i++) {
-					if(targets[i].state == TARGET_STATE_FRESH) {
-						if(targets[i].cid == targets[source].cid) {	//target and source are in the same cluster
-							if(failure_matrix_get(source, i) != FAILURE_MARK_FAILED) {
-								target = i;
-								break;
-							}
-						}
-					}
-				}
-			if(target == -1)
-				for(i = 1; i < ntargets; i++) {
-					if(targets[i].state == TARGET_STATE_FRESH) {
-						if(failure_matrix_get(source, i) != FAILURE_MARK_FAILED) {
-							target = i;
-							break;
-						}
-					}
-				}
-
+	if(nprocs > 0) {
+		UINT64_T key;
+		int status;
+		struct transfer_info *x;
 
-			if(target == -1 && freshtargets > 0) {
-				/* nothing left for this one to do */
-				targets[source].state = TARGET_STATE_FAILED;
-				continue;
-			}
+		itable_firstkey(transfer_table);
+		while(itable_nextkey(transfer_table, &key, (void **) &x)) {
+			kill(x->pid, SIGKILL);
 		}
 
-		if(nprocs < maxprocs && target != -1 && source != -1) {
-			if(target == 0) {
-				printf("%s, %s, %s %d \n", targets[source].name, sourcehost, targets[target].name, target);
-				exit(0);
-			}
-			fflush(0);
-			pid = fork();
-			if(pid > 0) {
-				nprocs++;
-				targets[source].state = TARGET_STATE_SENDING;
-				targets[source].pid = pid;
-				targets[target].state = TARGET_STATE_RECEIVING;
-				targets[target].pid = pid;
-			} else if(pid == 0) {
-				timestamp_t start, stop;
-				start = timestamp_get();
-
-				result = chirp_reli_thirdput(targets[source].name, sourcepath, targets[target].name, sourcepath, compute_stoptime());
-				stop = timestamp_get();
-				if(start == stop)
-					stop++;
-				if(result >= 0) {
-					c_State[targets[target].cid] = 1;	//mark cluster to "have files"
-					//targets[target].state = TARGET_STATE_IDLE;
-					if(detail_mode) {
-						printf("%u   %s (%d) -> %s (%d)   %.2lf secs, %.1lf MB/sec\n", (unsigned) time(0), targets[source].name, targets[source].cid, targets[target].name, targets[target].cid, (stop - start) / 1000000.0,
-							   result / (double) (stop - start));
-						fprintf(out, "%s %s %.1lf\n", targets[source].name, targets[target].name, result / (double) (stop - start));
-						//end_time = time(0);
-						//fprintf(outResult,"%d\n",end_time-start_time);
+		while((pid = wait(&status)) > 0 || errno == EINTR) {
+			if(pid > 0)
+				transfer_finish(pid, status);
+		}
+	}
 
-					} else {
-						//end_time = time(0);
-						//fprintf(outResult,"%d\n",end_time-start_time);
-					}
-					if(confirm_mode) {
-						printf("YES %s\n", targets[target].name);
-					}
-					fflush(0);
-					exit(0);
-				} else {
-					if(c_State[targets[target].cid] == 2)
-						c_State[targets[target].cid] = 0;	//cluster did not get files
-					int save_errno = errno;
-					if(detail_mode) {
-						printf("%u   %s(%d) -> %s(%d)    failed: %s\n", (unsigned) time(0), targets[source].name, targets[source].cid, targets[target].name, targets[target].cid, strerror(errno));
-					}
+	if(history)
+		fclose(history);
 
-					fflush(0);
-					chirp_reli_rmall(targets[target].name, sourcepath, compute_stoptime());
-					exit(save_errno);
-				}
-			} else {
-				fprintf(stderr, "chirp_distribute: %s\n", strerror(errno));
-				sleep(1);
-			}
-		} else {
-			int status;
-			pid = wait(&status);
-			if(pid > 0) {
-				int transfer_ok;
-				int error_code;
-
-				nprocs--;
-
-				if(WIFEXITED(status)) {
-					error_code = WEXITSTATUS(status);
-					transfer_ok = (error_code == 0);
-					if(transfer_ok) {
-						transfers_complete++;
-						//end_time = time(0);
-					}
-				} else {
-					transfer_ok = 0;
-					error_code = 0;
-				}
+	if(result >= 0 && S_ISDIR(buf.cst_mode)) {
+		/* give the copies the same access rights as the original */
+		struct list *acl = list_create();
+		char whoami[CHIRP_LINE_MAX];
+		char subject[CHIRP_LINE_MAX];
+		char rights[CHIRP_LINE_MAX];
+		char *line;
 
-				for(i = 0; i < ntargets; i++) {
-					if(targets[i].pid == pid) {
-						if(targets[i].state == TARGET_STATE_RECEIVING) {
-							target = i;
-							if(transfer_ok) {
-								targets[i].state = TARGET_STATE_IDLE;
-							} else if(error_code == ECONNRESET) {
-								targets[i].state = TARGET_STATE_FAILED;
-							} else {
-								targets[i].state = TARGET_STATE_FRESH;
-							}
-						} else if(targets[i].state == TARGET_STATE_SENDING) {
-							source = i;
-							targets[i].state = TARGET_STATE_IDLE;
-						}
-					}
-				}
-				if(transfer_ok) {
-					failure_matrix_set(source, target, FAILURE_MARK_SUCCESS);
-				} else {
-					failure_matrix_set(source, target, FAILURE_MARK_FAILED);
+		if(chirp_reli_whoami(sourcehost, whoami, sizeof(whoami), compute_stoptime()) >= 0 && chirp_reli_getacl(sourcehost, sourcepath, acl_line_save, acl, compute_stoptime()) >= 0) {
+			for(i = 1; i < ntargets; i++) {
+				if(targets[i].state != TARGET_STATE_COMPLETE)
+					continue;
+				list_first_item(acl);
+				while((line = list_next_item(acl))) {
+					if(sscanf(line, "%1023s %1023s", subject, rights) != 2 || !strcmp(subject, whoami))
+						continue;
+					chirp_reli_setacl(targets[i].name, sourcepath, subject, rights, compute_stoptime());
 				}
-			} else if(errno == ECHILD) {
-				break;
-			} else {
-				fprintf(stderr, "chirp_distribute: wait: %s\n", strerror(errno));
-				sleep(1);
 			}
 		}
-	}
-	if(out != NULL)
-		fclose(out);
-	if(fp != NULL)
-		fclose(fp);
-	/*if(outResult!=NULL)
-	   fclose(outResult); */
-
 
+		list_clear(acl, free);
+		list_delete(acl);
+	}
 
+	for(i = 1; i < ntargets; i++) {
+		if(targets[i].state == TARGET_STATE_COMPLETE)
+			continue;
+		if(targets[i].items_present || targets[i].failures) {
+			/* clean up partial copies so that nothing looks complete when it is not */
+			chirp_reli_rmall(targets[i].name, sourcepath, compute_stoptime());
+		}
+	}
 
 	failure_matrix_print();
-	//end_time = time(0);
 
 	return 0;
 }
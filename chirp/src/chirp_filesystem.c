@@ -449,6 +449,56 @@ INT64_T cfs_basic_fchown(int fd, INT64_T uid, INT64_T gid)
 	return 0;
 }
 
+/* Send length bytes from the start of fd over the link; short if the file ends early. */
+INT64_T cfs_basic_getfile(int fd, struct link *l, INT64_T length, time_t stoptime)
+{
+	INT64_T total = 0;
+
+	while(total < length) {
+		char buffer[65536];
+		INT64_T chunk = MIN((INT64_T)sizeof(buffer), length-total);
+
+		INT64_T ractual = cfs->pread(fd, buffer, chunk, total);
+		if(ractual <= 0)
+			break;
+
+		if(link_putlstring(l, buffer, ractual, stoptime) != ractual)
+			return -1;
+
+		total += ractual;
+	}
+
+	return total;
+}
+
+/* Receive length bytes from the link into the start of fd. If fd fails, the
+ * rest of the data is still read off the link so the connection stays in step. */
+INT64_T cfs_basic_putfile(int fd, struct link *l, INT64_T length, time_t stoptime)
+{
+	INT64_T total = 0;
+
+	while(total < length) {
+		char buffer[65536];
+		INT64_T chunk = MIN((INT64_T)sizeof(buffer), length-total);
+
+		INT64_T ractual = link_read(l, buffer, chunk, stoptime);
+		if(ractual <= 0)
+			return -1;
+
+		INT64_T wactual = cfs->pwrite(fd, buffer, ractual, total);
+		if(wactual != ractual) {
+			int saved = errno;
+			link_soak(l, length-total-ractual, stoptime);
+			errno = saved;
+			return -1;
+		}
+
+		total += ractual;
+	}
+
+	return total;
+}
+
 INT64_T cfs_basic_hash(const char *path, const char *algorithm, unsigned char digest[CHIRP_DIGEST_MAX])
 {
 	int fd;
@@ -41,6 +41,8 @@ struct chirp_filesystem {
 	INT64_T (*fchmod)    ( int fd, INT64_T mode );
 	INT64_T (*ftruncate) ( int fd, INT64_T length );
 	INT64_T (*fsync)     ( int fd );
+	INT64_T (*getfile)   ( int fd, struct link *l, INT64_T length, time_t stoptime );
+	INT64_T (*putfile)   ( int fd, struct link *l, INT64_T length, time_t stoptime );
 
 	INT64_T (*search) ( const char *subject, const char *dir, const char *patt, int flags, struct link *l, time_t stoptime );
 
@@ -110,8 +112,10 @@ int         cfs_isnotdir(const char *filename);
 /* "basic" implementation made of primitives for operations the backend FS does not implement */
 INT64_T cfs_basic_chown(const char *path, INT64_T uid, INT64_T gid);
 INT64_T cfs_basic_fchown(int fd, INT64_T uid, INT64_T gid);
+INT64_T cfs_basic_getfile(int fd, struct link *l, INT64_T length, time_t stoptime);
 INT64_T cfs_basic_hash (const char *path, const char *algorithm, unsigned char digest[CHIRP_DIGEST_MAX]);
 INT64_T cfs_basic_lchown(const char *path, INT64_T uid, INT64_T gid);
+INT64_T cfs_basic_putfile(int fd, struct link *l, INT64_T length, time_t stoptime);
 INT64_T cfs_basic_rmall(const char *path);
 INT64_T cfs_basic_search(const char *subject, const char *dir, const char *patt, int flags, struct link *l, time_t stoptime);
 INT64_T cfs_basic_sread(int fd, void *vbuffer, INT64_T length, INT64_T stride_length, INT64_T stride_skip, INT64_T offset);
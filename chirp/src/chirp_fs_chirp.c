@@ -421,6 +421,8 @@ struct chirp_filesystem chirp_fs_chirp = {
 	chirp_fs_chirp_fchmod,
 	chirp_fs_chirp_ftruncate,
 	chirp_fs_chirp_fsync,
+	cfs_basic_getfile,
+	cfs_basic_putfile,
 
 	/* TODO ideally we'd pass this on to the proxy, but we'd have to deal with buffers/links. */
 	cfs_basic_search,
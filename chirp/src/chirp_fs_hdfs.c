@@ -724,6 +724,8 @@ struct chirp_filesystem chirp_fs_hdfs = {
 	chirp_fs_hdfs_fchmod,
 	chirp_fs_hdfs_ftruncate,
 	chirp_fs_hdfs_fsync,
+	cfs_basic_getfile,
+	cfs_basic_putfile,
 
 	cfs_basic_search,
 
@@ -19,6 +19,7 @@ See the file COPYING for details.
 #include "xxmalloc.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <utime.h>
 
@@ -496,6 +497,40 @@ static INT64_T chirp_fs_local_fsync(int fd)
 	PROLOGUE
 }
 
+/* Whole-file transfers move data between the file and the socket in the kernel. */
+
+static INT64_T chirp_fs_local_getfile(int fd, struct link *l, INT64_T length, time_t stoptime)
+{
+	PREAMBLE("getfile(%d, %" PRId64 ")", fd, length);
+	SETUP_FILE
+	lseek(lfd, 0, SEEK_SET);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(lfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	rc = link_stream_from_fd(l, lfd, length, stoptime);
+	PROLOGUE
+}
+
+static INT64_T chirp_fs_local_putfile(int fd, struct link *l, INT64_T length, time_t stoptime)
+{
+	PREAMBLE("putfile(%d, %" PRId64 ")", fd, length);
+	SETUP_FILE
+	lseek(lfd, 0, SEEK_SET);
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(lfd, 0, length, POSIX_FADV_SEQUENTIAL);
+#endif
+	uint64_t start = link_bytes_read(l);
+	rc = link_stream_to_fd(l, lfd, length, stoptime);
+	if(rc != length) {
+		/* keep the connection in step if the file could not take all the data */
+		int saved = errno;
+		link_soak(l, length - (INT64_T)(link_bytes_read(l) - start), stoptime);
+		errno = saved;
+		rc = -1;
+	}
+	PROLOGUE
+}
+
 static INT64_T chirp_fs_local_unlink(const char *path)
 {
 	PREAMBLE("unlink(`%s')", path);
@@ -1055,6 +1090,8 @@ struct chirp_filesystem chirp_fs_local = {
 	chirp_fs_local_fchmod,
 	chirp_fs_local_ftruncate,
 	chirp_fs_local_fsync,
+	chirp_fs_local_getfile,
+	chirp_fs_local_putfile,
 
 	cfs_basic_search,
 
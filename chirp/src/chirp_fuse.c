@@ -26,13 +26,17 @@ This module written by James Fitzgerald, B.S. 2006.
 #include "auth_all.h"
 #include "cctools.h"
 #include "debug.h"
+#include "hash_table.h"
 #include "itable.h"
+#include "path.h"
 #include "stringtools.h"
 #include "string_array.h"
+#include "timestamp.h"
 #include "xxmalloc.h"
 #include "getopt_aux.h"
 
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,8 +47,108 @@ static int run_in_foreground = 0;
 static struct itable *file_table = 0;
 static int enable_small_file_optimizations = 1;
 
+static double attr_timeout = 1.0;
+static double entry_timeout = 1.0;
+static int enable_kernel_cache = 1;
+static int run_multi_threaded = 0;
+
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+Attributes returned by getattr and by directory listings are kept for
+attr_timeout seconds, so that a listing followed by a stat of every entry
+(as in ls -l) costs one round trip rather than one per entry.  The cache
+has its own lock, so that hits are served while another thread waits on
+the network.
+*/
+
+#define ATTR_CACHE_MAX 65536
+
+struct attr_entry {
+	struct stat info;
+	timestamp_t expires;
+};
+
+static struct hash_table *attr_table = 0;
+static pthread_mutex_t attr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void attr_cache_clear_locked(void)
+{
+	char *key;
+	struct attr_entry *e;
+
+	hash_table_firstkey(attr_table);
+	while(hash_table_nextkey(attr_table, &key, (void **) &e)) {
+		hash_table_remove(attr_table, key);
+		free(e);
+	}
+}
+
+static void attr_cache_insert(const char *path, struct stat *info)
+{
+	struct attr_entry *e;
+
+	if(attr_timeout <= 0)
+		return;
+
+	pthread_mutex_lock(&attr_mutex);
+	e = hash_table_lookup(attr_table, path);
+	if(!e) {
+		if(hash_table_size(attr_table) >= ATTR_CACHE_MAX)
+			attr_cache_clear_locked();
+		e = xxmalloc(sizeof(*e));
+		hash_table_insert(attr_table, path, e);
+	}
+	e->info = *info;
+	e->expires = timestamp_get() + attr_timeout * 1000000;
+	pthread_mutex_unlock(&attr_mutex);
+}
+
+static int attr_cache_lookup(const char *path, struct stat *info)
+{
+	struct attr_entry *e;
+	int found = 0;
+
+	pthread_mutex_lock(&attr_mutex);
+	e = hash_table_lookup(attr_table, path);
+	if(e) {
+		if(e->expires > timestamp_get()) {
+			*info = e->info;
+			found = 1;
+		} else {
+			hash_table_remove(attr_table, path);
+			free(e);
+		}
+	}
+	pthread_mutex_unlock(&attr_mutex);
+
+	return found;
+}
+
+/* Forget a changed path, along with its parent, whose times and link count change with it. */
+static void attr_cache_invalidate(const char *path)
+{
+	char parent[CHIRP_PATH_MAX];
+	struct attr_entry *e;
+
+	path_dirname(path, parent);
+
+	pthread_mutex_lock(&attr_mutex);
+	if((e = hash_table_remove(attr_table, path)))
+		free(e);
+	if((e = hash_table_remove(attr_table, parent)))
+		free(e);
+	pthread_mutex_unlock(&attr_mutex);
+}
+
+/* Forget everything, for changes that may affect the names below a directory. */
+static void attr_cache_clear(void)
+{
+	pthread_mutex_lock(&attr_mutex);
+	attr_cache_clear_locked();
+	pthread_mutex_unlock(&attr_mutex);
+}
+
 static void parsepath(const char *path, char *newpath, char *host)
 {
 	memset(newpath, 0, CHIRP_PATH_MAX);
@@ -93,6 +197,9 @@ static int chirp_fuse_getattr(const char *path, struct stat *info)
 	char newpath[CHIRP_PATH_MAX];
 	char host[CHIRP_PATH_MAX];
 
+	if(attr_cache_lookup(path, info))
+		return 0;
+
 	parsepath(path, newpath, host);
 
 	pthread_mutex_lock(&mutex);
@@ -102,6 +209,7 @@ static int chirp_fuse_getattr(const char *path, struct stat *info)
 	if(result < 0)
 		return -errno;
 	chirp_stat_to_fuse_stat(&cinfo, info);
+	attr_cache_insert(path, info);
 	return 0;
 }
 
@@ -123,30 +231,43 @@ static int chirp_fuse_readlink(const char *path, char *buf, size_t size)
 	return 0;
 }
 
-static fuse_fill_dir_t longdir_filler;
-static void *longdir_buf;
+struct longdir_args {
+	const char *path;
+	fuse_fill_dir_t filler;
+	void *buf;
+};
 
 static void longdir_callback(const char *name, struct chirp_stat *cinfo, void *arg)
 {
+	struct longdir_args *args = arg;
+	char path[CHIRP_PATH_MAX];
 	struct stat info;
+
 	chirp_stat_to_fuse_stat(cinfo, &info);
-	longdir_filler(longdir_buf, name, &info, 0);
+	args->filler(args->buf, name, &info, 0);
+
+	if(strcmp(name, ".") && strcmp(name, "..")) {
+		string_nformat(path, sizeof(path), "%s/%s", strcmp(args->path, "/") ? args->path : "", name);
+		attr_cache_insert(path, &info);
+	}
 }
 
 static int chirp_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi)
 {
 	char newpath[CHIRP_PATH_MAX];
 	char host[CHIRP_PATH_MAX];
+	struct longdir_args args;
 	int result;
 
 	parsepath(path, newpath, host);
 
-	pthread_mutex_lock(&mutex);
+	args.path = path;
+	args.filler = filler;
+	args.buf = buf;
 
-	longdir_buf = buf;
-	longdir_filler = filler;
+	pthread_mutex_lock(&mutex);
 
-	result = chirp_global_getlongdir(host, newpath, longdir_callback, 0, time(0) + chirp_fuse_timeout);
+	result = chirp_global_getlongdir(host, newpath, longdir_callback, &args, time(0) + chirp_fuse_timeout);
 
 	pthread_mutex_unlock(&mutex);
 
@@ -167,6 +288,7 @@ static int chirp_fuse_mkdir(const char *path, mode_t mode)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_mkdir(host, newpath, mode, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -187,6 +309,7 @@ static int chirp_fuse_unlink(const char *path)
 		result = chirp_global_unlink(host, newpath, time(0) + chirp_fuse_timeout);
 	}
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -207,6 +330,7 @@ static int chirp_fuse_rmdir(const char *path)
 		result = chirp_global_rmdir(host, newpath, time(0) + chirp_fuse_timeout);
 	}
 	pthread_mutex_unlock(&mutex);
+	attr_cache_clear();
 
 	if(result < 0)
 		return -errno;
@@ -227,6 +351,7 @@ static int chirp_fuse_symlink(const char *source, const char *target)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_symlink(host, source, dest_path, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(target);
 
 	if(result < 0)
 		return -errno;
@@ -244,6 +369,7 @@ static int chirp_fuse_rename(const char *from, const char *to)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_rename(host, frompath, topath, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_clear();
 
 	if(result < 0)
 		return -errno;
@@ -261,6 +387,8 @@ static int chirp_fuse_link(const char *from, const char *to)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_link(host, frompath, topath, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(from);
+	attr_cache_invalidate(to);
 
 	if(result < 0)
 		return -errno;
@@ -277,6 +405,7 @@ static int chirp_fuse_chmod(const char *path, mode_t mode)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_chmod(host, newpath, mode, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -294,6 +423,7 @@ static int chirp_fuse_chown(const char *path, uid_t uid, gid_t gid)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_chown(host, newpath, uid, gid, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -311,6 +441,7 @@ static int chirp_fuse_truncate(const char *path, off_t size)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_truncate(host, newpath, size, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -359,6 +490,7 @@ static int chirp_fuse_utime(const char *path, struct utimbuf *buf)
 	pthread_mutex_lock(&mutex);
 	result = chirp_global_utime(host, newpath, buf->actime, buf->modtime, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -378,6 +510,9 @@ static int chirp_fuse_open(const char *path, struct fuse_file_info *fi)
 
 	parsepath(path, newpath, host);
 
+	if(fi->flags & O_TRUNC)
+		attr_cache_invalidate(path);
+
 	pthread_mutex_lock(&mutex);
 	file = chirp_global_open(host, newpath, fi->flags, mode, time(0) + chirp_fuse_timeout);
 	if(file) {
@@ -414,6 +549,10 @@ static int chirp_fuse_release(const char *path, struct fuse_file_info *fi)
 
 	pthread_mutex_unlock(&mutex);
 
+	/* buffered writes reach the server at close */
+	if((fi->flags & O_ACCMODE) != O_RDONLY)
+		attr_cache_invalidate(path);
+
 	return result;
 }
 
@@ -456,6 +595,7 @@ static int chirp_fuse_write(const char *path, const char *buf, size_t size, off_
 	}
 
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(result < 0)
 		return -errno;
@@ -474,6 +614,7 @@ static int chirp_fuse_mknod(const char *path, mode_t mode, dev_t rdev)
 	pthread_mutex_lock(&mutex);
 	file = chirp_global_open(host, newpath, O_CREAT | O_WRONLY, mode, time(0) + chirp_fuse_timeout);
 	pthread_mutex_unlock(&mutex);
+	attr_cache_invalidate(path);
 
 	if(!file)
 		return -errno;
@@ -577,12 +718,16 @@ static void show_help(const char *cmd)
 	fprintf(stdout, "use: %s <mountpath>\n", cmd);
 	fprintf(stdout, "where options are:\n");
 	fprintf(stdout, " %-30s Require this authentication mode.\n", "-a,--auth=<flag>");
+	fprintf(stdout, " %-30s Cache file attributes for this many seconds. (default is %gs)\n", "   --attr-timeout=<secs>", attr_timeout);
 	fprintf(stdout, " %-30s Block size for network I/O. (default is %ds)\n", "-b,--block-size=<bytes>", (int) chirp_reli_blocksize_get());
 	fprintf(stdout, " %-30s Enable debugging for this subsystem.\n", "-d,--debug=<flag>");
 	fprintf(stdout, " %-30s Disable small file optimizations such as recursive delete.\n", "-D,--no-optimize");
+	fprintf(stdout, " %-30s Cache name lookups for this many seconds. (default is %gs)\n", "   --entry-timeout=<secs>", entry_timeout);
 	fprintf(stdout, " %-30s Run in foreground for debugging.\n", "-f,--foreground");
 	fprintf(stdout, " %-30s Comma-delimited list of tickets to use for authentication.\n", "-i,--tickets=<files>");
 	fprintf(stdout, " %-30s Mount options passed to FUSE.\n", "-m,--mount-options=<options>");
+	fprintf(stdout, " %-30s Handle several FUSE requests at once. (experimental)\n", "   --multi-threaded");
+	fprintf(stdout, " %-30s Do not keep file data in the kernel page cache across opens.\n", "   --no-kernel-cache");
 	fprintf(stdout, " %-30s Send debugging to this file. (can also be :stderr, or :stdout)\n", "-o,--debug-file=<file>");
 	fprintf(stdout, " %-30s Timeout for network operations. (default is %ds)\n", "-t,--timeout=<timeout>", chirp_fuse_timeout);
 	fprintf(stdout, " %-30s Show program version.\n", "-v,--version");
@@ -591,17 +736,27 @@ static void show_help(const char *cmd)
 
 int main(int argc, char *argv[])
 {
-	signed char c;
+	enum {
+		LONGOPT_ATTR_TIMEOUT    = INT_MAX-0,
+		LONGOPT_ENTRY_TIMEOUT   = INT_MAX-1,
+		LONGOPT_NO_KERNEL_CACHE = INT_MAX-2,
+		LONGOPT_MULTI_THREADED = INT_MAX-3,
+	};
+
+	int c;
 	int did_explicit_auth = 0;
 	char *tickets = NULL;
+	char cache_options[256];
 	struct fuse_args fa;
-	fa.argc = 0;
-	fa.argv = string_array_new();
+	/* FUSE takes the first argument to be the program name */
+	fa.argc = 1;
+	fa.argv = string_array_append(string_array_new(), argv[0]);
 	fa.allocated = 1;
 
 	debug_config(argv[0]);
 
 	static const struct option long_options[] = {
+		{"attr-timeout", required_argument, 0, LONGOPT_ATTR_TIMEOUT},
 		{"auth", required_argument, 0, 'a'},
 		{"block-size", required_argument, 0, 'b'},
 		{"debug", required_argument, 0, 'd'},
@@ -610,6 +765,9 @@ int main(int argc, char *argv[])
 		{"tickets", required_argument, 0, 'i'},
 		{"mount-options", required_argument, 0, 'm'},
 		{"debug-file", required_argument, 0, 'o'},
+		{"entry-timeout", required_argument, 0, LONGOPT_ENTRY_TIMEOUT},
+		{"no-kernel-cache", no_argument, 0, LONGOPT_NO_KERNEL_CACHE},
+		{"multi-threaded", no_argument, 0, LONGOPT_MULTI_THREADED},
 		{"timeout", required_argument, 0, 't'},
 		{"version", no_argument, 0, 'v'},
 		{"help", no_argument, 0, 'h'},
@@ -648,6 +806,18 @@ int main(int argc, char *argv[])
 		case 'f':
 			run_in_foreground = 1;
 			break;
+		case LONGOPT_ATTR_TIMEOUT:
+			attr_timeout = atof(optarg);
+			break;
+		case LONGOPT_ENTRY_TIMEOUT:
+			entry_timeout = atof(optarg);
+			break;
+		case LONGOPT_NO_KERNEL_CACHE:
+			enable_kernel_cache = 0;
+			break;
+		case LONGOPT_MULTI_THREADED:
+			run_multi_threaded = 1;
+			break;
 		case 'v':
 			cctools_version_print(stdout, argv[0]);
 			return 0;
@@ -681,6 +851,19 @@ int main(int argc, char *argv[])
 	}
 
 	file_table = itable_create(0);
+	attr_table = hash_table_create(0, 0);
+
+	/*
+	auto_cache keeps file data in the page cache across opens,
+	until the remote mtime or size is seen to change.
+	*/
+	string_nformat(cache_options, sizeof(cache_options), "-oattr_timeout=%g,entry_timeout=%g%s", attr_timeout, entry_timeout, enable_kernel_cache ? ",auto_cache" : "");
+#if FUSE_VERSION >= 28
+	/* let writes through in blocks larger than a page */
+	strcat(cache_options, ",big_writes");
+#endif
+	fa.argc += 1;
+	fa.argv = string_array_append(fa.argv, cache_options);
 
 	signal(SIGHUP, exit_handler);
 	signal(SIGINT, exit_handler);
@@ -711,7 +894,11 @@ int main(int argc, char *argv[])
 	if(!run_in_foreground)
 		daemon(0, 0);
 
-	fuse_loop(fuse_instance);
+	if(run_multi_threaded) {
+		fuse_loop_mt(fuse_instance);
+	} else {
+		fuse_loop(fuse_instance);
+	}
 
 	fuse_unmount(fuse_mountpoint, fuse_chan);
 	fuse_destroy(fuse_instance);
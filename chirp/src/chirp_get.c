@@ -33,6 +33,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Require this authentication mode.\n", "-a,--auth=<flag>");
 	fprintf(stdout, " %-30s Enable debugging for this subsystem.\n", "-d,--debug <flag>");
 	fprintf(stdout, " %-30s Comma-delimited list of tickets to use for authentication.\n", "-i,--tickets=<files>");
+	fprintf(stdout, " %-30s Move large files over this many parallel connections. (default is 1)\n", "-p,--parallel=<n>");
 	fprintf(stdout, " %-30s Timeout for failure. (default is %ds)\n", "-t,--timeout=<time>", timeout);
 	fprintf(stdout, " %-30s Show program version.\n", "-v,--version");
 	fprintf(stdout, " %-30s This message.\n", "-h,--help");
@@ -55,13 +56,14 @@ int main(int argc, char *argv[])
 		{"auth", required_argument, 0, 'a'},
 		{"debug", required_argument, 0, 'd'},
 		{"tickets", required_argument, 0, 'i'},
+		{"parallel", required_argument, 0, 'p'},
 		{"timeout", required_argument, 0, 't'},
 		{"version", no_argument, 0, 'v'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "a:d:i:t:vh", long_options, NULL)) > -1) {
+	while((c = getopt_long(argc, argv, "a:d:i:p:t:vh", long_options, NULL)) > -1) {
 		switch (c) {
 		case 'a':
 			if (!auth_register_byname(optarg))
@@ -74,6 +76,9 @@ int main(int argc, char *argv[])
 		case 'i':
 			tickets = strdup(optarg);
 			break;
+		case 'p':
+			chirp_recursive_set_streams(atoi(optarg));
+			break;
 		case 't':
 			timeout = string_time_parse(optarg);
 			break;
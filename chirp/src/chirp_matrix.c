@@ -12,6 +12,7 @@ See the file COPYING for details.
 #include "username.h"
 #include "stringtools.h"
 #include "macros.h"
+#include "itable.h"
 
 #include <time.h>
 #include <stdio.h>
@@ -25,6 +26,14 @@ See the file COPYING for details.
 #define SEPCHARS " \n"
 #define SEPCHARS2 "/"
 
+/* Largest read or write a Chirp server accepts in one request. */
+#define MATRIX_REQUEST_MAX (16*1024*1024)
+
+struct matrix_row {
+	char *data;
+	UINT64_T last_used;
+};
+
 struct chirp_matrix {
 	int width;
 	int height;
@@ -34,6 +43,16 @@ struct chirp_matrix {
 	int n_row_per_file;
 	struct chirp_file **rfiles;
 	struct chirp_bulkio *bulkio;
+
+	/* Rows kept by the client, by row number, with the least recently used evicted beyond cache_rows. */
+	struct itable *cache;
+	int cache_rows;
+	UINT64_T cache_clock;
+
+	/* Requests of the current range operation, one or more per file covered. */
+	struct chirp_bulkio *requests;
+	int nrequests;
+	int requests_max;
 };
 
 
@@ -169,7 +188,7 @@ struct chirp_matrix *chirp_matrix_open(const char *host, const char *path, time_
 	char *tmp;
 	struct chirp_matrix *matrix;
 
-	matrix = xxmalloc(sizeof(*matrix));
+	matrix = xxcalloc(1, sizeof(*matrix));
 
 	result = chirp_reli_getfile_buffer(host, path, &line, stoptime);
 	if(result < 0) {
@@ -209,6 +228,7 @@ struct chirp_matrix *chirp_matrix_open(const char *host, const char *path, time_
 
 	free(line);
 
+	matrix->cache = itable_create(0);
 
 	return matrix;
 }
@@ -239,55 +259,220 @@ int chirp_matrix_nfiles(struct chirp_matrix *a)
 	return a->nfiles;
 }
 
-int chirp_matrix_get(struct chirp_matrix *a, int i, int j, void *data, time_t stoptime)
+/*
+The rows of the matrix are divided into files of n_row_per_file rows,
+which are spread over the hosts in turn.  A range of rows is accessed
+with one request per file covered, or more if larger than a server
+accepts, and the requests are issued together with chirp_reli_bulkio,
+so that all of the hosts serve them at once.  Rows within a file are
+contiguous, so a range of full rows is one plain read or write, and
+a narrower range is one strided read or write.
+*/
+
+static void matrix_request(struct chirp_matrix *a, chirp_bulkio_t type, int file, char *buffer, INT64_T length, INT64_T stride_length, INT64_T stride_skip, INT64_T offset)
 {
-	int index = i / a->n_row_per_file;
-	INT64_T offset = ((i % a->n_row_per_file) * a->width + j) * a->element_size;
-	return chirp_reli_pread_unbuffered(a->rfiles[index], data, a->element_size, offset, stoptime);
+	if(a->nrequests == a->requests_max) {
+		a->requests_max = MAX(a->requests_max * 2, a->nfiles);
+		a->requests = xxrealloc(a->requests, a->requests_max * sizeof(*a->requests));
+	}
+
+	struct chirp_bulkio *b = &a->requests[a->nrequests++];
+	memset(b, 0, sizeof(*b));
+	b->type = type;
+	b->file = a->rfiles[file];
+	b->buffer = buffer;
+	b->length = length;
+	b->stride_length = stride_length;
+	b->stride_skip = stride_skip;
+	b->offset = offset;
 }
 
-int chirp_matrix_get_row(struct chirp_matrix *a, int j, void *data, time_t stoptime)
+static void matrix_plan_range(struct chirp_matrix *a, int write, int x, int y, int width, int height, char *data)
 {
-	int index = j / a->n_row_per_file;
-	INT64_T offset = (j % a->n_row_per_file) * a->width * a->element_size;
-	return chirp_reli_pread_unbuffered(a->rfiles[index], data, a->element_size * a->width, offset, stoptime);
+	INT64_T row_length = (INT64_T) a->width * a->element_size;
+	INT64_T length = (INT64_T) width * a->element_size;
+	int r = y;
+
+	while(r < y + height) {
+		int file = r / a->n_row_per_file;
+		int last = MIN(y + height, (file + 1) * a->n_row_per_file);
+		INT64_T offset = (r % a->n_row_per_file) * row_length + (INT64_T) x * a->element_size;
+		char *buffer = data + (r - y) * length;
+
+		if(length > MATRIX_REQUEST_MAX) {
+			/* Rows too long for one request are split, each row on its own. */
+			INT64_T done;
+			for(done = 0; done < length; done += MATRIX_REQUEST_MAX) {
+				matrix_request(a, write ? CHIRP_BULKIO_PWRITE : CHIRP_BULKIO_PREAD, file, buffer + done, MIN(length - done, MATRIX_REQUEST_MAX), 0, 0, offset + done);
+			}
+			r++;
+			continue;
+		}
+
+		int nrows = MIN(last - r, MATRIX_REQUEST_MAX / length);
+		if(width == a->width) {
+			matrix_request(a, write ? CHIRP_BULKIO_PWRITE : CHIRP_BULKIO_PREAD, file, buffer, nrows * length, 0, 0, offset);
+		} else {
+			matrix_request(a, write ? CHIRP_BULKIO_SWRITE : CHIRP_BULKIO_SREAD, file, buffer, nrows * length, length, row_length, offset);
+		}
+		r += nrows;
+	}
 }
 
-int chirp_matrix_set(struct chirp_matrix *a, int i, int j, const void *data, time_t stoptime)
+static int matrix_run_requests(struct chirp_matrix *a, time_t stoptime)
+{
+	int count = a->nrequests;
+	a->nrequests = 0;
+
+	if(chirp_reli_bulkio(a->requests, count, stoptime) < 0)
+		return -1;
+
+	int i;
+	for(i = 0; i < count; i++) {
+		struct chirp_bulkio *b = &a->requests[i];
+		if(b->result != b->length) {
+			errno = b->result < 0 ? b->errnum : EIO;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+The row cache keeps whole rows, and is written through, so that it
+always agrees with the writes of this client.  Writes of other clients
+to the same matrix are not seen in rows already cached.
+*/
+
+static void matrix_cache_trim(struct chirp_matrix *a, int nrows)
 {
-	int index = i / a->n_row_per_file;
-	INT64_T offset = ((i % a->n_row_per_file) * a->width + j) * a->element_size;
-	return chirp_reli_pwrite_unbuffered(a->rfiles[index], data, sizeof(data), offset, stoptime);
+	while(itable_size(a->cache) > nrows) {
+		UINT64_T y, oldest_y = 0;
+		struct matrix_row *row, *oldest = 0;
+		ITABLE_ITERATE(a->cache, y, row) {
+			if(!oldest || row->last_used < oldest->last_used) {
+				oldest = row;
+				oldest_y = y;
+			}
+		}
+		itable_remove(a->cache, oldest_y);
+		free(oldest->data);
+		free(oldest);
+	}
 }
 
-int chirp_matrix_set_row(struct chirp_matrix *a, int j, const void *data, time_t stoptime)
+void chirp_matrix_set_row_cache(struct chirp_matrix *a, int nrows)
 {
-	int index = j / a->n_row_per_file;
-	INT64_T offset = (j % a->n_row_per_file) * a->width * a->element_size;
-	return chirp_reli_pwrite_unbuffered(a->rfiles[index], data, a->element_size * a->width, offset, stoptime);
+	a->cache_rows = MAX(nrows, 0);
+	matrix_cache_trim(a, a->cache_rows);
 }
 
-int chirp_matrix_set_range(struct chirp_matrix *a, int x, int y, int width, int height, const void *data, time_t stoptime)
+static struct matrix_row *matrix_cache_lookup(struct chirp_matrix *a, int y)
 {
-	if(x < 0 || y < 0 || width < 1 || height < 1 || (x + width) > a->width || (y + height) > a->height) {
-		errno = EINVAL;
-		return -1;
+	struct matrix_row *row = itable_lookup(a->cache, y);
+	if(row)
+		row->last_used = ++a->cache_clock;
+	return row;
+}
+
+static void matrix_cache_insert(struct chirp_matrix *a, int y, const char *data)
+{
+	if(a->cache_rows < 1)
+		return;
+
+	INT64_T row_length = (INT64_T) a->width * a->element_size;
+	struct matrix_row *row = itable_lookup(a->cache, y);
+
+	if(!row) {
+		matrix_cache_trim(a, a->cache_rows - 1);
+		row = xxmalloc(sizeof(*row));
+		row->data = xxmalloc(row_length);
+		itable_insert(a->cache, y, row);
+	}
+
+	memcpy(row->data, data, row_length);
+	row->last_used = ++a->cache_clock;
+}
+
+/* Update the cached rows covered by a write of this client. */
+
+static void matrix_cache_update(struct chirp_matrix *a, int x, int y, int width, int height, const char *data)
+{
+	if(itable_size(a->cache) == 0)
+		return;
+
+	INT64_T length = (INT64_T) width * a->element_size;
+	int j;
+	for(j = 0; j < height; j++) {
+		struct matrix_row *row = itable_lookup(a->cache, y + j);
+		if(row)
+			memcpy(row->data + (INT64_T) x * a->element_size, data + j * length, length);
 	}
+}
+
+/*
+With the row cache, a range is served from the cached rows, and the
+runs of rows missing are read whole, so as to be cached in turn.
+*/
 
-	int j = 0;
-	const char *cdata = data;
+static int matrix_get_range_cached(struct chirp_matrix *a, int x, int y, int width, int height, char *data, time_t stoptime)
+{
+	INT64_T row_length = (INT64_T) a->width * a->element_size;
+	INT64_T length = (INT64_T) width * a->element_size;
 
+	int nmissing = 0;
+	int j;
 	for(j = 0; j < height; j++) {
-		int index = (y + j) / a->n_row_per_file;
-		INT64_T file_offset = (x + ((y + j) % a->n_row_per_file) * a->width) * a->element_size;
-		INT64_T buffer_offset = (j * width) * a->element_size;
-		INT64_T length = width * a->element_size;
-		INT64_T result = chirp_reli_pwrite_unbuffered(a->rfiles[index], &cdata[buffer_offset], length, file_offset, stoptime);
-		if(result != length)
+		if(!itable_lookup(a->cache, y + j))
+			nmissing++;
+	}
+
+	char *rows = 0;
+	int *missing = 0;
+	if(nmissing > 0) {
+		rows = xxmalloc(nmissing * row_length);
+		missing = xxmalloc(nmissing * sizeof(*missing));
+		int n = 0;
+		for(j = 0; j < height; j++) {
+			if(itable_lookup(a->cache, y + j))
+				continue;
+			int run = 1;
+			while(j + run < height && !itable_lookup(a->cache, y + j + run))
+				run++;
+			matrix_plan_range(a, 0, 0, y + j, a->width, run, rows + n * row_length);
+			n += run;
+			j += run - 1;
+		}
+
+		if(matrix_run_requests(a, stoptime) < 0) {
+			free(rows);
+			free(missing);
 			return -1;
+		}
 	}
 
-	return j * width * a->element_size;
+	int n = 0;
+	for(j = 0; j < height; j++) {
+		struct matrix_row *row = matrix_cache_lookup(a, y + j);
+		const char *source;
+		if(row) {
+			source = row->data;
+		} else {
+			missing[n] = y + j;
+			source = rows + (n++) * row_length;
+		}
+		memcpy(data + j * length, source + (INT64_T) x * a->element_size, length);
+	}
+
+	/* Rows are cached only once copied out, as caching may evict rows still to be copied. */
+	for(n = 0; n < nmissing; n++) {
+		matrix_cache_insert(a, missing[n], rows + n * row_length);
+	}
+
+	free(rows);
+	free(missing);
+	return height * length;
 }
 
 int chirp_matrix_get_range(struct chirp_matrix *a, int x, int y, int width, int height, void *data, time_t stoptime)
@@ -297,61 +482,72 @@ int chirp_matrix_get_range(struct chirp_matrix *a, int x, int y, int width, int
 		return -1;
 	}
 
-	int j = 0;
-	char *cdata = data;
+	if(a->cache_rows > 0)
+		return matrix_get_range_cached(a, x, y, width, height, data, stoptime);
 
-	for(j = 0; j < height; j++) {
-		int index = (y + j) / a->n_row_per_file;
-		INT64_T file_offset = (x + ((y + j) % a->n_row_per_file) * a->width) * a->element_size;
-		INT64_T buffer_offset = (j * width) * a->element_size;
-		INT64_T length = width * a->element_size;
-		INT64_T result = chirp_reli_pread_unbuffered(a->rfiles[index], &cdata[buffer_offset], length, file_offset, stoptime);
-		if(result != length)
-			return -1;
-	}
+	matrix_plan_range(a, 0, x, y, width, height, data);
+	if(matrix_run_requests(a, stoptime) < 0)
+		return -1;
 
-	return j * width * a->element_size;
+	return height * width * a->element_size;
 }
 
-int chirp_matrix_get_col(struct chirp_matrix *a, int i, void *data, time_t stoptime)
+int chirp_matrix_set_range(struct chirp_matrix *a, int x, int y, int width, int height, const void *data, time_t stoptime)
 {
-	INT64_T offset = i * a->element_size;
-	int length = a->element_size * a->n_row_per_file;
-	int j;
-
-	for(j = 0; j < a->nfiles; j++) {
-		struct chirp_bulkio *b = &a->bulkio[j];
-		b->type = CHIRP_BULKIO_SREAD;
-		b->file = a->rfiles[j];
-		b->buffer = (char *) data + j * length;	//Previously void arithmetic!
-		b->length = a->n_row_per_file * a->element_size;
-		b->stride_length = a->element_size;
-		b->stride_skip = a->element_size * a->width;
-		b->offset = offset;
+	if(x < 0 || y < 0 || width < 1 || height < 1 || (x + width) > a->width || (y + height) > a->height) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	return chirp_reli_bulkio(a->bulkio, a->nfiles, stoptime);
+	/* The requests only read from the buffer when writing. */
+	matrix_plan_range(a, 1, x, y, width, height, (char *) data);
+	if(matrix_run_requests(a, stoptime) < 0)
+		return -1;
+
+	matrix_cache_update(a, x, y, width, height, data);
+
+	return height * width * a->element_size;
 }
 
+int chirp_matrix_get(struct chirp_matrix *a, int i, int j, void *data, time_t stoptime)
+{
+	return chirp_matrix_get_range(a, j, i, 1, 1, data, stoptime);
+}
 
-int chirp_matrix_set_col(struct chirp_matrix *a, int i, const void *data, time_t stoptime)
+int chirp_matrix_get_row(struct chirp_matrix *a, int j, void *data, time_t stoptime)
 {
-	INT64_T offset = i * a->element_size;
-	int length = a->element_size * a->n_row_per_file;
-	int j;
+	return chirp_matrix_get_range(a, 0, j, a->width, 1, data, stoptime);
+}
 
-	for(j = 0; j < a->nfiles; j++) {
-		struct chirp_bulkio *b = &a->bulkio[j];
-		b->type = CHIRP_BULKIO_SWRITE;
-		b->file = a->rfiles[j];
-		b->buffer = (char *) data + j * length;
-		b->length = a->n_row_per_file * a->element_size;
-		b->stride_length = a->element_size;
-		b->stride_skip = a->element_size * a->width;
-		b->offset = offset;
+int chirp_matrix_set(struct chirp_matrix *a, int i, int j, const void *data, time_t stoptime)
+{
+	return chirp_matrix_set_range(a, j, i, 1, 1, data, stoptime);
+}
+
+int chirp_matrix_set_row(struct chirp_matrix *a, int j, const void *data, time_t stoptime)
+{
+	return chirp_matrix_set_range(a, 0, j, a->width, 1, data, stoptime);
+}
+
+/* A column is read from the hosts directly, as reading it through the row cache would read every row. */
+
+int chirp_matrix_get_col(struct chirp_matrix *a, int i, void *data, time_t stoptime)
+{
+	if(i < 0 || i >= a->width) {
+		errno = EINVAL;
+		return -1;
 	}
 
-	return chirp_reli_bulkio(a->bulkio, a->nfiles, stoptime);
+	matrix_plan_range(a, 0, i, 0, 1, a->height, data);
+	if(matrix_run_requests(a, stoptime) < 0)
+		return -1;
+
+	return a->height * a->element_size;
+}
+
+int chirp_matrix_set_col(struct chirp_matrix *a, int i, const void *data, time_t stoptime)
+{
+	return chirp_matrix_set_range(a, i, 0, 1, a->height, data, stoptime);
 }
 
 int chirp_matrix_setacl(const char *host, const char *path, const char *subject, const char *rights, time_t stoptime)
@@ -435,6 +631,9 @@ void chirp_matrix_close(struct chirp_matrix *a, time_t stoptime)
 	int i;
 	for(i = 0; i < a->nfiles; i++)
 		chirp_reli_close(a->rfiles[i], stoptime);
+	chirp_matrix_set_row_cache(a, 0);
+	itable_delete(a->cache);
+	free(a->requests);
 	free(a->bulkio);
 	free(a->rfiles);
 	free(a);
@@ -43,6 +43,17 @@ struct chirp_matrix *chirp_matrix_create(const char *host, const char *path, int
 
 struct chirp_matrix *chirp_matrix_open(const char *host, const char *path, time_t stoptime);
 
+/** Keep recently read rows of a matrix in memory.
+Rows read by @ref chirp_matrix_get_row, @ref chirp_matrix_get_range, and @ref chirp_matrix_get
+are kept whole, up to the given number of rows, evicting the least recently used.
+Writes through the same matrix update the rows kept, but writes by other clients are not seen in them.
+The cache is disabled by default.
+@param matrix A pointer to a chirp_matrix returned by @ref chirp_matrix_create or @ref chirp_matrix_open
+@param nrows The number of rows to keep, or zero to disable the cache.
+*/
+
+void chirp_matrix_set_row_cache(struct chirp_matrix *matrix, int nrows);
+
 /** Get all values in a row.
 This is the most efficient way to access data in a matrix.
 @param matrix A pointer to a chirp_matrix returned by @ref chirp_matrix_create or @ref chirp_matrix_open
@@ -89,6 +100,8 @@ If possible, use @ref chirp_matrix_set_row instead.
 int chirp_matrix_set_col(struct chirp_matrix *matrix, int x, const void *data, time_t stoptime);
 
 /** Get a range of data.
+The range is read from all of the hosts that hold its rows at once,
+with one request for the rows of the range held in each file.
 @param matrix A pointer to a chirp_matrix returned by @ref chirp_matrix_create or @ref chirp_matrix_open
 @param x The starting x position of the range.
 @param y The starting y position of the range;
@@ -102,6 +115,7 @@ int chirp_matrix_set_col(struct chirp_matrix *matrix, int x, const void *data, t
 int chirp_matrix_get_range(struct chirp_matrix *matrix, int x, int y, int width, int height, void *data, time_t stoptime);
 
 /** Set a range of data.
+The range is written to all of the hosts that hold its rows at once.
 @param matrix A pointer to a chirp_matrix returned by @ref chirp_matrix_create or @ref chirp_matrix_open
 @param x The starting x position of the range.
 @param y The starting y position of the range;
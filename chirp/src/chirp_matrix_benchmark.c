@@ -43,7 +43,7 @@ int main(int argc, char *argv[])
 	int randlimit = atoi(argv[6]);
 	time_t stoptime = time(0) + 3600;
 
-	double *data = malloc(width * 8);
+	double *data = malloc(MAX(width, height) * 8);
 
 	struct chirp_matrix *matrix;
 
@@ -117,7 +117,7 @@ int main(int argc, char *argv[])
 
 	start = timestamp_get();
 	for(i = 0; i < randlimit; i++) {
-		chirp_matrix_get(matrix, rand() % width, rand() % height, data, stoptime);
+		chirp_matrix_get(matrix, rand() % height, rand() % width, data, stoptime);
 	}
 	stop = timestamp_get();
 	printf("cellread  %8.0lf cells/sec\n", 1000000.0 * randlimit / (stop - start));
@@ -126,12 +126,27 @@ int main(int argc, char *argv[])
 
 	start = timestamp_get();
 	for(i = 0; i < randlimit; i++) {
-		chirp_matrix_set(matrix, rand() % width, rand() % height, data, stoptime);
+		chirp_matrix_set(matrix, rand() % height, rand() % width, data, stoptime);
 	}
 	chirp_matrix_fsync(matrix, stoptime);
 	stop = timestamp_get();
 	printf("cellwrite %8.0lf cells/sec\n", 1000000.0 * randlimit / (stop - start));
 
+	/*--------------------------------------------------------------------*/
+
+	/* Bands of rows cover several files, which are read from their hosts at once. */
+	int band = MIN(height, 64);
+	double *bandbuf = malloc((size_t) band * width * 8);
+
+	start = timestamp_get();
+	for(i = 0; i < randlimit; i++) {
+		chirp_matrix_get_range(matrix, 0, rand() % (height - band + 1), width, band, bandbuf, stoptime);
+	}
+	stop = timestamp_get();
+	printf("bandread  %8.0lf cells/sec\n", 1000000.0 * ((double) randlimit * band * width) / (stop - start));
+
+	free(bandbuf);
+
 	/*-------------------------------------------------------------------*/
 
 
@@ -7,8 +7,11 @@ See the file COPYING for details.
 #include "chirp_reli.h"
 #include "chirp_recursive.h"
 
+#include "full_io.h"
 #include "stringtools.h"
 #include "list.h"
+#include "macros.h"
+#include "path.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +20,8 @@ See the file COPYING for details.
 #include <errno.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 #if defined (CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
 #define fopen64 fopen
@@ -26,19 +31,230 @@ See the file COPYING for details.
 #define fstat64 fstat
 #define lstat64 lstat
 #define fseeko64 fseeko
+#define ftruncate64 ftruncate
 #endif
 
+/* Each stripe is moved in pieces of this size. */
+#define STRIPE_CHUNK_SIZE (1024*1024)
+
+/* Files smaller than this per stream are not worth striping. */
+#define STRIPE_MIN_SIZE (4*STRIPE_CHUNK_SIZE)
+
+static int recursive_streams = 1;
+
+void chirp_recursive_set_streams(int streams)
+{
+	recursive_streams = MAX(streams, 1);
+}
+
+/*
+Move the range [offset,offset+length) of a file between the local fd
+and the remote file over a connection of this process' own.
+Returns zero on success, otherwise an errno value.
+*/
+
+static int do_stripe(const char *hostport, const char *remote_file, int fd, int put, INT64_T offset, INT64_T length, time_t stoptime)
+{
+	struct chirp_file *cf;
+	char *buffer;
+	int result = 0;
+
+	cf = chirp_reli_open(hostport, remote_file, put ? O_WRONLY : O_RDONLY, 0, stoptime);
+	if(!cf)
+		return errno;
+
+	buffer = malloc(STRIPE_CHUNK_SIZE);
+	if(!buffer) {
+		chirp_reli_close(cf, stoptime);
+		return ENOMEM;
+	}
+
+	while(length > 0) {
+		INT64_T chunk = MIN(length, STRIPE_CHUNK_SIZE);
+		INT64_T actual;
+
+		if(put) {
+			actual = full_pread64(fd, buffer, chunk, offset);
+			if(actual > 0 && chirp_reli_pwrite_unbuffered(cf, buffer, actual, offset, stoptime) != actual)
+				actual = -1;
+		} else {
+			actual = chirp_reli_pread_unbuffered(cf, buffer, chunk, offset, stoptime);
+			if(actual > 0 && full_pwrite64(fd, buffer, actual, offset) != actual)
+				actual = -1;
+		}
+
+		if(actual <= 0) {
+			/* a short file means it changed under us */
+			result = actual < 0 ? errno : EIO;
+			break;
+		}
+
+		offset += actual;
+		length -= actual;
+	}
+
+	free(buffer);
+	if(chirp_reli_close(cf, stoptime) < 0 && result == 0)
+		result = errno;
+
+	return result;
+}
+
+/*
+Move length bytes between the local fd and an already created remote file
+by splitting the file into one contiguous stripe per stream and forking
+a process to move each stripe over its own connection.
+*/
+
+static INT64_T do_striped(const char *hostport, const char *remote_file, int fd, int put, INT64_T length, time_t stoptime)
+{
+	int streams = MIN(recursive_streams, length / STRIPE_MIN_SIZE);
+	INT64_T stripe = length / streams;
+	pid_t *pids;
+	int result = 0;
+	int i;
+
+	pids = calloc(streams, sizeof(*pids));
+	if(!pids)
+		return -1;
+
+	/* each child must make its own connections */
+	chirp_reli_cleanup_before_fork();
+
+	for(i = 0; i < streams; i++) {
+		INT64_T offset = i * stripe;
+		INT64_T count = (i == streams - 1) ? length - offset : stripe;
+
+		pids[i] = fork();
+		if(pids[i] == 0) {
+			_exit(do_stripe(hostport, remote_file, fd, put, offset, count, stoptime));
+		} else if(pids[i] < 0) {
+			result = errno;
+			break;
+		}
+	}
+
+	while(--i >= 0) {
+		int status;
+		while(waitpid(pids[i], &status, 0) < 0 && errno == EINTR) {}
+		if(result == 0) {
+			if(WIFEXITED(status))
+				result = WEXITSTATUS(status);
+			else
+				result = EIO;
+		}
+	}
+
+	free(pids);
+
+	if(result) {
+		errno = result;
+		return -1;
+	}
+	return length;
+}
+
+struct dir_entry {
+	char *path;
+	struct chirp_stat info;
+};
+
 static void add_to_list(const char *name, void *list)
 {
-	list_push_tail(list, strdup(name));
+	struct dir_entry *e;
+
+	if(!strcmp(name, ".") || !strcmp(name, ".."))
+		return;
+
+	/* zero mode marks an entry that still has to be stat'ed */
+	e = calloc(1, sizeof(*e));
+	e->path = strdup(name);
+	list_push_tail(list, e);
+}
+
+static void add_long_to_list(const char *name, struct chirp_stat *info, void *list)
+{
+	struct dir_entry *e;
+
+	if(!strcmp(name, ".") || !strcmp(name, ".."))
+		return;
+
+	e = malloc(sizeof(*e));
+	e->path = strdup(name);
+	e->info = *info;
+	list_push_tail(list, e);
+}
+
+static void dir_entry_delete(void *e)
+{
+	free(((struct dir_entry *) e)->path);
+	free(e);
 }
 
+/*
+List a directory along with the lstat of every entry.  getlongdir returns
+both in one streamed reply; servers without it fall back to getdir, and
+any entries still lacking a stat are lstat'ed together in one bulk request.
+*/
+
+static INT64_T list_dir(const char *hostport, const char *path, struct list *entries, time_t stoptime)
+{
+	struct dir_entry *e;
+	INT64_T result;
+	int count = 0;
+	int i = 0;
+
+	result = chirp_reli_getlongdir(hostport, path, add_long_to_list, entries, stoptime);
+	if(result < 0 && (errno == EINVAL || errno == ENOSYS)) {
+		list_clear(entries, dir_entry_delete);
+		result = chirp_reli_getdir(hostport, path, add_to_list, entries, stoptime);
+	}
+	if(result < 0)
+		return -1;
+
+	list_first_item(entries);
+	while((e = list_next_item(entries))) {
+		char *full = string_format("%s/%s", path, e->path);
+		free(e->path);
+		e->path = full;
+		if(e->info.cst_mode == 0)
+			count++;
+	}
+
+	if(count == 0)
+		return 0;
+
+	struct chirp_bulkio *v = calloc(count, sizeof(*v));
+
+	list_first_item(entries);
+	while((e = list_next_item(entries))) {
+		if(e->info.cst_mode == 0) {
+			v[i].type = CHIRP_BULKIO_LSTAT;
+			v[i].host = hostport;
+			v[i].path = e->path;
+			v[i].info = &e->info;
+			i++;
+		}
+	}
+
+	result = chirp_reli_bulkio(v, count, stoptime);
+	for(i = 0; i < count && result >= 0; i++) {
+		if(v[i].result < 0) {
+			errno = v[i].errnum;
+			result = -1;
+		}
+	}
+
+	free(v);
+	return result < 0 ? -1 : 0;
+}
+
+static INT64_T do_get_one(const char *hostport, const char *source_file, const char *target_file, struct chirp_stat *info, time_t stoptime);
+
 static INT64_T do_get_one_dir(const char *hostport, const char *source_file, const char *target_file, int mode, time_t stoptime)
 {
-	char new_source_file[CHIRP_PATH_MAX];
-	char new_target_file[CHIRP_PATH_MAX];
 	struct list *work_list;
-	const char *name;
+	struct dir_entry *e;
 	INT64_T result;
 	INT64_T total = 0;
 
@@ -46,31 +262,23 @@ static INT64_T do_get_one_dir(const char *hostport, const char *source_file, con
 
 	result = mkdir(target_file, mode);
 	if(result == 0 || errno == EEXIST) {
-		result = chirp_reli_getdir(hostport, source_file, add_to_list, work_list, stoptime);
+		result = list_dir(hostport, source_file, work_list, stoptime);
 		if(result >= 0) {
-			while((name = list_pop_head(work_list))) {
-				if(!strcmp(name, "."))
-					continue;
-				if(!strcmp(name, ".."))
-					continue;
-				sprintf(new_source_file, "%s/%s", source_file, name);
-				sprintf(new_target_file, "%s/%s", target_file, name);
-				result = chirp_recursive_get(hostport, new_source_file, new_target_file, stoptime);
-				free((char *) name);
+			list_first_item(work_list);
+			while((e = list_next_item(work_list))) {
+				char new_target_file[CHIRP_PATH_MAX];
+				sprintf(new_target_file, "%s/%s", target_file, path_basename(e->path));
+				result = do_get_one(hostport, e->path, new_target_file, &e->info, stoptime);
 				if(result < 0)
 					break;
 				total += result;
 			}
-		} else {
-			result = -1;
 		}
 	} else {
 		result = -1;
 	}
 
-	while((name = list_pop_head(work_list)))
-		free((char *) name);
-
+	list_clear(work_list, dir_entry_delete);
 	list_delete(work_list);
 
 	if(result >= 0) {
@@ -103,6 +311,22 @@ static INT64_T do_get_one_file(const char *hostport, const char *source_file, co
 	int save_errno;
 	INT64_T actual;
 
+	if(recursive_streams > 1 && length >= 2 * STRIPE_MIN_SIZE) {
+		int fd = open64(target_file, O_WRONLY|O_CREAT|O_TRUNC, mode);
+		if(fd < 0)
+			return -1;
+		fchmod(fd, mode);
+		if(ftruncate64(fd, length) < 0 || do_striped(hostport, source_file, fd, 0, length, stoptime) < 0) {
+			save_errno = errno;
+			close(fd);
+			errno = save_errno;
+			return -1;
+		}
+		if(close(fd) < 0)
+			return -1;
+		return length;
+	}
+
 	file = fopen64(target_file, "w");
 	if(!file)
 		return -1;
@@ -128,23 +352,27 @@ static INT64_T do_get_one_file(const char *hostport, const char *source_file, co
 	}
 }
 
+static INT64_T do_get_one(const char *hostport, const char *source_file, const char *target_file, struct chirp_stat *info, time_t stoptime)
+{
+	if(S_ISLNK(info->cst_mode)) {
+		return do_get_one_link(hostport, source_file, target_file, stoptime);
+	} else if(S_ISDIR(info->cst_mode)) {
+		return do_get_one_dir(hostport, source_file, target_file, info->cst_mode, stoptime);
+	} else if(S_ISREG(info->cst_mode)) {
+		return do_get_one_file(hostport, source_file, target_file, info->cst_mode, info->cst_size, stoptime);
+	} else {
+		return 0;
+	}
+}
+
 INT64_T chirp_recursive_get(const char *hostport, const char *source_file, const char *target_file, time_t stoptime)
 {
 	INT64_T result;
 	struct chirp_stat info;
 
 	result = chirp_reli_lstat(hostport, source_file, &info, stoptime);
-	if(result >= 0) {
-		if(S_ISLNK(info.cst_mode)) {
-			result = do_get_one_link(hostport, source_file, target_file, stoptime);
-		} else if(S_ISDIR(info.cst_mode)) {
-			result = do_get_one_dir(hostport, source_file, target_file, info.cst_mode, stoptime);
-		} else if(S_ISREG(info.cst_mode)) {
-			result = do_get_one_file(hostport, source_file, target_file, info.cst_mode, info.cst_size, stoptime);
-		} else {
-			result = 0;
-		}
-	}
+	if(result >= 0)
+		result = do_get_one(hostport, source_file, target_file, &info, stoptime);
 
 	return result;
 }
@@ -226,6 +454,23 @@ static INT64_T do_put_one_file(const char *hostport, const char *source_file, co
 	FILE *file;
 	int save_errno;
 
+	if(recursive_streams > 1 && length >= 2 * STRIPE_MIN_SIZE) {
+		struct chirp_file *cf;
+		int fd = open64(source_file, O_RDONLY);
+		if(fd < 0)
+			return -1;
+		/* create and truncate the target once, then fill it in parallel */
+		cf = chirp_reli_open(hostport, target_file, O_WRONLY|O_CREAT|O_TRUNC, mode, stoptime);
+		if(!cf || chirp_reli_close(cf, stoptime) < 0 || do_striped(hostport, target_file, fd, 1, length, stoptime) < 0) {
+			save_errno = errno;
+			close(fd);
+			errno = save_errno;
+			return -1;
+		}
+		close(fd);
+		return length;
+	}
+
 	file = fopen64(source_file, "r");
 	if(!file)
 		return -1;
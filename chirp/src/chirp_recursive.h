@@ -38,6 +38,16 @@ to handle a number of failure cases.
 
 INT64_T chirp_recursive_get(const char *hostport, const char *sourcepath, const char *targetpath, time_t stoptime);
 
+/** Set the number of parallel streams used for large files.
+When greater than one, each sufficiently large regular file moved by
+@ref chirp_recursive_put or @ref chirp_recursive_get is split into that many
+contiguous ranges, and each range is moved by a forked process over its own
+connection to the server.  The default is one stream.
+@param streams The number of streams per file.
+*/
+
+void chirp_recursive_set_streams(int streams);
+
 #endif
 
 /* vim: set noexpandtab tabstop=8: */
@@ -26,6 +26,13 @@ See the file COPYING for details.
 #define MIN_DELAY 1
 #define MAX_DELAY 60
 
+/* A block of the read cache of a file. */
+struct chirp_reli_block {
+	char *data;
+	INT64_T offset;
+	INT64_T valid;
+};
+
 struct chirp_file {
 	char host[CHIRP_LINE_MAX];
 	char path[CHIRP_LINE_MAX];
@@ -39,10 +46,17 @@ struct chirp_file {
 	INT64_T buffer_valid;
 	INT64_T buffer_offset;
 	INT64_T buffer_dirty;
+	struct chirp_reli_block *blocks; /* read cache, replaced in order starting at next_block. */
+	int nblocks;
+	INT64_T blocks_size;
+	int next_block;
+	INT64_T read_offset;             /* where the last read ended, to detect sequential reads. */
+	int readahead;                   /* number of blocks fetched on the next miss. */
 };
 
 struct hash_table *table = 0;
 static int chirp_reli_blocksize = 65536;
+static int chirp_reli_readahead_max = 16;
 static int chirp_reli_default_nreps = 0;
 
 INT64_T chirp_reli_blocksize_get()
@@ -55,6 +69,57 @@ void    chirp_reli_blocksize_set( INT64_T bs )
 	chirp_reli_blocksize = bs;
 }
 
+INT64_T chirp_reli_readahead_get()
+{
+	return chirp_reli_readahead_max;
+}
+
+void    chirp_reli_readahead_set( INT64_T blocks )
+{
+	chirp_reli_readahead_max = MAX(blocks,1);
+}
+
+static void chirp_reli_cache_clear( struct chirp_file *file )
+{
+	int i;
+	for(i=0;i<file->nblocks;i++) {
+		file->blocks[i].valid = 0;
+	}
+	file->readahead = 0;
+}
+
+static void chirp_reli_cache_free( struct chirp_file *file )
+{
+	int i;
+	for(i=0;i<file->nblocks;i++) {
+		free(file->blocks[i].data);
+	}
+	free(file->blocks);
+	file->blocks = 0;
+	file->nblocks = 0;
+}
+
+/* Allocate the read cache on the first read, or again if the block size or read-ahead changed. */
+static void chirp_reli_cache_alloc( struct chirp_file *file )
+{
+	int i;
+
+	if(file->blocks && file->nblocks==chirp_reli_readahead_max && file->blocks_size==chirp_reli_blocksize) return;
+
+	chirp_reli_cache_free(file);
+
+	file->nblocks = chirp_reli_readahead_max;
+	file->blocks_size = chirp_reli_blocksize;
+	file->blocks = xxmalloc(sizeof(*file->blocks)*file->nblocks);
+	for(i=0;i<file->nblocks;i++) {
+		file->blocks[i].data = xxmalloc(file->blocks_size);
+		file->blocks[i].offset = 0;
+		file->blocks[i].valid = 0;
+	}
+	file->next_block = 0;
+	file->readahead = 0;
+}
+
 static struct chirp_client * connect_to_host( const char *host, time_t stoptime )
 {
 	struct chirp_client *c;
@@ -169,6 +234,12 @@ struct chirp_file * chirp_reli_open( const char *host, const char *path, INT64_T
 				file->buffer_offset = 0;
 				file->buffer_valid = 0;
 				file->buffer_dirty = 0;
+				file->blocks = 0;
+				file->nblocks = 0;
+				file->blocks_size = 0;
+				file->next_block = 0;
+				file->read_offset = -1;
+				file->readahead = 0;
 				return file;
 			} else {
 				if(errno!=ECONNRESET) return 0;
@@ -206,6 +277,7 @@ INT64_T chirp_reli_close( struct chirp_file *file, time_t stoptime )
 			chirp_client_close(client,file->fd,stoptime);
 		}
 	}
+	chirp_reli_cache_free(file);
 	free(file->buffer);
 	free(file);
 	return 0;
@@ -253,8 +325,85 @@ INT64_T chirp_reli_pread_unbuffered( struct chirp_file *file, void *data, INT64_
 	RETRY_FILE( result = chirp_client_pread(client,file->fd,data,length,offset,stoptime); )
 }
 
+/*
+Fill file->readahead blocks of the read cache, starting with the block at offset.
+The reads of all the blocks are sent before any of their results are read back,
+so that fetching the whole window costs a single round trip. If that fails,
+only the first block is read through the usual retrying path.
+Returns the result of reading the first block.
+*/
+
+static INT64_T chirp_reli_cache_fill( struct chirp_file *file, INT64_T offset, time_t stoptime )
+{
+	struct chirp_reli_block *b;
+	INT64_T result;
+	int count = file->readahead;
+	int k;
+
+	for(k=0;k<count;k++) {
+		file->blocks[(file->next_block+k)%file->nblocks].valid = 0;
+	}
+
+	if(count>1) {
+		struct chirp_client *client = connect_to_host(file->host,stoptime);
+		if(client && connect_to_file(client,file,stoptime)) {
+			int sent, eof = 0, failed = 0, errnum = 0;
+			INT64_T actual;
+
+			for(sent=0;sent<count;sent++) {
+				b = &file->blocks[(file->next_block+sent)%file->nblocks];
+				if(chirp_client_pread_begin(client,file->fd,b->data,file->blocks_size,offset+sent*file->blocks_size,stoptime)<0) {
+					failed = 1;
+					break;
+				}
+			}
+
+			result = -1;
+			for(k=0;k<sent;k++) {
+				b = &file->blocks[(file->next_block+k)%file->nblocks];
+				actual = chirp_client_pread_finish(client,file->fd,b->data,file->blocks_size,offset+k*file->blocks_size,stoptime);
+				if(actual<0 && errno==ECONNRESET) {
+					failed = 1;
+					break;
+				}
+				if(k==0) {
+					result = actual;
+					errnum = errno;
+				}
+				if(actual>0 && !eof) {
+					b->offset = offset+k*file->blocks_size;
+					b->valid = actual;
+				}
+				if(actual<file->blocks_size) eof = 1;
+			}
+
+			if(!failed) {
+				file->next_block = (file->next_block+count)%file->nblocks;
+				errno = errnum;
+				return result;
+			}
+
+			for(k=0;k<count;k++) {
+				file->blocks[(file->next_block+k)%file->nblocks].valid = 0;
+			}
+			chirp_reli_disconnect(file->host);
+		}
+	}
+
+	b = &file->blocks[file->next_block];
+	result = chirp_reli_pread_unbuffered(file,b->data,file->blocks_size,offset,stoptime);
+	if(result>0) {
+		b->offset = offset;
+		b->valid = result;
+		file->next_block = (file->next_block+1)%file->nblocks;
+	}
+	return result;
+}
+
 static INT64_T chirp_reli_pread_buffered( struct chirp_file *file, void *data, INT64_T length, INT64_T offset, time_t stoptime )
 {
+	int i;
+
 	if(file->buffer_valid) {
 		if(offset >= file->buffer_offset && offset < (file->buffer_offset+file->buffer_valid) ) {
 			INT64_T blength;
@@ -264,21 +413,40 @@ static INT64_T chirp_reli_pread_buffered( struct chirp_file *file, void *data, I
 		}
 	}
 
+	for(i=0;i<file->nblocks;i++) {
+		struct chirp_reli_block *b = &file->blocks[i];
+		if(b->valid && offset >= b->offset && offset < (b->offset+b->valid) ) {
+			INT64_T blength;
+			blength = MIN(length,b->offset+b->valid-offset);
+			memcpy(data,&b->data[offset-b->offset],blength);
+			file->read_offset = offset+blength;
+			return blength;
+		}
+	}
+
 	chirp_reli_flush(file,stoptime);
 
 	if(length<=chirp_reli_blocksize) {
-		INT64_T result = chirp_reli_pread_unbuffered(file,file->buffer,chirp_reli_blocksize,offset,stoptime);
-		if(result<0) {
-			file->buffer_offset = 0;
-			file->buffer_valid = 0;
-			file->buffer_dirty = 0;
+		struct chirp_reli_block *b;
+		INT64_T result;
+
+		chirp_reli_cache_alloc(file);
+
+		/* double the read-ahead while the file is read sequentially. */
+		if(offset==file->read_offset) {
+			file->readahead = MIN(MAX(file->readahead*2,1),file->nblocks);
+		} else {
+			file->readahead = 1;
+		}
+
+		b = &file->blocks[file->next_block];
+		result = chirp_reli_cache_fill(file,offset,stoptime);
+		if(result<=0) {
 			return result;
 		} else {
-			file->buffer_offset = offset;
-			file->buffer_valid = result;
-			file->buffer_dirty = 0;
 			result = MIN(result,length);
-			memcpy(data,file->buffer,result);
+			memcpy(data,b->data,result);
+			file->read_offset = offset+result;
 			return result;
 		}
 	} else {
@@ -360,6 +528,8 @@ INT64_T chirp_reli_pwrite( struct chirp_file *file, const void *data, INT64_T le
 	INT64_T result = 0;
 	INT64_T actual = 0;
 
+	chirp_reli_cache_clear(file);
+
 	while(length>0) {
 		actual = chirp_reli_pwrite_buffered(file,cdata,length,offset,stoptime);
 		if(actual<=0) break;
@@ -386,6 +556,7 @@ INT64_T chirp_reli_sread( struct chirp_file *file, void *data, INT64_T length, I
 INT64_T chirp_reli_swrite( struct chirp_file *file, const void *data, INT64_T length, INT64_T stride_length, INT64_T stride_offset, INT64_T offset, time_t stoptime )
 {
 	chirp_reli_flush(file,stoptime);
+	chirp_reli_cache_clear(file);
 	RETRY_FILE( result = chirp_client_swrite(client,file->fd,data,length,stride_length,stride_offset,offset,stoptime); )
 }
 
@@ -416,6 +587,7 @@ INT64_T chirp_reli_fchmod( struct chirp_file *file, INT64_T mode, time_t stoptim
 INT64_T chirp_reli_ftruncate( struct chirp_file *file, INT64_T length, time_t stoptime )
 {
 	chirp_reli_flush(file,stoptime);
+	chirp_reli_cache_clear(file);
 	RETRY_FILE( result = chirp_client_ftruncate(client,file->fd,length,stoptime); )
 }
 
@@ -914,6 +1086,15 @@ void chirp_reli_closedir( struct chirp_dir *dir )
 	free(dir);
 }
 
+static const char * chirp_reli_bulkio_host( struct chirp_bulkio *b )
+{
+	if(b->type==CHIRP_BULKIO_STAT || b->type==CHIRP_BULKIO_LSTAT) {
+		return b->host;
+	} else {
+		return b->file->host;
+	}
+}
+
 static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t stoptime )
 {
 	int i;
@@ -923,10 +1104,12 @@ static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t
 		struct chirp_bulkio *b = &v[i];
 		struct chirp_client *client;
 
-		client = connect_to_host(b->file->host,stoptime);
+		client = connect_to_host(chirp_reli_bulkio_host(b),stoptime);
 		if(!client) goto failure;
 
-		if(connect_to_file(client,b->file,stoptime)<0) goto failure;
+		if(b->type!=CHIRP_BULKIO_STAT && b->type!=CHIRP_BULKIO_LSTAT) {
+			if(connect_to_file(client,b->file,stoptime)<0) goto failure;
+		}
 
 		if(b->type==CHIRP_BULKIO_PREAD) {
 			result = chirp_client_pread_begin(client,b->file->fd,b->buffer,b->length,b->offset,stoptime);
@@ -940,6 +1123,10 @@ static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t
 			result = chirp_client_fstat_begin(client,b->file->fd,b->info,stoptime);
 		} else if(b->type==CHIRP_BULKIO_FSYNC) {
 			result = chirp_client_fsync_begin(client,b->file->fd,stoptime);
+		} else if(b->type==CHIRP_BULKIO_STAT) {
+			result = chirp_client_stat_begin(client,b->path,b->info,stoptime);
+		} else if(b->type==CHIRP_BULKIO_LSTAT) {
+			result = chirp_client_lstat_begin(client,b->path,b->info,stoptime);
 		} else {
 			result = -1;
 			errno = EINVAL;
@@ -952,7 +1139,7 @@ static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t
 		struct chirp_bulkio *b = &v[i];
 		struct chirp_client *client;
 
-		client = connect_to_host(b->file->host,stoptime);
+		client = connect_to_host(chirp_reli_bulkio_host(b),stoptime);
 		if(!client) goto failure;
 
 		if(b->type==CHIRP_BULKIO_PREAD) {
@@ -967,6 +1154,10 @@ static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t
 			result = chirp_client_fstat_finish(client,b->file->fd,b->info,stoptime);
 		} else if(b->type==CHIRP_BULKIO_FSYNC) {
 			result = chirp_client_fsync_finish(client,b->file->fd,stoptime);
+		} else if(b->type==CHIRP_BULKIO_STAT) {
+			result = chirp_client_stat_finish(client,b->path,b->info,stoptime);
+		} else if(b->type==CHIRP_BULKIO_LSTAT) {
+			result = chirp_client_lstat_finish(client,b->path,b->info,stoptime);
 		} else {
 			result = -1;
 			errno = EINVAL;
@@ -983,7 +1174,7 @@ static INT64_T chirp_reli_bulkio_once( struct chirp_bulkio *v, int count, time_t
 	failure:
 	for(i=0;i<count;i++) {
 		struct chirp_bulkio *b = &v[i];
-		chirp_reli_disconnect(b->file->host);
+		chirp_reli_disconnect(chirp_reli_bulkio_host(b));
 	}
 	errno = ECONNRESET;
 	return -1;
@@ -995,6 +1186,13 @@ INT64_T chirp_reli_bulkio( struct chirp_bulkio *v, int count, time_t stoptime )
 	time_t nexttry;
 	INT64_T result;
 	time_t current;
+	int i;
+
+	for(i=0;i<count;i++) {
+		if(v[i].type==CHIRP_BULKIO_PWRITE || v[i].type==CHIRP_BULKIO_SWRITE) {
+			chirp_reli_cache_clear(v[i].file);
+		}
+	}
 
 	while(1) {
 		result = chirp_reli_bulkio_once(v,count,stoptime);
@@ -750,6 +750,8 @@ INT64_T chirp_reli_lsalloc(const char *host, const char *path, char *allocpath,
 This operation will perform multiple I/O operations by pipelining the requests
 and the results. It is the most efficient way to perform multiple reads
 and writes simultaneously, whether against one or many files.
+Stat and lstat requests on paths may be included as well, so that the status of
+many files on a server costs a single round trip.
 @param list An array of @ref chirp_bulkio structures, each describing one I/O operation.
 @param count The number of entries in the list.
 @param stoptime The absolute time at which to abort.
@@ -776,6 +778,22 @@ aggregated together.  This function sets the current buffer size.
 
 void chirp_reli_blocksize_set(INT64_T bs);
 
+/** Return the maximum number of blocks read ahead.
+@return The maximum number of blocks read ahead.
+*/
+
+INT64_T chirp_reli_readahead_get();
+
+/** Set the maximum number of blocks read ahead.
+Reads smaller than the block size are served from a cache of this many blocks per file.
+On a miss, the following blocks are requested together with the missing one, and the
+number of blocks requested doubles up to this maximum while the file is read sequentially.
+A value of one disables read-ahead.
+@param blocks The new maximum number of blocks.
+*/
+
+void chirp_reli_readahead_set(INT64_T blocks);
+
 /** Prepare to fork in a parallel program.
 The Chirp library is not thread-safe, but it can be used in a program
 that exploits parallelism by calling fork().  Before calling fork, this
@@ -29,6 +29,7 @@
 #include "getopt_aux.h"
 #include "host_disk_info.h"
 #include "host_memory_info.h"
+#include "itable.h"
 #include "jx.h"
 #include "jx_print.h"
 #include "jx_parse.h"
@@ -76,6 +77,10 @@
 
 /* The maximum chunk of memory the server will allocate to handle I/O */
 #define MAX_BUFFER_SIZE (16*1024*1024)
+/* Files opened with O_DIRECT are read and written through a buffer aligned to this. */
+#define CHIRP_SERVER_BUFFER_ALIGN 4096
+#define CHIRP_SERVER_OUTPUT_BUFFER (64*1024)
+#define CHIRP_WORKER_MAX_CLIENTS 1000
 
 struct list *catalog_host_list;
 char         chirp_hostname[DOMAIN_NAME_MAX] = "";
@@ -167,7 +172,13 @@ static int backend_setup(const char *url)
 static int backend_bootstrap(const char *url)
 {
 	downgrade();
-	return backend_setup(url);
+	backend_setup(url);
+
+	/* only done once at startup, as every other process shares the result */
+	if(chirp_alloc_recover(root_quota) == -1)
+		fatal("could not recover %s allocations: %s", url, strerror(errno));
+
+	return 0;
 }
 
 static int gc_tickets(const char *url)
@@ -388,8 +399,7 @@ static int errno_to_chirp(int e)
 
 static INT64_T getstream(const char *path, struct link * l, time_t stoptime)
 {
-	INT64_T fd, total = 0;
-	char buffer[65536];
+	INT64_T fd, total;
 
 	fd = cfs->open(path, O_RDONLY, S_IRWXU);
 	if(fd == -1)
@@ -397,20 +407,8 @@ static INT64_T getstream(const char *path, struct link * l, time_t stoptime)
 
 	link_putliteral(l, "0\n", stoptime);
 
-	while(1) {
-		INT64_T result;
-		INT64_T actual;
-
-		result = cfs->pread(fd, buffer, sizeof(buffer), total);
-		if(result <= 0)
-			break;
-
-		actual = link_putlstring(l, buffer, result, stoptime);
-		if(actual != result)
-			break;
-
-		total += actual;
-	}
+	/* the stream ends when the file does */
+	total = cfs->getfile(fd, l, INT64_MAX, stoptime);
 
 	cfs->close(fd);
 
@@ -427,6 +425,7 @@ static INT64_T putstream(const char *path, struct link * l, time_t stoptime)
 	}
 
 	link_putliteral(l, "0\n", stoptime);
+	link_flush_output(l);
 
 	while(1) {
 		char buffer[65536];
@@ -528,6 +527,7 @@ static INT64_T getvarstring (struct link *l, time_t stalltime, void *buffer, INT
 	} else {
 		if (link_read(l, buffer, count, stalltime) != count)
 			return errno = EINVAL, -1;
+		((char *)buffer)[count] = '\0';
 		return count;
 	}
 }
@@ -544,13 +544,23 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 {
 	char *esubject;
 	buffer_t B[1]; /* output buffer */
-	void *buffer = xxmalloc(MAX_BUFFER_SIZE+1); /* general purpose temporary buffer w/ room for NUL */
+	void *buffer; /* general purpose temporary buffer w/ room for NUL */
+	struct itable *open_fds; /* files left open by the client are closed when it disconnects */
+	UINT64_T open_fd;
 
 	if(!chirp_acl_whoami(subject, &esubject))
 		return;
 
+	if(posix_memalign(&buffer, CHIRP_SERVER_BUFFER_ALIGN, MAX_BUFFER_SIZE+1) != 0)
+		fatal("out of memory");
+
 	link_tune(l, LINK_TUNE_INTERACTIVE);
 
+	open_fds = itable_create(0);
+
+	/* replies are held while more requests are already waiting, so that pipelined requests are answered together. */
+	link_buffer_output(l, CHIRP_SERVER_OUTPUT_BUFFER);
+
 	buffer_init(B);
 	buffer_abortonfailure(B, 1);
 	buffer_max(B, MAX_BUFFER_SIZE+1 /* +1 for NUL */);
@@ -569,7 +579,9 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 		char chararg2[CHIRP_LINE_MAX] = "";
 
 		buffer_rewind(B, 0);
-		memset(buffer, 0, MAX_BUFFER_SIZE+1);
+
+		if(link_buffer_empty(l) && link_flush_output(l) < 0)
+			goto die;
 
 		if(chirp_alloc_flush_needed()) {
 			if(!link_usleep(l, 1000000, 1, 0)) {
@@ -793,21 +805,10 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 
 			link_printf(l, transmission_stalltime, "%" PRId64 "\n", length);
 
-			INT64_T total = 0;
-			while (total < length) {
-				char b[65536];
-				size_t chunk = MIN(sizeof(b), (size_t)(length-total));
-
-				INT64_T ractual = cfs->pread(fd, b, chunk, total);
-				if(ractual <= 0)
-					break;
-
-				if(link_putlstring(l, b, ractual, transmission_stalltime) == -1) {
-					debug(D_DEBUG, "getfile: write failed (%s), expected to write %" PRId64 " more bytes", strerror(errno), length);
-					break;
-				}
-
-				total += ractual;
+			INT64_T total = cfs->getfile(fd, l, length, transmission_stalltime);
+			if(total < length) {
+				debug(D_DEBUG, "getfile: write failed (%s), expected to write %" PRId64 " bytes", strerror(errno), length);
+				total = MAX(total, 0);
 			}
 			cfs->close(fd);
 
@@ -873,34 +874,18 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			transmission_stalltime = MAX(stalltime, transmission_stalltime);
 
 			link_putliteral(l, "0\n", transmission_stalltime);
+			link_flush_output(l);
 
-			INT64_T total = 0;
-			while (total < length) {
-				char b[65536];
-				size_t chunk = MIN(sizeof(b), (size_t)(length-total));
-
-				INT64_T ractual = link_read(l, b, chunk, transmission_stalltime);
-
-				INT64_T wactual = -1;
-				if (ractual > 0)
-					wactual = cfs->pwrite(fd, b, ractual, total);
-
-				if(ractual <= 0 || wactual < ractual) {
-					int saved = errno;
-					if (ractual <= 0)
-						debug(D_DEBUG, "putfile: socket read failed (%s), expected %" PRId64 " more bytes", strerror(errno), length-total);
-					else
-						debug(D_DEBUG, "putfile: file write failed: (%s)", strerror(errno));
-					cfs->close(fd);
-					if(cfs->unlink(path) == -1)
-						debug(D_DEBUG, "putfile: failed to unlink remnant file '%s': %s", path, strerror(errno));
-					chirp_alloc_realloc(path, 0, NULL);
-					link_soak(l, length - total - MAX(ractual, 0), transmission_stalltime);
-					errno = saved;
-					goto failure;
-				}
-
-				total += ractual;
+			INT64_T total = cfs->putfile(fd, l, length, transmission_stalltime);
+			if(total != length) {
+				int saved = errno;
+				debug(D_DEBUG, "putfile: transfer failed (%s), expected %" PRId64 " bytes", strerror(errno), length);
+				cfs->close(fd);
+				if(cfs->unlink(path) == -1)
+					debug(D_DEBUG, "putfile: failed to unlink remnant file '%s': %s", path, strerror(errno));
+				chirp_alloc_realloc(path, 0, NULL);
+				errno = saved;
+				goto failure;
 			}
 
 			chirp_stats_update(0, 0, total);
@@ -1037,9 +1022,12 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 				cfs->fstat(result, &info);
 				chirp_stat_encode(B, &info);
 				buffer_putliteral(B, "\n");
+				itable_insert(open_fds, result, (void *)1);
 			}
 		} else if(sscanf(line, "close %" SCNd64, &fd) == 1) {
 			result = cfs->close(fd);
+			if(result >= 0)
+				itable_remove(open_fds, fd);
 		} else if(sscanf(line, "fchmod %" SCNd64 " %" SCNd64, &fd, &mode) == 2) {
 			result = cfs->fchmod(fd, mode);
 		} else if(sscanf(line, "fchown %" SCNd64 " %" SCNd64 " %" SCNd64, &fd, &uid, &gid) == 3) {
@@ -1626,22 +1614,65 @@ done:
 			debug(D_CHIRP, "= %" PRId64, result);
 	}
 die:
+	link_flush_output(l);
+	itable_firstkey(open_fds);
+	while(itable_nextkey(open_fds, &open_fd, NULL))
+		cfs->close(open_fd);
+	itable_delete(open_fds);
 	buffer_free(B);
 	free(esubject);
 	free(buffer);
 }
 
-static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
+/* Authenticate a client with the current auth state and serve its requests. */
+static void chirp_session(struct link *link, const char *addr, int port)
 {
 	char *atype, *asubject;
 	char typesubject[AUTH_TYPE_MAX + AUTH_SUBJECT_MAX];
+
+	change_process_title("chirp_server [%s:%d] [authenticating]", addr, port);
+
+	auth_ticket_server_callback(chirp_acl_ticket_callback);
+
+	if(auth_accept(link, &atype, &asubject, time(0) + idle_timeout)) {
+		sprintf(typesubject, "%s:%s", atype, asubject);
+		free(atype);
+		free(asubject);
+
+		debug(D_LOGIN, "%s from %s:%d", typesubject, addr, port);
+
+		downgrade(); /* downgrade privileges after authentication */
+
+		/* Enable only globus, hostname, and address authentication for third-party transfers. */
+		auth_clear();
+		if(auth_globus_has_delegated_credential()) {
+			auth_globus_use_delegated_credential(1);
+			auth_globus_register();
+		}
+		auth_hostname_register();
+		auth_address_register();
+
+		change_process_title("chirp_server [%s:%d] [%s]", addr, port, typesubject);
+
+		chirp_handler(link, addr, typesubject);
+		chirp_alloc_flush();
+		chirp_stats_report(config_pipe[1], addr, typesubject, 0);
+
+		debug(D_LOGIN, "disconnected");
+	} else {
+		debug(D_LOGIN, "authentication failed from %s:%d", addr, port);
+	}
+}
+
+static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
+{
 	char addr[LINK_ADDRESS_MAX];
 	int port;
 
 	memset(addr, '\0', LINK_ADDRESS_MAX);
 	link_address_remote(link, addr, &port);
 
-	change_process_title("chirp_server [%s:%d] [backend starting]", addr, port, typesubject);
+	change_process_title("chirp_server [%s:%d] [backend starting]", addr, port);
 
 	/* Authentication problems:
 	 *
@@ -1674,50 +1705,68 @@ static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
 	 * as we should not make files as root in the backend. Fortunately, for
 	 * now, the initial bootstrap backend_setup does necessary ACL/etc.
 	 * creation so we should only ever read files between now and downgrade
-	 * (below).
+	 * (in chirp_session).
 	 */
 	backend_setup(url);
 
-	change_process_title("chirp_server [%s:%d] [authenticating]", addr, port, typesubject);
-
 	struct auth_state *backend_state = auth_clone();
 	auth_replace(server_state);
 
-	auth_ticket_server_callback(chirp_acl_ticket_callback);
+	chirp_session(link, addr, port);
+	auth_free(backend_state);
 
-	if(auth_accept(link, &atype, &asubject, time(0) + idle_timeout)) {
-		auth_replace(backend_state);
+	link_close(link);
 
-		sprintf(typesubject, "%s:%s", atype, asubject);
-		free(atype);
-		free(asubject);
+	cfs->destroy();
+}
 
-		debug(D_LOGIN, "%s from %s:%d", typesubject, addr, port);
+/*
+A worker accepts clients from the shared listening port and serves them
+one after another, so that the fork and the backend setup are paid once per
+worker rather than once per connection. Workers drop privileges before
+serving any client, so authentication methods that need root cannot be used
+with workers.
+*/
 
-		downgrade(); /* downgrade privileges after authentication */
+static void chirp_worker(struct link *port, char url[CHIRP_PATH_MAX], pid_t parent)
+{
+	int served = 0;
 
-		/* Enable only globus, hostname, and address authentication for third-party transfers. */
-		auth_clear();
-		if(auth_globus_has_delegated_credential()) {
-			auth_globus_use_delegated_credential(1);
-			auth_globus_register();
-		}
-		auth_hostname_register();
-		auth_address_register();
+	close(config_pipe[0]);
+	config_pipe[0] = -1;
 
-		change_process_title("chirp_server [%s:%d] [%s]", addr, port, typesubject);
+	change_process_title("chirp_server [worker starting]");
 
-		chirp_handler(link, addr, typesubject);
-		chirp_alloc_flush();
-		chirp_stats_report(config_pipe[1], addr, typesubject, 0);
+	downgrade();
+	backend_setup(url);
 
-		debug(D_LOGIN, "disconnected");
-	} else {
-		auth_free(backend_state);
-		debug(D_LOGIN, "authentication failed from %s:%d", addr, port);
+	/* chirp_session replaces the auth methods, so each client starts from a copy of the server's. */
+	struct auth_state *server_state = auth_clone();
+
+	while(served < CHIRP_WORKER_MAX_CLIENTS && getppid() == parent) {
+		char addr[LINK_ADDRESS_MAX];
+		int remote_port;
+
+		change_process_title("chirp_server [worker idle]");
+
+		struct link *l = link_accept(port, time(0) + 5);
+		if(!l)
+			continue;
+
+		memset(addr, '\0', LINK_ADDRESS_MAX);
+		link_address_remote(l, addr, &remote_port);
+
+		auth_replace(server_state);
+		free(server_state);
+		server_state = auth_clone();
+
+		chirp_session(l, addr, remote_port);
+		link_close(l);
+		served++;
 	}
 
-	link_close(link);
+	auth_free(server_state);
+	free(server_state);
 
 	cfs->destroy();
 }
@@ -1818,10 +1867,12 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Read-only mode.\n", "-R,--read-only");
 	fprintf(stdout, " %-30s Abort stalled operations after this long. (default: %ds)\n", "-s,--stalled=<time>", stall_timeout);
 	fprintf(stdout, " %-30s Maximum time to cache group information. (default: %ds)\n", "-T,--group-cache-exp=<time>", chirp_group_cache_time);
+	fprintf(stdout, " %-30s Send large files over this many parallel connections in thirdput. (default: %d)\n", "   --thirdput-streams=<n>", chirp_thirdput_streams);
 	fprintf(stdout, " %-30s Disconnect idle clients after this time. (default: %ds)\n", "-t,--idle-clients=<time>", idle_timeout);
 	fprintf(stdout, " %-30s Send status updates at this interval. (default: 5m)\n", "-U,--catalog-update=<time>");
 	fprintf(stdout, " %-30s Use alternate password file for unix authentication.\n", "-W,--passwd=<file>");
 	fprintf(stdout, " %-30s The name of this server's owner. (default: `whoami`)\n", "-w,--owner=<user>");
+	fprintf(stdout, " %-30s Serve clients from this many long-lived worker processes, rather than forking for each client. (default: disabled)\n", "   --workers=<count>");
 	fprintf(stdout, " %-30s Location of transient data. (default: `.')\n", "-y,--transient=<dir>");
 	fprintf(stdout, " %-30s Select port at random and write it to this file. (default: disabled)\n", "-Z,--port-file=<file>");
 	fprintf(stdout, " %-30s Set max timeout for unix filesystem authentication. (default: 5s)\n", "-z,--unix-timeout=<file>");
@@ -1839,6 +1890,8 @@ int main(int argc, char *argv[])
 		LONGOPT_JOB_TIME_LIMIT                   = INT_MAX-2,
 		LONGOPT_INHERIT_DEFAULT_ACL              = INT_MAX-3,
 		LONGOPT_PROJECT_NAME                     = INT_MAX-4,
+		LONGOPT_WORKERS                          = INT_MAX-5,
+		LONGOPT_THIRDPUT_STREAMS                 = INT_MAX-6,
 	};
 
 	static const struct option long_options[] = {
@@ -1877,10 +1930,12 @@ int main(int argc, char *argv[])
 		{"debug-rotate-max", required_argument, 0, 'O'},
 		{"stalled", required_argument, 0, 's'},
 		{"superuser", required_argument, 0, 'P'},
+		{"thirdput-streams", required_argument, 0, LONGOPT_THIRDPUT_STREAMS},
 		{"transient", required_argument, 0, 'y'},
 		{"unix-timeout", required_argument, 0, 'z'},
 		{"user", required_argument, 0, 'i'},
 		{"version", no_argument, 0, 'v'},
+		{"workers", required_argument, 0, LONGOPT_WORKERS},
 		{0, 0, 0, 0}
 	};
 
@@ -1894,6 +1949,7 @@ int main(int argc, char *argv[])
 	time_t gc_alarm = 0;
 	const char *manual_hostname = 0;
 	int max_child_procs = 100;
+	int num_workers = 0;
 	const char *listen_on_interface = 0;
 	int total_child_procs = 0;
 	int did_explicit_auth = 0;
@@ -2045,6 +2101,12 @@ int main(int argc, char *argv[])
 		case LONGOPT_PROJECT_NAME:
 			strncpy(chirp_project_name, optarg, sizeof(chirp_project_name)-1);
 			break;
+		case LONGOPT_WORKERS:
+			num_workers = atoi(optarg);
+			break;
+		case LONGOPT_THIRDPUT_STREAMS:
+			chirp_thirdput_streams = MAX(atoi(optarg), 1);
+			break;
 		case 'h':
 		default:
 			show_help(argv[0]);
@@ -2205,6 +2267,8 @@ int main(int argc, char *argv[])
 		}
 
 		while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			if(pid == chirp_job_schedd)
+				continue;
 			if(WIFEXITED(status))
 				debug(D_PROCESS, "pid %d exited with %d (%d total child procs)", pid, WEXITSTATUS(status), total_child_procs);
 			else if(WIFSIGNALED(status))
@@ -2224,13 +2288,29 @@ int main(int argc, char *argv[])
 			gc_alarm = time(0) + GC_TIMEOUT;
 		}
 
+		/* Workers accept clients themselves, so replace any that have exited. */
+
+		while(num_workers > 0 && total_child_procs < num_workers) {
+			pid = fork();
+			if(pid == 0) {
+				chirp_worker(link, chirp_url, getppid());
+				_exit(0);
+			} else if(pid > 0) {
+				total_child_procs++;
+				debug(D_PROCESS, "created worker pid %d (%d total child procs)", pid, total_child_procs);
+			} else {
+				debug(D_PROCESS, "couldn't fork: %s", strerror(errno));
+				break;
+			}
+		}
+
 		/* Wait for action on one of two ports: the main TCP port, or the internal pipe. */
-		/* If the limit of child procs has been reached, don't watch the TCP port. */
+		/* If the limit of child procs has been reached, or workers accept the clients, don't watch the TCP port. */
 
 		fd_set rfds;
 		FD_ZERO(&rfds);
 		FD_SET(config_pipe[0], &rfds);
-		if(max_child_procs == 0 || total_child_procs < max_child_procs) {
+		if(num_workers == 0 && (max_child_procs == 0 || total_child_procs < max_child_procs)) {
 			FD_SET(link_fd(link), &rfds);
 		}
 		int maxfd = MAX(link_fd(link), config_pipe[0]) + 1;
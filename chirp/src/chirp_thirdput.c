@@ -10,6 +10,7 @@ See the file COPYING for details.
 #include "chirp_acl.h"
 
 #include "debug.h"
+#include "macros.h"
 
 #include <unistd.h>
 #include <string.h>
@@ -17,6 +18,109 @@ See the file COPYING for details.
 #include <sys/time.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+
+/* Each stripe is moved in pieces of this size. */
+#define STRIPE_CHUNK_SIZE (1024*1024)
+
+/* Files smaller than this per stream are not worth striping. */
+#define STRIPE_MIN_SIZE (4*STRIPE_CHUNK_SIZE)
+
+int chirp_thirdput_streams = 1;
+
+/*
+Send the range [offset,offset+length) of the local fd to the remote file
+over a connection of this process' own.
+Returns zero on success, otherwise an errno value.
+*/
+
+static int thirdput_stripe(int fd, const char *hostname, const char *rpath, INT64_T offset, INT64_T length, time_t stoptime)
+{
+	struct chirp_file *F;
+	char *buffer;
+	int result = 0;
+
+	F = chirp_reli_open(hostname, rpath, O_WRONLY, 0, stoptime);
+	if(!F)
+		return errno;
+
+	buffer = malloc(STRIPE_CHUNK_SIZE);
+	if(!buffer) {
+		chirp_reli_close(F, stoptime);
+		return ENOMEM;
+	}
+
+	while(length > 0) {
+		INT64_T nread = cfs->pread(fd, buffer, MIN(length, STRIPE_CHUNK_SIZE), offset);
+		if(nread > 0 && chirp_reli_pwrite_unbuffered(F, buffer, nread, offset, stoptime) != nread)
+			nread = -1;
+		if(nread <= 0) {
+			result = nread < 0 ? errno : EIO;
+			break;
+		}
+		offset += nread;
+		length -= nread;
+	}
+
+	free(buffer);
+	if(chirp_reli_close(F, stoptime) < 0 && result == 0)
+		result = errno;
+
+	return result;
+}
+
+/*
+Send a large file to an already created remote file by splitting it into
+one contiguous stripe per stream, each sent by a forked process.
+*/
+
+static INT64_T thirdput_striped(int fd, const char *hostname, const char *rpath, INT64_T length, time_t stoptime)
+{
+	int streams = MIN(chirp_thirdput_streams, length / STRIPE_MIN_SIZE);
+	INT64_T stripe = length / streams;
+	pid_t *pids;
+	int result = 0;
+	int i;
+
+	pids = calloc(streams, sizeof(*pids));
+	if(!pids)
+		return -1;
+
+	/* each child must make its own connections */
+	chirp_reli_cleanup_before_fork();
+
+	for(i = 0; i < streams; i++) {
+		INT64_T offset = i * stripe;
+		INT64_T count = (i == streams - 1) ? length - offset : stripe;
+
+		pids[i] = fork();
+		if(pids[i] == 0) {
+			_exit(thirdput_stripe(fd, hostname, rpath, offset, count, stoptime));
+		} else if(pids[i] < 0) {
+			result = errno;
+			break;
+		}
+	}
+
+	while(--i >= 0) {
+		int status;
+		while(waitpid(pids[i], &status, 0) < 0 && errno == EINTR) {}
+		if(result == 0) {
+			if(WIFEXITED(status))
+				result = WEXITSTATUS(status);
+			else
+				result = EIO;
+		}
+	}
+
+	free(pids);
+
+	if(result) {
+		errno = result;
+		return -1;
+	}
+	return length;
+}
 
 static INT64_T chirp_thirdput_recursive(const char *subject, const char *lpath, const char *hostname, const char *rpath, const char *hostsubject, time_t stoptime)
 {
@@ -120,7 +224,16 @@ static INT64_T chirp_thirdput_recursive(const char *subject, const char *lpath,
 		int fd = cfs->open(lpath, O_RDONLY, 0);
 		if(fd >= 0) {
 			struct chirp_file *F = chirp_reli_open(hostname, rpath, O_WRONLY|O_CREAT|O_TRUNC, info.cst_mode, stoptime);
-			if(F) {
+			if(F && chirp_thirdput_streams > 1 && info.cst_size >= 2 * STRIPE_MIN_SIZE) {
+				/* the target now exists, so the stripes can be filled in parallel */
+				result = chirp_reli_close(F, stoptime);
+				if(result >= 0)
+					result = thirdput_striped(fd, hostname, rpath, info.cst_size, stoptime);
+				save_errno = errno;
+				cfs->close(fd);
+				errno = save_errno;
+				return result;
+			} else if(F) {
 				char buffer[65536];
 				INT64_T offset = 0;
 				INT64_T nread;
@@ -10,6 +10,9 @@ See the file COPYING for details.
 #include "int_sizes.h"
 #include <sys/time.h>
 
+/* Number of parallel streams used to send each large file; one disables striping. */
+extern int chirp_thirdput_streams;
+
 INT64_T chirp_thirdput(const char *subject, const char *lpath, const char *hostname, const char *rpath, time_t stoptime);
 
 #endif
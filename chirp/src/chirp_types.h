@@ -148,7 +148,9 @@ typedef enum {
 	CHIRP_BULKIO_SREAD,  /**< Perform a chirp_reli_sread.*/
 	CHIRP_BULKIO_SWRITE, /**< Perform a chirp_reli_swrite.*/
 	CHIRP_BULKIO_FSTAT,  /**< Perform a chirp_reli_fstat.*/
-	CHIRP_BULKIO_FSYNC   /**< Perform a chirp_reli_fsync.*/
+	CHIRP_BULKIO_FSYNC,  /**< Perform a chirp_reli_fsync.*/
+	CHIRP_BULKIO_STAT,   /**< Perform a chirp_reli_stat.*/
+	CHIRP_BULKIO_LSTAT   /**< Perform a chirp_reli_lstat.*/
 } chirp_bulkio_t;
 
 /** Describes a bulk I/O operation.
@@ -157,8 +159,10 @@ An array of chirp_bulkio structures passed to @ref chirp_reli_bulkio describes a
 
 struct chirp_bulkio {
 	chirp_bulkio_t type;	   /**< The type of I/O to perform. */
-	struct chirp_file *file;   /**< The file to access for all operations. */
-	struct chirp_stat *info;   /**< Pointer to a data buffer for FSTAT */
+	struct chirp_file *file;   /**< The file to access for PREAD, PWRITE, SREAD, SWRITE, FSTAT, and FSYNC. */
+	const char *host;	   /**< The host to contact for STAT and LSTAT. */
+	const char *path;	   /**< The path to examine for STAT and LSTAT. */
+	struct chirp_stat *info;   /**< Pointer to a data buffer for FSTAT, STAT, and LSTAT. */
 	void *buffer;		   /**< Pointer to data buffer for PREAD, PWRITE, SREAD, and SWRITE */
 	INT64_T length;		   /**< Length of the data, in bytes, for PREAD, WRITE, SREAD, and SWRITE. */
 	INT64_T stride_length;	   /**< Length of each stride for SREAD and SWRITE. */
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+r="./root.$PPID"
+
+prepare()
+{
+	chirp_start local --root-quota=1M
+	echo "$hostport" > "$c"
+	echo "$root" > "$r"
+	return 0
+}
+
+restart()
+{
+	# stop the server, but keep its root
+	for pid in ./chirp.test_dir.*/chirp.pid /tmp/chirp.test_dir.*/chirp.pid; do
+		if [ -s "$pid" ]; then
+			kill "$(cat "$pid")"
+			rm -f "$pid"
+		fi
+	done
+	sleep 1
+	chirp_start "$root" --root-quota=1M
+}
+
+run()
+{
+	hostport=$(cat "$c")
+	root=$(cat "$r")
+
+	chirp "$hostport" mkdir /data
+	for i in 1 2 3; do
+		dd if=/dev/zero bs=8k count=1 | chirp "$hostport" put /dev/stdin /data/$i
+	done
+	chirp "$hostport" lsalloc / | grep "24.0 KB INUSE"
+
+	# the journal names the changed allocations, which are recounted
+	restart
+	chirp "$hostport" lsalloc / | grep "24.0 KB INUSE"
+
+	# without a journal, the whole tree is scanned again
+	dd if=/dev/zero bs=8k count=1 of="$root/data/4"
+	rm -f "$root/.__alloc_journal"
+	restart
+	chirp "$hostport" lsalloc / | grep "32.0 KB INUSE"
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" "$r"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -23,13 +23,18 @@ run()
 
 	chirp_benchmark "$hostport" foo 10 10 0
 
+	chirp_benchmark --clients 2 --threads 2 --ops 20 --files 10 --file-size 1M --block-size 64K --acl-entries 10 --json benchmark.json "$hostport" /benchmark
+	for workload in stat open create write read pread acl; do
+		grep -q "\"workload\": *\"$workload\"" benchmark.json
+	done
+
 	return 0
 }
 
 clean()
 {
 	chirp_clean
-	rm -f "$c"
+	rm -f "$c" benchmark.json
 	return 0
 }
 
@@ -0,0 +1,41 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+
+prepare()
+{
+	chirp_start local --workers=2
+	echo "$hostport" > "$c"
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+
+	chirp -a unix "$hostport" mkdir /data
+	for i in 1 2 3 4 5 6 7 8; do
+		echo "$i" | chirp -a unix "$hostport" put /dev/stdin /data/$i
+	done
+	for i in 1 2 3 4 5 6 7 8; do
+		[ "$(chirp -a unix "$hostport" cat /data/$i)" = "$i" ]
+	done
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
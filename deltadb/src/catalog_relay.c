@@ -0,0 +1,462 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+The catalog relay gathers the catalog updates of all the managers,
+workers, and factories on a host through a Unix socket, and forwards
+them to the catalogs in batches, so that the catalogs see one compressed
+message every few seconds instead of one connection per sender and update.
+Of several updates of the same record, only the last is forwarded, and
+a record that has not changed since it was last forwarded is not sent
+again until the refresh interval has passed.  Queries through the relay
+are answered from a cache of the results from the catalogs.
+
+The protocol of the socket is described in catalog_query.c.
+*/
+
+#include "cctools.h"
+#include "catalog_query.h"
+#include "debug.h"
+#include "getopt.h"
+#include "hash_table.h"
+#include "buffer.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "link.h"
+#include "list.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+#include "macros.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Largest batch of records forwarded at once, uncompressed, which must fit in the buffer of the catalog. */
+#define RELAY_BATCH_MAX (512*1024)
+
+/* Longest time for the catalogs to answer a query. */
+#define RELAY_QUERY_TIMEOUT 15
+
+struct relay_record {
+	char *hosts;
+	char *text;
+	char *forwarded_text;
+	time_t received_time;
+	time_t forwarded_time;
+};
+
+struct relay_answer {
+	char *text;
+	time_t time;
+};
+
+static const char *socket_path = 0;
+static int flush_interval = 5;
+static int refresh_interval = 300;
+static int cache_lifetime = 15;
+static int lifetime = 1800;
+
+static struct hash_table *records = 0;
+static struct hash_table *answers = 0;
+
+static int updates_received = 0;
+static int queries_received = 0;
+static int queries_cached = 0;
+
+static volatile sig_atomic_t abort_flag = 0;
+
+static void handle_abort( int sig )
+{
+	abort_flag = 1;
+}
+
+static void install_handler( int sig, void (*handler) (int sig) )
+{
+	struct sigaction s;
+	s.sa_handler = handler;
+	sigfillset(&s.sa_mask);
+	s.sa_flags = 0;
+	sigaction(sig, &s, 0);
+}
+
+static void record_delete( struct relay_record *r )
+{
+	free(r->hosts);
+	free(r->text);
+	free(r->forwarded_text);
+	free(r);
+}
+
+static void answer_delete( struct relay_answer *a )
+{
+	free(a->text);
+	free(a);
+}
+
+/* Records are told apart as in the catalog, except for the address, which is the same for all of them. */
+
+static void handle_update( const char *hosts, char *text )
+{
+	struct jx *j = jx_parse_string(text);
+	if(!jx_istype(j,JX_OBJECT)) {
+		debug(D_DEBUG,"ignoring update that is not a JSON object");
+		jx_delete(j);
+		free(text);
+		return;
+	}
+
+	const char *type = jx_lookup_string(j,"type");
+	const char *name = jx_lookup_string(j,"name");
+	const char *uuid = jx_lookup_string(j,"uuid");
+	char *key = string_format("%s/%s/%s/%d/%s",hosts,type ? type : "",name ? name : "",(int)jx_lookup_integer(j,"port"),uuid ? uuid : "");
+	jx_delete(j);
+
+	struct relay_record *r = hash_table_lookup(records,key);
+	if(!r) {
+		r = xxcalloc(1,sizeof(*r));
+		r->hosts = xxstrdup(hosts);
+		hash_table_insert(records,key,r);
+	}
+	free(key);
+
+	free(r->text);
+	r->text = text;
+	r->received_time = time(0);
+
+	updates_received++;
+}
+
+static void handle_query( struct link *l, const char *hosts, const char *filter, time_t stoptime )
+{
+	time_t current = time(0);
+	char *key = string_format("%s\n%s",hosts,filter);
+
+	queries_received++;
+
+	struct relay_answer *a = hash_table_lookup(answers,key);
+	if(a && (current-a->time) < cache_lifetime) {
+		queries_cached++;
+	} else {
+		struct jx *expr = jx_parse_string(filter);
+		struct catalog_query *q = expr ? catalog_query_create(hosts,expr,time(0)+RELAY_QUERY_TIMEOUT) : 0;
+		if(!q) {
+			/* Without an answer, the client asks the catalogs itself. */
+			jx_delete(expr);
+			debug(D_DEBUG,"couldn't query catalogs %s",hosts);
+			free(key);
+			return;
+		}
+
+		struct jx *results = jx_array(0);
+		struct jx *j;
+		while((j = catalog_query_read(q,time(0)+RELAY_QUERY_TIMEOUT))) {
+			jx_array_append(results,j);
+		}
+		catalog_query_delete(q);
+
+		if(!a) {
+			a = xxcalloc(1,sizeof(*a));
+			hash_table_insert(answers,key,a);
+		}
+		free(a->text);
+		a->text = jx_print_string(results);
+		a->time = current;
+		jx_delete(results);
+	}
+
+	link_write(l,a->text,strlen(a->text),stoptime);
+	free(key);
+}
+
+/* Read one request from a client, as described in catalog_query.c. */
+
+static void handle_client( int fd )
+{
+	time_t stoptime = time(0) + CATALOG_RELAY_TIMEOUT;
+	char op[16];
+	char hosts[4096];
+	char line[sizeof(op)+sizeof(hosts)+32];
+	size_t length;
+
+	fcntl(fd,F_SETFL,O_NONBLOCK);
+	struct link *l = link_attach_to_fd(fd);
+
+	if(!link_readline(l,line,sizeof(line),stoptime) || sscanf(line,"%15s %4095s %zu",op,hosts,&length)!=3 || length>CATALOG_RELAY_RECORD_MAX) {
+		debug(D_DEBUG,"ignoring invalid request: %s",line);
+		link_close(l);
+		return;
+	}
+
+	char *body = xxmalloc(length+1);
+	if(link_read(l,body,length,stoptime)!=(ssize_t)length) {
+		debug(D_DEBUG,"ignoring incomplete %s request",op);
+		free(body);
+		link_close(l);
+		return;
+	}
+	body[length] = 0;
+
+	if(!strcmp(op,"update")) {
+		handle_update(hosts,body);
+		body = 0;
+	} else if(!strcmp(op,"query")) {
+		handle_query(l,hosts,body,stoptime);
+	} else {
+		debug(D_DEBUG,"ignoring unknown request: %s",op);
+	}
+
+	free(body);
+	link_close(l);
+}
+
+static void send_batch( const char *hosts, buffer_t *batch, int *batches )
+{
+	buffer_putliteral(batch,"]");
+	if(!catalog_query_send_update(hosts,buffer_tostring(batch),CATALOG_UPDATE_BACKGROUND)) {
+		debug(D_DEBUG,"couldn't forward updates to %s",hosts);
+	}
+	buffer_rewind(batch,0);
+	(*batches)++;
+}
+
+/*
+Forward the records received since the last flush, in one batch for each
+list of catalogs, and forget the records and answers that are too old.
+*/
+
+static void flush_records()
+{
+	time_t current = time(0);
+	struct hash_table *batches = hash_table_create(0,0);
+	int forwarded = 0;
+	int unchanged = 0;
+	int nbatches = 0;
+
+	char *key;
+	struct relay_record *r;
+	HASH_TABLE_ITERATE(records,key,r) {
+		if(!r->text) continue;
+
+		if(r->forwarded_text && !strcmp(r->text,r->forwarded_text) && (current-r->forwarded_time) < refresh_interval) {
+			free(r->text);
+			r->text = 0;
+			unchanged++;
+			continue;
+		}
+
+		buffer_t *batch = hash_table_lookup(batches,r->hosts);
+		if(!batch) {
+			batch = xxmalloc(sizeof(*batch));
+			buffer_init(batch);
+			hash_table_insert(batches,r->hosts,batch);
+		}
+
+		if(buffer_pos(batch)>0 && buffer_pos(batch)+strlen(r->text)+2 > RELAY_BATCH_MAX) {
+			send_batch(r->hosts,batch,&nbatches);
+		}
+
+		buffer_putstring(batch,buffer_pos(batch)>0 ? "," : "[");
+		buffer_putstring(batch,r->text);
+
+		free(r->forwarded_text);
+		r->forwarded_text = r->text;
+		r->forwarded_time = current;
+		r->text = 0;
+		forwarded++;
+	}
+
+	char *hosts;
+	buffer_t *batch;
+	HASH_TABLE_ITERATE(batches,hosts,batch) {
+		if(buffer_pos(batch)>0) send_batch(hosts,batch,&nbatches);
+		buffer_free(batch);
+		free(batch);
+	}
+	hash_table_delete(batches);
+
+	if(forwarded || unchanged) {
+		debug(D_DEBUG,"forwarded %d records in %d batches from %d updates, %d unchanged",forwarded,nbatches,updates_received,unchanged);
+	}
+	updates_received = 0;
+
+	if(queries_received) {
+		debug(D_DEBUG,"answered %d queries, %d from the cache",queries_received,queries_cached);
+	}
+	queries_received = queries_cached = 0;
+
+	struct list *expired = list_create();
+	HASH_TABLE_ITERATE(records,key,r) {
+		if(!r->text && (current-r->received_time) > lifetime) list_push_tail(expired,xxstrdup(key));
+	}
+	while((key = list_pop_head(expired))) {
+		record_delete(hash_table_remove(records,key));
+		free(key);
+	}
+
+	struct relay_answer *a;
+	HASH_TABLE_ITERATE(answers,key,a) {
+		if((current-a->time) >= cache_lifetime) list_push_tail(expired,xxstrdup(key));
+	}
+	while((key = list_pop_head(expired))) {
+		answer_delete(hash_table_remove(answers,key));
+		free(key);
+	}
+	list_delete(expired);
+}
+
+static int relay_serve( const char *path )
+{
+	struct sockaddr_un addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) fatal("socket path is too long: %s",path);
+	strcpy(addr.sun_path,path);
+
+	int fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd<0) fatal("couldn't create socket: %s",strerror(errno));
+
+	/* A socket left behind by a relay that is gone is replaced, but not the socket of a running relay. */
+	if(connect(fd,(struct sockaddr*)&addr,sizeof(addr))==0) fatal("another relay is already running at %s",path);
+	unlink(path);
+
+	if(bind(fd,(struct sockaddr*)&addr,sizeof(addr))<0) fatal("couldn't bind to %s: %s",path,strerror(errno));
+	if(listen(fd,SOMAXCONN)<0) fatal("couldn't listen on %s: %s",path,strerror(errno));
+	fcntl(fd,F_SETFL,O_NONBLOCK);
+
+	return fd;
+}
+
+static void show_help( const char *cmd )
+{
+	fprintf(stdout, "Use: %s [options]\n", cmd);
+	fprintf(stdout, "where options are:\n");
+	fprintf(stdout, " %-30s Answer queries from results up to this old.\n", "-A,--cache-lifetime=<secs>");
+	fprintf(stdout, " %-30s (default is %ds)\n", "", cache_lifetime);
+	fprintf(stdout, " %-30s Enable debugging for this subsystem\n", "-d,--debug=<subsystem>");
+	fprintf(stdout, " %-30s Show this help screen\n", "-h,--help");
+	fprintf(stdout, " %-30s Forward updates at this interval.\n", "-i,--interval=<secs>");
+	fprintf(stdout, " %-30s (default is %ds)\n", "", flush_interval);
+	fprintf(stdout, " %-30s Send debugging to this file. (can also\n", "-o,--debug-file=<file>");
+	fprintf(stdout, " %-30s be :stderr, or :stdout)\n", "");
+	fprintf(stdout, " %-30s Forward unchanged records at this interval.\n", "-r,--refresh=<secs>");
+	fprintf(stdout, " %-30s (default is %ds)\n", "", refresh_interval);
+	fprintf(stdout, " %-30s Listen on this Unix socket.\n", "-s,--socket=<path>");
+	fprintf(stdout, " %-30s (default is $CATALOG_RELAY)\n", "");
+	fprintf(stdout, " %-30s Show version string\n", "-v,--version");
+}
+
+int main( int argc, char *argv[] )
+{
+	signed char ch;
+
+	debug_config(argv[0]);
+
+	static const struct option long_options[] = {
+		{"cache-lifetime", required_argument, 0, 'A'},
+		{"debug", required_argument, 0, 'd'},
+		{"help", no_argument, 0, 'h'},
+		{"interval", required_argument, 0, 'i'},
+		{"debug-file", required_argument, 0, 'o'},
+		{"refresh", required_argument, 0, 'r'},
+		{"socket", required_argument, 0, 's'},
+		{"version", no_argument, 0, 'v'},
+		{0,0,0,0}
+	};
+
+	while((ch = getopt_long(argc, argv, "A:d:hi:o:r:s:v", long_options, NULL)) > -1) {
+		switch(ch) {
+		case 'A':
+			cache_lifetime = string_time_parse(optarg);
+			break;
+		case 'd':
+			debug_flags_set(optarg);
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 'i':
+			flush_interval = MAX(string_time_parse(optarg),1);
+			break;
+		case 'o':
+			debug_config_file(optarg);
+			break;
+		case 'r':
+			refresh_interval = string_time_parse(optarg);
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(!socket_path) socket_path = getenv("CATALOG_RELAY");
+	if(!socket_path || !socket_path[0]) {
+		fprintf(stderr,"%s: please give the socket to listen on with -s or CATALOG_RELAY\n",argv[0]);
+		return 1;
+	}
+	socket_path = xxstrdup(socket_path);
+
+	/* The relay itself talks to the catalogs directly, and sends batches too large for a datagram. */
+	unsetenv("CATALOG_RELAY");
+	setenv("CATALOG_UPDATE_PROTOCOL","tcp",1);
+
+	cctools_version_debug(D_DEBUG, argv[0]);
+
+	install_handler(SIGPIPE, SIG_IGN);
+	install_handler(SIGINT, handle_abort);
+	install_handler(SIGTERM, handle_abort);
+	install_handler(SIGQUIT, handle_abort);
+
+	int fd = relay_serve(socket_path);
+
+	records = hash_table_create(0,0);
+	answers = hash_table_create(0,0);
+
+	debug(D_DEBUG,"relaying catalog updates from %s every %ds",socket_path,flush_interval);
+
+	time_t next_flush = time(0) + flush_interval;
+
+	while(!abort_flag) {
+		struct pollfd p = {fd, POLLIN, 0};
+		int timeout = MAX(next_flush-time(0),0) * 1000;
+
+		if(poll(&p,1,timeout)>0) {
+			int client;
+			while((client = accept(fd,0,0))>=0) {
+				handle_client(client);
+			}
+		}
+
+		if(time(0)>=next_flush) {
+			flush_records();
+			next_flush = time(0) + flush_interval;
+		}
+	}
+
+	flush_records();
+	close(fd);
+	unlink(socket_path);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -7,6 +7,7 @@ See the file COPYING for details.
 
 #include "cctools.h"
 #include "catalog_query.h"
+#include "catalog_delta.h"
 #include "deltadb_query.h"
 #include "datagram.h"
 #include "link.h"
@@ -32,16 +33,24 @@ See the file COPYING for details.
 #include "copy_stream.h"
 #include "zlib.h"
 #include "b64.h"
+#include "sha1.h"
+#include "buffer.h"
+#include "hash_table.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/wait.h>
 #include <sys/select.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <inttypes.h>
 
 #ifndef LINE_MAX
 #define LINE_MAX 1024
@@ -130,6 +139,22 @@ static int outgoing_alarm = 0;
 static int outgoing_timeout = 300;
 static struct list *outgoing_host_list;
 
+/* Fields with a secondary index in the table, for queries that filter on them. */
+static const char *index_fields_option = "type,project,owner";
+static struct list *index_fields = 0;
+
+/* Directory for cached query responses, or null if the cache is disabled. */
+static const char *cache_dir = 0;
+
+/* Time for which a cached response is served even if the table has changed. */
+static int cache_ttl = 0;
+
+/* Time when old responses were most recently removed from the cache directory. */
+static time_t last_cache_prune_time = 0;
+
+/* Count of changes to the table, so that a cached response can tell if it is current. */
+static unsigned long table_epoch = 0;
+
 /* Buffer for uncompressed data is 1MB to accommodate expansion. */
 static char data[1024*1024];
 
@@ -170,6 +195,109 @@ int compare_jx(const void *a, const void *b)
 	return strcasecmp(sa, sb);
 }
 
+/*
+The last base of each stream of delta updates, keyed by the address of
+the sender and the stream it chose.  A base is kept as it was sent,
+before apply_update adds the fields that the catalog sets itself,
+so that the changes that follow apply to the same record as the sender's.
+*/
+
+struct update_base {
+	uint32_t version;
+	struct jx *object;
+	time_t lastheardfrom;
+};
+
+static struct hash_table *update_bases = 0;
+static pthread_mutex_t update_bases_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct jx *parse_delta_update( const char *addr, int port, const char *raw_data, int raw_data_length, char *data, unsigned long data_size, char **error )
+{
+	catalog_delta_kind_t kind;
+	uint64_t stream;
+	uint32_t version;
+	unsigned long data_length = data_size;
+	struct update_base *base;
+	struct jx *j = 0;
+
+	if(!catalog_delta_decode(raw_data,raw_data_length,&kind,&stream,&version,data,&data_length)) {
+		*error = string_format("warning: %s:%d sent an invalid delta update (ignoring it)\n",addr,port);
+		return 0;
+	}
+
+	char *key = string_format("%s:%"PRIu64,addr,stream);
+
+	if(kind==CATALOG_DELTA_BASE) {
+		j = jx_parse_string(data);
+		if(!jx_istype(j,JX_OBJECT) || !jx_is_constant(j)) {
+			*error = string_format("warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,data);
+			jx_delete(j);
+			free(key);
+			return 0;
+		}
+
+		pthread_mutex_lock(&update_bases_mutex);
+		if(!update_bases) update_bases = hash_table_create(0,0);
+		base = hash_table_lookup(update_bases,key);
+		if(!base) {
+			base = xxcalloc(1,sizeof(*base));
+			hash_table_insert(update_bases,key,base);
+		}
+		base->version = version;
+		jx_delete(base->object);
+		base->object = jx_copy(j);
+		base->lastheardfrom = time(0);
+		pthread_mutex_unlock(&update_bases_mutex);
+	} else {
+		int found = 0;
+		pthread_mutex_lock(&update_bases_mutex);
+		base = update_bases ? hash_table_lookup(update_bases,key) : 0;
+		if(base && base->version==version) {
+			j = catalog_delta_apply(base->object,data,data_length);
+			base->lastheardfrom = time(0);
+			found = 1;
+		}
+		pthread_mutex_unlock(&update_bases_mutex);
+
+		if(!found) {
+			/* The base was lost or replaced: wait for the sender to send the next one. */
+			*error = string_format("warning: %s:%d sent changes to an unknown base (ignoring them)\n",addr,port);
+		} else if(!j || !jx_is_constant(j)) {
+			*error = string_format("warning: %s:%d sent invalid delta data (ignoring it)\n",addr,port);
+			jx_delete(j);
+			j = 0;
+		}
+	}
+
+	free(key);
+	return j;
+}
+
+/* Forget the bases of senders that have not been heard from within the lifetime. */
+
+static void remove_expired_bases( time_t current )
+{
+	struct list *expired = list_create();
+	struct update_base *base;
+	char *key;
+
+	pthread_mutex_lock(&update_bases_mutex);
+	if(update_bases) {
+		HASH_TABLE_ITERATE(update_bases,key,base) {
+			if((current-base->lastheardfrom)>lifetime) list_push_tail(expired,xxstrdup(key));
+		}
+		while((key=list_pop_head(expired))) {
+			base = hash_table_remove(update_bases,key);
+			jx_delete(base->object);
+			free(base);
+			free(key);
+		}
+	}
+	pthread_mutex_unlock(&update_bases_mutex);
+
+	list_delete(expired);
+}
+
 static void remove_expired_records()
 {
 	struct jx *j;
@@ -198,9 +326,12 @@ static void remove_expired_records()
 		if( (current-lastheardfrom) > this_lifetime ) {
 				j = deltadb_remove(table,key);
 			if(j) jx_delete(j);
+			table_epoch++;
 		}
 	}
 
+	remove_expired_bases(current);
+
 	last_clean_time = current;
 }
 
@@ -252,23 +383,38 @@ static void make_hash_key(struct jx *j, char *key)
 			uuid ? uuid : "");
 }
 
-static void handle_update( const char *addr, int port, const char *raw_data, int raw_data_length, const char *protocol )
+/*
+Decode the raw data of an update into a JX object, using data as
+a buffer of data_size bytes for uncompressed data.  This does not touch
+the table, so it may be called by several ingest threads at once.
+Returns null and sets error to a message if the update is invalid.
+*/
+
+static struct jx *parse_update( const char *addr, int port, const char *raw_data, int raw_data_length, char *data, unsigned long data_size, char **error )
 {
-	char key[LINE_MAX];
 	unsigned long data_length;
 	struct jx *j;
 
+	*error = 0;
+
+		// If the packet starts with the delta marker, it refers to an earlier base.
+
+		if(raw_data[0]==CATALOG_DELTA_MARKER) {
+			return parse_delta_update(addr,port,raw_data,raw_data_length,data,data_size,error);
+		}
+
 		// If the packet starts with Control-Z (0x1A), it is compressed,
 		// so uncompress it to data[].  Otherwise just copy to data[];.
 
 		if(raw_data[0]==0x1A) {
-			data_length = sizeof(data);
+			data_length = data_size-1;
 			int success = uncompress((Bytef*)data,&data_length,(const Bytef*)&raw_data[1],raw_data_length-1);
 			if(success!=Z_OK) {
-				debug(D_DEBUG,"warning: %s:%d sent invalid compressed data (ignoring it)\n",addr,port);
-				return;
+				*error = string_format("warning: %s:%d sent invalid compressed data (ignoring it)\n",addr,port);
+				return 0;
 			}
 		} else {
+			if((unsigned long)raw_data_length>=data_size) raw_data_length = data_size-1;
 			memcpy(data,raw_data,raw_data_length);
 			data_length = raw_data_length;
 		}
@@ -278,26 +424,41 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 
 		// Once uncompressed, if it starts with a bracket,
 		// then it is JX/JSON, otherwise it is the legacy nvpair format.
+		// A square bracket is an array of records sent by a catalog relay.
 
-		if(data[0]=='{') {
+		if(data[0]=='{' || data[0]=='[') {
 			j = jx_parse_string(data);
 			if(!j) {
-				debug(D_DEBUG,"warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,data);
-				return;
+				*error = string_format("warning: %s:%d sent invalid JSON data (ignoring it)\n%s\n",addr,port,data);
+				return 0;
 			}
 			if(!jx_is_constant(j)) {
-				debug(D_DEBUG,"warning: %s:%d sent non-constant JX data (ignoring it)\n%s\n",addr,port,data);
+				*error = string_format("warning: %s:%d sent non-constant JX data (ignoring it)\n%s\n",addr,port,data);
 				jx_delete(j);
-				return;
+				return 0;
 			}
 		} else {
 			struct nvpair *nv = nvpair_create();
-			if(!nv) return;
+			if(!nv) return 0;
 			nvpair_parse(nv, data);
 			j = nvpair_to_jx(nv);
 			nvpair_delete(nv);
 		}
 
+		return j;
+}
+
+/*
+Complete a parsed update and apply it to the table and the log.
+Only the main thread applies updates, so queries see the table as it
+was between two updates: forked queries get a copy of it at that moment,
+and queries in single mode run while no updates are being applied.
+*/
+
+static void apply_update( const char *addr, struct jx *j, const char *protocol )
+{
+	char key[LINE_MAX];
+
 		jx_insert_string(j, "address", addr);
 		jx_insert_integer(j, "lastheardfrom", time(0));
 
@@ -351,10 +512,45 @@ static void handle_update( const char *addr, int port, const char *raw_data, int
 		}
 
 		deltadb_insert(table, key, j);
+		table_epoch++;
 
 		debug(D_DEBUG, "received %s update from %s",protocol,key);
 }
 
+/*
+A catalog relay forwards the records of all the senders on its host
+at once, as an array, and each is applied as if it came on its own.
+*/
+
+static void apply_updates( const char *addr, struct jx *j, const char *protocol )
+{
+	if(jx_istype(j,JX_ARRAY)) {
+		struct jx *item;
+		while((item = jx_array_shift(j))) {
+			if(jx_istype(item,JX_OBJECT)) {
+				apply_update(addr,item,protocol);
+			} else {
+				jx_delete(item);
+			}
+		}
+		jx_delete(j);
+	} else {
+		apply_update(addr,j,protocol);
+	}
+}
+
+static void handle_update( const char *addr, int port, const char *raw_data, int raw_data_length, const char *protocol )
+{
+	char *error;
+	struct jx *j = parse_update(addr,port,raw_data,raw_data_length,data,sizeof(data),&error);
+	if(j) {
+		apply_updates(addr,j,protocol);
+	} else if(error) {
+		debug(D_DEBUG,"%s",error);
+		free(error);
+	}
+}
+
 /*
 Where possible, we prefer to accept short updates via UDP,
 because these can be accepted quickly in a non-blocking manner.
@@ -409,6 +605,214 @@ void handle_tcp_update( struct link *update_port )
 	link_close(l);
 }
 
+/*
+With ingest threads enabled, updates are received and parsed apart from
+the main loop, so that a burst of updates does not hold up queries.
+One thread receives UDP updates and another accepts TCP updates.
+Each raw update goes on the parse queue, from which the parse threads
+uncompress and parse it, and also on the apply queue in the order it was
+received.  The main loop is woken through a pipe and applies the updates
+at the head of the apply queue once they are parsed, so that an older
+update never overwrites a newer one from the same sender, and the main
+loop remains the only writer of the table and the log.
+*/
+
+/* Number of threads parsing updates, or zero to handle updates in the main loop. */
+static int ingest_threads = 0;
+
+/* Maximum number of updates waiting to be parsed or applied before new ones are dropped. */
+#define INGEST_QUEUE_MAX 100000
+
+struct update {
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+	const char *protocol;
+	char *raw_data;
+	int raw_data_length;
+	struct jx *jx;
+	char *error;
+	int parsed;
+};
+
+static pthread_mutex_t ingest_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ingest_cond = PTHREAD_COND_INITIALIZER;
+static struct list *parse_queue = 0;
+static struct list *apply_queue = 0;
+static int ingest_dropped = 0;
+static int ingest_pipe[2];
+
+static void update_delete( struct update *u )
+{
+	free(u->raw_data);
+	free(u->error);
+	if(u->jx) jx_delete(u->jx);
+	free(u);
+}
+
+static void ingest_receive( const char *addr, int port, const char *raw_data, int raw_data_length, const char *protocol )
+{
+	struct update *u = xxmalloc(sizeof(*u));
+	memset(u,0,sizeof(*u));
+	strncpy(u->addr,addr,sizeof(u->addr)-1);
+	u->port = port;
+	u->protocol = protocol;
+	u->raw_data = xxmalloc(raw_data_length+1);
+	memcpy(u->raw_data,raw_data,raw_data_length);
+	u->raw_data[raw_data_length] = 0;
+	u->raw_data_length = raw_data_length;
+
+	pthread_mutex_lock(&ingest_mutex);
+	if(list_size(apply_queue)<INGEST_QUEUE_MAX) {
+		list_push_tail(parse_queue,u);
+		list_push_tail(apply_queue,u);
+		pthread_cond_signal(&ingest_cond);
+		u = 0;
+	} else {
+		ingest_dropped++;
+	}
+	pthread_mutex_unlock(&ingest_mutex);
+
+	if(u) update_delete(u);
+}
+
+static void *ingest_udp_thread( void *arg )
+{
+	char data[DATAGRAM_PAYLOAD_MAX+1];
+	char addr[DATAGRAM_ADDRESS_MAX];
+	int port;
+
+	while(1) {
+		int result = datagram_recv(update_dgram, data, DATAGRAM_PAYLOAD_MAX, addr, &port, 5000000);
+		if(result <= 0)
+			continue;
+
+		ingest_receive(addr,port,data,result,"udp");
+	}
+
+	return 0;
+}
+
+static void *ingest_tcp_thread( void *arg )
+{
+	char *data = xxmalloc(TCP_PAYLOAD_MAX);
+
+	while(1) {
+		struct link *l = link_accept(update_port,time(0)+5);
+		if(!l) continue;
+
+		time_t stoptime = time(0) + HANDLE_TCP_UPDATE_TIMEOUT;
+
+		char addr[LINK_ADDRESS_MAX];
+		int port;
+
+		link_address_remote(l,addr,&port);
+
+		int length = link_read(l,data,TCP_PAYLOAD_MAX-1,stoptime);
+
+		if(length>0 && !(length>4 && !strncmp(data,"GET ",4))) {
+			ingest_receive(addr,port,data,length,"tcp");
+		}
+
+		link_close(l);
+	}
+
+	return 0;
+}
+
+static void *ingest_parse_thread( void *arg )
+{
+	char *buffer = xxmalloc(sizeof(data));
+
+	while(1) {
+		pthread_mutex_lock(&ingest_mutex);
+		while(!list_size(parse_queue)) {
+			pthread_cond_wait(&ingest_cond,&ingest_mutex);
+		}
+		struct update *u = list_pop_head(parse_queue);
+		pthread_mutex_unlock(&ingest_mutex);
+
+		u->jx = parse_update(u->addr,u->port,u->raw_data,u->raw_data_length,buffer,sizeof(data),&u->error);
+		free(u->raw_data);
+		u->raw_data = 0;
+
+		pthread_mutex_lock(&ingest_mutex);
+		u->parsed = 1;
+		pthread_mutex_unlock(&ingest_mutex);
+
+		/* If the pipe is already full, the main loop is already due to wake up. */
+		char c = 0;
+		if(write(ingest_pipe[1],&c,1)<0) {}
+	}
+
+	return 0;
+}
+
+static void ingest_start()
+{
+	parse_queue = list_create();
+	apply_queue = list_create();
+
+	if(pipe(ingest_pipe)<0) fatal("couldn't create pipe: %s",strerror(errno));
+	fcntl(ingest_pipe[0],F_SETFL,O_NONBLOCK);
+	fcntl(ingest_pipe[1],F_SETFL,O_NONBLOCK);
+
+	/* Signals are left to the main loop. */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK,&all,&old);
+
+	pthread_t thread;
+	int i;
+
+	for(i=0;i<ingest_threads;i++) {
+		if(pthread_create(&thread,0,ingest_parse_thread,0)!=0) fatal("couldn't create thread: %s",strerror(errno));
+		pthread_detach(thread);
+	}
+
+	if(pthread_create(&thread,0,ingest_udp_thread,0)!=0) fatal("couldn't create thread: %s",strerror(errno));
+	pthread_detach(thread);
+
+	if(pthread_create(&thread,0,ingest_tcp_thread,0)!=0) fatal("couldn't create thread: %s",strerror(errno));
+	pthread_detach(thread);
+
+	pthread_sigmask(SIG_SETMASK,&old,0);
+
+	debug(D_DEBUG,"ingesting updates with %d parse threads",ingest_threads);
+}
+
+/* Apply the updates received before any that is still being parsed. */
+
+static void ingest_apply()
+{
+	char c[1024];
+	while(read(ingest_pipe[0],c,sizeof(c))>0) {}
+
+	struct list *updates = list_create();
+	struct update *u;
+
+	pthread_mutex_lock(&ingest_mutex);
+	while((u = list_peek_head(apply_queue)) && u->parsed) {
+		list_push_tail(updates,list_pop_head(apply_queue));
+	}
+	int dropped = ingest_dropped;
+	ingest_dropped = 0;
+	pthread_mutex_unlock(&ingest_mutex);
+
+	if(dropped>0) debug(D_DEBUG,"warning: dropped %d updates because the ingest queue was full",dropped);
+
+	while((u = list_pop_head(updates))) {
+		if(u->jx) {
+			apply_updates(u->addr,u->jx,u->protocol);
+			u->jx = 0;
+		} else if(u->error) {
+			debug(D_DEBUG,"%s",u->error);
+		}
+		update_delete(u);
+	}
+
+	list_delete(updates);
+}
+
 static struct jx_table html_headers[] = {
 	{"type", "TYPE", JX_TABLE_MODE_PLAIN, JX_TABLE_ALIGN_LEFT, 0},
 	{"name", "NAME", JX_TABLE_MODE_PLAIN, JX_TABLE_ALIGN_LEFT, 0},
@@ -429,7 +833,9 @@ int jx_eval_is_true( struct jx *expr, struct jx *context )
 	return result;
 }
 
-void send_http_response( struct link *l, int code, const char *message, const char *content_type, time_t stoptime )
+/* Send the headers of a response, with the encoding, length, and entity tag of the body if they are known. */
+
+static void send_http_response_body( struct link *l, int code, const char *message, const char *content_type, const char *encoding, long length, const char *etag, time_t stoptime )
 {
 	time_t current = time(0);
 	link_printf(l,stoptime, "HTTP/1.1 %d %s\n",code,message);
@@ -437,10 +843,252 @@ void send_http_response( struct link *l, int code, const char *message, const ch
 	link_printf(l,stoptime, "Server: catalog_server\n");
 	link_printf(l,stoptime, "Connection: close\n");
 	link_printf(l,stoptime, "Access-Control-Allow-Origin: *\n");
+	if(encoding) link_printf(l,stoptime, "Content-Encoding: %s\n",encoding);
+	if(length>=0) link_printf(l,stoptime, "Content-Length: %ld\n",length);
+	if(etag) link_printf(l,stoptime, "ETag: %s\n",etag);
 	link_printf(l,stoptime, "Content-type: %s; charset=utf-8\n\n",content_type);
 	link_flush_output(l);
 }
 
+void send_http_response( struct link *l, int code, const char *message, const char *content_type, time_t stoptime )
+{
+	send_http_response_body(l,code,message,content_type,0,-1,0,stoptime);
+}
+
+/*
+A query of the current table is tagged with the start time of the server
+and the epoch of the table, so that a client repeating it can be told with
+a 304 that nothing has changed, instead of being sent the same records.
+*/
+
+static char *query_etag( long long start, unsigned long epoch )
+{
+	return string_format("\"%lld.%lu\"",start,epoch);
+}
+
+static int query_etag_matches( const char *if_none_match, const char *etag )
+{
+	return if_none_match[0] && (strstr(if_none_match,etag) || !strcmp(if_none_match,"*"));
+}
+
+static void send_not_modified( struct link *l, const char *etag, time_t stoptime )
+{
+	send_http_response_body(l,304,"Not Modified","text/plain",0,-1,etag,stoptime);
+}
+
+/*
+Many clients repeat the same query of the current table every few seconds.
+When a cache directory is given, the JSON response to each query is kept
+there, both plain and gzip compressed, in a file named by the hash of the
+query, normalized by parsing and printing the expression.
+Queries are answered by forked processes, so the file records the start
+time of the server and the epoch of the table when it was made, and is
+used by later queries if the table has not changed since, or if it is
+younger than the cache lifetime.
+*/
+
+static char *query_cache_key( const char *path )
+{
+	char strexpr[LINE_MAX];
+
+	if(!strcmp(path,"/query.json")) {
+		return xxstrdup(path);
+	} else if(sscanf(path,"/query/%[^/]",strexpr)==1) {
+		char *key = 0;
+		struct buffer buf;
+		buffer_init(&buf);
+		if(b64_decode(strexpr,&buf)==0) {
+			struct jx *expr = jx_parse_string(buffer_tostring(&buf));
+			if(expr) {
+				char *str = jx_print_string(expr);
+				key = string_format("/query/%s",str);
+				free(str);
+				jx_delete(expr);
+			}
+		}
+		buffer_free(&buf);
+		return key;
+	} else {
+		return 0;
+	}
+}
+
+static char *query_cache_filename( const char *key )
+{
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+	sha1_buffer(key,strlen(key),digest);
+	return string_format("%s/%s",cache_dir,sha1_string(digest));
+}
+
+/* Send a cached response if there is a current one. Returns true if it was sent. */
+
+static int query_cache_send( struct link *l, const char *key, int accept_gzip, const char *if_none_match, time_t stoptime )
+{
+	char *filename = query_cache_filename(key);
+	FILE *file = fopen(filename,"r");
+	free(filename);
+	if(!file) return 0;
+
+	long long cache_starttime, created;
+	unsigned long epoch;
+	long plain_length, gzip_length;
+	char cache_key[LINE_MAX];
+	int sent = 0;
+
+	if(fscanf(file,"%lld %lu %lld %ld %ld ",&cache_starttime,&epoch,&created,&plain_length,&gzip_length)==5
+	&& fgets(cache_key,sizeof(cache_key),file)) {
+		string_chomp(cache_key);
+
+		int current = cache_starttime==starttime && epoch==table_epoch;
+		int fresh = (time(0)-created) < cache_ttl;
+
+		if(!strcmp(cache_key,key) && (current || fresh)) {
+			char *etag = query_etag(cache_starttime,epoch);
+			if(query_etag_matches(if_none_match,etag)) {
+				send_not_modified(l,etag,stoptime);
+				free(etag);
+				fclose(file);
+				debug(D_DEBUG,"query '%s' unchanged since cached",key);
+				return 1;
+			}
+
+			int use_gzip = accept_gzip && gzip_length>0;
+			long length = use_gzip ? gzip_length : plain_length;
+			char *data = xxmalloc(length+1);
+
+			if(use_gzip) fseek(file,plain_length,SEEK_CUR);
+
+			if(fread(data,1,length,file)==(size_t)length) {
+				send_http_response_body(l,200,"OK","text/plain",use_gzip ? "gzip" : 0,length,etag,stoptime);
+				link_write(l,data,length,stoptime);
+				sent = 1;
+				debug(D_DEBUG,"query '%s' answered from cache",key);
+			}
+
+			free(data);
+			free(etag);
+		}
+	}
+
+	fclose(file);
+	return sent;
+}
+
+/* Compress data in the gzip format, or return false if it cannot be. */
+
+static int gzip_data( const char *data, size_t length, buffer_t *output )
+{
+	z_stream z;
+	memset(&z,0,sizeof(z));
+
+	if(deflateInit2(&z,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)!=Z_OK) return 0;
+
+	uLong bound = deflateBound(&z,length);
+	char *compressed = xxmalloc(bound);
+
+	z.next_in = (Bytef *)data;
+	z.avail_in = length;
+	z.next_out = (Bytef *)compressed;
+	z.avail_out = bound;
+
+	int result = deflate(&z,Z_FINISH);
+	if(result==Z_STREAM_END) {
+		buffer_putlstring(output,compressed,z.total_out);
+	}
+
+	deflateEnd(&z);
+	free(compressed);
+
+	return result==Z_STREAM_END;
+}
+
+/* Keep a response in the cache, replacing any older one at once. */
+
+static void query_cache_store( const char *key, const char *data, size_t length )
+{
+	buffer_t gzip;
+	buffer_init(&gzip);
+	if(!gzip_data(data,length,&gzip)) buffer_rewind(&gzip,0);
+
+	char *filename = query_cache_filename(key);
+	char *tmpname = string_format("%s.%d",filename,(int)getpid());
+
+	FILE *file = fopen(tmpname,"w");
+	if(file) {
+		fprintf(file,"%lld %lu %lld %ld %ld %s\n",(long long)starttime,table_epoch,(long long)time(0),(long)length,(long)buffer_pos(&gzip),key);
+		fwrite(data,1,length,file);
+		fwrite(buffer_tostring(&gzip),1,buffer_pos(&gzip),file);
+		if(fclose(file)==0 && rename(tmpname,filename)==0) {
+			debug(D_DEBUG,"query '%s' stored in cache",key);
+		} else {
+			unlink(tmpname);
+		}
+	}
+
+	free(tmpname);
+	free(filename);
+	buffer_free(&gzip);
+}
+
+/*
+Every distinct query leaves a file in the cache directory, so remove the
+responses that are no longer of use.  A response older than the cache
+lifetime is served only while the table is unchanged, which seldom lasts
+a whole clean interval, so anything older than both is removed, along
+with temporary files left by query processes that died while writing.
+*/
+
+static void query_cache_prune()
+{
+	time_t current = time(0);
+
+	if(!cache_dir || (current-last_cache_prune_time)<clean_interval) return;
+	last_cache_prune_time = current;
+
+	DIR *dir = opendir(cache_dir);
+	if(!dir) return;
+
+	int removed = 0;
+	struct dirent *d;
+	while((d=readdir(dir))) {
+		if(d->d_name[0]=='.') continue;
+
+		char *filename = string_format("%s/%s",cache_dir,d->d_name);
+		struct stat info;
+		if(stat(filename,&info)==0 && S_ISREG(info.st_mode) && (current-info.st_mtime) > (cache_ttl+clean_interval)) {
+			if(unlink(filename)==0) removed++;
+		}
+		free(filename);
+	}
+	closedir(dir);
+
+	if(removed>0) debug(D_DEBUG,"removed %d old responses from the query cache",removed);
+}
+
+/*
+Send a JSON response computed for this query, keeping it in the cache if there is a key,
+and compressing it if the client accepts gzip.
+*/
+
+static void send_json_response( struct link *l, buffer_t *body, const char *cache_key, const char *etag, int accept_gzip, time_t stoptime )
+{
+	size_t length;
+	const char *data = buffer_tolstring(body,&length);
+
+	if(cache_key) query_cache_store(cache_key,data,length);
+
+	buffer_t gzip;
+	buffer_init(&gzip);
+	if(accept_gzip && gzip_data(data,length,&gzip)) {
+		send_http_response_body(l,200,"OK","text/plain","gzip",buffer_pos(&gzip),etag,stoptime);
+		link_write(l,buffer_tostring(&gzip),buffer_pos(&gzip),stoptime);
+	} else {
+		send_http_response_body(l,200,"OK","text/plain",0,length,etag,stoptime);
+		link_write(l,data,length,stoptime);
+	}
+	buffer_free(&gzip);
+}
+
 void send_html_header( struct link *l, time_t stoptime )
 {
 	link_printf(l,stoptime, "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\" \"http://www.w3.org/TR/html4/strict.dtd\">\n");
@@ -449,6 +1097,45 @@ void send_html_header( struct link *l, time_t stoptime )
 	link_printf(l,stoptime, "</head>\n");
 }
 
+/*
+Find an equality between an indexed field and a string that any record
+must satisfy to match the filter, so that only the records with that value
+need to be evaluated.  Returns true and sets name and value if found.
+*/
+
+static int find_indexed_equality( struct jx *expr, const char **name, const char **value )
+{
+	if(!jx_istype(expr,JX_OPERATOR)) return 0;
+
+	struct jx *left = expr->u.oper.left;
+	struct jx *right = expr->u.oper.right;
+
+	if(expr->u.oper.type==JX_OP_AND) {
+		return find_indexed_equality(left,name,value) || find_indexed_equality(right,name,value);
+	}
+
+	if(expr->u.oper.type!=JX_OP_EQ) return 0;
+
+	if(jx_istype(left,JX_STRING) && jx_istype(right,JX_SYMBOL)) {
+		struct jx *t = left;
+		left = right;
+		right = t;
+	}
+
+	if(!jx_istype(left,JX_SYMBOL) || !jx_istype(right,JX_STRING)) return 0;
+
+	const char *field;
+	LIST_ITERATE(index_fields,field) {
+		if(!strcmp(field,left->u.symbol_name)) {
+			*name = field;
+			*value = right->u.string_value;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 static void handle_query( struct link *ql, time_t st )
 {
 	char line[LINE_MAX];
@@ -464,6 +1151,8 @@ static void handle_query( struct link *ql, time_t st )
 	int port;
 	long time_start, time_stop;
 	long timestamp = 0;
+	int accept_gzip = 0;
+	char if_none_match[LINE_MAX] = "";
 
 	char *hkey;
 	struct jx *j;
@@ -489,6 +1178,15 @@ static void handle_query( struct link *ql, time_t st )
 			if(line[0] == 0) {
 				break;
 			}
+
+			if(!strncasecmp(line,"Accept-Encoding:",16) && strstr(line,"gzip")) {
+				accept_gzip = 1;
+			}
+
+			if(!strncasecmp(line,"If-None-Match:",14)) {
+				string_chomp(line);
+				strncpy(if_none_match,line+14,sizeof(if_none_match)-1);
+			}
 		}
 	} else {
 		return;
@@ -534,6 +1232,45 @@ static void handle_query( struct link *ql, time_t st )
 		return;
 	}
 
+	if(1==sscanf(full_path, "/subscribe/%[^/]",strexpr)) {
+		// send the matching records now, and then each change to them as it happens
+		struct buffer buf;
+		buffer_init(&buf);
+		if(b64_decode(strexpr,&buf)==0) {
+			struct jx *expr = jx_parse_string(buffer_tostring(&buf));
+			if(expr) {
+				if(link_using_ssl(ql)) {
+					send_http_response(ql,501,"Server Error","text/plain",st);
+					link_printf(ql,st,"Sorry, unable to serve subscriptions over HTTPS.");
+				} else if(!fork_mode) {
+					send_http_response(ql,501,"Server Error","text/plain",st);
+					link_printf(ql,st,"Sorry, unable to serve subscriptions in single process mode.");
+				} else {
+					send_http_response(ql,200,"OK","text/plain",st);
+
+					// A subscription lasts until the client goes away.
+					alarm(0);
+
+					struct deltadb_query *query = deltadb_query_create();
+					deltadb_query_set_filter(query,expr);
+					deltadb_query_set_output(query,fdopen(link_fd(ql),"w"));
+					deltadb_query_set_display(query,DELTADB_DISPLAY_STREAM);
+					deltadb_query_execute_follow(query,table,history_dir);
+					deltadb_query_delete(query);
+					jx_delete(expr);
+				}
+			} else {
+				send_http_response(ql,400,"Bad Request","text/plain",st);
+				link_printf(ql,st,"Invalid query text.\n");
+			}
+		} else {
+			send_http_response(ql,400,"Bad Request","text/plain",st);
+			link_printf(ql,st,"Invalid base-64 encoding.\n");
+		}
+		buffer_free(&buf);
+		return;
+	}
+
 	// check for historical timestamp prefix
 	int matches = sscanf(full_path, "/history/%ld%s", &timestamp, path);
 	if (matches == 2) {
@@ -551,12 +1288,52 @@ static void handle_query( struct link *ql, time_t st )
 		table = deltadb_create_snapshot(history_dir, timestamp);
 	}
 	
+	/* Tell a client repeating a query of the current table if nothing has changed. */
+	char *etag = 0;
+	if(!timestamp && (!strcmp(path,"/query.json") || !strncmp(path,"/query/",7))) {
+		etag = query_etag(starttime,table_epoch);
+		if(query_etag_matches(if_none_match,etag)) {
+			send_not_modified(ql,etag,st);
+			free(etag);
+			return;
+		}
+	}
+
+	/* Answer a repeated query of the current table from the cache. */
+	char *cache_key = 0;
+	if(cache_dir && !timestamp) {
+		cache_key = query_cache_key(path);
+		if(cache_key && query_cache_send(ql,cache_key,accept_gzip,if_none_match,st)) {
+			free(cache_key);
+			free(etag);
+			return;
+		}
+	}
+
+	/* Parse a filter first, since it may limit the records to be loaded. */
+	struct jx *filter = 0;
+	if(1==sscanf(path, "/query/%[^/]",strexpr)) {
+		struct buffer buf;
+		buffer_init(&buf);
+		if(b64_decode(strexpr,&buf)==0) filter = jx_parse_string(buffer_tostring(&buf));
+		buffer_free(&buf);
+	}
+
 	/* load the hash table entries into one big array */
+	const char *index_name, *index_value;
 	n = 0;
-	deltadb_firstkey(table);
-	while(deltadb_nextkey(table, &hkey, &j)) {
-		array[n] = j;
-		n++;
+	if(filter && find_indexed_equality(filter,&index_name,&index_value) && deltadb_index_firstkey(table,index_name,index_value)) {
+		while(deltadb_index_nextkey(table, &hkey, &j)) {
+			array[n] = j;
+			n++;
+		}
+		debug(D_DEBUG,"query uses index on %s to consider %d records",index_name,n);
+	} else {
+		deltadb_firstkey(table);
+		while(deltadb_nextkey(table, &hkey, &j)) {
+			array[n] = j;
+			n++;
+		}
 	}
 
 	// sort the array by name before displaying
@@ -567,33 +1344,38 @@ static void handle_query( struct link *ql, time_t st )
 		for(i = 0; i < n; i++)
 			catalog_export_nvpair(array[i], ql,st);
 	} else if(!strcmp(path, "/query.json")) {
-		send_http_response(ql,200,"OK","text/plain",st);
-		link_printf(ql,st,"[\n");
+		buffer_t body;
+		buffer_init(&body);
+		buffer_putliteral(&body,"[\n");
 		for(i = 0; i < n; i++) {
-			jx_print_link(array[i],ql,st);
-			if(i<(n-1)) link_printf(ql,st,",\n");
+			jx_print_buffer(array[i],&body);
+			if(i<(n-1)) buffer_putliteral(&body,",\n");
 		}
-		link_printf(ql,st,"\n]\n");
+		buffer_putliteral(&body,"\n]\n");
+		send_json_response(ql,&body,cache_key,etag,accept_gzip,st);
+		buffer_free(&body);
 	} else if(1==sscanf(path, "/query/%[^/]",strexpr)) {
 
 		struct buffer buf;
 		buffer_init(&buf);
 		if(b64_decode(strexpr,&buf)==0) {
-			struct jx *expr = jx_parse_string(buffer_tostring(&buf));
+			struct jx *expr = filter;
 			if(expr) {
-				send_http_response(ql,200,"OK","text/plain",st);
-				link_printf(ql,st,"[\n");
+				buffer_t body;
+				buffer_init(&body);
+				buffer_putliteral(&body,"[\n");
 
 				int count = 0;
 				for(i = 0; i < n; i++) {
 					if(jx_eval_is_true(expr,array[i])) {
-						if(count>0) link_printf(ql,st,",\n");
-						jx_print_link(array[i],ql,st);
+						if(count>0) buffer_putliteral(&body,",\n");
+						jx_print_buffer(array[i],&body);
 						count++;
 					}
 				}
-				link_printf(ql,st,"\n]\n");
-				jx_delete(expr);
+				buffer_putliteral(&body,"\n]\n");
+				send_json_response(ql,&body,cache_key,etag,accept_gzip,st);
+				buffer_free(&body);
 				debug(D_DEBUG,"query '%s' matched %d records",buffer_tostring(&buf),count);
 			} else {
 				send_http_response(ql,400,"Bad Request","text/plain",st);
@@ -694,6 +1476,10 @@ static void handle_query( struct link *ql, time_t st )
 		link_printf(ql,st,"<pre>%s</pre>",path);
 		link_printf(ql,st,"<p><a href=/>Return to Index</a></p>");
 	}
+
+	jx_delete(filter);
+	free(cache_key);
+	free(etag);
 }
 
 void handle_tcp_query( struct link *port, int using_ssl )
@@ -738,9 +1524,13 @@ static void show_help(const char *cmd)
 	fprintf(stdout, "where options are:\n");
 	fprintf(stdout, " %-30s Run as a daemon.\n", "-b,--background");
 	fprintf(stdout, " %-30s Write process identifier (PID) to file.\n", "-B,--pid-file=<file>");
+	fprintf(stdout, " %-30s Cache query responses in this directory.\n", "-c,--cache-dir=<directory>");
+	fprintf(stdout, " %-30s Serve cached responses up to this old,\n", "-A,--cache-lifetime=<time>");
+	fprintf(stdout, " %-30s even if the table has changed. (default is 0s)\n", "");
 	fprintf(stdout, " %-30s Enable debugging for this subsystem\n", "-d,--debug=<subsystem>");
 	fprintf(stdout, " %-30s Show this help screen\n", "-h,--help");
 	fprintf(stdout, " %-30s Record catalog history to this directory.\n", "-H,--history=<directory>");
+	fprintf(stdout, " %-30s Index these comma separated fields for queries. (default is %s)\n", "-i,--index=<fields>", index_fields_option);
 	fprintf(stdout, " %-30s Listen only on this network interface.\n", "-I,--interface=<addr>");
 	fprintf(stdout, " %-30s Lifetime of data, in seconds (default is %d)\n", "-l,--lifetime=<secs>", lifetime);
 	fprintf(stdout, " %-30s Log new updates to this file.\n", "-L,--update-log=<file>");
@@ -758,6 +1548,8 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s File containing SSL certificate for HTTPS.\n","-C,--ssl-cert=<file>");
 	fprintf(stdout, " %-30s File containing SSL key for HTTPS.\n","-K,--ssl-key=<file>");
 	fprintf(stdout, " %-30s Single process mode; do not work on queries.\n", "-S,--single");
+	fprintf(stdout, " %-30s Receive and parse updates on this many threads.\n", "-t,--ingest-threads=<n>");
+	fprintf(stdout, " %-30s (default is 0, in the main loop)\n", "");
 	fprintf(stdout, " %-30s Maximum time to allow a query process to run.\n", "-T,--timeout=<time>");
 	fprintf(stdout, " %-30s (default is %ds)\n", "", child_procs_timeout);
 	fprintf(stdout, " %-30s Send status updates to this host. (default is\n", "-u,--update-host=<host>");
@@ -790,9 +1582,12 @@ int main(int argc, char *argv[])
 	static const struct option long_options[] = {
 		{"background", no_argument, 0, 'b'},
 		{"pid-file", required_argument, 0, 'B'},
+		{"cache-dir", required_argument, 0, 'c'},
+		{"cache-lifetime", required_argument, 0, 'A'},
 		{"debug", required_argument, 0, 'd'},
 		{"help", no_argument, 0, 'h'},
 		{"history", required_argument, 0, 'H'},
+		{"index", required_argument, 0, 'i'},
 		{"interface", required_argument, 0, 'I'},
 		{"lifetime", required_argument, 0, 'l'},
 		{"update-log", required_argument, 0, 'L'},
@@ -806,6 +1601,7 @@ int main(int argc, char *argv[])
 		{"ssl-cert", required_argument, 0, 'C'},
 		{"ssl-key", required_argument, 0, 'K'},
 		{"single", no_argument, 0, 'S'},
+		{"ingest-threads", required_argument, 0, 't'},
 		{"timeout", required_argument, 0, 'T'},
 		{"update-host", required_argument, 0, 'u'},
 		{"update-interval", required_argument, 0, 'U'},
@@ -815,7 +1611,7 @@ int main(int argc, char *argv[])
 		{0,0,0,0}};
 
 
-	while((ch = getopt_long(argc, argv, "bB:C:d:hH:I:l:K:L:m:M:n:o:O:p:P:ST:u:U:vZ:", long_options, NULL)) > -1) {
+	while((ch = getopt_long(argc, argv, "A:bB:c:C:d:hH:i:I:l:K:L:m:M:n:o:O:p:P:St:T:u:U:vZ:", long_options, NULL)) > -1) {
 		switch (ch) {
 			case 'b':
 				is_daemon = 1;
@@ -824,6 +1620,12 @@ int main(int argc, char *argv[])
 				free(pidfile);
 				pidfile = strdup(optarg);
 				break;
+			case 'A':
+				cache_ttl = string_time_parse(optarg);
+				break;
+			case 'c':
+				cache_dir = optarg;
+				break;
 			case 'd':
 				debug_flags_set(optarg);
 				break;
@@ -840,6 +1642,9 @@ int main(int argc, char *argv[])
 			case 'H':
 				history_dir = strdup(optarg);
 				break;
+			case 'i':
+				index_fields_option = optarg;
+				break;
 			case 'I':
 				free(interface);
 				interface = strdup(optarg);
@@ -874,6 +1679,9 @@ int main(int argc, char *argv[])
 			case 'S':
 				fork_mode = 0;
 				break;
+			case 't':
+				ingest_threads = atoi(optarg);
+				break;
 			case 'T':
 				child_procs_timeout = string_time_parse(optarg);
 				break;
@@ -929,10 +1737,22 @@ int main(int argc, char *argv[])
 	username_get(owner);
 	starttime = time(0);
 
+	if(cache_dir && mkdir(cache_dir,0755)!=0 && errno!=EEXIST)
+		fatal("couldn't create directory %s: %s\n",cache_dir,strerror(errno));
+
 	table = deltadb_create(history_dir);
 	if(!table)
 		fatal("couldn't create directory %s: %s\n",history_dir,strerror(errno));
 
+	index_fields = list_create();
+	char *fields = xxstrdup(index_fields_option);
+	char *field;
+	for(field = strtok(fields,","); field; field = strtok(0,",")) {
+		list_push_tail(index_fields,xxstrdup(field));
+		deltadb_add_index(table,field);
+	}
+	free(fields);
+
 	query_port = link_serve_address(interface, port);
 	if(query_port) {
 		/*
@@ -993,6 +1813,8 @@ int main(int argc, char *argv[])
 	opts_write_port_file(port_file,port);
 	opts_write_port_file(ssl_port_file,ssl_port);
 
+	if(ingest_threads>0) ingest_start();
+
 	while(1) {
 		fd_set rfds;
 		int dfd = datagram_fd(update_dgram);
@@ -1004,6 +1826,7 @@ int main(int argc, char *argv[])
 		struct timeval timeout;
 
 		remove_expired_records();
+		query_cache_prune();
 
 		if(time(0) > outgoing_alarm) {
 			update_all_catalogs();
@@ -1022,8 +1845,12 @@ int main(int argc, char *argv[])
 		}
 
 		FD_ZERO(&rfds);
-		FD_SET(dfd, &rfds);
-		FD_SET(ufd, &rfds);
+		if(ingest_threads>0) {
+			FD_SET(ingest_pipe[0], &rfds);
+		} else {
+			FD_SET(dfd, &rfds);
+			FD_SET(ufd, &rfds);
+		}
 
 		/* Only accept incoming connections if child_procs available. */
 
@@ -1036,7 +1863,9 @@ int main(int argc, char *argv[])
 				FD_SET(sfd,&rfds);
 			}
 		}
-		maxfd = MAX(ufd,MAX(dfd, lfd)) + 1;
+		maxfd = MAX(ufd,MAX(dfd, lfd));
+		if(ingest_threads>0) maxfd = MAX(maxfd,ingest_pipe[0]);
+		maxfd++;
 
 		timeout.tv_sec = 5;
 		timeout.tv_usec = 0;
@@ -1045,12 +1874,18 @@ int main(int argc, char *argv[])
 		if(result <= 0)
 			continue;
 
-		if(FD_ISSET(dfd, &rfds)) {
-			handle_udp_updates(update_dgram);
-		}
+		if(ingest_threads>0) {
+			if(FD_ISSET(ingest_pipe[0], &rfds)) {
+				ingest_apply();
+			}
+		} else {
+			if(FD_ISSET(dfd, &rfds)) {
+				handle_udp_updates(update_dgram);
+			}
 
-		if(FD_ISSET(ufd, &rfds)) {
-			handle_tcp_update(update_port);
+			if(FD_ISSET(ufd, &rfds)) {
+				handle_tcp_update(update_port);
+			}
 		}
 
 		if(FD_ISSET(lfd, &rfds)) {
@@ -9,6 +9,7 @@ See the file COPYING for details.
 #include "jx_parse.h"
 
 #include "hash_table.h"
+#include "buffer.h"
 #include "debug.h"
 #include "nvpair.h"
 #include "nvpair_jx.h"
@@ -28,9 +29,25 @@ struct deltadb {
 	int logday;
 	FILE *logfile;
 	time_t last_log_time;
+	time_t next_checkpoint_time;
 	bool snapshot;
+	struct hash_table *indexes;
+	struct hash_table *index_iter;
 };
 
+/*
+A secondary index on a field maps each string value of that field
+to a table of the keys of the records that have that value.
+*/
+
+struct deltadb_index {
+	char *name;
+	struct hash_table *values;
+};
+
+/* Interval between the checkpoints written within a day's log. */
+#define DELTADB_CHECKPOINT_INTERVAL 3600
+
 /* Take the current state of the table and write it out verbatim to a checkpoint file. */
 
 static int checkpoint_write( struct deltadb *db, const char *filename )
@@ -165,6 +182,50 @@ static void log_select( struct deltadb *db )
 	// Reset the time so that an absolute time record comes next.
 	db->last_log_time = 0;
 
+	// The first checkpoint within the day comes at the next interval.
+	db->next_checkpoint_time = (current / DELTADB_CHECKPOINT_INTERVAL + 1) * DELTADB_CHECKPOINT_INTERVAL;
+}
+
+/*
+Once per interval, write a checkpoint of the table as it is at the end of
+the log, and add its time and the position in the log to the day's index.
+A query for a later time can then load that checkpoint and start reading
+the log from that position, instead of from the start of the day.
+The log continues with an absolute time record, so that it can be read
+from that position on.
+*/
+
+static void log_checkpoint( struct deltadb *db )
+{
+	log_select(db);
+
+	time_t current = time(0);
+	if(current < db->next_checkpoint_time) return;
+
+	db->next_checkpoint_time = (current / DELTADB_CHECKPOINT_INTERVAL + 1) * DELTADB_CHECKPOINT_INTERVAL;
+
+	fflush(db->logfile);
+	fseek(db->logfile,0,SEEK_END);
+	long offset = ftell(db->logfile);
+	if(offset<0) return;
+
+	char filename[PATH_MAX];
+	sprintf(filename,"%s/%d/%d.%lld.ckpt",db->logdir,db->logyear,db->logday,(long long)current);
+	if(!checkpoint_write(db,filename)) {
+		debug(D_NOTICE,"could not write checkpoint %s: %s",filename,strerror(errno));
+		return;
+	}
+
+	sprintf(filename,"%s/%d/%d.idx",db->logdir,db->logyear,db->logday);
+	FILE *index = fopen(filename,"a");
+	if(!index) {
+		debug(D_NOTICE,"could not open checkpoint index %s: %s",filename,strerror(errno));
+		return;
+	}
+	fprintf(index,"%lld %ld\n",(long long)current,offset);
+	fclose(index);
+
+	db->last_log_time = 0;
 }
 
 /* If time has advanced since the last event, log a time record. */
@@ -205,64 +266,91 @@ static void log_create( struct deltadb *db, const char *key, struct jx *j )
 	free(str);
 }
 
-/* Log update events that indicate the difference between objects a (old) and b (new)*/
+/*
+Bring the stored object a up to date with the new object b, in place,
+and log the difference.  Each value of b that differs is moved into a,
+so only the changed fields are touched, and the values of b that match
+are discarded along with b itself.  If log is false, nothing is logged.
+*/
 
-static void log_updates( struct deltadb *db, const char *key, struct jx *a, struct jx *b )
+static void update_in_place( struct deltadb *db, const char *key, struct jx *a, struct jx *b, int log )
 {
-	// u is the object containing the update
-	struct jx *u = jx_object(0);
+	struct jx_pair *p;
 
-	// For each item in the old object:
-	// If the new item is different, add it to an update object.
-	// If the new item is missing, log a remove event.
+	// For each item in the old object that is missing in the new one,
+	// log a remove event.  The items are removed after the walk,
+	// so that the walk never holds on to a pair that has been freed.
 
-	struct jx_pair *p;
-	for(p=a->u.pairs;p;p=p->next) {
+	struct jx *missing = jx_array(0);
 
+	for(p=a->u.pairs;p;p=p->next) {
 		const char *name = p->key->u.string_value;
-		struct jx *avalue = p->value;
-
-		// Do not log these special cases, because they do not carry new information:
-		if(!strcmp(name,"lastheardfrom")) continue;
-		if(!strcmp(name,"uptime")) continue;
+		if(jx_lookup(b,name)) continue;
 
-		struct jx *bvalue = jx_lookup(b,name);
-		if(bvalue) {
-			if(jx_equals(avalue,bvalue)) {
-				// items match, do nothing.
-			} else {
-				// item changed, include it in the update object.
-				jx_insert(u,jx_string(name),jx_copy(bvalue));
-			}
-		} else {
-			// item was removed, log a remove record instead
+		// Do not log these special cases, as below.
+		if(log && strcmp(name,"lastheardfrom") && strcmp(name,"uptime")) {
 			log_message(db,"R %s %s\n",key,name);
 		}
+		jx_array_append(missing,jx_copy(p->key));
 	}
 
-	// For each item in the new object:
-	// If it doesn't exist in the old one, add it to the update object.
+	struct jx *item;
+	void *i = 0;
+	while((item = jx_iterate_array(missing,&i))) {
+		jx_delete(jx_remove(a,item));
+	}
+	jx_delete(missing);
+
+	// For each item in the new object that is different or missing
+	// in the old one, move it into the old object and add it to the update.
+
+	buffer_t update;
+	buffer_init(&update);
 
 	for(p=b->u.pairs;p;p=p->next) {
 
 		const char *name = p->key->u.string_value;
-		struct jx *bvalue = p->value;
-
 		struct jx *avalue = jx_lookup(a,name);
-		if(!avalue) {
-			// item changed, include it.
-			jx_insert(u,jx_string(name),jx_copy(bvalue));
+
+		if(avalue) {
+			if(jx_equals(avalue,p->value)) continue;
+
+			// Exchange the values, so the old one is discarded with b.
+			struct jx t = *avalue;
+			*avalue = *p->value;
+			*p->value = t;
+
+			// Do not log these special cases, because they do not carry new information:
+			if(!strcmp(name,"lastheardfrom")) continue;
+			if(!strcmp(name,"uptime")) continue;
+
+			if(log) {
+				buffer_putliteral(&update,",");
+				jx_print_buffer(p->key,&update);
+				buffer_putliteral(&update,":");
+				jx_print_buffer(avalue,&update);
+			}
+		} else {
+			if(log) {
+				buffer_putliteral(&update,",");
+				jx_print_buffer(p->key,&update);
+				buffer_putliteral(&update,":");
+				jx_print_buffer(p->value,&update);
+			}
+
+			jx_insert(a,p->key,p->value);
+			p->key = 0;
+			p->value = 0;
 		}
 	}
 
 	// If the update is not empty, log it as a merge (M) event.
-	if(u->u.pairs) {
-		char *str = jx_print_string(u);
-		log_message(db,"M %s %s\n",key,str);
-		free(str);
+	if(buffer_pos(&update)>0) {
+		log_message(db,"M %s {%s}\n",key,buffer_tostring(&update)+1);
 	}
 
-	jx_delete(u);
+	buffer_free(&update);
+	jx_delete(b);
 }
 
 /* Log an event indicating an entire object was deleted. */
@@ -496,8 +584,11 @@ static struct deltadb * deltadb_create_instance( const char *logdir, time_t time
 	db->logday = 0;
 	db->logfile = 0;
 	db->last_log_time = 0;
+	db->next_checkpoint_time = 0;
 	db->logdir = 0;
 	db->snapshot = snapshot;
+	db->indexes = hash_table_create(0,0);
+	db->index_iter = 0;
 
 	if(logdir) {
 		db->logdir = strdup(logdir);
@@ -517,6 +608,50 @@ struct deltadb * deltadb_create_snapshot( const char *logdir, time_t timestamp )
 	return deltadb_create_instance(logdir, timestamp, true);
 }
 
+static void index_insert( struct deltadb_index *index, const char *key, struct jx *j )
+{
+	const char *value = jx_lookup_string(j,index->name);
+	if(!value) return;
+
+	struct hash_table *keys = hash_table_lookup(index->values,value);
+	if(!keys) {
+		keys = hash_table_create(0,0);
+		hash_table_insert(index->values,value,keys);
+	}
+	hash_table_insert(keys,key,(void*)1);
+}
+
+static void index_remove( struct deltadb_index *index, const char *key, struct jx *j )
+{
+	const char *value = jx_lookup_string(j,index->name);
+	if(!value) return;
+
+	struct hash_table *keys = hash_table_lookup(index->values,value);
+	if(!keys) return;
+
+	hash_table_remove(keys,key);
+	if(hash_table_size(keys)==0) {
+		hash_table_remove(index->values,value);
+		hash_table_delete(keys);
+	}
+}
+
+/* Move a record from its old values to its new values in each index. */
+
+static void indexes_update( struct deltadb *db, const char *key, struct jx *old, struct jx *new )
+{
+	char *name;
+	struct deltadb_index *index;
+
+	HASH_TABLE_ITERATE(db->indexes,name,index) {
+		const char *a = old ? jx_lookup_string(old,name) : 0;
+		const char *b = new ? jx_lookup_string(new,name) : 0;
+		if(a && b && !strcmp(a,b)) continue;
+		if(old) index_remove(index,key,old);
+		if(new) index_insert(index,key,new);
+	}
+}
+
 void deltadb_insert( struct deltadb *db, const char *key, struct jx *nv )
 {
 	if (db->snapshot) {
@@ -524,19 +659,18 @@ void deltadb_insert( struct deltadb *db, const char *key, struct jx *nv )
 		return;
 	}
 
-	struct jx *old = hash_table_remove(db->table,key);
+	if(db->logdir) log_checkpoint(db);
 
-	hash_table_insert(db->table,key,nv);
+	struct jx *old = hash_table_lookup(db->table,key);
 
-	if(db->logdir) {
-		if(old) {
-			log_updates(db,key,old,nv);
-		} else {
-			log_create(db,key,nv);
-		}
-	}
+	indexes_update(db,key,old,nv);
 
-	if(old) jx_delete(old);
+	if(old) {
+		update_in_place(db,key,old,nv,db->logdir!=0);
+	} else {
+		hash_table_insert(db->table,key,nv);
+		if(db->logdir) log_create(db,key,nv);
+	}
 
 	log_flush(db);
 }
@@ -555,7 +689,11 @@ struct jx * deltadb_remove( struct deltadb *db, const char *key )
 
 	const char *nkey = strdup(key);
 
+	if(db->logdir) log_checkpoint(db);
+
 	struct jx *j = hash_table_remove(db->table,key);
+	if(j) indexes_update(db,key,j,0);
+
 	if(db->logdir && j) {
 		log_delete(db,nkey);
 		log_flush(db);
@@ -573,4 +711,75 @@ int  deltadb_nextkey( struct deltadb *db, char **key, struct jx **j )
 	return hash_table_nextkey(db->table,key,(void**)j);
 }
 
+int deltadb_add_index( struct deltadb *db, const char *name )
+{
+	if(hash_table_lookup(db->indexes,name)) return 1;
+
+	struct deltadb_index *index = malloc(sizeof(*index));
+	index->name = strdup(name);
+	index->values = hash_table_create(0,0);
+	hash_table_insert(db->indexes,name,index);
+
+	char *key;
+	struct jx *j;
+	HASH_TABLE_ITERATE(db->table,key,j) {
+		index_insert(index,key,j);
+	}
+
+	return 1;
+}
+
+int deltadb_index_firstkey( struct deltadb *db, const char *name, const char *value )
+{
+	struct deltadb_index *index = hash_table_lookup(db->indexes,name);
+	if(!index) return 0;
+
+	db->index_iter = hash_table_lookup(index->values,value);
+	if(db->index_iter) hash_table_firstkey(db->index_iter);
+
+	return 1;
+}
+
+int deltadb_index_nextkey( struct deltadb *db, char **key, struct jx **j )
+{
+	void *unused;
+
+	if(!db->index_iter) return 0;
+
+	while(hash_table_nextkey(db->index_iter,key,&unused)) {
+		*j = hash_table_lookup(db->table,*key);
+		if(*j) return 1;
+	}
+
+	db->index_iter = 0;
+	return 0;
+}
+
+int deltadb_log_position( struct deltadb *db, int *year, int *day, long *offset )
+{
+	if(!db->logdir || db->snapshot) return 0;
+
+	struct stat info;
+
+	if(db->logfile) {
+		log_flush(db);
+		if(fstat(fileno(db->logfile),&info)!=0) return 0;
+		*year = db->logyear;
+		*day = db->logday;
+		*offset = info.st_size;
+	} else {
+		/* Nothing is logged yet, so the next change goes at the end of today's log. */
+		time_t current = time(0);
+		struct tm *t = gmtime(&current);
+		*year = t->tm_year + 1900;
+		*day = t->tm_yday;
+
+		char filename[PATH_MAX];
+		sprintf(filename,"%s/%d/%d.log",db->logdir,*year,*day);
+		*offset = stat(filename,&info)==0 ? info.st_size : 0;
+	}
+
+	return 1;
+}
+
 /* vim: set noexpandtab tabstop=4: */
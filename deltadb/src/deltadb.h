@@ -39,6 +39,13 @@ log file is named DIR/YEAR/DAY.log
 The checkpoint file is simply a json object containing
 the keys and values of all the objects in the database.
 
+Once an hour, a further checkpoint of the table is written to
+DIR/YEAR/DAY.TIME.ckpt, and a line with TIME and the byte offset of the
+end of the log at that time is added to the index DIR/YEAR/DAY.idx.
+The log then continues with an absolute time record.  A query for a
+later time can start from that checkpoint and offset, instead of playing
+the log from the start of the day.
+
 The log file consists of a series of entries,
 each one a json array in the following formats:
 
@@ -123,4 +130,47 @@ This function returns the next primary key and object in the iteration.
 
 int deltadb_nextkey( struct deltadb *db, char **key, struct jx **j );
 
+/** Maintain a secondary index on a field.
+Records are indexed by the string value of the field, and records
+without a string value for the field are not in the index.
+The index is built from the records in the database now, and then
+kept up to date by @ref deltadb_insert and @ref deltadb_remove.
+@param db The database to access.
+@param name The name of the field to index.
+@return Non-zero on success, zero otherwise.
+*/
+
+int deltadb_add_index( struct deltadb *db, const char *name );
+
+/** Begin iteration over the records with a given value of an indexed field.
+Next, invoke @ref deltadb_index_nextkey to retrieve each matching record.
+@param db The database to access.
+@param name The name of an indexed field.
+@param value The string value to match.
+@return Non-zero if the field is indexed, zero if it is not, in which case the caller must visit every record instead.
+*/
+
+int deltadb_index_firstkey( struct deltadb *db, const char *name, const char *value );
+
+/** Continue iteration over the records with a given value of an indexed field.
+@param db The database to access.
+@param key A pointer to an unset char pointer, which will be made to point to the primary key.
+@param j A pointer to an unset jx pointer, which will be made to point to the next object.
+@return Zero if there are no more matching records, non-zero otherwise.
+*/
+
+int deltadb_index_nextkey( struct deltadb *db, char **key, struct jx **j );
+
+/** Find the end of the log being written.
+Every change to the database up to now is in the log before this position,
+so a reader may continue from here to see each later change as it is made.
+The log of each day is named DIR/YEAR/DAY.log, where the day is in UTC.
+@param db The database to access.
+@param year A pointer to an integer, which will be set to the year of the current log.
+@param day A pointer to an integer, which will be set to the day of the year of the current log.
+@param offset A pointer to a long, which will be set to the length of the current log.
+@return Non-zero if the database has a log on disk, zero otherwise.
+*/
+int deltadb_log_position( struct deltadb *db, int *year, int *day, long *offset );
+
 #endif
@@ -0,0 +1,704 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "deltadb_archive.h"
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "hash_table.h"
+#include "list.h"
+#include "buffer.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include "zlib.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+An archive begins with a text header giving the number of streams,
+followed by one line for each stream with its name, compressed size,
+and uncompressed size.  The compressed streams follow in the same order.
+
+events  - One byte per event: C, D, M, U, R, or T.
+keys    - The string number of the key of each C, D, M, U, and R event.
+names   - The string number of the field name of each U and R event.
+times   - The change in time of each T event.
+objects - The JSON text of each C and M event, each ending with a null.
+strings - Each string in order of first use, each ending with a null.
+field.X - The value of each U event on field X.
+
+Numbers are written seven bits at a time, low bits first, and signed
+differences are folded so that small negative numbers stay small.
+A field value is a one byte tag followed by its data:
+i - the change from the previous integer value of the field,
+d - the eight bytes of a double, low byte first,
+s - a string number,
+t, f, n - true, false, or null, with no data,
+j - the JSON text of any other value, ending with a null.
+*/
+
+#define ARCHIVE_MAGIC "deltadb-archive 1"
+#define ARCHIVE_LINE_MAX 4096
+#define COLUMN_BUFFER_SIZE 65536
+
+struct column {
+	z_stream zstream;
+	buffer_t output;
+	unsigned char input[COLUMN_BUFFER_SIZE];
+	size_t input_length;
+	uint64_t raw_size;
+	int64_t last_integer;
+	char *name;
+};
+
+struct archive_writer {
+	struct list *columns;
+	struct hash_table *fields;
+	struct hash_table *strings;
+	uint64_t nstrings;
+	struct column *events;
+	struct column *keys;
+	struct column *names;
+	struct column *times;
+	struct column *objects;
+	struct column *string_column;
+	int64_t last_time;
+	long nevents;
+	int failed;
+};
+
+/* The stream parser passes only a query to the handlers, so the writer keeps its state here. */
+
+static struct archive_writer *writer = 0;
+
+static uint64_t zigzag_encode( int64_t value )
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode( uint64_t value )
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int column_deflate( struct column *c, int flush )
+{
+	unsigned char chunk[COLUMN_BUFFER_SIZE];
+
+	c->zstream.next_in = c->input;
+	c->zstream.avail_in = c->input_length;
+
+	do {
+		c->zstream.next_out = chunk;
+		c->zstream.avail_out = sizeof(chunk);
+		int result = deflate(&c->zstream,flush);
+		if(result==Z_STREAM_ERROR) return 0;
+		buffer_putlstring(&c->output,(const char *)chunk,sizeof(chunk)-c->zstream.avail_out);
+	} while(c->zstream.avail_out==0);
+
+	c->input_length = 0;
+	return 1;
+}
+
+static struct column *column_create( struct archive_writer *w, const char *name )
+{
+	struct column *c = xxmalloc(sizeof(*c));
+	memset(c,0,sizeof(*c));
+	c->name = xxstrdup(name);
+	buffer_init(&c->output);
+	if(deflateInit(&c->zstream,Z_DEFAULT_COMPRESSION)!=Z_OK) w->failed = 1;
+	list_push_tail(w->columns,c);
+	return c;
+}
+
+static void column_delete( struct column *c )
+{
+	deflateEnd(&c->zstream);
+	buffer_free(&c->output);
+	free(c->name);
+	free(c);
+}
+
+static void column_put( struct column *c, const void *data, size_t length )
+{
+	const unsigned char *bytes = data;
+
+	c->raw_size += length;
+
+	while(length>0) {
+		size_t n = COLUMN_BUFFER_SIZE - c->input_length;
+		if(n>length) n = length;
+		memcpy(&c->input[c->input_length],bytes,n);
+		c->input_length += n;
+		bytes += n;
+		length -= n;
+		if(c->input_length==COLUMN_BUFFER_SIZE && !column_deflate(c,Z_NO_FLUSH)) {
+			writer->failed = 1;
+		}
+	}
+}
+
+static void column_put_byte( struct column *c, int byte )
+{
+	unsigned char b = byte;
+	column_put(c,&b,1);
+}
+
+static void column_put_number( struct column *c, uint64_t value )
+{
+	unsigned char bytes[10];
+	int n = 0;
+
+	do {
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if(value) bytes[n] |= 0x80;
+		n++;
+	} while(value);
+
+	column_put(c,bytes,n);
+}
+
+static void column_put_string( struct column *c, const char *str )
+{
+	column_put(c,str,strlen(str)+1);
+}
+
+static void column_put_json( struct column *c, struct jx *j )
+{
+	char *str = jx_print_string(j);
+	column_put_string(c,str);
+	free(str);
+}
+
+static void put_string_number( struct archive_writer *w, struct column *c, const char *str )
+{
+	uint64_t n = (uintptr_t)hash_table_lookup(w->strings,str);
+	if(!n) {
+		n = ++w->nstrings;
+		hash_table_insert(w->strings,str,(void*)(uintptr_t)n);
+		column_put_string(w->string_column,str);
+	}
+	column_put_number(c,n-1);
+}
+
+static void put_event( struct archive_writer *w, int type, const char *key )
+{
+	column_put_byte(w->events,type);
+	if(key) put_string_number(w,w->keys,key);
+	w->nevents++;
+}
+
+static void put_field_value( struct archive_writer *w, const char *name, struct jx *value )
+{
+	struct column *c = hash_table_lookup(w->fields,name);
+	if(!c) {
+		char *column_name = string_format("field.%s",name);
+		c = column_create(w,column_name);
+		free(column_name);
+		hash_table_insert(w->fields,name,c);
+	}
+
+	if(value->type==JX_INTEGER) {
+		int64_t v = value->u.integer_value;
+		column_put_byte(c,'i');
+		column_put_number(c,zigzag_encode(v - c->last_integer));
+		c->last_integer = v;
+	} else if(value->type==JX_DOUBLE) {
+		uint64_t bits;
+		unsigned char bytes[8];
+		memcpy(&bits,&value->u.double_value,sizeof(bits));
+		int i;
+		for(i=0;i<8;i++) bytes[i] = (bits >> (8*i)) & 0xff;
+		column_put_byte(c,'d');
+		column_put(c,bytes,sizeof(bytes));
+	} else if(value->type==JX_STRING) {
+		column_put_byte(c,'s');
+		put_string_number(w,c,value->u.string_value);
+	} else if(value->type==JX_BOOLEAN) {
+		column_put_byte(c,value->u.boolean_value ? 't' : 'f');
+	} else if(value->type==JX_NULL) {
+		column_put_byte(c,'n');
+	} else {
+		column_put_byte(c,'j');
+		column_put_json(c,value);
+	}
+}
+
+static int write_create_event( struct deltadb_query *query, const char *key, struct jx *jobject )
+{
+	put_event(writer,'C',key);
+	column_put_json(writer->objects,jobject);
+	jx_delete(jobject);
+	return 1;
+}
+
+static int write_delete_event( struct deltadb_query *query, const char *key )
+{
+	put_event(writer,'D',key);
+	return 1;
+}
+
+static int write_update_event( struct deltadb_query *query, const char *key, const char *name, struct jx *jvalue )
+{
+	put_event(writer,'U',key);
+	put_string_number(writer,writer->names,name);
+	put_field_value(writer,name,jvalue);
+	jx_delete(jvalue);
+	return 1;
+}
+
+static int write_merge_event( struct deltadb_query *query, const char *key, struct jx *jobject )
+{
+	put_event(writer,'M',key);
+	column_put_json(writer->objects,jobject);
+	jx_delete(jobject);
+	return 1;
+}
+
+static int write_remove_event( struct deltadb_query *query, const char *key, const char *name )
+{
+	put_event(writer,'R',key);
+	put_string_number(writer,writer->names,name);
+	return 1;
+}
+
+static int write_time_event( struct deltadb_query *query, time_t starttime, time_t stoptime, time_t current )
+{
+	put_event(writer,'T',0);
+	column_put_number(writer->times,zigzag_encode((int64_t)current - writer->last_time));
+	writer->last_time = current;
+	return 1;
+}
+
+static int write_raw_event( struct deltadb_query *query, const char *line )
+{
+	return 1;
+}
+
+static struct deltadb_event_handlers write_handlers = {
+	write_create_event,
+	write_delete_event,
+	write_update_event,
+	write_merge_event,
+	write_remove_event,
+	write_time_event,
+	write_raw_event
+};
+
+long deltadb_archive_write( FILE *log, FILE *archive )
+{
+	struct archive_writer w;
+	memset(&w,0,sizeof(w));
+
+	w.columns = list_create();
+	w.fields = hash_table_create(0,0);
+	w.strings = hash_table_create(0,0);
+	w.events = column_create(&w,"events");
+	w.keys = column_create(&w,"keys");
+	w.names = column_create(&w,"names");
+	w.times = column_create(&w,"times");
+	w.objects = column_create(&w,"objects");
+	w.string_column = column_create(&w,"strings");
+
+	writer = &w;
+	deltadb_process_stream(0,&write_handlers,log,0,0);
+	writer = 0;
+
+	if(ferror(log)) w.failed = 1;
+
+	struct column *c;
+
+	list_first_item(w.columns);
+	while((c = list_next_item(w.columns))) {
+		if(!column_deflate(c,Z_FINISH)) w.failed = 1;
+	}
+
+	if(!w.failed) {
+		fprintf(archive,"%s %d\n",ARCHIVE_MAGIC,list_size(w.columns));
+
+		list_first_item(w.columns);
+		while((c = list_next_item(w.columns))) {
+			fprintf(archive,"%s %zu %llu\n",c->name,buffer_pos(&c->output),(unsigned long long)c->raw_size);
+		}
+
+		list_first_item(w.columns);
+		while((c = list_next_item(w.columns))) {
+			size_t length;
+			const char *data = buffer_tolstring(&c->output,&length);
+			fwrite(data,1,length,archive);
+		}
+
+		if(ferror(archive)) w.failed = 1;
+	}
+
+	while((c = list_pop_head(w.columns))) {
+		column_delete(c);
+	}
+
+	list_delete(w.columns);
+	hash_table_delete(w.fields);
+	hash_table_delete(w.strings);
+
+	return w.failed ? -1 : w.nevents;
+}
+
+struct archive_column {
+	long offset;
+	size_t compressed_size;
+	size_t size;
+	unsigned char *data;
+	size_t pos;
+	int64_t last_integer;
+};
+
+struct archive_reader {
+	FILE *file;
+	struct hash_table *columns;
+	char **strings;
+	uint64_t nstrings;
+};
+
+static void corrupt_archive( const char *what )
+{
+	fprintf(stderr,"corrupt archive: %s\n",what);
+}
+
+static int archive_open( struct archive_reader *r, FILE *file )
+{
+	char line[ARCHIVE_LINE_MAX];
+	char name[ARCHIVE_LINE_MAX];
+	int ncolumns;
+
+	memset(r,0,sizeof(*r));
+	r->file = file;
+	r->columns = hash_table_create(0,0);
+
+	if(!fgets(line,sizeof(line),file) || sscanf(line,ARCHIVE_MAGIC " %d",&ncolumns)!=1) {
+		corrupt_archive("bad header");
+		return 0;
+	}
+
+	/* The streams begin after the header, so collect the sizes first. */
+
+	struct list *order = list_create();
+	int i;
+
+	for(i=0;i<ncolumns;i++) {
+		size_t compressed_size, size;
+		if(!fgets(line,sizeof(line),file) || sscanf(line,"%s %zu %zu",name,&compressed_size,&size)!=3) {
+			corrupt_archive("bad stream header");
+			list_delete(order);
+			return 0;
+		}
+
+		struct archive_column *c = xxmalloc(sizeof(*c));
+		memset(c,0,sizeof(*c));
+		c->compressed_size = compressed_size;
+		c->size = size;
+		hash_table_insert(r->columns,name,c);
+		list_push_tail(order,c);
+	}
+
+	long offset = ftell(file);
+
+	struct archive_column *c;
+	while((c = list_pop_head(order))) {
+		c->offset = offset;
+		offset += c->compressed_size;
+	}
+
+	list_delete(order);
+	return 1;
+}
+
+static void archive_close( struct archive_reader *r )
+{
+	char *name;
+	struct archive_column *c;
+
+	hash_table_firstkey(r->columns);
+	while(hash_table_nextkey(r->columns,&name,(void**)&c)) {
+		free(c->data);
+		free(c);
+	}
+
+	hash_table_delete(r->columns);
+	free(r->strings);
+}
+
+/* Load and uncompress a stream the first time it is needed. A missing stream is empty. */
+
+static struct archive_column *archive_column( struct archive_reader *r, const char *name )
+{
+	struct archive_column *c = hash_table_lookup(r->columns,name);
+	if(!c) {
+		c = xxmalloc(sizeof(*c));
+		memset(c,0,sizeof(*c));
+		c->data = xxmalloc(1);
+		hash_table_insert(r->columns,name,c);
+		return c;
+	}
+
+	if(c->data) return c;
+
+	unsigned char *compressed = xxmalloc(c->compressed_size+1);
+	c->data = xxmalloc(c->size+1);
+
+	uLongf size = c->size;
+	if(fseek(r->file,c->offset,SEEK_SET)!=0
+	|| fread(compressed,1,c->compressed_size,r->file)!=c->compressed_size
+	|| uncompress(c->data,&size,compressed,c->compressed_size)!=Z_OK
+	|| size!=c->size) {
+		corrupt_archive(name);
+		c->size = 0;
+	}
+
+	free(compressed);
+	return c;
+}
+
+static int get_byte( struct archive_column *c, int *value )
+{
+	if(c->pos>=c->size) return 0;
+	*value = c->data[c->pos++];
+	return 1;
+}
+
+static int get_number( struct archive_column *c, uint64_t *value )
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	while(c->pos<c->size && shift<64) {
+		unsigned char b = c->data[c->pos++];
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)) {
+			*value = v;
+			return 1;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static const char *get_string( struct archive_column *c )
+{
+	if(c->pos>=c->size) return 0;
+	const char *str = (const char *)&c->data[c->pos];
+	const char *end = memchr(str,0,c->size-c->pos);
+	if(!end) return 0;
+	c->pos += end - str + 1;
+	return str;
+}
+
+static const char *get_string_number( struct archive_reader *r, struct archive_column *c )
+{
+	uint64_t n;
+	if(!get_number(c,&n) || n>=r->nstrings) return 0;
+	return r->strings[n];
+}
+
+static struct jx *get_field_value( struct archive_reader *r, struct archive_column *c )
+{
+	int tag;
+	if(!get_byte(c,&tag)) return 0;
+
+	if(tag=='i') {
+		uint64_t n;
+		if(!get_number(c,&n)) return 0;
+		c->last_integer += zigzag_decode(n);
+		return jx_integer(c->last_integer);
+	} else if(tag=='d') {
+		if(c->size-c->pos<8) return 0;
+		uint64_t bits = 0;
+		int i;
+		for(i=0;i<8;i++) bits |= (uint64_t)c->data[c->pos++] << (8*i);
+		double d;
+		memcpy(&d,&bits,sizeof(d));
+		return jx_double(d);
+	} else if(tag=='s') {
+		const char *str = get_string_number(r,c);
+		return str ? jx_string(str) : 0;
+	} else if(tag=='t') {
+		return jx_boolean(1);
+	} else if(tag=='f') {
+		return jx_boolean(0);
+	} else if(tag=='n') {
+		return jx_null();
+	} else if(tag=='j') {
+		const char *str = get_string(c);
+		return str ? jx_parse_string(str) : 0;
+	} else {
+		return 0;
+	}
+}
+
+static int load_strings( struct archive_reader *r )
+{
+	struct archive_column *c = archive_column(r,"strings");
+
+	uint64_t n = 0;
+	size_t i;
+	for(i=0;i<c->size;i++) {
+		if(!c->data[i]) n++;
+	}
+
+	r->strings = xxmalloc(sizeof(char*)*(n+1));
+
+	const char *str;
+	while((str = get_string(c))) {
+		r->strings[r->nstrings++] = (char *)str;
+	}
+
+	return r->nstrings==n;
+}
+
+int deltadb_process_archive( struct deltadb_query *query, struct deltadb_event_handlers *handlers, FILE *archive, struct hash_table *fields, time_t starttime, time_t stoptime )
+{
+	struct archive_reader r;
+	int result = 1;
+
+	if(!archive_open(&r,archive) || !load_strings(&r)) {
+		archive_close(&r);
+		return 1;
+	}
+
+	struct archive_column *events = archive_column(&r,"events");
+	struct archive_column *keys = archive_column(&r,"keys");
+	struct archive_column *names = archive_column(&r,"names");
+	struct archive_column *times = archive_column(&r,"times");
+	struct archive_column *objects = archive_column(&r,"objects");
+
+	/*
+	Field streams are found by string number, the first time that each
+	field is updated.  A field that the query does not need is marked
+	so that its updates are passed over.
+	*/
+
+	struct archive_column **field_columns = xxmalloc(sizeof(*field_columns)*(r.nstrings+1));
+	memset(field_columns,0,sizeof(*field_columns)*(r.nstrings+1));
+	struct archive_column skipped;
+
+	int64_t current = 0;
+
+	jx_parse_set_static_mode(true);
+
+	int type;
+	while(get_byte(events,&type)) {
+		const char *key = 0;
+		const char *name = 0;
+		const char *str;
+		struct jx *jvalue;
+		uint64_t n;
+
+		if(type!='T') {
+			key = get_string_number(&r,keys);
+			if(!key) goto corrupt;
+		}
+
+		if(type=='C' || type=='M') {
+			str = get_string(objects);
+			if(!str) goto corrupt;
+			jvalue = jx_parse_string(str);
+			if(!jvalue) {
+				if(type=='M') continue;
+				jvalue = jx_string(str);
+			}
+
+			if(type=='C') {
+				if(!handlers->deltadb_create_event(query,key,jvalue)) break;
+			} else {
+				if(!handlers->deltadb_merge_event(query,key,jvalue)) break;
+			}
+
+		} else if(type=='D') {
+			if(!handlers->deltadb_delete_event(query,key)) break;
+
+		} else if(type=='U') {
+			if(!get_number(names,&n) || n>=r.nstrings) goto corrupt;
+			name = r.strings[n];
+
+			struct archive_column *c = field_columns[n];
+			if(!c) {
+				if(fields && !hash_table_lookup(fields,name)) {
+					c = &skipped;
+				} else {
+					char *column_name = string_format("field.%s",name);
+					c = archive_column(&r,column_name);
+					free(column_name);
+				}
+				field_columns[n] = c;
+			}
+
+			if(c==&skipped) continue;
+
+			jvalue = get_field_value(&r,c);
+			if(!jvalue) goto corrupt;
+
+			if(!handlers->deltadb_update_event(query,key,name,jvalue)) break;
+
+		} else if(type=='R') {
+			name = get_string_number(&r,names);
+			if(!name) goto corrupt;
+
+			if(!handlers->deltadb_remove_event(query,key,name)) break;
+
+		} else if(type=='T') {
+			if(!get_number(times,&n)) goto corrupt;
+			current += zigzag_decode(n);
+
+			if(!handlers->deltadb_time_event(query,starttime,stoptime,current)) break;
+
+			if(stoptime && current>stoptime) {
+				result = 0;
+				break;
+			}
+
+		} else {
+			goto corrupt;
+		}
+	}
+
+	goto done;
+
+corrupt:
+	corrupt_archive("bad event");
+
+done:
+	jx_parse_set_static_mode(false);
+
+	free(field_columns);
+	archive_close(&r);
+
+	return result;
+}
+
+time_t deltadb_archive_last_time( FILE *archive )
+{
+	struct archive_reader r;
+	int64_t current = 0;
+
+	if(archive_open(&r,archive)) {
+		struct archive_column *times = archive_column(&r,"times");
+		uint64_t n;
+		while(get_number(times,&n)) {
+			current += zigzag_decode(n);
+		}
+	}
+
+	archive_close(&r);
+
+	return current;
+}
+
+/* vim: set noexpandtab tabstop=4: */
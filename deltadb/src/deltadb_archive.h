@@ -0,0 +1,48 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DELTADB_ARCHIVE_H
+#define DELTADB_ARCHIVE_H
+
+/*
+An archive holds the log of one closed day in a compressed, columnar form.
+The record types, keys, field names, times, whole objects, and the values
+of each field are kept in separate streams, and each stream is compressed
+on its own.  Strings are stored once in a dictionary and referred to by
+number, while times and integer values are stored as the difference from
+the previous value in the same stream.
+
+Playing an archive produces the same events as playing the log it came from.
+A query that depends only on some fields may name them, and updates to
+any other field are skipped without reading that field's stream.
+*/
+
+#include "deltadb_stream.h"
+#include "hash_table.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+Convert the text log read from log into an archive written to archive.
+Returns the number of events written, or -1 on failure.
+*/
+
+long deltadb_archive_write( FILE *log, FILE *archive );
+
+/*
+Play the events of an archive to the handlers, like deltadb_process_stream.
+If fields is not null, only updates to the fields that are keys of the
+table are played.
+*/
+
+int deltadb_process_archive( struct deltadb_query *query, struct deltadb_event_handlers *handlers, FILE *archive, struct hash_table *fields, time_t starttime, time_t stoptime );
+
+/* Return the last time recorded in an archive, or zero if there is none. */
+
+time_t deltadb_archive_last_time( FILE *archive );
+
+#endif
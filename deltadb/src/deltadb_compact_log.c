@@ -0,0 +1,291 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Convert the logs of closed days in a deltadb directory into archives.
+Each YEAR/DAY.log that is older than today becomes YEAR/DAY.arc,
+which deltadb_query plays in place of the log.  The archive is checked
+by playing it back before it replaces anything, and the text log,
+its index, and the checkpoints within the day are removed only if asked.
+*/
+
+#include "deltadb_archive.h"
+#include "deltadb_stream.h"
+
+#include "jx.h"
+#include "getopt.h"
+#include "cctools.h"
+#include "stringtools.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static long events_played = 0;
+
+static int count_create_event( struct deltadb_query *query, const char *key, struct jx *jobject )
+{
+	jx_delete(jobject);
+	events_played++;
+	return 1;
+}
+
+static int count_delete_event( struct deltadb_query *query, const char *key )
+{
+	events_played++;
+	return 1;
+}
+
+static int count_update_event( struct deltadb_query *query, const char *key, const char *name, struct jx *jvalue )
+{
+	jx_delete(jvalue);
+	events_played++;
+	return 1;
+}
+
+static int count_remove_event( struct deltadb_query *query, const char *key, const char *name )
+{
+	events_played++;
+	return 1;
+}
+
+static int count_time_event( struct deltadb_query *query, time_t starttime, time_t stoptime, time_t current )
+{
+	events_played++;
+	return 1;
+}
+
+static int count_raw_event( struct deltadb_query *query, const char *line )
+{
+	return 1;
+}
+
+static struct deltadb_event_handlers count_handlers = {
+	count_create_event,
+	count_delete_event,
+	count_update_event,
+	count_create_event,
+	count_remove_event,
+	count_time_event,
+	count_raw_event
+};
+
+static void remove_day_file( const char *filename )
+{
+	if(unlink(filename)!=0 && errno!=ENOENT) {
+		fprintf(stderr,"couldn't remove %s: %s\n",filename,strerror(errno));
+	}
+}
+
+/* Remove the text log of a day, along with its index and the checkpoints within the day. */
+
+static void remove_day( const char *yeardir, int day )
+{
+	DIR *dir = opendir(yeardir);
+	if(dir) {
+		struct dirent *d;
+		while((d = readdir(dir))) {
+			int n;
+			long long time;
+			char suffix[8];
+			if(sscanf(d->d_name,"%d.%lld.%7s",&n,&time,suffix)==3 && n==day && !strcmp(suffix,"ckpt")) {
+				char *filename = string_format("%s/%s",yeardir,d->d_name);
+				remove_day_file(filename);
+				free(filename);
+			}
+		}
+		closedir(dir);
+	}
+
+	char *filename = string_format("%s/%d.idx",yeardir,day);
+	remove_day_file(filename);
+	free(filename);
+
+	filename = string_format("%s/%d.log",yeardir,day);
+	remove_day_file(filename);
+	free(filename);
+}
+
+static int compact_day( const char *yeardir, int day, int remove_log )
+{
+	char *logname = string_format("%s/%d.log",yeardir,day);
+	char *arcname = string_format("%s/%d.arc",yeardir,day);
+	char *tmpname = string_format("%s/%d.arc.tmp",yeardir,day);
+	int result = 0;
+
+	FILE *log = 0;
+	FILE *archive = 0;
+	struct stat info;
+
+	if(stat(arcname,&info)==0) {
+		/* Already archived by an earlier run. */
+		if(remove_log) remove_day(yeardir,day);
+		result = 1;
+		goto done;
+	}
+
+	log = fopen(logname,"r");
+	if(!log) {
+		fprintf(stderr,"couldn't open %s: %s\n",logname,strerror(errno));
+		goto done;
+	}
+
+	archive = fopen(tmpname,"w");
+	if(!archive) {
+		fprintf(stderr,"couldn't open %s: %s\n",tmpname,strerror(errno));
+		goto done;
+	}
+
+	long nevents = deltadb_archive_write(log,archive);
+	if(fclose(archive)!=0) nevents = -1;
+
+	archive = 0;
+	if(nevents<0) {
+		fprintf(stderr,"couldn't write %s\n",tmpname);
+		unlink(tmpname);
+		goto done;
+	}
+
+	/* Play back the archive and check that every event is there. */
+
+	archive = fopen(tmpname,"r");
+	events_played = 0;
+	if(archive) deltadb_process_archive(0,&count_handlers,archive,0,0,0);
+	if(events_played!=nevents) {
+		fprintf(stderr,"%s has %ld events but should have %ld\n",tmpname,events_played,nevents);
+		unlink(tmpname);
+		goto done;
+	}
+
+	if(rename(tmpname,arcname)!=0) {
+		fprintf(stderr,"couldn't rename %s to %s: %s\n",tmpname,arcname,strerror(errno));
+		unlink(tmpname);
+		goto done;
+	}
+
+	struct stat loginfo;
+	fstat(fileno(log),&loginfo);
+	stat(arcname,&info);
+	printf("%s: %ld events, %lld bytes to %lld bytes\n",logname,nevents,(long long)loginfo.st_size,(long long)info.st_size);
+
+	if(remove_log) remove_day(yeardir,day);
+
+	result = 1;
+
+done:
+	if(log) fclose(log);
+	if(archive) fclose(archive);
+	free(logname);
+	free(arcname);
+	free(tmpname);
+	return result;
+}
+
+static int compact_year( const char *logdir, int year, int today_year, int today_day, int remove_log )
+{
+	char *yeardir = string_format("%s/%d",logdir,year);
+	int result = 1;
+
+	DIR *dir = opendir(yeardir);
+	if(!dir) {
+		fprintf(stderr,"couldn't open %s: %s\n",yeardir,strerror(errno));
+		free(yeardir);
+		return 0;
+	}
+
+	struct dirent *d;
+	while((d = readdir(dir))) {
+		int day;
+		char suffix[8];
+		if(sscanf(d->d_name,"%d.%7s",&day,suffix)!=2 || strcmp(suffix,"log")) continue;
+
+		/* The log of today, or of any later day, may still be written. */
+		if(year>today_year || (year==today_year && day>=today_day)) continue;
+
+		if(!compact_day(yeardir,day,remove_log)) result = 0;
+	}
+
+	closedir(dir);
+	free(yeardir);
+	return result;
+}
+
+static struct option long_options[] =
+{
+	{"remove", no_argument, 0, 'r'},
+	{"version", no_argument, 0, 'v'},
+	{"help", no_argument, 0, 'h'},
+	{0,0,0,0}
+};
+
+static void show_help( const char *cmd )
+{
+	printf("use: %s [options] <logdir>\n",cmd);
+	printf("Convert the logs of closed days in a deltadb directory into archives.\n");
+	printf("  --remove   Remove each text log after it is archived.\n");
+	printf("  --version  Show software version.\n");
+	printf("  --help     Show this help text.\n");
+}
+
+int main( int argc, char *argv[] )
+{
+	int remove_log = 0;
+	signed char c;
+
+	while((c=getopt_long(argc,argv,"rvh",long_options,0))!=-1) {
+		switch(c) {
+		case 'r':
+			remove_log = 1;
+			break;
+		case 'v':
+			cctools_version_print(stdout,"deltadb_compact_log");
+			return 0;
+		case 'h':
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind!=argc-1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	const char *logdir = argv[optind];
+
+	time_t now = time(0);
+	struct tm *today = localtime(&now);
+	int today_year = today->tm_year + 1900;
+	int today_day = today->tm_yday;
+
+	DIR *dir = opendir(logdir);
+	if(!dir) {
+		fprintf(stderr,"couldn't open %s: %s\n",logdir,strerror(errno));
+		return 1;
+	}
+
+	int result = 0;
+
+	struct dirent *d;
+	while((d = readdir(dir))) {
+		int year;
+		char extra;
+		if(sscanf(d->d_name,"%d%c",&year,&extra)!=1) continue;
+		if(!compact_year(logdir,year,today_year,today_day,remove_log)) result = 1;
+	}
+
+	closedir(dir);
+
+	return result;
+}
+
+/* vim: set noexpandtab tabstop=4: */
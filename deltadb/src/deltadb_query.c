@@ -5,10 +5,13 @@ See the file COPYING for details.
 */
 
 #include "deltadb_stream.h"
+#include "deltadb_archive.h"
+#include "deltadb.h"
 #include "deltadb_reduction.h"
 #include "deltadb_query.h"
 
 #include "jx_eval.h"
+#include "jx_program.h"
 #include "jx_print.h"
 #include "jx_parse.h"
 
@@ -16,6 +19,8 @@ See the file COPYING for details.
 #include "debug.h"
 #include "list.h"
 #include "stringtools.h"
+#include "buffer.h"
+#include "xxmalloc.h"
 #include "nvpair.h"
 #include "nvpair_jx.h"
 
@@ -26,8 +31,12 @@ See the file COPYING for details.
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <limits.h>
 
 struct deltadb_query {
 	struct hash_table *table;
@@ -35,13 +44,19 @@ struct deltadb_query {
 	int epoch_mode;
 	struct jx *filter_expr;
 	struct jx *where_expr;
+	struct jx_program *filter_program;
+	struct jx_program *where_program;
 	struct list * output_exprs;
+	struct list * output_programs;
 	struct list * reduce_exprs;
 	time_t display_every;
 	time_t display_next;
 	time_t deferred_time;
 	time_t last_output_time;
 	deltadb_display_mode_t display_mode;
+	int parallel;
+	int segment_mode;
+	struct jx *segment_first;
 };
 
 struct deltadb_query * deltadb_query_create()
@@ -51,6 +66,7 @@ struct deltadb_query * deltadb_query_create()
 	query->table = hash_table_create(0,0);
 	query->output_stream = stdout;
 	query->output_exprs = list_create();
+	query->output_programs = list_create();
 	query->reduce_exprs = list_create();
 	return query;
 }
@@ -67,8 +83,17 @@ void deltadb_query_delete( struct deltadb_query *query )
 	}
 	hash_table_delete(query->table);
 
+	jx_program_delete(query->filter_program);
+	jx_program_delete(query->where_program);
 	jx_delete(query->filter_expr);
 	jx_delete(query->where_expr);
+	jx_delete(query->segment_first);
+
+	list_first_item(query->output_programs);
+	for(struct jx_program *p; (p = list_next_item(query->output_programs));) {
+		jx_program_delete(p);
+	}
+	list_delete(query->output_programs);
 
 	list_first_item(query->output_exprs);
 	for(struct jx *j; (j = list_next_item(query->output_exprs));) {
@@ -98,11 +123,13 @@ void deltadb_query_set_display( struct deltadb_query *query, deltadb_display_mod
 void deltadb_query_set_filter( struct deltadb_query *query, struct jx *expr )
 {
 	query->filter_expr = expr;
+	query->filter_program = expr ? jx_program_create(expr) : 0;
 }
 
 void deltadb_query_set_where( struct deltadb_query *query, struct jx *expr )
 {
 	query->where_expr = expr;
+	query->where_program = expr ? jx_program_create(expr) : 0;
 }
 
 void deltadb_query_set_epoch_mode( struct deltadb_query *query, int mode )
@@ -115,9 +142,15 @@ void deltadb_query_set_interval( struct deltadb_query *query, int interval )
 	query->display_every = interval;
 }
 
+void deltadb_query_set_parallel( struct deltadb_query *query, int nprocs )
+{
+	query->parallel = nprocs;
+}
+
 void deltadb_query_add_output( struct deltadb_query *query, struct jx *expr )
 {
 	list_push_tail(query->output_exprs,expr);
+	list_push_tail(query->output_programs,jx_program_create(expr));
 }
 
 void deltadb_query_add_reduction( struct deltadb_query *query, struct deltadb_reduction *r )
@@ -125,14 +158,11 @@ void deltadb_query_add_reduction( struct deltadb_query *query, struct deltadb_re
 	list_push_tail(query->reduce_exprs,r);
 }
 
-static int deltadb_boolean_expr( struct jx *expr, struct jx *data )
+static int deltadb_boolean_expr( struct jx_program *program, struct jx *data )
 {
-	if(!expr) return 1;
+	if(!program) return 1;
 
-	struct jx *j = jx_eval(expr,data);
-	int result = j && !jx_istype(j, JX_ERROR) && j->type==JX_BOOLEAN && j->u.boolean_value;
-	jx_delete(j);
-	return result;
+	return jx_program_is_true(program,data);
 }
 
 /*
@@ -152,7 +182,7 @@ static int compat_checkpoint_read( struct deltadb_query *query, const char *file
 				nvpair_delete(hash_table_remove(query->table,key));
 				struct jx *j = nvpair_to_jx(nv);
 				/* skip objects that don't match the filter */
-				if(deltadb_boolean_expr(query->filter_expr,j)) {
+				if(deltadb_boolean_expr(query->filter_program,j)) {
 					hash_table_insert(query->table,key,j);
 				} else {
 					jx_delete(j);
@@ -194,7 +224,7 @@ static int checkpoint_read( struct deltadb_query *query, const char *filename )
 	struct jx_pair *p;
 	for(p=jcheckpoint->u.pairs;p;p=p->next) {
 		if(p->key->type!=JX_STRING) continue;
-		if(!deltadb_boolean_expr(query->filter_expr,p->value)) continue;
+		if(!deltadb_boolean_expr(query->filter_program,p->value)) continue;
 		hash_table_insert(query->table,p->key->u.string_value,p->value);
 		p->value = 0;
 	}
@@ -217,34 +247,25 @@ static void reset_reductions( struct deltadb_query *query, deltadb_scope_t scope
 static void update_reductions( struct deltadb_query *query, const char *key, struct jx *jobject, deltadb_scope_t scope )
 {
 	/* Skip if the where expression doesn't match */
-	if(!deltadb_boolean_expr(query->where_expr,jobject)) return;
+	if(!deltadb_boolean_expr(query->where_program,jobject)) return;
 
 	list_first_item(query->reduce_exprs);
 	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
 		if(r->scope!=scope) continue;
-		struct jx *value = jx_eval(r->expr,jobject);
+		struct jx *value = jx_program_eval(r->program,jobject);
 		if(value && !jx_istype(value, JX_ERROR)) {
 			deltadb_reduction_update(r,key,value,scope);
 		}
-		jx_delete(value);
 	}
 }
 
-static void display_reduce_exprs( struct deltadb_query *query, time_t current )
-{
-	/* Reset all spatial reductions. */
-	reset_reductions(query,DELTADB_SCOPE_SPATIAL);
-
-	/* For each object in the hash table: */
-
-	char *key;
-	struct jx *jobject;
-	hash_table_firstkey(query->table);
-	while(hash_table_nextkey(query->table,&key,(void**)&jobject)) {
-		/* Update each local reduction with its value. */
-		update_reductions(query,key,jobject,DELTADB_SCOPE_SPATIAL);
-	}
+/*
+Print one line of reductions at the current time.  If spatial is given,
+it holds the values of the spatial reductions computed by another process.
+*/
 
+static void print_reduce_line( struct deltadb_query *query, time_t current, struct jx *spatial )
+{
 	/* Emit the current time */
 
 	if(query->epoch_mode) {
@@ -256,8 +277,9 @@ static void display_reduce_exprs( struct deltadb_query *query, time_t current )
 	}
 
 	/* For each reduction, display the final value. */
+	int i = 0;
 	list_first_item(query->reduce_exprs);
-	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs)); i++) {
 		if (r->scope == DELTADB_SCOPE_TEMPORAL) {
 			struct jx *column = jx_object(0);
 			char *key;
@@ -274,6 +296,9 @@ static void display_reduce_exprs( struct deltadb_query *query, time_t current )
 			fprintf(query->output_stream, "%s ", str);
 			free(str);
 			jx_delete(column);
+		} else if (r->scope == DELTADB_SCOPE_SPATIAL && spatial) {
+			struct jx *value = jx_array_index(spatial,i);
+			fprintf(query->output_stream,"%s ",jx_istype(value,JX_STRING) ? value->u.string_value : "");
 		} else if (r->scope == DELTADB_SCOPE_SPATIAL || r->scope == DELTADB_SCOPE_GLOBAL) {
 			char *str = deltadb_reduction_string(r);
 			fprintf(query->output_stream,"%s ",str);
@@ -282,6 +307,60 @@ static void display_reduce_exprs( struct deltadb_query *query, time_t current )
 	}
 
 	fprintf(query->output_stream,"\n");
+}
+
+/*
+The first line of a segment processed apart from the one before it
+also covers the records since the last line of that segment.
+Keep the time, the spatial values, and the state of the other reductions,
+so that the line can be printed once the segments are combined.
+*/
+
+static struct jx *segment_first_line( struct deltadb_query *query, time_t current )
+{
+	struct jx *spatial = jx_array(0);
+	struct jx *state = jx_array(0);
+
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+		if(r->scope==DELTADB_SCOPE_SPATIAL) {
+			char *str = deltadb_reduction_string(r);
+			jx_array_append(spatial,jx_string(str));
+			jx_array_append(state,jx_null());
+			free(str);
+		} else {
+			jx_array_append(spatial,jx_null());
+			jx_array_append(state,deltadb_reduction_to_jx(r));
+		}
+	}
+
+	struct jx *j = jx_object(0);
+	jx_insert_integer(j,"time",current);
+	jx_insert(j,jx_string("spatial"),spatial);
+	jx_insert(j,jx_string("state"),state);
+	return j;
+}
+
+static void display_reduce_exprs( struct deltadb_query *query, time_t current )
+{
+	/* Reset all spatial reductions. */
+	reset_reductions(query,DELTADB_SCOPE_SPATIAL);
+
+	/* For each object in the hash table: */
+
+	char *key;
+	struct jx *jobject;
+	hash_table_firstkey(query->table);
+	while(hash_table_nextkey(query->table,&key,(void**)&jobject)) {
+		/* Update each local reduction with its value. */
+		update_reductions(query,key,jobject,DELTADB_SCOPE_SPATIAL);
+	}
+
+	if(query->segment_mode && !query->segment_first) {
+		query->segment_first = segment_first_line(query,current);
+	} else {
+		print_reduce_line(query,current,0);
+	}
 
 	/* Reset temporal and global reductions to compute new values. */
 	reset_reductions(query,DELTADB_SCOPE_TEMPORAL);
@@ -299,7 +378,7 @@ static void display_output_exprs( struct deltadb_query *query, time_t current )
 
 		/* Skip if the where expression doesn't match */
 
-		if(!deltadb_boolean_expr(query->where_expr,jobject)) continue;
+		if(!deltadb_boolean_expr(query->where_program,jobject)) continue;
 
 		/* Emit the current time */
 
@@ -313,12 +392,10 @@ static void display_output_exprs( struct deltadb_query *query, time_t current )
 
 		/* For each output expression, compute the value and print. */
 
-		list_first_item(query->output_exprs);
-		for(struct jx *j; (j = list_next_item(query->output_exprs));) {
-			struct jx *jvalue = jx_eval(j,jobject);
-			jx_print_stream(jvalue,query->output_stream);
+		list_first_item(query->output_programs);
+		for(struct jx_program *p; (p = list_next_item(query->output_programs));) {
+			jx_print_stream(jx_program_eval(p,jobject),query->output_stream);
 			fprintf(query->output_stream,"\t");
-			jx_delete(jvalue);
 		}
 
 		fprintf(query->output_stream,"\n");
@@ -340,7 +417,7 @@ static void display_output_objects( struct deltadb_query *query, time_t current
 	while(hash_table_nextkey(query->table,&key,(void**)&jobject)) {
 
 		/* Skip if the where expression doesn't match */
-		if(!deltadb_boolean_expr(query->where_expr,jobject)) continue;
+		if(!deltadb_boolean_expr(query->where_program,jobject)) continue;
 
 		if(!firstobject) {			
 			fprintf(query->output_stream,",\n");
@@ -377,7 +454,7 @@ static void display_deferred_time( struct deltadb_query *query )
 
 int deltadb_create_event( struct deltadb_query *query, const char *key, struct jx *jobject )
 {
-	if(!deltadb_boolean_expr(query->filter_expr,jobject)) {
+	if(!deltadb_boolean_expr(query->filter_program,jobject)) {
 		jx_delete(jobject);
 		return 1;
 	}
@@ -423,6 +500,8 @@ on to the head of the current list.
 
 static void jx_merge_into( struct jx *current, struct jx *update )
 {
+	jx_object_unindex(update);
+
 	while(1) {
 		struct jx_pair *p = update->u.pairs;
 		if(!p) break;
@@ -432,8 +511,7 @@ static void jx_merge_into( struct jx *current, struct jx *update )
 		struct jx *oldvalue = jx_remove(current,p->key);
 		if(oldvalue) jx_delete(oldvalue);
 
-		p->next = current->u.pairs;
-		current->u.pairs = p;
+		jx_insert_pair(current,p);
 	}
 
 
@@ -580,49 +658,193 @@ int deltadb_query_execute_stream( struct deltadb_query *query, FILE *stream, tim
 }
 
 /*
-Execute a query on a directory structure.
-Play the log from starttime to stoptime by opening the appropriate
-checkpoint file and working ahead in the various log files.
+A query can start from a checkpoint within the day only if its output
+depends on nothing but the state of the table from starttime on.
+Streams show every record since the day's checkpoint, and temporal and
+global reductions are updated by them, so those queries read the whole day.
 */
 
-int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+static int can_start_within_day( struct deltadb_query *query )
 {
-	int file_errors = 0;
+	if(query->display_mode==DELTADB_DISPLAY_STREAM) return 0;
 
-	query->display_next = starttime;
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+		if(r->scope!=DELTADB_SCOPE_SPATIAL) return 0;
+	}
 
-	struct tm *starttm = localtime(&starttime);
+	return 1;
+}
 
-	int year = starttm->tm_year + 1900;
-	int day = starttm->tm_yday;
+/*
+Find in the day's index the last checkpoint written at or before starttime,
+and load it. Returns the position in the day's log where it was written,
+or zero if the query has to start from the day's checkpoint.
+*/
 
-	struct tm *stoptm = localtime(&stoptime);
+static long checkpoint_read_within_day( struct deltadb_query *query, const char *logdir, int year, int day, time_t starttime )
+{
+	/* The positions in the index refer to the text log, not to an archive. */
+	char *filename = string_format("%s/%d/%d.arc",logdir,year,day);
+	int archived = access(filename,R_OK)==0;
+	free(filename);
+	if(archived) return 0;
 
-	int stopyear = stoptm->tm_year + 1900;
-	int stopday = stoptm->tm_yday;
+	filename = string_format("%s/%d/%d.idx",logdir,year,day);
+	FILE *index = fopen(filename,"r");
+	free(filename);
+	if(!index) return 0;
 
-	char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+	long long time, best_time = 0;
+	long offset, best_offset = 0;
+
+	while(fscanf(index,"%lld %ld",&time,&offset)==2) {
+		if(time>starttime) break;
+		best_time = time;
+		best_offset = offset;
+	}
+
+	fclose(index);
+
+	if(best_offset<=0) return 0;
+
+	filename = string_format("%s/%d/%d.%lld.ckpt",logdir,year,day,best_time);
 	int ret = checkpoint_read(query,filename);
 	free(filename);
-	if (!ret) {
+
+	return ret ? best_offset : 0;
+}
+
+/*
+Collect the names of the fields that an expression may look at.
+Returns zero if it may look at fields that are not named in it,
+as eval and template do with the strings given to them.
+*/
+
+static int expr_fields( struct jx *j, struct hash_table *fields );
+
+static int comprehension_fields( struct jx_comprehension *comp, struct hash_table *fields )
+{
+	for(;comp;comp=comp->next) {
+		if(!expr_fields(comp->elements,fields)) return 0;
+		if(!expr_fields(comp->condition,fields)) return 0;
+	}
+	return 1;
+}
+
+static int expr_fields( struct jx *j, struct hash_table *fields )
+{
+	if(!j) return 1;
+
+	if(j->type==JX_SYMBOL) {
+		hash_table_insert(fields,j->u.symbol_name,fields);
+	} else if(j->type==JX_ARRAY) {
+		struct jx_item *i;
+		for(i=j->u.items;i;i=i->next) {
+			if(!expr_fields(i->value,fields)) return 0;
+			if(!comprehension_fields(i->comp,fields)) return 0;
+		}
+	} else if(j->type==JX_OBJECT) {
+		struct jx_pair *p;
+		for(p=j->u.pairs;p;p=p->next) {
+			if(!expr_fields(p->key,fields)) return 0;
+			if(!expr_fields(p->value,fields)) return 0;
+			if(!comprehension_fields(p->comp,fields)) return 0;
+		}
+	} else if(j->type==JX_OPERATOR) {
+		struct jx *left = j->u.oper.left;
+		if(j->u.oper.type==JX_OP_CALL && jx_istype(left,JX_SYMBOL)) {
+			if(!strcmp(left->u.symbol_name,"eval") || !strcmp(left->u.symbol_name,"template")) return 0;
+		}
+		if(!expr_fields(left,fields)) return 0;
+		if(!expr_fields(j->u.oper.right,fields)) return 0;
+	}
+
+	return 1;
+}
+
+/*
+Find the fields that a query displays or reduces, so that updates to
+other fields can be skipped when playing an archive.  Every update is
+shown by a stream, and counted by temporal and global reductions, so
+those queries, and queries that display whole objects, need all fields.
+Returns a table of field names, or null if all fields are needed.
+The filter is applied to whole objects as they are created, so it does
+not need the updates to any field.
+*/
+
+static struct hash_table *query_fields( struct deltadb_query *query )
+{
+	if(query->display_mode!=DELTADB_DISPLAY_EXPRS && query->display_mode!=DELTADB_DISPLAY_REDUCE) return 0;
+
+	struct hash_table *fields = hash_table_create(0,0);
+	int ok = expr_fields(query->where_expr,fields);
+
+	list_first_item(query->output_exprs);
+	for(struct jx *j; ok && (j = list_next_item(query->output_exprs));) {
+		ok = expr_fields(j,fields);
+	}
+
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; ok && (r = list_next_item(query->reduce_exprs));) {
+		ok = r->scope==DELTADB_SCOPE_SPATIAL && expr_fields(r->expr,fields);
+	}
+
+	if(!ok) {
+		hash_table_delete(fields);
 		return 0;
 	}
 
-	while(1) {
-		char *filename = string_format("%s/%d/%d.log",logdir,year,day);
+	return fields;
+}
+
+/*
+Play the logs of ndays days, starting from the given day.
+Each day is read from its archive if it has one, or else from its text log.
+Returns 1 if the logs were played to the end, 0 if stoptime was reached,
+or -1 if too many logs were missing.
+*/
+
+static int play_logs( struct deltadb_query *query, const char *logdir, int year, int day, int ndays, long offset, time_t starttime, time_t stoptime )
+{
+	int file_errors = 0;
+	int result = 1;
+
+	struct hash_table *fields = query_fields(query);
+
+	while(ndays-- > 0) {
+		/* A day that has been archived is played from the archive instead of the log. */
+		char *filename = string_format("%s/%d/%d.arc",logdir,year,day);
 		FILE *file = fopen(filename,"r");
+		int archived = file!=0;
+		if(!archived) {
+			free(filename);
+			filename = string_format("%s/%d/%d.log",logdir,year,day);
+			file = fopen(filename,"r");
+		}
+
 		if(!file) {
 			file_errors += 1;
 			fprintf(stderr,"couldn't open %s: %s\n",filename,strerror(errno));
 			free(filename);
 			if (file_errors>5) {
-				return 0;
+				result = -1;
+				break;
 			}
 
 		} else {
 			free(filename);
+
+			/* Only the first log is read from a checkpoint within the day. */
+			if(offset) {
+				fseek(file,offset,SEEK_SET);
+				offset = 0;
+			}
+
 			int keepgoing;
-			if(is_fast_query(query)) {
+			if(archived) {
+				keepgoing = deltadb_process_archive(query,&handlers,file,fields,starttime,stoptime);
+			} else if(is_fast_query(query)) {
 				keepgoing = deltadb_process_stream_fast(query,&handlers,file,starttime,stoptime);
 			} else {
 				keepgoing = deltadb_process_stream(query,&handlers,file,starttime,stoptime);
@@ -632,7 +854,10 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 			fclose(file);
 
 			// If we reached the endtime in the file, stop.
-			if(!keepgoing) break;
+			if(!keepgoing) {
+				result = 0;
+				break;
+			}
 		}
 
 		day++;
@@ -640,12 +865,573 @@ int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir,
 			year++;
 			day = 0;
 		}
+	}
+
+	if(fields) hash_table_delete(fields);
+
+	return result;
+}
+
+/* Count the days of logs from the start day through the stop day. */
+
+static int days_between( int year, int day, int stopyear, int stopday )
+{
+	int ndays = 1;
+
+	while(1) {
+		day++;
+		if(day>=days_in_year(year)) {
+			year++;
+			day = 0;
+		}
 
 		// If we have passed the file, stop.
 		if(year>=stopyear && day>stopday) break;
+
+		ndays++;
+	}
+
+	return ndays;
+}
+
+/* Load the checkpoint that a query starting at starttime begins from, and return the offset in the first log. */
+
+static int checkpoint_read_start( struct deltadb_query *query, const char *logdir, int year, int day, time_t starttime, long *offset )
+{
+	*offset = 0;
+	if(can_start_within_day(query)) {
+		*offset = checkpoint_read_within_day(query,logdir,year,day,starttime);
+	}
+
+	if(!*offset) {
+		char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+		int ret = checkpoint_read(query,filename);
+		free(filename);
+		if (!ret) {
+			return 0;
+		}
 	}
 
 	return 1;
 }
 
+static int execute_dir_parallel( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime );
+
+/*
+Execute a query on a directory structure.
+Play the log from starttime to stoptime by opening the appropriate
+checkpoint file and working ahead in the various log files.
+*/
+
+int deltadb_query_execute_dir( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+{
+	if(query->parallel>1 && query->display_mode!=DELTADB_DISPLAY_STREAM) {
+		return execute_dir_parallel(query,logdir,starttime,stoptime);
+	}
+
+	query->display_next = starttime;
+
+	struct tm *starttm = localtime(&starttime);
+
+	int year = starttm->tm_year + 1900;
+	int day = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
 
+	int ndays = days_between(year,day,stopyear,stopday);
+
+	long offset;
+	if(!checkpoint_read_start(query,logdir,year,day,starttime,&offset)) {
+		return 0;
+	}
+
+	return play_logs(query,logdir,year,day,ndays,offset,starttime,stoptime) >= 0;
+}
+
+/*
+A query over many days may be split into segments at the days that have
+a checkpoint, and the segments played at once by separate processes.
+Each process writes its output to a temporary file, along with the state
+of its reductions before its first line and after its last line.
+The segments are then combined in order: the first line of each segment
+is printed from the reductions of the records since the last line of the
+segment before it, and its other lines are copied as they are.
+
+A segment starts its lines at the first interval after the last time
+record of the day before, which is where the previous segment left off,
+unless the log has gaps longer than the interval between lines.
+Streams are played in order, since they show each record as it is read.
+*/
+
+struct segment {
+	int year;
+	int day;
+	int ndays;
+	pid_t pid;
+	FILE *output;
+	FILE *state;
+};
+
+#define SEGMENT_COMPLETE 0
+#define SEGMENT_STOPPED 1
+#define SEGMENT_FAILED 2
+
+static void next_day( int *year, int *day )
+{
+	(*day)++;
+	if(*day>=days_in_year(*year)) {
+		(*year)++;
+		*day = 0;
+	}
+}
+
+static void previous_day( int *year, int *day )
+{
+	(*day)--;
+	if(*day<0) {
+		(*year)--;
+		*day = days_in_year(*year)-1;
+	}
+}
+
+static time_t day_start( int year, int day )
+{
+	struct tm t;
+	memset(&t,0,sizeof(t));
+	t.tm_year = year - 1900;
+	t.tm_mday = day + 1;
+	t.tm_isdst = -1;
+	return mktime(&t);
+}
+
+/*
+Find the last time record in the log of a day, by reading only the
+time records from the last checkpoint in the day's index,
+or only the times of the day's archive.
+*/
+
+static time_t log_last_time( const char *logdir, int year, int day )
+{
+	long long current = 0;
+	long offset = 0;
+
+	char *filename = string_format("%s/%d/%d.arc",logdir,year,day);
+	FILE *archive = fopen(filename,"r");
+	free(filename);
+	if(archive) {
+		current = deltadb_archive_last_time(archive);
+		fclose(archive);
+		return current;
+	}
+
+	filename = string_format("%s/%d/%d.idx",logdir,year,day);
+	FILE *index = fopen(filename,"r");
+	free(filename);
+	if(index) {
+		long long time;
+		long pos;
+		while(fscanf(index,"%lld %ld",&time,&pos)==2) {
+			current = time;
+			offset = pos;
+		}
+		fclose(index);
+	}
+
+	filename = string_format("%s/%d/%d.log",logdir,year,day);
+	FILE *file = fopen(filename,"r");
+	free(filename);
+	if(!file) return current;
+
+	fseek(file,offset,SEEK_SET);
+
+	char line[4096];
+	int line_start = 1;
+	long long value;
+	while(fgets(line,sizeof(line),file)) {
+		if(line_start) {
+			if(line[0]=='T' && sscanf(line,"T %lld",&value)==1) {
+				current = value;
+			} else if(line[0]=='t' && sscanf(line,"t %lld",&value)==1) {
+				current += value;
+			}
+		}
+		line_start = line[strlen(line)-1]=='\n';
+	}
+
+	fclose(file);
+
+	return current;
+}
+
+static int segment_run( struct deltadb_query *query, const char *logdir, struct segment *s, int first, time_t starttime, time_t stoptime )
+{
+	query->output_stream = s->output;
+	query->segment_mode = 1;
+	query->display_next = starttime;
+
+	/* Leave the records of the segments combined so far to the parent. */
+	reset_reductions(query,DELTADB_SCOPE_TEMPORAL);
+	reset_reductions(query,DELTADB_SCOPE_GLOBAL);
+
+	long offset = 0;
+
+	if(first) {
+		if(!checkpoint_read_start(query,logdir,s->year,s->day,starttime,&offset)) {
+			return SEGMENT_FAILED;
+		}
+	} else {
+		char *filename = string_format("%s/%d/%d.ckpt",logdir,s->year,s->day);
+		int ret = checkpoint_read(query,filename);
+		free(filename);
+		if(!ret) return SEGMENT_FAILED;
+
+		/* Begin at the first line that the previous segment did not reach. */
+		int year = s->year;
+		int day = s->day;
+		previous_day(&year,&day);
+		time_t last = log_last_time(logdir,year,day);
+		time_t after = last ? last+1 : day_start(s->year,s->day);
+		if(query->display_every>0 && after>starttime) {
+			query->display_next = starttime + (after-starttime+query->display_every-1)/query->display_every*query->display_every;
+		}
+
+		starttime = 0;
+	}
+
+	int result = play_logs(query,logdir,s->year,s->day,s->ndays,offset,starttime,stoptime);
+
+	struct jx *rest = jx_array(0);
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs));) {
+		jx_array_append(rest,r->scope==DELTADB_SCOPE_SPATIAL ? jx_null() : deltadb_reduction_to_jx(r));
+	}
+
+	struct jx *state = jx_object(0);
+	jx_insert(state,jx_string("first"),query->segment_first ? query->segment_first : jx_null());
+	query->segment_first = 0;
+	jx_insert(state,jx_string("rest"),rest);
+	jx_print_stream(state,s->state);
+	jx_delete(state);
+
+	if(fflush(s->output)!=0 || fflush(s->state)!=0) return SEGMENT_FAILED;
+
+	if(result<0) return SEGMENT_FAILED;
+	return result ? SEGMENT_COMPLETE : SEGMENT_STOPPED;
+}
+
+static int segment_start( struct deltadb_query *query, const char *logdir, struct segment *s, int first, time_t starttime, time_t stoptime )
+{
+	s->output = tmpfile();
+	s->state = tmpfile();
+	if(!s->output || !s->state) {
+		fprintf(stderr,"couldn't create a temporary file: %s\n",strerror(errno));
+		return 0;
+	}
+
+	fflush(query->output_stream);
+	fflush(stderr);
+
+	s->pid = fork();
+	if(s->pid<0) {
+		fprintf(stderr,"couldn't create a process: %s\n",strerror(errno));
+		return 0;
+	} else if(s->pid==0) {
+		_exit(segment_run(query,logdir,s,first,starttime,stoptime));
+	}
+
+	return 1;
+}
+
+static void segment_close( struct segment *s )
+{
+	if(s->output) fclose(s->output);
+	if(s->state) fclose(s->state);
+	s->output = s->state = 0;
+}
+
+static void merge_reductions( struct deltadb_query *query, struct jx *state )
+{
+	int i = 0;
+	list_first_item(query->reduce_exprs);
+	for(struct deltadb_reduction *r; (r = list_next_item(query->reduce_exprs)); i++) {
+		if(r->scope==DELTADB_SCOPE_SPATIAL) continue;
+		deltadb_reduction_merge_jx(r,jx_array_index(state,i));
+	}
+}
+
+/* Print the output of a finished segment after the segments before it. */
+
+static void segment_finish( struct deltadb_query *query, struct segment *s )
+{
+	rewind(s->state);
+	struct jx *state = jx_parse_stream(s->state);
+
+	struct jx *first = jx_lookup(state,"first");
+	if(jx_istype(first,JX_OBJECT)) {
+		merge_reductions(query,jx_lookup(first,"state"));
+		print_reduce_line(query,jx_lookup_integer(first,"time"),jx_lookup(first,"spatial"));
+		reset_reductions(query,DELTADB_SCOPE_TEMPORAL);
+		reset_reductions(query,DELTADB_SCOPE_GLOBAL);
+	}
+
+	rewind(s->output);
+	char buffer[65536];
+	size_t n;
+	while((n = fread(buffer,1,sizeof(buffer),s->output))>0) {
+		fwrite(buffer,1,n,query->output_stream);
+	}
+
+	if(state) merge_reductions(query,jx_lookup(state,"rest"));
+
+	jx_delete(state);
+}
+
+static int execute_dir_parallel( struct deltadb_query *query, const char *logdir, time_t starttime, time_t stoptime )
+{
+	struct tm *starttm = localtime(&starttime);
+
+	int year = starttm->tm_year + 1900;
+	int day = starttm->tm_yday;
+
+	struct tm *stoptm = localtime(&stoptime);
+
+	int stopyear = stoptm->tm_year + 1900;
+	int stopday = stoptm->tm_yday;
+
+	int ndays = days_between(year,day,stopyear,stopday);
+
+	/* Start a new segment at each day after the first that has a checkpoint. */
+
+	struct segment *segments = calloc(ndays,sizeof(*segments));
+	int nsegments = 0;
+
+	int i;
+	for(i=0;i<ndays;i++) {
+		char *filename = string_format("%s/%d/%d.ckpt",logdir,year,day);
+		if(i==0 || access(filename,R_OK)==0) {
+			segments[nsegments].year = year;
+			segments[nsegments].day = day;
+			nsegments++;
+		}
+		free(filename);
+		segments[nsegments-1].ndays++;
+		next_day(&year,&day);
+	}
+
+	int result = 1;
+	int launched = 0;
+	int finished;
+
+	for(finished=0;finished<nsegments;finished++) {
+		while(launched<nsegments && launched-finished<query->parallel) {
+			if(!segment_start(query,logdir,&segments[launched],launched==0,starttime,stoptime)) {
+				segment_close(&segments[launched]);
+				break;
+			}
+			launched++;
+		}
+
+		if(finished>=launched) {
+			result = 0;
+			break;
+		}
+
+		struct segment *s = &segments[finished];
+
+		int status;
+		while(waitpid(s->pid,&status,0)<0 && errno==EINTR) {}
+		int code = WIFEXITED(status) ? WEXITSTATUS(status) : SEGMENT_FAILED;
+
+		if(code==SEGMENT_FAILED) {
+			result = 0;
+			segment_close(s);
+			finished++;
+			break;
+		}
+
+		segment_finish(query,s);
+		segment_close(s);
+
+		if(code==SEGMENT_STOPPED) {
+			finished++;
+			break;
+		}
+	}
+
+	/* Segments past the stop time have nothing to show. */
+
+	for(;finished<launched;finished++) {
+		struct segment *s = &segments[finished];
+		kill(s->pid,SIGKILL);
+		while(waitpid(s->pid,0,0)<0 && errno==EINTR) {}
+		segment_close(s);
+	}
+
+	free(segments);
+
+	return result;
+}
+
+/*
+Follow the log of a live database: display the objects in it now,
+and then each change to them as the log is written, until the output fails.
+The log is read as it grows, and only whole lines are played, since the
+writer may be in the middle of a line.  Each part of the log is played
+as a stream of its own, so a part that begins with a relative time
+is preceded by the absolute time reached so far.
+When the log of the day ends and the log of the next day appears, the
+reader moves on to it, as the writer does.
+*/
+
+#define FOLLOW_POLL_INTERVAL 250000
+#define FOLLOW_KEEPALIVE_INTERVAL 30
+
+static int follow_chunk( struct deltadb_query *query, const char *data, size_t length, long long *current )
+{
+	buffer_t b;
+	buffer_init(&b);
+
+	if(data[0]=='t' && *current) buffer_printf(&b,"T %lld\n",*current);
+	buffer_putlstring(&b,data,length);
+
+	/* Keep track of the time at the end of this part. */
+	const char *line = data;
+	const char *end = data + length;
+	while(line<end) {
+		long long value;
+		if(line[0]=='T' && sscanf(line,"T %lld",&value)==1) {
+			*current = value;
+		} else if(line[0]=='t' && sscanf(line,"t %lld",&value)==1) {
+			*current += value;
+		}
+		line = memchr(line,'\n',end-line);
+		if(!line) break;
+		line++;
+	}
+
+	size_t size;
+	const char *text = buffer_tolstring(&b,&size);
+	FILE *stream = fmemopen((void *)text,size,"r");
+	if(stream) {
+		deltadb_process_stream(query,&handlers,stream,0,(time_t)LONG_MAX);
+		fclose(stream);
+	}
+
+	buffer_free(&b);
+	return stream!=0;
+}
+
+int deltadb_query_execute_follow( struct deltadb_query *query, struct deltadb *db, const char *logdir )
+{
+	int year, day;
+	long offset;
+
+	if(!deltadb_log_position(db,&year,&day,&offset)) return 0;
+
+	/* Display the current objects as created at this time. */
+
+	query->display_next = 0;
+	deltadb_time_event(query,0,(time_t)LONG_MAX,time(0));
+
+	char *key;
+	struct jx *j;
+	deltadb_firstkey(db);
+	while(deltadb_nextkey(db,&key,&j)) {
+		deltadb_create_event(query,key,jx_copy(j));
+	}
+
+	fflush(query->output_stream);
+
+	buffer_t pending;
+	buffer_init(&pending);
+
+	long long current = 0;
+	time_t last_output = time(0);
+	FILE *file = 0;
+	char chunk[65536];
+
+	while(!ferror(query->output_stream)) {
+		if(!file) {
+			char *filename = string_format("%s/%d/%d.log",logdir,year,day);
+			file = fopen(filename,"r");
+			free(filename);
+			if(file) fseek(file,offset,SEEK_SET);
+		}
+
+		size_t n = file ? fread(chunk,1,sizeof(chunk),file) : 0;
+		if(n>0) {
+			buffer_putlstring(&pending,chunk,n);
+
+			size_t length;
+			const char *data = buffer_tolstring(&pending,&length);
+			const char *last = data + length;
+			while(last>data && last[-1]!='\n') last--;
+
+			if(last>data) {
+				follow_chunk(query,data,last-data,&current);
+				fflush(query->output_stream);
+				last_output = time(0);
+
+				/* Keep any partial line for the next read. */
+				size_t restlength = data + length - last;
+				char *rest = xxmalloc(restlength+1);
+				memcpy(rest,last,restlength);
+				buffer_rewind(&pending,0);
+				buffer_putlstring(&pending,rest,restlength);
+				free(rest);
+			}
+			continue;
+		}
+
+		if(file) clearerr(file);
+
+		/* Once the log of today is written, the log of yesterday is complete. */
+
+		time_t now = time(0);
+		struct tm *t = gmtime(&now);
+		if(file && (t->tm_year+1900!=year || t->tm_yday!=day)) {
+			int next_year = year;
+			int next_day = day + 1;
+			if(next_day>=days_in_year(next_year)) {
+				next_year++;
+				next_day = 0;
+			}
+
+			char *filename = string_format("%s/%d/%d.log",logdir,next_year,next_day);
+			int exists = access(filename,R_OK)==0;
+			free(filename);
+
+			if(exists && fread(chunk,1,1,file)==0) {
+				fclose(file);
+				file = 0;
+				year = next_year;
+				day = next_day;
+				offset = 0;
+				current = 0;
+				buffer_rewind(&pending,0);
+				continue;
+			} else if(exists) {
+				fseek(file,-1,SEEK_CUR);
+				continue;
+			}
+		}
+
+		/* An empty line is ignored by readers, and finds out if the client is gone. */
+
+		if(now-last_output>=FOLLOW_KEEPALIVE_INTERVAL) {
+			fprintf(query->output_stream,"\n");
+			fflush(query->output_stream);
+			last_output = now;
+		}
+
+		usleep(FOLLOW_POLL_INTERVAL);
+	}
+
+	if(file) fclose(file);
+	buffer_free(&pending);
+
+	return 1;
+}
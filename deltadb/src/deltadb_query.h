@@ -26,6 +26,7 @@ void deltadb_query_set_where( struct deltadb_query *q, struct jx *expr );
 void deltadb_query_set_epoch_mode( struct deltadb_query *q, int mode );
 void deltadb_query_set_interval( struct deltadb_query *q, int interval );
 void deltadb_query_set_output( struct deltadb_query *q, FILE *stream );
+void deltadb_query_set_parallel( struct deltadb_query *q, int nprocs );
 
 void deltadb_query_add_output( struct deltadb_query *q, struct jx *expr );
 void deltadb_query_add_reduction( struct deltadb_query *q, struct deltadb_reduction *reduce );
@@ -33,4 +34,7 @@ void deltadb_query_add_reduction( struct deltadb_query *q, struct deltadb_reduct
 int deltadb_query_execute_dir( struct deltadb_query *q, const char *dir, time_t starttime, time_t stoptime );
 int deltadb_query_execute_stream( struct deltadb_query *q, FILE *stream, time_t starttime, time_t stoptime );
 
+struct deltadb;
+int deltadb_query_execute_follow( struct deltadb_query *q, struct deltadb *db, const char *dir );
+
 #endif
@@ -90,6 +90,7 @@ static struct option long_options[] =
 	{"every", required_argument, 0, 'e'},
 	{"json", no_argument, 0, 'j' },
 	{"epoch", no_argument, 0, 't'},
+	{"parallel", required_argument, 0, 'p'},
 	{"version", no_argument, 0, 'v'},
 	{"help", no_argument, 0, 'h'},
 	{0,0,0,0}
@@ -111,6 +112,7 @@ void show_help()
 	printf("  --every <interval>  Compute output at this time interval.\n");
 	printf("  --json              Output raw JSON objects.\n");
 	printf("  --epoch             Display time column in Unix epoch format.\n");
+	printf("  --parallel <n>      Play up to n days of the database at once.\n");
 	printf("  --version           Show software version.\n");
 	printf("  --help              Show this help text.\n");
 }
@@ -147,7 +149,7 @@ int main( int argc, char *argv[] )
 	struct deltadb_query *query = deltadb_query_create();
 	deltadb_query_set_display(query,DELTADB_DISPLAY_STREAM);
 
-	while((c=getopt_long(argc,argv,"D:L:o:w:f:F:T:e:tvh",long_options,0))!=-1) {
+	while((c=getopt_long(argc,argv,"D:L:o:w:f:F:T:e:tp:vh",long_options,0))!=-1) {
 		switch(c) {
 		case 'D':
 			dbdir = optarg;
@@ -254,6 +256,9 @@ int main( int argc, char *argv[] )
 			epoch_mode = 1;
 			deltadb_query_set_epoch_mode(query,epoch_mode);
 			break;
+		case 'p':
+			deltadb_query_set_parallel(query,atoi(optarg));
+			break;
 		case 'v':
 			cctools_version_print(stdout,"deltadb_query");
 			break;
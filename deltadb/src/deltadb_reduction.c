@@ -21,6 +21,7 @@ struct deltadb_reduction *deltadb_reduction_create_type( deltadb_reduction_t typ
 	r->type = type;
 	r->scope = scope;
 	r->expr = expr;
+	r->program = jx_program_create(expr);
 	r->temporal_table = hash_table_create(0,0);
 	r->unique_table = hash_table_create(0,0);
 	r->unique_value = jx_array(0);
@@ -68,6 +69,7 @@ void deltadb_reduction_delete( struct deltadb_reduction *r )
 	deltadb_reduction_delete_temporal_table(r->temporal_table);
 	jx_delete(r->unique_value);
 	hash_table_delete(r->unique_table);
+	jx_program_delete(r->program);
 	jx_delete(r->expr);
 	free(r);
 }
@@ -85,6 +87,17 @@ void deltadb_reduction_reset( struct deltadb_reduction *r, deltadb_scope_t scope
 	r->unique_value = jx_array(0);
 }
 
+static void unique_insert( struct deltadb_reduction *r, struct jx *value )
+{
+	char *str = jx_print_string(value);
+	if(!hash_table_lookup(r->unique_table,str)) {
+		struct jx *value_copy = jx_copy(value);
+		hash_table_insert(r->unique_table,str,value_copy);
+		jx_array_append(r->unique_value,value_copy);
+	}
+	free(str);
+}
+
 void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, struct jx * value, deltadb_scope_t scope )
 {
 	if(r->scope!=scope) return;
@@ -101,13 +114,7 @@ void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, str
 	/* UNIQUE: keep a value in a hash table, keyed by the string representation. */
 
 	if(r->type==UNIQUE) {
-		char *str = jx_print_string(value);
-		if(!hash_table_lookup(r->unique_table,str)) {
-			struct jx *value_copy = jx_copy(value);
-			hash_table_insert(r->unique_table,str,value_copy);
-			jx_array_append(r->unique_value,value_copy);
-		}
-		free(str);
+		unique_insert(r,value);
 		return;
 	}
 
@@ -171,4 +178,108 @@ char * deltadb_reduction_string( struct deltadb_reduction *r )
 	return string_format("%lf",value);
 }
 
+static struct jx *values_to_jx( struct deltadb_reduction *r )
+{
+	struct jx *j = jx_object(0);
+
+	if(r->type==UNIQUE) {
+		jx_insert(j,jx_string("unique"),jx_copy(r->unique_value));
+	} else {
+		jx_insert_double(j,"count",r->count);
+		jx_insert_double(j,"sum",r->sum);
+		jx_insert_double(j,"first",r->first);
+		jx_insert_double(j,"last",r->last);
+		jx_insert_double(j,"min",r->min);
+		jx_insert_double(j,"max",r->max);
+	}
+
+	return j;
+}
+
+struct jx * deltadb_reduction_to_jx( struct deltadb_reduction *r )
+{
+	if(r->scope!=DELTADB_SCOPE_TEMPORAL) return values_to_jx(r);
+
+	struct jx *table = jx_object(0);
+
+	char *key;
+	void *value;
+	hash_table_firstkey(r->temporal_table);
+	while(hash_table_nextkey(r->temporal_table,&key,&value)) {
+		jx_insert(table,jx_string(key),values_to_jx(value));
+	}
+
+	struct jx *j = jx_object(0);
+	jx_insert(j,jx_string("temporal"),table);
+	return j;
+}
+
+/* Whole doubles are printed as integers, so they may come back as either. */
+
+static double lookup_number( struct jx *j, const char *name )
+{
+	struct jx *value = jx_lookup(j,name);
+	if(!value) return 0;
+	if(value->type==JX_DOUBLE) return value->u.double_value;
+	if(value->type==JX_INTEGER) return value->u.integer_value;
+	return 0;
+}
+
+static void values_merge_jx( struct deltadb_reduction *r, struct jx *j )
+{
+	if(r->type==UNIQUE) {
+		struct jx *array = jx_lookup(j,"unique");
+		if(!jx_istype(array,JX_ARRAY)) return;
+		struct jx_item *i;
+		for(i=array->u.items;i;i=i->next) {
+			unique_insert(r,i->value);
+		}
+		return;
+	}
+
+	double count = lookup_number(j,"count");
+	if(count==0) return;
+
+	double min = lookup_number(j,"min");
+	double max = lookup_number(j,"max");
+
+	if(r->count==0) {
+		r->first = lookup_number(j,"first");
+		r->min = min;
+		r->max = max;
+	} else {
+		if (min < r->min) r->min = min;
+		if (max > r->max) r->max = max;
+	}
+
+	r->sum += lookup_number(j,"sum");
+	r->last = lookup_number(j,"last");
+	r->count += count;
+}
+
+void deltadb_reduction_merge_jx( struct deltadb_reduction *r, struct jx *j )
+{
+	if(!j) return;
+
+	if(r->scope!=DELTADB_SCOPE_TEMPORAL) {
+		values_merge_jx(r,j);
+		return;
+	}
+
+	struct jx *table = jx_lookup(j,"temporal");
+	if(!jx_istype(table,JX_OBJECT)) return;
+
+	struct jx_pair *p;
+	for(p=table->u.pairs;p;p=p->next) {
+		if(p->key->type!=JX_STRING) continue;
+		const char *key = p->key->u.string_value;
+		struct deltadb_reduction *t = hash_table_lookup(r->temporal_table,key);
+		if(!t) {
+			t = deltadb_reduction_create_type(r->type,jx_copy(r->expr),r->scope);
+			hash_table_insert(r->temporal_table,key,t);
+		}
+		values_merge_jx(t,p->value);
+	}
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -9,6 +9,7 @@ See the file COPYING for details.
 
 #include "jx.h"
 #include "hash_table.h"
+#include "jx_program.h"
 
 typedef enum {
 	COUNT,
@@ -32,6 +33,7 @@ struct deltadb_reduction {
 	deltadb_reduction_t type;
 	deltadb_scope_t scope;
 	struct jx *expr;
+	struct jx_program *program;
 	struct hash_table *temporal_table;
 	struct hash_table *unique_table;
 	struct jx *unique_value;
@@ -49,4 +51,13 @@ void deltadb_reduction_reset( struct deltadb_reduction *r, deltadb_scope_t scope
 void deltadb_reduction_update( struct deltadb_reduction *r, const char *key, struct jx *value, deltadb_scope_t scope );
 char * deltadb_reduction_string( struct deltadb_reduction *r );
 
+/*
+The state of a reduction over an interval of the log, so that intervals
+processed separately can be combined.  Merging the state of a later
+interval into r gives the same values as updating r with all of its records.
+*/
+
+struct jx * deltadb_reduction_to_jx( struct deltadb_reduction *r );
+void deltadb_reduction_merge_jx( struct deltadb_reduction *r, struct jx *state );
+
 #endif
@@ -0,0 +1,89 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	echo "creating update files"
+	for port in 9001 9002 9003
+	do
+		echo "{\"type\":\"cctools-relay-test\",\"port\":$port}" > update.$port.json
+	done
+}
+
+run()
+{
+	echo "starting the catalog server"
+	../src/catalog_server -d all -o catalog.log --port-file catalog.port &
+	server=$!
+
+	echo "waiting for catalog server to start"
+	wait_for_file_creation catalog.port 5
+	port=`cat catalog.port`
+
+	echo "starting the catalog relay"
+	CATALOG_RELAY=`pwd`/relay.sock
+	export CATALOG_RELAY
+	../src/catalog_relay -d all -o relay.log --interval 5 &
+	relay=$!
+	for i in 1 2 3 4 5
+	do
+		[ -S relay.sock ] && break
+		sleep 1
+	done
+
+	echo "sending updates through the relay"
+	for update in update.*.json
+	do
+		../../dttools/src/catalog_update --catalog localhost:$port --file $update
+	done
+
+	echo "waiting for the relay to forward the updates"
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		forwarded=`sed -n 's/.*forwarded \([0-9]*\) records.*/\1/p' relay.log | awk '{n+=$1} END {print n+0}'`
+		[ "$forwarded" = 3 ] && break
+		sleep 1
+	done
+	sleep 1
+
+	# The updates may fall on either side of a flush, but not on three.
+	if grep -q "forwarded [23] records in 1 batches" relay.log
+	then
+		echo "updates were forwarded in batches"
+		result=0
+	else
+		echo "expected the updates to be forwarded in batches"
+		result=1
+	fi
+
+	echo "querying the catalog through the relay"
+	count=`../../dttools/src/catalog_query --catalog localhost:$port --where 'type=="cctools-relay-test"' | grep -c '"type"'`
+	if [ "$count" != 3 ]
+	then
+		echo "expected 3 records, but found $count"
+		result=1
+	fi
+
+	kill $relay $server
+	wait $relay $server
+
+	if [ $result != 0 ]
+	then
+		echo "contents of relay.log:"
+		cat relay.log
+		echo "contents of catalog.log:"
+		cat catalog.log
+	fi
+
+	return $result
+}
+
+clean()
+{
+	rm -f catalog.log catalog.port relay.log relay.sock update.*.json
+	rm -rf catalog.history
+	return 0
+}
+
+dispatch "$@"
@@ -43,6 +43,20 @@ run()
 		result=1
 	fi
 
+	if [ $result = 0 ]
+	then
+		echo "repeating the query with its entity tag"
+		etag=`curl -s -D - -o /dev/null http://localhost:$port/query/dHlwZT09ImNjdG9vbHMtdGVzdCIK | sed -n 's/^ETag: *//p' | tr -d '\r'`
+		code=`curl -s -o /dev/null -w '%{http_code}' -H "If-None-Match: $etag" http://localhost:$port/query/dHlwZT09ImNjdG9vbHMtdGVzdCIK`
+		if [ -n "$etag" ] && [ "$code" = 304 ]
+		then
+			echo "unchanged query answered with 304"
+		else
+			echo "expected 304 for etag '$etag' but got $code"
+			result=1
+		fi
+	fi
+
 	echo "killing the catalog server"
 	kill $pid
 	wait $pid
@@ -0,0 +1,63 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	# Day 0 of 2020, with each kind of record and value.
+	mkdir -p archive.history/2020
+	echo '{}' > archive.history/2020/0.ckpt
+	cat > archive.history/2020/0.log << EOF
+T 1577880000
+C a {"name":"a","type":"test","load":0.5,"cores":8,"owner":"alice","up":true}
+C b {"name":"b","type":"test","load":1.5,"cores":16,"owner":"bob","up":true}
+t 60
+U a load 0.75
+U a cores 4
+U b owner "carol"
+U b up false
+t 60
+M a {"cores":12,"tags":[1,2]}
+U b cores -2
+t 60
+R a tags
+U a owner null
+t 60
+D b
+U a load 2.25
+T 1577880300
+EOF
+	cp -r archive.history compact.history
+	return 0
+}
+
+run()
+{
+	../src/deltadb_compact_log --remove compact.history || return 1
+
+	[ -f compact.history/2020/0.arc ] || return 1
+	[ ! -f compact.history/2020/0.log ] || return 1
+
+	for output in "--output name --output load --output cores --output owner --output up --output tags" "--output SUM(load) --output MAX(cores) --output UNIQUE(owner)" "--output GLOBAL_COUNT(load) --output TIME_MAX(load)" "--json"
+	do
+		../src/deltadb_query --db archive.history --from 2020-01-01 --to "2020-01-01 23:00:00" --every 1m $output > archive.out
+		../src/deltadb_query --db compact.history --from 2020-01-01 --to "2020-01-01 23:00:00" --every 1m $output > compact.out
+
+		if ! cmp archive.out compact.out
+		then
+			echo "output differs for $output:"
+			diff archive.out compact.out
+			return 1
+		fi
+	done
+
+	return 0
+}
+
+clean()
+{
+	rm -rf archive.history compact.history archive.out compact.out
+	return 0
+}
+
+dispatch "$@"
@@ -0,0 +1,79 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+# A record with more than 16 fields is indexed once it has been searched,
+# and must survive an update that drops one of its fields.
+
+prepare()
+{
+	fields=""
+	for i in `seq 1 20`
+	do
+		fields="$fields\"field$i\":$i,"
+	done
+	echo "{${fields}\"type\":\"cctools-large-test\"}" > update1.json
+	echo "{${fields}\"type\":\"cctools-large-test\"}" | sed 's/"field20":20,//' > update2.json
+}
+
+run()
+{
+	echo "starting the catalog server"
+	../src/catalog_server -d all -o catalog.log --port-file catalog.port --port 9097 &
+	pid=$!
+
+	echo "waiting for catalog server to start"
+	wait_for_file_creation catalog.port 5
+
+	port=`cat catalog.port`
+
+	echo "sending updates to the server"
+	for file in update1.json update1.json update2.json update2.json
+	do
+		../../dttools/src/catalog_update --catalog localhost:$port --file $file
+		sleep 1
+	done
+
+	# echo 'type=="cctools-large-test"' | base64
+	curl http://localhost:$port/query/dHlwZT09ImNjdG9vbHMtbGFyZ2UtdGVzdCIK > query.out
+
+	result=0
+	if ! kill -0 $pid
+	then
+		echo "catalog server is no longer running"
+		result=1
+	elif grep -q field20 query.out
+	then
+		echo "dropped field is still present:"
+		cat query.out
+		result=1
+	elif ! grep -q field19 query.out
+	then
+		echo "remaining fields are missing:"
+		cat query.out
+		result=1
+	else
+		echo "record was updated in place"
+	fi
+
+	echo "killing the catalog server"
+	kill $pid
+	wait $pid
+
+	if [ $result != 0 ]
+	then
+		echo "contents of catalog.log:"
+		cat catalog.log
+	fi
+
+	return $result
+}
+
+clean()
+{
+	rm -f catalog.log catalog.port update1.json update2.json query.out
+	rm -rf catalog.history
+	return 0
+}
+
+dispatch "$@"
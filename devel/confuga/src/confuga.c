@@ -712,6 +712,8 @@ static int parse_uri (confuga *C, const char *uri, int *explicit_auth)
 			} else if (strcmp(option, "scheduler") == 0) {
 				if (pattern_match(value, "^fifo%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_FIFO, strtoul(subvalue, NULL, 10)));
+				} else if (pattern_match(value, "^locality%-?(%d*)$", &subvalue) >= 0) {
+					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_LOCALITY, strtoul(subvalue, NULL, 10)));
 				} else CATCH(EINVAL);
 			} else if (strcmp(option, "replication") == 0) {
 				if (pattern_match(value, "^push%-sync%-?(%d*)$", &subvalue) >= 0) {
@@ -719,6 +721,14 @@ static int parse_uri (confuga *C, const char *uri, int *explicit_auth)
 				} else if (pattern_match(value, "^push%-async%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_replication_strategy(C, CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS, strtoul(subvalue, NULL, 10)));
 				} else CATCH(EINVAL);
+			} else if (strcmp(option, "replication-slots") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_replication_limits(C, strtoul(subvalue, NULL, 10), C->replication_bytes));
+				else CATCH(EINVAL);
+			} else if (strcmp(option, "replication-bytes") == 0) {
+				if (pattern_match(value, "^(%d+[kKmMgGtTpP]?)[bB]?$", &subvalue) >= 0) {
+					CATCH(confuga_replication_limits(C, C->replication_slots, string_metric_parse(subvalue)));
+				} else CATCH(EINVAL);
 			} else if (strcmp(option, "nodes") == 0) {
 				CATCH(confuga_nodes(C, value));
 			} else if (strcmp(option, "tickets") == 0) {
@@ -769,6 +779,8 @@ CONFUGA_API int confuga_connect (confuga **Cp, const char *uri, const char *cata
 	C->pull_threshold = (1<<27); /* 128MB */
 	C->replication = CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS;
 	C->replication_n = 1; /* max one push async job per node */
+	C->replication_slots = 2; /* max two health transfers per node */
+	C->replication_bytes = 0; /* unlimited */
 	C->scheduler = CONFUGA_SCHEDULER_FIFO;
 	C->scheduler_n = 0; /* unlimited */
 	C->operations = 0;
@@ -856,6 +868,14 @@ CONFUGA_API int confuga_replication_strategy (confuga *C, int strategy, uint64_t
 	return 0;
 }
 
+CONFUGA_API int confuga_replication_limits (confuga *C, uint64_t slots, uint64_t bytes)
+{
+	debug(D_CONFUGA, "setting replication limits to %" PRIu64 " transfers and %" PRIu64 " bytes per node", slots, bytes);
+	C->replication_slots = slots;
+	C->replication_bytes = bytes;
+	return 0;
+}
+
 CONFUGA_API int confuga_disconnect (confuga *C)
 {
 	int rc;
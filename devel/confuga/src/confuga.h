@@ -116,6 +116,7 @@ CONFUGA_API int confuga_snrm (confuga *C, const char *id, int flag);
 CONFUGA_API int confuga_nodes (confuga *C, const char *nodes); /* deprecated */
 
 #define CONFUGA_SCHEDULER_FIFO 1
+#define CONFUGA_SCHEDULER_LOCALITY 2
 CONFUGA_API int confuga_scheduler_strategy (confuga *C, int strategy, uint64_t n);
 
 CONFUGA_API int confuga_pull_threshold (confuga *C, uint64_t n);
@@ -123,6 +124,7 @@ CONFUGA_API int confuga_pull_threshold (confuga *C, uint64_t n);
 #define CONFUGA_REPLICATION_PUSH_SYNCHRONOUS  1
 #define CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS 2
 CONFUGA_API int confuga_replication_strategy (confuga *C, int strategy, uint64_t n);
+CONFUGA_API int confuga_replication_limits (confuga *C, uint64_t slots, uint64_t bytes);
 
 CONFUGA_API int confuga_getid (confuga *C, char **id);
 
@@ -26,6 +26,8 @@ struct confuga {
 	uint64_t pull_threshold;
 	int replication;
 	uint64_t replication_n;
+	uint64_t replication_slots;
+	uint64_t replication_bytes;
 	int scheduler;
 	uint64_t scheduler_n;
 
@@ -500,17 +500,28 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 		"WITH"
 			/* We want every active SN, even if it has no input file. */
 		"	StorageNodeAvailable AS ("
-		"		SELECT StorageNodeActive.id"
+		"		SELECT StorageNodeActive.id, COUNT(ConfugaJobAllocated.id) AS depth"
 		"			FROM Confuga.StorageNodeActive LEFT OUTER JOIN ConfugaJobAllocated ON StorageNodeActive.id = ConfugaJobAllocated.sid"
 		"			GROUP BY StorageNodeActive.id"
-		"			HAVING COUNT(ConfugaJobAllocated.id) < 1" /* TODO: allow more than one job on a SN */
+		"			HAVING COUNT(ConfugaJobAllocated.id) < ?2"
+		"	),"
+			/* Transfers into each SN, which slow down pulling the missing inputs. */
+		"	StorageNodeTransfers AS ("
+		"		SELECT StorageNodeActive.id, COUNT(ActiveTransfers.id) AS count"
+		"			FROM Confuga.StorageNodeActive LEFT OUTER JOIN Confuga.ActiveTransfers ON StorageNodeActive.id = ActiveTransfers.tsid"
+		"			GROUP BY StorageNodeActive.id"
+		"	),"
+		"	ConfugaJobInputBytes AS ("
+		"		SELECT ConfugaInputFile.jid, TOTAL(File.size) AS size"
+		"			FROM ConfugaInputFile JOIN Confuga.File ON ConfugaInputFile.fid = File.id"
+		"			GROUP BY ConfugaInputFile.jid"
 		"	),"
 		"	ConfugaInputFileReplicas AS ("
 		"		SELECT ConfugaInputFile.jid, FileReplicas.*"
 		"			FROM ConfugaInputFile JOIN Confuga.FileReplicas ON ConfugaInputFile.fid = FileReplicas.fid"
 		"	),"
 		"	StorageNodeJobBytes AS ("
-		"		SELECT ConfugaJob.id AS jid, StorageNodeAvailable.id AS sid, COUNT(ConfugaInputFileReplicas.size) AS count, SUM(ConfugaInputFileReplicas.size) AS size, RANDOM() AS _r"
+		"		SELECT ConfugaJob.id AS jid, StorageNodeAvailable.id AS sid, StorageNodeAvailable.depth, COUNT(ConfugaInputFileReplicas.size) AS count, SUM(ConfugaInputFileReplicas.size) AS size, RANDOM() AS _r"
 		"			FROM"
 		"				ConfugaJob CROSS JOIN StorageNodeAvailable"
 		"				LEFT OUTER JOIN ConfugaInputFileReplicas ON ConfugaJob.id = ConfugaInputFileReplicas.jid AND StorageNodeAvailable.id = ConfugaInputFileReplicas.sid"
@@ -518,9 +529,21 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 		"	)"
 		/* N.B. if there are no available storage nodes, sid will be NULL! */
 		"SELECT StorageNodeJobBytes.sid, StorageNodeJobBytes.count, StorageNodeJobBytes.size"
-		"	FROM StorageNodeJobBytes"
+		"	FROM"
+		"		StorageNodeJobBytes"
+		"		JOIN StorageNodeTransfers ON StorageNodeJobBytes.sid = StorageNodeTransfers.id"
+		"		LEFT OUTER JOIN ConfugaJobInputBytes ON StorageNodeJobBytes.jid = ConfugaJobInputBytes.jid"
 		"	WHERE StorageNodeJobBytes.jid = ?1"
-		"	ORDER BY StorageNodeJobBytes.size DESC, _r DESC" /* choose a random storage node if equally desirable */
+		"	ORDER BY"
+			/* With locality placement, the cost of a SN is the missing bytes to pull, slowed by the transfers
+			 * already going to it, plus the bytes of all inputs for each job queued ahead of this one. */
+		"		CASE WHEN ?3 THEN"
+		"			(IFNULL(ConfugaJobInputBytes.size, 0) - IFNULL(StorageNodeJobBytes.size, 0)) * (1 + StorageNodeTransfers.count)"
+		"			+ StorageNodeJobBytes.depth * IFNULL(ConfugaJobInputBytes.size, 0)"
+		"		END ASC,"
+		"		StorageNodeJobBytes.depth ASC,"
+		"		StorageNodeJobBytes.size DESC,"
+		"		_r DESC" /* choose a random storage node if equally desirable */
 		"	LIMIT 1;"
 		"UPDATE ConfugaJob"
 		"	SET"
@@ -549,6 +572,14 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	if (C->scheduler == CONFUGA_SCHEDULER_LOCALITY) {
+		/* scheduler_n is the number of jobs which may be queued on one SN */
+		sqlcatch(sqlite3_bind_int64(stmt, 2, C->scheduler_n ? C->scheduler_n : 1));
+		sqlcatch(sqlite3_bind_int(stmt, 3, 1));
+	} else {
+		sqlcatch(sqlite3_bind_int64(stmt, 2, 1)); /* TODO: allow more than one job on a SN */
+		sqlcatch(sqlite3_bind_int(stmt, 3, 0));
+	}
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW) {
 		if (sqlite3_column_type(stmt, 0) == SQLITE_INTEGER) {
@@ -617,10 +648,11 @@ static int job_schedule (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	assert(C->scheduler == CONFUGA_SCHEDULER_FIFO);
+	assert(C->scheduler == CONFUGA_SCHEDULER_FIFO || C->scheduler == CONFUGA_SCHEDULER_LOCALITY);
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	sqlcatch(sqlite3_bind_int64(stmt, 1, C->scheduler_n));
+	/* With locality placement, scheduler_n limits the jobs per SN in dispatch instead. */
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->scheduler == CONFUGA_SCHEDULER_FIFO ? C->scheduler_n : 0));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
 		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
@@ -645,6 +645,9 @@ out:
  *
  * Note:
  *   o The file must be at least 60 seconds old.
+ *   o Files needed by more waiting jobs are replicated first.
+ *   o Each storage node takes part in at most replication_slots transfers,
+ *     moving at most replication_bytes, at a time (0 is unlimited).
  */
 static int schedule_replication (confuga *C)
 {
@@ -657,17 +660,44 @@ static int schedule_replication (confuga *C)
 		 *
 		 * [1] https://www.mail-archive.com/sqlite-users@mailinglists.sqlite.org/msg05276.html
 		 */
+		"CREATE TEMPORARY TABLE IF NOT EXISTS TransferScheduleParameters__schedule_replication ("
+		"	key TEXT PRIMARY KEY,"
+		"	value INTEGER"
+		");"
+		"INSERT OR REPLACE INTO TransferScheduleParameters__schedule_replication"
+		"	VALUES ('transfer-slots', ?1), ('transfer-bytes', ?2);"
 		"CREATE TEMPORARY VIEW IF NOT EXISTS TransferSchedule__schedule_replication AS"
 		"	WITH"
-				/* This a StorageNode we are able to use to transfer a replica. If it is currently transferring a file, it is excluded. */
-		"		StorageNodeActiveRandom AS ("
-		"			SELECT StorageNodeAuthenticated.*, RANDOM() AS _r"
-		"				FROM StorageNodeAuthenticated"
+		"		TransferSlots AS ("
+		"			SELECT value FROM TransferScheduleParameters__schedule_replication WHERE key = 'transfer-slots'"
 		"		),"
+		"		TransferBytes AS ("
+		"			SELECT value FROM TransferScheduleParameters__schedule_replication WHERE key = 'transfer-bytes'"
+		"		),"
+				/* Transfers to or from each StorageNode, and the bytes they move. */
+		"		StorageNodeTransferLoad AS ("
+		"			SELECT id, COUNT(tjid) AS count, TOTAL(size) AS size"
+		"				FROM"
+		"					("
+		"						SELECT StorageNodeAuthenticated.id AS id, ActiveTransfers.id AS tjid, File.size AS size"
+		"							FROM (Confuga.StorageNodeAuthenticated LEFT OUTER JOIN Confuga.ActiveTransfers ON StorageNodeAuthenticated.id = ActiveTransfers.tsid) LEFT OUTER JOIN Confuga.File ON ActiveTransfers.fid = File.id"
+		"					UNION ALL"
+		"						SELECT StorageNodeAuthenticated.id AS id, ActiveTransfers.id AS tjid, File.size AS size"
+		"							FROM (Confuga.StorageNodeAuthenticated LEFT OUTER JOIN Confuga.ActiveTransfers ON StorageNodeAuthenticated.id = ActiveTransfers.fsid) LEFT OUTER JOIN Confuga.File ON ActiveTransfers.fid = File.id"
+		"					)"
+		"				GROUP BY id"
+		"		),"
+				/* StorageNode under both the cap on concurrent transfers and the cap on bytes in flight. Zero is unlimited. */
+		"		StorageNodeTransferReady AS ("
+		"			SELECT id"
+		"				FROM StorageNodeTransferLoad"
+		"				WHERE ((SELECT * FROM TransferSlots) == 0 OR count < (SELECT * FROM TransferSlots))"
+		"				  AND ((SELECT * FROM TransferBytes) == 0 OR size < (SELECT * FROM TransferBytes))"
+		"		),"
+				/* This a StorageNode we are able to use to transfer a replica, picked at random for each File. */
 		"		SourceStorageNode AS ("
-		"			SELECT Replica.fid, StorageNodeActiveRandom.id AS sid, MIN(StorageNodeActiveRandom._r)"
-		"				FROM Confuga.Replica JOIN StorageNodeActiveRandom ON Replica.sid = StorageNodeActiveRandom.id"
-		"				WHERE NOT EXISTS (SELECT fsid FROM Confuga.ActiveTransfers WHERE fsid = StorageNodeActiveRandom.id)"
+		"			SELECT Replica.fid, StorageNodeTransferReady.id AS sid, MIN(RANDOM())"
+		"				FROM Confuga.Replica JOIN StorageNodeTransferReady ON Replica.sid = StorageNodeTransferReady.id"
 		"				GROUP BY Replica.fid"
 		"		),"
 				/* This contains all the Replica of a File AND ongoing transfers of the File to some StorageNode */
@@ -680,15 +710,26 @@ static int schedule_replication (confuga *C)
 		"				SELECT File.id AS fid, ActiveTransfers.tsid AS sid"
 		"					FROM Confuga.File JOIN Confuga.ActiveTransfers ON File.id = ActiveTransfers.fid"
 		"		),"
-				/* These are degraded files, insufficient replicas exist. */
+				/* Jobs waiting to be placed which need each File. */
+		"		FileDemand AS ("
+		"			SELECT ConfugaInputFile.fid, COUNT(*) AS count"
+		"				FROM ConfugaInputFile JOIN ConfugaJob ON ConfugaInputFile.jid = ConfugaJob.id"
+		"				WHERE ConfugaJob.state IN ('BOUND_INPUTS', 'SCHEDULED')"
+		"				GROUP BY ConfugaInputFile.fid"
+		"		),"
+				/* These are degraded files, insufficient replicas exist, with a source ready to send a replica. */
 		"		DegradedFile AS ("
-		"			SELECT File.id, File.size, COUNT(Replicas.sid) AS count, File.minimum_replicas AS min"
-		"				FROM Confuga.File LEFT OUTER JOIN Replicas ON File.id = Replicas.fid"
+		"			SELECT File.id, File.size, COUNT(Replicas.sid) AS count, File.minimum_replicas AS min, IFNULL(FileDemand.count, 0) AS demand"
+		"				FROM"
+		"					Confuga.File"
+		"					JOIN SourceStorageNode ON File.id = SourceStorageNode.fid"
+		"					LEFT OUTER JOIN Replicas ON File.id = Replicas.fid"
+		"					LEFT OUTER JOIN FileDemand ON File.id = FileDemand.fid"
 		"				WHERE File.time_create < (strftime('%s', 'now')-60)"
 		"				GROUP BY File.id"
 		"				HAVING COUNT(Replicas.sid) < File.minimum_replicas"
-						/* We want to focus on degraded files which have low replica counts. */
-		"				ORDER BY count ASC"
+						/* We want to focus on degraded files needed by waiting jobs, then those which have low replica counts. */
+		"				ORDER BY demand DESC, count ASC"
 						/* This is an optimization because the complete SELECT query is limited to 1. */
 		"				LIMIT 1"
 		"		)"
@@ -697,6 +738,7 @@ static int schedule_replication (confuga *C)
 		"			DegradedFile"
 		"			JOIN SourceStorageNode ON DegradedFile.id = SourceStorageNode.fid"
 		"			JOIN StorageNodeActive AS TargetStorageNode"
+		"			JOIN StorageNodeTransferReady ON TargetStorageNode.id = StorageNodeTransferReady.id"
 				/* Originally, TargetStorageNode was a VIEW in the WITH clause. It JOINed on File so we could come up with a Target for each File. This was too expensive so the join is moved here, on DegradedFile. */
 		"		WHERE NOT EXISTS (SELECT sid FROM Replicas WHERE fid = DegradedFile.id AND sid = TargetStorageNode.id) AND TargetStorageNode.avail > DegradedFile.size"
 		"		GROUP BY DegradedFile.id"
@@ -720,6 +762,16 @@ static int schedule_replication (confuga *C)
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->replication_slots));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, C->replication_bytes));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
 	if (sqlite3_column_int(stmt, 0) == 0) {
@@ -960,12 +1012,14 @@ out:
 static int commit (confuga *C, confuga_sid_t sid, const char *hostport, const char *tjids, const char *cids)
 {
 	static const char SQL[] =
+		"BEGIN TRANSACTION;"
 		"UPDATE Confuga.TransferJob"
 		"	SET"
 		"		state = 'COMMITTED',"
 		"		time_commit = strftime('%s', 'now')"
 		"	WHERE id = ? AND state = 'CREATED'"
 		";"
+		"END TRANSACTION;"
 		;
 
 	int rc;
@@ -982,6 +1036,11 @@ static int commit (confuga *C, confuga_sid_t sid, const char *hostport, const ch
 
 	CATCHUNIX(chirp_reli_job_commit(hostport, cids, STOPTIME));
 
+	/* Update all of the transfer jobs on this node in one transaction. */
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	for (i = 0; i < J->u.array.length; i++) {
 		json_value *id = J->u.array.values[i];
@@ -992,11 +1051,16 @@ static int commit (confuga *C, confuga_sid_t sid, const char *hostport, const ch
 	}
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
 	rc = 0;
 	goto out;
 out:
 	json_value_free(J);
 	sqlite3_finalize(stmt);
+	sqlend(db);
 	return rc;
 }
 
@@ -1203,12 +1267,14 @@ out:
 static int reap (confuga *C, confuga_sid_t sid, const char *hostport, const char *tjids, const char *cids)
 {
 	static const char SQL[] =
+		"BEGIN TRANSACTION;"
 		"UPDATE Confuga.TransferJob"
 		"	SET"
 		"		state = 'REAPED',"
 		"		time_commit = strftime('%s', 'now')"
 		"	WHERE id = ? AND state = 'WAITED'"
 		";"
+		"END TRANSACTION;"
 		;
 
 	int rc;
@@ -1225,6 +1291,11 @@ static int reap (confuga *C, confuga_sid_t sid, const char *hostport, const char
 
 	CATCHUNIX(chirp_reli_job_reap(hostport, cids, STOPTIME));
 
+	/* Update all of the transfer jobs on this node in one transaction. */
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	for (i = 0; i < J->u.array.length; i++) {
 		json_value *id = J->u.array.values[i];
@@ -1235,11 +1306,16 @@ static int reap (confuga *C, confuga_sid_t sid, const char *hostport, const char
 	}
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
 	rc = 0;
 	goto out;
 out:
 	json_value_free(J);
 	sqlite3_finalize(stmt);
+	sqlend(db);
 	return rc;
 }
 
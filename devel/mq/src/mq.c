@@ -12,9 +12,19 @@ See the file COPYING for details.
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#endif
+
 #include "buffer.h"
 #include "cctools_endian.h"
 #include "debug.h"
@@ -39,6 +49,29 @@ See the file COPYING for details.
 #define FRAME_POS(p) (p & ((1 << MQ_FRAME_WIDTH) - 1))
 #define NEXT_FRAME(p) (((p >> MQ_FRAME_WIDTH) + 1) << MQ_FRAME_WIDTH)
 
+/* Queued messages up to this size are gathered into a single sendmsg(),
+ * up to MQ_BATCH_MAX bytes and MQ_BATCH_IOV pieces at a time.
+ */
+#define MQ_BATCH_MSG (8 * 1024)
+#define MQ_BATCH_MAX (64 * 1024)
+#define MQ_BATCH_IOV 64
+
+/* Number of epoll events taken per call to epoll_wait. */
+#define MQ_POLL_EVENTS 64
+
+/* Buffers at least this large are sent with MSG_ZEROCOPY. Below
+ * this, pinning the pages costs more than copying them.
+ */
+#define MQ_ZEROCOPY_MIN (1024 * 1024)
+
+#ifdef CCTOOLS_OPSYS_LINUX
+#define MQ_EPOLL
+#define MQ_SPLICE
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define MQ_ZEROCOPY
+#endif
+#endif
+
 enum mq_socket {
 	MQ_SOCKET_SERVER,
 	MQ_SOCKET_INPROGRESS,
@@ -60,6 +93,9 @@ struct mq_msg {
 	bool buffering;
 	bool seen_initial;
 	bool hung_up;
+	bool splicing;
+	bool zerocopy;
+	uint32_t zc_last;
 
 	/* Here be dragons!
 	 *
@@ -88,6 +124,16 @@ struct mq_msg {
 	uint32_t hdr_len;
 };
 
+/* A file descriptor registered with the epoll instance of a polling group.
+ * The socket may be polled for both send and recv, but epoll takes each
+ * fd only once, so each queue keeps two of these and merges its pollfds.
+ */
+struct mq_watch {
+	struct mq *mq;
+	int fd;
+	uint32_t events;
+};
+
 struct mq {
 	struct link *link;
 	enum mq_socket state;
@@ -99,6 +145,20 @@ struct mq {
 	struct mq_msg *recving;
 	struct mq_poll *poll_group;
 	void *tag;
+
+	/* Zero-copy state: 0 if not tried yet, 1 if enabled, -1 if unavailable.
+	 * Each send with MSG_ZEROCOPY is numbered, and the kernel reports
+	 * ranges of completed numbers on the socket's error queue. Messages
+	 * wait in zc_pending until the kernel is done with their buffers.
+	 */
+	int zerocopy;
+	uint32_t zc_next;
+	uint32_t zc_done;
+	struct list *zc_pending;
+
+	// events of interest and results, kept between calls when using epoll
+	struct pollfd pfd[2];
+	struct mq_watch watch[2];
 };
 
 struct mq_poll {
@@ -106,6 +166,14 @@ struct mq_poll {
 	struct set *acceptable;
 	struct set *readable;
 	struct set *error;
+
+	/* With epoll, only queues that had events or were touched by the
+	 * caller since the last wait are handled, so the cost of a wait
+	 * scales with the active connections rather than all of them.
+	 */
+	int epfd;
+	struct set *dirty;
+	struct set *working;
 };
 
 static size_t checked_add(size_t a, size_t b)
@@ -166,6 +234,128 @@ static void mq_msg_delete(struct mq_msg *msg)
 	free(msg);
 }
 
+static void unwatch_fd(struct mq *mq, int fd)
+{
+#ifdef MQ_EPOLL
+	if (fd < 0)
+		return;
+	for (int k = 0; k < 2; k++) {
+		struct mq_watch *w = &mq->watch[k];
+		if (w->fd != fd)
+			continue;
+		if (mq->poll_group && mq->poll_group->epfd >= 0) {
+			epoll_ctl(mq->poll_group->epfd, EPOLL_CTL_DEL, fd, NULL);
+		}
+		w->fd = -1;
+		w->events = 0;
+	}
+#endif
+}
+
+static void unwatch_all(struct mq *mq)
+{
+	unwatch_fd(mq, mq->watch[0].fd);
+	unwatch_fd(mq, mq->watch[1].fd);
+}
+
+/* The caller changed what mq is waiting for, so the next mq_poll_wait
+ * needs to look at it even if none of its fds had events.
+ */
+static void mark_dirty(struct mq *mq)
+{
+	if (mq->poll_group && mq->poll_group->epfd >= 0) {
+		set_insert(mq->poll_group->dirty, mq);
+	}
+}
+
+#ifdef MQ_ZEROCOPY
+static bool zc_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+/* Free the messages the kernel is no longer reading from. */
+static void zerocopy_release(struct mq *mq)
+{
+	struct mq_msg *msg;
+	while ((msg = list_peek_head(mq->zc_pending)) && zc_before(msg->zc_last, mq->zc_done)) {
+		list_pop_head(mq->zc_pending);
+		mq_msg_delete(msg);
+	}
+}
+
+/* Drain the completion notifications from the socket's error queue.
+ * TCP completes sends in order, so each notification covers everything
+ * up to the end of its range. If the kernel had to copy the data anyway
+ * (e.g. over loopback), zero-copy only adds overhead and is turned off
+ * for later messages.
+ */
+static int zerocopy_reap(struct mq *mq)
+{
+	int socket = link_fd(mq->link);
+	char control[128];
+
+	while (mq->zc_next != mq->zc_done) {
+		struct msghdr mh;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_control = control;
+		mh.msg_controllen = sizeof(control);
+
+		if (recvmsg(socket, &mh, MSG_ERRQUEUE) == -1) {
+			if (errno_is_temporary(errno))
+				break;
+			return -1;
+		}
+
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+			if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+				continue;
+			}
+			struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				errno = ee->ee_errno;
+				return -1;
+			}
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				mq->zerocopy = -1;
+			}
+			if (zc_before(mq->zc_done, ee->ee_data + 1)) {
+				mq->zc_done = ee->ee_data + 1;
+			}
+		}
+	}
+
+	zerocopy_release(mq);
+	return 0;
+}
+
+/* Return MSG_ZEROCOPY if the payload of snd should be sent without copying. */
+static int zerocopy_flags(struct mq *mq, struct mq_msg *snd)
+{
+	if (snd->storage != MQ_MSG_BUFFER || snd->len < MQ_ZEROCOPY_MIN)
+		return 0;
+	if (mq->zerocopy == 0) {
+		int on = 1;
+		mq->zerocopy = setsockopt(link_fd(mq->link), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0 ? 1 : -1;
+	}
+	return mq->zerocopy > 0 ? MSG_ZEROCOPY : 0;
+}
+#endif
+
+/* Dispose of a message that has been completely sent. */
+static void msg_retire(struct mq *mq, struct mq_msg *msg)
+{
+	unwatch_fd(mq, msg->pipefd);
+#ifdef MQ_ZEROCOPY
+	if (msg->zerocopy) {
+		list_push_tail(mq->zc_pending, msg);
+		zerocopy_release(mq);
+		return;
+	}
+#endif
+	mq_msg_delete(msg);
+}
+
 static void mq_die(struct mq *mq, int err)
 {
 	assert(mq);
@@ -176,6 +366,7 @@ static void mq_die(struct mq *mq, int err)
 	}
 
 	mq->state = MQ_SOCKET_ERROR;
+	unwatch_all(mq);
 	mq_close(mq->acc);
 	mq_msg_delete(mq->sending);
 	unset_nonblocking(mq->recving);
@@ -190,6 +381,11 @@ static void mq_die(struct mq *mq, int err)
 	}
 	list_cursor_destroy(cur);
 
+	struct mq_msg *msg;
+	while ((msg = list_pop_head(mq->zc_pending))) {
+		mq_msg_delete(msg);
+	}
+
 	if (mq->poll_group) {
 		set_remove(mq->poll_group->acceptable, mq);
 		set_remove(mq->poll_group->readable, mq);
@@ -205,8 +401,14 @@ static struct mq *mq_create(enum mq_socket state, struct link *link)
 {
 	struct mq *out = xxcalloc(1, sizeof(*out));
 	out->send = list_create();
+	out->zc_pending = list_create();
 	out->state = state;
 	out->link = link;
+	for (int k = 0; k < 2; k++) {
+		out->pfd[k].fd = -1;
+		out->watch[k].mq = out;
+		out->watch[k].fd = -1;
+	}
 	return out;
 }
 
@@ -216,12 +418,15 @@ void mq_close(struct mq *mq)
 		return;
 
 	mq_die(mq, 0);
+	unwatch_all(mq);
 	if (mq->poll_group) {
 		set_remove(mq->poll_group->members, mq);
 		set_remove(mq->poll_group->error, mq);
+		set_remove(mq->poll_group->dirty, mq);
 	}
 	link_close(mq->link);
 	list_delete(mq->send);
+	list_delete(mq->zc_pending);
 	free(mq);
 }
 
@@ -281,13 +486,178 @@ static int validate_header(struct mq_msg *msg)
 	return 0;
 }
 
+/* Request/response traffic is mostly small messages, each of which
+ * would otherwise cost a send() for the header and another for the
+ * payload, with Nagle's algorithm holding the payload back until the
+ * peer's delayed ACK for the header. Instead, the headers and payloads
+ * of the small messages at the head of the queue are gathered into one
+ * sendmsg(). A message cut off
+ * by a short write becomes the one being sent, and is finished by the
+ * usual send loop. Returns 1 if the send loop should carry on (whether
+ * or not anything was sent here), 0 if the socket is full, or -1 on error.
+ */
+static int flush_batch(struct mq *mq)
+{
+	assert(mq);
+	assert(!mq->sending);
+
+	struct iovec iov[MQ_BATCH_IOV];
+	int iovcnt = 0;
+	int count = 0;
+	size_t bytes = 0;
+
+	struct list_cursor *cur = list_cursor_create(mq->send);
+	list_seek(cur, 0);
+	for (struct mq_msg *msg; list_get(cur, (void **)&msg); list_next(cur)) {
+		if (msg->storage != MQ_MSG_BUFFER || msg->len > MQ_BATCH_MSG)
+			break;
+		if (iovcnt + 2 > MQ_BATCH_IOV || bytes + HDR_SIZE + msg->len > MQ_BATCH_MAX)
+			break;
+
+		// same framing as the send loop, but always a single frame
+		if (msg->len >= msg->max_len) {
+			msg->len = msg->max_len;
+		}
+		msg->type |= HDR_MSG_END;
+		msg->hdr_len = htonl(msg->len);
+
+		iov[iovcnt].iov_base = &msg->magic;
+		iov[iovcnt].iov_len = HDR_SIZE;
+		iovcnt++;
+		if (msg->len > 0) {
+			iov[iovcnt].iov_base = (char *)buffer_tostring(msg->buffer);
+			iov[iovcnt].iov_len = msg->len;
+			iovcnt++;
+		}
+		bytes += HDR_SIZE + msg->len;
+		count++;
+	}
+	list_cursor_destroy(cur);
+
+	if (count == 0)
+		return 1;
+
+	struct msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = iovcnt;
+
+	ssize_t rc = sendmsg(link_fd(mq->link), &mh, 0);
+	if (rc == -1 && errno_is_temporary(errno)) {
+		return 0;
+	} else if (rc <= 0) {
+		return -1;
+	}
+
+	size_t sent = rc;
+	for (int i = 0; i < count && sent > 0; i++) {
+		struct mq_msg *msg = list_pop_head(mq->send);
+		if (sent >= HDR_SIZE + msg->len) {
+			sent -= HDR_SIZE + msg->len;
+			msg_retire(mq, msg);
+		} else {
+			msg->hdr_pos = MIN(sent, HDR_SIZE);
+			msg->buf_pos = sent - msg->hdr_pos;
+			msg->total_len = msg->buf_pos;
+			mq->sending = msg;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+#ifdef MQ_SPLICE
+/* When sending from a pipe, the data is spliced straight into the socket
+ * rather than read into a buffer and written out again. A frame's length
+ * goes in its header, so each frame carries whatever the pipe holds when
+ * it starts (up to the frame limit), and an empty frame marks the end of
+ * the stream once the writer closes the pipe. Here `buffering` means the
+ * next frame is waiting on the pipe. Returns 1 to keep going, 0 if either
+ * side would block, or -1 on error.
+ */
+static int flush_splice(struct mq *mq, struct mq_msg *snd)
+{
+	int socket = link_fd(mq->link);
+
+	if (snd->buffering) {
+		struct pollfd pfd = {.fd = snd->pipefd, .events = POLLIN};
+		if (!snd->hung_up && poll(&pfd, 1, 0) == 0)
+			return 0;
+
+		/* The pipe polled readable, so nothing buffered means EOF.
+		 */
+		int avail = 0;
+		if (ioctl(snd->pipefd, FIONREAD, &avail) < 0)
+			return -1;
+
+		assert(snd->max_len >= snd->total_len);
+		size_t framelen = MIN((size_t)avail, MQ_FRAME_MAX);
+		if (avail == 0 || framelen >= snd->max_len - snd->total_len) {
+			framelen = MIN(framelen, snd->max_len - snd->total_len);
+			snd->type |= HDR_MSG_END;
+		}
+
+		snd->len = framelen;
+		snd->hdr_len = htonl(framelen);
+		snd->hdr_pos = 0;
+		snd->buf_pos = 0;
+		snd->buffering = false;
+		return 1;
+	}
+
+	if (snd->hdr_pos < HDR_SIZE) {
+		ssize_t rc = send(socket, (char *)&snd->magic + snd->hdr_pos, HDR_SIZE - snd->hdr_pos, 0);
+		if (rc == -1 && errno_is_temporary(errno)) {
+			return 0;
+		} else if (rc <= 0) {
+			return -1;
+		}
+		snd->hdr_pos = checked_add(snd->hdr_pos, rc);
+		return 1;
+	} else if (snd->buf_pos < snd->len) {
+		ssize_t rc = splice(snd->pipefd, NULL, socket, NULL, snd->len - snd->buf_pos, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (rc == -1 && errno_is_temporary(errno)) {
+			return 0;
+		} else if (rc == 0) {
+			// the bytes counted for this frame went missing
+			errno = EPIPE;
+			return -1;
+		} else if (rc < 0) {
+			return -1;
+		}
+		snd->buf_pos = checked_add(snd->buf_pos, rc);
+		snd->total_len = checked_add(snd->total_len, rc);
+		return 1;
+	} else if (snd->type & HDR_MSG_END) {
+		msg_retire(mq, snd);
+		mq->sending = NULL;
+		return 1;
+	} else {
+		snd->buffering = true;
+		snd->type = HDR_MSG_CONT;
+		return 1;
+	}
+}
+#endif
+
 static int flush_send(struct mq *mq)
 {
 	assert(mq);
 
 	int socket = link_fd(mq->link);
 
+#ifdef MQ_ZEROCOPY
+	if (mq->zc_next != mq->zc_done && zerocopy_reap(mq) == -1)
+		return -1;
+#endif
+
 	while (true) {
+		if (!mq->sending) {
+			int rc = flush_batch(mq);
+			if (rc <= 0)
+				return rc;
+		}
 		if (!mq->sending) {
 			mq->sending = list_pop_head(mq->send);
 		}
@@ -295,6 +665,15 @@ static int flush_send(struct mq *mq)
 		if (!snd)
 			return 0;
 
+#ifdef MQ_SPLICE
+		if (snd->splicing) {
+			int rc = flush_splice(mq, snd);
+			if (rc <= 0)
+				return rc;
+			continue;
+		}
+#endif
+
 		/* The logic here is a bit dense, since there are several modes of operation.
 		 * If a pipe/fd has been connected, we need to read some data in (of unknown
 		 * total length) and then spit that back out on the socket. It might be
@@ -356,7 +735,7 @@ static int flush_send(struct mq *mq)
 				snd->type |= HDR_MSG_END;
 			}
 
-			ssize_t rc = send(socket, &snd->magic + snd->hdr_pos, HDR_SIZE - snd->hdr_pos, 0);
+			ssize_t rc = send(socket, (char *)&snd->magic + snd->hdr_pos, HDR_SIZE - snd->hdr_pos, 0);
 			if (rc == -1 && errno_is_temporary(errno)) {
 				return 0;
 			} else if (rc <= 0) {
@@ -365,7 +744,22 @@ static int flush_send(struct mq *mq)
 			snd->hdr_pos = checked_add(snd->hdr_pos, rc);
 			continue;
 		} else if (snd->buf_pos < snd->len) {
-			ssize_t rc = send(socket, buffer_tostring(snd->buffer) + snd->buf_pos, MIN(snd->len, NEXT_FRAME(snd->buf_pos)) - snd->buf_pos, 0);
+			int flags = 0;
+#ifdef MQ_ZEROCOPY
+			flags |= zerocopy_flags(mq, snd);
+#endif
+			ssize_t rc = send(socket, buffer_tostring(snd->buffer) + snd->buf_pos, MIN(snd->len, NEXT_FRAME(snd->buf_pos)) - snd->buf_pos, flags);
+#ifdef MQ_ZEROCOPY
+			if (rc == -1 && errno == ENOBUFS && flags) {
+				// out of locked memory for pinning pages, so copy this one
+				flags = 0;
+				rc = send(socket, buffer_tostring(snd->buffer) + snd->buf_pos, MIN(snd->len, NEXT_FRAME(snd->buf_pos)) - snd->buf_pos, 0);
+			}
+			if (rc > 0 && flags) {
+				snd->zerocopy = true;
+				snd->zc_last = mq->zc_next++;
+			}
+#endif
 			if (rc == -1 && errno_is_temporary(errno)) {
 				return 0;
 			} else if (rc <= 0) {
@@ -390,7 +784,7 @@ static int flush_send(struct mq *mq)
 			 * otherwise, we're done.
 			 */
 			if (snd->type & HDR_MSG_END) {
-				mq_msg_delete(snd);
+				msg_retire(mq, snd);
 				mq->sending = NULL;
 			} else {
 				assert(snd->storage == MQ_MSG_FD);
@@ -420,7 +814,7 @@ static int flush_recv(struct mq *mq)
 
 		if (!rcv->buffering) {
 			if (rcv->hdr_pos < HDR_SIZE) {
-				ssize_t rc = recv(socket, &rcv->magic + rcv->hdr_pos, HDR_SIZE - rcv->hdr_pos, 0);
+				ssize_t rc = recv(socket, (char *)&rcv->magic + rcv->hdr_pos, HDR_SIZE - rcv->hdr_pos, 0);
 				if (rc == -1 && errno_is_temporary(errno)) {
 					return 0;
 				} else if (rc == 0) {
@@ -635,6 +1029,29 @@ static int handle_revents(struct mq *mq, struct pollfd *pfd)
 		 * the connection if the pipe we're recving into dies, as we don't
 		 * have anywhere to store the data we recv.
 		 */
+#ifdef MQ_ZEROCOPY
+		/* Completions of zero-copy sends arrive on the socket's error
+		 * queue, which also polls as POLLERR. Only a pending socket
+		 * error is fatal.
+		 */
+		if (mq->zc_next != mq->zc_done && ((pfd[0].fd == link_fd(mq->link) && pfd[0].revents & POLLERR) || (pfd[1].fd == link_fd(mq->link) && pfd[1].revents & POLLERR))) {
+			if (zerocopy_reap(mq) == -1) {
+				mq_die(mq, errno);
+				goto DONE;
+			}
+			rc = getsockopt(link_fd(mq->link), SOL_SOCKET, SO_ERROR, &err, &size);
+			assert(rc == 0);
+			if (err != 0) {
+				mq_die(mq, err);
+				goto DONE;
+			}
+			for (int i = 0; i < 2; i++) {
+				if (pfd[i].fd == link_fd(mq->link)) {
+					pfd[i].revents &= ~POLLERR;
+				}
+			}
+		}
+#endif
 		if (pfd[0].revents & (POLLERR | POLLHUP)) {
 			if (mq->sending && mq->sending->buffering) {
 				pfd[0].revents |= POLLIN;
@@ -720,13 +1137,12 @@ struct mq *mq_accept(struct mq *mq)
 	if (mq->poll_group) {
 		set_remove(mq->poll_group->acceptable, mq);
 	}
+	mark_dirty(mq);
 	return out;
 }
 
-int mq_wait(struct mq *mq, time_t stoptime)
+static int wait_one(struct mq *mq, time_t stoptime)
 {
-	assert(mq);
-
 	int rc;
 	struct pollfd pfd[2];
 	pfd[0].revents = 0;
@@ -751,6 +1167,25 @@ int mq_wait(struct mq *mq, time_t stoptime)
 	}
 }
 
+int mq_wait(struct mq *mq, time_t stoptime)
+{
+	assert(mq);
+
+	int rc = wait_one(mq, stoptime);
+
+	/* The fds registered with the polling group's epoll instance
+	 * might no longer match what mq is waiting for.
+	 */
+	if (mq->poll_group && mq->poll_group->epfd >= 0) {
+		unwatch_all(mq);
+		mq->pfd[0].revents = 0;
+		mq->pfd[1].revents = 0;
+		mark_dirty(mq);
+	}
+
+	return rc;
+}
+
 struct mq_poll *mq_poll_create(void)
 {
 	struct mq_poll *out = xxcalloc(1, sizeof(*out));
@@ -758,6 +1193,14 @@ struct mq_poll *mq_poll_create(void)
 	out->acceptable = set_create(0);
 	out->readable = set_create(0);
 	out->error = set_create(0);
+	out->dirty = set_create(0);
+	out->working = set_create(0);
+#ifdef MQ_EPOLL
+	// if epoll is not available, fall back to poll
+	out->epfd = epoll_create1(EPOLL_CLOEXEC);
+#else
+	out->epfd = -1;
+#endif
 	return out;
 }
 
@@ -769,12 +1212,17 @@ void mq_poll_delete(struct mq_poll *p)
 	struct mq *mq = NULL;
 	set_first_element(p->members);
 	while ((mq = set_next_element(p->members))) {
+		unwatch_all(mq);
 		mq->poll_group = NULL;
 	}
+	if (p->epfd >= 0)
+		close(p->epfd);
 	set_delete(p->members);
 	set_delete(p->readable);
 	set_delete(p->acceptable);
 	set_delete(p->error);
+	set_delete(p->dirty);
+	set_delete(p->working);
 	free(p);
 }
 
@@ -794,6 +1242,7 @@ int mq_poll_add(struct mq_poll *p, struct mq *mq)
 
 	mq->poll_group = p;
 	set_insert(p->members, mq);
+	mark_dirty(mq);
 
 	return 0;
 }
@@ -807,11 +1256,15 @@ int mq_poll_rm(struct mq_poll *p, struct mq *mq)
 		errno = ENOENT;
 		return -1;
 	}
+	unwatch_all(mq);
+	mq->pfd[0].revents = 0;
+	mq->pfd[1].revents = 0;
 	mq->poll_group = NULL;
 	set_remove(p->members, mq);
 	set_remove(p->acceptable, mq);
 	set_remove(p->readable, mq);
 	set_remove(p->error, mq);
+	set_remove(p->dirty, mq);
 
 	return 0;
 }
@@ -840,10 +1293,158 @@ struct mq *mq_poll_error(struct mq_poll *p)
 	return set_next_element(p->error);
 }
 
+#ifdef MQ_EPOLL
+static uint32_t poll_to_epoll(short events)
+{
+	uint32_t out = 0;
+	if (events & POLLIN)
+		out |= EPOLLIN;
+	if (events & POLLOUT)
+		out |= EPOLLOUT;
+	return out;
+}
+
+static short epoll_to_poll(uint32_t events)
+{
+	short out = 0;
+	if (events & EPOLLIN)
+		out |= POLLIN;
+	if (events & EPOLLOUT)
+		out |= POLLOUT;
+	if (events & EPOLLERR)
+		out |= POLLERR;
+	if (events & EPOLLHUP)
+		out |= POLLHUP;
+	return out;
+}
+
+/* Bring the fds registered for mq in line with the pollfds that
+ * poll_events just filled in. epoll refuses regular files, which poll
+ * always reports as ready, so those are handled by marking them ready
+ * and leaving mq dirty to be looked at again without waiting.
+ */
+static void watch_events(struct mq *mq)
+{
+	struct mq_poll *p = mq->poll_group;
+	struct pollfd *pfd = mq->pfd;
+
+	int fds[2] = {pfd[0].fd, pfd[1].fd};
+	uint32_t events[2] = {poll_to_epoll(pfd[0].events), poll_to_epoll(pfd[1].events)};
+	if (fds[0] >= 0 && fds[0] == fds[1]) {
+		events[0] |= events[1];
+		fds[1] = -1;
+	}
+
+	for (int k = 0; k < 2; k++) {
+		int fd = mq->watch[k].fd;
+		if (fd >= 0 && fd != fds[0] && fd != fds[1]) {
+			unwatch_fd(mq, fd);
+		}
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (fds[i] < 0)
+			continue;
+
+		struct mq_watch *w = NULL;
+		int op = EPOLL_CTL_MOD;
+		for (int k = 0; k < 2 && !w; k++) {
+			if (mq->watch[k].fd == fds[i])
+				w = &mq->watch[k];
+		}
+		if (!w) {
+			w = mq->watch[0].fd < 0 ? &mq->watch[0] : &mq->watch[1];
+			op = EPOLL_CTL_ADD;
+		} else if (w->events == events[i]) {
+			continue;
+		}
+
+		struct epoll_event ev;
+		ev.events = events[i];
+		ev.data.ptr = w;
+		if (epoll_ctl(p->epfd, op, fds[i], &ev) == 0) {
+			w->fd = fds[i];
+			w->events = events[i];
+		} else {
+			for (int j = 0; j < 2; j++) {
+				if (pfd[j].fd == fds[i])
+					pfd[j].revents = pfd[j].events;
+			}
+			set_insert(p->dirty, mq);
+		}
+	}
+}
+
+static int poll_wait_epoll(struct mq_poll *p, time_t stoptime)
+{
+	struct epoll_event events[MQ_POLL_EVENTS];
+	sigset_t mask;
+	sigemptyset(&mask);
+
+	while (true) {
+		struct set *work = p->dirty;
+		p->dirty = p->working;
+		p->working = work;
+
+		struct mq *mq;
+		while ((mq = set_pop(work))) {
+			// NB: revents are from the previous epoll_wait
+			int rc = handle_revents(mq, mq->pfd);
+			mq->pfd[0].revents = 0;
+			mq->pfd[1].revents = 0;
+			poll_events(mq, mq->pfd);
+			watch_events(mq);
+			if (rc == -1) {
+				while ((mq = set_pop(work))) {
+					set_insert(p->dirty, mq);
+				}
+				return -1;
+			}
+		}
+
+		int rc = 0;
+		rc += set_size(p->acceptable);
+		rc += set_size(p->readable);
+		rc += set_size(p->error);
+		if (rc > 0)
+			return rc;
+
+		// same timeout handling as ppoll_compat
+		int timeout = stoptime - time(NULL);
+		if (timeout < 0)
+			return 0;
+		if (set_size(p->dirty) > 0)
+			timeout = 0;
+
+		int n = epoll_pwait(p->epfd, events, MQ_POLL_EVENTS, timeout * 1000, &mask);
+		if (n == -1) {
+			return errno == EINTR ? 0 : -1;
+		} else if (n == 0 && set_size(p->dirty) == 0) {
+			return 0;
+		}
+
+		for (int i = 0; i < n; i++) {
+			struct mq_watch *w = events[i].data.ptr;
+			for (int j = 0; j < 2; j++) {
+				if (w->mq->pfd[j].fd == w->fd) {
+					w->mq->pfd[j].revents |= epoll_to_poll(events[i].events) & (w->mq->pfd[j].events | POLLERR | POLLHUP);
+				}
+			}
+			set_insert(p->dirty, w->mq);
+		}
+	}
+}
+#endif
+
 int mq_poll_wait(struct mq_poll *p, time_t stoptime)
 {
 	assert(p);
 
+#ifdef MQ_EPOLL
+	if (p->epfd >= 0)
+		return poll_wait_epoll(p, stoptime);
+#endif
+
 	int rc;
 	int count = set_size(p->members);
 	struct pollfd *pfds = xxcalloc(2 * count, sizeof(*pfds));
@@ -904,6 +1505,7 @@ int mq_send_buffer(struct mq *mq, buffer_t *buf, size_t maxlen)
 	msg->max_len = maxlen;
 	buffer_tolstring(buf, &msg->len);
 	list_push_tail(mq->send, msg);
+	mark_dirty(mq);
 
 	return 0;
 }
@@ -924,20 +1526,31 @@ int mq_send_fd(struct mq *mq, int fd, size_t maxlen)
 	struct mq_msg *msg = msg_create();
 	msg->storage = MQ_MSG_FD;
 	msg->buffering = true;
-	msg->buffer = xxcalloc(1, sizeof(*msg->buffer));
-	buffer_init(msg->buffer);
-	buffer_abortonfailure(msg->buffer, true);
-	buffer_grow(msg->buffer, MQ_FRAME_MAX);
 	msg->type = HDR_MSG_START;
 	msg->pipefd = fd;
 	msg->max_len = maxlen;
-	msg->len = MQ_FRAME_MAX;
-	list_push_tail(mq->send, msg);
 	if (set_nonblocking(msg) < 0) {
 		mq_msg_delete(msg);
 		return -1;
 	}
 
+#ifdef MQ_SPLICE
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode)) {
+		msg->splicing = true;
+	}
+#endif
+	if (!msg->splicing) {
+		msg->buffer = xxcalloc(1, sizeof(*msg->buffer));
+		buffer_init(msg->buffer);
+		buffer_abortonfailure(msg->buffer, true);
+		buffer_grow(msg->buffer, MQ_FRAME_MAX);
+		msg->len = MQ_FRAME_MAX;
+	}
+
+	list_push_tail(mq->send, msg);
+	mark_dirty(mq);
+
 	return 0;
 }
 
@@ -954,6 +1567,7 @@ mq_msg_t mq_recv(struct mq *mq, size_t *length)
 	if (mq->poll_group) {
 		set_remove(mq->poll_group->readable, mq);
 	}
+	mark_dirty(mq);
 	if (length) {
 		*length = msg->total_len;
 	}
@@ -981,6 +1595,7 @@ int mq_store_buffer(struct mq *mq, buffer_t *buf, size_t maxlen)
 	mq->recving->buffer = buf;
 	mq->recving->storage = MQ_MSG_BUFFER;
 	mq->recving->max_len = maxlen;
+	mark_dirty(mq);
 
 	return 0;
 }
@@ -1008,6 +1623,7 @@ int mq_store_fd(struct mq *mq, int fd, size_t maxlen)
 		mq->recving = NULL;
 		return -1;
 	}
+	mark_dirty(mq);
 
 	return 0;
 }
@@ -41,6 +41,14 @@ See the file COPYING for details.
  * messages/connections. Helper functions (@ref mq_poll_readable,
  * @ref mq_poll_acceptable, @ref mq_poll_error) are available to
  * efficiently find queues with messages/connections available.
+ * On Linux, polling groups are backed by epoll, and a wait only does
+ * work for the queues that had activity, so idle connections are
+ * nearly free.
+ *
+ * Small messages waiting to be sent are written together, headers and
+ * payloads, with one system call. Large buffers are sent with
+ * MSG_ZEROCOPY where the kernel supports it, and pipes passed to
+ * @ref mq_send_fd are spliced directly into the socket.
  *
  * The examples that follow are lazy about checking for errors,
  * be sure to check carefully!
@@ -347,7 +355,8 @@ int mq_send_buffer(struct mq *mq, buffer_t *buf, size_t maxlen);
  * close it when the message is sent, so callers MUST NOT use/close fd
  * after passing it in. This function will read from fd until reaching the
  * end of the file. This function will not seek fd, so it's possible to send
- * slices from within files.
+ * slices from within files. If fd is a pipe, data is sent as it arrives
+ * rather than a full frame at a time.
  * @param mq The message queue.
  * @param fd The file descriptor to read.
  * @param maxlen Maximum number of bytes to send, or 0 to read to EOF.
@@ -71,6 +71,9 @@ import tempfile
 import gzip
 import imp
 import socket
+import fcntl
+import threading
+from multiprocessing.pool import ThreadPool
 
 try:
     from StringIO import StringIO       # python 2.x
@@ -144,6 +147,9 @@ pac_manager = {
 
 upload_count = 0
 
+#the number of dependencies downloaded at once into the umbrella local cache.
+fetch_threads = 4
+
 def subprocess_error(cmd, rc, stdout, stderr):
     """Print the command, return code, stdout, and stderr; and then directly exit.
 
@@ -269,6 +275,127 @@ def url_download(url, dest):
     logging.debug("Start to download %s to %s ...." % (url, dest))
     urlretrieve(url, dest)
 
+class ChecksumError(Exception):
+    """The checksum of a downloaded dependency does not match its metadata."""
+    pass
+
+def cache_lock(dest_dir):
+    """Lock a directory of the umbrella local cache.
+    The lock is held against the other threads and the other umbrella processes sharing the local cache, so that each dependency is downloaded and unpacked only once.
+
+    Args:
+        dest_dir: the directory of the umbrella local cache where a dependency is put.
+
+    Returns:
+        the lock file, which releases the lock when closed.
+    """
+    if not os.path.exists(dest_dir):
+        try:
+            os.makedirs(dest_dir)
+        except OSError:
+            #another umbrella process may create it at the same time
+            if not os.path.isdir(dest_dir):
+                raise
+    lock = open(os.path.join(dest_dir, ".lock"), "a")
+    fcntl.flock(lock, fcntl.LOCK_EX)
+    return lock
+
+def cache_link_verified(dest_dir, checksum, dest):
+    """Hard link a dependency already in the umbrella local cache under another name.
+    The dependencies in the directory of a checksum have the same content, so the dependency of one specification can be shared by another specification which names it differently.
+
+    Args:
+        dest_dir: the directory of the umbrella local cache for the checksum.
+        checksum: the checksum of the dependency.
+        dest: the path where the dependency should be linked.
+
+    Returns:
+        If a verified copy of the dependency was linked, return True; otherwise, return False.
+    """
+    for item in os.listdir(dest_dir):
+        if item[-4:] != ".md5":
+            continue
+        archive = os.path.join(dest_dir, item[:-4])
+        try:
+            with open(os.path.join(dest_dir, item)) as f:
+                if f.read().strip() != checksum or not os.path.isfile(archive):
+                    continue
+            os.link(archive, dest)
+            logging.debug("%s is linked from %s in the umbrella local cache", dest, archive)
+            return True
+        except (IOError, OSError):
+            continue
+    return False
+
+def cache_fetch(url, checksum, dest, dest_uncompress, format_remote_storage, action):
+    """Download a dependency into the umbrella local cache, verify it, and unpack it.
+    The cache directory of the dependency is locked while the dependency is prepared. A dependency is downloaded or unpacked under a temporary name, and only renamed to its final path once complete, so that a failure never leaves a partial dependency behind in the cache.
+    Once its checksum is verified, the checksum is written beside the dependency with the suffix .md5, so that later runs do not need to read the whole dependency again.
+
+    Args:
+        url: the storage location of the dependency.
+        checksum: the md5 checksum of the dependency, or None if it should not be verified.
+        dest: the path of the compressed-version dependency.
+        dest_uncompress: the path of the uncompressed-version dependency.
+        format_remote_storage: the file format of the dependency, such as tgz.
+        action: the action on the downloaded dependency. Options: none, unpack.
+
+    Returns:
+        None. Raises ChecksumError if the checksum does not match, and other exceptions if the download fails.
+    """
+    dest_dir = os.path.dirname(dest)
+    verified = dest + ".md5"
+
+    lock = cache_lock(dest_dir)
+    try:
+        if not os.path.exists(dest):
+            part = "%s.part.%d.%d" % (dest, os.getpid(), threading.current_thread().ident)
+            try:
+                if not (checksum and cache_link_verified(dest_dir, checksum, part)):
+                    url_download(url, part)
+                if checksum:
+                    local_checksum = md5_cal(part)
+                    logging.debug("The checksum of %s is: %s", url, local_checksum)
+                    if local_checksum != checksum:
+                        raise ChecksumError("the checksum of %s downloaded from %s is incorrect!" % (dest, url))
+                os.rename(part, dest)
+            finally:
+                if os.path.exists(part):
+                    os.remove(part)
+            if checksum:
+                with open(verified, "w") as f:
+                    f.write(checksum)
+            #if it exists, the uncompressed-version directory will be deleted first
+            if action == "unpack" and format_remote_storage != 'plain' and os.path.exists(dest_uncompress):
+                shutil.rmtree(dest_uncompress)
+                logging.debug("the uncompressed-version directory exists already, first delete it")
+        elif checksum:
+            is_verified = False
+            if os.path.exists(verified):
+                with open(verified) as f:
+                    is_verified = f.read().strip() == checksum
+            if not is_verified:
+                local_checksum = md5_cal(dest)
+                logging.debug("The checksum of %s is: %s", dest, local_checksum)
+                if local_checksum != checksum:
+                    raise ChecksumError("The version of %s is incorrect! Please first delete it and its unpacked directory!!" % dest)
+                with open(verified, "w") as f:
+                    f.write(checksum)
+
+        #if the uncompressed-version dependency does not exist, uncompress the dependency
+        if action == "unpack" and (not os.path.exists(dest_uncompress)) and format_remote_storage == "tgz":
+            logging.debug("Uncompressing %s into %s ....", dest, dest_uncompress)
+            unpack_dir = tempfile.mkdtemp(dir=dest_dir, prefix=".unpack-")
+            try:
+                extract_tar(dest, unpack_dir, "tgz")
+                for item in os.listdir(unpack_dir):
+                    if not os.path.exists(os.path.join(dest_dir, item)):
+                        os.rename(os.path.join(unpack_dir, item), os.path.join(dest_dir, item))
+            finally:
+                shutil.rmtree(unpack_dir)
+    finally:
+        lock.close()
+
 def dependency_download(name, url, checksum, checksum_tool, dest, format_remote_storage, action):
     """Download a dependency from the url and verify its integrity.
 
@@ -297,38 +424,99 @@ def dependency_download(name, url, checksum, checksum_tool, dest, format_remote_
 
     dest = os.path.join(dest_dir, filename) #dest is the path of the compressed-version dependency
 
-    if not os.path.exists(dest_dir):
-        os.makedirs(dest_dir)
-
-    if not os.path.exists(dest):
-        #download the dependency from the url
-        #this method currently will fail when the data size is larger than the memory size, use subprocess + wget can solve it
-        url_download(url, dest)
-        #if it exists, the uncompressed-version directory will be deleted first
-        if action == "unpack" and format_remote_storage != 'plain' and os.path.exists(dest_uncompress):
-            shutil.rmtree(dest_uncompress)
-            logging.debug("the uncompressed-version directory exists already, first delete it")
-
-    #calculate the checkusm of the compressed-version dependency
     if checksum_tool == "md5sum":
-        local_checksum = md5_cal(dest)
-        logging.debug("The checksum of %s is: %s", dest, local_checksum)
-        if not local_checksum == checksum:
-            cleanup(tempfile_list, tempdir_list)
-            logging.critical("The version of %s is incorrect! Please first delete it and its unpacked directory!!", dest)
-            sys.exit("the version of " + dest + " is incorrect! Please first delete it and its unpacked directory!!\n")
+        pass
     elif not checksum_tool:
         logging.debug("the checksum of %s is not provided!", url)
+        checksum = None
     else:
         cleanup(tempfile_list, tempdir_list)
         logging.critical("%s is not supported currently!", checksum_tool)
         sys.exit(checksum_tool + "is not supported currently!")
 
-    #if the uncompressed-version dependency does not exist, uncompress the dependency
-    if action == "unpack" and (not os.path.exists(dest_uncompress)) and format_remote_storage == "tgz":
-        logging.debug("Uncompressing %s into %s ....", dest, dest_uncompress)
-        tfile = tarfile.open(dest, "r:gz")
-        tfile.extractall(dest_dir)
+    try:
+        cache_fetch(url, checksum, dest, dest_uncompress, format_remote_storage, action)
+    except ChecksumError as e:
+        cleanup(tempfile_list, tempdir_list)
+        logging.critical("%s", e)
+        sys.exit("%s\n" % e)
+
+def cache_install(src, parent_dir):
+    """Put a dependency from the umbrella local cache into parent_dir.
+    The dependency stays in the cache for the other jobs sharing it. It is hard linked into place where the cache and parent_dir are on the same filesystem, and copied otherwise.
+
+    Args:
+        src: the path of the dependency in the umbrella local cache.
+        parent_dir: the directory where the dependency should be put.
+
+    Returns:
+        If the dependency cannot be put into parent_dir, directly exit.
+        Otherwise, return None.
+    """
+    cmd = "cp -al %s %s/" % (src, parent_dir)
+    rc, stdout, stderr = func_call(cmd, ["cp"])
+    if rc != 0:
+        logging.debug("Fails to hard link %s into %s, copying it instead", src, parent_dir)
+        cmd = "cp -a %s %s/" % (src, parent_dir)
+        rc, stdout, stderr = func_call(cmd, ["cp"])
+        if rc != 0:
+            subprocess_error(cmd, rc, stdout, stderr)
+
+def dependency_prefetch(items, meta_json, sandbox_dir):
+    """Download the dependencies of a specification into the umbrella local cache at once, with fetch_threads threads.
+    Only the dependencies delivered through urls are downloaded here. Failures are ignored, and are reported when each dependency is installed in turn afterwards.
+
+    Args:
+        items: a list of (name, id, action) tuples, one for each dependency.
+        meta_json: the json object including all the metadata of dependencies.
+        sandbox_dir: the sandbox dir for temporary files like Parrot mountlist file.
+
+    Returns:
+        None
+    """
+    fetches = []
+    for (name, id, action) in items:
+        if name not in meta_json:
+            continue
+        if id:
+            item = meta_json[name].get(id)
+        else:
+            item = next(iter(meta_json[name].values()), None)
+        if not item or not item.get("source") or "checksum" not in item or "format" not in item:
+            continue
+
+        source = source_filter(item["source"], ['osf', 's3'], name)
+        if source[:4] == 'osf+':
+            source = source[4:]
+        elif source[:3] == 's3+':
+            source = source[3:]
+        elif source[:4] == 'git+' or source[:5] == 'cvmfs':
+            continue
+
+        checksum = item["checksum"].lower()
+        form = item["format"]
+        dest_uncompress = os.path.dirname(sandbox_dir) + "/cache/" + checksum + "/" + name
+        if form == "tgz":
+            dest = dest_uncompress + ".tar.gz"
+        else:
+            dest = dest_uncompress
+        fetches.append((source, checksum, dest, dest_uncompress, form, action))
+
+    if len(fetches) < 2 or fetch_threads < 2:
+        return
+
+    def fetch(args):
+        try:
+            cache_fetch(*args)
+        except BaseException as e:
+            logging.debug("Fails to prefetch %s: %s", args[0], e)
+
+    print("Downloading %d dependencies into the umbrella local cache with %d threads ..." % (len(fetches), fetch_threads))
+    logging.debug("Downloading %d dependencies into the umbrella local cache with %d threads ...", len(fetches), fetch_threads)
+    pool = ThreadPool(min(fetch_threads, len(fetches)))
+    pool.map(fetch, fetches)
+    pool.close()
+    pool.join()
 
 def extract_tar(src, dest, form):
     """Extract a tgz file from src to dest
@@ -1069,10 +1257,7 @@ def software_install(mount_dict, env_para_dict, software_spec, meta_json, sandbo
                         sys.exit("%s is not a directory!\n" % parent_dir)
 
                     if not os.path.exists(mountpoint):
-                        cmd = "mv -f %s %s/" % (mount_value, parent_dir)
-                        rc, stdout, stderr = func_call(cmd, ["mv"])
-                        if rc != 0:
-                            subprocess_error(cmd, rc, stdout, stderr)
+                        cache_install(mount_value, parent_dir)
                 else:
                     mount_dict[mountpoint] = mount_value
 
@@ -1856,10 +2041,7 @@ def workflow_repeat(cwd_setting, sandbox_dir, sandbox_mode, output_f_dict, outpu
                 sys.exit("%s is not a directory!\n" % parent_dir)
 
             if not os.path.exists(key):
-                cmd = "mv -f %s %s/" % (mount_dict[key], parent_dir)
-                rc, stdout, stderr = func_call_withenv(cmd, env_dict, ["mv"])
-                if rc != 0:
-                    subprocess_error(cmd, rc, stdout, stderr)
+                cache_install(mount_dict[key], parent_dir)
 
         print("Start executing the user's task: %s" % user_cmd[0])
         cmd = "cd %s; %s" % (cwd_setting, user_cmd[0])
@@ -2546,6 +2728,20 @@ def specification_process(spec_json, sandbox_dir, behavior, meta_json, sandbox_m
         needs_parrotize_user_cmd = True
 
     item = '%s-%s-%s' % (distro_name, distro_version, hardware_platform) #example of item here: redhat-6.5-x86_64
+
+    #download the os, software and data dependencies at once, before they are installed in turn below.
+    prefetch_items = []
+    if need_separate_rootfs and sandbox_mode not in ["destructive"]:
+        prefetch_items.append((item, os_id, 'unpack'))
+    for sec in ["software", "data"]:
+        if sec in spec_json.keys() and spec_json[sec]:
+            for name in spec_json[sec]:
+                dep = spec_json[sec][name]
+                if 'mount_env' in dep.keys() and 'mountpoint' not in dep.keys():
+                    continue
+                prefetch_items.append((name, dep.get('id', ''), dep.get('action', 'unpack').lower()))
+    dependency_prefetch(prefetch_items, meta_json, sandbox_dir)
+
     if need_separate_rootfs and sandbox_mode not in ["destructive"]:
         #download the os dependency into the local
         os_image_dir = "%s/cache/%s/%s" % (os.path.dirname(sandbox_dir), os_id, item)
@@ -3997,6 +4193,11 @@ To check the help doc for a specific behavoir, use: %prog <behavior> help""",
     parser.add_option("--parrot_path",
                     action="store",
                     help="the path of parrot_run on the host machine",)
+    parser.add_option("--fetch_threads",
+                    action="store",
+                    type="int",
+                    default=4,
+                    help="the number of dependencies to download at once into the umbrella local cache. (By default: 4)",)
     parser.add_option("--cms_siteconf",
                     action="store",
                     help="a tar.gz local file path (e.g., /tmp/1.tar.gz) or url path (e.g., http://.../1.tar.gz) pointing to the site configuration files for cms applications, the SITECONF dir should be organized following the suggestions at https://twiki.cern.ch/twiki/bin/view/CMSPublic/SiteConfInGitlab",)
@@ -4019,6 +4220,9 @@ To check the help doc for a specific behavoir, use: %prog <behavior> help""",
         global cms_siteconf_url
         cms_siteconf_url = options.cms_siteconf
 
+    global fetch_threads
+    fetch_threads = options.fetch_threads
+
     global tempfile_list
     global tempdir_list
     global upload_count
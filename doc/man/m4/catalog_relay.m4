@@ -0,0 +1,74 @@
+include(manual.h)dnl
+HEADER(catalog_relay)
+
+SECTION(NAME)
+BOLD(catalog_relay) - forward the catalog updates of a host in batches
+
+SECTION(SYNOPSIS)
+CODE(catalog_relay [options])
+
+SECTION(DESCRIPTION)
+
+PARA
+A host running many managers, workers, and factories sends the catalog
+server one update per program every minute or so, each on a connection
+of its own. The CODE(catalog_relay) gathers these updates through a Unix
+socket and forwards them to the catalog servers every few seconds, as
+one compressed batch for each list of catalog servers. Of several updates
+of the same record, only the last is forwarded, and a record that has
+not changed since it was last forwarded is not sent again until the
+refresh interval has passed.
+
+PARA
+Programs use the relay when the environment variable CODE(CATALOG_RELAY)
+names its socket, and send their updates directly to the catalog servers
+whenever the relay cannot be reached. Queries from these programs, such
+as those of CODE(catalog_query) and CODE(work_queue_status), are also
+sent through the relay, which answers repeated queries from the results
+it got from the catalog servers a short while ago.
+
+PARA
+The catalog servers must be of v8.0 or later to accept batches of updates.
+Since all the records come from the address of the relay, the relay should
+run on the same host as the programs that use it.
+
+SECTION(OPTIONS)
+
+OPTIONS_BEGIN
+OPTION_ARG(A, cache-lifetime, secs)Answer queries from results up to this old. (default is 15s)
+OPTION_ARG(d, debug, flag)Enable debugging for this subsystem.
+OPTION_FLAG(h,help)Show this help screen.
+OPTION_ARG(i, interval, secs)Forward the updates received at this interval. (default is 5s)
+OPTION_ARG(o,debug-file,file)Write debugging output to this file.
+OPTION_ARG(r, refresh, secs)Forward a record that has not changed no more often than this. (default is 300s)
+OPTION_ARG(s, socket, path)Listen on this Unix socket. (default is CODE(CATALOG_RELAY))
+OPTION_FLAG(v,version)Show version string.
+OPTIONS_END
+
+SECTION(ENVIRONMENT VARIABLES)
+
+LIST_BEGIN
+LIST_ITEM(CODE(CATALOG_RELAY)) The Unix socket of the relay, for the relay and the programs that use it.
+LIST_END
+
+SECTION(EXIT STATUS)
+On success, returns zero.  On failure, returns non-zero.
+
+SECTION(EXAMPLES)
+
+PARA
+Start a relay, and then managers that send their updates through it:
+
+LONGCODE_BEGIN
+% export CATALOG_RELAY=/tmp/catalog_relay.$USER
+% catalog_relay &
+% work_queue_factory -M myproject ...
+LONGCODE_END
+
+SECTION(COPYRIGHT)
+COPYRIGHT_BOILERPLATE
+
+SECTION(SEE ALSO)
+SEE_ALSO_CATALOG
+
+FOOTER
@@ -35,14 +35,26 @@ However, the catalog does update each incoming record with the actual IP address
 and port from which it came, thus preventing a malicious service from
 overwriting another service's record.
 
+PARA
+A client may also subscribe to changes in the catalog by requesting
+CODE(/subscribe/)ITALIC(expr), where ITALIC(expr) is a base64 encoded
+JX expression that selects the records of interest.  The server sends
+the records that match now, and then each change to them in the form of the
+catalog history log, as it happens, until the client disconnects.
+Each subscriber is served by a process of its own, and so counts
+toward the limit given by CODE(--max-jobs).
+
 SECTION(OPTIONS)
 
 OPTIONS_BEGIN
 OPTION_FLAG(b,background)Run as a daemon.
 OPTION_ARG(B, pid-file,file)Write process identifier (PID) to file.
+OPTION_ARG(c, cache-dir, directory)Keep the responses to JSON queries of the current table in this directory, so that repeated queries are answered without evaluating them again.  Responses are also kept compressed, and sent that way to clients that accept gzip encoding.  Responses that are no longer current are removed from the directory shortly after the cache lifetime.
+OPTION_ARG(A, cache-lifetime, time)Answer queries from a cached response of up to this age, even if the table has changed since.  Otherwise, a cached response is used only until the next update.  (default is 0s)
 OPTION_ARG(d, debug, flag)Enable debugging for this subsystem
 OPTION_FLAG(h,help)Show this help screen
 OPTION_ARG(H, history, directory) Store catalog history in this directory.  Enables fast data recovery after a failure or restart, and enables historical queries via deltadb_query.
+OPTION_ARG(i, index, fields)Keep an index of the records by each of these comma separated fields.  A query that requires a field to equal a string considers only the records in the index with that value.  (default is type,project,owner)
 OPTION_ARG(I, interface, addr)Listen only on this network interface.
 OPTION_ARG(l, lifetime, secs)Lifetime of data, in seconds (default is 1800)
 OPTION_ARG(L, update-log,file)Log new updates to this file.
@@ -53,6 +65,7 @@ OPTION_ARG(o,debug-file,file)Write debugging output to this file. By default, de
 OPTION_ARG(O, debug-rotate-max, bytes)Rotate debug file once it reaches this size (default 10M, 0 disables).
 OPTION_ARG(p,, port, port)Port number to listen on (default is 9097)
 OPTION_FLAG(S,single)Single process mode; do not fork on queries.
+OPTION_ARG(t, ingest-threads, n)Receive and parse updates on n threads apart from the main loop, which only applies the parsed updates to the table.  Use this when bursts of updates delay queries or cause UDP updates to be dropped.  (default is 0, to handle updates in the main loop)
 OPTION_ARG(T, timeout, time)Maximum time to allow a query process to run.  (default is 60s)
 OPTION_ARG(u, update-host, host)Send status updates to this host. (default is catalog.cse.nd.edu,backup-catalog.cse.nd.edu)
 OPTION_ARG(U, update-interval, time)Send status updates at this interval. (default is 5m)
@@ -5,6 +5,8 @@ SECTION(NAME)
 BOLD(chirp_benchmark) - do micro-performance tests on a Chirp server
 
 SECTION(SYNOPSIS)
+CODE(chirp_benchmark [options] PARAM(host[:port]) PARAM(dir))
+
 CODE(chirp_benchmark PARAM(host[:port]) PARAM(file) PARAM(loops) PARAM(cycles) PARAM(bwloops))
 
 SECTION(DESCRIPTION)
@@ -16,9 +18,37 @@ not use I/O bandwidth on the backend filesystem to measure the latency. It also
 tests the throughput for reading and writing to the given filename with
 various block sizes.
 
+PARA
+Given options and a directory, CODE(chirp_benchmark) instead runs a suite of
+workloads in that directory from several client processes at once, each with
+several threads, and each thread with its own connection to the server.
+The workloads are CODE(stat) and CODE(open) of existing files, CODE(create) of
+small files, sequential CODE(write) and CODE(read) of a large file per thread,
+CODE(pread) of small blocks at random offsets of a shared file, and CODE(acl),
+which opens files in a directory with a long access control list.
+For each workload it reports the operations per second, the bandwidth, and the
+50th, 90th and 99th percentile and maximum latency of a single operation.
+The directory is removed when done.
+
 PARA
 For complete details with examples, see the LINK(Chirp User's Manual,http://ccl.cse.nd.edu/software/manuals/chirp.html).
 
+SECTION(OPTIONS)
+OPTIONS_BEGIN
+OPTION_ARG(w,workloads,list)Workloads to run, separated by commas. (default: all)
+OPTION_ARG(c,clients,n)Number of client processes. (default: 1)
+OPTION_ARG(t,threads,n)Number of threads in each client. (default: 4)
+OPTION_ARG(n,ops,n)Operations of each thread. (default: 1000)
+OPTION_ARG(f,files,n)Number of files of the metadata workloads. (default: 100)
+OPTION_ARG(s,file-size,size)Size of the large files, a multiple of the block size. (default: 64MB)
+OPTION_ARG(b,block-size,size)Block size of sequential transfers, a multiple of 4KB. (default: 1MB)
+OPTION_ARG(a,acl-entries,n)Entries in the access control list of the acl workload. (default: 100)
+OPTION_ARG(j,json,file)Write a report in JSON to this file.
+OPTION_FLAG(k,keep)Keep the files in the directory when done.
+OPTION_ARG(T,timeout,secs)Timeout of each operation in seconds. (default: 60)
+OPTION_FLAG(h,help)Show the help screen.
+OPTIONS_END
+
 SECTION(EXIT STATUS)
 On success, returns zero.  On failure, returns non-zero.
 
@@ -31,13 +61,22 @@ $ chirp_benchmark host:port foobar 10 10 10
 getpid     1.0000 +/-    0.1414  usec
 write1   496.3200 +/-   41.1547  usec
 write8   640.0400 +/-   23.8790  usec
-read1     41.0400 +/-   91.3210  usec
+read4     41.0400 +/-   91.3210  usec
 read8      0.9200 +/-    0.1789  usec
 stat     530.2400 +/-   14.2425  usec
 open    1048.1200 +/-   15.5097  usec
 ...
 LONGCODE_END
 
+To run the metadata workloads from four clients with eight threads each, and keep a report:
+
+LONGCODE_BEGIN
+$ chirp_benchmark -c 4 -t 8 -w stat,open,create,acl -j report.json host:port /benchmark
+workload        ops  errors  time(s)      ops/s      MB/s   p50(us)   p90(us)   p99(us)   max(us)
+stat          32000       0     2.71    11808.1      0.00      2480      3581      5890      9120
+...
+LONGCODE_END
+
 SECTION(COPYRIGHT)
 
 COPYRIGHT_BOILERPLATE
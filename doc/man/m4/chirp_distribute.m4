@@ -12,6 +12,8 @@ BOLD(chirp_distribute) is a tool for coping commonly used data across Chirp serv
 PARA
 BOLD(chirp_distribute) is a quick and simple way for replicating a directory from a Chirp server to many Chirp Servers by creating a spanning tree and then transferring data concurrently from host to host using third party transfer. It is faster than manually copying data using BOLD(parrot cp), BOLD(chirp_put) or BOLD(chirp_third_put)
 PARA
+Each entry of the source directory is moved separately, so a host that has received part of the directory begins forwarding it to other hosts before it has the rest.  The throughput of each link is measured as data moves, and new transfers are started on the fastest links first, sending the least replicated entries first.  Measurements are kept in CODE(~/.chirp/out.txt) when BOLD(-D) is given, and are used to plan later runs.  A target that fails repeatedly is given up on, and any partial copy left on it is removed.
+PARA
 BOLD(chirp_distribute) also can clean up replicated data using -X option.
 SECTION(OPTIONS)
 
@@ -28,13 +28,17 @@ LINK(Chirp User's Manual,http://ccl.cse.nd.edu/software/manuals/chirp.html).
 SECTION(OPTIONS)
 
 OPTIONS_BEGIN
+OPTION_ARG_LONG(attr-timeout,secs)Cache file attributes, including those returned by directory listings, for this many seconds. (default is 1s)
 OPTION_ARG(a,auth,flag) Enable authentication mode: unix, hostname, address, ticket, kerberos, or globus.
 OPTION_ARG(b,block-size,bytes)Block size for network I/O. (default is 65536s)
 OPTION_ARG(d,debug,flag)Enable debugging for this subsystem.
 OPTION_FLAG(D,no-optimize)Disable small file optimizations such as recursive delete.
+OPTION_ARG_LONG(entry-timeout,secs)Cache name lookups in the kernel for this many seconds. (default is 1s)
 OPTION_FLAG(f,foreground)Run in foreground for debugging.
 OPTION_ARG(i,tickets,files)Comma-delimited list of tickets to use for authentication.
 OPTION_ARG(m,mount-options,option)Pass mount option to FUSE. Can be specified multiple times.
+OPTION_FLAG_LONG(multi-threaded)Handle several FUSE requests at once, rather than one at a time. This mode is experimental.
+OPTION_FLAG_LONG(no-kernel-cache)Do not keep file data in the kernel page cache across opens. By default, cached data is kept until the file is seen to change on the server.
 OPTION_ARG(o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
 OPTION_ARG(t,timeout,timeout)Timeout for network operations. (default is 60s)
 OPTION_FLAG(v,version)Show program version.
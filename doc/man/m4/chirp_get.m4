@@ -22,6 +22,7 @@ OPTION_ARG(a,auth,flag) Enable authentication mode: unix, hostname, address, tic
 OPTION_ARG(d,debug,flag)Enable debugging for this subsystem.
 OPTION_ARG(t,timeout,time)Timeout for failure. (default is 3600s)
 OPTION_ARG(i,tickets,files)Comma-delimited list of tickets to use for authentication.
+OPTION_ARG(p,parallel,n)Move each large file over this many parallel connections, each carrying one contiguous range of the file. Useful on high latency networks. (default is 1)
 OPTION_FLAG(v,version)Show program version.
 OPTION_FLAG(h,help)Show help text.
 OPTIONS_END
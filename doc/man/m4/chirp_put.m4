@@ -21,6 +21,7 @@ OPTION_ARG(d,debug,flag)Enable debugging for this subsystem.
 OPTION_ARG(b,block-size,size)Set transfer buffer size. (default is 65536 bytes).
 OPTION_FLAG(f,follow)Follow input file like tail -f.
 OPTION_ARG(i,tickets,files)Comma-delimited list of tickets to use for authentication.
+OPTION_ARG(p,parallel,n)Move each large file over this many parallel connections, each carrying one contiguous range of the file. Useful on high latency networks. (default is 1)
 OPTION_ARG(t,timeout, time)Timeout for failure. (default is 3600s)
 OPTION_FLAG(v,version)Show program version.
 OPTION_FLAG(h,help)Show help text.
@@ -43,7 +43,7 @@ OPTION_ARG(O, debug-rotate-max,bytes)Rotate debug file once it reaches this size
 OPTION_ARG(P,superuser,user)Superuser for all directories. (default is none)
 OPTION_ARG(p,port,port)Listen on this port (default is 9094, arbitrary is 0)
 OPTION_ARG_LONG(project-name,name)Project name this Chirp server belongs to.
-OPTION_ARG(Q,root-quota,size)Enforce this root quota in software.
+OPTION_ARG(Q,root-quota,size)Enforce this root quota in software. At startup, only the allocations changed since the previous start are recounted; remove .__alloc_journal from the root to force a full scan.
 OPTION_FLAG(R,read-only)Read-only mode.
 OPTION_ARG(r, root,url)URL of storage directory, like file://path or hdfs://host:port/path.
 OPTION_ARG(s,stalled,time)Abort stalled operations after this long. (default is 3600s)
@@ -54,6 +54,8 @@ OPTION_ARG(u,advertize,host)Send status updates to this host. (default is catalo
 OPTION_FLAG(v,version)Show version info.
 OPTION_ARG(W,passwd,file)Use alternate password file for unix authentication
 OPTION_ARG(w,owner,name)The name of this server's owner.  (default is username)
+OPTION_ARG_LONG(workers,count)Serve clients from this many long-lived worker processes, instead of forking a process for each client. Workers switch to the user given by --user before authenticating clients. (default is disabled)
+OPTION_ARG_LONG(thirdput-streams,n)Send each large file over this many parallel connections when serving thirdput requests. (default is 1)
 OPTION_ARG(y,transient,dir)Location of transient data (default is pwd).
 OPTION_ARG(Z,port-file,file)Select port at random and write it to this file.  (default is disabled)
 OPTION_ARG(z, unix-timeout,time)Set max timeout for unix filesystem authentication. (default is 5s)
@@ -37,7 +37,9 @@ OPTION_ARG_LONG(auth,method)Enable this method for Head Node to Storage Node aut
 OPTION_ARG_LONG(concurrency,limit)Limits the number of concurrent jobs executed by the cluster. The default is 0 for limitless.
 OPTION_ARG_LONG(pull-threshold,bytes)Sets the threshold for pull transfers. The default is 128MB.
 OPTION_ARG_LONG(replication,type)Sets the replication mode for satisfying job dependencies. BOLD(type) may be BOLD(push-sync) or BOLD(push-async-N). The default is BOLD(push-async-1).
-OPTION_ARG_LONG(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. The default is BOLD(fifo-0).
+OPTION_ARG_LONG(replication-bytes,bytes)Limits the bytes in flight to or from each storage node when restoring the minimum replicas of files. The default is 0 for limitless.
+OPTION_ARG_LONG(replication-slots,limit)Limits the number of concurrent transfers to or from each storage node when restoring the minimum replicas of files. Files needed by more waiting jobs are replicated first. The default is 2.
+OPTION_ARG_LONG(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. BOLD(type) may be BOLD(fifo-N), which schedules at most N jobs at a time on storage nodes holding the most input bytes, or BOLD(locality-N), which queues up to N jobs on each storage node and places each job where the fewest input bytes must be pulled, given the transfers and jobs already bound for the node. The default is BOLD(fifo-0).
 OPTION_ARG_LONG(tickets,tickets)Sets tickets to use for authenticating with storage nodes. Paths must be absolute.
 OPTIONS_END
 
@@ -0,0 +1,41 @@
+include(manual.h)dnl
+HEADER(deltadb_compact_log)
+
+SECTION(NAME)
+BOLD(deltadb_compact_log) - convert the logs of a deltadb directory into compressed archives.
+
+SECTION(SYNOPSIS)
+CODE(deltadb_compact_log [options] [source_directory])
+
+SECTION(DESCRIPTION)
+
+BOLD(deltadb_compact_log) converts the log of each day before today in a database directory
+written by the catalog server into a compressed, columnar archive, named YEAR/DAY.arc.
+The record types, keys, times, and the values of each field are stored as separate compressed streams,
+with strings stored once and numbers stored as differences from the value before.
+BOLD(deltadb_query) plays an archive in place of the log of the same day.
+
+Each archive is checked by playing it back before it is kept.
+Days that already have an archive are left alone, so the tool may be run periodically.
+
+SECTION(ARGUMENTS)
+OPTIONS_BEGIN
+OPTION_FLAG_LONG(--remove) Remove the text log of each archived day, along with its index and the checkpoints within the day.  The checkpoint at the start of the day is kept.
+OPTION_FLAG_LONG(--version) Show software version.
+OPTION_FLAG_LONG(--help) Show this help text.
+OPTIONS_END
+
+SECTION(EXAMPLES)
+
+LONGCODE_BEGIN
+% deltadb_compact_log --remove /data/catalog.history
+LONGCODE_END
+
+SECTION(COPYRIGHT)
+
+COPYRIGHT_BOILERPLATE
+
+SECTION(SEE ALSO)
+SEE_ALSO_CATALOG
+
+FOOTER
@@ -27,6 +27,7 @@ OPTION_ARG_LONG(--from, time) (required) The starting date and time of the query
 OPTION_ARG_LONG(--to, time) The ending time of the query, in the same format as the --from option.  If omitted, the current time is assumed.
 OPTION_ARG_LONG(--every, interval) The intervals at which output should be produced, like 5s, 5m, 5h, 5d to indicate five seconds, minutes, hours, or days ago, respectively.
 OPTION_FLAG_LONG(--epoch), Causes the output to be expressed in integer Unix epoch time, instead of a formatted time.
+OPTION_ARG_LONG(--parallel, n) Play up to n days of a database at once, each in its own process, starting from the checkpoint of each day.  The output is the same as that of a single process, unless the log has gaps longer than the --every interval.  Raw streams are always played by a single process.
 OPTION_ARG_LONG(--filter, expr) (multiple) If given, only records matching this expression will be processed.  Use --filter to apply expressions that do not change over time, such as the name or type of a record.
 OPTION_ARG_LONG(--where, expr)  (multiple) If given, only records matching this expression will be displayed.  Use --where to apply expressions that may change over time, such as load average or storage space consumed.
 OPTION_ARG_LONG(--output, expr) (multiple) Display this expression on the output.
@@ -123,6 +124,12 @@ LONGCODE_BEGIN
 % deltadb_query --file wq.data --output 'COUNT(name)' --output 'SUM(tasks_running)' -- output 'SUM(cores_inuse)'
 LONGCODE_END
 
+The logs of days that are over can be converted into compressed archives with BOLD(deltadb_compact_log), which are played in place of the logs.  Queries that display only some fields, without TIME_ or GLOBAL reductions, skip the updates to every other field when reading an archive:
+
+LONGCODE_BEGIN
+% deltadb_compact_log --remove /data/catalog.history
+LONGCODE_END
+
 SECTION(COPYRIGHT)
 
 COPYRIGHT_BOILERPLATE
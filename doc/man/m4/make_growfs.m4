@@ -28,9 +28,15 @@ OPTION_FLAG_SHORT(k)Disable checksums for files.
 OPTION_FLAG_SHORT(f)Follow all symbolic links.
 OPTION_FLAG_SHORT(F)Do not follow any symbolic links.
 OPTION_FLAG_SHORT(a)Only follow links that fall outside the root.  (default)
+OPTION_FLAG_SHORT(b)Write the directory listing as a binary image with a hash index of all paths, which clients map into memory instead of parsing. This is much faster for trees of millions of files, but requires clients that understand the image format.
 OPTION_FLAG_SHORT(h)Show help text.
 OPTIONS_END
 
+The companion tool BOLD(grow_image) converts between the two formats.
+CODE(grow_image -t PARAM(image)) prints an image as a text listing, and
+CODE(grow_image -d PARAM(old) PARAM(new)) prints the paths added, removed,
+or modified between two versions of a listing or image.
+
 SECTION(EXIT STATUS)
 On success, returns zero.  On failure, returns non-zero.
 
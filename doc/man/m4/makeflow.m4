@@ -48,16 +48,22 @@ OPTIONS_END
 SUBSECTION(Workflow Handling)
 OPTIONS_BEGIN
 OPTION_FLAG(a,advertise)Advertise the manager information to a catalog server.
-OPTION_ARG(l, makeflow-log, logfile)Use this file for the makeflow log. (default is X.makeflowlog)
+OPTION_ARG(l, makeflow-log, logfile)Use this file for the makeflow log. (default is X.makeflowlog) A snapshot of the recovered state is kept beside it in X.makeflowlog.snapshot, so that a restart only reads the end of a long log.
 OPTION_ARG(L, batch-log, logfile)Use this file for the batch system log. (default is X.PARAM(type)log)
+OPTION_ARG_LONG(log-group-commit, ms)Collect makeflow log records in memory and write and sync them together, at most every PARAM(ms) milliseconds, instead of writing each one as it happens. A completed job is always synced before any job that depends on it is submitted. Useful when the log is on a slow shared filesystem.
+OPTION_ARG_LONG(log-group-records, #)With BOLD(--log-group-commit), also sync after this many records. (default is 1000)
+OPTION_ARG_LONG(engine-stats, file)Write to PARAM(file) a JSON object with the time spent by makeflow itself in each phase: parsing the workflow, computing the ancestors of each rule, recovering the log, and the wall and cpu time of the run, with the number of log records and bytes written. With BOLD(-T dryrun), which assumes that every job creates its outputs, this measures the overhead of makeflow on large workflows. See makeflow/benchmark/engine_bench.sh.
 OPTION_ARG(m, email, email)Email summary of workflow to address.
 OPTION_ARG(j, max-local, #)Max number of local jobs to run at once. (default is # of cores)
 OPTION_ARG(J, max-remote, #)Max number of remote jobs to run at once. (default is 1000 for -Twq, 100 otherwise)
+OPTION_ARG_LONG(cluster-size, #)Run up to this many small remote jobs together in one batch job, to avoid the overhead of the batch system for each one. Only jobs with the same category, resources, environment, and batch options are clustered. The members of a cluster run one after the other, and each one still succeeds or fails on its own. (default is 1, no clustering)
+OPTION_ARG_LONG(node-priority, mode)Order in which ready jobs are submitted, also passed as the task priority to TaskVine and Work Queue. BOLD(depth) submits jobs with fewer ancestors first (default). BOLD(critical-path) submits first the jobs with the longest expected runtime to the end of the workflow, using runtimes from a previous run in the log or the requested wall time. BOLD(fan-out) submits first the jobs with the most immediate descendants. BOLD(free-disk) submits first the jobs whose inputs the garbage collector can delete afterwards.
 OPTION_FLAG(R,retry)Automatically retry failed batch jobs up to 100 times.
 OPTION_ARG(r, retry-count, n)Automatically retry failed batch jobs up to n times.
 OPTION_ARG_LONG(local-cores, #)Max number of cores used for local execution.
 OPTION_ARG_LONG(local-memory, #)Max amount of memory used for local execution.
 OPTION_ARG_LONG(local-disk, #)Max amount of disk used for local execution.
+OPTION_FLAG_LONG(local-cpu-affinity)Bind each local job that requests cores to that many cpus of its own, preferably on a single NUMA node.
 
 OPTION_END
 
@@ -67,6 +73,7 @@ OPTION_ARG(B, batch-options, options)Add these options to all batch submit files
 OPTION_FLAG_LONG(send-environment)Send all local environment variables in remote execution.
 OPTION_ARG_LONG(wait-for-files-upto, #)Wait for output files to be created upto this many seconds (e.g., to deal with NFS semantics).
 OPTION_ARG(S, submission-timeout, timeout)Time to retry failed batch job submission. (default is 3600s)
+OPTION_FLAG_LONG(async-submit)Submit remote jobs in the background, so that a slow batch system does not hold up local jobs and the handling of completed jobs.
 OPTION_ARG(T, batch-type, type)Batch system type: local, dryrun, condor, wq, vine, uge, pbs, torque, slurm, moab, cluster, amazon. (default is local)
 OPTION_FLAG_LONG(safe-submit-mode)Excludes resources at submission. (SLURM, TORQUE, and PBS)
 OPTION_FLAG_LONG(ignore-memory-spec)Excludes memory at submission. (SLURM)
@@ -83,6 +90,7 @@ OPTION_FLAG_LONG(json)Interpret PARAM(dagfile) as a JSON format Makeflow.
 OPTION_FLAG_LONG(jx)Evaluate JX expressions in PARAM(dagfile). Implies --json.
 OPTION_ARG_LONG(jx-args, args)Read variable definitions from the JX file PARAM(args).
 OPTION_ARG_LONG(jx-define, VAL=EXPR)Set the variable PARAM(VAL) to the JX expression PARAM(EXPR).
+OPTION_ARG_LONG(jx-lazy-rules, #)Expand the rules of a JX workflow that are written as list comprehensions on demand, keeping about # jobs waiting or running, instead of building the whole workflow in memory before starting. Complete jobs are released from memory as the workflow runs. A rule expanded on demand must not create a file needed by a rule that comes before it in the workflow. Garbage collection waits until every rule is expanded, and no snapshot of the log is written.
 OPTION_ARG_LONG(jx-context, ctx)Deprecated. See '--jx-args'.
 OPTIONS_END
 
@@ -155,17 +163,19 @@ OPTIONS_END
 SUBSECTION(Kubernetes Options)
 OPTIONS_BEGIN
 OPTION_ARG_LONG(k8s-image, docker_image) Indicate the Docker image for running pods on Kubernetes cluster. 
+OPTION_ARG_LONG(k8s-api, url) Create, watch, and delete pods through the Kubernetes API at PARAM(url), such as http://127.0.0.1:8001 for a local kubectl proxy, instead of running kubectl for each pod. Use PARAM(in-cluster) when running inside a pod, with its service account; the server must present a certificate of the cluster authority. Tasks are still run inside their pods with kubectl.
 OPTIONS_END
 
 SUBSECTION(Mountfile Support)
 OPTIONS_BEGIN
+OPTION_ARG_LONG(dag-cache, file)Keep the parsed workflow in a binary cache (default is X.dagcache), and load it instead of parsing the workflow again while the workflow, its arguments, and the environment are unchanged. The cache is removed by BOLD(--clean=all).
 OPTION_ARG_LONG(mounts, mountfile)Use this file as a mountlist. Every line of a mountfile can be used to specify the source and target of each input dependency in the format of BOLD(target source) (Note there should be a space between target and source.).
 OPTION_ARG_LONG(cache, cache_dir)Use this dir as the cache for file dependencies.
 OPTIONS_END
 
 SUBSECTION(Archiving Options)
 OPTIONS_BEGIN
-OPTION_ARG_LONG(archive)Archive results of workflow at the specified path (by default /tmp/makeflow.archive.$UID) and use outputs of any archived jobs instead of re-executing job
+OPTION_ARG_LONG(archive)Archive results of workflow at the specified path (by default /tmp/makeflow.archive.$UID) and use outputs of any archived jobs instead of re-executing job. Archived jobs are listed in the file tasks/index of the archive, and their outputs are restored as reflinks or hard links when the filesystem allows.
 OPTION_ARG_LONG(archive-dir,path)Specify archive base directory.
 OPTION_ARG_LONG(archive-read,path)Only check to see if jobs have been cached and use outputs if it has been
 OPTION_ARG_LONG(archive-s3,s3_bucket)Base S3 Bucket name
@@ -189,6 +199,7 @@ OPTION_FLAG(A,disable-afs-check)Disable the check for AFS. (experts only)
 OPTION_FLAG(z,zero-length-error)Force failure on zero-length output files.
 OPTION_ARG(g, gc, type)Enable garbage collection. (ref_cnt|on_demand|all)
 OPTION_ARG_LONG(gc-size, int)Set disk size to trigger GC. (on_demand only)
+OPTION_ARG_LONG(gc-order, order)Collect the largest files first (size, default), or the files no longer needed for the longest time first (lru). When collecting for disk space, collection stops once the disk is above the size given.
 OPTION_ARG(G, gc-count, int)Set number of files to trigger GC. (ref_cnt only)
 OPTION_ARG_LONG(wrapper,script) Wrap all commands with this BOLD(script). Each rule's original recipe is appended to BOLD(script) or replaces the first occurrence of BOLD({}) in BOLD(script).
 OPTION_ARG_LONG(wrapper-input,file) Wrapper command requires this input file. This option may be specified more than once, defining an array of inputs. Additionally, each job executing a recipe has a unique integer identifier that replaces occurrences BOLD(%%) in BOLD(file).
@@ -16,6 +16,8 @@ OPTION_ARG(a, add, path)The path of an existing package.
 OPTION_ARG(e, env-list, path)The path of the environment variables.
 OPTION_ARG_LONG(new-env, path)The relative path of the environment variable file under the package.
 OPTION_ARG(n, name-list, path)The path of the namelist list.
+OPTION_ARG(j, jobs, n)Copy the contents of files into the package with this many processes. (default 1) The tree and its metadata are created first, and the copies follow. Where the filesystem supports it, files are cloned rather than copied. A file with several hard links is copied once and linked in the package.
+OPTION_FLAG_LONG(hardlink)Hard link files into the package instead of copying them, when the package is on the same filesystem. The package then shares the files with the host, and changing one changes the other.
 OPTION_ARG(p, package-path, path)The path of the package.
 OPTION_ARG(d, debug, flag)Enable debugging for this sub-system.
 OPTION_ARG(o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
@@ -19,6 +19,7 @@ OPTIONS_BEGIN
 OPTION_ARG_LONG(check-driver,driver) Check for the presence of a given driver (e.g. http, ftp, etc) and return success if it is currently enabled.
 OPTION_ARG(a,chirp-auth,unix|hostname|ticket|globus|kerberos)Use this Chirp authentication method.  May be invoked multiple times to indicate a preferred list, in order.
 OPTION_ARG(b,block-size,bytes)Set the I/O block size hint.
+OPTION_ARG_LONG(cache-size,bytes)Limit the file cache in the temporary directory to this size (e.g. 10G). The least recently used entries are removed once it is exceeded. The cache is shared by all Parrots of the same user with the same temporary directory.
 OPTION_ARG(c,status-file,file)Print exit status information to file.
 OPTION_FLAG(C,channel-auth)Enable data channel authentication in GridFTP.
 OPTION_ARG(d,debug,flag)Enable debugging for this sub-system.
@@ -36,6 +37,8 @@ OPTION_FLAG(k,no-checksums)Do not checksum files.
 OPTION_ARG(l,ld-path,path)Path to ld.so to use.
 OPTION_ARG(m,ftab-file,file)Use this file as a mountlist.
 OPTION_ARG(M,mount,/foo=/bar)Mount (redirect) /foo to /bar.
+OPTION_ARG_LONG(ftp-streams,n)Get files from FTP servers over this many connections at once, each fetching a different part of the file, and resume a part that fails where it stopped. Files smaller than 2MB are fetched over one connection as usual. The default is one, since many servers limit the connections from one client.
+OPTION_ARG_LONG(metadata-ttl,secs)Reuse the results of stat and lstat on remote paths, including paths that do not exist, and FTP directory listings, for this many seconds. Entries are dropped when Parrot changes the path. By default this is 60 seconds for read-only services (cvmfs and http) and disabled for all others.
 OPTION_ARG(e,env-list,path)Record the environment variables.
 OPTION_ARG(n,name-list,path)Record all the file names.
 OPTION_FLAG_LONG(no-set-foreground)Disable changing the foreground process group of the session.
@@ -46,6 +49,7 @@ OPTION_ARG(p,proxy,host:port)Use this proxy server for HTTP requests.
 OPTION_FLAG(Q,no-chirp-catalog)Inhibit catalog queries to list /chirp.
 OPTION_ARG(r,cvmfs-repos,repos)CVMFS repositories to enable (PARROT_CVMFS_REPO).
 OPTION_FLAG_LONG(cvmfs-repo-switching) Allow repository switching with CVMFS.
+OPTION_ARG_LONG(cvmfs-prefetch,paths)Comma-separated list of CVMFS subtrees, such as /cvmfs/cms.cern.ch/slc7_amd64_gcc700, whose nested catalogs are loaded in parallel in the background once CVMFS is first accessed (PARROT_CVMFS_PREFETCH). Catalogs are kept in the CVMFS cache directory, shared with later runs on the same node.
 OPTION_ARG(R,root-checksum,cksum)Enforce this root filesystem checksum, where available.
 OPTION_FLAG(s,stream-no-cache)Use streaming protocols without caching.
 OPTION_FLAG(S,session-caching)Enable whole session caching for all protocols.
@@ -64,7 +68,10 @@ OPTION_FLAG_LONG(is-running)Test is Parrot is already running.
 OPTION_ARG(w,work-dir, dir)Initial working directory.
 OPTION_FLAG(W,syscall-table)Display table of system calls trapped.
 OPTION_FLAG(Y,sync-write)Force synchronous disk writes.
+OPTION_ARG_LONG(write-buffer,[service:]bytes)Gather consecutive writes to files of remote services into a buffer of this size (e.g. 4M) and send them as one write when it fills, or before the file is read, synced, or closed. Errors from buffered writes are reported by the call that sends them. With a service prefix (e.g. chirp:4M) the size applies to that service only; the option may be given more than once. Off by default.
 OPTION_FLAG(Z,auto-decompress)Enable automatic decompression on .gz files.
+OPTION_FLAG_LONG(seccomp)Install a seccomp filter in the traced program so that Parrot is only stopped for system calls it may need to virtualize, such as those taking a path or a file descriptor. Calls like futex, brk, sched_yield and anonymous mmap then run at native speed, and are not counted by -W. Requires Linux 4.8 or later on x86_64; otherwise every system call is traced as usual.
+OPTION_ARG_LONG(stats-file,file)Save runtime statistics to this file as JSON when Parrot exits. Under parrot.profile it reports the wall time, the time Parrot spent handling system calls (including the time spent in services), a count and handling time for each system call, the opens, reads, writes and bytes moved by each service, and the hits and misses of the file, directory, and metadata caches. A snapshot can be taken while running with CODE(parrot_debug --stats) CODE(file).
 OPTION_ARG_LONG(disable-service,service) Disable a compiled-in service (e.g. http, cvmfs, etc.)
 OPTIONS_END
 
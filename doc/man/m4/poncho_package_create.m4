@@ -54,12 +54,15 @@ BOLD(poncho_package_create) is a simple command-line utility that creates a loca
 The command creates an environment tarball at output-path that can be sent to and run on different machines with the same architecture.
 
 The CODE(dependency-file) argument is the path (relative or absolute) to the a JSON specification file. The CODE(output-path) argument specifies the path for the environment tarball that is created
-(should usually end in .tar.gz).
+(should usually end in .tar.gz). The format of the tarball follows this extension, so that, e.g., .tar.zst
+produces a tarball that is faster to unpack.
 
 SECTION(OPTIONS)
 OPTIONS_BEGIN
 OPTION_ARG_LONG(conda-executable, path) Location of conda executable to use. If not given, mamba, $CONDA_EXE, conda, and microconda are tried, in that order.
 OPTION_FLAG_LONG(no-microconda) Do not try to download microconda if a conda executable is not found.
+OPTION_ARG_LONG(threads, n) Number of threads used to compress the tarball. Default is -1, for all cores.
+OPTION_FLAG_LONG(directory) Write the environment unpacked into the output directory rather than as a tarball. TaskVine workers use such a directory without extracting it.
 OPTION_FLAG(h, help)               Show the help message.
 OPTIONS_END
 SECTION(EXIT STATUS)
@@ -100,14 +100,18 @@ OPTION_ARG(o,debug-file,file)Write debugging output to this file. By default, de
 OPTION_FLAG(v,version)Show version string.
 OPTION_FLAG(h,help)Show help text.
 OPTION_ARG(i,interval,n)Maximum interval between observations, in seconds (default=1).
+OPTION_ARG_LONG(min-interval,n)Adapt the interval between observations. Observations are taken as often as every CODE(n) seconds (which may be fractional) while resources change quickly or are close to their limits, and the interval doubles, up to the one given by --interval, while usage is stable. With --cgroup and a memory limit, the monitor is also woken by the kernel when memory reaches the limit.
 OPTION_ARG_LONG(pid,pid)Track pid instead of executing a command line (warning: less precise measurements).
 OPTION_FLAG_LONG(accurate-short-processes)Accurately measure short running processes (adds overhead).
 OPTION_ARG(c,sh,str)Read command line from CODE(str), and execute as '/bin/sh -c CODE(str)'.
+OPTION_FLAG_LONG(cgroup)Place the command in a cgroup v2 of its own, and measure cpu time, resident memory, and swap from the cgroup accounting instead of polling /proc. Processes that exit between observations are accounted for, and the expensive reading of /proc/pid/smaps is skipped when the memory controller is available. Requires a writable (delegated) cgroup; otherwise measurements fall back to /proc.
+OPTION_FLAG_LONG(detailed-maps)Measure memory by reading every map of /proc/pid/smaps, merging the maps shared by the processes of the tree. By default, memory is read from the totals of /proc/pid/smaps_rollup using the proportional set size, which is much cheaper for processes with many maps.
 OPTION_ARG(l,limits-file,file)Use maxfile with list of var: value pairs for resource limits.
 OPTION_ARG(L,limits,string)String of the form `"var: value, var: value"' to specify resource limits. (Could be specified multiple times.)
 OPTION_FLAG(f,child-in-foreground)Keep the monitored process in foreground (for interactive use).
 OPTION_ARG(-O,with-output-files,template)Specify CODE(template) for log files (default=CODE(resource-pid)).
 OPTION_FLAG_LONG(with-time-series)Write resource time series to CODE(template.series).
+OPTION_ARG_LONG(series-format,fmt)Format of the time series, either CODE(text) (default) or CODE(binary). The binary format stores the difference between consecutive samples in a few bytes, and can be converted to text with CODE(rmonitor_series_convert template.series).
 OPTION_FLAG_LONG(with-inotify)Write inotify statistics of opened files to default=CODE(template.files).
 OPTION_ARG(V,verbatim-to-summary,str)Include this string verbatim in a line in the summary. (Could be specified multiple times.)
 OPTION_ARG_LONG(measure-dir,dir)Follow the size of dir. By default the directory at the start of execution is followed. Can be specified multiple times. See --without-disk-footprint below.
@@ -39,6 +39,15 @@ transfer times currently observed at the manager.  With the -c option on,
 BOLD(vine_factory) will consider the manager's capacity to be the maximum
 number of workers to run.
 PARA
+If given the --predictive option, then BOLD(vine_factory) sizes the pool
+for the tasks it expects when newly submitted workers connect, rather than
+for the tasks present now.  It follows the time workers take to connect after
+submission, the rate at which tasks arrive at each manager, and the rate at
+which the tasks of each category complete.  A decrease of the target is only
+followed once it has lasted for twice that horizon, so that a short pause
+between bursts does not let the pool drain.  The number of workers submitted
+per cycle is still limited by --workers-per-cycle.
+PARA
 If BOLD(vine_factory) receives a terminating signal, it will attempt to
 remove all running workers before exiting.
 
@@ -55,6 +64,7 @@ OPTION_ARG_LONG(catalog,host:port) Catalog server to query for managers.
 OPTION_ARG(P,password,pwdfile) Password file for workers to authenticate.
 OPTION_ARG(S,scratch-dir,dir) Use this scratch dir for factory. Default is /tmp/wq-factory-$UID. 
 Also configurable through environment variables BOLD(CCTOOLS_TEMP) or BOLD(TMPDIR)
+OPTION_ARG_LONG(stage-dir,dir) Share a node-local PARAM(dir) among the workers on each host. Poncho environments are unpacked there once per host, and files cached forever by one worker are linked into the cache of the next, so that they are not sent again by the manager.
 OPTION_FLAG_LONG(run-factory-as-manager) Force factory to run itself as a manager.
 OPTION_FLAG_LONG(parent-death) Exit if parent process dies.
 OPTION_ARG(d,debug,subsystem) Enable debugging for this subsystem.
@@ -76,6 +86,7 @@ OPTION_ARG(t,timeout,time) Workers abort after idle time (default=300).
 OPTION_ARG_LONG(factory-timeout,n) Exit after no manager seen in PARAM(n) seconds.
 OPTION_ARG_LONG(tasks-per-worker,n) Average tasks per worker (default=one per core).
 OPTION_ARG(c,capacity,cap) Use worker capacity reported by managers.
+OPTION_FLAG_LONG(predictive) Submit workers ahead of the expected demand.
 OPTIONS_END
 
 Resource management options:
@@ -50,6 +50,7 @@ OPTION_ARG_LONG(debug-max-rotate, bytes)Set the maximum file size of the debug l
 OPTION_FLAG_LONG(debug-release-reset)Debug file will be closed, renamed, and a new one opened after being released from a manager.
 OPTION_ARG(P, password, pwfile)Password file for authenticating to the manager.
 OPTION_ARG(t, timeout, time)Abort after this amount of idle time. (default=900s)
+OPTION_ARG_LONG(lend-interval, time)When serving a project name given by -M, after this time without work, look in the catalog for a matching manager with tasks waiting, and ask the current manager to lend the worker to it. The manager releases the worker if it has no tasks waiting and holds no files only present at this worker. The cache of the worker is kept while it is lent. (default=off)
 OPTION_FLAG_LONG(parent-death)Exit if parent process dies.
 OPTION_ARG(w, tcp-window-size, size)Set TCP window size.
 OPTION_ARG(i, min-backoff, time)Set initial value for backoff interval when worker fails to connect to a manager. (default=1s)
@@ -60,13 +61,26 @@ OPTION_ARG_LONG(workspace, path) Set the workspace directory where the worker ke
 OPTION_LONG(keep-workspace) Do not delete the contents of the workspace on worker exit.  This permits the worker to restart at a later time and recover the contents of its cache directory.
 OPTION_ARG_LONG(cores, n)Set the number of cores this worker should use.  Set it to 0 to have the worker use all of the available resources. (default=1)
 OPTION_ARG_LONG(gpus, n)Set the number of GPUs this worker should use. If less than 0 or not given, try to detect gpus available.
+OPTION_ARG_LONG(gpu-slots, n)Divide each GPU into this many slots, reported to the manager as GPUs, so that several tasks share a device. A task is limited to its share of the device by CUDA_MPS_ACTIVE_THREAD_PERCENTAGE when NVIDIA MPS is running. MIG partitions are detected and used as GPUs when --gpus is not given. (default=1)
 OPTION_ARG_LONG(memory, mb)Manually set the amount of memory (in MB) reported by this worker.
 OPTION_ARG_LONG(disk, mb)Manually set the amount of disk space (in MB) reported by this worker.
+OPTION_ARG_LONG(disk-verify-interval, secs)The disk used by the cache is accounted as files come and go, and the growth of task sandboxes is bounded by the growth of the filesystem. Walk the cache directory and the sandboxes of tasks with a disk limit to verify these at least this often. Use 0 to walk them at every check of resources. (default=300)
+OPTION_ARG_LONG(cache-eviction, policy)Evict cached files that no task needs to keep the cache within the disk of the worker: none, lru (least recently used first), lfu (least frequently used first), or gdsf (rarely used, large, and quick to obtain again first). (default=none)
+OPTION_ARG_LONG(cache-high-watermark, percent)Start evicting cached files when the cache and the disk allocated to tasks exceed this percent of the worker disk. (default=90)
+OPTION_ARG_LONG(cache-low-watermark, percent)Stop evicting cached files when below this percent of the worker disk. (default=80)
+OPTION_ARG_LONG(stagein-mode, mode)Place cached inputs into task sandboxes by: link (hard link each file), clone (copy-on-write clone of each file on filesystems with reflinks such as Btrfs and XFS, otherwise a hard link), or symlink (one symbolic link per input, even a large directory). (default=link)
+OPTION_ARG_LONG(prefetch-tasks, n)Start fetching the inputs of this many waiting tasks, in order of arrival, before they have the resources to run. Use -1 for all waiting tasks. (default=-1)
+OPTION_ARG_LONG(task-launch, method)Start task processes with fork, or with posix_spawn, which avoids copying the page tables of a large worker for each task. (default=fork)
+OPTION_ARG_LONG(core-affinity, policy)Bind each task to as many cpus of its own as the cores it asks for, preferring the memory of their NUMA node, and give them to OpenMP in OMP_PLACES. With compact, a task is placed in the fullest node with room for it, keeping other nodes whole for larger tasks. With spread, it is placed in the emptiest node, so that tasks share memory bandwidth with fewer others. Tasks bound to cpus are always started with fork. (default=none)
+OPTION_ARG_LONG(url-streams, n)Fetch a url input of known size larger than two parts as this many byte ranges at once, which can be faster for a distant server. Use 1 to fetch each url as a single stream. (default=4)
+OPTION_ARG_LONG(url-part-size, mb)Size of each byte range of a url fetched in parallel, in MB. (default=64)
 OPTION_ARG_LONG(wall-time, s)Set the maximum number of seconds the worker may be active.
 OPTION_ARG_LONG(feature, feature)Specifies a user-defined feature the worker provides (option can be repeated).
 OPTION_ARG_LONG(volatility, chance)Set the percent chance per minute that the worker will shut down (simulates worker failures, for testing only).
 OPTION_ARG_LONG(connection-mode, mode)When using -M, override manager preference to resolve its address. One of by_ip, by_hostname, or by_apparent_ip. Default is set by manager.
 OPTION_ARG_LONG(transfer-port,port) Listening port for worker-worker transfers.  (default: any))
+OPTION_ARG_LONG(metrics-port,port) Serve the statistics of the worker and its cache in the OpenMetrics format at http://host:port/metrics.  (default: disabled)
+OPTION_ARG_LONG(trace-file,file) Write the steps of each task (receive, wait for inputs and resources, stagein, start, execute, stageout, report) and the transfers into the cache to this file in the Chrome trace format. Use vine_trace_merge to combine it with the transactions log of the manager.
 OPTION_ARG_LONG(contact-hostport,hostport) Explicit contact host:port for worker-worker transfers, e.g., when routing is used. (default: :<transfer_port>)
 
 OPTION_FLAG_LONG(ssl)Enable tls connection to manager (manager should support it).
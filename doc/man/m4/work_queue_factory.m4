@@ -55,6 +55,7 @@ OPTION_ARG_LONG(catalog,host:port) Catalog server to query for managers.
 OPTION_ARG(P,password,pwdfile) Password file for workers to authenticate.
 OPTION_ARG(S,scratch-dir,dir) Use this scratch dir for factory. Default is /tmp/wq-factory-$UID. 
 Also configurable through environment variables BOLD(CCTOOLS_TEMP) or BOLD(TMPDIR)
+OPTION_ARG_LONG(stage-dir,dir) Share a node-local PARAM(dir) among the workers on each host, so that poncho environments are unpacked there once per host.
 OPTION_FLAG_LONG(run-factory-as-manager) Force factory to run itself as a manager.
 OPTION_FLAG_LONG(parent-death) Exit if parent process dies.
 OPTION_ARG(d,debug,subsystem) Enable debugging for this subsystem.
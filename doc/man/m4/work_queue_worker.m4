@@ -69,6 +69,10 @@ OPTION_ARG_LONG(memory, mb)Manually set the amount of memory (in MB) reported by
 OPTION_ARG_LONG(disk, mb)Manually set the amount of disk space (in MB) reported by this worker.
 OPTION_ARG_LONG(wall-time, s)Set the maximum number of seconds the worker may be active.
 OPTION_ARG_LONG(feature, feature)Specifies a user-defined feature the worker provides (option can be repeated).
+OPTION_ARG_LONG(max-fetches, n)Set the maximum number of url transfers and commands run at once to fill the cache. (default=8)
+OPTION_ARG_LONG(max-fetches-per-source, n)Set the maximum number of those that may come from the same server. (default=4)
+OPTION_ARG_LONG(cache-limit, mb)Evict the least recently used files not needed by any task when the cache exceeds this size in MB. The manager is told of each eviction. (default=unlimited)
+OPTION_ARG_LONG(cache-dir, dir)Keep the cache in this directory, with an index of its files, when the worker exits. A worker restarted with the same directory advertises those files to the manager, which does not send them again if their sizes match. The directory may be used by only one worker at a time.
 OPTION_ARG_LONG(volatility, chance)Set the percent chance per minute that the worker will shut down (simulates worker failures, for testing only).
 OPTION_ARG_LONG(connection-mode, mode)When using -M, override manager preference to resolve its address. One of by_ip, by_hostname, or by_apparent_ip. Default is set by manager.
 OPTIONS_END
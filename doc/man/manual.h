@@ -51,6 +51,6 @@ LIST_END')dnl
 define(SEE_ALSO_CATALOG,
 `LIST_BEGIN
 LIST_ITEM(MANUAL(Cooperative Computing Tools Documentation,"../index.html"))
-LIST_ITEM(MANPAGE(catalog_server,1)  MANPAGE(catalog_update,1)  MANPAGE(catalog_query,1)  MANPAGE(chirp_status,1)  MANPAGE(work_queue_status,1)   MANPAGE(deltadb_query,1))
+LIST_ITEM(MANPAGE(catalog_server,1)  MANPAGE(catalog_update,1)  MANPAGE(catalog_query,1)  MANPAGE(catalog_relay,1)  MANPAGE(chirp_status,1)  MANPAGE(work_queue_status,1)   MANPAGE(deltadb_query,1)  MANPAGE(deltadb_compact_log,1))
 LIST_END')dnl
 dnl
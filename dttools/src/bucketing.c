@@ -5,79 +5,76 @@
 #include "random.h"
 #include "xxmalloc.h"
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /** Begin: internals **/
 
-/* Create a bucketing point
+/* Insert a point into the sorted array of points in O(log(n)) comparisons,
+ * before the points with the same value
+ * @param s the relevant bucketing state
  * @param val value of point
- * @param sig significance of point
- * @return pointer to created point
- * @return NULL if failure */
-static bucketing_point_t *bucketing_point_create(double val, double sig)
+ * @param sig significance of point */
+static void bucketing_insert_point(bucketing_state_t *s, double val, double sig)
 {
-	bucketing_point_t *p = xxmalloc(sizeof(*p));
+	int lo = 0;
+	int hi = s->num_sorted_points;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (s->sorted_points[mid].val < val) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
 
-	p->val = val;
-	p->sig = sig;
+	if (s->num_sorted_points == s->sorted_points_capacity) {
+		s->sorted_points_capacity = s->sorted_points_capacity ? 2 * s->sorted_points_capacity : 64;
+		s->sorted_points = xxrealloc(s->sorted_points, s->sorted_points_capacity * sizeof(*s->sorted_points));
+		s->sig_prefix = xxrealloc(s->sig_prefix, (s->sorted_points_capacity + 1) * sizeof(*s->sig_prefix));
+		s->val_sig_prefix = xxrealloc(s->val_sig_prefix, (s->sorted_points_capacity + 1) * sizeof(*s->val_sig_prefix));
+	}
 
-	return p;
-}
+	memmove(&s->sorted_points[lo + 1], &s->sorted_points[lo], (s->num_sorted_points - lo) * sizeof(*s->sorted_points));
+	s->sorted_points[lo].val = val;
+	s->sorted_points[lo].sig = sig;
+	++s->num_sorted_points;
 
-/* Delete a bucketing point
- * @param p the bucketing point to be deleted */
-static void bucketing_point_delete(bucketing_point_t *p)
-{
-	free(p);
+	if (lo < s->num_prefix_points)
+		s->num_prefix_points = lo;
 }
 
-/* Insert a bucketing point into a sorted list of points in O(log(n))
- * @param l pointer to sorted list of points
- * @param p pointer to point */
-static void bucketing_insert_point_to_sorted_list(struct list *l, bucketing_point_t *p)
+/* Remove a point chosen at random from the sorted array of points
+ * @param s the relevant bucketing state */
+static void bucketing_remove_random_point(bucketing_state_t *s)
 {
-	struct list_cursor *lc = list_cursor_create(l);
-	if (!lc) {
-		fatal("Cannot create list cursor\n");
-		return;
-	}
-
-	/* If list is empty, append new point to list */
-	if (list_length(l) == 0) {
-		list_insert(lc, p);
-		list_cursor_destroy(lc);
-		return;
-	}
+	int i = (uint64_t)random_int64() % s->num_sorted_points;
 
-	/* Linear insert a data point */
-	if (!list_seek(lc, 0)) {
-		fatal("Cannot seek list to index 0\n");
-		return;
-	}
+	memmove(&s->sorted_points[i], &s->sorted_points[i + 1], (s->num_sorted_points - i - 1) * sizeof(*s->sorted_points));
+	--s->num_sorted_points;
 
-	bucketing_point_t *bpp = 0;
-	int inserted = 0;
-	do {
-		if (!list_get(lc, (void **)&bpp)) {
-			fatal("Cannot get element from list.\n");
-			return;
-		}
+	if (i < s->num_prefix_points)
+		s->num_prefix_points = i;
+}
 
-		if (bpp->val >= p->val) {
-			list_insert(lc, p);
-			inserted = 1;
-			break;
-		}
-	} while (list_next(lc));
+/* Bring the prefix sums up to date from the lowest point changed since
+ * they were last computed
+ * @param s the relevant bucketing state */
+static void bucketing_update_prefix_sums(bucketing_state_t *s)
+{
+	s->sig_prefix[0] = 0;
+	s->val_sig_prefix[0] = 0;
 
-	/* Append point if it isn't inserted */
-	if (inserted == 0) {
-		list_insert(lc, p);
+	for (int i = s->num_prefix_points; i < s->num_sorted_points; ++i) {
+		bucketing_point_t *p = &s->sorted_points[i];
+		s->sig_prefix[i + 1] = s->sig_prefix[i] + p->sig;
+		s->val_sig_prefix[i + 1] = s->val_sig_prefix[i] + p->val * p->sig;
 	}
 
-	list_cursor_destroy(lc);
+	s->num_prefix_points = s->num_sorted_points;
 }
 
 static void generate_next_task_sig(bucketing_state_t *s)
@@ -98,6 +95,8 @@ static int bucketing_ready_to_update_buckets(bucketing_state_t *s)
 
 static void bucketing_update_buckets(bucketing_state_t *s)
 {
+	bucketing_update_prefix_sums(s);
+
 	switch (s->mode) {
 	case BUCKETING_MODE_GREEDY:
 		bucketing_greedy_update_buckets(s);
@@ -166,8 +165,12 @@ bucketing_state_t *bucketing_state_create(double default_value, int num_sampling
 
 	bucketing_state_t *s = xxmalloc(sizeof(*s));
 
-	s->sorted_points = list_create();
-	s->sequence_points = list_create();
+	s->sorted_points = 0;
+	s->num_sorted_points = 0;
+	s->sorted_points_capacity = 0;
+	s->sig_prefix = 0;
+	s->val_sig_prefix = 0;
+	s->num_prefix_points = 0;
 	s->sorted_buckets = list_create();
 
 	s->num_points = 0;
@@ -181,6 +184,7 @@ bucketing_state_t *bucketing_state_create(double default_value, int num_sampling
 	s->max_num_buckets = max_num_buckets;
 	s->mode = mode;
 	s->update_epoch = update_epoch;
+	s->max_num_points = BUCKETING_DEFAULT_MAX_NUM_POINTS;
 
 	return s;
 }
@@ -188,12 +192,9 @@ bucketing_state_t *bucketing_state_create(double default_value, int num_sampling
 void bucketing_state_delete(bucketing_state_t *s)
 {
 	if (s) {
-		list_clear(s->sorted_points, (void *)bucketing_point_delete);
-		list_delete(s->sorted_points);
-
-		/* pointers already free'd as sorted_points and sequence_points
-		 * share the same set of pointers */
-		list_delete(s->sequence_points);
+		free(s->sorted_points);
+		free(s->sig_prefix);
+		free(s->val_sig_prefix);
 		list_clear(s->sorted_buckets, (void *)bucketing_bucket_delete);
 		list_delete(s->sorted_buckets);
 		free(s);
@@ -229,6 +230,14 @@ void bucketing_state_tune(bucketing_state_t *s, const char *field, void *val)
 		s->num_sampling_points = *((bucketing_mode_t *)val);
 	} else if (!strncmp(field, "update_epoch", strlen("update_epoch"))) {
 		s->update_epoch = *((int *)val);
+	} else if (!strncmp(field, "max_num_points", strlen("max_num_points"))) {
+		s->max_num_points = *((int *)val);
+		if (s->max_num_points < 1) {
+			warn(D_BUCKETING, "maximum number of points cannot be less than 1\n");
+			s->max_num_points = 1;
+		}
+		while (s->num_sorted_points > s->max_num_points)
+			bucketing_remove_random_point(s);
 	} else {
 		warn(D_BUCKETING, "Cannot tune field %s as it doesn't exist\n", field);
 	}
@@ -236,18 +245,14 @@ void bucketing_state_tune(bucketing_state_t *s, const char *field, void *val)
 
 void bucketing_add(bucketing_state_t *s, double val)
 {
-	/* insert to sorted list and append to sequence list */
-	bucketing_point_t *p = bucketing_point_create(val, s->next_task_sig);
-	if (!p) {
-		fatal("Cannot create point\n");
-		return;
-	}
-
-	bucketing_insert_point_to_sorted_list(s->sorted_points, p);
-
-	if (!list_push_tail(s->sequence_points, p)) {
-		fatal("Cannot push point to list tail\n");
-		return;
+	/* Once max_num_points are kept, keep a uniform sample of all the points
+	 * added: the k-th point replaces a random kept point with probability
+	 * max_num_points/k. */
+	if (s->num_sorted_points < s->max_num_points) {
+		bucketing_insert_point(s, val, s->next_task_sig);
+	} else if (random_double() * (s->num_points + 1) < s->max_num_points) {
+		bucketing_remove_random_point(s);
+		bucketing_insert_point(s, val, s->next_task_sig);
 	}
 
 	/* Change to predicting phase if appropriate */
@@ -371,17 +376,13 @@ void bucketing_sorted_buckets_print(struct list *l)
 	}
 }
 
-void bucketing_sorted_points_print(struct list *l)
+void bucketing_sorted_points_print(bucketing_state_t *s)
 {
-	if (!l)
+	if (!s)
 		return;
-	bucketing_point_t *tmp;
-	list_first_item(l);
 	printf("Printing sorted points\n");
-	int i = 0;
-	while ((tmp = list_next_item(l))) {
-		printf("pos: %d, value: %lf, sig: %lf\n", i, tmp->val, tmp->sig);
-		++i;
+	for (int i = 0; i < s->num_sorted_points; ++i) {
+		printf("pos: %d, value: %lf, sig: %lf\n", i, s->sorted_points[i].val, s->sorted_points[i].sig);
 	}
 }
 
@@ -45,21 +45,29 @@ typedef struct
 typedef struct
 {
     /** Begin: internally maintained fields **/
-    /* a doubly linked list of pointers to points of type 'bucketing_point_t'
-     * sorted by 'point->val' in increasing order
-     * sorted_points and sequence_points share the same set of pointers */
-    struct list *sorted_points;
-
-    /* a doubly linked list of pointers to points of type 'bucketing_point_t'
-     * sorted by 'point->sig' in increasing order
-     * sequence_points and sorted_points share the same set of pointers */
-    struct list *sequence_points;
+    /* an array of points sorted by 'point->val' in increasing order. Once
+     * it holds max_num_points points, it is kept as a uniform sample of all
+     * the points added. */
+    bucketing_point_t *sorted_points;
+
+    /* number of points in sorted_points, and number of points allocated */
+    int num_sorted_points;
+    int sorted_points_capacity;
+
+    /* sums of 'point->sig' and of 'point->val * point->sig' of the first i
+     * sorted points at index i, so that the significance and expected value
+     * of any range of points are differences of two entries. Only the first
+     * num_prefix_points + 1 entries are current, as entries are updated
+     * from the lowest changed point when buckets are updated. */
+    double *sig_prefix;
+    double *val_sig_prefix;
+    int num_prefix_points;
     
     /* a doubly linked list of pointers to buckets of type 'bucketing_bucket_t'
      * sorted by 'bucket->val' in increasing order */
     struct list *sorted_buckets;
     
-    /* total number of points */
+    /* total number of points added */
     int num_points;
     
     /* whether bucketing is in sampling phase, 1 is yes, 0 is no */
@@ -95,9 +103,15 @@ typedef struct
     /* The number of iterations before another bucketing happens */
     int update_epoch;
 
+    /* the maximum number of points kept to compute buckets */
+    int max_num_points;
+
     /** End: externally provided fields **/ 
 } bucketing_state_t;
 
+/* Default maximum number of points kept by a bucketing state */
+#define BUCKETING_DEFAULT_MAX_NUM_POINTS 10000
+
 /** Begin: APIs **/
 
 /* Create a bucketing bucket
@@ -156,9 +170,9 @@ double bucketing_predict(bucketing_state_t* s, double prev_val);
  * @param l the list of buckets */
 void bucketing_sorted_buckets_print(struct list* l);
 
-/* Print a sorted list of bucketing_point_t
- * @param l the list of points */
-void bucketing_sorted_points_print(struct list* l);
+/* Print the sorted points of a bucketing state
+ * @param s the bucketing state */
+void bucketing_sorted_points_print(bucketing_state_t* s);
 
 /** End: debug functions **/
 
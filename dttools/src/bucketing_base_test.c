@@ -55,7 +55,7 @@ int main(int argc, char** argv)
     for (int i = 0; i < iters; ++i)
     {
         num = num * multiple % prime;
-        bucketing_sorted_points_print(s->sorted_points);
+        bucketing_sorted_points_print(s);
         bucketing_sorted_buckets_print(s->sorted_buckets);
         printf("iteration %d data value %d\n", i, num);
         while ((pred = bucketing_predict(s, prev_val)))
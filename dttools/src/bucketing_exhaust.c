@@ -31,76 +31,51 @@ static bucketing_bucket_t **bucketing_bucket_list_to_array(struct list *bucket_l
 	return bucket_array;
 }
 
-/* Reweight the probabilities of a range of buckets to 1
- * @param bucket_array the array of bucketing_bucket_t*
- * @param lo index of low bucket
- * @param hi index of high bucket
- * @return array of reweighted probabilities
- * @return 0 if failure */
-static double *bucketing_reweight_bucket_probs(bucketing_bucket_t **bucket_array, int lo, int hi)
+/* Find the end of the range of sorted points that starts at start and has
+ * values less than or equal to val
+ * @param s the relevant bucketing state
+ * @param start first point of the range
+ * @param val largest value in the range
+ * @return position of the first point after the range */
+static int bucketing_exhaust_range_end(bucketing_state_t *s, int start, double val)
 {
-	if (!bucket_array) {
-		fatal("No array of buckets\n");
-		return 0;
-	}
-
-	double *bucket_probs = xxmalloc((hi - lo + 1) * sizeof(*bucket_probs));
+	int lo = start;
+	int hi = s->num_sorted_points;
 
-	/* get all probabilities of buckets in range */
-	double total_prob = 0;
-	for (int i = lo; i <= hi; ++i) {
-		total_prob += bucket_array[i]->prob;
-	}
-
-	/* reweight to [0, 1] */
-	for (int i = lo; i <= hi; ++i) {
-		bucket_probs[i - lo] = bucket_array[i]->prob / total_prob;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (s->sorted_points[mid].val <= val) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
 
-	return bucket_probs;
+	return lo;
 }
 
 /* Compute the expectations of tasks' values in all buckets
  * @param s the relevant bucketing state
- * @param bucket_list the list of buckets
- * @return pointer to a malloc'ed array of values
- * @return 0 if failure */
-static double *bucketing_exhaust_compute_task_exps(bucketing_state_t *s, struct list *bucket_list)
+ * @param bucket_array the array of buckets
+ * @param n the number of buckets
+ * @return pointer to a malloc'ed array of values */
+static double *bucketing_exhaust_compute_task_exps(bucketing_state_t *s, bucketing_bucket_t **bucket_array, int n)
 {
-	if (!s || !bucket_list) {
-		fatal("At least one parameter is empty\n");
-		return 0;
-	}
+	double *task_exps = xxcalloc(n, sizeof(*task_exps));
 
-	double *task_exps = xxcalloc(list_size(bucket_list), sizeof(*task_exps));
+	/* the points of a bucket are those above the previous bucket, up to its value */
+	int start = 0;
+	for (int i = 0; i < n; ++i) {
+		int end = bucketing_exhaust_range_end(s, start, bucket_array[i]->val);
+		if (i == n - 1)
+			end = s->num_sorted_points;
 
-	bucketing_point_t *tmp_pnt;
-	bucketing_bucket_t *tmp_buck;
-	int i = 0;
-	double total_sig_buck = 0;
+		double total_sig_buck = s->sig_prefix[end] - s->sig_prefix[start];
+		task_exps[i] = (s->val_sig_prefix[end] - s->val_sig_prefix[start]) / total_sig_buck;
 
-	list_first_item(s->sorted_points);
-	list_first_item(bucket_list);
-	tmp_pnt = list_next_item(s->sorted_points);
-	tmp_buck = list_next_item(bucket_list);
-
-	/* Loop though all points to compute expected value of task if it is in a given bucket */
-	while ((tmp_pnt)) {
-		if (tmp_pnt->val <= tmp_buck->val) {
-			total_sig_buck += tmp_pnt->sig;
-			task_exps[i] += tmp_pnt->val * tmp_pnt->sig;
-			tmp_pnt = list_next_item(s->sorted_points);
-		} else {
-			task_exps[i] /= total_sig_buck;
-			++i;
-			total_sig_buck = 0;
-			tmp_buck = list_next_item(bucket_list);
-		}
+		start = end;
 	}
 
-	/* Update last task expectation of last bucket */
-	task_exps[i] /= total_sig_buck;
-
 	return task_exps;
 }
 
@@ -119,19 +94,24 @@ static double bucketing_exhaust_compute_cost(bucketing_state_t *s, struct list *
 	int N = list_size(bucket_list);
 	double cost_table[N][N];
 
-	/* Compute task expectation in each bucket */
-	double *task_exps = bucketing_exhaust_compute_task_exps(s, bucket_list);
-	if (!task_exps) {
-		fatal("Cannot compute task expectations\n");
-		return -1;
-	}
-
 	bucketing_bucket_t **bucket_array = bucketing_bucket_list_to_array(bucket_list);
 	if (!bucket_array) {
 		fatal("Cannot convert list of buckets to array of buckets\n");
 		return -1;
 	}
 
+	/* Compute task expectation in each bucket */
+	double *task_exps = bucketing_exhaust_compute_task_exps(s, bucket_array, N);
+
+	/* total probability of the buckets above each bucket, to reweight them to [0, 1] */
+	double upper_probs[N];
+	for (int j = 0; j < N; ++j) {
+		upper_probs[j] = 0;
+		for (int k = j + 1; k < N; ++k) {
+			upper_probs[j] += bucket_array[k]->prob;
+		}
+	}
+
 	/* i is task in which bucket, j is which bucket is chosen */
 	/* fill easy entries */
 	for (int j = 0; j < N; ++j) {
@@ -140,21 +120,13 @@ static double bucketing_exhaust_compute_cost(bucketing_state_t *s, struct list *
 		}
 	}
 
-	double *upper_bucket_probs;
 	/* fill entries that depend on other entries */
 	for (int i = N - 1; i > -1; --i) {
 		for (int j = i - 1; j > -1; --j) {
 			cost_table[i][j] = bucket_array[j]->val;
-			upper_bucket_probs = bucketing_reweight_bucket_probs(bucket_array, j + 1, N - 1);
-			if (!upper_bucket_probs) {
-				fatal("Cannot reweight buckets\n");
-				return -1;
-			}
-
 			for (int k = j + 1; k < N; ++k) {
-				cost_table[i][j] += upper_bucket_probs[k - (j + 1)] * cost_table[i][k];
+				cost_table[i][j] += bucket_array[k]->prob / upper_probs[j] * cost_table[i][k];
 			}
-			free(upper_bucket_probs);
 		}
 	}
 
@@ -184,18 +156,12 @@ static struct list *bucketing_exhaust_get_buckets(bucketing_state_t *s, int n)
 		return 0;
 	}
 
-	if (!s->sorted_points) {
-		fatal("sorted list of points is empty\n");
-		return 0;
-	}
-
-	bucketing_point_t *tmp_point = list_peek_tail(s->sorted_points);
-	if (!tmp_point) {
+	if (s->num_sorted_points < 1) {
 		fatal("list of points is empty so can't get a list of buckets\n");
 		return 0;
 	}
 
-	double max_val = tmp_point->val; // max value in all points
+	double max_val = s->sorted_points[s->num_sorted_points - 1].val; // max value in all points
 
 	int steps;
 	if (max_val == 0) // corner case where max value is 0, so no possible steps are available
@@ -222,44 +188,30 @@ static struct list *bucketing_exhaust_get_buckets(bucketing_state_t *s, int n)
 		}
 	}
 
-	double buck_sig = 0;		   // track signficance of a bucket
-	double total_sig = 0;		   // track total significance
-	int i = 0;			   // track index to candidate buckets
-	double prev_val = 0;		   // previous seen value of point
-	double candidate_probs[steps + n]; // probabilities of candidate buckets
-	for (i = 0; i < steps + n; ++i)
-		candidate_probs[i] = 0;
-
-	i = 0;
-	list_first_item(s->sorted_points);
-	bucketing_point_t *tmp = list_next_item(s->sorted_points);
-
-	/* loop through points to fill values for buckets */
-	while ((tmp) && (i < steps + n)) {
-		if (candidate_vals[i] < tmp->val) {
-			total_sig += buck_sig;
-			candidate_probs[i] = buck_sig;
-			candidate_vals[i] = prev_val;
-			++i;
-			buck_sig = 0;
-		} else if (candidate_vals[i] >= tmp->val) {
-			prev_val = tmp->val;
-			buck_sig += tmp->sig;
-
-			tmp = list_next_item(s->sorted_points);
-		}
-	}
+	double total_sig = s->sig_prefix[s->num_sorted_points]; // track total significance
+	double prev_val = 0;					  // previous seen value of point
+	double candidate_probs[steps + n];			  // probabilities of candidate buckets
+
+	/* fill values for buckets from the ranges of points below each candidate,
+	 * using the largest value seen as the value of the bucket */
+	int start = 0;
+	for (int i = 0; i < steps + n; ++i) {
+		int end = bucketing_exhaust_range_end(s, start, candidate_vals[i]);
+		if (end > start)
+			prev_val = s->sorted_points[end - 1].val;
 
-	/* update last bucket */
-	candidate_probs[i] = buck_sig;
-	total_sig += buck_sig;
+		candidate_probs[i] = s->sig_prefix[end] - s->sig_prefix[start];
+		candidate_vals[i] = prev_val;
+
+		start = end;
+	}
 
 	struct list *ret = list_create();
 
 	bucketing_bucket_t *tmp_bucket;
 
 	/* push a bucket in sorted order if bucket is not empty */
-	for (i = 0; i < steps + n; ++i) {
+	for (int i = 0; i < steps + n; ++i) {
 		if (candidate_probs[i] != 0) {
 			tmp_bucket = bucketing_bucket_create(candidate_vals[i], candidate_probs[i] / total_sig);
 			if (!tmp_bucket) {
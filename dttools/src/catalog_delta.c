@@ -0,0 +1,221 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "catalog_delta.h"
+#include "buffer.h"
+#include "cctools_endian.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "xxmalloc.h"
+#include "zlib.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+/*
+Each packet has a fixed header, followed by the body:
+the marker, the kind, the flags, the stream, and the version,
+with the numbers in network byte order.
+*/
+
+#define HEADER_LENGTH 15
+#define FLAG_COMPRESSED 1
+
+/*
+The body of a changes packet is a sequence of entries.
+An update is 'U', the length and text of the field name,
+and the length and JSON text of the new value.
+A removal is 'R' and the length and text of the field name.
+*/
+
+#define ENTRY_UPDATE 'U'
+#define ENTRY_REMOVE 'R'
+
+static char *encode_packet(catalog_delta_kind_t kind, uint64_t stream, uint32_t version, const char *body, size_t body_length, size_t compress_limit, size_t *length)
+{
+	int flags = 0;
+	char *compressed = 0;
+
+	if (body_length > compress_limit) {
+		unsigned long compressed_length = compressBound(body_length);
+		compressed = xxmalloc(compressed_length);
+		if (compress((Bytef *)compressed, &compressed_length, (const Bytef *)body, body_length) == Z_OK && compressed_length < body_length) {
+			body = compressed;
+			body_length = compressed_length;
+			flags |= FLAG_COMPRESSED;
+		}
+	}
+
+	char *packet = xxmalloc(HEADER_LENGTH + body_length);
+	uint64_t nstream = htonll(stream);
+	uint32_t nversion = htonl(version);
+
+	packet[0] = CATALOG_DELTA_MARKER;
+	packet[1] = kind;
+	packet[2] = flags;
+	memcpy(&packet[3], &nstream, sizeof(nstream));
+	memcpy(&packet[11], &nversion, sizeof(nversion));
+	memcpy(&packet[HEADER_LENGTH], body, body_length);
+
+	*length = HEADER_LENGTH + body_length;
+
+	free(compressed);
+	return packet;
+}
+
+char *catalog_delta_encode_base(uint64_t stream, uint32_t version, const char *text, size_t compress_limit, size_t *length)
+{
+	return encode_packet(CATALOG_DELTA_BASE, stream, version, text, strlen(text), compress_limit, length);
+}
+
+static void put_name(buffer_t *b, char type, const char *name)
+{
+	uint16_t nlength = htons(strlen(name));
+	buffer_putlstring(b, &type, 1);
+	buffer_putlstring(b, (const char *)&nlength, sizeof(nlength));
+	buffer_putstring(b, name);
+}
+
+char *catalog_delta_encode_changes(uint64_t stream, uint32_t version, struct jx *base, struct jx *object, size_t compress_limit, size_t *length)
+{
+	if (!jx_istype(base, JX_OBJECT) || !jx_istype(object, JX_OBJECT))
+		return 0;
+
+	buffer_t b;
+	buffer_init(&b);
+
+	struct jx_pair *p;
+	for (p = object->u.pairs; p; p = p->next) {
+		if (!jx_istype(p->key, JX_STRING))
+			continue;
+		const char *name = p->key->u.string_value;
+		struct jx *old = jx_lookup(base, name);
+		if (old && jx_equals(old, p->value))
+			continue;
+
+		char *value = jx_print_string(p->value);
+		uint32_t nlength = htonl(strlen(value));
+		put_name(&b, ENTRY_UPDATE, name);
+		buffer_putlstring(&b, (const char *)&nlength, sizeof(nlength));
+		buffer_putstring(&b, value);
+		free(value);
+	}
+
+	for (p = base->u.pairs; p; p = p->next) {
+		if (!jx_istype(p->key, JX_STRING))
+			continue;
+		const char *name = p->key->u.string_value;
+		if (!jx_lookup(object, name))
+			put_name(&b, ENTRY_REMOVE, name);
+	}
+
+	size_t body_length;
+	const char *body = buffer_tolstring(&b, &body_length);
+	char *packet = encode_packet(CATALOG_DELTA_CHANGES, stream, version, body, body_length, compress_limit, length);
+
+	buffer_free(&b);
+	return packet;
+}
+
+int catalog_delta_decode(const char *packet, size_t length, catalog_delta_kind_t *kind, uint64_t *stream, uint32_t *version, char *body, unsigned long *body_length)
+{
+	if (length < HEADER_LENGTH || packet[0] != CATALOG_DELTA_MARKER)
+		return 0;
+	if (packet[1] != CATALOG_DELTA_BASE && packet[1] != CATALOG_DELTA_CHANGES)
+		return 0;
+
+	uint64_t nstream;
+	uint32_t nversion;
+	memcpy(&nstream, &packet[3], sizeof(nstream));
+	memcpy(&nversion, &packet[11], sizeof(nversion));
+
+	*kind = packet[1];
+	*stream = ntohll(nstream);
+	*version = ntohl(nversion);
+
+	const char *data = &packet[HEADER_LENGTH];
+	unsigned long data_length = length - HEADER_LENGTH;
+
+	if (*body_length < 1)
+		return 0;
+
+	if (packet[2] & FLAG_COMPRESSED) {
+		unsigned long size = *body_length - 1;
+		if (uncompress((Bytef *)body, &size, (const Bytef *)data, data_length) != Z_OK)
+			return 0;
+		*body_length = size;
+	} else {
+		if (data_length >= *body_length)
+			return 0;
+		memcpy(body, data, data_length);
+		*body_length = data_length;
+	}
+
+	body[*body_length] = 0;
+	return 1;
+}
+
+struct jx *catalog_delta_apply(struct jx *base, const char *body, size_t length)
+{
+	struct jx *object = jx_copy(base);
+	const char *end = body + length;
+
+	while (body < end) {
+		char type = body[0];
+		uint16_t nlength;
+		if (end - body < 1 + (long)sizeof(nlength))
+			goto failure;
+		memcpy(&nlength, body + 1, sizeof(nlength));
+		body += 1 + sizeof(nlength);
+
+		size_t name_length = ntohs(nlength);
+		if ((size_t)(end - body) < name_length)
+			goto failure;
+		struct jx *name = jx_string_nocopy(strndup(body, name_length));
+		body += name_length;
+
+		jx_delete(jx_remove(object, name));
+
+		if (type == ENTRY_UPDATE) {
+			uint32_t vlength;
+			if ((size_t)(end - body) < sizeof(vlength)) {
+				jx_delete(name);
+				goto failure;
+			}
+			memcpy(&vlength, body, sizeof(vlength));
+			body += sizeof(vlength);
+
+			size_t value_length = ntohl(vlength);
+			if ((size_t)(end - body) < value_length) {
+				jx_delete(name);
+				goto failure;
+			}
+			char *text = strndup(body, value_length);
+			struct jx *value = jx_parse_string(text);
+			free(text);
+			body += value_length;
+
+			if (!value) {
+				jx_delete(name);
+				goto failure;
+			}
+			jx_insert(object, name, value);
+		} else if (type == ENTRY_REMOVE) {
+			jx_delete(name);
+		} else {
+			jx_delete(name);
+			goto failure;
+		}
+	}
+
+	return object;
+
+failure:
+	jx_delete(object);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef CATALOG_DELTA_H
+#define CATALOG_DELTA_H
+
+#include "jx.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** @file catalog_delta.h
+Compact binary encoding of catalog updates.
+
+A sender that updates the same record over and over may send the whole
+record once, as a base, and then send only the fields that have changed
+since that base.  Each packet names a stream chosen by the sender and the
+version of the base within that stream, so the catalog applies the changes
+only to the base they were computed from.  The changes are always relative
+to the last base, not to the previous change, so a lost packet only costs
+the update it carried, and a lost base is repaired by the next one.
+
+A packet starts with @ref CATALOG_DELTA_MARKER, which never begins
+an ordinary JSON, nvpair, or compressed update.
+*/
+
+/** The first byte of every packet in this encoding. */
+#define CATALOG_DELTA_MARKER 0x1D
+
+/** The kind of a packet. */
+typedef enum {
+	CATALOG_DELTA_BASE = 'B',   /**< The whole record, as JSON text. */
+	CATALOG_DELTA_CHANGES = 'C' /**< The fields changed since a base. */
+} catalog_delta_kind_t;
+
+/** Encode a whole record as a new base.
+@param stream The stream chosen by the sender.
+@param version The version of this base within the stream.
+@param text The JSON text of the record.
+@param compress_limit Compress the body if it is longer than this.
+@param length Set to the length of the packet.
+@return The packet, which must be freed, or null on failure.
+*/
+char *catalog_delta_encode_base(uint64_t stream, uint32_t version, const char *text, size_t compress_limit, size_t *length);
+
+/** Encode the differences between a base and a newer record.
+@param stream The stream chosen by the sender.
+@param version The version of the base.
+@param base The record as sent in the base.
+@param object The record as it is now.
+@param compress_limit Compress the body if it is longer than this.
+@param length Set to the length of the packet.
+@return The packet, which must be freed, or null on failure.
+*/
+char *catalog_delta_encode_changes(uint64_t stream, uint32_t version, struct jx *base, struct jx *object, size_t compress_limit, size_t *length);
+
+/** Decode the header of a packet and uncompress its body.
+@param packet The packet received.
+@param length The length of the packet.
+@param kind Set to the kind of the packet.
+@param stream Set to the stream of the packet.
+@param version Set to the version of the base.
+@param body A buffer to receive the body, which is null terminated.
+@param body_length On entry, the size of the buffer; on return, the length of the body.
+@return True on success, false if the packet is malformed or the body does not fit.
+*/
+int catalog_delta_decode(const char *packet, size_t length, catalog_delta_kind_t *kind, uint64_t *stream, uint32_t *version, char *body, unsigned long *body_length);
+
+/** Apply the body of a changes packet to a base.
+@param base The record as sent in the base, which is not modified.
+@param body The body of a changes packet.
+@param length The length of the body.
+@return A new record, or null if the body is malformed.
+*/
+struct jx *catalog_delta_apply(struct jx *base, const char *body, size_t length);
+
+#endif
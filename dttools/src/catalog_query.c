@@ -6,24 +6,34 @@ See the file COPYING for details.
 */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "address.h"
 #include "b64.h"
+#include "catalog_delta.h"
 #include "catalog_query.h"
 #include "datagram.h"
 #include "debug.h"
 #include "domain_name.h"
 #include "domain_name_cache.h"
 #include "fd.h"
+#include "hash_table.h"
 #include "http_query.h"
 #include "jx.h"
+#include "jx_arena.h"
 #include "jx_eval.h"
 #include "jx_parse.h"
 #include "jx_print.h"
+#include "link.h"
 #include "list.h"
 #include "macros.h"
+#include "random.h"
 #include "set.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
@@ -88,29 +98,31 @@ struct jx *catalog_query_send_query(struct catalog_host *h, struct jx *expr, tim
 	char *url = string_format("http://%s:%d/query/%s", h->host, h->port, buffer_tostring(&buf));
 	debug(D_DEBUG, "trying catalog query: %s", url);
 
-	struct link *link = http_query(url, "GET", stoptime);
+	/* Repeated queries reuse the connection, and an unchanged result is not sent again. */
+	size_t length;
+	char *data = http_query_buffer(url, &length, stoptime);
 
 	free(url);
 	buffer_free(&buf);
 	free(expr_str);
 
-	if (!link)
+	if (!data)
 		return 0;
 
-	struct jx *j = jx_parse_link(link, stoptime);
+	struct jx *j = jx_parse_string(data);
 
-	link_close(link);
+	free(data);
 
 	if (!j) {
 		url = string_format("http://%s:%d/query.json", h->host, h->port);
 		debug(D_DEBUG, "falling back to old query: %s", url);
-		link = http_query(url, "GET", stoptime);
+		data = http_query_buffer(url, &length, stoptime);
 		free(url);
-		if (!link)
+		if (!data)
 			return 0;
 
-		j = jx_parse_link(link, stoptime);
-		link_close(link);
+		j = jx_parse_string(data);
+		free(data);
 		if (!j) {
 			debug(D_DEBUG, "query result failed to parse as JSON");
 			return NULL;
@@ -173,11 +185,152 @@ struct list *catalog_query_sort_hostlist(const char *hosts)
 	return list_splice(previously_up, previously_down);
 }
 
+/*
+A catalog relay, as started by catalog_relay(1), gathers the updates of
+all the programs on a host and forwards them to the catalogs in batches,
+and answers queries from a short lived cache.  If CATALOG_RELAY names the
+Unix socket of a relay, updates and queries go through it, and go directly
+to the catalogs whenever the relay cannot be reached.  A request is one
+line giving the operation, the catalog hosts, and the length of the body
+that follows, which is the record to update or the filter expression.
+The relay answers a query with the JSON array of results.
+*/
+
+static int catalog_relay_connect()
+{
+	const char *path = getenv("CATALOG_RELAY");
+	if (!path || !path[0])
+		return -1;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		debug(D_DEBUG, "catalog relay path is too long: %s", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	/* A relay that is not keeping up refuses the connection at once, rather than holding up the caller. */
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		debug(D_DEBUG, "couldn't connect to catalog relay %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int catalog_relay_wait(int fd, short events, time_t stoptime)
+{
+	struct pollfd p = {fd, events, 0};
+	int timeout = MAX(stoptime - time(0), 0) * 1000;
+	return poll(&p, 1, timeout) > 0;
+}
+
+static int catalog_relay_write(int fd, const char *data, size_t length, time_t stoptime)
+{
+	while (length > 0) {
+		ssize_t chunk = send(fd, data, length, MSG_NOSIGNAL);
+		if (chunk > 0) {
+			data += chunk;
+			length -= chunk;
+		} else if (chunk < 0 && errno_is_temporary(errno) && catalog_relay_wait(fd, POLLOUT, stoptime)) {
+			continue;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int catalog_relay_request(const char *op, const char *hosts, const char *body, time_t stoptime)
+{
+	int fd = catalog_relay_connect();
+	if (fd < 0)
+		return -1;
+
+	char *header = string_format("%s %s %zu\n", op, hosts, strlen(body));
+	int ok = catalog_relay_write(fd, header, strlen(header), stoptime) && catalog_relay_write(fd, body, strlen(body), stoptime);
+	free(header);
+
+	if (!ok) {
+		debug(D_DEBUG, "couldn't send %s to catalog relay: %s", op, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int catalog_relay_update(const char *hosts, const char *text)
+{
+	int fd = catalog_relay_request("update", hosts, text, time(0) + CATALOG_RELAY_TIMEOUT);
+	if (fd < 0)
+		return 0;
+
+	debug(D_DEBUG, "sent update of %d bytes to catalog relay", (int)strlen(text));
+	close(fd);
+	return 1;
+}
+
+static struct jx *catalog_relay_query(const char *hosts, struct jx *filter_expr, time_t stoptime)
+{
+	char *expr_str = filter_expr ? jx_print_string(filter_expr) : strdup("true");
+	int fd = catalog_relay_request("query", hosts, expr_str, stoptime);
+	free(expr_str);
+	if (fd < 0)
+		return 0;
+
+	buffer_t buf;
+	buffer_init(&buf);
+
+	char data[65536];
+	ssize_t chunk;
+	while (1) {
+		chunk = read(fd, data, sizeof(data));
+		if (chunk > 0) {
+			buffer_putlstring(&buf, data, chunk);
+		} else if (chunk < 0 && errno_is_temporary(errno) && catalog_relay_wait(fd, POLLIN, stoptime)) {
+			continue;
+		} else {
+			break;
+		}
+	}
+	close(fd);
+
+	struct jx *j = chunk == 0 ? jx_parse_string(buffer_tostring(&buf)) : 0;
+	buffer_free(&buf);
+
+	if (!jx_istype(j, JX_ARRAY)) {
+		debug(D_DEBUG, "catalog relay did not answer the query");
+		jx_delete(j);
+		return 0;
+	}
+
+	return j;
+}
+
 struct catalog_query *catalog_query_create(const char *hosts, struct jx *filter_expr, time_t stoptime)
 {
 	struct catalog_query *q = NULL;
 	char *n;
 	struct catalog_host *h;
+
+	struct jx *relayed = catalog_relay_query(string_null_or_empty(hosts) ? CATALOG_HOST : hosts, filter_expr, stoptime);
+	if (relayed) {
+		q = xxmalloc(sizeof(*q));
+		q->data = relayed;
+		q->current = relayed->u.items;
+		q->filter_expr = filter_expr;
+		return q;
+	}
+
 	struct list *sorted_hosts = catalog_query_sort_hostlist(hosts);
 
 	int backoff_interval = 1;
@@ -322,14 +475,14 @@ Send a catalog update via a single udp message.
 This is inherently a non-blocking action.
 */
 
-static void catalog_update_udp(const char *host, const char *address, int port, const char *text)
+static void catalog_update_udp(const char *host, const char *address, int port, const char *data, size_t length)
 {
 	debug(D_DEBUG, "sending update via udp to %s(%s):%d", host, address, port);
 
 	struct datagram *d = datagram_create(DATAGRAM_PORT_ANY);
 	if (!d)
 		return;
-	datagram_send(d, text, strlen(text), address, port);
+	datagram_send(d, data, length, address, port);
 	datagram_delete(d);
 }
 
@@ -339,7 +492,7 @@ This is inherently a blocking action and could
 take some time under non-ideal conditions.
 */
 
-static int catalog_update_tcp(const char *host, const char *address, int port, const char *text)
+static int catalog_update_tcp(const char *host, const char *address, int port, const char *data, size_t length)
 {
 	debug(D_DEBUG, "sending update via tcp to %s(%s):%d", host, address, port);
 
@@ -350,7 +503,7 @@ static int catalog_update_tcp(const char *host, const char *address, int port, c
 		return 0;
 	}
 
-	link_write(l, text, strlen(text), stoptime);
+	link_write(l, data, length, stoptime);
 	link_close(l);
 	return 1;
 }
@@ -363,14 +516,14 @@ and that the main process will not have to handle an asynchronous
 "child completed" message at any later point.
 */
 
-static int catalog_update_tcp_background(const char *host, const char *address, int port, const char *text)
+static int catalog_update_tcp_background(const char *host, const char *address, int port, const char *data, size_t length)
 {
 	pid_t pid = fork();
 	if (pid == 0) {
 		pid_t grandpid = fork();
 		if (grandpid == 0) {
 			/* grandchild sends catalog update. */
-			catalog_update_tcp(host, address, port, text);
+			catalog_update_tcp(host, address, port, data, length);
 			/* grandchild process exits after sending update. */
 			_exit(0);
 		} else {
@@ -390,6 +543,97 @@ static int catalog_update_tcp_background(const char *host, const char *address,
 	}
 }
 
+/*
+Delta updates send a whole record as a base now and then, and otherwise
+only the fields that changed since the base, as described in catalog_delta.h.
+The sender keeps the last base of each record it updates, identified by
+the hosts it is sent to and the fields that the catalog uses as its key.
+A new base is sent after a number of changes, after a time limit,
+or whenever the changes would be no smaller than the record itself.
+*/
+
+#define CATALOG_DELTA_REFRESH_COUNT 20
+#define CATALOG_DELTA_REFRESH_INTERVAL 300
+
+struct catalog_delta_state {
+	uint64_t stream;
+	uint32_t version;
+	struct jx *base;
+	time_t base_time;
+	int changes_sent;
+};
+
+static struct hash_table *delta_states = NULL;
+
+static int catalog_update_deltas()
+{
+	const char *deltas = getenv("CATALOG_UPDATE_DELTAS");
+	return deltas && !strcmp(deltas, "on");
+}
+
+static char *catalog_query_delta_update(const char *hosts, const char *text, size_t compress_limit, size_t *data_length)
+{
+	/*
+	The base is kept from one update to the next, so it must not be
+	allocated from an arena that the caller deletes after sending.
+	*/
+	struct jx_arena *previous_arena = jx_arena_use(0);
+
+	struct jx *object = jx_parse_string(text);
+	if (!jx_istype(object, JX_OBJECT)) {
+		jx_delete(object);
+		jx_arena_use(previous_arena);
+		return 0;
+	}
+
+	const char *type = jx_lookup_string(object, "type");
+	const char *name = jx_lookup_string(object, "name");
+	const char *uuid = jx_lookup_string(object, "uuid");
+	char *key = string_format("%s/%s/%s/%d/%s", hosts, type ? type : "", name ? name : "", (int)jx_lookup_integer(object, "port"), uuid ? uuid : "");
+
+	if (!delta_states) {
+		delta_states = hash_table_create(0, 0);
+		random_init();
+	}
+
+	struct catalog_delta_state *state = hash_table_lookup(delta_states, key);
+	if (!state) {
+		state = xxcalloc(1, sizeof(*state));
+		state->stream = (uint64_t)random_int64();
+		hash_table_insert(delta_states, key, state);
+	}
+	free(key);
+
+	time_t now = time(0);
+	char *data = 0;
+
+	if (state->base && state->changes_sent < CATALOG_DELTA_REFRESH_COUNT && (now - state->base_time) < CATALOG_DELTA_REFRESH_INTERVAL) {
+		data = catalog_delta_encode_changes(state->stream, state->version, state->base, object, compress_limit, data_length);
+		if (data && *data_length >= strlen(text)) {
+			free(data);
+			data = 0;
+		}
+	}
+
+	if (data) {
+		state->changes_sent++;
+		jx_delete(object);
+	} else {
+		state->version++;
+		jx_delete(state->base);
+		state->base = object;
+		state->base_time = now;
+		state->changes_sent = 0;
+		data = catalog_delta_encode_base(state->stream, state->version, text, compress_limit, data_length);
+	}
+
+	jx_arena_use(previous_arena);
+	return data;
+}
+
+/* Longest wait for the address of a catalog when sending a background update. */
+#define CATALOG_LOOKUP_BACKGROUND_TIMEOUT 2
+
 int catalog_query_send_update(const char *hosts, const char *text, catalog_update_flags_t flags)
 {
 	size_t compress_limit = 1200;
@@ -397,28 +641,50 @@ int catalog_query_send_update(const char *hosts, const char *text, catalog_updat
 	if (compress_limit_str)
 		compress_limit = atoi(compress_limit_str);
 
-	unsigned long data_length = strlen(text);
+	size_t data_length = strlen(text);
 	char *update_data = 0;
 
+	// Leave the update to the relay on this host, if there is one.
+	if (data_length <= CATALOG_RELAY_RECORD_MAX) {
+		if (catalog_relay_update(hosts, text))
+			return 1;
+	} else if ((flags & CATALOG_UPDATE_CONDITIONAL) && getenv("CATALOG_RELAY")) {
+		debug(D_DEBUG, "update message exceeds limit of %d bytes for the catalog relay", CATALOG_RELAY_RECORD_MAX);
+		return 0;
+	}
+
 	// Ask which protocol should be used.
 	int use_udp = catalog_update_protocol();
 
+	// Send only the changes to the record, if asked.
+	if (catalog_update_deltas()) {
+		update_data = catalog_query_delta_update(hosts, text, compress_limit, &data_length);
+		if (update_data)
+			debug(D_DEBUG, "encoded update message of %d bytes as %d bytes", (int)strlen(text), (int)data_length);
+	}
+
 	// Decide whether to compress the data.
-	if (strlen(text) < compress_limit) {
+	if (update_data) {
+		// Already encoded above.
+	} else if (strlen(text) < compress_limit) {
 		// Don't bother compressing small updates
 		update_data = strdup(text);
+		data_length = strlen(text);
 	} else {
 		// Compress updates above a certain limit.
-		update_data = catalog_query_compress_update(text, &data_length);
+		unsigned long compress_length = strlen(text);
+		update_data = catalog_query_compress_update(text, &compress_length);
 		if (!update_data)
 			return 0;
+		data_length = compress_length;
 
 		debug(D_DEBUG, "compressed update message from %d to %d bytes", (int)strlen(text), (int)data_length);
+	}
 
-		if (data_length > compress_limit && (flags & CATALOG_UPDATE_CONDITIONAL) && !use_udp) {
-			debug(D_DEBUG, "compressed update message exceeds limit of %d bytes (CATALOG_UPDATE_LIMIT)", (int)compress_limit);
-			return 0;
-		}
+	if (data_length > compress_limit && (flags & CATALOG_UPDATE_CONDITIONAL) && !use_udp) {
+		debug(D_DEBUG, "update message exceeds limit of %d bytes (CATALOG_UPDATE_LIMIT)", (int)compress_limit);
+		free(update_data);
+		return 0;
 	}
 
 	int sent = 0;
@@ -431,17 +697,28 @@ int catalog_query_send_update(const char *hosts, const char *text, catalog_updat
 		int port;
 
 		next_host = parse_hostlist(next_host, host, &port);
-		if (domain_name_cache_lookup(host, address)) {
+
+		/*
+		A background update comes from the event loop of a manager,
+		which should not wait long on a slow name server.  If the name
+		is still being resolved, the update is skipped, and the next one
+		finds the address in the cache.
+		*/
+		time_t lookup_stoptime = (flags & CATALOG_UPDATE_BACKGROUND) ? time(0) + CATALOG_LOOKUP_BACKGROUND_TIMEOUT : DOMAIN_NAME_CACHE_WAIT_FOREVER;
+
+		if (domain_name_cache_lookup_timeout(host, address, lookup_stoptime)) {
 			if (use_udp) {
-				catalog_update_udp(host, address, port, text);
+				catalog_update_udp(host, address, port, update_data, data_length);
 				sent++;
 			} else {
 				if (flags & CATALOG_UPDATE_BACKGROUND) {
-					sent += catalog_update_tcp_background(host, address, port + 1, text);
+					sent += catalog_update_tcp_background(host, address, port + 1, update_data, data_length);
 				} else {
-					sent += catalog_update_tcp(host, address, port + 1, text);
+					sent += catalog_update_tcp(host, address, port + 1, update_data, data_length);
 				}
 			}
+		} else if (errno == EAGAIN) {
+			debug(D_DEBUG, "still looking up address of host: %s", host);
 		} else {
 			debug(D_DEBUG, "unable to lookup address of host: %s", host);
 		}
@@ -20,6 +20,12 @@ Query the global catalog server for server descriptions.
 #define CATALOG_HOST (getenv("CATALOG_HOST") ? getenv("CATALOG_HOST") : CATALOG_HOST_DEFAULT )
 #define CATALOG_PORT (getenv("CATALOG_PORT") ? atoi(getenv("CATALOG_PORT")) : CATALOG_PORT_DEFAULT )
 
+/** The longest record that a catalog relay accepts in an update. */
+#define CATALOG_RELAY_RECORD_MAX (256*1024)
+
+/** Longest wait for a catalog relay to accept an update, in seconds. */
+#define CATALOG_RELAY_TIMEOUT 5
+
 /** Catalog update control flags.
 These control the behavior of @ref catalog_query_send_update
 */
@@ -37,6 +43,8 @@ If neither is set, the system will contact chirp.cse.nd.edu on port 9097.
 @param hosts A comma delimited list of catalog servers to query, or null for the default server.
 @param filter_expr An optional expression to filter the results in JX syntax.
  A null pointer indicates no filter.
+If the environment variable CATALOG_RELAY names the socket of a catalog relay,
+the query is answered by the relay, or by the catalog if the relay does not answer.
 @param stoptime The absolute time at which to abort.
 @return A catalog query object on success, or null on failure.
 */
@@ -59,7 +67,9 @@ struct jx *catalog_query_read(struct catalog_query *q, time_t stoptime);
 void catalog_query_delete(struct catalog_query *q);
 
 /** Send update text to the given hosts
-hosts is a comma delimited list of hosts, each of which can be host or host:port
+hosts is a comma delimited list of hosts, each of which can be host or host:port.
+If the environment variable CATALOG_RELAY names the socket of a catalog relay,
+the update is left to the relay, and sent directly if the relay cannot be reached.
 @param hosts A list of hosts to which to send updates
 @param text String to send
 @param flags Any combination of CATALOG_UPDATE
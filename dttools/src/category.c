@@ -9,6 +9,7 @@ See the file COPYING for details.
 #include <math.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "assert.h"
 #include "bucketing_manager.h"
@@ -37,6 +38,111 @@ static const size_t labeled_resources[] = {
 /* map from resoure name to int bucket size. Initialized in category_create first time it is called. */
 static struct rmsummary *bucket_sizes = NULL;
 
+/* Cumulative counts and times of the buckets of a histogram, in increasing
+ * order of bucket. They are updated as values are added, so that a first
+ * allocation is computed with a single pass over the buckets, without
+ * sorting the buckets or looking up their data. */
+struct category_allocation_sums {
+	struct histogram *h;
+	int n;
+	int capacity;
+	double *keys;	      /* largest value of each bucket. */
+	double *times;	      /* wall time of the values in bucket i, in seconds. */
+	double *counts_accum; /* number of values in the buckets up to and including i. */
+	double *times_after;  /* wall time of the values in the buckets after i. */
+	double total_time;
+};
+
+static struct category_allocation_sums *category_allocation_sums_create(struct histogram *h)
+{
+	struct category_allocation_sums *s = calloc(1, sizeof(*s));
+	s->h = h;
+	return s;
+}
+
+static void category_allocation_sums_clear(struct category_allocation_sums *s)
+{
+	s->n = 0;
+	s->total_time = 0;
+}
+
+static void category_allocation_sums_delete(struct category_allocation_sums *s)
+{
+	if (!s)
+		return;
+
+	free(s->keys);
+	free(s->times);
+	free(s->counts_accum);
+	free(s->times_after);
+	free(s);
+}
+
+/* add count values that took time seconds to the bucket with largest value key. */
+static void category_allocation_sums_add(struct category_allocation_sums *s, double key, int64_t count, double time)
+{
+	int lo = 0;
+	int hi = s->n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (s->keys[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == s->n || s->keys[lo] != key) {
+		if (s->n == s->capacity) {
+			s->capacity = s->capacity ? 2 * s->capacity : 16;
+			s->keys = xxrealloc(s->keys, s->capacity * sizeof(double));
+			s->times = xxrealloc(s->times, s->capacity * sizeof(double));
+			s->counts_accum = xxrealloc(s->counts_accum, s->capacity * sizeof(double));
+			s->times_after = xxrealloc(s->times_after, s->capacity * sizeof(double));
+		}
+
+		size_t tail = (s->n - lo) * sizeof(double);
+		memmove(&s->keys[lo + 1], &s->keys[lo], tail);
+		memmove(&s->times[lo + 1], &s->times[lo], tail);
+		memmove(&s->counts_accum[lo + 1], &s->counts_accum[lo], tail);
+		memmove(&s->times_after[lo + 1], &s->times_after[lo], tail);
+		s->n++;
+
+		s->keys[lo] = key;
+		s->times[lo] = 0;
+		s->counts_accum[lo] = lo > 0 ? s->counts_accum[lo - 1] : 0;
+		s->times_after[lo] = lo + 1 < s->n ? s->times_after[lo + 1] + s->times[lo + 1] : 0;
+	}
+
+	int i;
+	for (i = lo; i < s->n; i++) {
+		s->counts_accum[i] += count;
+	}
+	for (i = 0; i < lo; i++) {
+		s->times_after[i] += time;
+	}
+
+	s->times[lo] += time;
+	s->total_time += time;
+}
+
+static struct category_allocation_sums *category_allocation_sums_from_histogram(struct histogram *h)
+{
+	struct category_allocation_sums *s = category_allocation_sums_create(h);
+
+	double *keys = histogram_buckets(h);
+
+	int i;
+	for (i = 0; i < histogram_size(h); i++) {
+		double *time_value = (double *)histogram_get_data(h, keys[i]);
+		category_allocation_sums_add(s, keys[i], histogram_count(h, keys[i]), *time_value);
+	}
+
+	free(keys);
+
+	return s;
+}
+
 struct category *category_create(const char *name)
 {
 	if (!name)
@@ -58,6 +164,7 @@ struct category *category_create(const char *name)
 	c->max_resources_seen = rmsummary_create(-1);
 
 	c->histograms = itable_create(0);
+	c->allocation_sums = itable_create(0);
 
 	if (!bucket_sizes) {
 		bucket_sizes = rmsummary_create(-1);
@@ -74,7 +181,9 @@ struct category *category_create(const char *name)
 		int64_t bucket_size = rmsummary_get_by_offset(bucket_sizes, o);
 		assert(bucket_size > 0);
 
-		itable_insert(c->histograms, o, histogram_create(bucket_size));
+		struct histogram *h = histogram_create(bucket_size);
+		itable_insert(c->histograms, o, h);
+		itable_insert(c->allocation_sums, o, category_allocation_sums_create(h));
 	}
 
 	c->steady_state = 0;
@@ -110,6 +219,8 @@ void category_specify_max_allocation(struct category *c, const struct rmsummary
 	c->max_allocation = rmsummary_create(-1);
 
 	rmsummary_merge_max(c->max_allocation, s);
+
+	c->allocation_cache_valid = 0;
 }
 
 void category_specify_min_allocation(struct category *c, const struct rmsummary *s)
@@ -122,6 +233,8 @@ void category_specify_min_allocation(struct category *c, const struct rmsummary
 	/* consider the minimum allocation as a measurement. This ensures that max
 	 * dynamic allocation is never below min dynamic allocation */
 	rmsummary_merge_max(c->max_resources_seen, s);
+
+	c->allocation_cache_valid = 0;
 }
 
 void category_specify_first_allocation_guess(struct category *c, const struct rmsummary *s)
@@ -136,6 +249,8 @@ void category_specify_first_allocation_guess(struct category *c, const struct rm
 	c->first_allocation = rmsummary_create(-1);
 
 	rmsummary_merge_max(c->first_allocation, s);
+
+	c->allocation_cache_valid = 0;
 }
 
 int category_in_bucketing_mode(struct category *c)
@@ -166,6 +281,8 @@ void category_specify_allocation_mode(struct category *c, int mode)
 	c->autolabel_resource->memory = autolabel;
 	c->autolabel_resource->disk = autolabel;
 	c->autolabel_resource->gpus = 0;
+
+	c->allocation_cache_valid = 0;
 }
 
 /* set autolabel per resource. */
@@ -206,6 +323,7 @@ static void category_clear_histograms(struct category *c)
 		assert(h);
 
 		category_clear_histogram(h);
+		category_allocation_sums_clear(itable_lookup(c->allocation_sums, o));
 	}
 }
 
@@ -224,9 +342,11 @@ static void category_delete_histograms(struct category *c)
 		assert(h);
 
 		histogram_delete(h);
+		category_allocation_sums_delete(itable_lookup(c->allocation_sums, o));
 	}
 
 	itable_delete(c->histograms);
+	itable_delete(c->allocation_sums);
 }
 
 void category_delete(struct hash_table *categories, const char *name)
@@ -244,6 +364,9 @@ void category_delete(struct hash_table *categories, const char *name)
 	if (c->wq_stats)
 		free(c->wq_stats);
 
+	quantile_sketch_delete(c->wq_task_times);
+	quantile_sketch_delete(c->vine_task_times);
+
 	if (c->vine_stats)
 		free(c->vine_stats);
 
@@ -281,6 +404,19 @@ void category_inc_histogram_count(struct histogram *h, double value, double wall
 	}
 }
 
+static void category_inc_resource(struct category *c, size_t o, double value, double wall_time)
+{
+	struct histogram *h = itable_lookup(c->histograms, o);
+	assert(h);
+
+	category_inc_histogram_count(h, value, wall_time);
+
+	if (value >= 0 && wall_time >= 0) {
+		struct category_allocation_sums *s = itable_lookup(c->allocation_sums, o);
+		category_allocation_sums_add(s, histogram_round_up(h, value), 1, wall_time / USECOND);
+	}
+}
+
 void category_first_allocation_accum_times(struct histogram *h, double *keys, double *tau_mean, double *counts_accum, double *times_accum)
 {
 
@@ -327,24 +463,20 @@ void category_first_allocation_accum_times(struct histogram *h, double *keys, do
 	free(times_values);
 }
 
-int64_t category_first_allocation_min_waste(struct histogram *h, int64_t top_resource)
+static int64_t category_first_allocation_min_waste_sums(struct category_allocation_sums *s, int64_t top_resource)
 {
 	/* Automatically labeling for resource is not activated. */
 	if (top_resource < 0) {
 		return -1;
 	}
 
-	int64_t n = histogram_size(h);
+	int64_t n = s->n;
 
 	if (n < 1)
 		return -1;
 
-	double *keys = histogram_buckets(h);
-	double tau_mean;
-	double *counts_accum = malloc(n * sizeof(double));
-	double *times_accum = malloc(n * sizeof(double));
-
-	category_first_allocation_accum_times(h, keys, &tau_mean, counts_accum, times_accum);
+	double total_count = s->counts_accum[n - 1];
+	double tau_mean = s->total_time / total_count;
 
 	int64_t a_1 = top_resource;
 	int64_t a_m = top_resource;
@@ -353,14 +485,17 @@ int64_t category_first_allocation_min_waste(struct histogram *h, int64_t top_res
 
 	int i;
 	for (i = 0; i < n; i++) {
-		int64_t a = keys[i];
+		int64_t a = s->keys[i];
 		double Ea;
 
 		if (a < 1) {
 			continue;
 		}
 
-		Ea = a * tau_mean + a_m * times_accum[i];
+		/* proportion of mean time for buckets larger than i. */
+		double times_accum = s->times_after[i] / total_count;
+
+		Ea = a * tau_mean + a_m * times_accum;
 
 		if (Ea < Ea_1) {
 			Ea_1 = Ea;
@@ -372,34 +507,35 @@ int64_t category_first_allocation_min_waste(struct histogram *h, int64_t top_res
 		a_1 = top_resource;
 	}
 
-	free(counts_accum);
-	free(times_accum);
-	free(keys);
-
 	/* round up to bucket size */
-	a_1 = histogram_round_up(h, a_1);
+	a_1 = histogram_round_up(s->h, a_1);
 
 	return a_1;
 }
 
-int64_t category_first_allocation_max_throughput(struct histogram *h, int64_t top_resource)
+int64_t category_first_allocation_min_waste(struct histogram *h, int64_t top_resource)
+{
+	struct category_allocation_sums *s = category_allocation_sums_from_histogram(h);
+	int64_t a_1 = category_first_allocation_min_waste_sums(s, top_resource);
+	category_allocation_sums_delete(s);
+
+	return a_1;
+}
+
+static int64_t category_first_allocation_max_throughput_sums(struct category_allocation_sums *s, int64_t top_resource)
 {
 	/* Automatically labeling for resource is not activated. */
 	if (top_resource < 0) {
 		return -1;
 	}
 
-	int64_t n = histogram_size(h);
+	int64_t n = s->n;
 
 	if (n < 1)
 		return -1;
 
-	double *keys = histogram_buckets(h);
-	double tau_mean;
-	double *counts_accum = malloc(n * sizeof(double));
-	double *times_accum = malloc(n * sizeof(double));
-
-	category_first_allocation_accum_times(h, keys, &tau_mean, counts_accum, times_accum);
+	double total_count = s->counts_accum[n - 1];
+	double tau_mean = s->total_time / total_count;
 
 	int64_t a_1 = top_resource;
 	int64_t a_m = top_resource;
@@ -408,7 +544,7 @@ int64_t category_first_allocation_max_throughput(struct histogram *h, int64_t to
 
 	int i;
 	for (i = 0; i < n; i++) {
-		int64_t a = keys[i];
+		int64_t a = s->keys[i];
 
 		if (a < 1) {
 			continue;
@@ -428,11 +564,11 @@ int64_t category_first_allocation_max_throughput(struct histogram *h, int64_t to
 		 * which is what we compute below.
 		 */
 
-		double Pbef = counts_accum[i];
-		double Paft = counts_accum[n - 1] - Pbef;
+		double Pbef = s->counts_accum[i];
+		double Paft = total_count - Pbef;
 
 		double numerator = (Pbef * a_m) / a + Paft;
-		double denominator = tau_mean + times_accum[i];
+		double denominator = tau_mean + s->times_after[i] / total_count;
 
 		double Ta = numerator / denominator;
 
@@ -446,12 +582,17 @@ int64_t category_first_allocation_max_throughput(struct histogram *h, int64_t to
 		a_1 = top_resource;
 	}
 
-	free(counts_accum);
-	free(times_accum);
-	free(keys);
-
 	/* round up to bucket size */
-	a_1 = histogram_round_up(h, a_1);
+	a_1 = histogram_round_up(s->h, a_1);
+
+	return a_1;
+}
+
+int64_t category_first_allocation_max_throughput(struct histogram *h, int64_t top_resource)
+{
+	struct category_allocation_sums *s = category_allocation_sums_from_histogram(h);
+	int64_t a_1 = category_first_allocation_max_throughput_sums(s, top_resource);
+	category_allocation_sums_delete(s);
 
 	return a_1;
 }
@@ -514,6 +655,18 @@ int64_t category_first_allocation(struct histogram *h, category_mode_t mode, int
 	return alloc;
 }
 
+static int64_t category_first_allocation_sums(struct category_allocation_sums *s, category_mode_t mode, int64_t top_resource, int64_t max_worker, int64_t max_explicit)
+{
+	switch (mode) {
+	case CATEGORY_ALLOCATION_MODE_MIN_WASTE:
+		return category_first_allocation_min_waste_sums(s, top_resource);
+	case CATEGORY_ALLOCATION_MODE_MAX_THROUGHPUT:
+		return category_first_allocation_max_throughput_sums(s, top_resource);
+	default:
+		return category_first_allocation(s->h, mode, top_resource, max_worker, max_explicit);
+	}
+}
+
 int category_update_first_allocation(struct category *c, const struct rmsummary *max_worker)
 {
 	/* buffer used only for debug output. */
@@ -534,8 +687,15 @@ int category_update_first_allocation(struct category *c, const struct rmsummary
 	rmsummary_merge_override(top, c->max_resources_seen);
 	rmsummary_merge_override(top, c->max_allocation);
 
-	if (!c->first_allocation) {
+	/* previous allocation, to report whether it changed. */
+	double previous[RMSUMMARY_VECTOR_SIZE];
+	int changed = 0;
+
+	if (c->first_allocation) {
+		rmsummary_to_vector(c->first_allocation, previous);
+	} else {
 		c->first_allocation = rmsummary_create(-1);
+		changed = 1;
 	}
 
 	size_t i;
@@ -544,8 +704,8 @@ int category_update_first_allocation(struct category *c, const struct rmsummary
 		int64_t should_update = rmsummary_get_by_offset(c->autolabel_resource, o);
 
 		if (should_update) {
-			struct histogram *h = itable_lookup(c->histograms, o);
-			assert(h);
+			struct category_allocation_sums *s = itable_lookup(c->allocation_sums, o);
+			assert(s);
 
 			int64_t top_value = rmsummary_get_by_offset(top, o);
 			int64_t max_explicit = rmsummary_get_by_offset(c->max_allocation, o);
@@ -555,7 +715,7 @@ int category_update_first_allocation(struct category *c, const struct rmsummary
 				worker = rmsummary_get_by_offset(max_worker, o);
 			}
 
-			int64_t new_value = category_first_allocation(h, c->allocation_mode, top_value, worker, max_explicit);
+			int64_t new_value = category_first_allocation_sums(s, c->allocation_mode, top_value, worker, max_explicit);
 
 			rmsummary_set_by_offset(c->first_allocation, o, new_value);
 		}
@@ -564,6 +724,24 @@ int category_update_first_allocation(struct category *c, const struct rmsummary
 	/* don't go below min allocation */
 	rmsummary_merge_max(c->first_allocation, c->min_allocation);
 
+	if (!changed) {
+		double current[RMSUMMARY_VECTOR_SIZE];
+		rmsummary_to_vector(c->first_allocation, current);
+		for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			if (current[i] != previous[i]) {
+				changed = 1;
+				break;
+			}
+		}
+	}
+
+	if (!changed) {
+		rmsummary_delete(top);
+		return 0;
+	}
+
+	c->allocation_cache_valid = 0;
+
 	/* From here on we only print debugging info. */
 	struct jx *jsum = rmsummary_to_json(c->first_allocation, 1);
 	if (jsum) {
@@ -631,35 +809,43 @@ int category_accumulate_summary(struct category *c, const struct rmsummary *rs,
 		rmsummary_delete(c->first_allocation);
 		c->first_allocation = NULL;
 		c->completions_since_last_reset = 0;
+		c->allocation_cache_valid = 0;
 		update = 1;
 	}
 
-	c->steady_state = c->completions_since_last_reset >= first_allocation_every_n_tasks;
+	int steady_state = c->completions_since_last_reset >= first_allocation_every_n_tasks;
+	if (steady_state != c->steady_state) {
+		c->steady_state = steady_state;
+		c->allocation_cache_valid = 0;
+	}
 
 	int i;
 	for (i = 0; labeled_resources[i]; i++) {
 		const size_t o = labeled_resources[i];
-		double max = MAX(rmsummary_get_by_offset(rs, o), rmsummary_get_by_offset(c->max_resources_seen, o));
-		rmsummary_set_by_offset(c->max_resources_seen, o, max);
+		double seen = rmsummary_get_by_offset(c->max_resources_seen, o);
+		double max = MAX(rmsummary_get_by_offset(rs, o), seen);
+		if (max != seen) {
+			rmsummary_set_by_offset(c->max_resources_seen, o, max);
+			c->allocation_cache_valid = 0;
+		}
 	}
 	if (rs && (!rs->exit_type || !strcmp(rs->exit_type, "normal"))) {
 		size_t i;
 		for (i = 0; labeled_resources[i]; i++) {
 			const size_t o = labeled_resources[i];
 
-			struct histogram *h = itable_lookup(c->histograms, o);
-			assert(h);
-
 			double value = rmsummary_get_by_offset(rs, o);
 			double wall_time = rs->wall_time;
 
-			category_inc_histogram_count(h, value, wall_time);
+			category_inc_resource(c, o, value, wall_time);
 		}
 
 		c->completions_since_last_reset++;
 
+		/* once enough tasks are seen, keep the first allocation current
+		 * after every completion, as it is a single pass over the buckets. */
 		if (first_allocation_every_n_tasks > 0) {
-			if (c->completions_since_last_reset % first_allocation_every_n_tasks == 0) {
+			if (c->completions_since_last_reset >= first_allocation_every_n_tasks) {
 				update |= category_update_first_allocation(c, max_worker);
 			}
 		}
@@ -720,36 +906,44 @@ int category_bucketing_accumulate_summary(struct category *c, const struct rmsum
 		rmsummary_delete(c->first_allocation);
 		c->first_allocation = NULL;
 		c->completions_since_last_reset = 0;
+		c->allocation_cache_valid = 0;
 		update = 1;
 	}
 
-	c->steady_state = c->completions_since_last_reset >= first_allocation_every_n_tasks;
+	int steady_state = c->completions_since_last_reset >= first_allocation_every_n_tasks;
+	if (steady_state != c->steady_state) {
+		c->steady_state = steady_state;
+		c->allocation_cache_valid = 0;
+	}
 
 	/* load new max values */
 	int i;
 	for (i = 0; labeled_resources[i]; i++) {
 		const size_t o = labeled_resources[i];
-		double max = MAX(rmsummary_get_by_offset(rs, o), rmsummary_get_by_offset(c->max_resources_seen, o));
-		rmsummary_set_by_offset(c->max_resources_seen, o, max);
+		double seen = rmsummary_get_by_offset(c->max_resources_seen, o);
+		double max = MAX(rmsummary_get_by_offset(rs, o), seen);
+		if (max != seen) {
+			rmsummary_set_by_offset(c->max_resources_seen, o, max);
+			c->allocation_cache_valid = 0;
+		}
 	}
 	if (rs && (!rs->exit_type || !strcmp(rs->exit_type, "normal"))) {
 		size_t i;
 		for (i = 0; labeled_resources[i]; i++) {
 			const size_t o = labeled_resources[i];
 
-			struct histogram *h = itable_lookup(c->histograms, o);
-			assert(h);
-
 			double value = rmsummary_get_by_offset(rs, o);
 			double wall_time = rs->wall_time;
 
-			category_inc_histogram_count(h, value, wall_time);
+			category_inc_resource(c, o, value, wall_time);
 		}
 
 		c->completions_since_last_reset++;
 
+		/* once enough tasks are seen, keep the first allocation current
+		 * after every completion, as it is a single pass over the buckets. */
 		if (first_allocation_every_n_tasks > 0) {
-			if (c->completions_since_last_reset % first_allocation_every_n_tasks == 0) {
+			if (c->completions_since_last_reset >= first_allocation_every_n_tasks) {
 				update |= category_update_first_allocation(c, max_worker);
 			}
 		}
@@ -776,6 +970,7 @@ void categories_initialize(struct hash_table *categories, struct rmsummary *top,
 		if (c->first_allocation) {
 			rmsummary_delete(c->first_allocation);
 			c->first_allocation = rmsummary_create(-1);
+			c->allocation_cache_valid = 0;
 		}
 	}
 
@@ -849,46 +1044,103 @@ category_allocation_t category_next_label(struct category *c, category_allocatio
 	return current_label;
 }
 
-// taskid >=0 means real task needs prediction, -1 means function called for other purposes
-const struct rmsummary *category_task_max_resources(struct category *c, struct rmsummary *user, category_allocation_t request, int taskid)
+/* Fill v with the allocation of the category for request, before the values
+ * of a particular task are applied. In the bucketing modes, prediction gives
+ * the values computed for the task by the bucketing manager. */
+static void category_allocation_vector(struct category *c, category_allocation_t request, const struct rmsummary *prediction, double *v)
 {
-	/* we keep an internal label so that the caller does not have to worry
-	 * about memory leaks. */
-	static struct rmsummary *internal = NULL;
-
-	if (internal) {
-		rmsummary_delete(internal);
-	}
+	double other[RMSUMMARY_VECTOR_SIZE];
 
-	internal = rmsummary_create(-1);
+	rmsummary_vector_fill(v, -1);
 
 	if (c->allocation_mode != CATEGORY_ALLOCATION_MODE_FIXED && c->allocation_mode != CATEGORY_ALLOCATION_MODE_MAX) {
 		if (category_in_steady_state(c) && (c->allocation_mode == CATEGORY_ALLOCATION_MODE_MIN_WASTE || c->allocation_mode == CATEGORY_ALLOCATION_MODE_MAX_THROUGHPUT)) {
 			/* load max seen values, but only if not in fixed or max mode.
 			 * In max mode, max seen is the first allocation, and next allocation
 			 * is to use whole workers. */
-			rmsummary_merge_override(internal, c->max_resources_seen);
+			rmsummary_to_vector(c->max_resources_seen, other);
+			rmsummary_vector_merge_override(v, other, 1);
 
 			/* Never go below what first_allocation computed */
-			rmsummary_merge_max(internal, c->first_allocation);
-		} else if (taskid >= 0 && category_in_bucketing_mode(c)) {
-			struct rmsummary *bucketing_prediction = bucketing_manager_predict(c->bucketing_manager, taskid);
-			rmsummary_merge_override(internal, bucketing_prediction);
-			rmsummary_delete(bucketing_prediction);
+			if (c->first_allocation) {
+				rmsummary_to_vector(c->first_allocation, other);
+				rmsummary_vector_merge_max(v, other, 1);
+			}
+		} else if (prediction) {
+			rmsummary_to_vector(prediction, other);
+			rmsummary_vector_merge_override(v, other, 1);
 		}
 	}
 
 	/* load explicit category max values */
-	rmsummary_merge_override(internal, c->max_allocation);
+	rmsummary_to_vector(c->max_allocation, other);
+	rmsummary_vector_merge_override(v, other, 1);
 
-	if (category_in_steady_state(c) && request == CATEGORY_ALLOCATION_FIRST &&
+	if (category_in_steady_state(c) && request == CATEGORY_ALLOCATION_FIRST && c->first_allocation &&
 			(c->allocation_mode == CATEGORY_ALLOCATION_MODE_MIN_WASTE || c->allocation_mode == CATEGORY_ALLOCATION_MODE_MAX_THROUGHPUT ||
 					c->allocation_mode == CATEGORY_ALLOCATION_MODE_MAX)) {
-		rmsummary_merge_override(internal, c->first_allocation);
+		rmsummary_to_vector(c->first_allocation, other);
+		rmsummary_vector_merge_override(v, other, 1);
+	}
+}
+
+/* Recompute the allocations of the category that do not depend on a task.
+ * They only change when a summary is accumulated or the category is
+ * specified again, so the tasks dispatched in between reuse them. */
+static void category_update_allocation_cache(struct category *c)
+{
+	category_allocation_vector(c, CATEGORY_ALLOCATION_FIRST, NULL, c->allocation_cache[0]);
+	category_allocation_vector(c, CATEGORY_ALLOCATION_MAX, NULL, c->allocation_cache[1]);
+
+	struct rmsummary *seen = rmsummary_create(-1);
+	if (c->allocation_mode != CATEGORY_ALLOCATION_MODE_FIXED) {
+		size_t i;
+		for (i = 0; labeled_resources[i]; i++) {
+			const size_t o = labeled_resources[i];
+			rmsummary_set_by_offset(seen, o, rmsummary_get_by_offset(c->max_resources_seen, o));
+		}
+	}
+	rmsummary_to_vector(seen, c->seen_allocation_cache);
+	rmsummary_delete(seen);
+
+	rmsummary_to_vector(c->min_allocation, c->min_allocation_cache);
+
+	c->allocation_cache_valid = 1;
+}
+
+// taskid >=0 means real task needs prediction, -1 means function called for other purposes
+const struct rmsummary *category_task_max_resources(struct category *c, struct rmsummary *user, category_allocation_t request, int taskid)
+{
+	/* we keep an internal label so that the caller does not have to worry
+	 * about memory leaks. */
+	static struct rmsummary *internal = NULL;
+
+	if (!internal) {
+		internal = rmsummary_create(-1);
+	}
+
+	double v[RMSUMMARY_VECTOR_SIZE];
+
+	if (taskid >= 0 && category_in_bucketing_mode(c)) {
+		/* predictions are drawn per task, so they are never cached. */
+		struct rmsummary *bucketing_prediction = bucketing_manager_predict(c->bucketing_manager, taskid);
+		category_allocation_vector(c, request, bucketing_prediction, v);
+		rmsummary_delete(bucketing_prediction);
+	} else {
+		if (!c->allocation_cache_valid) {
+			category_update_allocation_cache(c);
+		}
+		memcpy(v, c->allocation_cache[request == CATEGORY_ALLOCATION_FIRST ? 0 : 1], sizeof(v));
 	}
 
 	/* chip in user values if explicitly given */
-	rmsummary_merge_override(internal, user);
+	if (user) {
+		double u[RMSUMMARY_VECTOR_SIZE];
+		rmsummary_to_vector(user, u);
+		rmsummary_vector_merge_override(v, u, 1);
+	}
+
+	rmsummary_from_vector(internal, v);
 
 	return internal;
 }
@@ -898,28 +1150,27 @@ const struct rmsummary *category_task_min_resources(struct category *c, struct r
 	static struct rmsummary *internal = NULL;
 	const struct rmsummary *allocation = category_task_max_resources(c, user, request, taskid);
 
-	if (internal) {
-		rmsummary_delete(internal);
+	if (!internal) {
+		internal = rmsummary_create(-1);
 	}
 
-	internal = rmsummary_create(-1);
+	if (!c->allocation_cache_valid) {
+		category_update_allocation_cache(c);
+	}
 
 	/* load seen values */
-	struct rmsummary *seen = c->max_resources_seen;
-	if (c->allocation_mode != CATEGORY_ALLOCATION_MODE_FIXED) {
-		size_t i;
-		for (i = 0; labeled_resources[i]; i++) {
-			const size_t o = labeled_resources[i];
-			/* set internal to seen value */
-			rmsummary_set_by_offset(internal, o, rmsummary_get_by_offset(seen, o));
-		}
-	}
+	double v[RMSUMMARY_VECTOR_SIZE];
+	memcpy(v, c->seen_allocation_cache, sizeof(v));
 
 	/* prefer first allocation (if available) to maximum seen. */
-	rmsummary_merge_override(internal, allocation);
+	double a[RMSUMMARY_VECTOR_SIZE];
+	rmsummary_to_vector(allocation, a);
+	rmsummary_vector_merge_override(v, a, 1);
 
 	/* but don't go below the minimum defined for the category. */
-	rmsummary_merge_max(internal, c->min_allocation);
+	rmsummary_vector_merge_max(v, c->min_allocation_cache, 1);
+
+	rmsummary_from_vector(internal, v);
 
 	/* nor below the observed sandboxes if not in an auto mode */
 	if (c->allocation_mode == CATEGORY_ALLOCATION_MODE_FIXED && user && user->disk < 0) {
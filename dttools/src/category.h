@@ -13,6 +13,8 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "itable.h"
 #include "histogram.h"
+#include "quantile_sketch.h"
+#include "rmsummary.h"
 #include "timestamp.h"
 #include "bucketing_manager.h"
 
@@ -82,6 +84,10 @@ struct category {
 
 	struct itable *histograms;
 
+	/* per labeled resource, the cumulative counts and times of its histogram,
+	 * kept as tasks are accumulated to compute first allocations. */
+	struct itable *allocation_sums;
+
     /* manager for bucketing mode, if applicable */
     bucketing_manager_t* bucketing_manager;
 
@@ -97,12 +103,26 @@ struct category {
 	/* category is somewhat confident of the maximum seen value. */
 	int steady_state;
 
+	/* allocations computed from the state of the category, without task
+	 * specific values, reused by task_max/min_resources until the category
+	 * changes. Indexed by whether the request is for the first allocation. */
+	double allocation_cache[2][RMSUMMARY_VECTOR_SIZE];
+	double seen_allocation_cache[RMSUMMARY_VECTOR_SIZE];
+	double min_allocation_cache[RMSUMMARY_VECTOR_SIZE];
+	int allocation_cache_valid;
+
 	/* stats for work queue */
 	uint64_t average_task_time;
+
+	/* times of successful tasks, and the quantile of them used for fast abort (0 uses the average). */
+	struct quantile_sketch *wq_task_times;
+	double fast_abort_quantile;
+	uint64_t quantile_task_time;
 	struct work_queue_stats *wq_stats;
 
 	/* stats for taskvine */
 	struct vine_stats *vine_stats;
+	struct quantile_sketch *vine_task_times;
 
 	/* Max sandbox disk space observed, in MB. This is the minimum sandbox size needed if nothing else is known about the task.*/
 	int64_t min_vine_sandbox;
@@ -132,6 +152,7 @@ int category_bucketing_accumulate_summary(struct category *c, const struct rmsum
 
 int category_in_bucketing_mode(struct category* c);
 
+/* recompute the first allocation of the category from its histograms. Returns 1 if it changed. */
 int category_update_first_allocation(struct category *c, const struct rmsummary *max_worker);
 
 int category_in_steady_state(struct category *c);
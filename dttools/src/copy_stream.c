@@ -15,6 +15,10 @@ See the file COPYING for details.
 #include <sys/types.h>
 #include <unistd.h>
 
+#if defined(CCTOOLS_OPSYS_LINUX)
+#include <sys/sendfile.h>
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <signal.h>
@@ -50,10 +54,57 @@ int64_t copy_fd_to_stream(int fd, FILE *output)
 	return total;
 }
 
+#if defined(CCTOOLS_OPSYS_LINUX)
+/*
+Copy within the kernel, so that the data does not go through user space:
+with copy_file_range, which also lets the filesystem clone or share blocks,
+and otherwise with sendfile. Returns -1 without copying anything if neither
+applies to these descriptors, or if neither copies anything, as happens with
+some special files, and the caller falls back to read and write.
+*/
+static int64_t copy_fd_to_fd_kernel(int in, int out)
+{
+	int64_t total = 0;
+	int use_sendfile = 0;
+
+	while (1) {
+		ssize_t chunk;
+		if (use_sendfile) {
+			chunk = sendfile(out, in, 0, 1 << 30);
+		} else {
+			chunk = copy_file_range(in, 0, out, 0, 1 << 30, 0);
+		}
+
+		if (chunk > 0) {
+			total += chunk;
+		} else if (chunk == 0 && total > 0) {
+			break;
+		} else if (chunk < 0 && errno == EINTR) {
+			continue;
+		} else if (total == 0 && !use_sendfile) {
+			use_sendfile = 1;
+		} else if (total == 0) {
+			return -1;
+		} else {
+			break;
+		}
+	}
+
+	return total;
+}
+#endif
+
 int64_t copy_fd_to_fd(int in, int out)
 {
 	int64_t total = 0;
 
+#if defined(CCTOOLS_OPSYS_LINUX)
+	total = copy_fd_to_fd_kernel(in, out);
+	if (total >= 0)
+		return total;
+	total = 0;
+#endif
+
 	while (1) {
 		char buffer[COPY_BUFFER_SIZE];
 
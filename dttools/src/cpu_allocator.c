@@ -0,0 +1,400 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "cpu_allocator.h"
+#include "buffer.h"
+#include "debug.h"
+#include "load_average.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* The policy of set_mempolicy that prefers, but does not require, the given node. */
+#define CPU_ALLOCATOR_MPOL_PREFERRED 1
+
+/* The highest CPU number considered, which bounds the lists we will parse. */
+#define CPU_ALLOCATOR_MAX 65536
+
+struct cpu_allocator {
+	int ncpus;   /* One more than the highest CPU number. */
+	int nnodes;
+	int *node;   /* The node of each CPU, or -1 if it is not managed. */
+	char *used;  /* Whether each CPU is allocated. */
+	int total;
+	int available;
+	cpu_allocator_policy_t policy;
+};
+
+/*
+Call f for each CPU of a list such as "0-3,8".
+Returns false if the list is not valid.
+*/
+
+static int cpulist_foreach(const char *list, void (*f)(struct cpu_allocator *a, int cpu, void *arg), struct cpu_allocator *a, void *arg)
+{
+	const char *s = list;
+
+	while (*s && *s != '\n') {
+		char *end;
+		long first = strtol(s, &end, 10);
+		if (end == s || first < 0 || first >= CPU_ALLOCATOR_MAX)
+			return 0;
+		long last = first;
+		s = end;
+		if (*s == '-') {
+			s++;
+			last = strtol(s, &end, 10);
+			if (end == s || last < first || last >= CPU_ALLOCATOR_MAX)
+				return 0;
+			s = end;
+		}
+		for (long cpu = first; cpu <= last; cpu++)
+			f(a, cpu, arg);
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return 0;
+	}
+
+	return 1;
+}
+
+static void cpulist_max(struct cpu_allocator *a, int cpu, void *arg)
+{
+	if (cpu >= a->ncpus)
+		a->ncpus = cpu + 1;
+}
+
+static void cpulist_set_node(struct cpu_allocator *a, int cpu, void *arg)
+{
+	if (a->node[cpu] < 0)
+		a->total++;
+	a->node[cpu] = *(int *)arg;
+}
+
+static void cpulist_release(struct cpu_allocator *a, int cpu, void *arg)
+{
+	if (cpu < a->ncpus && a->node[cpu] >= 0 && a->used[cpu]) {
+		a->used[cpu] = 0;
+		a->available++;
+	}
+}
+
+static void cpulist_node(struct cpu_allocator *a, int cpu, void *arg)
+{
+	int *node = arg;
+	int n = cpu < a->ncpus ? a->node[cpu] : -1;
+	if (*node == -2)
+		*node = n;
+	else if (*node != n)
+		*node = -1;
+}
+
+/* Format the CPUs marked in chosen as a list, joining consecutive CPUs into ranges. */
+
+static char *cpulist_format(const char *chosen, int ncpus)
+{
+	buffer_t b;
+	buffer_init(&b);
+
+	int cpu = 0;
+	while (cpu < ncpus) {
+		if (!chosen[cpu]) {
+			cpu++;
+			continue;
+		}
+		int last = cpu;
+		while (last + 1 < ncpus && chosen[last + 1])
+			last++;
+		if (buffer_pos(&b) > 0)
+			buffer_putliteral(&b, ",");
+		if (last > cpu)
+			buffer_printf(&b, "%d-%d", cpu, last);
+		else
+			buffer_printf(&b, "%d", cpu);
+		cpu = last + 1;
+	}
+
+	char *result = xxstrdup(buffer_tostring(&b));
+	buffer_free(&b);
+	return result;
+}
+
+struct cpu_allocator *cpu_allocator_create_nodes(int nnodes, const char **cpulists)
+{
+	struct cpu_allocator *a = xxmalloc(sizeof(*a));
+	memset(a, 0, sizeof(*a));
+	a->nnodes = nnodes;
+
+	for (int i = 0; i < nnodes; i++) {
+		if (!cpulist_foreach(cpulists[i], cpulist_max, a, 0)) {
+			debug(D_NOTICE, "invalid list of cpus: %s", cpulists[i]);
+			free(a);
+			return 0;
+		}
+	}
+
+	a->node = xxmalloc(sizeof(*a->node) * (a->ncpus + 1));
+	a->used = xxmalloc(a->ncpus + 1);
+	for (int cpu = 0; cpu < a->ncpus; cpu++) {
+		a->node[cpu] = -1;
+		a->used[cpu] = 0;
+	}
+
+	for (int i = 0; i < nnodes; i++)
+		cpulist_foreach(cpulists[i], cpulist_set_node, a, &i);
+
+	a->available = a->total;
+
+	return a;
+}
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+
+static char *cpu_allocator_read_line(const char *path)
+{
+	char line[4096];
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return 0;
+	char *result = fgets(line, sizeof(line), file) ? xxstrdup(line) : 0;
+	fclose(file);
+	return result;
+}
+
+struct cpu_allocator *cpu_allocator_create()
+{
+	cpu_set_t *mask = CPU_ALLOC(CPU_ALLOCATOR_MAX);
+	size_t size = CPU_ALLOC_SIZE(CPU_ALLOCATOR_MAX);
+	CPU_ZERO_S(size, mask);
+
+	if (sched_getaffinity(0, size, mask) != 0) {
+		debug(D_NOTICE, "couldn't get the cpus of this process: %s", strerror(errno));
+		CPU_FREE(mask);
+		return 0;
+	}
+
+	/* Read the cpus of each numa node, or treat the host as a single node. */
+	int nnodes = 0;
+	char **cpulists = 0;
+	while (1) {
+		char *path = string_format("/sys/devices/system/node/node%d/cpulist", nnodes);
+		char *list = cpu_allocator_read_line(path);
+		free(path);
+		if (!list)
+			break;
+		cpulists = xxrealloc(cpulists, sizeof(*cpulists) * (nnodes + 1));
+		cpulists[nnodes++] = list;
+	}
+
+	if (nnodes == 0) {
+		int last = 0;
+		for (int cpu = 0; cpu < CPU_ALLOCATOR_MAX; cpu++) {
+			if (CPU_ISSET_S(cpu, size, mask))
+				last = cpu;
+		}
+		cpulists = xxmalloc(sizeof(*cpulists));
+		cpulists[nnodes++] = string_format("0-%d", last);
+	}
+
+	struct cpu_allocator *a = cpu_allocator_create_nodes(nnodes, (const char **)cpulists);
+
+	for (int i = 0; i < nnodes; i++)
+		free(cpulists[i]);
+	free(cpulists);
+
+	if (!a) {
+		CPU_FREE(mask);
+		return 0;
+	}
+
+	/* Only manage the cpus this process is allowed to use, as in a container or batch slot. */
+	for (int cpu = 0; cpu < a->ncpus; cpu++) {
+		if (a->node[cpu] >= 0 && !CPU_ISSET_S(cpu, size, mask)) {
+			a->node[cpu] = -1;
+			a->total--;
+			a->available--;
+		}
+	}
+
+	CPU_FREE(mask);
+
+	debug(D_DEBUG, "allocating %d cpus on %d numa nodes", a->total, a->nnodes);
+
+	return a;
+}
+
+struct cpulist_mask {
+	cpu_set_t *mask;
+	size_t size;
+};
+
+static void cpulist_set_mask(struct cpu_allocator *a, int cpu, void *arg)
+{
+	struct cpulist_mask *m = arg;
+	CPU_SET_S(cpu, m->size, m->mask);
+}
+
+int cpu_allocator_bind(struct cpu_allocator *a, const char *cpus)
+{
+	struct cpulist_mask m;
+	m.mask = CPU_ALLOC(CPU_ALLOCATOR_MAX);
+	m.size = CPU_ALLOC_SIZE(CPU_ALLOCATOR_MAX);
+	CPU_ZERO_S(m.size, m.mask);
+
+	if (!cpulist_foreach(cpus, cpulist_set_mask, a, &m)) {
+		CPU_FREE(m.mask);
+		return 0;
+	}
+
+	int result = sched_setaffinity(0, m.size, m.mask);
+	CPU_FREE(m.mask);
+
+	if (result != 0) {
+		debug(D_DEBUG, "couldn't bind to cpus %s: %s", cpus, strerror(errno));
+		return 0;
+	}
+
+	/* A failure to set the memory policy only loses locality, so it is not an error. */
+	int node = cpu_allocator_node(a, cpus);
+	if (a->nnodes > 1 && node >= 0 && node < (int)(8 * sizeof(unsigned long))) {
+		unsigned long nodemask = 1UL << node;
+		syscall(SYS_set_mempolicy, CPU_ALLOCATOR_MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask));
+	}
+
+	return 1;
+}
+
+#else
+
+struct cpu_allocator *cpu_allocator_create()
+{
+	char *list = string_format("0-%d", load_average_get_cpus() - 1);
+	struct cpu_allocator *a = cpu_allocator_create_nodes(1, (const char **)&list);
+	free(list);
+	return a;
+}
+
+int cpu_allocator_bind(struct cpu_allocator *a, const char *cpus)
+{
+	debug(D_DEBUG, "binding to cpus is not supported on this platform");
+	return 0;
+}
+
+#endif
+
+void cpu_allocator_delete(struct cpu_allocator *a)
+{
+	if (!a)
+		return;
+	free(a->node);
+	free(a->used);
+	free(a);
+}
+
+void cpu_allocator_set_policy(struct cpu_allocator *a, cpu_allocator_policy_t policy)
+{
+	a->policy = policy;
+}
+
+/*
+Prefer the node with the fewest free cpus that is still large enough, to keep
+the larger nodes whole for larger requests, or with the spread policy the node
+with the most free cpus.  Otherwise, take the free cpus of the nodes with the
+most free cpus, to span as few nodes as possible.
+*/
+
+static int cpu_allocator_better_fit(struct cpu_allocator *a, int count, int best_count)
+{
+	if (a->policy == CPU_ALLOCATOR_SPREAD)
+		return count > best_count;
+	else
+		return count < best_count;
+}
+
+char *cpu_allocator_alloc(struct cpu_allocator *a, int cores)
+{
+	if (cores < 1 || cores > a->available)
+		return 0;
+
+	int *free_count = xxmalloc(sizeof(*free_count) * (a->nnodes + 1));
+	memset(free_count, 0, sizeof(*free_count) * (a->nnodes + 1));
+	for (int cpu = 0; cpu < a->ncpus; cpu++) {
+		if (a->node[cpu] >= 0 && !a->used[cpu])
+			free_count[a->node[cpu]]++;
+	}
+
+	char *chosen = xxmalloc(a->ncpus + 1);
+	memset(chosen, 0, a->ncpus + 1);
+
+	int needed = cores;
+	while (needed > 0) {
+		int best = -1;
+		for (int n = 0; n < a->nnodes; n++) {
+			if (free_count[n] >= needed && (best < 0 || cpu_allocator_better_fit(a, free_count[n], free_count[best])))
+				best = n;
+		}
+		if (best < 0) {
+			for (int n = 0; n < a->nnodes; n++) {
+				if (free_count[n] > 0 && (best < 0 || free_count[n] > free_count[best]))
+					best = n;
+			}
+		}
+
+		for (int cpu = 0; cpu < a->ncpus && needed > 0 && free_count[best] > 0; cpu++) {
+			if (a->node[cpu] == best && !a->used[cpu]) {
+				a->used[cpu] = 1;
+				chosen[cpu] = 1;
+				free_count[best]--;
+				needed--;
+			}
+		}
+	}
+
+	a->available -= cores;
+
+	char *result = cpulist_format(chosen, a->ncpus);
+	free(chosen);
+	free(free_count);
+
+	return result;
+}
+
+void cpu_allocator_release(struct cpu_allocator *a, const char *cpus)
+{
+	if (cpus)
+		cpulist_foreach(cpus, cpulist_release, a, 0);
+}
+
+int cpu_allocator_node(struct cpu_allocator *a, const char *cpus)
+{
+	int node = -2;
+	if (!cpulist_foreach(cpus, cpulist_node, a, &node))
+		return -1;
+	return node < 0 ? -1 : node;
+}
+
+int cpu_allocator_total(struct cpu_allocator *a)
+{
+	return a->total;
+}
+
+int cpu_allocator_available(struct cpu_allocator *a)
+{
+	return a->available;
+}
+
+/* vim: set noexpandtab tabstop=8: */
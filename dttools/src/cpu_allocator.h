@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef CPU_ALLOCATOR_H
+#define CPU_ALLOCATOR_H
+
+/** @file cpu_allocator.h
+Allocate disjoint sets of CPUs to concurrent processes.
+An allocator keeps track of which CPUs of the host are in use, and gives
+each request a set of free CPUs, taken from a single NUMA node when one
+has enough of them, so that the processes do not compete for the same
+cores and caches.  Sets of CPUs are given as lists in the format of the
+Linux kernel, such as <tt>0-3,8</tt>.
+*/
+
+struct cpu_allocator;
+
+/** How an allocator chooses the node of a request that fits in one node. */
+typedef enum {
+	CPU_ALLOCATOR_COMPACT, /**< The fullest node, keeping the others whole for larger requests. (default) */
+	CPU_ALLOCATOR_SPREAD,  /**< The emptiest node, so that processes share the memory bandwidth of fewer others. */
+} cpu_allocator_policy_t;
+
+/** Create an allocator for the CPUs that this process may run on,
+grouped by the NUMA nodes of the host.
+@return A new allocator, or null if the CPUs could not be determined.
+*/
+struct cpu_allocator *cpu_allocator_create();
+
+/** Create an allocator for a given set of NUMA nodes.
+@param nnodes The number of nodes.
+@param cpulists The list of CPUs of each node.
+@return A new allocator, or null if a list is not valid.
+*/
+struct cpu_allocator *cpu_allocator_create_nodes(int nnodes, const char **cpulists);
+
+/** Delete an allocator.
+@param a The allocator to delete.
+*/
+void cpu_allocator_delete(struct cpu_allocator *a);
+
+/** Set how the allocator chooses among the nodes that fit a request.
+@param a The allocator.
+@param policy The policy, CPU_ALLOCATOR_COMPACT by default.
+*/
+void cpu_allocator_set_policy(struct cpu_allocator *a, cpu_allocator_policy_t policy);
+
+/** Allocate a set of free CPUs.
+@param a The allocator.
+@param cores The number of CPUs needed.
+@return The list of CPUs allocated, which must be freed by the caller,
+or null if there are not enough free CPUs.
+*/
+char *cpu_allocator_alloc(struct cpu_allocator *a, int cores);
+
+/** Return a set of CPUs to the allocator.
+@param a The allocator.
+@param cpus A list returned by @ref cpu_allocator_alloc.
+*/
+void cpu_allocator_release(struct cpu_allocator *a, const char *cpus);
+
+/** Restrict the calling process to a set of CPUs.
+If the CPUs belong to a single NUMA node, memory is preferably allocated
+from that node as well.  Typically called by a child process before exec.
+@param a The allocator.
+@param cpus A list returned by @ref cpu_allocator_alloc.
+@return True on success, false otherwise.
+*/
+int cpu_allocator_bind(struct cpu_allocator *a, const char *cpus);
+
+/** Get the NUMA node of a set of CPUs.
+@param a The allocator.
+@param cpus A list of CPUs.
+@return The node of all of the CPUs, or -1 if they span several nodes.
+*/
+int cpu_allocator_node(struct cpu_allocator *a, const char *cpus);
+
+/** Get the number of CPUs managed by the allocator.
+@param a The allocator.
+@return The number of CPUs.
+*/
+int cpu_allocator_total(struct cpu_allocator *a);
+
+/** Get the number of free CPUs.
+@param a The allocator.
+@return The number of CPUs not allocated.
+*/
+int cpu_allocator_available(struct cpu_allocator *a);
+
+#endif
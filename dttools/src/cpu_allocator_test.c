@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "cpu_allocator.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPECT(cpus, expected) do { \
+	if (!(cpus) || strcmp((cpus), (expected))) \
+		FAIL("expected cpus %s, got %s", (expected), (cpus) ? (cpus) : "none"); \
+} while(0)
+
+int main(int argc, char **argv)
+{
+	const char *nodes[] = {"0-3,8-11", "4-7,12-15"};
+
+	struct cpu_allocator *a = cpu_allocator_create_nodes(2, nodes);
+	if (!a)
+		FAIL("couldn't create allocator");
+	if (cpu_allocator_total(a) != 16 || cpu_allocator_available(a) != 16)
+		FAIL("expected 16 cpus, found %d", cpu_allocator_total(a));
+
+	/* A request that fits a node stays within it. */
+	char *j1 = cpu_allocator_alloc(a, 6);
+	EXPECT(j1, "0-3,8-9");
+	if (cpu_allocator_node(a, j1) != 0)
+		FAIL("expected %s on node 0", j1);
+
+	/* The fullest node that still fits is used, keeping the other whole. */
+	char *j2 = cpu_allocator_alloc(a, 2);
+	EXPECT(j2, "10-11");
+
+	/* A request larger than any node spans nodes. */
+	char *j3 = cpu_allocator_alloc(a, 8);
+	EXPECT(j3, "4-7,12-15");
+	if (cpu_allocator_available(a) != 0)
+		FAIL("expected no free cpus, found %d", cpu_allocator_available(a));
+	if (cpu_allocator_alloc(a, 1))
+		FAIL("allocated a cpu that is in use");
+
+	cpu_allocator_release(a, j1);
+	cpu_allocator_release(a, j3);
+	if (cpu_allocator_available(a) != 14)
+		FAIL("expected 14 free cpus, found %d", cpu_allocator_available(a));
+
+	char *j4 = cpu_allocator_alloc(a, 12);
+	EXPECT(j4, "0-7,12-15");
+	if (cpu_allocator_node(a, j4) != -1)
+		FAIL("expected %s to span nodes", j4);
+
+	free(j1);
+	free(j2);
+	free(j3);
+	free(j4);
+	cpu_allocator_delete(a);
+
+	/* The spread policy places each request on the emptiest node that fits. */
+	a = cpu_allocator_create_nodes(2, nodes);
+	cpu_allocator_set_policy(a, CPU_ALLOCATOR_SPREAD);
+	j1 = cpu_allocator_alloc(a, 2);
+	EXPECT(j1, "0-1");
+	j2 = cpu_allocator_alloc(a, 2);
+	EXPECT(j2, "4-5");
+	j3 = cpu_allocator_alloc(a, 8);
+	EXPECT(j3, "2-3,6-11");
+	free(j1);
+	free(j2);
+	free(j3);
+	cpu_allocator_delete(a);
+
+	if (cpu_allocator_create_nodes(1, (const char *[]){"0-x"}))
+		FAIL("accepted an invalid list");
+
+	/* The cpus of this host can be bound to. */
+	a = cpu_allocator_create();
+	if (!a)
+		FAIL("couldn't create allocator for this host");
+	char *cpus = cpu_allocator_alloc(a, 1);
+	if (!cpus)
+		FAIL("couldn't allocate a cpu of this host");
+	if (!cpu_allocator_bind(a, cpus))
+		FAIL("couldn't bind to %s", cpus);
+	free(cpus);
+	cpu_allocator_delete(a);
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -15,9 +15,12 @@ See the file COPYING for details.
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -38,6 +41,37 @@ static pid_t (*debug_getpid)(void) = getpid;
 static char debug_program_name[PATH_MAX];
 static int64_t debug_flags = D_NOTICE | D_ERROR | D_FATAL;
 
+/*
+When buffering is enabled, formatted messages are gathered in debug_buffer
+and written out together once it fills, once a second has passed, when an
+error or notice arrives, or when debug_flush is called.  A child process
+discards what it inherited from its parent, which will write it out itself.
+Other threads may log at the same time, so the buffer, the rate limits, and
+the cached local time are only touched while holding debug_buffer_mutex,
+which is also held across fork so that the child never inherits it locked.
+*/
+
+static buffer_t debug_buffer;
+static size_t debug_buffer_size = 0;
+static int64_t debug_buffer_flags = 0;
+static time_t debug_buffer_time = 0;
+static pid_t debug_buffer_pid = 0;
+static pthread_mutex_t debug_buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t debug_buffer_once = PTHREAD_ONCE_INIT;
+
+/*
+When rate limiting is enabled, at most debug_rate_limit messages are shown
+per second for each subsystem flag, and the number suppressed is reported
+when the second is over.  Errors, notices, and fatal messages are never limited.
+*/
+
+#define DEBUG_RATE_FLAGS 64
+
+static int debug_rate_limit = 0;
+static time_t debug_rate_time = 0;
+static int debug_rate_count[DEBUG_RATE_FLAGS];
+static int64_t debug_rate_dropped[DEBUG_RATE_FLAGS];
+
 struct flag_info {
 	const char *name;
 	int64_t flag;
@@ -168,25 +202,110 @@ static const char *debug_flags_to_name(int64_t flags)
 	return "debug";
 }
 
-static void do_debug(int64_t flags, const char *fmt, va_list args)
+static void debug_fork_prepare(void)
+{
+	pthread_mutex_lock(&debug_buffer_mutex);
+}
+
+static void debug_fork_done(void)
+{
+	pthread_mutex_unlock(&debug_buffer_mutex);
+}
+
+static void debug_buffer_init_once(void)
+{
+	pthread_atfork(debug_fork_prepare, debug_fork_done, debug_fork_done);
+}
+
+static void debug_buffer_lock(void)
+{
+	pthread_once(&debug_buffer_once, debug_buffer_init_once);
+	pthread_mutex_lock(&debug_buffer_mutex);
+}
+
+static void debug_buffer_unlock(void)
+{
+	pthread_mutex_unlock(&debug_buffer_mutex);
+}
+
+static void debug_flush_buffer(void)
+{
+	if (debug_buffer_pid != getpid()) {
+		/* These messages were inherited from the parent process. */
+		buffer_rewind(&debug_buffer, 0);
+		debug_buffer_pid = getpid();
+	}
+
+	if (buffer_pos(&debug_buffer) > 0) {
+		debug_write(debug_buffer_flags, buffer_tostring(&debug_buffer));
+		buffer_rewind(&debug_buffer, 0);
+		debug_buffer_flags = 0;
+	}
+}
+
+void debug_flush(void)
+{
+	if (!debug_buffer_size)
+		return;
+
+	debug_buffer_lock();
+	debug_flush_buffer();
+	debug_buffer_unlock();
+}
+
+static void debug_emit(int64_t flags, const char *str, size_t length, time_t now)
+{
+	if (debug_buffer_size == 0) {
+		debug_write(flags, str);
+		return;
+	}
+
+	debug_buffer_lock();
+
+	if (debug_buffer_pid != getpid() || (buffer_pos(&debug_buffer) > 0 && now != debug_buffer_time))
+		debug_flush_buffer();
+
+	if (buffer_pos(&debug_buffer) == 0)
+		debug_buffer_time = now;
+
+	buffer_putlstring(&debug_buffer, str, length);
+	debug_buffer_flags |= flags;
+
+	if (buffer_pos(&debug_buffer) >= debug_buffer_size || (flags & (D_ERROR | D_NOTICE | D_FATAL)))
+		debug_flush_buffer();
+
+	debug_buffer_unlock();
+}
+
+static void do_debug_format(int64_t flags, const char *fmt, va_list args)
 {
 	buffer_t B;
 	char ubuf[1 << 16];
 
+	static struct tm debug_tm;
+	static time_t debug_tm_time = -1;
+	struct timeval tv;
+	struct tm tm;
+
 	buffer_init(&B);
 	buffer_ubuf(&B, ubuf, sizeof(ubuf));
 	buffer_max(&B, sizeof(ubuf));
 
+	gettimeofday(&tv, 0);
+
 	if (debug_write == debug_file_write || debug_write == debug_stderr_write || debug_write == debug_stdout_write) {
-		struct timeval tv;
-		struct tm *tm;
-		gettimeofday(&tv, 0);
-		tm = localtime(&tv.tv_sec);
+		debug_buffer_lock();
+		if (tv.tv_sec != debug_tm_time) {
+			localtime_r(&tv.tv_sec, &debug_tm);
+			debug_tm_time = tv.tv_sec;
+		}
+		tm = debug_tm;
+		debug_buffer_unlock();
 
 		buffer_putfstring(&B, "%lu.%06lu %li %i %i %i ",
 				tv.tv_sec, (long) tv.tv_usec,
 				(long) getpid(),
-				tm->tm_wday, tm->tm_hour, tm->tm_min);
+				tm.tm_wday, tm.tm_hour, tm.tm_min);
 		/* buffer_putfstring(&B, */
 		/* 		"%04d-%02d-%02d %02d:%02d:%02d.%06d ", */
 		/* 		tm->tm_year + 1900, */
@@ -212,7 +331,7 @@ static void do_debug(int64_t flags, const char *fmt, va_list args)
 		buffer_rewind(&B, buffer_pos(&B) - 1); /* chomp whitespace */
 	buffer_putliteral(&B, "\n");
 
-	debug_write(flags, buffer_tostring(&B));
+	debug_emit(flags, buffer_tostring(&B), buffer_pos(&B), tv.tv_sec);
 
 	if (debug_write != debug_stderr_write && (flags & (D_ERROR | D_NOTICE | D_FATAL))) {
 		debug_stderr_write(flags, buffer_tostring(&B));
@@ -221,6 +340,69 @@ static void do_debug(int64_t flags, const char *fmt, va_list args)
 	buffer_free(&B);
 }
 
+static void debug_format(int64_t flags, const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	do_debug_format(flags, fmt, args);
+	va_end(args);
+}
+
+/*
+Return true if a message with these flags is within the rate limit.
+The counts of the previous second are reported after releasing the lock,
+as writing the report takes it again.
+*/
+
+static int debug_rate_check(int64_t flags)
+{
+	if (!debug_rate_limit || !flags || (flags & (D_ERROR | D_NOTICE | D_FATAL)))
+		return 1;
+
+	int64_t dropped[DEBUG_RATE_FLAGS];
+	int report = 0;
+	int allowed = 1;
+	int i;
+
+	time_t now = time(0);
+
+	debug_buffer_lock();
+
+	if (now != debug_rate_time) {
+		debug_rate_time = now;
+		memcpy(dropped, debug_rate_dropped, sizeof(dropped));
+		memset(debug_rate_dropped, 0, sizeof(debug_rate_dropped));
+		memset(debug_rate_count, 0, sizeof(debug_rate_count));
+		report = 1;
+	}
+
+	i = __builtin_ctzll(flags);
+	if (debug_rate_count[i] >= debug_rate_limit) {
+		debug_rate_dropped[i]++;
+		allowed = 0;
+	} else {
+		debug_rate_count[i]++;
+	}
+
+	debug_buffer_unlock();
+
+	if (report) {
+		for (i = 0; i < DEBUG_RATE_FLAGS; i++) {
+			if (dropped[i]) {
+				debug_format(1LL << i, "suppressed %" PRId64 " %s messages over the rate limit", dropped[i], debug_flags_to_name(1LL << i));
+			}
+		}
+	}
+
+	return allowed;
+}
+
+static void do_debug(int64_t flags, const char *fmt, va_list args)
+{
+	if (debug_rate_check(flags))
+		do_debug_format(flags, fmt, args);
+}
+
 void debug(int64_t flags, const char *fmt, ...)
 {
 	if (flags & debug_flags) {
@@ -292,8 +474,28 @@ void debug_config_fatal(void (*callback)())
 	fatal_callback_list = f;
 }
 
+void debug_config_buffer(size_t size)
+{
+	static int initialized = 0;
+
+	debug_flush();
+	if (!initialized && size) {
+		buffer_init(&debug_buffer);
+		buffer_abortonfailure(&debug_buffer, 1);
+		atexit(debug_flush);
+		initialized = 1;
+	}
+	debug_buffer_size = size;
+}
+
+void debug_config_rate_limit(int limit)
+{
+	debug_rate_limit = limit > 0 ? limit : 0;
+}
+
 int debug_config_file_e(const char *path)
 {
+	debug_flush();
 	if (path == NULL || strcmp(path, ":stderr") == 0) {
 		debug_write = debug_stderr_write;
 		return 0;
@@ -343,17 +545,20 @@ void debug_flags_restore(int64_t fl)
 
 void debug_rename(const char *suffix)
 {
+	debug_flush();
 	debug_file_rename(suffix);
 }
 
 void debug_reopen(void)
 {
+	debug_flush();
 	if (debug_file_reopen() == -1)
 		fatal("could not reopen debug log: %s", strerror(errno));
 }
 
 void debug_close(void)
 {
+	debug_flush();
 	debug_file_close();
 }
 
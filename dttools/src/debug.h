@@ -125,6 +125,9 @@ modify the linker namespace we are using.
 #define debug_config_file_size cctools_debug_config_file_size
 #define debug_config_fatal     cctools_debug_config_fatal
 #define debug_config_getpid    cctools_debug_config_getpid
+#define debug_config_buffer    cctools_debug_config_buffer
+#define debug_config_rate_limit cctools_debug_config_rate_limit
+#define debug_flush            cctools_debug_flush
 #define debug_flags_set        cctools_debug_flags_set
 #define debug_flags_print      cctools_debug_flags_print
 #define debug_flags_clear      cctools_debug_flags_clear
@@ -204,6 +207,31 @@ When it exceeds this size, it will be renamed to (file).old, and a new file will
 
 void debug_config_file_size(off_t size);
 
+/** Buffer debug output.
+Rather than writing each message as it is made, gather messages in memory
+and write them together when the buffer fills, when a message arrives in a later
+second than the oldest one buffered, when an error or notice arrives,
+when @ref debug_flush is called, and at exit.  This makes verbose
+debugging much cheaper, at the cost of losing the last messages if the program crashes.
+@param size The number of bytes to gather before writing, or zero to write each message immediately (the default).
+@see debug_flush
+*/
+void debug_config_buffer(size_t size);
+
+/** Limit the rate of debug output.
+Show at most this many messages per second for each debugging flag,
+and report how many were suppressed once the second is over.
+Errors, notices, and fatal messages are never suppressed.
+@param limit The number of messages per second for each flag, or zero for no limit (the default).
+*/
+void debug_config_rate_limit(int limit);
+
+/** Write out any buffered debug output.
+Programs that buffer debug output should call this before waiting for a long time.
+@see debug_config_buffer
+*/
+void debug_flush(void);
+
 void debug_config_fatal(void (*callback) (void));
 
 void debug_config_getpid (pid_t (*getpidf)(void));
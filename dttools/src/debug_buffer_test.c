@@ -0,0 +1,132 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "debug.h"
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char path[] = "debug_buffer_test.XXXXXX";
+
+static off_t file_size(void)
+{
+	struct stat info;
+	if (stat(path, &info) < 0)
+		return -1;
+	return info.st_size;
+}
+
+static int count_lines(const char *text)
+{
+	FILE *file = fopen(path, "r");
+	char line[1024];
+	int count = 0;
+
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (strstr(line, text))
+			count++;
+	}
+	fclose(file);
+	return count;
+}
+
+static void *log_thread(void *arg)
+{
+	int i;
+	for (i = 0; i < 1000; i++)
+		debug(D_DEBUG, "threaded message %d", i);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	int fd = mkstemp(path);
+	if (fd < 0)
+		FAIL("could not create a temporary file");
+	close(fd);
+
+	debug_config(argv[0]);
+	debug_config_file(path);
+	debug_flags_set("debug");
+	debug_config_buffer(1 << 20);
+
+	/* Messages are held until they are flushed. */
+	for (i = 0; i < 100; i++)
+		debug(D_DEBUG, "buffered message %d", i);
+	if (file_size() != 0)
+		FAIL("buffered messages were written before a flush");
+	debug_flush();
+	if (count_lines("buffered message") != 100)
+		FAIL("buffered messages were not all written by a flush");
+
+	/* A child discards the messages it inherited. */
+	debug(D_DEBUG, "parent message");
+	pid_t pid = fork();
+	if (pid == 0) {
+		debug(D_DEBUG, "child message");
+		debug_flush();
+		_exit(0);
+	}
+	waitpid(pid, 0, 0);
+	debug_flush();
+	if (count_lines("parent message") != 1 || count_lines("child message") != 1)
+		FAIL("messages were lost or repeated across a fork");
+
+	/* Filling the buffer writes it out. */
+	debug_config_buffer(4096);
+	for (i = 0; i < 1000; i++)
+		debug(D_DEBUG, "filling message %d", i);
+	if (count_lines("filling message") < 900)
+		FAIL("a full buffer was not written out");
+	debug_flush();
+
+	/* Threads may log at the same time without losing messages. */
+	pthread_t threads[4];
+	for (i = 0; i < 4; i++)
+		pthread_create(&threads[i], 0, log_thread, 0);
+	for (i = 0; i < 4; i++)
+		pthread_join(threads[i], 0);
+	debug_flush();
+	if (count_lines("threaded message") != 4000)
+		FAIL("messages logged by several threads were lost");
+
+	/* Only so many messages are shown each second for a flag. */
+	debug_config_rate_limit(10);
+	time_t start = time(0);
+	for (i = 0; i < 100; i++)
+		debug(D_DEBUG, "limited message %d", i);
+	notice(D_DEBUG, "unlimited notice");
+	while (time(0) < start + 2)
+		usleep(10000);
+	debug(D_DEBUG, "later message");
+	debug_flush();
+
+	/* The messages may have spanned two seconds. */
+	int limited = count_lines("limited message");
+	if (limited < 10 || limited > 20)
+		FAIL("%d messages were shown instead of the rate limit", limited);
+	if (count_lines("over the rate limit") < 1)
+		FAIL("suppressed messages were not reported");
+	if (count_lines("unlimited notice") != 1 || count_lines("later message") != 1)
+		FAIL("a message within the rate limit was lost");
+
+	unlink(path);
+
+	fprintf(stdout, "debug buffer is correct\n");
+	return 0;
+}
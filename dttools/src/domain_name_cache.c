@@ -6,30 +6,92 @@ See the file COPYING for details.
 */
 
 #include "domain_name_cache.h"
+#include "address.h"
 #include "debug.h"
 #include "hash_cache.h"
+#include "hash_table.h"
 #include "stringtools.h"
+#include "xxmalloc.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/utsname.h>
+#include <time.h>
 
 /* cache domain names for up to five minutes */
 #define DOMAIN_NAME_CACHE_LIFETIME 300
 
-static struct hash_cache *name_to_addr = 0;
+/* remember names that could not be resolved for a short while */
+#define DOMAIN_NAME_CACHE_NEGATIVE_LIFETIME 10
+
+/*
+Names are resolved to addresses by threads, so that a caller with a
+deadline, such as an event loop, can give up on a slow name server and
+find the answer in the cache later.  An address that has expired is still
+returned at once while a thread looks it up again, so that a program that
+resolves the same names repeatedly only waits on the name server the
+first time.  The table of names is shared with the threads under a mutex.
+*/
+
+struct domain_name_entry {
+	char addr[DOMAIN_NAME_MAX];
+	int found;
+	time_t expires;
+	int resolving;
+};
+
+struct domain_name_request {
+	char *name;
+	unsigned generation;
+};
+
+static struct hash_table *name_to_addr = 0;
 static struct hash_cache *addr_to_name = 0;
 
-static int domain_name_cache_init()
+static pthread_mutex_t name_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t name_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t name_once = PTHREAD_ONCE_INIT;
+
+/* Incremented in a forked child, whose copy of the table no longer has resolving threads. */
+static unsigned name_generation = 0;
+
+static void domain_name_cache_atfork_prepare()
 {
-	if (!name_to_addr) {
-		name_to_addr = hash_cache_create(127, hash_string, free);
-		if (!name_to_addr) {
-			return 0;
-		}
+	pthread_mutex_lock(&name_mutex);
+}
+
+static void domain_name_cache_atfork_parent()
+{
+	pthread_mutex_unlock(&name_mutex);
+}
+
+static void domain_name_cache_atfork_child()
+{
+	char *name;
+	struct domain_name_entry *e;
+
+	HASH_TABLE_ITERATE(name_to_addr, name, e)
+	{
+		e->resolving = 0;
 	}
+	name_generation++;
+
+	pthread_mutex_init(&name_mutex, 0);
+	pthread_cond_init(&name_cond, 0);
+}
+
+static void domain_name_cache_init_once()
+{
+	name_to_addr = hash_table_create(0, 0);
+	pthread_atfork(domain_name_cache_atfork_prepare, domain_name_cache_atfork_parent, domain_name_cache_atfork_child);
+}
+
+static int domain_name_cache_init()
+{
+	pthread_once(&name_once, domain_name_cache_init_once);
 
 	if (!addr_to_name) {
 		addr_to_name = hash_cache_create(127, hash_string, free);
@@ -47,33 +109,143 @@ int domain_name_cache_canonical(const char *name_or_addr, char *cname)
 	return domain_name_cache_lookup(name_or_addr, addr) && domain_name_cache_lookup_reverse(addr, cname);
 }
 
-int domain_name_cache_lookup(const char *name, char *addr)
-{
-	char *found, *copy;
-	int success;
+/* Record the result of a lookup. Must be called with name_mutex held. */
 
-	if (!domain_name_cache_init())
-		return 0;
+static void domain_name_cache_store(const char *name, const char *addr, int found)
+{
+	struct domain_name_entry *e = hash_table_lookup(name_to_addr, name);
+	if (!e) {
+		e = xxcalloc(1, sizeof(*e));
+		hash_table_insert(name_to_addr, name, e);
+	}
 
-	found = hash_cache_lookup(name_to_addr, name);
 	if (found) {
-		strcpy(addr, found);
-		return 1;
+		strcpy(e->addr, addr);
+		e->found = 1;
+		e->expires = time(0) + DOMAIN_NAME_CACHE_LIFETIME;
+	} else if (!e->found || time(0) >= e->expires) {
+		/* A failed refresh keeps a known address until it expires. */
+		e->found = 0;
+		e->expires = time(0) + DOMAIN_NAME_CACHE_NEGATIVE_LIFETIME;
+	}
+	e->resolving = 0;
+}
+
+static void *domain_name_cache_thread(void *arg)
+{
+	struct domain_name_request *r = arg;
+	char addr[DOMAIN_NAME_MAX];
+
+	int found = domain_name_lookup(r->name, addr);
+
+	pthread_mutex_lock(&name_mutex);
+	if (r->generation == name_generation) {
+		domain_name_cache_store(r->name, addr, found);
+		pthread_cond_broadcast(&name_cond);
 	}
+	pthread_mutex_unlock(&name_mutex);
 
-	success = domain_name_lookup(name, addr);
-	if (!success)
-		return 0;
+	free(r->name);
+	free(r);
+	return 0;
+}
 
-	copy = strdup(addr);
-	if (!copy)
+/* Start resolving a name in the background. Must be called with name_mutex held. */
+
+static int domain_name_cache_start(const char *name, struct domain_name_entry *e)
+{
+	if (e->resolving)
 		return 1;
 
-	success = hash_cache_insert(name_to_addr, name, copy, DOMAIN_NAME_CACHE_LIFETIME);
+	struct domain_name_request *r = xxmalloc(sizeof(*r));
+	r->name = xxstrdup(name);
+	r->generation = name_generation;
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int result = pthread_create(&thread, &attr, domain_name_cache_thread, r);
+	pthread_attr_destroy(&attr);
+
+	if (result != 0) {
+		debug(D_DNS, "couldn't start resolving %s: %s", name, strerror(result));
+		free(r->name);
+		free(r);
+		return 0;
+	}
 
+	e->resolving = 1;
 	return 1;
 }
 
+int domain_name_cache_lookup_timeout(const char *name, char *addr, time_t stoptime)
+{
+	struct domain_name_entry *e;
+	int result = -1;
+	int timed_out = 0;
+
+	if (!domain_name_cache_init())
+		return 0;
+
+	/* Addresses need no lookup, and waiting on a thread for them would only be slower. */
+	if (address_is_valid_ip(name))
+		return domain_name_lookup(name, addr);
+
+	pthread_mutex_lock(&name_mutex);
+
+	e = hash_table_lookup(name_to_addr, name);
+	if (!e) {
+		e = xxcalloc(1, sizeof(*e));
+		hash_table_insert(name_to_addr, name, e);
+	}
+
+	while (result < 0) {
+		time_t now = time(0);
+
+		if (e->expires > now || (e->found && e->resolving)) {
+			result = e->found;
+		} else if (e->found) {
+			/* Use the expired address now, and refresh it for next time. */
+			result = 1;
+			domain_name_cache_start(name, e);
+		} else if (!e->resolving && !domain_name_cache_start(name, e)) {
+			/* Without a thread, resolve the name here. */
+			pthread_mutex_unlock(&name_mutex);
+			int found = domain_name_lookup(name, addr);
+			pthread_mutex_lock(&name_mutex);
+			domain_name_cache_store(name, addr, found);
+		} else if (stoptime != DOMAIN_NAME_CACHE_WAIT_FOREVER && now >= stoptime) {
+			debug(D_DNS, "still resolving %s", name);
+			timed_out = 1;
+			result = 0;
+			break;
+		} else if (stoptime == DOMAIN_NAME_CACHE_WAIT_FOREVER) {
+			pthread_cond_wait(&name_cond, &name_mutex);
+		} else {
+			struct timespec ts = {.tv_sec = stoptime, .tv_nsec = 0};
+			pthread_cond_timedwait(&name_cond, &name_mutex, &ts);
+		}
+		/* The entry may have been replaced while waiting. */
+		e = hash_table_lookup(name_to_addr, name);
+	}
+
+	if (result > 0)
+		strcpy(addr, e->addr);
+
+	pthread_mutex_unlock(&name_mutex);
+
+	if (!result)
+		errno = timed_out ? EAGAIN : ENOENT;
+
+	return result;
+}
+
+int domain_name_cache_lookup(const char *name, char *addr)
+{
+	return domain_name_cache_lookup_timeout(name, addr, DOMAIN_NAME_CACHE_WAIT_FOREVER);
+}
+
 int domain_name_cache_lookup_reverse(const char *addr, char *name)
 {
 	char *found, *copy;
@@ -10,6 +10,8 @@ See the file COPYING for details.
 
 #include "domain_name.h"
 
+#include <time.h>
+
 /** @file domain_name_cache.h
 Look up domain names and addresses quickly.
 These routines resolve domain names using an internal cache,
@@ -46,6 +48,23 @@ int domain_name_cache_guess_short(char *name);
 
 int domain_name_cache_lookup(const char *name, char *addr);
 
+/** Stoptime for @ref domain_name_cache_lookup_timeout to wait as long as the lookup takes. */
+#define DOMAIN_NAME_CACHE_WAIT_FOREVER ((time_t)-1)
+
+/** Resolve a domain name to an IP address with caching, waiting no longer than a deadline.
+The name is resolved by a background thread, so that if the name server is slow,
+the caller may go on with other work and call again later to find the address in the cache.
+An address that has expired from the cache is returned at once while it is refreshed,
+and a name that could not be resolved is not looked up again for a few seconds.
+@param name A string containing a domain name like "www.google.com".
+@param addr A string where the IP address will be written.
+@param stoptime The absolute time at which to stop waiting, which may be in the past to not wait at all,
+or @ref DOMAIN_NAME_CACHE_WAIT_FOREVER.
+@return One on success, zero on failure, with errno set to EAGAIN if the name is still being resolved.
+*/
+
+int domain_name_cache_lookup_timeout(const char *name, char *addr, time_t stoptime);
+
 /** Resolve an IP address to a domain name with caching.
 @param addr A string containing an IP address like "202.5.129.1"
 @param name A string where the domain name will be written.
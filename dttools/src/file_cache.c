@@ -10,6 +10,7 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name_cache.h"
 #include "hash_table.h"
+#include "itable.h"
 #include "md5.h"
 
 #include <dirent.h>
@@ -24,6 +25,12 @@ See the file COPYING for details.
 #include <time.h>
 #include <unistd.h>
 
+/* Fills of the same path are serialized by a lock on one byte of this file, chosen by the path's checksum. */
+#define LOCK_FILE "txn/.lock"
+
+/* Eviction removes the least recently used entries until usage falls to this fraction of the limit. */
+#define EVICT_LOW_WATER 0.9
+
 /* Cygwin does not have 64-bit I/O, while Darwin & FreeBSD have it by default. */
 
 #if defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
@@ -35,6 +42,16 @@ See the file COPYING for details.
 
 struct file_cache {
 	char *root;
+	int lockfd;
+	struct itable *held;
+	INT64_T limit;
+	INT64_T usage;
+};
+
+struct cache_entry {
+	char *name;
+	time_t atime;
+	INT64_T size;
 };
 
 static void cached_name(struct file_cache *c, const char *path, char *lpath)
@@ -53,55 +70,52 @@ static void txn_name(struct file_cache *c, const char *path, char *txn)
 	sprintf(txn, "%s/txn/%s.%s.%d.XXXXXX", c->root, md5_to_string(digest), shortname, (int)getpid());
 }
 
-static int wait_for_running_txn(struct file_cache *c, const char *path)
+static off_t lock_offset(const char *path)
 {
-	char txn[PATH_MAX];
-	char dirname[PATH_MAX];
 	unsigned char digest[MD5_DIGEST_LENGTH];
-	DIR *dir;
-	struct dirent *d;
-	const char *checksum;
-
 	md5_buffer(path, strlen(path), digest);
-	checksum = md5_to_string(digest);
+	return ((off_t) (digest[0] & 0x7f) << 24) | (digest[1] << 16) | (digest[2] << 8) | digest[3];
+}
 
-	txn[0] = 0;
+static int lock_path(struct file_cache *c, const char *path, int type, int wait)
+{
+	struct flock fl;
 
-	sprintf(dirname, "%s/txn", c->root);
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = lock_offset(path);
+	fl.l_len = 1;
 
-	dir = opendir(dirname);
-	if (!dir)
-		return 0;
-
-	while ((d = readdir(dir))) {
-		if (!strncmp(d->d_name, checksum, 32)) {
-			sprintf(txn, "%s/txn/%s", c->root, d->d_name);
-			break;
-		}
+	while (fcntl(c->lockfd, wait ? F_SETLKW : F_SETLK, &fl) < 0) {
+		if (errno != EINTR)
+			return -1;
 	}
+	return 0;
+}
 
-	closedir(dir);
+/*
+If another process is filling this path, wait for it to finish.
+The lock is released when the filler commits, aborts, or dies,
+so unlike a timeout this never gives up on a slow transfer.
+*/
 
-	if (!txn[0])
+static int wait_for_running_txn(struct file_cache *c, const char *path)
+{
+	/* record locks belong to the process, so probing our own would release it */
+	if (itable_lookup(c->held, lock_offset(path)))
 		return 0;
 
-	while (1) {
-		struct stat64 info;
-
-		debug(D_CACHE, "wait %s", txn);
-		if (stat64(txn, &info) < 0)
-			return 1;
-
-		time_t current = time(0);
-
-		if ((current - info.st_mtime) < 60) {
-			sleep(1);
-			continue;
-		} else {
-			debug(D_CACHE, "override %s", txn);
-			return 0;
-		}
+	if (lock_path(c, path, F_RDLCK, 0) == 0) {
+		lock_path(c, path, F_UNLCK, 0);
+		return 0;
 	}
+
+	debug(D_CACHE, "wait %s", path);
+	if (lock_path(c, path, F_RDLCK, 1) < 0)
+		return 0;
+	lock_path(c, path, F_UNLCK, 0);
+	return 1;
 }
 
 static int mkdir_or_exists(const char *path, mode_t mode)
@@ -124,6 +138,10 @@ struct file_cache *file_cache_init(const char *root)
 		free(f);
 		return 0;
 	}
+	f->lockfd = -1;
+	f->held = itable_create(0);
+	f->limit = 0;
+	f->usage = -1;
 
 	sprintf(path, "%s/ff", root);
 	result = stat64(path, &buf);
@@ -141,6 +159,12 @@ struct file_cache *file_cache_init(const char *root)
 		}
 	}
 
+	sprintf(path, "%s/%s", root, LOCK_FILE);
+	f->lockfd = open64(path, O_RDWR | O_CREAT, 0777);
+	if (f->lockfd < 0)
+		goto failure;
+	fcntl(f->lockfd, F_SETFD, FD_CLOEXEC);
+
 	return f;
 
 failure:
@@ -151,6 +175,10 @@ failure:
 void file_cache_fini(struct file_cache *f)
 {
 	if (f) {
+		if (f->lockfd >= 0)
+			close(f->lockfd);
+		if (f->held)
+			itable_delete(f->held);
 		free(f->root);
 		free(f);
 	}
@@ -181,6 +209,8 @@ void file_cache_cleanup(struct file_cache *f)
 			continue;
 		if (!strcmp(d->d_name, ".."))
 			continue;
+		if (!strcmp(d->d_name, ".lock"))
+			continue;
 		if (sscanf(d->d_name, "%*[^.].%[^.].%d", shortname, &pid) == 2) {
 			if (!strcmp(shortname, myshortname)) {
 				if (kill(pid, 0) == 0) {
@@ -250,6 +280,9 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 		if (fstat64(fd, &info) == 0) {
 			if ((size == 0 || (size == info.st_size)) && ((mtime == 0) || (info.st_mtime >= mtime))) {
 				debug(D_CACHE, "hit %s %s", path, lpath);
+				/* the access time orders eviction; the modification time is the remote one */
+				struct timespec times[2] = {{0, UTIME_NOW}, {0, UTIME_OMIT}};
+				futimens(fd, times);
 				return fd;
 			} else {
 				debug(D_CACHE, "stale %s %s", path, lpath);
@@ -272,6 +305,7 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 int file_cache_delete(struct file_cache *f, const char *path)
 {
 	char lpath[PATH_MAX];
+	file_cache_map_delete(f, path);
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "remove %s %s", path, lpath);
 	return unlink(lpath);
@@ -280,19 +314,33 @@ int file_cache_delete(struct file_cache *f, const char *path)
 int file_cache_begin(struct file_cache *f, const char *path, char *txn)
 {
 	int result;
+
+	/* held until commit or abort, so others wait for this fill rather than repeat it */
+	if (lock_path(f, path, F_WRLCK, 1) < 0)
+		return -1;
+
 	txn_name(f, path, txn);
 	result = mkstemp64(txn);
 	if (result >= 0) {
 		debug(D_CACHE, "begin %s %s", path, txn);
 		fchmod(result, 0700);
+		itable_insert(f->held, lock_offset(path), f);
+	} else {
+		int save_errno = errno;
+		lock_path(f, path, F_UNLCK, 0);
+		errno = save_errno;
 	}
 	return result;
 }
 
 int file_cache_abort(struct file_cache *f, const char *path, const char *txn)
 {
+	int result;
 	debug(D_CACHE, "abort %s %s", path, txn);
-	return unlink(txn);
+	result = unlink(txn);
+	itable_remove(f->held, lock_offset(path));
+	lock_path(f, path, F_UNLCK, 0);
+	return result;
 }
 
 int file_cache_commit(struct file_cache *f, const char *path, const char *txn)
@@ -301,10 +349,128 @@ int file_cache_commit(struct file_cache *f, const char *path, const char *txn)
 	char lpath[PATH_MAX];
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "commit %s %s %s", path, txn, lpath);
+
+	struct stat64 info;
+	if (stat64(txn, &info) < 0)
+		info.st_size = 0;
+
 	result = rename(txn, lpath);
 	if (result < 0)
 		debug(D_CACHE, "commit failed: %s", strerror(errno));
+	itable_remove(f->held, lock_offset(path));
+	lock_path(f, path, F_UNLCK, 0);
+
+	if (result == 0 && f->limit > 0) {
+		f->usage += info.st_size;
+		if (f->usage > f->limit)
+			file_cache_evict(f);
+	}
+
 	return result;
 }
 
+/*
+A partially filled entry has a map beside it, holding one byte per
+block: nonzero once that block of the entry is present.  The map is
+created before the entry is committed and deleted once it is complete,
+so an entry without a map is always whole.
+*/
+
+int file_cache_map_open(struct file_cache *f, const char *path, int flags)
+{
+	char mpath[PATH_MAX];
+	cached_name(f, path, mpath);
+	strcat(mpath, ".map");
+	return open64(mpath, flags, 0700);
+}
+
+int file_cache_map_delete(struct file_cache *f, const char *path)
+{
+	char mpath[PATH_MAX];
+	cached_name(f, path, mpath);
+	strcat(mpath, ".map");
+	return unlink(mpath);
+}
+
+void file_cache_set_limit(struct file_cache *f, INT64_T limit)
+{
+	f->limit = limit;
+	if (limit > 0)
+		file_cache_evict(f);
+}
+
+static int compare_atime(const void *a, const void *b)
+{
+	const struct cache_entry *x = a;
+	const struct cache_entry *y = b;
+	return (x->atime > y->atime) - (x->atime < y->atime);
+}
+
+/*
+Recount the space used by the cache, and if it is over the limit, delete
+the least recently used entries.  Every process using the cache keeps
+its own estimate of usage between scans, so the cache may briefly
+overshoot the limit when many processes fill it at once.
+*/
+
+void file_cache_evict(struct file_cache *f)
+{
+	struct cache_entry *entries = 0;
+	size_t nentries = 0, allocated = 0, i;
+	INT64_T usage = 0;
+	char path[PATH_MAX + 8];
+	struct dirent *d;
+	struct stat64 info;
+	DIR *dir;
+	int j;
+
+	for (j = 0; j <= 0xff; j++) {
+		sprintf(path, "%s/%02x", f->root, j);
+		dir = opendir(path);
+		if (!dir)
+			continue;
+		while ((d = readdir(dir))) {
+			if (d->d_name[0] == '.')
+				continue;
+			sprintf(path, "%s/%02x/%s", f->root, j, d->d_name);
+			if (stat64(path, &info) < 0 || !S_ISREG(info.st_mode))
+				continue;
+			/* space actually used, since partial entries are sparse */
+			usage += info.st_blocks * 512;
+			if (strlen(d->d_name) > 4 && !strcmp(d->d_name + strlen(d->d_name) - 4, ".map"))
+				continue;
+			if (nentries == allocated) {
+				size_t n = allocated ? allocated * 2 : 1024;
+				struct cache_entry *e = realloc(entries, n * sizeof(*entries));
+				if (!e)
+					continue;
+				entries = e;
+				allocated = n;
+			}
+			entries[nentries].name = strdup(path);
+			entries[nentries].atime = info.st_atime;
+			entries[nentries].size = info.st_blocks * 512;
+			nentries++;
+		}
+		closedir(dir);
+	}
+
+	if (usage > f->limit) {
+		INT64_T target = f->limit * EVICT_LOW_WATER;
+		qsort(entries, nentries, sizeof(*entries), compare_atime);
+		for (i = 0; i < nentries && usage > target; i++) {
+			debug(D_CACHE, "evict %s", entries[i].name);
+			if (unlink(entries[i].name) == 0)
+				usage -= entries[i].size;
+			sprintf(path, "%s.map", entries[i].name);
+			unlink(path);
+		}
+	}
+
+	f->usage = usage;
+	for (i = 0; i < nentries; i++)
+		free(entries[i].name);
+	free(entries);
+}
+
 /* vim: set noexpandtab tabstop=8: */
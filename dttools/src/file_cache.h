@@ -24,4 +24,10 @@ int file_cache_begin(struct file_cache *c, const char *path, char *txn);
 int file_cache_commit(struct file_cache *c, const char *path, const char *txn);
 int file_cache_abort(struct file_cache *c, const char *path, const char *txn);
 
+int file_cache_map_open(struct file_cache *c, const char *path, int flags);
+int file_cache_map_delete(struct file_cache *c, const char *path);
+
+void file_cache_set_limit(struct file_cache *c, INT64_T limit);
+void file_cache_evict(struct file_cache *c);
+
 #endif
@@ -3,11 +3,17 @@
 #include "stringtools.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <linux/fs.h>
+#endif
+
 int file_link_recursive(const char *source, const char *target, int allow_symlinks)
 {
 	struct stat info;
@@ -82,3 +88,89 @@ int file_link_recursive(const char *source, const char *target, int allow_symlin
 		return 0;
 	}
 }
+
+/*
+Make a copy-on-write clone of a single regular file, sharing its
+data blocks with the source, as supported by Btrfs and XFS.
+*/
+
+static int file_clone(const char *source, const char *target, struct stat *info)
+{
+#ifdef FICLONE
+	int in = open(source, O_RDONLY);
+	if (in < 0)
+		return 0;
+
+	int out = open(target, O_WRONLY | O_CREAT | O_EXCL, info->st_mode & 07777);
+	if (out < 0) {
+		close(in);
+		return 0;
+	}
+
+	int result = ioctl(out, FICLONE, in) == 0;
+	int saved_errno = errno;
+
+	close(in);
+	close(out);
+
+	if (!result) {
+		unlink(target);
+		errno = saved_errno;
+	}
+
+	return result;
+#else
+	errno = ENOTSUP;
+	return 0;
+#endif
+}
+
+int file_clone_recursive(const char *source, const char *target, int allow_links)
+{
+	struct stat info;
+
+	if (lstat(source, &info) < 0)
+		return 0;
+
+	if (S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(source);
+		if (!dir)
+			return 0;
+
+		mkdir(target, 0777);
+
+		struct dirent *d;
+		int result = 1;
+
+		while ((d = readdir(dir))) {
+			if (!strcmp(d->d_name, "."))
+				continue;
+			if (!strcmp(d->d_name, ".."))
+				continue;
+
+			char *subsource = string_format("%s/%s", source, d->d_name);
+			char *subtarget = string_format("%s/%s", target, d->d_name);
+
+			result = file_clone_recursive(subsource, subtarget, allow_links);
+
+			free(subsource);
+			free(subtarget);
+
+			if (!result)
+				break;
+		}
+		closedir(dir);
+
+		return result;
+	} else if (S_ISREG(info.st_mode) && file_clone(source, target, &info)) {
+		return 1;
+	} else if (allow_links) {
+		/*
+		Symlinks and other special files cannot be cloned, nor can
+		files on a filesystem without reflinks, so link them instead.
+		*/
+		return file_link_recursive(source, target, 1);
+	} else {
+		return 0;
+	}
+}
@@ -13,4 +13,15 @@ If source is a directory, do it recursively.
 
 int file_link_recursive( const char *source, const char *target, int allow_symlink );
 
+/** Make a copy-on-write clone (reflink) of source at target.
+If source is a directory, do it recursively.  The clone shares data
+blocks with the source, but later writes to either one are private.
+@param source The source path to clone.
+@param target The target path to create.
+@param allow_links If true, link the files that cannot be cloned, as by @ref file_link_recursive.
+@return 1 on success, 0 on failure.
+*/
+
+int file_clone_recursive( const char *source, const char *target, int allow_links );
+
 #endif
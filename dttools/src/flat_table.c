@@ -0,0 +1,346 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "flat_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+Entries live in an array of slots, divided into groups of GROUP_SIZE.
+Each slot has a control byte: EMPTY, DELETED, or the low seven bits
+of the hash of its key.  A key is looked up by visiting the groups
+in a triangular sequence starting from the high bits of its hash,
+comparing keys only in slots whose control byte matches, and stopping
+at the first group that still has an empty slot.
+*/
+
+#define GROUP_SIZE 16
+#define DEFAULT_SIZE 128
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+#define HASH_CTRL(hash) ((uint8_t)((hash) & 0x7f))
+#define HASH_GROUP(hash) ((hash) >> 7)
+
+struct slot {
+	unsigned hash;
+	char *key;
+	void *value;
+};
+
+struct flat_table {
+	hash_func_t hash_func;
+	int borrow_keys;
+	int capacity;
+	int group_count;
+	int size;
+	int deleted;
+	uint8_t *ctrl;
+	struct slot *slots;
+	int islot;
+};
+
+/* Return a bitmask with bit i set where the control byte i of the group equals the given byte. */
+
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t byte)
+{
+#if defined(__SSE2__)
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t bits = vandq_u8(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(byte)), vld1q_u8(weights));
+	return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+	unsigned mask = 0;
+	int i;
+	for (i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] == byte)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/* Return a bitmask with bit i set where slot i of the group is empty or deleted. */
+
+static inline unsigned group_match_free(const uint8_t *ctrl)
+{
+#if defined(__SSE2__)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	int8x16_t high = vshrq_n_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl)), 7);
+	uint8x16_t bits = vandq_u8(vreinterpretq_u8_s8(high), vld1q_u8(weights));
+	return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+	unsigned mask = 0;
+	int i;
+	for (i = 0; i < GROUP_SIZE; i++) {
+		if (ctrl[i] & 0x80)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+static inline int lowest_bit(unsigned mask)
+{
+	return __builtin_ctz(mask);
+}
+
+static int flat_table_alloc(struct flat_table *t, int capacity)
+{
+	uint8_t *ctrl = malloc(capacity);
+	struct slot *slots = malloc(capacity * sizeof(*slots));
+	if (!ctrl || !slots) {
+		free(ctrl);
+		free(slots);
+		return 0;
+	}
+
+	memset(ctrl, CTRL_EMPTY, capacity);
+	t->ctrl = ctrl;
+	t->slots = slots;
+	t->capacity = capacity;
+	t->group_count = capacity / GROUP_SIZE;
+	t->size = 0;
+	t->deleted = 0;
+
+	return 1;
+}
+
+static struct flat_table *flat_table_create_internal(int buckets, hash_func_t func, int borrow_keys)
+{
+	struct flat_table *t = malloc(sizeof(*t));
+	if (!t)
+		return 0;
+
+	if (buckets < 1)
+		buckets = DEFAULT_SIZE;
+
+	int capacity = GROUP_SIZE;
+	while ((long)capacity * MAX_LOAD_NUM / MAX_LOAD_DEN < buckets)
+		capacity *= 2;
+
+	t->hash_func = func ? func : hash_string;
+	t->borrow_keys = borrow_keys;
+	t->islot = 0;
+
+	if (!flat_table_alloc(t, capacity)) {
+		free(t);
+		return 0;
+	}
+
+	return t;
+}
+
+struct flat_table *flat_table_create(int buckets, hash_func_t func)
+{
+	return flat_table_create_internal(buckets, func, 0);
+}
+
+struct flat_table *flat_table_create_borrowed(int buckets, hash_func_t func)
+{
+	return flat_table_create_internal(buckets, func, 1);
+}
+
+void flat_table_clear(struct flat_table *t, void (*delete_func)(void *))
+{
+	int i;
+	for (i = 0; i < t->capacity; i++) {
+		if (t->ctrl[i] & 0x80)
+			continue;
+		if (delete_func)
+			delete_func(t->slots[i].value);
+		if (!t->borrow_keys)
+			free(t->slots[i].key);
+	}
+
+	memset(t->ctrl, CTRL_EMPTY, t->capacity);
+	t->size = 0;
+	t->deleted = 0;
+}
+
+void flat_table_delete(struct flat_table *t)
+{
+	flat_table_clear(t, 0);
+	free(t->ctrl);
+	free(t->slots);
+	free(t);
+}
+
+/* Return the slot holding the given key, or -1 if it is not in the table. */
+
+static int flat_table_find(struct flat_table *t, const char *key, unsigned hash)
+{
+	uint8_t byte = HASH_CTRL(hash);
+	int group = HASH_GROUP(hash) & (t->group_count - 1);
+	int step;
+
+	for (step = 1; step <= t->group_count; step++) {
+		const uint8_t *ctrl = &t->ctrl[group * GROUP_SIZE];
+
+		unsigned mask = group_match(ctrl, byte);
+		while (mask) {
+			int i = group * GROUP_SIZE + lowest_bit(mask);
+			struct slot *s = &t->slots[i];
+			if (s->hash == hash && (s->key == key || !strcmp(s->key, key)))
+				return i;
+			mask &= mask - 1;
+		}
+
+		if (group_match(ctrl, CTRL_EMPTY))
+			return -1;
+
+		group = (group + step) & (t->group_count - 1);
+	}
+
+	return -1;
+}
+
+/* Return the first empty or deleted slot in the probe sequence of the given hash. */
+
+static int flat_table_find_free(struct flat_table *t, unsigned hash)
+{
+	int group = HASH_GROUP(hash) & (t->group_count - 1);
+	int step;
+
+	for (step = 1;; step++) {
+		unsigned mask = group_match_free(&t->ctrl[group * GROUP_SIZE]);
+		if (mask)
+			return group * GROUP_SIZE + lowest_bit(mask);
+		group = (group + step) & (t->group_count - 1);
+	}
+}
+
+/* Move all entries into new arrays of the given capacity, dropping deleted slots. */
+
+static int flat_table_rehash(struct flat_table *t, int capacity)
+{
+	uint8_t *old_ctrl = t->ctrl;
+	struct slot *old_slots = t->slots;
+	int old_capacity = t->capacity;
+	int size = t->size;
+
+	if (!flat_table_alloc(t, capacity))
+		return 0;
+
+	int i;
+	for (i = 0; i < old_capacity; i++) {
+		if (old_ctrl[i] & 0x80)
+			continue;
+		int j = flat_table_find_free(t, old_slots[i].hash);
+		t->ctrl[j] = old_ctrl[i];
+		t->slots[j] = old_slots[i];
+	}
+	t->size = size;
+
+	free(old_ctrl);
+	free(old_slots);
+
+	return 1;
+}
+
+int flat_table_insert(struct flat_table *t, const char *key, const void *value)
+{
+	unsigned hash = t->hash_func(key);
+
+	if (flat_table_find(t, key, hash) >= 0)
+		return 0;
+
+	if ((long)(t->size + t->deleted + 1) * MAX_LOAD_DEN > (long)t->capacity * MAX_LOAD_NUM) {
+		/* Grow if full of entries, otherwise just clean out deleted slots. */
+		int capacity = t->capacity;
+		if (t->deleted < t->capacity / GROUP_SIZE)
+			capacity *= 2;
+		if (!flat_table_rehash(t, capacity))
+			return 0;
+	}
+
+	char *k = t->borrow_keys ? (char *)key : strdup(key);
+	if (!k)
+		return 0;
+
+	int i = flat_table_find_free(t, hash);
+	if (t->ctrl[i] == CTRL_DELETED)
+		t->deleted--;
+
+	t->ctrl[i] = HASH_CTRL(hash);
+	t->slots[i].hash = hash;
+	t->slots[i].key = k;
+	t->slots[i].value = (void *)value;
+	t->size++;
+
+	return 1;
+}
+
+void *flat_table_lookup(struct flat_table *t, const char *key)
+{
+	int i = flat_table_find(t, key, t->hash_func(key));
+	return i >= 0 ? t->slots[i].value : 0;
+}
+
+void *flat_table_remove(struct flat_table *t, const char *key)
+{
+	int i = flat_table_find(t, key, t->hash_func(key));
+	if (i < 0)
+		return 0;
+
+	void *value = t->slots[i].value;
+	if (!t->borrow_keys)
+		free(t->slots[i].key);
+
+	/*
+	If the group still has an empty slot, no probe sequence has gone past it,
+	so the slot can be made empty again.  Otherwise, leave a deleted marker.
+	*/
+	uint8_t *ctrl = &t->ctrl[i - i % GROUP_SIZE];
+	if (group_match(ctrl, CTRL_EMPTY)) {
+		t->ctrl[i] = CTRL_EMPTY;
+	} else {
+		t->ctrl[i] = CTRL_DELETED;
+		t->deleted++;
+	}
+	t->size--;
+
+	return value;
+}
+
+int flat_table_size(struct flat_table *t)
+{
+	return t->size;
+}
+
+void flat_table_firstkey(struct flat_table *t)
+{
+	t->islot = 0;
+}
+
+int flat_table_nextkey(struct flat_table *t, char **key, void **value)
+{
+	while (t->islot < t->capacity) {
+		int i = t->islot++;
+		if (t->ctrl[i] & 0x80)
+			continue;
+		*key = t->slots[i].key;
+		*value = t->slots[i].value;
+		return 1;
+	}
+
+	return 0;
+}
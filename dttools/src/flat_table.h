@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef FLAT_TABLE_H
+#define FLAT_TABLE_H
+
+#include "hash_table.h"
+
+/** @file flat_table.h An open-addressing hash table.
+This module maps C strings to arbitrary objects (void pointers), like @ref hash_table.h,
+but keeps all of its entries in a single array rather than in chained nodes.
+Each entry stores the full hash of its key, and a separate array holds one
+control byte per entry with seven bits of that hash.  Lookups scan the control
+bytes sixteen at a time (with SSE2 or NEON where available), and only compare
+keys whose control byte matches.
+
+A flat table may either copy its keys, as a @ref hash_table does, or borrow them
+from the caller, which is useful when the key is already a field of the value:
+
+<pre>
+struct flat_table *t = flat_table_create_borrowed(0,0);
+flat_table_insert(t,f->cached_name,f);
+f = flat_table_lookup(t,cached_name);
+f = flat_table_remove(t,f->cached_name);
+</pre>
+
+Removing the current entry while iterating is allowed.
+Inserting while iterating is not, as the table may be resized.
+*/
+
+/** Create a new flat table that copies its keys.
+@param buckets The expected number of entries.  If zero, a default value will be used.
+@param func The hash function to be used.  If zero, @ref hash_string will be used.
+@return A pointer to a new flat table.
+*/
+
+struct flat_table *flat_table_create(int buckets, hash_func_t func);
+
+/** Create a new flat table that borrows its keys.
+The table stores the key pointers given to @ref flat_table_insert without copying them,
+so each key must remain valid and unchanged while its entry is in the table.
+@param buckets The expected number of entries.  If zero, a default value will be used.
+@param func The hash function to be used.  If zero, @ref hash_string will be used.
+@return A pointer to a new flat table.
+*/
+
+struct flat_table *flat_table_create_borrowed(int buckets, hash_func_t func);
+
+/** Remove all entries from a flat table.
+@param t The flat table to clear.
+@param delete_func If non-null, will be invoked on each object to delete it.
+*/
+
+void flat_table_clear(struct flat_table *t, void (*delete_func)(void *));
+
+/** Delete a flat table.
+Note that this function will not delete the objects contained within the table.
+@param t The flat table to delete.
+*/
+
+void flat_table_delete(struct flat_table *t);
+
+/** Insert a key and value.
+This call will fail if the table already contains the same key.
+@param t A pointer to a flat table.
+@param key A pointer to a string key.
+@param value A pointer to store with the key.
+@return One if the insert succeeded, zero otherwise.
+*/
+
+int flat_table_insert(struct flat_table *t, const char *key, const void *value);
+
+/** Look up a value by key.
+@param t A pointer to a flat table.
+@param key A string key to search for.
+@return If found, the pointer associated with the key, otherwise null.
+*/
+
+void *flat_table_lookup(struct flat_table *t, const char *key);
+
+/** Remove a value by key.
+@param t A pointer to a flat table.
+@param key A string key to remove.
+@return If found, the pointer associated with the key, otherwise null.
+*/
+
+void *flat_table_remove(struct flat_table *t, const char *key);
+
+/** Count the entries in a flat table.
+@param t A pointer to a flat table.
+@return The number of entries in the table.
+*/
+
+int flat_table_size(struct flat_table *t);
+
+/** Begin iteration over all keys.
+Invoke @ref flat_table_nextkey to retrieve each entry in turn.
+@param t A pointer to a flat table.
+*/
+
+void flat_table_firstkey(struct flat_table *t);
+
+/** Continue iteration over all keys.
+@param t A pointer to a flat table.
+@param key A pointer to a key pointer.
+@param value A pointer to a value pointer.
+@return Zero if there are no more elements to visit, one otherwise.
+*/
+
+int flat_table_nextkey(struct flat_table *t, char **key, void **value);
+
+/** Utility macro to simplify iterating over a flat table, as @ref HASH_TABLE_ITERATE. */
+
+#define FLAT_TABLE_ITERATE( table, key, value ) flat_table_firstkey(table); while(flat_table_nextkey(table,&key,(void**)&value))
+
+#endif
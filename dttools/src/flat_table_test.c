@@ -0,0 +1,98 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "flat_table.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 100000
+
+static int deleted = 0;
+
+static void count_delete(void *value)
+{
+	deleted++;
+}
+
+int main(int argc, char **argv)
+{
+	char buffer[32];
+	char *key;
+	void *value;
+	int i;
+
+	struct flat_table *t = flat_table_create(0, 0);
+
+	for (i = 0; i < N; i++) {
+		sprintf(buffer, "key-%d", i);
+		if (!flat_table_insert(t, buffer, (void *)(long)(i + 1)))
+			FAIL("could not insert %s", buffer);
+	}
+	if (flat_table_insert(t, "key-7", (void *)1))
+		FAIL("duplicate key was inserted");
+	if (flat_table_size(t) != N)
+		FAIL("expected %d entries, found %d", N, flat_table_size(t));
+
+	for (i = 0; i < N; i++) {
+		sprintf(buffer, "key-%d", i);
+		if (flat_table_lookup(t, buffer) != (void *)(long)(i + 1))
+			FAIL("wrong value for %s", buffer);
+	}
+	if (flat_table_lookup(t, "missing"))
+		FAIL("found a missing key");
+
+	/* Remove the even keys while iterating, then put them back, many times over. */
+	int round;
+	for (round = 0; round < 5; round++) {
+		int visited = 0;
+		FLAT_TABLE_ITERATE(t, key, value)
+		{
+			visited++;
+			if (((long)value - 1) % 2 == 0 && flat_table_remove(t, key) != value)
+				FAIL("could not remove %s", key);
+		}
+		if (visited != N || flat_table_size(t) != N / 2)
+			FAIL("visited %d entries and kept %d", visited, flat_table_size(t));
+
+		for (i = 0; i < N; i += 2) {
+			sprintf(buffer, "key-%d", i);
+			if (flat_table_lookup(t, buffer))
+				FAIL("found removed key %s", buffer);
+			flat_table_insert(t, buffer, (void *)(long)(i + 1));
+		}
+	}
+
+	for (i = 0; i < N; i++) {
+		sprintf(buffer, "key-%d", i);
+		if (flat_table_lookup(t, buffer) != (void *)(long)(i + 1))
+			FAIL("wrong value for %s after removals", buffer);
+	}
+
+	flat_table_clear(t, count_delete);
+	if (deleted != N || flat_table_size(t) != 0 || flat_table_lookup(t, "key-1"))
+		FAIL("table was not cleared");
+	flat_table_delete(t);
+
+	/* A borrowed key is stored as given. */
+	static char names[100][16];
+	t = flat_table_create_borrowed(0, 0);
+	for (i = 0; i < 100; i++) {
+		sprintf(names[i], "name-%d", i);
+		flat_table_insert(t, names[i], names[i]);
+	}
+	FLAT_TABLE_ITERATE(t, key, value)
+	{
+		if (key != value)
+			FAIL("borrowed key %s was copied", key);
+	}
+	flat_table_delete(t);
+
+	fprintf(stdout, "flat table is correct\n");
+	return 0;
+}
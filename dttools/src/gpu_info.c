@@ -6,13 +6,16 @@ See the file COPYING for details.
 
 #include "gpu_info.h"
 #include "get_line.h"
+#include "list.h"
 #include "stringtools.h"
 #include "debug.h"
+#include "xxmalloc.h"
 
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -21,6 +24,7 @@ See the file COPYING for details.
 #define GPU_EXECUTABLE "/bin/nvidia-smi"
 #define GPU_COUNT_COMMAND GPU_EXECUTABLE " --query-gpu=count --format=csv,noheader"
 #define GPU_NAME_COMMAND GPU_EXECUTABLE " --query-gpu=name --format=csv,noheader"
+#define GPU_LIST_COMMAND GPU_EXECUTABLE " -L"
 
 int gpu_count_get()
 {
@@ -86,4 +90,44 @@ char *gpu_name_get()
 	}
 }
 
+/*
+The partitions are listed under each gpu in lines like:
+  MIG 1g.10gb     Device  0: (UUID: MIG-5c3ba5b0-7e42-5a2f-9d51-1c2f1c5b6a3e)
+*/
+
+struct list *gpu_mig_uuids_get()
+{
+	struct list *uuids = list_create();
+
+	if (access(GPU_EXECUTABLE, X_OK) != 0)
+		return uuids;
+
+	debug(D_DEBUG, "gpu_mig_uuids_get: running \"%s\"\n", GPU_LIST_COMMAND);
+
+	FILE *pipe = popen(GPU_LIST_COMMAND, "r");
+	if (!pipe)
+		return uuids;
+
+	char line[1024];
+	while (fgets(line, sizeof(line), pipe)) {
+		char *start = strstr(line, "UUID: MIG-");
+		if (start) {
+			start += strlen("UUID: ");
+			char *end = strchr(start, ')');
+			if (end)
+				*end = 0;
+			list_push_tail(uuids, xxstrdup(start));
+		}
+	}
+
+	int status = pclose(pipe);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		debug(D_DEBUG, "gpu_mig_uuids_get: failed with status %d", WEXITSTATUS(status));
+		list_clear(uuids, free);
+	}
+
+	return uuids;
+}
+
 /* vim: set noexpandtab tabstop=8: */
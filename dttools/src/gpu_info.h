@@ -21,6 +21,12 @@ int gpu_count_get();
 */
 char *gpu_name_get();
 
+/** Get the MIG (multi-instance gpu) partitions configured on the gpus.
+@return A list of the UUIDs of the partitions, as accepted by CUDA_VISIBLE_DEVICES,
+which must be deleted along with its strings. The list is empty if there are no partitions.
+*/
+struct list *gpu_mig_uuids_get();
+
 #endif
 
 /* vim: set noexpandtab tabstop=8: */
@@ -6,6 +6,7 @@ See the file COPYING for details.
 */
 
 #include "hash_table.h"
+#include "string_intern.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +15,9 @@ See the file COPYING for details.
 #define DEFAULT_LOAD 0.75
 #define DEFAULT_FUNC hash_string
 
+/* Number of old buckets moved to the new bucket array on each insert while resizing. */
+#define REHASH_STEP 4
+
 struct entry {
 	char *key;
 	void *value;
@@ -21,15 +25,39 @@ struct entry {
 	struct entry *next;
 };
 
+/*
+When the table grows, the entries are not moved all at once.
+Instead, the previous bucket array is kept in old_buckets,
+and each insert moves a few of its buckets to the new array,
+starting from rehash_index.  Lookups and removals consult both
+arrays until the move is complete.  For iteration, buckets are
+numbered with the old ones first, followed by the new ones.
+
+Since an insert may move entries between buckets, no iteration can
+guarantee to visit each entry once across inserts, so inserting new
+keys during an iteration is not allowed.
+*/
+
 struct hash_table {
 	hash_func_t hash_func;
 	int bucket_count;
 	int size;
 	struct entry **buckets;
-	int ibucket;
-	struct entry *ientry;
+	struct entry **old_buckets;
+	int old_bucket_count;
+	int rehash_index;
+	struct hash_table_iter iter;
+	int intern_keys;
 };
 
+static void hash_table_free_key(struct hash_table *h, char *key)
+{
+	if (h->intern_keys)
+		string_intern_release(key);
+	else
+		free(key);
+}
+
 struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 {
 	struct hash_table *h;
@@ -44,6 +72,7 @@ struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 		func = DEFAULT_FUNC;
 
 	h->size = 0;
+	h->intern_keys = 0;
 	h->hash_func = func;
 	h->bucket_count = bucket_count;
 	h->buckets = (struct entry **)calloc(bucket_count, sizeof(struct entry *));
@@ -52,29 +81,58 @@ struct hash_table *hash_table_create(int bucket_count, hash_func_t func)
 		return 0;
 	}
 
+	h->old_buckets = 0;
+	h->old_bucket_count = 0;
+	h->rehash_index = 0;
+
+	h->iter.table = h;
+	h->iter.start = 0;
+	h->iter.bucket = 0;
+	h->iter.entry = 0;
+
 	return h;
 }
 
-void hash_table_clear(struct hash_table *h, void (*delete_func)(void *))
+struct hash_table *hash_table_create_interned(int bucket_count, hash_func_t func)
+{
+	struct hash_table *h = hash_table_create(bucket_count, func);
+	if (h)
+		h->intern_keys = 1;
+	return h;
+}
+
+static void hash_table_clear_buckets(struct hash_table *h, struct entry **buckets, int bucket_count, void (*delete_func)(void *))
 {
 	struct entry *e, *f;
 	int i;
 
-	for (i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+	for (i = 0; i < bucket_count; i++) {
+		e = buckets[i];
 		while (e) {
 			f = e->next;
 			if (delete_func)
 				delete_func(e->value);
-			free(e->key);
+			hash_table_free_key(h, e->key);
 			free(e);
 			e = f;
 		}
+		buckets[i] = 0;
 	}
+}
+
+void hash_table_clear(struct hash_table *h, void (*delete_func)(void *))
+{
+	hash_table_clear_buckets(h, h->buckets, h->bucket_count, delete_func);
 
-	for (i = 0; i < h->bucket_count; i++) {
-		h->buckets[i] = 0;
+	if (h->old_buckets) {
+		hash_table_clear_buckets(h, h->old_buckets, h->old_bucket_count, delete_func);
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
 	}
+
+	h->size = 0;
+	h->iter.entry = 0;
 }
 
 void hash_table_delete(struct hash_table *h)
@@ -84,68 +142,100 @@ void hash_table_delete(struct hash_table *h)
 	free(h);
 }
 
-void *hash_table_lookup(struct hash_table *h, const char *key)
+/*
+Find the link pointing to the entry with this key, or null if it is not in the table.
+If found, also give the iteration position of the bucket holding it.
+*/
+
+static struct entry **hash_table_find_position(struct hash_table *h, const char *key, unsigned hash, int *position)
 {
-	struct entry *e;
-	unsigned hash, index;
+	struct entry **p;
+	unsigned index = hash % h->bucket_count;
+
+	for (p = &h->buckets[index]; *p; p = &(*p)->next) {
+		struct entry *e = *p;
+		if (hash == e->hash && (key == e->key || !strcmp(key, e->key))) {
+			*position = h->old_bucket_count + index;
+			return p;
+		}
+	}
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
+	if (!h->old_buckets)
+		return 0;
 
-	while (e) {
-		if (hash == e->hash && !strcmp(key, e->key)) {
-			return e->value;
+	index = hash % h->old_bucket_count;
+	if ((int)index < h->rehash_index)
+		return 0;
+
+	for (p = &h->old_buckets[index]; *p; p = &(*p)->next) {
+		struct entry *e = *p;
+		if (hash == e->hash && (key == e->key || !strcmp(key, e->key))) {
+			*position = index;
+			return p;
 		}
-		e = e->next;
 	}
 
 	return 0;
 }
 
-int hash_table_size(struct hash_table *h)
+static struct entry **hash_table_find(struct hash_table *h, const char *key, unsigned hash)
 {
-	return h->size;
+	int position;
+	return hash_table_find_position(h, key, hash, &position);
 }
 
-static int hash_table_double_buckets(struct hash_table *h)
+void *hash_table_lookup(struct hash_table *h, const char *key)
 {
-	struct hash_table *hn = hash_table_create(2 * h->bucket_count, h->hash_func);
+	struct entry **p = hash_table_find(h, key, h->hash_func(key));
+	return p ? (*p)->value : 0;
+}
 
-	if (!hn)
-		return 0;
+int hash_table_size(struct hash_table *h)
+{
+	return h->size;
+}
 
-	/* Move pairs to new hash */
-	char *key;
-	void *value;
-	hash_table_firstkey(h);
-	while (hash_table_nextkey(h, &key, &value))
-		if (!hash_table_insert(hn, key, value)) {
-			hash_table_delete(hn);
-			return 0;
-		}
+/* Move up to the given number of old buckets into the new bucket array. */
 
-	/* Delete all old pairs */
-	struct entry *e, *f;
-	int i;
-	for (i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+static void hash_table_rehash_step(struct hash_table *h, int steps)
+{
+	while (h->old_buckets && steps-- > 0) {
+		struct entry *e = h->old_buckets[h->rehash_index];
 		while (e) {
-			f = e->next;
-			free(e->key);
-			free(e);
+			struct entry *f = e->next;
+			unsigned index = e->hash % h->bucket_count;
+			e->next = h->buckets[index];
+			h->buckets[index] = e;
 			e = f;
 		}
+		h->old_buckets[h->rehash_index] = 0;
+
+		h->rehash_index++;
+		if (h->rehash_index >= h->old_bucket_count) {
+			free(h->old_buckets);
+			h->old_buckets = 0;
+			h->old_bucket_count = 0;
+			h->rehash_index = 0;
+		}
 	}
+}
 
-	/* Make the old point to the new */
-	free(h->buckets);
-	h->buckets = hn->buckets;
-	h->bucket_count = hn->bucket_count;
-	h->size = hn->size;
+static int hash_table_double_buckets(struct hash_table *h)
+{
+	/* A previous resize must be complete before starting another. */
+	if (h->old_buckets)
+		hash_table_rehash_step(h, h->old_bucket_count);
+
+	struct entry **buckets = (struct entry **)calloc(2 * h->bucket_count, sizeof(struct entry *));
+	if (!buckets)
+		return 0;
 
-	/* Delete reference to new, so old is safe */
-	free(hn);
+	h->old_buckets = h->buckets;
+	h->old_bucket_count = h->bucket_count;
+	h->rehash_index = 0;
+
+	h->buckets = buckets;
+	h->bucket_count = 2 * h->bucket_count;
 
 	return 1;
 }
@@ -155,29 +245,31 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 	struct entry *e;
 	unsigned hash, index;
 
-	if (((float)h->size / h->bucket_count) > DEFAULT_LOAD)
-		hash_table_double_buckets(h);
-
 	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
+	if (hash_table_find(h, key, hash))
+		return 0;
 
-	while (e) {
-		if (hash == e->hash && !strcmp(key, e->key))
-			return 0;
-		e = e->next;
+	if (h->old_buckets) {
+		hash_table_rehash_step(h, REHASH_STEP);
+	} else if (((float)h->size / h->bucket_count) > DEFAULT_LOAD) {
+		hash_table_double_buckets(h);
 	}
 
 	e = (struct entry *)malloc(sizeof(struct entry));
 	if (!e)
 		return 0;
 
-	e->key = strdup(key);
+	if (h->intern_keys) {
+		e->key = (char *)string_intern(key);
+	} else {
+		e->key = strdup(key);
+	}
 	if (!e->key) {
 		free(e);
 		return 0;
 	}
 
+	index = hash % h->bucket_count;
 	e->value = (void *)value;
 	e->hash = hash;
 	e->next = h->buckets[index];
@@ -189,33 +281,90 @@ int hash_table_insert(struct hash_table *h, const char *key, const void *value)
 
 void *hash_table_remove(struct hash_table *h, const char *key)
 {
-	struct entry *e, *f;
-	void *value;
-	unsigned hash, index;
+	struct entry **p = hash_table_find(h, key, h->hash_func(key));
+	if (!p)
+		return 0;
 
-	hash = h->hash_func(key);
-	index = hash % h->bucket_count;
-	e = h->buckets[index];
-	f = 0;
-
-	while (e) {
-		if (hash == e->hash && !strcmp(key, e->key)) {
-			if (f) {
-				f->next = e->next;
-			} else {
-				h->buckets[index] = e->next;
-			}
-			value = e->value;
-			free(e->key);
-			free(e);
-			h->size--;
-			return value;
-		}
-		f = e;
-		e = e->next;
+	struct entry *e = *p;
+	void *value = e->value;
+
+	/* Keep the internal iterator valid if it was about to visit this entry. */
+	if (h->iter.entry == e)
+		hash_table_iter_next(&h->iter, 0, 0);
+
+	*p = e->next;
+	hash_table_free_key(h, e->key);
+	free(e);
+	h->size--;
+
+	return value;
+}
+
+/*
+An iteration visits every bucket position once, old buckets first,
+beginning at the given start position and wrapping around the end.
+*/
+
+static int hash_table_bucket_positions(struct hash_table *h)
+{
+	return h->old_bucket_count + h->bucket_count;
+}
+
+static struct entry *hash_table_bucket_at(struct hash_table *h, int position)
+{
+	if (position < h->old_bucket_count)
+		return h->old_buckets[position];
+	else
+		return h->buckets[position - h->old_bucket_count];
+}
+
+/* Move the iterator to the first entry at or after its current bucket. */
+
+static void hash_table_iter_seek(struct hash_table_iter *it)
+{
+	struct hash_table *h = it->table;
+	int count = hash_table_bucket_positions(h);
+
+	it->entry = 0;
+	for (; it->bucket < count; it->bucket++) {
+		it->entry = hash_table_bucket_at(h, (it->start + it->bucket) % count);
+		if (it->entry)
+			break;
 	}
+}
 
-	return 0;
+static void hash_table_iter_start_at(struct hash_table *h, struct hash_table_iter *it, int start, int bucket)
+{
+	it->table = h;
+	it->start = start;
+	it->bucket = bucket;
+	hash_table_iter_seek(it);
+}
+
+void hash_table_iter_start(struct hash_table *h, struct hash_table_iter *it)
+{
+	hash_table_iter_start_at(h, it, 0, 0);
+}
+
+int hash_table_iter_next(struct hash_table_iter *it, char **key, void **value)
+{
+	struct entry *e = it->entry;
+	if (!e)
+		return 0;
+
+	if (key)
+		*key = e->key;
+	if (value)
+		*value = e->value;
+
+	if (e->next) {
+		it->entry = e->next;
+	} else {
+		it->bucket++;
+		hash_table_iter_seek(it);
+	}
+
+	return 1;
 }
 
 int hash_table_fromkey(struct hash_table *h, const char *key)
@@ -227,103 +376,40 @@ int hash_table_fromkey(struct hash_table *h, const char *key)
 	}
 
 	unsigned hash = h->hash_func(key);
-	h->ibucket = hash % h->bucket_count;
-	h->ientry = h->buckets[h->ibucket];
-
-	while (h->ientry) {
-		if (hash == h->ientry->hash && !strcmp(key, h->ientry->key)) {
-			return 1;
-		}
-		h->ientry = h->ientry->next;
+	int position;
+	struct entry **p = hash_table_find_position(h, key, hash, &position);
+	if (!p) {
+		hash_table_firstkey(h);
+		return 0;
 	}
 
-	hash_table_firstkey(h);
-	return 0;
+	hash_table_iter_start_at(h, &h->iter, 0, position);
+	h->iter.entry = *p;
+
+	return 1;
 }
 
 void hash_table_firstkey(struct hash_table *h)
 {
-	h->ientry = 0;
-	for (h->ibucket = 0; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
-		if (h->ientry)
-			break;
-	}
+	hash_table_iter_start(h, &h->iter);
 }
 
 int hash_table_nextkey(struct hash_table *h, char **key, void **value)
 {
-	if (h->ientry) {
-		*key = h->ientry->key;
-		*value = h->ientry->value;
-
-		h->ientry = h->ientry->next;
-		if (!h->ientry) {
-			h->ibucket++;
-			for (; h->ibucket < h->bucket_count; h->ibucket++) {
-				h->ientry = h->buckets[h->ibucket];
-				if (h->ientry)
-					break;
-			}
-		}
-		return 1;
-	} else {
-		return 0;
-	}
+	return hash_table_iter_next(&h->iter, key, value);
 }
 
 void hash_table_randomkey(struct hash_table *h, int *offset_bookkeep)
 {
-	h->ientry = 0;
-	if (h->bucket_count < 1) {
-		return;
-	}
-
-	int ibucket_start = random() % h->bucket_count;
-
-	for (h->ibucket = ibucket_start; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
-		if (h->ientry) {
-			*offset_bookkeep = h->ibucket;
-			return;
-		}
-	}
-
-	for (h->ibucket = 0; h->ibucket < ibucket_start; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
-		if (h->ientry) {
-			*offset_bookkeep = h->ibucket;
-			return;
-		}
-	}
+	int start = random() % hash_table_bucket_positions(h);
+	hash_table_iter_start_at(h, &h->iter, start, 0);
+	*offset_bookkeep = start;
 }
 
 int hash_table_nextkey_with_offset(struct hash_table *h, int offset_bookkeep, char **key, void **value)
 {
-	if (h->bucket_count < 1) {
-		return 0;
-	}
-
-	offset_bookkeep = offset_bookkeep % h->bucket_count;
-
-	if (h->ientry) {
-		*key = h->ientry->key;
-		*value = h->ientry->value;
-
-		h->ientry = h->ientry->next;
-		if (!h->ientry) {
-			h->ibucket = (h->ibucket + 1) % h->bucket_count;
-			for (; h->ibucket != offset_bookkeep; h->ibucket = (h->ibucket + 1) % h->bucket_count) {
-				h->ientry = h->buckets[h->ibucket];
-				if (h->ientry) {
-					break;
-				}
-			}
-		}
-		return 1;
-	}
-
-	return 0;
+	/* The offset is recorded in the iterator by hash_table_randomkey. */
+	return hash_table_iter_next(&h->iter, key, value);
 }
 
 typedef unsigned long int ub4; /* unsigned 4-byte quantities */
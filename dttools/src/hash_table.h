@@ -34,8 +34,29 @@ while(hash_table_nextkey(&key,&value)) {
 	printf("table contains: %s\n",key);
 }
 </pre>
+
+To allow nested iterations, use @ref hash_table_iter_start and @ref hash_table_iter_next with an iterator of your own.
+
+The table grows incrementally: when it becomes too full, its entries are moved
+to a larger bucket array a few buckets at a time by the inserts that follow,
+so that no single insert pays for moving the whole table.
+As an insert may move entries, no keys may be inserted during an iteration of either kind;
+collect them and insert them once the iteration is over.
+*/
+
+/** An iterator over a hash table, see @ref hash_table_iter_start.
+The iterator is an ordinary value that may live on the stack,
+so several iterations over the same table may proceed at once.
+Its fields are private to the hash table module.
 */
 
+struct hash_table_iter {
+	struct hash_table *table;
+	int start;
+	int bucket;
+	void *entry;
+};
+
 /** The type signature for a hash function given to @ref hash_table_create */
 
 typedef unsigned (*hash_func_t) (const char *key);
@@ -48,6 +69,17 @@ typedef unsigned (*hash_func_t) (const char *key);
 
 struct hash_table *hash_table_create(int buckets, hash_func_t func);
 
+/** Create a new hash table whose keys are interned strings.
+Keys are stored with @ref string_intern rather than copied,
+so that a key shared by several such tables is stored only once,
+and lookups with an interned key compare by pointer first.
+@param buckets The number of buckets in the table.  If zero, a default value will be used.
+@param func The default hash function to be used.  If zero, @ref hash_string will be used.
+@return A pointer to a new hash table.
+*/
+
+struct hash_table *hash_table_create_interned(int buckets, hash_func_t func);
+
 /** Remove all entries from an hash table.
 @param h The hash table to delete.
 @param delete_func If non-null, will be invoked on each object to delete it.
@@ -102,6 +134,8 @@ void *hash_table_remove(struct hash_table *h, const char *key);
 This function begins a new iteration over a hash table,
 allowing you to visit every key and value in the table.
 Next, invoke @ref hash_table_nextkey to retrieve each value in order.
+The entry most recently returned may be removed during the iteration,
+but no entries may be inserted until the iteration is over.
 @param h A pointer to a hash table.
 */
 
@@ -117,6 +151,26 @@ This function returns the next key and value in the iteration.
 
 int hash_table_nextkey(struct hash_table *h, char **key, void **value);
 
+/** Begin an iteration over all keys with an external iterator.
+Invoke @ref hash_table_iter_next to retrieve each value in order.
+Unlike @ref hash_table_firstkey, this does not disturb other iterations over the same table.
+The entry most recently returned may be removed from the table during the iteration,
+but other entries may not be removed, and no entries may be inserted.
+@param h A pointer to a hash table.
+@param it A pointer to an iterator to initialize.
+*/
+
+void hash_table_iter_start(struct hash_table *h, struct hash_table_iter *it);
+
+/** Continue an iteration with an external iterator.
+@param it A pointer to an iterator initialized by @ref hash_table_iter_start.
+@param key A pointer to a key pointer, or null.
+@param value A pointer to a value pointer, or null.
+@return Zero if there are no more elements to visit, one otherwise.
+*/
+
+int hash_table_iter_next(struct hash_table_iter *it, char **key, void **value);
+
 /** Begin iteration over all keys from a random offset.
 This function begins a new iteration over a hash table,
 allowing you to visit every key and value in the table.
@@ -172,6 +226,21 @@ HASH_TABLE_ITERATE(table,key,value) {
 
 #define HASH_TABLE_ITERATE( table, key, value ) hash_table_firstkey(table); while(hash_table_nextkey(table,&key,(void**)&value))
 
+/** Utility macro to iterate over a hash table with an external iterator, which allows nested iterations.
+
+<pre>
+struct hash_table_iter it;
+char *key;
+void *value;
+
+HASH_TABLE_ITERATE_WITH(table,it,key,value) {
+	printf("table contains: %s\n",key);
+}
+</pre>
+*/
+
+#define HASH_TABLE_ITERATE_WITH( table, iter, key, value ) for(hash_table_iter_start(table,&iter); hash_table_iter_next(&iter,&key,(void**)&value);)
+
 #define HASH_TABLE_ITERATE_RANDOM_START( table, offset_bookkeep, key, value ) hash_table_randomkey(table, &offset_bookkeep); while(hash_table_nextkey_with_offset(table, offset_bookkeep, &key, (void **)&value))
 
 #define HASH_TABLE_ITERATE_FROM_KEY( table, iter_control, iter_count_var, key_start, key, value ) \
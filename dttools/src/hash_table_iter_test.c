@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "hash_table.h"
+#include "itable.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 50000
+
+int main(int argc, char **argv)
+{
+	char buffer[32];
+	char *key, *inner_key;
+	void *value, *inner_value;
+	int i;
+
+	/* Every key stays visible while the table grows a few buckets at a time. */
+	struct hash_table *h = hash_table_create(0, 0);
+	for (i = 0; i < N; i++) {
+		sprintf(buffer, "key-%d", i);
+		if (!hash_table_insert(h, buffer, (void *)(long)(i + 1)))
+			FAIL("could not insert %s", buffer);
+		if (hash_table_insert(h, buffer, (void *)(long)(i + 1)))
+			FAIL("duplicate %s was inserted", buffer);
+		int j = i / 2;
+		sprintf(buffer, "key-%d", j);
+		if (hash_table_lookup(h, buffer) != (void *)(long)(j + 1))
+			FAIL("lost %s after %d inserts", buffer, i + 1);
+	}
+
+	/* Iterations visit every entry once, including nested ones. */
+	long sum = 0;
+	int count = 0, inner_count = 0;
+	struct hash_table_iter outer, inner;
+	HASH_TABLE_ITERATE_WITH(h, outer, key, value)
+	{
+		sum += (long)value;
+		if (count++ < 3) {
+			HASH_TABLE_ITERATE_WITH(h, inner, inner_key, inner_value)
+			{
+				inner_count++;
+			}
+		}
+	}
+	if (count != N || sum != (long)N * (N + 1) / 2 || inner_count != 3 * N)
+		FAIL("iteration visited %d entries, sum %ld, nested %d", count, sum, inner_count);
+
+	count = 0;
+	int random_offset;
+	HASH_TABLE_ITERATE_RANDOM_START(h, random_offset, key, value)
+	{
+		count++;
+	}
+	if (count != N)
+		FAIL("random start iteration visited %d entries", count);
+
+	/* The current entry may be removed during an iteration. */
+	count = 0;
+	HASH_TABLE_ITERATE_WITH(h, outer, key, value)
+	{
+		if ((long)value % 2 == 0)
+			hash_table_remove(h, key);
+		count++;
+	}
+	if (count != N || hash_table_size(h) != N / 2)
+		FAIL("removing while iterating visited %d and kept %d", count, hash_table_size(h));
+
+	HASH_TABLE_ITERATE(h, key, value)
+	{
+		hash_table_remove(h, key);
+	}
+	if (hash_table_size(h) != 0)
+		FAIL("removing during iteration left %d entries", hash_table_size(h));
+	hash_table_delete(h);
+
+	/* The same for integer tables. */
+	struct itable *t = itable_create(0);
+	UINT64_T ikey;
+	for (i = 0; i < N; i++) {
+		itable_insert(t, i, (void *)(long)(i + 1));
+		if (itable_lookup(t, i / 2) != (void *)(long)(i / 2 + 1))
+			FAIL("lost %d after %d inserts", i / 2, i + 1);
+	}
+
+	struct itable_iter iiter;
+	sum = 0;
+	count = 0;
+	ITABLE_ITERATE_WITH(t, iiter, ikey, value)
+	{
+		sum += (long)value;
+		itable_insert(t, ikey, value);
+		if (ikey % 2)
+			itable_remove(t, ikey);
+		count++;
+	}
+	if (count != N || sum != (long)N * (N + 1) / 2 || itable_size(t) != N / 2)
+		FAIL("itable iteration visited %d entries, sum %ld, kept %d", count, sum, itable_size(t));
+
+	while (itable_pop(t))
+		;
+	if (itable_size(t) != 0)
+		FAIL("itable_pop left %d entries", itable_size(t));
+	itable_delete(t);
+
+	fprintf(stdout, "hash table iteration is correct\n");
+	return 0;
+}
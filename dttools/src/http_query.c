@@ -10,19 +10,37 @@ See the file COPYING for details.
 #include "buffer.h"
 #include "debug.h"
 #include "domain_name_cache.h"
+#include "hash_table.h"
+#include "macros.h"
 #include "stringtools.h"
 #include "url_encode.h"
+#include "xxmalloc.h"
+
+#include "zlib.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #define HTTP_LINE_MAX 4096
 #define HTTP_PORT 80
 
+/* Idle connections kept for reuse, and how long each may stay idle. */
+#define HTTP_POOL_MAX 8
+#define HTTP_POOL_IDLE_TIMEOUT 30
+
+/* Responses kept for revalidation, and the largest response kept. */
+#define HTTP_CACHE_MAX 32
+#define HTTP_CACHE_OBJECT_MAX (64 * 1024 * 1024)
+
+/* Redirects followed before giving up. */
+#define HTTP_REDIRECT_MAX 8
+
 static int http_response_to_errno(int response)
 {
 	if (response <= 299) {
@@ -62,10 +80,12 @@ struct link *http_query(const char *url, const char *action, time_t stoptime)
 	return http_query_size(url, action, &size, stoptime, 0);
 }
 
-struct link *http_query_size(const char *url, const char *action, INT64_T *size, time_t stoptime, int cache_reload)
+static struct link *http_query_range_via_proxy(const char *proxy, const char *url, const char *action, INT64_T offset, INT64_T *size, time_t stoptime, int cache_reload);
+
+static struct link *http_query_range_any_proxy(const char *url, const char *action, INT64_T offset, INT64_T *size, time_t stoptime, int cache_reload)
 {
 	if (!getenv("HTTP_PROXY")) {
-		return http_query_size_via_proxy(0, url, action, size, stoptime, cache_reload);
+		return http_query_range_via_proxy(0, url, action, offset, size, stoptime, cache_reload);
 	} else {
 		char proxies[HTTP_LINE_MAX];
 		char *proxy;
@@ -75,7 +95,7 @@ struct link *http_query_size(const char *url, const char *action, INT64_T *size,
 
 		while (proxy) {
 			struct link *result;
-			result = http_query_size_via_proxy(proxy, url, action, size, stoptime, cache_reload);
+			result = http_query_range_via_proxy(proxy, url, action, offset, size, stoptime, cache_reload);
 			if (result)
 				return result;
 			proxy = strtok(0, ";");
@@ -84,20 +104,33 @@ struct link *http_query_size(const char *url, const char *action, INT64_T *size,
 	}
 }
 
-struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T *size, time_t stoptime, int cache_reload)
+struct link *http_query_size(const char *url, const char *action, INT64_T *size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_any_proxy(url, action, -1, size, stoptime, cache_reload);
+}
+
+struct link *http_query_range(const char *url, INT64_T offset, INT64_T *size, time_t stoptime)
+{
+	return http_query_range_any_proxy(url, "GET", offset, size, stoptime, 0);
+}
+
+struct link *http_query_size_via_proxy(const char *proxy, const char *url, const char *action, INT64_T *size, time_t stoptime, int cache_reload)
+{
+	return http_query_range_via_proxy(proxy, url, action, -1, size, stoptime, cache_reload);
+}
+
+/*
+Find the host and port to connect to for a url, either that of the url
+or of the proxy, and the Request-URI to send: the whole url to a proxy,
+but only the path to the server itself.  The url must be at least
+HTTP_LINE_MAX bytes, and host must be HTTP_LINE_MAX bytes.
+*/
+
+static int http_parse_url(const char *proxy, const char *urlin, char *url, char *actual_host, int *port)
 {
-	char url[HTTP_LINE_MAX];
-	char newurl[HTTP_LINE_MAX];
-	char line[HTTP_LINE_MAX];
-	char addr[LINK_ADDRESS_MAX];
-	struct link *link;
-	int save_errno;
-	int response;
-	char actual_host[HTTP_LINE_MAX];
 	int actual_port;
-	*size = 0;
 
-	url_encode(urlin, url, sizeof(url));
+	url_encode(urlin, url, HTTP_LINE_MAX);
 
 	if (proxy && !strcmp(proxy, "DIRECT"))
 		proxy = 0;
@@ -132,10 +165,47 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 			delta = delta + 1 + s_port; /* 1 is for the colon between host and port. */
 		}
 		memmove(url, url + delta, strlen(url) - delta + 1); /* 1: copy the terminating null character */
+		if (!url[0])
+			strcpy(url, "/");
 	}
 
+	*port = actual_port;
+	return 1;
+}
+
+static void http_put_user_agent(buffer_t *B)
+{
+	if (getenv("HTTP_USER_AGENT"))
+		buffer_printf(B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/ %s)\r\n", CCTOOLS_VERSION, getenv("HTTP_USER_AGENT"));
+	else
+		buffer_printf(B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/)\r\n", CCTOOLS_VERSION);
+}
+
+/*
+A negative offset asks for the whole object.  Otherwise only the bytes
+from offset to the end are requested, and size is set to their count.
+A server that ignores the range answers 200 with the whole object,
+which is refused with ESPIPE so the caller does not read the wrong bytes.
+*/
+
+static struct link *http_query_range_via_proxy(const char *proxy, const char *urlin, const char *action, INT64_T offset, INT64_T *size, time_t stoptime, int cache_reload)
+{
+	char url[HTTP_LINE_MAX];
+	char newurl[HTTP_LINE_MAX];
+	char line[HTTP_LINE_MAX];
+	char addr[LINK_ADDRESS_MAX];
+	struct link *link;
+	int save_errno;
+	int response;
+	char actual_host[HTTP_LINE_MAX];
+	int actual_port;
+	*size = 0;
+
+	if (!http_parse_url(proxy, urlin, url, actual_host, &actual_port))
+		return 0;
+
 	debug(D_HTTP, "connect %s port %d", actual_host, actual_port);
-	if (!domain_name_cache_lookup(actual_host, addr))
+	if (!domain_name_cache_lookup_timeout(actual_host, addr, stoptime))
 		return 0;
 
 	link = link_connect(addr, actual_port, stoptime);
@@ -153,12 +223,11 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 		buffer_printf(&B, "%s %s HTTP/1.1\r\n", action, url);
 		if (cache_reload)
 			buffer_putliteral(&B, "Cache-Control: max-age=0\r\n");
+		if (offset >= 0)
+			buffer_printf(&B, "Range: bytes=%" PRId64 "-\r\n", offset);
 		buffer_putliteral(&B, "Connection: close\r\n");
 		buffer_printf(&B, "Host: %s\r\n", actual_host);
-		if (getenv("HTTP_USER_AGENT"))
-			buffer_printf(&B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/ %s)\r\n", CCTOOLS_VERSION, getenv("HTTP_USER_AGENT"));
-		else
-			buffer_printf(&B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/)\r\n", CCTOOLS_VERSION);
+		http_put_user_agent(&B);
 		buffer_putliteral(&B, "\r\n"); /* header terminator */
 
 		debug(D_HTTP, "%s", buffer_tostring(&B));
@@ -184,6 +253,20 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 
 			switch (response) {
 			case 200:
+				if (offset > 0) {
+					debug(D_HTTP, "server ignored range request for %s", url);
+					link_close(link);
+					errno = ESPIPE;
+					return 0;
+				}
+				return link;
+				break;
+			case 206:
+				if (offset < 0) {
+					link_close(link);
+					errno = EIO;
+					return 0;
+				}
 				return link;
 				break;
 			case 301:
@@ -197,7 +280,7 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 						errno = EIO;
 						return 0;
 					} else {
-						return http_query_size_via_proxy(proxy, newurl, action, size, stoptime, cache_reload);
+						return http_query_range_via_proxy(proxy, newurl, action, offset, size, stoptime, cache_reload);
 					}
 				} else {
 					errno = ENOENT;
@@ -224,6 +307,474 @@ struct link *http_query_size_via_proxy(const char *proxy, const char *urlin, con
 	return 0;
 }
 
+/*
+http_query_buffer fetches a whole object into memory, which lets it
+reuse connections: once the body has been read, a connection to a
+server that keeps it alive goes back to a small pool of idle connections,
+keyed by the host and port connected to, and the next query to the same
+place sends its request there instead of connecting again.  An idle
+connection that the server has closed is noticed by its becoming readable,
+and a request on a reused connection that fails before any response is
+retried once on a new connection.
+
+Bodies are requested with gzip encoding, and responses that carry an ETag
+or Last-Modified are kept, so that the next query of the same url can ask
+the server to revalidate them and receive only a 304 if unchanged.
+*/
+
+struct http_connection {
+	char key[HTTP_LINE_MAX + 16];
+	struct link *link;
+	time_t last_used;
+};
+
+struct http_cached_response {
+	char *etag;
+	char *last_modified;
+	char *data;
+	size_t length;
+};
+
+static struct http_connection http_pool[HTTP_POOL_MAX];
+static struct hash_table *http_cache = 0;
+static pthread_mutex_t http_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct link *http_pool_get(const char *key)
+{
+	struct link *link = 0;
+	time_t now = time(0);
+	int i;
+
+	pthread_mutex_lock(&http_mutex);
+	for (i = 0; i < HTTP_POOL_MAX; i++) {
+		struct http_connection *c = &http_pool[i];
+		if (!c->link)
+			continue;
+		/* An idle connection is readable only if the server closed it. */
+		if (now - c->last_used > HTTP_POOL_IDLE_TIMEOUT || link_usleep(c->link, 0, 1, 0)) {
+			link_close(c->link);
+			c->link = 0;
+		} else if (!link && !strcmp(c->key, key)) {
+			link = c->link;
+			c->link = 0;
+		}
+	}
+	pthread_mutex_unlock(&http_mutex);
+
+	return link;
+}
+
+static void http_pool_put(const char *key, struct link *link)
+{
+	struct http_connection *oldest = &http_pool[0];
+	int i;
+
+	pthread_mutex_lock(&http_mutex);
+	for (i = 0; i < HTTP_POOL_MAX; i++) {
+		struct http_connection *c = &http_pool[i];
+		if (!c->link) {
+			oldest = c;
+			break;
+		}
+		if (c->last_used < oldest->last_used)
+			oldest = c;
+	}
+	if (oldest->link)
+		link_close(oldest->link);
+	strncpy(oldest->key, key, sizeof(oldest->key) - 1);
+	oldest->link = link;
+	oldest->last_used = time(0);
+	pthread_mutex_unlock(&http_mutex);
+}
+
+static void http_cached_response_delete(struct http_cached_response *r)
+{
+	if (!r)
+		return;
+	free(r->etag);
+	free(r->last_modified);
+	free(r->data);
+	free(r);
+}
+
+/* Returns a copy of the cached body of a url, and its validators if wanted. */
+
+static char *http_cache_lookup(const char *url, size_t *length, char **etag, char **last_modified)
+{
+	char *data = 0;
+
+	pthread_mutex_lock(&http_mutex);
+	struct http_cached_response *r = http_cache ? hash_table_lookup(http_cache, url) : 0;
+	if (r) {
+		data = xxmalloc(r->length + 1);
+		memcpy(data, r->data, r->length);
+		data[r->length] = 0;
+		*length = r->length;
+		if (etag)
+			*etag = r->etag ? xxstrdup(r->etag) : 0;
+		if (last_modified)
+			*last_modified = r->last_modified ? xxstrdup(r->last_modified) : 0;
+	}
+	pthread_mutex_unlock(&http_mutex);
+
+	return data;
+}
+
+static void http_cache_store(const char *url, const char *etag, const char *last_modified, const char *data, size_t length)
+{
+	struct http_cached_response *r = 0;
+
+	if ((etag || last_modified) && length <= HTTP_CACHE_OBJECT_MAX) {
+		r = xxmalloc(sizeof(*r));
+		r->etag = etag ? xxstrdup(etag) : 0;
+		r->last_modified = last_modified ? xxstrdup(last_modified) : 0;
+		r->data = xxmalloc(length + 1);
+		memcpy(r->data, data, length);
+		r->length = length;
+	}
+
+	pthread_mutex_lock(&http_mutex);
+	if (!http_cache)
+		http_cache = hash_table_create(0, 0);
+
+	http_cached_response_delete(hash_table_remove(http_cache, url));
+
+	if (r) {
+		/* Make room by dropping an arbitrary response, as they are cheap to fetch again. */
+		if (hash_table_size(http_cache) >= HTTP_CACHE_MAX) {
+			char *key;
+			void *value;
+			hash_table_firstkey(http_cache);
+			if (hash_table_nextkey(http_cache, &key, &value))
+				http_cached_response_delete(hash_table_remove(http_cache, key));
+		}
+		hash_table_insert(http_cache, url, r);
+	}
+	pthread_mutex_unlock(&http_mutex);
+}
+
+/* Read a body delimited by chunked transfer encoding. */
+
+static int http_read_chunked(struct link *link, buffer_t *body, time_t stoptime)
+{
+	char line[HTTP_LINE_MAX];
+
+	while (link_readline(link, line, sizeof(line), stoptime)) {
+		size_t size = strtoul(line, 0, 16);
+		if (size == 0) {
+			/* Skip any trailer, up to the blank line. */
+			while (link_readline(link, line, sizeof(line), stoptime)) {
+				string_chomp(line);
+				if (!line[0])
+					return 1;
+			}
+			return 0;
+		}
+
+		char *data = xxmalloc(size);
+		ssize_t actual = link_read(link, data, size, stoptime);
+		if (actual == (ssize_t)size)
+			buffer_putlstring(body, data, size);
+		free(data);
+
+		if (actual != (ssize_t)size || !link_readline(link, line, sizeof(line), stoptime))
+			return 0;
+	}
+
+	return 0;
+}
+
+/* Read a body of known length, or up to the end of the connection if the length is negative. */
+
+static int http_read_length(struct link *link, buffer_t *body, INT64_T length, time_t stoptime)
+{
+	char data[65536];
+
+	while (length != 0) {
+		size_t want = length < 0 ? sizeof(data) : (size_t)MIN((INT64_T)sizeof(data), length);
+		ssize_t actual = link_read(link, data, want, stoptime);
+		if (actual <= 0)
+			return length < 0 && actual == 0;
+		buffer_putlstring(body, data, actual);
+		if (length > 0)
+			length -= actual;
+	}
+
+	return 1;
+}
+
+/* Decode a gzip encoded body into a new buffer, returning false if it is damaged. */
+
+static int http_gunzip(const char *data, size_t length, buffer_t *output)
+{
+	z_stream z;
+	char chunk[65536];
+	int result;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, 15 + 32) != Z_OK)
+		return 0;
+
+	z.next_in = (Bytef *)data;
+	z.avail_in = length;
+
+	do {
+		z.next_out = (Bytef *)chunk;
+		z.avail_out = sizeof(chunk);
+		result = inflate(&z, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END)
+			break;
+		buffer_putlstring(output, chunk, sizeof(chunk) - z.avail_out);
+	} while (result != Z_STREAM_END);
+
+	inflateEnd(&z);
+	return result == Z_STREAM_END;
+}
+
+/*
+Send one GET of url to proxy (or directly) and read the whole response.
+Returns the status code, or zero if no response was read.  If the
+connection was reused and failed before a response, *stale is set so
+that the caller tries once more.  A redirect location is put in newurl.
+*/
+
+static int http_buffer_attempt(const char *proxy, const char *urlin, int reuse, int *stale, buffer_t *body, char *newurl, char **etag, char **last_modified, time_t stoptime)
+{
+	char url[HTTP_LINE_MAX];
+	char line[HTTP_LINE_MAX];
+	char addr[LINK_ADDRESS_MAX];
+	char actual_host[HTTP_LINE_MAX];
+	char key[HTTP_LINE_MAX + 16];
+	int actual_port;
+	int response = 0;
+	int minor_version = 0;
+	int keep_alive = 1;
+	int chunked = 0;
+	int gzip = 0;
+	INT64_T length = -1;
+	struct link *link = 0;
+	char *cached_etag = 0;
+	char *cached_last_modified = 0;
+	size_t cached_length;
+
+	*stale = 0;
+	newurl[0] = 0;
+
+	if (!http_parse_url(proxy, urlin, url, actual_host, &actual_port))
+		return 0;
+
+	snprintf(key, sizeof(key), "%s:%d", actual_host, actual_port);
+
+	if (reuse)
+		link = http_pool_get(key);
+
+	if (link) {
+		debug(D_HTTP, "reusing connection to %s", key);
+	} else {
+		reuse = 0;
+		debug(D_HTTP, "connect %s port %d", actual_host, actual_port);
+		if (!domain_name_cache_lookup_timeout(actual_host, addr, stoptime))
+			return 0;
+		link = link_connect(addr, actual_port, stoptime);
+		if (!link) {
+			errno = ECONNRESET;
+			return 0;
+		}
+	}
+
+	free(http_cache_lookup(urlin, &cached_length, &cached_etag, &cached_last_modified));
+
+	buffer_t B;
+	buffer_init(&B);
+	buffer_abortonfailure(&B, 1);
+	buffer_printf(&B, "GET %s HTTP/1.1\r\n", url);
+	buffer_printf(&B, "Host: %s\r\n", actual_host);
+	buffer_putliteral(&B, "Connection: keep-alive\r\n");
+	buffer_putliteral(&B, "Accept-Encoding: gzip\r\n");
+	if (cached_etag)
+		buffer_printf(&B, "If-None-Match: %s\r\n", cached_etag);
+	if (cached_last_modified)
+		buffer_printf(&B, "If-Modified-Since: %s\r\n", cached_last_modified);
+	http_put_user_agent(&B);
+	buffer_putliteral(&B, "\r\n");
+	debug(D_HTTP, "%s", buffer_tostring(&B));
+	int sent = link_putlstring(link, buffer_tostring(&B), buffer_pos(&B), stoptime) == (ssize_t)buffer_pos(&B);
+	buffer_free(&B);
+	free(cached_etag);
+	free(cached_last_modified);
+
+	if (!sent || !link_readline(link, line, sizeof(line), stoptime)) {
+		debug(D_HTTP, "no response from %s", key);
+		*stale = reuse;
+		link_close(link);
+		errno = ECONNRESET;
+		return 0;
+	}
+
+	string_chomp(line);
+	debug(D_HTTP, "%s", line);
+	if (sscanf(line, "HTTP/1.%d %d", &minor_version, &response) != 2) {
+		debug(D_HTTP, "malformed response");
+		link_close(link);
+		errno = ECONNRESET;
+		return 0;
+	}
+	if (minor_version < 1)
+		keep_alive = 0;
+
+	while (link_readline(link, line, sizeof(line), stoptime)) {
+		string_chomp(line);
+		debug(D_HTTP, "%s", line);
+		if (!line[0])
+			break;
+
+		char *value = strchr(line, ':');
+		if (!value)
+			continue;
+		*value++ = 0;
+		while (isspace((unsigned char)*value))
+			value++;
+
+		if (!strcasecmp(line, "Content-Length")) {
+			length = strtoll(value, 0, 10);
+		} else if (!strcasecmp(line, "Transfer-Encoding")) {
+			chunked = strstr(value, "chunked") != 0;
+		} else if (!strcasecmp(line, "Content-Encoding")) {
+			gzip = strstr(value, "gzip") != 0;
+		} else if (!strcasecmp(line, "Connection")) {
+			if (!strcasecmp(value, "close"))
+				keep_alive = 0;
+		} else if (!strcasecmp(line, "Location")) {
+			snprintf(newurl, HTTP_LINE_MAX, "%s", value);
+		} else if (!strcasecmp(line, "ETag")) {
+			*etag = xxstrdup(value);
+		} else if (!strcasecmp(line, "Last-Modified")) {
+			*last_modified = xxstrdup(value);
+		}
+	}
+
+	int complete;
+	if (response == 304 || response == 204 || (response >= 100 && response < 200)) {
+		complete = 1;
+	} else if (chunked) {
+		complete = http_read_chunked(link, body, stoptime);
+	} else {
+		if (length < 0)
+			keep_alive = 0;
+		complete = http_read_length(link, body, length, stoptime);
+	}
+
+	if (complete && keep_alive) {
+		http_pool_put(key, link);
+	} else {
+		link_close(link);
+	}
+
+	if (!complete) {
+		debug(D_HTTP, "incomplete response from %s", key);
+		errno = ECONNRESET;
+		return 0;
+	}
+
+	if (gzip && response == 200) {
+		buffer_t plain;
+		buffer_init(&plain);
+		if (!http_gunzip(buffer_tostring(body), buffer_pos(body), &plain)) {
+			debug(D_HTTP, "couldn't decode gzip response from %s", key);
+			buffer_free(&plain);
+			errno = EIO;
+			return 0;
+		}
+		buffer_rewind(body, 0);
+		buffer_putlstring(body, buffer_tostring(&plain), buffer_pos(&plain));
+		buffer_free(&plain);
+	}
+
+	return response;
+}
+
+static char *http_query_buffer_via_proxy(const char *proxy, const char *url, size_t *length, time_t stoptime, int redirects)
+{
+	char newurl[HTTP_LINE_MAX];
+	char *etag = 0;
+	char *last_modified = 0;
+	char *result = 0;
+	int response, stale;
+	buffer_t body;
+
+	buffer_init(&body);
+	buffer_abortonfailure(&body, 1);
+
+	response = http_buffer_attempt(proxy, url, 1, &stale, &body, newurl, &etag, &last_modified, stoptime);
+	if (!response && stale) {
+		buffer_rewind(&body, 0);
+		response = http_buffer_attempt(proxy, url, 0, &stale, &body, newurl, &etag, &last_modified, stoptime);
+	}
+
+	switch (response) {
+	case 0:
+		break;
+	case 200:
+		*length = buffer_pos(&body);
+		result = xxmalloc(*length + 1);
+		memcpy(result, buffer_tostring(&body), *length);
+		result[*length] = 0;
+		http_cache_store(url, etag, last_modified, result, *length);
+		break;
+	case 304:
+		result = http_cache_lookup(url, length, 0, 0);
+		if (result) {
+			debug(D_HTTP, "%s is unchanged", url);
+		} else {
+			errno = EIO;
+		}
+		break;
+	case 301:
+	case 302:
+	case 303:
+	case 307:
+	case 308:
+		if (!newurl[0]) {
+			errno = ENOENT;
+		} else if (!strcmp(url, newurl) || redirects >= HTTP_REDIRECT_MAX) {
+			debug(D_HTTP, "error: server gave %d redirect from %s to %s too many times!", response, url, newurl);
+			errno = EIO;
+		} else {
+			result = http_query_buffer_via_proxy(proxy, newurl, length, stoptime, redirects + 1);
+		}
+		break;
+	default:
+		errno = http_response_to_errno(response);
+		break;
+	}
+
+	free(etag);
+	free(last_modified);
+	buffer_free(&body);
+	return result;
+}
+
+char *http_query_buffer(const char *url, size_t *length, time_t stoptime)
+{
+	if (!getenv("HTTP_PROXY")) {
+		return http_query_buffer_via_proxy(0, url, length, stoptime, 0);
+	} else {
+		char proxies[HTTP_LINE_MAX];
+		char *proxy, *saveptr;
+
+		snprintf(proxies, sizeof(proxies), "%s", getenv("HTTP_PROXY"));
+		proxy = strtok_r(proxies, ";", &saveptr);
+
+		while (proxy) {
+			char *result = http_query_buffer_via_proxy(proxy, url, length, stoptime, 0);
+			if (result)
+				return result;
+			proxy = strtok_r(0, ";", &saveptr);
+		}
+		return 0;
+	}
+}
+
 INT64_T http_fetch_to_file(const char *url, const char *filename, time_t stoptime)
 {
 	FILE *file;
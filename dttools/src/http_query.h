@@ -14,8 +14,20 @@ See the file COPYING for details.
 struct link *http_query(const char *url, const char *action, time_t stoptime);
 struct link *http_query_no_cache(const char *url, const char *action, time_t stoptime);
 struct link *http_query_size(const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
+struct link *http_query_range(const char *url, INT64_T offset, INT64_T * size, time_t stoptime);
 struct link *http_query_size_via_proxy(const char *proxy, const char *url, const char *action, INT64_T * size, time_t stoptime, int cache_reload);
 
+/** Fetch a whole object with GET into memory.
+Connections to a server that allows keep-alive are kept and reused by later
+calls, the body may be sent gzip encoded, and a response with an ETag or
+Last-Modified is kept and revalidated with the server on the next call.
+@param url The http url to fetch.
+@param length Set to the length of the body.
+@param stoptime The absolute time at which to abort.
+@return The body, null terminated, which the caller must free, or null with errno set on failure.
+*/
+char *http_query_buffer(const char *url, size_t *length, time_t stoptime);
+
 INT64_T http_fetch_to_file(const char *url, const char *filename, time_t stoptime);
 
 #endif
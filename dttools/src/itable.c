@@ -13,18 +13,32 @@ See the file COPYING for details.
 #define DEFAULT_SIZE 127
 #define DEFAULT_LOAD 0.75
 
+/* Number of old buckets moved to the new bucket array on each insert while resizing. */
+#define REHASH_STEP 4
+
 struct entry {
 	UINT64_T key;
 	void *value;
 	struct entry *next;
 };
 
+/*
+As in hash_table, the table grows incrementally: the previous bucket
+array is kept in old_buckets while each insert moves a few of its
+buckets to the new array.  Lookups and removals consult both arrays
+until the move is complete.  For iteration, buckets are numbered with
+the old ones first, followed by the new ones.  As inserts of new keys
+move entries, they are not allowed during an iteration.
+*/
+
 struct itable {
 	int size;
 	int bucket_count;
 	struct entry **buckets;
-	int ibucket;
-	struct entry *ientry;
+	struct entry **old_buckets;
+	int old_bucket_count;
+	int rehash_index;
+	struct itable_iter iter;
 };
 
 struct itable *itable_create(int bucket_count)
@@ -46,17 +60,24 @@ struct itable *itable_create(int bucket_count)
 	}
 
 	h->size = 0;
+	h->old_buckets = 0;
+	h->old_bucket_count = 0;
+	h->rehash_index = 0;
+
+	h->iter.table = h;
+	h->iter.bucket = 0;
+	h->iter.entry = 0;
 
 	return h;
 }
 
-void itable_clear(struct itable *h, void (*delete_func)(void *))
+static void itable_clear_buckets(struct entry **buckets, int bucket_count, void (*delete_func)(void *))
 {
 	struct entry *e, *f;
 	int i;
 
-	for (i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+	for (i = 0; i < bucket_count; i++) {
+		e = buckets[i];
 		while (e) {
 			if (delete_func)
 				delete_func(e->value);
@@ -64,11 +85,23 @@ void itable_clear(struct itable *h, void (*delete_func)(void *))
 			free(e);
 			e = f;
 		}
+		buckets[i] = 0;
 	}
+}
 
-	for (i = 0; i < h->bucket_count; i++) {
-		h->buckets[i] = 0;
+void itable_clear(struct itable *h, void (*delete_func)(void *))
+{
+	itable_clear_buckets(h->buckets, h->bucket_count, delete_func);
+
+	if (h->old_buckets) {
+		itable_clear_buckets(h->old_buckets, h->old_bucket_count, delete_func);
+		free(h->old_buckets);
+		h->old_buckets = 0;
+		h->old_bucket_count = 0;
 	}
+
+	h->size = 0;
+	h->iter.entry = 0;
 }
 
 void itable_delete(struct itable *h)
@@ -83,61 +116,79 @@ int itable_size(struct itable *h)
 	return h->size;
 }
 
-void *itable_lookup(struct itable *h, UINT64_T key)
+/* Find the link pointing to the entry with this key, or null if it is not in the table. */
+
+static struct entry **itable_find(struct itable *h, UINT64_T key)
 {
-	struct entry *e;
-	UINT64_T index;
+	struct entry **p;
 
-	index = key % h->bucket_count;
-	e = h->buckets[index];
+	for (p = &h->buckets[key % h->bucket_count]; *p; p = &(*p)->next) {
+		if ((*p)->key == key)
+			return p;
+	}
 
-	while (e) {
-		if (key == e->key) {
-			return e->value;
-		}
-		e = e->next;
+	if (!h->old_buckets)
+		return 0;
+
+	UINT64_T index = key % h->old_bucket_count;
+	if (index < (UINT64_T)h->rehash_index)
+		return 0;
+
+	for (p = &h->old_buckets[index]; *p; p = &(*p)->next) {
+		if ((*p)->key == key)
+			return p;
 	}
 
 	return 0;
 }
 
-static int itable_double_buckets(struct itable *h)
+void *itable_lookup(struct itable *h, UINT64_T key)
 {
-	struct itable *hn = itable_create(2 * h->bucket_count);
+	struct entry **p = itable_find(h, key);
+	return p ? (*p)->value : 0;
+}
 
-	if (!hn)
-		return 0;
+/* Move up to the given number of old buckets into the new bucket array. */
 
-	/* Move pairs to new hash */
-	uint64_t key;
-	void *value;
-	itable_firstkey(h);
-	while (itable_nextkey(h, &key, &value))
-		if (!itable_insert(hn, key, value)) {
-			itable_delete(hn);
-			return 0;
-		}
-
-	/* Delete all old pairs */
-	struct entry *e, *f;
-	int i;
-	for (i = 0; i < h->bucket_count; i++) {
-		e = h->buckets[i];
+static void itable_rehash_step(struct itable *h, int steps)
+{
+	while (h->old_buckets && steps-- > 0) {
+		struct entry *e = h->old_buckets[h->rehash_index];
 		while (e) {
-			f = e->next;
-			free(e);
+			struct entry *f = e->next;
+			UINT64_T index = e->key % h->bucket_count;
+			e->next = h->buckets[index];
+			h->buckets[index] = e;
 			e = f;
 		}
+		h->old_buckets[h->rehash_index] = 0;
+
+		h->rehash_index++;
+		if (h->rehash_index >= h->old_bucket_count) {
+			free(h->old_buckets);
+			h->old_buckets = 0;
+			h->old_bucket_count = 0;
+			h->rehash_index = 0;
+		}
 	}
+}
 
-	/* Make the old point to the new */
-	free(h->buckets);
-	h->buckets = hn->buckets;
-	h->bucket_count = hn->bucket_count;
-	h->size = hn->size;
+static int itable_double_buckets(struct itable *h)
+{
+	/* A previous resize must be complete before starting another. */
+	if (h->old_buckets)
+		itable_rehash_step(h, h->old_bucket_count);
+
+	struct entry **buckets = (struct entry **)calloc(2 * h->bucket_count, sizeof(struct entry *));
+	if (!buckets)
+		return 0;
 
-	/* Delete reference to new, so old is safe */
-	free(hn);
+	h->old_buckets = h->buckets;
+	h->old_bucket_count = h->bucket_count;
+	h->rehash_index = 0;
+
+	h->buckets = buckets;
+	h->bucket_count = 2 * h->bucket_count;
 
 	return 1;
 }
@@ -147,24 +198,24 @@ int itable_insert(struct itable *h, UINT64_T key, const void *value)
 	struct entry *e;
 	UINT64_T index;
 
-	if (((float)h->size / h->bucket_count) > DEFAULT_LOAD)
-		itable_double_buckets(h);
-
-	index = key % h->bucket_count;
-	e = h->buckets[index];
+	struct entry **p = itable_find(h, key);
+	if (p) {
+		(*p)->value = (void *)value;
+		return 1;
+	}
 
-	while (e) {
-		if (key == e->key) {
-			e->value = (void *)value;
-			return 1;
-		}
-		e = e->next;
+	/* Only new keys move entries, so that updating values does not disturb an iteration. */
+	if (h->old_buckets) {
+		itable_rehash_step(h, REHASH_STEP);
+	} else if (((float)h->size / h->bucket_count) > DEFAULT_LOAD) {
+		itable_double_buckets(h);
 	}
 
 	e = (struct entry *)malloc(sizeof(struct entry));
 	if (!e)
 		return 0;
 
+	index = key % h->bucket_count;
 	e->key = key;
 	e->value = (void *)value;
 	e->next = h->buckets[index];
@@ -176,31 +227,22 @@ int itable_insert(struct itable *h, UINT64_T key, const void *value)
 
 void *itable_remove(struct itable *h, UINT64_T key)
 {
-	struct entry *e, *f;
-	void *value;
-	UINT64_T index;
+	struct entry **p = itable_find(h, key);
+	if (!p)
+		return 0;
 
-	index = key % h->bucket_count;
-	e = h->buckets[index];
-	f = 0;
-
-	while (e) {
-		if (key == e->key) {
-			if (f) {
-				f->next = e->next;
-			} else {
-				h->buckets[index] = e->next;
-			}
-			value = e->value;
-			free(e);
-			h->size--;
-			return value;
-		}
-		f = e;
-		e = e->next;
-	}
+	struct entry *e = *p;
+	void *value = e->value;
 
-	return 0;
+	/* Keep the internal iterator valid if it was about to visit this entry. */
+	if (h->iter.entry == e)
+		itable_iter_next(&h->iter, 0, 0);
+
+	*p = e->next;
+	free(e);
+	h->size--;
+
+	return value;
 }
 
 void *itable_pop(struct itable *t)
@@ -216,37 +258,65 @@ void *itable_pop(struct itable *t)
 	}
 }
 
-void itable_firstkey(struct itable *h)
+static struct entry *itable_bucket_at(struct itable *h, int position)
+{
+	if (position < h->old_bucket_count)
+		return h->old_buckets[position];
+	else
+		return h->buckets[position - h->old_bucket_count];
+}
+
+/* Move the iterator to the first entry at or after its current bucket. */
+
+static void itable_iter_seek(struct itable_iter *it)
 {
-	h->ientry = 0;
-	for (h->ibucket = 0; h->ibucket < h->bucket_count; h->ibucket++) {
-		h->ientry = h->buckets[h->ibucket];
-		if (h->ientry)
+	struct itable *h = it->table;
+	int count = h->old_bucket_count + h->bucket_count;
+
+	it->entry = 0;
+	for (; it->bucket < count; it->bucket++) {
+		it->entry = itable_bucket_at(h, it->bucket);
+		if (it->entry)
 			break;
 	}
 }
 
-int itable_nextkey(struct itable *h, UINT64_T *key, void **value)
+void itable_iter_start(struct itable *h, struct itable_iter *it)
 {
-	if (h->ientry) {
-		*key = h->ientry->key;
-		if (value)
-			*value = h->ientry->value;
-
-		h->ientry = h->ientry->next;
-		if (!h->ientry) {
-			h->ibucket++;
-			for (; h->ibucket < h->bucket_count; h->ibucket++) {
-				h->ientry = h->buckets[h->ibucket];
-				if (h->ientry)
-					break;
-			}
-		}
+	it->table = h;
+	it->bucket = 0;
+	itable_iter_seek(it);
+}
 
-		return 1;
-	} else {
+int itable_iter_next(struct itable_iter *it, UINT64_T *key, void **value)
+{
+	struct entry *e = it->entry;
+	if (!e)
 		return 0;
+
+	if (key)
+		*key = e->key;
+	if (value)
+		*value = e->value;
+
+	if (e->next) {
+		it->entry = e->next;
+	} else {
+		it->bucket++;
+		itable_iter_seek(it);
 	}
+
+	return 1;
+}
+
+void itable_firstkey(struct itable *h)
+{
+	itable_iter_start(h, &h->iter);
+}
+
+int itable_nextkey(struct itable *h, UINT64_T *key, void **value)
+{
+	return itable_iter_next(&h->iter, key, value);
 }
 
 /* vim: set noexpandtab tabstop=8: */
@@ -46,8 +46,22 @@ ITABLE_ITERATE(h,key,value) {
 	printf("table contains: %d\n",key);
 }
 </pre>
+
+To allow nested iterations, use @ref itable_iter_start and @ref itable_iter_next with an iterator of your own.
+Like @ref hash_table.h, the table grows incrementally over the inserts that follow a resize,
+so no new keys may be inserted during an iteration.
+*/
+
+/** An iterator over an integer table, see @ref itable_iter_start.
+Its fields are private to the itable module.
 */
 
+struct itable_iter {
+	struct itable *table;
+	int bucket;
+	void *entry;
+};
+
 /** Create a new integer table.
 @param buckets The number of buckets in the table.  If zero, a default value will be used.
 @return A pointer to a new integer table.
@@ -115,6 +129,9 @@ void * itable_pop( struct itable *h );
 This function begins a new iteration over an integer table,
 allowing you to visit every key and value in the table.
 Next, invoke @ref itable_nextkey to retrieve each value in order.
+The entry most recently returned may be removed during the iteration,
+and the values of existing keys may be changed,
+but no new keys may be inserted until the iteration is over.
 @param h A pointer to an integer table.
 */
 
@@ -130,6 +147,25 @@ This function returns the next key and value in the iteration.
 
 int itable_nextkey(struct itable *h, UINT64_T * key, void **value);
 
+/** Begin an iteration over all keys with an external iterator.
+Unlike @ref itable_firstkey, this does not disturb other iterations over the same table.
+The entry most recently returned may be removed from the table during the iteration,
+but other entries may not be removed, and no entries may be inserted.
+@param h A pointer to an integer table.
+@param it A pointer to an iterator to initialize.
+*/
+
+void itable_iter_start(struct itable *h, struct itable_iter *it);
+
+/** Continue an iteration with an external iterator.
+@param it A pointer to an iterator initialized by @ref itable_iter_start.
+@param key A pointer to a key integer, or null.
+@param value A pointer to a value pointer, or null.
+@return Zero if there are no more elements to visit, one otherwise.
+*/
+
+int itable_iter_next(struct itable_iter *it, UINT64_T *key, void **value);
+
 /** Utility macro to simplify common case of iterating over an itable.
 Use as follows:
 
@@ -146,4 +182,8 @@ ITABLE_ITERATE(table,key,value) {
 
 #define ITABLE_ITERATE(table,key,value) itable_firstkey(table); while(itable_nextkey(table,&key,(void**)&value))
 
+/** Utility macro to iterate over an itable with an external iterator, which allows nested iterations. */
+
+#define ITABLE_ITERATE_WITH(table,iter,key,value) for(itable_iter_start(table,&iter); itable_iter_next(&iter,&key,(void**)&value);)
+
 #endif
@@ -7,7 +7,8 @@ See the file COPYING for details.
 #include "jx.h"
 #include "buffer.h"
 #include "stringtools.h"
-#include "xxmalloc.h"
+#include "jx_arena.h"
+#include "hash_table.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -17,7 +18,7 @@ See the file COPYING for details.
 
 struct jx_pair *jx_pair(struct jx *key, struct jx *value, struct jx_pair *next)
 {
-	struct jx_pair *pair = calloc(1, sizeof(*pair));
+	struct jx_pair *pair = jx_arena_calloc(sizeof(*pair));
 	pair->key = key;
 	pair->value = value;
 	pair->next = next;
@@ -26,7 +27,7 @@ struct jx_pair *jx_pair(struct jx *key, struct jx *value, struct jx_pair *next)
 
 struct jx_item *jx_item(struct jx *value, struct jx_item *next)
 {
-	struct jx_item *item = calloc(1, sizeof(*item));
+	struct jx_item *item = jx_arena_calloc(sizeof(*item));
 	item->value = value;
 	item->next = next;
 	return item;
@@ -36,8 +37,8 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 {
 	assert(variable);
 	assert(elements);
-	struct jx_comprehension *comp = calloc(1, sizeof(*comp));
-	comp->variable = strdup(variable);
+	struct jx_comprehension *comp = jx_arena_calloc(sizeof(*comp));
+	comp->variable = jx_arena_strdup(variable);
 	comp->elements = elements;
 	comp->condition = condition;
 	comp->next = next;
@@ -46,7 +47,7 @@ struct jx_comprehension *jx_comprehension(const char *variable, struct jx *eleme
 
 static struct jx *jx_create(jx_type_t type)
 {
-	struct jx *j = xxcalloc(1, sizeof(*j));
+	struct jx *j = jx_arena_calloc(sizeof(*j));
 	j->type = type;
 	return j;
 }
@@ -59,20 +60,20 @@ struct jx *jx_null()
 struct jx *jx_symbol(const char *symbol_name)
 {
 	struct jx *j = jx_create(JX_SYMBOL);
-	j->u.symbol_name = strdup(symbol_name);
+	j->u.symbol_name = jx_arena_strdup(symbol_name);
 	return j;
 }
 
 struct jx *jx_string(const char *string_value)
 {
 	assert(string_value);
-	return jx_string_nocopy(strdup(string_value));
+	return jx_string_nocopy(jx_arena_strdup(string_value));
 }
 
 struct jx *jx_string_nocopy(char *string_value)
 {
 	struct jx *j = jx_create(JX_STRING);
-	j->u.string_value = string_value;
+	j->u.string_value = jx_arena_adopt(string_value);
 	return j;
 }
 
@@ -92,7 +93,7 @@ struct jx *jx_format(const char *fmt, ...)
 	buffer_free(B);
 
 	j = jx_create(JX_STRING);
-	j->u.string_value = str;
+	j->u.string_value = jx_arena_adopt(str);
 
 	return j;
 }
@@ -183,9 +184,132 @@ struct jx *jx_arrayv(struct jx *value, ...)
 	return array;
 }
 
+/*
+An object that is searched often and holds many pairs gets an index
+of its pairs with string keys: an open-addressing table of slots that
+record the pair, the hash of its key, and a sequence number.  Pairs
+closer to the front of the list have higher sequence numbers, so that
+when a key appears more than once, the index finds the same pair as a
+walk of the list.  The index is allocated individually, and is not built
+while an arena is in use, because it may outlive the arena.
+*/
+
+#define JX_INDEX_THRESHOLD 16
+#define JX_INDEX_REMOVED ((struct jx_pair *)1)
+
+struct jx_index_slot {
+	struct jx_pair *pair;
+	unsigned hash;
+	unsigned seq;
+};
+
+struct jx_index {
+	int capacity;
+	int used;
+	unsigned seq;
+	struct jx_index_slot *slots;
+};
+
+static int jx_pair_has_string_key(struct jx_pair *p)
+{
+	return p->key && p->key->type == JX_STRING;
+}
+
+static void jx_index_delete(struct jx_index *x)
+{
+	if (!x)
+		return;
+	free(x->slots);
+	free(x);
+}
+
+static void jx_index_add(struct jx_index *x, struct jx_pair *p, unsigned hash, unsigned seq)
+{
+	int i = hash & (x->capacity - 1);
+	while (x->slots[i].pair && x->slots[i].pair != JX_INDEX_REMOVED)
+		i = (i + 1) & (x->capacity - 1);
+
+	if (!x->slots[i].pair)
+		x->used++;
+
+	x->slots[i].pair = p;
+	x->slots[i].hash = hash;
+	x->slots[i].seq = seq;
+}
+
+static struct jx_index *jx_index_build(struct jx *j)
+{
+	struct jx_pair *p;
+	int count = 0;
+
+	for (p = j->u.pairs; p; p = p->next) {
+		if (jx_pair_has_string_key(p))
+			count++;
+	}
+
+	struct jx_index *x = malloc(sizeof(*x));
+	if (!x)
+		return 0;
+
+	x->capacity = JX_INDEX_THRESHOLD;
+	while (x->capacity < count * 2)
+		x->capacity *= 2;
+
+	x->slots = calloc(x->capacity, sizeof(*x->slots));
+	if (!x->slots) {
+		free(x);
+		return 0;
+	}
+
+	x->used = 0;
+	x->seq = count;
+
+	unsigned seq = count;
+	for (p = j->u.pairs; p; p = p->next) {
+		if (jx_pair_has_string_key(p))
+			jx_index_add(x, p, hash_string(p->key->u.string_value), seq--);
+	}
+
+	return x;
+}
+
+/* Return the slot of the frontmost pair with the given key, or null if there is none. */
+
+static struct jx_index_slot *jx_index_find(struct jx_index *x, const char *key, unsigned hash)
+{
+	struct jx_index_slot *best = 0;
+
+	int i = hash & (x->capacity - 1);
+	while (x->slots[i].pair) {
+		struct jx_index_slot *s = &x->slots[i];
+		if (s->pair != JX_INDEX_REMOVED && s->hash == hash && (!best || s->seq > best->seq) && !strcmp(s->pair->key->u.string_value, key))
+			best = s;
+		i = (i + 1) & (x->capacity - 1);
+	}
+
+	return best;
+}
+
+/* Build the index of an object once a search has walked past enough pairs. */
+
+static void jx_index_consider(struct jx *j, int steps)
+{
+	if (steps > JX_INDEX_THRESHOLD && !j->index && !jx_arena_current())
+		j->index = jx_index_build(j);
+}
+
+void jx_object_unindex(struct jx *j)
+{
+	if (!j || j->type != JX_OBJECT)
+		return;
+	jx_index_delete(j->index);
+	j->index = 0;
+}
+
 struct jx *jx_lookup_guard(struct jx *j, const char *key, int *found)
 {
 	struct jx_pair *p;
+	int steps = 0;
 
 	if (found)
 		*found = 0;
@@ -193,17 +317,32 @@ struct jx *jx_lookup_guard(struct jx *j, const char *key, int *found)
 	if (!j || j->type != JX_OBJECT)
 		return 0;
 
+	if (j->index) {
+		struct jx_index_slot *s = jx_index_find(j->index, key, hash_string(key));
+		if (!s)
+			return 0;
+		if (found)
+			*found = 1;
+		return s->pair->value;
+	}
+
 	for (p = j->u.pairs; p; p = p->next) {
+		steps++;
 		if (p && p->key && p->key->type == JX_STRING) {
 			if (!strcmp(p->key->u.string_value, key)) {
-				if (found)
-					*found = 1;
-				return p->value;
+				break;
 			}
 		}
 	}
 
-	return 0;
+	jx_index_consider(j, steps);
+
+	if (!p)
+		return 0;
+
+	if (found)
+		*found = 1;
+	return p->value;
 }
 
 struct jx *jx_lookup(struct jx *j, const char *key)
@@ -261,15 +400,50 @@ double jx_lookup_double(struct jx *object, const char *key)
 	}
 }
 
+/*
+Unlink a pair found through the index of an object, and return its value.
+Only the removed pair is freed, so that a caller walking the list may
+hold on to the next pair, as with an object that is not indexed.
+*/
+
+static struct jx *jx_remove_indexed(struct jx *object, struct jx_index_slot *s)
+{
+	struct jx_pair *p = s->pair;
+	struct jx *value = p->value;
+
+	s->pair = JX_INDEX_REMOVED;
+
+	if (object->u.pairs == p) {
+		object->u.pairs = p->next;
+	} else {
+		struct jx_pair *last;
+		for (last = object->u.pairs; last->next != p; last = last->next) {
+		}
+		last->next = p->next;
+	}
+
+	p->value = 0;
+	p->next = 0;
+	jx_pair_delete(p);
+	return value;
+}
+
 struct jx *jx_remove(struct jx *object, struct jx *key)
 {
 	if (!object || object->type != JX_OBJECT)
 		return 0;
 
+	if (object->index && key && key->type == JX_STRING) {
+		struct jx_index_slot *s = jx_index_find(object->index, key->u.string_value, hash_string(key->u.string_value));
+		return s ? jx_remove_indexed(object, s) : 0;
+	}
+
 	struct jx_pair *p;
 	struct jx_pair *last = 0;
+	int steps = 0;
 
 	for (p = object->u.pairs; p; p = p->next) {
+		steps++;
 		if (jx_equals(key, p->key)) {
 			struct jx *value = p->value;
 			if (last) {
@@ -285,6 +459,9 @@ struct jx *jx_remove(struct jx *object, struct jx *key)
 		last = p;
 	}
 
+	if (key && key->type == JX_STRING)
+		jx_index_consider(object, steps);
+
 	return 0;
 }
 
@@ -292,7 +469,28 @@ int jx_insert(struct jx *j, struct jx *key, struct jx *value)
 {
 	if (!j || j->type != JX_OBJECT)
 		return 0;
-	j->u.pairs = jx_pair(key, value, j->u.pairs);
+	return jx_insert_pair(j, jx_pair(key, value, 0));
+}
+
+int jx_insert_pair(struct jx *j, struct jx_pair *pair)
+{
+	if (!j || j->type != JX_OBJECT)
+		return 0;
+
+	pair->next = j->u.pairs;
+	j->u.pairs = pair;
+
+	struct jx_index *x = j->index;
+	if (x && jx_pair_has_string_key(pair)) {
+		if ((x->used + 1) * 4 > x->capacity * 3) {
+			/* Rebuilding from the list also drops removed slots. */
+			jx_index_delete(x);
+			j->index = jx_index_build(j);
+		} else {
+			jx_index_add(x, pair, hash_string(pair->key->u.string_value), ++x->seq);
+		}
+	}
+
 	return 1;
 }
 
@@ -389,7 +587,7 @@ struct jx *jx_array_concat(struct jx *array, ...)
 		*tail = a->u.items;
 		while (*tail)
 			tail = &(*tail)->next;
-		free(a);
+		jx_arena_free(a);
 	}
 	va_end(ap);
 	return result;
@@ -404,7 +602,7 @@ struct jx *jx_array_shift(struct jx *array)
 	if (i) {
 		result = i->value;
 		array->u.items = i->next;
-		free(i);
+		jx_arena_free(i);
 	}
 	return result;
 }
@@ -417,7 +615,7 @@ void jx_pair_delete(struct jx_pair *pair)
 	jx_delete(pair->value);
 	jx_comprehension_delete(pair->comp);
 	jx_pair_delete(pair->next);
-	free(pair);
+	jx_arena_free(pair);
 }
 
 void jx_item_delete(struct jx_item *item)
@@ -427,18 +625,18 @@ void jx_item_delete(struct jx_item *item)
 	jx_delete(item->value);
 	jx_comprehension_delete(item->comp);
 	jx_item_delete(item->next);
-	free(item);
+	jx_arena_free(item);
 }
 
 void jx_comprehension_delete(struct jx_comprehension *comp)
 {
 	if (!comp)
 		return;
-	free(comp->variable);
+	jx_arena_free(comp->variable);
 	jx_delete(comp->elements);
 	jx_delete(comp->condition);
 	jx_comprehension_delete(comp->next);
-	free(comp);
+	jx_arena_free(comp);
 }
 
 void jx_delete(struct jx *j)
@@ -453,15 +651,16 @@ void jx_delete(struct jx *j)
 	case JX_NULL:
 		break;
 	case JX_SYMBOL:
-		free(j->u.symbol_name);
+		jx_arena_free(j->u.symbol_name);
 		break;
 	case JX_STRING:
-		free(j->u.string_value);
+		jx_arena_free(j->u.string_value);
 		break;
 	case JX_ARRAY:
 		jx_item_delete(j->u.items);
 		break;
 	case JX_OBJECT:
+		jx_index_delete(j->index);
 		jx_pair_delete(j->u.pairs);
 		break;
 	case JX_OPERATOR:
@@ -472,7 +671,7 @@ void jx_delete(struct jx *j)
 		jx_delete(j->u.err);
 		break;
 	}
-	free(j);
+	jx_arena_free(j);
 }
 
 int jx_isatomic(struct jx *j)
@@ -572,9 +771,9 @@ struct jx_comprehension *jx_comprehension_copy(struct jx_comprehension *c)
 	struct jx_comprehension **nc = &head;
 
 	while (c) {
-		*nc = calloc(1, sizeof(struct jx_comprehension));
+		*nc = jx_arena_calloc(sizeof(struct jx_comprehension));
 		(*nc)->line = c->line;
-		(*nc)->variable = strdup(c->variable);
+		(*nc)->variable = jx_arena_strdup(c->variable);
 		(*nc)->elements = jx_copy(c->elements);
 		(*nc)->condition = jx_copy(c->condition);
 
@@ -591,7 +790,7 @@ struct jx_pair *jx_pair_copy(struct jx_pair *p)
 	struct jx_pair **np = &head;
 
 	while (p) {
-		*np = calloc(1, sizeof(struct jx_pair));
+		*np = jx_arena_calloc(sizeof(struct jx_pair));
 		(*np)->line = p->line;
 		(*np)->key = jx_copy(p->key);
 		(*np)->value = jx_copy(p->value);
@@ -610,7 +809,7 @@ struct jx_item *jx_item_copy(struct jx_item *i)
 	struct jx_item **ni = &head;
 
 	while (i) {
-		*ni = calloc(1, sizeof(struct jx_item));
+		*ni = jx_arena_calloc(sizeof(struct jx_item));
 		(*ni)->line = i->line;
 		(*ni)->value = jx_copy(i->value);
 		(*ni)->comp = jx_comprehension_copy(i->comp);
@@ -32,6 +32,12 @@ Will create the following output:
 { "hello" : "world" }
 </pre>
 
+Looking up a key in an object walks its list of pairs.  Objects that
+are searched often and hold many pairs get a private hash index of
+their string keys, built on demand and kept up to date by @ref jx_insert,
+@ref jx_insert_pair, and @ref jx_remove.  Code that modifies the
+list of pairs of an object directly must first call @ref jx_object_unindex.
+
 @see jx_parse.h
 @see jx_print.h
 */
@@ -128,6 +134,7 @@ struct jx {
 		struct jx_operator oper; /**< value of @ref JX_OPERATOR */
 		struct jx *err;  /**< error value of @ref JX_ERROR */
 	} u;
+	struct jx_index *index;       /**< private lookup index of a large @ref JX_OBJECT */
 };
 
 /** Create a JX null value. @return A JX expression. */
@@ -252,6 +259,12 @@ struct jx * jx_remove( struct jx *object, struct jx *key );
 /** Insert a key-value pair into an object.  @param object The object.  @param key The key.  @param value The value. @return True on success, false on failure.  Failure can only occur if the object is not a @ref JX_OBJECT. */
 int jx_insert( struct jx *object, struct jx *key, struct jx *value );
 
+/** Insert an existing pair at the front of an object, which takes ownership of it.  @param object The object.  @param pair The pair, whose next field is overwritten. @return True on success, false on failure.  Failure can only occur if the object is not a @ref JX_OBJECT. */
+int jx_insert_pair( struct jx *object, struct jx_pair *pair );
+
+/** Drop the lookup index of an object, before modifying its list of pairs directly.  @param object The object. */
+void jx_object_unindex( struct jx *object );
+
 /** Insert a key-value pair into an object, unless the value is an empty collection, in which case delete the key and value.  @param object The target object. @param key The key.  @param value The value. @return 1 on success, -1 on empty value, 0 on failure.  Failure can only occur if the object is not a @ref JX_OBJECT. */
 int jx_insert_unless_empty( struct jx *object, struct jx *key, struct jx *value );
 
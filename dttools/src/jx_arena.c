@@ -0,0 +1,182 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_arena.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BLOCK_SIZE 65536
+#define ALIGNMENT 16
+
+/*
+An arena is a list of blocks, newest first.  Allocations are taken
+from the front of the newest block, and each new block is twice as
+large as the previous one, so that few blocks are needed.
+*/
+
+struct jx_arena_block {
+	struct jx_arena_block *next;
+	size_t size;
+	size_t used;
+	char *data;
+};
+
+struct jx_arena {
+	struct jx_arena_block *blocks;
+	size_t block_size;
+	size_t bytes;
+};
+
+static struct jx_arena *current = 0;
+
+static struct jx_arena_block *jx_arena_block_create(size_t size)
+{
+	struct jx_arena_block *b = malloc(sizeof(*b) + size + ALIGNMENT);
+	if (!b)
+		fatal("jx_arena: out of memory");
+	b->size = size;
+	b->used = 0;
+	b->data = (char *)(((uintptr_t)(b + 1) + ALIGNMENT - 1) & ~(uintptr_t)(ALIGNMENT - 1));
+	b->next = 0;
+	return b;
+}
+
+struct jx_arena *jx_arena_create(size_t block_size)
+{
+	struct jx_arena *a = malloc(sizeof(*a));
+	if (!a)
+		fatal("jx_arena: out of memory");
+
+	a->block_size = block_size ? block_size : DEFAULT_BLOCK_SIZE;
+	a->blocks = jx_arena_block_create(a->block_size);
+	a->bytes = 0;
+
+	return a;
+}
+
+void jx_arena_delete(struct jx_arena *a)
+{
+	if (!a)
+		return;
+
+	if (a == current)
+		fatal("jx_arena_delete: arena is still in use");
+
+	struct jx_arena_block *b = a->blocks;
+	while (b) {
+		struct jx_arena_block *next = b->next;
+		free(b);
+		b = next;
+	}
+
+	free(a);
+}
+
+struct jx_arena *jx_arena_use(struct jx_arena *a)
+{
+	struct jx_arena *previous = current;
+	current = a;
+	return previous;
+}
+
+struct jx_arena *jx_arena_current(void)
+{
+	return current;
+}
+
+size_t jx_arena_bytes(struct jx_arena *a)
+{
+	return a->bytes;
+}
+
+static void *jx_arena_alloc(struct jx_arena *a, size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+
+	struct jx_arena_block *b = a->blocks;
+	if (b->used + size > b->size) {
+		size_t block_size = b->size * 2;
+		while (block_size < size)
+			block_size *= 2;
+		b = jx_arena_block_create(block_size);
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+
+	void *p = b->data + b->used;
+	b->used += size;
+	a->bytes += size;
+
+	return p;
+}
+
+static int jx_arena_owns(struct jx_arena *a, const void *p)
+{
+	const char *c = p;
+	struct jx_arena_block *b;
+	for (b = a->blocks; b; b = b->next) {
+		if (c >= b->data && c < b->data + b->size)
+			return 1;
+	}
+	return 0;
+}
+
+void *jx_arena_calloc(size_t size)
+{
+	void *p;
+
+	if (current) {
+		p = jx_arena_alloc(current, size);
+		memset(p, 0, size);
+	} else {
+		p = calloc(1, size);
+		if (!p)
+			fatal("jx: out of memory");
+	}
+
+	return p;
+}
+
+char *jx_arena_strdup(const char *s)
+{
+	size_t length = strlen(s) + 1;
+	char *copy;
+
+	if (current) {
+		copy = jx_arena_alloc(current, length);
+	} else {
+		copy = malloc(length);
+		if (!copy)
+			fatal("jx: out of memory");
+	}
+
+	memcpy(copy, s, length);
+	return copy;
+}
+
+void jx_arena_free(void *p)
+{
+	if (!p)
+		return;
+
+	if (current && jx_arena_owns(current, p))
+		return;
+
+	free(p);
+}
+
+char *jx_arena_adopt(char *s)
+{
+	if (!current || !s || jx_arena_owns(current, s))
+		return s;
+
+	char *copy = jx_arena_strdup(s);
+	free(s);
+	return copy;
+}
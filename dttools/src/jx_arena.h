@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_ARENA_H
+#define JX_ARENA_H
+
+#include <stddef.h>
+
+/** @file jx_arena.h Bulk allocation of short-lived JX values.
+Building a JX expression allocates every value, pair, item, and string separately.
+When an expression is only built to be printed or examined and then discarded,
+it can instead be allocated in an arena: each allocation takes the next bytes
+of a large block, and all of them are released at once when the arena is deleted.
+
+While an arena is in use, all JX values created by @ref jx.h, @ref jx_parse.h,
+and the other JX modules are allocated in it, and @ref jx_delete does not release
+values in the arena.  Values in an arena must not be deleted individually
+after the arena is no longer in use, nor kept after it is deleted, and should
+only be examined while the arena is still in use.
+
+<pre>
+struct jx_arena *a = jx_arena_create(0);
+struct jx_arena *previous = jx_arena_use(a);
+
+struct jx *j = jx_parse_string(text);
+...
+jx_arena_use(previous);
+jx_arena_delete(a);
+</pre>
+*/
+
+/** Create a new arena.
+@param block_size The size of the first block of the arena.  If zero, a default value will be used.
+@return A pointer to a new arena.
+*/
+
+struct jx_arena *jx_arena_create(size_t block_size);
+
+/** Release an arena and everything allocated in it.
+@param a The arena to delete.  It must not be in use.
+*/
+
+void jx_arena_delete(struct jx_arena *a);
+
+/** Select the arena in which JX values are allocated.
+@param a The arena to use, or null to allocate values individually again.
+@return The arena previously in use, or null.
+*/
+
+struct jx_arena *jx_arena_use(struct jx_arena *a);
+
+/** Return the arena in which JX values are currently allocated.
+@return The arena in use, or null.
+*/
+
+struct jx_arena *jx_arena_current(void);
+
+/** Count the bytes allocated in an arena.
+@param a A pointer to an arena.
+@return The number of bytes handed out by the arena.
+*/
+
+size_t jx_arena_bytes(struct jx_arena *a);
+
+/** Allocate zeroed memory for a JX value, from the arena in use if any.
+@param size The number of bytes needed.
+@return A pointer to the memory.  Aborts on failure.
+*/
+
+void *jx_arena_calloc(size_t size);
+
+/** Duplicate a string for a JX value, in the arena in use if any.
+@param s The string to duplicate.
+@return A pointer to the copy.  Aborts on failure.
+*/
+
+char *jx_arena_strdup(const char *s);
+
+/** Release memory obtained from @ref jx_arena_calloc or @ref jx_arena_strdup.
+Memory in the arena in use is left for @ref jx_arena_delete, other memory is freed.
+@param p The memory to release, or null.
+*/
+
+void jx_arena_free(void *p);
+
+/** Take ownership of a string for a JX value.
+If an arena is in use, the string is copied into it and the original is freed.
+@param s A string allocated with malloc.
+@return A string owned by the JX value.
+*/
+
+char *jx_arena_adopt(char *s);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx.h"
+#include "jx_arena.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *text = "{\"type\":\"vine_manager\",\"port\":9123,\"load\":[0.5,1.5,2.5],\"workers\":{\"connected\":10,\"idle\":2},\"name\":\"test\"}";
+
+int main(int argc, char **argv)
+{
+	struct jx *expected = jx_parse_string(text);
+	char *expected_str = jx_print_string(expected);
+
+	struct jx_arena *arena = jx_arena_create(256);
+	if (jx_arena_use(arena))
+		FAIL("an arena was already in use");
+
+	/* Values built in the arena behave as usual. */
+	struct jx *j = jx_parse_string(text);
+	if (!j || !jx_equals(j, expected))
+		FAIL("parsing in an arena gave a different value");
+
+	jx_insert_integer(j, "lastheardfrom", 1234);
+	jx_insert(j, jx_string("owner"), jx_string_nocopy(string_format("user-%d", 5)));
+	jx_delete(jx_remove(j, jx_string("load")));
+	if (jx_lookup_integer(j, "lastheardfrom") != 1234 || strcmp(jx_lookup_string(j, "owner"), "user-5") || jx_lookup(j, "load"))
+		FAIL("modifying a value in an arena failed");
+
+	int i;
+	for (i = 0; i < 1000; i++) {
+		struct jx *k = jx_copy(j);
+		jx_delete(k);
+	}
+
+	if (jx_arena_bytes(arena) < 1000 * sizeof(struct jx))
+		FAIL("values were not allocated in the arena");
+
+	/* A copy made after leaving the arena outlives it. */
+	if (jx_arena_use(0) != arena)
+		FAIL("jx_arena_use did not return the arena in use");
+
+	struct jx *copy = jx_copy(j);
+	jx_arena_delete(arena);
+
+	struct jx *load = jx_string("load");
+	jx_delete(jx_remove(expected, load));
+	jx_delete(load);
+	jx_insert_integer(expected, "lastheardfrom", 1234);
+	jx_insert_string(expected, "owner", "user-5");
+	if (!jx_equals(copy, expected))
+		FAIL("copy of a value from the arena is different");
+
+	jx_delete(copy);
+	jx_delete(expected);
+	free(expected_str);
+
+	fprintf(stdout, "jx arena is correct\n");
+	return 0;
+}
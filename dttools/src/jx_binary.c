@@ -5,12 +5,18 @@ See the file COPYING for details.
 */
 
 #include "jx_binary.h"
+#include "buffer.h"
 #include "debug.h"
+#include "hash_table.h"
 #include "jx.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /*
 Rather than relying on the enumeration in jx.h, we rely
@@ -34,6 +40,19 @@ not change, unlike the in-memory enumeration of jx.h
 #define JX_BINARY_ARRAY 23
 #define JX_BINARY_OBJECT 24
 #define JX_BINARY_END 25
+#define JX_BINARY_ARRAY32 26
+#define JX_BINARY_OBJECT32 27
+#define JX_BINARY_INDEX 28
+
+/*
+The sized containers written by jx_binary_write_indexed are followed by
+the number of bytes of their members and the number of members, so that
+a reader can step over them without decoding them.  If the top value is
+an object, it is followed by an index of its keys: JX_BINARY_INDEX,
+the number of entries, and the offset of each key in the file.
+*/
+
+#define JX_BINARY_SIZED_HEADER (1 + 2 * sizeof(uint32_t))
 
 static int jx_binary_write_data(FILE *stream, void *data, unsigned length)
 {
@@ -316,6 +335,34 @@ struct jx *jx_binary_read(FILE *stream)
 		}
 		return obj;
 		break;
+	case JX_BINARY_ARRAY32:
+		jx_binary_read_uint32(stream, &u32);
+		jx_binary_read_uint32(stream, &u32);
+		arr = jx_array(0);
+		item = &arr->u.items;
+		while (u32-- > 0) {
+			*item = jx_binary_read_item(stream);
+			if (!*item) {
+				jx_delete(arr);
+				return 0;
+			}
+			item = &(*item)->next;
+		}
+		return arr;
+	case JX_BINARY_OBJECT32:
+		jx_binary_read_uint32(stream, &u32);
+		jx_binary_read_uint32(stream, &u32);
+		obj = jx_object(0);
+		pair = &obj->u.pairs;
+		while (u32-- > 0) {
+			*pair = jx_binary_read_pair(stream);
+			if (!*pair) {
+				jx_delete(obj);
+				return 0;
+			}
+			pair = &(*pair)->next;
+		}
+		return obj;
 	case JX_BINARY_END:
 		return 0;
 	default:
@@ -326,3 +373,619 @@ struct jx *jx_binary_read(FILE *stream)
 
 	return 0;
 }
+
+static void jx_binary_put_uint8(buffer_t *b, uint8_t i)
+{
+	buffer_putlstring(b, (const char *)&i, sizeof(i));
+}
+
+static void jx_binary_put_uint32(buffer_t *b, uint32_t i)
+{
+	buffer_putlstring(b, (const char *)&i, sizeof(i));
+}
+
+static void jx_binary_patch_uint32(buffer_t *b, size_t offset, uint32_t i)
+{
+	memcpy(b->buf + offset, &i, sizeof(i));
+}
+
+/*
+Encode a value into a buffer in the same form as jx_binary_write, except that
+arrays and objects are sized.  If keys is given, the offsets of the keys of
+an object are appended to it.
+*/
+
+static int jx_binary_encode(buffer_t *b, struct jx *j, buffer_t *keys)
+{
+	struct jx_pair *pair;
+	struct jx_item *item;
+	uint32_t length;
+	int64_t i;
+
+	switch (j->type) {
+	case JX_NULL:
+		jx_binary_put_uint8(b, JX_BINARY_NULL);
+		break;
+	case JX_BOOLEAN:
+		jx_binary_put_uint8(b, j->u.boolean_value ? JX_BINARY_TRUE : JX_BINARY_FALSE);
+		break;
+	case JX_INTEGER:
+		i = j->u.integer_value;
+		if (i == 0) {
+			jx_binary_put_uint8(b, JX_BINARY_INTEGER0);
+		} else if (i >= -128 && i < 128) {
+			int8_t i8 = i;
+			jx_binary_put_uint8(b, JX_BINARY_INTEGER8);
+			buffer_putlstring(b, (const char *)&i8, sizeof(i8));
+		} else if (i >= -32768 && i < 32768) {
+			int16_t i16 = i;
+			jx_binary_put_uint8(b, JX_BINARY_INTEGER16);
+			buffer_putlstring(b, (const char *)&i16, sizeof(i16));
+		} else if (i >= -2147483648 && i < 2147483648) {
+			int32_t i32 = i;
+			jx_binary_put_uint8(b, JX_BINARY_INTEGER32);
+			buffer_putlstring(b, (const char *)&i32, sizeof(i32));
+		} else {
+			jx_binary_put_uint8(b, JX_BINARY_INTEGER64);
+			buffer_putlstring(b, (const char *)&i, sizeof(i));
+		}
+		break;
+	case JX_DOUBLE:
+		jx_binary_put_uint8(b, JX_BINARY_DOUBLE);
+		buffer_putlstring(b, (const char *)&j->u.double_value, sizeof(j->u.double_value));
+		break;
+	case JX_STRING:
+		length = strlen(j->u.string_value);
+		if (length < 256) {
+			jx_binary_put_uint8(b, JX_BINARY_STRING8);
+			jx_binary_put_uint8(b, length);
+		} else if (length < 65536) {
+			uint16_t u16 = length;
+			jx_binary_put_uint8(b, JX_BINARY_STRING16);
+			buffer_putlstring(b, (const char *)&u16, sizeof(u16));
+		} else {
+			jx_binary_put_uint8(b, JX_BINARY_STRING32);
+			jx_binary_put_uint32(b, length);
+		}
+		buffer_putlstring(b, j->u.string_value, length);
+		break;
+	case JX_ARRAY:
+	case JX_OBJECT: {
+		size_t start = buffer_pos(b);
+		uint32_t count = 0;
+
+		jx_binary_put_uint8(b, j->type == JX_ARRAY ? JX_BINARY_ARRAY32 : JX_BINARY_OBJECT32);
+		jx_binary_put_uint32(b, 0);
+		jx_binary_put_uint32(b, 0);
+
+		if (j->type == JX_ARRAY) {
+			for (item = j->u.items; item; item = item->next, count++) {
+				if (!jx_binary_encode(b, item->value, 0))
+					return 0;
+			}
+		} else {
+			for (pair = j->u.pairs; pair; pair = pair->next, count++) {
+				if (keys)
+					jx_binary_put_uint32(keys, buffer_pos(b));
+				if (!jx_binary_encode(b, pair->key, 0) || !jx_binary_encode(b, pair->value, 0))
+					return 0;
+			}
+		}
+
+		size_t size = buffer_pos(b) - start - JX_BINARY_SIZED_HEADER;
+		if (size > UINT32_MAX) {
+			debug(D_NOTICE, "JX container is too large for binary form");
+			return 0;
+		}
+		jx_binary_patch_uint32(b, start + 1, size);
+		jx_binary_patch_uint32(b, start + 1 + sizeof(uint32_t), count);
+		break;
+	}
+	case JX_OPERATOR:
+	case JX_SYMBOL:
+	case JX_ERROR:
+		debug(D_NOTICE, "cannot write out non-constant JX data!");
+		return 0;
+	}
+
+	return 1;
+}
+
+int jx_binary_write_indexed(FILE *stream, struct jx *j)
+{
+	buffer_t b, keys;
+	buffer_init(&b);
+	buffer_init(&keys);
+	buffer_abortonfailure(&b, 1);
+	buffer_abortonfailure(&keys, 1);
+
+	int ok = jx_binary_encode(&b, j, j->type == JX_OBJECT ? &keys : 0);
+
+	if (ok && j->type == JX_OBJECT) {
+		if (buffer_pos(&b) > UINT32_MAX) {
+			debug(D_NOTICE, "JX object is too large for an indexed binary form");
+			ok = 0;
+		} else {
+			jx_binary_put_uint8(&b, JX_BINARY_INDEX);
+			jx_binary_put_uint32(&b, buffer_pos(&keys) / sizeof(uint32_t));
+			buffer_putlstring(&b, buffer_tostring(&keys), buffer_pos(&keys));
+		}
+	}
+
+	if (ok)
+		ok = fwrite(buffer_tostring(&b), buffer_pos(&b), 1, stream) == 1;
+
+	buffer_free(&keys);
+	buffer_free(&b);
+	return ok;
+}
+
+struct jx_binary_map {
+	const char *data;
+	size_t size;
+	int64_t index_offset;
+	struct hash_table *index;
+};
+
+/* Copy length bytes at an offset of the map, failing if they run past its end. */
+
+static int jx_binary_map_get(struct jx_binary_map *m, int64_t offset, void *data, size_t length)
+{
+	if (offset < 0 || (size_t)offset > m->size || length > m->size - offset)
+		return 0;
+	memcpy(data, m->data + offset, length);
+	return 1;
+}
+
+/* Find the contents of the string at an offset, returning a pointer into the map. */
+
+static const char *jx_binary_map_string(struct jx_binary_map *m, int64_t offset, uint32_t *length)
+{
+	uint8_t type, u8;
+	uint16_t u16;
+
+	if (!jx_binary_map_get(m, offset, &type, 1))
+		return 0;
+
+	offset++;
+	switch (type) {
+	case JX_BINARY_STRING8:
+		if (!jx_binary_map_get(m, offset, &u8, sizeof(u8)))
+			return 0;
+		*length = u8;
+		offset += sizeof(u8);
+		break;
+	case JX_BINARY_STRING16:
+		if (!jx_binary_map_get(m, offset, &u16, sizeof(u16)))
+			return 0;
+		*length = u16;
+		offset += sizeof(u16);
+		break;
+	case JX_BINARY_STRING32:
+		if (!jx_binary_map_get(m, offset, length, sizeof(*length)))
+			return 0;
+		offset += sizeof(*length);
+		break;
+	default:
+		return 0;
+	}
+
+	if (*length > m->size - offset)
+		return 0;
+	return m->data + offset;
+}
+
+/*
+Find the members of the container at an offset.
+Returns the offset of the first member, and sets *end to the offset past the last
+one, or to -1 for a container in the stream form, which ends with JX_BINARY_END.
+*/
+
+static int64_t jx_binary_map_members(struct jx_binary_map *m, int64_t offset, uint8_t *type, int64_t *end, uint32_t *count)
+{
+	uint32_t size;
+
+	if (!jx_binary_map_get(m, offset, type, 1))
+		return -1;
+
+	switch (*type) {
+	case JX_BINARY_ARRAY:
+	case JX_BINARY_OBJECT:
+		*end = -1;
+		*count = 0;
+		return offset + 1;
+	case JX_BINARY_ARRAY32:
+	case JX_BINARY_OBJECT32:
+		if (!jx_binary_map_get(m, offset + 1, &size, sizeof(size)) || !jx_binary_map_get(m, offset + 1 + sizeof(size), count, sizeof(*count)))
+			return -1;
+		if (size > m->size - offset - JX_BINARY_SIZED_HEADER)
+			return -1;
+		*end = offset + JX_BINARY_SIZED_HEADER + size;
+		return offset + JX_BINARY_SIZED_HEADER;
+	default:
+		return -1;
+	}
+}
+
+/* Return true if the member at an offset is the last of its container. */
+
+static int jx_binary_map_at_end(struct jx_binary_map *m, int64_t offset, int64_t end)
+{
+	uint8_t type;
+	if (end >= 0)
+		return offset >= end;
+	return !jx_binary_map_get(m, offset, &type, 1) || type == JX_BINARY_END;
+}
+
+/* Return the offset just past the value at an offset, or -1 if it is not valid. */
+
+static int64_t jx_binary_map_skip(struct jx_binary_map *m, int64_t offset)
+{
+	uint8_t type;
+	uint32_t length, count;
+	int64_t end;
+
+	if (!jx_binary_map_get(m, offset, &type, 1))
+		return -1;
+
+	switch (type) {
+	case JX_BINARY_NULL:
+	case JX_BINARY_TRUE:
+	case JX_BINARY_FALSE:
+	case JX_BINARY_INTEGER0:
+		return offset + 1;
+	case JX_BINARY_INTEGER8:
+		return offset + 1 + sizeof(int8_t);
+	case JX_BINARY_INTEGER16:
+		return offset + 1 + sizeof(int16_t);
+	case JX_BINARY_INTEGER32:
+		return offset + 1 + sizeof(int32_t);
+	case JX_BINARY_INTEGER64:
+		return offset + 1 + sizeof(int64_t);
+	case JX_BINARY_DOUBLE:
+		return offset + 1 + sizeof(double);
+	case JX_BINARY_STRING8:
+	case JX_BINARY_STRING16:
+	case JX_BINARY_STRING32: {
+		const char *s = jx_binary_map_string(m, offset, &length);
+		return s ? (s - m->data) + length : -1;
+	}
+	case JX_BINARY_ARRAY32:
+	case JX_BINARY_OBJECT32:
+		if (jx_binary_map_members(m, offset, &type, &end, &count) < 0)
+			return -1;
+		return end;
+	case JX_BINARY_ARRAY:
+	case JX_BINARY_OBJECT:
+		/* The stream form has no sizes, so each member must be stepped over. */
+		offset++;
+		while (!jx_binary_map_at_end(m, offset, -1)) {
+			offset = jx_binary_map_skip(m, offset);
+			if (offset < 0)
+				return -1;
+		}
+		return offset < (int64_t)m->size ? offset + 1 : -1;
+	default:
+		return -1;
+	}
+}
+
+struct jx_binary_map *jx_binary_map_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || info.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	void *data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 0;
+
+	struct jx_binary_map *m = calloc(1, sizeof(*m));
+	m->data = data;
+	m->size = info.st_size;
+	m->index_offset = -1;
+
+	/* An index of the keys may follow the top value. */
+	int64_t end = jx_binary_map_skip(m, 0);
+	uint8_t type;
+	uint32_t count;
+	if (end >= 0 && jx_binary_map_get(m, end, &type, 1) && type == JX_BINARY_INDEX) {
+		if (jx_binary_map_get(m, end + 1, &count, sizeof(count)) && (uint64_t)count * sizeof(uint32_t) == m->size - end - 1 - sizeof(count)) {
+			m->index_offset = end + 1;
+		} else {
+			end = -1;
+		}
+	}
+
+	if (end < 0) {
+		debug(D_DEBUG, "%s does not contain valid binary JX data", path);
+		jx_binary_map_close(m);
+		return 0;
+	}
+
+	return m;
+}
+
+void jx_binary_map_close(struct jx_binary_map *m)
+{
+	if (!m)
+		return;
+	if (m->index)
+		hash_table_delete(m->index);
+	munmap((void *)m->data, m->size);
+	free(m);
+}
+
+jx_type_t jx_binary_map_type(struct jx_binary_map *m, int64_t offset)
+{
+	uint8_t type;
+	if (!jx_binary_map_get(m, offset, &type, 1))
+		return JX_ERROR;
+
+	switch (type) {
+	case JX_BINARY_NULL:
+		return JX_NULL;
+	case JX_BINARY_TRUE:
+	case JX_BINARY_FALSE:
+		return JX_BOOLEAN;
+	case JX_BINARY_INTEGER0:
+	case JX_BINARY_INTEGER8:
+	case JX_BINARY_INTEGER16:
+	case JX_BINARY_INTEGER32:
+	case JX_BINARY_INTEGER64:
+		return JX_INTEGER;
+	case JX_BINARY_DOUBLE:
+		return JX_DOUBLE;
+	case JX_BINARY_STRING8:
+	case JX_BINARY_STRING16:
+	case JX_BINARY_STRING32:
+		return JX_STRING;
+	case JX_BINARY_ARRAY:
+	case JX_BINARY_ARRAY32:
+		return JX_ARRAY;
+	case JX_BINARY_OBJECT:
+	case JX_BINARY_OBJECT32:
+		return JX_OBJECT;
+	default:
+		return JX_ERROR;
+	}
+}
+
+int jx_binary_map_length(struct jx_binary_map *m, int64_t offset)
+{
+	uint8_t type;
+	uint32_t count;
+	int64_t end;
+
+	int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+	if (member < 0)
+		return -1;
+	if (end >= 0)
+		return count;
+
+	int length = 0;
+	while (!jx_binary_map_at_end(m, member, end)) {
+		member = jx_binary_map_skip(m, member);
+		if (member < 0)
+			return -1;
+		if (type == JX_BINARY_OBJECT)
+			member = jx_binary_map_skip(m, member);
+		if (member < 0)
+			return -1;
+		length++;
+	}
+	return length;
+}
+
+int64_t jx_binary_map_index(struct jx_binary_map *m, int64_t offset, int n)
+{
+	uint8_t type;
+	uint32_t count;
+	int64_t end;
+
+	int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+	if (member < 0 || n < 0 || (type != JX_BINARY_ARRAY && type != JX_BINARY_ARRAY32))
+		return -1;
+	if (end >= 0 && (uint32_t)n >= count)
+		return -1;
+
+	while (n-- > 0) {
+		if (jx_binary_map_at_end(m, member, end))
+			return -1;
+		member = jx_binary_map_skip(m, member);
+		if (member < 0)
+			return -1;
+	}
+
+	return jx_binary_map_at_end(m, member, end) ? -1 : member;
+}
+
+/* Load the index of the keys of the top object into a table from key to value offset. */
+
+static void jx_binary_map_load_index(struct jx_binary_map *m)
+{
+	uint32_t count, i, key_offset, length;
+
+	if (!jx_binary_map_get(m, m->index_offset, &count, sizeof(count)))
+		return;
+
+	m->index = hash_table_create(count * 2 + 1, 0);
+
+	for (i = 0; i < count; i++) {
+		if (!jx_binary_map_get(m, m->index_offset + sizeof(count) + i * sizeof(key_offset), &key_offset, sizeof(key_offset)))
+			break;
+
+		const char *s = jx_binary_map_string(m, key_offset, &length);
+		int64_t value = jx_binary_map_skip(m, key_offset);
+		if (!s || value < 0)
+			break;
+
+		/* As with jx_lookup, the first of repeated keys is found. */
+		char *key = strndup(s, length);
+		if (!hash_table_lookup(m->index, key))
+			hash_table_insert(m->index, key, (void *)(intptr_t)(value + 1));
+		free(key);
+	}
+}
+
+int64_t jx_binary_map_lookup(struct jx_binary_map *m, int64_t offset, const char *key)
+{
+	if (offset == 0 && m->index_offset >= 0) {
+		if (!m->index)
+			jx_binary_map_load_index(m);
+		return (intptr_t)hash_table_lookup(m->index, key) - 1;
+	}
+
+	uint8_t type;
+	uint32_t count, length;
+	int64_t end;
+	size_t key_length = strlen(key);
+
+	int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+	if (member < 0 || (type != JX_BINARY_OBJECT && type != JX_BINARY_OBJECT32))
+		return -1;
+
+	while (!jx_binary_map_at_end(m, member, end)) {
+		const char *s = jx_binary_map_string(m, member, &length);
+		int64_t value = jx_binary_map_skip(m, member);
+		if (value < 0)
+			return -1;
+		if (s && length == key_length && !memcmp(s, key, length))
+			return value;
+		member = jx_binary_map_skip(m, value);
+		if (member < 0)
+			return -1;
+	}
+
+	return -1;
+}
+
+/* Decode the value at an offset, setting *next to the offset just past it. */
+
+static struct jx *jx_binary_map_decode_at(struct jx_binary_map *m, int64_t offset, int64_t *next)
+{
+	uint8_t type;
+	int8_t i8;
+	int16_t i16;
+	int32_t i32;
+	int64_t i64;
+	double d;
+	uint32_t length, count;
+	int64_t end;
+	struct jx *j;
+
+	if (!jx_binary_map_get(m, offset, &type, 1))
+		return 0;
+
+	*next = jx_binary_map_skip(m, offset);
+	if (*next < 0)
+		return 0;
+
+	switch (type) {
+	case JX_BINARY_NULL:
+		return jx_null();
+	case JX_BINARY_TRUE:
+		return jx_boolean(1);
+	case JX_BINARY_FALSE:
+		return jx_boolean(0);
+	case JX_BINARY_INTEGER0:
+		return jx_integer(0);
+	case JX_BINARY_INTEGER8:
+		jx_binary_map_get(m, offset + 1, &i8, sizeof(i8));
+		return jx_integer(i8);
+	case JX_BINARY_INTEGER16:
+		jx_binary_map_get(m, offset + 1, &i16, sizeof(i16));
+		return jx_integer(i16);
+	case JX_BINARY_INTEGER32:
+		jx_binary_map_get(m, offset + 1, &i32, sizeof(i32));
+		return jx_integer(i32);
+	case JX_BINARY_INTEGER64:
+		jx_binary_map_get(m, offset + 1, &i64, sizeof(i64));
+		return jx_integer(i64);
+	case JX_BINARY_DOUBLE:
+		jx_binary_map_get(m, offset + 1, &d, sizeof(d));
+		return jx_double(d);
+	case JX_BINARY_STRING8:
+	case JX_BINARY_STRING16:
+	case JX_BINARY_STRING32: {
+		const char *s = jx_binary_map_string(m, offset, &length);
+		return jx_string_nocopy(strndup(s, length));
+	}
+	case JX_BINARY_ARRAY:
+	case JX_BINARY_ARRAY32: {
+		int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+		j = jx_array(0);
+		struct jx_item **item = &j->u.items;
+		while (!jx_binary_map_at_end(m, member, end)) {
+			struct jx *value = jx_binary_map_decode_at(m, member, &member);
+			if (!value) {
+				jx_delete(j);
+				return 0;
+			}
+			*item = jx_item(value, 0);
+			item = &(*item)->next;
+		}
+		return j;
+	}
+	case JX_BINARY_OBJECT:
+	case JX_BINARY_OBJECT32: {
+		int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+		j = jx_object(0);
+		struct jx_pair **pair = &j->u.pairs;
+		while (!jx_binary_map_at_end(m, member, end)) {
+			struct jx *key = jx_binary_map_decode_at(m, member, &member);
+			struct jx *value = key ? jx_binary_map_decode_at(m, member, &member) : 0;
+			if (!value) {
+				jx_delete(key);
+				jx_delete(j);
+				return 0;
+			}
+			*pair = jx_pair(key, value, 0);
+			pair = &(*pair)->next;
+		}
+		return j;
+	}
+	default:
+		return 0;
+	}
+}
+
+struct jx *jx_binary_map_decode(struct jx_binary_map *m, int64_t offset)
+{
+	int64_t next;
+	return jx_binary_map_decode_at(m, offset, &next);
+}
+
+struct jx *jx_binary_map_keys(struct jx_binary_map *m, int64_t offset)
+{
+	uint8_t type;
+	uint32_t count;
+	int64_t end;
+
+	int64_t member = jx_binary_map_members(m, offset, &type, &end, &count);
+	if (member < 0 || (type != JX_BINARY_OBJECT && type != JX_BINARY_OBJECT32))
+		return 0;
+
+	struct jx *keys = jx_array(0);
+	struct jx_item **item = &keys->u.items;
+
+	while (!jx_binary_map_at_end(m, member, end)) {
+		struct jx *key = jx_binary_map_decode_at(m, member, &member);
+		if (!key || (member = jx_binary_map_skip(m, member)) < 0) {
+			jx_delete(key);
+			jx_delete(keys);
+			return 0;
+		}
+		*item = jx_item(key, 0);
+		item = &(*item)->next;
+	}
+
+	return keys;
+}
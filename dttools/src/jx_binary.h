@@ -15,6 +15,7 @@ and so should only be used for efficient internal storage.
 **/
 
 #include <stdio.h>
+#include <stdint.h>
 #include "jx.h"
 
 /** Write a JX expression to a file in binary form.
@@ -32,4 +33,89 @@ int jx_binary_write( FILE *stream, struct jx *j );
 
 struct jx * jx_binary_read( FILE *stream );
 
+/** Write a JX expression to a file in a binary form that can be mapped.
+The form is the same as that of @ref jx_binary_write, except that arrays and objects
+record their size, so that @ref jx_binary_map_open can step over them.
+If the expression is an object, an index of its keys follows it.
+The result can still be read with @ref jx_binary_read.
+No array or object may exceed 4 GB.
+@param stream The stdio stream to write to.
+@param j The expression to write.
+@return True on success, false on failure.
+*/
+
+int jx_binary_write_indexed( FILE *stream, struct jx *j );
+
+/** A binary JX file mapped into memory. */
+
+struct jx_binary_map;
+
+/** Map a file written by @ref jx_binary_write_indexed or @ref jx_binary_write.
+Values within the file are named by their offset, starting with the top value at zero,
+and are only decoded when asked for, so a single field of a large file
+can be read without parsing the rest of it.
+@param path The file to map.
+@return A mapped file, or null if it could not be mapped or does not hold binary JX data.
+*/
+
+struct jx_binary_map * jx_binary_map_open( const char *path );
+
+/** Unmap a file.
+@param m The mapped file.
+*/
+
+void jx_binary_map_close( struct jx_binary_map *m );
+
+/** Get the type of a mapped value.
+@param m The mapped file.
+@param offset The offset of the value.
+@return The type of the value, or JX_ERROR if the offset does not hold a value.
+*/
+
+jx_type_t jx_binary_map_type( struct jx_binary_map *m, int64_t offset );
+
+/** Get the number of members of a mapped array or object.
+@param m The mapped file.
+@param offset The offset of the array or object.
+@return The number of items or pairs, or -1 on failure.
+*/
+
+int jx_binary_map_length( struct jx_binary_map *m, int64_t offset );
+
+/** Find a value in a mapped object.
+The top object is searched with its index, if it has one.
+As with @ref jx_lookup, the first of repeated keys is found.
+@param m The mapped file.
+@param offset The offset of the object.
+@param key The key to find.
+@return The offset of the value, or -1 if the key is not present.
+*/
+
+int64_t jx_binary_map_lookup( struct jx_binary_map *m, int64_t offset, const char *key );
+
+/** Find an item of a mapped array.
+@param m The mapped file.
+@param offset The offset of the array.
+@param n The position of the item, starting from zero.
+@return The offset of the item, or -1 if there is no such item.
+*/
+
+int64_t jx_binary_map_index( struct jx_binary_map *m, int64_t offset, int n );
+
+/** Get the keys of a mapped object.
+@param m The mapped file.
+@param offset The offset of the object.
+@return An array of the keys in order, or null on failure.
+*/
+
+struct jx * jx_binary_map_keys( struct jx_binary_map *m, int64_t offset );
+
+/** Decode a mapped value.
+@param m The mapped file.
+@param offset The offset of the value.
+@return A new JX expression, or null on failure.
+*/
+
+struct jx * jx_binary_map_decode( struct jx_binary_map *m, int64_t offset );
+
 #endif
@@ -0,0 +1,166 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx.h"
+#include "jx_binary.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NKEYS 1000
+
+static int write_file(const char *path, struct jx *j, int indexed)
+{
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return 0;
+	int result = indexed ? jx_binary_write_indexed(file, j) : jx_binary_write(file, j);
+	fclose(file);
+	return result;
+}
+
+static int check_value(struct jx_binary_map *m, int64_t offset, struct jx *expected)
+{
+	struct jx *j = jx_binary_map_decode(m, offset);
+	int result = j && jx_equals(j, expected);
+	jx_delete(j);
+	return result;
+}
+
+/* Check every field of the top object of a mapped file against the original. */
+
+static int check_map(const char *path, struct jx *j)
+{
+	struct jx_binary_map *m = jx_binary_map_open(path);
+	int i;
+
+	if (!m || jx_binary_map_type(m, 0) != JX_OBJECT || jx_binary_map_length(m, 0) != NKEYS + 1)
+		return 0;
+	if (!check_value(m, 0, j))
+		return 0;
+
+	for (i = 0; i < NKEYS; i++) {
+		char *key = string_format("key%d", i);
+		int64_t offset = jx_binary_map_lookup(m, 0, key);
+		int ok = offset > 0 && check_value(m, offset, jx_lookup(j, key));
+		free(key);
+		if (!ok)
+			return 0;
+	}
+
+	if (jx_binary_map_lookup(m, 0, "missing") != -1)
+		return 0;
+
+	/* The first of repeated keys is found. */
+	int64_t dup = jx_binary_map_lookup(m, 0, "key7");
+	if (jx_binary_map_type(m, dup) != JX_OBJECT)
+		return 0;
+
+	/* Nested values are found without an index. */
+	int64_t list = jx_binary_map_lookup(m, jx_binary_map_lookup(m, 0, "key3"), "list");
+	if (jx_binary_map_type(m, list) != JX_ARRAY || jx_binary_map_length(m, list) != 3)
+		return 0;
+	int64_t item = jx_binary_map_index(m, list, 2);
+	if (jx_binary_map_type(m, item) != JX_STRING || !check_value(m, item, jx_lookup(jx_lookup(j, "key3"), "list")->u.items->next->next->value))
+		return 0;
+	if (jx_binary_map_index(m, list, 3) != -1 || jx_binary_map_index(m, 0, 0) != -1)
+		return 0;
+
+	struct jx *keys = jx_binary_map_keys(m, 0);
+	struct jx *expected = jx_array(0);
+	struct jx_pair *p;
+	for (p = j->u.pairs; p; p = p->next)
+		jx_array_append(expected, jx_copy(p->key));
+	int result = keys && jx_equals(keys, expected);
+	jx_delete(keys);
+	jx_delete(expected);
+
+	jx_binary_map_close(m);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "jx_binary_map_test.XXXXXX";
+	int fd = mkstemp(path);
+	int i;
+
+	if (fd < 0)
+		FAIL("could not create a temporary file");
+	close(fd);
+
+	struct jx *j = jx_object(0);
+	for (i = NKEYS - 1; i >= 0; i--) {
+		char *key = string_format("key%d", i);
+		struct jx *value;
+		if (i % 3 == 0)
+			value = jx_objectv("id", jx_integer(i), "name", jx_string(key), "list", jx_arrayv(jx_double(i / 3.0), jx_null(), jx_string("a string that is longer than two hundred and fifty five bytes, so that it is written with a sixteen bit length.................................................................................................................................................."), NULL), NULL);
+		else if (i % 3 == 1)
+			value = jx_integer((jx_int_t)i * 1000000007);
+		else
+			value = jx_boolean(i % 2);
+		jx_insert(j, jx_string(key), value);
+		free(key);
+	}
+	/* A repeated key, which inserts at the front, so that the object is found first. */
+	jx_insert(j, jx_string("key7"), jx_object(0));
+
+	/* Both forms can be mapped. */
+	if (!write_file(path, j, 1) || !check_map(path, j))
+		FAIL("indexed file was not mapped correctly");
+	if (!write_file(path, j, 0) || !check_map(path, j))
+		FAIL("stream file was not mapped correctly");
+
+	/* The indexed form can still be read as a stream. */
+	write_file(path, j, 1);
+	FILE *file = fopen(path, "r");
+	struct jx *k = jx_binary_read(file);
+	fclose(file);
+	if (!k || !jx_equals(j, k))
+		FAIL("indexed file was not read correctly as a stream");
+	jx_delete(k);
+
+	/* Values other than objects have no index. */
+	struct jx *a = jx_arrayv(jx_integer(1), jx_arrayv(jx_string("x"), NULL), NULL);
+	write_file(path, a, 1);
+	struct jx_binary_map *m = jx_binary_map_open(path);
+	if (!m || jx_binary_map_length(m, 0) != 2 || !check_value(m, 0, a) || jx_binary_map_lookup(m, 0, "x") != -1)
+		FAIL("indexed array was not mapped correctly");
+	jx_binary_map_close(m);
+	jx_delete(a);
+
+	/* A truncated file is refused. */
+	write_file(path, j, 1);
+	file = fopen(path, "r");
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	for (i = 1; i < 64; i++) {
+		if (truncate(path, size / 2 / i) < 0)
+			FAIL("could not truncate the file");
+		m = jx_binary_map_open(path);
+		if (m)
+			FAIL("truncated file of %ld bytes was mapped", size / 2 / i);
+	}
+
+	/* Data that is not valid is refused. */
+	file = fopen(path, "w");
+	fprintf(file, "{\"a\":1}");
+	fclose(file);
+	if (jx_binary_map_open(path))
+		FAIL("text file was mapped");
+
+	unlink(path);
+	jx_delete(j);
+
+	fprintf(stdout, "jx binary map is correct\n");
+	return 0;
+}
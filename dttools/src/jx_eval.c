@@ -7,7 +7,9 @@ See the file COPYING for details.
 #include "jx_eval.h"
 #include "debug.h"
 #include "jx_function.h"
+#include "jx_match.h"
 #include "jx_print.h"
+#include "xxmalloc.h"
 
 #include <assert.h>
 #include <math.h>
@@ -754,6 +756,209 @@ struct jx *jx_eval_with_defines(struct jx *j, struct jx *context)
 	return result;
 }
 
+/*
+An iterator evaluates the values of one array item lazily, so that
+a list comprehension over a large range is never held in memory.
+Each level of the comprehension binds its variable in a context of its own,
+copied from the enclosing level.  A range() is counted, rather than evaluated.
+*/
+
+struct jx_eval_level {
+	struct jx_comprehension *comp;
+	struct jx *context;
+	struct jx *list;
+	void *cursor;
+	int is_range;
+	jx_int_t next;
+	jx_int_t stop;
+	jx_int_t step;
+};
+
+struct jx_eval_iterator {
+	struct jx *body;
+	struct jx *context;
+	struct jx_eval_level *levels;
+	int nlevels;
+	int depth;
+	int started;
+	int done;
+};
+
+struct jx_eval_iterator *jx_eval_iterator_create(struct jx_item *item, struct jx *context)
+{
+	assert(item);
+
+	struct jx_eval_iterator *it = xxcalloc(1, sizeof(*it));
+	it->body = item->value;
+	it->context = context;
+
+	struct jx_comprehension *comp;
+	for (comp = item->comp; comp; comp = comp->next)
+		it->nlevels++;
+
+	it->levels = xxcalloc(it->nlevels + 1, sizeof(*it->levels));
+
+	int i = 0;
+	for (comp = item->comp; comp; comp = comp->next)
+		it->levels[i++].comp = comp;
+
+	return it;
+}
+
+static void jx_eval_level_reset(struct jx_eval_level *l)
+{
+	jx_delete(l->context);
+	jx_delete(l->list);
+	l->context = NULL;
+	l->list = NULL;
+	l->cursor = NULL;
+	l->is_range = 0;
+}
+
+/* Begin a level in the context of the enclosing one, or return an error. */
+
+static struct jx *jx_eval_level_start(struct jx_eval_level *l, struct jx *context)
+{
+	struct jx *elements = l->comp->elements;
+
+	l->context = jx_copy(context);
+
+	if (jx_istype(elements, JX_OPERATOR) && elements->u.oper.type == JX_OP_CALL && jx_istype(elements->u.oper.left, JX_SYMBOL) && !strcmp(elements->u.oper.left->u.symbol_name, "range")) {
+		struct jx *args = jx_eval(elements->u.oper.right, context);
+		jx_int_t start, stop, step;
+		int matched = jx_istype(args, JX_ARRAY) ? jx_match_array(args, &start, JX_INTEGER, &stop, JX_INTEGER, &step, JX_INTEGER, NULL) : 0;
+		int n = jx_istype(args, JX_ARRAY) ? jx_array_length(args) : -1;
+		jx_delete(args);
+
+		/* Count the same values as jx_function_range, or let it report the error. */
+		if (matched == n && matched >= 1 && matched <= 3) {
+			if (matched == 1) {
+				stop = start;
+				start = 0;
+			}
+			if (matched < 3)
+				step = 1;
+			if (step != 0) {
+				l->is_range = 1;
+				l->next = start;
+				l->stop = stop;
+				l->step = step;
+				if ((stop - start) * step < 0)
+					l->next = l->stop;
+				return NULL;
+			}
+		}
+	}
+
+	l->list = jx_eval(elements, context);
+	if (jx_istype(l->list, JX_ERROR)) {
+		struct jx *err = l->list;
+		l->list = NULL;
+		return err;
+	}
+	if (!jx_istype(l->list, JX_ARRAY)) {
+		return jx_error(jx_format("on line %d: list comprehension takes an array", l->comp->line));
+	}
+
+	return NULL;
+}
+
+/* Get the next element of a level, or null at the end. */
+
+static struct jx *jx_eval_level_next(struct jx_eval_level *l)
+{
+	if (l->is_range) {
+		if (l->step > 0 ? l->next < l->stop : l->next > l->stop) {
+			struct jx *value = jx_integer(l->next);
+			l->next += l->step;
+			return value;
+		}
+		return NULL;
+	}
+
+	struct jx *j = jx_iterate_array(l->list, &l->cursor);
+	return j ? jx_copy(j) : NULL;
+}
+
+struct jx *jx_eval_iterator_next(struct jx_eval_iterator *it)
+{
+	if (it->done)
+		return NULL;
+
+	if (it->nlevels == 0) {
+		it->done = 1;
+		return jx_eval(it->body, it->context);
+	}
+
+	while (1) {
+		struct jx_eval_level *l = &it->levels[it->depth];
+		struct jx *parent = it->depth > 0 ? it->levels[it->depth - 1].context : it->context;
+
+		if (!l->context) {
+			struct jx *err = jx_eval_level_start(l, parent);
+			if (err) {
+				it->done = 1;
+				return err;
+			}
+		}
+
+		struct jx *value = jx_eval_level_next(l);
+		if (!value) {
+			jx_eval_level_reset(l);
+			if (it->depth == 0) {
+				it->done = 1;
+				return NULL;
+			}
+			it->depth--;
+			continue;
+		}
+
+		struct jx *key = jx_string(l->comp->variable);
+		jx_delete(jx_remove(l->context, key));
+		jx_insert(l->context, key, value);
+
+		if (l->comp->condition) {
+			struct jx *cond = jx_eval(l->comp->condition, l->context);
+			if (jx_istype(cond, JX_ERROR)) {
+				it->done = 1;
+				return cond;
+			}
+			if (!jx_istype(cond, JX_BOOLEAN)) {
+				char *s = jx_print_string(cond);
+				struct jx *err = jx_error(jx_format("on line %d, %s: list comprehension condition takes a boolean", cond->line, s));
+				free(s);
+				jx_delete(cond);
+				it->done = 1;
+				return err;
+			}
+			int ok = cond->u.boolean_value;
+			jx_delete(cond);
+			if (!ok)
+				continue;
+		}
+
+		if (it->depth + 1 < it->nlevels) {
+			it->depth++;
+			continue;
+		}
+
+		return jx_eval(it->body, l->context);
+	}
+}
+
+void jx_eval_iterator_delete(struct jx_eval_iterator *it)
+{
+	if (!it)
+		return;
+
+	int i;
+	for (i = 0; i < it->nlevels; i++)
+		jx_eval_level_reset(&it->levels[i]);
+
+	free(it->levels);
+	free(it);
+}
+
 /* Note that this is referenced by jx_function.c */
 int __jx_eval_external_functions_flag = 0;
 
@@ -33,6 +33,31 @@ If the expression is invalid in some way, an object of type @ref JX_NULL is retu
 */
 struct jx * jx_eval_with_defines( struct jx *j, struct jx* context );
 
+/** Evaluate the values of an array item one at a time.
+An item with a list comprehension stands for many values of an array.
+An iterator produces those values on demand, so that they are never
+all in memory at once, and a comprehension over a range() does not
+create the range.  The values are the same as @ref jx_eval would produce
+for the item, in the same order.
+@param item The array item to evaluate, which must outlive the iterator.
+@param context An object in which values will be found, which must outlive the iterator.
+@return A new iterator, which must be deleted with @ref jx_eval_iterator_delete.
+*/
+struct jx_eval_iterator * jx_eval_iterator_create( struct jx_item *item, struct jx *context );
+
+/** Evaluate the next value of an array item.
+@param it The iterator.
+@return A newly created value, which must be deleted with @ref jx_delete,
+or null after the last value.  After an error, which is returned as a value
+of type @ref JX_ERROR, no more values are produced.
+*/
+struct jx * jx_eval_iterator_next( struct jx_eval_iterator *it );
+
+/** Delete an iterator.
+@param it The iterator to delete.
+*/
+void jx_eval_iterator_delete( struct jx_eval_iterator *it );
+
 /** Enable external functions.
 A small number of JX functions make use of "external" context,
 For safety, these functions are not enabled unless the user first
@@ -0,0 +1,85 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jx.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+
+/* Evaluate each item of an array with an iterator, and check that the values are those of jx_eval. */
+
+static void check(const char *expr, struct jx *context)
+{
+	struct jx *j = jx_parse_string(expr);
+	assert(jx_istype(j, JX_ARRAY));
+
+	struct jx *expected = jx_eval(j, context);
+	struct jx *actual = jx_array(NULL);
+	struct jx_item **tail = &actual->u.items;
+	struct jx_item *item;
+	int errors = 0;
+
+	for (item = j->u.items; item; item = item->next) {
+		struct jx_eval_iterator *it = jx_eval_iterator_create(item, context);
+		struct jx *value;
+		while ((value = jx_eval_iterator_next(it))) {
+			if (jx_istype(value, JX_ERROR))
+				errors++;
+			*tail = jx_item(value, NULL);
+			tail = &(*tail)->next;
+		}
+		jx_eval_iterator_delete(it);
+	}
+
+	char *e = jx_print_string(expected);
+	char *a = jx_print_string(actual);
+	printf("%s\n\t%s\n\t%s\n", expr, e, a);
+
+	if (jx_istype(expected, JX_ERROR)) {
+		assert(errors > 0);
+	} else {
+		assert(errors == 0);
+		assert(jx_equals(expected, actual));
+	}
+
+	free(e);
+	free(a);
+	jx_delete(expected);
+	jx_delete(actual);
+	jx_delete(j);
+}
+
+int main(int argc, char **argv)
+{
+	struct jx *context = jx_parse_string("{\"n\": 4, \"names\": [\"a\", \"b\", \"c\"]}");
+
+	check("[1, 2, 3]", context);
+	check("[x for x in range(5)]", context);
+	check("[x for x in range(n)]", context);
+	check("[x for x in range(2, 10, 3)]", context);
+	check("[x for x in range(10, 2, -3)]", context);
+	check("[x for x in range(5, 2)]", context);
+	check("[x for x in range(0)]", context);
+	check("[0, x for x in range(3), 9]", context);
+	check("[s + \".txt\" for s in names]", context);
+	check("[x * y for x in range(4) for y in range(x) if x != y + 1]", context);
+	check("[x + s for x in [\"p\", \"q\"] if x != \"q\" for s in names]", context);
+	check("[{\"id\": x, \"name\": s} for x in range(2) for s in names]", context);
+	check("[x for x in range(1, 2, 0)]", context);
+	check("[x for x in 5]", context);
+	check("[x for x in range(3) if x]", context);
+	check("[x for x in range(3) if undefined]", context);
+
+	jx_delete(context);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
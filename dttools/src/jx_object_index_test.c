@@ -0,0 +1,176 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NKEYS 200
+
+/* Find the value of a key by walking the pairs, as an unindexed lookup would. */
+
+static struct jx *list_lookup(struct jx *j, const char *key)
+{
+	struct jx_pair *p;
+	for (p = j->u.pairs; p; p = p->next) {
+		if (jx_istype(p->key, JX_STRING) && !strcmp(p->key->u.string_value, key))
+			return p->value;
+	}
+	return 0;
+}
+
+static int check_all(struct jx *j, int nkeys)
+{
+	int i;
+	for (i = 0; i < nkeys; i++) {
+		char *key = string_format("key%d", i);
+		int found;
+		struct jx *v = jx_lookup_guard(j, key, &found);
+		if (v != list_lookup(j, key) || found != !!v) {
+			free(key);
+			return 0;
+		}
+		free(key);
+	}
+	return 1;
+}
+
+static void remove_key(struct jx *j, const char *name)
+{
+	struct jx *key = jx_string(name);
+	jx_delete(jx_remove(j, key));
+	jx_delete(key);
+}
+
+int main(int argc, char **argv)
+{
+	struct jx *j = jx_object(0);
+	struct jx_pair *p, *next;
+	int i;
+
+	for (i = 0; i < NKEYS; i++) {
+		char *key = string_format("key%d", i);
+		jx_insert_integer(j, key, i);
+		free(key);
+	}
+
+	/* Lookups find every key, whether or not the index has been built yet. */
+	for (i = 0; i < NKEYS; i++) {
+		char *key = string_format("key%d", i);
+		if (jx_lookup_integer(j, key) != i)
+			FAIL("lookup of %s failed", key);
+		free(key);
+	}
+	if (!j->index)
+		FAIL("a large object was not indexed");
+	if (jx_lookup(j, "missing"))
+		FAIL("lookup of a missing key succeeded");
+
+	/* A key inserted again shadows the older pair until it is removed. */
+	jx_insert_integer(j, "key5", 1000);
+	if (jx_lookup_integer(j, "key5") != 1000)
+		FAIL("newer pair was not found first");
+	remove_key(j, "key5");
+	if (jx_lookup_integer(j, "key5") != 5)
+		FAIL("older pair was not found after removing the newer one");
+	remove_key(j, "key5");
+	if (jx_lookup(j, "key5"))
+		FAIL("removed key was still found");
+
+	/* Removing the last pair of the list, and a missing key. */
+	remove_key(j, "key0");
+	remove_key(j, "missing");
+	if (jx_lookup(j, "key0") || jx_lookup_integer(j, "key1") != 1)
+		FAIL("removing the last pair failed");
+	if (!check_all(j, NKEYS))
+		FAIL("index disagrees with the list after removals");
+
+	/* Pairs with other keys are not indexed, but can still be removed. */
+	jx_insert(j, jx_integer(7), jx_string("seven"));
+	struct jx *ikey = jx_integer(7);
+	struct jx *v = jx_remove(j, ikey);
+	if (!v || strcmp(v->u.string_value, "seven"))
+		FAIL("removing a non-string key failed");
+	jx_delete(v);
+	jx_delete(ikey);
+
+	/* Removing the current pair while holding the next one, as a walk of the list does. */
+	for (p = j->u.pairs; p; p = next) {
+		next = p->next;
+		if (jx_istype(p->key, JX_STRING) && !strcmp(p->key->u.string_value, "key3"))
+			jx_delete(jx_remove(j, p->key));
+	}
+	if (jx_lookup(j, "key3") || jx_lookup_integer(j, "key4") != 4)
+		FAIL("removing a pair during a walk failed");
+	jx_insert_integer(j, "key3", 3);
+
+	/* Enough inserts and removals to rebuild the index several times. */
+	for (i = 0; i < 4 * NKEYS; i++) {
+		char *key = string_format("key%d", i % NKEYS);
+		remove_key(j, key);
+		jx_insert_integer(j, key, i);
+		free(key);
+	}
+	for (i = 0; i < NKEYS; i++) {
+		char *key = string_format("key%d", i);
+		if (jx_lookup_integer(j, key) != 3 * NKEYS + i)
+			FAIL("lookup of %s after reinserting failed", key);
+		free(key);
+	}
+	if (!check_all(j, NKEYS))
+		FAIL("index disagrees with the list after reinserting");
+
+	/* An unindexed copy is equal and prints the same. */
+	struct jx *c = jx_copy(j);
+	char *s1 = jx_print_string(j);
+	char *s2 = jx_print_string(c);
+	if (!jx_equals(j, c) || strcmp(s1, s2))
+		FAIL("copy of an indexed object differs");
+	free(s1);
+	free(s2);
+
+	/* Merging large objects keeps the last value of each key. */
+	struct jx *update = jx_object(0);
+	for (i = 0; i < NKEYS; i += 2) {
+		char *key = string_format("key%d", i);
+		jx_insert_integer(update, key, -i);
+		free(key);
+	}
+	struct jx *m = jx_merge(c, update, NULL);
+	for (i = 0; i < NKEYS; i++) {
+		char *key = string_format("key%d", i);
+		jx_int_t expected = i % 2 ? 3 * NKEYS + i : -i;
+		if (jx_lookup_integer(m, key) != expected)
+			FAIL("merged value of %s is wrong", key);
+		free(key);
+	}
+	if (jx_lookup(m, "key1") != list_lookup(m, "key1"))
+		FAIL("index disagrees with the list after merging");
+
+	/* After dropping the index, the list may be changed directly. */
+	jx_object_unindex(m);
+	p = m->u.pairs;
+	m->u.pairs = p->next;
+	p->next = 0;
+	if (jx_lookup(m, p->key->u.string_value))
+		FAIL("lookup found a pair unlinked from the list");
+	jx_pair_delete(p);
+	if (!check_all(m, NKEYS))
+		FAIL("rebuilt index disagrees with the list");
+
+	jx_delete(m);
+	jx_delete(update);
+	jx_delete(c);
+	jx_delete(j);
+
+	fprintf(stdout, "jx object index is correct\n");
+	return 0;
+}
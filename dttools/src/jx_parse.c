@@ -8,15 +8,24 @@ See the file COPYING for details.
 #include "jx_eval.h"
 #include "jx_print.h"
 
+#include "copy_stream.h"
 #include "debug.h"
 #include "stringtools.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 typedef enum {
 	JX_TOKEN_SYMBOL,
 	JX_TOKEN_INTEGER,
@@ -1166,6 +1175,427 @@ struct jx *jx_parse(struct jx_parser *s)
 	return j;
 }
 
+/*
+Most documents given to the parser are plain JSON, such as catalog
+updates and log records.  These are first parsed by a simpler scanner
+that works directly on the text in memory and finds the end of each
+string sixteen bytes at a time.  It produces the same values and line
+numbers as the parser above, but gives up at the first thing that is
+not plain JSON, such as an expression, a comment, a trailing comma, or
+an error, and the text is then parsed again from the start by jx_parse.
+*/
+
+#define JX_FAST_MAX_DEPTH 1000
+
+struct jx_fast_parser {
+	const char *pos;
+	const char *end;
+	unsigned line;
+};
+
+static bool jx_fast_isspace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static void jx_fast_skip_space(struct jx_fast_parser *f)
+{
+	while (f->pos < f->end && jx_fast_isspace(*f->pos)) {
+		if (*f->pos == '\n')
+			f->line++;
+		f->pos++;
+	}
+}
+
+/*
+Look at the sixteen bytes at s, and return the offset of the first quote,
+backslash, or null byte among them, or 16 if there is none.
+The newlines before that offset are added to *lines.
+*/
+
+static inline int jx_fast_scan_block(const char *s, unsigned *lines)
+{
+	unsigned stop, newlines;
+
+#if defined(__SSE2__)
+	__m128i block = _mm_loadu_si128((const __m128i *)s);
+	__m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')));
+	special = _mm_or_si128(special, _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+	stop = _mm_movemask_epi8(special);
+	newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t w = vld1q_u8(weights);
+	uint8x16_t block = vld1q_u8((const uint8_t *)s);
+	uint8x16_t special = vorrq_u8(vceqq_u8(block, vdupq_n_u8('"')), vceqq_u8(block, vdupq_n_u8('\\')));
+	special = vandq_u8(vorrq_u8(special, vceqq_u8(block, vdupq_n_u8(0))), w);
+	uint8x16_t nl = vandq_u8(vceqq_u8(block, vdupq_n_u8('\n')), w);
+	stop = vaddv_u8(vget_low_u8(special)) | (vaddv_u8(vget_high_u8(special)) << 8);
+	newlines = vaddv_u8(vget_low_u8(nl)) | (vaddv_u8(vget_high_u8(nl)) << 8);
+#else
+	int i;
+	stop = newlines = 0;
+	for (i = 0; i < 16; i++) {
+		if (s[i] == '"' || s[i] == '\\' || s[i] == 0)
+			stop |= 1u << i;
+		if (s[i] == '\n')
+			newlines |= 1u << i;
+	}
+#endif
+
+	int n = stop ? __builtin_ctz(stop) : 16;
+	if (n < 16)
+		newlines &= (1u << n) - 1;
+	*lines += __builtin_popcount(newlines);
+	return n;
+}
+
+/* Decode the escapes in the body of a string, returning its length or -1 if it must be left to the full parser. */
+
+static int jx_fast_unescape(const char *s, const char *end, char *out)
+{
+	char *o = out;
+
+	while (s < end) {
+		char c = *s++;
+		if (c != '\\') {
+			*o++ = c;
+			continue;
+		}
+
+		c = *s++;
+		switch (c) {
+		case 'b':
+			*o++ = '\b';
+			break;
+		case 'f':
+			*o++ = '\f';
+			break;
+		case 'n':
+			*o++ = '\n';
+			break;
+		case 'r':
+			*o++ = '\r';
+			break;
+		case 't':
+			*o++ = '\t';
+			break;
+		case 'u': {
+			int i, uc = 0;
+			if (end - s < 4)
+				return -1;
+			for (i = 0; i < 4; i++) {
+				if (!isxdigit((unsigned char)s[i]))
+					return -1;
+				uc = uc * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : tolower((unsigned char)s[i]) - 'a' + 10);
+			}
+			/* The full parser reports anything beyond ascii, and ends the string at a null. */
+			if (uc < 1 || uc > 0x7f)
+				return -1;
+			*o++ = uc;
+			s += 4;
+			break;
+		}
+		default:
+			*o++ = c;
+			break;
+		}
+	}
+
+	return o - out;
+}
+
+/* Parse a string whose opening quote has been consumed. */
+
+static struct jx *jx_fast_string(struct jx_fast_parser *f)
+{
+	const char *start = f->pos;
+	bool escaped = false;
+
+	while (1) {
+		if (f->end - f->pos >= 16) {
+			int n = jx_fast_scan_block(f->pos, &f->line);
+			f->pos += n;
+			if (n == 16)
+				continue;
+		} else {
+			while (f->pos < f->end && *f->pos != '"' && *f->pos != '\\' && *f->pos) {
+				if (*f->pos == '\n')
+					f->line++;
+				f->pos++;
+			}
+			if (f->pos == f->end)
+				return 0;
+		}
+
+		if (*f->pos == '"')
+			break;
+		if (!*f->pos)
+			return 0;
+
+		/* Skip the backslash and the character it escapes. */
+		escaped = true;
+		f->pos++;
+		if (f->pos == f->end || !*f->pos)
+			return 0;
+		if (*f->pos == '\n')
+			f->line++;
+		f->pos++;
+	}
+
+	const char *stop = f->pos++;
+	char *str = malloc(stop - start + 1);
+	if (!str)
+		return 0;
+
+	int length;
+	if (escaped) {
+		length = jx_fast_unescape(start, stop, str);
+	} else {
+		length = stop - start;
+		memcpy(str, start, length);
+	}
+
+	if (length < 0 || length >= MAX_TOKEN_SIZE) {
+		free(str);
+		return 0;
+	}
+	str[length] = 0;
+
+	struct jx *j = jx_string_nocopy(str);
+	j->line = f->line;
+	return j;
+}
+
+static struct jx *jx_fast_number(struct jx_fast_parser *f)
+{
+	bool negative = false;
+	if (*f->pos == '-') {
+		negative = true;
+		f->pos++;
+	}
+
+	/* Accept the same characters as jx_scan, then let strtoll and strtod decide. */
+	const char *start = f->pos;
+	if (start == f->end || !isdigit((unsigned char)*start))
+		return 0;
+
+	while (f->pos < f->end) {
+		char c = *f->pos;
+		if (isdigit((unsigned char)c) || c == '.') {
+			f->pos++;
+		} else if (c == 'e' || c == 'E') {
+			f->pos++;
+			if (f->pos < f->end && (*f->pos == '-' || *f->pos == '+'))
+				f->pos++;
+		} else {
+			break;
+		}
+	}
+
+	char token[64];
+	size_t length = f->pos - start;
+	if (length >= sizeof(token))
+		return 0;
+	memcpy(token, start, length);
+	token[length] = 0;
+
+	struct jx *j;
+	char *endptr;
+	jx_int_t integer_value = strtoll(token, &endptr, 10);
+	if (!*endptr) {
+		j = jx_integer(negative ? -integer_value : integer_value);
+	} else {
+		double double_value = strtod(token, &endptr);
+		if (*endptr)
+			return 0;
+		j = jx_double(negative ? -double_value : double_value);
+	}
+
+	j->line = f->line;
+	return j;
+}
+
+static struct jx *jx_fast_literal(struct jx_fast_parser *f, const char *word, struct jx *(*create)(void))
+{
+	size_t length = strlen(word);
+	if ((size_t)(f->end - f->pos) < length || memcmp(f->pos, word, length))
+		return 0;
+
+	f->pos += length;
+	if (f->pos < f->end && (isalnum((unsigned char)*f->pos) || *f->pos == '_'))
+		return 0;
+
+	struct jx *j = create();
+	j->line = f->line;
+	return j;
+}
+
+static struct jx *jx_fast_true(void)
+{
+	return jx_boolean(1);
+}
+
+static struct jx *jx_fast_false(void)
+{
+	return jx_boolean(0);
+}
+
+static struct jx *jx_fast_value(struct jx_fast_parser *f, int depth);
+
+static struct jx *jx_fast_object(struct jx_fast_parser *f, int depth)
+{
+	struct jx *j = jx_object(0);
+	j->line = f->line;
+
+	struct jx_pair **tail = &j->u.pairs;
+
+	jx_fast_skip_space(f);
+	if (f->pos < f->end && *f->pos == '}') {
+		f->pos++;
+		return j;
+	}
+
+	while (1) {
+		jx_fast_skip_space(f);
+		if (f->pos == f->end || *f->pos != '"')
+			goto fail;
+		f->pos++;
+
+		struct jx *key = jx_fast_string(f);
+		if (!key)
+			goto fail;
+
+		jx_fast_skip_space(f);
+		if (f->pos == f->end || *f->pos != ':') {
+			jx_delete(key);
+			goto fail;
+		}
+		f->pos++;
+
+		unsigned line = f->line;
+		struct jx *value = jx_fast_value(f, depth + 1);
+		if (!value) {
+			jx_delete(key);
+			goto fail;
+		}
+
+		struct jx_pair *p = jx_pair(key, value, 0);
+		p->line = line;
+		*tail = p;
+		tail = &p->next;
+
+		jx_fast_skip_space(f);
+		if (f->pos == f->end)
+			goto fail;
+		if (*f->pos == '}') {
+			f->pos++;
+			return j;
+		}
+		if (*f->pos != ',')
+			goto fail;
+		f->pos++;
+	}
+
+fail:
+	jx_delete(j);
+	return 0;
+}
+
+static struct jx *jx_fast_array(struct jx_fast_parser *f, int depth)
+{
+	struct jx *j = jx_array(0);
+	j->line = f->line;
+
+	struct jx_item **tail = &j->u.items;
+
+	jx_fast_skip_space(f);
+	if (f->pos < f->end && *f->pos == ']') {
+		f->pos++;
+		return j;
+	}
+
+	while (1) {
+		struct jx *value = jx_fast_value(f, depth + 1);
+		if (!value)
+			goto fail;
+
+		struct jx_item *i = jx_item(value, 0);
+		i->line = value->line;
+		*tail = i;
+		tail = &i->next;
+
+		jx_fast_skip_space(f);
+		if (f->pos == f->end)
+			goto fail;
+		if (*f->pos == ']') {
+			f->pos++;
+			return j;
+		}
+		if (*f->pos != ',')
+			goto fail;
+		f->pos++;
+	}
+
+fail:
+	jx_delete(j);
+	return 0;
+}
+
+static struct jx *jx_fast_value(struct jx_fast_parser *f, int depth)
+{
+	if (depth > JX_FAST_MAX_DEPTH)
+		return 0;
+
+	jx_fast_skip_space(f);
+	if (f->pos == f->end)
+		return 0;
+
+	switch (*f->pos) {
+	case '{':
+		f->pos++;
+		return jx_fast_object(f, depth);
+	case '[':
+		f->pos++;
+		return jx_fast_array(f, depth);
+	case '"':
+		f->pos++;
+		return jx_fast_string(f);
+	case 't':
+		return jx_fast_literal(f, "true", jx_fast_true);
+	case 'f':
+		return jx_fast_literal(f, "false", jx_fast_false);
+	case 'n':
+		return jx_fast_literal(f, "null", jx_null);
+	default:
+		if (*f->pos == '-' || isdigit((unsigned char)*f->pos))
+			return jx_fast_number(f);
+		return 0;
+	}
+}
+
+/* Parse a complete plain JSON document, or return null if it must be left to the full parser. */
+
+static struct jx *jx_parse_fast(const char *str, size_t length)
+{
+	struct jx_fast_parser f;
+	f.pos = str;
+	f.end = str + length;
+	f.line = 1;
+
+	struct jx *j = jx_fast_value(&f, 0);
+	if (!j)
+		return 0;
+
+	jx_fast_skip_space(&f);
+	if (f.pos != f.end) {
+		jx_delete(j);
+		return 0;
+	}
+
+	return j;
+}
+
 static struct jx *jx_parse_finish(struct jx_parser *p)
 {
 	struct jx *j = jx_parse(p);
@@ -1192,6 +1622,10 @@ struct jx *jx_parser_yield(struct jx_parser *p)
 
 struct jx *jx_parse_string(const char *str)
 {
+	struct jx *j = jx_parse_fast(str, strlen(str));
+	if (j)
+		return j;
+
 	struct jx_parser *p = jx_parser_create(false);
 	jx_parser_read_string(p, str);
 	return jx_parse_finish(p);
@@ -1199,6 +1633,10 @@ struct jx *jx_parse_string(const char *str)
 
 struct jx *jx_parse_string_and_length(const char *str, int length)
 {
+	struct jx *j = jx_parse_fast(str, length < 0 ? strlen(str) : (size_t)length);
+	if (j)
+		return j;
+
 	struct jx_parser *p = jx_parser_create(false);
 	jx_parser_read_string_and_length(p, str, length);
 	return jx_parse_finish(p);
@@ -1225,8 +1663,21 @@ struct jx *jx_parse_file(const char *name)
 		debug(D_JX, "Could not open jx file: %s", name);
 		return NULL;
 	}
-	struct jx *j = jx_parse_stream(file);
+
+	/* Read the whole file so that plain JSON can take the fast path. */
+	char *text = 0;
+	size_t length;
+	if (copy_stream_to_buffer(file, &text, &length) < 0 || length > INT_MAX) {
+		free(text);
+		rewind(file);
+		struct jx *j = jx_parse_stream(file);
+		fclose(file);
+		return j;
+	}
 	fclose(file);
+
+	struct jx *j = jx_parse_string_and_length(text, length);
+	free(text);
 	return j;
 }
 
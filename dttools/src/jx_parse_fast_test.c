@@ -0,0 +1,189 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Check that plain JSON parsed by jx_parse_string, which takes the fast path,
+gives the same values and line numbers as the general parser, and that
+everything else is still handled by the general parser.
+*/
+
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *documents[] = {
+	"{}",
+	"[]",
+	"  \n\t{ }  \n",
+	"{\"type\":\"vine_manager\",\"port\":9123,\"load\":[0.5,1.5,-2.5e3],\"workers\":{\"connected\":10,\"idle\":-2},\"name\":\"test\",\"ok\":true,\"bad\":false,\"none\":null}",
+	"{\n  \"a\" :\n 1,\n \"b\"\n: [\n\"x\",\n{\"c\":\n\"multi\nline\"}\n]\n}",
+	"[\"escapes \\\" \\\\ \\/ \\b \\f \\n \\r \\t \\u0041 \\q\"]",
+	"\"a string that is longer than sixteen bytes, with a \\\"quote\\\" past the first block\"",
+	"[1, 1.0, 1e5, 1E-5, 12.5e+2, -0, -0.0, 9223372036854775807, 9223372036854775808, 007, 1.]",
+	"{\"dup\":1,\"dup\":2}",
+	"[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]",
+	"\"\"",
+	"true",
+	"-17",
+	/* The rest are not plain JSON and are left to the general parser. */
+	"",
+	"   ",
+	"{\"a\":1,}",
+	"[1,2,]",
+	"1 + 2",
+	"-x",
+	"- 5",
+	"{\"a\":1}[\"a\"]",
+	"{\"a\":1} # comment",
+	"# comment\n{\"a\":1}",
+	"{a:1}",
+	"[x for x in [1,2,3]]",
+	"{\"a\":1};",
+	"[1 2]",
+	"[.5]",
+	"[1.2.3]",
+	"[1e]",
+	"truex",
+	"error(\"failed\")",
+	"\"\\u00e9\"",
+	"\"\\u0000\"",
+	"\"\\u00zz\"",
+	"\"unterminated",
+	"\"ends in a backslash\\",
+	"{\"a\":1} {\"b\":2}",
+	"[1] 2",
+	0,
+};
+
+/* Compare two values, including the line numbers of every part of them. */
+
+static int same(struct jx *a, struct jx *b)
+{
+	if (!a || !b)
+		return !a && !b;
+	if (a->type != b->type || a->line != b->line)
+		return 0;
+
+	if (a->type == JX_OBJECT) {
+		struct jx_pair *p, *q;
+		for (p = a->u.pairs, q = b->u.pairs; p && q; p = p->next, q = q->next) {
+			if (p->line != q->line || !same(p->key, q->key) || !same(p->value, q->value))
+				return 0;
+		}
+		return !p && !q;
+	} else if (a->type == JX_ARRAY) {
+		struct jx_item *i, *k;
+		for (i = a->u.items, k = b->u.items; i && k; i = i->next, k = k->next) {
+			if (i->line != k->line || !same(i->value, k->value))
+				return 0;
+		}
+		return !i && !k;
+	} else if (a->type == JX_OPERATOR) {
+		return a->u.oper.type == b->u.oper.type && same(a->u.oper.left, b->u.oper.left) && same(a->u.oper.right, b->u.oper.right);
+	}
+
+	if (!jx_equals(a, b))
+		return 0;
+	if (a->type == JX_DOUBLE && memcmp(&a->u.double_value, &b->u.double_value, sizeof(double)))
+		return 0;
+	return 1;
+}
+
+static struct jx *parse_general(const char *text, int length)
+{
+	struct jx_parser *p = jx_parser_create(false);
+	jx_parser_read_string_and_length(p, text, length);
+	struct jx *j = jx_parse(p);
+	if (jx_parser_errors(p)) {
+		jx_delete(j);
+		j = 0;
+	}
+	jx_parser_delete(p);
+	return j;
+}
+
+static int check(const char *text, int length)
+{
+	struct jx *a = jx_parse_string_and_length(text, length);
+	struct jx *b = parse_general(text, length);
+	int result = same(a, b);
+	jx_delete(a);
+	jx_delete(b);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; documents[i]; i++) {
+		if (!check(documents[i], strlen(documents[i])))
+			FAIL("parsers disagree on document %d: %s", i, documents[i]);
+		struct jx *j = jx_parse_string(documents[i]);
+		struct jx *k = parse_general(documents[i], strlen(documents[i]));
+		if (!same(j, k))
+			FAIL("parsers disagree on string %d: %s", i, documents[i]);
+		jx_delete(j);
+		jx_delete(k);
+	}
+
+	/* A null byte inside the given length is not the end of the text. */
+	if (!check("[1,\0 2]", 7) || !check("\"a\0b\"", 5))
+		FAIL("parsers disagree on text with a null byte");
+
+	/* A string too long for the general parser is still refused. */
+	int size = 70000;
+	char *big = malloc(size + 3);
+	big[0] = '"';
+	memset(big + 1, 'x', size);
+	big[size + 1] = '"';
+	big[size + 2] = 0;
+	if (jx_parse_string(big))
+		FAIL("overlong string was accepted");
+	free(big);
+
+	/* Random changes to the documents must never make the parsers disagree. */
+	const char alphabet[] = "{}[]:,\"\\ \n-+.eE0123456789tfnulrsax#u";
+	srand(42);
+	for (i = 0; i < 50000; i++) {
+		const char *doc = documents[rand() % 13];
+		char text[512];
+		int length = strlen(doc);
+		memcpy(text, doc, length);
+
+		int changes = 1 + rand() % 3;
+		while (changes-- > 0 && length > 0 && length < (int)sizeof(text) - 1) {
+			int at = rand() % length;
+			char c = alphabet[rand() % (sizeof(alphabet) - 1)];
+			switch (rand() % 3) {
+			case 0:
+				text[at] = c;
+				break;
+			case 1:
+				memmove(text + at, text + at + 1, length - at - 1);
+				length--;
+				break;
+			case 2:
+				memmove(text + at + 1, text + at, length - at);
+				text[at] = c;
+				length++;
+				break;
+			}
+		}
+		text[length] = 0;
+
+		if (!check(text, length))
+			FAIL("parsers disagree on changed document: %s", text);
+	}
+
+	fprintf(stdout, "jx fast parse is correct\n");
+	return 0;
+}
@@ -7,8 +7,19 @@ See the file COPYING for details.
 #include "jx_print.h"
 #include "jx_parse.h"
 
+#include "zlib.h"
+
 #include <assert.h>
 #include <ctype.h>
+#include <math.h>
+
+/*
+Large values are printed in pieces: each element of an array or object at
+the top level is formatted into a buffer, which is handed to the output
+whenever it grows past JX_PRINT_CHUNK.
+*/
+
+#define JX_PRINT_CHUNK 65536
 
 void jx_comprehension_print(struct jx_comprehension *comp, buffer_t *b)
 {
@@ -129,49 +140,88 @@ const char *jx_type_string(jx_type_t type)
 	}
 }
 
+/* A character that can be printed in a JSON string without an escape. */
+
+static int jx_print_plain(char c)
+{
+	return c && c != '\"' && c != '\'' && c != '\\' && isprint(c);
+}
+
 void jx_escape_string(const char *s, buffer_t *b)
 {
 	if (!s)
 		return;
 
-	buffer_putstring(b, "\"");
+	buffer_putliteral(b, "\"");
 	while (*s) {
+		/* Copy the longest run of characters without escapes at once. */
+		const char *run = s;
+		while (jx_print_plain(*s))
+			s++;
+		if (s > run)
+			buffer_putlstring(b, run, s - run);
+		if (!*s)
+			break;
+
 		switch (*s) {
 		case '\"':
-			buffer_putstring(b, "\\\"");
+			buffer_putliteral(b, "\\\"");
 			break;
 		case '\'':
-			buffer_putstring(b, "\\\'");
+			buffer_putliteral(b, "\\\'");
 			break;
 		case '\\':
-			buffer_putstring(b, "\\\\");
+			buffer_putliteral(b, "\\\\");
 			break;
 		case '\b':
-			buffer_putstring(b, "\\b");
+			buffer_putliteral(b, "\\b");
 			break;
 		case '\f':
-			buffer_putstring(b, "\\f");
+			buffer_putliteral(b, "\\f");
 			break;
 		case '\n':
-			buffer_putstring(b, "\\n");
+			buffer_putliteral(b, "\\n");
 			break;
 		case '\r':
-			buffer_putstring(b, "\\r");
+			buffer_putliteral(b, "\\r");
 			break;
 		case '\t':
-			buffer_putstring(b, "\\t");
+			buffer_putliteral(b, "\\t");
 			break;
 		default:
-			if (isprint(*s)) {
-				buffer_printf(b, "%c", *s);
-			} else {
-				buffer_printf(b, "\\u%04x", (int)*s);
-			}
+			buffer_printf(b, "\\u%04x", (int)*s);
 			break;
 		}
 		s++;
 	}
-	buffer_putstring(b, "\"");
+	buffer_putliteral(b, "\"");
+}
+
+static void jx_print_integer(jx_int_t value, buffer_t *b)
+{
+	char digits[24];
+	char *p = digits + sizeof(digits);
+
+	unsigned long long u = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+
+	if (value < 0)
+		*--p = '-';
+
+	buffer_putlstring(b, p, digits + sizeof(digits) - p);
+}
+
+static void jx_print_double(double value, buffer_t *b)
+{
+	/* Whole numbers that %.16g would print without an exponent are the same digits as an integer. */
+	if (value >= -1e15 && value <= 1e15 && value == (jx_int_t)value && (value != 0 || !signbit(value))) {
+		jx_print_integer((jx_int_t)value, b);
+	} else {
+		buffer_printf(b, "%.16g", value);
+	}
 }
 
 void jx_print_subexpr(struct jx *j, jx_operator_t parent, buffer_t *b)
@@ -208,19 +258,19 @@ void jx_print_buffer(struct jx *j, buffer_t *b)
 
 	switch (j->type) {
 	case JX_NULL:
-		buffer_putstring(b, "null");
+		buffer_putliteral(b, "null");
 		break;
 	case JX_DOUBLE:
-		buffer_printf(b, "%.16g", j->u.double_value);
+		jx_print_double(j->u.double_value, b);
 		break;
 	case JX_BOOLEAN:
-		buffer_printf(b, "%s", j->u.boolean_value ? "true" : "false");
+		buffer_putstring(b, j->u.boolean_value ? "true" : "false");
 		break;
 	case JX_INTEGER:
-		buffer_printf(b, "%lld", (long long)j->u.integer_value);
+		jx_print_integer(j->u.integer_value, b);
 		break;
 	case JX_SYMBOL:
-		buffer_printf(b, "%s", j->u.symbol_name);
+		buffer_putstring(b, j->u.symbol_name);
 		break;
 	case JX_STRING:
 		jx_escape_string(j->u.string_value, b);
@@ -255,27 +305,144 @@ void jx_print_buffer(struct jx *j, buffer_t *b)
 	}
 }
 
+typedef int (*jx_print_write_t)(const char *data, size_t length, void *arg);
+
+/* Print a value in pieces of about JX_PRINT_CHUNK bytes, stopping if a write fails. */
+
+static int jx_print_chunked(struct jx *j, jx_print_write_t write, void *arg)
+{
+	buffer_t b;
+	buffer_init(&b);
+	int ok = 1;
+
+#define JX_PRINT_FLUSH(min) \
+	if (ok && buffer_pos(&b) >= (min)) { \
+		ok = write(buffer_tostring(&b), buffer_pos(&b), arg); \
+		buffer_rewind(&b, 0); \
+	}
+
+	if (jx_istype(j, JX_ARRAY)) {
+		struct jx_item *item;
+		buffer_putliteral(&b, "[");
+		for (item = j->u.items; item && ok; item = item->next) {
+			jx_print_buffer(item->value, &b);
+			jx_comprehension_print(item->comp, &b);
+			if (item->next)
+				buffer_putliteral(&b, ",");
+			JX_PRINT_FLUSH(JX_PRINT_CHUNK);
+		}
+		buffer_putliteral(&b, "]");
+	} else if (jx_istype(j, JX_OBJECT)) {
+		struct jx_pair *pair;
+		buffer_putliteral(&b, "{");
+		for (pair = j->u.pairs; pair && ok; pair = pair->next) {
+			jx_print_buffer(pair->key, &b);
+			buffer_putliteral(&b, ":");
+			jx_print_buffer(pair->value, &b);
+			jx_comprehension_print(pair->comp, &b);
+			if (pair->next)
+				buffer_putliteral(&b, ",");
+			JX_PRINT_FLUSH(JX_PRINT_CHUNK);
+		}
+		buffer_putliteral(&b, "}");
+	} else {
+		jx_print_buffer(j, &b);
+	}
+
+	JX_PRINT_FLUSH(1);
+#undef JX_PRINT_FLUSH
+
+	buffer_free(&b);
+	return ok;
+}
+
+static int jx_print_write_stream(const char *data, size_t length, void *arg)
+{
+	return fwrite(data, 1, length, arg) == length;
+}
+
 void jx_print_stream(struct jx *j, FILE *file)
 {
-	buffer_t buffer;
-	buffer_init(&buffer);
-	jx_print_buffer(j, &buffer);
-	fprintf(file, "%s", buffer_tostring(&buffer));
-	buffer_free(&buffer);
+	if (!j)
+		return;
+	jx_print_chunked(j, jx_print_write_stream, file);
+}
+
+struct jx_print_link_output {
+	struct link *link;
+	time_t stoptime;
+};
+
+static int jx_print_write_link(const char *data, size_t length, void *arg)
+{
+	struct jx_print_link_output *out = arg;
+	return link_write(out->link, data, length, out->stoptime) == (ssize_t)length;
 }
 
 void jx_print_link(struct jx *j, struct link *l, time_t stoptime)
 {
+	if (!j)
+		return;
+	struct jx_print_link_output out = {l, stoptime};
+	jx_print_chunked(j, jx_print_write_link, &out);
+}
 
-	buffer_t buffer;
-	buffer_init(&buffer);
-	jx_print_buffer(j, &buffer);
+struct jx_print_gzip_output {
+	struct jx_print_link_output link;
+	z_stream stream;
+	char data[JX_PRINT_CHUNK];
+};
 
-	size_t len;
-	const char *str = buffer_tolstring(&buffer, &len);
+/* Compress the given data, or finish the stream if it is null, writing the output as it fills up. */
 
-	link_printf(l, stoptime, "%s", str);
-	buffer_free(&buffer);
+static int jx_print_write_gzip(const char *data, size_t length, void *arg)
+{
+	struct jx_print_gzip_output *out = arg;
+	int flush = data ? Z_NO_FLUSH : Z_FINISH;
+
+	out->stream.next_in = (Bytef *)data;
+	out->stream.avail_in = length;
+
+	while (1) {
+		out->stream.next_out = (Bytef *)out->data;
+		out->stream.avail_out = sizeof(out->data);
+
+		int result = deflate(&out->stream, flush);
+		if (result == Z_STREAM_ERROR)
+			return 0;
+
+		size_t have = sizeof(out->data) - out->stream.avail_out;
+		if (have > 0 && !jx_print_write_link(out->data, have, &out->link))
+			return 0;
+
+		if (flush == Z_FINISH ? result == Z_STREAM_END : out->stream.avail_in == 0)
+			return 1;
+	}
+}
+
+int jx_print_link_gzip(struct jx *j, struct link *l, time_t stoptime)
+{
+	if (!j)
+		return 1;
+
+	struct jx_print_gzip_output *out = calloc(1, sizeof(*out));
+	if (!out)
+		return 0;
+
+	out->link.link = l;
+	out->link.stoptime = stoptime;
+
+	/* A window of 15 bits plus 16 selects the gzip format rather than zlib. */
+	if (deflateInit2(&out->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(out);
+		return 0;
+	}
+
+	int ok = jx_print_chunked(j, jx_print_write_gzip, out) && jx_print_write_gzip(0, 0, out);
+
+	deflateEnd(&out->stream);
+	free(out);
+	return ok;
 }
 
 char *jx_print_string(struct jx *j)
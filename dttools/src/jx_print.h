@@ -34,6 +34,9 @@ void jx_print_buffer( struct jx *j, buffer_t *buffer);
 
 void jx_print_link( struct jx *j, struct link *l, time_t stoptime );
 
+/** Print a JX expression to a link, compressed in gzip format, as for an HTTP response with Content-Encoding: gzip.  @param j A JX expression. @param l The network link to write. @param stoptime The absolute time to stop. @return True on success, false if the output could not be compressed or written. @see link.h */
+int jx_print_link_gzip( struct jx *j, struct link *l, time_t stoptime );
+
 /** Print a C string in JSON format (with escape codes) into a buffer.  @param s A C string.  @param b The buffer for output.  @see buffer.h */
 void jx_escape_string( const char *s, buffer_t *b );
 
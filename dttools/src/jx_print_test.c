@@ -0,0 +1,88 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx.h"
+#include "jx_print.h"
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int check_print(struct jx *j, const char *expected)
+{
+	char *str = jx_print_string(j);
+	int result = !strcmp(str, expected);
+	if (!result)
+		fprintf(stdout, "printed %s instead of %s\n", str, expected);
+	free(str);
+	jx_delete(j);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	char expected[64];
+	int i;
+
+	/* Numbers print as they did with %lld and %.16g. */
+	jx_int_t integers[] = {0, 1, -1, 9, 10, -10, 1234567890, LLONG_MAX, LLONG_MIN};
+	for (i = 0; i < (int)(sizeof(integers) / sizeof(integers[0])); i++) {
+		snprintf(expected, sizeof(expected), "%lld", (long long)integers[i]);
+		if (!check_print(jx_integer(integers[i]), expected))
+			FAIL("integer %lld printed incorrectly", (long long)integers[i]);
+	}
+
+	double doubles[] = {0.0, -0.0, 1.0, -1.0, 0.5, 3.25, 0.1, 1e15, -1e15, 1e15 + 1, 1e16, 123456789012345.0, 1e300, 1e-300, 2.5e-7, NAN, INFINITY, -INFINITY};
+	for (i = 0; i < (int)(sizeof(doubles) / sizeof(doubles[0])); i++) {
+		snprintf(expected, sizeof(expected), "%.16g", doubles[i]);
+		if (!check_print(jx_double(doubles[i]), expected))
+			FAIL("double %.16g printed incorrectly", doubles[i]);
+	}
+
+	if (!check_print(jx_boolean(1), "true") || !check_print(jx_boolean(0), "false") || !check_print(jx_null(), "null"))
+		FAIL("constant printed incorrectly");
+
+	/* Strings are copied in runs between escapes. */
+	if (!check_print(jx_string(""), "\"\""))
+		FAIL("empty string printed incorrectly");
+	if (!check_print(jx_string("plain text"), "\"plain text\""))
+		FAIL("plain string printed incorrectly");
+	if (!check_print(jx_string("a\"b'c\\d\be\ff\ng\rh\ti\001j"), "\"a\\\"b\\'c\\\\d\\be\\ff\\ng\\rh\\ti\\u0001j\""))
+		FAIL("escaped string printed incorrectly");
+
+	/* A large value printed to a stream in pieces matches the string form. */
+	struct jx *a = jx_array(0);
+	for (i = 0; i < 20000; i++) {
+		char *name = string_format("item-%d", i);
+		jx_array_append(a, jx_objectv("name", jx_string(name), "id", jx_integer(i), "load", jx_double(i / 4.0), NULL));
+		free(name);
+	}
+
+	char *str = jx_print_string(a);
+	FILE *file = tmpfile();
+	jx_print_stream(a, file);
+	long length = ftell(file);
+	rewind(file);
+	char *streamed = malloc(length + 1);
+	if (fread(streamed, 1, length, file) != (size_t)length)
+		FAIL("could not read back the stream");
+	streamed[length] = 0;
+	fclose(file);
+
+	if (length < 65536 * 4 || strcmp(str, streamed))
+		FAIL("streamed output differs from the string form");
+
+	free(streamed);
+	free(str);
+	jx_delete(a);
+
+	fprintf(stdout, "jx print is correct\n");
+	return 0;
+}
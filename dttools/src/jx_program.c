@@ -0,0 +1,376 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx_program.h"
+#include "jx_eval.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+A program is the expression flattened into an array of nodes, in which
+each operator refers to its operands by position.  Each node has room
+for its own result, so evaluation only writes into the nodes.
+Wherever jx_eval would allocate a new value or produce an error, the fast
+evaluation gives up and returns null, and the whole expression is
+evaluated by jx_eval instead.  The fast evaluation must therefore give
+the same result as jx_eval in every case that it does not give up.
+*/
+
+typedef enum {
+	NODE_CONSTANT,
+	NODE_SYMBOL,
+	NODE_OPERATOR,
+} node_kind_t;
+
+struct jx_program_node {
+	node_kind_t kind;
+	struct jx *expr;
+	int left;
+	int right;
+	struct jx result;
+};
+
+struct jx_program {
+	struct jx *expr;
+	struct jx_program_node *nodes;
+	int nnodes;
+	int root;
+	int fast;
+	struct jx *fallback;
+};
+
+static int jx_program_count(struct jx *j)
+{
+	if (!j)
+		return 0;
+	if (j->type == JX_OPERATOR)
+		return 1 + jx_program_count(j->u.oper.left) + jx_program_count(j->u.oper.right);
+	return 1;
+}
+
+static int jx_program_supported(jx_operator_t op)
+{
+	switch (op) {
+	case JX_OP_EQ:
+	case JX_OP_NE:
+	case JX_OP_LE:
+	case JX_OP_LT:
+	case JX_OP_GE:
+	case JX_OP_GT:
+	case JX_OP_ADD:
+	case JX_OP_SUB:
+	case JX_OP_MUL:
+	case JX_OP_DIV:
+	case JX_OP_MOD:
+	case JX_OP_AND:
+	case JX_OP_OR:
+	case JX_OP_NOT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Add the nodes for j and return the position of its node, or -1 if j is null. */
+
+static int jx_program_compile(struct jx_program *p, struct jx *j)
+{
+	if (!j)
+		return -1;
+
+	struct jx_program_node *n;
+	int left, right;
+
+	switch (j->type) {
+	case JX_NULL:
+	case JX_BOOLEAN:
+	case JX_INTEGER:
+	case JX_DOUBLE:
+	case JX_STRING:
+		n = &p->nodes[p->nnodes];
+		n->kind = NODE_CONSTANT;
+		break;
+	case JX_SYMBOL:
+		n = &p->nodes[p->nnodes];
+		n->kind = NODE_SYMBOL;
+		break;
+	case JX_OPERATOR:
+		if (!jx_program_supported(j->u.oper.type) || !j->u.oper.right) {
+			p->fast = 0;
+			return -1;
+		}
+		left = jx_program_compile(p, j->u.oper.left);
+		right = jx_program_compile(p, j->u.oper.right);
+		n = &p->nodes[p->nnodes];
+		n->kind = NODE_OPERATOR;
+		n->left = left;
+		n->right = right;
+		break;
+	default:
+		p->fast = 0;
+		return -1;
+	}
+
+	n->expr = j;
+	return p->nnodes++;
+}
+
+struct jx_program *jx_program_create(struct jx *expr)
+{
+	struct jx_program *p = xxcalloc(1, sizeof(*p));
+	p->expr = expr;
+	p->nodes = xxcalloc(jx_program_count(expr) + 1, sizeof(*p->nodes));
+	p->fast = 1;
+	p->root = jx_program_compile(p, p->expr);
+	if (p->root < 0)
+		p->fast = 0;
+	return p;
+}
+
+void jx_program_delete(struct jx_program *p)
+{
+	if (!p)
+		return;
+	jx_delete(p->fallback);
+	free(p->nodes);
+	free(p);
+}
+
+static struct jx *jx_program_boolean(struct jx_program_node *n, int value)
+{
+	n->result.type = JX_BOOLEAN;
+	n->result.u.boolean_value = value;
+	return &n->result;
+}
+
+static struct jx *jx_program_run(struct jx_program *p, int i, struct jx *context);
+
+static struct jx *jx_program_run_operator(struct jx_program *p, struct jx_program_node *n, struct jx *context)
+{
+	jx_operator_t op = n->expr->u.oper.type;
+	struct jx *left = 0;
+	struct jx *right = 0;
+
+	if (n->left >= 0) {
+		left = jx_program_run(p, n->left, context);
+		if (!left)
+			return 0;
+	}
+
+	if (op == JX_OP_AND && jx_isfalse(left))
+		return left;
+	if (op == JX_OP_OR && jx_istrue(left))
+		return left;
+
+	right = jx_program_run(p, n->right, context);
+	if (!right)
+		return 0;
+
+	jx_type_t type = right->type;
+
+	if (left && left->type != right->type) {
+		if ((left->type == JX_INTEGER && right->type == JX_DOUBLE) || (left->type == JX_DOUBLE && right->type == JX_INTEGER)) {
+			type = JX_DOUBLE;
+		} else if (op == JX_OP_EQ) {
+			return jx_program_boolean(n, 0);
+		} else if (op == JX_OP_NE) {
+			return jx_program_boolean(n, 1);
+		} else {
+			return 0;
+		}
+	}
+
+	switch (type) {
+	case JX_NULL:
+		if (op == JX_OP_EQ)
+			return jx_program_boolean(n, 1);
+		if (op == JX_OP_NE)
+			return jx_program_boolean(n, 0);
+		return 0;
+	case JX_BOOLEAN: {
+		int a = left ? left->u.boolean_value : 0;
+		int b = right->u.boolean_value;
+		switch (op) {
+		case JX_OP_EQ:
+			return jx_program_boolean(n, a == b);
+		case JX_OP_NE:
+			return jx_program_boolean(n, a != b);
+		case JX_OP_AND:
+			return jx_program_boolean(n, a && b);
+		case JX_OP_OR:
+			return jx_program_boolean(n, a || b);
+		case JX_OP_NOT:
+			return jx_program_boolean(n, !b);
+		default:
+			return 0;
+		}
+	}
+	case JX_INTEGER: {
+		jx_int_t a = left ? left->u.integer_value : 0;
+		jx_int_t b = right->u.integer_value;
+		n->result.type = JX_INTEGER;
+		switch (op) {
+		case JX_OP_EQ:
+			return jx_program_boolean(n, a == b);
+		case JX_OP_NE:
+			return jx_program_boolean(n, a != b);
+		case JX_OP_LT:
+			return jx_program_boolean(n, a < b);
+		case JX_OP_LE:
+			return jx_program_boolean(n, a <= b);
+		case JX_OP_GT:
+			return jx_program_boolean(n, a > b);
+		case JX_OP_GE:
+			return jx_program_boolean(n, a >= b);
+		case JX_OP_ADD:
+			n->result.u.integer_value = a + b;
+			return &n->result;
+		case JX_OP_SUB:
+			n->result.u.integer_value = a - b;
+			return &n->result;
+		case JX_OP_MUL:
+			n->result.u.integer_value = a * b;
+			return &n->result;
+		case JX_OP_DIV:
+			if (b == 0)
+				return 0;
+			n->result.u.integer_value = a / b;
+			return &n->result;
+		case JX_OP_MOD:
+			if (b == 0)
+				return 0;
+			n->result.u.integer_value = a % b;
+			return &n->result;
+		default:
+			return 0;
+		}
+	}
+	case JX_DOUBLE: {
+		double a = !left ? 0 : left->type == JX_INTEGER ? left->u.integer_value : left->u.double_value;
+		double b = right->type == JX_INTEGER ? right->u.integer_value : right->u.double_value;
+		n->result.type = JX_DOUBLE;
+		switch (op) {
+		case JX_OP_EQ:
+			return jx_program_boolean(n, a == b);
+		case JX_OP_NE:
+			return jx_program_boolean(n, a != b);
+		case JX_OP_LT:
+			return jx_program_boolean(n, a < b);
+		case JX_OP_LE:
+			return jx_program_boolean(n, a <= b);
+		case JX_OP_GT:
+			return jx_program_boolean(n, a > b);
+		case JX_OP_GE:
+			return jx_program_boolean(n, a >= b);
+		case JX_OP_ADD:
+			n->result.u.double_value = a + b;
+			return &n->result;
+		case JX_OP_SUB:
+			n->result.u.double_value = a - b;
+			return &n->result;
+		case JX_OP_MUL:
+			n->result.u.double_value = a * b;
+			return &n->result;
+		case JX_OP_DIV:
+			if (b == 0)
+				return 0;
+			n->result.u.double_value = a / b;
+			return &n->result;
+		case JX_OP_MOD:
+			if ((jx_int_t)b == 0)
+				return 0;
+			n->result.u.double_value = (jx_int_t)a % (jx_int_t)b;
+			return &n->result;
+		default:
+			return 0;
+		}
+	}
+	case JX_STRING: {
+		const char *a = left ? left->u.string_value : "";
+		const char *b = right->u.string_value;
+		switch (op) {
+		case JX_OP_EQ:
+			return jx_program_boolean(n, strcmp(a, b) == 0);
+		case JX_OP_NE:
+			return jx_program_boolean(n, strcmp(a, b) != 0);
+		case JX_OP_LT:
+			return jx_program_boolean(n, strcmp(a, b) < 0);
+		case JX_OP_LE:
+			return jx_program_boolean(n, strcmp(a, b) <= 0);
+		case JX_OP_GT:
+			return jx_program_boolean(n, strcmp(a, b) > 0);
+		case JX_OP_GE:
+			return jx_program_boolean(n, strcmp(a, b) >= 0);
+		default:
+			return 0;
+		}
+	}
+	case JX_ARRAY:
+		if (!left)
+			return 0;
+		if (op == JX_OP_EQ)
+			return jx_program_boolean(n, jx_equals(left, right));
+		if (op == JX_OP_NE)
+			return jx_program_boolean(n, !jx_equals(left, right));
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static struct jx *jx_program_run(struct jx_program *p, int i, struct jx *context)
+{
+	struct jx_program_node *n = &p->nodes[i];
+	struct jx *value;
+
+	switch (n->kind) {
+	case NODE_CONSTANT:
+		return n->expr;
+	case NODE_SYMBOL:
+		value = jx_lookup(context, n->expr->u.symbol_name);
+		if (!value)
+			return 0;
+		switch (value->type) {
+		case JX_NULL:
+		case JX_BOOLEAN:
+		case JX_INTEGER:
+		case JX_DOUBLE:
+		case JX_STRING:
+			return value;
+		case JX_ARRAY:
+		case JX_OBJECT:
+			return jx_is_constant(value) ? value : 0;
+		default:
+			return 0;
+		}
+	case NODE_OPERATOR:
+		return jx_program_run_operator(p, n, context);
+	}
+
+	return 0;
+}
+
+struct jx *jx_program_eval(struct jx_program *p, struct jx *context)
+{
+	if (p->fast && jx_istype(context, JX_OBJECT)) {
+		struct jx *result = jx_program_run(p, p->root, context);
+		if (result)
+			return result;
+	}
+
+	jx_delete(p->fallback);
+	p->fallback = jx_eval(p->expr, context);
+	return p->fallback;
+}
+
+int jx_program_is_true(struct jx_program *p, struct jx *context)
+{
+	return jx_istrue(jx_program_eval(p, context));
+}
+
+/* vim: set noexpandtab tabstop=8: */
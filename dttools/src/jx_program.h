@@ -0,0 +1,59 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef JX_PROGRAM_H
+#define JX_PROGRAM_H
+
+#include "jx.h"
+
+/** @file jx_program.h Repeated evaluation of one JX expression.
+
+A program is an expression prepared once to be evaluated against
+many contexts, such as a filter applied to every record in a table.
+Constants, symbols, and the arithmetic, comparison, and logical operators
+on atomic values are evaluated without allocating memory: the result is
+either a value held by the program or a value found in the context.
+Any other expression, or any case that would produce an error,
+is handed to @ref jx_eval, so the result is always the same.
+
+<pre>
+struct jx_program *p = jx_program_create(expr);
+for(each record) {
+	if(jx_program_is_true(p,record)) ...
+}
+jx_program_delete(p);
+</pre>
+*/
+
+/** Prepare an expression for evaluation.
+@param expr The expression, which is not copied, and must not be modified
+or deleted until the program is deleted.
+@return A new program, to be deleted with @ref jx_program_delete.
+*/
+struct jx_program *jx_program_create(struct jx *expr);
+
+/** Delete a program.
+@param p The program to delete.
+*/
+void jx_program_delete(struct jx_program *p);
+
+/** Evaluate a program.
+@param p The program to evaluate.
+@param context An object in which values will be found.
+@return The result, which belongs to the program or the context, must not be
+modified or deleted, and is valid only until the program is evaluated again
+or the context is changed.  Use @ref jx_copy to keep it.
+*/
+struct jx *jx_program_eval(struct jx_program *p, struct jx *context);
+
+/** Evaluate a program as a condition.
+@param p The program to evaluate.
+@param context An object in which values will be found.
+@return True if the result is the boolean true, false otherwise.
+*/
+int jx_program_is_true(struct jx_program *p, struct jx *context);
+
+#endif
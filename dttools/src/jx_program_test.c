@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "jx.h"
+#include "jx_eval.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "jx_program.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *contexts[] = {
+	"{\"type\":\"vine_manager\",\"name\":\"a\",\"port\":9123,\"load\":0.5,\"up\":true,\"tags\":[1,2],\"none\":null}",
+	"{\"type\":\"wq_worker\",\"name\":\"b\",\"port\":0,\"load\":2,\"up\":false,\"tags\":[1,2,3],\"none\":null}",
+	"{\"type\":\"chirp\",\"port\":\"9094\",\"load\":\"high\",\"up\":1}",
+	"{}",
+};
+
+static const char *exprs[] = {
+	"type==\"vine_manager\"",
+	"type!=\"chirp\" && port>100",
+	"port>100 || load<1",
+	"up",
+	"!up",
+	"!port",
+	"-port",
+	"-load",
+	"port+1",
+	"load*2+port",
+	"port/0",
+	"port%7",
+	"load%2",
+	"port/3",
+	"load/2",
+	"port==load",
+	"port!=name",
+	"port<name",
+	"name<\"b\"",
+	"name+\"x\"",
+	"name+port",
+	"tags==[1,2]",
+	"tags!=[1,2]",
+	"tags",
+	"none==null",
+	"none<null",
+	"missing",
+	"missing==1",
+	"up && port",
+	"port && up",
+	"false && missing",
+	"true || missing",
+	"tags[0]",
+	"len(tags)>1",
+	"port>=9123 && port<=9123",
+	"3.5",
+	"\"text\"",
+	"null",
+};
+
+int main(int argc, char **argv)
+{
+	size_t i, k;
+
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+		struct jx *expr = jx_parse_string(exprs[i]);
+		if (!expr)
+			FAIL("couldn't parse %s", exprs[i]);
+
+		struct jx_program *p = jx_program_create(expr);
+
+		/* Run twice to check that no result is left over from the last context. */
+		int round;
+		for (round = 0; round < 2; round++) {
+			for (k = 0; k < sizeof(contexts) / sizeof(contexts[0]); k++) {
+				struct jx *context = jx_parse_string(contexts[k]);
+
+				struct jx *expected = jx_eval(expr, context);
+				char *expected_str = jx_print_string(expected);
+				char *actual_str = jx_print_string(jx_program_eval(p, context));
+
+				if (strcmp(expected_str, actual_str))
+					FAIL("%s in %s: expected %s but got %s", exprs[i], contexts[k], expected_str, actual_str);
+				if (jx_istrue(expected) != jx_program_is_true(p, context))
+					FAIL("%s in %s: condition differs", exprs[i], contexts[k]);
+
+				free(expected_str);
+				free(actual_str);
+				jx_delete(expected);
+				jx_delete(context);
+			}
+		}
+
+		jx_program_delete(p);
+		jx_delete(expr);
+	}
+
+	return 0;
+}
@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "jx_sub.h"
+#include "jx_arena.h"
 #include "jx_function.h"
 
 #include <assert.h>
@@ -96,7 +97,7 @@ static struct jx_item *jx_sub_list_comprehension(struct jx *body, struct jx_comp
 		next = item->comp;
 		value = item->value;
 
-		free(item);
+		jx_arena_free(item);
 
 	} else {
 		// final comp -> do sub on body
@@ -168,7 +169,7 @@ static struct jx_pair *jx_sub_dict_comprehension(struct jx *key, struct jx *valu
 		new_key = pair->key;
 		new_value = pair->value;
 
-		free(pair);
+		jx_arena_free(pair);
 
 	} else {
 		// final comp -> do sub on body
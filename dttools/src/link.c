@@ -11,8 +11,11 @@ See the file COPYING for details.
 #include "debug.h"
 #include "domain_name.h"
 #include "full_io.h"
+#include "hash_table.h"
 #include "macros.h"
+#include "set.h"
 #include "stringtools.h"
+#include "xxmalloc.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -21,13 +24,23 @@ See the file COPYING for details.
 #include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#if defined(CCTOOLS_OPSYS_LINUX)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+#include <sys/event.h>
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include <assert.h>
@@ -52,8 +65,46 @@ See the file COPYING for details.
 #include "openssl/err.h"
 #include "openssl/ssl.h"
 static int openssl_initialized = 0;
+
+#ifdef HAS_TLS_method
+/*
+SSL contexts are shared by the links of a process, so that a server issues
+session tickets that remain valid across its connections, and a client
+resumes the session of its previous connection to the same server rather
+than doing a full handshake each time, as workers do when reconnecting.
+*/
+struct ssl_server_context {
+	SSL_CTX *ctx;
+	time_t key_mtime;
+	time_t cert_mtime;
+};
+
+static SSL_CTX *ssl_client_ctx = 0;
+static struct hash_table *ssl_server_contexts = 0;
+static struct hash_table *ssl_sessions = 0;
+static pthread_mutex_t ssl_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
 #endif
 
+/* Read buffers are taken from a pool only while a link holds unread data,
+so that idle links do not keep any. Their size doubles from the smallest
+class while reads fill them, and halves when reads use little of them. */
+#define LINK_BUFFER_MIN (1 << 12)
+#define LINK_BUFFER_MAX (1 << 16)
+#define LINK_BUFFER_CLASSES 5
+#define LINK_BUFFER_POOL_MAX 64
+
+/* Largest number of segments given to a single writev by link_writev. */
+#define LINK_IOV_MAX 64
+
+struct link_buffer_pool {
+	void *free[LINK_BUFFER_CLASSES];
+	int count[LINK_BUFFER_CLASSES];
+	pthread_mutex_t mutex;
+};
+
+static struct link_buffer_pool link_buffer_pool = {{0}, {0}, PTHREAD_MUTEX_INITIALIZER};
+
 enum link_type {
 	LINK_TYPE_STANDARD,
 	LINK_TYPE_FILE,
@@ -65,7 +116,9 @@ struct link {
 	uint64_t read, written;
 	char *buffer_start;
 	size_t buffer_length;
-	char buffer[1 << 16];
+	char *buffer;
+	size_t buffer_size;
+	size_t buffer_next_size;
 
 	buffer_t output_buffer;
 	size_t output_buffer_size;
@@ -73,12 +126,28 @@ struct link {
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
 
+	struct link_poll_set *poll_set;
+	int poll_events;
+	int poll_buffered;
+
 #ifdef HAS_OPENSSL
 	SSL_CTX *ctx;
 	SSL *ssl;
+	char *ssl_session_name;
 #endif
 };
 
+struct link_poll_set {
+	int fd;                  /* epoll or kqueue descriptor, or -1 when using plain poll. */
+	struct set *links;       /* All links in the set. */
+	struct link **buffered;  /* Links that had data read into their buffer since the last wait. */
+	int buffered_count;
+	int buffered_size;
+	void *events;            /* Scratch space for the events returned by the kernel. */
+	struct link **polled;    /* For plain poll, the link corresponding to each entry of events. */
+	int events_size;
+};
+
 static int link_send_window = 65536;
 static int link_recv_window = 65536;
 static int link_override_window = 0;
@@ -182,6 +251,11 @@ int link_buffer_empty(struct link *link)
 	return link->buffer_length > 0 ? 0 : 1;
 }
 
+uint64_t link_bytes_read(struct link *link)
+{
+	return link->read - link->buffer_length;
+}
+
 int errno_is_temporary(int e)
 {
 	if (e == EINTR || e == EWOULDBLOCK || e == EAGAIN || e == EINPROGRESS || e == EALREADY || e == EISCONN) {
@@ -290,6 +364,61 @@ int link_usleep_mask(struct link *link, int usec, sigset_t *mask, int reading, i
 	return link_internal_sleep(link, &tm, mask, reading, writing);
 }
 
+static int buffer_class(size_t size)
+{
+	int c = 0;
+	while ((size_t)(LINK_BUFFER_MIN << c) < size)
+		c++;
+	return c;
+}
+
+static void buffer_acquire(struct link *link)
+{
+	link->buffer_size = link->buffer_next_size;
+	int c = buffer_class(link->buffer_size);
+
+	pthread_mutex_lock(&link_buffer_pool.mutex);
+	link->buffer = link_buffer_pool.free[c];
+	if (link->buffer) {
+		link_buffer_pool.free[c] = *(void **)link->buffer;
+		link_buffer_pool.count[c]--;
+	}
+	pthread_mutex_unlock(&link_buffer_pool.mutex);
+
+	if (!link->buffer)
+		link->buffer = xxmalloc(link->buffer_size);
+}
+
+/* Return the read buffer to the pool once all its data has been consumed. */
+static void buffer_release(struct link *link)
+{
+	if (!link->buffer || link->buffer_length > 0)
+		return;
+
+	int c = buffer_class(link->buffer_size);
+	void *b = link->buffer;
+	link->buffer = 0;
+	link->buffer_start = 0;
+
+	pthread_mutex_lock(&link_buffer_pool.mutex);
+	if (link_buffer_pool.count[c] < LINK_BUFFER_POOL_MAX) {
+		*(void **)b = link_buffer_pool.free[c];
+		link_buffer_pool.free[c] = b;
+		link_buffer_pool.count[c]++;
+		b = 0;
+	}
+	pthread_mutex_unlock(&link_buffer_pool.mutex);
+
+	free(b);
+}
+
+static void buffer_consume(struct link *link, size_t chunk)
+{
+	link->buffer_start += chunk;
+	link->buffer_length -= chunk;
+	buffer_release(link);
+}
+
 static struct link *link_create()
 {
 	struct link *link;
@@ -301,8 +430,11 @@ static struct link *link_create()
 	link->read = link->written = 0;
 	link->fd = -1;
 
-	link->buffer_start = link->buffer;
+	link->buffer_start = 0;
 	link->buffer_length = 0;
+	link->buffer = 0;
+	link->buffer_size = 0;
+	link->buffer_next_size = LINK_BUFFER_MIN;
 
 	buffer_init(&link->output_buffer);
 	link->output_buffer_size = 0;
@@ -311,9 +443,14 @@ static struct link *link_create()
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
 
+	link->poll_set = 0;
+	link->poll_events = 0;
+	link->poll_buffered = 0;
+
 #ifdef HAS_OPENSSL
 	link->ctx = 0;
 	link->ssl = 0;
+	link->ssl_session_name = 0;
 #endif
 
 	return link;
@@ -431,6 +568,94 @@ static SSL_CTX *_create_ssl_context()
 	return ctx;
 }
 
+static void _set_ssl_keys(SSL_CTX *ctx, const char *ssl_key, const char *ssl_cert);
+
+#ifdef HAS_TLS_method
+/* Get the server context for this key and certificate, created again if their files changed. */
+static SSL_CTX *_get_ssl_server_context(const char *ssl_key, const char *ssl_cert)
+{
+	struct stat key_info, cert_info;
+	if (stat(ssl_key, &key_info) < 0 || stat(ssl_cert, &cert_info) < 0) {
+		fatal("could not find ssl key %s or certificate %s: %s", ssl_key, ssl_cert, strerror(errno));
+	}
+
+	char *name = string_format("%s\n%s", ssl_key, ssl_cert);
+
+	pthread_mutex_lock(&ssl_cache_mutex);
+	if (!ssl_server_contexts)
+		ssl_server_contexts = hash_table_create(0, 0);
+
+	struct ssl_server_context *sc = hash_table_lookup(ssl_server_contexts, name);
+	if (sc && (sc->key_mtime != key_info.st_mtime || sc->cert_mtime != cert_info.st_mtime)) {
+		debug(D_SSL, "ssl key or certificate changed, creating a new context");
+		hash_table_remove(ssl_server_contexts, name);
+		SSL_CTX_free(sc->ctx);
+		free(sc);
+		sc = 0;
+	}
+
+	if (!sc) {
+		sc = xxmalloc(sizeof(*sc));
+		sc->ctx = _create_ssl_context();
+		_set_ssl_keys(sc->ctx, ssl_key, ssl_cert);
+		SSL_CTX_set_session_cache_mode(sc->ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_set_session_id_context(sc->ctx, (const unsigned char *)"cctools", 7);
+		sc->key_mtime = key_info.st_mtime;
+		sc->cert_mtime = cert_info.st_mtime;
+		hash_table_insert(ssl_server_contexts, name, sc);
+	}
+
+	SSL_CTX_up_ref(sc->ctx);
+	pthread_mutex_unlock(&ssl_cache_mutex);
+
+	free(name);
+	return sc->ctx;
+}
+
+/* Keep the newest session given by a server, to resume it on the next connection. */
+static int _ssl_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+	struct link *link = SSL_get_app_data(ssl);
+	if (!link || !link->ssl_session_name)
+		return 0;
+
+	pthread_mutex_lock(&ssl_cache_mutex);
+	if (!ssl_sessions)
+		ssl_sessions = hash_table_create(0, 0);
+	SSL_SESSION *old = hash_table_remove(ssl_sessions, link->ssl_session_name);
+	if (old)
+		SSL_SESSION_free(old);
+	hash_table_insert(ssl_sessions, link->ssl_session_name, session);
+	pthread_mutex_unlock(&ssl_cache_mutex);
+
+	return 1;
+}
+
+static SSL_CTX *_get_ssl_client_context()
+{
+	pthread_mutex_lock(&ssl_cache_mutex);
+	if (!ssl_client_ctx) {
+		ssl_client_ctx = _create_ssl_context();
+		SSL_CTX_set_session_cache_mode(ssl_client_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ssl_client_ctx, _ssl_new_session_cb);
+	}
+	SSL_CTX_up_ref(ssl_client_ctx);
+	pthread_mutex_unlock(&ssl_cache_mutex);
+
+	return ssl_client_ctx;
+}
+
+/* Offer the session of a previous connection to the same server, if any. */
+static void _set_ssl_session(struct link *link)
+{
+	pthread_mutex_lock(&ssl_cache_mutex);
+	SSL_SESSION *session = ssl_sessions ? hash_table_lookup(ssl_sessions, link->ssl_session_name) : 0;
+	if (session)
+		SSL_set_session(link->ssl, session);
+	pthread_mutex_unlock(&ssl_cache_mutex);
+}
+#endif
+
 static void _set_ssl_keys(SSL_CTX *ctx, const char *ssl_key, const char *ssl_cert)
 {
 	debug(D_SSL, "setting certificate and key");
@@ -561,8 +786,12 @@ int link_ssl_wrap_accept(struct link *link, const char *key, const char *cert)
 			return 0;
 		}
 
+#ifdef HAS_TLS_method
+		link->ctx = _get_ssl_server_context(key, cert);
+#else
 		link->ctx = _create_ssl_context();
 		_set_ssl_keys(link->ctx, key, cert);
+#endif
 
 		link->ssl = SSL_new(link->ctx);
 		SSL_set_fd(link->ssl, link->fd);
@@ -572,6 +801,8 @@ int link_ssl_wrap_accept(struct link *link, const char *key, const char *cert)
 			debug(D_SSL, "ssl accept failed from %s port %d", link->raddr, link->rport);
 			ERR_print_errors_cb(_ssl_errors_cb, /* use warn */ (void *)1);
 			ret = 0;
+		} else if (SSL_session_reused(link->ssl)) {
+			debug(D_SSL, "resumed ssl session from %s port %d", link->raddr, link->rport);
 		}
 
 		if (!link_nonblocking(link, 1)) {
@@ -587,6 +818,11 @@ int link_ssl_wrap_accept(struct link *link, const char *key, const char *cert)
 }
 
 int link_ssl_wrap_connect(struct link *link, const char *sni_hostname)
+{
+	return link_ssl_wrap_connect_verify(link, sni_hostname, 0);
+}
+
+int link_ssl_wrap_connect_verify(struct link *link, const char *sni_hostname, const char *ca_file)
 {
 #ifdef HAS_OPENSSL
 
@@ -595,7 +831,22 @@ int link_ssl_wrap_connect(struct link *link, const char *sni_hostname)
 		return 0;
 	}
 
-	link->ctx = _create_ssl_context();
+	if (ca_file) {
+		/* A verifying context of its own, so that unverified sessions are never resumed. */
+		link->ctx = _create_ssl_context();
+		if (SSL_CTX_load_verify_locations(link->ctx, ca_file, 0) != 1) {
+			debug(D_SSL, "could not load certificate authorities from %s", ca_file);
+			ERR_print_errors_cb(_ssl_errors_cb, 0);
+			return 0;
+		}
+		SSL_CTX_set_verify(link->ctx, SSL_VERIFY_PEER, 0);
+	} else {
+#ifdef HAS_TLS_method
+		link->ctx = _get_ssl_client_context();
+#else
+		link->ctx = _create_ssl_context();
+#endif
+	}
 	link->ssl = SSL_new(link->ctx);
 	SSL_set_fd(link->ssl, link->fd);
 
@@ -605,6 +856,22 @@ int link_ssl_wrap_connect(struct link *link, const char *sni_hostname)
 		name = sni_hostname;
 	}
 
+	if (ca_file) {
+		/* The certificate must name the server, either by its address or by its host name. */
+		X509_VERIFY_PARAM *param = SSL_get0_param(link->ssl);
+		if (X509_VERIFY_PARAM_set1_ip_asc(param, name) != 1) {
+			X509_VERIFY_PARAM_set1_host(param, name, 0);
+		}
+	}
+
+#ifdef HAS_TLS_method
+	if (!ca_file) {
+		link->ssl_session_name = string_format("%s:%d:%s", link->raddr, link->rport, name);
+		SSL_set_app_data(link->ssl, link);
+		_set_ssl_session(link);
+	}
+#endif
+
 	debug(D_SSL, "Setting SNI to: %s", name);
 	SSL_set_tlsext_host_name(link->ssl, name);
 
@@ -624,6 +891,15 @@ int link_ssl_wrap_connect(struct link *link, const char *sni_hostname)
 		}
 	}
 
+	if (ca_file && SSL_get_verify_result(link->ssl) != X509_V_OK) {
+		debug(D_SSL, "could not verify the certificate of %s port %d", link->raddr, link->rport);
+		return 0;
+	}
+
+	if (SSL_session_reused(link->ssl)) {
+		debug(D_SSL, "resumed ssl session with %s port %d", link->raddr, link->rport);
+	}
+
 	if (!link_nonblocking(link, 1)) {
 		debug(D_SSL, "Could not switch link back to non-blocking after SSL handshake: %s", strerror(errno));
 		return 0;
@@ -822,30 +1098,46 @@ ssize_t write_aux(struct link *link, const char *data, size_t count)
 	return write(link->fd, data, count);
 }
 
+static void poll_set_add_buffered(struct link_poll_set *s, struct link *link);
+
 static ssize_t fill_buffer(struct link *link, time_t stoptime)
 {
 	if (link->buffer_length > 0)
 		return link->buffer_length;
 
+	if (!link->buffer)
+		buffer_acquire(link);
+
 	while (1) {
-		ssize_t chunk = read_aux(link, link->buffer, sizeof(link->buffer));
+		ssize_t chunk = read_aux(link, link->buffer, link->buffer_size);
 		if (chunk > 0) {
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			if (link->poll_set && !link->poll_buffered) {
+				poll_set_add_buffered(link->poll_set, link);
+			}
+			/* Adapt the size of the next buffer to the traffic of the link. */
+			if ((size_t)chunk == link->buffer_size && link->buffer_size < LINK_BUFFER_MAX) {
+				link->buffer_next_size = link->buffer_size * 2;
+			} else if ((size_t)chunk < link->buffer_size / 4 && link->buffer_size > LINK_BUFFER_MIN) {
+				link->buffer_next_size = link->buffer_size / 2;
+			}
 			return chunk;
 		} else if (chunk == 0) {
-			link->buffer_start = link->buffer;
 			link->buffer_length = 0;
+			buffer_release(link);
 			return 0;
 		} else {
 			if (errno_is_temporary(errno)) {
 				if (link_sleep(link, stoptime, 1, 0)) {
 					continue;
 				} else {
+					buffer_release(link);
 					return -1;
 				}
 			} else {
+				buffer_release(link);
 				return -1;
 			}
 		}
@@ -862,7 +1154,7 @@ ssize_t link_read(struct link *link, char *data, size_t count, time_t stoptime)
 		return 0;
 
 	/* If this is a small read, attempt to fill the buffer */
-	if (count < sizeof(link->buffer)) {
+	if (count < link->buffer_next_size) {
 		chunk = fill_buffer(link, stoptime);
 		if (chunk <= 0)
 			return chunk;
@@ -876,8 +1168,7 @@ ssize_t link_read(struct link *link, char *data, size_t count, time_t stoptime)
 		data += chunk;
 		total += chunk;
 		count -= chunk;
-		link->buffer_start += chunk;
-		link->buffer_length -= chunk;
+		buffer_consume(link, chunk);
 	}
 
 	/* Otherwise, pull it all off the wire. */
@@ -930,8 +1221,7 @@ ssize_t link_read_avail(struct link *link, char *data, size_t count, time_t stop
 		data += chunk;
 		total += chunk;
 		count -= chunk;
-		link->buffer_start += chunk;
-		link->buffer_length -= chunk;
+		buffer_consume(link, chunk);
 	}
 
 	/* Next, read what is available off the wire */
@@ -979,6 +1269,7 @@ int link_readline(struct link *link, char *line, size_t length, time_t stoptime)
 			link->buffer_length--;
 			if (*line == '\n') {
 				*line = '\0';
+				buffer_release(link);
 				return 1;
 			} else if (*line == '\r') {
 				continue;
@@ -993,17 +1284,15 @@ int link_readline(struct link *link, char *line, size_t length, time_t stoptime)
 			break;
 	}
 
+	buffer_release(link);
 	return 0;
 }
 
-ssize_t link_write(struct link *link, const char *data, size_t count, time_t stoptime)
+static ssize_t write_unbuffered(struct link *link, const char *data, size_t count, time_t stoptime)
 {
 	ssize_t total = 0;
 	ssize_t chunk = 0;
 
-	if (!link)
-		return errno = EINVAL, -1;
-
 	while (count > 0) {
 		chunk = write_aux(link, data, count);
 		if (chunk < 0) {
@@ -1037,16 +1326,14 @@ ssize_t link_write(struct link *link, const char *data, size_t count, time_t sto
 	}
 }
 
-ssize_t link_putlstring(struct link *link, const char *data, size_t count, time_t stoptime)
+/* Loop because, unlike link_write, we do not allow partial writes. */
+
+static ssize_t putlstring_unbuffered(struct link *link, const char *data, size_t count, time_t stoptime)
 {
 	ssize_t total = 0;
 
-	if (!link)
-		return errno = EINVAL, -1;
-
-	/* Loop because, unlike link_write, we do not allow partial writes. */
 	while (count > 0) {
-		ssize_t w = link_write(link, data, count, stoptime);
+		ssize_t w = write_unbuffered(link, data, count, stoptime);
 		if (w == -1)
 			return -1;
 		count -= w;
@@ -1057,6 +1344,154 @@ ssize_t link_putlstring(struct link *link, const char *data, size_t count, time_
 	return total;
 }
 
+/*
+If output buffering is enabled, data that fits is appended to the output
+buffer. Otherwise any pending output is flushed first, so that the data
+written directly is still delivered in order.
+*/
+
+ssize_t link_write(struct link *link, const char *data, size_t count, time_t stoptime)
+{
+	if (!link)
+		return errno = EINVAL, -1;
+
+	if (buffer_pos(&link->output_buffer) + count <= link->output_buffer_size) {
+		if (buffer_putlstring(&link->output_buffer, data, count) < 0)
+			return -1;
+		return count;
+	}
+
+	if (link_flush_output(link) < 0)
+		return -1;
+
+	return write_unbuffered(link, data, count, stoptime);
+}
+
+ssize_t link_putlstring(struct link *link, const char *data, size_t count, time_t stoptime)
+{
+	struct iovec iov;
+	iov.iov_base = (void *)data;
+	iov.iov_len = count;
+	return link_writev(link, &iov, 1, stoptime);
+}
+
+/*
+Write all the segments, without allowing partial writes. Segments that fit
+in the output buffer are appended to it. Otherwise, any pending output and
+the segments go out together with writev, so that a buffered header and
+its payload take a single system call without copying the payload. Over
+ssl, small messages are combined in the output buffer to form one record.
+*/
+
+ssize_t link_writev(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime)
+{
+	struct iovec v[LINK_IOV_MAX];
+	size_t total = 0;
+	int i, n = 0;
+
+	if (!link || iovcnt < 0)
+		return errno = EINVAL, -1;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	size_t pending = buffer_pos(&link->output_buffer);
+	int combine = pending + total <= link->output_buffer_size;
+#ifdef HAS_OPENSSL
+	if (link->ssl && pending + total <= LINK_BUFFER_MAX)
+		combine = 1;
+#endif
+
+	if (combine) {
+		for (i = 0; i < iovcnt; i++) {
+			if (buffer_putlstring(&link->output_buffer, iov[i].iov_base, iov[i].iov_len) < 0)
+				return -1;
+		}
+		if (buffer_pos(&link->output_buffer) > link->output_buffer_size && link_flush_output(link) < 0)
+			return -1;
+		return total;
+	}
+
+	if (link_using_ssl(link) || iovcnt >= LINK_IOV_MAX) {
+		if (link_flush_output(link) < 0)
+			return -1;
+		for (i = 0; i < iovcnt; i++) {
+			if (putlstring_unbuffered(link, iov[i].iov_base, iov[i].iov_len, stoptime) < 0)
+				return -1;
+		}
+		return total;
+	}
+
+	if (pending > 0) {
+		v[n].iov_base = (void *)buffer_tostring(&link->output_buffer);
+		v[n].iov_len = pending;
+		n++;
+	}
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > 0)
+			v[n++] = iov[i];
+	}
+
+	struct iovec *cur = v;
+	ssize_t result = total;
+
+	while (n > 0) {
+		ssize_t chunk = writev(link->fd, cur, n);
+		if (chunk < 0) {
+			if (errno_is_temporary(errno) && link_sleep(link, stoptime, 0, 1)) {
+				continue;
+			}
+			result = -1;
+			break;
+		} else if (chunk == 0) {
+			result = -1;
+			break;
+		}
+
+		link->written += chunk;
+		while (n > 0 && (size_t)chunk >= cur->iov_len) {
+			chunk -= cur->iov_len;
+			cur++;
+			n--;
+		}
+		if (n > 0) {
+			cur->iov_base = (char *)cur->iov_base + chunk;
+			cur->iov_len -= chunk;
+		}
+	}
+
+	if (pending > 0) {
+		buffer_free(&link->output_buffer);
+		buffer_init(&link->output_buffer);
+	}
+
+	return result;
+}
+
+/* Fill all the segments in order, stopping early only at the end of the stream or on error. */
+
+ssize_t link_readv(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime)
+{
+	ssize_t total = 0;
+	int i;
+
+	if (!link || iovcnt < 0)
+		return errno = EINVAL, -1;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len == 0)
+			continue;
+		ssize_t chunk = link_read(link, iov[i].iov_base, iov[i].iov_len, stoptime);
+		if (chunk < 0)
+			return total > 0 ? total : chunk;
+		total += chunk;
+		if ((size_t)chunk < iov[i].iov_len)
+			break;
+	}
+
+	return total;
+}
+
 int link_buffer_output(struct link *link, size_t size)
 {
 	link->output_buffer_size = size;
@@ -1074,7 +1509,7 @@ int link_flush_output(struct link *link)
 
 	size_t len;
 	const char *str = buffer_tolstring(&link->output_buffer, &len);
-	int rc = link_putlstring(link, str, len, time(0) + 60);
+	int rc = putlstring_unbuffered(link, str, len, time(0) + 60);
 	buffer_free(&link->output_buffer);
 	buffer_init(&link->output_buffer);
 	return rc;
@@ -1110,6 +1545,10 @@ void link_close(struct link *link)
 		link_flush_output(link);
 		buffer_free(&link->output_buffer);
 
+		if (link->poll_set) {
+			link_poll_set_remove(link->poll_set, link);
+		}
+
 #ifdef HAS_OPENSSL
 		if (link->ctx) {
 			if (link->rport) {
@@ -1125,11 +1564,14 @@ void link_close(struct link *link)
 			SSL_shutdown(link->ssl);
 			SSL_free(link->ssl);
 		}
+		free(link->ssl_session_name);
 #endif
 		if (link->fd >= 0)
 			close(link->fd);
 		if (link->rport)
 			debug(D_TCP, "disconnected from %s port %d", link->raddr, link->rport);
+		link->buffer_length = 0;
+		buffer_release(link);
 		free(link);
 	}
 }
@@ -1137,6 +1579,8 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if (link) {
+		link->buffer_length = 0;
+		buffer_release(link);
 		free(link);
 	}
 }
@@ -1236,10 +1680,98 @@ ssize_t link_stream_to_buffer(struct link *link, char **buffer, time_t stoptime)
 	return total;
 }
 
+/*
+Move up to length bytes from the socket of the link directly into fd
+through a pipe with splice, so that the data is not copied through user
+space. Returns the number of bytes written to fd, which is short if the
+link reached its end or timed out, or if fd cannot be used with splice.
+In that case, the caller continues with ordinary reads and writes.
+Returns -1 if the link or fd failed.
+*/
+
+static int64_t stream_to_fd_splice(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+#if defined(CCTOOLS_OPSYS_LINUX)
+	int64_t total = 0;
+	int fallback = 0;
+	int p[2];
+
+	if (pipe(p) < 0)
+		return 0;
+
+	while (length > 0 && !fallback) {
+		ssize_t chunk = splice(link->fd, 0, p[1], 0, MIN(length, 1 << 16), SPLICE_F_MOVE);
+		if (chunk > 0) {
+			link->read += chunk;
+			length -= chunk;
+		} else if (chunk == 0) {
+			break;
+		} else if (errno_is_temporary(errno)) {
+			if (!link_sleep(link, stoptime, 1, 0))
+				break;
+			continue;
+		} else if (errno == EINVAL || errno == ENOSYS) {
+			break;
+		} else {
+			total = -1;
+			break;
+		}
+
+		/* The pipe holds at most one chunk, so empty it before reading more. */
+		while (chunk > 0) {
+			ssize_t wchunk = splice(p[0], 0, fd, 0, chunk, SPLICE_F_MOVE);
+			if (wchunk > 0) {
+				total += wchunk;
+				chunk -= wchunk;
+			} else if (wchunk < 0 && errno == EINVAL) {
+				char buffer[1 << 16];
+				ssize_t ractual = full_read(p[0], buffer, chunk);
+				if (ractual != chunk || full_write(fd, buffer, ractual) != ractual) {
+					total = -1;
+					goto done;
+				}
+				total += ractual;
+				chunk = 0;
+				fallback = 1;
+			} else {
+				total = -1;
+				goto done;
+			}
+		}
+	}
+
+done:
+	close(p[0]);
+	close(p[1]);
+	return total;
+#else
+	return 0;
+#endif
+}
+
 int64_t link_stream_to_fd(struct link *link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
+	if (link->type == LINK_TYPE_STANDARD && !link_using_ssl(link) && length > 0) {
+		/* Data already in the buffer of the link goes first. */
+		if (link->buffer_length > 0) {
+			size_t chunk = MIN(link->buffer_length, (size_t)length);
+			if (full_write(fd, link->buffer_start, chunk) != (ssize_t)chunk)
+				return -1;
+			buffer_consume(link, chunk);
+			total += chunk;
+			length -= chunk;
+		}
+
+		int64_t spliced = stream_to_fd_splice(link, fd, length, stoptime);
+		if (spliced < 0)
+			return -1;
+
+		total += spliced;
+		length -= spliced;
+	}
+
 	while (length > 0) {
 		char buffer[1 << 16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1286,10 +1818,58 @@ int64_t link_stream_to_file(struct link *link, FILE *file, int64_t length, time_
 	return total;
 }
 
+/*
+Send up to length bytes from fd directly to the socket of the link,
+so that the data is not copied through user space. Returns the number
+of bytes sent, which is short if fd reached its end or cannot be used
+with sendfile. In that case, the caller continues with ordinary reads
+and writes from the current position of fd. Returns -1 if the link failed.
+*/
+
+static int64_t stream_from_fd_sendfile(struct link *link, int fd, int64_t length, time_t stoptime)
+{
+#if defined(CCTOOLS_OPSYS_LINUX)
+	int64_t total = 0;
+
+	while (length > 0) {
+		ssize_t chunk = sendfile(link->fd, fd, 0, MIN(length, 1 << 30));
+		if (chunk > 0) {
+			link->written += chunk;
+			total += chunk;
+			length -= chunk;
+		} else if (chunk == 0) {
+			break;
+		} else if (errno_is_temporary(errno)) {
+			if (!link_sleep(link, stoptime, 0, 1))
+				return -1;
+		} else if (errno == EINVAL || errno == ENOSYS) {
+			break;
+		} else {
+			return -1;
+		}
+	}
+
+	return total;
+#else
+	return 0;
+#endif
+}
+
 int64_t link_stream_from_fd(struct link *link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
+	if (link->type == LINK_TYPE_STANDARD && !link_using_ssl(link) && length > 0) {
+		if (link_flush_output(link) < 0)
+			return -1;
+
+		total = stream_from_fd_sendfile(link, fd, length, stoptime);
+		if (total < 0)
+			return -1;
+
+		length -= total;
+	}
+
 	while (length > 0) {
 		char buffer[1 << 16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1444,4 +2024,367 @@ int link_get_buffer_bytes(struct link *link)
 	return bytes;
 }
 
+size_t link_memory_usage(struct link *link)
+{
+	size_t bytes = sizeof(*link);
+
+	if (link->buffer)
+		bytes += link->buffer_size;
+	if (link->output_buffer.buf != link->output_buffer.initial)
+		bytes += link->output_buffer.len;
+
+	return bytes;
+}
+
+/*
+A link_poll_set keeps the links registered with the kernel (via epoll or kqueue)
+between calls, so that the cost of waiting does not grow with the number of idle links.
+Since data may already have been read into the buffer of a link, leaving nothing
+for the kernel to report, fill_buffer records such links in the buffered array,
+and link_poll_set_wait reports them as ready until their buffers are drained.
+*/
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+static int link_to_epoll(int events)
+{
+	int r = 0;
+	if (events & LINK_READ)
+		r |= EPOLLIN | EPOLLRDHUP;
+	if (events & LINK_WRITE)
+		r |= EPOLLOUT;
+	return r;
+}
+
+static int epoll_to_link(int events)
+{
+	int r = 0;
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		r |= LINK_READ;
+	if (events & EPOLLOUT)
+		r |= LINK_WRITE;
+	return r;
+}
+#endif
+
+static void poll_set_add_buffered(struct link_poll_set *s, struct link *link)
+{
+	if (s->buffered_count >= s->buffered_size) {
+		int size = MAX(16, s->buffered_size * 2);
+		struct link **b = realloc(s->buffered, sizeof(*b) * size);
+		if (!b) {
+			/* Without room to remember it, the data will be noticed once more arrives. */
+			return;
+		}
+		s->buffered = b;
+		s->buffered_size = size;
+	}
+
+	s->buffered[s->buffered_count++] = link;
+	link->poll_buffered = 1;
+}
+
+static void poll_set_remove_buffered(struct link_poll_set *s, struct link *link)
+{
+	int i;
+	for (i = 0; i < s->buffered_count; i++) {
+		if (s->buffered[i] == link) {
+			s->buffered[i] = s->buffered[--s->buffered_count];
+			break;
+		}
+	}
+	link->poll_buffered = 0;
+}
+
+/* Ensure that the scratch space for kernel events can hold n entries. */
+
+static int poll_set_reserve_events(struct link_poll_set *s, int n)
+{
+	if (n <= s->events_size)
+		return 1;
+
+	int size = MAX(n, s->events_size * 2);
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+	size_t event_size = s->fd >= 0 ? sizeof(struct epoll_event) : sizeof(struct pollfd);
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+	size_t event_size = s->fd >= 0 ? sizeof(struct kevent) : sizeof(struct pollfd);
+#else
+	size_t event_size = sizeof(struct pollfd);
+#endif
+
+	void *events = realloc(s->events, event_size * size);
+	if (!events)
+		return 0;
+	s->events = events;
+
+	if (s->fd < 0) {
+		struct link **polled = realloc(s->polled, sizeof(*polled) * size);
+		if (!polled)
+			return 0;
+		s->polled = polled;
+	}
+
+	s->events_size = size;
+	return 1;
+}
+
+struct link_poll_set *link_poll_set_create()
+{
+	struct link_poll_set *s = calloc(1, sizeof(*s));
+	if (!s)
+		return 0;
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+	s->fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+	s->fd = kqueue();
+	if (s->fd >= 0)
+		fcntl(s->fd, F_SETFD, FD_CLOEXEC);
+#else
+	s->fd = -1;
+#endif
+
+	if (s->fd < 0) {
+		debug(D_TCP, "using poll for link poll set");
+	}
+
+	s->links = set_create(0);
+
+	return s;
+}
+
+void link_poll_set_delete(struct link_poll_set *s)
+{
+	if (!s)
+		return;
+
+	struct link *link;
+	SET_ITERATE(s->links, link)
+	{
+		link->poll_set = 0;
+		link->poll_events = 0;
+		link->poll_buffered = 0;
+	}
+
+	if (s->fd >= 0)
+		close(s->fd);
+
+	set_delete(s->links);
+	free(s->buffered);
+	free(s->events);
+	free(s->polled);
+	free(s);
+}
+
+int link_poll_set_add(struct link_poll_set *s, struct link *link, int events)
+{
+	if (link->poll_set) {
+		errno = EEXIST;
+		return 0;
+	}
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+	if (s->fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = link_to_epoll(events);
+		ev.data.ptr = link;
+		if (epoll_ctl(s->fd, EPOLL_CTL_ADD, link->fd, &ev) < 0) {
+			debug(D_TCP, "couldn't add fd %d to epoll set: %s", link->fd, strerror(errno));
+			return 0;
+		}
+	}
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+	if (s->fd >= 0) {
+		struct kevent ev[2];
+		int n = 0;
+		if (events & LINK_READ)
+			EV_SET(&ev[n++], link->fd, EVFILT_READ, EV_ADD, 0, 0, link);
+		if (events & LINK_WRITE)
+			EV_SET(&ev[n++], link->fd, EVFILT_WRITE, EV_ADD, 0, 0, link);
+		if (kevent(s->fd, ev, n, 0, 0, 0) < 0) {
+			debug(D_TCP, "couldn't add fd %d to kqueue: %s", link->fd, strerror(errno));
+			return 0;
+		}
+	}
+#endif
+
+	set_insert(s->links, link);
+	link->poll_set = s;
+	link->poll_events = events;
+
+	if (link->buffer_length > 0) {
+		poll_set_add_buffered(s, link);
+	}
+
+	return 1;
+}
+
+int link_poll_set_remove(struct link_poll_set *s, struct link *link)
+{
+	if (link->poll_set != s)
+		return 0;
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+	if (s->fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		epoll_ctl(s->fd, EPOLL_CTL_DEL, link->fd, &ev);
+	}
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+	if (s->fd >= 0) {
+		struct kevent ev[2];
+		int n = 0;
+		if (link->poll_events & LINK_READ)
+			EV_SET(&ev[n++], link->fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+		if (link->poll_events & LINK_WRITE)
+			EV_SET(&ev[n++], link->fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
+		kevent(s->fd, ev, n, 0, 0, 0);
+	}
+#endif
+
+	if (link->poll_buffered) {
+		poll_set_remove_buffered(s, link);
+	}
+
+	set_remove(s->links, link);
+	link->poll_set = 0;
+	link->poll_events = 0;
+
+	return 1;
+}
+
+int link_poll_set_size(struct link_poll_set *s)
+{
+	return set_size(s->links);
+}
+
+/*
+Add an active link to the n results already in array, merging with a previous entry
+for the same link if found among the first nsearch results. Returns the new number of results.
+*/
+
+static int poll_set_report(struct link_info *array, int n, int nsearch, struct link *link, int revents)
+{
+	int i;
+	for (i = 0; i < nsearch; i++) {
+		if (array[i].link == link) {
+			array[i].revents |= revents;
+			return n;
+		}
+	}
+
+	array[n].link = link;
+	array[n].events = link->poll_events;
+	array[n].revents = revents;
+	return n + 1;
+}
+
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *array, int nlinks, int msec)
+{
+	int i, r;
+	int n = 0;
+
+	/* Report links with buffered data first, and forget the ones that have been drained. */
+	for (i = 0; i < s->buffered_count;) {
+		struct link *link = s->buffered[i];
+		if (link->buffer_length > 0) {
+			if (n < nlinks) {
+				array[n].link = link;
+				array[n].events = link->poll_events;
+				array[n].revents = LINK_READ;
+				n++;
+			}
+			i++;
+		} else {
+			link->poll_buffered = 0;
+			s->buffered[i] = s->buffered[--s->buffered_count];
+		}
+	}
+
+	int nbuffered = n;
+	int max = nlinks - n;
+	if (max < 1)
+		return n;
+
+	// If there's data already waiting, don't sit in the poll
+	if (n > 0)
+		msec = 0;
+
+	if (s->fd < 0) {
+		if (!poll_set_reserve_events(s, set_size(s->links)))
+			return n > 0 ? n : -1;
+
+		struct pollfd *fds = s->events;
+		struct link *link;
+		int nfds = 0;
+		SET_ITERATE(s->links, link)
+		{
+			fds[nfds].fd = link->fd;
+			fds[nfds].events = link_to_poll(link->poll_events);
+			fds[nfds].revents = 0;
+			s->polled[nfds] = link;
+			nfds++;
+		}
+
+		r = poll(fds, nfds, msec);
+		if (r < 0)
+			return n > 0 ? n : (errno == EINTR ? 0 : -1);
+
+		for (i = 0; i < nfds && n < nlinks; i++) {
+			int revents = poll_to_link(fds[i].revents);
+			if (fds[i].revents & POLLERR)
+				revents |= LINK_READ;
+			if (revents) {
+				struct link *link = s->polled[i];
+				n = poll_set_report(array, n, link->poll_buffered ? nbuffered : 0, link, revents);
+			}
+		}
+
+		return n;
+	}
+
+	if (!poll_set_reserve_events(s, max))
+		return n > 0 ? n : -1;
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+	struct epoll_event *events = s->events;
+	r = epoll_wait(s->fd, events, max, msec);
+	if (r < 0)
+		return n > 0 ? n : (errno == EINTR ? 0 : -1);
+
+	for (i = 0; i < r; i++) {
+		struct link *link = events[i].data.ptr;
+		n = poll_set_report(array, n, link->poll_buffered ? nbuffered : 0, link, epoll_to_link(events[i].events));
+	}
+#elif defined(CCTOOLS_OPSYS_DARWIN) || defined(CCTOOLS_OPSYS_FREEBSD)
+	struct kevent *events = s->events;
+	struct timespec ts;
+	struct timespec *timeout = 0;
+	if (msec >= 0) {
+		ts.tv_sec = msec / 1000;
+		ts.tv_nsec = (msec % 1000) * 1000000;
+		timeout = &ts;
+	}
+
+	r = kevent(s->fd, 0, 0, events, max, timeout);
+	if (r < 0)
+		return n > 0 ? n : (errno == EINTR ? 0 : -1);
+
+	for (i = 0; i < r && n < nlinks; i++) {
+		struct link *link = events[i].udata;
+		int revents = events[i].filter == EVFILT_WRITE ? LINK_WRITE : LINK_READ;
+		if (events[i].flags & (EV_EOF | EV_ERROR))
+			revents |= LINK_READ;
+		/* A link waiting to both read and write may appear twice. */
+		int nsearch = link->poll_buffered ? nbuffered : 0;
+		if ((link->poll_events & LINK_READ) && (link->poll_events & LINK_WRITE))
+			nsearch = n;
+		n = poll_set_report(array, n, nsearch, link, revents);
+	}
+#endif
+
+	return n;
+}
+
 /* vim: set noexpandtab tabstop=8: */
@@ -42,6 +42,7 @@ link_close(link);
 */
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <limits.h>
 #include <signal.h>
@@ -75,6 +76,17 @@ struct link *link_connect(const char *addr, int port, time_t stoptime);
 */
 int link_ssl_wrap_connect(struct link *link, const char *sni_hostname);
 
+/** Wrap a connect link with an ssl context that verifies the server.
+The server must present a certificate signed by one of the authorities
+in ca_file and issued for sni_hostname, or for the address of the link
+if sni_hostname is null.  The connection fails otherwise.
+@param link A link returned from @ref link_connect
+@param sni_hostname Optional domainame for tls routing and verification.
+@param ca_file File of trusted certificate authorities in PEM format, or null for no verification.
+@return 0 on failure, 1 on success
+*/
+int link_ssl_wrap_connect_verify(struct link *link, const char *sni_hostname, const char *ca_file);
+
 /** Turn a FILE* into a link.  Useful when trying to poll both remote and local connections using @ref link_poll
 @param file File to create the link from.
 @return On success, returns a pointer to a link object.  On failure, returns a null pointer with errno set appropriately.
@@ -189,6 +201,28 @@ ssize_t link_write(struct link *link, const char *data, size_t length, time_t st
 */
 ssize_t link_putlstring(struct link *link, const char *str, size_t len, time_t stoptime);
 
+/** Write several segments of data to a connection, without copying them.
+All data is written until finished or an error is encountered.
+Any output held by @ref link_buffer_output is sent first, in the same system call.
+@param link The link to write.
+@param iov The segments to write, in order.
+@param iovcnt The number of segments.
+@param stoptime The time at which to abort.
+@return The number of bytes written from the segments, or less than zero on error.
+*/
+ssize_t link_writev(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime);
+
+/** Read data from a connection into several segments.
+This call will block until all the segments have been filled,
+or the connection is dropped.
+@param link The link from which to read.
+@param iov The segments to fill, in order.
+@param iovcnt The number of segments.
+@param stoptime The time at which to abort.
+@return The number of bytes actually read, or zero if the connection is closed, or less than zero on error.
+*/
+ssize_t link_readv(struct link *link, const struct iovec *iov, int iovcnt, time_t stoptime);
+
 /* Write a C string to a connection. All data is written until finished or an
    error is encountered. It is defined as a macro.
 @param link The link to write.
@@ -300,9 +334,12 @@ int link_readline(struct link *link, char *line, size_t length, time_t stoptime)
 */
 int link_fd(struct link *link);
 
-/** Enable output buffering for link_printf.
+/** Enable output buffering for link_printf, link_write, and link_putlstring.
+Output is held until the buffer would exceed the given size, or @ref link_flush_output is called.
+Pending output is not flushed by reading from the link, so it must be flushed before waiting for a reply.
 @param link The link to modify.
 @param size The number of bytes to buffer.  Zero disables buffering and flushes pending output.
+@return Zero if nothing was flushed, the number of bytes flushed, or less than zero on failure.
 */
 int link_buffer_output(struct link *link, size_t size );
 
@@ -328,6 +365,13 @@ int link_nonblocking(struct link *link, int onoff);
 */
 int link_buffer_empty(struct link *link);
 
+/** Return the number of bytes consumed from a link so far.
+Data read into the buffer of the link but not yet returned to the caller is not counted.
+@param link The link to examine.
+@return The number of bytes delivered by reads on the link.
+*/
+uint64_t link_bytes_read(struct link *link);
+
 /** Return the local address of the link in text format.
 @param link The link to examine.
 @param addr Pointer to a string of at least @ref LINK_ADDRESS_MAX bytes, which will be filled with a text representation of the local IP address.
@@ -391,12 +435,72 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** Create a persistent set of links to be polled together.
+Unlike @ref link_poll, which examines every link given on each call,
+links are registered once with @ref link_poll_set_add and remain in the set until removed,
+so the cost of @ref link_poll_set_wait depends on the number of active links, not on the size of the set.
+On Linux the set is backed by epoll, on Darwin and FreeBSD by kqueue, and elsewhere by ordinary poll.
+@return A pointer to a new poll set, or null on failure.
+*/
+
+struct link_poll_set *link_poll_set_create();
+
+/** Delete a poll set.
+The links in the set are not closed.
+@param s The poll set to delete.
+*/
+
+void link_poll_set_delete(struct link_poll_set *s);
+
+/** Add a link to a poll set.
+A link may belong to only one poll set at a time.
+A link that is closed with @ref link_close is automatically removed from its poll set.
+@param s The poll set.
+@param link The link to add.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE)
+@return True on success, false on failure.
+*/
+
+int link_poll_set_add(struct link_poll_set *s, struct link *link, int events);
+
+/** Remove a link from a poll set.
+@param s The poll set.
+@param link The link to remove.
+@return True if the link was in the set, false otherwise.
+*/
+
+int link_poll_set_remove(struct link_poll_set *s, struct link *link);
+
+/** Count the links in a poll set.
+@param s The poll set.
+@return The number of links in the set.
+*/
+
+int link_poll_set_size(struct link_poll_set *s);
+
+/** Wait for activity on the links of a poll set.
+Links that already have data buffered by a previous read are always reported as readable.
+@param s The poll set.
+@param array Pointer to an array of @ref link_info structures, which will be filled in with the link and revents of each active link.
+@param nlinks The length of the array.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of entries filled in the array, or -1 on failure.
+*/
+
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *array, int nlinks, int msec);
+
 /** Get the number of bytes in the output buffer of a link.
 @param link The link to examine.
 @return The number of bytes in the output buffer of a link.
 */
 int link_get_buffer_bytes(struct link *link);
 
+/** Get the memory held by a link, including its input and output buffers.
+@param link The link to examine.
+@return The number of bytes of memory allocated for the link.
+*/
+size_t link_memory_usage(struct link *link);
+
 
 int errno_is_temporary(int e);
 
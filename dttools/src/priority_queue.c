@@ -0,0 +1,176 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "priority_queue.h"
+#include "debug.h"
+
+#include <stdlib.h>
+
+#define DEFAULT_CAPACITY 127
+
+struct element {
+	void *data;
+	double priority;
+};
+
+struct priority_queue {
+	int size;
+	int capacity;
+	struct element *elements;
+};
+
+static void swap_elements(struct priority_queue *pq, int i, int j)
+{
+	struct element temp = pq->elements[i];
+	pq->elements[i] = pq->elements[j];
+	pq->elements[j] = temp;
+}
+
+static void sift_up(struct priority_queue *pq, int index)
+{
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+		if (pq->elements[parent].priority >= pq->elements[index].priority)
+			break;
+		swap_elements(pq, parent, index);
+		index = parent;
+	}
+}
+
+static void sift_down(struct priority_queue *pq, int index)
+{
+	while (1) {
+		int largest = index;
+		int left = 2 * index + 1;
+		int right = 2 * index + 2;
+
+		if (left < pq->size && pq->elements[left].priority > pq->elements[largest].priority)
+			largest = left;
+		if (right < pq->size && pq->elements[right].priority > pq->elements[largest].priority)
+			largest = right;
+		if (largest == index)
+			break;
+
+		swap_elements(pq, index, largest);
+		index = largest;
+	}
+}
+
+/* Remove the element at position index, and restore the heap property. */
+
+static void *remove_at(struct priority_queue *pq, int index)
+{
+	void *data = pq->elements[index].data;
+
+	pq->size--;
+	if (index < pq->size) {
+		pq->elements[index] = pq->elements[pq->size];
+		sift_down(pq, index);
+		sift_up(pq, index);
+	}
+
+	return data;
+}
+
+struct priority_queue *priority_queue_create(int initial_capacity)
+{
+	struct priority_queue *pq = malloc(sizeof(*pq));
+	if (!pq)
+		return 0;
+
+	if (initial_capacity < 1)
+		initial_capacity = DEFAULT_CAPACITY;
+
+	pq->elements = malloc(sizeof(struct element) * initial_capacity);
+	if (!pq->elements) {
+		free(pq);
+		return 0;
+	}
+
+	pq->size = 0;
+	pq->capacity = initial_capacity;
+
+	return pq;
+}
+
+void priority_queue_delete(struct priority_queue *pq)
+{
+	if (!pq)
+		return;
+	free(pq->elements);
+	free(pq);
+}
+
+int priority_queue_size(struct priority_queue *pq)
+{
+	return pq->size;
+}
+
+int priority_queue_push(struct priority_queue *pq, void *data, double priority)
+{
+	if (!data)
+		return 0;
+
+	if (pq->size >= pq->capacity) {
+		int new_capacity = pq->capacity * 2;
+		struct element *new_elements = realloc(pq->elements, sizeof(struct element) * new_capacity);
+		if (!new_elements) {
+			debug(D_NOTICE, "priority_queue: unable to grow queue to %d elements", new_capacity);
+			return 0;
+		}
+		pq->elements = new_elements;
+		pq->capacity = new_capacity;
+	}
+
+	pq->elements[pq->size].data = data;
+	pq->elements[pq->size].priority = priority;
+	sift_up(pq, pq->size);
+	pq->size++;
+
+	return 1;
+}
+
+void *priority_queue_pop(struct priority_queue *pq)
+{
+	if (pq->size < 1)
+		return 0;
+	return remove_at(pq, 0);
+}
+
+void *priority_queue_peek_top(struct priority_queue *pq)
+{
+	if (pq->size < 1)
+		return 0;
+	return pq->elements[0].data;
+}
+
+double priority_queue_get_top_priority(struct priority_queue *pq)
+{
+	if (pq->size < 1)
+		return 0;
+	return pq->elements[0].priority;
+}
+
+void *priority_queue_peek_at(struct priority_queue *pq, int index)
+{
+	if (index < 0 || index >= pq->size)
+		return 0;
+	return pq->elements[index].data;
+}
+
+int priority_queue_remove(struct priority_queue *pq, void *data)
+{
+	int i;
+	for (i = 0; i < pq->size; i++) {
+		if (pq->elements[i].data == data) {
+			remove_at(pq, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,114 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PRIORITY_QUEUE_H
+#define PRIORITY_QUEUE_H
+
+/** @file priority_queue.h A priority queue of arbitrary objects.
+Objects are kept in a binary heap ordered by a floating point priority,
+so that the object with the highest priority can be found in constant time,
+and added or removed in logarithmic time.  For example, to schedule
+timers that expire at different times, use the negated expiration time as the priority:
+<pre>
+struct priority_queue *pq;
+pq = priority_queue_create(0);
+
+priority_queue_push(pq,timer_a,-expire_a);
+priority_queue_push(pq,timer_b,-expire_b);
+
+while(priority_queue_size(pq)>0 && -priority_queue_get_top_priority(pq)<=now) {
+	timer = priority_queue_pop(pq);
+	...
+}
+</pre>
+
+To visit all of the objects in a priority queue (in no particular order),
+use @ref PRIORITY_QUEUE_ITERATE like this:
+
+<pre>
+int index;
+void *data;
+
+PRIORITY_QUEUE_ITERATE(pq,index,data) {
+	printf("queue contains: %p\n",data);
+}
+</pre>
+
+The queue must not be modified while it is being iterated.
+*/
+
+#define PRIORITY_QUEUE_ITERATE( pq, index, data ) for(index=0; (data = priority_queue_peek_at(pq,index)); index++)
+
+/** Create a new priority queue.
+@param initial_capacity The number of objects the queue may hold before growing. If zero, a default value will be used.
+@return A pointer to a new priority queue.
+*/
+
+struct priority_queue *priority_queue_create(int initial_capacity);
+
+/** Delete a priority queue.
+Note that this function will not delete the objects contained within the queue.
+@param pq The priority queue to delete.
+*/
+
+void priority_queue_delete(struct priority_queue *pq);
+
+/** Count the objects in a priority queue.
+@param pq A pointer to a priority queue.
+@return The number of objects in the queue.
+*/
+
+int priority_queue_size(struct priority_queue *pq);
+
+/** Add an object to a priority queue.
+@param pq A pointer to a priority queue.
+@param data The object to add, which must not be null.
+@param priority The priority of the object. Objects with higher priority are popped first.
+@return One on success, zero on failure.
+*/
+
+int priority_queue_push(struct priority_queue *pq, void *data, double priority);
+
+/** Remove the object with the highest priority.
+@param pq A pointer to a priority queue.
+@return The object with the highest priority, or null if the queue is empty.
+*/
+
+void *priority_queue_pop(struct priority_queue *pq);
+
+/** Find the object with the highest priority without removing it.
+@param pq A pointer to a priority queue.
+@return The object with the highest priority, or null if the queue is empty.
+*/
+
+void *priority_queue_peek_top(struct priority_queue *pq);
+
+/** Get the priority of the object at the top of the queue.
+@param pq A pointer to a priority queue.
+@return The highest priority in the queue, or zero if the queue is empty.
+*/
+
+double priority_queue_get_top_priority(struct priority_queue *pq);
+
+/** Get the object stored at a given position of the underlying heap.
+This is intended for iterating over all the objects with @ref PRIORITY_QUEUE_ITERATE.
+@param pq A pointer to a priority queue.
+@param index The position in the heap, starting at zero.
+@return The object at that position, or null if index is out of range.
+*/
+
+void *priority_queue_peek_at(struct priority_queue *pq, int index);
+
+/** Remove a given object from the queue, regardless of its priority.
+This requires a linear search for the object.
+@param pq A pointer to a priority queue.
+@param data The object to remove.
+@return One if the object was found and removed, zero otherwise.
+*/
+
+int priority_queue_remove(struct priority_queue *pq, void *data);
+
+#endif
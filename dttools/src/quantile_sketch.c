@@ -0,0 +1,209 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "quantile_sketch.h"
+
+#include "debug.h"
+#include "xxmalloc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Bucket k counts the values in (gamma^(k-1), gamma^k], where
+gamma = (1+e)/(1-e) for a relative error e.  Any value in the bucket is
+within e of 2*gamma^k/(gamma+1), which is the value reported for it.
+The buckets in use are kept in a dense array that starts at bucket
+first, since the values in a stream are usually within a few orders of
+magnitude of each other.
+*/
+
+struct quantile_sketch {
+	double relative_error;
+	double gamma;
+	double log_gamma;
+	int max_buckets;
+
+	int64_t first;
+	int nbuckets;
+	int alloc;
+	uint64_t *counts;
+
+	uint64_t zero_count;
+	uint64_t total_count;
+};
+
+struct quantile_sketch *quantile_sketch_create(double relative_error, int max_buckets)
+{
+	if(relative_error <= 0 || relative_error >= 1) {
+		fatal("Relative error of a quantile sketch should be between 0 and 1: %lf", relative_error);
+	}
+
+	struct quantile_sketch *s = xxcalloc(1, sizeof(*s));
+
+	s->relative_error = relative_error;
+	s->gamma = (1 + relative_error) / (1 - relative_error);
+	s->log_gamma = log(s->gamma);
+	s->max_buckets = max_buckets > 0 ? max_buckets : QUANTILE_SKETCH_MAX_BUCKETS;
+
+	return s;
+}
+
+void quantile_sketch_delete(struct quantile_sketch *s)
+{
+	if(!s)
+		return;
+
+	free(s->counts);
+	free(s);
+}
+
+void quantile_sketch_clear(struct quantile_sketch *s)
+{
+	s->nbuckets = 0;
+	s->zero_count = 0;
+	s->total_count = 0;
+}
+
+static void grow(struct quantile_sketch *s, int nbuckets)
+{
+	if(nbuckets <= s->alloc)
+		return;
+
+	int alloc = s->alloc > 0 ? s->alloc : 16;
+	while(alloc < nbuckets)
+		alloc *= 2;
+
+	s->counts = xxrealloc(s->counts, alloc * sizeof(*s->counts));
+	s->alloc = alloc;
+}
+
+/* Add count to bucket k, extending the range of buckets, and merging the lowest ones if it grows too large. */
+static void add_to_bucket(struct quantile_sketch *s, int64_t k, uint64_t count)
+{
+	if(s->nbuckets == 0) {
+		grow(s, 1);
+		s->first = k;
+		s->nbuckets = 1;
+		s->counts[0] = count;
+		return;
+	}
+
+	int64_t last = s->first + s->nbuckets - 1;
+
+	if(k < s->first) {
+		int64_t wanted = last - k + 1;
+		if(wanted > s->max_buckets) {
+			/* Values below the lowest bucket that can be kept go into it. */
+			wanted = s->max_buckets;
+		}
+
+		int shift = wanted - s->nbuckets;
+		if(shift > 0) {
+			grow(s, wanted);
+			memmove(s->counts + shift, s->counts, s->nbuckets * sizeof(*s->counts));
+			memset(s->counts, 0, shift * sizeof(*s->counts));
+			s->first -= shift;
+			s->nbuckets = wanted;
+		}
+
+		if(k < s->first)
+			k = s->first;
+	} else if(k > last) {
+		int64_t wanted = k - s->first + 1;
+		if(wanted > s->max_buckets) {
+			/* Merge the lowest buckets so that bucket k fits. */
+			int64_t shift = wanted - s->max_buckets;
+			if(shift >= s->nbuckets) {
+				uint64_t merged = 0;
+				int i;
+				for(i = 0; i < s->nbuckets; i++)
+					merged += s->counts[i];
+				s->counts[0] = merged;
+				s->first = k - s->max_buckets + 1;
+				s->nbuckets = 1;
+			} else {
+				int i;
+				for(i = 0; i < shift; i++)
+					s->counts[shift] += s->counts[i];
+				memmove(s->counts, s->counts + shift, (s->nbuckets - shift) * sizeof(*s->counts));
+				s->first += shift;
+				s->nbuckets -= shift;
+			}
+			wanted = k - s->first + 1;
+		}
+
+		grow(s, wanted);
+		memset(s->counts + s->nbuckets, 0, (wanted - s->nbuckets) * sizeof(*s->counts));
+		s->nbuckets = wanted;
+	}
+
+	s->counts[k - s->first] += count;
+}
+
+void quantile_sketch_insert(struct quantile_sketch *s, double value)
+{
+	s->total_count++;
+
+	if(!(value > 0)) {
+		s->zero_count++;
+		return;
+	}
+
+	add_to_bucket(s, (int64_t) ceil(log(value) / s->log_gamma), 1);
+}
+
+int quantile_sketch_merge(struct quantile_sketch *s, const struct quantile_sketch *other)
+{
+	if(s->relative_error != other->relative_error)
+		return 0;
+
+	int i;
+	for(i = 0; i < other->nbuckets; i++) {
+		if(other->counts[i] > 0)
+			add_to_bucket(s, other->first + i, other->counts[i]);
+	}
+
+	s->zero_count += other->zero_count;
+	s->total_count += other->total_count;
+
+	return 1;
+}
+
+uint64_t quantile_sketch_count(const struct quantile_sketch *s)
+{
+	return s->total_count;
+}
+
+double quantile_sketch_quantile(const struct quantile_sketch *s, double q)
+{
+	if(s->total_count == 0)
+		return 0;
+
+	if(q < 0)
+		q = 0;
+	if(q > 1)
+		q = 1;
+
+	uint64_t rank = (uint64_t) (q * (s->total_count - 1));
+
+	if(rank < s->zero_count)
+		return 0;
+
+	uint64_t seen = s->zero_count;
+	int i;
+	for(i = 0; i < s->nbuckets; i++) {
+		seen += s->counts[i];
+		if(seen > rank)
+			break;
+	}
+
+	if(i == s->nbuckets)
+		i = s->nbuckets - 1;
+
+	return 2 * pow(s->gamma, s->first + i) / (s->gamma + 1);
+}
@@ -0,0 +1,82 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <stdint.h>
+
+/** @file quantile_sketch.h Estimate quantiles of a stream of positive numbers in bounded space.
+
+Values are counted in buckets whose bounds grow geometrically, so that
+any quantile is returned within a given relative error of a value that
+was inserted, no matter how skewed the values are.  Values that are not
+positive are counted in a bucket of their own and reported as zero.
+When the number of buckets exceeds a maximum, the lowest buckets are
+merged, which keeps the upper quantiles accurate.
+
+<pre>
+struct quantile_sketch *s = quantile_sketch_create(0.01, 0);
+
+quantile_sketch_insert(s, 12.5);
+quantile_sketch_insert(s, 14.0);
+quantile_sketch_insert(s, 310.0);
+
+double median = quantile_sketch_quantile(s, 0.5);
+double p99    = quantile_sketch_quantile(s, 0.99);
+
+quantile_sketch_delete(s);
+</pre>
+*/
+
+/** Default maximum number of buckets. With a relative error of 1%, this covers values across more than forty orders of magnitude. */
+#define QUANTILE_SKETCH_MAX_BUCKETS 2048
+
+/** Create a new sketch.
+@param relative_error The relative error of the quantiles returned, greater than 0 and less than 1.
+@param max_buckets The maximum number of buckets kept, or 0 for @ref QUANTILE_SKETCH_MAX_BUCKETS.
+@return A new sketch.
+*/
+struct quantile_sketch *quantile_sketch_create(double relative_error, int max_buckets);
+
+/** Delete a sketch.
+@param s The sketch to delete.
+*/
+void quantile_sketch_delete(struct quantile_sketch *s);
+
+/** Remove all values from a sketch.
+@param s The sketch to clear.
+*/
+void quantile_sketch_clear(struct quantile_sketch *s);
+
+/** Add a value to a sketch.
+@param s The sketch.
+@param value The value to add.
+*/
+void quantile_sketch_insert(struct quantile_sketch *s, double value);
+
+/** Add all the values of one sketch to another.
+Both sketches must have been created with the same relative error.
+@param s The sketch to add to.
+@param other The sketch to add from.
+@return 1 on success, 0 if the sketches have different relative errors.
+*/
+int quantile_sketch_merge(struct quantile_sketch *s, const struct quantile_sketch *other);
+
+/** Return the number of values added to a sketch.
+@param s The sketch.
+@return The number of values.
+*/
+uint64_t quantile_sketch_count(const struct quantile_sketch *s);
+
+/** Estimate a quantile of the values added to a sketch.
+@param s The sketch.
+@param q The quantile, from 0 to 1. For example, 0.95 for the 95th percentile.
+@return The estimated quantile, or 0 if the sketch is empty.
+*/
+double quantile_sketch_quantile(const struct quantile_sketch *s, double q);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "quantile_sketch.h"
+#include "test_fail.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ERROR 0.01
+#define VALUES 100000
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static int close_to(double estimate, double exact)
+{
+	return fabs(estimate - exact) <= ERROR * exact * 1.0001;
+}
+
+int main(int argc, char **argv)
+{
+	struct quantile_sketch *s = quantile_sketch_create(ERROR, 0);
+	struct quantile_sketch *a = quantile_sketch_create(ERROR, 0);
+	struct quantile_sketch *b = quantile_sketch_create(ERROR, 0);
+
+	if(quantile_sketch_quantile(s, 0.5) != 0)
+		FAIL("empty sketch has a median");
+
+	/* A heavy tailed stream: most values near 60, a few stragglers far above. */
+	double *values = malloc(VALUES * sizeof(double));
+	srand(17);
+	int i;
+	for(i = 0; i < VALUES; i++) {
+		double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+		values[i] = 60.0 * pow(u, -0.5);
+		quantile_sketch_insert(s, values[i]);
+		quantile_sketch_insert(i % 2 ? a : b, values[i]);
+	}
+
+	if(quantile_sketch_count(s) != VALUES)
+		FAIL("sketch counted %llu values instead of %d", (unsigned long long) quantile_sketch_count(s), VALUES);
+
+	if(!quantile_sketch_merge(a, b))
+		FAIL("could not merge sketches");
+
+	qsort(values, VALUES, sizeof(double), compare_doubles);
+
+	double quantiles[] = {0, 0.25, 0.5, 0.9, 0.95, 0.99, 0.999, 1};
+	int j;
+	for(j = 0; j < (int) (sizeof(quantiles) / sizeof(quantiles[0])); j++) {
+		double exact = values[(int) (quantiles[j] * (VALUES - 1))];
+		double estimate = quantile_sketch_quantile(s, quantiles[j]);
+		double merged = quantile_sketch_quantile(a, quantiles[j]);
+		if(!close_to(estimate, exact))
+			FAIL("quantile %g estimated as %g instead of %g", quantiles[j], estimate, exact);
+		if(!close_to(merged, exact))
+			FAIL("quantile %g of merged sketch estimated as %g instead of %g", quantiles[j], merged, exact);
+	}
+
+	/* With fewer buckets than the values span, the lowest are merged and the upper quantiles stay accurate. */
+	struct quantile_sketch *small = quantile_sketch_create(ERROR, 512);
+	for(i = 0; i < VALUES; i++)
+		quantile_sketch_insert(small, values[i] / 1000.0);
+	double exact = values[(int) (0.99 * (VALUES - 1))] / 1000.0;
+	if(!close_to(quantile_sketch_quantile(small, 0.99), exact))
+		FAIL("p99 of a bounded sketch estimated as %g instead of %g", quantile_sketch_quantile(small, 0.99), exact);
+	if(quantile_sketch_quantile(small, 0) > quantile_sketch_quantile(small, 0.5))
+		FAIL("bounded sketch quantiles are not ordered");
+
+	/* Values that are not positive are reported as zero. */
+	quantile_sketch_clear(small);
+	quantile_sketch_insert(small, 0);
+	quantile_sketch_insert(small, -3);
+	quantile_sketch_insert(small, 5);
+	if(quantile_sketch_quantile(small, 0.5) != 0 || !close_to(quantile_sketch_quantile(small, 1), 5))
+		FAIL("zero values counted incorrectly");
+
+	quantile_sketch_delete(small);
+	quantile_sketch_delete(s);
+	quantile_sketch_delete(a);
+	quantile_sketch_delete(b);
+	free(values);
+
+	fprintf(stdout, "quantile sketch is correct\n");
+	return 0;
+}
@@ -0,0 +1,286 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "rmonitor_cgroup.h"
+#include "debug.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(CCTOOLS_OPSYS_LINUX)
+#include <sys/inotify.h>
+#endif
+
+struct rmonitor_cgroup {
+	char *path;
+	int events_fd;
+};
+
+/* Find where the cgroup v2 hierarchy is mounted, as /sys/fs/cgroup or /sys/fs/cgroup/unified. */
+
+static char *rmonitor_cgroup_mount_point(void)
+{
+	FILE *file = fopen("/proc/self/mounts", "r");
+	if (!file)
+		return 0;
+
+	char line[4096];
+	char device[4096];
+	char dir[4096];
+	char type[4096];
+	char *result = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%4095s %4095s %4095s", device, dir, type) == 3 && !strcmp(type, "cgroup2")) {
+			result = xxstrdup(dir);
+			break;
+		}
+	}
+
+	fclose(file);
+	return result;
+}
+
+/* The cgroup v2 of this process is given by the line "0::/path" of /proc/self/cgroup. */
+
+static char *rmonitor_cgroup_self(void)
+{
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	if (!file)
+		return 0;
+
+	char line[4096];
+	char *result = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (!strncmp(line, "0::", 3)) {
+			string_chomp(line);
+			result = xxstrdup(line + 3);
+			break;
+		}
+	}
+
+	fclose(file);
+	return result;
+}
+
+static int rmonitor_cgroup_write(const char *dir, const char *name, const char *value)
+{
+	char *path = string_format("%s/%s", dir, name);
+	int fd = open(path, O_WRONLY);
+	free(path);
+
+	if (fd < 0)
+		return 0;
+
+	int result = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+	close(fd);
+
+	return result;
+}
+
+static int64_t rmonitor_cgroup_read_int(struct rmonitor_cgroup *c, const char *name)
+{
+	char *path = string_format("%s/%s", c->path, name);
+	FILE *file = fopen(path, "r");
+	free(path);
+
+	if (!file)
+		return -1;
+
+	int64_t value;
+	if (fscanf(file, "%" SCNd64, &value) != 1)
+		value = -1;
+
+	fclose(file);
+	return value;
+}
+
+struct rmonitor_cgroup *rmonitor_cgroup_create(const char *name)
+{
+	char *mount = rmonitor_cgroup_mount_point();
+	if (!mount) {
+		debug(D_RMON, "cgroup v2 is not mounted.");
+		return 0;
+	}
+
+	char *self = rmonitor_cgroup_self();
+	if (!self) {
+		debug(D_RMON, "could not find the cgroup of this process.");
+		free(mount);
+		return 0;
+	}
+
+	char *parent = string_format("%s%s", mount, strcmp(self, "/") ? self : "");
+	free(mount);
+	free(self);
+
+	/* Controllers may only be enabled for a cgroup without processes of its own, so these may fail. */
+	const char *controllers[] = {"+cpu", "+memory", "+io", "+pids"};
+	for (size_t i = 0; i < sizeof(controllers) / sizeof(*controllers); i++) {
+		if (!rmonitor_cgroup_write(parent, "cgroup.subtree_control", controllers[i]))
+			debug(D_RMON, "could not enable controller %s in %s: %s", controllers[i] + 1, parent, strerror(errno));
+	}
+
+	struct rmonitor_cgroup *c = xxmalloc(sizeof(*c));
+	c->path = string_format("%s/%s", parent, name);
+	c->events_fd = -1;
+	free(parent);
+
+	if (mkdir(c->path, 0755) != 0) {
+		debug(D_RMON, "could not create cgroup %s: %s", c->path, strerror(errno));
+		free(c->path);
+		free(c);
+		return 0;
+	}
+
+	debug(D_RMON, "created cgroup %s", c->path);
+
+	return c;
+}
+
+int rmonitor_cgroup_add_process(struct rmonitor_cgroup *c, pid_t pid)
+{
+	char *value = string_format("%d", (int)pid);
+	int result = rmonitor_cgroup_write(c->path, "cgroup.procs", value);
+	free(value);
+
+	if (!result)
+		debug(D_RMON, "could not add process %d to cgroup %s: %s", (int)pid, c->path, strerror(errno));
+
+	return result;
+}
+
+int rmonitor_cgroup_measure(struct rmonitor_cgroup *c, struct rmonitor_cgroup_info *info)
+{
+	char line[4096];
+	char *path;
+	FILE *file;
+
+	info->cpu_usec = -1;
+	info->bytes_read = -1;
+	info->bytes_written = -1;
+
+	path = string_format("%s/cpu.stat", c->path);
+	file = fopen(path, "r");
+	free(path);
+
+	if (!file)
+		return 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "usage_usec %" SCNd64, &info->cpu_usec) == 1)
+			break;
+	}
+	fclose(file);
+
+	/* memory.current also counts the page cache, which is not resident memory of the processes. */
+	info->memory = -1;
+	path = string_format("%s/memory.stat", c->path);
+	file = fopen(path, "r");
+	free(path);
+
+	if (file) {
+		info->memory = 0;
+		while (fgets(line, sizeof(line), file)) {
+			int64_t value;
+			if (sscanf(line, "anon %" SCNd64, &value) == 1 || sscanf(line, "file_mapped %" SCNd64, &value) == 1)
+				info->memory += value;
+		}
+		fclose(file);
+	}
+
+	info->swap = rmonitor_cgroup_read_int(c, "memory.swap.current");
+	info->processes = rmonitor_cgroup_read_int(c, "pids.current");
+
+	/* Each line of io.stat is a device followed by key=value pairs. */
+	path = string_format("%s/io.stat", c->path);
+	file = fopen(path, "r");
+	free(path);
+
+	if (file) {
+		info->bytes_read = 0;
+		info->bytes_written = 0;
+		while (fgets(line, sizeof(line), file)) {
+			char *field = strtok(line, " \n");
+			while ((field = strtok(0, " \n"))) {
+				int64_t value;
+				if (sscanf(field, "rbytes=%" SCNd64, &value) == 1)
+					info->bytes_read += value;
+				else if (sscanf(field, "wbytes=%" SCNd64, &value) == 1)
+					info->bytes_written += value;
+			}
+		}
+		fclose(file);
+	}
+
+	return 1;
+}
+
+int rmonitor_cgroup_watch_memory(struct rmonitor_cgroup *c, int64_t high)
+{
+#if defined(CCTOOLS_OPSYS_LINUX)
+	char *value = string_format("%" PRId64, high);
+	int result = rmonitor_cgroup_write(c->path, "memory.high", value);
+	free(value);
+
+	if (!result) {
+		debug(D_RMON, "could not set memory.high of cgroup %s: %s", c->path, strerror(errno));
+		return -1;
+	}
+
+	if (c->events_fd < 0) {
+		/* The kernel generates a file modified event when the counters of memory.events change. */
+		c->events_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (c->events_fd < 0)
+			return -1;
+
+		char *path = string_format("%s/memory.events", c->path);
+		if (inotify_add_watch(c->events_fd, path, IN_MODIFY) < 0) {
+			debug(D_RMON, "could not watch %s: %s", path, strerror(errno));
+			close(c->events_fd);
+			c->events_fd = -1;
+		}
+		free(path);
+	}
+
+	return c->events_fd;
+#else
+	return -1;
+#endif
+}
+
+void rmonitor_cgroup_delete(struct rmonitor_cgroup *c)
+{
+	if (!c)
+		return;
+
+	if (c->events_fd >= 0)
+		close(c->events_fd);
+
+	if (rmdir(c->path) != 0 && errno == EBUSY) {
+		/* Processes that escaped the monitor are still in the cgroup. */
+		rmonitor_cgroup_write(c->path, "cgroup.kill", "1");
+		for (int i = 0; i < 10 && rmdir(c->path) != 0 && errno == EBUSY; i++)
+			usleep(100000);
+	}
+
+	if (access(c->path, F_OK) == 0)
+		debug(D_RMON, "could not remove cgroup %s: %s", c->path, strerror(errno));
+
+	free(c->path);
+	free(c);
+}
+
+/* vim: set noexpandtab tabstop=8: */
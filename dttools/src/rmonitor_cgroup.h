@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef RMONITOR_CGROUP_H
+#define RMONITOR_CGROUP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+Measure a tree of processes through a cgroup v2 of its own.
+The kernel accounts for every process placed in the cgroup and all of its
+descendants, including those that exit between measurements, so a single
+read of a few files replaces scanning /proc for each process.
+The cgroup is created under the cgroup of the calling process, which must
+be writable, as when it is delegated by systemd or a container runtime.
+*/
+
+struct rmonitor_cgroup;
+
+/* Values not provided by the controllers enabled in the cgroup are -1. */
+
+struct rmonitor_cgroup_info {
+	int64_t cpu_usec;      /* From cpu.stat. */
+	int64_t memory;        /* Resident memory, as anon plus file_mapped of memory.stat, in bytes. */
+	int64_t swap;          /* From memory.swap.current, in bytes. */
+	int64_t bytes_read;    /* From io.stat, summed over devices. */
+	int64_t bytes_written;
+	int64_t processes;     /* From pids.current. */
+};
+
+/* Create a cgroup with the given name, or return null if it is not possible. */
+
+struct rmonitor_cgroup *rmonitor_cgroup_create(const char *name);
+
+/* Move a process into the cgroup.  Typically called by a child before exec. */
+
+int rmonitor_cgroup_add_process(struct rmonitor_cgroup *c, pid_t pid);
+
+/* Read the current accounting of the cgroup.  Returns false if it cannot be read. */
+
+int rmonitor_cgroup_measure(struct rmonitor_cgroup *c, struct rmonitor_cgroup_info *info);
+
+/* Set memory.high of the cgroup to the given number of bytes, and return a
+file descriptor that becomes readable whenever memory.events changes, such as
+when usage goes above memory.high.  Returns -1 if not available.  The
+descriptor should be drained with read, and is closed by rmonitor_cgroup_delete. */
+
+int rmonitor_cgroup_watch_memory(struct rmonitor_cgroup *c, int64_t high);
+
+/* Remove the cgroup, killing any process left in it. */
+
+void rmonitor_cgroup_delete(struct rmonitor_cgroup *c);
+
+#endif
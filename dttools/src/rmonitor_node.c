@@ -0,0 +1,304 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "rmonitor_node.h"
+#include "debug.h"
+#include "itable.h"
+#include "list.h"
+#include "macros.h"
+#include "rmonitor_poll_internal.h"
+#include "xxmalloc.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* As in resource_monitor, cores are averaged over windows of this many seconds, so that short bursts are not reported as peaks. */
+#define RMONITOR_NODE_CORES_WINDOW 180
+
+struct rmonitor_node {
+	struct itable *trees;
+};
+
+struct rmonitor_node_tree {
+	pid_t root;
+	struct itable *processes; /* rmonitor_process_info of each live process, by pid. */
+	uint64_t start;		  /* in usecs. */
+	int64_t total_processes;
+
+	/* accumulated from the deltas of each pass, to count processes that already exited. */
+	double cpu_time;
+	double bytes_read;
+	double bytes_written;
+	int64_t context_switches;
+
+	double window_wall_time;
+	double window_cpu_time;
+
+	struct rmsummary *summary; /* peak values. */
+	struct rmsummary *current; /* values of the last pass, with cores used since the pass before. */
+};
+
+struct rmonitor_node *rmonitor_node_create()
+{
+	struct rmonitor_node *n = xxmalloc(sizeof(*n));
+	n->trees = itable_create(0);
+	return n;
+}
+
+static void rmonitor_node_tree_delete(struct rmonitor_node_tree *t)
+{
+	uint64_t pid;
+	struct rmonitor_process_info *p;
+
+	ITABLE_ITERATE(t->processes, pid, p)
+	{
+		free(p);
+	}
+	itable_delete(t->processes);
+
+	rmsummary_delete(t->summary);
+	rmsummary_delete(t->current);
+	free(t);
+}
+
+void rmonitor_node_delete(struct rmonitor_node *n)
+{
+	if (!n)
+		return;
+
+	uint64_t id;
+	struct rmonitor_node_tree *t;
+
+	ITABLE_ITERATE(n->trees, id, t)
+	{
+		rmonitor_node_tree_delete(t);
+	}
+	itable_delete(n->trees);
+
+	free(n);
+}
+
+void rmonitor_node_add(struct rmonitor_node *n, uint64_t id, pid_t pid)
+{
+	struct rmonitor_node_tree *t = xxmalloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+
+	t->root = pid;
+	t->processes = itable_create(0);
+	t->start = usecs_since_epoch();
+
+	t->summary = rmsummary_create(-1);
+	t->summary->start = ((double)t->start) / ONE_SECOND;
+	t->summary->end = t->summary->start;
+	t->summary->wall_time = 0;
+
+	struct rmonitor_node_tree *old = itable_remove(n->trees, id);
+	if (old)
+		rmonitor_node_tree_delete(old);
+
+	itable_insert(n->trees, id, t);
+
+	debug(D_RMON, "monitoring task %" PRIu64 " with root process %d", id, (int)pid);
+}
+
+/* Find the live processes of the tree by following the children of each process from the root. */
+
+static void rmonitor_node_update_tree(struct rmonitor_node_tree *t)
+{
+	struct itable *found = itable_create(0);
+	struct list *pending = list_create();
+
+	list_push_tail(pending, (void *)(uintptr_t)t->root);
+
+	void *item;
+	while ((item = list_pop_head(pending))) {
+		uint64_t pid = (uintptr_t)item;
+		if (itable_lookup(found, pid) || kill(pid, 0) != 0)
+			continue;
+
+		itable_insert(found, pid, (void *)1);
+
+		uint64_t *children = NULL;
+		int count = rmonitor_get_children(pid, &children);
+		for (int i = 0; i < count; i++)
+			list_push_tail(pending, (void *)(uintptr_t)children[i]);
+		free(children);
+	}
+	list_delete(pending);
+
+	uint64_t pid;
+	struct rmonitor_process_info *p;
+
+	ITABLE_ITERATE(t->processes, pid, p)
+	{
+		if (!itable_lookup(found, pid)) {
+			itable_remove(t->processes, pid);
+			free(p);
+			itable_firstkey(t->processes);
+		}
+	}
+
+	ITABLE_ITERATE(found, pid, item)
+	{
+		if (!itable_lookup(t->processes, pid)) {
+			p = xxmalloc(sizeof(*p));
+			memset(p, 0, sizeof(*p));
+			p->pid = pid;
+			itable_insert(t->processes, pid, p);
+			t->total_processes++;
+		}
+	}
+
+	itable_delete(found);
+}
+
+static void rmonitor_node_poll_tree(struct rmonitor_node_tree *t)
+{
+	struct rmonitor_process_info p_acc;
+	struct rmonitor_mem_info m_acc;
+
+	rmonitor_node_update_tree(t);
+
+	if (itable_size(t->processes) < 1)
+		return;
+
+	rmonitor_poll_all_processes_once(t->processes, &p_acc);
+	rmonitor_poll_maps_once(t->processes, &m_acc);
+
+	t->cpu_time += ((double)p_acc.cpu.delta) / ONE_SECOND;
+	t->context_switches += p_acc.ctx.delta;
+	t->bytes_read += ((double)(p_acc.io.delta_chars_read + p_acc.io.delta_bytes_faulted)) / ONE_MEGABYTE;
+	t->bytes_written += ((double)p_acc.io.delta_chars_written) / ONE_MEGABYTE;
+
+	struct rmsummary *tr = rmsummary_create(-1);
+
+	tr->start = ((double)t->start) / ONE_SECOND;
+	tr->end = ((double)usecs_since_epoch()) / ONE_SECOND;
+	tr->wall_time = tr->end - tr->start;
+
+	tr->cpu_time = t->cpu_time;
+	tr->context_switches = t->context_switches;
+
+	if (tr->wall_time < RMONITOR_NODE_CORES_WINDOW) {
+		tr->cores = tr->cpu_time / RMONITOR_NODE_CORES_WINDOW;
+	} else if (tr->wall_time - t->window_wall_time >= RMONITOR_NODE_CORES_WINDOW) {
+		tr->cores = (tr->cpu_time - t->window_cpu_time) / (tr->wall_time - t->window_wall_time);
+		t->window_wall_time = tr->wall_time;
+		t->window_cpu_time = tr->cpu_time;
+	}
+
+	if (tr->wall_time > 0)
+		tr->cores_avg = tr->cpu_time / tr->wall_time;
+
+	tr->max_concurrent_processes = itable_size(t->processes);
+	tr->total_processes = t->total_processes;
+
+	/* smaps may not be readable, in which case /proc/pid/status is a conservative fallback. */
+	if (m_acc.resident > 0) {
+		tr->virtual_memory = m_acc.virtual;
+		tr->memory = m_acc.resident;
+		tr->swap_memory = m_acc.swap;
+	} else {
+		tr->virtual_memory = p_acc.mem.virtual;
+		tr->memory = p_acc.mem.resident;
+		tr->swap_memory = p_acc.mem.swap;
+	}
+
+	tr->bytes_read = t->bytes_read;
+	tr->bytes_written = t->bytes_written;
+
+	tr->machine_load = p_acc.load.last_minute;
+	tr->machine_cpus = p_acc.load.cpus;
+
+	t->summary->wall_time = tr->wall_time;
+	t->summary->end = tr->end;
+	rmsummary_merge_max_w_time(t->summary, tr);
+
+	/* unlike the peaks, the current cores are those used since the previous pass. */
+	if (t->current && tr->wall_time > t->current->wall_time) {
+		tr->cores = (tr->cpu_time - t->current->cpu_time) / (tr->wall_time - t->current->wall_time);
+	} else {
+		tr->cores = tr->cores_avg;
+	}
+
+	rmsummary_delete(t->current);
+	t->current = tr;
+}
+
+void rmonitor_node_poll(struct rmonitor_node *n)
+{
+	uint64_t id;
+	struct rmonitor_node_tree *t;
+
+	ITABLE_ITERATE(n->trees, id, t)
+	{
+		rmonitor_node_poll_tree(t);
+	}
+}
+
+const struct rmsummary *rmonitor_node_summary(struct rmonitor_node *n, uint64_t id)
+{
+	struct rmonitor_node_tree *t = itable_lookup(n->trees, id);
+	return t ? t->summary : NULL;
+}
+
+const struct rmsummary *rmonitor_node_current(struct rmonitor_node *n, uint64_t id)
+{
+	struct rmonitor_node_tree *t = itable_lookup(n->trees, id);
+	return t ? t->current : NULL;
+}
+
+int rmonitor_node_check_limits(struct rmonitor_node *n, uint64_t id, struct rmsummary *limits)
+{
+	struct rmonitor_node_tree *t = itable_lookup(n->trees, id);
+	if (!t)
+		return 1;
+
+	return rmsummary_check_limits(t->summary, limits);
+}
+
+struct rmsummary *rmonitor_node_remove(struct rmonitor_node *n, uint64_t id, const struct rusage *usage)
+{
+	struct rmonitor_node_tree *t = itable_remove(n->trees, id);
+	if (!t)
+		return NULL;
+
+	struct rmsummary *s = t->summary;
+	t->summary = NULL;
+
+	s->end = ((double)usecs_since_epoch()) / ONE_SECOND;
+	s->wall_time = s->end - s->start;
+
+	if (usage) {
+		/* usage includes all the descendants the root process waited for. */
+		struct rmsummary *tr = rmsummary_create(-1);
+
+		tr->cpu_time = usage->ru_utime.tv_sec + ((double)usage->ru_utime.tv_usec) / ONE_SECOND;
+		tr->cpu_time += usage->ru_stime.tv_sec + ((double)usage->ru_stime.tv_usec) / ONE_SECOND;
+
+		if (usage->ru_majflt > 0) {
+			tr->bytes_read = s->bytes_read + ((double)usage->ru_majflt * sysconf(_SC_PAGESIZE)) / ONE_MEGABYTE;
+		}
+
+		tr->wall_time = s->wall_time;
+		rmsummary_merge_max_w_time(s, tr);
+		rmsummary_delete(tr);
+	}
+
+	/* as in resource_monitor, cores are at least the average over the whole run. */
+	if (s->wall_time > 0) {
+		s->cores_avg = s->cpu_time / s->wall_time;
+		s->cores = MAX(s->cores, s->cores_avg);
+	}
+
+	rmonitor_node_tree_delete(t);
+
+	return s;
+}
+
+/* vim: set noexpandtab tabstop=8: */
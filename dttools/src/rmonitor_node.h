@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef RMONITOR_NODE_H
+#define RMONITOR_NODE_H
+
+#include "rmsummary.h"
+
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/** @file rmonitor_node.h
+Measure the process trees of many tasks running on the same node.
+Rather than one resource_monitor per task, each polling /proc on its own,
+a single process such as a worker registers the root process of each task,
+and all the trees are measured in one pass.  The summary of each task has
+the same fields as the one written by resource_monitor, so that it can be
+read with @ref rmsummary_parse_file_single.
+*/
+
+struct rmonitor_node;
+
+/** Create a monitor with no tasks.
+@return A new monitor.
+*/
+struct rmonitor_node *rmonitor_node_create();
+
+/** Delete a monitor and the summaries of all its tasks.
+@param n The monitor to delete.
+*/
+void rmonitor_node_delete(struct rmonitor_node *n);
+
+/** Start measuring the process tree of a task.
+@param n The monitor.
+@param id A unique identifier of the task.
+@param pid The root process of the task.
+*/
+void rmonitor_node_add(struct rmonitor_node *n, uint64_t id, pid_t pid);
+
+/** Measure all the process trees once.
+Processes created by the tasks since the last pass are found by following
+the children of each process of the tree.
+@param n The monitor.
+*/
+void rmonitor_node_poll(struct rmonitor_node *n);
+
+/** Get the peak resources measured for a task so far.
+@param n The monitor.
+@param id The identifier of the task.
+@return The summary of the task, owned by the monitor, or null if the task is unknown.
+*/
+const struct rmsummary *rmonitor_node_summary(struct rmonitor_node *n, uint64_t id);
+
+/** Get the resources measured for a task in the last pass.
+Memory and processes are those found in the last pass, and cores are
+those used since the pass before, rather than the peaks of the summary.
+@param n The monitor.
+@param id The identifier of the task.
+@return The resources of the task, owned by the monitor, or null if the task is unknown or has not been measured yet.
+*/
+const struct rmsummary *rmonitor_node_current(struct rmonitor_node *n, uint64_t id);
+
+/** Check the peak resources of a task against limits.
+The resources exceeded are recorded in the summary of the task.
+@param n The monitor.
+@param id The identifier of the task.
+@param limits The limits of the task.
+@return True if the task is within its limits, false otherwise.
+*/
+int rmonitor_node_check_limits(struct rmonitor_node *n, uint64_t id, struct rmsummary *limits);
+
+/** Stop measuring a task, and get its final summary.
+@param n The monitor.
+@param id The identifier of the task.
+@param usage If not null, the resource usage of the root process collected by wait4, to account for processes that exited between passes.
+@return The summary of the task, which must be deleted by the caller, or null if the task is unknown.
+*/
+struct rmsummary *rmonitor_node_remove(struct rmonitor_node *n, uint64_t id, const struct rusage *usage);
+
+#endif
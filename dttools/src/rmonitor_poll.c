@@ -12,6 +12,7 @@ See the file COPYING for details.
 #include <string.h>
 #include <strings.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "load_average.h"
@@ -31,6 +32,33 @@ See the file COPYING for details.
 
 #define ANON_MAPS_NAME "[anon]"
 
+/* If true, memory is accounted from the totals of /proc/[pid]/smaps_rollup,
+ * rather than by parsing every map of /proc/[pid]/smaps, which for processes
+ * with thousands of maps is more expensive than the process itself. */
+static int rmonitor_poll_use_rollup = 1;
+
+void rmonitor_poll_detailed_maps(int detailed)
+{
+	rmonitor_poll_use_rollup = !detailed;
+}
+
+/* smaps_rollup appeared in Linux 4.14. */
+static int rmonitor_poll_rollup_available()
+{
+	static int available = -1;
+
+	if (!rmonitor_poll_use_rollup)
+		return 0;
+
+	if (available < 0) {
+		available = access("/proc/self/smaps_rollup", R_OK) == 0;
+		if (!available)
+			debug(D_RMON, "smaps_rollup is not available, reading smaps instead.");
+	}
+
+	return available;
+}
+
 uint64_t usecs_since_epoch()
 {
 	uint64_t usecs;
@@ -561,11 +589,79 @@ int rmonitor_get_mmaps_usage(pid_t pid, struct hash_table *maps)
 	return 0;
 }
 
+/* Proportional set sizes add up correctly across processes that share pages,
+ * so the totals of smaps_rollup need no merging of maps. */
+int rmonitor_get_rollup_usage(pid_t pid, struct rmonitor_mem_info *mem)
+{
+	FILE *fmem = open_proc_file(pid, "smaps_rollup");
+	if (!fmem)
+		return 1;
+
+	uint64_t pss = 0, swap = 0, ref = 0;
+	uint64_t private_clean = 0, private_dirty = 0;
+
+	/* in kB! */
+	int status = 0;
+	status |= rmonitor_get_int_attribute(fmem, "Pss:", &pss, 1);
+	status |= rmonitor_get_int_attribute(fmem, "Private_Clean:", &private_clean, 1);
+	status |= rmonitor_get_int_attribute(fmem, "Private_Dirty:", &private_dirty, 1);
+	status |= rmonitor_get_int_attribute(fmem, "Referenced:", &ref, 1);
+	if (rmonitor_get_int_attribute(fmem, "SwapPss:", &swap, 1))
+		status |= rmonitor_get_int_attribute(fmem, "Swap:", &swap, 1);
+
+	fclose(fmem);
+
+	if (status)
+		return 1;
+
+	mem->resident = pss;
+	mem->private = MIN(private_clean + private_dirty, pss);
+	mem->shared = pss - mem->private;
+	mem->referenced = ref;
+	mem->swap = swap;
+
+	return 0;
+}
+
+static int rmonitor_poll_rollup_once(struct itable *processes, struct rmonitor_mem_info *mem)
+{
+	uint64_t pid;
+	struct rmonitor_process_info *pinfo;
+	itable_firstkey(processes);
+	while (itable_nextkey(processes, &pid, (void *)&pinfo)) {
+		struct rmonitor_mem_info info;
+		if (rmonitor_get_rollup_usage(pid, &info))
+			continue;
+
+		mem->resident += info.resident;
+		mem->private += info.private;
+		mem->shared += info.shared;
+		mem->referenced += info.referenced;
+		mem->swap += info.swap;
+
+		/* smaps_rollup has no virtual size, use the one from /proc/[pid]/status, already in MB. */
+		mem->virtual += pinfo->mem.virtual * 1024;
+	}
+
+	/* all the values computed are in kB, we convert to MB. */
+	mem->virtual = DIV_INT_ROUND_UP(mem->virtual, 1024);
+	mem->shared = DIV_INT_ROUND_UP(mem->shared, 1024);
+	mem->private = DIV_INT_ROUND_UP(mem->private, 1024);
+	mem->resident = DIV_INT_ROUND_UP(mem->resident, 1024);
+	mem->referenced = DIV_INT_ROUND_UP(mem->referenced, 1024);
+	mem->swap = DIV_INT_ROUND_UP(mem->swap, 1024);
+
+	return 0;
+}
+
 int rmonitor_poll_maps_once(struct itable *processes, struct rmonitor_mem_info *mem)
 {
 	/* set result to 0. */
 	bzero(mem, sizeof(struct rmonitor_mem_info));
 
+	if (rmonitor_poll_rollup_available())
+		return rmonitor_poll_rollup_once(processes, mem);
+
 	struct hash_table *maps_per_file = hash_table_create(0, 0);
 
 	uint64_t pid;
@@ -722,18 +818,36 @@ int rmonitor_get_map_io_usage(pid_t pid, struct rmonitor_io_info *io)
 	kbytes_resident_accum = 0;
 	io->delta_bytes_faulted = 0;
 
-	FILE *fsmaps = open_proc_file(pid, "smaps");
-	if (!fsmaps) {
-		return 1;
-	}
+	FILE *fsmaps;
 
-	char dummy_line[1024];
+	if (rmonitor_poll_rollup_available()) {
+		/* resident pages not anonymous are the ones mapped from files. */
+		fsmaps = open_proc_file(pid, "smaps_rollup");
+		if (!fsmaps) {
+			return 1;
+		}
+
+		uint64_t kbytes_anonymous = 0;
+		kbytes_resident = 0;
+		rmonitor_get_int_attribute(fsmaps, "Rss:", &kbytes_resident, 1);
+		rmonitor_get_int_attribute(fsmaps, "Anonymous:", &kbytes_anonymous, 1);
 
-	/* Look for next mmap file */
-	while (fgets(dummy_line, 1024, fsmaps))
-		if (strchr(dummy_line, '/'))
-			if (rmonitor_get_int_attribute(fsmaps, "Rss:", &kbytes_resident, 0) == 0)
-				kbytes_resident_accum += kbytes_resident;
+		if (kbytes_resident > kbytes_anonymous)
+			kbytes_resident_accum = kbytes_resident - kbytes_anonymous;
+	} else {
+		fsmaps = open_proc_file(pid, "smaps");
+		if (!fsmaps) {
+			return 1;
+		}
+
+		char dummy_line[1024];
+
+		/* Look for next mmap file */
+		while (fgets(dummy_line, 1024, fsmaps))
+			if (strchr(dummy_line, '/'))
+				if (rmonitor_get_int_attribute(fsmaps, "Rss:", &kbytes_resident, 0) == 0)
+					kbytes_resident_accum += kbytes_resident;
+	}
 
 	if ((kbytes_resident_accum * 1024) > io->bytes_faulted)
 		io->delta_bytes_faulted = (kbytes_resident_accum * 1024) - io->bytes_faulted;
@@ -45,11 +45,16 @@ int rmonitor_poll_wd_once(     struct rmonitor_wdir_info    *d, int max_time_for
 int rmonitor_poll_fs_once(     struct rmonitor_filesys_info *f);
 int rmonitor_poll_maps_once(   struct itable *processes, struct rmonitor_mem_info *mem);
 
+/* By default, memory is read from the totals of /proc/[pid]/smaps_rollup.
+ * If detailed is true, every map of /proc/[pid]/smaps is read instead. */
+void rmonitor_poll_detailed_maps(int detailed);
+
 void rmonitor_info_to_rmsummary(struct rmsummary *tr, struct rmonitor_process_info *p, struct rmonitor_wdir_info *d, struct rmonitor_filesys_info *f, uint64_t start_time);
 
 int rmonitor_get_cpu_time_usage(pid_t pid,        struct rmonitor_cpu_time_info *cpu);
 int rmonitor_get_ctxsw_usage(   pid_t pid,        struct rmonitor_ctxsw_info *ctx);
 int rmonitor_get_mem_usage(     pid_t pid,        struct rmonitor_mem_info *mem);
+int rmonitor_get_rollup_usage(  pid_t pid,        struct rmonitor_mem_info *mem);
 int rmonitor_get_sys_io_usage(  pid_t pid,        struct rmonitor_io_info *io);
 int rmonitor_get_map_io_usage(  pid_t pid,        struct rmonitor_io_info *io);
 int rmonitor_get_dsk_usage(     const char *path, struct statfs *disk);
@@ -70,6 +70,9 @@ static const struct resource_info resources_info[] = {{"start", "s", 6, offsetof
 
 static char **resources_names = NULL;
 
+/* resource vectors are laid out as resources_info. */
+typedef char rmsummary_vector_size_check[(sizeof(resources_info) / sizeof(resources_info[0]) == RMSUMMARY_VECTOR_SIZE) ? 1 : -1];
+
 /* reverse map for resource_info. Lookup by resource name rather than
  * sequential access. Use to print resources with the correct number of
  * decimals. */
@@ -922,6 +925,80 @@ void rmsummary_add(struct rmsummary *dest, const struct rmsummary *src)
 	RM_BIN_OP(dest, src, plus);
 }
 
+void rmsummary_to_vector(const struct rmsummary *s, double *v)
+{
+	size_t i;
+	for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+		v[i] = rmsummary_get_by_offset(s, resources_info[i].offset);
+	}
+}
+
+void rmsummary_from_vector(struct rmsummary *s, const double *v)
+{
+	size_t i;
+	for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+		rmsummary_set_by_offset(s, resources_info[i].offset, v[i]);
+	}
+}
+
+void rmsummary_vector_fill(double *v, double value)
+{
+	size_t i;
+	for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+		v[i] = value;
+	}
+}
+
+/* The element operations below are written without branches, as selects
+ * between the min and max of each pair, so that the loops vectorize. They
+ * give the same results as override_field, max_field, min_field and plus. */
+
+void rmsummary_vector_merge_override(double *restrict dest, const double *restrict src, size_t count)
+{
+	size_t j, i;
+	for (j = 0; j < count; j++, src += RMSUMMARY_VECTOR_SIZE) {
+		for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			dest[i] = (src[i] > -1) ? src[i] : dest[i];
+		}
+	}
+}
+
+void rmsummary_vector_merge_max(double *restrict dest, const double *restrict src, size_t count)
+{
+	size_t j, i;
+	for (j = 0; j < count; j++, src += RMSUMMARY_VECTOR_SIZE) {
+		for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			dest[i] = (dest[i] > src[i]) ? dest[i] : src[i];
+		}
+	}
+}
+
+void rmsummary_vector_merge_min(double *restrict dest, const double *restrict src, size_t count)
+{
+	size_t j, i;
+	for (j = 0; j < count; j++, src += RMSUMMARY_VECTOR_SIZE) {
+		for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			double lo = (dest[i] < src[i]) ? dest[i] : src[i];
+			double hi = (dest[i] > src[i]) ? dest[i] : src[i];
+			double undefined = (hi > -1) ? hi : -1;
+			dest[i] = (lo < 0) ? undefined : lo;
+		}
+	}
+}
+
+void rmsummary_vector_add(double *restrict dest, const double *restrict src, size_t count)
+{
+	size_t j, i;
+	for (j = 0; j < count; j++, src += RMSUMMARY_VECTOR_SIZE) {
+		for (i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			double lo = (dest[i] < src[i]) ? dest[i] : src[i];
+			double hi = (dest[i] > src[i]) ? dest[i] : src[i];
+			double undefined = (hi > 0) ? hi : 0;
+			dest[i] = (lo < 0) ? undefined : dest[i] + src[i];
+		}
+	}
+}
+
 void rmsummary_debug_report(const struct rmsummary *s)
 {
 	if (!s)
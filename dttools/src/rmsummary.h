@@ -115,6 +115,24 @@ void rmsummary_merge_max(struct rmsummary *dest, const struct rmsummary *src);
 void rmsummary_merge_min(struct rmsummary *dest, const struct rmsummary *src);
 void rmsummary_add(struct rmsummary *dest, const struct rmsummary *src);
 
+/* Resources of summaries as dense vectors of RMSUMMARY_VECTOR_SIZE doubles,
+ * in the order of rmsummary_list_resources(). Aggregating many summaries
+ * is cheaper as vectors, converting only at the edges, since the bulk
+ * operations below run over contiguous doubles without per field lookups,
+ * and can be vectorized by the compiler. */
+#define RMSUMMARY_VECTOR_SIZE 24
+
+void rmsummary_to_vector(const struct rmsummary *s, double *v);
+void rmsummary_from_vector(struct rmsummary *s, const double *v);
+void rmsummary_vector_fill(double *v, double value);
+
+/* Merge count vectors stored contiguously at src into the vector dest,
+ * with the same semantics as the corresponding summary operations. */
+void rmsummary_vector_merge_override(double *dest, const double *src, size_t count);
+void rmsummary_vector_merge_max(double *dest, const double *src, size_t count);
+void rmsummary_vector_merge_min(double *dest, const double *src, size_t count);
+void rmsummary_vector_add(double *dest, const double *src, size_t count);
+
 void rmsummary_debug_report(const struct rmsummary *s);
 
 struct rmsummary *rmsummary_get_snapshot(const struct rmsummary *s, size_t i);
@@ -0,0 +1,96 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "rmsummary.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SUMMARIES 1000
+
+/* A value for each resource of each summary, including undefined (-1) and zero values. */
+static double value_of(int j, int i)
+{
+	int r = (j * 31 + i * 17) % 11;
+	return r < 2 ? -1 : r < 3 ? 0 : r * 1.5;
+}
+
+static int same(const struct rmsummary *a, const struct rmsummary *b)
+{
+	const char **resources = rmsummary_list_resources();
+	for (size_t i = 0; i < rmsummary_num_resources(); i++) {
+		if (rmsummary_get(a, resources[i]) != rmsummary_get(b, resources[i])) {
+			fprintf(stdout, "%s: %f != %f\n", resources[i], rmsummary_get(a, resources[i]), rmsummary_get(b, resources[i]));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (rmsummary_num_resources() != RMSUMMARY_VECTOR_SIZE)
+		FAIL("expected %d resources, found %d", RMSUMMARY_VECTOR_SIZE, (int)rmsummary_num_resources());
+
+	struct rmsummary *summaries[SUMMARIES];
+	double *vectors = malloc(sizeof(double) * RMSUMMARY_VECTOR_SIZE * SUMMARIES);
+
+	const char **resources = rmsummary_list_resources();
+	for (int j = 0; j < SUMMARIES; j++) {
+		summaries[j] = rmsummary_create(-1);
+		for (int i = 0; i < RMSUMMARY_VECTOR_SIZE; i++) {
+			rmsummary_set(summaries[j], resources[i], value_of(j, i));
+		}
+		rmsummary_to_vector(summaries[j], vectors + j * RMSUMMARY_VECTOR_SIZE);
+	}
+
+	/* conversions keep every resource. */
+	struct rmsummary *s = rmsummary_create(-1);
+	rmsummary_from_vector(s, vectors + 7 * RMSUMMARY_VECTOR_SIZE);
+	if (!same(s, summaries[7]))
+		FAIL("summary changed when converted to a vector and back");
+	rmsummary_delete(s);
+
+	/* bulk operations agree with the operations on summaries. */
+	const char *names[] = {"override", "max", "min", "add"};
+	for (int op = 0; op < 4; op++) {
+		double initial = op == 3 ? 0 : -1;
+
+		struct rmsummary *expected = rmsummary_create(initial);
+		for (int j = 0; j < SUMMARIES; j++) {
+			switch (op) {
+			case 0: rmsummary_merge_override(expected, summaries[j]); break;
+			case 1: rmsummary_merge_max(expected, summaries[j]); break;
+			case 2: rmsummary_merge_min(expected, summaries[j]); break;
+			case 3: rmsummary_add(expected, summaries[j]); break;
+			}
+		}
+
+		double v[RMSUMMARY_VECTOR_SIZE];
+		rmsummary_vector_fill(v, initial);
+		switch (op) {
+		case 0: rmsummary_vector_merge_override(v, vectors, SUMMARIES); break;
+		case 1: rmsummary_vector_merge_max(v, vectors, SUMMARIES); break;
+		case 2: rmsummary_vector_merge_min(v, vectors, SUMMARIES); break;
+		case 3: rmsummary_vector_add(v, vectors, SUMMARIES); break;
+		}
+
+		struct rmsummary *result = rmsummary_create(-1);
+		rmsummary_from_vector(result, v);
+		if (!same(result, expected))
+			FAIL("vector %s differs from summary %s", names[op], names[op]);
+
+		rmsummary_delete(result);
+		rmsummary_delete(expected);
+	}
+
+	for (int j = 0; j < SUMMARIES; j++)
+		rmsummary_delete(summaries[j]);
+	free(vectors);
+
+	return 0;
+}
@@ -32,7 +32,13 @@
 #include <openssl/bio.h>
 #include <openssl/buffer.h>
 
+#include <ctype.h>
+#include <inttypes.h>
+#include <strings.h>
+
+#include "buffer.h"
 #include "s3_file_io.h"
+#include "stringtools.h"
 
 
 /*!
@@ -45,46 +51,34 @@ static int useRrs = 0;  /// <Use reduced redundancy storage
 static char * awsKeyID = NULL;  /// <AWS Key ID
 static char * awsKey   = NULL;  /// <AWS Key Material
 static char * S3Host     = "s3.amazonaws.com";     /// <AWS S3 host
+static char * Region   = "us-east-1";  /// <AWS region used in signatures
 static char * Bucket   = NULL;
 static char * MimeType = NULL;
 static char * AccessControl = NULL;
+static int64_t PartSize = 64 << 20;  /// <Size of the parts of large objects
+static int Concurrency = 4;          /// <Parts transferred at once
+
+/// One part of an object, transferred as a range or an upload part
+struct s3_part {
+  int fd;
+  int number;
+  int64_t offset;
+  int64_t length;
+  int64_t done;
+  char etag[256];
+};
 
 static void __debug ( char *fmt, ... ) ;
-static char * __aws_get_httpdate ();
-static int s3_do_get ( FILE *b, char * const signature, 
-			  char * const date, char * const resource );
-static int s3_do_put ( FILE *b, char * const signature, 
-			  char * const date, char * const resource );
-static int s3_do_check ( char * const signature,
-                          char * const date, char * const resource );
-static char* __aws_sign ( char * const str );
-
-
-/// Encode a binary into base64 buffer
-/// \param input binary data  text
-/// \param length length of the input text
-/// \internal
-/// \return a newly allocated buffer with base64 encoded data 
-static char *__b64_encode(const unsigned char *input, int length)
-{
-  BIO *bmem, *b64;
-  BUF_MEM *bptr;
-
-  b64 = BIO_new(BIO_f_base64());
-  bmem = BIO_new(BIO_s_mem());
-  b64 = BIO_push(b64, bmem);
-  BIO_write(b64, input, length);
-  if(BIO_flush(b64)) {} /* make gcc 4.1.2 happy */
-  BIO_get_mem_ptr(b64, &bptr);
-
-  char *buff = (char *)malloc(bptr->length);
-  memcpy(buff, bptr->data, bptr->length-1);
-  buff[bptr->length-1] = 0;
+static struct curl_slist * __aws_sign_v4 ( struct curl_slist *slist,
+			  const char *method, const char *resource, const char *query );
+static void __s3_resource ( char *resource, int resSize, const char *file );
+static char * __s3_url ( const char *resource, const char *query );
+static int s3_do_get ( FILE *b, const char *resource );
+static int s3_do_put ( FILE *b, const char *resource );
+static int s3_do_check ( const char *resource, int64_t *size );
+static int s3_do_get_parts ( FILE *b, const char *resource, int64_t size );
+static int s3_do_put_multipart ( FILE *b, const char *resource, int64_t size );
 
-  BIO_free_all(b64);
-
-  return buff;
-}
 
 /// Handles reception of the data
 /// \param ptr pointer to the incoming data
@@ -98,6 +92,14 @@ static size_t writefunc ( void * ptr, size_t size, size_t nmemb, void * stream )
     return written;
 }
 
+/// Collects a response body in memory
+static size_t bufferfunc ( void * ptr, size_t size, size_t nmemb, void * stream )
+{
+  if ( buffer_putlstring ( (buffer_t *) stream, ptr, size * nmemb ) < 0 )
+    return 0;
+  return size * nmemb;
+}
+
 /// Print debug output
 /// \internal
 /// \param fmt printf like formating string
@@ -113,75 +115,177 @@ static void __debug ( char *fmt, ... ) {
   va_end( args );
 }
 
+/// Hex encoding of a binary buffer
+/// \internal
+static void __hex ( const unsigned char *in, unsigned len, char *out )
+{
+  unsigned i;
+  for ( i = 0; i < len; i++ )
+    sprintf ( out + 2*i, "%02x", in[i] );
+  out[2*len] = 0;
+}
 
-/// Get Request Date
+/// SHA256 of a string, in hex
 /// \internal
-/// \return date in HTTP format
-static char * __aws_get_httpdate ()
+static void __sha256_hex ( const char *str, char *out )
 {
-  static char dTa[256];
-  time_t t = time(NULL);
-  struct tm * gTime = gmtime ( & t );
-  memset ( dTa, 0 , sizeof(dTa));
-  strftime ( dTa, sizeof(dTa), "%a, %d %b %Y %H:%M:%S +0000", gTime );
-  __debug ( "Request Time: %s", dTa );
-  return dTa;
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned len;
+  EVP_Digest ( str, strlen(str), md, &len, EVP_sha256(), NULL );
+  __hex ( md, len, out );
+}
+
+/// HMAC-SHA256 of a string
+/// \internal
+static unsigned __hmac_sha256 ( const unsigned char *key, int keylen, const char *str, unsigned char *out )
+{
+  unsigned len;
+  HMAC ( EVP_sha256(), key, keylen, (const unsigned char *) str, strlen(str), out, &len );
+  return len;
 }
 
-/// Get S3 Request signature
+/// URI encoding as required by AWS signatures
 /// \internal
-/// \param resource -- URI of the object
-/// \param resSize --  size of the resoruce buffer
-/// \param date -- HTTP date
+/// \param keep_slash do not encode slashes, as in paths
+static void __uri_encode ( buffer_t *B, const char *str, int keep_slash )
+{
+  for ( ; *str; str++ ) {
+    unsigned char c = *str;
+    if ( isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~' || ( keep_slash && c == '/' ) )
+      buffer_putlstring ( B, (char *) &c, 1 );
+    else
+      buffer_printf ( B, "%%%02X", c );
+  }
+}
+
+/// Sign a request with AWS signature version 4
+/// \internal
+/// \param slist headers of the request, to which the signature is added
 /// \param method -- HTTP method
-/// \param bucket -- bucket 
-/// \param file --  file
-/// \return fills up resource and date parameters, also 
-///         returns request signature to be used with Authorization header
-static char * GetStringToSign ( char * resource,  int resSize, 
-			     char ** date,
-			     char * const method,
-			     char * const bucket,
-			     char * const file )
+/// \param resource -- URI of the object, without the leading slash
+/// \param query -- query string, with its parameters sorted by name, or NULL
+/// \return the headers of the request
+static struct curl_slist * __aws_sign_v4 ( struct curl_slist *slist,
+			  const char *method, const char *resource, const char *query )
 {
-  char  reqToSign[2048];
-  char  acl[32];
-  char  rrs[64];
+  char amzdate[32], datestamp[16];
+  char Buf[1024];
+  char hash[2*EVP_MAX_MD_SIZE + 1];
+  unsigned char key[EVP_MAX_MD_SIZE];
+  unsigned keylen;
 
-  /// \todo Change the way RRS is handled.  Need to pass it in
-  
-  * date = __aws_get_httpdate();
+  time_t t = time(NULL);
+  struct tm * gTime = gmtime ( & t );
+  strftime ( amzdate, sizeof(amzdate), "%Y%m%dT%H%M%SZ", gTime );
+  strftime ( datestamp, sizeof(datestamp), "%Y%m%d", gTime );
+
+  /// Headers signed in addition to host, in the sorted order of their names
+  char signed_headers[256] = "host";
+  buffer_t headers;
+  buffer_init ( &headers );
+  buffer_printf ( &headers, "host:%s\n", S3Host );
+
+  int sends_object = !strcmp(method, "PUT") || ( !strcmp(method, "POST") && query && !strcmp(query, "uploads=") );
+  if ( sends_object && AccessControl ) {
+    buffer_printf ( &headers, "x-amz-acl:%s\n", AccessControl );
+    strcat ( signed_headers, ";x-amz-acl" );
+  }
+  buffer_printf ( &headers, "x-amz-content-sha256:UNSIGNED-PAYLOAD\n" );
+  buffer_printf ( &headers, "x-amz-date:%s\n", amzdate );
+  strcat ( signed_headers, ";x-amz-content-sha256;x-amz-date" );
+  if ( sends_object && useRrs ) {
+    buffer_printf ( &headers, "x-amz-storage-class:REDUCED_REDUNDANCY\n" );
+    strcat ( signed_headers, ";x-amz-storage-class" );
+  }
 
-  memset ( resource,0,resSize);
-  if ( bucket != NULL )
-    snprintf ( resource, resSize,"%s/%s", bucket, file );
-  else
-    snprintf ( resource, resSize,"%s", file );
+  buffer_t request;
+  buffer_init ( &request );
+  buffer_printf ( &request, "%s\n/", method );
+  __uri_encode ( &request, resource, 1 );
+  buffer_printf ( &request, "\n%s\n%s\n%s\nUNSIGNED-PAYLOAD",
+		  query ? query : "", buffer_tostring(&headers), signed_headers );
+  __debug ( "CanonicalRequest:%s", buffer_tostring(&request) );
+  __sha256_hex ( buffer_tostring(&request), hash );
+
+  char scope[128];
+  snprintf ( scope, sizeof(scope), "%s/%s/s3/aws4_request", datestamp, Region );
+  snprintf ( Buf, sizeof(Buf), "AWS4-HMAC-SHA256\n%s\n%s\n%s", amzdate, scope, hash );
+
+  /// The signing key is derived from the secret for the date, region, and service
+  char secret[512];
+  snprintf ( secret, sizeof(secret), "AWS4%s", awsKey ? awsKey : "" );
+  keylen = __hmac_sha256 ( (unsigned char *) secret, strlen(secret), datestamp, key );
+  keylen = __hmac_sha256 ( key, keylen, Region, key );
+  keylen = __hmac_sha256 ( key, keylen, "s3", key );
+  keylen = __hmac_sha256 ( key, keylen, "aws4_request", key );
+  keylen = __hmac_sha256 ( key, keylen, Buf, key );
+  __hex ( key, keylen, hash );
+
+  if ( sends_object && AccessControl ) {
+    snprintf ( Buf, sizeof(Buf), "x-amz-acl: %s", AccessControl );
+    slist = curl_slist_append(slist, Buf );
+  }
+  if ( sends_object && useRrs )
+    slist = curl_slist_append(slist, "x-amz-storage-class: REDUCED_REDUNDANCY" );
+  if ( sends_object && MimeType ) {
+    snprintf ( Buf, sizeof(Buf), "Content-Type: %s", MimeType );
+    slist = curl_slist_append(slist, Buf );
+  }
+  slist = curl_slist_append(slist, "x-amz-content-sha256: UNSIGNED-PAYLOAD" );
+  snprintf ( Buf, sizeof(Buf), "x-amz-date: %s", amzdate );
+  slist = curl_slist_append(slist, Buf );
+  snprintf ( Buf, sizeof(Buf), "Authorization: AWS4-HMAC-SHA256 Credential=%s/%s, SignedHeaders=%s, Signature=%s",
+	     awsKeyID ? awsKeyID : "", scope, signed_headers, hash );
+  slist = curl_slist_append(slist, Buf );
 
-  if (AccessControl)
-    snprintf( acl, sizeof(acl), "x-amz-acl:%s\n", AccessControl);
-  else
-    acl[0] = 0;
+  buffer_free ( &headers );
+  buffer_free ( &request );
+  return slist;
+}
 
-  if (useRrs)
-    strncpy( rrs, "x-amz-storage-class:REDUCED_REDUNDANCY\n", sizeof(rrs));  
+/// Get the URI of an object in the current bucket
+/// \internal
+static void __s3_resource ( char *resource, int resSize, const char *file )
+{
+  memset ( resource,0,resSize);
+  // EU: If bucket is in virtual host name, remove bucket from path
+  if ( Bucket != NULL && strncmp(S3Host, Bucket, strlen(Bucket)) != 0 )
+    snprintf ( resource, resSize,"%s/%s", Bucket, file );
   else
-    rrs[0] = 0;
+    snprintf ( resource, resSize,"%s", file );
+}
 
+/// Get the URL of a request
+/// \internal
+/// \return a newly allocated URL
+static char * __s3_url ( const char *resource, const char *query )
+{
+  buffer_t B;
+  buffer_init ( &B );
+  buffer_printf ( &B, "http://%s/", S3Host );
+  __uri_encode ( &B, resource, 1 );
+  if ( query )
+    buffer_printf ( &B, "?%s", query );
+  char *url = strdup ( buffer_tostring(&B) );
+  buffer_free ( &B );
+  return url;
+}
 
-  snprintf ( reqToSign, sizeof(reqToSign),"%s\n\n%s\n%s\n%s%s/%s",
-	     method,
-	     MimeType ? MimeType : "",
-	     *date,
-	     acl,
-	     rrs,
-	     resource );
+/// Create a signed request
+/// \internal
+static CURL * __s3_request ( const char *method, const char *resource, const char *query, struct curl_slist **slist )
+{
+  CURL* ch =  curl_easy_init( );
+  char *url = __s3_url ( resource, query );
 
-  // EU: If bucket is in virtual host name, remove bucket from path
-  if (bucket && strncmp(S3Host, bucket, strlen(bucket)) == 0)
-    snprintf ( resource, resSize,"%s", file );
+  *slist = __aws_sign_v4 ( *slist, method, resource, query );
+  curl_easy_setopt ( ch, CURLOPT_HTTPHEADER, *slist);
+  curl_easy_setopt ( ch, CURLOPT_URL, url );
+  if ( strcmp(method, "GET") && strcmp(method, "PUT") )
+    curl_easy_setopt ( ch, CURLOPT_CUSTOMREQUEST, method );
 
-  return __aws_sign(reqToSign);
+  free ( url );
+  return ch;
 }
 
 /*!
@@ -233,6 +337,22 @@ void s3_set_acl ( char * const str )
 { AccessControl = str ? strdup(str) : NULL; }
 
 
+/// Set the AWS region used to sign requests
+void s3_set_region ( char * const str )
+{ Region = str ? strdup(str) : "us-east-1"; }
+
+/// Set the size of the parts of large objects
+/// \param size bytes per part; objects of at least two parts are
+///        uploaded in multiple parts and downloaded as parallel ranges
+void s3_set_part_size ( int64_t size )
+{ PartSize = size < (5 << 20) ? (5 << 20) : size; }
+
+/// Set the number of parts of an object transferred at once
+/// \param n number of connections, 1 to transfer objects in a single request
+void s3_set_concurrency ( int n )
+{ Concurrency = n < 1 ? 1 : n; }
+
+
 /// Upload the file into currently selected bucket
 /// \param FILE b
 /// \param file filename (can be renamed to a different name in s3 bucket this way)
@@ -241,16 +361,18 @@ void s3_set_acl ( char * const str )
 //     s3_put(fp,"test.txt"); 
 int s3_put ( FILE * b, char * const file )
 {
-  char * const method = "PUT";
   char  resource [1024];
-  char * date = NULL;
+  struct stat file_info;
 
-  char * signature = GetStringToSign ( resource, sizeof(resource), 
-				       &date, method, Bucket, file ); 
-  int sc = s3_do_put( b, signature, date, resource ); 
-  free ( signature );
-  return sc;
+  __s3_resource ( resource, sizeof(resource), file );
+
+  if(fstat(fileno(b), &file_info) != 0)
+    return 1; /* can't continue */
 
+  if ( Concurrency > 1 && file_info.st_size >= 2 * PartSize )
+    return s3_do_put_multipart ( b, resource, file_info.st_size );
+  else
+    return s3_do_put ( b, resource );
 }
 
 
@@ -262,114 +384,77 @@ int s3_put ( FILE * b, char * const file )
 //     s3_get(fp,"test.txt);
 int s3_get ( FILE * b, char * const file )
 {
-  char * const method = "GET";
-  
   char  resource [1024];
-  char * date = NULL;
+  int64_t size = 0;
 
-  
-  char * signature = GetStringToSign ( resource, sizeof(resource), 
-				       &date, method, Bucket, file ); 
-  int sc = s3_do_get( b, signature, date, resource ); 
-  free ( signature );
-  return sc;
+  __s3_resource ( resource, sizeof(resource), file );
+
+  if ( Concurrency > 1 && s3_do_check ( resource, &size ) && size >= 2 * PartSize )
+    return s3_do_get_parts ( b, resource, size );
+  else
+    return s3_do_get ( b, resource );
 }
 
 ///Checks to see if file exists in S3 bucket
 /// \param file filename
 int s3_check ( char * const file )
 {
-  char * const method = "HEAD";
-  
   char  resource [1024];
-  char * date = NULL;
-  char * signature = GetStringToSign ( resource, sizeof(resource), 
-				       &date, method, Bucket, file );
-  int sc = s3_do_check( signature, date, resource ); 
-  free ( signature );
 
-  return sc;
+  __s3_resource ( resource, sizeof(resource), file );
 
+  int sc = s3_do_check ( resource, NULL );
+  if ( sc )
+    printf("FILE EXISTS\n");
+  else
+    printf("FILE DOES NOT EXIST\n");
+  return sc;
 }
 
 
 
-static int s3_do_put ( FILE *b, char * const signature, 
-		       char * const date, char * const resource )
+static int s3_do_put ( FILE *b, const char *resource )
 {
-  char Buf[1024];
   struct stat file_info;
-  CURL* ch =  curl_easy_init( );
   struct curl_slist *slist=NULL;
-  
+
   if(fstat(fileno(b), &file_info) != 0)
     return 1; /* can't continue */ 
-  
-  if (MimeType) {
-    snprintf ( Buf, sizeof(Buf), "Content-Type: %s", MimeType );
-    slist = curl_slist_append(slist, Buf );
-  }
-
-  if (AccessControl) {
-    snprintf ( Buf, sizeof(Buf), "x-amz-acl: %s", AccessControl );
-    slist = curl_slist_append(slist, Buf );
-  }
 
-  if (useRrs) {
-    strncpy ( Buf, "x-amz-storage-class: REDUCED_REDUNDANCY", sizeof(Buf) );
-    slist = curl_slist_append(slist, Buf );  }
-
-
-
-  snprintf ( Buf, sizeof(Buf), "Date: %s", date );
-  slist = curl_slist_append(slist, Buf );
-  snprintf ( Buf, sizeof(Buf), "Authorization: AWS %s:%s", awsKeyID, signature );
-  slist = curl_slist_append(slist, Buf );
-
-  snprintf ( Buf, sizeof(Buf), "http://%s/%s", S3Host , resource );
-  curl_easy_setopt ( ch, CURLOPT_HTTPHEADER, slist);
-  curl_easy_setopt ( ch, CURLOPT_URL, Buf );
+  CURL* ch = __s3_request ( "PUT", resource, NULL, &slist );
   curl_easy_setopt ( ch, CURLOPT_READDATA, b );
   curl_easy_setopt ( ch, CURLOPT_UPLOAD, 1L );
-  curl_easy_setopt ( ch, CURLOPT_INFILESIZE,(curl_off_t)file_info.st_size);
+  curl_easy_setopt ( ch, CURLOPT_INFILESIZE_LARGE,(curl_off_t)file_info.st_size);
   //curl_easy_setopt ( ch, CURLOPT_VERBOSE, 1L );
   //curl_easy_setopt ( ch, CURLOPT_FOLLOWLOCATION, 1 );
 
   int  sc  = curl_easy_perform(ch);
-  /** \todo check the return code  */
-  __debug ( "Return Code: %d ", sc );
+  long response_code = 0;
+  curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &response_code);
+  __debug ( "Return Code: %d HTTP: %ld", sc, response_code );
   
   curl_slist_free_all(slist);
   curl_easy_cleanup(ch);
 
+  if ( sc == 0 && response_code != 200 )
+    sc = 1;
   return sc;
 
 }
 
 
-static int s3_do_get ( FILE *b, char * const signature, 
-		       char * const date, char * const resource )
+static int s3_do_get ( FILE *b, const char *resource )
 {
-  char Buf[1024];
-
-  CURL* ch =  curl_easy_init( );
   struct curl_slist *slist=NULL;
-  snprintf ( Buf, sizeof(Buf), "Date: %s", date );
-  slist = curl_slist_append(slist, Buf );
-  snprintf ( Buf, sizeof(Buf), "Authorization: AWS %s:%s", awsKeyID, signature );
-  slist = curl_slist_append(slist, Buf );
 
-  snprintf ( Buf, sizeof(Buf), "http://%s/%s", S3Host, resource );
-  curl_easy_setopt ( ch, CURLOPT_HTTPHEADER, slist);
-  curl_easy_setopt ( ch, CURLOPT_URL, Buf );
+  CURL* ch = __s3_request ( "GET", resource, NULL, &slist );
   curl_easy_setopt ( ch, CURLOPT_WRITEFUNCTION, writefunc );
   curl_easy_setopt ( ch, CURLOPT_WRITEDATA, b );
 
   int  sc  = curl_easy_perform(ch);
-  long response_code;
+  long response_code = 0;
   curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &response_code);
-  /** \todo check the return code  */
-  __debug ( "Return Code: %d ", sc );
+  __debug ( "Return Code: %d HTTP: %ld", sc, response_code );
   
   curl_slist_free_all(slist);
   curl_easy_cleanup(ch);
@@ -385,60 +470,262 @@ static int s3_do_get ( FILE *b, char * const signature,
 
 }
 
-static int s3_do_check ( char * const signature, 
-		       char * const date, char * const resource )
+/// \param size if not NULL, set to the size of the object
+static int s3_do_check ( const char *resource, int64_t *size )
 {
-  char Buf[1024];
-
-  CURL* ch =  curl_easy_init( );
   struct curl_slist *slist=NULL;
- 
-  snprintf ( Buf, sizeof(Buf), "Date: %s", date );
-  slist = curl_slist_append(slist, Buf );
-  snprintf ( Buf, sizeof(Buf), "Authorization: AWS %s:%s", awsKeyID, signature );
-  slist = curl_slist_append(slist, Buf ); 
 
-  snprintf ( Buf, sizeof(Buf), "http://%s/%s", S3Host, resource );
-  curl_easy_setopt ( ch, CURLOPT_HTTPHEADER, slist);
-  curl_easy_setopt ( ch, CURLOPT_URL, Buf );
+  CURL* ch = __s3_request ( "HEAD", resource, NULL, &slist );
   curl_easy_setopt(ch, CURLOPT_NOBODY, 1);
 
   CURLcode  sc  = curl_easy_perform(ch);
-  /** \todo check the return code  */
-  __debug ( "Return Code: %d ", sc );
-  long response_code;
+  long response_code = 0;
+  curl_off_t length = -1;
   curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &response_code);
+  curl_easy_getinfo(ch, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+  __debug ( "Return Code: %d HTTP: %ld", sc, response_code );
   curl_slist_free_all(slist);
   curl_easy_cleanup(ch);
-  if(response_code == 200){
-	printf("FILE EXISTS\n");
-	return 1;
+
+  if ( size )
+    *size = length;
+  return response_code == 200;
+}
+
+/// Reads the data of an upload part from its file
+static size_t part_readfunc ( void * ptr, size_t size, size_t nmemb, void * stream )
+{
+  struct s3_part *p = stream;
+  size_t n = size * nmemb;
+  if ( (int64_t) n > p->length - p->done )
+    n = p->length - p->done;
+  ssize_t r = pread ( p->fd, ptr, n, p->offset + p->done );
+  if ( r < 0 )
+    return CURL_READFUNC_ABORT;
+  p->done += r;
+  return r;
+}
+
+/// Writes the data of a range to its place in the file
+static size_t part_writefunc ( void * ptr, size_t size, size_t nmemb, void * stream )
+{
+  struct s3_part *p = stream;
+  size_t n = size * nmemb;
+  if ( p->done + (int64_t) n > p->length )
+    return 0;
+  if ( pwrite ( p->fd, ptr, n, p->offset + p->done ) != (ssize_t) n )
+    return 0;
+  p->done += n;
+  return n;
+}
+
+/// Keeps the ETag of an upload part
+static size_t part_headerfunc ( char * ptr, size_t size, size_t nmemb, void * stream )
+{
+  struct s3_part *p = stream;
+  size_t n = size * nmemb;
+  if ( n > 5 && !strncasecmp ( ptr, "ETag:", 5 ) ) {
+    char *value = ptr + 5;
+    size_t len = n - 5;
+    while ( len > 0 && isspace((unsigned char) *value) ) { value++; len--; }
+    while ( len > 0 && isspace((unsigned char) value[len-1]) ) len--;
+    if ( len < sizeof(p->etag) ) {
+      memcpy ( p->etag, value, len );
+      p->etag[len] = 0;
+    }
   }
-  else{
-	printf("FILE DOES NOT EXIST\n");
-	return 0;
+  return n;
+}
+
+/// Transfers parts of an object, Concurrency of them at once
+/// \internal
+/// \param uploadId the multipart upload to put the parts in, or NULL to get them as ranges
+/// \return zero if all parts were transferred
+static int __s3_transfer_parts ( struct s3_part *parts, int nparts, const char *resource, const char *uploadId )
+{
+  CURLM *cm = curl_multi_init();
+  int next = 0, active = 0, failed = 0;
+  char Buf[1024];
+
+  while ( active > 0 || ( !failed && next < nparts ) ) {
+    while ( !failed && next < nparts && active < Concurrency ) {
+      struct s3_part *p = &parts[next++];
+      struct curl_slist *slist = NULL;
+      CURL *ch;
+
+      p->done = 0;
+      if ( uploadId ) {
+        buffer_t Q;
+        buffer_init ( &Q );
+        buffer_printf ( &Q, "partNumber=%d&uploadId=", p->number );
+        __uri_encode ( &Q, uploadId, 0 );
+        ch = __s3_request ( "PUT", resource, buffer_tostring(&Q), &slist );
+        buffer_free ( &Q );
+        curl_easy_setopt ( ch, CURLOPT_UPLOAD, 1L );
+        curl_easy_setopt ( ch, CURLOPT_READFUNCTION, part_readfunc );
+        curl_easy_setopt ( ch, CURLOPT_READDATA, p );
+        curl_easy_setopt ( ch, CURLOPT_INFILESIZE_LARGE, (curl_off_t) p->length );
+        curl_easy_setopt ( ch, CURLOPT_HEADERFUNCTION, part_headerfunc );
+        curl_easy_setopt ( ch, CURLOPT_HEADERDATA, p );
+      } else {
+        ch = __s3_request ( "GET", resource, NULL, &slist );
+        snprintf ( Buf, sizeof(Buf), "%" PRId64 "-%" PRId64, p->offset, p->offset + p->length - 1 );
+        curl_easy_setopt ( ch, CURLOPT_RANGE, Buf );
+        curl_easy_setopt ( ch, CURLOPT_WRITEFUNCTION, part_writefunc );
+        curl_easy_setopt ( ch, CURLOPT_WRITEDATA, p );
+      }
+      curl_easy_setopt ( ch, CURLOPT_PRIVATE, slist );
+      curl_multi_add_handle ( cm, ch );
+      active++;
+    }
+
+    int running;
+    curl_multi_perform ( cm, &running );
+
+    CURLMsg *msg;
+    int left;
+    while ( ( msg = curl_multi_info_read ( cm, &left ) ) ) {
+      if ( msg->msg != CURLMSG_DONE )
+        continue;
+      CURL *ch = msg->easy_handle;
+      struct curl_slist *slist;
+      long response_code = 0;
+      curl_easy_getinfo ( ch, CURLINFO_PRIVATE, (char **) &slist );
+      curl_easy_getinfo ( ch, CURLINFO_RESPONSE_CODE, &response_code );
+      __debug ( "Part Return Code: %d HTTP: %ld", msg->data.result, response_code );
+      if ( msg->data.result != CURLE_OK || ( response_code != 200 && response_code != 206 ) )
+        failed = 1;
+      curl_multi_remove_handle ( cm, ch );
+      curl_easy_cleanup ( ch );
+      curl_slist_free_all ( slist );
+      active--;
+    }
+
+    if ( active > 0 )
+      curl_multi_wait ( cm, NULL, 0, 1000, NULL );
   }
+
+  curl_multi_cleanup ( cm );
+
+  int i;
+  for ( i = 0; i < nparts && !failed; i++ ) {
+    if ( parts[i].done != parts[i].length || ( uploadId && !parts[i].etag[0] ) )
+      failed = 1;
+  }
+  return failed;
 }
 
-static char* __aws_sign ( char * const str )
+/// Divides an object into parts of PartSize
+/// \internal
+static struct s3_part * __s3_make_parts ( int fd, int64_t size, int *nparts )
 {
-  HMAC_CTX *ctx;
-  unsigned char MD[256];
-  unsigned len;
+  *nparts = ( size + PartSize - 1 ) / PartSize;
+  struct s3_part *parts = calloc ( *nparts, sizeof(*parts) );
+  int i;
+  for ( i = 0; i < *nparts; i++ ) {
+    parts[i].fd = fd;
+    parts[i].number = i + 1;
+    parts[i].offset = i * PartSize;
+    parts[i].length = ( i == *nparts - 1 ) ? size - parts[i].offset : PartSize;
+  }
+  return parts;
+}
 
-  __debug("StrToSign:%s", str );
+/// Download an object as ranges fetched in parallel
+static int s3_do_get_parts ( FILE *b, const char *resource, int64_t size )
+{
+  int nparts;
+  int fd = fileno(b);
 
-  ctx = HMAC_CTX_new();
-  HMAC_Init(ctx, awsKey, strlen(awsKey), EVP_sha1());
-  HMAC_Update(ctx,(unsigned char*)str, strlen(str));
-  HMAC_Final(ctx,(unsigned char*)MD,&len);
-  HMAC_CTX_free(ctx);
+  fflush ( b );
+  if ( ftruncate ( fd, size ) < 0 )
+    return 1;
 
-  char * b64 = __b64_encode (MD,len);
-  __debug("Signature:  %s", b64 );
+  struct s3_part *parts = __s3_make_parts ( fd, size, &nparts );
+  int failed = __s3_transfer_parts ( parts, nparts, resource, NULL );
+  free ( parts );
 
-  return b64;
+  if ( !failed )
+    fseeko ( b, 0, SEEK_END );
+  __debug ( "Downloaded %" PRId64 " bytes in %d parts: %s", size, nparts, failed ? "failed" : "ok" );
+  return failed;
 }
 
+/// Sends a request with a body held in memory, and collects the response
+/// \internal
+/// \return the HTTP response code
+static long __s3_request_body ( const char *method, const char *resource, const char *query,
+				const char *body, buffer_t *response )
+{
+  struct curl_slist *slist = NULL;
+  CURL *ch = __s3_request ( method, resource, query, &slist );
+  curl_easy_setopt ( ch, CURLOPT_POSTFIELDS, body ? body : "" );
+  curl_easy_setopt ( ch, CURLOPT_WRITEFUNCTION, bufferfunc );
+  curl_easy_setopt ( ch, CURLOPT_WRITEDATA, response );
+
+  long response_code = 0;
+  int sc = curl_easy_perform ( ch );
+  curl_easy_getinfo ( ch, CURLINFO_RESPONSE_CODE, &response_code );
+  __debug ( "Return Code: %d HTTP: %ld", sc, response_code );
+
+  curl_slist_free_all ( slist );
+  curl_easy_cleanup ( ch );
+  return sc == 0 ? response_code : 0;
+}
+
+/// Upload an object in parts sent in parallel
+static int s3_do_put_multipart ( FILE *b, const char *resource, int64_t size )
+{
+  buffer_t response, query, body;
+  buffer_init ( &response );
+  buffer_init ( &query );
+  buffer_init ( &body );
+  int failed = 1;
+  struct s3_part *parts = NULL;
+  int nparts, i;
+
+  long code = __s3_request_body ( "POST", resource, "uploads=", NULL, &response );
+  const char *start = strstr ( buffer_tostring(&response), "<UploadId>" );
+  const char *end = start ? strstr ( start, "</UploadId>" ) : NULL;
+  if ( code != 200 || !end ) {
+    __debug ( "Could not start multipart upload: %s", buffer_tostring(&response) );
+    goto done;
+  }
+  start += strlen("<UploadId>");
+  char *uploadId = strndup ( start, end - start );
+  __uri_encode ( &query, uploadId, 0 );
+
+  parts = __s3_make_parts ( fileno(b), size, &nparts );
+  failed = __s3_transfer_parts ( parts, nparts, resource, uploadId );
+
+  buffer_rewind ( &response, 0 );
+  if ( !failed ) {
+    buffer_printf ( &body, "<CompleteMultipartUpload>" );
+    for ( i = 0; i < nparts; i++ )
+      buffer_printf ( &body, "<Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>", parts[i].number, parts[i].etag );
+    buffer_printf ( &body, "</CompleteMultipartUpload>" );
+
+    char *q = string_format ( "uploadId=%s", buffer_tostring(&query) );
+    code = __s3_request_body ( "POST", resource, q, buffer_tostring(&body), &response );
+    /// The completion may fail after the response has started, with an error in its body
+    failed = code != 200 || strstr ( buffer_tostring(&response), "<Error>" );
+    free ( q );
+  }
+
+  if ( failed ) {
+    __debug ( "Aborting multipart upload %s", uploadId );
+    char *q = string_format ( "uploadId=%s", buffer_tostring(&query) );
+    __s3_request_body ( "DELETE", resource, q, NULL, &response );
+    free ( q );
+  }
 
+  __debug ( "Uploaded %" PRId64 " bytes in %d parts: %s", size, nparts, failed ? "failed" : "ok" );
+  free ( uploadId );
 
+done:
+  free ( parts );
+  buffer_free ( &response );
+  buffer_free ( &query );
+  buffer_free ( &body );
+  return failed;
+}
@@ -6,6 +6,8 @@
  *
  */
 
+#include <stdint.h>
+#include <stdio.h>
 
 void aws_init ();
 void aws_set_key ( char * const str );
@@ -20,3 +22,6 @@ int s3_check ( char * const file );
 void s3_set_host ( char * const str );
 void s3_set_mime ( char * const str );
 void s3_set_acl ( char * const str );
+void s3_set_region ( char * const str );
+void s3_set_part_size ( int64_t size );
+void s3_set_concurrency ( int n );
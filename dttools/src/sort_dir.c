@@ -12,6 +12,37 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 
+/*
+Merge sort the entries, passing the comparison along as an argument.
+(qsort hands its comparison pointers to the array elements, so calling
+a string comparison from it would need the function kept in a global.)
+*/
+
+static void sort_dir_merge(char **list, char **scratch, size_t n, int (*sort)(const char *a, const char *b))
+{
+	if (n < 2)
+		return;
+
+	size_t half = n / 2;
+	sort_dir_merge(list, scratch, half, sort);
+	sort_dir_merge(list + half, scratch, n - half, sort);
+
+	size_t i = 0, j = half, k = 0;
+	while (i < half && j < n) {
+		if (sort(list[j], list[i]) < 0) {
+			scratch[k++] = list[j++];
+		} else {
+			scratch[k++] = list[i++];
+		}
+	}
+	while (i < half)
+		scratch[k++] = list[i++];
+	while (j < n)
+		scratch[k++] = list[j++];
+
+	memcpy(list, scratch, n * sizeof(char *));
+}
+
 int sort_dir(const char *dirname, char ***list, int (*sort)(const char *a, const char *b))
 {
 	DIR *dir;
@@ -32,8 +63,15 @@ int sort_dir(const char *dirname, char ***list, int (*sort)(const char *a, const
 		return 0;
 	}
 
-	if (sort) {
-		qsort(*list, n, sizeof(char *), (int (*)(const void *, const void *))sort);
+	if (sort && n > 1) {
+		char **scratch = malloc(n * sizeof(char *));
+		if (!scratch) {
+			sort_dir_free(*list);
+			*list = 0;
+			return 0;
+		}
+		sort_dir_merge(*list, scratch, n, sort);
+		free(scratch);
 	}
 
 	return 1;
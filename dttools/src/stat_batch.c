@@ -0,0 +1,330 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "stat_batch.h"
+#include "hash_table.h"
+#include "macros.h"
+#include "xxmalloc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Default number of threads, enough to hide the latency of a shared filesystem. */
+#define STAT_BATCH_DEFAULT_THREADS 16
+
+/* List a directory instead of looking up its files one by one, when at least this many are wanted. */
+#define STAT_BATCH_LISTING_MIN 16
+
+/*
+Listing a directory costs about as much as a stat for every this many entries,
+which are estimated from the size of the directory at this many bytes each.
+*/
+#define STAT_BATCH_ENTRIES_PER_STAT 100
+#define STAT_BATCH_BYTES_PER_ENTRY 32
+
+struct stat_group {
+	char *dir;
+	int count;
+	DIR *listing;
+	struct hash_table *names;
+};
+
+struct stat_entry {
+	char *path;
+	const char *name;
+	struct stat_group *group;
+	int want_attributes;
+	int result;
+	struct stat info;
+};
+
+struct stat_batch {
+	int nthreads;
+	struct hash_table *entries;
+	struct stat_entry **pending;
+	int pending_count;
+	int pending_capacity;
+
+	/* Shared by the threads of a run. */
+	pthread_mutex_t mutex;
+	int next;
+};
+
+struct stat_batch *stat_batch_create(int nthreads)
+{
+	struct stat_batch *b = xxcalloc(1, sizeof(*b));
+	b->nthreads = nthreads > 0 ? nthreads : STAT_BATCH_DEFAULT_THREADS;
+	b->entries = hash_table_create(0, 0);
+	pthread_mutex_init(&b->mutex, 0);
+	return b;
+}
+
+void stat_batch_delete(struct stat_batch *b)
+{
+	char *key;
+	struct stat_entry *e;
+
+	if (!b)
+		return;
+
+	hash_table_firstkey(b->entries);
+	while (hash_table_nextkey(b->entries, &key, (void **)&e)) {
+		free(e->path);
+		free(e);
+	}
+	hash_table_delete(b->entries);
+	free(b->pending);
+	pthread_mutex_destroy(&b->mutex);
+	free(b);
+}
+
+void stat_batch_add(struct stat_batch *b, const char *path, int want_attributes)
+{
+	struct stat_entry *e = hash_table_lookup(b->entries, path);
+
+	if (e) {
+		e->want_attributes |= want_attributes;
+		if (e->result != EAGAIN) {
+			/* Already looked up, so look it up again on the next run. */
+			e->result = EAGAIN;
+		} else {
+			return;
+		}
+	} else {
+		e = xxcalloc(1, sizeof(*e));
+		e->path = xxstrdup(path);
+		e->want_attributes = want_attributes;
+		e->result = EAGAIN;
+		hash_table_insert(b->entries, path, e);
+	}
+
+	if (b->pending_count >= b->pending_capacity) {
+		b->pending_capacity = MAX(64, b->pending_capacity * 2);
+		b->pending = xxrealloc(b->pending, b->pending_capacity * sizeof(*b->pending));
+	}
+	b->pending[b->pending_count++] = e;
+}
+
+/* Call fn on items 0..count-1, spread over the threads of the batch. */
+
+struct stat_batch_work {
+	struct stat_batch *b;
+	void **items;
+	int count;
+	void (*fn)(void *item);
+};
+
+static void *stat_batch_worker(void *arg)
+{
+	struct stat_batch_work *w = arg;
+
+	while (1) {
+		pthread_mutex_lock(&w->b->mutex);
+		int i = w->b->next++;
+		pthread_mutex_unlock(&w->b->mutex);
+
+		if (i >= w->count)
+			break;
+		w->fn(w->items[i]);
+	}
+
+	return 0;
+}
+
+static void stat_batch_parallel(struct stat_batch *b, void **items, int count, void (*fn)(void *item))
+{
+	struct stat_batch_work w = {b, items, count, fn};
+	int nthreads = MIN(b->nthreads, count);
+	int i;
+
+	b->next = 0;
+
+	if (nthreads <= 1) {
+		stat_batch_worker(&w);
+		return;
+	}
+
+	pthread_t *threads = xxmalloc(nthreads * sizeof(*threads));
+	int started = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[started], 0, stat_batch_worker, &w) == 0)
+			started++;
+	}
+
+	/* If no thread could be started, do the work here instead. */
+	if (started == 0)
+		stat_batch_worker(&w);
+
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], 0);
+	}
+
+	free(threads);
+}
+
+/* Read the names in a directory, with their types when the filesystem provides them. */
+
+static void stat_group_list(void *item)
+{
+	struct stat_group *g = item;
+	struct dirent *d;
+	struct stat info;
+
+	/* Don't read a huge directory to find a few files in it. */
+	if (stat(g->dir, &info) < 0)
+		return;
+	if (info.st_size / STAT_BATCH_BYTES_PER_ENTRY > (off_t)g->count * STAT_BATCH_ENTRIES_PER_STAT)
+		return;
+
+	g->listing = opendir(g->dir);
+	if (!g->listing)
+		return;
+
+	g->names = hash_table_create(g->count * 2, 0);
+	while ((d = readdir(g->listing))) {
+		hash_table_insert(g->names, d->d_name, (void *)(intptr_t)(d->d_type + 1));
+	}
+}
+
+static int stat_entry_name_valid(const char *name)
+{
+	return name[0] && strcmp(name, ".") && strcmp(name, "..");
+}
+
+static void stat_entry_lookup(void *item)
+{
+	struct stat_entry *e = item;
+	struct stat_group *g = e->group;
+	int result;
+
+	if (!g->names || !stat_entry_name_valid(e->name)) {
+		result = stat(e->path, &e->info);
+	} else {
+		intptr_t type = (intptr_t)hash_table_lookup(g->names, e->name);
+		if (!type) {
+			e->result = ENOENT;
+			return;
+		}
+		type--;
+
+		if (!e->want_attributes && type != DT_UNKNOWN && type != DT_LNK) {
+			/* The listing alone says what this is. */
+			memset(&e->info, 0, sizeof(e->info));
+			e->info.st_mode = DTTOIF(type);
+			result = 0;
+		} else {
+			result = fstatat(dirfd(g->listing), e->name, &e->info, 0);
+		}
+	}
+
+	e->result = result == 0 ? 0 : errno;
+}
+
+void stat_batch_run(struct stat_batch *b)
+{
+	struct hash_table *groups_by_dir = hash_table_create(0, 0);
+	struct stat_group **groups = 0;
+	struct stat_group **listed = 0;
+	int ngroups = 0;
+	int nlisted = 0;
+	int i;
+
+	if (b->pending_count == 0) {
+		hash_table_delete(groups_by_dir);
+		return;
+	}
+
+	/* Group the pending paths by directory. */
+	groups = xxmalloc(b->pending_count * sizeof(*groups));
+
+	for (i = 0; i < b->pending_count; i++) {
+		struct stat_entry *e = b->pending[i];
+		const char *slash = strrchr(e->path, '/');
+		char *dir;
+
+		if (!slash) {
+			dir = xxstrdup(".");
+			e->name = e->path;
+		} else if (slash == e->path) {
+			dir = xxstrdup("/");
+			e->name = slash + 1;
+		} else {
+			dir = xxstrdup(e->path);
+			dir[slash - e->path] = 0;
+			e->name = slash + 1;
+		}
+
+		struct stat_group *g = hash_table_lookup(groups_by_dir, dir);
+		if (!g) {
+			g = xxcalloc(1, sizeof(*g));
+			g->dir = dir;
+			hash_table_insert(groups_by_dir, dir, g);
+			groups[ngroups++] = g;
+		} else {
+			free(dir);
+		}
+
+		g->count++;
+		e->group = g;
+	}
+
+	/* List the directories from which many files are wanted, then look up every path. */
+	listed = xxmalloc(ngroups * sizeof(*listed));
+	for (i = 0; i < ngroups; i++) {
+		if (groups[i]->count >= STAT_BATCH_LISTING_MIN)
+			listed[nlisted++] = groups[i];
+	}
+
+	stat_batch_parallel(b, (void **)listed, nlisted, stat_group_list);
+	stat_batch_parallel(b, (void **)b->pending, b->pending_count, stat_entry_lookup);
+
+	for (i = 0; i < b->pending_count; i++) {
+		b->pending[i]->group = 0;
+		b->pending[i]->name = 0;
+	}
+	b->pending_count = 0;
+
+	for (i = 0; i < ngroups; i++) {
+		struct stat_group *g = groups[i];
+		if (g->listing)
+			closedir(g->listing);
+		if (g->names)
+			hash_table_delete(g->names);
+		free(g->dir);
+		free(g);
+	}
+
+	free(listed);
+	free(groups);
+	hash_table_delete(groups_by_dir);
+}
+
+int stat_batch_lookup(struct stat_batch *b, const char *path, struct stat *info)
+{
+	struct stat_entry *e = hash_table_lookup(b->entries, path);
+
+	if (!e) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (e->result) {
+		errno = e->result;
+		return -1;
+	}
+
+	*info = e->info;
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,77 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef STAT_BATCH_H
+#define STAT_BATCH_H
+
+#include <sys/stat.h>
+
+/** @file stat_batch.h Look up many files at once.
+On a shared filesystem, each call to stat may take several milliseconds,
+so checking a large number of files one at a time is very slow.
+A stat batch collects the paths to check, and then looks them all up at once
+with a pool of threads.  Paths are grouped by directory: when many of the
+files in a directory are wanted, the directory is listed once, so that files
+that are missing, and files whose attributes are not wanted, are answered
+from the listing without a stat of their own.
+
+<pre>
+struct stat_batch *b = stat_batch_create(16);
+
+stat_batch_add(b, "data/a.txt", 1);
+stat_batch_add(b, "data/b.txt", 0);
+stat_batch_run(b);
+
+if(stat_batch_lookup(b, "data/a.txt", &info) == 0) {
+	printf("a.txt has %d bytes\n", (int) info.st_size);
+}
+
+stat_batch_delete(b);
+</pre>
+*/
+
+/** Create a new stat batch.
+@param nthreads The number of threads used to look up files. If zero, a default value is used.
+@return A pointer to a new stat batch.
+*/
+
+struct stat_batch *stat_batch_create(int nthreads);
+
+/** Delete a stat batch and all of its results.
+@param b The stat batch to delete.
+*/
+
+void stat_batch_delete(struct stat_batch *b);
+
+/** Add a path to be looked up by the next @ref stat_batch_run.
+A path that was already looked up is looked up again by the next run.
+@param b The stat batch.
+@param path The path to look up.
+@param want_attributes If true, all of the fields of the stat structure are wanted.
+If false, only the existence and the type (S_IFMT bits of st_mode) of the file are wanted,
+which may be answered without a stat.
+*/
+
+void stat_batch_add(struct stat_batch *b, const char *path, int want_attributes);
+
+/** Look up all of the paths added since the last run.
+@param b The stat batch.
+*/
+
+void stat_batch_run(struct stat_batch *b);
+
+/** Get the result of looking up a path.
+@param b The stat batch.
+@param path The path, which must have been added and run.
+@param info The stat structure to fill in. If the path was added without
+want_attributes, only the type in st_mode is valid.
+@return Zero on success, or -1 with errno set if the path does not exist.
+If the path was not looked up by a run, errno is EAGAIN.
+*/
+
+int stat_batch_lookup(struct stat_batch *b, const char *path, struct stat *info);
+
+#endif
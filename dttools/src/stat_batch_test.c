@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "stat_batch.h"
+#include "stringtools.h"
+#include "unlink_recursive.h"
+#include "test_fail.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NFILES 100
+
+/* Compare every result of the batch with a plain stat of the same path. */
+
+static int check(struct stat_batch *b, const char *path, int want_attributes)
+{
+	struct stat expected, actual;
+
+	int expected_result = stat(path, &expected);
+	int expected_errno = errno;
+	int actual_result = stat_batch_lookup(b, path, &actual);
+	int actual_errno = errno;
+
+	if (expected_result != actual_result)
+		FAIL("%s: stat returned %d but stat_batch returned %d", path, expected_result, actual_result);
+	if (expected_result < 0 && expected_errno != actual_errno)
+		FAIL("%s: stat failed with %d but stat_batch failed with %d", path, expected_errno, actual_errno);
+	if (expected_result < 0)
+		return 0;
+	if ((expected.st_mode & S_IFMT) != (actual.st_mode & S_IFMT))
+		FAIL("%s: file types differ", path);
+	if (want_attributes && (expected.st_size != actual.st_size || expected.st_mtime != actual.st_mtime || expected.st_ino != actual.st_ino))
+		FAIL("%s: attributes differ", path);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "stat_batch_test.XXXXXX";
+	int i;
+
+	if (!mkdtemp(dir))
+		FAIL("couldn't create %s", dir);
+
+	char *sub = string_format("%s/sub", dir);
+	mkdir(sub, 0777);
+
+	/* Even files exist, with a size equal to their number. */
+	for (i = 0; i < NFILES; i += 2) {
+		char *path = string_format("%s/file.%d", dir, i);
+		int fd = open(path, O_CREAT | O_WRONLY, 0666);
+		if (fd < 0 || ftruncate(fd, i) < 0)
+			FAIL("couldn't create %s", path);
+		close(fd);
+		free(path);
+	}
+
+	char *link = string_format("%s/link", dir);
+	char *dangling = string_format("%s/dangling", dir);
+	symlink("file.0", link);
+	symlink("missing", dangling);
+
+	const char *others[] = {link, dangling, sub, "stat_batch_test.c", "missing", "/", "./", 0};
+
+	struct stat_batch *b = stat_batch_create(4);
+
+	int want_attributes;
+	for (want_attributes = 0; want_attributes <= 1; want_attributes++) {
+		for (i = 0; i < NFILES; i++) {
+			char *path = string_format("%s/file.%d", dir, i);
+			stat_batch_add(b, path, want_attributes);
+			free(path);
+		}
+		for (i = 0; others[i]; i++) {
+			stat_batch_add(b, others[i], want_attributes);
+		}
+
+		stat_batch_run(b);
+
+		for (i = 0; i < NFILES; i++) {
+			char *path = string_format("%s/file.%d", dir, i);
+			if (check(b, path, want_attributes))
+				return 1;
+			free(path);
+		}
+		for (i = 0; others[i]; i++) {
+			if (check(b, others[i], want_attributes))
+				return 1;
+		}
+	}
+
+	/* A path that was never added is not found. */
+	struct stat info;
+	if (stat_batch_lookup(b, "never/added", &info) == 0)
+		FAIL("found a path that was never added");
+
+	/* A path added again is looked up again. */
+	char *first = string_format("%s/file.1", dir);
+	int fd = open(first, O_CREAT | O_WRONLY, 0666);
+	close(fd);
+	stat_batch_add(b, first, 1);
+	stat_batch_run(b);
+	if (stat_batch_lookup(b, first, &info) < 0)
+		FAIL("%s was not looked up again", first);
+
+	stat_batch_delete(b);
+	unlink_recursive(dir);
+
+	printf("stat_batch tests passed\n");
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
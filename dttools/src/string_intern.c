@@ -0,0 +1,127 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "string_intern.h"
+#include "debug.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Each interned string is stored once, following its reference count,
+in a chained hash table private to this module.  The pool is shared by
+all threads, so every access holds string_intern_mutex.
+*/
+
+struct string_intern_entry {
+	struct string_intern_entry *next;
+	unsigned hash;
+	int refcount;
+	char string[1];
+};
+
+#define STRING_INTERN_ENTRY(s) ((struct string_intern_entry *)((s) - offsetof(struct string_intern_entry, string)))
+
+static struct string_intern_entry **buckets = 0;
+static int bucket_count = 0;
+static int entry_count = 0;
+static pthread_mutex_t string_intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void string_intern_grow(void)
+{
+	int new_count = bucket_count ? bucket_count * 2 : 1024;
+	struct string_intern_entry **new_buckets = xxcalloc(new_count, sizeof(*new_buckets));
+
+	int i;
+	for (i = 0; i < bucket_count; i++) {
+		struct string_intern_entry *e = buckets[i];
+		while (e) {
+			struct string_intern_entry *next = e->next;
+			int index = e->hash % new_count;
+			e->next = new_buckets[index];
+			new_buckets[index] = e;
+			e = next;
+		}
+	}
+
+	free(buckets);
+	buckets = new_buckets;
+	bucket_count = new_count;
+}
+
+const char *string_intern(const char *s)
+{
+	unsigned hash = hash_string(s);
+
+	pthread_mutex_lock(&string_intern_mutex);
+
+	if (entry_count >= bucket_count)
+		string_intern_grow();
+
+	int index = hash % bucket_count;
+
+	struct string_intern_entry *e;
+	for (e = buckets[index]; e; e = e->next) {
+		if (e->hash == hash && (e->string == s || !strcmp(e->string, s))) {
+			e->refcount++;
+			pthread_mutex_unlock(&string_intern_mutex);
+			return e->string;
+		}
+	}
+
+	size_t length = strlen(s);
+	e = xxmalloc(sizeof(*e) + length);
+	memcpy(e->string, s, length + 1);
+	e->hash = hash;
+	e->refcount = 1;
+	e->next = buckets[index];
+	buckets[index] = e;
+	entry_count++;
+
+	pthread_mutex_unlock(&string_intern_mutex);
+
+	return e->string;
+}
+
+void string_intern_release(const char *s)
+{
+	if (!s)
+		return;
+
+	struct string_intern_entry *e = STRING_INTERN_ENTRY(s);
+
+	pthread_mutex_lock(&string_intern_mutex);
+
+	if (--e->refcount > 0) {
+		pthread_mutex_unlock(&string_intern_mutex);
+		return;
+	}
+
+	struct string_intern_entry **p = &buckets[e->hash % bucket_count];
+	while (*p && *p != e)
+		p = &(*p)->next;
+
+	if (!*p)
+		fatal("string_intern_release: %s is not an interned string", s);
+
+	*p = e->next;
+	free(e);
+	entry_count--;
+
+	pthread_mutex_unlock(&string_intern_mutex);
+}
+
+int string_intern_count(void)
+{
+	pthread_mutex_lock(&string_intern_mutex);
+	int count = entry_count;
+	pthread_mutex_unlock(&string_intern_mutex);
+	return count;
+}
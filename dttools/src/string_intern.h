@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef STRING_INTERN_H
+#define STRING_INTERN_H
+
+/** @file string_intern.h A pool of shared, reference-counted strings.
+Interning a string returns a single shared copy for all equal strings,
+so that a string repeated in many places is stored only once, and two
+interned strings are equal exactly when their pointers are equal.
+Each call to @ref string_intern must be matched by a call to
+@ref string_intern_release, and the shared copy is freed when the last
+reference is released.  The pool is shared by all threads of the process,
+and may be used from any of them.
+<pre>
+const char *a = string_intern("file-md5-1234");
+const char *b = string_intern("file-md5-1234");
+assert(a == b);
+string_intern_release(a);
+string_intern_release(b);
+</pre>
+*/
+
+/** Obtain the shared copy of a string, and add a reference to it.
+@param s The string to intern, which may itself be an interned string.
+@return The shared copy of the string, which must not be modified.
+*/
+
+const char *string_intern(const char *s);
+
+/** Release a reference to an interned string.
+@param s A string returned by @ref string_intern, or null.
+*/
+
+void string_intern_release(const char *s);
+
+/** Count the distinct strings currently interned.
+@return The number of distinct strings in the pool.
+*/
+
+int string_intern_count(void);
+
+#endif
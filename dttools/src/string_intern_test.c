@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "hash_table.h"
+#include "string_intern.h"
+#include "test_fail.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREADS 4
+
+static void *intern_many(void *arg)
+{
+	char buffer[32];
+	int i;
+
+	for (i = 0; i < 100000; i++) {
+		sprintf(buffer, "shared-%d", i % 100);
+		string_intern_release(string_intern(buffer));
+		const char *s = string_intern(buffer);
+		sprintf(buffer, "thread-%ld-%d", (long)arg, i % 100);
+		string_intern_release(string_intern(buffer));
+		string_intern_release(s);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char buffer[32];
+
+	/* Equal strings share a single copy. */
+	strcpy(buffer, "file-md5-1234");
+	const char *a = string_intern(buffer);
+	const char *b = string_intern("file-md5-1234");
+	if (a != b || a == buffer)
+		FAIL("equal strings were not interned to the same copy");
+	if (string_intern(a) != a)
+		FAIL("interning an interned string gave a different copy");
+	if (string_intern_count() != 1)
+		FAIL("expected 1 interned string, found %d", string_intern_count());
+
+	/* The copy lives until its last reference is released. */
+	string_intern_release(a);
+	string_intern_release(a);
+	if (strcmp(b, "file-md5-1234") || string_intern_count() != 1)
+		FAIL("interned string released too early");
+	string_intern_release(b);
+	if (string_intern_count() != 0)
+		FAIL("expected 0 interned strings, found %d", string_intern_count());
+
+	/* Interned tables share their keys, also as they grow. */
+	struct hash_table *h = hash_table_create_interned(0, 0);
+	struct hash_table *g = hash_table_create_interned(0, 0);
+
+	int i;
+	for (i = 0; i < 1000; i++) {
+		sprintf(buffer, "key-%d", i);
+		hash_table_insert(h, buffer, (void *)(long)(i + 1));
+		hash_table_insert(g, buffer, (void *)(long)(i + 1));
+	}
+	if (string_intern_count() != 1000)
+		FAIL("expected 1000 interned keys, found %d", string_intern_count());
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(buffer, "key-%d", i);
+		if (hash_table_lookup(h, buffer) != (void *)(long)(i + 1))
+			FAIL("wrong value for %s", buffer);
+	}
+
+	for (i = 0; i < 500; i++) {
+		sprintf(buffer, "key-%d", i);
+		hash_table_remove(h, buffer);
+		hash_table_remove(g, buffer);
+	}
+	if (hash_table_size(h) != 500 || string_intern_count() != 500)
+		FAIL("expected 500 entries and keys, found %d and %d", hash_table_size(h), string_intern_count());
+
+	hash_table_delete(h);
+	if (string_intern_count() != 500)
+		FAIL("keys still in use were released");
+	hash_table_delete(g);
+	if (string_intern_count() != 0)
+		FAIL("expected 0 interned keys, found %d", string_intern_count());
+
+	/* Threads may intern and release the same strings at once. */
+	pthread_t threads[THREADS];
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], 0, intern_many, (void *)(long)i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], 0);
+	if (string_intern_count() != 0)
+		FAIL("expected 0 interned strings after the threads, found %d", string_intern_count());
+
+	fprintf(stdout, "string interning is correct\n");
+	return 0;
+}
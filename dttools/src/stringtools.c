@@ -565,6 +565,109 @@ char *string_subst(char *value, string_subst_lookup_t lookup, void *arg)
 	}
 }
 
+/*
+The string_next_* functions decode the space separated protocol messages
+exchanged by managers and workers.  Delimiters are located with strspn and
+strcspn, which the C library implements with vector instructions, and numbers
+are converted directly rather than through sscanf, which must interpret its
+format string and skip whitespace character by character on every call.
+*/
+
+#define STRING_FIELD_SEPARATORS " \t\r\n"
+
+int string_next_slice(const char **s, const char **start, size_t *length)
+{
+	const char *p = *s;
+
+	p += strspn(p, STRING_FIELD_SEPARATORS);
+
+	size_t n = strcspn(p, STRING_FIELD_SEPARATORS);
+	if (n == 0)
+		return 0;
+
+	*start = p;
+	*length = n;
+	*s = p + n;
+	return 1;
+}
+
+int string_next_word(const char **s, char *word, size_t length)
+{
+	const char *p = *s;
+	const char *start;
+	size_t n;
+
+	if (!string_next_slice(&p, &start, &n) || n >= length)
+		return 0;
+
+	memcpy(word, start, n);
+	word[n] = 0;
+
+	*s = p;
+	return 1;
+}
+
+static int string_next_number(const char **s, int base, int64_t *value)
+{
+	const char *p = *s;
+	int negative = 0;
+	uint64_t v = 0;
+
+	p += strspn(p, STRING_FIELD_SEPARATORS);
+
+	if (*p == '-' || *p == '+') {
+		negative = (*p == '-');
+		p++;
+	}
+
+	const char *digits = p;
+	while ((unsigned)(*p - '0') < (unsigned)base) {
+		unsigned digit = *p - '0';
+		if (v > (UINT64_MAX - digit) / base)
+			return 0;
+		v = v * base + digit;
+		p++;
+	}
+
+	if (p == digits)
+		return 0;
+
+	if (v > (uint64_t)INT64_MAX + negative)
+		return 0;
+
+	*value = negative ? (int64_t)(0 - v) : (int64_t)v;
+	*s = p;
+	return 1;
+}
+
+int string_next_int64(const char **s, int64_t *value)
+{
+	return string_next_number(s, 10, value);
+}
+
+int string_next_int(const char **s, int *value)
+{
+	int64_t v;
+	if (!string_next_number(s, 10, &v))
+		return 0;
+	*value = (int)v;
+	return 1;
+}
+
+int string_next_octal(const char **s, int *value)
+{
+	int64_t v;
+	if (!string_next_number(s, 8, &v))
+		return 0;
+	*value = (int)v;
+	return 1;
+}
+
+int string_slice_is(const char *start, size_t length, const char *word)
+{
+	return strlen(word) == length && !memcmp(start, word, length);
+}
+
 int string_prefix_is(const char *string, const char *prefix)
 {
 	size_t n;
@@ -73,6 +73,44 @@ char *string_pad_left(char *str, int length);
 void string_cookie(char *str, int length);
 char *string_subst(char *value, string_subst_lookup_t lookup, void *arg);
 int string_prefix_is(const char *string, const char *prefix);
+
+/** Find the next field of a space separated protocol message.
+Leading spaces are skipped, the field is located without copying it,
+and <tt>*s</tt> is advanced just past it.
+@param s Pointer to the current position in the message, updated on success.
+@param start Set to the first character of the field.
+@param length Set to the number of characters in the field.
+@return One if a field was found, zero at the end of the message.
+*/
+int string_next_slice(const char **s, const char **start, size_t *length);
+
+/** Copy the next space separated field of a message into a buffer.
+@param s Pointer to the current position in the message, updated on success.
+@param word Buffer to receive the null terminated field.
+@param length Size of the buffer.
+@return One on success, zero if there is no field or it does not fit in the buffer.
+*/
+int string_next_word(const char **s, char *word, size_t length);
+
+/** Parse the next field of a message as a signed decimal integer.
+@param s Pointer to the current position in the message, updated on success.
+@param value Set to the parsed value.
+@return One on success, zero if the next field does not begin with a number.
+*/
+int string_next_int64(const char **s, int64_t *value);
+
+/** Parse the next field of a message as a signed decimal int.
+@see string_next_int64 */
+int string_next_int(const char **s, int *value);
+
+/** Parse the next field of a message as an octal number, such as a file mode.
+@see string_next_int64 */
+int string_next_octal(const char **s, int *value);
+
+/** Compare a slice returned by @ref string_next_slice against a word.
+@return True if the slice is exactly equal to the word.
+*/
+int string_slice_is(const char *start, size_t length, const char *word);
 int string_suffix_is(const char *string, const char *suffix);
 
 /** Appends second to first, both null terminated strings. Returns the new
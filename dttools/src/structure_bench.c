@@ -0,0 +1,623 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Microbenchmarks of the data structures and primitives that the
+TaskVine manager and worker lean on, with keys shaped like the ones
+they actually use: cached names of files, hash keys of links, and
+sequential task ids.  Results can be written as JSON and compared
+against a stored baseline, so that a proposed change to a data
+structure can be measured on the same machine before and after.
+*/
+
+#include "hash_table.h"
+#include "itable.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "link.h"
+#include "list.h"
+#include "macros.h"
+#include "md5.h"
+#include "set.h"
+#include "stringtools.h"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct result {
+	int64_t ops;   /* Operations timed. */
+	int64_t bytes; /* Bytes processed, for benchmarks of throughput. */
+	int64_t nsecs; /* Time of the timed operations. */
+};
+
+struct benchmark {
+	const char *name;
+	void (*run)(struct result *r);
+};
+
+static double scale = 1.0;
+static int nkeys = 0;
+static char **cachenames = 0;
+static char **linkkeys = 0;
+
+static int64_t now_nsecs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define TIMED(r, body)                                  \
+	do {                                            \
+		int64_t timed_start_ = now_nsecs();     \
+		body;                                   \
+		(r)->nsecs = now_nsecs() - timed_start_; \
+	} while (0)
+
+/*
+Cached names follow the forms made by the manager: content hashes of
+files and urls, and random names of temporary files.
+*/
+
+static void random_hex(char *s, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		s[i] = "0123456789abcdef"[random() % 16];
+	}
+	s[n] = 0;
+}
+
+static void random_lower(char *s, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		s[i] = 'a' + random() % 26;
+	}
+	s[n] = 0;
+}
+
+static void make_keys(void)
+{
+	char text[64];
+	int i;
+
+	nkeys = MAX(1000, (int)(200000 * scale));
+	cachenames = malloc(nkeys * sizeof(char *));
+	linkkeys = malloc(nkeys * sizeof(char *));
+
+	srandom(42);
+
+	for (i = 0; i < nkeys; i++) {
+		int kind = random() % 10;
+		if (kind < 6) {
+			random_hex(text, 32);
+			cachenames[i] = string_format("file-meta-%s", text);
+		} else if (kind < 8) {
+			random_hex(text, 32);
+			cachenames[i] = string_format("url-%s", text);
+		} else {
+			random_lower(text, 20);
+			cachenames[i] = string_format("temp-rnd-%s", text);
+		}
+
+		/* Links are keyed by the printed address of the link structure. */
+		linkkeys[i] = string_format("0x%" PRIxPTR, (uintptr_t)0x55d0c0a4b000 + (uintptr_t)i * 0x1a0);
+	}
+}
+
+static void bench_hash_insert(struct result *r)
+{
+	struct hash_table *h = hash_table_create(0, 0);
+	int i;
+	TIMED(r, for (i = 0; i < nkeys; i++) hash_table_insert(h, cachenames[i], cachenames[i]));
+	r->ops = nkeys;
+	hash_table_delete(h);
+}
+
+static struct hash_table *filled_table(char **keys)
+{
+	struct hash_table *h = hash_table_create(0, 0);
+	int i;
+	for (i = 0; i < nkeys; i++) {
+		hash_table_insert(h, keys[i], keys[i]);
+	}
+	return h;
+}
+
+static void bench_hash_lookup(struct result *r)
+{
+	struct hash_table *h = filled_table(cachenames);
+	int64_t found = 0;
+	int i;
+	TIMED(r, for (i = 0; i < nkeys; i++) found += hash_table_lookup(h, cachenames[(i * 7919) % nkeys]) != 0);
+	r->ops = found;
+	hash_table_delete(h);
+}
+
+static void bench_hash_lookup_miss(struct result *r)
+{
+	struct hash_table *h = filled_table(cachenames);
+	char **misses = malloc(nkeys * sizeof(char *));
+	int i;
+	for (i = 0; i < nkeys; i++) {
+		misses[i] = string_format("%s-x", cachenames[i]);
+	}
+	int64_t found = 0;
+	TIMED(r, for (i = 0; i < nkeys; i++) found += hash_table_lookup(h, misses[i]) != 0);
+	r->ops = nkeys - found;
+	for (i = 0; i < nkeys; i++) {
+		free(misses[i]);
+	}
+	free(misses);
+	hash_table_delete(h);
+}
+
+static void bench_hash_remove(struct result *r)
+{
+	struct hash_table *h = filled_table(cachenames);
+	int i;
+	TIMED(r, for (i = 0; i < nkeys; i++) hash_table_remove(h, cachenames[i]));
+	r->ops = nkeys;
+	hash_table_delete(h);
+}
+
+static void bench_hash_iterate(struct result *r)
+{
+	struct hash_table *h = filled_table(cachenames);
+	char *key;
+	void *value;
+	int64_t count = 0;
+	TIMED(r, HASH_TABLE_ITERATE(h, key, value) { count++; });
+	r->ops = count;
+	hash_table_delete(h);
+}
+
+static void bench_hash_lookup_linkkey(struct result *r)
+{
+	struct hash_table *h = filled_table(linkkeys);
+	int64_t found = 0;
+	int i;
+	TIMED(r, for (i = 0; i < nkeys; i++) found += hash_table_lookup(h, linkkeys[(i * 7919) % nkeys]) != 0);
+	r->ops = found;
+	hash_table_delete(h);
+}
+
+static void bench_itable_insert(struct result *r)
+{
+	struct itable *t = itable_create(0);
+	int i;
+	TIMED(r, for (i = 1; i <= nkeys; i++) itable_insert(t, i, cachenames[i - 1]));
+	r->ops = nkeys;
+	itable_delete(t);
+}
+
+static void bench_itable_lookup(struct result *r)
+{
+	struct itable *t = itable_create(0);
+	int64_t found = 0;
+	int i;
+	for (i = 1; i <= nkeys; i++) {
+		itable_insert(t, i, cachenames[i - 1]);
+	}
+	TIMED(r, for (i = 0; i < nkeys; i++) found += itable_lookup(t, 1 + (i * 7919) % nkeys) != 0);
+	r->ops = found;
+	itable_delete(t);
+}
+
+static void bench_itable_remove(struct result *r)
+{
+	struct itable *t = itable_create(0);
+	int i;
+	for (i = 1; i <= nkeys; i++) {
+		itable_insert(t, i, cachenames[i - 1]);
+	}
+	TIMED(r, for (i = 1; i <= nkeys; i++) itable_remove(t, i));
+	r->ops = nkeys;
+	itable_delete(t);
+}
+
+static void bench_list_push_pop(struct result *r)
+{
+	struct list *l = list_create();
+	int i;
+	TIMED(r, {
+		for (i = 0; i < nkeys; i++)
+			list_push_tail(l, cachenames[i]);
+		while (list_pop_head(l)) {
+		}
+	});
+	r->ops = 2 * (int64_t)nkeys;
+	list_delete(l);
+}
+
+static void bench_list_iterate(struct result *r)
+{
+	struct list *l = list_create();
+	int i;
+	for (i = 0; i < nkeys; i++) {
+		list_push_tail(l, cachenames[i]);
+	}
+	char *item;
+	int64_t count = 0;
+	TIMED(r, LIST_ITERATE(l, item) { count++; });
+	r->ops = count;
+	while (list_pop_head(l)) {
+	}
+	list_delete(l);
+}
+
+/*
+The ready list of the manager is kept in order of priority,
+with a few thousand tasks and most priorities equal.
+*/
+
+static double item_priority(void *item)
+{
+	return *(double *)item;
+}
+
+static void bench_list_push_priority(struct result *r)
+{
+	struct list *l = list_create();
+	int depth = 2000;
+	int ops = MAX(1000, nkeys / 20);
+	double *priorities = malloc((depth + ops) * sizeof(double));
+	int i;
+
+	for (i = 0; i < depth + ops; i++) {
+		priorities[i] = random() % 4;
+	}
+
+	for (i = 0; i < depth; i++) {
+		list_push_priority(l, item_priority, &priorities[i]);
+	}
+
+	TIMED(r, for (i = 0; i < ops; i++) {
+		list_push_priority(l, item_priority, &priorities[depth + i]);
+		list_pop_head(l);
+	});
+
+	r->ops = ops;
+	while (list_pop_head(l)) {
+	}
+	list_delete(l);
+	free(priorities);
+}
+
+static void bench_set_insert(struct result *r)
+{
+	struct set *s = set_create(0);
+	int i;
+	TIMED(r, for (i = 0; i < nkeys; i++) set_insert(s, cachenames[i]));
+	r->ops = nkeys;
+	set_delete(s);
+}
+
+static void bench_set_lookup(struct result *r)
+{
+	struct set *s = set_create(0);
+	int64_t found = 0;
+	int i;
+	for (i = 0; i < nkeys; i++) {
+		set_insert(s, cachenames[i]);
+	}
+	TIMED(r, for (i = 0; i < nkeys; i++) found += set_lookup(s, cachenames[(i * 7919) % nkeys]));
+	r->ops = found;
+	set_delete(s);
+}
+
+/* A task as described in the status of the manager. */
+
+static const char *task_json =
+		"{\"task_id\":1234,\"state\":\"RUNNING\",\"category\":\"analysis\",\"command\":\"python3 process.py --input data.txt --output out.txt\","
+		"\"worker\":\"worker-432222e74b0fb335d7cf0c04780282bb\",\"addrport\":\"10.32.79.143:48268\",\"priority\":1.5,"
+		"\"cores\":1,\"memory\":800,\"disk\":500,\"gpus\":0,\"time_when_submitted\":1792051377627836,\"time_when_commit_start\":1792051377643138,"
+		"\"input_files\":[\"file-meta-fe5c964fd600d082b765c867e89ecb69\",\"url-63931245c04801e364edebd46bf2e801\"],"
+		"\"output_files\":[\"temp-rnd-weerogjyifkwyvuabcde\"],\"env\":{\"OMP_NUM_THREADS\":\"1\",\"PATH\":\"/usr/bin:/bin\"}}";
+
+static void bench_jx_parse(struct result *r)
+{
+	int ops = MAX(1000, nkeys / 10);
+	int i;
+	TIMED(r, for (i = 0; i < ops; i++) jx_delete(jx_parse_string(task_json)));
+	r->ops = ops;
+	r->bytes = (int64_t)ops * strlen(task_json);
+}
+
+static void bench_jx_print(struct result *r)
+{
+	struct jx *j = jx_parse_string(task_json);
+	int ops = MAX(1000, nkeys / 10);
+	int64_t bytes = 0;
+	int i;
+	TIMED(r, for (i = 0; i < ops; i++) {
+		char *s = jx_print_string(j);
+		bytes += strlen(s);
+		free(s);
+	});
+	r->ops = ops;
+	r->bytes = bytes;
+	jx_delete(j);
+}
+
+static void bench_md5(struct result *r)
+{
+	int length = 1 << 20;
+	int ops = MAX(4, (int)(64 * scale));
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	char *data = malloc(length);
+	int i;
+
+	for (i = 0; i < length; i++) {
+		data[i] = random();
+	}
+
+	TIMED(r, for (i = 0; i < ops; i++) md5_buffer(data, length, digest));
+	r->ops = ops;
+	r->bytes = (int64_t)ops * length;
+	free(data);
+}
+
+/*
+Throughput of a link over the loopback interface, to a child process
+that reads everything and then acknowledges with a single byte.
+*/
+
+static void bench_link_loopback(struct result *r)
+{
+	int chunk = 64 * 1024;
+	int64_t total = MAX(4, (int64_t)(256 * scale)) * 1024 * 1024;
+	char *data = calloc(1, chunk);
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+
+	struct link *server = link_serve_address("127.0.0.1", 0);
+	if (!server || !link_address_local(server, addr, &port)) {
+		fprintf(stderr, "structure_bench: could not listen on loopback\n");
+		exit(1);
+	}
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		struct link *l = link_accept(server, time(0) + 60);
+		int64_t got = 0;
+		while (l && got < total) {
+			ssize_t n = link_read(l, data, chunk, time(0) + 60);
+			if (n <= 0)
+				_exit(1);
+			got += n;
+		}
+		link_write(l, "", 1, time(0) + 60);
+		link_close(l);
+		_exit(0);
+	}
+
+	struct link *l = link_connect(addr, port, time(0) + 60);
+	if (!l) {
+		fprintf(stderr, "structure_bench: could not connect over loopback\n");
+		exit(1);
+	}
+
+	int64_t sent = 0;
+	char ack;
+	TIMED(r, {
+		while (sent < total) {
+			if (link_write(l, data, chunk, time(0) + 60) != chunk)
+				break;
+			sent += chunk;
+		}
+		link_read(l, &ack, 1, time(0) + 60);
+	});
+
+	r->ops = sent / chunk;
+	r->bytes = sent;
+
+	link_close(l);
+	link_close(server);
+	waitpid(pid, 0, 0);
+	free(data);
+}
+
+static struct benchmark benchmarks[] = {
+		{"hash_table_insert", bench_hash_insert},
+		{"hash_table_lookup", bench_hash_lookup},
+		{"hash_table_lookup_miss", bench_hash_lookup_miss},
+		{"hash_table_lookup_linkkey", bench_hash_lookup_linkkey},
+		{"hash_table_remove", bench_hash_remove},
+		{"hash_table_iterate", bench_hash_iterate},
+		{"itable_insert", bench_itable_insert},
+		{"itable_lookup", bench_itable_lookup},
+		{"itable_remove", bench_itable_remove},
+		{"list_push_pop", bench_list_push_pop},
+		{"list_iterate", bench_list_iterate},
+		{"list_push_priority", bench_list_push_priority},
+		{"set_insert", bench_set_insert},
+		{"set_lookup", bench_set_lookup},
+		{"jx_parse", bench_jx_parse},
+		{"jx_print", bench_jx_print},
+		{"md5", bench_md5},
+		{"link_loopback", bench_link_loopback},
+		{0, 0},
+};
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [options]\n", cmd);
+	printf("Run microbenchmarks of the dttools data structures.\n");
+	printf(" %-20s Multiply the size of each benchmark by this factor. (default: 1.0)\n", "-n <scale>");
+	printf(" %-20s Run each benchmark this many times and keep the fastest. (default: 3)\n", "-r <runs>");
+	printf(" %-20s Run only the benchmarks whose name contains this string.\n", "-f <filter>");
+	printf(" %-20s Print the results as JSON.\n", "-j");
+	printf(" %-20s Write the results as JSON to this file, for use as a baseline.\n", "-w <file>");
+	printf(" %-20s Compare the results against this baseline.\n", "-b <file>");
+	printf(" %-20s Percent slowdown against the baseline counted as a regression. (default: 10)\n", "-t <percent>");
+	printf(" %-20s List the benchmarks and exit.\n", "-l");
+	printf(" %-20s Show this help screen.\n", "-h");
+}
+
+int main(int argc, char *argv[])
+{
+	int runs = 3;
+	const char *filter = 0;
+	int json = 0;
+	const char *write_file = 0;
+	const char *baseline_file = 0;
+	double threshold = 10;
+	struct benchmark *b;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:r:f:jw:b:t:lh")) != -1) {
+		switch (c) {
+		case 'n':
+			scale = atof(optarg);
+			break;
+		case 'r':
+			runs = MAX(1, atoi(optarg));
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'w':
+			write_file = optarg;
+			break;
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'l':
+			for (b = benchmarks; b->name; b++) {
+				printf("%s\n", b->name);
+			}
+			return 0;
+		case 'h':
+		default:
+			show_help(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	struct jx *baseline = 0;
+	if (baseline_file) {
+		baseline = jx_parse_file(baseline_file);
+		if (!jx_istype(baseline, JX_OBJECT)) {
+			fprintf(stderr, "structure_bench: could not read baseline %s\n", baseline_file);
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	make_keys();
+
+	struct jx *results = jx_object(0);
+	int regressions = 0;
+
+	if (!json) {
+		printf("%-26s %12s %12s %10s", "BENCHMARK", "OPS", "NS/OP", "MB/S");
+		if (baseline) {
+			printf(" %12s %8s", "BASELINE", "CHANGE");
+		}
+		printf("\n");
+	}
+
+	for (b = benchmarks; b->name; b++) {
+		if (filter && !strstr(b->name, filter)) {
+			continue;
+		}
+
+		struct result best = {0, 0, 0};
+		int i;
+		for (i = 0; i < runs; i++) {
+			struct result r = {0, 0, 0};
+			b->run(&r);
+			if (i == 0 || r.nsecs < best.nsecs) {
+				best = r;
+			}
+		}
+
+		double ns_per_op = best.ops > 0 ? (double)best.nsecs / best.ops : 0;
+		double mb_per_s = best.bytes > 0 && best.nsecs > 0 ? (best.bytes / 1e6) / (best.nsecs / 1e9) : 0;
+
+		struct jx *j = jx_object(0);
+		jx_insert_integer(j, "ops", best.ops);
+		jx_insert_double(j, "ns_per_op", ns_per_op);
+		if (best.bytes > 0) {
+			jx_insert_double(j, "mb_per_s", mb_per_s);
+		}
+		jx_insert(results, jx_string(b->name), j);
+
+		double base = 0;
+		struct jx *bj = baseline ? jx_lookup(baseline, b->name) : 0;
+		if (bj) {
+			base = jx_lookup_double(bj, "ns_per_op");
+		}
+
+		double change = base > 0 ? 100.0 * (ns_per_op - base) / base : 0;
+		int regressed = base > 0 && change > threshold;
+		regressions += regressed;
+
+		if (bj) {
+			jx_insert_double(j, "baseline_ns_per_op", base);
+			jx_insert_double(j, "change_percent", change);
+		}
+
+		if (!json) {
+			printf("%-26s %12" PRId64 " %12.1f", b->name, best.ops, ns_per_op);
+			if (best.bytes > 0) {
+				printf(" %10.1f", mb_per_s);
+			} else {
+				printf(" %10s", "-");
+			}
+			if (bj) {
+				printf(" %12.1f %+7.1f%%%s", base, change, regressed ? " REGRESSION" : "");
+			} else if (baseline) {
+				printf(" %12s %8s", "-", "-");
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+
+	if (json) {
+		jx_print_stream(results, stdout);
+		printf("\n");
+	}
+
+	if (write_file) {
+		FILE *file = fopen(write_file, "w");
+		if (!file) {
+			fprintf(stderr, "structure_bench: could not write %s\n", write_file);
+			return 1;
+		}
+		jx_print_stream(results, file);
+		fprintf(file, "\n");
+		fclose(file);
+	}
+
+	if (baseline && !json) {
+		printf("%d regressions of more than %.0f%% against %s\n", regressions, threshold, baseline_file);
+	}
+
+	jx_delete(results);
+	jx_delete(baseline);
+
+	return regressions > 0 ? 2 : 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
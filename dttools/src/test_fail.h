@@ -0,0 +1,23 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef TEST_FAIL_H
+#define TEST_FAIL_H
+
+/** @file test_fail.h
+Failure reporting shared by the unit test programs.
+This header is not installed.
+*/
+
+#include <stdio.h>
+
+/** Print a message in printf format and return 1 from the calling function,
+which is normally the main function of the test program.
+*/
+
+#define FAIL(...) do { fprintf(stdout, __VA_ARGS__); fprintf(stdout, "\n"); return 1; } while(0)
+
+#endif
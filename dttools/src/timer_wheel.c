@@ -0,0 +1,231 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "timer_wheel.h"
+#include "itable.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+
+/*
+The wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots each.
+A timer due within 64 ticks sits in the level 0 slot for its exact tick,
+a timer due within 64^2 ticks sits in the level 1 slot covering its group of
+64 ticks, and so on.  Each time the level 0 index wraps, the next level 1
+slot is cascaded down into level 0, and likewise up the hierarchy.  Timers
+beyond the range of the top level are kept in its last slot and re-placed
+as the wheel reaches them.  Expired timers are moved to a separate due list
+from which they are popped one at a time.
+*/
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_DUE (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+
+struct timer_wheel_entry {
+	uint64_t id;
+	void *data;
+	uint64_t expires;
+	int slot;
+	struct timer_wheel_entry *prev;
+	struct timer_wheel_entry *next;
+};
+
+struct timer_wheel {
+	timestamp_t resolution;
+	uint64_t current; /* The next tick to be processed. */
+	struct itable *entries;
+	struct timer_wheel_entry *heads[TIMER_WHEEL_DUE + 1];
+	struct timer_wheel_entry *tails[TIMER_WHEEL_DUE + 1];
+};
+
+struct timer_wheel *timer_wheel_create(timestamp_t now, timestamp_t resolution)
+{
+	struct timer_wheel *w = xxcalloc(1, sizeof(*w));
+	w->resolution = resolution > 0 ? resolution : 1;
+	w->current = now / w->resolution;
+	w->entries = itable_create(0);
+	return w;
+}
+
+void timer_wheel_delete(struct timer_wheel *w)
+{
+	if (!w)
+		return;
+
+	uint64_t id;
+	struct timer_wheel_entry *e;
+	ITABLE_ITERATE(w->entries, id, e)
+	{
+		free(e);
+	}
+
+	itable_delete(w->entries);
+	free(w);
+}
+
+int timer_wheel_size(struct timer_wheel *w)
+{
+	return itable_size(w->entries);
+}
+
+static void slot_append(struct timer_wheel *w, int slot, struct timer_wheel_entry *e)
+{
+	e->slot = slot;
+	e->next = 0;
+	e->prev = w->tails[slot];
+	if (e->prev) {
+		e->prev->next = e;
+	} else {
+		w->heads[slot] = e;
+	}
+	w->tails[slot] = e;
+}
+
+static void slot_unlink(struct timer_wheel *w, struct timer_wheel_entry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		w->heads[e->slot] = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		w->tails[e->slot] = e->prev;
+	}
+	e->prev = e->next = 0;
+}
+
+static void place(struct timer_wheel *w, struct timer_wheel_entry *e)
+{
+	if (e->expires < w->current) {
+		slot_append(w, TIMER_WHEEL_DUE, e);
+		return;
+	}
+
+	uint64_t delta = e->expires - w->current;
+	uint64_t expires = e->expires;
+	int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ull << (TIMER_WHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	uint64_t range = 1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+	if (delta >= range) {
+		expires = w->current + range - 1;
+	}
+
+	int index = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	slot_append(w, level * TIMER_WHEEL_SLOTS + index, e);
+}
+
+/* Move the timers of one slot at a higher level down to their place relative to the current tick. */
+
+static int cascade(struct timer_wheel *w, int level)
+{
+	int index = (w->current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	int slot = level * TIMER_WHEEL_SLOTS + index;
+
+	struct timer_wheel_entry *e = w->heads[slot];
+	w->heads[slot] = w->tails[slot] = 0;
+
+	while (e) {
+		struct timer_wheel_entry *next = e->next;
+		place(w, e);
+		e = next;
+	}
+
+	return index;
+}
+
+static void advance(struct timer_wheel *w, uint64_t target)
+{
+	if (itable_size(w->entries) == 0) {
+		if (target >= w->current) {
+			w->current = target + 1;
+		}
+		return;
+	}
+
+	while (w->current <= target) {
+		int index = w->current & TIMER_WHEEL_MASK;
+
+		if (index == 0) {
+			int level;
+			for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+				if (cascade(w, level) != 0) {
+					break;
+				}
+			}
+		}
+
+		struct timer_wheel_entry *e = w->heads[index];
+		w->heads[index] = w->tails[index] = 0;
+
+		while (e) {
+			struct timer_wheel_entry *next = e->next;
+			slot_append(w, TIMER_WHEEL_DUE, e);
+			e = next;
+		}
+
+		w->current++;
+	}
+}
+
+void timer_wheel_insert(struct timer_wheel *w, uint64_t id, timestamp_t deadline, void *data)
+{
+	struct timer_wheel_entry *e = itable_lookup(w->entries, id);
+
+	if (e) {
+		slot_unlink(w, e);
+	} else {
+		e = xxcalloc(1, sizeof(*e));
+		e->id = id;
+		itable_insert(w->entries, id, e);
+	}
+
+	e->data = data;
+	e->expires = (deadline + w->resolution - 1) / w->resolution;
+	place(w, e);
+}
+
+int timer_wheel_remove(struct timer_wheel *w, uint64_t id)
+{
+	struct timer_wheel_entry *e = itable_remove(w->entries, id);
+	if (!e)
+		return 0;
+
+	slot_unlink(w, e);
+	free(e);
+	return 1;
+}
+
+int timer_wheel_pop_expired(struct timer_wheel *w, timestamp_t now, uint64_t *id, void **data)
+{
+	if (!w->heads[TIMER_WHEEL_DUE]) {
+		advance(w, now / w->resolution);
+	}
+
+	struct timer_wheel_entry *e = w->heads[TIMER_WHEEL_DUE];
+	if (!e)
+		return 0;
+
+	slot_unlink(w, e);
+	itable_remove(w->entries, e->id);
+
+	*id = e->id;
+	*data = e->data;
+	free(e);
+	return 1;
+}
+
+/* vim: set noexpandtab tabstop=8: */
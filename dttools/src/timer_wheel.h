@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/** @file timer_wheel.h A hierarchical timer wheel.
+A timer wheel holds a large number of timers, each named by an integer id,
+and finds the expired ones in time proportional to the number expired,
+rather than to the number of timers outstanding.  Timers may be added,
+moved, and cancelled in constant time.  Deadlines are rounded up to the
+resolution of the wheel, so a timer never fires early, but may fire up to
+one resolution late.  For example, to expire tasks whose deadlines have passed:
+
+<pre>
+struct timer_wheel *w = timer_wheel_create(timestamp_get(), 100000);
+
+timer_wheel_insert(w, task_id, deadline, task);
+...
+uint64_t id;
+void *data;
+while(timer_wheel_pop_expired(w, timestamp_get(), &id, &data)) {
+	expire_task(data);
+}
+</pre>
+
+It is safe to insert and remove timers between calls to @ref timer_wheel_pop_expired.
+*/
+
+#include "timestamp.h"
+
+#include <stdint.h>
+
+/** Create a new timer wheel.
+@param now The current time, in microseconds.
+@param resolution The granularity of the wheel, in microseconds.
+@return A pointer to a new timer wheel.
+*/
+
+struct timer_wheel *timer_wheel_create(timestamp_t now, timestamp_t resolution);
+
+/** Delete a timer wheel.
+Note that this function will not delete the data attached to the timers.
+@param w The timer wheel to delete.
+*/
+
+void timer_wheel_delete(struct timer_wheel *w);
+
+/** Count the timers in a timer wheel.
+@param w A pointer to a timer wheel.
+@return The number of timers outstanding.
+*/
+
+int timer_wheel_size(struct timer_wheel *w);
+
+/** Set a timer.
+If a timer with the same id already exists, it is replaced.
+@param w A pointer to a timer wheel.
+@param id The id of the timer.
+@param deadline The time at which the timer expires, in microseconds.
+@param data A pointer to attach to the timer.
+*/
+
+void timer_wheel_insert(struct timer_wheel *w, uint64_t id, timestamp_t deadline, void *data);
+
+/** Cancel a timer.
+@param w A pointer to a timer wheel.
+@param id The id of the timer.
+@return One if the timer was found and cancelled, zero otherwise.
+*/
+
+int timer_wheel_remove(struct timer_wheel *w, uint64_t id);
+
+/** Remove one expired timer.
+@param w A pointer to a timer wheel.
+@param now The current time, in microseconds.
+@param id Set to the id of the expired timer.
+@param data Set to the data attached to the expired timer.
+@return One if an expired timer was removed, zero if none have expired.
+*/
+
+int timer_wheel_pop_expired(struct timer_wheel *w, timestamp_t now, uint64_t *id, void **data);
+
+#endif
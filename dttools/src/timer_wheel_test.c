@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "timer_wheel.h"
+#include "test_fail.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTIMERS 2000
+#define RESOLUTION 1000
+
+/*
+Drive a wheel with random inserts, moves, and cancellations, across
+deadlines from a few ticks to far beyond the range of the wheel, and
+check each expiration against a plain array of deadlines.
+*/
+
+static uint64_t random64(void)
+{
+	return ((uint64_t)random() << 31) | random();
+}
+
+int main(int argc, char *argv[])
+{
+	static timestamp_t deadline[NTIMERS];
+	static int pending[NTIMERS];
+
+	timestamp_t now = 1700000000ull * 1000000;
+	struct timer_wheel *w = timer_wheel_create(now, RESOLUTION);
+	int outstanding = 0;
+	int fired = 0;
+	int removed = 0;
+	int i;
+
+	srandom(42);
+
+	for (i = 0; i < NTIMERS; i++) {
+		timestamp_t span = (timestamp_t)1 << (random() % 36);
+		deadline[i] = now + random64() % span;
+		pending[i] = 1;
+		timer_wheel_insert(w, i, deadline[i], &deadline[i]);
+		outstanding++;
+	}
+
+	if (timer_wheel_size(w) != outstanding)
+		FAIL("size is %d, expected %d", timer_wheel_size(w), outstanding);
+
+	while (outstanding > 0) {
+		now += random() % (1 << (random() % 30));
+
+		int k;
+		for (k = 0; k < 4; k++) {
+			int action = random() % 4;
+			i = random() % NTIMERS;
+			if (!pending[i]) {
+				continue;
+			} else if (action == 0) {
+				if (!timer_wheel_remove(w, i))
+					FAIL("timer %d could not be removed", i);
+				pending[i] = 0;
+				outstanding--;
+				removed++;
+			} else if (action == 1) {
+				deadline[i] = now + random() % (1 << 28);
+				timer_wheel_insert(w, i, deadline[i], &deadline[i]);
+			}
+		}
+
+		uint64_t id;
+		void *data;
+		while (timer_wheel_pop_expired(w, now, &id, &data)) {
+			if (id >= NTIMERS || !pending[id])
+				FAIL("timer %" PRIu64 " fired but was not pending", id);
+			if (data != &deadline[id])
+				FAIL("timer %" PRIu64 " returned the wrong data", id);
+			if (deadline[id] > now)
+				FAIL("timer %" PRIu64 " fired early", id);
+			pending[id] = 0;
+			outstanding--;
+			fired++;
+		}
+
+		for (i = 0; i < NTIMERS; i++) {
+			if (pending[i] && deadline[i] + RESOLUTION <= now)
+				FAIL("timer %d is late: deadline %" PRIu64 ", now %" PRIu64, i, deadline[i], now);
+		}
+	}
+
+	if (timer_wheel_size(w) != 0)
+		FAIL("size is %d after all timers expired", timer_wheel_size(w));
+	if (timer_wheel_remove(w, 0))
+		FAIL("removed a timer that had already fired");
+
+	timer_wheel_delete(w);
+
+	printf("%d timers fired, %d removed\n", fired, removed);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
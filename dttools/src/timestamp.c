@@ -32,6 +32,17 @@ timestamp_t timestamp_get()
 	return stamp;
 }
 
+timestamp_t timestamp_coarse()
+{
+#ifdef CLOCK_REALTIME_COARSE
+	struct timespec current;
+	if (clock_gettime(CLOCK_REALTIME_COARSE, &current) == 0) {
+		return ((timestamp_t)current.tv_sec) * 1000000 + current.tv_nsec / 1000;
+	}
+#endif
+	return timestamp_get();
+}
+
 int timestamp_fmt(char *buf, size_t size, const char *fmt, timestamp_t ts)
 {
 	time_t tv_sec;
@@ -27,6 +27,15 @@ typedef UINT64_T timestamp_t;
 
 timestamp_t timestamp_get(void);
 
+/** Get the current time cheaply.
+Uses a coarse clock where available, which is read without a system call
+and is only accurate to a few milliseconds.  This is suitable for checking
+timeouts many times per second, but not for measuring short intervals.
+@return The current time, in microseconds since January 1st, 1970.
+*/
+
+timestamp_t timestamp_coarse(void);
+
 /** Formats timestamp_t ts according to the format specification fmt and stores the result as a string in array buf.
 @param buf The array that holds the formatted string.
 @param size The size of array buf.
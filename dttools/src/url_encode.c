@@ -31,18 +31,45 @@ void url_encode(const char *s, char *t, int length)
 	*t = 0;
 }
 
+static int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+Most names carry few or no escapes, so copy each plain run in one step,
+locating the next escape with strcspn, and convert escapes by table
+rather than through sscanf.  A malformed escape is copied literally.
+*/
+
 void url_decode(const char *s, char *t, int length)
 {
 	while (*s && length > 1) {
 		if (*s == '%') {
-			unsigned int x;
-			sscanf(s + 1, "%2x", &x);
-			*t++ = x;
-			s += 3;
+			int hi = hex_value(s[1]);
+			int lo = hi < 0 ? -1 : hex_value(s[2]);
+			if (lo < 0) {
+				*t++ = *s++;
+			} else {
+				*t++ = (hi << 4) | lo;
+				s += 3;
+			}
+			length--;
 		} else {
-			*t++ = *s++;
+			size_t n = strcspn(s, "%");
+			if (n > (size_t)(length - 1))
+				n = length - 1;
+			memcpy(t, s, n);
+			t += n;
+			s += n;
+			length -= n;
 		}
-		length--;
 	}
 	*t = 0;
 }
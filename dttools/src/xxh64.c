@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+This is an implementation of the XXH64 algorithm by Yann Collet, as
+specified at https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+Data is consumed in stripes of 32 bytes by four independent accumulators,
+which lets the processor overlap their multiplications.
+*/
+
+#include "xxh64.h"
+#include "xxmalloc.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define BUFFER_SIZE (1 << 20)
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t v)
+{
+	acc ^= xxh64_round(0, v);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Consume whole stripes of 32 bytes, returning the number of bytes consumed. */
+
+static size_t xxh64_stripes(uint64_t v[4], const uint8_t *p, size_t length)
+{
+	const uint8_t *start = p;
+	const uint8_t *end = p + (length & ~(size_t)31);
+
+	uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+	while (p < end) {
+		v1 = xxh64_round(v1, read64(p));
+		v2 = xxh64_round(v2, read64(p + 8));
+		v3 = xxh64_round(v3, read64(p + 16));
+		v4 = xxh64_round(v4, read64(p + 24));
+		p += 32;
+	}
+	v[0] = v1, v[1] = v2, v[2] = v3, v[3] = v4;
+
+	return p - start;
+}
+
+void xxh64_init(xxh64_context_t *ctx, uint64_t seed)
+{
+	ctx->seed = seed;
+	ctx->v[0] = seed + PRIME64_1 + PRIME64_2;
+	ctx->v[1] = seed + PRIME64_2;
+	ctx->v[2] = seed;
+	ctx->v[3] = seed - PRIME64_1;
+	ctx->total = 0;
+	ctx->used = 0;
+}
+
+void xxh64_update(xxh64_context_t *ctx, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+
+	ctx->total += length;
+
+	if (ctx->used) {
+		size_t n = sizeof(ctx->buffer) - ctx->used;
+		if (length < n) {
+			memcpy(ctx->buffer + ctx->used, p, length);
+			ctx->used += length;
+			return;
+		}
+		memcpy(ctx->buffer + ctx->used, p, n);
+		xxh64_stripes(ctx->v, ctx->buffer, sizeof(ctx->buffer));
+		p += n;
+		length -= n;
+		ctx->used = 0;
+	}
+
+	size_t n = xxh64_stripes(ctx->v, p, length);
+	memcpy(ctx->buffer, p + n, length - n);
+	ctx->used = length - n;
+}
+
+uint64_t xxh64_final(xxh64_context_t *ctx)
+{
+	const uint8_t *p = ctx->buffer;
+	const uint8_t *end = p + ctx->used;
+	uint64_t h;
+
+	if (ctx->total >= 32) {
+		uint64_t *v = ctx->v;
+		h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+		h = xxh64_merge(h, v[0]);
+		h = xxh64_merge(h, v[1]);
+		h = xxh64_merge(h, v[2]);
+		h = xxh64_merge(h, v[3]);
+	} else {
+		h = ctx->seed + PRIME64_5;
+	}
+
+	h += ctx->total;
+
+	while (p + 8 <= end) {
+		h ^= xxh64_round(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t xxh64_buffer(const void *data, size_t length, uint64_t seed)
+{
+	xxh64_context_t ctx;
+	xxh64_init(&ctx, seed);
+	xxh64_update(&ctx, data, length);
+	return xxh64_final(&ctx);
+}
+
+int xxh64_file(const char *path, uint64_t *hash)
+{
+	struct stat info;
+	xxh64_context_t ctx;
+	xxh64_init(&ctx, 0);
+
+	int fd = open(path, O_RDONLY | O_NOCTTY);
+	if (fd == -1)
+		return 0;
+
+	if (fstat(fd, &info) == -1) {
+		close(fd);
+		return 0;
+	}
+
+	void *data = info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (data == MAP_FAILED) {
+		void *buffer = xxmalloc(BUFFER_SIZE);
+		ssize_t n;
+		while ((n = read(fd, buffer, BUFFER_SIZE)) > 0) {
+			xxh64_update(&ctx, buffer, n);
+		}
+		free(buffer);
+		close(fd);
+		if (n < 0)
+			return 0;
+	} else {
+		close(fd);
+		posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+		xxh64_update(&ctx, data, info.st_size);
+		munmap(data, info.st_size);
+	}
+
+	*hash = xxh64_final(&ctx);
+	return 1;
+}
+
+const char *xxh64_to_string(uint64_t hash)
+{
+	static char str[XXH64_DIGEST_LENGTH_HEX + 1];
+	snprintf(str, sizeof(str), "%016" PRIx64, hash);
+	return str;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef XXH64_H
+#define XXH64_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** @file xxh64.h
+Routines for computing the XXH64 hash, a fast non-cryptographic hash of content.
+XXH64 runs many times faster than @ref md5.h or @ref sha1.h, and is suitable
+for detecting changes to data or naming data that is not supplied by an adversary.
+It must not be used where a collision could be constructed deliberately.
+The results are identical to those of the reference xxHash implementation.
+*/
+
+#define XXH64_DIGEST_LENGTH_HEX 16
+
+typedef struct {
+	uint64_t v[4];
+	uint64_t seed;
+	uint64_t total;
+	uint8_t buffer[32];
+	size_t used;
+} xxh64_context_t;
+
+/** Begin hashing data in pieces.
+@param ctx The context to initialize.
+@param seed A seed that gives a different family of hashes, usually zero.
+*/
+void xxh64_init(xxh64_context_t *ctx, uint64_t seed);
+
+/** Hash the next piece of data.
+@param ctx A context from @ref xxh64_init.
+@param data Pointer to the data.
+@param length Length of the data in bytes.
+*/
+void xxh64_update(xxh64_context_t *ctx, const void *data, size_t length);
+
+/** Finish hashing data in pieces.
+@param ctx A context from @ref xxh64_init.
+@return The hash of all the data given to @ref xxh64_update.
+*/
+uint64_t xxh64_final(xxh64_context_t *ctx);
+
+/** Hash a memory buffer.
+@param data Pointer to a memory buffer.
+@param length Length of the buffer in bytes.
+@param seed A seed that gives a different family of hashes, usually zero.
+@return The hash of the buffer.
+*/
+uint64_t xxh64_buffer(const void *data, size_t length, uint64_t seed);
+
+/** Hash a local file with a seed of zero.
+@param path Path to the file to hash.
+@param hash Set to the hash of the contents of the file.
+@return One on success, zero on failure.
+*/
+int xxh64_file(const char *path, uint64_t *hash);
+
+/** Convert a hash into a printable string.
+@param hash A hash from @ref xxh64_buffer or @ref xxh64_file.
+@returns A static pointer to the hash as sixteen hexadecimal digits.
+*/
+const char *xxh64_to_string(uint64_t hash);
+
+#endif
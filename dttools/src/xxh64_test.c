@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "xxh64.h"
+#include "test_fail.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Hashes computed by the reference xxHash library. */
+
+static const struct {
+	const char *text;
+	uint64_t seed;
+	uint64_t hash;
+} strings[] = {
+	{"", 0, 0xef46db3751d8e999ULL},
+	{"abc", 0, 0x44bc2cf5ad770999ULL},
+	{"The quick brown fox jumps over the lazy dog", 0, 0x0b242d361fda71bcULL},
+	{"The quick brown fox jumps over the lazy dog", 12345, 0xd1b38ddc85a6fba1ULL},
+};
+
+/* Hashes of the first length bytes of the pattern (i*7+3)&255, with seed zero. */
+
+static const struct {
+	size_t length;
+	uint64_t hash;
+} patterns[] = {
+	{1, 0x1f25c8d0bc1f4bb6ULL},
+	{4, 0x9bb64b7d66ee9fdaULL},
+	{7, 0x9a7b149959ce60d8ULL},
+	{8, 0xdab99d95c6f90092ULL},
+	{31, 0xa2aa5f33cc4a6119ULL},
+	{32, 0x23c3c17ef790fd97ULL},
+	{33, 0x50a7cfc7ba588784ULL},
+	{63, 0x5e3e54b431c7493cULL},
+	{64, 0x0eb64b3ef6eeb01fULL},
+	{100, 0xa61f8d4c170fe531ULL},
+	{1000, 0x5f235fa033f1a3fbULL},
+};
+
+int main(int argc, char **argv)
+{
+	unsigned char data[1000];
+	size_t i, j;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (i * 7 + 3) & 255;
+
+	for (i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+		uint64_t h = xxh64_buffer(strings[i].text, strlen(strings[i].text), strings[i].seed);
+		if (h != strings[i].hash)
+			FAIL("hash of '%s' was %016" PRIx64 " instead of %016" PRIx64, strings[i].text, h, strings[i].hash);
+	}
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		size_t length = patterns[i].length;
+		uint64_t h = xxh64_buffer(data, length, 0);
+		if (h != patterns[i].hash)
+			FAIL("hash of %zu bytes was %016" PRIx64 " instead of %016" PRIx64, length, h, patterns[i].hash);
+
+		/* The same data given in pieces of every size gives the same hash. */
+		for (j = 1; j <= length; j++) {
+			xxh64_context_t ctx;
+			size_t offset;
+			xxh64_init(&ctx, 0);
+			for (offset = 0; offset < length; offset += j) {
+				size_t n = length - offset < j ? length - offset : j;
+				xxh64_update(&ctx, data + offset, n);
+			}
+			h = xxh64_final(&ctx);
+			if (h != patterns[i].hash)
+				FAIL("hash of %zu bytes in pieces of %zu was %016" PRIx64, length, j, h);
+		}
+	}
+
+	char path[] = "xxh64_test.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || write(fd, data, sizeof(data)) != sizeof(data))
+		FAIL("couldn't write %s", path);
+	close(fd);
+
+	uint64_t h;
+	int ok = xxh64_file(path, &h);
+	unlink(path);
+	if (!ok || h != 0x5f235fa033f1a3fbULL)
+		FAIL("hash of file was %016" PRIx64, h);
+
+	if (strcmp(xxh64_to_string(0x0b242d361fda71bcULL), "0b242d361fda71bc"))
+		FAIL("hash string was %s", xxh64_to_string(0x0b242d361fda71bcULL));
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="data_struct_priority_queue.test"
+
+prepare()
+{
+	${CC} -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "priority_queue.h"
+
+int main(int argc, char **argv)
+{
+  uintptr_t N = 1000;
+  uintptr_t i;
+
+  /* start small so that the queue is forced to grow. */
+  struct priority_queue *pq = priority_queue_create(2);
+  assert( priority_queue_size(pq) == 0 );
+  assert( priority_queue_pop(pq) == NULL );
+  assert( priority_queue_peek_top(pq) == NULL );
+
+  /* insert items in a scrambled order, using the item as its own priority. */
+  for(i = 0; i < N; i++) {
+	uintptr_t item = ((i * 7919) % N) + 1;
+	assert( priority_queue_push(pq, (void *) item, (double) item) );
+  }
+  assert( priority_queue_size(pq) == N );
+  assert( priority_queue_peek_top(pq) == (void *) N );
+  assert( priority_queue_get_top_priority(pq) == (double) N );
+
+  /* remove a few arbitrary items. */
+  assert( priority_queue_remove(pq, (void *) N) );
+  assert( priority_queue_remove(pq, (void *) 500) );
+  assert( priority_queue_remove(pq, (void *) 1) );
+  assert( !priority_queue_remove(pq, (void *) 500) );
+  assert( priority_queue_size(pq) == N - 3 );
+
+  /* iteration visits every remaining item exactly once. */
+  int index;
+  void *data;
+  uintptr_t sum = 0;
+  PRIORITY_QUEUE_ITERATE(pq, index, data) {
+	sum += (uintptr_t) data;
+  }
+  assert( sum == (N * (N + 1)) / 2 - N - 500 - 1 );
+
+  /* items come out in decreasing order of priority. */
+  uintptr_t last = N;
+  uintptr_t count = 0;
+  while( (data = priority_queue_pop(pq)) ) {
+	assert( (uintptr_t) data < last );
+	last = (uintptr_t) data;
+	count++;
+  }
+  assert( count == N - 3 );
+  assert( last == 2 );
+
+  priority_queue_delete(pq);
+
+  return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
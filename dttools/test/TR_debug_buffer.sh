@@ -0,0 +1,22 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	return 0
+}
+
+run()
+{
+	../src/debug_buffer_test
+}
+
+clean()
+{
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
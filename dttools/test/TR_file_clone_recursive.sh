@@ -0,0 +1,57 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="file_clone_recursive.test"
+source="file_clone_recursive.source"
+target="file_clone_recursive.target"
+
+prepare()
+{
+	mkdir -p "$source/sub/deeper"
+	echo one > "$source/one"
+	echo two > "$source/sub/two"
+	echo three > "$source/sub/deeper/three"
+	ln -s one "$source/link"
+
+	${CC} -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none -I ../src ../src/libdttools.a -lm <<EOF
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "file_link_recursive.h"
+
+int main (int argc, char *argv[])
+{
+	if (!file_clone_recursive(argv[1], argv[2], 1)) {
+		fprintf(stderr, "could not clone %s to %s\n", argv[1], argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe" "$source" "$target" || return 1
+
+	# Whether cloned or linked, the target must have the same contents.
+	diff -r "$source" "$target" || return 1
+
+	[ -L "$target/link" ] || return 1
+
+	return 0
+}
+
+clean()
+{
+	rm -f "$exe"
+	rm -rf "$source" "$target"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,68 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="sort_dir.test"
+dir="sort_dir.dir"
+
+prepare()
+{
+	mkdir -p "$dir"
+	for name in zeta alpha mu beta omega gamma; do
+		touch "$dir/$name"
+	done
+
+	${CC} -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none -I ../src ../src/libdttools.a -lm <<EOF
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort_dir.h"
+
+int main (int argc, char *argv[])
+{
+	const char *expected[] = {".", "..", "alpha", "beta", "gamma", "mu", "omega", "zeta", 0};
+	char **list;
+	int i;
+
+	if (!sort_dir("$dir", &list, strcmp)) {
+		fprintf(stderr, "could not list $dir\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; expected[i]; i++) {
+		if (!list[i] || strcmp(list[i], expected[i])) {
+			fprintf(stderr, "entry %d is %s, expected %s\n", i, list[i] ? list[i] : "(end)", expected[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (list[i]) {
+		fprintf(stderr, "unexpected entry %s\n", list[i]);
+		return EXIT_FAILURE;
+	}
+
+	sort_dir_free(list);
+
+	return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	rm -rf "$dir"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -8,6 +8,7 @@ prepare()
 {
 	${CC} -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none -I ../src ../src/libdttools.a -lm <<EOF
 #include "stringtools.h"
+#include "url_encode.h"
 
 #include <inttypes.h>
 #include <math.h>
@@ -85,6 +86,51 @@ void t_string_escape_condor (void)
 	a_streql(string_escape_condor("\\"test 'var'\\""), "\\"\\"\\"test '''var'''\\"\\" \\"");
 }
 
+void t_string_next (void)
+{
+	const char *s = "puturl  file%20a -42 0755 9223372036854775807 x";
+	const char *start;
+	size_t length;
+	char word[16];
+	int64_t v;
+	int i;
+
+	a_int64eql(string_next_slice(&s, &start, &length), 1);
+	a_int64eql(string_slice_is(start, length, "puturl"), 1);
+	a_int64eql(string_slice_is(start, length, "put"), 0);
+	a_int64eql(string_next_word(&s, word, sizeof(word)), 1);
+	a_streql(word, "file%20a");
+	a_int64eql(string_next_int(&s, &i), 1);
+	a_int64eql(i, -42);
+	a_int64eql(string_next_octal(&s, &i), 1);
+	a_int64eql(i, 0755);
+	a_int64eql(string_next_int64(&s, &v), 1);
+	a_int64eql(v, INT64_MAX);
+	a_int64eql(string_next_int64(&s, &v), 0);
+	a_int64eql(string_next_word(&s, word, sizeof(word)), 1);
+	a_streql(word, "x");
+	a_int64eql(string_next_word(&s, word, sizeof(word)), 0);
+
+	s = "a_word_that_is_too_long";
+	a_int64eql(string_next_word(&s, word, sizeof(word)), 0);
+	s = "99999999999999999999";
+	a_int64eql(string_next_int64(&s, &v), 0);
+}
+
+void t_url_decode (void)
+{
+	char t[16];
+
+	url_decode("Let%27s%20go", t, sizeof(t));
+	a_streql(t, "Let's go");
+	url_decode("100%", t, sizeof(t));
+	a_streql(t, "100%");
+	url_decode("%zz%4", t, sizeof(t));
+	a_streql(t, "%zz%4");
+	url_decode("abcdefghijklmnopqrstuvwxyz", t, 8);
+	a_streql(t, "abcdefg");
+}
+
 int main (int argc, char *argv[])
 {
 	t_string_metric();
@@ -92,6 +138,8 @@ int main (int argc, char *argv[])
 	t_string_time_parse();
 	t_string_escape_shell();
 	t_string_escape_condor();
+	t_string_next();
+	t_url_decode();
 
 	return 0;
 }
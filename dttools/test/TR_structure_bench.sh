@@ -0,0 +1,30 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+baseline=structure_bench.baseline.json
+
+prepare()
+{
+	rm -f "$baseline"
+	return 0
+}
+
+run()
+{
+	# Timings at this scale are noise, so only check that a baseline
+	# can be written and compared against, not the numbers themselves.
+	../src/structure_bench -n 0.02 -r 1 -w "$baseline" || return 1
+	../src/structure_bench -n 0.02 -r 1 -b "$baseline" -t 1000000 || return 1
+	../src/structure_bench -n 0.02 -r 1 -f hash_table -j | grep -q '"hash_table_lookup"'
+}
+
+clean()
+{
+	rm -f "$baseline"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
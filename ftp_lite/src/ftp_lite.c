@@ -17,6 +17,7 @@ See the file COPYING for details.
 #include "stringtools.h"
 #include "debug.h"
 #include "full_io.h"
+#include "macros.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -29,6 +30,7 @@ See the file COPYING for details.
 #include <ctype.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/types.h>
 
 int ftp_lite_data_channel_authentication = 0;
@@ -85,6 +87,7 @@ static int ftp_lite_send_command( struct ftp_lite_server *s, const char *fmt, ..
 {
 	char buffer[FTP_LITE_LINE_MAX];
 	va_list args;
+	int result;
 
 	va_start(args,fmt);
 	vsprintf(buffer,fmt,args);
@@ -98,13 +101,18 @@ static int ftp_lite_send_command( struct ftp_lite_server *s, const char *fmt, ..
 
 	switch(s->authtype) {
 		case PLAIN:
-			return ftp_lite_send_command_raw(s,buffer);
+			result = ftp_lite_send_command_raw(s,buffer);
+			break;
 		case GLOBUS_GSS:
-			return ftp_lite_send_command_gss(s,buffer);
+			result = ftp_lite_send_command_gss(s,buffer);
+			break;
 		default:
 			errno = ENOTSUP;
 			return 0;
 	}
+
+	if(!result) s->broken = 1;
+	return result;
 }
 
 static int ftp_lite_get_response( struct ftp_lite_server *s, int accept_note, char *buffer )
@@ -146,7 +154,10 @@ static int ftp_lite_get_response( struct ftp_lite_server *s, int accept_note, ch
 				return 0;
 		}
 
-		if(!result) return 0;
+		if(!result) {
+			s->broken = 1;
+			return 0;
+		}
 
 		string_chomp(buffer);
 
@@ -271,6 +282,7 @@ struct ftp_lite_server * ftp_lite_open( const char *host, int port )
 	s->authtype = PLAIN;
 	s->auth_done = 0;
 	s->hostname = strdup(host);
+	s->broken = 0;
 	s->went_binary = 0;
 	s->data_channel_authentication = 0;
 
@@ -494,7 +506,7 @@ FILE * ftp_lite_get( struct ftp_lite_server *s, const char *path, ftp_lite_off_t
 	FILE *data;
 
 	if(offset!=0) {
-		ftp_lite_send_command(s,"REST %d",offset);
+		ftp_lite_send_command(s,"REST %lld",(long long)offset);
 		response = ftp_lite_get_response(s,0,buffer);
 		if(response/100!=3) {
 			errno = ftp_lite_error(response);
@@ -570,6 +582,221 @@ int ftp_lite_done( struct ftp_lite_server *s )
 	}
 }
 
+int ftp_lite_is_broken( struct ftp_lite_server *s )
+{
+	return s->broken;
+}
+
+/*
+A parallel get divides the file into ranges, several for each
+connection, so that a connection that finishes early takes up the
+next range rather than waiting on a slow one.  Each range is fetched
+with REST and RETR, and the data connection is closed as soon as the
+range is complete, to which the server answers with 426 or 226.
+A range that is cut short, by a failed data connection or by a stall,
+is put back to be resumed at its first missing byte, on whichever
+connection is free next.  The data connections are all served by one
+loop around poll, so that the caller needs no threads.
+*/
+
+#define FTP_LITE_RANGES_PER_SERVER 4
+#define FTP_LITE_RETRY_MAX 3
+#define FTP_LITE_STALL_TIMEOUT 60
+
+struct ftp_lite_range {
+	ftp_lite_off_t offset;
+	ftp_lite_off_t end;
+	int attempts;
+	int active;
+};
+
+struct ftp_lite_stripe {
+	struct ftp_lite_server *server;
+	struct ftp_lite_range *range;
+	FILE *data;
+};
+
+static struct ftp_lite_range * ftp_lite_next_range( struct ftp_lite_range *ranges, int nranges )
+{
+	int i;
+	for(i=0;i<nranges;i++) {
+		if(!ranges[i].active && ranges[i].offset<ranges[i].end) return &ranges[i];
+	}
+	return 0;
+}
+
+static int ftp_lite_stripe_start( struct ftp_lite_stripe *t, struct ftp_lite_range *r, const char *path )
+{
+	t->data = ftp_lite_get(t->server,path,r->offset);
+	if(!t->data) {
+		debug(D_FTP,"%s couldn't get %s at offset %lld: %s\n",t->server->hostname,path,(long long)r->offset,strerror(errno));
+		return 0;
+	}
+	t->range = r;
+	r->active = 1;
+	return 1;
+}
+
+static void ftp_lite_stripe_stop( struct ftp_lite_stripe *t )
+{
+	char buffer[FTP_LITE_LINE_MAX];
+	int save_errno = errno;
+
+	fclose(t->data);
+	t->data = 0;
+	ftp_lite_get_response(t->server,0,buffer);
+	t->range->active = 0;
+	t->range = 0;
+
+	errno = save_errno;
+}
+
+/* Count a failure of the range, and return false if it has failed too often. */
+
+static int ftp_lite_stripe_failed( struct ftp_lite_stripe *t )
+{
+	struct ftp_lite_range *r = t->range;
+
+	debug(D_FTP,"%s range ending at %lld stopped at %lld, will resume\n",t->server->hostname,(long long)r->end,(long long)r->offset);
+	ftp_lite_stripe_stop(t);
+
+	return ++r->attempts<=FTP_LITE_RETRY_MAX;
+}
+
+ftp_lite_size_t ftp_lite_get_parallel( struct ftp_lite_server **servers, int nservers, const char *path, ftp_lite_size_t size, int fd )
+{
+	char buffer[65536];
+	struct ftp_lite_range *ranges = 0;
+	struct ftp_lite_stripe *stripes = 0;
+	struct pollfd *fds = 0;
+	int *which = 0;
+	ftp_lite_size_t total = 0;
+	ftp_lite_size_t range_size;
+	int nranges, remaining;
+	int i, j, save_errno;
+
+	if(nservers<1 || size<0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nranges = nservers*FTP_LITE_RANGES_PER_SERVER;
+	range_size = MAX(FTP_LITE_STRIPE_MIN,(size+nranges-1)/nranges);
+	nranges = (size+range_size-1)/range_size;
+
+	ranges = calloc(MAX(nranges,1),sizeof(*ranges));
+	stripes = calloc(nservers,sizeof(*stripes));
+	fds = calloc(nservers,sizeof(*fds));
+	which = calloc(nservers,sizeof(*which));
+	if(!ranges || !stripes || !fds || !which) goto failure;
+
+	for(i=0;i<nranges;i++) {
+		ranges[i].offset = i*range_size;
+		ranges[i].end = MIN(size,(i+1)*range_size);
+	}
+
+	for(i=0;i<nservers;i++) {
+		stripes[i].server = servers[i];
+	}
+
+	debug(D_FTP,"getting %s in %d ranges over %d connections\n",path,nranges,nservers);
+
+	remaining = nranges;
+
+	while(remaining>0) {
+		int nactive = 0;
+		int nalive = 0;
+
+		for(i=0;i<nservers;i++) {
+			struct ftp_lite_stripe *t = &stripes[i];
+			if(t->server->broken) continue;
+			nalive++;
+
+			if(!t->data) {
+				struct ftp_lite_range *r = ftp_lite_next_range(ranges,nranges);
+				if(!r) continue;
+				if(!ftp_lite_stripe_start(t,r,path)) {
+					if(++r->attempts>FTP_LITE_RETRY_MAX) goto failure;
+					continue;
+				}
+			}
+
+			fds[nactive].fd = fileno(t->data);
+			fds[nactive].events = POLLIN;
+			fds[nactive].revents = 0;
+			which[nactive] = i;
+			nactive++;
+		}
+
+		if(nalive==0) {
+			errno = ECONNRESET;
+			goto failure;
+		}
+
+		if(nactive==0) continue;
+
+		int n = poll(fds,nactive,FTP_LITE_STALL_TIMEOUT*1000);
+		if(n<0) {
+			if(errno==EINTR) continue;
+			goto failure;
+		}
+
+		if(n==0) {
+			for(j=0;j<nactive;j++) {
+				if(!ftp_lite_stripe_failed(&stripes[which[j]])) {
+					errno = ETIMEDOUT;
+					goto failure;
+				}
+			}
+			continue;
+		}
+
+		for(j=0;j<nactive;j++) {
+			if(!fds[j].revents) continue;
+
+			struct ftp_lite_stripe *t = &stripes[which[j]];
+			struct ftp_lite_range *r = t->range;
+
+			ssize_t chunk = read(fds[j].fd,buffer,MIN((ftp_lite_size_t)sizeof(buffer),r->end-r->offset));
+			if(chunk>0) {
+				if(full_pwrite64(fd,buffer,chunk,r->offset)!=chunk) goto failure;
+				r->offset += chunk;
+				total += chunk;
+				if(r->offset==r->end) {
+					ftp_lite_stripe_stop(t);
+					remaining--;
+				}
+			} else if(chunk<0 && errno==EINTR) {
+				continue;
+			} else {
+				if(chunk==0) errno = EPIPE;
+				if(!ftp_lite_stripe_failed(t)) goto failure;
+			}
+		}
+	}
+
+	free(ranges);
+	free(stripes);
+	free(fds);
+	free(which);
+
+	return total;
+
+failure:
+	save_errno = errno;
+	if(stripes) {
+		for(i=0;i<nservers;i++) {
+			if(stripes[i].data) ftp_lite_stripe_stop(&stripes[i]);
+		}
+	}
+	free(ranges);
+	free(stripes);
+	free(fds);
+	free(which);
+	errno = save_errno;
+	return -1;
+}
+
 ftp_lite_size_t ftp_lite_size( struct ftp_lite_server *s, const char *path )
 {
 	char buffer[FTP_LITE_LINE_MAX];
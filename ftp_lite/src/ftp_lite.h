@@ -17,6 +17,7 @@ typedef long long ftp_lite_size_t;
 #define FTP_LITE_DEFAULT_PORT 21
 #define FTP_LITE_GSS_DEFAULT_PORT 2811
 #define FTP_LITE_WHOLE_FILE ((ftp_lite_size_t)-1)
+#define FTP_LITE_STRIPE_MIN (1024*1024)
 
 extern int ftp_lite_data_channel_authentication;
 
@@ -34,6 +35,18 @@ FILE * ftp_lite_put( struct ftp_lite_server *s, const char *path, ftp_lite_off_t
 FILE * ftp_lite_list( struct ftp_lite_server *s, const char *path );
 
 int ftp_lite_done( struct ftp_lite_server *s );
+int ftp_lite_is_broken( struct ftp_lite_server *s );
+
+/*
+Get the first size bytes of a file into fd, striped over several
+connections to the same server, each fetching ranges of at least
+FTP_LITE_STRIPE_MIN with REST and RETR.  A range cut short is resumed
+where it stopped, on any connection still working.  The connections
+remain open, and may be reused unless ftp_lite_is_broken says not.
+Returns the number of bytes written, or -1 with errno set.
+*/
+
+ftp_lite_size_t ftp_lite_get_parallel( struct ftp_lite_server **servers, int nservers, const char *path, ftp_lite_size_t size, int fd );
 
 int ftp_lite_rename( struct ftp_lite_server *s, const char *oldname, const char *newname );
 int ftp_lite_delete( struct ftp_lite_server *s, const char *path );
@@ -7,15 +7,89 @@ See the file COPYING for details.
 
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 #include "grow.h"
+#include "buffer.h"
 #include "debug.h"
+#include "itable.h"
 #include "xxmalloc.h"
 #include "int_sizes.h"
 
 static sha1_context_t grow_filesystem_checksum;
 
+/*
+A binary image of a directory tree is laid out as a header,
+an array of entries in which each directory precedes its
+contents, an array of the indices of the children of each
+directory sorted by name, the heads of the hash chains of
+all entries by path relative to the root, and the strings
+of all names.  Clients map the image into memory, and only
+create a grow_dirent for the entries they look up.
+*/
+
+#define GROW_IMAGE_BYTEORDER 0x01020304
+#define GROW_IMAGE_NONE      UINT32_MAX
+#define GROW_IMAGE_CHECKSUM  1
+
+struct grow_image_header {
+	char magic[8];
+	uint32_t byteorder;
+	uint32_t entry_size;
+	uint64_t nentries;
+	uint64_t nchildren;
+	uint64_t nbuckets;
+	uint64_t entries;
+	uint64_t children;
+	uint64_t buckets;
+	uint64_t strings;
+	uint64_t strings_size;
+};
+
+struct grow_image_entry {
+	uint64_t size;
+	int64_t  mtime;
+	uint32_t mode;
+	uint32_t parent;
+	uint32_t name;
+	uint32_t linkname;
+	uint32_t children;
+	uint32_t nchildren;
+	uint32_t hash_next;
+	uint32_t flags;
+	unsigned char checksum[SHA1_DIGEST_LENGTH];
+	uint32_t reserved;
+};
+
+struct grow_image {
+	void *data;
+	size_t length;
+	const struct grow_image_header *header;
+	const struct grow_image_entry *entries;
+	const uint32_t *children;
+	const uint32_t *buckets;
+	const char *strings;
+	struct itable *dirents;
+};
+
+/*
+The FNV-1a hash of a path, which may be computed
+one element at a time by passing in the hash so far.
+*/
+
+#define GROW_HASH_INIT 14695981039346656037ULL
+
+static uint64_t grow_hash( uint64_t h, const char *s, size_t length ) {
+	size_t i;
+	for(i=0;i<length;i++) {
+		h ^= (unsigned char)s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
 /*
 Compare two path strings only up to the first slash.
 For example, "foo" matches "foo/bar/baz".
@@ -80,6 +154,8 @@ static struct grow_dirent *grow_dirent_create_from_file( FILE *file, struct grow
 		}
 
 		d->inode = inode++;
+		d->image = 0;
+		d->index = 0;
 
 		if(fields>=6) {
 			d->name = xxstrdup(name);
@@ -107,21 +183,142 @@ static struct grow_dirent *grow_dirent_create_from_file( FILE *file, struct grow
 	return list;
 }
 
+static void grow_image_delete( struct grow_image *img ) {
+	if(img->dirents) {
+		itable_clear(img->dirents, free);
+		itable_delete(img->dirents);
+	}
+	if(img->data) munmap(img->data, img->length);
+	free(img);
+}
+
+/*
+Create the grow_dirent for entry i of an image,
+or return the one already created.
+*/
+
+static struct grow_dirent *grow_image_dirent( struct grow_image *img, uint32_t i ) {
+	const struct grow_image_header *h = img->header;
+	struct grow_dirent *d;
+
+	d = itable_lookup(img->dirents, i);
+	if(d) return d;
+
+	if(i>=h->nentries) goto corrupt;
+
+	const struct grow_image_entry *e = &img->entries[i];
+	if(e->name>=h->strings_size || e->linkname>=h->strings_size) goto corrupt;
+	if(i>0 && e->parent>=i) goto corrupt;
+	if((uint64_t)e->children+e->nchildren>h->nchildren) goto corrupt;
+
+	d = xxcalloc(1, sizeof(*d));
+	d->name = (char *) img->strings + e->name;
+	d->linkname = e->linkname ? (char *) img->strings + e->linkname : 0;
+	d->mode = e->mode;
+	d->size = e->size;
+	d->mtime = e->mtime;
+	d->inode = i + 2;
+	if(e->flags&GROW_IMAGE_CHECKSUM) {
+		strcpy(d->checksum, sha1_string((unsigned char *) e->checksum));
+	} else {
+		strcpy(d->checksum, "0");
+	}
+	d->image = img;
+	d->index = i;
+
+	if(i>0) {
+		d->parent = grow_image_dirent(img, e->parent);
+		if(!d->parent) {
+			free(d);
+			return 0;
+		}
+	}
+
+	itable_insert(img->dirents, i, d);
+	return d;
+
+	corrupt:
+	debug(D_GROW,"directory image is corrupted at entry %u!",i);
+	errno = EIO;
+	return 0;
+}
+
+static void *grow_image_section( struct grow_image *img, uint64_t offset, uint64_t count, size_t size ) {
+	if(offset>img->length || count>(img->length-offset)/size) return 0;
+	return (char *) img->data + offset;
+}
+
+static struct grow_dirent *grow_image_load( FILE *file ) {
+	struct grow_image *img = xxcalloc(1, sizeof(*img));
+	struct stat info;
+
+	if(fstat(fileno(file), &info)<0) goto failure;
+	if((size_t)info.st_size<sizeof(struct grow_image_header)) goto corrupt;
+
+	img->length = info.st_size;
+	img->data = mmap(0, img->length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if(img->data==MAP_FAILED) {
+		img->data = 0;
+		goto failure;
+	}
+
+	const struct grow_image_header *h = img->header = img->data;
+	if(h->byteorder!=GROW_IMAGE_BYTEORDER || h->entry_size!=sizeof(struct grow_image_entry)) goto corrupt;
+	if(h->nentries==0 || h->nentries>=GROW_IMAGE_NONE) goto corrupt;
+	if(h->nbuckets==0 || (h->nbuckets&(h->nbuckets-1))) goto corrupt;
+
+	img->entries = grow_image_section(img, h->entries, h->nentries, sizeof(struct grow_image_entry));
+	img->children = grow_image_section(img, h->children, h->nchildren, sizeof(uint32_t));
+	img->buckets = grow_image_section(img, h->buckets, h->nbuckets, sizeof(uint32_t));
+	img->strings = grow_image_section(img, h->strings, h->strings_size, 1);
+	if(!img->entries || !img->children || !img->buckets || !img->strings) goto corrupt;
+	if(h->strings_size==0 || img->strings[0] || img->strings[h->strings_size-1]) goto corrupt;
+
+	img->dirents = itable_create(0);
+
+	struct grow_dirent *root = grow_image_dirent(img, 0);
+	if(!root) goto failure;
+
+	debug(D_GROW,"mapped directory image of %" PRIu64 " entries",h->nentries);
+	return root;
+
+	corrupt:
+	debug(D_GROW,"directory image is corrupted!");
+	errno = EIO;
+	failure:
+	grow_image_delete(img);
+	return 0;
+}
+
 /*
 Recursively create a grow directory structure by reading
-descriptor lines from a stored file.
+descriptor lines from a stored file, or by mapping a
+binary image of it.
 */
 struct grow_dirent *grow_from_file(FILE *file) {
+	char magic[sizeof(GROW_IMAGE_MAGIC)-1];
+
+	if(fread(magic,1,sizeof(magic),file)==sizeof(magic) && !memcmp(magic,GROW_IMAGE_MAGIC,sizeof(magic))) {
+		return grow_image_load(file);
+	}
+
+	rewind(file);
 	return grow_dirent_create_from_file(file, NULL);
 }
 
 /*
 Recursively destroy a directory structure.
+A tree loaded from an image is destroyed all at once.
 */
 
 void grow_delete(struct grow_dirent *d) {
 	struct grow_dirent *n;
 
+	if(d && d->image) {
+		grow_image_delete(d->image);
+		return;
+	}
+
 	while(d) {
 		if(d->name) free(d->name);
 		if(d->linkname) free(d->linkname);
@@ -148,6 +345,123 @@ void grow_dirent_to_stat(struct grow_dirent *d, struct stat *s) {
 	s->st_ctime = d->mtime;
 }
 
+struct grow_dirent *grow_children(struct grow_dirent *d) {
+	if(!d->image || !S_ISDIR(d->mode) || d->children) return d->children;
+
+	struct grow_image *img = d->image;
+	const struct grow_image_entry *e = &img->entries[d->index];
+	struct grow_dirent *list = 0;
+	uint32_t i;
+
+	for(i=e->nchildren;i>0;i--) {
+		struct grow_dirent *c = grow_image_dirent(img, img->children[e->children+i-1]);
+		if(!c) return 0;
+		c->next = list;
+		list = c;
+	}
+
+	d->children = list;
+	return list;
+}
+
+/*
+Compare a name to a path element, as strcmp does.
+*/
+
+static int compare_name( const char *name, const char *path, size_t length ) {
+	int result = strncmp(name,path,length);
+	if(result) return result;
+	return name[length] ? 1 : 0;
+}
+
+/*
+Find the child of an image directory named by the first
+element of path, by binary search of its sorted children.
+*/
+
+static struct grow_dirent *grow_image_child( struct grow_dirent *d, const char *path ) {
+	struct grow_image *img = d->image;
+	const struct grow_image_entry *e = &img->entries[d->index];
+	size_t length = strcspn(path,"/");
+	uint32_t low = 0;
+	uint32_t high = e->nchildren;
+
+	while(low<high) {
+		uint32_t middle = low + (high-low)/2;
+		uint32_t i = img->children[e->children+middle];
+		if(i>=img->header->nentries || img->entries[i].name>=img->header->strings_size) break;
+		int result = compare_name(img->strings+img->entries[i].name,path,length);
+		if(result==0) {
+			return grow_image_dirent(img, i);
+		} else if(result<0) {
+			low = middle+1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Check whether entry i of an image is found at the given path,
+by comparing its name and those of its parents to the end of path.
+*/
+
+static int grow_image_matches( struct grow_image *img, uint32_t i, const char *path, size_t length ) {
+	while(i>0) {
+		const struct grow_image_entry *e = &img->entries[i];
+		if(e->name>=img->header->strings_size || e->parent>=i) return 0;
+
+		const char *name = img->strings+e->name;
+		size_t n = strlen(name);
+		if(n>length || memcmp(path+length-n,name,n)) return 0;
+		length -= n;
+
+		i = e->parent;
+		if(i==0) return length==0;
+		if(length==0 || path[length-1]!='/') return 0;
+		length--;
+	}
+	return length==0;
+}
+
+/*
+Find the entry of an image at path, relative to the root,
+by its hash.  Paths through "." or ".." are not in the index,
+and must be resolved one element at a time.
+*/
+
+static struct grow_dirent *grow_image_lookup( struct grow_image *img, const char *path ) {
+	char key[GROW_LINE_MAX];
+	size_t length = 0;
+	uint64_t count;
+
+	while(*path) {
+		while(*path=='/') path++;
+		if(!*path) break;
+		if(length>0) key[length++] = '/';
+		while(*path && *path!='/') {
+			if(length>=sizeof(key)) return 0;
+			key[length++] = *path++;
+		}
+		if(length>=sizeof(key)) return 0;
+	}
+	if(length==0) return 0;
+
+	uint64_t h = grow_hash(GROW_HASH_INIT,key,length);
+	uint32_t i = img->buckets[h&(img->header->nbuckets-1)];
+
+	for(count=0;i<img->header->nentries && count<img->header->nentries;count++) {
+		if(grow_image_matches(img,i,key,length)) {
+			return grow_image_dirent(img,i);
+		}
+		i = img->entries[i].hash_next;
+	}
+
+	return 0;
+}
+
 /*
 Recursively search for the grow_dirent named by path
 in the filesystem given by root.  If link_count is zero,
@@ -162,6 +476,16 @@ struct grow_dirent * grow_lookup(const char *path, struct grow_dirent *root, int
 	if(!path) path = "\0";
 	while(*path=='/') path++;
 
+	if(root->image && root->index==0 && *path) {
+		d = grow_image_lookup(root->image, path);
+		if(d) {
+			if(S_ISLNK(d->mode) && link_count>0) {
+				return grow_lookup("", d, link_count);
+			}
+			return d;
+		}
+	}
+
 	if( S_ISLNK(root->mode) && ( link_count>0 || path[0] ) ) {
 		if(link_count>100) {
 			errno = ELOOP;
@@ -208,12 +532,207 @@ struct grow_dirent * grow_lookup(const char *path, struct grow_dirent *root, int
 		}
 	}
 
-	for(d=root->children;d;d=d->next) {
-		if(compare_path_element(d->name,path)) {
+	if(root->image) {
+		d = grow_image_child(root, path);
+		if(d) {
 			return grow_lookup(subpath, d, link_count);
 		}
+	} else {
+		for(d=root->children;d;d=d->next) {
+			if(compare_path_element(d->name,path)) {
+				return grow_lookup(subpath, d, link_count);
+			}
+		}
 	}
 
 	errno = ENOENT;
 	return 0;
 }
+
+static int compare_dirent_names( const void *a, const void *b ) {
+	const struct grow_dirent *x = *(const struct grow_dirent **) a;
+	const struct grow_dirent *y = *(const struct grow_dirent **) b;
+	return strcmp(x->name, y->name);
+}
+
+static int decode_checksum( const char *str, unsigned char digest[SHA1_DIGEST_LENGTH] ) {
+	int i;
+	for(i=0;i<SHA1_DIGEST_LENGTH;i++) {
+		unsigned byte;
+		if(sscanf(str+2*i,"%2x",&byte)!=1) return 0;
+		digest[i] = byte;
+	}
+	return str[2*SHA1_DIGEST_LENGTH]==0;
+}
+
+struct grow_image_writer {
+	struct grow_image_entry *entries;
+	uint64_t *hashes;
+	uint64_t nentries;
+	uint64_t maxentries;
+	uint32_t *children;
+	uint64_t nchildren;
+	uint64_t maxchildren;
+	buffer_t strings;
+};
+
+static uint32_t grow_image_string( struct grow_image_writer *w, const char *str ) {
+	uint32_t offset = buffer_pos(&w->strings);
+	buffer_putlstring(&w->strings, str, strlen(str)+1);
+	return offset;
+}
+
+/*
+Append the entry for d and, recursively, its contents,
+returning the index of d or GROW_IMAGE_NONE on error.
+*/
+
+static uint32_t grow_image_add( struct grow_image_writer *w, struct grow_dirent *d, uint32_t parent, uint64_t hash ) {
+	if(w->nentries>=GROW_IMAGE_NONE-1) {
+		errno = EFBIG;
+		return GROW_IMAGE_NONE;
+	}
+
+	if(w->nentries==w->maxentries) {
+		w->maxentries = w->maxentries ? w->maxentries*2 : 1024;
+		w->entries = xxrealloc(w->entries, w->maxentries*sizeof(*w->entries));
+		w->hashes = xxrealloc(w->hashes, w->maxentries*sizeof(*w->hashes));
+	}
+
+	uint32_t i = w->nentries++;
+	struct grow_image_entry *e = &w->entries[i];
+	memset(e, 0, sizeof(*e));
+	e->size = d->size;
+	e->mtime = d->mtime;
+	e->mode = d->mode;
+	e->parent = parent;
+	e->name = grow_image_string(w, d->name);
+	e->linkname = d->linkname && d->linkname[0] ? grow_image_string(w, d->linkname) : 0;
+	if(decode_checksum(d->checksum, e->checksum)) e->flags |= GROW_IMAGE_CHECKSUM;
+	w->hashes[i] = hash;
+
+	if(!S_ISDIR(d->mode)) return i;
+
+	struct grow_dirent *c;
+	uint32_t count = 0;
+	for(c=grow_children(d);c;c=c->next) count++;
+
+	struct grow_dirent **sorted = xxmalloc(count*sizeof(*sorted) + 1);
+	count = 0;
+	for(c=grow_children(d);c;c=c->next) sorted[count++] = c;
+	qsort(sorted, count, sizeof(*sorted), compare_dirent_names);
+
+	if(w->nchildren+count>w->maxchildren) {
+		while(w->nchildren+count>w->maxchildren) {
+			w->maxchildren = w->maxchildren ? w->maxchildren*2 : 1024;
+		}
+		w->children = xxrealloc(w->children, w->maxchildren*sizeof(*w->children));
+	}
+
+	uint64_t first = w->nchildren;
+	w->nchildren += count;
+
+	uint32_t j;
+	for(j=0;j<count;j++) {
+		uint64_t h = i>0 ? grow_hash(hash, "/", 1) : hash;
+		h = grow_hash(h, sorted[j]->name, strlen(sorted[j]->name));
+		uint32_t k = grow_image_add(w, sorted[j], i, h);
+		if(k==GROW_IMAGE_NONE) {
+			free(sorted);
+			return GROW_IMAGE_NONE;
+		}
+		w->children[first+j] = k;
+	}
+
+	/* entries may have moved while adding the children */
+	w->entries[i].children = first;
+	w->entries[i].nchildren = count;
+
+	free(sorted);
+	return i;
+}
+
+static uint64_t align8( uint64_t offset ) {
+	return (offset+7) & ~(uint64_t)7;
+}
+
+static int write_padded( const void *data, size_t length, FILE *file ) {
+	static const char zeros[8];
+	if(length && fwrite(data, length, 1, file)!=1) return -1;
+	if(align8(length)>length && fwrite(zeros, align8(length)-length, 1, file)!=1) return -1;
+	return 0;
+}
+
+int grow_image_write(struct grow_dirent *root, FILE *file) {
+	struct grow_image_writer w;
+	struct grow_image_header h;
+	uint32_t *buckets = 0;
+	int result = -1;
+	uint64_t i;
+
+	memset(&w, 0, sizeof(w));
+	buffer_init(&w.strings);
+	buffer_abortonfailure(&w.strings, 1);
+	buffer_putlstring(&w.strings, "", 1);
+
+	if(grow_image_add(&w, root, 0, GROW_HASH_INIT)==GROW_IMAGE_NONE) goto out;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, GROW_IMAGE_MAGIC, sizeof(h.magic));
+	h.byteorder = GROW_IMAGE_BYTEORDER;
+	h.entry_size = sizeof(struct grow_image_entry);
+	h.nentries = w.nentries;
+	h.nchildren = w.nchildren;
+	for(h.nbuckets=1;h.nbuckets<w.nentries;h.nbuckets*=2) {}
+
+	buckets = xxmalloc(h.nbuckets*sizeof(*buckets));
+	for(i=0;i<h.nbuckets;i++) buckets[i] = GROW_IMAGE_NONE;
+	for(i=w.nentries;i>0;i--) {
+		uint64_t b = w.hashes[i-1]&(h.nbuckets-1);
+		w.entries[i-1].hash_next = buckets[b];
+		buckets[b] = i-1;
+	}
+
+	h.strings_size = buffer_pos(&w.strings);
+	h.entries = align8(sizeof(h));
+	h.children = h.entries + align8(h.nentries*sizeof(struct grow_image_entry));
+	h.buckets = h.children + align8(h.nchildren*sizeof(uint32_t));
+	h.strings = h.buckets + align8(h.nbuckets*sizeof(uint32_t));
+
+	if(write_padded(&h, sizeof(h), file)<0) goto out;
+	if(write_padded(w.entries, h.nentries*sizeof(struct grow_image_entry), file)<0) goto out;
+	if(write_padded(w.children, h.nchildren*sizeof(uint32_t), file)<0) goto out;
+	if(write_padded(buckets, h.nbuckets*sizeof(uint32_t), file)<0) goto out;
+	if(write_padded(buffer_tostring(&w.strings), h.strings_size, file)<0) goto out;
+
+	result = 0;
+
+	out:
+	free(w.entries);
+	free(w.hashes);
+	free(w.children);
+	free(buckets);
+	buffer_free(&w.strings);
+	return result;
+}
+
+static void grow_print_dirent( struct grow_dirent *d, FILE *file ) {
+	long mtime = d->mtime - GROW_EPOCH;
+
+	if(S_ISLNK(d->mode)) {
+		fprintf(file, "L %s\t%u %" PRIu64 " %ld 0 %s\n", d->name, d->mode, d->size, mtime, d->linkname ? d->linkname : "");
+	} else if(S_ISDIR(d->mode)) {
+		struct grow_dirent *c;
+		fprintf(file, "D %s\t%u %" PRIu64 " %ld 0\n", d->name, d->mode, d->size, mtime);
+		for(c=grow_children(d);c;c=c->next) {
+			grow_print_dirent(c, file);
+		}
+		fprintf(file, "E\n");
+	} else {
+		fprintf(file, "F %s\t%u %" PRIu64 " %ld %s\n", d->name, d->mode, d->size, mtime, d->checksum);
+	}
+}
+
+void grow_print(struct grow_dirent *root, FILE *file) {
+	grow_print_dirent(root, file);
+}
@@ -10,6 +10,9 @@ See the file COPYING for details.
 #define GROW_LINE_MAX 4096
 #define GROW_EPOCH 1199163600
 
+/* A binary directory image begins with this magic string instead of a listing. */
+#define GROW_IMAGE_MAGIC "GROWIMG1"
+
 #include <stdint.h>
 #include <stdio.h>
 #include <time.h>
@@ -18,11 +21,17 @@ See the file COPYING for details.
 
 #include "sha1.h"
 
+struct grow_image;
+
 /**
  * A grow_dirent is a node in a tree representing the
  * entire directory structure of a grow_filesystem.
  * Each node describes its name, metadata, checksum,
- * and children (if a directory)
+ * and children (if a directory).
+ * If the tree was loaded from a binary image, nodes
+ * are created from the image as they are looked up,
+ * and the children of a directory are only available
+ * through @ref grow_children.
 */
 struct grow_dirent {
 	char *name;
@@ -35,15 +44,41 @@ struct grow_dirent {
 	struct grow_dirent *children;
 	struct grow_dirent *parent;
 	struct grow_dirent *next;
+	struct grow_image *image;
+	uint32_t index;
 };
 
 /**
  * Parse the given file to generate an in-memory directory tree.
+ * If the file is a binary image, it is mapped into memory instead.
  * @param FILE A file stream open for reading.
  * @returns A pointer to the root of the directory tree, or NULL on error.
  */
 struct grow_dirent *grow_from_file(FILE *file);
 
+/**
+ * Write a directory tree as a binary image, with a hash index
+ * of all paths and the entries of each directory sorted by name.
+ * @param root The root of the directory tree.
+ * @param file A file stream open for writing.
+ * @returns Zero on success, or -1 with errno set.
+ */
+int grow_image_write(struct grow_dirent *root, FILE *file);
+
+/**
+ * Write a directory tree in the text format of a directory listing.
+ * @param root The root of the directory tree.
+ * @param file A file stream open for writing.
+ */
+void grow_print(struct grow_dirent *root, FILE *file);
+
+/**
+ * Get the children of a directory.
+ * @param d The directory.
+ * @returns The first child, followed by the rest through the next field.
+ */
+struct grow_dirent *grow_children(struct grow_dirent *d);
+
 /**
  * Recursively free a directory tree.
  */
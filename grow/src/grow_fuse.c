@@ -195,7 +195,7 @@ static int grow_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler
 	struct grow_dirent *e = grow_lookup(path, root->metadata, 1);
 	if (!e) return -errno;
 	if (!S_ISDIR(e->mode)) return -ENOTDIR;
-	for (struct grow_dirent *c = e->children; c; c = c->next) {
+	for (struct grow_dirent *c = grow_children(e); c; c = c->next) {
 		if (filler(buf, c->name, NULL, 0)) return -ENOMEM;
 	}
 	return 0;
@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+grow_image converts the directory listing written by make_growfs
+into a binary image which GROW clients map into memory, prints an
+image back as a listing, and compares two listings or images.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "grow.h"
+#include "buffer.h"
+#include "debug.h"
+#include "xxmalloc.h"
+
+static void show_help(const char *cmd)
+{
+	fprintf(stdout, "Use: %s [options] <listing> <image>\n", cmd);
+	fprintf(stdout, "       %s -t <image>\n", cmd);
+	fprintf(stdout, "       %s -d <old> <new>\n", cmd);
+	fprintf(stdout, "Where options are:\n");
+	fprintf(stdout, "  -t  Print a listing or image as a text listing.\n");
+	fprintf(stdout, "  -d  Print the paths added (+), removed (-), or modified (M) between two listings or images.\n");
+	fprintf(stdout, "  -h  Show this help file.\n");
+}
+
+static struct grow_dirent *load(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		fprintf(stderr, "grow_image: couldn't open %s: %s\n", filename, strerror(errno));
+		exit(1);
+	}
+
+	struct grow_dirent *root = grow_from_file(file);
+	if (!root) {
+		fprintf(stderr, "grow_image: %s is corrupted\n", filename);
+		exit(1);
+	}
+
+	fclose(file);
+	return root;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	const struct grow_dirent *x = *(const struct grow_dirent **)a;
+	const struct grow_dirent *y = *(const struct grow_dirent **)b;
+	return strcmp(x->name, y->name);
+}
+
+/* Return the children of d sorted by name, with a null at the end. */
+
+static struct grow_dirent **sorted_children(struct grow_dirent *d)
+{
+	struct grow_dirent *c;
+	size_t n = 0;
+
+	if (d && S_ISDIR(d->mode)) {
+		for (c = grow_children(d); c; c = c->next)
+			n++;
+	}
+
+	struct grow_dirent **children = xxmalloc((n + 1) * sizeof(*children));
+	n = 0;
+	if (d && S_ISDIR(d->mode)) {
+		for (c = grow_children(d); c; c = c->next)
+			children[n++] = c;
+	}
+	children[n] = 0;
+
+	qsort(children, n, sizeof(*children), compare_names);
+	return children;
+}
+
+static int modified(struct grow_dirent *a, struct grow_dirent *b)
+{
+	if (a->mode != b->mode)
+		return 1;
+	if (S_ISDIR(a->mode))
+		return 0;
+	if (a->size != b->size || a->mtime != b->mtime || strcmp(a->checksum, b->checksum))
+		return 1;
+	if (S_ISLNK(a->mode) && strcmp(a->linkname ? a->linkname : "", b->linkname ? b->linkname : ""))
+		return 1;
+	return 0;
+}
+
+/*
+Compare the contents of two directories, either of which may be null,
+merging their children by name.
+*/
+
+static void diff(struct grow_dirent *old, struct grow_dirent *new, buffer_t *path)
+{
+	struct grow_dirent **a = sorted_children(old);
+	struct grow_dirent **b = sorted_children(new);
+	size_t i = 0, j = 0;
+	size_t length = buffer_pos(path);
+
+	while (a[i] || b[j]) {
+		int result;
+		if (!a[i]) {
+			result = 1;
+		} else if (!b[j]) {
+			result = -1;
+		} else {
+			result = strcmp(a[i]->name, b[j]->name);
+		}
+
+		struct grow_dirent *x = result <= 0 ? a[i] : 0;
+		struct grow_dirent *y = result >= 0 ? b[j] : 0;
+		const char *name = x ? x->name : y->name;
+
+		buffer_putfstring(path, "/%s", name);
+
+		if (!y) {
+			printf("- %s\n", buffer_tostring(path));
+		} else if (!x) {
+			printf("+ %s\n", buffer_tostring(path));
+		} else if (modified(x, y)) {
+			printf("M %s\n", buffer_tostring(path));
+		}
+
+		if ((x && S_ISDIR(x->mode)) || (y && S_ISDIR(y->mode))) {
+			diff(x && S_ISDIR(x->mode) ? x : 0, y && S_ISDIR(y->mode) ? y : 0, path);
+		}
+
+		buffer_rewind(path, length);
+
+		if (x)
+			i++;
+		if (y)
+			j++;
+	}
+
+	free(a);
+	free(b);
+}
+
+int main(int argc, char *argv[])
+{
+	int print_mode = 0;
+	int diff_mode = 0;
+	int c;
+
+	debug_config(argv[0]);
+
+	while ((c = getopt(argc, argv, "tdh")) != -1) {
+		switch (c) {
+		case 't':
+			print_mode = 1;
+			break;
+		case 'd':
+			diff_mode = 1;
+			break;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if (print_mode && optind + 1 == argc) {
+		struct grow_dirent *root = load(argv[optind]);
+		grow_print(root, stdout);
+		grow_delete(root);
+		return 0;
+	}
+
+	if (diff_mode && optind + 2 == argc) {
+		struct grow_dirent *old = load(argv[optind]);
+		struct grow_dirent *new = load(argv[optind + 1]);
+		buffer_t path;
+		buffer_init(&path);
+		diff(old, new, &path);
+		buffer_free(&path);
+		grow_delete(old);
+		grow_delete(new);
+		return 0;
+	}
+
+	if (print_mode || diff_mode || optind + 2 != argc) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	struct grow_dirent *root = load(argv[optind]);
+
+	FILE *file = fopen(argv[optind + 1], "w");
+	if (!file) {
+		fprintf(stderr, "grow_image: couldn't write %s: %s\n", argv[optind + 1], strerror(errno));
+		return 1;
+	}
+
+	if (grow_image_write(root, file) < 0 || fclose(file) != 0) {
+		fprintf(stderr, "grow_image: couldn't write %s: %s\n", argv[optind + 1], strerror(errno));
+		return 1;
+	}
+
+	grow_delete(root);
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
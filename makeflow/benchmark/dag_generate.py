@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2022 The University of Notre Dame
+# This software is distributed under the GNU General Public License.
+# See the file COPYING for details.
+
+# Writes a synthetic makeflow of a given shape and size, to measure the
+# overhead of makeflow itself with -T dryrun.  Rules are written as they are
+# generated, so DAGs of millions of nodes do not have to fit in memory.
+#
+#   chain   each rule reads the output of the previous one.
+#   fan     a root rule, a fan-out of --width rules reading its output, and a
+#           rule gathering their outputs, repeated until --nodes rules.
+#   random  each rule reads the outputs of up to --parents rules chosen at
+#           random among the --window rules before it.
+#
+# For example:
+#     ./dag_generate.py --shape random --nodes 1000000 > random.mf
+
+import argparse
+import random
+import sys
+
+
+def rule(out, outputs, inputs):
+    out.write("{}: {}\n".format(" ".join(outputs), " ".join(inputs)))
+    out.write("\ttouch {}\n\n".format(" ".join(outputs)))
+
+
+def chain(out, args):
+    rule(out, ["f0"], [])
+    for i in range(1, args.nodes):
+        rule(out, ["f{}".format(i)], ["f{}".format(i - 1)])
+
+
+def fan(out, args):
+    i = 0
+    while i < args.nodes:
+        root = "f{}".format(i)
+        rule(out, [root], [])
+        i += 1
+
+        width = max(0, min(args.width, args.nodes - i - 1))
+        leaves = ["f{}".format(i + k) for k in range(width)]
+        for leaf in leaves:
+            rule(out, [leaf], [root])
+        i += width
+
+        if i < args.nodes:
+            rule(out, ["f{}".format(i)], leaves or [root])
+            i += 1
+
+
+def random_dag(out, args):
+    rng = random.Random(args.seed)
+    for i in range(args.nodes):
+        low = max(0, i - args.window)
+        count = min(rng.randint(0, args.parents), i - low)
+        parents = sorted(rng.sample(range(low, i), count))
+        rule(out, ["f{}".format(i)], ["f{}".format(p) for p in parents])
+
+
+SHAPES = {"chain": chain, "fan": fan, "random": random_dag}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Write a synthetic makeflow to stdout.")
+    parser.add_argument("--shape", choices=sorted(SHAPES), default="random")
+    parser.add_argument("--nodes", type=int, default=1000, help="number of rules (default 1000)")
+    parser.add_argument("--width", type=int, default=100, help="rules in each fan-out (default 100)")
+    parser.add_argument("--parents", type=int, default=3, help="most inputs of a random rule (default 3)")
+    parser.add_argument("--window", type=int, default=1000, help="earlier rules a random rule may read from (default 1000)")
+    parser.add_argument("--seed", type=int, default=0, help="seed of the random shape (default 0)")
+    args = parser.parse_args()
+
+    out = sys.stdout
+    SHAPES[args.shape](out, args)
+    out.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Measures the overhead of makeflow itself on a synthetic DAG, using the
+# dryrun batch queue so that no job is actually executed.
+#
+# The DAG is written by dag_generate.py, then run twice in a temp directory:
+# once from scratch, and once more against the complete log, which measures
+# recovery.  makeflow writes the time of each phase with --engine-stats, and
+# the two results are copied to <shape>-<nodes>.run.json and
+# <shape>-<nodes>.recover.json in the current directory.
+#
+# For example:
+#     ./engine_bench.sh random 1000000
+#     ./engine_bench.sh fan 100000 --width 1000
+#
+# Additional arguments are passed to dag_generate.py.  Set MAKEFLOW to choose
+# the makeflow to measure, and MAKEFLOW_OPTIONS to pass it more options,
+# such as --log-group-commit.
+
+if [ "$#" -lt 2 ]; then
+	echo "usage: $0 <chain|fan|random> <nodes> [dag_generate.py options]"
+	exit 1
+fi
+
+shape=$1
+nodes=$2
+shift 2
+
+makeflow=${MAKEFLOW:-makeflow}
+generate=$(cd "$(dirname "$0")" && pwd)/dag_generate.py
+name=$shape-$nodes
+
+unset TESTDIR
+function cleanup {
+	rm -rf "$TESTDIR"
+}
+trap cleanup EXIT
+TESTDIR=$(mktemp -d)
+
+echo "generating $shape dag of $nodes nodes..."
+python3 "$generate" --shape "$shape" --nodes "$nodes" "$@" > "$TESTDIR/bench.mf" || exit 1
+
+(
+	cd "$TESTDIR" || exit 1
+
+	echo "running..."
+	"$makeflow" -T dryrun --skip-file-check --engine-stats=run.json $MAKEFLOW_OPTIONS bench.mf > run.out || exit 1
+
+	echo "recovering..."
+	"$makeflow" -T dryrun --skip-file-check --engine-stats=recover.json $MAKEFLOW_OPTIONS bench.mf > recover.out || exit 1
+) || exit 1
+
+cp "$TESTDIR/run.json" "$name.run.json"
+cp "$TESTDIR/recover.json" "$name.recover.json"
+
+cat "$name.run.json"
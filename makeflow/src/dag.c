@@ -18,6 +18,7 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "list.h"
 #include "set.h"
+#include "priority_queue.h"
 #include "stringtools.h"
 #include "rmsummary.h"
 
@@ -82,6 +83,8 @@ void dag_compile_ancestors(struct dag *d)
 
 	if (!d) return;
 
+	timestamp_t start = timestamp_get();
+
 	hash_table_firstkey(d->files);
 	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
 		m = f->created_by;
@@ -96,6 +99,8 @@ void dag_compile_ancestors(struct dag *d)
 			set_insert(n->ancestors, m);
 		}
 	}
+
+	d->ancestors_time += timestamp_get() - start;
 }
 
 static int get_ancestor_depth(struct dag_node *n)
@@ -191,6 +196,275 @@ void dag_count_states(struct dag *d)
 	}
 }
 
+dag_priority_t dag_priority_from_string(const char *name)
+{
+	if(!strcmp(name, "depth")) {
+		return DAG_PRIORITY_DEPTH;
+	} else if(!strcmp(name, "critical-path")) {
+		return DAG_PRIORITY_CRITICAL_PATH;
+	} else if(!strcmp(name, "fan-out")) {
+		return DAG_PRIORITY_FAN_OUT;
+	} else if(!strcmp(name, "free-disk")) {
+		return DAG_PRIORITY_FREE_DISK;
+	} else {
+		return -1;
+	}
+}
+
+/* The expected runtime of a node: as measured in a previous run, as requested, or one second. */
+
+static double dag_node_expected_runtime(struct dag_node *n)
+{
+	if(n->previous_runtime > 0)
+		return n->previous_runtime;
+
+	const struct rmsummary *r = dag_node_dynamic_label(n);
+	if(r && r->wall_time > 0)
+		return r->wall_time;
+
+	return 1;
+}
+
+/* The longest expected runtime from the start of n to any sink, memoized in n->priority. */
+
+static double get_critical_path(struct dag_node *n)
+{
+	struct dag_node *descendant;
+	double longest = 0;
+
+	if(n->priority >= 0)
+		return n->priority;
+
+	set_first_element(n->descendants);
+	while((descendant = set_next_element(n->descendants))) {
+		double length = get_critical_path(descendant);
+		if(length > longest)
+			longest = length;
+	}
+
+	n->priority = longest + dag_node_expected_runtime(n);
+	return n->priority;
+}
+
+/* The disk the garbage collector may free once n completes, sharing each file among its consumers. */
+
+static double get_freed_disk(struct dag *d, struct dag_node *n)
+{
+	struct dag_file *f;
+	double freed = 0;
+
+	list_first_item(n->source_files);
+	while((f = list_next_item(n->source_files))) {
+		if(dag_file_is_source(f) || set_lookup(d->outputs, f))
+			continue;
+		freed += (double) dag_file_size(f) / list_size(f->needed_by);
+	}
+
+	return freed;
+}
+
+static void dag_node_priority(struct dag *d, struct dag_node *n, dag_priority_t mode)
+{
+	switch(mode) {
+	case DAG_PRIORITY_DEPTH:
+		n->priority = -n->ancestor_depth;
+		break;
+	case DAG_PRIORITY_CRITICAL_PATH:
+		get_critical_path(n);
+		break;
+	case DAG_PRIORITY_FAN_OUT:
+		n->priority = set_size(n->descendants);
+		break;
+	case DAG_PRIORITY_FREE_DISK:
+		n->priority = get_freed_disk(d, n);
+		break;
+	}
+}
+
+/*
+Compute the priority of every node once the dag is loaded.
+Priorities are whole numbers, so that ties can be broken by rule order
+in dag_ready_priority.
+*/
+
+void dag_compute_priorities(struct dag *d, dag_priority_t mode)
+{
+	struct dag_node *n;
+
+	dag_find_ancestor_depth(d);
+
+	for(n = d->nodes; n; n = n->next) {
+		n->priority = -1;
+	}
+
+	for(n = d->nodes; n; n = n->next) {
+		dag_node_priority(d, n, mode);
+	}
+
+	for(n = d->nodes; n; n = n->next) {
+		n->priority = floor(n->priority);
+	}
+}
+
+/* Compute the priority of a node added after dag_compute_priorities, from the nodes it depends on. */
+
+void dag_node_compute_priority(struct dag *d, struct dag_node *n, dag_priority_t mode)
+{
+	if(mode == DAG_PRIORITY_DEPTH)
+		get_ancestor_depth(n);
+
+	n->priority = -1;
+	dag_node_priority(d, n, mode);
+	n->priority = floor(n->priority);
+}
+
+/*
+The ready queue holds the waiting nodes whose source files all exist,
+so that dispatching does not need to visit every node of the dag.
+Each node counts its missing sources, and the count is adjusted as
+files change state.  Nodes are dispatched by priority, and nodes of
+equal priority in the order they appear in the makeflow.
+A node may stay in the queue after it stops being ready; such entries
+are discarded when popped.
+*/
+
+static double dag_ready_priority(struct dag *d, struct dag_node *n)
+{
+	return n->priority - (double) n->nodeid / (d->nodeid_counter + 1);
+}
+
+void dag_ready_push(struct dag *d, struct dag_node *n)
+{
+	if(!d->ready_nodes || n->ready_queued)
+		return;
+
+	if(n->state != DAG_NODE_STATE_WAITING || n->sources_missing > 0)
+		return;
+
+	priority_queue_push(d->ready_nodes, n, dag_ready_priority(d, n));
+	n->ready_queued = 1;
+}
+
+struct dag_node *dag_ready_pop(struct dag *d)
+{
+	struct dag_node *n;
+
+	if(!d->ready_nodes)
+		return NULL;
+
+	while((n = priority_queue_pop(d->ready_nodes))) {
+		n->ready_queued = 0;
+		if(n->state == DAG_NODE_STATE_WAITING && n->sources_missing == 0)
+			return n;
+	}
+
+	return NULL;
+}
+
+void dag_ready_init(struct dag *d)
+{
+	struct dag_node *n;
+
+	if(d->ready_nodes)
+		priority_queue_delete(d->ready_nodes);
+	d->ready_nodes = priority_queue_create(0);
+
+	for(n = d->nodes; n; n = n->next) {
+		n->ready_queued = 0;
+		dag_ready_add(d, n);
+	}
+}
+
+/* Count the missing sources of a node not in the queue yet, and queue it if it is ready. */
+
+void dag_ready_add(struct dag *d, struct dag_node *n)
+{
+	struct dag_file *f;
+
+	n->sources_missing = 0;
+
+	list_first_item(n->source_files);
+	while((f = list_next_item(n->source_files))) {
+		if(!dag_file_should_exist(f))
+			n->sources_missing++;
+	}
+
+	dag_ready_push(d, n);
+}
+
+/* Called after the state of f changes, with whether it should have existed before. */
+
+void dag_ready_file_changed(struct dag *d, struct dag_file *f, int existed)
+{
+	struct dag_node *n;
+
+	if(!d->ready_nodes)
+		return;
+
+	int exists = dag_file_should_exist(f);
+	if(exists == existed)
+		return;
+
+	/* Use a cursor, as callers may be walking f->needed_by themselves. */
+	struct list_cursor *cur = list_cursor_create(f->needed_by);
+	for(list_seek(cur, 0); list_get(cur, (void **) &n); list_next(cur)) {
+		if(exists) {
+			n->sources_missing--;
+			dag_ready_push(d, n);
+		} else {
+			n->sources_missing++;
+		}
+	}
+	list_cursor_destroy(cur);
+}
+
+/*
+Remove the nodes expanded on demand that are complete and that no other
+node depends on, so that the memory of a lazy workflow is bounded by the
+nodes still to run.  The outputs of a removed node remain in the dag,
+and become sources of any node expanded later.
+*/
+
+int dag_release_complete_nodes(struct dag *d)
+{
+	struct dag_node **p = &d->nodes;
+	struct dag_node *n, *m;
+	struct dag_file *f;
+	int count = 0;
+
+	while((n = *p)) {
+		if(!n->expanded || n->state != DAG_NODE_STATE_COMPLETE || n->ready_queued || n->task || set_size(n->descendants) > 0) {
+			p = &n->next;
+			continue;
+		}
+
+		*p = n->next;
+
+		list_first_item(n->source_files);
+		while((f = list_next_item(n->source_files))) {
+			list_remove(f->needed_by, n);
+		}
+
+		list_first_item(n->target_files);
+		while((f = list_next_item(n->target_files))) {
+			if(f->created_by == n)
+				f->created_by = NULL;
+		}
+
+		set_first_element(n->ancestors);
+		while((m = set_next_element(n->ancestors))) {
+			set_remove(m->descendants, n);
+		}
+
+		itable_remove(d->node_table, n->nodeid);
+		dag_node_delete(n);
+		count++;
+	}
+
+	d->nodes_released += count;
+	return count;
+}
+
 /**
  * If the return value is x, a positive integer, that means at least x tasks
  * can be run in parallel during a certain point of the execution of the
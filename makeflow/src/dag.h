@@ -17,9 +17,17 @@ See the file COPYING for details.
 #include "timestamp.h"
 #include "batch_queue.h"
 #include "category.h"
+#include "priority_queue.h"
 
 #include <stdio.h>
 
+typedef enum {
+	DAG_PRIORITY_DEPTH,         /* Nodes with fewer ancestors first. */
+	DAG_PRIORITY_CRITICAL_PATH, /* Nodes with the longest expected runtime to a sink first. */
+	DAG_PRIORITY_FAN_OUT,       /* Nodes with the most immediate descendants first. */
+	DAG_PRIORITY_FREE_DISK,     /* Nodes that let the garbage collector free the most disk first. */
+} dag_priority_t;
+
 struct dag {
 	/* Static properties of the DAG */
 	char *filename;                    /* Source makeflow file path. */
@@ -33,6 +41,7 @@ struct dag {
 	struct string_set *export_vars;    /* List of variables with prefix export. (these are setenv'ed eventually). */
 	struct string_set *special_vars;   /* List of special variables, such as category, cores, memory, etc. */
 	category_mode_t allocation_mode;   /* One of CATEGORY_ALLOCATION_MODE_{FIXED,MAX_THROUGHTPUT,MIN_WASTE} */
+	timestamp_t ancestors_time;        /* Time spent in dag_compile_ancestors, in microseconds. */
 
 
 	/* Dynamic states related to execution via Makeflow. */
@@ -48,6 +57,12 @@ struct dag {
 	char *cache_dir;                    /* The dirname of the cache storing all the deps specified in the mountfile */
 
 	uint64_t total_file_size;           /* Keeps cumulative size of existing files. */
+
+	struct priority_queue *ready_nodes; /* Waiting nodes whose source files all exist, by priority. Null until dag_ready_init. */
+	struct priority_queue *gc_files;    /* Files no rule still needs, in the order to collect them. Null until the first makeflow_gc. */
+
+	struct dag_rules *lazy_rules;       /* Rules of a JX workflow not expanded into nodes yet, or null. See dag_expand_rules. */
+	int nodes_released;                 /* Count of complete nodes removed by dag_release_complete_nodes. */
 };
 
 struct dag *dag_create();
@@ -58,6 +73,20 @@ void dag_compile_ancestors(struct dag *d);
 void dag_find_ancestor_depth(struct dag *d);
 void dag_count_states(struct dag *d);
 
+struct dag_file;
+
+dag_priority_t dag_priority_from_string(const char *name);
+void dag_compute_priorities(struct dag *d, dag_priority_t mode);
+
+void dag_ready_init(struct dag *d);
+void dag_ready_file_changed(struct dag *d, struct dag_file *f, int existed);
+struct dag_node *dag_ready_pop(struct dag *d);
+void dag_ready_push(struct dag *d, struct dag_node *n);
+void dag_ready_add(struct dag *d, struct dag_node *n);
+
+void dag_node_compute_priority(struct dag *d, struct dag_node *n, dag_priority_t mode);
+int dag_release_complete_nodes(struct dag *d);
+
 struct dag_file *dag_file_lookup_or_create(struct dag *d, const char *filename);
 struct dag_file *dag_file_from_name(struct dag *d, const char *filename);
 
@@ -0,0 +1,513 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "dag_cache.h"
+#include "dag_node.h"
+#include "dag_file.h"
+#include "dag_variable.h"
+#include "dag_resources.h"
+
+#include "buffer.h"
+#include "category.h"
+#include "debug.h"
+#include "full_io.h"
+#include "hash_table.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "list.h"
+#include "sha1.h"
+#include "string_set.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*
+The cache is a sequence of integers and strings in the native byte order,
+as it is only meant to be read back on the machine that wrote it.
+Integers are eight bytes.  Strings are a four byte length and the text,
+with a length of -1 for a null string.  The file starts with the magic
+string and the key, and ends with the magic string again, so a file that
+was cut short is never mistaken for a valid cache.
+*/
+
+#define DAG_CACHE_MAGIC "makeflow-dag-cache-1"
+
+static void put_int(buffer_t *b, int64_t value)
+{
+	buffer_putlstring(b, (const char *) &value, sizeof(value));
+}
+
+static void put_string(buffer_t *b, const char *s)
+{
+	int32_t length = s ? (int32_t) strlen(s) : -1;
+	buffer_putlstring(b, (const char *) &length, sizeof(length));
+	if(s)
+		buffer_putlstring(b, s, length);
+}
+
+static void put_variables(buffer_t *b, struct hash_table *table)
+{
+	char *name;
+	struct dag_variable *var;
+
+	put_int(b, hash_table_size(table));
+
+	hash_table_firstkey(table);
+	while(hash_table_nextkey(table, &name, (void **) &var)) {
+		put_string(b, name);
+		put_int(b, var->count);
+		int i;
+		for(i = 0; i < var->count; i++) {
+			put_int(b, var->values[i]->nodeid);
+			put_string(b, var->values[i]->value);
+		}
+	}
+}
+
+/* Files are written in the order they were added, which is the reverse of the list. */
+
+static void put_node_files(buffer_t *b, struct dag_node *n, struct list *files)
+{
+	struct dag_file *f;
+
+	put_int(b, list_size(files));
+
+	struct list_cursor *cur = list_cursor_create(files);
+	for(list_seek(cur, -1); list_get(cur, (void **) &f); list_prev(cur)) {
+		put_string(b, f->filename);
+		put_string(b, (const char *) itable_lookup(n->remote_names, (uintptr_t) f));
+	}
+	list_cursor_destroy(cur);
+}
+
+struct reader {
+	const char *data;
+	size_t length;
+	size_t pos;
+	int failed;
+};
+
+static int64_t get_int(struct reader *r)
+{
+	int64_t value = 0;
+
+	if(r->failed || r->length - r->pos < sizeof(value)) {
+		r->failed = 1;
+		return 0;
+	}
+
+	memcpy(&value, r->data + r->pos, sizeof(value));
+	r->pos += sizeof(value);
+	return value;
+}
+
+/* Returns a new string, or null for a null string or on failure. */
+
+static char *get_string(struct reader *r)
+{
+	int32_t length;
+
+	if(r->failed || r->length - r->pos < sizeof(length)) {
+		r->failed = 1;
+		return NULL;
+	}
+
+	memcpy(&length, r->data + r->pos, sizeof(length));
+	r->pos += sizeof(length);
+
+	if(length < 0)
+		return NULL;
+
+	if(r->length - r->pos < (size_t) length) {
+		r->failed = 1;
+		return NULL;
+	}
+
+	char *s = xxmalloc(length + 1);
+	memcpy(s, r->data + r->pos, length);
+	s[length] = 0;
+	r->pos += length;
+	return s;
+}
+
+/* The variables are rebuilt directly, as dag_variable_create would consult the environment again. */
+
+static void get_variables(struct reader *r, struct hash_table *table)
+{
+	int64_t count = get_int(r);
+	int64_t i, j;
+
+	for(i = 0; i < count && !r->failed; i++) {
+		char *name = get_string(r);
+		int64_t nvalues = get_int(r);
+		if(!name || r->failed || nvalues < 0 || (size_t) nvalues > r->length) {
+			free(name);
+			r->failed = 1;
+			return;
+		}
+
+		struct dag_variable *var = xxmalloc(sizeof(*var));
+		var->count = 0;
+		var->values = nvalues ? xxmalloc(nvalues * sizeof(*var->values)) : NULL;
+
+		for(j = 0; j < nvalues; j++) {
+			int64_t nodeid = get_int(r);
+			char *value = get_string(r);
+			if(!value) {
+				r->failed = 1;
+				break;
+			}
+			struct dag_variable_value *v = dag_variable_value_create(value);
+			v->nodeid = nodeid;
+			var->values[var->count++] = v;
+			free(value);
+		}
+
+		hash_table_insert(table, name, var);
+		free(name);
+	}
+}
+
+static void get_node_files(struct reader *r, struct dag_node *n, int targets)
+{
+	int64_t count = get_int(r);
+	int64_t i;
+
+	for(i = 0; i < count && !r->failed; i++) {
+		char *filename = get_string(r);
+		char *remotename = get_string(r);
+		if(!filename) {
+			free(remotename);
+			r->failed = 1;
+			return;
+		}
+		if(targets) {
+			dag_node_add_target_file(n, filename, remotename);
+		} else {
+			dag_node_add_source_file(n, filename, remotename);
+		}
+		free(filename);
+		free(remotename);
+	}
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+The key covers the contents of the workflow, its syntax and arguments,
+the version of makeflow, and the environment, since variables
+may take their values from the environment while parsing.
+*/
+
+char *dag_cache_key(const char *filename, dag_syntax_type format, struct jx *args)
+{
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+
+	if(!sha1_file(filename, digest))
+		return NULL;
+
+	sha1_context_t context;
+	sha1_init(&context);
+	sha1_update(&context, DAG_CACHE_MAGIC, strlen(DAG_CACHE_MAGIC));
+	sha1_update(&context, CCTOOLS_VERSION, strlen(CCTOOLS_VERSION));
+	sha1_update(&context, digest, sizeof(digest));
+	sha1_update(&context, &format, sizeof(format));
+
+	if(args) {
+		char *text = jx_print_string(args);
+		sha1_update(&context, text, strlen(text));
+		free(text);
+	}
+
+	int count;
+	for(count = 0; environ[count]; count++) {
+	}
+
+	char **env = xxmalloc((count + 1) * sizeof(*env));
+	memcpy(env, environ, count * sizeof(*env));
+	qsort(env, count, sizeof(*env), compare_strings);
+
+	int i;
+	for(i = 0; i < count; i++) {
+		sha1_update(&context, env[i], strlen(env[i]) + 1);
+	}
+	free(env);
+
+	sha1_final(digest, &context);
+	return xxstrdup(sha1_string(digest));
+}
+
+int dag_cache_save(struct dag *d, const char *cachefile, const char *key)
+{
+	buffer_t b;
+	buffer_init(&b);
+
+	put_string(&b, DAG_CACHE_MAGIC);
+	put_string(&b, key);
+	put_string(&b, d->filename);
+	put_int(&b, d->nodeid_counter);
+	put_string(&b, d->default_category->name);
+
+	char *name;
+	put_int(&b, string_set_size(d->export_vars));
+	string_set_first_element(d->export_vars);
+	while(string_set_next_element(d->export_vars, &name)) {
+		put_string(&b, name);
+	}
+
+	struct category *c;
+	put_int(&b, hash_table_size(d->categories));
+	hash_table_firstkey(d->categories);
+	while(hash_table_nextkey(d->categories, &name, (void **) &c)) {
+		put_string(&b, name);
+		put_variables(&b, c->mf_variables);
+	}
+
+	struct dag_file *f;
+	put_int(&b, hash_table_size(d->files));
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		put_string(&b, f->filename);
+		put_int(&b, f->estimated_size);
+	}
+
+	/* Nodes are kept newest first, so write them in reverse to add them back in order. */
+	struct dag_node *n;
+	int count = 0;
+	for(n = d->nodes; n; n = n->next) {
+		count++;
+	}
+
+	struct dag_node **nodes = xxmalloc((count + 1) * sizeof(*nodes));
+	int i = count;
+	for(n = d->nodes; n; n = n->next) {
+		nodes[--i] = n;
+	}
+
+	put_int(&b, count);
+	for(i = 0; i < count; i++) {
+		n = nodes[i];
+		put_int(&b, n->nodeid);
+		put_int(&b, n->linenum);
+		put_int(&b, n->type);
+		put_int(&b, n->local_job);
+		put_int(&b, n->resource_request);
+		put_string(&b, n->category ? n->category->name : NULL);
+		if(n->type == DAG_NODE_TYPE_WORKFLOW) {
+			put_string(&b, n->workflow_file);
+			char *text = n->workflow_args ? jx_print_string(n->workflow_args) : NULL;
+			put_string(&b, text);
+			free(text);
+			put_int(&b, n->workflow_is_jx);
+		} else {
+			put_string(&b, n->command);
+		}
+		put_variables(&b, n->variables);
+		put_node_files(&b, n, n->source_files);
+		put_node_files(&b, n, n->target_files);
+	}
+	free(nodes);
+
+	put_string(&b, DAG_CACHE_MAGIC);
+
+	/* Write to a temporary file and rename, so a reader never sees a partial cache. */
+	char *tmpfile = string_format("%s.%d", cachefile, (int) getpid());
+	int result = 0;
+
+	int fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd >= 0) {
+		size_t length;
+		const char *data = buffer_tolstring(&b, &length);
+		if(full_write(fd, data, length) == (ssize_t) length && close(fd) == 0) {
+			result = rename(tmpfile, cachefile) == 0;
+		} else {
+			close(fd);
+		}
+		if(!result)
+			unlink(tmpfile);
+	}
+
+	if(result) {
+		debug(D_MAKEFLOW_PARSER, "wrote dag cache %s", cachefile);
+	} else {
+		debug(D_MAKEFLOW_PARSER, "couldn't write dag cache %s: %s", cachefile, strerror(errno));
+	}
+
+	free(tmpfile);
+	buffer_free(&b);
+	return result;
+}
+
+static struct dag *dag_cache_read(struct reader *r, const char *key)
+{
+	char *s;
+	int64_t count, i;
+
+	s = get_string(r);
+	int ok = s && !strcmp(s, DAG_CACHE_MAGIC);
+	free(s);
+	if(!ok)
+		return NULL;
+
+	s = get_string(r);
+	ok = s && !strcmp(s, key);
+	free(s);
+	if(!ok) {
+		debug(D_MAKEFLOW_PARSER, "dag cache is out of date");
+		return NULL;
+	}
+
+	struct dag *d = dag_create();
+
+	d->filename = get_string(r);
+	int64_t nodeid_counter = get_int(r);
+
+	s = get_string(r);
+	if(s) {
+		d->default_category = makeflow_category_lookup_or_create(d, s);
+		free(s);
+	}
+
+	count = get_int(r);
+	for(i = 0; i < count && !r->failed; i++) {
+		s = get_string(r);
+		if(s)
+			string_set_insert(d->export_vars, s);
+		free(s);
+	}
+
+	count = get_int(r);
+	for(i = 0; i < count && !r->failed; i++) {
+		s = get_string(r);
+		if(!s) {
+			r->failed = 1;
+			break;
+		}
+		struct category *c = makeflow_category_lookup_or_create(d, s);
+		free(s);
+		get_variables(r, c->mf_variables);
+	}
+
+	count = get_int(r);
+	for(i = 0; i < count && !r->failed; i++) {
+		s = get_string(r);
+		int64_t estimated_size = get_int(r);
+		if(!s) {
+			r->failed = 1;
+			break;
+		}
+		struct dag_file *f = dag_file_lookup_or_create(d, s);
+		f->estimated_size = estimated_size;
+		free(s);
+	}
+
+	count = get_int(r);
+	for(i = 0; i < count && !r->failed; i++) {
+		d->nodeid_counter = get_int(r);
+		int64_t linenum = get_int(r);
+		int64_t type = get_int(r);
+
+		struct dag_node *n = dag_node_create(d, linenum);
+		n->local_job = get_int(r);
+		n->resource_request = get_int(r);
+
+		s = get_string(r);
+		if(s) {
+			n->category = makeflow_category_lookup_or_create(d, s);
+			free(s);
+		}
+
+		if(type == DAG_NODE_TYPE_WORKFLOW) {
+			char *workflow = get_string(r);
+			char *text = get_string(r);
+			int64_t is_jx = get_int(r);
+			struct jx *args = text ? jx_parse_string(text) : NULL;
+			if(workflow) {
+				dag_node_set_workflow(n, workflow, args, is_jx);
+			} else {
+				r->failed = 1;
+			}
+			jx_delete(args);
+			free(workflow);
+			free(text);
+		} else {
+			s = get_string(r);
+			if(s) {
+				dag_node_set_command(n, s);
+			} else {
+				r->failed = 1;
+			}
+			free(s);
+		}
+
+		get_variables(r, n->variables);
+		get_node_files(r, n, 0);
+		get_node_files(r, n, 1);
+
+		dag_node_insert(n);
+	}
+
+	d->nodeid_counter = nodeid_counter;
+
+	s = get_string(r);
+	if(!s || strcmp(s, DAG_CACHE_MAGIC))
+		r->failed = 1;
+	free(s);
+
+	/*
+	A damaged cache leaves a partial dag, which is abandoned rather than
+	freed, as there is no function to delete a whole dag.
+	*/
+	if(r->failed) {
+		debug(D_MAKEFLOW_PARSER, "dag cache is damaged");
+		return NULL;
+	}
+
+	return d;
+}
+
+struct dag *dag_cache_load(const char *cachefile, const char *key)
+{
+	int fd = open(cachefile, O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	struct stat info;
+	if(fstat(fd, &info) < 0 || info.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+		return NULL;
+
+	struct reader r = {data, info.st_size, 0, 0};
+	struct dag *d = dag_cache_read(&r, key);
+
+	munmap(data, info.st_size);
+
+	if(d)
+		debug(D_MAKEFLOW_PARSER, "loaded dag from cache %s", cachefile);
+
+	return d;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,31 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef DAG_CACHE_H
+#define DAG_CACHE_H
+
+#include "dag.h"
+#include "parser.h"
+#include "jx.h"
+
+/*
+A dag cache is a binary image of a dag as it stands right after parsing,
+before it is closed over the environment, nodes, and categories.
+It records the nodes, files, categories, and variables, and is identified
+by a key computed from everything the parse depends on, so that a large
+workflow that has not changed is loaded without running the parser again.
+*/
+
+/* Compute the key of a workflow, or return null if the file cannot be read. */
+char *dag_cache_key(const char *filename, dag_syntax_type format, struct jx *args);
+
+/* Load a dag from a cache, or return null if the cache is missing, damaged, or has a different key. */
+struct dag *dag_cache_load(const char *cachefile, const char *key);
+
+/* Write a freshly parsed dag to a cache. Returns true on success. */
+int dag_cache_save(struct dag *d, const char *cachefile, const char *key);
+
+#endif
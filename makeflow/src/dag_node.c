@@ -83,9 +83,12 @@ void dag_node_delete(struct dag_node *n)
 		dag_node_footprint_delete(n->footprint);
 
 	rmsummary_delete(n->resources_requested);
+	rmsummary_delete(n->resources_allocated);
 	if(n->resources_measured)
 		rmsummary_delete(n->resources_measured);
 
+	free((char *) n->command);
+	free((char *) n->workflow_file);
 
 	jx_delete(n->workflow_args);
 	free(n);
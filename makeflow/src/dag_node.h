@@ -82,11 +82,18 @@ struct dag_node {
 	int children_remaining;
 	int only_my_children;               /* Number of nodes this node is the only parent. */
 
+	double priority;                    /* Higher is dispatched first. See dag_compute_priorities. */
+	int sources_missing;                /* Number of entries in source_files that do not exist yet. */
+	int ready_queued;                   /* Flag: is this node in d->ready_nodes? */
+	int expanded;                       /* Flag: was this node expanded on demand by dag_expand_rules? */
+
 	/* dynamic properties of execution */
 	batch_queue_id_t jobid;               /* The id this node get, either from the local or remote batch system. */
 	dag_node_state_t state;             /* Enum: DAG_NODE_STATE_{WAITING,RUNNING,...} */
 	int failure_count;                  /* How many times has this rule failed? (see -R and -r) */
 	time_t previous_completion;
+	time_t previous_start;              /* When this node last started running, according to the log. */
+	time_t previous_runtime;            /* How long this node ran when it last completed, or zero if unknown. */
 
 	const char *umbrella_spec;          /* the umbrella spec file for executing this job */
 	
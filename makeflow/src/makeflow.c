@@ -7,6 +7,7 @@ See the file COPYING for details.
 #include "auth_all.h"
 #include "auth_ticket.h"
 #include "batch_queue.h"
+#include "batch_wrapper.h"
 #include "cctools.h"
 #include "copy_stream.h"
 #include "create_dir.h"
@@ -22,6 +23,7 @@ See the file COPYING for details.
 #include "path.h"
 #include "random.h"
 #include "rmonitor.h"
+#include "stat_batch.h"
 #include "stringtools.h"
 #include "work_queue.h"
 #include "work_queue_catalog.h"
@@ -31,6 +33,7 @@ See the file COPYING for details.
 #include "jx_parse.h"
 #include "jx_getopt.h"
 #include "jx_print.h"
+#include "jx_pretty_print.h"
 #include "jx_eval.h"
 #include "create_dir.h"
 #include "sha1.h"
@@ -52,6 +55,7 @@ See the file COPYING for details.
 #include "makeflow_hook.h"
 
 #include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <libgen.h>
@@ -59,6 +63,7 @@ See the file COPYING for details.
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -89,6 +94,9 @@ an example.
 
 #define MAX_REMOTE_JOBS_DEFAULT 100
 
+/* The most completed jobs handled in one pass of the main loop. */
+#define MAKEFLOW_WAIT_MAX 1000
+
 /*
 Flags to control the basic behavior of the Makeflow main loop.
 */
@@ -97,7 +105,10 @@ enum job_submit_status {
 	JOB_SUBMISSION_SKIPPED,
 	JOB_SUBMISSION_SUBMITTED,
 	JOB_SUBMISSION_ABORTED,
-	JOB_SUBMISSION_TIMEOUT
+	JOB_SUBMISSION_TIMEOUT,
+	JOB_SUBMISSION_CLUSTERED,
+	JOB_SUBMISSION_DEFERRED,
+	JOB_SUBMISSION_PENDING
 };
 
 static sig_atomic_t makeflow_abort_flag = 0;
@@ -106,6 +117,9 @@ static int makeflow_submit_timeout = 32; // in seconds
 static int makeflow_retry_flag = 0;
 static int makeflow_retry_max = 5;
 
+/* The order in which ready nodes are dispatched, see dag_compute_priorities. */
+static dag_priority_t makeflow_node_priority = DAG_PRIORITY_DEPTH;
+
 /*
 Garbage Collection (GC) controls when and where intermediate
 files are cleaned up, so as to minimize disk space consumption.
@@ -155,6 +169,44 @@ the user takes some positive steps to that effect.
 static int local_jobs_max = 1;
 static int remote_jobs_max = MAX_REMOTE_JOBS_DEFAULT;
 
+/*
+If greater than one, independent remote jobs with the same category, resources,
+and environment are clustered together, up to this many in one batch job.
+*/
+static int makeflow_cluster_size = 1;
+
+/* Clusters that have been submitted, indexed by jobid. */
+static struct itable *makeflow_cluster_table = 0;
+
+static struct list *makeflow_cluster_remove( struct dag_node *n, uint64_t jobid );
+
+/*
+If set, remote jobs are submitted in the background by the batch queue,
+and these are the nodes whose submission is in progress, indexed by nodeid.
+*/
+static struct itable *makeflow_submitting = 0;
+
+static void makeflow_collect_submissions( struct dag *d, time_t stoptime );
+
+/* Remote jobs running, or being submitted in the background. */
+
+static int makeflow_remote_jobs_active( struct dag *d )
+{
+	return dag_remote_jobs_running(d) + (makeflow_submitting ? itable_size(makeflow_submitting) : 0);
+}
+
+/*
+If greater than zero, the rules of a JX workflow are expanded on demand,
+so that about this many nodes are waiting or running at once.
+*/
+static int makeflow_lazy_frontier = 0;
+
+/* Set if a rule could not be expanded, which stops the expansion of any more. */
+static int makeflow_lazy_failed = 0;
+
+/* Release complete nodes after this many nodes have been expanded on demand. */
+#define MAKEFLOW_LAZY_RELEASE_INTERVAL 1000
+
 /*
 The project name and manual port number chosen for the 
 Work Queue configuration.  A port number of zero indicates
@@ -213,6 +265,31 @@ once weaver/pbui tools are updated.)
 */
 static int log_verbose_mode = 0;
 
+/*
+If nonzero, sync the log in groups of records, at most every so many milliseconds.
+*/
+static int log_group_commit_interval = 0;
+static int log_group_commit_records = 1000;
+
+/*
+If set, write the time spent by makeflow itself in each phase to this file,
+to measure the overhead of the engine, e.g. on a large DAG with -T dryrun.
+*/
+static const char *engine_stats_file = 0;
+
+struct makeflow_engine_stats {
+	timestamp_t parse_time;
+	timestamp_t recovery_time;
+	timestamp_t run_time;
+	timestamp_t run_cpu_time;
+	int nodes_recovered;
+	int nodes_completed;
+	int64_t log_records;
+	int64_t log_bytes;
+};
+
+static struct makeflow_engine_stats engine_stats;
+
 /*
 Send periodic reports of type "makeflow" to the catalog
 server, viewable by the makeflow_status command. 
@@ -306,6 +383,7 @@ struct batch_job *makeflow_node_to_task(struct dag_node *n, struct batch_queue *
 {
 	struct batch_job *task = batch_job_create(queue);
 	task->taskid = n->nodeid;
+	task->priority = n->priority;
 
 	if(n->type==DAG_NODE_TYPE_COMMAND) {
 
@@ -408,6 +486,11 @@ static void makeflow_abort_all(struct dag *d)
 
 	printf("got abort signal...\n");
 
+	/* Jobs still being submitted must be known before they can be removed. */
+	if(makeflow_submitting) {
+		makeflow_collect_submissions(d, 0);
+	}
+
 	itable_firstkey(d->local_job_table);
 	while(itable_nextkey(d->local_job_table, &jobid, (void **) &n)) {
 		makeflow_abort_job(d,n,local_queue,jobid,"local");
@@ -416,6 +499,18 @@ static void makeflow_abort_all(struct dag *d)
 	itable_firstkey(d->remote_job_table);
 	while(itable_nextkey(d->remote_job_table, &jobid, (void **) &n)) {
 		makeflow_abort_job(d,n,remote_queue,jobid,"remote");
+
+		/* The other members of a cluster go with the same job. */
+		struct list *others = makeflow_cluster_remove(n, jobid);
+		if(others) {
+			struct dag_node *m;
+			while((m = list_pop_head(others))) {
+				makeflow_hook_node_abort(m);
+				makeflow_log_state_change(d, m, DAG_NODE_STATE_ABORTED);
+				makeflow_clean_node(d,remote_queue,m);
+			}
+			list_delete(others);
+		}
 	}
 }
 
@@ -423,6 +518,7 @@ static void makeflow_abort_all(struct dag *d)
 
 static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct batch_queue *queue, struct batch_job *task);
 static void makeflow_node_reset_by_file( struct dag *d, struct dag_file *f );
+static enum job_submit_status makeflow_task_submit_retry( struct batch_queue *queue, struct batch_job *task);
 
 /*
 Reset all state to cause a node to be re-run.
@@ -443,6 +539,16 @@ void makeflow_node_reset( struct dag *d, struct dag_node *n )
 		} else {
 			batch_queue_remove(remote_queue, n->jobid);
 			itable_remove(d->remote_job_table, n->jobid);
+
+			/* The other members of a cluster lost their job as well. */
+			struct list *others = makeflow_cluster_remove(n, n->jobid);
+			if(others) {
+				struct dag_node *m;
+				while((m = list_pop_head(others))) {
+					makeflow_node_reset(d, m);
+				}
+				list_delete(others);
+			}
 		}
 	}
 
@@ -497,9 +603,21 @@ void makeflow_node_decide_reset( struct dag *d, struct dag_node *n, int silent )
 	if(n->state == DAG_NODE_STATE_WAITING) {
 		// The job hasn't run yet, nothing to do.	
 	} else if(n->state == DAG_NODE_STATE_RUNNING && !(n->local_job && local_queue) && batch_queue_type == BATCH_QUEUE_TYPE_CONDOR) {
-		// It's a Condor job and still out there in the batch system, so note that and keep going.
-		if(!silent) fprintf(stderr, "rule still running: %s\n", n->command);
-		itable_insert(d->remote_job_table, n->jobid, n);
+		static struct itable *clustered_jobids = 0;
+		struct dag_node *other = itable_lookup(d->remote_job_table, n->jobid);
+		if(!clustered_jobids) clustered_jobids = itable_create(0);
+
+		if(other || itable_lookup(clustered_jobids, n->jobid)) {
+			// Rules that ran together in a cluster cannot be reconnected, so rerun all of them.
+			if(!silent) fprintf(stderr, "will retry clustered rule: %s\n", n->command);
+			itable_insert(clustered_jobids, n->jobid, n);
+			if(other) makeflow_node_reset(d,other);
+			makeflow_node_reset(d,n);
+		} else {
+			// It's a Condor job and still out there in the batch system, so note that and keep going.
+			if(!silent) fprintf(stderr, "rule still running: %s\n", n->command);
+			itable_insert(d->remote_job_table, n->jobid, n);
+		}
 	} else if(n->state == DAG_NODE_STATE_RUNNING || n->state == DAG_NODE_STATE_FAILED || n->state == DAG_NODE_STATE_ABORTED) {
 		// Otherwise, we cannot reconnect to the job, so rerun it
 		if(!silent) fprintf(stderr, "will retry failed rule: %s\n", n->command);
@@ -516,11 +634,6 @@ This is necessary because busy batch systems occasionally do not accept a job su
 
 static enum job_submit_status makeflow_node_submit_retry( struct batch_queue *queue, struct batch_job *task)
 {
-	time_t stoptime = time(0) + makeflow_submit_timeout;
-	int waittime = 1;
-	batch_queue_id_t jobid = 0;
-
-
 	/* Display the fully elaborated command, just like Make does. */
 	printf("submitting job: %s\n", task->command);
 
@@ -535,6 +648,23 @@ static enum job_submit_status makeflow_node_submit_retry( struct batch_queue *qu
 		return JOB_SUBMISSION_HOOK_FAILURE;
 	}
 
+	if(makeflow_submitting && queue == remote_queue && batch_queue_submit_async(queue, task)) {
+		return JOB_SUBMISSION_PENDING;
+	}
+
+	return makeflow_task_submit_retry(queue, task);
+}
+
+/*
+Submit a task to the batch system, retrying until makeflow_submit_timeout.
+*/
+
+static enum job_submit_status makeflow_task_submit_retry( struct batch_queue *queue, struct batch_job *task)
+{
+	time_t stoptime = time(0) + makeflow_submit_timeout;
+	int waittime = 1;
+	batch_queue_id_t jobid = 0;
+
 	while(1) {
 		if(makeflow_abort_flag) {
 			break;
@@ -570,6 +700,32 @@ static enum job_submit_status makeflow_node_submit_retry( struct batch_queue *qu
 }
 
 
+/*
+Record that a node is running as the given batch job.
+Only the first member of a cluster is entered in the job table,
+so that the table counts the batch jobs actually running.
+*/
+
+static void makeflow_node_running(struct dag *d, struct dag_node *n, batch_queue_id_t jobid, int insert)
+{
+	n->jobid = jobid;
+	/* Not sure if this is necessary/what it does. */
+	memcpy(n->resources_allocated, n->task->resources, sizeof(struct rmsummary));
+	makeflow_log_state_change(d, n, DAG_NODE_STATE_RUNNING);
+
+	if(is_local_job(n)) {
+		makeflow_local_resources_subtract(local_resources,n);
+	}
+
+	if(!insert) {
+		return;
+	} else if(n->local_job && local_queue) {
+		itable_insert(d->local_job_table, n->jobid, n);
+	} else {
+		itable_insert(d->remote_job_table, n->jobid, n);
+	}
+}
+
 /*
 Submit a node to the appropriate batch system, after materializing
 the necessary list of input and output files, and applying all options.
@@ -629,20 +785,7 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 			break;
 		case JOB_SUBMISSION_SUBMITTED:
 			debug(D_MAKEFLOW_RUN, "node %d was successfully submitted.", n->nodeid);
-			n->jobid = task->jobid;
-			/* Not sure if this is necessary/what it does. */
-			memcpy(n->resources_allocated, task->resources, sizeof(struct rmsummary));
-			makeflow_log_state_change(d, n, DAG_NODE_STATE_RUNNING);
-
-			if(is_local_job(n)) {
-				makeflow_local_resources_subtract(local_resources,n);
-			}
-
-			if(n->local_job && local_queue) {
-				itable_insert(d->local_job_table, n->jobid, n);
-			} else {
-				itable_insert(d->remote_job_table, n->jobid, n);
-			}
+			makeflow_node_running(d, n, task->jobid, 1);
 			break;
 		case JOB_SUBMISSION_ABORTED:
 			/* do nothing, as node was aborted before it was submitted. */
@@ -652,6 +795,13 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 			debug(D_MAKEFLOW_RUN, "node %d submission timed-out, retrying later.", n->nodeid);
 			/* do nothing, and let other rules to be waited/submitted. */
 			break;
+		case JOB_SUBMISSION_PENDING:
+			debug(D_MAKEFLOW_RUN, "node %d is being submitted in the background.", n->nodeid);
+			itable_insert(makeflow_submitting, n->nodeid, n);
+			break;
+		case JOB_SUBMISSION_CLUSTERED:
+		case JOB_SUBMISSION_DEFERRED:
+			break;
 	}
 
 	/* Restore old batch job options. */
@@ -663,6 +813,424 @@ static enum job_submit_status makeflow_node_submit(struct dag *d, struct dag_nod
 	return submitted;
 }
 
+/*
+Handle the remote jobs whose background submission has completed, waiting
+until stoptime as in batch_queue_wait_submitted.  A node whose job could not
+be submitted is left waiting, to be submitted again by a later dispatch,
+just as when a submission times out.
+*/
+
+static void makeflow_collect_submissions( struct dag *d, time_t stoptime )
+{
+	struct batch_job *task;
+	batch_queue_id_t jobid;
+
+	while((task = batch_queue_wait_submitted(remote_queue, &jobid, stoptime))) {
+		struct dag_node *n = itable_remove(makeflow_submitting, task->taskid);
+		if(!n) {
+			continue;
+		}
+
+		if(jobid > 0) {
+			printf("submitted job %"PRIbjid"\n", jobid);
+			task->jobid = jobid;
+			makeflow_node_running(d, n, jobid, 1);
+		} else {
+			fprintf(stderr, "couldn't submit batch job, will try again later...\n");
+			debug(D_MAKEFLOW_RUN, "node %d could not be submitted, retrying later.", n->nodeid);
+			dag_ready_push(d, n);
+		}
+	}
+}
+
+/*
+Small jobs may be clustered together into one batch job, so that the
+overhead of the batch system is paid once for the whole group.  Each member
+is prepared as a task of its own, with all of the usual hooks, and then
+the cluster runs the member commands one after the other in a wrapper
+script, which writes the exit status of each one into a status file.
+When the cluster completes, each member is completed with its own status.
+*/
+
+struct makeflow_cluster {
+	char *batch_options;
+	struct list *nodes;
+	struct hash_table *inner_names;
+	struct batch_job *task;
+	char *wrapper;
+	char *status_file;
+};
+
+static struct makeflow_cluster *makeflow_cluster_create(const char *batch_options)
+{
+	struct makeflow_cluster *c = xxcalloc(1, sizeof(*c));
+	c->batch_options = batch_options ? xxstrdup(batch_options) : 0;
+	c->nodes = list_create();
+	c->inner_names = hash_table_create(0, 0);
+	c->task = batch_job_create(remote_queue);
+	return c;
+}
+
+static void makeflow_cluster_delete(struct makeflow_cluster *c)
+{
+	if(c->wrapper) unlink(c->wrapper);
+	if(c->status_file) unlink(c->status_file);
+
+	free(c->batch_options);
+	list_delete(c->nodes);
+	hash_table_clear(c->inner_names, 0);
+	hash_table_delete(c->inner_names);
+	batch_job_delete(c->task);
+	free(c->wrapper);
+	free(c->status_file);
+	free(c);
+}
+
+static int makeflow_node_can_cluster(struct dag_node *n)
+{
+	return makeflow_cluster_size > 1 && n->type == DAG_NODE_TYPE_COMMAND && !(n->local_job && local_queue);
+}
+
+/* Jobs may only be clustered if they ask for the same resources, environment, and options. */
+
+static char *makeflow_cluster_key(struct dag *d, struct dag_node *n, const char *batch_options)
+{
+	struct jx *env = dag_node_env_create(d, n, should_send_all_local_environment);
+	char *env_string = jx_print_string(env);
+	char *resources_string = rmsummary_print_string(dag_node_dynamic_label(n), 1);
+
+	char *key = string_format("%s\n%s\n%s\n%s", n->category->name, resources_string, env_string, batch_options ? batch_options : "");
+
+	free(resources_string);
+	free(env_string);
+	jx_delete(env);
+
+	return key;
+}
+
+/* A task fits in a cluster unless two different files would have the same name in the job. */
+
+static int makeflow_cluster_fits(struct makeflow_cluster *c, struct batch_job *task)
+{
+	struct list *lists[2] = {task->input_files, task->output_files};
+	struct batch_file *f;
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		list_first_item(lists[i]);
+		while((f = list_next_item(lists[i]))) {
+			const char *outer = hash_table_lookup(c->inner_names, f->inner_name);
+			if(outer && strcmp(outer, f->outer_name)) return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void makeflow_cluster_add(struct makeflow_cluster *c, struct dag_node *n, struct batch_job *task)
+{
+	struct batch_file *f;
+
+	list_first_item(task->input_files);
+	while((f = list_next_item(task->input_files))) {
+		if(hash_table_lookup(c->inner_names, f->inner_name)) continue;
+		batch_job_add_input_file(c->task, f->outer_name, f->inner_name);
+		hash_table_insert(c->inner_names, f->inner_name, f->outer_name);
+	}
+
+	list_first_item(task->output_files);
+	while((f = list_next_item(task->output_files))) {
+		if(hash_table_lookup(c->inner_names, f->inner_name)) continue;
+		batch_job_add_output_file(c->task, f->outer_name, f->inner_name);
+		hash_table_insert(c->inner_names, f->inner_name, f->outer_name);
+	}
+
+	list_push_tail(c->nodes, n);
+}
+
+/* Write the wrapper that runs each member and records its exit status. */
+
+static int makeflow_cluster_write_wrapper(struct makeflow_cluster *c)
+{
+	struct dag_node *first = list_peek_head(c->nodes);
+	struct dag_node *n;
+	int i = 0;
+
+	c->status_file = string_format("makeflow.cluster.%d.status", first->nodeid);
+
+	struct batch_wrapper *w = batch_wrapper_create();
+	batch_wrapper_prefix(w, "./makeflow.cluster");
+
+	char *cmd = string_format("exec 3>%s", c->status_file);
+	batch_wrapper_pre(w, cmd);
+	free(cmd);
+
+	list_first_item(c->nodes);
+	while((n = list_next_item(c->nodes))) {
+		char *member = string_escape_shell(n->task->command);
+		cmd = string_format("if sh -c %s; then echo %d 0 >&3; else echo %d $? >&3; fi", member, i, i);
+		batch_wrapper_pre(w, cmd);
+		free(cmd);
+		free(member);
+		i++;
+	}
+
+	c->wrapper = batch_wrapper_write(w, c->task);
+	batch_wrapper_delete(w);
+
+	if(!c->wrapper) {
+		debug(D_MAKEFLOW_RUN, "couldn't write cluster wrapper: %s", strerror(errno));
+		return 0;
+	}
+
+	batch_job_set_command(c->task, c->wrapper);
+	batch_job_add_output_file(c->task, c->status_file, c->status_file);
+	return 1;
+}
+
+/*
+Submit a cluster as one batch job.  A cluster of one is submitted as a plain job.
+The cluster is consumed, except when it is submitted and kept until it completes.
+*/
+
+static enum job_submit_status makeflow_cluster_submit(struct dag *d, struct makeflow_cluster *c)
+{
+	struct batch_queue *queue = remote_queue;
+	struct dag_node *first = list_peek_head(c->nodes);
+	struct dag_node *n;
+	enum job_submit_status submitted;
+
+	char *previous_batch_options = NULL;
+	if(batch_queue_get_option(queue, "batch-options"))
+		previous_batch_options = xxstrdup(batch_queue_get_option(queue, "batch-options"));
+	if(c->batch_options)
+		batch_queue_set_option(queue, "batch-options", c->batch_options);
+
+	if(list_size(c->nodes) == 1) {
+		submitted = makeflow_task_submit_retry(queue, first->task);
+		if(submitted == JOB_SUBMISSION_SUBMITTED) {
+			makeflow_node_running(d, first, first->task->jobid, 1);
+		}
+		makeflow_cluster_delete(c);
+	} else if(!makeflow_cluster_write_wrapper(c)) {
+		list_first_item(c->nodes);
+		while((n = list_next_item(c->nodes))) {
+			makeflow_log_state_change(d, n, DAG_NODE_STATE_FAILED);
+		}
+		makeflow_failed_flag = 1;
+		makeflow_cluster_delete(c);
+		submitted = JOB_SUBMISSION_HOOK_FAILURE;
+	} else {
+		struct rmsummary *resources = rmsummary_copy(first->task->resources, 0);
+		if(resources->wall_time > 0) {
+			resources->wall_time *= list_size(c->nodes);
+		}
+		batch_job_set_resources(c->task, resources);
+		rmsummary_delete(resources);
+
+		batch_job_set_envlist(c->task, first->task->envlist);
+		c->task->taskid = first->nodeid;
+
+		list_first_item(c->nodes);
+		while((n = list_next_item(c->nodes))) {
+			c->task->priority = MAX(c->task->priority, n->task->priority);
+		}
+
+		printf("submitting cluster of %d jobs\n", list_size(c->nodes));
+		submitted = makeflow_task_submit_retry(queue, c->task);
+
+		if(submitted == JOB_SUBMISSION_SUBMITTED) {
+			itable_insert(makeflow_cluster_table, c->task->jobid, c);
+			list_first_item(c->nodes);
+			while((n = list_next_item(c->nodes))) {
+				makeflow_node_running(d, n, c->task->jobid, n == first);
+			}
+		} else {
+			makeflow_cluster_delete(c);
+		}
+	}
+
+	if(previous_batch_options) {
+		batch_queue_set_option(queue, "batch-options", previous_batch_options);
+		free(previous_batch_options);
+	}
+
+	return submitted;
+}
+
+/*
+Prepare a node as a member of a cluster, and add it to the open cluster
+for its kind of job, which is submitted once it is full.  The clusters
+still open at the end of a dispatch pass are submitted by makeflow_cluster_flush.
+*/
+
+static enum job_submit_status makeflow_cluster_node(struct dag *d, struct dag_node *n, struct hash_table *open_clusters)
+{
+	struct batch_queue *queue = remote_queue;
+	enum job_submit_status submitted = JOB_SUBMISSION_CLUSTERED;
+
+	struct dag_variable_lookup_set s = { d, n->category, n, NULL };
+	char *batch_options = dag_variable_lookup_string("BATCH_OPTIONS", &s);
+	char *key = makeflow_cluster_key(d, n, batch_options);
+
+	struct makeflow_cluster *c = hash_table_lookup(open_clusters, key);
+
+	/* Each open cluster will become one more running job. */
+	if(!c && makeflow_remote_jobs_active(d) + hash_table_size(open_clusters) >= remote_jobs_max) {
+		free(key);
+		free(batch_options);
+		return JOB_SUBMISSION_DEFERRED;
+	}
+
+	struct batch_job *task = makeflow_node_to_task(n, queue);
+	batch_queue_set_int_option(queue, "task-id", task->taskid);
+	n->task = task;
+
+	if(makeflow_hook_node_submit(n, task) != MAKEFLOW_HOOK_SUCCESS) {
+		makeflow_failed_flag = 1;
+		submitted = JOB_SUBMISSION_HOOK_FAILURE;
+		goto done;
+	}
+
+	makeflow_log_batch_file_list_state_change(d, task->output_files, DAG_FILE_STATE_EXPECT);
+
+	printf("submitting job: %s\n", task->command);
+
+	int rc = makeflow_hook_batch_submit(task);
+	if(rc == MAKEFLOW_HOOK_SKIP) {
+		/* Exited Normally was updated and may have been handled elsewhere (e.g. Archive) */
+		if(task->info->exited_normally) {
+			makeflow_node_complete(d, n, queue, task);
+		}
+		submitted = JOB_SUBMISSION_SKIPPED;
+		goto done;
+	} else if(rc != MAKEFLOW_HOOK_SUCCESS) {
+		makeflow_log_state_change(d, n, DAG_NODE_STATE_FAILED);
+		n->task = NULL;
+		batch_job_delete(task);
+		makeflow_failed_flag = 1;
+		submitted = JOB_SUBMISSION_HOOK_FAILURE;
+		goto done;
+	}
+
+	if(c && !makeflow_cluster_fits(c, task)) {
+		hash_table_remove(open_clusters, key);
+		submitted = makeflow_cluster_submit(d, c);
+		c = 0;
+		if(submitted == JOB_SUBMISSION_ABORTED || submitted == JOB_SUBMISSION_TIMEOUT)
+			goto done;
+		submitted = JOB_SUBMISSION_CLUSTERED;
+	}
+
+	if(!c) {
+		c = makeflow_cluster_create(batch_options);
+		hash_table_insert(open_clusters, key, c);
+	}
+
+	makeflow_cluster_add(c, n, task);
+
+	if(list_size(c->nodes) >= makeflow_cluster_size) {
+		hash_table_remove(open_clusters, key);
+		submitted = makeflow_cluster_submit(d, c);
+	}
+
+done:
+	free(key);
+	free(batch_options);
+	return submitted;
+}
+
+/* Submit all of the clusters still open, and return the last failure, if any. */
+
+static enum job_submit_status makeflow_cluster_flush(struct dag *d, struct hash_table *open_clusters)
+{
+	enum job_submit_status result = JOB_SUBMISSION_SUBMITTED;
+	struct makeflow_cluster *c;
+	char *key;
+
+	hash_table_firstkey(open_clusters);
+	while(hash_table_nextkey(open_clusters, &key, (void **) &c)) {
+		if(makeflow_abort_flag || result == JOB_SUBMISSION_TIMEOUT) {
+			/* The members are still waiting, and will be tried again. */
+			makeflow_cluster_delete(c);
+			continue;
+		}
+
+		enum job_submit_status submitted = makeflow_cluster_submit(d, c);
+		if(submitted == JOB_SUBMISSION_TIMEOUT || submitted == JOB_SUBMISSION_ABORTED)
+			result = submitted;
+	}
+	hash_table_clear(open_clusters, 0);
+
+	return result;
+}
+
+/*
+Complete each member of a cluster with the exit status recorded by the wrapper.
+A member with no recorded status takes the status of the whole batch job.
+*/
+
+static void makeflow_cluster_complete(struct dag *d, struct makeflow_cluster *c, struct batch_job_info *info)
+{
+	int count = list_size(c->nodes);
+	int *status = xxmalloc(count * sizeof(*status));
+	struct dag_node *n;
+	int i, code;
+
+	for(i = 0; i < count; i++) status[i] = -1;
+
+	FILE *file = fopen(c->status_file, "r");
+	if(file) {
+		while(fscanf(file, "%d %d", &i, &code) == 2) {
+			if(i >= 0 && i < count) status[i] = code;
+		}
+		fclose(file);
+	}
+
+	i = 0;
+	list_first_item(c->nodes);
+	while((n = list_next_item(c->nodes))) {
+		struct batch_job_info member = *info;
+		if(status[i] >= 0) {
+			member.exited_normally = 1;
+			member.exit_code = status[i];
+			member.exit_signal = 0;
+		} else if(member.exited_normally && member.exit_code == 0) {
+			member.exit_code = 1;
+		}
+		batch_job_set_info(n->task, &member);
+		makeflow_node_complete(d, n, remote_queue, n->task);
+		i++;
+	}
+
+	free(status);
+	makeflow_cluster_delete(c);
+}
+
+/*
+Remove the cluster running as a given job, if any, and return the members
+other than the given node, which the caller must reset or abort.
+*/
+
+static struct list *makeflow_cluster_remove(struct dag_node *n, uint64_t jobid)
+{
+	if(!makeflow_cluster_table) return 0;
+
+	struct makeflow_cluster *c = itable_remove(makeflow_cluster_table, jobid);
+	if(!c) return 0;
+
+	struct list *others = list_create();
+	struct dag_node *m;
+
+	list_first_item(c->nodes);
+	while((m = list_next_item(c->nodes))) {
+		if(m != n) list_push_tail(others, m);
+	}
+
+	makeflow_cluster_delete(c);
+	return others;
+}
+
 static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct rmsummary *resources)
 {
 	struct dag_file *f;
@@ -670,6 +1238,9 @@ static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct r
 	if(n->state != DAG_NODE_STATE_WAITING)
 		return 0;
 
+	if(makeflow_submitting && itable_lookup(makeflow_submitting, n->nodeid))
+		return 0;
+
 	if(is_local_job(n)) {
 		if(!makeflow_local_resources_available(local_resources,resources))
 			return 0;
@@ -679,7 +1250,7 @@ static int makeflow_node_ready(struct dag *d, struct dag_node *n, const struct r
 		if(dag_local_jobs_running(d) >= local_jobs_max)
 			return 0;
 	} else {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max)
+		if(makeflow_remote_jobs_active(d) >= remote_jobs_max)
 			return 0;
 	}
 
@@ -728,6 +1299,8 @@ int makeflow_nodes_remote_waiting_count(const struct dag *d) {
 
 /*
 Find all jobs ready to be run, then submit them.
+Only the nodes in the dag's ready queue are considered,
+so the cost is proportional to the number of ready nodes.
 */
 
 static void makeflow_dispatch_ready_jobs(struct dag *d)
@@ -744,8 +1317,19 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 	 */
 	int submission_timeout = 0;
 
-	for(n = d->nodes; n; n = n->next) {
-		if(dag_remote_jobs_running(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max) {
+	/* Completions must be durable in the log before their dependents run. */
+	makeflow_log_commit(d);
+
+	/* Nodes that are still waiting after this pass, to be tried again next time. */
+	struct list *deferred = list_create();
+
+	/* Clusters of jobs being gathered in this pass, by kind of job. */
+	struct hash_table *open_clusters = hash_table_create(0, 0);
+
+	while((n = dag_ready_pop(d))) {
+		list_push_tail(deferred, n);
+
+		if(makeflow_remote_jobs_active(d) >= remote_jobs_max && dag_local_jobs_running(d) >= local_jobs_max) {
 			break;
 		}
 
@@ -753,7 +1337,12 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 
 		if(makeflow_node_ready(d, n, resources)) {
 			if(is_local_job(n) || !submission_timeout) {
-				enum job_submit_status status = makeflow_node_submit(d, n, resources);
+				enum job_submit_status status;
+				if(makeflow_node_can_cluster(n)) {
+					status = makeflow_cluster_node(d, n, open_clusters);
+				} else {
+					status = makeflow_node_submit(d, n, resources);
+				}
 
 				if(status == JOB_SUBMISSION_ABORTED) {
 					break;
@@ -764,21 +1353,40 @@ static void makeflow_dispatch_ready_jobs(struct dag *d)
 			}
 		}
 	}
+
+	makeflow_cluster_flush(d, open_clusters);
+	hash_table_delete(open_clusters);
+
+	/* dag_ready_push ignores the nodes that were submitted or failed. */
+	while((n = list_pop_head(deferred))) {
+		dag_ready_push(d, n);
+	}
+	list_delete(deferred);
 }
 
 /*
 Check the the indicated file was created and log, error, or retry as appropriate.
 */
 
-int makeflow_node_check_file_was_created(struct dag *d, struct dag_node *n, struct dag_file *f)
+int makeflow_node_check_file_was_created(struct dag *d, struct dag_node *n, struct dag_file *f, struct stat_batch *outputs)
 {
 	struct stat buf;
 	int file_created = 0;
+	int result;
 
 	int64_t start_check = time(0);
 
+	/* A dry run does not execute anything, so assume that its outputs were created. */
+	if(batch_queue_type == BATCH_QUEUE_TYPE_DRYRUN) {
+		makeflow_log_file_state_change(n->d, f, DAG_FILE_STATE_EXISTS);
+		return 1;
+	}
+
+	/* The first check uses the outputs looked up together, later checks look again. */
+	result = stat_batch_lookup(outputs, f->filename, &buf);
+
 	while(!file_created) {
-		if(stat(f->filename, &buf) < 0) {
+		if(result < 0) {
 			fprintf(stderr, "%s did not create file %s\n", n->command, f->filename);
 		}
 		else if(output_len_check && buf.st_size <= 0) {
@@ -798,6 +1406,7 @@ int makeflow_node_check_file_was_created(struct dag *d, struct dag_node *n, stru
 			/* Failed to see the file. Sleep and try again. */
 			debug(D_MAKEFLOW_RUN, "Checking again for file %s.\n", f->filename);
 			sleep(1);
+			result = stat(f->filename, &buf);
 		} else {
 			/* Failed was not seen by makeflow in the aloted tries. */
 			debug(D_MAKEFLOW_RUN, "File %s was not created by rule %d.\n", f->filename, n->nodeid);
@@ -843,13 +1452,21 @@ static void makeflow_node_complete(struct dag *d, struct dag_node *n, struct bat
 	}
 
 	if (task->info->exited_normally && task->info->exit_code == 0) {
+		struct stat_batch *outputs = stat_batch_create(0);
+		list_first_item(n->task->output_files);
+		while ((bf = list_next_item(n->task->output_files))) {
+			stat_batch_add(outputs, bf->outer_name, 1);
+		}
+		stat_batch_run(outputs);
+
 		list_first_item(n->task->output_files);
 		while ((bf = list_next_item(n->task->output_files))) {
 			f = dag_file_lookup_or_create(d, bf->outer_name);
-			if (!makeflow_node_check_file_was_created(d, n, f)) {
+			if (!makeflow_node_check_file_was_created(d, n, f, outputs)) {
 				job_failed = 1;
 			}
 		}
+		stat_batch_delete(outputs);
 	} else {
 		if(task->info->exited_normally) {
 			fprintf(stderr, "%s failed with exit code %d\n", n->command, task->info->exit_code);
@@ -939,6 +1556,17 @@ whether provided by the user, or created by
 a prior run that was logged.
 */
 
+static int makeflow_check_file_wanted(struct dag_file *f)
+{
+	/* Skip special files that are not connected to the DAG nodes. */
+	if(!f->created_by && !list_size(f->needed_by)) return 0;
+
+	/* Skip any file that should not exist yet. */
+	if(!dag_file_should_exist(f)) return 0;
+
+	return 1;
+}
+
 static int makeflow_check_files(struct dag *d)
 {
 	struct stat buf;
@@ -949,17 +1577,30 @@ static int makeflow_check_files(struct dag *d)
 
 	printf("checking files for unexpected changes...  (use --skip-file-check to skip this step)\n");
 
+	/* Look up all of the files at once, rather than waiting for each one in turn. */
+	struct stat_batch *batch = stat_batch_create(0);
+
 	hash_table_firstkey(d->files);
 	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		if(makeflow_check_file_wanted(f)) {
+			/* Only the existence of source files matters. */
+			stat_batch_add(batch, f->filename, !dag_file_is_source(f));
+		}
+	}
+
+	stat_batch_run(batch);
 
-		/* Skip special files that are not connected to the DAG nodes. */
-		if(!f->created_by && !list_size(f->needed_by)) continue;
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
 
-		/* Skip any file that should not exist yet. */
-		if(!dag_file_should_exist(f)) continue;
+		if(!makeflow_check_file_wanted(f)) continue;
 
 		/* Check for the presence of the file. */
-		int result = stat(f->filename, &buf );
+		int result = stat_batch_lookup(batch, f->filename, &buf);
+		if(result < 0 && errno == EAGAIN) {
+			/* A reset made this file wanted after the batch was run. */
+			result = stat(f->filename, &buf);
+		}
 
 		if(dag_file_is_source(f)) {
 			/* Source files must exist before running */
@@ -984,6 +1625,8 @@ static int makeflow_check_files(struct dag *d)
 		}
 	}
 
+	stat_batch_delete(batch);
+
 	if(errors>0 || warnings>0) {
 		printf("found %d errors and %d warnings during consistency check.\n", errors,warnings);
 	}
@@ -1034,11 +1677,100 @@ static int makeflow_check_batch_consistency(struct dag *d)
 Main loop for running a makeflow: submit jobs, wait for completion, keep going until everything done.
 */
 
+/*
+Expand more rules of a lazy workflow, to keep the frontier of waiting
+and running nodes full.  The new nodes are checked like the rules parsed
+at the start, and added to the ready queue.
+*/
+
+static void makeflow_expand_rules( struct dag *d )
+{
+	static int expanded_since_release = 0;
+	struct dag_node *n;
+	struct dag_file *f;
+	struct stat info;
+
+	if(!d->lazy_rules || makeflow_lazy_failed)
+		return;
+
+	int active = d->node_states[DAG_NODE_STATE_WAITING] + d->node_states[DAG_NODE_STATE_RUNNING];
+	if(active >= makeflow_lazy_frontier)
+		return;
+
+	struct list *created = list_create();
+	int count = dag_expand_rules(d, makeflow_lazy_frontier - active, created);
+	if(count < 0) {
+		fprintf(stderr, "makeflow: couldn't expand the rules of the workflow\n");
+		makeflow_lazy_failed = 1;
+		list_delete(created);
+		return;
+	}
+
+	/* Source files must exist before running, as makeflow_check_files does for the rules parsed first. */
+	struct stat_batch *batch = stat_batch_create(0);
+
+	list_first_item(created);
+	while((n = list_next_item(created))) {
+		list_first_item(n->source_files);
+		while((f = list_next_item(n->source_files))) {
+			if(dag_file_is_source(f))
+				stat_batch_add(batch, f->filename, 0);
+		}
+	}
+
+	stat_batch_run(batch);
+
+	list_first_item(created);
+	while((n = list_next_item(created))) {
+		int missing = 0;
+
+		list_first_item(n->source_files);
+		while((f = list_next_item(n->source_files))) {
+			if(dag_file_is_source(f) && stat_batch_lookup(batch, f->filename, &info) < 0) {
+				printf("error: %s does not exist, and is not created by any rule.\n", f->filename);
+				missing++;
+			}
+		}
+
+		d->node_states[n->state]++;
+
+		/* A node that can't run is left waiting, and the workflow stops once the running jobs finish. */
+		if(missing) {
+			makeflow_lazy_failed = 1;
+			continue;
+		}
+
+		dag_node_compute_priority(d, n, makeflow_node_priority);
+		dag_ready_add(d, n);
+	}
+
+	stat_batch_delete(batch);
+	list_delete(created);
+
+	expanded_since_release += count;
+	if(expanded_since_release >= MAKEFLOW_LAZY_RELEASE_INTERVAL || !d->lazy_rules) {
+		/* The batch jobs of complete nodes are no longer needed. */
+		for(n = d->nodes; n; n = n->next) {
+			if(n->expanded && n->state == DAG_NODE_STATE_COMPLETE && n->task) {
+				batch_job_delete(n->task);
+				n->task = NULL;
+			}
+		}
+
+		int released = dag_release_complete_nodes(d);
+		debug(D_MAKEFLOW_RUN, "released %d complete nodes", released);
+		expanded_since_release = 0;
+	}
+}
+
 static void makeflow_run( struct dag *d )
 {
 	struct dag_node *n;
 	batch_queue_id_t jobid;
-	struct batch_job_info info;
+	int i, count;
+	// Jobs that complete together are collected and handled in one pass.
+	batch_queue_id_t *jobids = xxmalloc(MAKEFLOW_WAIT_MAX * sizeof(*jobids));
+	struct batch_job_info *infos = xxmalloc(MAKEFLOW_WAIT_MAX * sizeof(*infos));
 	// Start Catalog at current time
 	timestamp_t start = timestamp_get();
 	// Last Report is created stall for first reporting.
@@ -1052,33 +1784,49 @@ static void makeflow_run( struct dag *d )
 	if(file_status_on){
 		makeflow_file_summary(d, project, batch_queue_type, start, file_status_name);
 	}
+
+	dag_ready_init(d);
 	
 	while(!makeflow_abort_flag) {
+		makeflow_expand_rules(d);
 		makeflow_dispatch_ready_jobs(d);
+		makeflow_log_commit(d);
 		/*
-			We continue the loop under 3 general conditions:
+			We continue the loop under 4 general conditions:
 			1. We have local jobs running
 			2. We have remote jobs running
 			3. A Hook determined it needed to loop again 
 				(e.g. Archived Jobs or Cleaned Jobs)
+			4. There are rules left to expand
  		*/
 		if(dag_local_jobs_running(d)==0 && 
-			dag_remote_jobs_running(d)==0 && 
+			makeflow_remote_jobs_active(d)==0 && 
 			(makeflow_hook_dag_loop(d) == MAKEFLOW_HOOK_END) &&
-			makeflow_nodes_remote_waiting_count(d) == 0) {
+			makeflow_nodes_remote_waiting_count(d) == 0 &&
+			(!d->lazy_rules || makeflow_lazy_failed)) {
 			break;
 		}
 
-		if(dag_remote_jobs_running(d)) {
+		if(makeflow_remote_jobs_active(d)) {
 			int tmp_timeout = 5;
-			jobid = batch_queue_wait_timeout(remote_queue, &info, time(0) + tmp_timeout);
-			if(jobid > 0) {
+			count = batch_queue_wait_many(remote_queue, jobids, infos, MAKEFLOW_WAIT_MAX, time(0) + tmp_timeout);
+
+			/* A job may complete as soon as it is submitted, so collect the submissions first. */
+			if(makeflow_submitting) {
+				makeflow_collect_submissions(d, time(0));
+			}
+
+			for(i = 0; i < count; i++) {
+				jobid = jobids[i];
 				printf("job %"PRIbjid" completed\n",jobid);
 				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
 				n = itable_remove(d->remote_job_table, jobid);
-				if(n){
+				struct makeflow_cluster *c = makeflow_cluster_table ? itable_remove(makeflow_cluster_table, jobid) : 0;
+				if(c) {
+					makeflow_cluster_complete(d, c, &infos[i]);
+				} else if(n){
 					// Stop gap until batch_queue_wait returns task struct
-					batch_job_set_info(n->task, &info);
+					batch_job_set_info(n->task, &infos[i]);
 					makeflow_node_complete(d, n, remote_queue, n->task);
 				}
 			}
@@ -1088,19 +1836,20 @@ static void makeflow_run( struct dag *d )
 			time_t stoptime;
 			int tmp_timeout = 5;
 
-			if(dag_remote_jobs_running(d)) {
+			if(makeflow_remote_jobs_active(d)) {
 				stoptime = time(0);
 			} else {
 				stoptime = time(0) + tmp_timeout;
 			}
 
-			jobid = batch_queue_wait_timeout(local_queue, &info, stoptime);
-			if(jobid > 0) {
+			count = batch_queue_wait_many(local_queue, jobids, infos, MAKEFLOW_WAIT_MAX, stoptime);
+			for(i = 0; i < count; i++) {
+				jobid = jobids[i];
 				debug(D_MAKEFLOW_RUN, "Job %" PRIbjid " has returned.\n", jobid);
 				n = itable_remove(d->local_job_table, jobid);
 				if(n){
 					// Stop gap until batch_queue_wait returns task struct
-					batch_job_set_info(n->task, &info);
+					batch_job_set_info(n->task, &infos[i]);
 					makeflow_node_complete(d, n, local_queue, n->task);
 				}
 			}
@@ -1126,7 +1875,8 @@ static void makeflow_run( struct dag *d )
 		 * wait loop, perform garbage collection after a proportional
 		 * amount of tasks have passed. */
 		makeflow_gc_barrier--;
-		if(makeflow_gc_method != MAKEFLOW_GC_NONE && makeflow_gc_barrier == 0) {
+		/* Files needed by rules not yet expanded can't be collected. */
+		if(makeflow_gc_method != MAKEFLOW_GC_NONE && makeflow_gc_barrier <= 0 && !d->lazy_rules) {
 			makeflow_gc(d, remote_queue, makeflow_gc_method, makeflow_gc_size, makeflow_gc_count);
 			makeflow_gc_barrier = MAX(d->nodeid_counter * makeflow_gc_task_ratio, 1);
 		}
@@ -1147,6 +1897,9 @@ static void makeflow_run( struct dag *d )
 	} else if(!makeflow_failed_flag && makeflow_gc_method != MAKEFLOW_GC_NONE) {
 		makeflow_gc(d,remote_queue,MAKEFLOW_GC_ALL,0,0);
 	}
+
+	free(jobids);
+	free(infos);
 }
 
 /*
@@ -1167,6 +1920,58 @@ static void handle_abort(int sig)
 
 }
 
+/*
+Return the cpu time (user and system) used by this process, in microseconds.
+*/
+
+static timestamp_t makeflow_cpu_time()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (timestamp_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+Write the times measured for --engine-stats, along with the size of the dag.
+Rates are per second of the run.
+*/
+
+static void makeflow_engine_stats_write(struct dag *d, const char *filename)
+{
+	struct makeflow_engine_stats *s = &engine_stats;
+
+	FILE *file = fopen(filename, "w");
+	if(!file) {
+		debug(D_ERROR, "could not write engine stats to %s: %s", filename, strerror(errno));
+		return;
+	}
+
+	double run_seconds = s->run_time / 1000000.0;
+	if(run_seconds <= 0) run_seconds = 1e-6;
+
+	/* Inserted in reverse, so that the phases print in order. */
+	struct jx *j = jx_object(0);
+	jx_insert_double(j, "log_bytes_per_second", s->log_bytes / run_seconds);
+	jx_insert_double(j, "log_records_per_second", s->log_records / run_seconds);
+	jx_insert_integer(j, "log_bytes", s->log_bytes);
+	jx_insert_integer(j, "log_records", s->log_records);
+	jx_insert_double(j, "nodes_per_second", s->nodes_completed / run_seconds);
+	jx_insert_integer(j, "nodes_completed", s->nodes_completed);
+	jx_insert_integer(j, "run_cpu_time", s->run_cpu_time);
+	jx_insert_integer(j, "run_time", s->run_time);
+	jx_insert_integer(j, "nodes_recovered", s->nodes_recovered);
+	jx_insert_integer(j, "recovery_time", s->recovery_time);
+	jx_insert_integer(j, "ancestors_time", d->ancestors_time);
+	jx_insert_integer(j, "parse_time", s->parse_time);
+	jx_insert_integer(j, "files", hash_table_size(d->files));
+	jx_insert_integer(j, "nodes", itable_size(d->node_table));
+
+	jx_pretty_print_stream(j, file);
+	fprintf(file, "\n");
+	fclose(file);
+	jx_delete(j);
+}
+
 static void show_help_run(const char *cmd)
 {
 		/* Stars indicate 80-column limit.  Try to keep things within 79 columns.       */
@@ -1196,12 +2001,22 @@ static void show_help_run(const char *cmd)
 	printf("    --jx-args=<file>            File defining JX variables for JX workflow.\n");
 	printf("    --jx-define=<VAR>=<EXPR>	Set the JX variable VAR to JX expression EXPR.\n");
 	printf("    --log-verbose               Add node id symbol tags in the makeflow log.\n");
+	printf("    --log-group-commit=<ms>     Sync the makeflow log at most every <ms> milliseconds.\n");
+	printf("    --log-group-records=<#>     With --log-group-commit, sync after this many records.\n");
+	printf("    --engine-stats=<file>       Write the time spent by makeflow in each phase to <file>.\n");
 	printf(" -j,--max-local=<#>             Max number of local jobs to run at once.\n");
 	printf(" -J,--max-remote=<#>            Max number of remote jobs to run at once.\n");
+	printf("    --jx-lazy-rules=<#>         Expand the rules of a JX workflow on demand,\n");
+	printf("                                  keeping about this many jobs waiting or running.\n");
+	printf("    --cluster-size=<#>          Run up to this many small remote jobs\n");
+	printf("                                  together in one batch job.\n");
+	printf("    --node-priority=<mode>      Order of ready jobs.\n");
+	printf("                                  (depth|critical-path|fan-out|free-disk)\n");
 	printf(" -R,--retry                     Retry failed batch jobs up to 5 times.\n");
 	printf(" -r,--retry-count=<n>           Retry failed batch jobs up to n times.\n");
 	printf("    --send-environment          Send local environment variables for execution.\n");
 	printf(" -S,--submission-timeout=<#>    Time to retry failed batch job submission.\n");
+	printf("    --async-submit              Submit remote jobs in the background.\n");
 	printf(" -f,--summary-log=<file>        Write summary of workflow to this file at end.\n");
 	printf("    --file-status=<file>        Write summary of workflow to file periodically.\n");
 	printf("    --file-status-interval=<file>	Set time interval for periodic workflow summary.\n");
@@ -1221,8 +2036,11 @@ static void show_help_run(const char *cmd)
 	printf(" -X,--change-directory=<dir>    Change to <dir> before executing the workflow.\n");
 	printf(" -g,--gc=<type>                 Enable garbage collector.(ref_cnt|on_demand|all)\n");
 	printf("    --gc-size=<int>             Set disk size to trigger GC (on_demand only)\n");
+	printf("    --gc-order=<order>          Collect the largest or least recently needed files first.(size|lru)\n");
 	printf(" -G,--gc-count=<int>            Set number of files to trigger GC.(ref_cnt only)\n");
 	printf("    --mounts=<mountfile>        Use this file as a mountlist\n");
+	printf("    --dag-cache[=<file>]        Keep the parsed workflow in this file and load\n");
+	printf("                                  it while the workflow is unchanged.\n");
 	printf("    --skip-file-check           Do not check for file existence before running.\n");
 	printf("    --do-not-save-failed-output Disables saving failed nodes to directory.\n"); 
 	printf("    --shared-fs=<dir>           Assume that <dir> is in a shared filesystem.\n");
@@ -1253,6 +2071,7 @@ static void show_help_run(const char *cmd)
 	printf("    --local-cores=#             Max number of local cores to use.\n");
 	printf("    --local-memory=#            Max amount of local memory (MB) to use.\n");
 	printf("    --local-disk=#              Max amount of local disk (MB) to use.\n");
+	printf("    --local-cpu-affinity        Bind each local job to cpus of its own.\n");
 	printf("    --safe-submit-mode          Excludes resources at submission.\n");
 	printf("                                  (SLURM, TORQUE, and PBS)\n");
 	printf("    --verbose-jobnames          Set the job name based on the command.\n");
@@ -1278,6 +2097,7 @@ static void show_help_run(const char *cmd)
 	printf(" --parrot-path=<path>           Path to parrot_run for --enforcement.\n");
 	printf(" --env-replace-path=<path>      Path to env_replace for --enforcement.\n");
 	printf(" --k8s-image=<path>             Container image used by kubernetes.\n");
+	printf(" --k8s-api=<url>                Manage pods through the kubernetes api at <url>.\n");
 	printf(" --sandbox                      Surround node command with sandbox wrapper.\n");
 	printf(" --vc3-builder                  VC3 Builder enabled.\n");
 	printf(" --vc3-exe=<file>               VC3 Builder executable location.\n");
@@ -1305,12 +2125,15 @@ int main(int argc, char *argv[])
 	char *dagfile = NULL;
 	char *change_dir = NULL;
 	char *batchlogfilename = NULL;
+	char *dagcachefilename = NULL;
+	int use_dag_cache = 0;
 	const char *batch_submit_options = NULL;
 	makeflow_clean_depth clean_mode = MAKEFLOW_CLEAN_NONE;
 	char *email_summary_to = NULL;
 	int explicit_remote_jobs_max = 0;
 	int explicit_local_jobs_max = 0;
 	int explicit_local_cores = 0;
+	int local_cpu_affinity = 0;
 	int explicit_local_memory = 0;
 	int explicit_local_disk = 0;
 
@@ -1323,6 +2146,9 @@ int main(int argc, char *argv[])
 	timestamp_t runtime = 0;
 	int disable_afs_check = 0;
 	timestamp_t time_completed = 0;
+	timestamp_t phase_start = 0;
+	timestamp_t run_cpu_start = 0;
+	long run_log_offset = 0;
 	const char *option_scheduler = NULL;
 	const char *option_keepalive_interval = NULL;
 	const char *option_keepalive_timeout = NULL;
@@ -1352,6 +2178,7 @@ int main(int argc, char *argv[])
 	struct jx *hook_args = base_hook_args;
 
 	char *k8s_image = NULL;
+	char *k8s_api = NULL;
 	extern struct makeflow_hook makeflow_hook_basic_wrapper;
 	extern struct makeflow_hook makeflow_hook_docker;
 	extern struct makeflow_hook makeflow_hook_enforcement;
@@ -1416,10 +2243,12 @@ int main(int argc, char *argv[])
 		LONG_OPT_FILE_CREATION_PATIENCE_WAIT_TIME,
 		LONG_OPT_FAIL_DIR,
 		LONG_OPT_GC_SIZE,
+		LONG_OPT_GC_ORDER,
 		LONG_OPT_IGNORE_MEM,
 		LONG_OPT_LOCAL_CORES,
 		LONG_OPT_LOCAL_MEMORY,
 		LONG_OPT_LOCAL_DISK,
+		LONG_OPT_LOCAL_CPU_AFFINITY,
 		LONG_OPT_BATCH_MEM_TYPE,
 		LONG_OPT_MONITOR,
 		LONG_OPT_MONITOR_EXE,
@@ -1429,6 +2258,9 @@ int main(int argc, char *argv[])
 		LONG_OPT_MONITOR_OPENED_FILES,
 		LONG_OPT_MONITOR_TIME_SERIES,
 		LONG_OPT_MOUNTS,
+		LONG_OPT_DAG_CACHE,
+		LONG_OPT_NODE_PRIORITY,
+		LONG_OPT_CLUSTER_SIZE,
 		LONG_OPT_SAFE_SUBMIT,
 		LONG_OPT_SANDBOX,
 		LONG_OPT_STORAGE_TYPE,
@@ -1442,6 +2274,9 @@ int main(int argc, char *argv[])
 		LONG_OPT_VC3_OPT,
 		LONG_OPT_VERBOSE_PARSING,
 		LONG_OPT_LOG_VERBOSE_MODE,
+		LONG_OPT_LOG_GROUP_COMMIT,
+		LONG_OPT_LOG_GROUP_RECORDS,
+		LONG_OPT_ENGINE_STATS,
 		LONG_OPT_WORKING_DIR,
 		LONG_OPT_PREFERRED_CONNECTION,
 		LONG_OPT_WAIT_FOR_WORKERS,
@@ -1456,6 +2291,7 @@ int main(int argc, char *argv[])
 		LONG_OPT_JX,
 		LONG_OPT_JX_ARGS,
 		LONG_OPT_JX_DEFINE,
+		LONG_OPT_JX_LAZY_RULES,
 		LONG_OPT_SKIP_FILE_CHECK,
 		LONG_OPT_UMBRELLA_BINARY,
 		LONG_OPT_UMBRELLA_LOG_PREFIX,
@@ -1480,7 +2316,9 @@ int main(int argc, char *argv[])
 		LONG_OPT_ARCHIVE_READ,
 		LONG_OPT_ARCHIVE_WRITE,
 		LONG_OPT_SEND_ENVIRONMENT,
+		LONG_OPT_ASYNC_SUBMIT,
 		LONG_OPT_K8S_IMG,
+		LONG_OPT_K8S_API,
 		LONG_OPT_VERBOSE_JOBNAMES,
 		LONG_OPT_KEEP_WRAPPER_STDOUT,
 		LONG_OPT_TLQ,
@@ -1512,6 +2350,7 @@ int main(int argc, char *argv[])
 		{"wait-for-files-upto", required_argument, 0, LONG_OPT_FILE_CREATION_PATIENCE_WAIT_TIME},
 		{"gc", required_argument, 0, 'g'},
 		{"gc-size", required_argument, 0, LONG_OPT_GC_SIZE},
+		{"gc-order", required_argument, 0, LONG_OPT_GC_ORDER},
 		{"gc-count", required_argument, 0, 'G'},
 		{"help", no_argument, 0, 'h'},
 		{"ignore-memory-spec", no_argument, 0, LONG_OPT_IGNORE_MEM},
@@ -1519,6 +2358,7 @@ int main(int argc, char *argv[])
 		{"local-cores", required_argument, 0, LONG_OPT_LOCAL_CORES},
 		{"local-memory", required_argument, 0, LONG_OPT_LOCAL_MEMORY},
 		{"local-disk", required_argument, 0, LONG_OPT_LOCAL_DISK},
+		{"local-cpu-affinity", no_argument, 0, LONG_OPT_LOCAL_CPU_AFFINITY},
 		{"makeflow-log", required_argument, 0, 'l'},
 		{"max-local", required_argument, 0, 'j'},
 		{"max-remote", required_argument, 0, 'J'},
@@ -1531,6 +2371,9 @@ int main(int argc, char *argv[])
 		{"monitor-with-opened-files", no_argument, 0, LONG_OPT_MONITOR_OPENED_FILES},
 		{"monitor-with-time-series",  no_argument, 0, LONG_OPT_MONITOR_TIME_SERIES},
 		{"mounts",  required_argument, 0, LONG_OPT_MOUNTS},
+		{"dag-cache", optional_argument, 0, LONG_OPT_DAG_CACHE},
+		{"node-priority", required_argument, 0, LONG_OPT_NODE_PRIORITY},
+		{"cluster-size", required_argument, 0, LONG_OPT_CLUSTER_SIZE},
 		{"password", required_argument, 0, LONG_OPT_PASSWORD},
 		{"port", required_argument, 0, 'p'},
 		{"port-file", required_argument, 0, 'Z'},
@@ -1542,6 +2385,7 @@ int main(int argc, char *argv[])
 		{"safe-submit-mode", no_argument, 0, LONG_OPT_SAFE_SUBMIT},
 		{"sandbox", no_argument, 0, LONG_OPT_SANDBOX},
 		{"send-environment", no_argument, 0, LONG_OPT_SEND_ENVIRONMENT},
+		{"async-submit", no_argument, 0, LONG_OPT_ASYNC_SUBMIT},
 		{"shared-fs", required_argument, 0, LONG_OPT_SHARED_FS},
 		{"show-output", no_argument, 0, 'O'}, // Deprecated
 		{"ssl-key", required_argument, 0, LONG_OPT_SSL_KEY},
@@ -1558,6 +2402,9 @@ int main(int argc, char *argv[])
 		{"vc3-options", required_argument, 0, LONG_OPT_VC3_OPT},
 		{"version", no_argument, 0, 'v'},
 		{"log-verbose", no_argument, 0, LONG_OPT_LOG_VERBOSE_MODE},
+		{"log-group-commit", required_argument, 0, LONG_OPT_LOG_GROUP_COMMIT},
+		{"log-group-records", required_argument, 0, LONG_OPT_LOG_GROUP_RECORDS},
+		{"engine-stats", required_argument, 0, LONG_OPT_ENGINE_STATS},
 		{"working-dir", required_argument, 0, LONG_OPT_WORKING_DIR},
 		{"skip-file-check", no_argument, 0, LONG_OPT_SKIP_FILE_CHECK},
 		{"umbrella-binary", required_argument, 0, LONG_OPT_UMBRELLA_BINARY},
@@ -1584,6 +2431,7 @@ int main(int argc, char *argv[])
 		{"jx-context", required_argument, 0, LONG_OPT_JX_ARGS}, // Deprecated
 		{"jx-args", required_argument, 0, LONG_OPT_JX_ARGS},
 		{"jx-define", required_argument, 0, LONG_OPT_JX_DEFINE},
+		{"jx-lazy-rules", required_argument, 0, LONG_OPT_JX_LAZY_RULES},
 		{"enforcement", no_argument, 0, LONG_OPT_ENFORCEMENT},
 		{"parrot-path", required_argument, 0, LONG_OPT_PARROT_PATH},
 		{"env-replace-path", required_argument, 0, LONG_OPT_ENVREPLACE},
@@ -1599,6 +2447,7 @@ int main(int argc, char *argv[])
 		{"archive-read", no_argument, 0, LONG_OPT_ARCHIVE_READ},
 		{"archive-write", no_argument, 0, LONG_OPT_ARCHIVE_WRITE},
 		{"k8s-image", required_argument, 0, LONG_OPT_K8S_IMG},
+		{"k8s-api", required_argument, 0, LONG_OPT_K8S_API},
 		{"verbose-jobnames", no_argument, 0, LONG_OPT_VERBOSE_JOBNAMES},
 		{"keep-wrapper-stdout", no_argument, 0, LONG_OPT_KEEP_WRAPPER_STDOUT},
 		{"tlq", required_argument, 0, LONG_OPT_TLQ},
@@ -1678,6 +2527,16 @@ int main(int argc, char *argv[])
 			case LONG_OPT_GC_SIZE:
 				makeflow_gc_size = string_metric_parse(optarg);
 				break;
+			case LONG_OPT_GC_ORDER:
+				if(strcasecmp(optarg, "size") == 0) {
+					makeflow_gc_set_order(MAKEFLOW_GC_ORDER_SIZE);
+				} else if(strcasecmp(optarg, "lru") == 0) {
+					makeflow_gc_set_order(MAKEFLOW_GC_ORDER_LRU);
+				} else {
+					fprintf(stderr, "makeflow: invalid garbage collection order: %s\n", optarg);
+					exit(1);
+				}
+				break;
 			case 'G':
 				makeflow_gc_count = atoi(optarg);
 				break;
@@ -1702,6 +2561,9 @@ int main(int argc, char *argv[])
 			case 'm':
 				email_summary_to = xxstrdup(optarg);
 				break;
+			case LONG_OPT_LOCAL_CPU_AFFINITY:
+				local_cpu_affinity = 1;
+				break;
 			case LONG_OPT_LOCAL_CORES:
 				explicit_local_cores = atoi(optarg);
 				break;
@@ -1752,6 +2614,23 @@ int main(int argc, char *argv[])
 			case LONG_OPT_MOUNTS:
 				mountfile = xxstrdup(optarg);
 				break;
+			case LONG_OPT_DAG_CACHE:
+				use_dag_cache = 1;
+				if(optarg) {
+					free(dagcachefilename);
+					dagcachefilename = xxstrdup(optarg);
+				}
+				break;
+			case LONG_OPT_NODE_PRIORITY:
+				makeflow_node_priority = dag_priority_from_string(optarg);
+				if((int) makeflow_node_priority < 0) {
+					fprintf(stderr, "makeflow: invalid node priority: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case LONG_OPT_CLUSTER_SIZE:
+				makeflow_cluster_size = MAX(atoi(optarg), 1);
+				break;
 			case LONG_OPT_AMAZON_CONFIG:
 				amazon_config = xxstrdup(optarg);
 				break;
@@ -1849,6 +2728,15 @@ int main(int argc, char *argv[])
 			case LONG_OPT_LOG_VERBOSE_MODE:
 				log_verbose_mode = 1;
 				break;
+			case LONG_OPT_LOG_GROUP_COMMIT:
+				log_group_commit_interval = atoi(optarg);
+				break;
+			case LONG_OPT_LOG_GROUP_RECORDS:
+				log_group_commit_records = atoi(optarg);
+				break;
+			case LONG_OPT_ENGINE_STATS:
+				engine_stats_file = optarg;
+				break;
 			case LONG_OPT_WRAPPER:
 				if (makeflow_hook_register(&makeflow_hook_basic_wrapper, &hook_args) == MAKEFLOW_HOOK_FAILURE)
 					goto EXIT_WITH_FAILURE;
@@ -1955,6 +2843,10 @@ int main(int argc, char *argv[])
 					fatal("Failed to parse in JX Define.\n");
 				}
 				break;
+			case LONG_OPT_JX_LAZY_RULES:
+				dag_syntax = DAG_SYNTAX_JX;
+				makeflow_lazy_frontier = MAX(atoi(optarg), 1);
+				break;
 			case LONG_OPT_UMBRELLA_BINARY:
 				if (makeflow_hook_register(&makeflow_hook_umbrella, &hook_args) == MAKEFLOW_HOOK_FAILURE)
 					goto EXIT_WITH_FAILURE;
@@ -1978,6 +2870,9 @@ int main(int argc, char *argv[])
 			case LONG_OPT_K8S_IMG:
 				k8s_image = xxstrdup(optarg);
 				break;
+			case LONG_OPT_K8S_API:
+				k8s_api = xxstrdup(optarg);
+				break;
 #ifdef HAS_CURL
 			case LONG_OPT_S3_HOSTNAME:
 				if (makeflow_hook_register(&makeflow_hook_archive, &hook_args) == MAKEFLOW_HOOK_FAILURE)
@@ -2032,6 +2927,9 @@ int main(int argc, char *argv[])
 			case LONG_OPT_SEND_ENVIRONMENT:
 				should_send_all_local_environment = 1;
 				break;
+			case LONG_OPT_ASYNC_SUBMIT:
+				makeflow_submitting = itable_create(0);
+				break;
 			case LONG_OPT_ENFORCEMENT:
 				if (makeflow_hook_register(&makeflow_hook_enforcement, &hook_args) == MAKEFLOW_HOOK_FAILURE)
 					goto EXIT_WITH_FAILURE;
@@ -2197,13 +3095,28 @@ int main(int argc, char *argv[])
 	if(!logfilename)
 		logfilename = string_format("%s.makeflowlog", dagfile);
 
-	printf("parsing %s...\n",dagfile);
-	d = dag_from_file(dagfile, dag_syntax, jx_args);
+	if(!dagcachefilename)
+		dagcachefilename = string_format("%s.dagcache", dagfile);
+
+	phase_start = timestamp_get();
+
+	if(makeflow_lazy_frontier > 0) {
+		printf("parsing %s, expanding rules on demand...\n",dagfile);
+		d = dag_from_file_lazy(dagfile, jx_args);
+	} else if(use_dag_cache) {
+		printf("parsing %s (or loading %s)...\n",dagfile,dagcachefilename);
+		d = dag_from_file_cached(dagfile, dag_syntax, jx_args, dagcachefilename);
+	} else {
+		printf("parsing %s...\n",dagfile);
+		d = dag_from_file(dagfile, dag_syntax, jx_args);
+	}
 
 	if(!d) {
 		fatal("makeflow: couldn't load %s: %s\n", dagfile, strerror(errno));
 	}
 
+	engine_stats.parse_time = timestamp_get() - phase_start;
+
 	d->allocation_mode = allocation_mode;
 
 	/* Measure resources available for local job execution. */
@@ -2272,6 +3185,10 @@ int main(int argc, char *argv[])
 
 	printf("max running local jobs: %d\n",local_jobs_max);
 
+	if(makeflow_cluster_size > 1) {
+		makeflow_cluster_table = itable_create(0);
+	}
+
 	remote_queue = batch_queue_create(batch_queue_type,ssl_key_file,ssl_cert_file);
 	if(!remote_queue) {
 		fprintf(stderr, "makeflow: couldn't create batch queue.\n");
@@ -2295,6 +3212,7 @@ int main(int argc, char *argv[])
 
 	if(batch_queue_type == BATCH_QUEUE_TYPE_K8S) {
 		batch_queue_set_option(remote_queue, "k8s-image", k8s_image);
+		batch_queue_set_option(remote_queue, "k8s-api", k8s_api);
 	}
 
 	if(batch_queue_type == BATCH_QUEUE_TYPE_DRYRUN) {
@@ -2350,6 +3268,10 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if(local_cpu_affinity) {
+		batch_queue_set_option(local_queue ? local_queue : remote_queue, "cpu-affinity", "yes");
+	}
+
 	/* Remote storage modes do not (yet) support measuring storage for garbage collection. */
 
 	if(makeflow_gc_method == MAKEFLOW_GC_SIZE && !batch_queue_supports_feature(remote_queue, "gc_size")) {
@@ -2399,7 +3321,20 @@ int main(int argc, char *argv[])
 	} else if(rc == MAKEFLOW_HOOK_END) {
 		goto EXIT_WITH_SUCCESS;
 	}
-	printf("%s has %d rules.\n",dagfile,d->nodeid_counter);
+	if(d->lazy_rules && clean_mode != MAKEFLOW_CLEAN_NONE) {
+		/* Cleaning needs every file of the workflow. */
+		struct list *created = list_create();
+		int count = dag_expand_rules(d, INT_MAX, created);
+		list_delete(created);
+		if(count < 0)
+			goto EXIT_WITH_FAILURE;
+	}
+
+	if(d->lazy_rules) {
+		printf("%s has %d rules, and more are expanded on demand.\n",dagfile,d->nodeid_counter);
+	} else {
+		printf("%s has %d rules.\n",dagfile,d->nodeid_counter);
+	}
 
 	setlinebuf(stdout);
 	setlinebuf(stderr);
@@ -2409,10 +3344,19 @@ int main(int argc, char *argv[])
 	/* In case when the user uses --cache option to specify the mount cache dir and the log file also has
 	 * a cache dir logged, these two dirs must be the same. Otherwise exit.
 	 */
+	if(log_group_commit_interval > 0) {
+		makeflow_log_set_group_commit(log_group_commit_interval, log_group_commit_records);
+	}
+
+	phase_start = timestamp_get();
+
 	if(makeflow_log_recover(d, logfilename, log_verbose_mode, remote_queue, clean_mode )) {
 		goto EXIT_WITH_FAILURE;
 	}
 
+	engine_stats.recovery_time = timestamp_get() - phase_start;
+	engine_stats.nodes_recovered = d->node_states[DAG_NODE_STATE_COMPLETE];
+
 	if(skip_file_check) {
 		printf("skipping file checks.");
 	} else {
@@ -2421,6 +3365,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Uses the runtimes recovered from the log. */
+	dag_compute_priorities(d, makeflow_node_priority);
+
 	/* This check must happen after makeflow_log_recover which may load the cache_dir info into d->cache_dir.
 	 * This check must happen before makeflow_mount_install to guarantee that the program ends before any mount is copied if any target is invliad.
 	 */
@@ -2459,8 +3406,12 @@ int main(int argc, char *argv[])
 		}
 
 		if(clean_mode == MAKEFLOW_CLEAN_ALL) {
+			char *snapshotfilename = string_format("%s.snapshot", logfilename);
 			unlink(logfilename);
+			unlink(snapshotfilename);
 			unlink(batchlogfilename);
+			unlink(dagcachefilename);
+			free(snapshotfilename);
 		}
 
 		goto EXIT_WITH_SUCCESS;
@@ -2496,8 +3447,23 @@ int main(int argc, char *argv[])
 	}
 	else if(tlq_port && !debug_file_name) debug(D_TLQ, "cannot lookup makeflow TLQ URL: debug log not set");
 
+	phase_start = timestamp_get();
+	run_cpu_start = makeflow_cpu_time();
+	engine_stats.log_records = makeflow_log_records_written();
+	run_log_offset = ftell(d->logfile);
+
 	makeflow_run(d);
 
+	engine_stats.run_time = timestamp_get() - phase_start;
+	engine_stats.run_cpu_time = makeflow_cpu_time() - run_cpu_start;
+	engine_stats.nodes_completed = d->node_states[DAG_NODE_STATE_COMPLETE] - engine_stats.nodes_recovered;
+	engine_stats.log_records = makeflow_log_records_written() - engine_stats.log_records;
+	engine_stats.log_bytes = ftell(d->logfile) - run_log_offset;
+
+	if(makeflow_lazy_failed) {
+		goto EXIT_WITH_FAILURE;
+	}
+
 	if(makeflow_failed_flag == 0 && makeflow_nodes_local_waiting_count(d) > 0) {
 		debug(D_ERROR, "There are local jobs that could not be run. Usually this means that makeflow did not have enough local resources to run them.");
 		goto EXIT_WITH_FAILURE;
@@ -2519,6 +3485,9 @@ EXIT_WITH_FAILURE:
 	if(write_summary_to || email_summary_to)
 		makeflow_summary_create(d, write_summary_to, email_summary_to, runtime, time_completed, argc, argv, dagfile, remote_queue, makeflow_abort_flag, makeflow_failed_flag );
 
+	if(engine_stats_file)
+		makeflow_engine_stats_write(d, engine_stats_file);
+
 	int exit_value;
 	if(makeflow_abort_flag) {
 		makeflow_hook_dag_abort(d);
@@ -2562,6 +3531,7 @@ EXIT_WITH_FAILURE:
 	/* clean up allocated objects to satisfy valgrind */
 	if(logfilename) free(logfilename);
 	if(batchlogfilename) free(batchlogfilename);
+	if(dagcachefilename) free(dagcachefilename);
 	jx_delete(jx_args);
 	jx_delete(base_hook_args);
 
@@ -13,6 +13,7 @@ See the file COPYING for details.
 #include "copy_tree.h"
 #include "unlink_recursive.h"
 #include "path.h"
+#include "priority_queue.h"
 
 #include "dag.h"
 #include "makeflow_log.h"
@@ -22,6 +23,7 @@ See the file COPYING for details.
 #include <dirent.h>
 #include <sys/types.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -41,6 +43,57 @@ include measuring available space and inodes consumed.
 
 static int makeflow_gc_collected = 0;
 
+static makeflow_gc_order_t makeflow_gc_order = MAKEFLOW_GC_ORDER_SIZE;
+
+/*
+Rather than walk every file of the dag on each collection, the files are
+queued as their reference counts fall to zero and they become complete,
+so that a collection only touches the files it deletes. Entries are not
+removed when a file changes state again, but are checked when taken from
+the queue.
+*/
+
+static int makeflow_gc_collectible( struct dag *d, struct dag_file *f )
+{
+	return f->state == DAG_FILE_STATE_COMPLETE
+		&& !dag_file_is_source(f)
+		&& !set_lookup(d->outputs, f)
+		&& !set_lookup(d->inputs, f);
+}
+
+static double makeflow_gc_priority( struct dag_file *f )
+{
+	if(makeflow_gc_order == MAKEFLOW_GC_ORDER_LRU)
+		return -(double) timestamp_get();
+	return (double) dag_file_size(f);
+}
+
+void makeflow_gc_set_order( makeflow_gc_order_t order )
+{
+	makeflow_gc_order = order;
+}
+
+void makeflow_gc_file_complete( struct dag *d, struct dag_file *f )
+{
+	if(d->gc_files && makeflow_gc_collectible(d, f))
+		priority_queue_push(d->gc_files, f, makeflow_gc_priority(f));
+}
+
+/* The files complete before the first collection, e.g. from a recovered log, are queued at once. */
+
+static void makeflow_gc_init( struct dag *d )
+{
+	struct dag_file *f;
+	char *name;
+
+	d->gc_files = priority_queue_create(0);
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		makeflow_gc_file_complete(d, f);
+	}
+}
+
 /*
 Return true if disk space falls below the fixed minimum. (inexpensive!)
 XXX this value should be configurable.
@@ -269,29 +322,44 @@ int makeflow_clean(struct dag *d, struct batch_queue *queue, makeflow_clean_dept
 	return 0;
 }
 
-/* Collect available garbage, up to a limit of maxfiles. */
+/*
+Collect available garbage, up to a limit of maxfiles, in the order of
+the queue. If low_disk is not zero, stop as soon as the disk has more
+than low_disk bytes available. Files that could not be deleted are
+queued again for the next collection.
+*/
 
-static void makeflow_gc_all( struct dag *d, struct batch_queue *queue, int maxfiles)
+static void makeflow_gc_all( struct dag *d, struct batch_queue *queue, int maxfiles, uint64_t low_disk )
 {
 	int collected = 0;
 	struct dag_file *f;
-	char *name;
+	struct list *failed = list_create();
 
 	timestamp_t start_time, stop_time;
 
-	/* This will walk the table of files to collect and will remove any
-	 * that are below or equal to the threshold. */
+	if(!d->gc_files)
+		makeflow_gc_init(d);
+
 	start_time = timestamp_get();
-	hash_table_firstkey(d->files);
-	while(hash_table_nextkey(d->files, &name, (void **) &f) && collected < maxfiles) {
-		if(f->state == DAG_FILE_STATE_COMPLETE
-			&& !dag_file_is_source(f)
-			&& !set_lookup(d->outputs, f)
-			&& !set_lookup(d->inputs, f)
-			&& makeflow_clean_file(d, queue, f)){
-			collected++;
+	while(collected < maxfiles && (f = priority_queue_pop(d->gc_files))) {
+		if(!makeflow_gc_collectible(d, f))
+			continue;
+
+		if(makeflow_clean_file(d, queue, f)) {
+			list_push_tail(failed, f);
+			continue;
 		}
+
+		collected++;
+
+		if(low_disk && !directory_low_disk(".", low_disk))
+			break;
+	}
+
+	while((f = list_pop_head(failed))) {
+		priority_queue_push(d->gc_files, f, makeflow_gc_priority(f));
 	}
+	list_delete(failed);
 
 	stop_time = timestamp_get();
 
@@ -312,23 +380,27 @@ void makeflow_gc( struct dag *d, struct batch_queue *queue, makeflow_gc_method_t
 	case MAKEFLOW_GC_NONE:
 		break;
 	case MAKEFLOW_GC_COUNT:
+		/* Files are deleted as soon as no rule needs them, so all of the queue is collected. */
 		debug(D_MAKEFLOW_RUN, "Performing incremental file (%d) garbage collection", count);
-		makeflow_gc_all(d, queue, count);
+		makeflow_gc_all(d, queue, INT_MAX, 0);
 		break;
 	case MAKEFLOW_GC_ON_DEMAND:
-		if(d->completed_files - d->deleted_files > count || directory_low_disk(".",size)){
+		if(d->completed_files - d->deleted_files > count) {
 			debug(D_MAKEFLOW_RUN, "Performing on demand (%d) garbage collection", count);
-			makeflow_gc_all(d, queue, INT_MAX);
+			makeflow_gc_all(d, queue, INT_MAX, 0);
+		} else if(directory_low_disk(".", size)) {
+			debug(D_MAKEFLOW_RUN, "Performing on demand (%d) garbage collection until disk is above %" PRIu64 " bytes", count, size);
+			makeflow_gc_all(d, queue, INT_MAX, size);
 		}
 		break;
 	case MAKEFLOW_GC_SIZE:
 		if(directory_low_disk(".", size)) {
 			debug(D_MAKEFLOW_RUN, "Performing size (%d) garbage collection", count);
-			makeflow_gc_all(d, queue, INT_MAX);
+			makeflow_gc_all(d, queue, INT_MAX, size);
 		}
 		break;
 	case MAKEFLOW_GC_ALL:
-		makeflow_gc_all(d, queue, INT_MAX);
+		makeflow_gc_all(d, queue, INT_MAX, 0);
 		break;
 	}
 }
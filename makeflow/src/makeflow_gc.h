@@ -23,6 +23,11 @@ typedef enum {
 	MAKEFLOW_GC_ALL         /* Remove all collectable files right now. */
 } makeflow_gc_method_t;
 
+typedef enum {
+	MAKEFLOW_GC_ORDER_SIZE,       /* Collect the largest files first, to free space with the fewest deletions. */
+	MAKEFLOW_GC_ORDER_LRU         /* Collect the files first that were last needed the longest ago. */
+} makeflow_gc_order_t;
+
 typedef enum {
 	MAKEFLOW_CLEAN_NONE,          /* Clean nothing, default. */
 	MAKEFLOW_CLEAN_INTERMEDIATES, /* Clean only intermediate files. */
@@ -33,6 +38,10 @@ typedef enum {
 
 void makeflow_parse_input_outputs( struct dag *d );
 void makeflow_gc( struct dag *d, struct batch_queue *queue, makeflow_gc_method_t method, uint64_t size, int count );
+void makeflow_gc_set_order( makeflow_gc_order_t order );
+
+/* Note that no rule still to run needs f, so that it may be collected. */
+void makeflow_gc_file_complete( struct dag *d, struct dag_file *f );
 int  makeflow_clean_file( struct dag *d, struct batch_queue *queue, struct dag_file *f );
 void makeflow_clean_node( struct dag *d, struct batch_queue *queue, struct dag_node *n );
 
@@ -8,12 +8,17 @@ See the file COPYING for details.
 #include "makeflow_log.h"
 #include "makeflow_gc.h"
 #include "dag.h"
+#include "parser_jx.h"
 #include "get_line.h"
 #include "makeflow_mounts.h"
 
 #include "timestamp.h"
 #include "list.h"
 #include "debug.h"
+#include "full_io.h"
+#include "macros.h"
+#include "sha1.h"
+#include "stringtools.h"
 #include "xxmalloc.h"
 
 #include <limits.h>
@@ -22,6 +27,8 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define MAX_BUFFER_SIZE 4096
 
@@ -106,16 +113,66 @@ These event types indicate that the workflow as a whole has started or completed
 */
 
 void makeflow_node_decide_reset( struct dag *d, struct dag_node *n, int silent );
+static void makeflow_log_node_times( struct dag_node *n, int state, timestamp_t time );
+static void makeflow_log_snapshot( struct dag *d );
+static void makeflow_log_snapshot_event( struct dag *d );
 
 /*
 To balance between performance and consistency, we sync the log every 60 seconds
 on ordinary events, but sync immediately on important events like a makeflow restart.
+
+In group commit mode, records are collected in a large buffer instead, and written
+and synced together once group_commit_records have been logged or group_commit_interval
+has passed, and whenever makeflow_log_commit is called.  makeflow commits before
+it submits jobs, so that a completed job is durable before any job that depends on it.
 */
 
+#define GROUP_COMMIT_BUFFER_SIZE (1024*1024)
+
+static timestamp_t group_commit_interval = 0;
+static int group_commit_records = 0;
+static int group_commit_pending = 0;
+static timestamp_t group_commit_last = 0;
+static char *group_commit_buffer = 0;
+
+/* Count of records written to the log by this process, for --engine-stats. */
+static int64_t log_records_written = 0;
+
+void makeflow_log_set_group_commit( int interval_ms, int records )
+{
+	group_commit_interval = (timestamp_t) interval_ms * 1000;
+	group_commit_records = MAX(records, 1);
+}
+
+void makeflow_log_commit( struct dag *d )
+{
+	if(!d || !d->logfile || !group_commit_pending) return;
+
+	fflush(d->logfile);
+	fsync(fileno(d->logfile));
+	group_commit_pending = 0;
+	group_commit_last = timestamp_get();
+}
+
+int64_t makeflow_log_records_written()
+{
+	return log_records_written;
+}
+
 static void makeflow_log_sync( struct dag *d, int force )
 {
 	static time_t last_fsync = 0;
 
+	log_records_written++;
+
+	if(group_commit_interval > 0) {
+		group_commit_pending++;
+		if(force || group_commit_pending >= group_commit_records || timestamp_get() - group_commit_last >= group_commit_interval) {
+			makeflow_log_commit(d);
+		}
+		return;
+	}
+
 	/* Force buffered data to the kernel. */
 	fflush(d->logfile);
 
@@ -132,8 +189,12 @@ void makeflow_log_close( struct dag *d )
 	if(!d || !d->logfile) return;
 
 	makeflow_log_sync(d,1);
+	makeflow_log_snapshot(d);
 	fclose(d->logfile);
 	d->logfile = 0;
+
+	free(group_commit_buffer);
+	group_commit_buffer = 0;
 }
 
 void makeflow_log_started_event( struct dag *d )
@@ -194,17 +255,28 @@ void makeflow_log_state_change( struct dag *d, struct dag_node *n, int newstate
 	}
 	n->state = newstate;
 	d->node_states[n->state]++;
+	dag_ready_push(d, n);
 
-	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", timestamp_get(), n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
+	/* Keep the times up to date as recovery would find them, for snapshots. */
+	timestamp_t time = timestamp_get();
+	makeflow_log_node_times(n, newstate, time);
+
+	fprintf(d->logfile, "%" PRIu64 " %d %d %" PRIbjid " %d %d %d %d %d %d\n", time, n->nodeid, newstate, n->jobid, d->node_states[0], d->node_states[1], d->node_states[2], d->node_states[3], d->node_states[4], d->nodeid_counter);
 
 	makeflow_log_sync(d,0);
+	makeflow_log_snapshot_event(d);
 }
 
 void makeflow_log_file_state_change( struct dag *d, struct dag_file *f, int newstate )
 {
 	debug(D_MAKEFLOW_RUN, "file %s %s -> %s\n", f->filename, dag_file_state_name(f->state), dag_file_state_name(newstate));
 
+	int existed = dag_file_should_exist(f);
 	f->state = newstate;
+	dag_ready_file_changed(d, f, existed);
+
+	if(newstate == DAG_FILE_STATE_COMPLETE)
+		makeflow_gc_file_complete(d, f);
 
 	/* If a file is a wrapper global file do not log to avoid cleaning floating global files. */
 	if(f->type == DAG_FILE_TYPE_GLOBAL) return;
@@ -218,6 +290,7 @@ void makeflow_log_file_state_change( struct dag *d, struct dag_file *f, int news
 		d->deleted_files += 1;
 	}
 	makeflow_log_sync(d,0);
+	makeflow_log_snapshot_event(d);
 }
 
 void makeflow_log_batch_file_state_change( struct dag *d, struct batch_file *f, int newstate )
@@ -312,6 +385,362 @@ void makeflow_log_dag_structure( struct dag *d )
 	}
 }
 
+/* Record the times of a node state change, as read back from the log. */
+
+static void makeflow_log_node_times( struct dag_node *n, int state, timestamp_t time )
+{
+	/* Log timestamp is in microseconds, we need seconds for diff. */
+	n->previous_completion = (time_t) (time / 1000000);
+	if(state == DAG_NODE_STATE_RUNNING) {
+		n->previous_start = n->previous_completion;
+	} else if(state == DAG_NODE_STATE_COMPLETE && n->previous_start > 0) {
+		n->previous_runtime = n->previous_completion - n->previous_start;
+	}
+}
+
+/*
+Apply one line of the log to the dag.
+Returns 1 if the line was applied or ignored, 0 if it is not understood,
+and -1 if it conflicts with the options given to makeflow.
+*/
+
+/*
+Find a node named in the log.  If rules are expanded on demand, the node
+may not be expanded yet: since ids follow the order of expansion, expand
+rules until its id is reached.
+*/
+
+static struct dag_node *makeflow_log_lookup_node( struct dag *d, int nodeid )
+{
+	struct dag_node *n = itable_lookup(d->node_table, nodeid);
+
+	while(!n && d->lazy_rules && nodeid >= d->nodeid_counter) {
+		struct list *created = list_create();
+		int count = dag_expand_rules(d, nodeid - d->nodeid_counter + 1, created);
+		list_delete(created);
+
+		if(count < 0) {
+			fprintf(stderr, "makeflow: couldn't expand the rules of the workflow\n");
+			exit(1);
+		}
+		if(count == 0)
+			break;
+
+		n = itable_lookup(d->node_table, nodeid);
+	}
+
+	return n;
+}
+
+static int makeflow_log_recover_line( struct dag *d, char *line )
+{
+	char file[MAX_BUFFER_SIZE];
+	char source[PATH_MAX], cache_dir[NAME_MAX], cache_name[NAME_MAX];
+	int nodeid, state, jobid, file_state, type;
+	struct dag_node *n;
+	struct dag_file *f;
+	timestamp_t previous_completion_time;
+	uint64_t size;
+
+	if(sscanf(line, "# FILE %" SCNu64 " %s %d %" SCNu64 "", &previous_completion_time, file, &file_state, &size) == 4) {
+		f = dag_file_lookup_or_create(d, file);
+		f->state = file_state;
+		if(file_state == DAG_FILE_STATE_EXISTS){
+			d->completed_files += 1;
+			f->creation_logged = (time_t) (previous_completion_time / 1000000);
+		} else if(file_state == DAG_FILE_STATE_DELETE){
+			d->deleted_files += 1;
+		}
+	} else if(sscanf(line, "# CACHE %" SCNu64 " %s", &previous_completion_time, cache_dir) == 2) {
+		/* if the user specifies a cache dir using --cache dir, ignore the info from the log file */
+		if(!d->cache_dir) {
+			d->cache_dir = xxstrdup(cache_dir);
+		} else {
+			/* There are two possible reasons for the inconsistency:
+			 * 1) the cache dir specified via the --cache opt and in the log file mismatch;
+			 * 2) the log file includes multiple different CACHE entries.
+			 */
+			if(strcmp(cache_dir, d->cache_dir)) {
+				fprintf(stderr, "The --cache option (%s) does not match the cache dir (%s) in the log file!\n", d->cache_dir, cache_dir);
+				return -1;
+			}
+		}
+	} else if(sscanf(line, "# MOUNT %" SCNu64 " %s %s %s %d", &previous_completion_time, file, source, cache_name, &type) == 5) {
+		f = dag_file_lookup_or_create(d, file);
+
+		if(!f->source) {
+			f->source = xxstrdup(source);
+			f->cache_name = xxstrdup(cache_name);
+			f->type = type;
+		} else {
+			/* If a mount entry is specified in the mountfile and logged in a log file at the same time, they must not conflict with each other. */
+			/* If a mount entry is logged in a log file multiple times deliberately or not, they must not conflict with each other. */
+			if(makeflow_mount_check_consistency(file, f->source, source, d->cache_dir, cache_name)) {
+				return -1;
+			}
+		}
+	} else if(line[0] == '#') {
+		/* Ignore any other comment lines */
+	} else if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
+		n = makeflow_log_lookup_node(d, nodeid);
+		if(n) {
+			n->state = state;
+			n->jobid = jobid;
+			makeflow_log_node_times(n, state, previous_completion_time);
+		}
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+A snapshot is the state of every node and file, as it would be
+recovered by reading the log up to a given offset, so that a long log
+can be recovered by loading the snapshot and then reading only the rest.
+It is kept in the file LOG.snapshot, and is replaced atomically.
+
+Line format: # SNAPSHOT log_offset log_lines log_tail_sha1 completed_files deleted_files
+Line format: # CACHE and # MOUNT, as in the log.
+Line format: N node_id state job_id previous_completion previous_start previous_runtime
+Line format: F state creation_logged filename
+Line format: # END
+
+log_tail_sha1 is the checksum of the up to 4096 bytes of the log before
+log_offset, so a snapshot is never applied to a log it was not taken from.
+A snapshot is written after every few node or file events, proportional
+to the size of the dag so that the cost stays small, and when the log is closed.
+*/
+
+#define SNAPSHOT_TAIL_SIZE 4096
+#define SNAPSHOT_MIN_EVENTS 100000
+
+static char *snapshot_filename = 0;
+static char *snapshot_logfilename = 0;
+static int64_t snapshot_log_lines = 0;
+static off_t snapshot_log_offset = 0;
+static int64_t snapshot_events = 0;
+
+/* Count the lines of the log written since the last snapshot, so that errors can still be reported by line. */
+
+static int makeflow_log_count_lines( const char *logfilename, off_t offset )
+{
+	char buffer[65536];
+
+	int fd = open(logfilename, O_RDONLY);
+	if(fd < 0)
+		return 0;
+
+	while(snapshot_log_offset < offset) {
+		ssize_t actual = full_pread(fd, buffer, MIN((off_t) sizeof(buffer), offset - snapshot_log_offset), snapshot_log_offset);
+		if(actual <= 0) {
+			close(fd);
+			return 0;
+		}
+		ssize_t i;
+		for(i = 0; i < actual; i++) {
+			if(buffer[i] == '\n')
+				snapshot_log_lines++;
+		}
+		snapshot_log_offset += actual;
+	}
+
+	close(fd);
+	return 1;
+}
+
+static int makeflow_log_tail_checksum( const char *logfilename, off_t offset, char *checksum )
+{
+	unsigned char digest[SHA1_DIGEST_LENGTH];
+	char buffer[SNAPSHOT_TAIL_SIZE];
+	size_t length = MIN(offset, SNAPSHOT_TAIL_SIZE);
+
+	int fd = open(logfilename, O_RDONLY);
+	if(fd < 0)
+		return 0;
+
+	ssize_t actual = full_pread(fd, buffer, length, offset - length);
+	close(fd);
+	if(actual != (ssize_t) length)
+		return 0;
+
+	sha1_buffer(buffer, length, digest);
+	strcpy(checksum, sha1_string(digest));
+	return 1;
+}
+
+static void makeflow_log_snapshot( struct dag *d )
+{
+	char checksum[SHA1_DIGEST_ASCII_LENGTH + 1];
+	struct dag_node *n;
+	struct dag_file *f;
+	char *name;
+
+	/* Nodes that are not expanded yet, or were released, can't be recorded in a snapshot. */
+	if(!snapshot_filename || !d->logfile || d->lazy_rules || d->nodes_released)
+		return;
+
+	snapshot_events = 0;
+
+	fflush(d->logfile);
+	off_t offset = ftello(d->logfile);
+	if(offset < 0 || !makeflow_log_count_lines(snapshot_logfilename, offset) || !makeflow_log_tail_checksum(snapshot_logfilename, offset, checksum))
+		return;
+
+	char *tmpname = string_format("%s.tmp", snapshot_filename);
+	FILE *file = fopen(tmpname, "w");
+	if(!file) {
+		debug(D_MAKEFLOW_RUN, "couldn't write snapshot %s: %s", tmpname, strerror(errno));
+		free(tmpname);
+		return;
+	}
+
+	fprintf(file, "# SNAPSHOT %" PRIu64 " %" PRIi64 " %s %d %d\n", (uint64_t) offset, snapshot_log_lines, checksum, d->completed_files, d->deleted_files);
+
+	if(d->cache_dir)
+		fprintf(file, "# CACHE 0 %s\n", d->cache_dir);
+
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		if(f->source)
+			fprintf(file, "# MOUNT 0 %s %s %s %d\n", f->filename, f->source, f->cache_name, f->type);
+	}
+
+	for(n = d->nodes; n; n = n->next) {
+		fprintf(file, "N %d %d %" PRIbjid " %ld %ld %ld\n", n->nodeid, n->state, n->jobid, (long) n->previous_completion, (long) n->previous_start, (long) n->previous_runtime);
+	}
+
+	/* Global files are never logged, so they are not recovered either. */
+	hash_table_firstkey(d->files);
+	while(hash_table_nextkey(d->files, &name, (void **) &f)) {
+		if(f->type != DAG_FILE_TYPE_GLOBAL)
+			fprintf(file, "F %d %ld %s\n", f->state, (long) f->creation_logged, f->filename);
+	}
+
+	fprintf(file, "# END\n");
+
+	int failed = ferror(file);
+	failed |= fflush(file) != 0 || fsync(fileno(file)) != 0;
+	failed |= fclose(file) != 0;
+
+	if(failed || rename(tmpname, snapshot_filename) != 0) {
+		debug(D_MAKEFLOW_RUN, "couldn't write snapshot %s: %s", snapshot_filename, strerror(errno));
+		unlink(tmpname);
+	} else {
+		debug(D_MAKEFLOW_RUN, "wrote snapshot %s at offset %" PRIu64, snapshot_filename, (uint64_t) offset);
+	}
+
+	free(tmpname);
+}
+
+/* Count an event written to the log, and take a snapshot when enough have passed. */
+
+static void makeflow_log_snapshot_event( struct dag *d )
+{
+	snapshot_events++;
+
+	if(snapshot_events >= MAX(SNAPSHOT_MIN_EVENTS, 2 * (d->nodeid_counter + hash_table_size(d->files)))) {
+		makeflow_log_snapshot(d);
+	}
+}
+
+/* Check that the snapshot file ends with a complete END line. */
+
+static int makeflow_log_snapshot_complete( FILE *file )
+{
+	char end[7];
+
+	if(fseeko(file, -6, SEEK_END) != 0)
+		return 0;
+	if(fread(end, 1, 6, file) != 6)
+		return 0;
+	end[6] = 0;
+	rewind(file);
+
+	return !strcmp(end, "# END\n");
+}
+
+/*
+Load the snapshot, if it matches the log, and return the offset of
+the log at which to continue reading, or zero to read the whole log.
+Returns -1 if the snapshot conflicts with the options given to makeflow.
+*/
+
+static off_t makeflow_log_load_snapshot( struct dag *d, const char *logfilename, int *linenum )
+{
+	char checksum[SHA1_DIGEST_ASCII_LENGTH + 1];
+	char logged_checksum[SHA1_DIGEST_ASCII_LENGTH + 1];
+	char file[MAX_BUFFER_SIZE];
+	uint64_t offset;
+	int64_t lines;
+	int completed_files, deleted_files;
+	struct stat info;
+	char *line;
+
+	FILE *snapshot = fopen(snapshot_filename, "r");
+	if(!snapshot)
+		return 0;
+
+	if(!makeflow_log_snapshot_complete(snapshot) || !(line = get_line(snapshot))) {
+		fclose(snapshot);
+		return 0;
+	}
+
+	int n = sscanf(line, "# SNAPSHOT %" SCNu64 " %" SCNi64 " %40s %d %d", &offset, &lines, logged_checksum, &completed_files, &deleted_files);
+	free(line);
+
+	if(n != 5 || stat(logfilename, &info) < 0 || (uint64_t) info.st_size < offset
+		|| !makeflow_log_tail_checksum(logfilename, offset, checksum) || strcmp(checksum, logged_checksum)) {
+		debug(D_MAKEFLOW_RUN, "snapshot %s does not match log %s", snapshot_filename, logfilename);
+		fclose(snapshot);
+		return 0;
+	}
+
+	printf("recovering from snapshot %s...\n", snapshot_filename);
+
+	while((line = get_line(snapshot))) {
+		int nodeid, state, file_state;
+		batch_queue_id_t jobid;
+		long previous_completion, previous_start, previous_runtime, creation_logged;
+		int result = 1;
+
+		if(sscanf(line, "N %d %d %" SCNbjid " %ld %ld %ld", &nodeid, &state, &jobid, &previous_completion, &previous_start, &previous_runtime) == 6) {
+			struct dag_node *n = makeflow_log_lookup_node(d, nodeid);
+			if(n) {
+				n->state = state;
+				n->jobid = jobid;
+				n->previous_completion = previous_completion;
+				n->previous_start = previous_start;
+				n->previous_runtime = previous_runtime;
+			}
+		} else if(sscanf(line, "F %d %ld %s", &file_state, &creation_logged, file) == 3) {
+			struct dag_file *f = dag_file_lookup_or_create(d, file);
+			f->state = file_state;
+			f->creation_logged = creation_logged;
+		} else {
+			result = makeflow_log_recover_line(d, line);
+		}
+
+		if(result <= 0) {
+			if(result == 0)
+				fprintf(stderr, "makeflow: snapshot %s is corrupted, remove it to recover from the whole log\n", snapshot_filename);
+			free(line);
+			fclose(snapshot);
+			return -1;
+		}
+		free(line);
+	}
+
+	fclose(snapshot);
+
+	d->completed_files = completed_files;
+	d->deleted_files = deleted_files;
+	*linenum = lines;
+
+	return offset;
+}
+
 /*
 Recover the state of the workflow so far by reading back the state
 from the log file, if it exists.  (If not, create a new log.)
@@ -319,84 +748,51 @@ from the log file, if it exists.  (If not, create a new log.)
 
 int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode )
 {
-	char *line, file[MAX_BUFFER_SIZE];
-	int nodeid, state, jobid, file_state;
+	char *line;
 	int first_run = 1;
 	struct dag_node *n;
-	struct dag_file *f;
-	timestamp_t previous_completion_time;
-	uint64_t size;
+
+	free(snapshot_filename);
+	free(snapshot_logfilename);
+	snapshot_filename = string_format("%s.snapshot", filename);
+	snapshot_logfilename = xxstrdup(filename);
+	snapshot_log_lines = 0;
+	snapshot_log_offset = 0;
+	snapshot_events = 0;
 
 	d->logfile = fopen(filename, "r");
 	if(d->logfile) {
 		int linenum = 0;
 		first_run = 0;
 
+		off_t offset = makeflow_log_load_snapshot(d, filename, &linenum);
+		if(offset < 0) {
+			fclose(d->logfile);
+			return -1;
+		}
+		fseeko(d->logfile, offset, SEEK_SET);
+
 		printf("recovering from log file %s...\n",filename);
 
 		while((line = get_line(d->logfile))) {
-			char source[PATH_MAX], cache_dir[NAME_MAX], cache_name[NAME_MAX];
-			int type;
 			linenum++;
 
-			if(sscanf(line, "# FILE %" SCNu64 " %s %d %" SCNu64 "", &previous_completion_time, file, &file_state, &size) == 4) {
-				f = dag_file_lookup_or_create(d, file);
-				f->state = file_state;
-				if(file_state == DAG_FILE_STATE_EXISTS){
-					d->completed_files += 1;
-					f->creation_logged = (time_t) (previous_completion_time / 1000000);
-				} else if(file_state == DAG_FILE_STATE_DELETE){
-					d->deleted_files += 1;
-				}
-			} else if(sscanf(line, "# CACHE %" SCNu64 " %s", &previous_completion_time, cache_dir) == 2) {
-				/* if the user specifies a cache dir using --cache dir, ignore the info from the log file */
-				if(!d->cache_dir) {
-					d->cache_dir = xxstrdup(cache_dir);
-				} else {
-					/* There are two possible reasons for the inconsistency:
-					 * 1) the cache dir specified via the --cache opt and in the log file mismatch;
-					 * 2) the log file includes multiple different CACHE entries.
-					 */
-					if(strcmp(cache_dir, d->cache_dir)) {
-						fprintf(stderr, "The --cache option (%s) does not match the cache dir (%s) in the log file!\n", d->cache_dir, cache_dir);
-						free(line);
-						return -1;
-					}
-				}
-			} else if(sscanf(line, "# MOUNT %" SCNu64 " %s %s %s %d", &previous_completion_time, file, source, cache_name, &type) == 5) {
-				f = dag_file_lookup_or_create(d, file);
-
-				if(!f->source) {
-					f->source = xxstrdup(source);
-					f->cache_name = xxstrdup(cache_name);
-					f->type = type;
-				} else {
-					/* If a mount entry is specified in the mountfile and logged in a log file at the same time, they must not conflict with each other. */
-					/* If a mount entry is logged in a log file multiple times deliberately or not, they must not conflict with each other. */
-					if(makeflow_mount_check_consistency(file, f->source, source, d->cache_dir, cache_name)) {
-						free(line);
-						return -1;
-					}
-				}
-			} else if(line[0] == '#') {
-				/* Ignore any other comment lines */
-			} else if(sscanf(line, "%" SCNu64 " %d %d %d", &previous_completion_time, &nodeid, &state, &jobid) == 4) {
-				n = itable_lookup(d->node_table, nodeid);
-				if(n) {
-					n->state = state;
-					n->jobid = jobid;
-					/* Log timestamp is in microseconds, we need seconds for diff. */
-					n->previous_completion = (time_t) (previous_completion_time / 1000000);
-				}
-			} else {
+			int result = makeflow_log_recover_line(d, line);
+			if(result < 0) {
+				free(line);
+				return -1;
+			} else if(result == 0) {
 				fprintf(stderr, "makeflow: %s appears to be corrupted on line %d\n", filename, linenum);
 				exit(1);
 			}
 			free(line);
 		}
+		snapshot_log_lines = linenum;
+		snapshot_log_offset = ftello(d->logfile);
 		fclose(d->logfile);
 	} else {
 		printf("creating new log file %s...\n",filename);
+		unlink(snapshot_filename);
 	}
 
 	d->logfile = fopen(filename, "a");
@@ -404,7 +800,14 @@ int makeflow_log_recover(struct dag *d, const char *filename, int verbose_mode,
 		fprintf(stderr, "makeflow: couldn't open logfile %s: %s\n", filename, strerror(errno));
 		exit(1);
 	}
-	if(setvbuf(d->logfile, NULL, _IOLBF, BUFSIZ) != 0) {
+	if(group_commit_interval > 0) {
+		group_commit_buffer = xxmalloc(GROUP_COMMIT_BUFFER_SIZE);
+		if(setvbuf(d->logfile, group_commit_buffer, _IOFBF, GROUP_COMMIT_BUFFER_SIZE) != 0) {
+			fprintf(stderr, "makeflow: couldn't set buffer on logfile %s: %s\n", filename, strerror(errno));
+			exit(1);
+		}
+		group_commit_last = timestamp_get();
+	} else if(setvbuf(d->logfile, NULL, _IOLBF, BUFSIZ) != 0) {
 		fprintf(stderr, "makeflow: couldn't set line buffer on logfile %s: %s\n", filename, strerror(errno));
 		exit(1);
 	}
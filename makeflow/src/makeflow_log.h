@@ -35,6 +35,18 @@ void makeflow_log_alloc_event( struct dag *d, struct makeflow_alloc *alloc );
 void makeflow_log_gc_event( struct dag *d, int collected, timestamp_t elapsed, int total_collected );
 void makeflow_log_close(struct dag *d );
 
+/*
+Collect log records and sync them together, at most every interval_ms milliseconds
+or every so many records.  Must be set before makeflow_log_recover opens the log.
+*/
+void makeflow_log_set_group_commit( int interval_ms, int records );
+
+/* Write and sync any records collected in group commit mode. */
+void makeflow_log_commit( struct dag *d );
+
+/* Return the number of records written to the log since makeflow started. */
+int64_t makeflow_log_records_written();
+
 /* return 0 on success, return non-zero on failure. */
 int makeflow_log_recover( struct dag *d, const char *filename, int verbose_mode, struct batch_queue *queue, makeflow_clean_depth clean_mode );
 
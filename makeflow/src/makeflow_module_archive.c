@@ -14,6 +14,9 @@ Updated for S3 bucket handling and directory handling for input and output files
 #include <sys/stat.h>
 #include <errno.h>
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <time.h>
@@ -22,6 +25,8 @@ Updated for S3 bucket handling and directory handling for input and output files
 #include "copy_stream.h"
 #include "create_dir.h"
 #include "debug.h"
+#include "file_link_recursive.h"
+#include "full_io.h"
 #include "list.h"
 #include "jx.h"
 #include "jx_parse.h"
@@ -29,6 +34,7 @@ Updated for S3 bucket handling and directory handling for input and output files
 #include "path.h"
 #include "set.h"
 #include "sha1.h"
+#include "stat_batch.h"
 #include "stringtools.h"
 #include "timestamp.h"
 #include "unlink_recursive.h"
@@ -67,6 +73,10 @@ struct archive_instance {
 
 	/* Runtime data struct */
 	char *source_makeflow;
+
+	/* Ids of the tasks completely stored in the archive, as listed in tasks/index */
+	struct hash_table *index;
+	char *index_path;
 };
 
 struct archive_instance *archive_instance_create()
@@ -79,6 +89,146 @@ struct archive_instance *archive_instance_create()
 	return a;
 }
 
+/* The index lists the id of each task that was completely archived, one per line.
+ * Loading it once lets every ready task be checked against the archive in memory,
+ * instead of probing the task directory and each of its output files. */
+
+/* Add a task id to the index and append it to the index file.
+ * Appends of a single short line are atomic, so several makeflows may share one archive. */
+static void makeflow_archive_index_add(struct archive_instance *a, const char *id)
+{
+	if(hash_table_lookup(a->index, id))
+		return;
+
+	hash_table_insert(a->index, id, (void *) 1);
+
+	int fd = open(a->index_path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if(fd < 0) {
+		debug(D_MAKEFLOW_HOOK, "could not open archive index %s: %s", a->index_path, strerror(errno));
+		return;
+	}
+
+	char *line = string_format("%s\n", id);
+	if(full_write(fd, line, strlen(line)) != (ssize_t) strlen(line)) {
+		debug(D_MAKEFLOW_HOOK, "could not write to archive index %s: %s", a->index_path, strerror(errno));
+	}
+	free(line);
+	close(fd);
+}
+
+static int makeflow_archive_index_load(struct archive_instance *a)
+{
+	char line[SHA1_DIGEST_LENGTH * 2 + 16];
+
+	FILE *file = fopen(a->index_path, "r");
+	if(!file)
+		return 0;
+
+	while(fgets(line, sizeof(line), file)) {
+		string_chomp(line);
+		if(strlen(line) == SHA1_DIGEST_LENGTH * 2) {
+			hash_table_insert(a->index, line, (void *) 1);
+		}
+	}
+	fclose(file);
+
+	debug(D_MAKEFLOW_HOOK, "loaded %d archived tasks from %s", hash_table_size(a->index), a->index_path);
+	return 1;
+}
+
+/* An archive written before the index existed is indexed once by listing its tasks.
+ * A task is complete if all the links in its output_files directory resolve,
+ * which is checked for all tasks at once. */
+static void makeflow_archive_index_rebuild(struct archive_instance *a)
+{
+	struct hash_table *candidates = hash_table_create(0, 0);
+	struct stat_batch *b = stat_batch_create(0);
+	struct dirent *d, *e;
+	char *id;
+	struct list *outputs;
+
+	char *tasks_dir = string_format("%s/tasks", a->dir);
+	DIR *prefixes = opendir(tasks_dir);
+
+	while(prefixes && (d = readdir(prefixes))) {
+		if(strlen(d->d_name) != 2)
+			continue;
+
+		char *prefix_dir = string_format("%s/%s", tasks_dir, d->d_name);
+		DIR *tasks = opendir(prefix_dir);
+
+		while(tasks && (e = readdir(tasks))) {
+			if(strlen(e->d_name) != SHA1_DIGEST_LENGTH * 2)
+				continue;
+
+			char *outputs_dir = string_format("%s/%s/output_files", prefix_dir, e->d_name);
+			DIR *files = opendir(outputs_dir);
+			if(files) {
+				struct dirent *f;
+				outputs = list_create();
+				while((f = readdir(files))) {
+					if(!strcmp(f->d_name, ".") || !strcmp(f->d_name, ".."))
+						continue;
+					char *path = string_format("%s/%s", outputs_dir, f->d_name);
+					stat_batch_add(b, path, 0);
+					list_push_tail(outputs, path);
+				}
+				closedir(files);
+				hash_table_insert(candidates, e->d_name, outputs);
+			}
+			free(outputs_dir);
+		}
+
+		if(tasks)
+			closedir(tasks);
+		free(prefix_dir);
+	}
+
+	if(prefixes)
+		closedir(prefixes);
+
+	stat_batch_run(b);
+
+	char *tmp_path = string_format("%s.%d", a->index_path, (int) getpid());
+	FILE *file = fopen(tmp_path, "w");
+
+	hash_table_firstkey(candidates);
+	while(hash_table_nextkey(candidates, &id, (void **) &outputs)) {
+		struct stat info;
+		char *path;
+		int complete = 1;
+
+		while((path = list_pop_head(outputs))) {
+			if(stat_batch_lookup(b, path, &info) < 0)
+				complete = 0;
+			free(path);
+		}
+		list_delete(outputs);
+
+		if(complete) {
+			hash_table_insert(a->index, id, (void *) 1);
+			if(file)
+				fprintf(file, "%s\n", id);
+		}
+	}
+
+	/* Only install the new index if no other makeflow did so meanwhile. */
+	if(file) {
+		fclose(file);
+		if(link(tmp_path, a->index_path) < 0 && errno != EEXIST) {
+			debug(D_MAKEFLOW_HOOK, "could not create archive index %s: %s", a->index_path, strerror(errno));
+		}
+		unlink(tmp_path);
+	}
+
+	debug(D_MAKEFLOW_HOOK, "indexed %d archived tasks in %s", hash_table_size(a->index), tasks_dir);
+
+	free(tmp_path);
+	free(tasks_dir);
+	stat_batch_delete(b);
+	hash_table_delete(candidates);
+}
+
 static int create( void ** instance_struct, struct jx *hook_args )
 {	
 	aws_init ();
@@ -175,6 +325,12 @@ static int create( void ** instance_struct, struct jx *hook_args )
 	}
 	free(tasks_dir);
 
+	a->index = hash_table_create(0, 0);
+	a->index_path = string_format("%s/tasks/index", a->dir);
+	if(!makeflow_archive_index_load(a)) {
+		makeflow_archive_index_rebuild(a);
+	}
+
 	s3_set_bucket (a->s3_dir);
 
 	return MAKEFLOW_HOOK_SUCCESS;
@@ -186,6 +342,9 @@ static int destroy( void * instance_struct, struct dag *d)
 
 	free(a->dir);
 	free(a->source_makeflow);
+	if(a->index)
+		hash_table_delete(a->index);
+	free(a->index_path);
 	free(a);
 	return MAKEFLOW_HOOK_SUCCESS;
 }
@@ -510,6 +669,10 @@ static int makeflow_archive_file(struct archive_instance *a, struct batch_file *
 				rv = 1;
 				goto FAIL;
 			}
+			/* Archived files are read only, so that a restored hard link cannot modify them. */
+			if(stat(file_archive_path, &buf) == 0){
+				chmod(file_archive_path, buf.st_mode & ~(S_IWUSR | S_IWGRP | S_IWOTH));
+			}
 		}
 		else{
 			debug(D_MAKEFLOW,"COPYING %s to the archive",f->outer_name);
@@ -705,6 +868,43 @@ static int makeflow_archive_remove_task(struct archive_instance *a, struct dag_n
 	return 1;
 }
 
+/* Restore an archived output to the working directory.
+ * A reflink or hard link shares the data with the archive instead of copying it.
+ * Only read only files are hard linked, since writing through the link would change the archive.
+@return 1 if restored, 0 on failure.
+ */
+static int makeflow_archive_restore_file(const char *archive_path, const char *file_name) {
+	char source[PATH_MAX];
+	struct stat info;
+
+	// Resolve the link in the task directory to the file in the archive
+	if(!realpath(archive_path, source) || stat(source, &info) < 0){
+		return 0;
+	}
+
+	unlink_recursive(file_name);
+	if(file_clone_recursive(source, file_name, 0)){
+		debug(D_MAKEFLOW_HOOK, "cloned %s to %s", source, file_name);
+		return 1;
+	}
+	unlink_recursive(file_name);
+
+	if(S_ISDIR(info.st_mode)){
+		return copy_dir(source, file_name) == 0;
+	}
+
+	if(!(info.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) && link(source, file_name) == 0){
+		debug(D_MAKEFLOW_HOOK, "linked %s to %s", source, file_name);
+		return 1;
+	}
+
+	if(copy_file_to_file(source, file_name) < 0){
+		return 0;
+	}
+	chmod(file_name, info.st_mode | S_IWUSR);
+	return 1;
+}
+
 int makeflow_archive_copy_preserved_files(struct archive_instance *a, struct batch_job *t, char *task_path ) {
 	struct batch_file *f;
 	struct stat buf;
@@ -738,30 +938,17 @@ int makeflow_archive_copy_preserved_files(struct archive_instance *a, struct bat
 			}
 		}
 		free(directory_name);
-		// Copy output file or directory over to specified location
-		if(path_is_dir(output_file_path) != 1){
-			int64_t success = copy_file_to_file(output_file_path, file_name);
-			free(output_file_path);
-			free(file_name);
-			if (success < 0) {
-				list_cursor_destroy(cur);
-				debug(D_ERROR|D_MAKEFLOW_HOOK,"Failed to copy output file %s to %s\n", output_file_path, file_name);
-				return 1;
-			}
-		}
-		else{
-			if(copy_dir(output_file_path, file_name) != 0){
-				list_cursor_destroy(cur);
-								debug(D_ERROR|D_MAKEFLOW_HOOK,"Failed to copy output file %s to %s\n", output_file_path, file_name);
-				free(output_file_path);
-							free(file_name);
-								return 1;
-						}
+		// Restore output file or directory to specified location
+		if(!makeflow_archive_restore_file(output_file_path, file_name)){
+			debug(D_ERROR|D_MAKEFLOW_HOOK,"Failed to restore output file %s to %s\n", output_file_path, file_name);
+			list_cursor_destroy(cur);
 			free(output_file_path);
 			free(file_name);
+			return 1;
 		}
-		}
-
+		free(output_file_path);
+		free(file_name);
+	}
 
 	list_cursor_destroy(cur);
 
@@ -802,6 +989,27 @@ int makeflow_archive_is_preserved(struct archive_instance *a, struct batch_job *
 	return 1;
 }
 
+/* Check whether a task is in the archive using the index.
+ * With S3, a task downloaded into the local archive is not yet indexed,
+ * so its directory is probed and indexed when found. */
+static int makeflow_archive_is_indexed(struct archive_instance *a, struct batch_job *t, char *id, char *task_path) {
+	if(makeflow_archive_task_adheres_to_sandbox(t)){
+		return 0;
+	}
+
+	if(hash_table_lookup(a->index, id)){
+		return 1;
+	}
+
+	if(a->s3 && makeflow_archive_is_preserved(a, t, task_path)){
+		makeflow_archive_index_add(a, id);
+		return 1;
+	}
+
+	debug(D_MAKEFLOW_HOOK, "task %d has not been previously archived", t->taskid);
+	return 0;
+}
+
 static int makeflow_s3_archive_copy_task_files(struct archive_instance *a, char *id, char *task_path, struct batch_job *t){
 	char *taskTarFile = string_format("%s/%s",task_path,id);
 	// Check to see if the task is already in the local archive so it is not downloaded twice
@@ -913,9 +1121,9 @@ static int batch_submit( void * instance_struct, struct batch_job *t){
 	// Generates a hash id for the task
 	char *id = batch_job_generate_id(t);
 	char *task_path = string_format("%s/tasks/%.2s/%s",a->dir, id, id);
-	create_dir(task_path,0777);
 	debug(D_MAKEFLOW_HOOK, "Checking archive for task %d at %.5s\n", t->taskid, id);
-	if(a->s3){
+	if(a->s3 && !hash_table_lookup(a->index, id)){
+		create_dir(task_path,0777);
 		int result = 1;
 		result = makeflow_s3_archive_copy_task_files(a, id, task_path, t);
 		if(!result){
@@ -924,16 +1132,21 @@ static int batch_submit( void * instance_struct, struct batch_job *t){
 
 	}
 
-	// If a is in read mode and the archive is preserved (all the output files exist)
-	if(a->read && makeflow_archive_is_preserved(a, t, task_path)){
+	// If a is in read mode and the task is in the archive index
+	if(a->read && makeflow_archive_is_indexed(a, t, id, task_path)){
 		debug(D_MAKEFLOW_HOOK, "Task %d already exists in archive, replicating output files\n", t->taskid);
 
-		/* copy archived files to working directory and update state for node and dag_files */
-		makeflow_archive_copy_preserved_files(a, t, task_path);
-		t->info->exited_normally = 1;
-		a->found_archived_job = 1;
-		printf("task %d was pulled from archive\n", t->taskid);
-		rc = MAKEFLOW_HOOK_SKIP;
+		/* restore archived files to working directory and update state for node and dag_files */
+		if(makeflow_archive_copy_preserved_files(a, t, task_path)){
+			/* The archive no longer matches the index, so run the task instead. */
+			debug(D_MAKEFLOW_HOOK, "Task %d could not be restored from archive, running it\n", t->taskid);
+			hash_table_remove(a->index, id);
+		} else {
+			t->info->exited_normally = 1;
+			a->found_archived_job = 1;
+			printf("task %d was pulled from archive\n", t->taskid);
+			rc = MAKEFLOW_HOOK_SKIP;
+		}
 	}
 
 	free(id);
@@ -948,8 +1161,8 @@ static int batch_retrieve( void * instance_struct, struct batch_job *t){
 	char *id = batch_job_generate_id(t);
 	char *task_path = string_format("%s/tasks/%.2s/%s",a->dir, id, id);
 
-	// If a is in read mode and the archive is preserved (all the output files exist)
-	if(a->read && makeflow_archive_is_preserved(a, t, task_path)){
+	// If a is in read mode and the task is in the archive index
+	if(a->read && makeflow_archive_is_indexed(a, t, id, task_path)){
 		// Print out debug statement
 		debug(D_MAKEFLOW_HOOK, "Task %d run was bypassed using archive\n", t->taskid);
 		// Bypass task run
@@ -1019,8 +1232,8 @@ static int node_success( void * instance_struct, struct dag_node *n, struct batc
 		// Generates a hash id for the task
 		char *id = batch_job_generate_id(t);
 		char *task_path = string_format("%s/tasks/%.2s/%s",a->dir, id, id);
-		// If the archive is preserved (all the output files exist)
-		if(makeflow_archive_is_preserved(a, t, task_path)){
+		// If the task is already in the archive index
+		if(makeflow_archive_is_indexed(a, t, id, task_path)){
 			// Free excess memory
 			free(id);
 			free(task_path);
@@ -1052,6 +1265,8 @@ static int node_success( void * instance_struct, struct dag_node *n, struct batc
 			}
 		}
 
+		makeflow_archive_index_add(a, id);
+
 		free(id);
 		free(task_path);
 	}
@@ -46,6 +46,7 @@ See the file COPYING for details.
 #include "path.h"
 
 #include "dag.h"
+#include "dag_cache.h"
 #include "dag_visitors.h"
 #include "dag_resources.h"
 #include "lexer.h"
@@ -55,9 +56,9 @@ See the file COPYING for details.
 #include "parser_jx.h"
 #include "parser.h"
 
-/* Returns a pointer to a new struct dag described by filename. Return NULL on
- * failure. */
-struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct jx *args)
+/* Parses filename into a new struct dag, without closing it over the
+ * environment, nodes, and categories. Return NULL on failure. */
+static struct dag *dag_parse_file(const char *filename, dag_syntax_type format, struct jx *args)
 {
 	FILE *dagfile = NULL;
 	struct jx *dag = NULL;
@@ -110,12 +111,76 @@ struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct j
 			break;
 	}
 
+	return d;
+}
+
+static void dag_complete(struct dag *d)
+{
 	dag_close_over_environment(d);
 	dag_close_over_nodes(d);
 	dag_close_over_categories(d);
 
 	dag_compile_ancestors(d);
+}
 
+/* Returns a pointer to a new struct dag described by filename. Return NULL on
+ * failure. */
+struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct jx *args)
+{
+	struct dag *d = dag_parse_file(filename, format, args);
+	dag_complete(d);
+	return d;
+}
+
+/* As dag_from_file for a JX workflow, but leave the rules written as
+ * list comprehensions to be expanded on demand by dag_expand_rules. */
+struct dag *dag_from_file_lazy(const char *filename, struct jx *args)
+{
+	struct jx *j = jx_parse_file(filename);
+	if(!j) {
+		debug(D_MAKEFLOW_PARSER, "makeflow: failed to parse jx from %s\n", filename);
+		return NULL;
+	}
+
+	/* The same variables as jx_eval_with_defines would use. */
+	struct jx *defines = jx_lookup(j, "define");
+	struct jx *empty = jx_object(0);
+	struct jx *context = jx_merge(defines ? defines : empty, args ? args : empty, 0);
+	jx_delete(empty);
+
+	struct dag *d = dag_create();
+	if(dag_parse_jx_lazy(d, j, context)) {
+		dag_complete(d);
+	} else {
+		free(d);
+		d = NULL;
+		errno = EINVAL;
+	}
+
+	jx_delete(context);
+	jx_delete(j);
+
+	return d;
+}
+
+/* As dag_from_file, but load the dag from cachefile if it was written from
+ * the same workflow, and otherwise parse the workflow and write cachefile. */
+struct dag *dag_from_file_cached(const char *filename, dag_syntax_type format, struct jx *args, const char *cachefile)
+{
+	struct dag *d = NULL;
+	char *key = dag_cache_key(filename, format, args);
+
+	if(key)
+		d = dag_cache_load(cachefile, key);
+
+	if(!d) {
+		d = dag_parse_file(filename, format, args);
+		if(d && key)
+			dag_cache_save(d, cachefile, key);
+	}
+
+	free(key);
+	dag_complete(d);
 	return d;
 }
 
@@ -219,6 +284,14 @@ void set_resources_from_env(struct rmsummary *rs, struct dag_variable_lookup_set
 	}
 }
 
+void dag_close_over_node(struct dag_node *n)
+{
+	struct rmsummary *rs = n->resources_requested;
+
+	struct dag_variable_lookup_set s = {NULL, NULL, n, NULL };
+	set_resources_from_env(rs, s, NULL);
+}
+
 void dag_close_over_nodes(struct dag *d)
 {
 	struct dag_node *n;
@@ -226,10 +299,7 @@ void dag_close_over_nodes(struct dag *d)
 	if (!d) return;
 
 	for(n = d->nodes; n; n = n->next) {
-		struct rmsummary *rs = n->resources_requested;
-
-		struct dag_variable_lookup_set s = {NULL, NULL, n, NULL };
-		set_resources_from_env(rs, s, NULL);
+		dag_close_over_node(n);
 	}
 }
 
@@ -16,6 +16,10 @@ typedef enum {
 
 
 struct dag *dag_from_file(const char *filename, dag_syntax_type format, struct jx *args);
+struct dag *dag_from_file_cached(const char *filename, dag_syntax_type format, struct jx *args, const char *cachefile);
+struct dag *dag_from_file_lazy(const char *filename, struct jx *args);
+
+void dag_close_over_node(struct dag_node *n);
 void dag_close_over_nodes(struct dag *d);
 void dag_close_over_categories(struct dag *d);
 void dag_close_over_environment(struct dag *d);
@@ -17,6 +17,7 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "debug.h"
 #include "parser.h"
+#include "list.h"
 #include "rmsummary.h"
 #include "jx_eval.h"
 #include "jx_match.h"
@@ -185,7 +186,7 @@ static int files_from_jx(struct dag_node *n, int inputs, struct jx *j)
 	return 1;
 }
 
-static int rule_from_jx(struct dag *d, struct jx *j)
+static struct dag_node *rule_from_jx(struct dag *d, struct jx *j)
 {
 	assert(j);
 
@@ -196,13 +197,13 @@ static int rule_from_jx(struct dag *d, struct jx *j)
 	debug(D_MAKEFLOW_PARSER, "Parsing inputs");
 	if(!files_from_jx(n, 1, inputs)) {
 		report_error(j->line, "could not parse rule inputs.", NULL);
-		return 0;
+		return NULL;
 	}
 	struct jx *outputs = jx_lookup(j, "outputs");
 	debug(D_MAKEFLOW_PARSER, "Parsing outputs");
 	if(!files_from_jx(n, 0, outputs)) {
 		report_error(j->line, "could not parse rule outputs.", NULL);
-		return 0;
+		return NULL;
 	}
 
 	const char *command = jx_lookup_string(j, "command");
@@ -210,7 +211,7 @@ static int rule_from_jx(struct dag *d, struct jx *j)
 
 	if(workflow && command) {
 		report_error(j->line, "rule is invalid because it defines both a command and a workflow.", NULL);
-		return 0;
+		return NULL;
 	}
 
 	if(command) {
@@ -222,7 +223,7 @@ static int rule_from_jx(struct dag *d, struct jx *j)
 		dag_node_set_workflow(n, workflow, args, 1);
 	} else {
 		report_error(j->line, "rule neither defines a command nor a sub-workflow.", NULL);
-		return 0;
+		return NULL;
 	}
 
 	dag_node_insert(n);
@@ -244,7 +245,7 @@ static int rule_from_jx(struct dag *d, struct jx *j)
 	struct jx *resource = jx_lookup(j, "resources");
 	if(resource && !resources_from_jx(n->variables, resource, n->nodeid)) {
 		report_error(j->line, "a resource definition", resource);
-		return 0;
+		return NULL;
 	}
 
 	const char *allocation = jx_lookup_string(j, "allocation");
@@ -260,13 +261,13 @@ static int rule_from_jx(struct dag *d, struct jx *j)
 			n->resource_request = CATEGORY_ALLOCATION_ERROR;
 		} else {
 			report_error(j->line, "one of \"max\", \"auto\", or \"error\"", j);
-			return 0;
+			return NULL;
 		}
 	}
 
 	environment_from_jx(d, n, n->variables, jx_lookup(j, "environment"));
 
-	return 1;
+	return n;
 }
 
 static int category_from_jx(struct dag *d, const char *name, struct jx *j)
@@ -351,3 +352,156 @@ struct dag *dag_parse_jx(struct dag *d, struct jx *j)
 
 	return d;
 }
+
+/*
+Rules written as list comprehensions may stand for a very large number of rules,
+so in a lazy workflow they are not evaluated when it is parsed.  Instead, each
+comprehension is evaluated one rule at a time by dag_expand_rules, as makeflow
+needs more rules to run.  The other rules are parsed as usual.
+*/
+
+struct dag_rules {
+	struct jx *rules;                   /* The unevaluated array of rules. */
+	struct jx *context;                 /* The variables in which rules are evaluated. */
+	struct jx_item *item;               /* The next comprehension to expand. */
+	struct jx_eval_iterator *iterator;  /* The comprehension being expanded, if any. */
+};
+
+static void dag_rules_delete(struct dag_rules *r)
+{
+	if(!r)
+		return;
+	jx_eval_iterator_delete(r->iterator);
+	jx_delete(r->rules);
+	jx_delete(r->context);
+	free(r);
+}
+
+struct dag *dag_parse_jx_lazy(struct dag *d, struct jx *j, struct jx *context)
+{
+	if(!jx_istype(j, JX_OBJECT)) {
+		report_error(0, "a workflow definition as a JSON object", j);
+		return NULL;
+	}
+
+	struct jx *key = jx_string("rules");
+	struct jx *rules = jx_remove(j, key);
+	jx_delete(key);
+
+	struct jx *workflow = jx_eval(j, context);
+	struct dag *result = dag_parse_jx(d, workflow);
+	jx_delete(workflow);
+
+	if(!result) {
+		jx_delete(rules);
+		return NULL;
+	}
+
+	if(!rules) {
+		return d;
+	}
+
+	if(!jx_istype(rules, JX_ARRAY)) {
+		report_error(rules->line, "a list of rules as JSON array", rules);
+		jx_delete(rules);
+		return NULL;
+	}
+
+	struct jx_item *item;
+	for(item = rules->u.items; item; item = item->next) {
+		if(item->comp)
+			continue;
+
+		struct jx *rule = jx_eval(item->value, context);
+		if(jx_istype(rule, JX_ERROR) || !rule_from_jx(d, rule)) {
+			report_error(item->line, "error parsing the rule.", NULL);
+			jx_delete(rule);
+			jx_delete(rules);
+			return NULL;
+		}
+		jx_delete(rule);
+	}
+
+	struct dag_rules *r = calloc(1, sizeof(*r));
+	r->rules = rules;
+	r->context = jx_copy(context);
+	r->item = rules->u.items;
+	d->lazy_rules = r;
+
+	return d;
+}
+
+/* Connect a rule expanded after the dag was compiled to the nodes already in it. */
+
+static int dag_expand_rule_connect(struct dag *d, struct dag_node *n)
+{
+	struct dag_file *f;
+
+	list_first_item(n->target_files);
+	while((f = list_next_item(n->target_files))) {
+		if(list_size(f->needed_by) > 0) {
+			struct dag_node *m = list_peek_head(f->needed_by);
+			fprintf(stderr, "makeflow: line %d: %s is created by a rule expanded on demand, but is needed by the rule at line %d, which was expanded before it.\n", n->linenum, f->filename, m->linenum);
+			return 0;
+		}
+	}
+
+	list_first_item(n->source_files);
+	while((f = list_next_item(n->source_files))) {
+		if(f->created_by) {
+			set_insert(f->created_by->descendants, n);
+			set_insert(n->ancestors, f->created_by);
+		}
+	}
+
+	dag_close_over_node(n);
+	n->expanded = 1;
+
+	return 1;
+}
+
+int dag_expand_rules(struct dag *d, int max, struct list *created)
+{
+	struct dag_rules *r = d->lazy_rules;
+	int count = 0;
+
+	while(r && count < max) {
+		if(!r->iterator) {
+			while(r->item && !r->item->comp)
+				r->item = r->item->next;
+
+			if(!r->item) {
+				dag_rules_delete(r);
+				d->lazy_rules = r = NULL;
+				break;
+			}
+
+			r->iterator = jx_eval_iterator_create(r->item, r->context);
+			r->item = r->item->next;
+		}
+
+		struct jx *rule = jx_eval_iterator_next(r->iterator);
+		if(!rule) {
+			jx_eval_iterator_delete(r->iterator);
+			r->iterator = NULL;
+			continue;
+		}
+
+		struct dag_node *n = NULL;
+		if(jx_istype(rule, JX_ERROR)) {
+			report_error(rule->line, "a rule", rule);
+		} else {
+			n = rule_from_jx(d, rule);
+		}
+		jx_delete(rule);
+
+		if(!n || !dag_expand_rule_connect(d, n)) {
+			return -1;
+		}
+
+		list_push_tail(created, n);
+		count++;
+	}
+
+	return count;
+}
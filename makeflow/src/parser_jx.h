@@ -11,5 +11,15 @@ See the file COPYING for details.
 
 struct dag *dag_parse_jx(struct dag *d, struct jx *);
 
+/* Parse a workflow whose rules written as list comprehensions are
+ * expanded later by dag_expand_rules. The workflow is not evaluated
+ * beforehand, and context holds the variables to evaluate it in. */
+struct dag *dag_parse_jx_lazy(struct dag *d, struct jx *j, struct jx *context);
+
+/* Expand up to max rules not yet expanded, appending the new nodes to created.
+ * Once all rules are expanded, d->lazy_rules becomes null.
+ * Returns the number of nodes created, or -1 on error. */
+int dag_expand_rules(struct dag *d, int max, struct list *created);
+
 #endif
 
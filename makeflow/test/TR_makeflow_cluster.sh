@@ -0,0 +1,63 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+	for i in 1 2 3 4 5 6
+	do
+		printf "out.$i:\n\techo $i > out.$i\n\n"
+	done > test.makeflow
+
+cat >> test.makeflow << EOF
+bad:
+	exit 3
+
+all: out.1 out.2 out.3
+	cat out.1 out.2 out.3 > all
+EOF
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ run jobs in clusters of four +++++"
+	./makeflow -T local --cluster-size=4 --retry-count=0 test.makeflow > output.log 2>&1
+	cat output.log
+
+	[ `grep -c "submitting cluster of 4 jobs" output.log` = 2 ] || exit 1
+
+	echo "+++++ each member should complete on its own +++++"
+	for i in 1 2 3 4 5 6
+	do
+		[ "`cat out.$i`" = "$i" ] || exit 1
+	done
+	[ "`cat all`" = "1
+2
+3" ] || exit 1
+	grep "exit 3 failed with exit code 3" output.log || exit 1
+	[ ! -f bad ] || exit 1
+
+	echo "+++++ the cluster files should be removed +++++"
+	ls makeflow.cluster* && exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+cat > test.makeflow << EOF
+GREETING=hello
+
+out.1:
+	echo \$(GREETING) > out.1
+
+out.2: out.1
+	cat out.1 out.1 > out.2
+EOF
+	exit 0
+}
+
+reset()
+{
+	rm -f out.1 out.2 test.makeflow.makeflowlog test.makeflow.batchlog debug.log
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ first run: should write the cache +++++"
+	./makeflow --dag-cache test.makeflow || exit 1
+	[ -f test.makeflow.dagcache ] || exit 1
+	[ "`cat out.2`" = "hello
+hello" ] || exit 1
+	reset
+
+	echo "+++++ second run: should load the cache +++++"
+	./makeflow --dag-cache -d makeflow_parser -o debug.log test.makeflow || exit 1
+	grep "loaded dag from cache" debug.log || exit 1
+	[ "`cat out.2`" = "hello
+hello" ] || exit 1
+	reset
+
+	echo "+++++ third run: should notice the change +++++"
+	sed -i 's/hello/goodbye/' test.makeflow
+	./makeflow --dag-cache -d makeflow_parser -o debug.log test.makeflow || exit 1
+	grep "dag cache is out of date" debug.log || exit 1
+	[ "`cat out.2`" = "goodbye
+goodbye" ] || exit 1
+
+	echo "+++++ clean: should remove the cache +++++"
+	./makeflow -c test.makeflow || exit 1
+	[ ! -f test.makeflow.dagcache ] || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,61 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+cat > test.makeflow << EOF2
+out.1:
+	echo hello > out.1
+
+out.2: out.1
+	cat out.1 out.1 > out.2
+
+out.3: out.1
+	cat out.1 out.1 > out.3
+
+out.4: out.2 out.3
+	cat out.2 out.3 > out.4
+EOF2
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ dry run should complete without creating outputs +++++"
+	./makeflow -T dryrun --engine-stats=run.json test.makeflow || exit 1
+	[ -f out.1 ] && exit 1
+	cat run.json
+	grep '"nodes":4' run.json || exit 1
+	grep '"nodes_completed":4' run.json || exit 1
+	grep '"parse_time"' run.json || exit 1
+	grep '"ancestors_time"' run.json || exit 1
+	grep '"run_cpu_time"' run.json || exit 1
+	grep '"log_records"' run.json || exit 1
+
+	echo "+++++ second run should recover every node +++++"
+	./makeflow -T dryrun --skip-file-check --engine-stats=recover.json test.makeflow || exit 1
+	cat recover.json
+	grep '"nodes_recovered":4' recover.json || exit 1
+	grep '"nodes_completed":0' recover.json || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
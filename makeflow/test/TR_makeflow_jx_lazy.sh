@@ -0,0 +1,78 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+cat > test.jx << EOF
+{
+	"rules": [
+		{
+			"command" : "echo " + i + " > out." + i,
+			"outputs" : [ "out." + i ]
+		} for i in range(20),
+		{
+			"command" : "cat out." + i + " out." + i + " > double." + i,
+			"inputs" : [ "out." + i ],
+			"outputs" : [ "double." + i ]
+		} for i in range(20),
+		{
+			"command" : "cat input > copy",
+			"inputs" : [ "input" ],
+			"outputs" : [ "copy" ]
+		}
+	]
+}
+EOF
+	echo hello > input
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ run with a small frontier +++++"
+	./makeflow --jx-lazy-rules=4 test.jx > output.log 2>&1
+	status=$?
+	cat output.log
+	[ $status = 0 ] || exit 1
+	grep "has 1 rules, and more are expanded on demand" output.log || exit 1
+
+	echo "+++++ every rule should have run +++++"
+	for i in `seq 0 19`
+	do
+		[ "`cat out.$i`" = "$i" ] || exit 1
+		[ "`cat double.$i`" = "$i
+$i" ] || exit 1
+	done
+	[ "`cat copy`" = "hello" ] || exit 1
+	[ `grep -c "^[0-9]* [0-9]* 2 " test.jx.makeflowlog` = 41 ] || exit 1
+
+	echo "+++++ restart should find nothing to do +++++"
+	./makeflow --jx-lazy-rules=4 test.jx > output.log 2>&1 || exit 1
+	cat output.log
+	grep "submitting job" output.log && exit 1
+
+	echo "+++++ clean should expand every rule +++++"
+	./makeflow --jx-lazy-rules=4 --clean test.jx || exit 1
+	ls out.* double.* copy && exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
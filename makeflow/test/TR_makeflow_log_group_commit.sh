@@ -0,0 +1,53 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+cat > test.makeflow << EOF
+out.1:
+	echo hello > out.1
+
+out.2: out.1
+	cat out.1 out.1 > out.2
+
+out.3: out.2
+	cat out.2 out.2 > out.3
+EOF
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ run with group commit +++++"
+	./makeflow --log-group-commit=60000 --log-group-records=1000 test.makeflow || exit 1
+	[ -f out.3 ] || exit 1
+
+	echo "+++++ every node should be logged as complete +++++"
+	[ `grep -c "^[0-9]* [0-9]* 2 " test.makeflow.makeflowlog` = 3 ] || exit 1
+
+	echo "+++++ restart should find nothing to do +++++"
+	./makeflow --log-group-commit=60000 test.makeflow > output.log || exit 1
+	cat output.log
+	grep "submitting job" output.log && exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
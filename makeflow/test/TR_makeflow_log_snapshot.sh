@@ -0,0 +1,71 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+test_dir=`basename $0 .sh`.dir
+
+prepare()
+{
+	mkdir $test_dir
+	cd $test_dir
+	ln -sf ../../src/makeflow .
+
+cat > test.makeflow << EOF
+out.1:
+	echo hello > out.1
+
+out.2: out.1
+	cat out.1 out.1 > out.2
+
+out.3: out.2
+	test -f go && cat out.2 > out.3
+EOF
+	exit 0
+}
+
+run()
+{
+	cd $test_dir
+
+	echo "+++++ first run: out.3 fails, should write a snapshot +++++"
+	./makeflow test.makeflow
+	[ -f test.makeflow.makeflowlog.snapshot ] || exit 1
+	tail -n 1 test.makeflow.makeflowlog.snapshot | grep "^# END" || exit 1
+
+	echo "+++++ second run: should recover from the snapshot +++++"
+	touch go
+	./makeflow test.makeflow > output.log || exit 1
+	cat output.log
+	grep "recovering from snapshot" output.log || exit 1
+	grep "submitting job: echo hello" output.log && exit 1
+	[ -f out.3 ] || exit 1
+
+	echo "+++++ third run: should ignore a snapshot of another log +++++"
+	cp test.makeflow.makeflowlog.snapshot saved.snapshot
+	./makeflow -c test.makeflow || exit 1
+	./makeflow test.makeflow || exit 1
+	cp saved.snapshot test.makeflow.makeflowlog.snapshot
+	echo "# a change to the log" > test.makeflow.makeflowlog.new
+	cat test.makeflow.makeflowlog >> test.makeflow.makeflowlog.new
+	mv test.makeflow.makeflowlog.new test.makeflow.makeflowlog
+	./makeflow test.makeflow > output.log || exit 1
+	cat output.log
+	grep "recovering from snapshot" output.log && exit 1
+	grep "nothing left to do" output.log || exit 1
+
+	echo "+++++ clean: should remove the snapshot +++++"
+	./makeflow -c test.makeflow || exit 1
+	[ ! -f test.makeflow.makeflowlog.snapshot ] || exit 1
+
+	exit 0
+}
+
+clean()
+{
+	rm -fr $test_dir
+	exit 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -269,4 +269,13 @@ int parrot_fork_namespace ( void )
 #endif
 }
 
+int parrot_stats ( const char *path )
+{
+#ifdef CCTOOLS_CPU_I386
+	return syscall(SYSCALL32_parrot_stats,path);
+#else
+	return syscall(SYSCALL64_parrot_stats,path);
+#endif
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -29,5 +29,6 @@ int parrot_mount( const char *path, const char *destination, const char *mode );
 int parrot_unmount( const char *path );
 ssize_t parrot_version ( char *buf, size_t len );
 int parrot_fork_namespace ( void );
+int parrot_stats ( const char *path );
 
 #endif
@@ -21,8 +21,17 @@ int main( int argc, char *argv[] )
 	const char *file = NULL;
 	off_t size = 0;
 
+	if (argc == 3 && !strcmp(argv[1], "--stats")) {
+		if (parrot_stats(argv[2]) == -1) {
+			fprintf(stderr, "debug: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		return 0;
+	}
+
 	if (!(2 <= argc && argc <= 4)) {
 		fprintf(stderr, "Use: %s <flags> [file [size]]\n", argv[0]);
+		fprintf(stderr, "     %s --stats <file>\n", argv[0]);
 		fprintf(stderr, "Debug flags are: ");
 		debug_flags_print(stderr);
 		fprintf(stderr, "\n");
@@ -16,10 +16,14 @@
 #include <sys/sendfile.h>
 #include <time.h>
 #include <limits.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
 
 #include "copy_stream.h"
 #include "debug.h"
+#include "hash_table.h"
+#include "list.h"
 #include "stringtools.h"
 
 const char *namelist;
@@ -28,7 +32,11 @@ const char *envlist;
 const char *add_packagepath;
 const char *new_env;
 
+int copy_jobs = 1;
+int copy_hardlinks = 0;
+
 int line_process(const char *path, char *caller, int ignore_direntry, int is_direntry, FILE *special_file);
+static void wait_for_children(int sig);
 
 //files from these paths will be ignored.
 const char *special_path[] = {"var", "sys", "dev", "proc", "net", "misc", "selinux"};
@@ -49,6 +57,8 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-34s The relative path of the environment variable file under the package.\n", "   --new-env=<path>");
 	fprintf(stdout, " %-34s The path of the namelist list.\n", "-n,--name-list=<listpath>");
 	fprintf(stdout, " %-34s The path of the package.\n", "-p,--package-path=<packagepath>");
+	fprintf(stdout, " %-34s Copy file contents with this many processes. (default 1)\n", "-j,--jobs=<n>");
+	fprintf(stdout, " %-34s Hard link files into the package instead of copying them.\n", "   --hardlink");
 	fprintf(stdout, " %-34s Enable debugging for this sub-system.    (PARROT_DEBUG_FLAGS)\n", "-d,--debug=<name>");
 	fprintf(stdout, " %-34s Send debugging to this file. (can also be :stderr, or :stdout) (PARROT_DEBUG_FILE)\n", "-o,--debug-file=<file>");
 	fprintf(stdout, " %-34s Show the help info.\n", "-h,--help");
@@ -385,6 +395,195 @@ ignore_direntry is to tell whether the directory struture of one directory needs
 if is_direntry is 1, ignore the process to check whether its parent dir has been created in the target package, which can greatly reduce the amount of `access` syscall.
 Currently only process DIR REG LINK, all the remaining files are ignored.
 */
+/*
+The contents of regular files are not copied while the namelist is
+walked, which only creates the tree and its metadata.  Each copy is
+queued and done afterwards by a pool of processes, so that a large
+package is not limited by the latency of one file at a time.
+A source with several hard links is copied once and linked in the
+package for the others.
+*/
+
+struct package_copy {
+	char *path;
+	char *new_path;
+	char *link_to;
+	struct stat info;
+};
+
+static struct list *copy_list = NULL;
+static struct hash_table *copy_table = NULL;
+static struct hash_table *inode_table = NULL;
+
+static int package_copy_add(const char *path, const char *new_path, struct stat *info)
+{
+	if(!copy_list) {
+		copy_list = list_create();
+		copy_table = hash_table_create(0, 0);
+		inode_table = hash_table_create(0, 0);
+	}
+
+	/* leave an empty file, so that the metadata can be set until the contents arrive. */
+	int fd = open(new_path, O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR);
+	if(fd == -1) {
+		debug(D_DEBUG, "open(`%s`) fails: %s\n", new_path, strerror(errno));
+		return -1;
+	}
+	close(fd);
+
+	if(hash_table_lookup(copy_table, new_path))
+		return 0;
+
+	struct package_copy *c = malloc(sizeof(*c));
+	c->path = strdup(path);
+	c->new_path = strdup(new_path);
+	c->link_to = NULL;
+	c->info = *info;
+
+	if(info->st_nlink > 1) {
+		char key[64];
+		snprintf(key, sizeof(key), "%lu:%lu", (unsigned long)info->st_dev, (unsigned long)info->st_ino);
+		struct package_copy *first = hash_table_lookup(inode_table, key);
+		if(first) {
+			c->link_to = first->new_path;
+		} else {
+			hash_table_insert(inode_table, key, c);
+		}
+	}
+
+	hash_table_insert(copy_table, new_path, c);
+	list_push_tail(copy_list, c);
+	return 0;
+}
+
+/* Copy one file by sharing its blocks if the filesystem allows it, or else by reading it. */
+static int package_copy_data(const char *path, const char *new_path)
+{
+#ifdef FICLONE
+	int in = open(path, O_RDONLY);
+	if(in >= 0) {
+		int out = open(new_path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+		if(out >= 0) {
+			int result = ioctl(out, FICLONE, in);
+			close(out);
+			close(in);
+			if(result == 0)
+				return 0;
+		} else {
+			close(in);
+		}
+	}
+#endif
+	if(copy_file_to_file(path, new_path) < 0) {
+		debug(D_DEBUG, "copy_file_to_file from %s to %s fails.\n", path, new_path);
+		return -1;
+	}
+	return 0;
+}
+
+static int package_copy_finish(struct package_copy *c)
+{
+	struct utimbuf time_buf;
+	time_buf.modtime = c->info.st_mtime;
+	time_buf.actime = c->info.st_atime;
+	if(utime(c->new_path, &time_buf) == -1) {
+		debug(D_DEBUG, "utime(`%s`) fails: %s\n", c->new_path, strerror(errno));
+		return -1;
+	}
+	if(chmod(c->new_path, c->info.st_mode) == -1) {
+		debug(D_DEBUG, "chmod(`%s`) fails: %s\n", c->new_path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int package_copy_one(struct package_copy *c)
+{
+	const char *source = c->link_to ? c->link_to : c->path;
+
+	if(unlink(c->new_path) == -1 && errno != ENOENT) {
+		debug(D_DEBUG, "unlink(`%s`) fails: %s\n", c->new_path, strerror(errno));
+		return -1;
+	}
+
+	if((c->link_to || copy_hardlinks) && link(source, c->new_path) == 0) {
+		debug(D_DEBUG, "`%s`: linked to `%s`\n", c->new_path, source);
+		return 0;
+	}
+
+	if(package_copy_data(c->path, c->new_path) == -1)
+		return -1;
+	return package_copy_finish(c);
+}
+
+/* Copy every n-th queued file, starting with the i-th. */
+static int package_copy_share(int i, int n)
+{
+	struct package_copy *c;
+	int index = 0;
+	int errors = 0;
+
+	LIST_ITERATE(copy_list, c) {
+		if(!c->link_to && index % n == i && package_copy_one(c) == -1) {
+			debug(D_DEBUG, "copy of `%s` fails.\n", c->path);
+			errors++;
+		}
+		index++;
+	}
+	return errors;
+}
+
+/* Copy the queued files with copy_jobs processes. */
+static int package_copy_run(void)
+{
+	struct package_copy *c;
+	int failures = 0;
+	int i, n;
+
+	if(!copy_list)
+		return 0;
+
+	n = copy_jobs;
+	if(n > list_size(copy_list))
+		n = list_size(copy_list);
+
+	if(n <= 1) {
+		failures += package_copy_share(0, 1);
+	} else {
+		/* the workers must not be reaped by wait_for_children */
+		signal(SIGCHLD, SIG_DFL);
+
+		for(i = 0; i < n; i++) {
+			pid_t pid = fork();
+			if(pid == 0) {
+				_exit(package_copy_share(i, n) ? EXIT_FAILURE : EXIT_SUCCESS);
+			} else if(pid < 0) {
+				debug(D_DEBUG, "fork fails: %s\n", strerror(errno));
+				failures += package_copy_share(i, n);
+			}
+		}
+
+		int status;
+		pid_t pid;
+		while((pid = wait(&status)) > 0 || errno == EINTR) {
+			if(pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+				failures++;
+		}
+
+		signal(SIGCHLD, wait_for_children);
+	}
+
+	/* the other names of a hard linked source can only be linked once it is copied */
+	LIST_ITERATE(copy_list, c) {
+		if(c->link_to && package_copy_one(c) == -1) {
+			debug(D_DEBUG, "copy of `%s` fails.\n", c->path);
+			failures++;
+		}
+	}
+
+	return failures ? -1 : 0;
+}
+
 int line_process(const char *path, char *caller, int ignore_direntry, int is_direntry, FILE *special_file)
 {
 	int afs_item = 0;
@@ -464,8 +663,7 @@ int line_process(const char *path, char *caller, int ignore_direntry, int is_dir
 						return -1;
 					}
 				}
-				if(copy_file_to_file(path, new_path) < 0) {
-					debug(D_DEBUG, "copy_file_to_file from %s to %s fails.\n", path, new_path);
+				if(package_copy_add(path, new_path, &source_stat) < 0) {
 					return -1;
 				}
 				else
@@ -485,8 +683,7 @@ int line_process(const char *path, char *caller, int ignore_direntry, int is_dir
 						return -1;
 					}
 				}
-				if(copy_file_to_file(path, new_path) < 0) {
-					debug(D_DEBUG, "copy_file_to_file from %s to %s fails.\n", path, new_path);
+				if(package_copy_add(path, new_path, &source_stat) < 0) {
 					return -1;
 				}
 				else
@@ -724,6 +921,7 @@ int main(int argc, char *argv[])
 
 	enum {
 		LONG_OPT_NEW_ENV = UCHAR_MAX+1,
+		LONG_OPT_HARDLINK,
 	};
 
 	static const struct option long_options[] = {
@@ -732,13 +930,15 @@ int main(int argc, char *argv[])
 		{"name-list", required_argument, 0, 'n'},
 		{"env-list", required_argument, 0, 'e'},
 		{"new-env", required_argument, 0, LONG_OPT_NEW_ENV},
+		{"jobs", required_argument, 0, 'j'},
+		{"hardlink", no_argument, 0, LONG_OPT_HARDLINK},
 		{"package-path", required_argument, 0, 'p'},
 		{"debug", required_argument, 0, 'd'},
 		{"debug-file", required_argument, 0, 'o'},
 		{0,0,0,0}
 	};
 
-	while((c=getopt_long(argc, argv, "+ha:d:o:e:n:p:", long_options, NULL)) > -1) {
+	while((c=getopt_long(argc, argv, "+ha:d:o:e:j:n:p:", long_options, NULL)) > -1) {
 		switch(c) {
 		case 'a':
 			add_packagepath = optarg;
@@ -749,6 +949,16 @@ int main(int argc, char *argv[])
 		case LONG_OPT_NEW_ENV:
 			new_env = optarg;
 			break;
+		case 'j':
+			copy_jobs = atoi(optarg);
+			if(copy_jobs < 1) {
+				fprintf(stderr, "The number of jobs must be at least 1.\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case LONG_OPT_HARDLINK:
+			copy_hardlinks = 1;
+			break;
 		case 'n':
 			namelist = optarg;
 			break;
@@ -821,6 +1031,10 @@ int main(int argc, char *argv[])
 			debug(D_DEBUG, "line(%s) does not been processed perfectly.\n", line);
 	}
 	fclose(namelist_file);
+
+	if(package_copy_run() == -1)
+		fprintf(stderr, "some files could not be copied into the package.\n");
+
 	fclose(special_file);
 	char special_filename_tmp[PATH_MAX];
 	string_nformat(special_filename_tmp, sizeof(special_filename_tmp), "%s%s", special_filename, ".tmp");
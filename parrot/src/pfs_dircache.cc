@@ -5,6 +5,7 @@ See the file COPYING for details.
 */
 
 #include "pfs_dircache.h"
+#include "pfs_stats.h"
 #include "pfs_dir.h"
 #include "pfs_types.h"
 
@@ -93,6 +94,8 @@ int pfs_dircache::lookup( const char *path, struct pfs_stat *buf )
 		result = 1;
 	}
 
+	pfs_stats_cache("dircache", result);
+
 	return (result);
 }
 
@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include "pfs_pointer.h"
 #include "pfs_process.h"
 #include "pfs_service.h"
+#include "pfs_stats.h"
 #include "pfs_sys.h"
 #include "pfs_sysdeps.h"
 #include "pfs_time.h"
@@ -44,6 +45,7 @@ extern "C" {
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
@@ -422,33 +424,35 @@ static int iovec_size( struct pfs_process *p, struct pfs_kernel_iovec *v, int co
 	return total;
 }
 
-static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+/* The tracee's iovec in the layout of our own, so it can be handed to the tracer whole. */
+static struct iovec * iovec_to_native( struct pfs_kernel_iovec *v, int count )
 {
-	int i, pos=0;
-	for(i=0;i<count;i++) {
-		tracer_copy_in(p->tracer,&buf[pos],POINTER(v[i].iov_base),v[i].iov_len,0);
-		pos += v[i].iov_len;
+	struct iovec *n = (struct iovec *) malloc(sizeof(struct iovec)*count);
+	if(n) {
+		for(int i=0;i<count;i++) {
+			n[i].iov_base = POINTER(v[i].iov_base);
+			n[i].iov_len = v[i].iov_len;
+		}
 	}
-	return pos;
+	return n;
+}
+
+static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+{
+	struct iovec *n = iovec_to_native(v,count);
+	if(!n) return -1;
+	int result = tracer_copy_in_iov(p->tracer,buf,iovec_size(p,v,count),n,count);
+	free(n);
+	return result;
 }
 
 static int iovec_copy_out( struct pfs_process *p, void *buf, struct pfs_kernel_iovec *v, int count, size_t total )
 {
-	int i = 0;
-	size_t current = 0;
-
-	while (current < total) {
-		if (v[i].iov_len <= (total-current)) {
-			tracer_copy_out(p->tracer,((char *)buf)+current,POINTER(v[i].iov_base),v[i].iov_len,0);
-			current += v[i].iov_len;
-			i += 1;
-		} else {
-			tracer_copy_out(p->tracer,((char *)buf)+current,POINTER(v[i].iov_base),total-current,0);
-			current += (total-current);
-			assert(current == total);
-		}
-	}
-	return current;
+	struct iovec *n = iovec_to_native(v,count);
+	if(!n) return -1;
+	int result = tracer_copy_out_iov(p->tracer,buf,total,n,count);
+	free(n);
+	return result;
 }
 
 /*
@@ -3444,6 +3448,15 @@ static void decode_syscall( struct pfs_process *p, int entering )
 			}
 			break;
 
+		case SYSCALL32_parrot_stats:
+			if (entering) {
+				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
+				p->syscall_result = pfs_stats_dump(path);
+				if(p->syscall_result<0) p->syscall_result = -errno;
+				divert_to_dummy(p,p->syscall_result);
+			}
+			break;
+
 		/* These things are not currently permitted.
 		 */
 
@@ -3609,8 +3622,20 @@ void pfs_dispatch32( struct pfs_process *p )
 			assert(0);
 	}
 
+	if(p->fill_wait) {
+		/* Leave the process stopped with its original system call until the helper finishes. */
+		tracer_args_set(p->tracer,p->syscall_original,p->syscall_args,TRACER_ARGS_MAX);
+		p->state = PFS_PROCESS_STATE_USER;
+		p->syscall_dummy = 0;
+		wait_barrier = 0;
+		pfs_current = oldcurrent;
+		return;
+	}
+
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
+			tracer_continue_syscall(p->tracer,0);
+			break;
 		case PFS_PROCESS_STATE_USER:
 			tracer_continue(p->tracer,0);
 			break;
@@ -3623,11 +3648,19 @@ void pfs_dispatch32( struct pfs_process *p )
 
 void pfs_dispatch( struct pfs_process *p )
 {
-	if(tracer_is_64bit(p->tracer)) {
+	timestamp_t start = pfs_stats_enabled ? timestamp_get() : 0;
+	int entering = p->state==PFS_PROCESS_STATE_USER;
+	int is64 = tracer_is_64bit(p->tracer);
+
+	if(is64) {
 		pfs_dispatch64(p);
 	} else {
 		pfs_dispatch32(p);
 	}
+
+	if(pfs_stats_enabled) {
+		pfs_stats_syscall(is64,p->syscall,entering,timestamp_get()-start);
+	}
 }
 
 int pfs_dispatch_prepexe (struct pfs_process *p, char exe[PATH_MAX], const char *physical_name)
@@ -52,6 +52,7 @@ extern "C" {
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
@@ -430,33 +431,35 @@ static int iovec_size( struct pfs_process *p, struct pfs_kernel_iovec *v, int co
 	return total;
 }
 
-static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+/* The tracee's iovec in the layout of our own, so it can be handed to the tracer whole. */
+static struct iovec * iovec_to_native( struct pfs_kernel_iovec *v, int count )
 {
-	int i, pos=0;
-	for(i=0;i<count;i++) {
-		tracer_copy_in(p->tracer,&buf[pos],POINTER(v[i].iov_base),v[i].iov_len,0);
-		pos += v[i].iov_len;
+	struct iovec *n = (struct iovec *) malloc(sizeof(struct iovec)*count);
+	if(n) {
+		for(int i=0;i<count;i++) {
+			n[i].iov_base = POINTER(v[i].iov_base);
+			n[i].iov_len = v[i].iov_len;
+		}
 	}
-	return pos;
+	return n;
+}
+
+static int iovec_copy_in( struct pfs_process *p, char *buf, struct pfs_kernel_iovec *v, int count )
+{
+	struct iovec *n = iovec_to_native(v,count);
+	if(!n) return -1;
+	int result = tracer_copy_in_iov(p->tracer,buf,iovec_size(p,v,count),n,count);
+	free(n);
+	return result;
 }
 
 static int iovec_copy_out( struct pfs_process *p, void *buf, struct pfs_kernel_iovec *v, int count, size_t total )
 {
-	int i = 0;
-	size_t current = 0;
-
-	while (current < total) {
-		if (v[i].iov_len <= (total-current)) {
-			tracer_copy_out(p->tracer,((char *)buf)+current,POINTER(v[i].iov_base),v[i].iov_len,0);
-			current += v[i].iov_len;
-			i += 1;
-		} else {
-			tracer_copy_out(p->tracer,((char *)buf)+current,POINTER(v[i].iov_base),total-current,0);
-			current += (total-current);
-			assert(current == total);
-		}
-	}
-	return current;
+	struct iovec *n = iovec_to_native(v,count);
+	if(!n) return -1;
+	int result = tracer_copy_out_iov(p->tracer,buf,total,n,count);
+	free(n);
+	return result;
 }
 
 /*
@@ -3170,6 +3173,15 @@ static void decode_syscall( struct pfs_process *p, int entering )
 			}
 			break;
 
+		case SYSCALL64_parrot_stats:
+			if (entering) {
+				TRACER_MEM_OP(tracer_copy_in_string(p->tracer,path,POINTER(args[0]),sizeof(path),0));
+				p->syscall_result = pfs_stats_dump(path);
+				if(p->syscall_result<0) p->syscall_result = -errno;
+				divert_to_dummy(p,p->syscall_result);
+			}
+			break;
+
 		/* These things are not currently permitted.
 		 */
 
@@ -3322,8 +3334,20 @@ void pfs_dispatch64( struct pfs_process *p )
 			assert(0);
 	}
 
+	if(p->fill_wait) {
+		/* Leave the process stopped with its original system call until the helper finishes. */
+		tracer_args_set(p->tracer,p->syscall_original,p->syscall_args,TRACER_ARGS_MAX);
+		p->state = PFS_PROCESS_STATE_USER;
+		p->syscall_dummy = 0;
+		wait_barrier = 0;
+		pfs_current = oldcurrent;
+		return;
+	}
+
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
+			tracer_continue_syscall(p->tracer,0);
+			break;
 		case PFS_PROCESS_STATE_USER:
 			tracer_continue(p->tracer,0);
 			break;
@@ -0,0 +1,241 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_file.h"
+#include "pfs_file_buffer.h"
+#include "pfs_service.h"
+
+extern "C" {
+#include "debug.h"
+#include "hash_table.h"
+#include "macros.h"
+#include "stringtools.h"
+}
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Write-back buffering for remote files.  Writes that continue where the
+previous one ended are gathered into one buffer per open file and sent
+to the service as a single write when the buffer fills, when a write
+lands elsewhere in the file, or before anything that must observe the
+data: reads, fstat, ftruncate, fsync, mmap, and close.  An error from
+a deferred write is reported by the operation that caused the flush.
+*/
+
+static pfs_size_t default_size = 0;
+static struct hash_table *service_sizes = 0;
+
+class pfs_file_buffered : public pfs_file
+{
+private:
+	pfs_file *file;
+	char *buffer;
+	pfs_size_t size;
+	pfs_size_t length;
+	pfs_off_t offset;
+
+	int flush() {
+		pfs_size_t total = 0;
+
+		while(total<length) {
+			pfs_ssize_t actual = file->write(buffer+total,length-total,offset+total);
+			if(actual<=0) {
+				if(actual==0) errno = EIO;
+				debug(D_NOTICE,"couldn't write back %s: %s",name.path,strerror(errno));
+				length = 0;
+				return -1;
+			}
+			total += actual;
+		}
+
+		length = 0;
+		return 0;
+	}
+
+public:
+	pfs_file_buffered( pfs_name *n, pfs_file *f, pfs_size_t s ) : pfs_file(n) {
+		file = f;
+		size = s;
+		buffer = (char *) malloc(size);
+		length = 0;
+		offset = 0;
+	}
+
+	virtual ~pfs_file_buffered() {
+		free(buffer);
+		delete file;
+	}
+
+	virtual int close() {
+		int result = flush();
+		int save_errno = errno;
+		if(file->close()<0) return -1;
+		errno = save_errno;
+		return result;
+	}
+
+	virtual pfs_ssize_t read( void *data, pfs_size_t length, pfs_off_t offset ) {
+		if(flush()<0) return -1;
+		return file->read(data,length,offset);
+	}
+
+	virtual pfs_ssize_t write( const void *data, pfs_size_t n, pfs_off_t o ) {
+		if(length>0 && (o!=offset+length || length+n>size)) {
+			if(flush()<0) return -1;
+		}
+
+		if(n>=size) {
+			if(flush()<0) return -1;
+			return file->write(data,n,o);
+		}
+
+		if(length==0) offset = o;
+		memcpy(buffer+length,data,n);
+		length += n;
+		return n;
+	}
+
+	virtual int fstat( struct pfs_stat *buf ) {
+		if(flush()<0) return -1;
+		return file->fstat(buf);
+	}
+
+	virtual int fstatfs( struct pfs_statfs *buf ) {
+		return file->fstatfs(buf);
+	}
+
+	virtual int ftruncate( pfs_size_t length ) {
+		if(flush()<0) return -1;
+		return file->ftruncate(length);
+	}
+
+	virtual int fsync() {
+		if(flush()<0) return -1;
+		return file->fsync();
+	}
+
+	virtual int fcntl( int cmd, void *arg ) {
+		return file->fcntl(cmd,arg);
+	}
+
+	virtual int fchmod( mode_t mode ) {
+		return file->fchmod(mode);
+	}
+
+	virtual int fchown( uid_t uid, gid_t gid ) {
+		return file->fchown(uid,gid);
+	}
+
+	virtual int flock( int op ) {
+		if(flush()<0) return -1;
+		return file->flock(op);
+	}
+
+	virtual void * mmap( void *start, pfs_size_t length, int prot, int flags, pfs_off_t offset ) {
+		if(flush()<0) return 0;
+		return file->mmap(start,length,prot,flags,offset);
+	}
+
+	virtual struct dirent * fdreaddir( pfs_off_t offset, pfs_off_t *next_offset ) {
+		return file->fdreaddir(offset,next_offset);
+	}
+
+	virtual ssize_t fgetxattr( const char *name, void *data, size_t size ) {
+		return file->fgetxattr(name,data,size);
+	}
+
+	virtual ssize_t flistxattr( char *list, size_t size ) {
+		return file->flistxattr(list,size);
+	}
+
+	virtual int fsetxattr( const char *name, const void *data, size_t size, int flags ) {
+		return file->fsetxattr(name,data,size,flags);
+	}
+
+	virtual int fremovexattr( const char *name ) {
+		return file->fremovexattr(name);
+	}
+
+	virtual pfs_ssize_t get_size() {
+		if(flush()<0) return -1;
+		return file->get_size();
+	}
+
+	virtual int get_real_fd() {
+		return file->get_real_fd();
+	}
+
+	virtual int get_local_name( char *n ) {
+		if(flush()<0) return -1;
+		return file->get_local_name(n);
+	}
+
+	virtual int get_block_size() {
+		return file->get_block_size();
+	}
+
+	virtual int is_seekable() {
+		return file->is_seekable();
+	}
+
+	virtual pfs_off_t get_last_offset() {
+		return file->get_last_offset();
+	}
+
+	virtual void set_last_offset( pfs_off_t o ) {
+		file->set_last_offset(o);
+	}
+};
+
+/*
+The argument is either a size, which applies to every remote service,
+or service:size, which applies to that service only.  A size of zero
+turns buffering off.
+*/
+
+int pfs_buffer_configure( const char *arg )
+{
+	const char *colon = strrchr(arg,':');
+	const char *s = colon ? colon+1 : arg;
+
+	int64_t size = string_metric_parse(s);
+	if(size<0) return -1;
+
+	if(colon) {
+		if(!service_sizes) service_sizes = hash_table_create(0,0);
+		char *service = strndup(arg,colon-arg);
+		hash_table_remove(service_sizes,service);
+		hash_table_insert(service_sizes,service,(void*)(intptr_t)(size+1));
+		free(service);
+	} else {
+		default_size = size;
+	}
+
+	return 0;
+}
+
+pfs_file * pfs_buffer_open( pfs_name *name, pfs_file *file, int flags )
+{
+	if(!file || (flags&O_ACCMODE)==O_RDONLY || name->service->is_local()) return file;
+
+	pfs_size_t size = default_size;
+	if(service_sizes) {
+		intptr_t s = (intptr_t) hash_table_lookup(service_sizes,name->service_name);
+		if(s) size = s-1;
+	}
+
+	if(size<=0) return file;
+
+	debug(D_DEBUG,"buffering writes to %s in %lld bytes",name->path,(long long)size);
+	return new pfs_file_buffered(name,file,size);
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,15 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_FILE_BUFFER_H
+#define PFS_FILE_BUFFER_H
+
+#include "pfs_file.h"
+
+pfs_file * pfs_buffer_open( pfs_name *name, pfs_file *file, int flags );
+int        pfs_buffer_configure( const char *arg );
+
+#endif
@@ -7,7 +7,9 @@ See the file COPYING for details.
 
 #include "pfs_file.h"
 #include "pfs_file_cache.h"
+#include "pfs_process.h"
 #include "pfs_service.h"
+#include "pfs_stats.h"
 
 extern "C" {
 #include "debug.h"
@@ -16,6 +18,8 @@ extern "C" {
 #include "file_cache.h"
 #include "full_io.h"
 #include "hash_table.h"
+#include "itable.h"
+#include "macros.h"
 }
 
 #include <unistd.h>
@@ -24,6 +28,7 @@ extern "C" {
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
+#include <sys/wait.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <utime.h>
@@ -35,8 +40,39 @@ extern int pfs_main_timeout;
 
 static struct hash_table * not_found_table = 0;
 
+/*
+A whole file fetched by a forked helper, while the processes
+that opened it stay parked at the open.
+*/
+struct pfs_cache_fill {
+	pid_t helper;
+	char path[PFS_PATH_MAX];
+	char txn[PFS_PATH_MAX];
+	int fd;
+	struct utimbuf ut;
+	int done;
+	int error;
+};
+
+static struct itable * fill_by_helper = 0;
+static struct hash_table * fill_by_path = 0;
+
 #define BUFFER_SIZE 65536
 
+/*
+Files at least this large that are opened read-only from a seekable
+service are cached in blocks, fetched as they are read, rather than
+copied whole at open.
+*/
+#define PARTIAL_MIN_SIZE   (64*1024*1024)
+#define PARTIAL_BLOCK_SIZE (1024*1024)
+
+/*
+Reads that continue where the last one ended fetch this many blocks
+beyond what was asked for, doubling on each such read up to the maximum.
+*/
+#define PARTIAL_READAHEAD_MAX 16
+
 static pfs_ssize_t copy_fd_to_file( int fd, pfs_file *file )
 {
 	pfs_ssize_t ractual, wactual, offset = 0;
@@ -81,18 +117,126 @@ private:
 	int changed;
 	time_t ctime;
 	ino_t inode;
+	int mapfd;
+	pfs_file *rfile;
+	char *block;
+	pfs_off_t next_block;
+	int readahead;
+
+	pfs_ssize_t fill_block( pfs_off_t b, pfs_size_t size ) {
+		char present = 0;
+		if(::pread64(mapfd,&present,1,b)==1 && present) {
+			pfs_stats_cache("file_cache_blocks",1);
+			return 0;
+		}
+		pfs_stats_cache("file_cache_blocks",0);
+
+		if(!rfile) {
+			rfile = name.service->open(&name,O_RDONLY,0);
+			if(!rfile) return -1;
+			block = (char*) malloc(PARTIAL_BLOCK_SIZE);
+		}
+
+		pfs_off_t offset = b*PARTIAL_BLOCK_SIZE;
+		pfs_size_t length = MIN(PARTIAL_BLOCK_SIZE,size-offset);
+		pfs_size_t total = 0;
+		while(total<length) {
+			pfs_ssize_t actual = rfile->read(block+total,length-total,offset+total);
+			if(actual<=0) {
+				if(actual==0) errno = EIO;
+				return -1;
+			}
+			total += actual;
+		}
+
+		/* the data must land before the map says it is there */
+		if(::full_pwrite64(fd,block,length,offset)!=length) return -1;
+		present = 1;
+		if(::pwrite64(mapfd,&present,1,b)!=1) return -1;
+		return 0;
+	}
+
+	pfs_ssize_t fill_range( pfs_off_t offset, pfs_size_t length ) {
+		struct stat64 info;
+		if(mapfd<0) return 0;
+		if(::fstat64(fd,&info)<0) return -1;
+		if(offset>=info.st_size || length==0) return 0;
+		pfs_off_t first = offset/PARTIAL_BLOCK_SIZE;
+		pfs_off_t last = (MIN(offset+length,info.st_size)-1)/PARTIAL_BLOCK_SIZE;
+		pfs_off_t nblocks = (info.st_size+PARTIAL_BLOCK_SIZE-1)/PARTIAL_BLOCK_SIZE;
+
+		if(first==next_block || first==next_block-1) {
+			readahead = readahead ? MIN(readahead*2,PARTIAL_READAHEAD_MAX) : 1;
+		} else {
+			readahead = 0;
+		}
+
+		for(pfs_off_t b=first;b<=last;b++) {
+			if(fill_block(b,info.st_size)<0) return -1;
+		}
+		next_block = last+1;
+
+		/* a failed read ahead is not an error, the block is fetched when read */
+		for(pfs_off_t b=last+1;b<=last+readahead && b<nblocks;b++) {
+			if(fill_block(b,info.st_size)<0) break;
+		}
+		return 0;
+	}
+
+	int is_complete() {
+		struct stat64 info;
+		char map[BUFFER_SIZE];
+		pfs_off_t offset = 0;
+		if(::fstat64(mapfd,&info)<0) return 0;
+		while(offset<info.st_size) {
+			pfs_ssize_t actual = ::full_pread64(mapfd,map,MIN((pfs_off_t)sizeof(map),info.st_size-offset),offset);
+			if(actual<=0) return 0;
+			for(pfs_ssize_t i=0;i<actual;i++) {
+				if(!map[i]) return 0;
+			}
+			offset += actual;
+		}
+		return 1;
+	}
 
 public:
-	pfs_file_cached( pfs_name *n, int f, int m, time_t c, ino_t i ) : pfs_file(n) {
+	pfs_file_cached( pfs_name *n, int f, int m, time_t c, ino_t i, int mf = -1 ) : pfs_file(n) {
 		fd = f;
 		mode = m;
 		changed = 0;
 		ctime = c;
 		inode = i;
+		mapfd = mf;
+		rfile = 0;
+		block = 0;
+		next_block = -1;
+		readahead = 0;
+	}
+
+	/* Fetch every missing block, making this an ordinary whole cache entry. */
+	int fill_all() {
+		if(mapfd<0) return 0;
+		if(fill_range(0,get_size())<0) return -1;
+		file_cache_map_delete(pfs_file_cache,name.path);
+		::close(mapfd);
+		mapfd = -1;
+		return 0;
 	}
 
 	virtual int close() {
 		int result = -1;
+		if(mapfd>=0) {
+			if(is_complete()) {
+				debug(D_CACHE,"completed %s",name.path);
+				file_cache_map_delete(pfs_file_cache,name.path);
+			}
+			::close(mapfd);
+		}
+		if(rfile) {
+			rfile->close();
+			delete rfile;
+			free(block);
+		}
 		if(changed) {
 			debug(D_CACHE,"storing %s",name.path);
 			pfs_file *wfile = name.service->open(&name,O_WRONLY|O_CREAT|O_TRUNC,mode);
@@ -118,6 +262,7 @@ public:
 	}
 
 	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
+		if(fill_range(offset,length)<0) return -1;
 		return ::full_pread64(fd,d,length,offset);
 	}
 
@@ -162,6 +307,7 @@ public:
 	}
 
 	virtual int get_local_name( char *n ) {
+		if(fill_all()<0) return -1;
 		return file_cache_contains(pfs_file_cache,name.path,n);
 	}
 
@@ -170,8 +316,122 @@ public:
 	}
 };
 
+/*
+Wrap an entry found in the cache.  A partial entry is reopened for
+writing so that missing blocks can be filled in, and is completed at
+once unless the file is only to be read.
+*/
+
+static pfs_file * cache_hit( pfs_name *name, int fd, const char *lpath, int flags, mode_t mode, struct pfs_stat *buf )
+{
+	pfs_stats_cache("file_cache",1);
+
+	int mapfd = file_cache_map_open(pfs_file_cache,name->path,O_RDWR);
+	if(mapfd<0) {
+		if(flags&O_TRUNC) ftruncate(fd,0);
+		return new pfs_file_cached(name,fd,mode,buf->st_ctime,buf->st_ino);
+	}
+
+	::close(fd);
+	fd = ::open64(lpath,O_RDWR);
+	if(fd<0) {
+		int save_errno = errno;
+		::close(mapfd);
+		errno = save_errno;
+		return 0;
+	}
+
+	pfs_file_cached *file = new pfs_file_cached(name,fd,mode,buf->st_ctime,buf->st_ino,mapfd);
+	if((flags&O_ACCMODE)!=O_RDONLY || (flags&O_TRUNC)) {
+		if(file->fill_all()<0) {
+			int save_errno = errno;
+			file->close();
+			delete file;
+			errno = save_errno;
+			return 0;
+		}
+		if(flags&O_TRUNC) file->ftruncate(0);
+	}
+	return file;
+}
+
+static struct pfs_cache_fill * cache_fill_start( pfs_name *name, int fd, const char *txn, struct pfs_stat *buf )
+{
+	pid_t pid = fork();
+	if(pid<0) {
+		debug(D_CACHE,"couldn't fork a helper for %s: %s",name->path,strerror(errno));
+		return 0;
+	} else if(pid==0) {
+		int status = 0;
+		pfs_file *rfile = name->service->open(name,O_RDONLY,0);
+		if(!rfile) {
+			status = errno ? errno : EIO;
+		} else if(copy_file_to_fd(rfile,fd)!=0 || rfile->close()<0) {
+			status = errno ? errno : EIO;
+		}
+		_exit(status);
+	}
+
+	struct pfs_cache_fill *f = (struct pfs_cache_fill *) malloc(sizeof(*f));
+	f->helper = pid;
+	strcpy(f->path,name->path);
+	strcpy(f->txn,txn);
+	f->fd = fd;
+	f->ut.actime = buf->st_atime;
+	f->ut.modtime = buf->st_mtime;
+	f->done = 0;
+	f->error = 0;
+
+	itable_insert(fill_by_helper,pid,f);
+	hash_table_insert(fill_by_path,f->path,f);
+
+	debug(D_CACHE,"loading %s in helper %d",name->path,(int)pid);
+	return f;
+}
+
+int pfs_cache_fill_done( pid_t pid, int status )
+{
+	if(!fill_by_helper) return 0;
+
+	struct pfs_cache_fill *f = (struct pfs_cache_fill *) itable_lookup(fill_by_helper,pid);
+	if(!f) return 0;
+
+	if(WIFEXITED(status) && WEXITSTATUS(status)==0) {
+		::utime(f->txn,&f->ut);
+		if(file_cache_commit(pfs_file_cache,f->path,f->txn)!=0) {
+			f->error = errno;
+		}
+	} else {
+		f->error = WIFEXITED(status) ? WEXITSTATUS(status) : EIO;
+		file_cache_abort(pfs_file_cache,f->path,f->txn);
+	}
+	::close(f->fd);
+	f->done = 1;
+
+	if(f->error) {
+		debug(D_CACHE,"helper %d failed to load %s: %s",(int)pid,f->path,strerror(f->error));
+		if(pfs_session_cache && f->error==ENOENT) {
+			hash_table_insert(not_found_table,f->path,(void*)1);
+		}
+	} else {
+		debug(D_CACHE,"helper %d loaded %s",(int)pid,f->path);
+	}
+
+	return 1;
+}
+
+void pfs_cache_fill_release( pid_t pid )
+{
+	struct pfs_cache_fill *f = (struct pfs_cache_fill *) itable_remove(fill_by_helper,pid);
+	if(f) {
+		hash_table_remove(fill_by_path,f->path);
+		free(f);
+	}
+}
+
 pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 {
+	char lpath[PFS_PATH_MAX];
 	struct pfs_stat buf;
 	char txn[PFS_PATH_MAX];
 	int fd, ok_to_fail;
@@ -179,6 +439,28 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 	struct utimbuf ut;
 	int sleep_time = 1;
 
+	if(!fill_by_helper) {
+		fill_by_helper = itable_create(0);
+		fill_by_path = hash_table_create(0,0);
+	}
+
+	struct pfs_cache_fill *f = (struct pfs_cache_fill *) hash_table_lookup(fill_by_path,name->path);
+	if(f && f->done) {
+		/* resumed after a helper; a failure is reported to every waiter */
+		if(f->error) {
+			errno = f->error;
+			return 0;
+		}
+	} else if(f) {
+		if(pfs_process_can_park(pfs_current)) {
+			pfs_current->fill_wait = f->helper;
+			errno = EAGAIN;
+			return 0;
+		} else {
+			return name->service->open(name,flags,mode);
+		}
+	}
+
 	retry:
 
 	buf.st_ctime = time(0);
@@ -206,19 +488,63 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 	}
 
 
-	fd = file_cache_open(pfs_file_cache,name->path,flags,txn,buf.st_size,0);
+	fd = file_cache_open(pfs_file_cache,name->path,flags,lpath,buf.st_size,0);
 	if(fd>=0) {
-		if(flags&O_TRUNC) ftruncate(fd,0);
-		return new pfs_file_cached(name,fd,mode,buf.st_ctime,buf.st_ino);
+		return cache_hit(name,fd,lpath,flags,mode,&buf);
 	} else {
 		debug(D_DEBUG, "file cache lookup failed: %s", strerror(errno));
 	}
 
-	debug(D_CACHE,"loading %s",name->path);
-
 	fd = file_cache_begin(pfs_file_cache,name->path,txn);
 	if(fd<0) return 0;
 
+	/* another process may have filled it while we waited for the lock */
+	int hitfd = file_cache_open(pfs_file_cache,name->path,flags,lpath,buf.st_size,0);
+	if(hitfd>=0) {
+		::close(fd);
+		file_cache_abort(pfs_file_cache,name->path,txn);
+		return cache_hit(name,hitfd,lpath,flags,mode,&buf);
+	}
+
+	pfs_stats_cache("file_cache",0);
+
+	/* blocks are fetched out of order, so only from services that can read at an offset */
+	if(!(flags&(O_CREAT|O_TRUNC)) && (flags&O_ACCMODE)==O_RDONLY && buf.st_size>=PARTIAL_MIN_SIZE && name->service->supports_ranges()) {
+		debug(D_CACHE,"loading %s in blocks",name->path);
+		int mapfd = file_cache_map_open(pfs_file_cache,name->path,O_RDWR|O_CREAT|O_TRUNC);
+		if(mapfd>=0 && ::ftruncate64(fd,buf.st_size)==0 && ::ftruncate64(mapfd,(buf.st_size+PARTIAL_BLOCK_SIZE-1)/PARTIAL_BLOCK_SIZE)==0) {
+			ut.actime = buf.st_atime;
+			ut.modtime = buf.st_mtime;
+			::utime(txn,&ut);
+			if(file_cache_commit(pfs_file_cache,name->path,txn)==0) {
+				return new pfs_file_cached(name,fd,mode,buf.st_ctime,buf.st_ino,mapfd);
+			}
+		}
+		int save_errno = errno;
+		if(mapfd>=0) {
+			::close(mapfd);
+			file_cache_map_delete(pfs_file_cache,name->path);
+		}
+		::close(fd);
+		file_cache_abort(pfs_file_cache,name->path,txn);
+		errno = save_errno;
+		return 0;
+	}
+
+	/* a whole entry replaces any stale partial one */
+	file_cache_map_delete(pfs_file_cache,name->path);
+
+	if(!(flags&(O_CREAT|O_TRUNC)) && name->service->supports_background_fetch() && pfs_process_can_park(pfs_current)) {
+		f = cache_fill_start(name,fd,txn,&buf);
+		if(f) {
+			pfs_current->fill_wait = f->helper;
+			errno = EAGAIN;
+			return 0;
+		}
+	}
+
+	debug(D_CACHE,"loading %s",name->path);
+
 	if(flags&O_TRUNC) {
 		rfile = 0;
 		ok_to_fail = 1;
@@ -268,6 +594,8 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 			result->close();
 			result = new pfs_file_cached(name,fd,mode,buf.st_ctime,buf.st_ino);
 			if(result) result->ftruncate(0);
+			/* the new file is written back on close, not kept in the cache */
+			file_cache_abort(pfs_file_cache,name->path,txn);
 		}
 	} else {
 		result = 0;
@@ -12,5 +12,7 @@ See the file COPYING for details.
 
 pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode );
 int        pfs_cache_invalidate( pfs_name *name );
+int        pfs_cache_fill_done( pid_t pid, int status );
+void       pfs_cache_fill_release( pid_t pid );
 
 #endif
@@ -9,9 +9,12 @@ See the file COPYING for details.
 #include "pfs_channel.h"
 #include "pfs_critical.h"
 #include "pfs_dispatch.h"
+#include "pfs_file_buffer.h"
+#include "pfs_file_cache.h"
 #include "pfs_paranoia.h"
 #include "pfs_process.h"
 #include "pfs_service.h"
+#include "pfs_stats.h"
 #include "pfs_table.h"
 #include "pfs_time.h"
 #include "ptrace.h"
@@ -94,7 +97,10 @@ int pfs_force_cache = 0;
 int pfs_force_sync = 0;
 int pfs_follow_symlinks = 1;
 int pfs_session_cache = 0;
+int pfs_metadata_ttl = -1;
+int pfs_ftp_streams = 1;
 int pfs_use_helper = 0;
+int pfs_use_seccomp = 0;
 int pfs_checksum_files = 1;
 int pfs_write_rval = 0;
 int pfs_no_flock = 0;
@@ -128,6 +134,7 @@ INT64_T pfs_read_count = 0;
 INT64_T pfs_write_count = 0;
 
 const char * pfs_cvmfs_repo_arg = 0;
+const char * pfs_cvmfs_prefetch_arg = 0;
 const char * pfs_cvmfs_config_arg = 0;
 const char * pfs_cvmfs_http_proxy = 0;
 bool pfs_cvmfs_repo_switching = false;
@@ -164,6 +171,7 @@ enum {
 	LONG_OPT_CVMFS_REPO_SWITCHING,
 	LONG_OPT_CVMFS_OPTION,
 	LONG_OPT_CVMFS_OPTION_FILE,
+	LONG_OPT_CVMFS_PREFETCH,
 	LONG_OPT_HELPER,
 	LONG_OPT_NO_SET_FOREGROUND,
 	LONG_OPT_SYSCALL_DISABLE_DEBUG,
@@ -180,6 +188,11 @@ enum {
 	LONG_OPT_DISABLE_SERVICE,
 	LONG_OPT_NO_FLOCK,
 	LONG_OPT_EXT_IMAGE,
+	LONG_OPT_SECCOMP,
+	LONG_OPT_CACHE_SIZE,
+	LONG_OPT_METADATA_TTL,
+	LONG_OPT_WRITE_BUFFER,
+	LONG_OPT_FTP_STREAMS,
 };
 
 static void get_linux_version(const char *cmd)
@@ -280,13 +293,18 @@ static void show_help( const char *cmd )
 	printf("\n");
 	printf("Performance and consistency options:\n");
 	printf( " %-30s Set the I/O block size hint.              (PARROT_BLOCK_SIZE)\n", "-b,--block-size=<bytes>");
+	printf( " %-30s Evict least recently used cached files above this size.\n", "   --cache-size=<bytes>");
 	printf( " %-30s Disable small file optimizations.\n", "-D,--no-optimize");
 	printf( " %-30s Enable file snapshot caching for all protocols.\n", "-F,--with-snapshots");
 	printf( " %-30s Disable following symlinks.\n", "-f,--no-follow-symlinks");
+	printf( " %-30s Get FTP files over this many connections at once.\n", "   --ftp-streams=<n>");
 	printf( " %-30s Use streaming protocols without caching.(PARROT_FORCE_STREAM)\n", "-s,--stream-no-cache");
 	printf( " %-30s Enable whole session caching for all protocols.\n", "-S,--session-caching");
+	printf( " %-30s Reuse remote stat results for this many seconds.\n", "   --metadata-ttl=<secs>");
 	printf( " %-30s Force synchronous disk writes.            (PARROT_FORCE_SYNC)\n", "-Y,--sync-write");
+	printf( " %-30s Coalesce writes to remote files in this buffer.\n", "   --write-buffer=[<svc>:]<bytes>");
 	printf( " %-30s Enable automatic decompression on .gz files.\n", "-Z,--auto-decompress");
+	printf( " %-30s Only stop for system calls that may need virtualizing.\n", "   --seccomp");
 	printf( " %-30s Disable the given service.\n", "--disable-service");
 	printf( " %-30s Make flock a no-op.\n", "--no-flock");
 	printf("\n");
@@ -315,6 +333,7 @@ static void show_help( const char *cmd )
 	printf( " %-30s (deprecated) CVMFS common configuration.               (PARROT_CVMFS_CONFIG)\n", "   --cvmfs-config=<config>");
 	printf( " %-30s CVMFS repositories to enable.               (PARROT_CVMFS_REPO)\n", "-r,--cvmfs-repos=<repos>");
 	printf( " %-30s Allow repository switching when using CVMFS.\n","   --cvmfs-repo-switching");
+	printf( " %-30s Load catalogs under these paths at start.   (PARROT_CVMFS_PREFETCH)\n","   --cvmfs-prefetch=<paths>");
 	printf( " %-30s (deprecated) Set CVMFS common cache directory.    (PARROT_CVMFS_ALIEN_CACHE)\n","   --cvmfs-alien-cache=<dir>");
 	printf( " %-30s (deprecated) Disable CVMFS common cache directory.\n","   --cvmfs-disable-alien-cache");
 	printf("\n");
@@ -398,6 +417,9 @@ static void handle_event( pid_t pid, int status, struct rusage *usage )
 	if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP|0x80)) {
 		/* The common case, a syscall delivery stop. */
 		pfs_dispatch(p);
+	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP<<8))) {
+		/* With --seccomp, the filter stops the tracee at syscall entry instead. */
+		pfs_dispatch(p);
 	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_CLONE<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_FORK<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_VFORK<<8))) {
 		pid_t cpid;
 		struct pfs_process *child;
@@ -416,11 +438,11 @@ static void handle_event( pid_t pid, int status, struct rusage *usage )
 		}
 		child = pfs_process_create(cpid,p,p->syscall_args[0]&CLONE_THREAD,clone_files);
 		child->syscall_result = 0;
-		if (tracer_continue(p->tracer,0) == -1) /* child starts stopped. */
+		if (tracer_continue_syscall(p->tracer,0) == -1) /* child starts stopped. */
 			return;
 	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_EXEC<<8))) {
 		pfs_process_exec(p);
-		if (tracer_continue(p->tracer,0) == -1)
+		if (tracer_continue_syscall(p->tracer,0) == -1)
 			return;
 	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_EXIT<<8)) || WIFEXITED(status) || WIFSIGNALED(status)) {
 		/* In my own testing, if we use PTRACE_O_TRACEEXIT then we never get
@@ -593,6 +615,29 @@ static int pfswait (struct pfswait *p, pid_t pid, int block)
 	return 1;
 }
 
+/*
+Dispatch again the open of every process that was parked on a helper,
+which now finds the file in the cache or reports the helper's error.
+*/
+
+static void resume_fill_waiters( pid_t helper )
+{
+	struct pfs_process *p;
+	struct pfswait w;
+
+	while((p = pfs_process_waiting_on(helper))) {
+		pid_t pid = p->pid;
+		debug(D_PROCESS,"pid %d resumed after helper %d",pid,helper);
+		p->fill_wait = 0;
+		wait_barrier = 0;
+		pfs_dispatch(p);
+		while(wait_barrier && pfswait(&w, pid, 1)) {
+			wait_barrier = 0;
+			handle_event(w.pid, w.status, &w.usage);
+		}
+	}
+}
+
 int main( int argc, char *argv[] )
 {
 	int c;
@@ -602,6 +647,7 @@ int main( int argc, char *argv[] )
 	struct pfs_process *p;
 	char envlist[PATH_MAX] = "";
 	int valgrind = 0;
+	INT64_T cache_size = 0;
 	int envdebug = 0;
 	int envauth = 0;
 	std::vector<pfs_service *> service_instances;
@@ -816,6 +862,7 @@ int main( int argc, char *argv[] )
 		{"auto-decompress", no_argument, 0, 'Z'},
 		{"block-size", required_argument, 0, 'b'},
 		{"channel-auth", no_argument, 0, 'C'},
+		{"cache-size", required_argument, 0, LONG_OPT_CACHE_SIZE},
 		{"check-driver", required_argument, 0, LONG_OPT_CHECK_DRIVER },
 		{"chirp-auth",  required_argument, 0, 'a'},
 		{"cvmfs-repos", required_argument, 0, 'r'},
@@ -825,6 +872,7 @@ int main( int argc, char *argv[] )
 		{"cvmfs-repos", required_argument, 0, 'r'},
 		{"cvmfs-option", required_argument, 0, LONG_OPT_CVMFS_OPTION},
 		{"cvmfs-option-file", required_argument, 0, LONG_OPT_CVMFS_OPTION_FILE},
+		{"cvmfs-prefetch", required_argument, 0, LONG_OPT_CVMFS_PREFETCH},
 		{"debug", required_argument, 0, 'd'},
 		{"debug-file", required_argument, 0, 'o'},
 		{"debug-level-irods", required_argument, 0, 'I'},
@@ -834,11 +882,14 @@ int main( int argc, char *argv[] )
 		{"env-list", required_argument, 0, 'e'},
 		{"ext-image", required_argument, 0, LONG_OPT_EXT_IMAGE},
 		{"fake-setuid", no_argument, 0, LONG_OPT_FAKE_SETUID},
+		{"ftp-streams", required_argument, 0, LONG_OPT_FTP_STREAMS},
 		{"gid", required_argument, 0, 'G'},
 		{"help", no_argument, 0, 'h'},
 		{"helper", no_argument, 0, LONG_OPT_HELPER},
 		{"hostname", required_argument, 0, 'N'},
 		{"ld-path", required_argument, 0, 'l'},
+		{"metadata-ttl", required_argument, 0, LONG_OPT_METADATA_TTL},
+		{"write-buffer", required_argument, 0, LONG_OPT_WRITE_BUFFER},
 		{"mount", required_argument, 0, 'M'},
 		{"name-list", required_argument, 0, 'n'},
 		{"no-checksums", no_argument, 0, 'k'},
@@ -854,6 +905,7 @@ int main( int argc, char *argv[] )
 		{"pid-warp", no_argument, 0, LONG_OPT_PID_WARP},
 		{"proxy", required_argument, 0, 'p'},
 		{"root-checksum", required_argument, 0, 'R'},
+		{"seccomp", no_argument, 0, LONG_OPT_SECCOMP},
 		{"session-caching", no_argument, 0, 'S'},
 		{"stats-file", required_argument, 0, LONG_OPT_STATS_FILE},
 		{"status-file", required_argument, 0, 'c'},
@@ -1001,6 +1053,9 @@ int main( int argc, char *argv[] )
 		case LONG_OPT_CVMFS_REPO_SWITCHING:
 			pfs_cvmfs_repo_switching = true;
 			break;
+		case LONG_OPT_CVMFS_PREFETCH:
+			pfs_cvmfs_prefetch_arg = optarg;
+			break;
 		case LONG_OPT_CVMFS_ALIEN_CACHE:
 			snprintf(pfs_cvmfs_alien_cache_dir,sizeof(pfs_cvmfs_alien_cache_dir),"%s",optarg);
 			break;
@@ -1071,6 +1126,28 @@ int main( int argc, char *argv[] )
 		case LONG_OPT_VALGRIND:
 			valgrind = 1;
 			break;
+		case LONG_OPT_SECCOMP:
+			pfs_use_seccomp = 1;
+			break;
+		case LONG_OPT_CACHE_SIZE:
+			cache_size = string_metric_parse(optarg);
+			break;
+		case LONG_OPT_METADATA_TTL:
+			pfs_metadata_ttl = atoi(optarg);
+			break;
+		case LONG_OPT_WRITE_BUFFER:
+			if(pfs_buffer_configure(optarg)<0) {
+				fprintf(stderr, "Malformed write buffer size: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case LONG_OPT_FTP_STREAMS:
+			pfs_ftp_streams = atoi(optarg);
+			if(pfs_ftp_streams<1) {
+				fprintf(stderr, "The number of FTP streams must be at least one: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case LONG_OPT_CHECK_DRIVER:
 			if(pfs_service_lookup(optarg)) {
 				printf("%s is enabled\n",optarg);
@@ -1162,6 +1239,7 @@ int main( int argc, char *argv[] )
 	FILE *stats_out = NULL;
 	if (stats_file) {
 		stats_enable();
+		pfs_stats_enable();
 		stats_out = fopen(stats_file, "w");
 		if (!stats_out)
 			fatal("could not open stats file %s: %s", stats_file, strerror(errno));
@@ -1233,6 +1311,8 @@ int main( int argc, char *argv[] )
 	pfs_file_cache = file_cache_init(pfs_temp_dir);
 	if(!pfs_file_cache) fatal("couldn't setup cache in %s: %s\n",pfs_temp_dir,strerror(errno));
 	file_cache_cleanup(pfs_file_cache);
+	if(cache_size > 0)
+		file_cache_set_limit(pfs_file_cache, cache_size);
 
 	string_nformat(pfs_cvmfs_locks_dir, sizeof(pfs_cvmfs_locks_dir), "%s/cvmfs_locks_XXXXXX", pfs_temp_per_instance_dir);
 
@@ -1280,6 +1360,16 @@ int main( int argc, char *argv[] )
 		}
 	}
 
+	if (pfs_use_seccomp) {
+		if (valgrind) {
+			debug(D_NOTICE, "--seccomp cannot be used with --valgrind, tracing every system call");
+			pfs_use_seccomp = 0;
+		} else if (tracer_seccomp_enable() == -1) {
+			debug(D_NOTICE, "seccomp filtering needs Linux 4.8 or later on x86_64, tracing every system call");
+			pfs_use_seccomp = 0;
+		}
+	}
+
 	/* XXX Notes on strange code ahead:
 	 *
 	 * Previously we had a really simple synchronization mechanism whereby the
@@ -1338,6 +1428,11 @@ int main( int argc, char *argv[] )
 			signal(SIGUSR1, set_attached_and_ready);
 			raise(SIGSTOP); /* synchronize with parent, above */
 			while (!attached_and_ready) ; /* spin waiting to be traced (NO SLEEPING/STOPPING) */
+			/* the filter is installed only once traced, as untraced it would fail the trapped calls */
+			if (pfs_use_seccomp && tracer_seccomp_install() == -1) {
+				fprintf(stderr, "unable to install seccomp filter: %s\n", strerror(errno));
+				_exit(1);
+			}
 			execvp(argv[optind],&argv[optind]);
 		}
 		fprintf(stderr, "unable to execute %s: %s\n", argv[optind], strerror(errno));
@@ -1415,6 +1510,9 @@ int main( int argc, char *argv[] )
 					pfs_process_kill_everyone(SIGKILL);
 					break;
 				}
+			} else if(pfs_cache_fill_done(it->pid, it->status)) {
+				resume_fill_waiters(it->pid);
+				pfs_cache_fill_release(it->pid);
 			} else {
 				p = *it;
 				do {
@@ -1470,7 +1568,10 @@ int main( int argc, char *argv[] )
 	}
 
 	if (stats_file) {
-		jx_pretty_print_stream(stats_get(), stats_out);
+		struct jx *stats = stats_get();
+		jx_insert(stats, jx_string("parrot.profile"), pfs_stats_jx());
+		jx_pretty_print_stream(stats, stats_out);
+		jx_delete(stats);
 		fprintf(stats_out, "\n");
 		fclose(stats_out);
 	}
@@ -0,0 +1,147 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_metacache.h"
+#include "pfs_stats.h"
+#include "pfs_types.h"
+
+extern "C" {
+#include "debug.h"
+#include "hash_table.h"
+#include "path.h"
+#include "xxmalloc.h"
+}
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* When the table grows past this many entries, it is simply emptied. */
+#define METACACHE_MAX 65536
+
+struct metacache_entry {
+	time_t expires;
+	int exists;
+	struct pfs_stat buf;
+};
+
+static void make_key( char *key, const char *path, int follow )
+{
+	snprintf(key,PFS_PATH_MAX+2,"%c%s",follow ? 'S' : 'L',path);
+}
+
+pfs_metacache::pfs_metacache()
+{
+	table = 0;
+}
+
+pfs_metacache::~pfs_metacache()
+{
+	invalidate_all();
+
+	if (table)
+		hash_table_delete(table);
+}
+
+/*
+Returns 1 with buf filled in if the path is known to exist,
+-1 with errno set to ENOENT if it is known not to, and 0 otherwise.
+*/
+
+int pfs_metacache::lookup( const char *path, int follow, struct pfs_stat *buf )
+{
+	char key[PFS_PATH_MAX+2];
+	struct metacache_entry *e;
+
+	if (!table) return 0;
+
+	make_key(key, path, follow);
+	e = (struct metacache_entry *)hash_table_lookup(table, key);
+	if (e && e->expires < time(0)) {
+		hash_table_remove(table, key);
+		free(e);
+		e = 0;
+	}
+
+	pfs_stats_cache("metacache", e!=0);
+	if (!e) return 0;
+
+	if (e->exists) {
+		*buf = e->buf;
+		return 1;
+	} else {
+		errno = ENOENT;
+		return -1;
+	}
+}
+
+/* A null buf records that the path does not exist. */
+
+void pfs_metacache::insert( const char *path, int follow, struct pfs_stat *buf, int ttl )
+{
+	char key[PFS_PATH_MAX+2];
+	struct metacache_entry *e;
+
+	if (ttl <= 0) return;
+
+	if (!table) table = hash_table_create(0, 0);
+
+	if (hash_table_size(table) >= METACACHE_MAX) {
+		debug(D_CACHE, "metadata cache is full, emptying it");
+		invalidate_all();
+	}
+
+	make_key(key, path, follow);
+	e = (struct metacache_entry *)hash_table_remove(table, key);
+	if (!e) e = (struct metacache_entry *)xxmalloc(sizeof(*e));
+
+	e->expires = time(0) + ttl;
+	e->exists = buf != 0;
+	if (buf) e->buf = *buf;
+
+	hash_table_insert(table, key, e);
+}
+
+/*
+Changing an entry also changes the times and link count of its
+directory, so both are forgotten.
+*/
+
+void pfs_metacache::invalidate( const char *path )
+{
+	char key[PFS_PATH_MAX+2];
+	char parent[PFS_PATH_MAX];
+	int i;
+
+	if (!table) return;
+
+	path_dirname(path, parent);
+
+	for (i = 0; i < 2; i++) {
+		make_key(key, path, i);
+		free(hash_table_remove(table, key));
+		make_key(key, parent, i);
+		free(hash_table_remove(table, key));
+	}
+}
+
+void pfs_metacache::invalidate_all()
+{
+	char *key;
+	void *value;
+
+	if (table) {
+		hash_table_firstkey(table);
+		while (hash_table_nextkey(table, &key, &value)) {
+			hash_table_remove(table, key);
+			free(value);
+		}
+	}
+}
+
+/* vim: set noexpandtab tabstop=8: */
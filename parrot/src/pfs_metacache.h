@@ -0,0 +1,37 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_METACACHE_H
+#define PFS_METACACHE_H
+
+#include "pfs_types.h"
+
+extern "C" {
+#include "hash_table.h"
+}
+
+/*
+Remembers the results of stat and lstat on remote paths for a few
+seconds, including paths that do not exist, so that repeated lookups
+(library and module searches) do not each cost a round trip.
+Entries are dropped whenever Parrot itself changes the path.
+*/
+
+class pfs_metacache {
+public:
+	pfs_metacache();
+	virtual ~pfs_metacache();
+
+	virtual int lookup( const char *path, int follow, struct pfs_stat *buf );
+	virtual void insert( const char *path, int follow, struct pfs_stat *buf, int ttl );
+	virtual void invalidate( const char *path );
+	virtual void invalidate_all();
+
+protected:
+	struct hash_table *table;
+};
+
+#endif
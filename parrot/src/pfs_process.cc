@@ -78,6 +78,35 @@ void pfs_process_kill_everyone( int sig )
 	}
 }
 
+/*
+A process may only be parked while it is entering an open, where
+restarting the system call from scratch has no visible side effects.
+*/
+
+int pfs_process_can_park( struct pfs_process *p )
+{
+	if(!p || p->state!=PFS_PROCESS_STATE_KERNEL) return 0;
+
+	if(tracer_is_64bit(p->tracer)) {
+		return p->syscall==SYSCALL64_open || p->syscall==SYSCALL64_creat || p->syscall==SYSCALL64_openat;
+	} else {
+		return p->syscall==SYSCALL32_open || p->syscall==SYSCALL32_creat || p->syscall==SYSCALL32_openat;
+	}
+}
+
+struct pfs_process * pfs_process_waiting_on( pid_t helper )
+{
+	UINT64_T pid;
+	struct pfs_process *p;
+
+	itable_firstkey(pfs_process_table);
+	while(itable_nextkey(pfs_process_table,&pid,(void**)&p)) {
+		if(p && p->fill_wait==helper) return p;
+	}
+
+	return 0;
+}
+
 /* For every process interested in asynchronous events, send a SIGIO.  Note
  * that is is more coarse than it should be.  Most processes register interest
  * only on particular fds, however, we have limited mechanism for figuring out
@@ -257,6 +286,7 @@ struct pfs_process * pfs_process_create( pid_t pid, struct pfs_process *parent,
 	child->nsyscalls = 0;
 	child->completing_execve = 0;
 	child->exefd = -1;
+	child->fill_wait = 0;
 	child->ns = NULL;
 
 	if(parent) {
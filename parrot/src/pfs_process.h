@@ -76,6 +76,8 @@ struct pfs_process {
 	INT64_T syscall_args[TRACER_ARGS_MAX];
 	INT64_T syscall_args_changed;
 
+	pid_t fill_wait; /* helper fetching a file this process is waiting on */
+
 	char tmp[4096];
 };
 
@@ -99,6 +101,9 @@ void pfs_process_scratch_get( struct pfs_process *p, void *data, size_t len );
 uintptr_t pfs_process_scratch_set( struct pfs_process *p, const void *data, size_t len );
 void pfs_process_scratch_restore( struct pfs_process *p );
 
+int  pfs_process_can_park( struct pfs_process *p );
+struct pfs_process * pfs_process_waiting_on( pid_t helper );
+
 void pfs_process_pathtofilename( char *path );
 int pfs_process_stat( pid_t pid, int fd, struct stat *buf );
 void pfs_process_bootstrapfd( void );
@@ -26,6 +26,8 @@ extern "C" {
 #include <string.h>
 #include <stdlib.h>
 
+extern int pfs_metadata_ttl;
+
 void * pfs_service::connect( pfs_name *name )
 {
 	errno = ENOSYS;
@@ -51,6 +53,38 @@ int pfs_service::is_local()
 	return 0;
 }
 
+/*
+Whether a file opened from this service can be read at any offset,
+even if it is streamed rather than seekable through the file table.
+*/
+
+int pfs_service::supports_ranges()
+{
+	return is_seekable();
+}
+
+/*
+Whether a whole file may be fetched by a forked helper while other
+processes continue.  Only services that keep no connection state
+shared with the helper may say yes.
+*/
+
+int pfs_service::supports_background_fetch()
+{
+	return 0;
+}
+
+/*
+How many seconds the results of stat and lstat may be reused.
+Local files are cheap to stat and may change under us, so never.
+*/
+
+int pfs_service::get_metadata_ttl()
+{
+	if(is_local()) return 0;
+	return pfs_metadata_ttl>0 ? pfs_metadata_ttl : 0;
+}
+
 pfs_file * pfs_service::open( pfs_name *name, int flags, mode_t mode )
 {
 	errno = ENOENT;
@@ -14,6 +14,9 @@ See the file COPYING for details.
 #include "pfs_location.h"
 #include "pfs_search.h"
 
+/* Seconds that metadata from read-only services is reused unless --metadata-ttl says otherwise. */
+#define PFS_METADATA_TTL_READONLY 60
+
 class pfs_service {
 public:
 	virtual ~pfs_service() {};
@@ -24,6 +27,9 @@ public:
 	virtual int get_block_size();
 	virtual int tilde_is_special();
 	virtual int is_seekable() = 0;
+	virtual int supports_ranges();
+	virtual int supports_background_fetch();
+	virtual int get_metadata_ttl();
 	virtual int is_local();
 
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode );
@@ -37,12 +37,15 @@ extern "C" {
 #include <sys/file.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 #include <string>
 #include <list>
 
 extern int pfs_main_timeout;
+extern int pfs_metadata_ttl;
 extern char pfs_temp_dir[];
 extern const char * pfs_cvmfs_repo_arg;
+extern const char * pfs_cvmfs_prefetch_arg;
 extern const char * pfs_cvmfs_config_arg;
 extern bool pfs_cvmfs_repo_switching;
 extern char pfs_cvmfs_alien_cache_dir[];
@@ -985,6 +988,8 @@ static void cvmfs_read_config()
 	}
 }
 
+static void cvmfs_prefetch_start();
+
 static cvmfs_filesystem *lookup_filesystem(pfs_name * name, char const **subpath_result)
 {
 	const char *subpath;
@@ -997,6 +1002,7 @@ static cvmfs_filesystem *lookup_filesystem(pfs_name * name, char const **subpath
 	if( !cvmfs_configured ) {
 		cvmfs_read_config();
 		cvmfs_configured = true;
+		cvmfs_prefetch_start();
 	}
 
 	if( cvmfs_filesystem_list.empty() ) {
@@ -1084,6 +1090,119 @@ static void chomp_slashes( char *s )
 		}
 }
 
+/*
+Catalog prefetch: each subtree named in --cvmfs-prefetch is walked a few
+levels deep by its own thread, which loads the nested catalogs found there
+into the cache directory while the job starts.  With the default alien
+cache, that directory is shared by every parrot_run of the user on the
+node, so later runs start with the catalogs already present.
+*/
+
+#define CVMFS_PREFETCH_DEPTH 3
+
+#if LIBCVMFS_VERSION > 1
+struct cvmfs_prefetch {
+	cvmfs_context *ctx;
+	std::string path;
+};
+
+static void cvmfs_prefetch_walk(cvmfs_context *ctx, const std::string &path, int depth)
+{
+	struct stat st;
+
+	if(cvmfs_lstat(ctx, path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || depth <= 0) {
+		return;
+	}
+
+	char **buf = NULL;
+	size_t buflen = 0;
+	if(cvmfs_listdir(ctx, path.c_str(), &buf, &buflen) < 0) {
+		return;
+	}
+
+	for(int i = 0; buf[i]; i++) {
+		if(strcmp(buf[i],".") && strcmp(buf[i],"..")) {
+			cvmfs_prefetch_walk(ctx, path + "/" + buf[i], depth - 1);
+		}
+		free(buf[i]);
+	}
+	free(buf);
+}
+
+static void *cvmfs_prefetch_thread(void *arg)
+{
+	struct cvmfs_prefetch *p = (struct cvmfs_prefetch *) arg;
+	cvmfs_prefetch_walk(p->ctx, p->path, CVMFS_PREFETCH_DEPTH);
+	delete p;
+	return 0;
+}
+#endif
+
+static void cvmfs_prefetch_start()
+{
+	const char *paths = pfs_cvmfs_prefetch_arg;
+	if(!paths) {
+		paths = getenv("PARROT_CVMFS_PREFETCH");
+	}
+	if(!paths || !paths[0]) {
+		return;
+	}
+
+#if LIBCVMFS_VERSION > 1
+	cvmfs_filesystem *saved_active = cvmfs_active_filesystem;
+
+	char *list = strdup(paths);
+	char *saveptr;
+	for(char *entry = strtok_r(list, ",", &saveptr); entry; entry = strtok_r(0, ",", &saveptr)) {
+		struct pfs_name name;
+		const char *subpath;
+
+		/* entries are /cvmfs/repo/subtree or repo/subtree */
+		const char *e = entry;
+		if(!strncmp(e, "/cvmfs/", 7)) e += 7;
+		while(*e == '/') e++;
+
+		memset(&name, 0, sizeof(name));
+		const char *slash = strchr(e, '/');
+		size_t hostlen = slash ? (size_t)(slash - e) : strlen(e);
+		if(hostlen == 0 || hostlen >= sizeof(name.host)) continue;
+		memcpy(name.host, e, hostlen);
+		snprintf(name.rest, sizeof(name.rest), "%s", slash ? slash : "/");
+		chomp_slashes(name.rest);
+
+		cvmfs_filesystem *f = lookup_filesystem(&name, &subpath);
+		if(!f || f->cvmfs_not_configured || f->use_local_filesystem || f->try_local_filesystem) {
+			debug(D_CVMFS, "not prefetching catalogs for %s", entry);
+			continue;
+		}
+		if(!cvmfs_activate_filesystem(f)) {
+			debug(D_CVMFS|D_NOTICE, "couldn't activate %s to prefetch catalogs", name.host);
+			continue;
+		}
+
+		struct cvmfs_prefetch *p = new cvmfs_prefetch;
+		p->ctx = f->cvmfs_ctx;
+		p->path = name.rest;
+
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if(pthread_create(&thread, &attr, cvmfs_prefetch_thread, p) == 0) {
+			debug(D_CVMFS, "prefetching catalogs under %s:%s", name.host, name.rest);
+		} else {
+			delete p;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	free(list);
+
+	cvmfs_active_filesystem = saved_active;
+#else
+	debug(D_CVMFS|D_NOTICE, "The installed libcvmfs version does not support catalog prefetch");
+#endif
+}
+
 static int do_readlink(pfs_name *name, char *buf, pfs_size_t bufsiz, bool expand_internal_symlinks) {
 
 	/*
@@ -1360,6 +1479,12 @@ class pfs_service_cvmfs:public pfs_service {
 		return 0;
 	}
 
+	virtual int get_metadata_ttl() {
+		// Published content only changes with a new catalog,
+		// so a short reuse of metadata is safe by default.
+		return pfs_metadata_ttl>=0 ? pfs_metadata_ttl : PFS_METADATA_TTL_READONLY;
+	}
+
 	virtual int is_seekable() {
 		// CVMFS has its own cache, and the file descriptors returned
 		// by cvmfs_open are just handles to whole files in the CVMFS
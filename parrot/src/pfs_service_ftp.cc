@@ -16,6 +16,9 @@ extern "C" {
 #include "domain_name_cache.h"
 #include "copy_stream.h"
 #include "full_io.h"
+#include "buffer.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
 }
 
 #include <unistd.h>
@@ -26,9 +29,74 @@ extern "C" {
 #include <sys/statfs.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <time.h>
+
+extern int pfs_ftp_streams;
+extern char pfs_temp_per_instance_dir[PATH_MAX];
 
 enum ftp_type_t { ANONYMOUS, USERPASS, GLOBUS_GSS };
 
+/*
+Programs that walk an archive list the same directories again and
+again, and each listing costs a data connection, so listings are kept
+for the metadata ttl.  Like the chirp directory cache, all of them are
+dropped whenever Parrot changes anything on an FTP server.
+*/
+
+struct ftp_listing {
+	time_t expires;
+	char *entries;
+};
+
+static struct hash_table *ftp_dircache = 0;
+
+static void ftp_dircache_invalidate()
+{
+	char *key;
+	void *value;
+
+	if(!ftp_dircache) return;
+
+	hash_table_firstkey(ftp_dircache);
+	while(hash_table_nextkey(ftp_dircache,&key,&value)) {
+		struct ftp_listing *l = (struct ftp_listing *) hash_table_remove(ftp_dircache,key);
+		free(l->entries);
+		free(l);
+	}
+}
+
+static void ftp_dircache_insert( const char *path, const char *entries, int ttl )
+{
+	if(!ftp_dircache) ftp_dircache = hash_table_create(0,0);
+
+	struct ftp_listing *l = (struct ftp_listing *) hash_table_remove(ftp_dircache,path);
+	if(l) {
+		free(l->entries);
+	} else {
+		l = (struct ftp_listing *) xxmalloc(sizeof(*l));
+	}
+	l->expires = time(0)+ttl;
+	l->entries = xxstrdup(entries);
+	hash_table_insert(ftp_dircache,path,l);
+}
+
+static const char * ftp_dircache_lookup( const char *path )
+{
+	if(!ftp_dircache) return 0;
+
+	struct ftp_listing *l = (struct ftp_listing *) hash_table_lookup(ftp_dircache,path);
+	if(!l) return 0;
+
+	if(l->expires<time(0)) {
+		hash_table_remove(ftp_dircache,path);
+		free(l->entries);
+		free(l);
+		return 0;
+	}
+
+	return l->entries;
+}
+
 class pfs_file_ftp : public pfs_file
 {
 private:
@@ -135,15 +203,71 @@ public:
 		}
 	}
 
+	/*
+	Get a whole file over several connections at once into a temporary
+	file, and read it from there.  The first connection is the caller's,
+	and the others come from the connection cache, which keeps only one
+	of them when they are given back.  Returns null if the file is too
+	small to be worth striping or the transfer fails, in which case the
+	caller streams the file over its own connection.
+	*/
+
+	pfs_file * open_striped( pfs_name *name, struct ftp_lite_server *server ) {
+		char path[PFS_PATH_MAX];
+		struct ftp_lite_server **servers;
+		ftp_lite_size_t size, actual;
+		int i, n, fd;
+
+		size = ftp_lite_size(server,name->rest);
+		if(size<2*FTP_LITE_STRIPE_MIN) return 0;
+
+		string_nformat(path,sizeof(path),"%s/ftp.XXXXXX",pfs_temp_per_instance_dir);
+		fd = mkstemp(path);
+		if(fd<0) return 0;
+		::unlink(path);
+
+		servers = (struct ftp_lite_server **) xxmalloc(pfs_ftp_streams*sizeof(*servers));
+		servers[0] = server;
+		for(n=1;n<pfs_ftp_streams;n++) {
+			servers[n] = (struct ftp_lite_server *) pfs_service_connect_cache(name);
+			if(!servers[n]) break;
+		}
+
+		actual = ftp_lite_get_parallel(servers,n,name->rest,size,fd);
+
+		int save_errno = errno;
+		for(i=1;i<n;i++) {
+			pfs_service_disconnect_cache(name,servers[i],ftp_lite_is_broken(servers[i]));
+		}
+		free(servers);
+
+		if(actual!=size) {
+			debug(D_FTP,"couldn't get %s over %d connections: %s",name->rest,n,strerror(save_errno));
+			::close(fd);
+			return 0;
+		}
+
+		debug(D_FTP,"got %lld bytes of %s over %d connections",(long long)actual,name->rest,n);
+		return pfs_file_bootstrap(fd,name->path);
+	}
+
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode ) {
 		FILE *stream=0;
 		pfs_file *result=0;
 		struct ftp_lite_server *server = (struct ftp_lite_server*) pfs_service_connect_cache(name);
 		if(server) {
 			if((flags&O_ACCMODE)==O_RDONLY) {
+				if(pfs_ftp_streams>1) {
+					result = open_striped(name,server);
+					if(result) {
+						pfs_service_disconnect_cache(name,(void*)server,ftp_lite_is_broken(server));
+						return result;
+					}
+				}
 				stream = ftp_lite_get(server,name->rest,0);
 				if(stream) result = new pfs_file_ftp(name,stream,server);
 			} else if((flags&O_ACCMODE)==O_WRONLY) {
+				ftp_dircache_invalidate();
 				stream = ftp_lite_put(server,name->rest,0,FTP_LITE_WHOLE_FILE);
 				if(stream) result = new pfs_file_ftp(name,stream,server);
 			} else {
@@ -173,18 +297,38 @@ public:
 		FILE *data;
 		char entry[PFS_PATH_MAX];
 		pfs_dir *result = 0;
+		int ttl = get_metadata_ttl();
+
+		const char *entries = ttl>0 ? ftp_dircache_lookup(name->path) : 0;
+		if(entries) {
+			result = new pfs_dir(name);
+			while(*entries) {
+				size_t length = strcspn(entries,"\n");
+				string_nformat(entry,sizeof(entry),"%.*s",(int)length,entries);
+				result->append(entry);
+				entries += length;
+				if(*entries) entries++;
+			}
+			return result;
+		}
 
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
 			data = ftp_lite_list(server,name->rest);
 			if(data) {
+				buffer_t listing;
+				buffer_init(&listing);
 				result = new pfs_dir(name);
 				while(fgets(entry,sizeof(entry),data)) {
 					string_chomp(entry);
 					result->append(entry);
+					buffer_printf(&listing,"%s\n",entry);
 				}
 				fclose(data);
-				ftp_lite_done(server);
+				if(ftp_lite_done(server) && ttl>0) {
+					ftp_dircache_insert(name->path,buffer_tostring(&listing),ttl);
+				}
+				buffer_free(&listing);
 			}
 			int invalid = (errno==ECONNRESET);
 			pfs_service_disconnect_cache(name,(void*)server,invalid);
@@ -259,6 +403,7 @@ public:
 		int result=-1;
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
+			ftp_dircache_invalidate();
 			if(ftp_lite_delete(server,name->rest)) {
 				result = 0;
 			} else {
@@ -274,6 +419,7 @@ public:
 		int result=-1;
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
+			ftp_dircache_invalidate();
 			if(ftp_lite_rename(server,name->rest,newname->rest)) {
 				result = 0;
 			} else {
@@ -289,6 +435,7 @@ public:
 		int result=-1;
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
+			ftp_dircache_invalidate();
 			if(ftp_lite_make_dir(server,name->rest)) {
 				result = 0;
 			} else {
@@ -304,6 +451,7 @@ public:
 		int result=-1;
 		struct ftp_lite_server *server = (struct ftp_lite_server *)pfs_service_connect_cache(name);
 		if(server) {
+			ftp_dircache_invalidate();
 			if(ftp_lite_delete_dir(server,name->rest)) {
 				result = 0;
 			} else {
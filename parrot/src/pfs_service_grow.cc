@@ -21,7 +21,9 @@ a file .growfsdir that contains a complete directory listing and
 checksum of all data.  Upon first accessing the filesystem remotely,
 GROW-FS loads the directory listing into a tree form in memory.
 All metadata requests and directory lookups are handled using this
-data structure.
+data structure.  If make_growfs was run with -b, the listing is a
+binary image instead, which is mapped into memory and looked up by
+a hash of the path without being parsed.
 
 To access a file, GROW issues an HTTP request and reads the data
 sequentially into the pfs_file_cache.  A checksum is computed
@@ -564,7 +566,7 @@ public:
 			++dirsize;
 		}
 
-		for(d=d->children;d;d=d->next) {
+		for(d=grow_children(d);d;d=d->next) {
 			dir->append(d->name);
 			++dirsize;
 		}
@@ -15,6 +15,7 @@ extern "C" {
 #include "file_cache.h"
 #include "full_io.h"
 #include "http_query.h"
+#include "macros.h"
 }
 
 #include <unistd.h>
@@ -31,6 +32,7 @@ extern "C" {
 #define HTTP_FILE_MODE (S_IFREG | 0555)
 
 extern int pfs_main_timeout;
+extern int pfs_metadata_ttl;
 
 static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size )
 {
@@ -45,25 +47,86 @@ static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *si
 	return http_query_size(url,action,size,time(0)+pfs_main_timeout,0);
 }
 
+/*
+Forward gaps smaller than this are read and discarded from the open
+response rather than paying for a new connection and range request.
+*/
+#define HTTP_SKIP_MAX (1024*1024)
+
+static struct link * http_fetch_range( pfs_name *name, INT64_T offset, INT64_T *size )
+{
+	char url[HTTP_LINE_MAX];
+
+	sprintf(url,"http://%s:%d%s",name->host,name->port,name->rest);
+	return http_query_range(url,offset,size,time(0)+pfs_main_timeout);
+}
+
 class pfs_file_http : public pfs_file
 {
 private:
 	struct link *link;
 	INT64_T size;
+	INT64_T position;
+
+	/* Read and throw away length bytes of the current response. */
+	int skip( INT64_T length ) {
+		char buffer[65536];
+		while(length>0) {
+			int actual = link_read(link,buffer,MIN((INT64_T)sizeof(buffer),length),time(0)+pfs_main_timeout);
+			if(actual<=0) return -1;
+			length -= actual;
+			position += actual;
+		}
+		return 0;
+	}
+
+	/* Position the response at offset, asking for a new range if needed. */
+	int seek( pfs_off_t offset ) {
+		INT64_T length;
+
+		if(link && offset>=position && offset-position<HTTP_SKIP_MAX) {
+			if(skip(offset-position)==0) return 0;
+		}
+
+		if(link) link_close(link);
+		link = http_fetch_range(&name,offset,&length);
+		if(link) {
+			position = offset;
+			return 0;
+		}
+
+		/* The server ignores ranges, so read up to the offset from the start. */
+		if(errno!=ESPIPE) return -1;
+		link = http_fetch(&name,"GET",&length);
+		if(!link) return -1;
+		position = 0;
+		return skip(offset);
+	}
 
 public:
 	pfs_file_http( pfs_name *n, struct link *l, INT64_T s ) : pfs_file(n) {
 		link = l;
 		size = s;
+		position = 0;
 	}
 
 	virtual int close() {
-		link_close(link);
+		if(link) link_close(link);
 		return 0;
 	}
 
 	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
-		return link_read(link,(char*)d,length,LINK_FOREVER);
+		if(offset>=size) return 0;
+		if(!link || offset!=position) {
+			if(seek(offset)<0) {
+				if(link) link_close(link);
+				link = 0;
+				return -1;
+			}
+		}
+		pfs_ssize_t result = link_read(link,(char*)d,length,LINK_FOREVER);
+		if(result>0) position += result;
+		return result;
 	}
 
 	virtual int fstat( struct pfs_stat *buf ) {
@@ -125,6 +188,18 @@ public:
 	virtual int is_seekable (void) {
 		return 0;
 	}
+
+	virtual int supports_ranges (void) {
+		return 1;
+	}
+
+	virtual int supports_background_fetch (void) {
+		return 1;
+	}
+
+	virtual int get_metadata_ttl (void) {
+		return pfs_metadata_ttl>=0 ? pfs_metadata_ttl : PFS_METADATA_TTL_READONLY;
+	}
 };
 
 static pfs_service_http pfs_service_http_instance;
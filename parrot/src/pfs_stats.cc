@@ -0,0 +1,191 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_stats.h"
+
+extern "C" {
+#include "hash_table.h"
+#include "tracer.h"
+}
+
+#include <stdlib.h>
+
+/*
+Aggregate counters describing where a Parrot session spends its time.
+Parrot time is measured around each dispatch, so it includes the time
+spent in services; whatever remains of the wall clock was spent by the
+tracees themselves or in the kernel stopping and resuming them.
+*/
+
+struct syscall_stats {
+	INT64_T count;
+	timestamp_t time;
+};
+
+struct service_stats {
+	INT64_T opens;
+	INT64_T reads;
+	INT64_T writes;
+	INT64_T bytes_read;
+	INT64_T bytes_written;
+	timestamp_t time;
+};
+
+struct cache_stats {
+	INT64_T hits;
+	INT64_T misses;
+};
+
+int pfs_stats_enabled = 0;
+
+static timestamp_t start_time = 0;
+static timestamp_t parrot_time = 0;
+static struct syscall_stats *syscalls32 = 0;
+static struct syscall_stats *syscalls64 = 0;
+static struct hash_table *services = 0;
+static struct hash_table *caches = 0;
+
+void pfs_stats_enable()
+{
+	pfs_stats_enabled = 1;
+	start_time = timestamp_get();
+}
+
+void pfs_stats_syscall( int is64, INT64_T syscall, int entering, timestamp_t elapsed )
+{
+	struct syscall_stats *s;
+
+	parrot_time += elapsed;
+
+	if(is64) {
+		if(!syscalls64) syscalls64 = (struct syscall_stats *) calloc(SYSCALL64_MAX,sizeof(*syscalls64));
+		if(syscall<0 || syscall>=SYSCALL64_MAX) return;
+		s = &syscalls64[syscall];
+	} else {
+		if(!syscalls32) syscalls32 = (struct syscall_stats *) calloc(SYSCALL32_MAX,sizeof(*syscalls32));
+		if(syscall<0 || syscall>=SYSCALL32_MAX) return;
+		s = &syscalls32[syscall];
+	}
+
+	if(entering) s->count++;
+	s->time += elapsed;
+}
+
+void pfs_stats_io( const char *service, pfs_stats_op_t op, pfs_ssize_t bytes, timestamp_t elapsed )
+{
+	if(!pfs_stats_enabled) return;
+	if(!services) services = hash_table_create(0,0);
+
+	struct service_stats *s = (struct service_stats *) hash_table_lookup(services,service);
+	if(!s) {
+		s = (struct service_stats *) calloc(1,sizeof(*s));
+		hash_table_insert(services,service,s);
+	}
+
+	switch(op) {
+		case PFS_STATS_OPEN:
+			s->opens++;
+			break;
+		case PFS_STATS_READ:
+			s->reads++;
+			if(bytes>0) s->bytes_read += bytes;
+			break;
+		case PFS_STATS_WRITE:
+			s->writes++;
+			if(bytes>0) s->bytes_written += bytes;
+			break;
+	}
+
+	s->time += elapsed;
+}
+
+void pfs_stats_cache( const char *cache, int hit )
+{
+	if(!pfs_stats_enabled) return;
+	if(!caches) caches = hash_table_create(0,0);
+
+	struct cache_stats *c = (struct cache_stats *) hash_table_lookup(caches,cache);
+	if(!c) {
+		c = (struct cache_stats *) calloc(1,sizeof(*c));
+		hash_table_insert(caches,cache,c);
+	}
+
+	if(hit) {
+		c->hits++;
+	} else {
+		c->misses++;
+	}
+}
+
+static struct jx * syscalls_jx( struct syscall_stats *table, int max, const char * (*name)( int ) )
+{
+	struct jx *j = jx_object(0);
+
+	for(int i=0;table && i<max;i++) {
+		if(!table[i].count && !table[i].time) continue;
+		struct jx *s = jx_object(0);
+		jx_insert_integer(s,"count",table[i].count);
+		jx_insert_double(s,"time",table[i].time/1000000.0);
+		jx_insert(j,jx_string(name(i)),s);
+	}
+
+	return j;
+}
+
+struct jx * pfs_stats_jx()
+{
+	struct jx *j = jx_object(0);
+	timestamp_t wall_time = timestamp_get()-start_time;
+	char *key;
+	void *value;
+
+	if(!pfs_stats_enabled) return j;
+
+	jx_insert_double(j,"wall_time",wall_time/1000000.0);
+	jx_insert_double(j,"parrot_time",parrot_time/1000000.0);
+	jx_insert_double(j,"tracee_time",(wall_time>parrot_time ? wall_time-parrot_time : 0)/1000000.0);
+
+	jx_insert(j,jx_string("syscalls"),syscalls_jx(syscalls64,SYSCALL64_MAX,tracer_syscall64_name));
+	if(syscalls32) {
+		jx_insert(j,jx_string("syscalls32"),syscalls_jx(syscalls32,SYSCALL32_MAX,tracer_syscall32_name));
+	}
+
+	struct jx *sj = jx_object(0);
+	if(services) {
+		hash_table_firstkey(services);
+		while(hash_table_nextkey(services,&key,&value)) {
+			struct service_stats *s = (struct service_stats *) value;
+			struct jx *o = jx_object(0);
+			jx_insert_integer(o,"opens",s->opens);
+			jx_insert_integer(o,"reads",s->reads);
+			jx_insert_integer(o,"writes",s->writes);
+			jx_insert_integer(o,"bytes_read",s->bytes_read);
+			jx_insert_integer(o,"bytes_written",s->bytes_written);
+			jx_insert_double(o,"time",s->time/1000000.0);
+			jx_insert(sj,jx_string(key),o);
+		}
+	}
+	jx_insert(j,jx_string("services"),sj);
+
+	struct jx *cj = jx_object(0);
+	if(caches) {
+		hash_table_firstkey(caches);
+		while(hash_table_nextkey(caches,&key,&value)) {
+			struct cache_stats *c = (struct cache_stats *) value;
+			struct jx *o = jx_object(0);
+			jx_insert_integer(o,"hits",c->hits);
+			jx_insert_integer(o,"misses",c->misses);
+			INT64_T total = c->hits+c->misses;
+			jx_insert_double(o,"hit_rate",total ? (double)c->hits/total : 0);
+			jx_insert(cj,jx_string(key),o);
+		}
+	}
+	jx_insert(j,jx_string("caches"),cj);
+
+	return j;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,32 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_STATS_H
+#define PFS_STATS_H
+
+#include "pfs_types.h"
+
+extern "C" {
+#include "jx.h"
+#include "timestamp.h"
+}
+
+typedef enum {
+	PFS_STATS_OPEN,
+	PFS_STATS_READ,
+	PFS_STATS_WRITE,
+} pfs_stats_op_t;
+
+extern int pfs_stats_enabled;
+
+void pfs_stats_enable();
+void pfs_stats_syscall( int is64, INT64_T syscall, int entering, timestamp_t elapsed );
+void pfs_stats_io( const char *service, pfs_stats_op_t op, pfs_ssize_t bytes, timestamp_t elapsed );
+void pfs_stats_cache( const char *cache, int hit );
+
+struct jx * pfs_stats_jx();
+
+#endif
@@ -11,10 +11,13 @@ See the file COPYING for details.
 #include "pfs_table.h"
 #include "pfs_process.h"
 #include "pfs_service.h"
+#include "pfs_stats.h"
 
 extern "C" {
 #include "debug.h"
 #include "full_io.h"
+#include "jx_print.h"
+#include "stats.h"
 #include "file_cache.h"
 #include "pfs_mountfile.h"
 #include "pfs_resolve.h"
@@ -457,6 +460,45 @@ int pfs_timeout( const char *str )
 	END
 }
 
+int pfs_stats_dump( const char *path )
+{
+	BEGIN
+	debug(D_LIBCALL,"stats_dump %s",path);
+
+	if(!pfs_stats_enabled) {
+		errno = ENOTSUP;
+		result = -1;
+	} else {
+		struct jx *j = stats_get();
+		jx_insert(j,jx_string("parrot.profile"),pfs_stats_jx());
+		char *text = jx_print_string(j);
+		size_t length = strlen(text);
+		jx_delete(j);
+
+		char native[PFS_PATH_MAX];
+		int fd = pfs_current->table->open(path,O_WRONLY|O_CREAT|O_TRUNC,0666,0,native,sizeof(native));
+		if(fd==-2) {
+			fd = ::open(native,O_WRONLY|O_CREAT|O_TRUNC,0666);
+			if(fd>=0) {
+				result = full_write(fd,text,length)==(ssize_t)length ? 0 : -1;
+				::close(fd);
+			} else {
+				result = -1;
+			}
+		} else if(fd>=0) {
+			result = pfs_current->table->write(fd,text,length)==(pfs_ssize_t)length ? 0 : -1;
+			int save_errno = errno;
+			pfs_current->table->close(fd);
+			errno = save_errno;
+		} else {
+			result = -1;
+		}
+
+		free(text);
+	}
+	END
+}
+
 int pfs_mkalloc( const char *path, pfs_ssize_t size, mode_t mode )
 {
 	BEGIN
@@ -111,6 +111,7 @@ int		pfs_copyfile( const char *source, const char *target );
 int		pfs_fcopyfile( int srcfd, int dstfd );
 int		pfs_md5( const char *path, unsigned char *digest );
 int		pfs_timeout( const char *str );
+int		pfs_stats_dump( const char *path );
 
 int		pfs_get_real_fd( int fd );
 int		pfs_get_full_name( int fd, char *name );
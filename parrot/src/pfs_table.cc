@@ -16,8 +16,11 @@ See the file COPYING for details.
 #include "pfs_file.h"
 #include "pfs_mmap.h"
 #include "pfs_process.h"
+#include "pfs_file_buffer.h"
 #include "pfs_file_cache.h"
+#include "pfs_metacache.h"
 #include "pfs_resolve.h"
+#include "pfs_stats.h"
 
 extern "C" {
 #include "pfs_channel.h"
@@ -77,6 +80,16 @@ extern int pfs_no_flock;
 
 extern const char * pfs_initial_working_directory;
 
+static pfs_metacache metacache;
+
+/* Forget what is known about a remote path that is being changed. */
+static void metadata_changed( pfs_name *pname )
+{
+	if(pname->service && pname->service->get_metadata_ttl()>0) {
+		metacache.invalidate(pname->path);
+	}
+}
+
 static const int _SENTINEL1 = 0;
 #define NATIVE ((pfs_pointer *)&_SENTINEL1)
 static const int _SENTINEL2 = 0;
@@ -406,6 +419,11 @@ void pfs_table::follow_symlink( struct pfs_name *pname, mode_t mode, int depth )
 
 	if (string_prefix_is(pname->path, "/proc/")) in_proc = true;
 
+	/* A path known to be missing or not to be a link has nothing to follow. */
+	struct pfs_stat buf;
+	int cached = metacache.lookup(pname->path,0,&buf);
+	if (cached<0 || (cached>0 && !S_ISLNK(buf.st_mode))) return;
+
 	int rlres = new_pname.service->readlink(pname,link_target,PFS_PATH_MAX-1);
 	if (rlres > 0) {
 		/* readlink does not NULL-terminate */
@@ -676,10 +694,17 @@ pfs_file * pfs_table::open_object( const char *lname, int flags, mode_t mode, in
 	// on the parent directory. However, this seems to cause problems if
 	// system directories (or the filesystem root) are marked RO.
 	if(resolve_name(1,lname,&pname,open_mode)) {
+		timestamp_t start = timestamp_get();
 		if((flags&O_CREAT) && (flags&O_DIRECTORY)) {
 			// Linux ignores O_DIRECTORY in this combination
 			flags &= ~O_DIRECTORY;
 		}
+		if(flags&(O_WRONLY|O_RDWR|O_CREAT|O_TRUNC)) {
+			metadata_changed(&pname);
+		} else {
+			struct pfs_stat buf;
+			if(metacache.lookup(pname.path,1,&buf)<0) return 0;
+		}
 		char *pid = NULL;
 		if(flags&O_DIRECTORY) {
 			if (pattern_match(pname.rest, "^/proc/(%d+)/fd/?$", &pid) >= 0) {
@@ -748,14 +773,14 @@ pfs_file * pfs_table::open_object( const char *lname, int flags, mode_t mode, in
 					file = open_directory(&pname, flags);
 				}
 			} else {
-				file = pname.service->open(&pname,flags,mode);
+				file = pfs_buffer_open(&pname,pname.service->open(&pname,flags,mode),flags);
 				if(!file && (errno == EISDIR)) {
 					file = open_directory(&pname, flags);
 				}
 			}
 		} else {
 			if(force_stream) {
-				file = pname.service->open(&pname,flags,mode);
+				file = pfs_buffer_open(&pname,pname.service->open(&pname,flags,mode),flags);
 				if(!file && (errno == EISDIR)) {
 					file = open_directory(&pname, flags);
 				}
@@ -766,6 +791,10 @@ pfs_file * pfs_table::open_object( const char *lname, int flags, mode_t mode, in
 				}
 			}
 		}
+		if(!file && errno==ENOENT && !(flags&O_CREAT)) {
+			metacache.insert(pname.path,1,0,pname.service->get_metadata_ttl());
+		}
+		pfs_stats_io(pname.service_name,PFS_STATS_OPEN,0,timestamp_get()-start);
 		free(pid);
 	} else {
 		file = 0;
@@ -870,6 +899,8 @@ int pfs_table::close( int fd )
 
 		if(f->refs()==1) {
 			result = f->close();
+			/* a written file may only reach the service on close */
+			if((p->flags&O_ACCMODE)!=O_RDONLY) metadata_changed(f->get_name());
 			delete f;
 		} else {
 			f->delref();
@@ -940,7 +971,9 @@ pfs_ssize_t pfs_table::pread( int fd, void *data, pfs_size_t nbyte, pfs_off_t of
 			errno = ESPIPE;
 			result = -1;
 		} else {
+			timestamp_t start = timestamp_get();
 			result = f->read( data, nbyte, offset );
+			pfs_stats_io(f->get_name()->service_name,PFS_STATS_READ,result,timestamp_get()-start);
 			if(result>0) f->set_last_offset(offset+result);
 		}
 	}
@@ -966,8 +999,11 @@ pfs_ssize_t pfs_table::pwrite( int fd, const void *data, pfs_size_t nbyte, pfs_o
 			errno = ESPIPE;
 			result = -1;
 		} else {
+			timestamp_t start = timestamp_get();
 			result = f->write( data, nbyte, offset );
+			pfs_stats_io(f->get_name()->service_name,PFS_STATS_WRITE,result,timestamp_get()-start);
 			if(result>0) f->set_last_offset(offset+result);
+			metadata_changed(f->get_name());
 		}
 	}
 
@@ -1075,6 +1111,7 @@ int pfs_table::ftruncate( int fd, pfs_off_t size )
 		result = 0;
 	} else {
 		result = pointers[fd]->file->ftruncate(size);
+		metadata_changed(pointers[fd]->file->get_name());
 	}
 
 	return result;
@@ -1205,6 +1242,7 @@ int pfs_table::fchmod( int fd, mode_t mode )
 {
 	CHECK_FD(fd);
 
+	metadata_changed(pointers[fd]->file->get_name());
 	return pointers[fd]->file->fchmod(mode);
 }
 
@@ -1212,6 +1250,7 @@ int pfs_table::fchown( int fd, struct pfs_process *p, uid_t uid, gid_t gid )
 {
 	CHECK_FD(fd);
 
+	metadata_changed(pointers[fd]->file->get_name());
 	int result = pointers[fd]->file->fchown(uid,gid);
 
 	/*
@@ -1288,7 +1327,18 @@ int pfs_table::access( const char *n, mode_t mode )
 	int result = -1;
 
 	if(resolve_name(0,n,&pname,X_OK | mode)) {
-		result = pname.service->access(&pname,mode);
+		struct pfs_stat buf;
+		int cached = metacache.lookup(pname.path,1,&buf);
+		if(cached<0) {
+			result = -1;
+		} else if(cached>0 && mode==F_OK) {
+			result = 0;
+		} else {
+			result = pname.service->access(&pname,mode);
+			if(result<0 && errno==ENOENT) {
+				metacache.insert(pname.path,1,0,pname.service->get_metadata_ttl());
+			}
+		}
 	}
 
 	return result;
@@ -1300,6 +1350,7 @@ int pfs_table::chmod( const char *n, mode_t mode )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->chmod(&pname,mode);
 	}
 
@@ -1312,6 +1363,7 @@ int pfs_table::chown( const char *n, struct pfs_process *p, uid_t uid, gid_t gid
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->chown(&pname,uid,gid);
 	}
 
@@ -1333,6 +1385,7 @@ int pfs_table::lchown( const char *n, uid_t uid, gid_t gid )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK,false)) {
+		metadata_changed(&pname);
 		result = pname.service->lchown(&pname,uid,gid);
 	}
 
@@ -1345,6 +1398,7 @@ int pfs_table::truncate( const char *n, pfs_off_t offset )
 	int result=-1;
 
 	if(resolve_name(1,n,&pname,W_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->truncate(&pname,offset);
 	}
 
@@ -1481,6 +1535,7 @@ int pfs_table::utime( const char *n, struct utimbuf *buf )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->utime(&pname,buf);
 	}
 
@@ -1493,6 +1548,7 @@ int pfs_table::utimens( const char *n, const struct timespec times[2] )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->utimens(&pname,times);
 	}
 
@@ -1505,6 +1561,7 @@ int pfs_table::lutimens( const char *n, const struct timespec times[2] )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,W_OK,false)) {
+		metadata_changed(&pname);
 		result = pname.service->lutimens(&pname,times);
 	}
 
@@ -1518,6 +1575,7 @@ int pfs_table::unlink( const char *n )
 	int result = -1;
 
 	if(resolve_name(0,n,&pname,E_OK,false)) {
+		metadata_changed(&pname);
 		result = pname.service->unlink(&pname);
 		if(result==0) {
 			pfs_cache_invalidate(&pname);
@@ -1535,13 +1593,22 @@ int pfs_table::stat( const char *n, struct pfs_stat *b )
 
 	/* You don't need to have read permission on a file to stat it. */
 	if(resolve_name(0,n,&pname,F_OK)) {
-		result = pname.service->stat(&pname,b);
-		if(result>=0) {
-			b->st_blksize = pname.service->get_block_size();
-		} else if(errno==ENOENT && !pname.hostport[0]) {
-			pfs_service_emulate_stat(&pname,b);
-			b->st_mode = S_IFDIR | 0555;
-			result = 0;
+		int ttl = pname.service->get_metadata_ttl();
+		int cached = ttl>0 ? metacache.lookup(pname.path,1,b) : 0;
+		if(cached) {
+			result = cached>0 ? 0 : -1;
+		} else {
+			result = pname.service->stat(&pname,b);
+			if(result>=0) {
+				b->st_blksize = pname.service->get_block_size();
+				metacache.insert(pname.path,1,b,ttl);
+			} else if(errno==ENOENT && !pname.hostport[0]) {
+				pfs_service_emulate_stat(&pname,b);
+				b->st_mode = S_IFDIR | 0555;
+				result = 0;
+			} else if(errno==ENOENT) {
+				metacache.insert(pname.path,1,0,ttl);
+			}
 		}
 	}
 
@@ -1595,13 +1662,22 @@ int pfs_table::lstat( const char *n, struct pfs_stat *b )
 
 	/* You don't need to have read permission on a file to stat it. */
 	if(resolve_name(0,n,&pname,F_OK,false)) {
-		result = pname.service->lstat(&pname,b);
-		if(result>=0) {
-			b->st_blksize = pname.service->get_block_size();
-		} else if(errno==ENOENT && !pname.hostport[0]) {
-			pfs_service_emulate_stat(&pname,b);
-			b->st_mode = S_IFDIR | 0555;
-			result = 0;
+		int ttl = pname.service->get_metadata_ttl();
+		int cached = ttl>0 ? metacache.lookup(pname.path,0,b) : 0;
+		if(cached) {
+			result = cached>0 ? 0 : -1;
+		} else {
+			result = pname.service->lstat(&pname,b);
+			if(result>=0) {
+				b->st_blksize = pname.service->get_block_size();
+				metacache.insert(pname.path,0,b,ttl);
+			} else if(errno==ENOENT && !pname.hostport[0]) {
+				pfs_service_emulate_stat(&pname,b);
+				b->st_mode = S_IFDIR | 0555;
+				result = 0;
+			} else if(errno==ENOENT) {
+				metacache.insert(pname.path,0,0,ttl);
+			}
 		}
 	}
 
@@ -1615,6 +1691,7 @@ int pfs_table::rename( const char *n1, const char *n2 )
 
 	if(resolve_name(0,n1,&p1,E_OK,false) && resolve_name(0,n2,&p2,E_OK,false)) {
 		if(p1.service==p2.service) {
+			metacache.invalidate_all();
 			result = p1.service->rename(&p1,&p2);
 			if(result==0) {
 				pfs_cache_invalidate(&p1);
@@ -1638,6 +1715,8 @@ int pfs_table::link( const char *n1, const char *n2 )
 	// and bypassing restrictions
 	if(resolve_name(0,n1,&p1,W_OK,false) && resolve_name(0,n2,&p2,E_OK,false)) {
 		if(p1.service==p2.service) {
+			metadata_changed(&p1);
+			metadata_changed(&p2);
 			result = p1.service->link(&p1,&p2);
 		} else {
 			errno = EXDEV;
@@ -1662,6 +1741,7 @@ int pfs_table::symlink( const char *target, const char *path )
 	*/
 
 	if(resolve_name(0,path,&pname,E_OK,false)) {
+		metadata_changed(&pname);
 		result = pname.service->symlink(target,&pname);
 	}
 
@@ -1729,6 +1809,7 @@ int pfs_table::mknod( const char *n, mode_t mode, dev_t dev )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,E_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->mknod(&pname,mode,dev);
 	}
 
@@ -1741,6 +1822,7 @@ int pfs_table::mkdir( const char *n, mode_t mode )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,E_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->mkdir(&pname,mode);
 	}
 
@@ -1753,6 +1835,8 @@ int pfs_table::rmdir( const char *n )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,E_OK,false)) {
+		/* entries below the directory are named by it */
+		metacache.invalidate_all();
 		result = pname.service->rmdir(&pname);
 	}
 
@@ -1779,6 +1863,7 @@ int pfs_table::mkalloc( const char *n, pfs_ssize_t size, mode_t mode )
 	int result=-1;
 
 	if(resolve_name(0,n,&pname,E_OK)) {
+		metadata_changed(&pname);
 		result = pname.service->mkalloc(&pname,size,mode);
 	}
 
@@ -2271,6 +2356,8 @@ pfs_ssize_t pfs_table::copyfile( const char *source, const char *target )
 	if(resolve_name(1,source,&psource,R_OK)<0) return -1;
 	if(resolve_name(1,target,&ptarget,W_OK|E_OK)<0) return -1;
 
+	metadata_changed(&ptarget);
+
 	if(psource.service == ptarget.service) {
 		result = ptarget.service->thirdput(&psource,&ptarget);
 	} else if(psource.service->is_local()) {
@@ -21,12 +21,19 @@ See the file COPYING for details.
 #include <syscall.h>
 #include <unistd.h>
 
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/wait.h>
 
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +55,11 @@ See the file COPYING for details.
 
 #include "tracer.table.c"
 #include "tracer.table64.c"
+#include "tracer.table64.h"
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#	define PR_SET_NO_NEW_PRIVS 38
+#endif
 
 /*
 Note that we would normally get such register definitions
@@ -88,12 +100,126 @@ struct tracer {
 	int has_args5_bug;
 };
 
+/*
+In seccomp mode, the tracee runs a filter that lets through the system
+calls which Parrot never changes, so it only stops for the rest.  A
+tracee is then resumed with PTRACE_CONT between system calls, and with
+PTRACE_SYSCALL only to catch the exit of a system call it stopped for.
+*/
+
+static int use_seccomp = 0;
+
+#if defined(CCTOOLS_CPU_X86_64) && defined(SECCOMP_RET_TRACE)
+/*
+System calls passed through untouched by pfs_dispatch64 that are
+common enough to be worth not stopping for.  Anything not listed here,
+including every call that takes a path or a file descriptor, still stops.
+*/
+
+static const int seccomp_allowed64[] = {
+	SYSCALL64_brk,
+	SYSCALL64_clock_getres,
+	SYSCALL64_clock_nanosleep,
+	SYSCALL64_exit,
+	SYSCALL64_exit_group,
+	SYSCALL64_futex,
+	SYSCALL64_get_robust_list,
+	SYSCALL64_getcpu,
+	SYSCALL64_getitimer,
+	SYSCALL64_getpriority,
+	SYSCALL64_getrandom,
+	SYSCALL64_getrlimit,
+	SYSCALL64_getrusage,
+	SYSCALL64_gettid,
+	SYSCALL64_madvise,
+	SYSCALL64_membarrier,
+	SYSCALL64_mincore,
+	SYSCALL64_mprotect,
+	SYSCALL64_mremap,
+	SYSCALL64_nanosleep,
+	SYSCALL64_prlimit64,
+	SYSCALL64_restart_syscall,
+	SYSCALL64_rt_sigaction,
+	SYSCALL64_rt_sigpending,
+	SYSCALL64_rt_sigprocmask,
+	SYSCALL64_rt_sigreturn,
+	SYSCALL64_sched_getaffinity,
+	SYSCALL64_sched_yield,
+	SYSCALL64_set_robust_list,
+	SYSCALL64_set_tid_address,
+	SYSCALL64_setitimer,
+	SYSCALL64_sigaltstack,
+	SYSCALL64_sysinfo,
+	SYSCALL64_times,
+};
+#endif
+
+int tracer_seccomp_enable( void )
+{
+#if defined(CCTOOLS_CPU_X86_64) && defined(SECCOMP_RET_TRACE)
+	/* Earlier kernels stop for seccomp before syscall-entry, and do not recheck a changed system call. */
+	if (linux_available(4,8,0)) {
+		use_seccomp = 1;
+		return 0;
+	}
+#endif
+	errno = ENOSYS;
+	return -1;
+}
+
+int tracer_seccomp_install( void )
+{
+#if defined(CCTOOLS_CPU_X86_64) && defined(SECCOMP_RET_TRACE)
+	const size_t nallowed = sizeof(seccomp_allowed64)/sizeof(seccomp_allowed64[0]);
+	struct sock_filter filter[nallowed+9];
+	struct sock_fprog prog;
+	size_t mmap = 4+nallowed;
+	size_t trace = mmap+3;
+	size_t allow = mmap+4;
+	size_t i, n = 0;
+
+	/* Other ABIs (i386, x32) always stop, and are dispatched as they are today. */
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch));
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, AUDIT_ARCH_X86_64, 0, trace-n-1); n++;
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr));
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JGE|BPF_K, 0x40000000, trace-n-1, 0); n++;
+	for (i = 0; i < nallowed; i++) {
+		filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, seccomp_allowed64[i], allow-n-1, 0); n++;
+	}
+
+	/* Anonymous memory is never Parrot's; mmap of a file descriptor still stops. */
+	assert(n == mmap);
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SYSCALL64_mmap, 0, trace-n-1); n++;
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, args[3]));
+	filter[n] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JSET|BPF_K, MAP_ANONYMOUS, allow-n-1, trace-n-1); n++;
+
+	assert(n == trace);
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+	filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+
+	prog.len = n;
+	prog.filter = filter;
+
+	/* A traced process cannot gain privileges on exec anyway. */
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+		return -1;
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1)
+		return -1;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 int tracer_attach (pid_t pid)
 {
 	intptr_t options = PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACEEXEC|PTRACE_O_TRACEEXIT|PTRACE_O_TRACECLONE|PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK;
 
 	if (linux_available(3,8,0))
 		options |= PTRACE_O_EXITKILL;
+	if (use_seccomp)
+		options |= PTRACE_O_TRACESECCOMP;
 	assert(linux_available(2,5,60));
 
 	if (linux_available(3,4,0)) {
@@ -193,6 +319,19 @@ void tracer_detach( struct tracer *t )
 }
 
 int tracer_continue( struct tracer *t, int signum )
+{
+	t->gotregs = 0;
+	if(t->setregs) {
+		if(ptrace(PTRACE_SETREGS,t->pid,0,&t->regs) == -1)
+			return -1;
+		t->setregs = 0;
+	}
+	if (ptrace(use_seccomp ? PTRACE_CONT : PTRACE_SYSCALL,t->pid,0,signum) == -1)
+		ERROR;
+	return 0;
+}
+
+int tracer_continue_syscall( struct tracer *t, int signum )
 {
 	t->gotregs = 0;
 	if(t->setregs) {
@@ -715,6 +854,104 @@ ssize_t tracer_copy_in_string( struct tracer *t, char *str, const void *uaddr, s
 	return rc;
 }
 
+/*
+Copy between one local buffer and the scattered buffers of a readv or
+writev.  All of the tracee buffers are handed to a single
+process_vm_readv or process_vm_writev (per IOV_MAX of them), rather
+than one call per buffer.  Returns the number of bytes moved, which is
+short only if some of the tracee memory is not mapped.
+*/
+
+static ssize_t copy_iov_fast( struct tracer *t, void *data, size_t length, const struct iovec *uv, int count, int out )
+{
+	struct iovec local;
+	struct iovec remote[IOV_MAX];
+	size_t moved = 0;
+	int i = 0;
+
+	if (!linux_available(3,2,0))
+		return errno = ENOSYS, -1;
+
+	while (i < count && moved < length) {
+		size_t chunk = 0;
+		size_t rn = 0;
+
+		while (i < count && rn < IOV_MAX && moved+chunk < length) {
+			size_t n = MIN(uv[i].iov_len, length-moved-chunk);
+			if (n) {
+				remote[rn].iov_base = uv[i].iov_base;
+#if !defined(CCTOOLS_CPU_I386)
+				if (!tracer_is_64bit(t))
+					remote[rn].iov_base = VOID_MATH(remote[rn].iov_base, & 0xffffffff);
+#endif
+				remote[rn].iov_len = n;
+				chunk += n;
+				rn++;
+			}
+			i++;
+		}
+		if (rn == 0)
+			break;
+
+		local.iov_base = VOID_MATH(data, +moved);
+		local.iov_len = chunk;
+
+#ifdef CCTOOLS_CPU_I386
+		ssize_t n = syscall(out ? SYSCALL32_process_vm_writev : SYSCALL32_process_vm_readv, t->pid, &local, (int32_t)1, remote, rn, (int32_t)0);
+#else
+		ssize_t n = syscall(out ? SYSCALL64_process_vm_writev : SYSCALL64_process_vm_readv, (int64_t)t->pid, &local, (int64_t)1, remote, rn, (int64_t)0);
+#endif
+		if (n == -1) {
+			if (errno == EFAULT && moved)
+				return moved;
+			return -1;
+		}
+		moved += n;
+		if ((size_t)n < chunk)
+			break;
+	}
+
+	return moved;
+}
+
+static ssize_t copy_iov_slow( struct tracer *t, void *data, size_t length, const struct iovec *uv, int count, int out )
+{
+	size_t moved = 0;
+	int i;
+
+	for (i = 0; i < count && moved < length; i++) {
+		size_t n = MIN(uv[i].iov_len, length-moved);
+		ssize_t rc;
+		if (out)
+			rc = tracer_copy_out(t, VOID_MATH(data, +moved), uv[i].iov_base, n, 0);
+		else
+			rc = tracer_copy_in(t, VOID_MATH(data, +moved), uv[i].iov_base, n, 0);
+		if (rc == -1)
+			return moved ? (ssize_t)moved : -1;
+		moved += rc;
+		if ((size_t)rc < n)
+			break;
+	}
+
+	return moved;
+}
+
+ssize_t tracer_copy_out_iov( struct tracer *t, const void *data, size_t length, const struct iovec *uv, int count )
+{
+	ssize_t rc = copy_iov_fast(t, (void *)data, length, uv, count, 1);
+	if (rc == -1 && errno == ENOSYS)
+		rc = copy_iov_slow(t, (void *)data, length, uv, count, 1);
+	return rc;
+}
+
+ssize_t tracer_copy_in_iov( struct tracer *t, void *data, size_t length, const struct iovec *uv, int count )
+{
+	ssize_t rc = copy_iov_fast(t, data, length, uv, count, 0);
+	if (rc == -1 && errno == ENOSYS)
+		rc = copy_iov_slow(t, data, length, uv, count, 0);
+	return rc;
+}
+
 const char * tracer_syscall32_name( int syscall )
 {
 	if( syscall<0 || syscall>SYSCALL32_MAX ) {
@@ -16,9 +16,12 @@ See the file COPYING for details.
 struct tracer;
 
 int tracer_attach( pid_t pid );
+int tracer_seccomp_enable( void );
+int tracer_seccomp_install( void );
 void tracer_detach( struct tracer *t );
 struct tracer *tracer_init( pid_t pid );
 int tracer_continue( struct tracer *t, int signum );
+int tracer_continue_syscall( struct tracer *t, int signum );
 int tracer_listen( struct tracer *t );
 int tracer_getevent( struct tracer *t, unsigned long *message );
 
@@ -40,6 +43,11 @@ ssize_t tracer_copy_out( struct tracer *t, const void *data, const void *uaddr,
 ssize_t tracer_copy_in( struct tracer *t, void *data, const void *uaddr, size_t length, int flags );
 ssize_t tracer_copy_in_string( struct tracer *t, char *data, const void *uaddr, size_t maxlength, int flags );
 
+/* Scattered copies, as for readv and writev, moving at most length bytes. */
+struct iovec;
+ssize_t tracer_copy_out_iov( struct tracer *t, const void *data, size_t length, const struct iovec *uv, int count );
+ssize_t tracer_copy_in_iov( struct tracer *t, void *data, size_t length, const struct iovec *uv, int count );
+
 int tracer_is_64bit( struct tracer *t );
 
 const char *tracer_syscall32_name( int syscall );
@@ -5,6 +5,57 @@
 # See the file COPYING for details.
 
 
+# This function serves as the preamble of a Python Library Task, and runs
+# before the imports of the library. If the library was started before on this
+# worker with --zygote, a process of the library with its imports already done
+# waits for new instances in the zygote directory given by the worker. This
+# instance is then handed over to it, and only waits for its exit status.
+def library_zygote_code():
+    import os
+    import sys
+
+    def zygote_handoff():
+        import hashlib
+        import json
+        import socket
+
+        zygote_dir = os.environ.get("VINE_LIBRARY_ZYGOTE_DIR")
+        if not zygote_dir or "--zygote" not in sys.argv:
+            return None
+
+        digest = hashlib.sha1(sys.executable.encode())
+        with open(sys.argv[0], "rb") as f:
+            digest.update(f.read())
+        # connect by a relative name, as socket paths are limited in length.
+        cwd = os.getcwd()
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            os.chdir(zygote_dir)
+            conn.connect(f"{digest.hexdigest()[:16]}.sock")
+        except OSError:
+            conn.close()
+            return None
+        finally:
+            os.chdir(cwd)
+
+        fds = [0, 1, 2] + [int(sys.argv[sys.argv.index(o) + 1]) for o in ("--in-pipe-fd", "--out-pipe-fd")]
+        request = json.dumps({"argv": sys.argv, "cwd": cwd, "env": dict(os.environ)}).encode()
+        socket.send_fds(conn, [f"{len(request)}\n".encode()], fds)
+        conn.sendall(request)
+
+        status = b""
+        while True:
+            data = conn.recv(64)
+            if not data:
+                break
+            status += data
+        return int(status) if status else 1
+
+    zygote_status = zygote_handoff()
+    if zygote_status is not None:
+        os._exit(zygote_status)
+
+
 # This function serves as the template for Python Library Task.
 # A Python Library Task's script will be extracted as the body of this
 # function and run on a worker as a pilot task. Upcoming Python
@@ -21,6 +72,9 @@ def library_network_code():
     import select
     import signal
     import time
+    import concurrent.futures
+    import threading
+    from collections import OrderedDict
     from datetime import datetime
     import socket
     from threadpoolctl import threadpool_limits
@@ -29,6 +83,53 @@ def library_network_code():
     # into an I/O event.
     r, w = os.pipe()
 
+    # The connection to the process that started this library, when this
+    # instance was forked from a zygote.
+    zygote_state = {"conn": None}
+
+    # Results of function calls kept in memory, so that later calls in this
+    # library read them without unpickling their files again. Entries are
+    # keyed by the identity of the file, which is kept when the worker moves
+    # it to its cache and links it into other sandboxes, and are dropped in
+    # least recently used order once over the limit, as the file remains on disk.
+    memory_store = OrderedDict()
+    memory_store_state = {"limit": 0, "size": 0}
+    memory_store_lock = threading.Lock()
+
+    def memory_store_key(path):
+        st = os.stat(path)
+        return (st.st_dev, st.st_ino, st.st_size, st.st_mtime_ns)
+
+    # Remember the contents of the result file at path.
+    def vine_keep_result(path, result):
+        if memory_store_state["limit"] < 1:
+            return
+        key = memory_store_key(path)
+        size = key[2]
+        if size > memory_store_state["limit"]:
+            return
+        with memory_store_lock:
+            if key not in memory_store:
+                memory_store_state["size"] += size
+            memory_store[key] = result
+            memory_store.move_to_end(key)
+            while memory_store_state["size"] > memory_store_state["limit"]:
+                (old, _) = memory_store.popitem(last=False)
+                memory_store_state["size"] -= old[2]
+
+    # Load a result file, from memory if it was produced or read in this library.
+    def vine_load_result(path):
+        if memory_store_state["limit"] > 0:
+            key = memory_store_key(path)
+            with memory_store_lock:
+                if key in memory_store:
+                    memory_store.move_to_end(key)
+                    return memory_store[key]
+        with open(path, "rb") as f:
+            result = cloudpickle.load(f)
+        vine_keep_result(path, result)
+        return result
+
     # This class captures how results from FunctionCalls are conveyed from
     # the library to the manager.
     # For now, all communication details should use this class to generate responses.
@@ -57,9 +158,8 @@ def library_network_code():
             new_args = []
             for arg in args:
                 if isinstance(arg, dict) and "VineFutureFile" in arg:
-                    with open(arg["VineFutureFile"], "rb") as f:
-                        output = cloudpickle.load(f)["Result"]
-                        new_args.append(output)
+                    output = vine_load_result(arg["VineFutureFile"])["Result"]
+                    new_args.append(output)
                 else:
                     new_args.append(arg)
             args = tuple(new_args)
@@ -82,7 +182,9 @@ def library_network_code():
         os.writev(w, [b"a"])
 
     # Read data from worker, start function, and dump result to `outfile`.
-    def start_function(in_pipe_fd, thread_limit=1):
+    # Returns the pid and function id of a forked function, or None if the
+    # function runs (or ran) inside the library and reports its own result.
+    def start_function(in_pipe_fd, out_pipe_fd, worker_pid, exec_mode, executor, thread_limit=1):
         # read length of buffer to read
         buffer_len = b""
         while True:
@@ -120,124 +222,129 @@ def library_network_code():
             stdout_timed_message(f"error: invalid function name, malformed message {line} from worker")
             exit(1)
 
-        with threadpool_limits(limits=thread_limit):
+        arg_infile = os.path.join(function_sandbox, "infile")
+        try:
+            with open(arg_infile, "rb") as f:
+                event = cloudpickle.load(f)
+        except Exception:
+            stdout_timed_message(f"TASK {function_id} error: can't load the arguments from {arg_infile}")
+            send_result(out_pipe_fd, worker_pid, function_id, 2 << 8)
+            return None
+
+        # outputs of earlier functions are named relative to the sandbox,
+        # which is not the working directory of functions run in threads.
+        event["fn_args"] = [
+            {"VineFutureFile": os.path.join(function_sandbox, arg["VineFutureFile"])} if isinstance(arg, dict) and "VineFutureFile" in arg else arg
+            for arg in event.get("fn_args", [])
+        ]
+
+        # a function call may ask for its own method, otherwise use the library's
+        exec_method = event.get("remote_task_exec_method", exec_mode)
+
+        if exec_method == "direct":
+            # run in the library process itself, keeping any state it has loaded.
+            library_cwd = os.getcwd()
+            os.chdir(function_sandbox)
+            try:
+                with threadpool_limits(limits=thread_limit):
+                    exit_status = run_function(function_id, function_name, function_sandbox, function_stdout_filename, event, redirect=True, keep_result=True)
+            finally:
+                os.chdir(library_cwd)
+            send_result(out_pipe_fd, worker_pid, function_id, exit_status << 8)
+            return None
+
+        if exec_method == "thread" and executor:
+            # run in the pool of function slots. The working directory and
+            # stdout are shared by all threads, so output goes to the library's stdout.
+            def run_in_thread():
+                exit_status = run_function(function_id, function_name, function_sandbox, function_stdout_filename, event, redirect=False, keep_result=True)
+                send_result(out_pipe_fd, worker_pid, function_id, exit_status << 8)
+
+            executor.submit(run_in_thread)
+            return None
 
-            # exec method for now is fork only, direct will be supported later
-            exec_method = "fork"
-            if exec_method == "direct":
-                library_sandbox = os.getcwd()
-                try:
-                    os.chdir(function_sandbox)
+        with threadpool_limits(limits=thread_limit):
+            p = os.fork()
+            if p == 0:
+                os.chdir(function_sandbox)
+                exit_status = run_function(function_id, function_name, function_sandbox, function_stdout_filename, event, redirect=True)
+                os._exit(exit_status)
+            elif p < 0:
+                stdout_timed_message(f"TASK {function_id} error: unable to fork to execute {function_name}")
+                send_result(out_pipe_fd, worker_pid, function_id, 1 << 8)
+                return None
+            # return pid and function id of child process to parent.
+            else:
+                return p, function_id
 
-                    # parameters are represented as infile.
-                    with open("infile", "rb") as f:
-                        event = cloudpickle.load(f)
+    # Execute one function and dump its result to `outfile` in its sandbox.
+    # If redirect is set, stdout and stderr of the function go to its own file.
+    # If keep_result is set, the result is also kept in the memory store.
+    # Returns the exit status of the function call.
+    def run_function(function_id, function_name, function_sandbox, function_stdout_filename, event, redirect, keep_result=False):
+        stdout_timed_message(f"TASK {function_id} {function_name} arrives, starting to run in process {os.getpid()}")
 
-                    # output of execution should be dumped to outfile.
+        exit_status = 1
+        try:
+            try:
+                # setup stdout/err for a function call so we can capture them.
+                function_stdout_fd = os.open(
+                    function_stdout_filename, os.O_WRONLY | os.O_CREAT | os.O_TRUNC
+                )
+                if redirect:
+                    # store the library's stdout fd
+                    library_stdout_fd = os.dup(sys.stdout.fileno())
+                    library_stderr_fd = os.dup(sys.stderr.fileno())
+
+                    # only redirect the stdout of a specific FunctionCall task into its own stdout fd,
+                    # otherwise use the library's stdout
+                    os.dup2(function_stdout_fd, sys.stdout.fileno())
+                    os.dup2(function_stdout_fd, sys.stderr.fileno())
+                try:
                     result = globals()[function_name](event)
-                    try:
-                        with open("outfile", "wb") as f:
-                            cloudpickle.dump(result, f)
-                    except Exception:
-                        if os.path.exits("outfile"):
-                            os.remove("outfile")
-                        raise
-
-                    try:
-                        if not result["Success"]:
-                            raise Exception(result["Reason"])
-                    except Exception:
-                        raise
-
-                except Exception as e:
-                    stdout_timed_message(
-                        f"Library code: Function call failed due to {e}",
-                        file=sys.stderr,
-                    )
-                    sys.exit(1)
                 finally:
-                    os.chdir(library_sandbox)
-            else:
-                try:
-                    arg_infile = os.path.join(function_sandbox, "infile")
-                    with open(arg_infile, "rb") as f:
-                        event = cloudpickle.load(f)
-                except Exception:
-                    stdout_timed_message(f"TASK {function_id} error: can't load the arguments from {arg_infile}")
-                    return
-                p = os.fork()
-                if p == 0:
-                    try:
-                        # change the working directory to the function's sandbox
-                        os.chdir(function_sandbox)
-
-                        stdout_timed_message(f"TASK {function_id} {function_name} arrives, starting to run in process {os.getpid()}")
-
-                        try:
-                            exit_status = 1
-                        except Exception:
-                            stdout_timed_message(f"TASK {function_id} error: can't load the arguments from infile")
-                            exit_status = 2
-                            raise
-
-                        try:
-                            # setup stdout/err for a function call so we can capture them.
-                            function_stdout_fd = os.open(
-                                function_stdout_filename, os.O_WRONLY | os.O_CREAT | os.O_TRUNC
-                            )
-                            # store the library's stdout fd
-                            library_fd = os.dup(sys.stdout.fileno())
-
-                            # only redirect the stdout of a specific FunctionCall task into its own stdout fd,
-                            # otherwise use the library's stdout
-                            os.dup2(function_stdout_fd, sys.stdout.fileno())
-                            os.dup2(function_stdout_fd, sys.stderr.fileno())
-                            result = globals()[function_name](event)
-
-                            # restore to the library's stdout fd on completion
-                            os.dup2(library_fd, sys.stdout.fileno())
-                        except Exception:
-                            stdout_timed_message(f"TASK {function_id} error: can't execute this function")
-                            exit_status = 3
-                            raise
-                        finally:
-                            if function_stdout_fd in locals():
-                                os.close(function_stdout_fd)
-
-                        try:
-                            with open("outfile", "wb") as f:
-                                cloudpickle.dump(result, f)
-                        except Exception:
-                            stdout_timed_message(f"TASK {function_id} error: can't load the result from outfile")
-                            exit_status = 4
-                            if os.path.exits("outfile"):
-                                os.remove("outfile")
-                            raise
-
-                        try:
-                            if not result["Success"]:
-                                exit_status = 5
-                        except Exception:
-                            stdout_timed_message(f"TASK {function_id} error: the result is invalid")
-                            exit_status = 5
-                            raise
-
-                        # nothing failed
-                        stdout_timed_message(f"TASK {function_id} finished successfully")
-                        exit_status = 0
-                    except Exception as e:
-                        stdout_timed_message(f"TASK {function_id} error: execution failed due to {e}")
-                    finally:
-                        os._exit(exit_status)
-                elif p < 0:
-                    stdout_timed_message(f"TASK {function_id} error: unable to fork to execute {function_name}")
-                    return -1
-
-                # return pid and function id of child process to parent.
-                else:
-                    return p, function_id
+                    if redirect:
+                        # restore to the library's stdout fd on completion
+                        sys.stdout.flush()
+                        sys.stderr.flush()
+                        os.dup2(library_stdout_fd, sys.stdout.fileno())
+                        os.dup2(library_stderr_fd, sys.stderr.fileno())
+                        os.close(library_stdout_fd)
+                        os.close(library_stderr_fd)
+                    os.close(function_stdout_fd)
+            except Exception:
+                stdout_timed_message(f"TASK {function_id} error: can't execute this function")
+                exit_status = 3
+                raise
 
-        return -1
+            outfile = os.path.join(function_sandbox, "outfile")
+            try:
+                with open(outfile, "wb") as f:
+                    cloudpickle.dump(result, f)
+                if keep_result:
+                    vine_keep_result(outfile, result)
+            except Exception:
+                stdout_timed_message(f"TASK {function_id} error: can't load the result from outfile")
+                exit_status = 4
+                if os.path.exists(outfile):
+                    os.remove(outfile)
+                raise
+
+            try:
+                if not result["Success"]:
+                    exit_status = 5
+                    return exit_status
+            except Exception:
+                stdout_timed_message(f"TASK {function_id} error: the result is invalid")
+                exit_status = 5
+                raise
+
+            # nothing failed
+            stdout_timed_message(f"TASK {function_id} finished successfully")
+            exit_status = 0
+        except Exception as e:
+            stdout_timed_message(f"TASK {function_id} error: execution failed due to {e}")
+        return exit_status
 
     # Send result of a function execution to worker. Wake worker up to do work with SIGCHLD.
     def send_result(out_pipe_fd, worker_pid, task_id, exit_code):
@@ -259,6 +366,137 @@ def library_network_code():
         timestamp = datetime.now().strftime("%m/%d/%y %H:%M:%S.%f")
         os.write(sys.stdout.fileno(), f"{timestamp} {message}\n".encode())
 
+    # Fork a zygote from this library, now that its imports are done, so that
+    # later instances of the library on this worker start from it.
+    def start_zygote(worker_pid):
+        import hashlib
+
+        zygote_dir = os.environ.get("VINE_LIBRARY_ZYGOTE_DIR")
+        if not zygote_dir:
+            return
+        digest = hashlib.sha1(sys.executable.encode())
+        with open(sys.argv[0], "rb") as f:
+            digest.update(f.read())
+        sock_name = f"{digest.hexdigest()[:16]}.sock"
+
+        pid = os.fork()
+        if pid > 0:
+            os.waitpid(pid, 0)
+            return
+
+        # detach the zygote from this library and its worker process group.
+        os.setsid()
+        if os.fork() > 0:
+            os._exit(0)
+        try:
+            run_zygote(zygote_dir, sock_name, worker_pid)
+        finally:
+            os._exit(0)
+
+    def run_zygote(zygote_dir, sock_name, worker_pid):
+        os.makedirs(zygote_dir, exist_ok=True)
+        os.chdir(zygote_dir)
+
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            listener.bind(sock_name)
+        except OSError:
+            # an existing zygote serves the library, unless it is gone.
+            probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                probe.connect(sock_name)
+                return
+            except OSError:
+                os.unlink(sock_name)
+                listener.bind(sock_name)
+            finally:
+                probe.close()
+        listener.listen(16)
+        listener.settimeout(5)
+
+        # keep only the listening socket and the numbers of the self-pipe,
+        # and detach from the library's files.
+        keep = (listener.fileno(), r, w)
+        for fd in [int(fd) for fd in os.listdir("/proc/self/fd")]:
+            if fd > 2 and fd not in keep:
+                try:
+                    os.close(fd)
+                except OSError:
+                    pass
+        devnull = os.open(os.devnull, os.O_RDWR)
+        for fd in (0, 1, 2):
+            os.dup2(devnull, fd)
+        os.close(devnull)
+
+        while True:
+            try:
+                (conn, _) = listener.accept()
+            except socket.timeout:
+                conn = None
+
+            try:
+                while os.waitpid(-1, os.WNOHANG)[0] > 0:
+                    pass
+            except ChildProcessError:
+                pass
+
+            # the zygote lives as long as its worker and its workspace.
+            try:
+                os.kill(worker_pid, 0)
+            except ProcessLookupError:
+                return
+            if not os.path.exists(sock_name):
+                return
+
+            if conn:
+                if os.fork() == 0:
+                    listener.close()
+                    run_instance(conn)
+                conn.close()
+
+    # Take over the files, arguments, and environment of a library started
+    # after the zygote, and run as that library. Does not return.
+    def run_instance(conn):
+        status = 1
+        try:
+            # do not share the sigchld self-pipe with other instances.
+            (new_r, new_w) = os.pipe()
+            os.dup2(new_r, r)
+            os.dup2(new_w, w)
+            os.close(new_r)
+            os.close(new_w)
+
+            (header, fds, _, _) = socket.recv_fds(conn, 4096, 5)
+            (length, request) = header.split(b"\n", 1)
+            while len(request) < int(length):
+                data = conn.recv(65536)
+                if not data:
+                    os._exit(1)
+                request += data
+            request = json.loads(request)
+
+            for (i, fd) in enumerate(fds[:3]):
+                os.dup2(fd, i)
+                os.close(fd)
+            argv = request["argv"]
+            argv[argv.index("--in-pipe-fd") + 1] = str(fds[3])
+            argv[argv.index("--out-pipe-fd") + 1] = str(fds[4])
+            sys.argv = argv
+            os.chdir(request["cwd"])
+            os.environ.clear()
+            os.environ.update(request["env"])
+
+            zygote_state["conn"] = conn
+            status = main()
+        except SystemExit as e:
+            status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+        except Exception:
+            traceback.print_exc()
+        try:
+            conn.sendall(str(status).encode())
+        finally:
+            os._exit(status)
+
     def main():
         ppid = os.getppid()
 
@@ -298,6 +536,25 @@ def library_network_code():
             default=1,
             help="number of function slots of this library",
         )
+        parser.add_argument(
+            "--exec-mode",
+            required=False,
+            default="fork",
+            choices=["fork", "direct", "thread"],
+            help="how to run function calls: in a forked child, directly in the library, or in a pool of threads.",
+        )
+        parser.add_argument(
+            "--memory-store",
+            required=False,
+            type=int,
+            default=0,
+            help="MB of function results to keep in memory for later calls (direct and thread exec modes).",
+        )
+        parser.add_argument(
+            "--zygote",
+            action="store_true",
+            help="keep a process of this library after its imports, to start later instances on this worker.",
+        )
         parser.add_argument(
             "--worker-pid",
             required=True,
@@ -341,6 +598,14 @@ def library_network_code():
         stdout_timed_message(f"library cores        {args.library_cores}")
         stdout_timed_message(f"function slots       {args.function_slots}")
         stdout_timed_message(f"thread limit         {thread_limit}")
+        stdout_timed_message(f"exec mode            {args.exec_mode}")
+        stdout_timed_message(f"memory store         {args.memory_store} MB")
+        stdout_timed_message(f"started from zygote  {zygote_state['conn'] is not None}")
+
+        if args.zygote and not zygote_state["conn"]:
+            start_zygote(args.worker_pid)
+
+        memory_store_state["limit"] = args.memory_store * 1024 * 1024
 
         # Open communication pipes to vine_worker.
         # The file descriptors are inherited from the vine_worker parent process
@@ -351,9 +616,18 @@ def library_network_code():
         # mapping of child pid to function id of currently running functions
         pid_to_func_id = {}
 
-        # send configuration of library, just its name for now
+        # a direct library runs one function at a time, while threads share the function slots.
+        executor = None
+        function_slots = args.function_slots
+        if args.exec_mode == "direct":
+            function_slots = 1
+        elif args.exec_mode == "thread":
+            executor = concurrent.futures.ThreadPoolExecutor(max_workers=args.function_slots)
+
+        # send configuration of library, its name and how many functions it runs at once
         config = {
             "name": name(),  # noqa: F821
+            "function_slots": function_slots,
         }
         send_configuration(config, out_pipe_fd, args.worker_pid)
 
@@ -379,16 +653,27 @@ def library_network_code():
                 last_check_time = current_check_time
 
             # wait for messages from worker or child to return
+            watched = [in_pipe_fd, r]
+            if zygote_state["conn"]:
+                watched.append(zygote_state["conn"])
+            rlist = []
             try:
-                rlist, wlist, xlist = select.select([in_pipe_fd, r], [], [], timeout)
+                rlist, wlist, xlist = select.select(watched, [], [], timeout)
             except Exception as e:
                 stdout_timed_message(f"error unable to read from pipe {in_pipe_fd}\n{e}")
 
+            # the process that started this instance from a zygote is gone
+            if zygote_state["conn"] in rlist:
+                stdout_timed_message("library finished because its starting process exited")
+                exit(0)
+
             for re in rlist:
                 # worker has a function, run it
                 if re == in_pipe_fd:
-                    pid, func_id = start_function(in_pipe_fd, thread_limit)
-                    pid_to_func_id[pid] = func_id
+                    started = start_function(in_pipe_fd, out_pipe_fd, args.worker_pid, args.exec_mode, executor, thread_limit)
+                    if started:
+                        pid, func_id = started
+                        pid_to_func_id[pid] = func_id
                 else:
                     # at least 1 child exits, reap all.
                     # read only once as os.read is blocking if there's nothing to read.
@@ -14,6 +14,7 @@ import hashlib
 import shutil
 import logging
 import re
+import tarfile
 from platform import uname
 from packaging import version
 
@@ -108,7 +109,39 @@ def _copy_run_in_env(env_dir):
     os.chmod(f"{env_dir}/env/bin/run_in_env", 0o755)
 
 
-def _pack_env_with_conda_dir(spec, output, ignore_editable_packages=False):
+# Pack the conda environment at prefix into output. The archive format follows
+# the extension of output (e.g., .tar.gz, or .tar.zst for faster unpacking), and
+# is compressed with the given number of threads (-1 for all cores). If directory
+# is set, output is instead a directory holding the unpacked environment, which
+# workers use without extracting it.
+def _conda_pack(prefix, output, ignore_editable_packages=False, threads=-1, directory=False):
+    if not directory:
+        conda_pack.pack(
+            prefix=prefix,
+            output=str(output),
+            force=True,
+            ignore_missing_files=True,
+            ignore_editable_packages=ignore_editable_packages,
+            n_threads=threads,
+        )
+        return
+
+    with tempfile.TemporaryDirectory(prefix="poncho_pack") as pack_dir:
+        tarball = f"{pack_dir}/env.tar"
+        conda_pack.pack(
+            prefix=prefix,
+            output=tarball,
+            force=True,
+            ignore_missing_files=True,
+            ignore_editable_packages=ignore_editable_packages,
+        )
+        shutil.rmtree(output, ignore_errors=True)
+        os.makedirs(output)
+        with tarfile.open(tarball) as tar:
+            tar.extractall(output)
+
+
+def _pack_env_with_conda_dir(spec, output, ignore_editable_packages=False, threads=-1, directory=False):
     # remove trailing slash if present
     spec = spec[:-1] if spec[-1] == "/" else spec
     try:
@@ -121,13 +154,7 @@ def _pack_env_with_conda_dir(spec, output, ignore_editable_packages=False):
         )
         os.rename(f"{spec}/env/bin/run_in_env", f"{spec}/bin/run_in_env")
 
-        conda_pack.pack(
-            prefix=f"{spec}",
-            output=str(output),
-            force=True,
-            ignore_missing_files=True,
-            ignore_editable_packages=ignore_editable_packages,
-        )
+        _conda_pack(f"{spec}", output, ignore_editable_packages, threads, directory)
         logger.info(
             "to activate environment run poncho_package_run -e {} <command>".format(
                 output
@@ -194,6 +221,8 @@ def pack_env_from_dict(
     conda_executable=None,
     download_micromamba=False,
     ignore_editable_packages=False,
+    threads=-1,
+    directory=False,
 ):
     # record packages installed as editable from pip
     local_pip_pkgs = _find_local_pip()
@@ -254,13 +283,7 @@ def pack_env_from_dict(
         # https://github.com/conda/conda-pack/issues/145
         if ignore_editable_packages is not True:
             ignore_editable_packages = False
-        conda_pack.pack(
-            prefix=f"{env_dir}/env",
-            output=str(output),
-            force=True,
-            ignore_missing_files=True,
-            ignore_editable_packages=ignore_editable_packages,
-        )
+        _conda_pack(f"{env_dir}/env", output, ignore_editable_packages, threads, directory)
 
         logger.info(
             "to activate environment run poncho_package_run -e {} <command>".format(
@@ -277,10 +300,12 @@ def pack_env(
     conda_executable=None,
     download_micromamba=False,
     ignore_editable_packages=False,
+    threads=-1,
+    directory=False,
 ):
     # pack a conda directory directly
     if os.path.isdir(spec):
-        _pack_env_with_conda_dir(spec, output, ignore_editable_packages)
+        _pack_env_with_conda_dir(spec, output, ignore_editable_packages, threads, directory)
 
     # else if spec is a file or from stdin
     elif os.path.isfile(spec) or spec == "-":
@@ -292,13 +317,15 @@ def pack_env(
                 conda_executable,
                 download_micromamba,
                 ignore_editable_packages,
+                threads,
+                directory,
             )
 
     # else pack from a conda environment name
     # this thus assumes conda executable is in the current shell executable path
     else:
         conda_env_dir = _get_conda_env_dir_by_name(spec)
-        _pack_env_with_conda_dir(conda_env_dir, output, ignore_editable_packages)
+        _pack_env_with_conda_dir(conda_env_dir, output, ignore_editable_packages, threads, directory)
 
 
 def _get_conda_env_dir_by_name(env_name):
@@ -8,7 +8,7 @@
 from ndcctools.poncho import package_analyze as analyze
 from ndcctools.poncho import package_create as create
 from ndcctools.poncho.wq_network_code import wq_network_code
-from ndcctools.poncho.library_network_code import library_network_code
+from ndcctools.poncho.library_network_code import library_network_code, library_zygote_code
 
 import json
 import os
@@ -66,6 +66,10 @@ def create_library_code(path, funcs, dest, version, hoisting_modules=None):
     with open(dest, "w") as output_file:
         # write shebang to file
         output_file.write(shebang)
+        # write the zygote preamble to file, so that it runs before the imports
+        if version == "taskvine":
+            raw_source_code = inspect.getsource(library_zygote_code)
+            output_file.write("\n".join([line[4:] for line in raw_source_code.split("\n")[1:]]))
         # write imports to file
         hoisting_code_list = generate_hoisting_code(hoisting_modules)
         if hoisting_code_list:
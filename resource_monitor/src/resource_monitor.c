@@ -151,7 +151,9 @@ See the file COPYING for details.
 #include "xxmalloc.h"
 
 #include "rmonitor.h"
+#include "rmonitor_cgroup.h"
 #include "rmonitor_file_watch.h"
+#include "rmonitor_series.h"
 #include "rmonitor_poll_internal.h"
 
 #define RESOURCE_MONITOR_USE_INOTIFY 1
@@ -164,15 +166,21 @@ See the file COPYING for details.
 #include "rmonitor_piggyback.h"
 
 #define DEFAULT_INTERVAL 5		   /* in seconds */
+
+#define ADAPTIVE_CHANGE_FRACTION 0.10 /* resources changing by more than this fraction between observations are sampled densely. */
+#define ADAPTIVE_LIMIT_FRACTION 0.80  /* resources above this fraction of their limits are sampled densely. */
 #define DEFAULT_LOG_NAME "resource-pid-%d" /* %d is used for the value of getpid() */
 
 #define ACTIVATE_DEBUG_FILE ".cctools_resource_monitor_debug"
 
 uint64_t interval = DEFAULT_INTERVAL;
+double min_interval = 0; /* If > 0, observations are taken every min_interval to interval seconds, depending on how quickly resources change. */
 
 char *summary_path = NULL; /* name of the summary file */
 FILE *log_summary = NULL;  /* Final statistics are written to this file (FILE * to summary_path). */
 FILE *log_series = NULL;   /* Resource events and samples are written to this file. */
+struct rmonitor_series *series = NULL; /* Encodes the samples written to log_series. */
+int series_binary = 0;                 /* 1 if samples are written in the compact binary format. */
 FILE *log_inotify = NULL;  /* List of opened files is written to this file. */
 
 char *template_path = NULL; /* Prefix of all output files names */
@@ -265,6 +273,12 @@ int64_t catalog_interval_default = 30;
 timestamp_t last_summary_write = 0;
 int update_summary_file = 0;
 
+/* If not null, the monitored processes are placed in this cgroup, and
+ * cpu time and memory are read from its accounting rather than from /proc. */
+static struct rmonitor_cgroup *rmonitor_cgroup = NULL;
+static int rmonitor_cgroup_has_memory = 0;
+static int rmonitor_cgroup_events_fd = -1; /* readable when memory.events of the cgroup changes. */
+
 /***
  * Utility functions (open log files, proc files, measure time)
  ***/
@@ -858,35 +872,8 @@ int64_t average_bandwidth(int use_min_len)
 void rmonitor_summary_header()
 {
 	if (log_series) {
-		fprintf(log_series, "# Units:\n");
-		fprintf(log_series, "# wall_clock and cpu_time in seconds\n");
-		fprintf(log_series, "# virtual, resident and swap memory in megabytes.\n");
-		fprintf(log_series, "# disk in megabytes.\n");
-		fprintf(log_series, "# bandwidth in Mbps.\n");
-		fprintf(log_series, "# cpu_time, bytes_read, bytes_written, bytes_sent, and bytes_received show cummulative values.\n");
-		fprintf(log_series, "# wall_clock, max_concurrent_processes, virtual, resident, swap, files, and disk show values at the sample point.\n");
-
-		fprintf(log_series, "#");
-		fprintf(log_series, "%s", "wall_clock");
-		fprintf(log_series, " %s", "cpu_time");
-		fprintf(log_series, " %s", "cores");
-		fprintf(log_series, " %s", "max_concurrent_processes");
-		fprintf(log_series, " %s", "virtual_memory");
-		fprintf(log_series, " %s", "memory");
-		fprintf(log_series, " %s", "swap_memory");
-		fprintf(log_series, " %s", "bytes_read");
-		fprintf(log_series, " %s", "bytes_written");
-		fprintf(log_series, " %s", "bytes_received");
-		fprintf(log_series, " %s", "bytes_sent");
-		fprintf(log_series, " %s", "bandwidth");
-		fprintf(log_series, " %s", "machine_load");
-
-		if (resources_flags->disk) {
-			fprintf(log_series, " %25s", "total_files");
-			fprintf(log_series, " %25s", "disk");
-		}
-
-		fprintf(log_series, "\n");
+		series = rmonitor_series_create(log_series, series_binary, resources_flags->disk);
+		rmonitor_series_header(series);
 	}
 }
 
@@ -955,6 +942,16 @@ void rmonitor_collate_tree(struct rmsummary *tr, struct rmonitor_process_info *p
 	tr->cpu_time += ((double)p->cpu.delta) / ONE_SECOND;
 	tr->context_switches += p->ctx.delta;
 
+	struct rmonitor_cgroup_info cg;
+	if (!rmonitor_cgroup || !rmonitor_cgroup_measure(rmonitor_cgroup, &cg)) {
+		cg.cpu_usec = cg.memory = cg.swap = cg.processes = -1;
+	}
+
+	/* the cgroup also accounts for processes that terminated between polls. */
+	if (cg.cpu_usec >= 0) {
+		tr->cpu_time = ((double)cg.cpu_usec) / ONE_SECOND;
+	}
+
 	tr->cores = 0;
 	tr->cores_avg = 0;
 
@@ -963,7 +960,7 @@ void rmonitor_collate_tree(struct rmsummary *tr, struct rmonitor_process_info *p
 		tr->cores_avg = tr->cpu_time / tr->wall_time;
 	}
 
-	tr->max_concurrent_processes = (double)itable_size(processes);
+	tr->max_concurrent_processes = (double)MAX(itable_size(processes), cg.processes);
 	tr->total_processes = (double)summary->total_processes;
 
 	/* we use max here, as /proc/pid/smaps that fills *m is not always
@@ -979,6 +976,13 @@ void rmonitor_collate_tree(struct rmsummary *tr, struct rmonitor_process_info *p
 		tr->swap_memory = (double)p->mem.swap;
 	}
 
+	if (cg.memory >= 0) {
+		tr->memory = (double)DIV_INT_ROUND_UP(cg.memory, ONE_MEGABYTE);
+		if (cg.swap >= 0) {
+			tr->swap_memory = (double)DIV_INT_ROUND_UP(cg.swap, ONE_MEGABYTE);
+		}
+	}
+
 	tr->bytes_read = ((double)(p->io.delta_chars_read + tr->bytes_read + p->io.delta_bytes_faulted)) / ONE_MEGABYTE;
 	tr->bytes_written = ((double)(p->io.delta_chars_written + tr->bytes_written)) / ONE_MEGABYTE;
 
@@ -1019,37 +1023,28 @@ void rmonitor_find_max_tree(struct rmsummary *result, struct rmsummary *tr)
 
 void rmonitor_log_row(struct rmsummary *tr)
 {
-	if (log_series) {
-		fprintf(log_series, "%s", rmsummary_resource_to_str("start", tr->wall_time + summary->start, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("cpu_time", tr->cpu_time, 0));
-
-		if (tr->wall_time > max_peak_cores_interval) {
-			fprintf(log_series, " %s", rmsummary_resource_to_str("cores", tr->cores, 0));
-		} else {
-			fprintf(log_series, " %s", rmsummary_resource_to_str("cores", tr->cores_avg, 0));
+	if (series) {
+		double values[rmonitor_series_columns(series)];
+
+		for (int i = 0; i < rmonitor_series_columns(series); i++) {
+			const char *column = rmonitor_series_column(i);
+			if (!strcmp(column, "start")) {
+				values[i] = tr->wall_time + summary->start;
+			} else if (!strcmp(column, "cores") && tr->wall_time <= max_peak_cores_interval) {
+				values[i] = tr->cores_avg;
+			} else {
+				values[i] = rmsummary_get(tr, column);
+			}
 		}
 
-		fprintf(log_series, " %s", rmsummary_resource_to_str("max_concurrent_processes", tr->max_concurrent_processes, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("virtual_memory", tr->virtual_memory, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("memory", tr->memory, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("swap_memory", tr->swap_memory, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("bytes_read", tr->bytes_read, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("bytes_written", tr->bytes_written, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("bytes_received", tr->bytes_received, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("bytes_sent", tr->bytes_sent, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("bandwidth", tr->bandwidth, 0));
-		fprintf(log_series, " %s", rmsummary_resource_to_str("machine_load", tr->machine_load, 0));
+		rmonitor_series_write(series, values);
+		fflush(log_series);
 
-		if (resources_flags->disk) {
-			fprintf(log_series, " %s", rmsummary_resource_to_str("total_files", tr->total_files, 0));
-			fprintf(log_series, " %s", rmsummary_resource_to_str("disk", tr->disk, 0));
+		/* the binary series is meant for many short samples, so we leave syncing to the kernel. */
+		if (!series_binary) {
+			fsync(fileno(log_series));
 		}
 
-		fprintf(log_series, "\n");
-
-		fflush(log_series);
-		fsync(fileno(log_series));
-
 		/* are we going to keep monitoring the whole filesystem? */
 		// fprintf(log_series "%" PRId64 "\n", tr->fs_nodes);
 	}
@@ -1624,10 +1619,23 @@ void rmonitor_final_cleanup()
 		lib_helper_extracted = 0;
 	}
 
+	if (rmonitor_cgroup) {
+		struct rmonitor_cgroup_info cg;
+		if (rmonitor_cgroup_measure(rmonitor_cgroup, &cg) && cg.cpu_usec >= 0) {
+			summary->cpu_time = MAX(summary->cpu_time, ((double)cg.cpu_usec) / ONE_SECOND);
+		}
+		rmonitor_cgroup_delete(rmonitor_cgroup);
+		rmonitor_cgroup = NULL;
+		rmonitor_cgroup_events_fd = -1;
+	}
+
 	status = rmonitor_final_summary();
 
 	send_catalog_update(summary, 1);
 
+	if (series)
+		rmonitor_series_delete(series);
+
 	if (log_series)
 		fclose(log_series);
 	if (log_inotify)
@@ -1824,23 +1832,23 @@ int rmonitor_dispatch_msg(void)
 	return 0;
 }
 
-int wait_for_messages(int interval)
+int wait_for_messages(double interval)
 {
 	struct timeval timeout;
-	timeout.tv_sec = interval;
-	timeout.tv_usec = 0;
+	timeout.tv_sec = (time_t)interval;
+	timeout.tv_usec = (suseconds_t)((interval - timeout.tv_sec) * USECOND);
 
-	debug(D_RMON, "sleeping for: %d seconds\n", interval);
+	debug(D_RMON, "sleeping for: %.2lf seconds\n", interval);
 
 	// If grandchildren processes cannot talk to us, simply wait.
 	// Else, wait, and check socket for messages.
-	if (rmonitor_queue_fd < 0) {
+	if (rmonitor_queue_fd < 0 && rmonitor_cgroup_events_fd < 0) {
 		/* wait for interval. */
 		select(1, NULL, NULL, NULL, &timeout);
 	} else {
 
 		/* Figure out the number of file descriptors to pass to select */
-		int nfds = 1 + MAX(rmonitor_queue_fd, rmonitor_inotify_fd);
+		int nfds = 1 + MAX(MAX(rmonitor_queue_fd, rmonitor_inotify_fd), rmonitor_cgroup_events_fd);
 		fd_set rset;
 
 		int urgent = 0;
@@ -1855,6 +1863,10 @@ int wait_for_messages(int interval)
 				FD_SET(rmonitor_inotify_fd, &rset);
 			}
 
+			if (rmonitor_cgroup_events_fd >= 0) {
+				FD_SET(rmonitor_cgroup_events_fd, &rset);
+			}
+
 			count = select(nfds, &rset, NULL, NULL, &timeout);
 
 			if (FD_ISSET(rmonitor_queue_fd, &rset)) {
@@ -1865,6 +1877,15 @@ int wait_for_messages(int interval)
 				urgent |= rmonitor_handle_inotify();
 			}
 
+			if (rmonitor_cgroup_events_fd >= 0 && FD_ISSET(rmonitor_cgroup_events_fd, &rset)) {
+				/* memory went above memory.high, which is set to the memory limit. Measure right away. */
+				char buf[4096];
+				while (read(rmonitor_cgroup_events_fd, buf, sizeof(buf)) > 0) {
+				}
+				debug(D_RMON, "memory event in cgroup.\n");
+				urgent = 1;
+			}
+
 			if (urgent) {
 				timeout.tv_sec = 0;
 				timeout.tv_usec = 0;
@@ -1971,6 +1992,10 @@ struct rmonitor_process_info *spawn_first_process(const char *executable, char *
 
 		prctl(PR_SET_PDEATHSIG, SIGKILL);
 
+		if (rmonitor_cgroup) {
+			rmonitor_cgroup_add_process(rmonitor_cgroup, getpid());
+		}
+
 		errno = 0;
 		execvp(executable, argv);
 		// We get here only if execlp fails.
@@ -1992,9 +2017,14 @@ static void show_help(const char *cmd)
 	fprintf(stdout, "%-30s Show version string.\n", "-v,--version");
 	fprintf(stdout, "\n");
 	fprintf(stdout, "%-30s Maximum interval between observations, in seconds. (default=%d)\n", "-i,--interval=<n>", DEFAULT_INTERVAL);
+	fprintf(stdout, "%-30s Sample as often as every <n> seconds while resources change quickly or\n", "--min-interval=<n>");
+	fprintf(stdout, "%-30s approach their limits, backing off up to --interval while stable.\n", "");
 	fprintf(stdout, "%-30s Track <pid> instead of executing a command line (warning: less precise measurements).\n", "--pid=<pid>");
 	fprintf(stdout, "%-30s Accurately measure short running processes (adds overhead).\n", "--accurate-short-processes");
 	fprintf(stdout, "%-30s Read command line from <str>, and execute as '/bin/sh -c <str>'\n", "-c,--sh=<str>");
+	fprintf(stdout, "%-30s Measure cpu time and memory from a cgroup v2 of the command.\n", "--cgroup");
+	fprintf(stdout, "%-30s Read memory from every map of /proc/pid/smaps rather than from\n", "--detailed-maps");
+	fprintf(stdout, "%-30s /proc/pid/smaps_rollup (adds overhead).\n", "");
 	fprintf(stdout, "\n");
 	fprintf(stdout, "%-30s Use maxfile with list of var: value pairs for resource limits.\n", "-l,--limits-file=<maxfile>");
 	fprintf(stdout, "%-30s Use string of the form \"var: value, var: value\" to specify.\n", "-L,--limits=<string>");
@@ -2005,6 +2035,8 @@ static void show_help(const char *cmd)
 	fprintf(stdout, "\n");
 	fprintf(stdout, "%-30s Specify filename template for log files (default=resource-pid-<pid>)\n", "-O,--with-output-files=<file>");
 	fprintf(stdout, "%-30s Write resource time series to <template>.series\n", "--with-time-series");
+	fprintf(stdout, "%-30s Format of the time series, text (default) or binary. Binary series\n", "--series-format=<fmt>");
+	fprintf(stdout, "%-30s can be converted to text with rmonitor_series_convert.\n", "");
 	fprintf(stdout, "%-30s Write inotify statistics of opened files to default=<template>.files\n", "--with-inotify");
 	fprintf(stdout, "%-30s Include this string verbatim in a line in the summary. \n", "-V,--verbatim-to-summary=<str>");
 	fprintf(stdout, "%-30s (Could be specified multiple times.)\n", "");
@@ -2026,6 +2058,60 @@ static void show_help(const char *cmd)
 	fprintf(stdout, "%-30s Configuration file for snapshots on file patterns. (See man page.)\n", "--snapshot-events=<file>");
 }
 
+/***
+ * Adaptive sampling. Resources that change quickly or that are close to
+ * their limits are observed every min_interval seconds. Otherwise, the
+ * time between observations doubles, up to interval seconds.
+ ***/
+
+int rmonitor_resources_changing(const struct rmsummary *prev, const struct rmsummary *now)
+{
+	const char *resources[] = {"memory", "virtual_memory", "swap_memory", "disk", "total_files", "max_concurrent_processes", "cores", NULL};
+
+	int i;
+	for (i = 0; resources[i]; i++) {
+		double p = rmsummary_get(prev, resources[i]);
+		double n = rmsummary_get(now, resources[i]);
+
+		if (fabs(n - p) > ADAPTIVE_CHANGE_FRACTION * MAX(p, 1)) {
+			debug(D_RMON, "%s changed from %.2lf to %.2lf\n", resources[i], p, n);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int rmonitor_resources_near_limits(const struct rmsummary *now)
+{
+	const char **resources = rmsummary_list_resources();
+
+	size_t i;
+	for (i = 0; i < rmsummary_num_resources(); i++) {
+		double l = rmsummary_get(resources_limits, resources[i]);
+		double n = rmsummary_get(now, resources[i]);
+
+		if (l > 0 && n > ADAPTIVE_LIMIT_FRACTION * l) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+double rmonitor_next_interval(double current, const struct rmsummary *prev, const struct rmsummary *now)
+{
+	if (min_interval <= 0) {
+		return interval;
+	}
+
+	if (!prev || rmonitor_resources_changing(prev, now) || rmonitor_resources_near_limits(now)) {
+		return min_interval;
+	}
+
+	return MIN((double)interval, 2 * current);
+}
+
 int rmonitor_resources(long int interval /*in seconds */)
 {
 	uint64_t round;
@@ -2036,6 +2122,8 @@ int rmonitor_resources(long int interval /*in seconds */)
 	struct rmonitor_mem_info *m_acc = calloc(1, sizeof(struct rmonitor_mem_info));
 
 	struct rmsummary *resources_now = calloc(1, sizeof(struct rmsummary));
+	struct rmsummary *resources_prev = NULL;
+	double current_interval = interval;
 
 	// Loop while there are processes to monitor, that is
 	// itable_size(processes) > 0). The check is done again in a
@@ -2052,10 +2140,13 @@ int rmonitor_resources(long int interval /*in seconds */)
 		ping_processes();
 
 		rmonitor_poll_all_processes_once(processes, p_acc);
-		rmonitor_poll_maps_once(processes, m_acc);
+		/* smaps is expensive to read, and resident memory comes from the cgroup when available. */
+		if (!rmonitor_cgroup_has_memory) {
+			rmonitor_poll_maps_once(processes, m_acc);
+		}
 
 		if (resources_flags->disk) {
-			rmonitor_poll_all_wds_once(wdirs, d_acc, MAX(1, interval / (MAX(1, hash_table_size(wdirs)))));
+			rmonitor_poll_all_wds_once(wdirs, d_acc, MAX(1, current_interval / (MAX(1, hash_table_size(wdirs)))));
 		}
 
 		// rmonitor_fss_once(f); disabled until statfs fs id makes sense.
@@ -2089,7 +2180,11 @@ int rmonitor_resources(long int interval /*in seconds */)
 		if (itable_size(processes) < 1)
 			break;
 
-		wait_for_messages(interval);
+		current_interval = rmonitor_next_interval(current_interval, resources_prev, resources_now);
+		rmsummary_delete(resources_prev);
+		resources_prev = rmsummary_copy(resources_now, 0);
+
+		wait_for_messages(current_interval);
 
 		// if monitoring a static executable, this adds children missed by
 		// BRANCH messages.
@@ -2103,6 +2198,7 @@ int rmonitor_resources(long int interval /*in seconds */)
 	}
 
 	rmsummary_delete(resources_now);
+	rmsummary_delete(resources_prev);
 	free(p_acc);
 	free(m_acc);
 	free(d_acc);
@@ -2126,6 +2222,7 @@ int main(int argc, char **argv)
 
 	int use_series = 0;
 	int use_inotify = 0;
+	int use_cgroup = 0;
 	int child_in_foreground = 0;
 
 	debug_config(argv[0]);
@@ -2189,7 +2286,11 @@ int main(int argc, char **argv)
 		LONG_OPT_CATALOG_INTERVAL,
 		LONG_OPT_UPDATE_SUMMARY,
 		LONG_OPT_PID,
-		LONG_OPT_MEASURE_ONLY
+		LONG_OPT_MEASURE_ONLY,
+		LONG_OPT_CGROUP,
+		LONG_OPT_MIN_INTERVAL,
+		LONG_OPT_DETAILED_MAPS,
+		LONG_OPT_SERIES_FORMAT
 	};
 
 	static const struct option long_options[] = {/* Regular Options */
@@ -2203,6 +2304,9 @@ int main(int argc, char **argv)
 			{"sh", required_argument, 0, 'c'},
 			{"pid", required_argument, 0, LONG_OPT_PID},
 			{"measure-only", no_argument, 0, LONG_OPT_MEASURE_ONLY},
+			{"cgroup", no_argument, 0, LONG_OPT_CGROUP},
+			{"min-interval", required_argument, 0, LONG_OPT_MIN_INTERVAL},
+			{"detailed-maps", no_argument, 0, LONG_OPT_DETAILED_MAPS},
 
 			{"verbatim-to-summary", required_argument, 0, 'V'},
 
@@ -2214,6 +2318,7 @@ int main(int argc, char **argv)
 
 			{"with-output-files", required_argument, 0, 'O'},
 			{"with-time-series", no_argument, 0, LONG_OPT_TIME_SERIES},
+			{"series-format", required_argument, 0, LONG_OPT_SERIES_FORMAT},
 			{"with-inotify", no_argument, 0, LONG_OPT_OPENED_FILES},
 			{"without-disk-footprint", no_argument, 0, LONG_OPT_NO_DISK_FOOTPRINT},
 
@@ -2281,6 +2386,16 @@ int main(int argc, char **argv)
 		case LONG_OPT_TIME_SERIES:
 			use_series = 1;
 			break;
+		case LONG_OPT_SERIES_FORMAT:
+			if (!strcmp(optarg, "binary")) {
+				series_binary = 1;
+			} else if (!strcmp(optarg, "text")) {
+				series_binary = 0;
+			} else {
+				debug(D_FATAL, "series format should be either 'text' or 'binary'.");
+				exit(RM_MONITOR_ERROR);
+			}
+			break;
 		case LONG_OPT_OPENED_FILES:
 			use_inotify = 1;
 			break;
@@ -2304,6 +2419,19 @@ int main(int argc, char **argv)
 		case LONG_OPT_NO_PPRINT:
 			pprint_summaries = 0;
 			break;
+		case LONG_OPT_CGROUP:
+			use_cgroup = 1;
+			break;
+		case LONG_OPT_DETAILED_MAPS:
+			rmonitor_poll_detailed_maps(1);
+			break;
+		case LONG_OPT_MIN_INTERVAL:
+			min_interval = strtod(optarg, NULL);
+			if (min_interval <= 0) {
+				debug(D_FATAL, "minimum interval should be a positive number of seconds.");
+				exit(RM_MONITOR_ERROR);
+			}
+			break;
 		case LONG_OPT_SNAPSHOT_FILE:
 			debug(D_FATAL, "This option has been replaced with --snapshot-events. Please consult the manual of resource_monitor.");
 			exit(RM_MONITOR_ERROR);
@@ -2494,6 +2622,24 @@ int main(int argc, char **argv)
 
 	set_snapshot_watch_events();
 
+	if (use_cgroup && !first_pid_manually_set) {
+		char *name = string_format("resource_monitor.%d", getpid());
+		rmonitor_cgroup = rmonitor_cgroup_create(name);
+		free(name);
+
+		struct rmonitor_cgroup_info cg;
+		if (!rmonitor_cgroup) {
+			debug(D_NOTICE, "could not create a cgroup, measuring from /proc instead.");
+		} else if (rmonitor_cgroup_measure(rmonitor_cgroup, &cg)) {
+			rmonitor_cgroup_has_memory = cg.memory >= 0;
+		}
+
+		/* with adaptive sampling, let the kernel tell us when memory reaches its limit. */
+		if (rmonitor_cgroup_has_memory && min_interval > 0 && enforce_limits && resources_limits->memory > 0) {
+			rmonitor_cgroup_events_fd = rmonitor_cgroup_watch_memory(rmonitor_cgroup, (int64_t)(resources_limits->memory * ONE_MEGABYTE));
+		}
+	}
+
 	if (first_pid_manually_set > 0) {
 		rmonitor_track_process(first_process_pid);
 	} else {
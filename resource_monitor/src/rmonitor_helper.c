@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/ipc.h>
 #include <sys/sem.h>
 #include <sys/socket.h>
@@ -78,6 +79,29 @@ static uint64_t end_time = 0;
 
 static int stop_short_running = 0; /* Stop processes that run for less than RESOURCE_MONITOR_SHORT_TIME seconds. */
 
+/* Reads, writes, and network transfers are counted by each thread, and
+ * sent to the monitor as one message per kind every
+ * RMONITOR_HELPER_FLUSH_INTERVAL useconds, or every
+ * RMONITOR_HELPER_FLUSH_BYTES bytes, whichever comes first. The clock is
+ * only read every RMONITOR_HELPER_CLOCK_SAMPLE calls, so that a call
+ * costs a few additions rather than a message. Failed writes are sent at
+ * once, as the monitor looks at their errors. Counts are also sent when a
+ * thread or process ends, and the counts of a child start from zero. */
+#define RMONITOR_HELPER_FLUSH_INTERVAL 250000
+#define RMONITOR_HELPER_FLUSH_BYTES (1024 * 1024)
+#define RMONITOR_HELPER_CLOCK_SAMPLE 32
+
+struct io_batch {
+	uint64_t bytes;
+	uint64_t calls;
+	timestamp_t start;
+};
+
+static __thread struct io_batch io_batches[TX - READ + 1];
+static __thread int io_flushing = 0;
+static __thread int io_thread_registered = 0;
+static pthread_key_t io_thread_key;
+
 #define declare_original_dlsym(name) __typeof__(name) *original_##name;
 #define define_original_dlsym(name) original_##name = dlsym(RTLD_NEXT, #name);
 
@@ -104,6 +128,78 @@ declare_original_dlsym(open64);
 
 static int initializing_helper = 0;
 
+static void flush_io(enum rmonitor_msg_type type, int error)
+{
+	struct io_batch *b = &io_batches[type - READ];
+
+	if (b->bytes > 0 || error) {
+		struct rmonitor_msg msg;
+		msg.type = type;
+		msg.error = error;
+		msg.origin = getpid();
+		msg.start = b->start;
+		msg.end = timestamp_get();
+		msg.data.n = b->bytes;
+
+		io_flushing = 1;
+		send_monitor_msg(&msg);
+		io_flushing = 0;
+	}
+
+	memset(b, 0, sizeof(*b));
+}
+
+static void flush_all_io()
+{
+	enum rmonitor_msg_type type;
+	for (type = READ; type <= TX; type++) {
+		flush_io(type, 0);
+	}
+}
+
+/* Called as each thread exits, to send what it counted. */
+static void flush_thread_io(void *arg)
+{
+	flush_all_io();
+}
+
+static void record_io(enum rmonitor_msg_type type, ssize_t count)
+{
+	/* The messages sent may themselves read or write. */
+	if (io_flushing)
+		return;
+
+	int last_errno = errno;
+
+	if (!io_thread_registered && family_of_fd) {
+		io_thread_registered = 1;
+		pthread_setspecific(io_thread_key, io_batches);
+	}
+
+	struct io_batch *b = &io_batches[type - READ];
+
+	if (count < 0) {
+		if (type == WRITE) {
+			flush_io(type, last_errno);
+		}
+	} else {
+		if (b->calls == 0) {
+			b->start = timestamp_get();
+		}
+
+		b->calls++;
+		b->bytes += count;
+
+		if (b->bytes >= RMONITOR_HELPER_FLUSH_BYTES) {
+			flush_io(type, 0);
+		} else if (b->calls % RMONITOR_HELPER_CLOCK_SAMPLE == 0 && timestamp_get() - b->start >= RMONITOR_HELPER_FLUSH_INTERVAL) {
+			flush_io(type, 0);
+		}
+	}
+
+	errno = last_errno;
+}
+
 void rmonitor_helper_initialize()
 {
 
@@ -135,6 +231,7 @@ void rmonitor_helper_initialize()
 
 	if (!family_of_fd) {
 		family_of_fd = itable_create(8);
+		pthread_key_create(&io_thread_key, flush_thread_io);
 	}
 
 	if (getenv(RESOURCE_MONITOR_HELPER_STOP_SHORT)) {
@@ -169,6 +266,9 @@ pid_t fork()
 		snprintf(start_tmp, 256, "%" PRId64, timestamp_get());
 		setenv(RESOURCE_MONITOR_PROCESS_START, start_tmp, 1);
 
+		/* The counts of the parent are sent by the parent. */
+		memset(io_batches, 0, sizeof(io_batches));
+
 		struct rmonitor_msg msg;
 		msg.type = BRANCH;
 
@@ -392,169 +492,109 @@ int socket(int domain, int type, int protocol)
 
 ssize_t write(int fd, const void *buf, size_t count)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_write) {
 		return syscall(SYS_write, fd, buf, count);
 	}
 
-	msg.origin = getpid();
-
+	enum rmonitor_msg_type type = WRITE;
 	if (family_of_fd && itable_lookup(family_of_fd, fd)) {
-		msg.type = TX;
-	} else {
-		msg.type = WRITE;
+		type = TX;
 	}
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_write(fd, buf, count);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_write(fd, buf, count);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t read(int fd, void *buf, size_t count)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_read) {
 		return syscall(SYS_read, fd, buf, count);
 	}
 
-	msg.origin = getpid();
-
+	enum rmonitor_msg_type type = READ;
 	if (family_of_fd && itable_lookup(family_of_fd, fd)) {
-		msg.type = RX;
-	} else {
-		msg.type = READ;
+		type = RX;
 	}
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_read(fd, buf, count);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_read(fd, buf, count);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t recv(int fd, void *buf, size_t count, int flags)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_recv) {
 		rmonitor_helper_initialize();
 		assert(original_recv);
 	}
 
-	msg.type = RX;
-	msg.origin = getpid();
+	enum rmonitor_msg_type type = RX;
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_recv(fd, buf, count, flags);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_recv(fd, buf, count, flags);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t recvfrom(int fd, void *buf, size_t count, int flags, struct sockaddr *src, socklen_t *addrlen)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_recvfrom) {
 		rmonitor_helper_initialize();
 		assert(original_recvfrom);
 	}
 
-	msg.type = RX;
-	msg.origin = getpid();
+	enum rmonitor_msg_type type = RX;
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_recvfrom(fd, buf, count, flags, src, addrlen);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_recvfrom(fd, buf, count, flags, src, addrlen);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t send(int fd, const void *buf, size_t count, int flags)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_send) {
 		rmonitor_helper_initialize();
 		assert(original_send);
 	}
 
-	msg.type = TX;
-	msg.origin = getpid();
+	enum rmonitor_msg_type type = TX;
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_send(fd, buf, count, flags);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_send(fd, buf, count, flags);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t sendmsg(int fd, const struct msghdr *mg, int flags)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_sendmsg) {
 		rmonitor_helper_initialize();
 		assert(original_sendmsg);
 	}
 
-	msg.type = TX;
-	msg.origin = getpid();
-
-	ssize_t real_count;
-	START(msg)
-	real_count = original_sendmsg(fd, mg, flags);
-	END(msg)
+	enum rmonitor_msg_type type = TX;
 
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_sendmsg(fd, mg, flags);
+	record_io(type, real_count);
 
 	return real_count;
 }
 
 ssize_t recvmsg(int fd, struct msghdr *mg, int flags)
 {
-	struct rmonitor_msg msg;
-
 	if (!original_recvmsg) {
 		rmonitor_helper_initialize();
 		assert(original_recvmsg);
 	}
 
-	msg.type = RX;
-	msg.origin = getpid();
+	enum rmonitor_msg_type type = RX;
 
-	ssize_t real_count;
-	START(msg)
-	real_count = original_recvmsg(fd, mg, flags);
-	END(msg)
-
-	msg.data.n = real_count;
-	send_monitor_msg(&msg);
+	ssize_t real_count = original_recvmsg(fd, mg, flags);
+	record_io(type, real_count);
 
 	return real_count;
 }
@@ -583,6 +623,8 @@ void exit_wrapper_preamble(int status)
 
 	debug(D_RMON, "%s from %d.\n", str_msgtype(END_WAIT), getpid());
 
+	flush_all_io();
+
 	char *start_tmp = getenv(RESOURCE_MONITOR_PROCESS_START);
 	start_time = start_tmp ? atoll(start_tmp) : 0;
 	end_time = timestamp_get();
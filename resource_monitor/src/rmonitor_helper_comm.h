@@ -30,6 +30,8 @@ enum rmonitor_msg_type { BRANCH, WAIT, END_WAIT, END, CHDIR, OPEN_INPUT, OPEN_OU
  * WRITE:  Number of bytes written.
  * RX:     Number of bytes received.
  * TX:     Number of bytes sent.
+ *         (For READ, WRITE, RX, and TX, the bytes are those of all the calls of a
+ *         thread from start to end, as the helper sends them in batches.)
  * SNAPSHOT: snapshot name
  */
 
@@ -0,0 +1,271 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "rmonitor_series.h"
+#include "rmsummary.h"
+#include "xxmalloc.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RMONITOR_SERIES_MAX_COLUMNS 64
+
+static const char *rmonitor_series_names[] = {
+		"start",
+		"cpu_time",
+		"cores",
+		"max_concurrent_processes",
+		"virtual_memory",
+		"memory",
+		"swap_memory",
+		"bytes_read",
+		"bytes_written",
+		"bytes_received",
+		"bytes_sent",
+		"bandwidth",
+		"machine_load",
+		"total_files",
+		"disk",
+};
+
+/* columns written when disk is not measured. */
+#define RMONITOR_SERIES_COLUMNS_NO_DISK 13
+
+struct rmonitor_series {
+	FILE *file;
+	int binary;
+	int columns;
+	int64_t scale[RMONITOR_SERIES_MAX_COLUMNS];
+	int64_t last[RMONITOR_SERIES_MAX_COLUMNS];
+};
+
+static int64_t pow10_int(int decimals)
+{
+	int64_t result = 1;
+	while (decimals-- > 0)
+		result *= 10;
+	return result;
+}
+
+static void write_varint(FILE *file, int64_t value)
+{
+	/* zigzag, so that small negative differences are also short. */
+	uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+	while (v >= 0x80) {
+		fputc((int)(v & 0x7f) | 0x80, file);
+		v >>= 7;
+	}
+	fputc((int)v, file);
+}
+
+static int read_varint(FILE *file, int64_t *value)
+{
+	uint64_t v = 0;
+	int shift = 0;
+
+	while (shift < 64) {
+		int c = fgetc(file);
+		if (c == EOF)
+			return 0;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+			return 1;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+struct rmonitor_series *rmonitor_series_create(FILE *file, int binary, int with_disk)
+{
+	struct rmonitor_series *s = xxcalloc(1, sizeof(*s));
+
+	s->file = file;
+	s->binary = binary;
+	s->columns = with_disk ? (int)(sizeof(rmonitor_series_names) / sizeof(*rmonitor_series_names)) : RMONITOR_SERIES_COLUMNS_NO_DISK;
+
+	for (int i = 0; i < s->columns; i++) {
+		s->scale[i] = pow10_int(rmsummary_resource_decimals(rmonitor_series_names[i]));
+	}
+
+	return s;
+}
+
+void rmonitor_series_delete(struct rmonitor_series *s)
+{
+	free(s);
+}
+
+int rmonitor_series_columns(struct rmonitor_series *s)
+{
+	return s->columns;
+}
+
+const char *rmonitor_series_column(int i)
+{
+	return rmonitor_series_names[i];
+}
+
+static void text_header(FILE *file, int columns, char **names)
+{
+	fprintf(file, "# Units:\n");
+	fprintf(file, "# wall_clock and cpu_time in seconds\n");
+	fprintf(file, "# virtual, resident and swap memory in megabytes.\n");
+	fprintf(file, "# disk in megabytes.\n");
+	fprintf(file, "# bandwidth in Mbps.\n");
+	fprintf(file, "# cpu_time, bytes_read, bytes_written, bytes_sent, and bytes_received show cummulative values.\n");
+	fprintf(file, "# wall_clock, max_concurrent_processes, virtual, resident, swap, files, and disk show values at the sample point.\n");
+
+	fprintf(file, "#");
+	for (int i = 0; i < columns; i++) {
+		const char *name = names[i];
+		if (!strcmp(name, "start")) {
+			name = "wall_clock";
+		}
+
+		if (i == 0) {
+			fprintf(file, "%s", name);
+		} else if (!strcmp(name, "total_files") || !strcmp(name, "disk")) {
+			fprintf(file, " %25s", name);
+		} else {
+			fprintf(file, " %s", name);
+		}
+	}
+	fprintf(file, "\n");
+}
+
+static void text_row(FILE *file, int columns, char **names, const double *values)
+{
+	for (int i = 0; i < columns; i++) {
+		fprintf(file, "%s%s", i > 0 ? " " : "", rmsummary_resource_to_str(names[i], values[i], 0));
+	}
+	fprintf(file, "\n");
+}
+
+void rmonitor_series_header(struct rmonitor_series *s)
+{
+	if (!s->binary) {
+		text_header(s->file, s->columns, (char **)rmonitor_series_names);
+		return;
+	}
+
+	fwrite(RMONITOR_SERIES_MAGIC, 1, strlen(RMONITOR_SERIES_MAGIC), s->file);
+	fputc(RMONITOR_SERIES_VERSION, s->file);
+	fputc(s->columns, s->file);
+
+	for (int i = 0; i < s->columns; i++) {
+		fwrite(rmonitor_series_names[i], 1, strlen(rmonitor_series_names[i]) + 1, s->file);
+		fputc(rmsummary_resource_decimals(rmonitor_series_names[i]), s->file);
+	}
+}
+
+void rmonitor_series_write(struct rmonitor_series *s, const double *values)
+{
+	if (!s->binary) {
+		text_row(s->file, s->columns, (char **)rmonitor_series_names, values);
+		return;
+	}
+
+	for (int i = 0; i < s->columns; i++) {
+		int64_t v = llround(values[i] * s->scale[i]);
+		write_varint(s->file, v - s->last[i]);
+		s->last[i] = v;
+	}
+}
+
+static char *read_name(FILE *file)
+{
+	char name[256];
+	size_t n = 0;
+
+	int c;
+	while ((c = fgetc(file)) != EOF && c != '\0') {
+		if (n >= sizeof(name) - 1)
+			return NULL;
+		name[n++] = c;
+	}
+
+	if (c == EOF)
+		return NULL;
+
+	name[n] = '\0';
+	return xxstrdup(name);
+}
+
+int rmonitor_series_convert(FILE *input, FILE *output)
+{
+	char magic[sizeof(RMONITOR_SERIES_MAGIC)];
+	size_t magic_len = strlen(RMONITOR_SERIES_MAGIC);
+
+	if (fread(magic, 1, magic_len, input) != magic_len || memcmp(magic, RMONITOR_SERIES_MAGIC, magic_len)) {
+		return -1;
+	}
+
+	if (fgetc(input) != RMONITOR_SERIES_VERSION) {
+		return -1;
+	}
+
+	int columns = fgetc(input);
+	if (columns == EOF || columns < 1 || columns > RMONITOR_SERIES_MAX_COLUMNS) {
+		return -1;
+	}
+
+	char *names[RMONITOR_SERIES_MAX_COLUMNS];
+	int64_t scale[RMONITOR_SERIES_MAX_COLUMNS];
+	int64_t last[RMONITOR_SERIES_MAX_COLUMNS];
+	double values[RMONITOR_SERIES_MAX_COLUMNS];
+
+	int valid = 1;
+	int i;
+	for (i = 0; i < columns; i++) {
+		names[i] = read_name(input);
+		int decimals = fgetc(input);
+		if (!names[i] || decimals == EOF) {
+			free(names[i]);
+			valid = 0;
+			break;
+		}
+		scale[i] = pow10_int(decimals);
+		last[i] = 0;
+	}
+
+	int rows = -1;
+	if (valid) {
+		text_header(output, columns, names);
+
+		rows = 0;
+		while (1) {
+			int j;
+			for (j = 0; j < columns; j++) {
+				int64_t delta;
+				if (!read_varint(input, &delta))
+					break;
+				last[j] += delta;
+				values[j] = ((double)last[j]) / scale[j];
+			}
+
+			/* a partial row is the sample being written when the monitor stopped. */
+			if (j < columns)
+				break;
+
+			text_row(output, columns, names, values);
+			rows++;
+		}
+	}
+
+	for (int j = 0; j < i; j++) {
+		free(names[j]);
+	}
+
+	return rows;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef RMONITOR_SERIES_H
+#define RMONITOR_SERIES_H
+
+#include <stdio.h>
+
+/*
+Time series of resources written by resource_monitor.
+
+The text format has one row of space separated columns per sample. The
+binary format starts with the magic string RMONITOR_SERIES_MAGIC, a
+version byte, and the number of columns followed by the name and decimals
+of each column. Each sample is then written as the difference to the
+previous sample of each column, scaled to an integer by its decimals, and
+encoded as a zigzag varint. A sample in which few resources changed takes
+only a few bytes, and converting back to text gives the same rows that the
+text format would have had.
+*/
+
+#define RMONITOR_SERIES_MAGIC "RMSERIES"
+#define RMONITOR_SERIES_VERSION 1
+
+struct rmonitor_series;
+
+/* Create a series written to file. If with_disk, the total_files and disk columns are included. */
+struct rmonitor_series *rmonitor_series_create(FILE *file, int binary, int with_disk);
+
+/* Write the header of the series. */
+void rmonitor_series_header(struct rmonitor_series *s);
+
+/* Write a sample, one value per column in the order of rmonitor_series_column. */
+void rmonitor_series_write(struct rmonitor_series *s, const double *values);
+
+/* Number of columns of the series. */
+int rmonitor_series_columns(struct rmonitor_series *s);
+
+/* Name of a column, as a resource of rmsummary. */
+const char *rmonitor_series_column(int i);
+
+/* Delete the series. The file is not closed. */
+void rmonitor_series_delete(struct rmonitor_series *s);
+
+/* Convert a binary series to text. Returns the number of samples converted, or -1 if input is not a valid series. */
+int rmonitor_series_convert(FILE *input, FILE *output);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+  Copyright (C) 2022 The University of Notre Dame
+  This software is distributed under the GNU General Public License.
+  See the file COPYING for details.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "rmonitor_series.h"
+
+int main(int argc, char **argv)
+{
+	if (argc > 3) {
+		fatal("Use: %s [BINARY_SERIES [TEXT_SERIES]]", argv[0]);
+	}
+
+	FILE *input = stdin;
+	FILE *output = stdout;
+
+	if (argc > 1 && strcmp(argv[1], "-")) {
+		input = fopen(argv[1], "r");
+		if (!input) {
+			fatal("could not open %s: %s", argv[1], strerror(errno));
+		}
+	}
+
+	if (argc > 2 && strcmp(argv[2], "-")) {
+		output = fopen(argv[2], "w");
+		if (!output) {
+			fatal("could not open %s: %s", argv[2], strerror(errno));
+		}
+	}
+
+	int rows = rmonitor_series_convert(input, output);
+	if (rows < 0) {
+		fatal("%s is not a binary series of resource_monitor", argc > 1 ? argv[1] : "input");
+	}
+
+	fclose(input);
+	if (fclose(output) != 0) {
+		fatal("could not write the series: %s", strerror(errno));
+	}
+
+	return 0;
+}
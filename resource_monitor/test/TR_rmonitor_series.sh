@@ -0,0 +1,60 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+import_config_val CCTOOLS_OPSYS
+
+check_needed()
+{
+	[ "${CCTOOLS_OPSYS}" = LINUX ] || return 1
+
+	return 0
+}
+
+prepare()
+{
+	return 0
+}
+
+run()
+{
+	# do not run the test if not on linux.
+	[ -d /proc ] || return 0
+
+	set -e
+
+	../src/resource_monitor --no-pprint -i 1 --with-time-series --series-format binary -O series_test -- sleep 3
+
+	# the binary series converts to the same layout as the text series.
+	../src/rmonitor_series_convert series_test.series series_test.txt
+	cat series_test.txt
+
+	[ "$(grep -c '^#' series_test.txt)" -eq 8 ]
+
+	rows=$(grep -vc '^#' series_test.txt)
+	[ "$rows" -ge 3 ]
+
+	# columns: wall_clock cpu_time cores ... total_files disk
+	[ "$(grep -v '^#' series_test.txt | awk '{print NF}' | sort -u)" = 15 ]
+
+	# wall clock of the samples is increasing.
+	grep -v '^#' series_test.txt | awk 'NR > 1 && $1 < last {exit 1} {last = $1}'
+
+	# a text series is not accepted by the converter.
+	../src/resource_monitor --no-pprint -i 1 --with-time-series -O series_test_text -- true
+	if ../src/rmonitor_series_convert series_test_text.series /dev/null; then
+		return 1
+	fi
+
+	return 0
+}
+
+clean()
+{
+	rm -f series_test.* series_test_text.*
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -14,6 +14,7 @@ from .task import FunctionCall
 from .dask_dag import DaskVineDag
 from .cvine import VINE_TEMP
 
+from collections import defaultdict
 import contextlib
 import cloudpickle
 import os
@@ -85,6 +86,9 @@ class DaskVine(Manager):
     # @param lib_resources A dictionary with optional keys of cores, memory and disk in MB (function-calls task_mode)
     # @param lib_command A command to be prefixed to the execution of a Library task (function-calls task_mode)
     # @param lib_modules Hoist these module imports for the execution library (function-calls task_mode)
+    # @param lib_exec_mode How the execution library runs function calls: "fork", "direct" or "thread" (function-calls task_mode)
+    # @param lib_memory_store MB of results the execution library keeps in memory for later calls on the same
+    #                      worker. Requires lib_exec_mode "direct" or "thread" (function-calls task_mode)
     # @param env_per_task execute each task
     # @param resources_mode Automatically resize allocation per task. One of 'fixed'
     #                       (use the value of 'resources' above), 'max througput',
@@ -105,6 +109,11 @@ class DaskVine(Manager):
     #                      Should return a tuple of (wrapper result, dask call result). Use for debugging.
     # @param wrapper_proc  Function to process results from wrapper on completion. (default is print)
     # @param prune_files If True, remove files from the cluster after they are no longer needed.
+    # @param reduction_functions A collection of functions that reduce a list of values to a single value,
+    #                      such that they can also combine their own results (e.g., sum). With worker_transfers,
+    #                      the inputs of a graph vertex (fn, [keys...]) with fn in this collection are first
+    #                      combined at each worker that holds several of them, and only the partial results
+    #                      are moved to compute the final value.
     def get(self, dsk, keys, *,
             environment=None,
             extra_files=None,
@@ -122,6 +131,8 @@ class DaskVine(Manager):
             lib_resources=None,
             lib_command=None,
             lib_modules=None,
+            lib_exec_mode='fork',
+            lib_memory_store=0,
             task_mode='tasks',
             env_per_task=False,
             progress_disable=False,
@@ -129,6 +140,7 @@ class DaskVine(Manager):
             wrapper=None,
             wrapper_proc=print,
             prune_files=False,
+            reduction_functions=None,
             hoisting_modules=None,  # Deprecated, use lib_modules
             import_modules=None,    # Deprecated, use lib_modules
             lazy_transfers=True,    # Deprecated, use worker_tranfers
@@ -163,6 +175,8 @@ class DaskVine(Manager):
                 self.lib_modules = lib_modules
             else:
                 self.lib_modules = hoisting_modules if hoisting_modules else import_modules  # Deprecated
+            self.lib_exec_mode = lib_exec_mode
+            self.lib_memory_store = lib_memory_store
             self.task_mode = task_mode
             self.env_per_task = env_per_task
             self.progress_disable = progress_disable
@@ -170,6 +184,7 @@ class DaskVine(Manager):
             self.wrapper = wrapper
             self.wrapper_proc = wrapper_proc
             self.prune_files = prune_files
+            self.reduction_functions = reduction_functions
 
             if submit_per_cycle is not None and submit_per_cycle < 1:
                 submit_per_cycle = None
@@ -217,7 +232,9 @@ class DaskVine(Manager):
                                                          poncho_env="dummy-value",
                                                          add_env=False,
                                                          init_command=self.lib_command,
-                                                         hoisting_modules=self.lib_modules)
+                                                         hoisting_modules=self.lib_modules,
+                                                         exec_mode=self.lib_exec_mode,
+                                                         memory_store=self.lib_memory_store)
 
             if self.environment:
                 libtask.add_environment(self.environment)
@@ -245,6 +262,10 @@ class DaskVine(Manager):
 
             self.install_library(libtask)
 
+        # final key -> reduction in progress, and partial step key -> final key
+        self._reductions = {}
+        self._reduction_steps = {}
+
         enqueued_calls = []
         rs = dag.set_targets(keys_flatten)
         self._enqueue_dask_calls(dag, tag, rs, self.retries, enqueued_calls)
@@ -274,7 +295,11 @@ class DaskVine(Manager):
 
                     if t.successful():
                         result_file = DaskVineFile(t.output_file, t.key, dag, self.task_mode)
-                        rs = dag.set_result(t.key, result_file)
+                        is_step = t.key in self._reduction_steps
+                        if is_step:
+                            rs = self._set_reduction_step_result(t.key, result_file)
+                        else:
+                            rs = dag.set_result(t.key, result_file)
                         self._enqueue_dask_calls(dag, tag, rs, self.retries, enqueued_calls)
 
                         if self.wrapper:
@@ -283,7 +308,7 @@ class DaskVine(Manager):
                         if t.key in dsk:
                             bar_update(advance=1)
 
-                        if self.prune_files:
+                        if self.prune_files and not is_step:
                             self._prune_file(dag, t.key)
                     else:
                         retries_left = t.decrement_retry()
@@ -330,52 +355,113 @@ class DaskVine(Manager):
     def _enqueue_dask_calls(self, dag, tag, rs, retries, enqueued_calls):
         targets = dag.get_targets()
         for (k, sexpr) in rs:
+            if k in self._reduction_steps:
+                # a partial step is retried wherever its inputs can be found
+                inputs = {c: dag.get_result(c) for c in sexpr[1]}
+                enqueued_calls.append(self._make_dask_call(dag, tag, k, sexpr, retries, True, inputs=inputs))
+                continue
+
+            if k in self._reductions:
+                inputs = self._reductions[k]["inputs"]
+            elif self._plan_reduction(dag, tag, k, sexpr, retries, enqueued_calls):
+                continue
+            else:
+                inputs = None
+
             lazy = self.worker_transfers and k not in targets
             if lazy and self.checkpoint_fn:
                 lazy = self.checkpoint_fn(dag, k)
 
-            cat = self.category_name(sexpr)
-            if self.task_mode == 'tasks':
-                if cat not in self._categories_known:
-                    if self.resources:
-                        self.set_category_resources_max(cat, self.resources)
-                    if self.resources_mode:
-                        self.set_category_mode(cat, self.resources_mode)
-
-                        if not self._categories_known:
-                            self.enable_monitoring()
-                    self._categories_known.add(cat)
-
-                t = PythonTaskDask(self,
-                                   dag, k, sexpr,
-                                   category=cat,
-                                   environment=self.environment,
-                                   extra_files=self.extra_files,
-                                   env_vars=self.env_vars,
-                                   retries=retries,
-                                   worker_transfers=lazy,
-                                   wrapper=self.wrapper)
-
-                if self.env_per_task:
-                    t.set_command(
-                        f"mkdir envdir && tar -xf {self._environment_name} -C envdir && envdir/bin/run_in_env {t._command}")
-                    t.add_input(self.environment_file, self.environment_name)
-
-                t.set_tag(tag)  # tag that identifies this dag
-                enqueued_calls.append(t)
-
-            if self.task_mode == 'function-calls':
-                t = FunctionCallDask(self,
-                                     dag, k, sexpr,
-                                     category=cat,
-                                     extra_files=self.extra_files,
-                                     retries=retries,
-                                     worker_transfers=lazy,
-                                     wrapper=self.wrapper)
-
-                t.set_tag(tag)  # tag that identifies this dag
-
-                enqueued_calls.append(t)
+            enqueued_calls.append(self._make_dask_call(dag, tag, k, sexpr, retries, lazy, inputs=inputs))
+
+    def _make_dask_call(self, dag, tag, k, sexpr, retries, lazy, inputs=None, pinned=False):
+        cat = self.category_name(sexpr)
+        if self.task_mode == 'tasks':
+            if cat not in self._categories_known:
+                if self.resources:
+                    self.set_category_resources_max(cat, self.resources)
+                if self.resources_mode:
+                    self.set_category_mode(cat, self.resources_mode)
+
+                    if not self._categories_known:
+                        self.enable_monitoring()
+                self._categories_known.add(cat)
+
+            t = PythonTaskDask(self,
+                               dag, k, sexpr,
+                               category=cat,
+                               environment=self.environment,
+                               extra_files=self.extra_files,
+                               env_vars=self.env_vars,
+                               retries=retries,
+                               worker_transfers=lazy,
+                               wrapper=self.wrapper,
+                               inputs=inputs,
+                               pinned=pinned)
+
+            if self.env_per_task:
+                t.set_command(
+                    f"mkdir envdir && tar -xf {self._environment_name} -C envdir && envdir/bin/run_in_env {t._command}")
+                t.add_input(self.environment_file, self.environment_name)
+
+        if self.task_mode == 'function-calls':
+            t = FunctionCallDask(self,
+                                 dag, k, sexpr,
+                                 category=cat,
+                                 extra_files=self.extra_files,
+                                 retries=retries,
+                                 worker_transfers=lazy,
+                                 wrapper=self.wrapper,
+                                 inputs=inputs,
+                                 pinned=pinned)
+
+        t.set_tag(tag)  # tag that identifies this dag
+        return t
+
+    # Split the reduction (fn, [keys...]) of key k into partial steps, one per worker that
+    # holds several of its inputs. Each step runs where its inputs are, and k is computed
+    # from the partial results once all steps complete. Returns True if k was split.
+    def _plan_reduction(self, dag, tag, k, sexpr, retries, enqueued_calls):
+        if not self.reduction_functions or not self.worker_transfers:
+            return False
+        if not (DaskVineDag.taskp(sexpr) and len(sexpr) == 2 and DaskVineDag.listp(sexpr[1])):
+            return False
+        if sexpr[0] not in self.reduction_functions:
+            return False
+
+        by_location = defaultdict(list)
+        for c in sexpr[1]:
+            if not dag.graph_keyp(c):
+                return False
+            r = dag.get_result(c)
+            if not isinstance(r, DaskVineFile) or not r.is_temp():
+                return False
+            by_location[self.file_location(r.file)].append(c)
+
+        groups = [cs for (location, cs) in by_location.items() if location and len(cs) > 1]
+        if not groups or len(groups[0]) == len(sexpr[1]):
+            # nothing to combine locally, or the scheduler already sends k to the single worker with its inputs
+            return False
+
+        grouped = set(c for cs in groups for c in cs)
+        inputs = {c: dag.get_result(c) for c in sexpr[1] if c not in grouped}
+        self._reductions[k] = {"fn": sexpr[0], "pending": len(groups), "inputs": inputs}
+
+        for (i, cs) in enumerate(groups):
+            step = ("vine-reduce", k, i)
+            self._reduction_steps[step] = k
+            step_inputs = {c: dag.get_result(c) for c in cs}
+            enqueued_calls.append(self._make_dask_call(dag, tag, step, (sexpr[0], cs), retries, True, inputs=step_inputs, pinned=True))
+        return True
+
+    def _set_reduction_step_result(self, step, result_file):
+        k = self._reduction_steps.pop(step)
+        reduction = self._reductions[k]
+        reduction["inputs"][step] = result_file
+        reduction["pending"] -= 1
+        if reduction["pending"] > 0:
+            return []
+        return [(k, (reduction["fn"], list(reduction["inputs"].keys())))]
 
     def _load_results(self, dag, key_indices, keys):
         results = list(keys)
@@ -400,6 +486,12 @@ class DaskVine(Manager):
             return raw
 
     def _prune_file(self, dag, key):
+        reduction = self._reductions.pop(key, None)
+        if reduction:
+            for (c, r) in reduction["inputs"].items():
+                if c not in dag.get_children(key):
+                    self.prune_file(r._file)
+
         children = dag.get_children(key)
         for c in children:
             if len(dag.get_pending_parents(c)) == 0:
@@ -489,6 +581,8 @@ class PythonTaskDask(PythonTask):
     # @param retries        Number of times to retry failed task.
     # @param worker_transfers If true, do not return outputs to manager until required.
     # @param wrapper
+    # @param inputs         Results to use as arguments, by key. Default is the results of the children of key in dag.
+    # @param pinned         If true, run only where the input files already are.
     #
     def __init__(self, m,
                  dag, key, sexpr, *,
@@ -498,7 +592,9 @@ class PythonTaskDask(PythonTask):
                  env_vars=None,
                  retries=5,
                  worker_transfers=False,
-                 wrapper=None):
+                 wrapper=None,
+                 inputs=None,
+                 pinned=False):
         self._key = key
         self._sexpr = sexpr
 
@@ -506,7 +602,9 @@ class PythonTaskDask(PythonTask):
         self._wrapper_output_file = None
         self._wrapper_output = None
 
-        args_raw = {k: dag.get_result(k) for k in dag.get_children(key)}
+        if inputs is None:
+            inputs = {k: dag.get_result(k) for k in dag.get_children(key)}
+        args_raw = inputs
         args = {
             k: f"{uuid4()}.p"
             for k, v in args_raw.items()
@@ -526,7 +624,7 @@ class PythonTaskDask(PythonTask):
 
         for k, f in args_raw.items():
             if isinstance(f, DaskVineFile):
-                self.add_input(f.file, args[k])
+                self.add_input(f.file, args[k], strict_input=pinned)
 
         if category:
             self.set_category(category)
@@ -590,6 +688,8 @@ class FunctionCallDask(FunctionCall):
     # @param extra_files    Additional files to provide to the task.
     # @param retries        Number of times to retry failed task.
     # @param worker_transfers If true, do not return outputs to manager until required.
+    # @param inputs         Results to use as arguments, by key. Default is the results of the children of key in dag.
+    # @param pinned         If true, run only where the input files already are.
     #
 
     def __init__(self, m,
@@ -599,14 +699,18 @@ class FunctionCallDask(FunctionCall):
                  extra_files=None,
                  retries=5,
                  worker_transfers=False,
-                 wrapper=None):
+                 wrapper=None,
+                 inputs=None,
+                 pinned=False):
 
         self._key = key
         self.resources = resources
         self._sexpr = sexpr
 
         self._retries_left = retries
-        args_raw = {k: dag.get_result(k) for k in dag.get_children(key)}
+        if inputs is None:
+            inputs = {k: dag.get_result(k) for k in dag.get_children(key)}
+        args_raw = inputs
         args = {k: f"{uuid4()}.p" for k, v in args_raw.items() if isinstance(v, DaskVineFile)}
 
         keys_of_files = list(args.keys())
@@ -625,7 +729,7 @@ class FunctionCallDask(FunctionCall):
 
         for k, f in args_raw.items():
             if isinstance(f, DaskVineFile):
-                self.add_input(f.file, args[k])
+                self.add_input(f.file, args[k], strict_input=pinned)
 
         if category:
             self.set_category(category)
@@ -674,13 +778,19 @@ def execute_graph_vertex(wrapper, key, sexpr, args, keys_of_files):
         else:
             return sexpr
 
+    # inside a library, results of earlier calls may be kept in memory
+    load_result = globals().get("vine_load_result")
+
     for k in keys_of_files:
         try:
-            with open(args[k], "rb") as f:
-                arg = cloudpickle.load(f)
-                if isinstance(arg, dict) and 'Result' in arg and arg['Result'] is not None:
-                    arg = arg['Result']
-                args[k] = arg
+            if load_result:
+                arg = load_result(args[k])
+            else:
+                with open(args[k], "rb") as f:
+                    arg = cloudpickle.load(f)
+            if isinstance(arg, dict) and 'Result' in arg and arg['Result'] is not None:
+                arg = arg['Result']
+            args[k] = arg
         except Exception as e:
             print(f"Could not read input file {args[k]} for key {k}: {e}")
             raise
@@ -11,6 +11,7 @@ from concurrent.futures._base import PENDING
 from concurrent.futures._base import CANCELLED
 from concurrent.futures._base import FINISHED
 from concurrent.futures import TimeoutError
+from concurrent.futures import CancelledError
 from collections import namedtuple
 from .task import (
     PythonTask,
@@ -24,7 +25,10 @@ from .manager import (
 
 import os
 import time
+import queue
+import asyncio
 import textwrap
+import threading
 
 RESULT_PENDING = 'result_pending'
 
@@ -142,14 +146,86 @@ def as_completed(fs, timeout=None):
     return _iterator()
 
 
+##
+# \class ProgressThread
+#
+# Background thread that drives the manager on behalf of a FuturesExecutor.
+#
+# The thread is the only one calling the manager: futures are submitted and
+# cancelled through a queue, and completed tasks resolve their futures and run
+# their callbacks from this thread. The GIL is released while the manager waits
+# for tasks, so that the application keeps running meanwhile.
+class ProgressThread(threading.Thread):
+    def __init__(self, manager, timeout=1):
+        super().__init__(name="vine-futures-progress", daemon=True)
+        self._manager = manager
+        self._manager._wait_releases_gil = True
+        self._timeout = timeout
+        self._requests = queue.SimpleQueue()
+        self._tasks = {}
+        self._stopped = False
+
+    def submit(self, task):
+        task._future._progress = self
+        task._future._is_submitted = True
+        self._requests.put(("submit", task))
+
+    def cancel(self, task):
+        self._requests.put(("cancel", task))
+
+    # Call fn with the manager as argument from the thread.
+    def call(self, fn):
+        self._requests.put(("call", fn))
+
+    def stop(self):
+        self._stopped = True
+        self._requests.put(("stop", None))
+        if self.is_alive() and threading.current_thread() is not self:
+            self.join()
+            self._manager._wait_releases_gil = False
+
+    def _handle(self, request):
+        (action, task) = request
+        if action == "submit":
+            self._manager.submit(task)
+            self._tasks[task.id] = task
+        elif action == "cancel" and task.id in self._tasks:
+            self._manager.cancel_by_task_id(task.id)
+        elif action == "call":
+            task(self._manager)
+
+    def run(self):
+        while not self._stopped:
+            try:
+                # block on requests only when there is nothing to wait for
+                request = self._requests.get(block=not self._tasks, timeout=self._timeout)
+                self._handle(request)
+                continue
+            except queue.Empty:
+                pass
+
+            t = self._manager.wait(self._timeout)
+            if t and t.id in self._tasks:
+                del self._tasks[t.id]
+                t._has_retrieved = True
+                if t.result == "cancelled":
+                    t._future._set_output(CancelledError(), CANCELLED)
+                else:
+                    t._future._set_output(t.output())
+
+
 ##
 # \class FuturesExecutor
 #
 # TaskVine FuturesExecutor object
 #
-# This class acts as an interface for the creation of Futures
+# This class acts as an interface for the creation of Futures.
+# If progress_thread is True, a background thread submits the tasks of the
+# futures, completes them, and runs their callbacks, so that futures do not
+# need to be polled, and can be awaited from asyncio. The manager should then
+# not be called directly.
 class FuturesExecutor(Executor):
-    def __init__(self, port=9123, batch_type="local", manager=None, manager_host_port=None, manager_name=None, factory_binary=None, worker_binary=None, log_file=os.devnull, factory=True, opts={}):
+    def __init__(self, port=9123, batch_type="local", manager=None, manager_host_port=None, manager_name=None, factory_binary=None, worker_binary=None, log_file=os.devnull, factory=True, opts={}, progress_thread=False):
         self.manager = Manager(port=port)
         self.port = self.manager.port
         if manager_name:
@@ -173,15 +249,18 @@ class FuturesExecutor(Executor):
         else:
             self.factory = None
 
+        self._progress = None
+        if progress_thread:
+            self._progress = ProgressThread(self.manager)
+            self._progress.start()
+
     def submit(self, fn, *args, **kwargs):
         if isinstance(fn, FuturePythonTask):
-            self.manager.submit(fn)
-            fn._future._is_submitted = True
+            self._submit_task(fn)
             return fn._future
         if isinstance(fn, FutureFunctionCall):
-            self.manager.submit(fn)
+            self._submit_task(fn)
             self.task_table.append(fn)
-            fn._future._is_submitted = True
             return fn._future
         future_task = self.future_task(fn, *args, **kwargs)
         self.task_table.append(future_task)
@@ -189,6 +268,18 @@ class FuturesExecutor(Executor):
         self.submit(future_task)
         return future_task._future
 
+    def _submit_task(self, task):
+        if self._progress:
+            self._progress.submit(task)
+        else:
+            self.manager.submit(task)
+            task._future._is_submitted = True
+
+    def shutdown(self, wait=True, *, cancel_futures=False):
+        if self._progress:
+            self._progress.stop()
+            self._progress = None
+
     def future_task(self, fn, *args, **kwargs):
         return FuturePythonTask(self.manager, fn, *args, **kwargs)
 
@@ -196,11 +287,53 @@ class FuturesExecutor(Executor):
         return self.manager.create_library_from_functions(name, *function_list, retrieve_output, poncho_env=poncho_env, init_command=init_command, add_env=add_env, hoisting_modules=hoisting_modules)
 
     def install_library(self, libtask):
-        self.manager.install_library(libtask)
+        if self._progress:
+            self._progress.call(lambda m: m.install_library(libtask))
+        else:
+            self.manager.install_library(libtask)
 
     def future_funcall(self, library_name, fn, *args, **kwargs):
         return FutureFunctionCall(self.manager, library_name, fn, *args, **kwargs)
 
+    ##
+    # Combine the results of futures with a function of a library, in a tree
+    # of function calls executed at the workers. The results of the futures
+    # and of the intermediate calls remain at the workers, so that only the
+    # final value is brought back to the manager when the returned future
+    # is resolved.
+    #
+    # @param self          Reference to the current executor.
+    # @param library_name  The name of the library that contains the function fn.
+    # @param fn            The name of the reduce function. It is called with up to
+    #                      fan_in results as positional arguments, and should return
+    #                      their combination.
+    # @param futures       A list of futures or values to combine, such as those
+    #                      returned for calls of @ref future_funcall.
+    # @param fan_in        The largest number of results combined by a single call.
+    # @returns             A future resolving to the combined value.
+    def reduce(self, library_name, fn, futures, fan_in=2):
+        if fan_in < 2:
+            raise ValueError("fan_in must be at least 2")
+        futures = list(futures)
+        if not futures:
+            raise ValueError("nothing to reduce")
+
+        while len(futures) > 1:
+            combined = []
+            for i in range(0, len(futures), fan_in):
+                group = futures[i:i + fan_in]
+                if len(group) == 1:
+                    # a lone result is carried to the next level as is.
+                    combined.append(group[0])
+                else:
+                    combined.append(self.submit(self.future_funcall(library_name, fn, *group)))
+            futures = combined
+
+        result = futures[0]
+        if not isinstance(result, VineFuture):
+            result = self.submit(self.future_funcall(library_name, fn, result))
+        return result
+
     def set(self, name, value):
         if self.factory:
             return self.factory.__setattr__(name, value)
@@ -210,6 +343,7 @@ class FuturesExecutor(Executor):
             return self.factory.__getattr__(name)
 
     def __del__(self):
+        self.shutdown()
         for task in self.task_table:
             if hasattr(task, '_retriever') and task._retriever:
                 task._retriever.__del__()
@@ -233,12 +367,18 @@ class VineFuture(Future):
         self._exception = None
         self._is_submitted = False
         self._ran_functions = False
+        self._progress = None
 
     def cancel(self):
+        if self._progress:
+            self._progress.cancel(self._task)
+            return not self.done()
         self._task._module_manager.cancel_by_task_id(self._task.id)
         self._state = CANCELLED
 
     def cancelled(self):
+        if self._progress:
+            return self._state == CANCELLED
         state = self._task._module_manager.task_state(self._task.id)
         if state == cvine.VINE_TASK_CANCELED:
             return True
@@ -246,6 +386,8 @@ class VineFuture(Future):
             return False
 
     def running(self):
+        if self._progress:
+            return not self.done()
         state = self._task.state
         if state == "RUNNING":
             return True
@@ -253,6 +395,8 @@ class VineFuture(Future):
             return False
 
     def done(self):
+        if self._progress:
+            return self._state in (FINISHED, CANCELLED)
         state = self._task.state
         if state == "DONE" or state == "RETRIEVED":
             return True
@@ -262,6 +406,16 @@ class VineFuture(Future):
     def result(self, timeout="wait_forever"):
         if timeout is None:
             timeout = "wait_forever"
+        if self._progress:
+            with self._condition:
+                if not self.done():
+                    self._condition.wait(None if timeout == "wait_forever" else timeout)
+                if not self.done():
+                    raise TimeoutError()
+            if self._exception:
+                raise self._exception
+            return self._result
+
         result = self._task.output(timeout=timeout)
         if result == RESULT_PENDING:
             raise TimeoutError()
@@ -290,7 +444,32 @@ class VineFuture(Future):
             return None
 
     def add_done_callback(self, fn):
-        self._callback_fns.append(fn)
+        with self._condition:
+            if not (self._progress and self._ran_functions):
+                self._callback_fns.append(fn)
+                return
+        fn(self)
+
+    # Set the output of the task of this future, waking up any waiters, and run
+    # the callbacks. Called from the progress thread.
+    def _set_output(self, result, state=FINISHED):
+        with self._condition:
+            if isinstance(result, Exception):
+                self._exception = result
+            else:
+                self._result = result
+            self._state = state
+            self._ran_functions = True
+            self._condition.notify_all()
+        for fn in self._callback_fns:
+            fn(self)
+
+    # Futures can be awaited from asyncio. Without a progress thread, the
+    # result is waited for in the default executor of the event loop.
+    def __await__(self):
+        if self._progress:
+            return asyncio.wrap_future(self).__await__()
+        return asyncio.get_event_loop().run_in_executor(None, self.result).__await__()
 
 
 ##
@@ -88,6 +88,7 @@ class Manager(object):
         self._stats_hierarchy = None
         self._task_table = {}
         self._library_table = {}    # A table of all libraries known to the manager
+        self._wait_releases_gil = False  # Set by a thread that is the only caller of the manager
         self._info_widget = None
         self._using_ssl = False
         if staging_path:
@@ -131,6 +132,7 @@ class Manager(object):
 
             # support for PythonTask serialization:
             self._function_buffers = {}
+            self._function_inline_limit = 1024 * 1024
             for d in ['outputs', 'arguments', 'functions']:
                 pathlib.Path.mkdir(pathlib.Path(self.staging_directory, d), exist_ok=True)
 
@@ -420,6 +422,36 @@ class Manager(object):
     def disable_peer_transfers(self):
         return cvine.vine_disable_peer_transfers(self._taskvine)
 
+    ##
+    # Remember the checksums of local files across runs, so that unchanged
+    # files declared with @ref declare_file need not be read again.
+    #
+    # @param self     Reference to the current manager object.
+    # @param filename The file in which to keep the checksums. It is read now,
+    #                 and written when the manager is deleted.
+    def enable_checksum_cache(self, filename):
+        return cvine.vine_enable_checksum_cache(self._taskvine, filename)
+
+    ##
+    # Keep a checkpoint of the tasks completed, so that a manager restarted
+    # with the same checkpoint returns them at once instead of running them
+    # again, as long as their output files are still present.
+    #
+    # @param self     Reference to the current manager object.
+    # @param filename The file in which to keep the checkpoint. Call before
+    #                 submitting tasks.
+    def enable_checkpoint(self, filename):
+        return cvine.vine_enable_checkpoint(self._taskvine, filename)
+
+    ##
+    # Record the workload of the manager in the logs directory, so that it can
+    # be replayed offline with vine_replay to compare scheduling policies.
+    #
+    # @param self     Reference to the current manager object.
+    # @param filename The name of the log, in the logs directory of the manager.
+    def enable_replay_log(self, filename):
+        return cvine.vine_enable_replay_log(self._taskvine, filename)
+
     ##
     # Change the project name for the given manager.
     #
@@ -443,6 +475,17 @@ class Manager(object):
     def enable_disconnect_slow_workers_category(self, name, multiplier):
         return cvine.vine_enable_disconnect_slow_workers_category(self._taskvine, name, multiplier)
 
+    ##
+    # Enable speculative execution of slow tasks. When no task is waiting to
+    # run, a task that has run longer than the given quantile of the task times
+    # of its category is duplicated on a different worker, and the copy that
+    # finishes first provides the results.
+    #
+    # @param self       Reference to the current manager object.
+    # @param quantile   The quantile of task times beyond which a task is duplicated, e.g. 0.95; disabled if not between 0 and 1.
+    def enable_speculative_execution(self, quantile):
+        return cvine.vine_enable_speculative_execution(self._taskvine, quantile)
+
     ##
     # Turn on or off draining mode for workers at hostname.
     #
@@ -703,6 +746,25 @@ class Manager(object):
     def set_category_max_concurrent(self, category, max_concurrent):
         return cvine.vine_set_category_max_concurrent(self._work_queue, category, max_concurrent)
 
+    ##
+    # Specifies the share of the workers given to the tasks of a category
+    # while they are waiting, relative to the other categories, and turns on
+    # fair share scheduling. Category names are read as a hierarchy split at
+    # '/', so that a share may also be set for a group of categories.
+    #
+    # @param self      Reference to the current manager object.
+    # @param category  Name of the category, or a prefix of names up to a '/'.
+    # @param share     Relative share of cores. Shares not positive are reset to 1 (the default).
+    # For example:
+    # @code
+    # >>> # Give alice twice the cores of bob, whatever the categories of their tasks:
+    # >>> q.set_category_share("alice", 2)
+    # >>> q.set_category_share("bob", 1)
+    # >>> t.set_category("alice/align")
+    # @endcode
+    def set_category_share(self, category, share):
+        return cvine.vine_set_category_share(self._taskvine, category, share)
+
     ##
     # Initialize first value of categories
     #
@@ -830,15 +892,32 @@ class Manager(object):
     def set_keepalive_timeout(self, timeout):
         return cvine.vine_set_keepalive_timeout(self._taskvine, timeout)
 
+    ##
+    # Set the largest arguments of a FunctionCall sent to workers from memory.
+    # Larger arguments are written to a file in the staging directory first.
+    # Results of FunctionCalls whose output is neither cached nor temporary
+    # are always received into memory.
+    #
+    # @param self     Reference to the current manager object.
+    # @param size     Size in bytes of the serialized arguments. (default=1MB)
+    def set_function_inline_limit(self, size):
+        self._function_inline_limit = size
+
     ##
     # Tune advanced parameters.
     #
     # @param self  Reference to the current manager object.
     # @param name  The name fo the parameter to tune. Can be one of following:
     # - "attempt-schedule-depth" The amount of tasks to attempt scheduling on each pass of send_one_task in the main loop. (default=100)
+    # - "background-retrieval-size" Output files of at least this many MB are received in the background, while the manager keeps scheduling on other workers. (default=0)
+    # - "background-staging-size" Input files of at least this many MB are sent in the background, while the manager keeps dispatching to other workers. (default=0)
     # - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
+    # - "chunk-directories" If 1, input directories are sent as a manifest of content-defined chunks, and workers receive only the chunks not already in their cache. (default=0)
+    # - "cross-site-max-transfers" The maximum number of concurrent peer transfers between workers declaring different site= features. If 0, there is no limit. (default=0)
     # - "default-transfer-rate" The assumed network bandwidth used until sufficient data has been collected.  (1MB/s)
     # - "disconnect-slow-workers-factor" Set the multiplier of the average task time at which point to disconnect a worker; disabled if less than 1. (default=0)
+    # - "dispatch-batch-size" The maximum number of tasks to dispatch in each pass of the main loop. (default=1)
+    # - "fair-share" If 1, choose the category of the next task to dispatch by the shares set with @ref set_category_share, rather than taking tasks in the order submitted. (default=0)
     # - "hungry-minimum" Mimimum number of tasks to consider manager not hungry. (default=10)
     # - "hungry-minimum-factor" Queue is hungry if number of waiting tasks is less than hungry-minumum-factor x (number of workers) | 2 |
     # - "immediate-recovery" If set to 1, create recovery tasks for temporary files as soon as their worker disconnects. Otherwise, create recovery tasks only if the temporary files are used as input when trying to dispatch another task.
@@ -848,18 +927,23 @@ class Manager(object):
     # - "max-retrievals" Sets the max number of tasks to retrieve per manager wait(). If less than 1, the manager prefers to retrieve all completed tasks before dispatching new tasks to workers. (default=1)
     # - "min-transfer-timeout" Set the minimum number of seconds to wait for files to be transferred to or from a worker. (default=10)
     # - "monitor-interval" Parameter to change how frequently the resource monitor records resource consumption of a task in a times series, if this feature is enabled. See @ref enable_monitoring.
+    # - "monitor-shared" If 1, each worker measures all of its tasks in a single pass, rather than wrapping every task with its own resource monitor. Set before @ref enable_monitoring. (default=0)
+    # - "peer-stripe-min-size" With peer transfers enabled, files of at least this many MB are fetched in byte ranges from several peers at once. (default=256)
+    # - "peer-stripe-sources" The maximum number of peers that a single file may be fetched from at once. If 1, every peer transfer comes from a single peer. (default=1)
     # - "prefer-dispatch" If 1, try to dispatch tasks even if there are retrieved tasks ready to be reportedas done. (default=0)
     # - "proportional-resources" If set to 0, do not assign resources proportionally to tasks. The default is to use proportions.
     # - "proportional-whole-tasks" Round up resource proportions such that only an integer number of tasks could be fit in the worker. The default is to use proportions.
     # - "ramp-down-heuristic" If set to 1 and there are more workers than tasks waiting, then tasks are allocated all the free resources of a worker large enough to run them. If monitoring watchdog is not enabled, then this heuristic has no effect. (default=0)
     # - "resource-submit-multiplier" Treat each worker as having ({cores,memory,gpus} * multiplier) when submitting tasks. This allows for tasks to wait at a worker rather than the manager. (default = 1.0)
     # - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
+    # - "spill-retrieved-tasks" If > 0, tasks retrieved but not yet returned by @ref wait beyond this many keep their standard output and measured resources on disk rather than in memory. (default=0)
     # - "transfer-outlier-factor" Transfer that are this many times slower than the average will be terminated.  (default=10x)
     # - "transfer-replica-per-cycle" Number of replicas to schedule per file per iteration. (default=1)
     # - "transfer-temps-recovery" If 1, try to replicate temp files to reach threshold on worker removal. (default=0)
     # - "transient-error-interval" Time to wait in seconds after a resource failure before attempting to use it again. (default=15)
     # - "wait-for-workers" Mimimum number of workers to connect before starting dispatching tasks. (default=0)
     # - "wait-retrieve-many" If set to 0, cvine.vine_wait breaks out of the while loop whenever a task changes to "task_done" (wait_retrieve_one mode). If set to 1, vine_wait does not break, but continues recieving and dispatching tasks. This occurs until no task is sent or recieved, at which case it breaks out of the while loop (wait_retrieve_many mode). (default=0)
+    # - "worker-usage-interval" If > 0, workers report every this many seconds the cores and memory actually used by their running tasks. Tasks overcommitted with resource-submit-multiplier are then only sent to workers whose reported usage leaves room for them. Set before workers connect. (default=0)
     # - "worker-retrievals" If 1, retrieve all completed tasks from a worker when retrieving results, even if going above the parameter max-retrievals . Otherwise, if 0, retrieve just one task before deciding to dispatch new tasks or connect new workers. (default=1)
     # - "watch-library-logfiles" If 1, watch the output files produced by each of the library processes running on the remote workers, take them back the current logging directory. (default=0)
     # @param value The value to set the parameter to.
@@ -885,6 +969,31 @@ class Manager(object):
             self._task_table[task_id] = task
             return task_id
 
+    ##
+    # Submit several tasks to the manager at once.
+    #
+    # Equivalent to calling @ref ndcctools.taskvine.manager.Manager.submit on each task,
+    # but all tasks are handed to the manager in a single call, which is
+    # faster when submitting many small tasks, such as FunctionCalls.
+    #
+    # @param self   Reference to the current manager object.
+    # @param tasks  A list of task descriptions created from @ref ndcctools.taskvine.task.Task.
+    # @return       A list with the task id of each task, in the same order.
+    def submit_many(self, tasks):
+        tasks = list(tasks)
+        for task in tasks:
+            task.manager = self
+            task.submit_finalize()
+
+        task_ids = cvine.vine_submit_many(self._taskvine, [task._task for task in tasks])
+        for task, task_id in zip(tasks, task_ids):
+            if task_id != 0:
+                self._task_table[task_id] = task
+
+        if 0 in task_ids:
+            raise ValueError("invalid task description")
+        return task_ids
+
     ##
     # Submit a library to install on all connected workers
     #
@@ -931,7 +1040,16 @@ class Manager(object):
     # @param add_env         Whether to automatically create and/or add environment to the library
     # @returns               A task to be used with @ref ndcctools.taskvine.manager.Manager.install_library.
     # @param hoisting_modules  A list of modules imported at the preamble of library, including packages, functions and classes.
-    def create_library_from_functions(self, library_name, *function_list, poncho_env=None, init_command=None, add_env=True, hoisting_modules=None):
+    # @param exec_mode       How the library runs function calls: "fork" runs each in a child process,
+    #                        "direct" runs them one at a time in the library process, keeping its state,
+    #                        and "thread" runs them in a pool of threads, one per function slot.
+    # @param memory_store    MB of function call results to keep in the memory of the library, so that later
+    #                        calls on the same worker use them without reading their files. Only with "direct" or
+    #                        "thread" exec modes. Default is 0 (disabled).
+    # @param zygote          Whether the library keeps a process on the worker after its imports, from which
+    #                        later instances of the library on that worker start without importing again.
+    #                        The hoisted modules must be safe to fork after import.
+    def create_library_from_functions(self, library_name, *function_list, poncho_env=None, init_command=None, add_env=True, hoisting_modules=None, exec_mode="fork", memory_store=0, zygote=False):
         # Delay loading of poncho until here, to avoid bringing in poncho dependencies unless needed.
         # Ensure poncho python library is available.
         from ndcctools.poncho import package_serverize
@@ -968,11 +1086,20 @@ class Manager(object):
             # enable correct permissions for library code
             os.chmod(library_code_path, 0o775)
 
+        if exec_mode not in ["fork", "direct", "thread"]:
+            raise ValueError(f"invalid exec mode '{exec_mode}'")
+
+        library_command = f"python ./library_code.py --exec-mode {exec_mode}"
+        if memory_store > 0:
+            library_command += f" --memory-store {int(memory_store)}"
+        if zygote:
+            library_command += " --zygote"
+
         # Create Task to execute the Library and prepend it with some setup code if needed.
         if init_command:
-            t = LibraryTask(f"{init_command} python ./library_code.py", library_name)
+            t = LibraryTask(f"{init_command} {library_command}", library_name)
         else:
-            t = LibraryTask("python ./library_code.py", library_name)
+            t = LibraryTask(library_command, library_name)
 
         # Declare the environment if needed.
         if add_env:
@@ -1044,6 +1171,31 @@ class Manager(object):
             timeout = get_c_constant("wait_forever")
         return self.wait_for_tag(None, timeout)
 
+    ##
+    # Wait for tasks to complete, and return all that are complete at once.
+    #
+    # Blocks like @ref ndcctools.taskvine.manager.Manager.wait until a task
+    # completes, and then also returns every other task that has already
+    # completed, without waiting for more.
+    #
+    # @param self       Reference to the current manager object.
+    # @param timeout    The number of seconds to wait for the first completed task.
+    #                   Use an integer or "wait_forever", as in @ref ndcctools.taskvine.manager.Manager.wait.
+    # @param max_tasks  Return at most this many tasks. If 0, there is no limit.
+    # @return           A list of completed tasks, empty if the timeout was reached.
+    def wait_many(self, timeout="wait_forever", max_tasks=0):
+        if timeout == "wait_forever":
+            timeout = get_c_constant("wait_forever")
+
+        self._update_status_display()
+
+        task_ids = cvine.vine_wait_many(self._taskvine, timeout, max_tasks, int(self._wait_releases_gil))
+        if task_ids and self.empty():
+            # if last task in queue, update display
+            self._update_status_display(force=True)
+
+        return [self._task_table.pop(task_id) for task_id in task_ids]
+
     ##
     # Similar to @ref ndcctools.taskvine.manager.Manager.wait, but guarantees that the returned task has the
     # specified tag.
@@ -1061,7 +1213,10 @@ class Manager(object):
 
         self._update_status_display()
 
-        task_pointer = cvine.vine_wait_for_tag(self._taskvine, tag, timeout)
+        if self._wait_releases_gil:
+            task_pointer = cvine.vine_wait_for_tag_released(self._taskvine, tag, timeout)
+        else:
+            task_pointer = cvine.vine_wait_for_tag(self._taskvine, tag, timeout)
         if task_pointer:
             if self.empty():
                 # if last task in queue, update display
@@ -1447,10 +1602,14 @@ class Manager(object):
     # @param peer_transfer   Whether the file can be transfered between workers when
     #                peer transfers are enabled (see @ref ndcctools.taskvine.manager.Manager.enable_peer_transfers). Default is True.
     # @param unlink_when_done   Whether to delete the file when its reference count is 0. (Warning: Only use on files produced by the application, and never on irreplaceable input files.)
+    # @param checksum_on_transfer   Whether to compute the checksum of the file while it is first sent to a worker,
+    #                rather than reading it once more now. Only applies to single files with cache 'worker' or 'forever'. Default is False.
     # @return
     # A file object to use in @ref ndcctools.taskvine.task.Task.add_input or @ref ndcctools.taskvine.task.Task.add_output
-    def declare_file(self, path, cache=False, peer_transfer=True, unlink_when_done=False):
+    def declare_file(self, path, cache=False, peer_transfer=True, unlink_when_done=False, checksum_on_transfer=False):
         flags = Task._determine_file_flags(peer_transfer, unlink_when_done)
+        if checksum_on_transfer:
+            flags |= cvine.VINE_CHECKSUM_ON_TRANSFER
         cache_level = Task._determine_cache_level(cache)
         f = cvine.vine_declare_file(self._taskvine, path, cache_level, flags)
         return File(f)
@@ -1464,6 +1623,15 @@ class Manager(object):
     def fetch_file(self, file):
         return cvine.vine_fetch_file(self._taskvine, file._file)
 
+    ##
+    # Find a worker holding a replica of a file.
+    #
+    # @param self    The manager to register this file
+    # @param file    The file object
+    # @return The address and port of a worker holding the file, or None.
+    def file_location(self, file):
+        return cvine.vine_file_location(self._taskvine, file._file)
+
     ##
     # Un-declare a file that was created by @ref declare_file or similar methods.
     # The given file or directory object is deleted from all worker's caches,
@@ -1605,7 +1773,8 @@ class Manager(object):
     # Declare a file that sets up a poncho environment
     #
     # @param self    The manager to register this file
-    # @param package The poncho environment tarball. Either a vine file or a
+    # @param package The poncho environment tarball, or a directory created with
+    #                poncho_package_create --directory. Either a vine file or a
     #                string representing a local file.
     # @param cache   If True or 'workflow', cache the file at workers for reuse
     #                until the end of the workflow. If 'worker', the file is cache until the
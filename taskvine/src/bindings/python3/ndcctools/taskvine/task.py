@@ -1094,13 +1094,20 @@ class FunctionCall(PythonTask):
         if not self.manager.check_library_exists(library_name):
             raise ValueError(f"invalid library name \'{library_name}\'")
 
-        name = os.path.join(self.manager.staging_directory, "arguments", self._id)
-        with open(name, "wb") as wf:
-            cloudpickle.dump(self._event, wf)
-        self._input_file = self.manager.declare_file(name, unlink_when_done=True, cache=False, peer_transfer=True)
+        # small arguments and results travel in memory, without a round trip through the staging directory.
+        event = cloudpickle.dumps(self._event)
+        if len(event) <= self.manager._function_inline_limit:
+            self._input_file = self.manager.declare_buffer(event, cache=False, peer_transfer=True)
+        else:
+            name = os.path.join(self.manager.staging_directory, "arguments", self._id)
+            with open(name, "wb") as wf:
+                wf.write(event)
+            self._input_file = self.manager.declare_file(name, unlink_when_done=True, cache=False, peer_transfer=True)
 
         if self._tmp_output_enabled:
             self._output_file = self.manager.declare_temp()
+        elif not self._cache_output:
+            self._output_file = self.manager.declare_buffer(cache=False, peer_transfer=True)
         else:
             name = os.path.join(self.manager.staging_directory, "outputs", self._id)
             self._output_file = self.manager.declare_file(name, cache=self._cache_output, unlink_when_done=False)
@@ -1122,11 +1129,12 @@ class FunctionCall(PythonTask):
     ##
     # Specify how the remote task should execute
     # @param self                     Reference to the current remote task object
-    # @param remote_task_exec_method  Can be either of "fork" or "direct".
-    # Fork creates a child process to execute the function and direct
-    # has the worker directly call the function.
+    # @param remote_task_exec_method  Can be one of "fork", "direct" or "thread".
+    # Fork creates a child process to execute the function, direct
+    # has the library directly call the function, and thread calls it
+    # from the library's pool of threads.
     def set_exec_method(self, remote_task_exec_method):
-        if remote_task_exec_method not in ["fork", "direct"]:
+        if remote_task_exec_method not in ["fork", "direct", "thread"]:
             print("Error, vine_exec_method must either be fork or direct, choosing fork by default")
             remote_task_exec_method = "fork"
         self._event["remote_task_exec_method"] = remote_task_exec_method
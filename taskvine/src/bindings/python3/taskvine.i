@@ -1,5 +1,12 @@
 /* taskvine.i */
-%module cvine
+%module(threads="1") cvine
+
+/* Calls hold the GIL, so that no other Python thread may call the manager
+meanwhile.  Only vine_wait_for_tag_released, and vine_wait_many when asked,
+let other threads run while waiting, for a thread that is the only caller
+of the manager. */
+%nothread;
+%thread vine_wait_for_tag_released;
 
 %include carrays.i
 %array_functions(struct rmsummary *, rmsummayArray);
@@ -66,6 +73,67 @@ into a swig function f(data) */
     }
 %}
 
+/* Submit a list of tasks and wait for several tasks in one call,
+so that large batches of small tasks cross the binding only once. */
+%inline %{
+    PyObject *vine_submit_many(struct vine_manager *m, PyObject *tasks) {
+        PyObject *seq = PySequence_Fast(tasks, "tasks must be a sequence");
+        if (!seq)
+            return NULL;
+
+        Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+        PyObject *ids = PyList_New(n);
+        if (!ids) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+
+        for (Py_ssize_t i = 0; i < n; i++) {
+            struct vine_task *t = NULL;
+            if (!SWIG_IsOK(SWIG_ConvertPtr(PySequence_Fast_GET_ITEM(seq, i), (void **)&t, SWIGTYPE_p_vine_task, 0))) {
+                PyErr_SetString(PyExc_TypeError, "tasks must be a sequence of vine_task");
+                Py_DECREF(ids);
+                Py_DECREF(seq);
+                return NULL;
+            }
+            PyList_SET_ITEM(ids, i, PyLong_FromLong(vine_submit(m, t)));
+        }
+
+        Py_DECREF(seq);
+        return ids;
+    }
+
+    struct vine_task *vine_wait_for_tag_released(struct vine_manager *m, const char *tag, int timeout) {
+        return vine_wait_for_tag(m, tag, timeout);
+    }
+
+    PyObject *vine_wait_many(struct vine_manager *m, int timeout, int max_tasks, int release_gil) {
+        PyObject *ids = PyList_New(0);
+        if (!ids)
+            return NULL;
+
+        struct vine_task *t;
+        if (release_gil) {
+            Py_BEGIN_ALLOW_THREADS
+            t = vine_wait(m, timeout);
+            Py_END_ALLOW_THREADS
+        } else {
+            t = vine_wait(m, timeout);
+        }
+        while (t) {
+            PyObject *id = PyLong_FromLong(vine_task_get_id(t));
+            PyList_Append(ids, id);
+            Py_DECREF(id);
+            if (max_tasks > 0 && PyList_GET_SIZE(ids) >= max_tasks)
+                break;
+            /* with a zero timeout, only tasks that are already complete are returned. */
+            t = vine_wait(m, 0);
+        }
+
+        return ids;
+    }
+%}
+
 %include "stdint.i"
 %include "int_sizes.h"
 %include "taskvine.h"
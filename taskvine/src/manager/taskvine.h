@@ -66,8 +66,11 @@ typedef enum {
 typedef enum {
 	VINE_PEER_NOSHARE = 1,	  /**< Schedule this file to be shared between peers where available. See @ref
 				     vine_enable_peer_transfers **/
-	VINE_UNLINK_WHEN_DONE = 2 /**< Whether to delete the file when its reference count is 0. (Warning: Only use on
+	VINE_UNLINK_WHEN_DONE = 2, /**< Whether to delete the file when its reference count is 0. (Warning: Only use on
 				     files produced by the application, and never on irreplaceable input files.) */
+	VINE_CHECKSUM_ON_TRANSFER = 4 /**< Compute the checksum of a local file while it is first sent to a worker,
+				     rather than reading it once more when declared. Only applies to single files cached at
+				     VINE_CACHE_LEVEL_WORKER or above. */
 } vine_file_flags_t;
 
 /** Select overall scheduling algorithm for matching tasks to workers. */
@@ -148,6 +151,45 @@ typedef enum {
 } vine_file_type_t;
 
 
+/** Phases of the main loop of the manager, as profiled in @ref vine_stats.
+These can be converted to a string with @ref vine_loop_phase_string.
+*/
+typedef enum {
+	VINE_LOOP_PHASE_POLL = 0,      /**< Waiting for messages from workers. */
+	VINE_LOOP_PHASE_RECV_COMPLETE, /**< Handling a message that a task completed. */
+	VINE_LOOP_PHASE_RECV_CACHE,    /**< Handling a message that a file was cached at a worker. */
+	VINE_LOOP_PHASE_RECV_STATUS,   /**< Answering a request for the status of the manager. */
+	VINE_LOOP_PHASE_RECV_OTHER,    /**< Handling any other message from a worker. */
+	VINE_LOOP_PHASE_SCHEDULE,      /**< Looking for a worker to run a task. */
+	VINE_LOOP_PHASE_COMMIT,        /**< Sending a task and its inputs to a worker. */
+	VINE_LOOP_PHASE_RETRIEVE,      /**< Retrieving the outputs of a task from a worker. */
+	VINE_LOOP_PHASE_CATALOG,       /**< Reporting to the catalog server. */
+	VINE_LOOP_PHASE_RECOVERY,      /**< Looking for temporary files to replicate. */
+	VINE_LOOP_PHASE_MAX	       /**< Not a phase, but the number of phases. */
+} vine_loop_phase_t;
+
+/** Types of objects whose memory is accounted in @ref vine_stats.
+These can be converted to a string with @ref vine_memory_type_string.
+*/
+typedef enum {
+	VINE_MEMORY_TASKS = 0, /**< Tasks, with their commands, environments, mounts, resources, and standard output. */
+	VINE_MEMORY_FILES,     /**< Declared files, including the contents of buffers. */
+	VINE_MEMORY_REPLICAS,  /**< Records of the replicas of files at workers. */
+	VINE_MEMORY_WORKERS,   /**< Connected workers, with their features and tables of current tasks. */
+	VINE_MEMORY_LINKS,     /**< Connections to workers, with their input and output buffers. */
+	VINE_MEMORY_MAX	       /**< Not a type, but the number of types. */
+} vine_memory_type_t;
+
+/** Statistics describing one phase of the main loop of the manager. All times in microseconds. */
+struct vine_loop_phase_stats {
+	int64_t count;		/**< Number of times the phase ran. */
+	timestamp_t time_total; /**< Total time spent in the phase. */
+	timestamp_t time_p50;	/**< Median time of one run of the phase. */
+	timestamp_t time_p90;	/**< 90th percentile of the time of one run of the phase. */
+	timestamp_t time_p99;	/**< 99th percentile of the time of one run of the phase. */
+	timestamp_t time_max;	/**< Longest time of one run of the phase. */
+};
+
 /** Statistics describing a manager. */
 struct vine_stats {
 	/* Stats for the current state of workers: */
@@ -182,6 +224,8 @@ struct vine_stats {
 	int tasks_failed;     /**< Total number of tasks completed and returned to user with result other than
 				 VINE_RESULT_SUCCESS. */
 	int tasks_cancelled;  /**< Total number of tasks cancelled. */
+	int tasks_speculative; /**< Total number of duplicates of slow tasks launched. (see @ref vine_enable_speculative_execution) */
+	int tasks_speculative_won; /**< Total number of tasks whose results came from a duplicate that finished first. */
 	int tasks_exhausted_attempts; /**< Total number of task executions that failed given resource exhaustion. */
 
 	/* All times in microseconds */
@@ -219,6 +263,16 @@ struct vine_stats {
 				   the workers by the manager. */
 	double bandwidth; /**< Average network bandwidth in MB/S observed by the manager when transferring to workers.
 			   */
+	int64_t cache_hits;   /**< Total number of task inputs already cached at the worker when the task was dispatched. */
+	int64_t cache_misses; /**< Total number of task inputs that had to be sent to the worker when the task was dispatched. */
+	int64_t fetches;              /**< Total number of files placed in worker caches by the manager, a peer, or a url. */
+	int64_t fetch_bytes;          /**< Total size of the files fetched. */
+	int64_t fetch_unique_bytes;   /**< Total size of the distinct files fetched, counting each file once. */
+	int64_t fetch_bytes_manager;  /**< Total size of the files fetched from the manager. */
+	int64_t fetch_bytes_peer;     /**< Total size of the files fetched from other workers. */
+	int64_t fetch_bytes_url;      /**< Total size of the files fetched from urls. */
+	int64_t fetch_duplicates;     /**< Total number of fetches of a file to a host that had fetched it before. */
+	int64_t fetch_after_eviction; /**< Total number of fetches of a file to a host that had evicted it. */
 
 	/* resources statistics */
 	int capacity_tasks;  /**< The estimated number of tasks that this manager can effectively support. */
@@ -253,6 +307,12 @@ struct vine_stats {
 	int64_t min_gpus;   /**< The smallest number of gpus observed among the connected workers. */
 
 	int64_t inuse_cache; /**< Used disk space of declared files in MB aggregated across the connected workers. */
+
+	/* Profile of the main loop of the manager: */
+	struct vine_loop_phase_stats loop_phases[VINE_LOOP_PHASE_MAX]; /**< Times of each phase of the main loop, indexed by @ref vine_loop_phase_t. Percentiles are within 1%. */
+
+	/* Memory used by the manager: */
+	int64_t memory_bytes[VINE_MEMORY_MAX]; /**< Approximate bytes of memory held by each type of object, indexed by @ref vine_memory_type_t. Measured at most every memory-stats-interval seconds. */
 };
 
 /** @name Functions - Tasks */
@@ -731,6 +791,8 @@ cache at execution site even when worker terminates (VINE_CACHE_LEVEL_FOREVER).
 @param flags Flags that can be or'ed (|) to indicate whether a file should not be transferred among
 workers (VINE_PEER_NOSHARE) when peer transfers are enabled (@ref vine_enable_peer_transfers), or whether a file should
 be delete at the manager's site after it is not needed by the workflow (@ref vine_undeclare_file).
+With VINE_CHECKSUM_ON_TRANSFER, the checksum that names the file in the worker caches is computed while the file is
+first sent, rather than by reading it once more here.
 @return A file object to use in @ref vine_task_add_input, and @ref vine_task_add_output
 */
 struct vine_file *vine_declare_file(
@@ -790,6 +852,9 @@ struct vine_file *vine_declare_chirp(struct vine_manager *m, const char *server,
 /** Create a scratch file object.
 A scratch file has no initial content, but is created
 as the output of a task, and may be consumed by other tasks.
+A task consuming a scratch file may be submitted before the task producing it
+has completed: the manager holds the consumer until the file is created.
+In this way, a whole graph of dependent tasks can be submitted at once.
 @param m A manager object
 @return A file object to use in @ref vine_task_add_input, @ref vine_task_add_output
 */
@@ -848,7 +913,8 @@ struct vine_file *vine_declare_untar(
 
 /** Create a file object by unpacking a poncho package
 @param m A manager object
-@param f A file object corresponding to poncho or conda-pack tarball
+@param f A file object corresponding to poncho or conda-pack tarball, in any compression known to tar,
+or to a directory with the unpacked environment, which is used without extraction.
 @param cache Method for caching file at the workers: never, the default (VINE_CACHE_LEVEL_TASK), to cache only for the
 current manager (VINE_CACHE_LEVEL_WORKFLOW), to cache for the lifetime of the worker (VINE_CACHE_LEVEL_WORKER), or to
 cache at execution site even when worker terminates (VINE_CACHE_LEVEL_FOREVER).
@@ -885,6 +951,15 @@ whose contents are not returned to the manager by default.
 
 const char *vine_fetch_file(struct vine_manager *m, struct vine_file *f);
 
+/** Find a worker holding a replica of a file.
+This is useful to place tasks that consume temporary files near their data.
+@param m A manager object
+@param f A file object.
+@return The address and port of a worker holding a ready replica of the file, or null if there is none.
+*/
+
+const char *vine_file_location(struct vine_manager *m, struct vine_file *f);
+
 /** Un-declare a file that was created by @ref vine_declare_file or similar functions.
 The given file or directory object is deleted from all worker's caches,
 and is no longer available for use as an input file.
@@ -1089,6 +1164,29 @@ int vine_enable_peer_transfers(struct vine_manager *m);
 /** Disable taskvine peer transfers to be scheduled by the manager **/
 int vine_disable_peer_transfers(struct vine_manager *m);
 
+/** Remember the checksums of local files across runs.
+The checksum of each local file declared with @ref vine_declare_file, and of each
+file within a declared directory, is kept along with the inode, size, and modification
+time of the file. Checksums are loaded from the given file now, and saved to it when
+the manager is deleted, so that unchanged files need not be read again by a later run.
+@param m A manager object
+@param filename The file in which to keep the checksums, or null to stop keeping them between runs.
+@return 1 on success, 0 if the file exists but could not be read.
+*/
+int vine_enable_checksum_cache(struct vine_manager *m, const char *filename);
+
+/** Keep a checkpoint of the tasks completed, so that a manager restarted with the same checkpoint
+does not run them again. Each task completed successfully is appended to the given file as it is
+returned by @ref vine_wait. A task submitted later with the same command, inputs, and outputs
+is returned at once with its earlier standard output and exit code, as long as its output files
+are still present. Only tasks whose outputs are all local files are kept. The resources measured
+for the tasks in the checkpoint are also given to their categories. Call before submitting tasks.
+@param m A manager object
+@param filename The file in which to keep the checkpoint.
+@return 1 on success, 0 if the file could not be read or written.
+*/
+int vine_enable_checkpoint(struct vine_manager *m, const char *filename);
+
 /** When enabled, resources to tasks in are assigned in proportion to the size
 of the worker. If a resource is specified (e.g. with @ref vine_task_set_cores),
 proportional resources never go below explicit specifications. This mode is most
@@ -1155,9 +1253,21 @@ void vine_get_stats(struct vine_manager *m, struct vine_stats *s);
 */
 void vine_get_stats_category(struct vine_manager *m, const char *c, struct vine_stats *s);
 
+/** Name a phase of the main loop of the manager.
+@param phase A phase, as used to index @ref vine_stats.loop_phases.
+@return String name of the phase.
+*/
+const char *vine_loop_phase_string(vine_loop_phase_t phase);
+
+/** Name a type of object whose memory is accounted by the manager.
+@param type A type, as used to index @ref vine_stats.memory_bytes.
+@return String name of the type.
+*/
+const char *vine_memory_type_string(vine_memory_type_t type);
+
 /** Get manager information as json
 @param m A manager object
-@param request One of: manager, tasks, workers, or categories
+@param request One of: manager, tasks, workers, categories, loop, or memory
 */
 char *vine_get_status(struct vine_manager *m, const char *request);
 
@@ -1203,6 +1313,17 @@ the multiplier of the "default" category.
 */
 int vine_enable_disconnect_slow_workers_category(struct vine_manager *m, const char *category, double multiplier);
 
+/** Enable speculative execution of slow tasks. When no task is waiting to
+run, a task that has run longer than the given quantile of the times of the
+completed tasks of its category is duplicated on a different worker. Whichever
+copy finishes first provides the results of the task, and the other is cancelled.
+This hedges against stragglers on slow workers without disconnecting them.
+@param m A manager object
+@param quantile The quantile of task times beyond which a task is duplicated, e.g. 0.95. Disabled if not between 0 and 1.
+@returns 0 if activated, 1 if deactivated.
+*/
+int vine_enable_speculative_execution(struct vine_manager *m, double quantile);
+
 /** Set the draining mode per worker hostname.
 If drain_flag is 0, workers at hostname receive tasks as usual.
 If drain_flag is not 1, no new tasks are dispatched to workers at hostname,
@@ -1230,6 +1351,15 @@ default).
 */
 void vine_set_category_max_concurrent(struct vine_manager *m, const char *category, int max_concurrent);
 
+/** Set the share of the workers given to tasks of this category while they are waiting, relative to the other
+categories, and turn on fair share scheduling. Category names are read as a hierarchy split at '/', so that a share may
+also be set for a group of categories, e.g. "alice" for "alice/align" and "alice/sort". Shares default to 1.
+@param m A manager object.
+@param category A category name, or a prefix of category names up to a '/'.
+@param share The relative share of cores. Shares not positive are reset to 1.
+*/
+void vine_set_category_share(struct vine_manager *m, const char *category, double share);
+
 /** Turn on or off first-allocation labeling for a given category and resource. This function should be use to fine-tune
 the defaults from @ref vine_set_category_mode.
 @param m A manager object
@@ -1338,6 +1468,16 @@ int vine_enable_transactions_log(struct vine_manager *m, const char *logfile);
 */
 int vine_enable_taskgraph_log(struct vine_manager *m, const char *logfile);
 
+/** Add a log that records the workload of the manager so that it can be replayed offline with vine_replay:
+the resources of the workers as they arrive and leave, the resources and inputs of the tasks as they are
+submitted, and the execution time and output sizes of the tasks as they complete.
+The log is not enabled by default, and is written to the logs directory of the manager.
+@param m A manager object
+@param logfile The filename.
+@return 1 if logfile was opened, 0 otherwise.
+*/
+int vine_enable_replay_log(struct vine_manager *m, const char *logfile);
+
 /** Shut down workers connected to the manager. Gives a best effort and then returns the number of workers given the
 shut down order.
 @param m A manager object
@@ -1391,11 +1531,15 @@ This allows for tasks to wait at a worker rather than the manager. (default = 1.
  - "default-transfer-rate" The assumed network bandwidth used until sufficient data has been collected.  (1MB/s)
  - "disconnect-slow-workers-factor" Set the multiplier of the average task time at which point to disconnect;
 deactivated if less than 1. (default=0)
+ - "speculative-quantile" Duplicate tasks that run longer than this quantile of the task times of their category.
+See @ref vine_enable_speculative_execution. (default=0, disabled)
  - "keepalive-interval" Set the minimum number of seconds to wait before sending new keepalive checks to workers.
 (default=300)
  - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it
 as dead. (default=30)
  - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
+ - "spill-retrieved-tasks" If > 0, tasks retrieved but not yet returned by @ref vine_wait beyond this many keep their
+standard output and measured resources on disk rather than in memory. (default=0)
  - "monitor-interval" Maximum number of seconds between resource monitor measurements. If less than 1, use default (5s).
 (default=5)
  - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
@@ -1403,14 +1547,42 @@ as dead. (default=30)
  - "wait-for-workers" Mimimum number of workers to connect before starting dispatching tasks. (default=0)
  - "attempt-schedule-depth" The amount of tasks to attempt scheduling on each pass of send_one_task in the main loop.
 (default=100)
+ - "dispatch-batch-size" The maximum number of tasks to dispatch in each pass of the main loop. Messages to the same
+worker are sent together at the end of the pass. (default=1)
+ - "fair-share" If 1, choose the category of the next task to dispatch by the shares set with
+@ref vine_set_category_share, rather than taking tasks in the order submitted. (default=0)
+ - "background-retrieval-size" Output files of at least this many MB are received in the background, while the manager
+keeps scheduling on other workers. If 0, all outputs are received synchronously. (default=0)
+ - "background-staging-size" Input files of at least this many MB are sent in the background, while the manager keeps
+dispatching to other workers. If 0, all inputs are sent synchronously. (default=0)
+ - "chunk-directories" If 1, input directories are sent as a manifest of content-defined chunks, and workers receive
+only the chunks not already in their cache, assembling the rest from earlier versions of the directory. (default=0)
+ - "cross-site-max-transfers" The maximum number of concurrent peer transfers between workers declaring different site=
+features. If 0, there is no limit. (default=0)
+ - "peer-stripe-sources" The maximum number of peers that a single file may be fetched from at once. If 1, every peer
+transfer comes from a single peer. (default=1)
+ - "peer-stripe-min-size" With peer transfers enabled, files of at least this many MB are fetched in byte ranges from
+several peers at once. (default=256)
  - "wait_retrieve_many" Parameter to alter how vine_wait works. If set to 0, vine_wait breaks out of the while loop
 whenever a task changes to VINE_TASK_DONE (wait_retrieve_one mode). If set to 1, vine_wait does not break, but continues
 recieving and dispatching tasks. This occurs until no task is sent or recieved, at which case it breaks out of the while
 loop (wait_retrieve_many mode). (default=0)
  - "monitor-interval" Parameter to change how frequently the resource monitor records resource consumption of a task in
 a times series, if this feature is enabled. See @ref vine_enable_monitoring.
+ - "monitor-shared" If 1, tasks are measured by the worker, which polls the processes of all its tasks in a single pass,
+rather than each task being wrapped by its own resource_monitor. Summaries are the same, but time series are not
+produced. Set before @ref vine_enable_monitoring and before submitting tasks. (default=0)
  - "update_interval"  Seconds between updates to the catalog. (default=60)
+ - "worker-usage-interval" If > 0, workers report every this many seconds the cores and memory actually used by their
+running tasks. Tasks overcommitted with resource-submit-multiplier are then only sent to workers whose reported usage
+leaves room for them. Set before workers connect. (default=0)
  - "temp-replica-count" Degree of replication across workers for remote temp files (default=0)
+ - "temp-replica-demand" If > 0, add a replica of a temp file for each this many tasks waiting on it or recently
+fetching it, up to one per worker. (default=0)
+ - "recovery-planning" If 1, when a worker is lost, plan at once the recovery of all the lost temp files still needed,
+deepest in the lineage first. (default=0)
+ - "recovery-replicate-depth" If > 0, temp files at the end of a chain of at least this many temp files are replicated
+to at least two workers. (default=0)
  - "transient-error-interval" Time to wait in seconds after a resource failure before attempting to use it again
 (default=15)
  - "resource_management_interval" Seconds between measurement of manager local resources. (default=30)
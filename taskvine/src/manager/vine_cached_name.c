@@ -114,7 +114,7 @@ value to use for caching purposes: md5 checksum, E-Tag, Last-Modified-Time,
 or if all else fails, just the URL itself.
 */
 
-static vine_url_cache_t get_url_properties(const char *url, char *tag)
+static vine_url_cache_t get_url_properties(const char *url, char *tag, struct vine_checksum_cache *checksums)
 {
 	vine_url_cache_t val = VINE_FOUND_NONE;
 	char line[VINE_LINE_MAX];
@@ -128,7 +128,7 @@ static vine_url_cache_t get_url_properties(const char *url, char *tag)
 
 	if (!strncmp(url, "file://", 7)) {
 		ssize_t totalsize;
-		char *hash = vine_checksum_any(&url[7], &totalsize);
+		char *hash = vine_checksum_any(checksums, &url[7], &totalsize);
 		if (hash) {
 			strcpy(tag, hash);
 			free(hash);
@@ -199,7 +199,7 @@ directly.  If not, then we compute from the ETag, Last-Modified-Time,
 or if all else fails, from the URL itself.
 */
 
-static char *make_url_cached_name(const struct vine_file *f)
+static char *make_url_cached_name(const struct vine_file *f, struct vine_checksum_cache *checksums)
 {
 	char tag[VINE_LINE_MAX];
 	unsigned char digest[MD5_DIGEST_LENGTH];
@@ -209,7 +209,7 @@ static char *make_url_cached_name(const struct vine_file *f)
 
 	debug(D_VINE, "fetching headers for url %s", f->source);
 
-	vine_url_cache_t val = get_url_properties(f->source, tag);
+	vine_url_cache_t val = get_url_properties(f->source, tag, checksums);
 
 	switch (val) {
 	case VINE_FOUND_NONE:
@@ -295,6 +295,34 @@ char *vine_meta_name(const struct vine_file *f, ssize_t *totalsize)
 
 	return name;
 }
+
+/*
+Generates a provisional cached name for a file object of type VINE_FILE
+whose checksum is to be computed while it is first sent to a worker.
+Returns null if the file should be named by its content right away,
+because it is not a single regular file or its checksum is already known.
+*/
+char *vine_pending_name(const struct vine_file *f, struct vine_checksum_cache *checksums, ssize_t *totalsize)
+{
+	struct stat info;
+
+	if (f->type != VINE_FILE)
+		return 0;
+
+	if (lstat(f->source, &info) || !S_ISREG(info.st_mode))
+		return 0;
+
+	char *hash = vine_checksum_lookup(checksums, f->source);
+	if (hash) {
+		free(hash);
+		return 0;
+	}
+
+	*totalsize = info.st_size;
+
+	return vine_meta_name(f, totalsize);
+}
+
 /*
 Generates a random cached name of a file object.
 Returns a string that must be freed with free().
@@ -335,14 +363,14 @@ Compute the cached name of a file object, based on its type.
 Returns a string that must be freed with free().
 */
 
-char *vine_cached_name(const struct vine_file *f, ssize_t *totalsize)
+char *vine_cached_name(const struct vine_file *f, struct vine_checksum_cache *checksums, ssize_t *totalsize)
 {
 	unsigned char digest[MD5_DIGEST_LENGTH];
 	char *hash, *name;
 
 	switch (f->type) {
 	case VINE_FILE:
-		hash = vine_checksum_any(f->source, totalsize);
+		hash = vine_checksum_any(checksums, f->source, totalsize);
 		if (hash) {
 			/* An existing file is identified by its content. */
 			name = string_format("file-md5-%s", hash);
@@ -360,7 +388,7 @@ char *vine_cached_name(const struct vine_file *f, ssize_t *totalsize)
 		break;
 	case VINE_URL:
 		/* A url is identified by its metadata. */
-		hash = make_url_cached_name(f);
+		hash = make_url_cached_name(f, checksums);
 		name = string_format("url-%s", hash);
 		free(hash);
 		break;
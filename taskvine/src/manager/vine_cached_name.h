@@ -8,10 +8,12 @@ See the file COPYING for details.
 #define VINE_CACHED_NAME_H
 
 #include "vine_file.h"
+#include "vine_checksum.h"
 #include <sys/types.h>
 
-char *vine_cached_name( const struct vine_file *f, ssize_t *totalsize );
+char *vine_cached_name( const struct vine_file *f, struct vine_checksum_cache *checksums, ssize_t *totalsize );
 char *vine_meta_name( const struct vine_file *f, ssize_t *totalsize );
+char *vine_pending_name( const struct vine_file *f, struct vine_checksum_cache *checksums, ssize_t *totalsize );
 char *vine_random_name( const struct vine_file *f, ssize_t *totalsize );
 
 #endif
@@ -0,0 +1,332 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_checkpoint.h"
+#include "vine_file.h"
+#include "vine_mount.h"
+#include "vine_task.h"
+
+#include "category.h"
+#include "debug.h"
+#include "hash_table.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "jx_print.h"
+#include "md5.h"
+#include "rmsummary.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Tasks with a larger standard output are not recorded, to keep the journal small. */
+#define VINE_CHECKPOINT_MAX_OUTPUT (1024 * 1024)
+
+/*
+Only standard tasks whose outputs are all local files can be restored.
+Temporary files and buffers do not outlive the manager, and function
+calls depend on the state of their library.
+*/
+
+static int task_is_checkpointable(struct vine_task *t)
+{
+	if (t->type != VINE_TASK_TYPE_STANDARD || t->needs_library)
+		return 0;
+
+	struct vine_mount *m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		if (m->file->type == VINE_TEMP)
+			return 0;
+	}
+
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		if (m->file->type != VINE_FILE)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+The key of a task is the hash of its command, the cached names of its
+inputs, and the names and local paths of its outputs. Input files named
+by their content give the same key when unchanged from the earlier run.
+*/
+
+static char *task_key(struct vine_task *t)
+{
+	char *taskstr = vine_task_to_json(t);
+	char *buffer = taskstr;
+
+	struct vine_mount *m;
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		char *next = string_format("%s:%s", buffer, m->file->source);
+		free(buffer);
+		buffer = next;
+	}
+
+	char *key = md5_of_string(buffer);
+	free(buffer);
+	return key;
+}
+
+static void record_insert(struct vine_manager *q, struct jx *record)
+{
+	const char *key = jx_lookup_string(record, "key");
+	if (!key) {
+		jx_delete(record);
+		return;
+	}
+
+	jx_delete(hash_table_remove(q->checkpoint_table, key));
+	hash_table_insert(q->checkpoint_table, key, record);
+}
+
+static void record_write(FILE *file, struct jx *record)
+{
+	jx_print_stream(record, file);
+	fputc('\n', file);
+}
+
+/* The resources measured in earlier runs give the categories a head start. */
+
+static void record_accumulate(struct vine_manager *q, struct jx *record)
+{
+	struct jx *resources = jx_lookup(record, "resources");
+	if (!resources)
+		return;
+
+	struct rmsummary *s = json_to_rmsummary(resources);
+	if (!s)
+		return;
+
+	const char *name = jx_lookup_string(record, "category");
+	struct category *c = vine_category_lookup_or_create(q, name ? name : "default");
+	category_accumulate_summary(c, s, q->current_max_worker);
+	rmsummary_delete(s);
+}
+
+/* Read the journal, later records of a task replacing earlier ones. */
+
+static int journal_load(struct vine_manager *q, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		if (errno != ENOENT)
+			debug(D_NOTICE, "couldn't open checkpoint %s: %s", filename, strerror(errno));
+		return errno == ENOENT;
+	}
+
+	char *line = 0;
+	size_t length = 0;
+	int count = 0;
+
+	while (getline(&line, &length, file) > 0) {
+		struct jx *record = jx_parse_string(line);
+		if (!jx_istype(record, JX_OBJECT)) {
+			/* The last line may be incomplete if the manager stopped while writing it. */
+			jx_delete(record);
+			continue;
+		}
+		record_accumulate(q, record);
+		record_insert(q, record);
+		count++;
+	}
+
+	free(line);
+	fclose(file);
+
+	debug(D_VINE, "checkpoint: loaded %d records of %d tasks from %s", count, hash_table_size(q->checkpoint_table), filename);
+	return 1;
+}
+
+/* Write a snapshot with one record per task, which later runs append to. */
+
+static int journal_compact(struct vine_manager *q, const char *filename)
+{
+	char *tmpname = string_format("%s.tmp", filename);
+	FILE *file = fopen(tmpname, "w");
+	if (!file) {
+		debug(D_NOTICE, "couldn't write checkpoint %s: %s", tmpname, strerror(errno));
+		free(tmpname);
+		return 0;
+	}
+
+	char *key;
+	struct jx *record;
+	HASH_TABLE_ITERATE(q->checkpoint_table, key, record)
+	{
+		record_write(file, record);
+	}
+
+	int result = !fclose(file) && !rename(tmpname, filename);
+	if (!result)
+		debug(D_NOTICE, "couldn't write checkpoint %s: %s", filename, strerror(errno));
+
+	free(tmpname);
+	return result;
+}
+
+int vine_checkpoint_open(struct vine_manager *q, const char *filename)
+{
+	vine_checkpoint_close(q);
+
+	q->checkpoint_table = hash_table_create(0, 0);
+
+	if (!journal_load(q, filename) || !journal_compact(q, filename)) {
+		vine_checkpoint_close(q);
+		return 0;
+	}
+
+	q->checkpoint_file = fopen(filename, "a");
+	if (!q->checkpoint_file) {
+		debug(D_NOTICE, "couldn't open checkpoint %s: %s", filename, strerror(errno));
+		vine_checkpoint_close(q);
+		return 0;
+	}
+
+	/* Each record is written whole, so that a crash loses at most the last one. */
+	setvbuf(q->checkpoint_file, NULL, _IOLBF, 4096);
+
+	return 1;
+}
+
+/* The outputs of a task must still be where the earlier run left them. */
+
+static int outputs_present(struct jx *record)
+{
+	struct jx *outputs = jx_lookup(record, "outputs");
+	if (!jx_istype(outputs, JX_ARRAY))
+		return 0;
+
+	struct jx *output;
+	for (void *i = NULL; (output = jx_iterate_array(outputs, &i));) {
+		const char *path = jx_lookup_string(output, "path");
+		if (!path)
+			return 0;
+
+		struct stat info;
+		if (stat(path, &info) != 0)
+			return 0;
+
+		if (S_ISREG(info.st_mode) && info.st_size != jx_lookup_integer(output, "size"))
+			return 0;
+	}
+
+	return 1;
+}
+
+int vine_checkpoint_restore(struct vine_manager *q, struct vine_task *t)
+{
+	if (!q->checkpoint_table || !task_is_checkpointable(t))
+		return 0;
+
+	char *key = task_key(t);
+	struct jx *record = hash_table_lookup(q->checkpoint_table, key);
+
+	if (!record || !outputs_present(record)) {
+		free(key);
+		return 0;
+	}
+
+	vine_task_set_result(t, VINE_RESULT_SUCCESS);
+	t->exit_code = jx_lookup_integer(record, "exit_code");
+
+	const char *output = jx_lookup_string(record, "output");
+	free(t->output);
+	t->output = output ? xxstrdup(output) : 0;
+
+	struct jx *resources = jx_lookup(record, "resources");
+	if (resources) {
+		rmsummary_delete(t->resources_measured);
+		t->resources_measured = json_to_rmsummary(resources);
+	}
+
+	debug(D_VINE, "checkpoint: task %d (%s) was completed by an earlier run", t->task_id, t->command_line);
+
+	free(key);
+	return 1;
+}
+
+void vine_checkpoint_write(struct vine_manager *q, struct vine_task *t)
+{
+	if (!q->checkpoint_file)
+		return;
+
+	if (t->result != VINE_RESULT_SUCCESS || !task_is_checkpointable(t))
+		return;
+
+	if (t->output && strlen(t->output) > VINE_CHECKPOINT_MAX_OUTPUT)
+		return;
+
+	/* A task restored from the checkpoint was never dispatched, and is already recorded. */
+	if (t->try_count == 0)
+		return;
+
+	char *key = task_key(t);
+
+	struct jx *outputs = jx_array(0);
+	struct vine_mount *m;
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		struct stat info;
+		if (stat(m->file->source, &info) != 0) {
+			/* An output that is not present cannot be restored later. */
+			jx_delete(outputs);
+			free(key);
+			return;
+		}
+		struct jx *o = jx_object(0);
+		jx_insert_integer(o, "size", S_ISREG(info.st_mode) ? info.st_size : 0);
+		jx_insert_string(o, "path", m->file->source);
+		jx_array_append(outputs, o);
+	}
+
+	/* jx_insert prepends, so keys are inserted in reverse to print in order. */
+	struct jx *record = jx_object(0);
+	jx_insert(record, jx_string("outputs"), outputs);
+	if (t->resources_measured) {
+		jx_insert(record, jx_string("resources"), rmsummary_to_json(t->resources_measured, 1));
+	}
+	jx_insert_string(record, "output", t->output ? t->output : "");
+	jx_insert_integer(record, "exit_code", t->exit_code);
+	jx_insert_string(record, "category", t->category ? t->category : "default");
+	jx_insert_string(record, "command", t->command_line);
+	jx_insert_string(record, "key", key);
+
+	record_write(q->checkpoint_file, record);
+	record_insert(q, record);
+
+	free(key);
+}
+
+void vine_checkpoint_close(struct vine_manager *q)
+{
+	if (q->checkpoint_file) {
+		fclose(q->checkpoint_file);
+		q->checkpoint_file = 0;
+	}
+
+	if (q->checkpoint_table) {
+		char *key;
+		struct jx *record;
+		HASH_TABLE_ITERATE(q->checkpoint_table, key, record)
+		{
+			jx_delete(record);
+		}
+		hash_table_delete(q->checkpoint_table);
+		q->checkpoint_table = 0;
+	}
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,36 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_CHECKPOINT_H
+#define VINE_CHECKPOINT_H
+
+/*
+Implementation of the manager's checkpoint, a journal of the tasks
+completed successfully, so that a manager restarted with the same
+journal returns them at once instead of running them again.
+Each completed task is appended as one JSON object per line, keyed
+by the command, inputs, and outputs of the task. When the journal is
+opened, it is read and compacted into a snapshot with one record per
+task, and the resources measured are given back to the categories.
+Only tasks whose outputs are all local files are recorded, since the
+outputs of the other tasks do not outlive the cluster.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+
+/* Load and compact the journal in filename, and open it to record further tasks. */
+int vine_checkpoint_open( struct vine_manager *q, const char *filename );
+
+/* If t was completed by an earlier run and its outputs are still present, fill in its results and return true. */
+int vine_checkpoint_restore( struct vine_manager *q, struct vine_task *t );
+
+/* Append t to the journal if it ran and completed successfully, replacing any earlier record of the same task. */
+void vine_checkpoint_write( struct vine_manager *q, struct vine_task *t );
+
+void vine_checkpoint_close( struct vine_manager *q );
+
+#endif
@@ -6,16 +6,304 @@ See the file COPYING for details.
 
 #include "vine_checksum.h"
 
+#include "buffer.h"
 #include "debug.h"
+#include "full_io.h"
+#include "hash_table.h"
+#include "list.h"
+#include "load_average.h"
+#include "macros.h"
 #include "md5.h"
 #include "sort_dir.h"
 #include "string_array.h"
 #include "stringtools.h"
+#include "url_encode.h"
 #include "xxmalloc.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+The digest of each regular file is remembered along with the
+inode, size, and modification time of the file, so that a file
+that has not changed since it was last seen is not read again.
+Each manager keeps its own cache, which can be saved to and
+loaded from a file, so that it persists across runs.
+*/
+
+struct vine_checksum_cache {
+	struct hash_table *table;
+	/* Incremented by each call to vine_checksum_any. */
+	int generation;
+};
+
+struct vine_checksum_entry {
+	ino_t inode;
+	int64_t size;
+	time_t mtime;
+	int racy;
+	int generation;
+	char digest[MD5_DIGEST_LENGTH_HEX + 1];
+};
+
+/*
+A file modified this recently may still be changing within the same second
+as its mtime, so its digest is racy: it is used only by the same call to
+vine_checksum_any that computed it, and is never saved.
+*/
+#define VINE_CHECKSUM_CACHE_SETTLE_TIME 2
+
+/* Hashing is split among processes only when there is at least this much work. */
+#define VINE_CHECKSUM_PARALLEL_MIN_FILES 16
+#define VINE_CHECKSUM_PARALLEL_MIN_BYTES (64 * 1024 * 1024)
+#define VINE_CHECKSUM_PARALLEL_MAX_PROCS 8
+
+struct vine_checksum_cache *vine_checksum_cache_create(void)
+{
+	struct vine_checksum_cache *c = xxmalloc(sizeof(*c));
+	c->table = hash_table_create(0, 0);
+	c->generation = 0;
+	return c;
+}
+
+void vine_checksum_cache_delete(struct vine_checksum_cache *c)
+{
+	if (!c)
+		return;
+	hash_table_clear(c->table, (void *)free);
+	hash_table_delete(c->table);
+	free(c);
+}
+
+static const char *vine_checksum_cache_lookup(struct vine_checksum_cache *c, const char *path, struct stat *info)
+{
+	struct vine_checksum_entry *e = hash_table_lookup(c->table, path);
+	if (e && e->inode == info->st_ino && e->size == info->st_size && e->mtime == info->st_mtime) {
+		if (!e->racy || e->generation == c->generation)
+			return e->digest;
+	}
+	return 0;
+}
+
+static void vine_checksum_cache_insert(struct vine_checksum_cache *c, const char *path, struct stat *info, const char *digest)
+{
+	struct vine_checksum_entry *e = hash_table_lookup(c->table, path);
+	if (!e) {
+		e = xxmalloc(sizeof(*e));
+		hash_table_insert(c->table, path, e);
+	}
+
+	e->inode = info->st_ino;
+	e->size = info->st_size;
+	e->mtime = info->st_mtime;
+	e->racy = info->st_mtime > time(0) - VINE_CHECKSUM_CACHE_SETTLE_TIME;
+	e->generation = c->generation;
+	snprintf(e->digest, sizeof(e->digest), "%s", digest);
+}
+
+int vine_checksum_cache_load(struct vine_checksum_cache *c, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		if (errno != ENOENT)
+			debug(D_NOTICE, "couldn't open checksum cache %s: %s", filename, strerror(errno));
+		return errno == ENOENT;
+	}
+
+	char line[4096];
+	char digest[MD5_DIGEST_LENGTH_HEX + 1];
+	char path_encoded[sizeof(line)];
+	char path[sizeof(line)];
+	uint64_t inode;
+	int64_t size;
+	long long mtime;
+	int count = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%32s %" SCNu64 " %" SCNd64 " %lld %s", digest, &inode, &size, &mtime, path_encoded) != 5)
+			continue;
+
+		url_decode(path_encoded, path, sizeof(path));
+
+		struct vine_checksum_entry *e = xxmalloc(sizeof(*e));
+		e->inode = inode;
+		e->size = size;
+		e->mtime = mtime;
+		e->racy = 0;
+		e->generation = 0;
+		snprintf(e->digest, sizeof(e->digest), "%s", digest);
+
+		free(hash_table_remove(c->table, path));
+		hash_table_insert(c->table, path, e);
+		count++;
+	}
+
+	fclose(file);
+
+	debug(D_VINE, "loaded %d checksums from %s", count, filename);
+
+	return 1;
+}
+
+int vine_checksum_cache_save(struct vine_checksum_cache *c, const char *filename)
+{
+	char *tmpname = string_format("%s.tmp", filename);
+	FILE *file = fopen(tmpname, "w");
+	if (!file) {
+		debug(D_NOTICE, "couldn't write checksum cache %s: %s", tmpname, strerror(errno));
+		free(tmpname);
+		return 0;
+	}
+
+	char path_encoded[4096];
+	char *path;
+	struct vine_checksum_entry *e;
+
+	HASH_TABLE_ITERATE(c->table, path, e)
+	{
+		if (e->racy)
+			continue;
+		url_encode(path, path_encoded, sizeof(path_encoded));
+		fprintf(file, "%s %" PRIu64 " %" PRId64 " %lld %s\n", e->digest, (uint64_t)e->inode, e->size, (long long)e->mtime, path_encoded);
+	}
+
+	int result = !fclose(file) && !rename(tmpname, filename);
+	if (!result)
+		debug(D_NOTICE, "couldn't write checksum cache %s: %s", filename, strerror(errno));
+
+	free(tmpname);
+	return result;
+}
+
+/*
+Find the regular files below path whose digests are not yet known,
+appending their paths to the list and their sizes to pending_bytes.
+*/
+
+static void vine_checksum_find_pending(struct vine_checksum_cache *c, const char *path, struct list *pending, int64_t *pending_bytes)
+{
+	struct stat info;
+
+	if (lstat(path, &info))
+		return;
+
+	if (S_ISREG(info.st_mode)) {
+		if (!vine_checksum_cache_lookup(c, path, &info)) {
+			list_push_tail(pending, xxstrdup(path));
+			*pending_bytes += info.st_size;
+		}
+	} else if (S_ISDIR(info.st_mode)) {
+		char **entries;
+		if (!sort_dir(path, &entries, strcmp))
+			return;
+		int i;
+		for (i = 0; entries[i]; i++) {
+			if (!strcmp(entries[i], ".") || !strcmp(entries[i], ".."))
+				continue;
+			char *subpath = string_format("%s/%s", path, entries[i]);
+			vine_checksum_find_pending(c, subpath, pending, pending_bytes);
+			free(subpath);
+		}
+		sort_dir_free(entries);
+	}
+}
+
+/*
+Hash every nth file of the array, starting at first,
+and report each result as "index digest" along fd.
+*/
+
+static void vine_checksum_child(char **paths, int npaths, int first, int stride, int fd)
+{
+	int i;
+	for (i = first; i < npaths; i += stride) {
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		if (md5_file(paths[i], digest)) {
+			char *line = string_format("%d %s\n", i, md5_to_string(digest));
+			full_write(fd, line, strlen(line));
+			free(line);
+		}
+	}
+	close(fd);
+	_exit(0);
+}
+
+/*
+Hash the pending files with several processes at once, and record
+the results in the checksum cache.  Files that cannot be hashed
+here are simply left out, and will be hashed serially later.
+*/
+
+static void vine_checksum_parallel(struct vine_checksum_cache *c, struct list *pending, int nprocs)
+{
+	int npaths = list_size(pending);
+	char **paths = xxmalloc(npaths * sizeof(char *));
+	int *fds = xxmalloc(nprocs * sizeof(int));
+	pid_t *pids = xxmalloc(nprocs * sizeof(pid_t));
+
+	int i = 0;
+	char *p;
+	LIST_ITERATE(pending, p)
+	{
+		paths[i++] = p;
+	}
+
+	int started = 0;
+	for (i = 0; i < nprocs; i++) {
+		int pfd[2];
+		if (pipe(pfd) < 0)
+			break;
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(pfd[0]);
+			vine_checksum_child(paths, npaths, i, nprocs, pfd[1]);
+		} else if (pid < 0) {
+			close(pfd[0]);
+			close(pfd[1]);
+			break;
+		}
+
+		close(pfd[1]);
+		fds[started] = pfd[0];
+		pids[started] = pid;
+		started++;
+	}
+
+	/* If not every process could be started, the missing stripes are hashed serially later. */
+
+	for (i = 0; i < started; i++) {
+		FILE *stream = fdopen(fds[i], "r");
+		char line[256];
+		int index;
+		char digest[MD5_DIGEST_LENGTH_HEX + 1];
+
+		while (fgets(line, sizeof(line), stream)) {
+			if (sscanf(line, "%d %32s", &index, digest) == 2 && index >= 0 && index < npaths) {
+				struct stat info;
+				if (!lstat(paths[index], &info))
+					vine_checksum_cache_insert(c, paths[index], &info, digest);
+			}
+		}
+
+		fclose(stream);
+		waitpid(pids[i], 0, 0);
+	}
+
+	debug(D_VINE, "hashed %d files with %d processes", npaths, started);
+
+	free(paths);
+	free(fds);
+	free(pids);
+}
 
 /*
 Compute the recursive hash of a directory by building up a string like this:
@@ -27,17 +315,20 @@ Compute the recursive hash of a directory by building up a string like this:
 And then compute the hash of that string.
 
 Returns an allocated string that must be freed.
-
-XXX For consistency, this should sort the directory entries before hashing.
 */
 
-static char *vine_checksum_dir(const char *path, ssize_t *totalsize)
+static char *vine_checksum_any_internal(struct vine_checksum_cache *c, const char *path, ssize_t *totalsize);
+
+static char *vine_checksum_dir(struct vine_checksum_cache *c, const char *path, ssize_t *totalsize)
 {
-	char *dirstring = xxstrdup("");
+	buffer_t dirstring;
 	char **entries;
 	struct stat info;
 	if (!sort_dir(path, &entries, strcmp))
 		return 0;
+
+	buffer_init(&dirstring);
+
 	int i;
 	for (i = 0; entries[i]; i++) {
 
@@ -47,32 +338,41 @@ static char *vine_checksum_dir(const char *path, ssize_t *totalsize)
 			continue;
 
 		char *subpath = string_format("%s/%s", path, entries[i]);
-		if (stat(subpath, &info))
+		if (stat(subpath, &info)) {
+			free(subpath);
+			sort_dir_free(entries);
+			buffer_free(&dirstring);
 			return 0;
+		}
 
-		char *subhash = vine_checksum_any(subpath, totalsize);
-		char *line = string_format("%s:%o:%s:%s:\n", entries[i], info.st_mode, ctime(&info.st_mtime), subhash);
-
-		dirstring = string_combine(dirstring, line);
+		char *subhash = vine_checksum_any_internal(c, subpath, totalsize);
+		buffer_printf(&dirstring, "%s:%o:%s:%s:\n", entries[i], info.st_mode, ctime(&info.st_mtime), subhash);
 
 		free(subpath);
 		free(subhash);
-		free(line);
 	}
 
 	sort_dir_free(entries);
-	char *result = md5_of_string(dirstring);
+	char *result = md5_of_string(buffer_tostring(&dirstring));
 
-	free(dirstring);
+	buffer_free(&dirstring);
 
 	return result;
 }
 
-static char *vine_checksum_file(const char *path)
+static char *vine_checksum_file(struct vine_checksum_cache *c, const char *path, struct stat *info)
 {
+	const char *cached = vine_checksum_cache_lookup(c, path, info);
+	if (cached)
+		return xxstrdup(cached);
+
 	unsigned char digest[MD5_DIGEST_LENGTH];
-	md5_file(path, digest);
-	return xxstrdup(md5_to_string(digest));
+	if (!md5_file(path, digest))
+		return 0;
+
+	const char *result = md5_to_string(digest);
+	vine_checksum_cache_insert(c, path, info, result);
+	return xxstrdup(result);
 }
 
 static char *vine_checksum_symlink(const char *path, ssize_t linklength)
@@ -90,7 +390,7 @@ static char *vine_checksum_symlink(const char *path, ssize_t linklength)
 	}
 }
 
-char *vine_checksum_any(const char *path, ssize_t *totalsize)
+static char *vine_checksum_any_internal(struct vine_checksum_cache *c, const char *path, ssize_t *totalsize)
 {
 	struct stat info;
 
@@ -98,10 +398,10 @@ char *vine_checksum_any(const char *path, ssize_t *totalsize)
 		return 0;
 
 	if (S_ISDIR(info.st_mode)) {
-		return vine_checksum_dir(path, totalsize);
+		return vine_checksum_dir(c, path, totalsize);
 	} else if (S_ISREG(info.st_mode)) {
 		*totalsize += info.st_size;
-		return vine_checksum_file(path);
+		return vine_checksum_file(c, path, &info);
 	} else if (S_ISLNK(info.st_mode)) {
 		return vine_checksum_symlink(path, info.st_size);
 	} else {
@@ -109,3 +409,86 @@ char *vine_checksum_any(const char *path, ssize_t *totalsize)
 		return 0;
 	}
 }
+
+/* Remembered digests are keyed by absolute path, so they remain valid if the working directory changes. */
+
+static char *vine_checksum_full_path(const char *path)
+{
+	if (path[0] == '/') {
+		return xxstrdup(path);
+	} else {
+		char cwd[PATH_MAX];
+		if (!getcwd(cwd, sizeof(cwd)))
+			return 0;
+		return string_format("%s/%s", cwd, path);
+	}
+}
+
+char *vine_checksum_any(struct vine_checksum_cache *c, const char *path, ssize_t *totalsize)
+{
+	char *fullpath = vine_checksum_full_path(path);
+	if (!fullpath)
+		return 0;
+
+	/* Without a cache, the digests hashed in parallel are kept just for this call. */
+	struct vine_checksum_cache *cache = c ? c : vine_checksum_cache_create();
+	cache->generation++;
+
+	/* Before walking a directory, hash the files not seen before in parallel. */
+	struct stat info;
+	if (!lstat(fullpath, &info) && S_ISDIR(info.st_mode)) {
+		struct list *pending = list_create();
+		int64_t pending_bytes = 0;
+		vine_checksum_find_pending(cache, fullpath, pending, &pending_bytes);
+
+		int nprocs = MIN(load_average_get_cpus(), VINE_CHECKSUM_PARALLEL_MAX_PROCS);
+		if (nprocs > 1 && list_size(pending) >= VINE_CHECKSUM_PARALLEL_MIN_FILES && pending_bytes >= VINE_CHECKSUM_PARALLEL_MIN_BYTES) {
+			vine_checksum_parallel(cache, pending, nprocs);
+		}
+
+		list_clear(pending, free);
+		list_delete(pending);
+	}
+
+	char *result = vine_checksum_any_internal(cache, fullpath, totalsize);
+	free(fullpath);
+
+	if (!c)
+		vine_checksum_cache_delete(cache);
+
+	return result;
+}
+
+char *vine_checksum_lookup(struct vine_checksum_cache *c, const char *path)
+{
+	if (!c)
+		return 0;
+
+	char *fullpath = vine_checksum_full_path(path);
+	if (!fullpath)
+		return 0;
+
+	char *result = 0;
+	struct stat info;
+	if (!lstat(fullpath, &info) && S_ISREG(info.st_mode)) {
+		const char *cached = vine_checksum_cache_lookup(c, fullpath, &info);
+		if (cached)
+			result = xxstrdup(cached);
+	}
+
+	free(fullpath);
+	return result;
+}
+
+void vine_checksum_remember(struct vine_checksum_cache *c, const char *path, struct stat *info, const char *digest)
+{
+	if (!c)
+		return;
+
+	char *fullpath = vine_checksum_full_path(path);
+	if (!fullpath)
+		return;
+
+	vine_checksum_cache_insert(c, fullpath, info, digest);
+	free(fullpath);
+}
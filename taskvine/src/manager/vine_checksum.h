@@ -8,7 +8,30 @@ See the file COPYING for details.
 #define VINE_CHECKSUM_H
 
 #include <sys/types.h>
+#include <sys/stat.h>
 
-char *vine_checksum_any( const char *path, ssize_t *totalsize );
+/* Remembered digests of regular files, kept by each manager. */
+struct vine_checksum_cache;
+
+/* Create an empty cache of file digests. */
+struct vine_checksum_cache *vine_checksum_cache_create( void );
+
+/* Delete a cache of file digests. */
+void vine_checksum_cache_delete( struct vine_checksum_cache *c );
+
+/* Compute the recursive md5 checksum of a file, directory, or symlink, adding the size of regular files to totalsize. The cache may be null. */
+char *vine_checksum_any( struct vine_checksum_cache *c, const char *path, ssize_t *totalsize );
+
+/* Return the remembered digest of a regular file if it has not changed since, or null otherwise. */
+char *vine_checksum_lookup( struct vine_checksum_cache *c, const char *path );
+
+/* Remember the digest of a regular file computed elsewhere, as given by the stat information taken before reading it. */
+void vine_checksum_remember( struct vine_checksum_cache *c, const char *path, struct stat *info, const char *digest );
+
+/* Load remembered file digests from a file written by @ref vine_checksum_cache_save. A missing file is not an error. */
+int vine_checksum_cache_load( struct vine_checksum_cache *c, const char *filename );
+
+/* Save the remembered file digests, so that unchanged files need not be read again in a later run. */
+int vine_checksum_cache_save( struct vine_checksum_cache *c, const char *filename );
 
 #endif
@@ -8,13 +8,16 @@ See the file COPYING for details.
 #include "macros.h"
 #include "vine_blocklist.h"
 #include "vine_manager.h"
+#include "vine_topology.h"
 #include "xxmalloc.h"
 
 #include "debug.h"
+#include "list.h"
 
 struct vine_transfer_pair {
 	struct vine_worker_info *to;
 	struct vine_worker_info *source_worker;
+	struct list *stripe_workers;
 	char *source_url;
 };
 
@@ -23,6 +26,7 @@ static struct vine_transfer_pair *vine_transfer_pair_create(struct vine_worker_i
 	struct vine_transfer_pair *t = malloc(sizeof(struct vine_transfer_pair));
 	t->to = to;
 	t->source_worker = source_worker;
+	t->stripe_workers = 0;
 	t->source_url = source_url ? xxstrdup(source_url) : 0;
 	return t;
 }
@@ -30,6 +34,7 @@ static struct vine_transfer_pair *vine_transfer_pair_create(struct vine_worker_i
 static void vine_transfer_pair_delete(struct vine_transfer_pair *p)
 {
 	if (p) {
+		list_delete(p->stripe_workers);
 		free(p->source_url);
 		free(p);
 	}
@@ -48,6 +53,37 @@ char *vine_current_transfers_add(struct vine_manager *q, struct vine_worker_info
 	return transfer_id;
 }
 
+// add another source worker to a transaction that fetches ranges of a file from several peers
+void vine_current_transfers_add_source(struct vine_manager *q, const char *id, struct vine_worker_info *source_worker)
+{
+	struct vine_transfer_pair *t = hash_table_lookup(q->current_transfer_table, id);
+	if (!t)
+		return;
+
+	if (!t->stripe_workers)
+		t->stripe_workers = list_create();
+
+	list_push_tail(t->stripe_workers, source_worker);
+}
+
+// true if a worker is one of the sources of a transaction
+static int vine_transfer_pair_has_source(struct vine_transfer_pair *t, struct vine_worker_info *w)
+{
+	if (t->source_worker == w)
+		return 1;
+
+	if (t->stripe_workers) {
+		struct vine_worker_info *s;
+		LIST_ITERATE(t->stripe_workers, s)
+		{
+			if (s == w)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
 // remove a completed transaction from the transfer table - i.e. open the source to an additional transfer
 int vine_current_transfers_remove(struct vine_manager *q, const char *id)
 {
@@ -152,6 +188,14 @@ void vine_current_transfers_set_success(struct vine_manager *q, char *id)
 		source->xfer_total_good_source_counter++;
 	}
 
+	if (p->stripe_workers) {
+		LIST_ITERATE(p->stripe_workers, source)
+		{
+			source->xfer_streak_bad_source_counter = 0;
+			source->xfer_total_good_source_counter++;
+		}
+	}
+
 	struct vine_worker_info *to = p->to;
 	if (to) {
 		vine_blocklist_unblock(q, to->addrport);
@@ -169,12 +213,39 @@ int vine_current_transfers_source_in_use(struct vine_manager *q, struct vine_wor
 	int c = 0;
 	HASH_TABLE_ITERATE(q->current_transfer_table, id, t)
 	{
-		if (source_worker == t->source_worker)
+		if (vine_transfer_pair_has_source(t, source_worker))
 			c++;
 	}
 	return c;
 }
 
+// count the number of transfers between workers in different sites
+int vine_current_transfers_cross_site_in_use(struct vine_manager *q)
+{
+	char *id;
+	struct vine_transfer_pair *t;
+	int c = 0;
+	HASH_TABLE_ITERATE(q->current_transfer_table, id, t)
+	{
+		if (t->to && t->source_worker && vine_topology_is_cross_site(t->to, t->source_worker))
+			c++;
+	}
+	return c;
+}
+
+// find the worker serving a transaction, if it is a peer transfer
+struct vine_worker_info *vine_current_transfers_source_worker(struct vine_manager *q, const char *id)
+{
+	struct vine_transfer_pair *t = hash_table_lookup(q->current_transfer_table, id);
+	return t ? t->source_worker : 0;
+}
+
+// true if the manager requested the transaction, rather than the worker creating the file by itself
+int vine_current_transfers_exists(struct vine_manager *q, const char *id)
+{
+	return hash_table_lookup(q->current_transfer_table, id) != 0;
+}
+
 // count the number transfers coming from a specific remote url (not a worker)
 int vine_current_transfers_url_in_use(struct vine_manager *q, const char *source)
 {
@@ -218,7 +289,7 @@ int vine_current_transfers_wipe_worker(struct vine_manager *q, struct vine_worke
 	struct vine_transfer_pair *t;
 	HASH_TABLE_ITERATE(q->current_transfer_table, id, t)
 	{
-		if (t->to == w || t->source_worker == w) {
+		if (t->to == w || vine_transfer_pair_has_source(t, w)) {
 			vine_current_transfers_remove(q, id);
 			removed++;
 		}
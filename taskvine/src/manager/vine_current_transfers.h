@@ -12,6 +12,8 @@ See the file COPYING for details.
 
 char *vine_current_transfers_add(struct vine_manager *q, struct vine_worker_info *to, struct vine_worker_info *source_worker, const char *source_url);
 
+void vine_current_transfers_add_source(struct vine_manager *q, const char *id, struct vine_worker_info *source_worker);
+
 int vine_current_transfers_remove(struct vine_manager *q, const char *id);
 
 int vine_current_transfers_set_failure(struct vine_manager *q, char *id);
@@ -20,6 +22,12 @@ void vine_current_transfers_set_success(struct vine_manager *q, char *id);
 
 int vine_current_transfers_source_in_use(struct vine_manager *q, struct vine_worker_info *source);
 
+int vine_current_transfers_cross_site_in_use(struct vine_manager *q);
+
+struct vine_worker_info *vine_current_transfers_source_worker(struct vine_manager *q, const char *id);
+
+int vine_current_transfers_exists(struct vine_manager *q, const char *id);
+
 int vine_current_transfers_url_in_use(struct vine_manager *q, const char *source);
 
 int vine_current_transfers_dest_in_use(struct vine_manager *q,struct vine_worker_info *w);
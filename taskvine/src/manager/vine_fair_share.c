@@ -0,0 +1,342 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_fair_share.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "macros.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Each category is a leaf of a tree whose inner nodes are the groups named
+by the prefixes of category names, with the root as the group of them all.
+Each group keeps its children with ready tasks in a round robin list.
+The child at the head of the list is chosen while its deficit is positive,
+and otherwise is given a quantum in proportion to its weight and moved to
+the tail. Dispatching a task takes its cores from the deficits of its
+category and of all the groups above it.
+*/
+
+struct fair_node {
+	char *name;
+	double weight;
+	double deficit;
+	int active;
+	struct fair_node *parent;
+	struct list *children;
+	struct list *ready;
+};
+
+struct vine_fair_share {
+	struct fair_node *root;
+	struct hash_table *categories;
+	struct hash_table *groups;
+	struct hash_table *weights;
+	struct list *queues;
+	struct fair_node *current;
+	double quantum;
+	int active_categories;
+};
+
+static double fair_task_priority(void *item)
+{
+	struct vine_task *t = item;
+	return t->priority;
+}
+
+static struct fair_node *node_create(struct vine_fair_share *f, const char *name, struct fair_node *parent)
+{
+	struct fair_node *n = xxcalloc(1, sizeof(*n));
+	n->name = xxstrdup(name);
+	n->parent = parent;
+
+	double *weight = hash_table_lookup(f->weights, name);
+	n->weight = weight ? *weight : 1;
+
+	return n;
+}
+
+static struct fair_node *group_lookup(struct vine_fair_share *f, const char *name, int length)
+{
+	if (length <= 0) {
+		return f->root;
+	}
+
+	char *key = strndup(name, length);
+	struct fair_node *n = hash_table_lookup(f->groups, key);
+	if (!n) {
+		const char *slash = memrchr(name, '/', length);
+		n = node_create(f, key, group_lookup(f, name, slash ? slash - name : 0));
+		n->children = list_create();
+		hash_table_insert(f->groups, key, n);
+	}
+	free(key);
+
+	return n;
+}
+
+static struct fair_node *category_lookup(struct vine_fair_share *f, const char *name)
+{
+	struct fair_node *n = hash_table_lookup(f->categories, name);
+	if (!n) {
+		const char *slash = strrchr(name, '/');
+		n = node_create(f, name, group_lookup(f, name, slash ? slash - name : 0));
+		n->ready = list_create();
+		hash_table_insert(f->categories, name, n);
+		list_push_tail(f->queues, n->ready);
+	}
+	return n;
+}
+
+static int node_is_empty(struct fair_node *n)
+{
+	return list_size(n->ready ? n->ready : n->children) == 0;
+}
+
+/* A node starts with no deficit or credit whenever it becomes active. */
+
+static void node_activate(struct vine_fair_share *f, struct fair_node *n)
+{
+	if (n->ready && !n->active) {
+		f->active_categories++;
+	}
+
+	while (n != f->root && !n->active) {
+		n->active = 1;
+		n->deficit = 0;
+		list_push_tail(n->parent->children, n);
+		n = n->parent;
+	}
+}
+
+static void node_deactivate_if_empty(struct vine_fair_share *f, struct fair_node *n)
+{
+	if (n->ready && n->active && node_is_empty(n)) {
+		f->active_categories--;
+	}
+
+	while (n != f->root && n->active && node_is_empty(n)) {
+		list_remove(n->parent->children, n);
+		n->active = 0;
+		n->deficit = 0;
+		n = n->parent;
+	}
+}
+
+struct vine_fair_share *vine_fair_share_create()
+{
+	struct vine_fair_share *f = xxcalloc(1, sizeof(*f));
+	f->categories = hash_table_create(0, 0);
+	f->groups = hash_table_create(0, 0);
+	f->weights = hash_table_create(0, 0);
+	f->queues = list_create();
+	f->quantum = 1;
+
+	f->root = node_create(f, "", 0);
+	f->root->children = list_create();
+
+	return f;
+}
+
+static void node_delete(struct fair_node *n)
+{
+	list_delete(n->children);
+	list_delete(n->ready);
+	free(n->name);
+	free(n);
+}
+
+void vine_fair_share_delete(struct vine_fair_share *f)
+{
+	if (!f)
+		return;
+
+	char *name;
+	struct fair_node *n;
+	HASH_TABLE_ITERATE(f->categories, name, n)
+	{
+		node_delete(n);
+	}
+	HASH_TABLE_ITERATE(f->groups, name, n)
+	{
+		node_delete(n);
+	}
+	node_delete(f->root);
+
+	hash_table_clear(f->weights, free);
+	hash_table_delete(f->weights);
+	hash_table_delete(f->categories);
+	hash_table_delete(f->groups);
+	list_delete(f->queues);
+	free(f);
+}
+
+void vine_fair_share_set_weight(struct vine_fair_share *f, const char *name, double weight)
+{
+	if (weight <= 0) {
+		weight = 1;
+	}
+
+	double *w = hash_table_lookup(f->weights, name);
+	if (!w) {
+		w = xxmalloc(sizeof(*w));
+		hash_table_insert(f->weights, name, w);
+	}
+	*w = weight;
+
+	struct fair_node *n;
+	if ((n = hash_table_lookup(f->categories, name))) {
+		n->weight = weight;
+	}
+	if ((n = hash_table_lookup(f->groups, name))) {
+		n->weight = weight;
+	}
+
+	debug(D_VINE, "fair share: weight of %s is %.2lf", name, weight);
+}
+
+void vine_fair_share_push(struct vine_fair_share *f, struct vine_task *t, int at_head)
+{
+	struct fair_node *n = category_lookup(f, t->category);
+
+	if (at_head) {
+		list_push_head(n->ready, t);
+	} else if (t->priority != 0) {
+		list_push_priority(n->ready, fair_task_priority, t);
+	} else {
+		list_push_tail(n->ready, t);
+	}
+
+	node_activate(f, n);
+}
+
+int vine_fair_share_remove(struct vine_fair_share *f, struct vine_task *t)
+{
+	struct fair_node *n = hash_table_lookup(f->categories, t->category);
+	if (!n || !list_remove(n->ready, t)) {
+		return 0;
+	}
+
+	node_deactivate_if_empty(f, n);
+	return 1;
+}
+
+struct vine_task *vine_fair_share_pop(struct vine_fair_share *f)
+{
+	char *name;
+	struct fair_node *n;
+	HASH_TABLE_ITERATE(f->categories, name, n)
+	{
+		struct vine_task *t = list_pop_head(n->ready);
+		if (t) {
+			node_deactivate_if_empty(f, n);
+			return t;
+		}
+	}
+	return 0;
+}
+
+int vine_fair_share_size(struct vine_fair_share *f)
+{
+	int size = 0;
+	struct list *ready;
+	LIST_ITERATE(f->queues, ready)
+	{
+		size += list_size(ready);
+	}
+	return size;
+}
+
+int vine_fair_share_active(struct vine_fair_share *f)
+{
+	return f->active_categories;
+}
+
+struct list *vine_fair_share_next(struct vine_fair_share *f)
+{
+	struct fair_node *n = f->root;
+
+	while (!n->ready) {
+		struct fair_node *c = list_peek_head(n->children);
+		if (!c) {
+			/* Only the root may be empty, when there are no ready tasks. */
+			f->current = 0;
+			return 0;
+		}
+
+		while (c->deficit <= 0) {
+			c->deficit += c->weight * f->quantum;
+			list_rotate(n->children);
+			c = list_peek_head(n->children);
+		}
+
+		n = c;
+	}
+
+	f->current = n;
+	return n->ready;
+}
+
+void vine_fair_share_charge(struct vine_fair_share *f, double cost)
+{
+	struct fair_node *n = f->current;
+	if (!n)
+		return;
+
+	cost = MAX(cost, 1);
+
+	/* The quantum covers the largest task seen, so a category is chosen within one round of the others. */
+	f->quantum = MAX(f->quantum, cost);
+
+	for (; n != f->root; n = n->parent) {
+		n->deficit -= cost;
+	}
+
+	node_deactivate_if_empty(f, f->current);
+	f->current = 0;
+}
+
+void vine_fair_share_skip(struct vine_fair_share *f)
+{
+	struct fair_node *n = f->current;
+	if (!n)
+		return;
+
+	/* The whole path is moved back, so that the next choice is made from other groups first. */
+	for (; n != f->root; n = n->parent) {
+		if (n->active && list_remove(n->parent->children, n)) {
+			list_push_tail(n->parent->children, n);
+		}
+	}
+
+	node_deactivate_if_empty(f, f->current);
+	f->current = 0;
+}
+
+void vine_fair_share_refresh(struct vine_fair_share *f)
+{
+	char *name;
+	struct fair_node *n;
+	HASH_TABLE_ITERATE(f->categories, name, n)
+	{
+		if (node_is_empty(n)) {
+			node_deactivate_if_empty(f, n);
+		} else {
+			node_activate(f, n);
+		}
+	}
+}
+
+struct list *vine_fair_share_queues(struct vine_fair_share *f)
+{
+	return f->queues;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,73 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_FAIR_SHARE_H
+#define VINE_FAIR_SHARE_H
+
+/*
+The fair share keeps the ready tasks of each category in a queue of its
+own, and chooses the category to dispatch from next by weighted deficit
+round robin, so that each category gets cores in proportion to its
+weight while it has tasks waiting, whatever the order of submission.
+
+Category names are read as a hierarchy split at '/', so that the
+categories "alice/align" and "alice/sort" share the part of "alice"
+with the categories of other users, e.g. "bob/align". Weights may be
+set for a category or for any such group, and default to 1.
+
+Choosing the next category takes time proportional to the depth of the
+hierarchy, not to the number of ready tasks. Once the manager has
+looked at the tasks of the chosen category, it must report whether one
+was dispatched with @ref vine_fair_share_charge, or not with
+@ref vine_fair_share_skip.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_task.h"
+
+#include "list.h"
+
+struct vine_fair_share *vine_fair_share_create();
+void vine_fair_share_delete(struct vine_fair_share *f);
+
+/* Set the weight of a category or group of categories. Weights not positive are reset to 1. */
+void vine_fair_share_set_weight(struct vine_fair_share *f, const char *name, double weight);
+
+/* Add t to the queue of its category by priority, or at the head of the queue if at_head is set. */
+void vine_fair_share_push(struct vine_fair_share *f, struct vine_task *t, int at_head);
+
+/* Remove t from the queue of its category. Returns 1 if t was found. */
+int vine_fair_share_remove(struct vine_fair_share *f, struct vine_task *t);
+
+/* Remove and return any ready task, or null if there are none. */
+struct vine_task *vine_fair_share_pop(struct vine_fair_share *f);
+
+/* Number of ready tasks in all the queues. */
+int vine_fair_share_size(struct vine_fair_share *f);
+
+/* Number of categories with ready tasks. */
+int vine_fair_share_active(struct vine_fair_share *f);
+
+/*
+Return the queue of the category to dispatch from next, or null if
+there are no ready tasks. The caller may rotate the queue and remove
+tasks from it before calling charge or skip.
+*/
+struct list *vine_fair_share_next(struct vine_fair_share *f);
+
+/* A task needing cost cores was dispatched from the queue returned by next. */
+void vine_fair_share_charge(struct vine_fair_share *f, double cost);
+
+/* No task could be dispatched from the queue returned by next, so try the others first. */
+void vine_fair_share_skip(struct vine_fair_share *f);
+
+/* Update the categories with ready tasks, after tasks were removed from the queues directly. */
+void vine_fair_share_refresh(struct vine_fair_share *f);
+
+/* The queues of all categories, for iterating over all the ready tasks. */
+struct list *vine_fair_share_queues(struct vine_fair_share *f);
+
+#endif
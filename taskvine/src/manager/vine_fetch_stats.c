@@ -0,0 +1,159 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_fetch_stats.h"
+
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+
+struct vine_fetch_host {
+	int fetches;
+	int evicted;
+};
+
+struct vine_fetch_file {
+	int64_t size;
+	int64_t fetches;
+	int64_t bytes;
+	int64_t duplicates;
+	int64_t after_eviction;
+	struct hash_table *hosts; /* hostname -> struct vine_fetch_host */
+};
+
+struct vine_fetch_stats {
+	struct hash_table *files; /* cachename -> struct vine_fetch_file */
+};
+
+static void vine_fetch_file_delete(struct vine_fetch_file *f)
+{
+	if (!f) {
+		return;
+	}
+
+	hash_table_clear(f->hosts, free);
+	hash_table_delete(f->hosts);
+	free(f);
+}
+
+struct vine_fetch_stats *vine_fetch_stats_create()
+{
+	struct vine_fetch_stats *s = xxmalloc(sizeof(*s));
+	s->files = hash_table_create(0, 0);
+	return s;
+}
+
+void vine_fetch_stats_delete(struct vine_fetch_stats *s)
+{
+	if (!s) {
+		return;
+	}
+
+	hash_table_clear(s->files, (void *)vine_fetch_file_delete);
+	hash_table_delete(s->files);
+	free(s);
+}
+
+const char *vine_fetch_source_string(vine_fetch_source_t source)
+{
+	switch (source) {
+	case VINE_FETCH_SOURCE_MANAGER:
+		return "MANAGER";
+	case VINE_FETCH_SOURCE_PEER:
+		return "PEER";
+	case VINE_FETCH_SOURCE_URL:
+		return "URL";
+	}
+	return "UNKNOWN";
+}
+
+void vine_fetch_stats_record(struct vine_manager *q, struct vine_worker_info *w, const char *cachename, int64_t size, vine_fetch_source_t source)
+{
+	struct vine_fetch_file *f = hash_table_lookup(q->fetch_stats->files, cachename);
+	if (!f) {
+		f = xxcalloc(1, sizeof(*f));
+		f->hosts = hash_table_create(0, 0);
+		hash_table_insert(q->fetch_stats->files, cachename, f);
+		q->stats->fetch_unique_bytes += size;
+	}
+
+	struct vine_fetch_host *h = hash_table_lookup(f->hosts, w->hostname);
+	if (!h) {
+		h = xxcalloc(1, sizeof(*h));
+		hash_table_insert(f->hosts, w->hostname, h);
+	} else {
+		f->duplicates++;
+		q->stats->fetch_duplicates++;
+		if (h->evicted) {
+			f->after_eviction++;
+			q->stats->fetch_after_eviction++;
+			h->evicted = 0;
+		}
+	}
+
+	h->fetches++;
+	f->size = size;
+	f->fetches++;
+	f->bytes += size;
+
+	q->stats->fetches++;
+	q->stats->fetch_bytes += size;
+
+	switch (source) {
+	case VINE_FETCH_SOURCE_MANAGER:
+		q->stats->fetch_bytes_manager += size;
+		break;
+	case VINE_FETCH_SOURCE_PEER:
+		q->stats->fetch_bytes_peer += size;
+		break;
+	case VINE_FETCH_SOURCE_URL:
+		q->stats->fetch_bytes_url += size;
+		break;
+	}
+}
+
+void vine_fetch_stats_evict(struct vine_manager *q, struct vine_worker_info *w, const char *cachename)
+{
+	struct vine_fetch_file *f = hash_table_lookup(q->fetch_stats->files, cachename);
+	if (!f) {
+		return;
+	}
+
+	struct vine_fetch_host *h = hash_table_lookup(f->hosts, w->hostname);
+	if (h) {
+		h->evicted = 1;
+	}
+}
+
+void vine_fetch_stats_forget(struct vine_manager *q, const char *cachename)
+{
+	vine_fetch_file_delete(hash_table_remove(q->fetch_stats->files, cachename));
+}
+
+struct jx *vine_fetch_stats_to_jx(struct vine_manager *q)
+{
+	struct jx *a = jx_array(0);
+
+	char *cachename;
+	struct vine_fetch_file *f;
+	HASH_TABLE_ITERATE(q->fetch_stats->files, cachename, f)
+	{
+		struct jx *j = jx_object(0);
+		jx_insert_string(j, "cachename", cachename);
+		jx_insert_integer(j, "size", f->size);
+		jx_insert_integer(j, "fetches", f->fetches);
+		jx_insert_integer(j, "bytes", f->bytes);
+		jx_insert_integer(j, "hosts", hash_table_size(f->hosts));
+		jx_insert_integer(j, "duplicates", f->duplicates);
+		jx_insert_integer(j, "after_eviction", f->after_eviction);
+		jx_array_append(a, j);
+	}
+
+	return a;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_FETCH_STATS_H
+#define VINE_FETCH_STATS_H
+
+/*
+Fetch statistics describe how files reach the caches of the workers:
+how many times each file was fetched, how many of those fetches went
+to a host that had already fetched it, possibly after evicting it,
+and whether the bytes came from the manager, a peer, or a url.
+The totals are kept in the vine_stats of the manager, and the
+per-file counts are available with the "fetch_status" request.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+#include "vine_worker_info.h"
+
+#include "jx.h"
+
+typedef enum {
+	VINE_FETCH_SOURCE_MANAGER = 0,
+	VINE_FETCH_SOURCE_PEER,
+	VINE_FETCH_SOURCE_URL,
+} vine_fetch_source_t;
+
+struct vine_fetch_stats *vine_fetch_stats_create();
+void vine_fetch_stats_delete(struct vine_fetch_stats *s);
+
+/* Record that a file of the given size was placed in the cache of a worker. */
+void vine_fetch_stats_record(struct vine_manager *q, struct vine_worker_info *w, const char *cachename, int64_t size, vine_fetch_source_t source);
+
+/* Record that a worker evicted a file it had fetched. */
+void vine_fetch_stats_evict(struct vine_manager *q, struct vine_worker_info *w, const char *cachename);
+
+/* Forget the per-file counts of a file that is no longer declared. The totals are kept. */
+void vine_fetch_stats_forget(struct vine_manager *q, const char *cachename);
+
+/* Name of a source, as written to the transaction log. */
+const char *vine_fetch_source_string(vine_fetch_source_t source);
+
+/* Per-file counts, as an array with one object for each file fetched. */
+struct jx *vine_fetch_stats_to_jx(struct vine_manager *q);
+
+#endif
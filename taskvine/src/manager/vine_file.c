@@ -7,11 +7,14 @@ See the file COPYING for details.
 #include "vine_file.h"
 #include "vine_cached_name.h"
 #include "vine_counters.h"
+#include "vine_manifest.h"
 #include "vine_task.h"
 
 #include "copy_stream.h"
 #include "debug.h"
+#include "list.h"
 #include "path.h"
+#include "string_intern.h"
 #include "stringtools.h"
 #include "timestamp.h"
 #include "unlink_recursive.h"
@@ -64,8 +67,10 @@ int vine_file_delete(struct vine_file *f)
 		}
 
 		vine_task_delete(f->mini_task);
+		list_delete(f->stripe_workers);
+		vine_manifest_delete(f->manifest);
 		free(f->source);
-		free(f->cached_name);
+		string_intern_release(f->cached_name);
 		free(f->data);
 		free(f);
 	}
@@ -73,19 +78,28 @@ int vine_file_delete(struct vine_file *f)
 	return 0;
 }
 
-/* Create a new file object with the given properties. */
+/*
+Create a new file object with the given properties.
+The checksums of the manager, if given, save reading local files again to name them.
+*/
 struct vine_file *vine_file_create(const char *source, const char *cached_name, const char *data, size_t size, vine_file_type_t type, struct vine_task *mini_task,
-		vine_cache_level_t cache_level, vine_file_flags_t flags)
+		vine_cache_level_t cache_level, vine_file_flags_t flags, struct vine_checksum_cache *checksums)
 {
 	struct vine_file *f = xxmalloc(sizeof(*f));
 	memset(f, 0, sizeof(*f));
 
 	f->source = source ? xxstrdup(source) : 0;
 	f->source_worker = 0;
+	f->stripe_workers = 0;
 	f->type = type;
 	f->size = size;
 	f->mini_task = mini_task;
 	f->recovery_task = 0;
+	f->producers = 0;
+	f->recovery_depth = 0;
+	f->consumers = 0;
+	f->fetch_rate = 0;
+	f->fetch_time = 0;
 	f->state = VINE_FILE_STATE_PENDING;
 	f->cache_level = cache_level;
 	f->flags = flags;
@@ -110,7 +124,13 @@ struct vine_file *vine_file_create(const char *source, const char *cached_name,
 		/* This may give us the actual size of the object along the way. */
 		ssize_t totalsize = 0;
 		if (f->cache_level >= VINE_CACHE_LEVEL_WORKER) {
-			f->cached_name = vine_cached_name(f, &totalsize);
+			if (f->flags & VINE_CHECKSUM_ON_TRANSFER) {
+				f->cached_name = vine_pending_name(f, checksums, &totalsize);
+				f->checksum_pending = f->cached_name != 0;
+			}
+			if (!f->cached_name) {
+				f->cached_name = vine_cached_name(f, checksums, &totalsize);
+			}
 		} else {
 			if (f->type == VINE_FILE) {
 				f->cached_name = vine_meta_name(f, &totalsize);
@@ -127,6 +147,13 @@ struct vine_file *vine_file_create(const char *source, const char *cached_name,
 		}
 	}
 
+	/* The cached name is shared with the manager and worker tables keyed by it. */
+	if (f->cached_name) {
+		char *name = f->cached_name;
+		f->cached_name = (char *)string_intern(name);
+		free(name);
+	}
+
 	f->refcount = 1;
 	vine_counters.file.created++;
 
@@ -220,19 +247,19 @@ int vine_file_has_changed(struct vine_file *f)
 	return 0;
 }
 
-struct vine_file *vine_file_local(const char *source, vine_cache_level_t cache, vine_file_flags_t flags)
+struct vine_file *vine_file_local(const char *source, vine_cache_level_t cache, vine_file_flags_t flags, struct vine_checksum_cache *checksums)
 {
-	return vine_file_create(source, 0, 0, 0, VINE_FILE, 0, cache, flags);
+	return vine_file_create(source, 0, 0, 0, VINE_FILE, 0, cache, flags, checksums);
 }
 
-struct vine_file *vine_file_url(const char *source, vine_cache_level_t cache, vine_file_flags_t flags)
+struct vine_file *vine_file_url(const char *source, vine_cache_level_t cache, vine_file_flags_t flags, struct vine_checksum_cache *checksums)
 {
-	return vine_file_create(source, 0, 0, 0, VINE_URL, 0, cache, flags);
+	return vine_file_create(source, 0, 0, 0, VINE_URL, 0, cache, flags, checksums);
 }
 
 struct vine_file *vine_file_substitute_url(struct vine_file *f, const char *source, struct vine_worker_info *w)
 {
-	struct vine_file *sub = vine_file_create(source, f->cached_name, 0, f->size, VINE_URL, 0, 0, 0);
+	struct vine_file *sub = vine_file_create(source, f->cached_name, 0, f->size, VINE_URL, 0, 0, 0, 0);
 	sub->source_worker = w;
 	return sub;
 }
@@ -242,18 +269,18 @@ struct vine_file *vine_file_temp()
 	// temp files are always cached at workers until explicitely removed.
 	vine_cache_level_t cache = VINE_CACHE_LEVEL_WORKFLOW;
 
-	return vine_file_create("temp", 0, 0, 0, VINE_TEMP, 0, cache, 0);
+	return vine_file_create("temp", 0, 0, 0, VINE_TEMP, 0, cache, 0, 0);
 }
 
 struct vine_file *vine_file_buffer(const char *data, size_t size, vine_cache_level_t cache, vine_file_flags_t flags)
 {
-	return vine_file_create("buffer", 0, data, size, VINE_BUFFER, 0, cache, flags);
+	return vine_file_create("buffer", 0, data, size, VINE_BUFFER, 0, cache, flags, 0);
 }
 
 struct vine_file *vine_file_mini_task(struct vine_task *t, const char *name, vine_cache_level_t cache, vine_file_flags_t flags)
 {
 	flags |= VINE_PEER_NOSHARE; // we don't know how to share mini tasks yet.
-	return vine_file_create(name, 0, 0, 0, VINE_MINI_TASK, t, cache, flags);
+	return vine_file_create(name, 0, 0, 0, VINE_MINI_TASK, t, cache, flags, 0);
 }
 
 struct vine_file *vine_file_untar(struct vine_file *f, vine_cache_level_t cache, vine_file_flags_t flags)
@@ -263,13 +290,23 @@ struct vine_file *vine_file_untar(struct vine_file *f, vine_cache_level_t cache,
 	return vine_file_mini_task(t, "output", cache, flags);
 }
 
+/*
+A poncho package is either a tarball, in any compression that tar detects
+(e.g. gzip or zstd), or an environment directory that was already unpacked.
+A directory is linked into the sandbox, so it becomes the output without
+copying or extracting any data, unless it was staged in as a symlink.
+*/
+
 struct vine_file *vine_file_poncho(struct vine_file *f, vine_cache_level_t cache, vine_file_flags_t flags)
 {
-	char *cmd = string_format("mkdir output && tar xf package.tar.gz -C output && output/bin/run_in_env");
+	char *cmd = string_format(
+			"if [ -L package ]; then cp -R package/ output; "
+			"elif [ -d package ]; then mv package output; "
+			"else mkdir output && tar xf package -C output; fi && output/bin/run_in_env");
 	struct vine_task *t = vine_task_create(cmd);
 	free(cmd);
 
-	vine_task_add_input(t, f, "package.tar.gz", 0);
+	vine_task_add_input(t, f, "package", 0);
 	return vine_file_mini_task(t, "output", cache, flags);
 }
 
@@ -307,7 +344,7 @@ struct vine_file *vine_file_xrootd(const char *source, struct vine_file *proxy,
 	if (!proxy) {
 		char *proxy_filename = find_x509_proxy();
 		if (proxy_filename) {
-			proxy = vine_file_local(proxy_filename, VINE_CACHE_LEVEL_WORKFLOW, 0);
+			proxy = vine_file_local(proxy_filename, VINE_CACHE_LEVEL_WORKFLOW, 0, 0);
 			free(proxy_filename);
 		}
 	}
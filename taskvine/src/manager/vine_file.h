@@ -21,6 +21,9 @@ This module is private to the manager and should not be invoked by the end user.
 */
 
 #include "taskvine.h"
+#include "vine_checksum.h"
+
+#include "timestamp.h"
 
 #include <sys/types.h>
 
@@ -41,12 +44,20 @@ struct vine_file {
 	char *data;         // Raw data for an input or output buffer.
 	struct vine_task *mini_task; // Mini task used to generate the desired output file.
 	struct vine_task *recovery_task; // For temp files, a copy of the task that created it.
+	int producers;      // For temp files, number of submitted tasks that create it and have not yet completed.
+	int recovery_depth; // For temp files, the longest chain of temp files to recreate if it is lost, itself included.
+	int consumers;      // For temp files, number of submitted tasks that use it and have not yet completed.
+	double fetch_rate;  // For temp files, fetches by tasks at other workers, decayed over time since fetch_time.
+	timestamp_t fetch_time; // For temp files, time of the last fetch counted in fetch_rate.
 	struct vine_worker_info *source_worker; // if this is a substitute file, attach the worker serving it. 
+	struct list *stripe_workers; // if a striped substitute, the other workers serving ranges of it.
 	int change_message_shown; // True if error message already shown.
+	int checksum_pending; // True if cached_name is provisional until the file is checksummed while sent.
+	struct vine_manifest *manifest; // For directories sent by chunks, the manifest computed on the first send.
 	int refcount;       // Number of references from a task object, delete when zero.
 };
 
-struct vine_file * vine_file_create( const char *source, const char *cached_name, const char *data, size_t size, vine_file_type_t type, struct vine_task *mini_task, vine_cache_level_t cache_level, vine_file_flags_t flags);
+struct vine_file * vine_file_create( const char *source, const char *cached_name, const char *data, size_t size, vine_file_type_t type, struct vine_task *mini_task, vine_cache_level_t cache_level, vine_file_flags_t flags, struct vine_checksum_cache *checksums);
 
 struct vine_file * vine_file_substitute_url( struct vine_file *f, const char *source, struct vine_worker_info *w );
 
@@ -59,8 +70,8 @@ int vine_file_has_changed( struct vine_file *f );
 
 char * vine_file_make_file_url( const char * source);
 
-struct vine_file *vine_file_local( const char *source, vine_cache_level_t cache, vine_file_flags_t flags );
-struct vine_file *vine_file_url( const char *source, vine_cache_level_t cache, vine_file_flags_t flags );
+struct vine_file *vine_file_local( const char *source, vine_cache_level_t cache, vine_file_flags_t flags, struct vine_checksum_cache *checksums );
+struct vine_file *vine_file_url( const char *source, vine_cache_level_t cache, vine_file_flags_t flags, struct vine_checksum_cache *checksums );
 struct vine_file *vine_file_temp();
 struct vine_file *vine_file_buffer( const char *buffer, size_t size, vine_cache_level_t cache, vine_file_flags_t flags );
 struct vine_file *vine_file_mini_task( struct vine_task *t, const char *name, vine_cache_level_t cache, vine_file_flags_t flags );
@@ -14,9 +14,12 @@ See the file COPYING for details.
 #include "vine_file_replica.h"
 #include "vine_manager.h"
 #include "vine_manager_put.h"
+#include "vine_recovery.h"
+#include "vine_topology.h"
 #include "vine_worker_info.h"
 
 #include "stringtools.h"
+#include "timestamp.h"
 
 #include "debug.h"
 #include "macros.h"
@@ -77,53 +80,146 @@ struct vine_file_replica *vine_file_replica_table_lookup(struct vine_worker_info
 	return hash_table_lookup(w->current_files, cachename);
 }
 
-// find a worker (randomly) in posession of a specific file, and is ready to transfer it.
-struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager *q, const char *cachename)
+// true if a peer holds a ready replica of a file and can serve one more transfer of it.
+static int vine_file_replica_table_source_ready(struct vine_manager *q, struct vine_worker_info *peer, const char *cachename)
+{
+	if (!peer->transfer_port_active)
+		return 0;
+
+	timestamp_t current_time = timestamp_get();
+	if (current_time - peer->last_transfer_failure < q->transient_error_interval) {
+		debug(D_VINE, "Skipping worker source after recent failure : %s", peer->transfer_host);
+		return 0;
+	}
+
+	struct vine_file_replica *replica = hash_table_lookup(peer->current_files, cachename);
+	if (!replica || replica->state != VINE_FILE_REPLICA_STATE_READY)
+		return 0;
+
+	return vine_current_transfers_source_in_use(q, peer) < q->worker_source_max_transfers;
+}
+
+// find a worker in posession of a specific file, and is ready to transfer it to the worker to.
+// Prefer the closest peer to the destination, choosing randomly among equally good ones.
+struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager *q, const char *cachename, struct vine_worker_info *to)
 {
 	struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
 	if (!workers) {
 		return 0;
 	}
 
-	int total_count = set_size(workers);
-	if (total_count < 1) {
+	if (set_size(workers) < 1) {
 		return 0;
 	}
 
-	int random_index = random() % total_count;
-
 	struct vine_worker_info *peer = NULL;
 	struct vine_worker_info *peer_selected = NULL;
-	struct vine_file_replica *replica = NULL;
 
 	int offset_bookkeep;
 	SET_ITERATE_RANDOM_START(workers, offset_bookkeep, peer)
 	{
-		random_index--;
-		if (!peer->transfer_port_active)
+		if (!vine_file_replica_table_source_ready(q, peer, cachename))
 			continue;
 
-		timestamp_t current_time = timestamp_get();
-		if (current_time - peer->last_transfer_failure < q->transient_error_interval) {
-			debug(D_VINE, "Skipping worker source after recent failure : %s", peer->transfer_host);
+		if (vine_topology_cross_site_full(q, to, peer))
 			continue;
-		}
 
-		if ((replica = hash_table_lookup(peer->current_files, cachename)) && replica->state == VINE_FILE_REPLICA_STATE_READY) {
-			int current_transfers = vine_current_transfers_source_in_use(q, peer);
-			if (current_transfers < q->worker_source_max_transfers) {
-				peer_selected = peer;
-				if (random_index < 0) {
-					return peer_selected;
-				}
-			}
+		if (!to)
+			return peer;
+
+		if (vine_topology_prefer(to, peer, peer_selected)) {
+			peer_selected = peer;
+			if (vine_topology_distance(to, peer) == VINE_TOPOLOGY_SAME_HOST)
+				break;
 		}
 	}
 
 	return peer_selected;
 }
 
-// trigger replications of file to satisfy temp_replica_count
+// find up to max workers in posession of a specific file, and ready to transfer it to the worker to,
+// closest first.
+int vine_file_replica_table_find_workers(struct vine_manager *q, const char *cachename, struct vine_worker_info *to, struct vine_worker_info **peers, int max)
+{
+	struct set *workers = hash_table_lookup(q->file_worker_table, cachename);
+	if (!workers) {
+		return 0;
+	}
+
+	int count = 0;
+	struct vine_worker_info *peer = NULL;
+
+	int offset_bookkeep;
+	SET_ITERATE_RANDOM_START(workers, offset_bookkeep, peer)
+	{
+		if (!vine_file_replica_table_source_ready(q, peer, cachename))
+			continue;
+
+		if (vine_topology_cross_site_full(q, to, peer))
+			continue;
+
+		/* Insert in order of preference, dropping the worst if already full. */
+		int i = count < max ? count++ : max;
+		while (i > 0 && vine_topology_prefer(to, peer, peers[i - 1])) {
+			if (i < max)
+				peers[i] = peers[i - 1];
+			i--;
+		}
+		if (i < max)
+			peers[i] = peer;
+	}
+
+	return count;
+}
+
+/* Fetches of a temp file count towards its demand for about this long. */
+#define VINE_FILE_FETCH_WINDOW (60 * USECOND)
+
+/* A worker is short of disk when its cache uses more than this fraction of its disk. */
+#define VINE_FILE_DISK_PRESSURE 0.9
+
+static double fetch_rate_now(struct vine_file *f, timestamp_t now)
+{
+	if (f->fetch_rate <= 0)
+		return 0;
+	return f->fetch_rate * exp(-(double)(now - f->fetch_time) / VINE_FILE_FETCH_WINDOW);
+}
+
+/* Count a fetch of a temp file made to run one of its consumers elsewhere. */
+void vine_file_replica_table_record_fetch(struct vine_file *f)
+{
+	timestamp_t now = timestamp_get();
+	f->fetch_rate = fetch_rate_now(f, now) + 1;
+	f->fetch_time = now;
+}
+
+/*
+The number of replicas wanted for a temp file. Beyond the fixed count,
+with temp-replica-demand a file gets one more replica for each that many
+tasks waiting on it or recently fetching it, up to one per worker.
+*/
+int vine_file_replica_table_replicas_wanted(struct vine_manager *m, struct vine_file *f)
+{
+	int wanted = vine_recovery_replicas_wanted(m, f);
+
+	if (m->temp_replica_demand > 0 && f->type == VINE_TEMP) {
+		double demand = f->consumers + fetch_rate_now(f, timestamp_get());
+		int by_demand = 1 + (int)(demand / m->temp_replica_demand);
+		by_demand = MIN(by_demand, hash_table_size(m->worker_table));
+		wanted = MAX(wanted, by_demand);
+	}
+
+	return wanted;
+}
+
+int vine_file_replica_table_disk_pressure(struct vine_worker_info *w)
+{
+	if (!w->resources || w->resources->disk.total <= 0)
+		return 0;
+	return BYTES_TO_MEGABYTES(w->inuse_cache) > VINE_FILE_DISK_PRESSURE * w->resources->disk.total;
+}
+
+// trigger replications of file to satisfy the replicas wanted
 int vine_file_replica_table_replicate(struct vine_manager *m, struct vine_file *f)
 {
 	/* the number of replicated copies in this round */
@@ -139,7 +235,7 @@ int vine_file_replica_table_replicate(struct vine_manager *m, struct vine_file *
 	}
 
 	int nsources = set_size(sources);
-	int to_find = MIN(m->temp_replica_count - nsources, m->transfer_replica_per_cycle);
+	int to_find = MIN(vine_file_replica_table_replicas_wanted(m, f) - nsources, m->transfer_replica_per_cycle);
 	if (to_find < 1) {
 		return round_replication_count;
 	}
@@ -150,8 +246,9 @@ int vine_file_replica_table_replicate(struct vine_manager *m, struct vine_file *
 	struct vine_worker_info **sources_frozen = (struct vine_worker_info **)set_values(sources);
 	struct vine_worker_info *source;
 
-	int i = 0;
-	for (source = sources_frozen[i]; i < nsources; i++) {
+	int i;
+	for (i = 0; i < nsources; i++) {
+		source = sources_frozen[i];
 		if (round_replication_count >= to_find) {
 			break;
 		}
@@ -166,43 +263,69 @@ int vine_file_replica_table_replicate(struct vine_manager *m, struct vine_file *
 		char *source_addr = string_format("%s/%s", source->transfer_url, f->cached_name);
 		int source_in_use = vine_current_transfers_source_in_use(m, source);
 
-		char *id;
-		struct vine_worker_info *peer;
-		int offset_bookkeep;
-		HASH_TABLE_ITERATE_RANDOM_START(m->worker_table, offset_bookkeep, id, peer)
-		{
-
-			if (found_per_source >= MIN(m->file_source_max_transfers, to_find)) {
-				break;
-			}
-
-			if (source_in_use >= m->worker_source_max_transfers) {
-				break;
-			}
-
-			if (!peer->transfer_port_active) {
-				continue;
-			}
-
-			if (set_lookup(sources, peer)) {
-				continue;
-			}
-
-			if (vine_current_transfers_dest_in_use(m, peer) >= m->worker_source_max_transfers) {
-				continue;
-			}
-
-			if (strcmp(source->hostname, peer->hostname) == 0) {
-				continue;
+		/*
+		Place replicas in the same rack as the source first, then elsewhere in the site, then other sites.
+		Replicas wanted for demand go first to workers with free cores, where the consumers are likely to run.
+		*/
+		int pass;
+		for (pass = m->temp_replica_demand > 0 ? 0 : 1; pass < 2; pass++) {
+			vine_topology_distance_t distance;
+			for (distance = VINE_TOPOLOGY_SAME_RACK; distance <= VINE_TOPOLOGY_REMOTE_SITE; distance++) {
+				char *id;
+				struct vine_worker_info *peer;
+				int offset_bookkeep;
+				HASH_TABLE_ITERATE_RANDOM_START(m->worker_table, offset_bookkeep, id, peer)
+				{
+
+					if (found_per_source >= MIN(m->file_source_max_transfers, to_find)) {
+						break;
+					}
+
+					if (source_in_use >= m->worker_source_max_transfers) {
+						break;
+					}
+
+					if (!peer->transfer_port_active) {
+						continue;
+					}
+
+					if (set_lookup(sources, peer)) {
+						continue;
+					}
+
+					if (pass == 0 && peer->resources->cores.inuse >= peer->resources->cores.total) {
+						continue;
+					}
+
+					if (m->temp_replica_demand > 0 && vine_file_replica_table_disk_pressure(peer)) {
+						continue;
+					}
+
+					if (vine_current_transfers_dest_in_use(m, peer) >= m->worker_source_max_transfers) {
+						continue;
+					}
+
+					if (strcmp(source->hostname, peer->hostname) == 0) {
+						continue;
+					}
+
+					if (vine_topology_distance(source, peer) != distance) {
+						continue;
+					}
+
+					if (vine_topology_cross_site_full(m, peer, source)) {
+						continue;
+					}
+
+					debug(D_VINE, "replicating %s from %s to %s", f->cached_name, source->addrport, peer->addrport);
+
+					vine_manager_put_url_now(m, peer, source, source_addr, f);
+
+					source_in_use++;
+					found_per_source++;
+					round_replication_count++;
+				}
 			}
-
-			debug(D_VINE, "replicating %s from %s to %s", f->cached_name, source->addrport, peer->addrport);
-
-			vine_manager_put_url_now(m, peer, source_addr, f);
-
-			source_in_use++;
-			found_per_source++;
-			round_replication_count++;
 		}
 
 		free(source_addr);
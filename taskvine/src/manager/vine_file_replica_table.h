@@ -25,10 +25,18 @@ int vine_file_worker_table_remove(struct vine_manager *m, struct vine_worker_inf
 
 struct vine_file_replica *vine_file_replica_table_lookup(struct vine_worker_info *w, const char *cachename);
 
-struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager *q, const char *cachename);
+struct vine_worker_info *vine_file_replica_table_find_worker(struct vine_manager *q, const char *cachename, struct vine_worker_info *to);
+
+int vine_file_replica_table_find_workers(struct vine_manager *q, const char *cachename, struct vine_worker_info *to, struct vine_worker_info **peers, int max);
 
 int vine_file_replica_table_replicate(struct vine_manager *q, struct vine_file *f);
 
+int vine_file_replica_table_replicas_wanted(struct vine_manager *q, struct vine_file *f);
+
+void vine_file_replica_table_record_fetch(struct vine_file *f);
+
+int vine_file_replica_table_disk_pressure(struct vine_worker_info *w);
+
 int vine_file_replica_table_exists_somewhere( struct vine_manager *q, const char *cachename );
 
 int vine_file_replica_table_count_replicas( struct vine_manager *q, const char *cachename, vine_file_replica_state_t state );
@@ -0,0 +1,124 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_loop_profile.h"
+
+#include "macros.h"
+#include "quantile_sketch.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+
+/* Times are kept to within 1%, in the manner of an HDR histogram. */
+#define VINE_LOOP_PROFILE_ERROR 0.01
+
+struct vine_loop_phase {
+	int64_t count;
+	timestamp_t total;
+	timestamp_t max;
+	struct quantile_sketch *times;
+};
+
+struct vine_loop_profile {
+	struct vine_loop_phase phases[VINE_LOOP_PHASE_MAX];
+};
+
+static const char *phase_names[VINE_LOOP_PHASE_MAX] = {
+		"poll",
+		"recv_complete",
+		"recv_cache",
+		"recv_status",
+		"recv_other",
+		"schedule",
+		"commit",
+		"retrieve",
+		"catalog",
+		"recovery",
+};
+
+const char *vine_loop_phase_string(vine_loop_phase_t phase)
+{
+	if (phase < 0 || phase >= VINE_LOOP_PHASE_MAX) {
+		return "unknown";
+	}
+	return phase_names[phase];
+}
+
+struct vine_loop_profile *vine_loop_profile_create()
+{
+	struct vine_loop_profile *p = xxcalloc(1, sizeof(*p));
+
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		p->phases[i].times = quantile_sketch_create(VINE_LOOP_PROFILE_ERROR, 0);
+	}
+
+	return p;
+}
+
+void vine_loop_profile_delete(struct vine_loop_profile *p)
+{
+	if (!p) {
+		return;
+	}
+
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		quantile_sketch_delete(p->phases[i].times);
+	}
+
+	free(p);
+}
+
+void vine_loop_profile_end(struct vine_loop_profile *p, vine_loop_phase_t phase, timestamp_t start)
+{
+	timestamp_t now = timestamp_get();
+	timestamp_t elapsed = now > start ? now - start : 0;
+
+	struct vine_loop_phase *ph = &p->phases[phase];
+	ph->count++;
+	ph->total += elapsed;
+	ph->max = MAX(ph->max, elapsed);
+	quantile_sketch_insert(ph->times, elapsed);
+}
+
+void vine_loop_profile_get(struct vine_loop_profile *p, struct vine_loop_phase_stats *s)
+{
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		struct vine_loop_phase *ph = &p->phases[i];
+		s[i].count = ph->count;
+		s[i].time_total = ph->total;
+		s[i].time_p50 = quantile_sketch_quantile(ph->times, 0.50);
+		s[i].time_p90 = quantile_sketch_quantile(ph->times, 0.90);
+		s[i].time_p99 = quantile_sketch_quantile(ph->times, 0.99);
+		s[i].time_max = ph->max;
+	}
+}
+
+struct jx *vine_loop_profile_to_jx(struct vine_loop_profile *p)
+{
+	struct vine_loop_phase_stats s[VINE_LOOP_PHASE_MAX];
+	vine_loop_profile_get(p, s);
+
+	struct jx *j = jx_object(0);
+
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		struct jx *ph = jx_object(0);
+		jx_insert_integer(ph, "count", s[i].count);
+		jx_insert_integer(ph, "time_total", s[i].time_total);
+		jx_insert_integer(ph, "time_p50", s[i].time_p50);
+		jx_insert_integer(ph, "time_p90", s[i].time_p90);
+		jx_insert_integer(ph, "time_p99", s[i].time_p99);
+		jx_insert_integer(ph, "time_max", s[i].time_max);
+		jx_insert(j, jx_string(vine_loop_phase_string(i)), ph);
+	}
+
+	return j;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,34 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_LOOP_PROFILE_H
+#define VINE_LOOP_PROFILE_H
+
+/*
+The loop profile keeps a count, a total, a maximum, and a distribution of
+the time of each phase of the manager loop, so that a drop in throughput
+can be traced to the phase that causes it.  Recording a run of a phase
+costs a clock read and a bucket increment.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "taskvine.h"
+
+#include "jx.h"
+#include "timestamp.h"
+
+struct vine_loop_profile *vine_loop_profile_create();
+void vine_loop_profile_delete(struct vine_loop_profile *p);
+
+/* Record a run of a phase that started at the given time and ends now. */
+void vine_loop_profile_end(struct vine_loop_profile *p, vine_loop_phase_t phase, timestamp_t start);
+
+/* Fill an array of VINE_LOOP_PHASE_MAX statistics, indexed by phase. */
+void vine_loop_profile_get(struct vine_loop_profile *p, struct vine_loop_phase_stats *s);
+
+struct jx *vine_loop_profile_to_jx(struct vine_loop_profile *p);
+
+#endif
@@ -6,10 +6,13 @@ See the file COPYING for details.
 
 #include "vine_manager.h"
 #include "vine_blocklist.h"
+#include "vine_checkpoint.h"
+#include "vine_checksum.h"
 #include "vine_counters.h"
 #include "vine_current_transfers.h"
 #include "vine_factory_info.h"
 #include "vine_fair.h"
+#include "vine_fair_share.h"
 #include "vine_file.h"
 #include "vine_file_replica.h"
 #include "vine_file_replica_table.h"
@@ -17,15 +20,23 @@ See the file COPYING for details.
 #include "vine_manager_get.h"
 #include "vine_manager_put.h"
 #include "vine_manager_summarize.h"
+#include "vine_fetch_stats.h"
+#include "vine_loop_profile.h"
+#include "vine_memory.h"
+#include "vine_metrics.h"
 #include "vine_mount.h"
 #include "vine_perf_log.h"
 #include "vine_protocol.h"
+#include "vine_recovery.h"
+#include "vine_replay_log.h"
+#include "vine_resource_index.h"
 #include "vine_resources.h"
 #include "vine_runtime_dir.h"
 #include "vine_schedule.h"
 #include "vine_task.h"
 #include "vine_task_info.h"
 #include "vine_taskgraph_log.h"
+#include "vine_topology.h"
 #include "vine_txn_log.h"
 #include "vine_worker_info.h"
 
@@ -37,12 +48,14 @@ See the file COPYING for details.
 #include "copy_stream.h"
 #include "create_dir.h"
 #include "debug.h"
+#include "flat_table.h"
 #include "domain_name_cache.h"
 #include "envtools.h"
 #include "hash_table.h"
 #include "int_sizes.h"
 #include "interfaces_address.h"
 #include "itable.h"
+#include "jx_arena.h"
 #include "jx_parse.h"
 #include "jx_print.h"
 #include "link.h"
@@ -52,6 +65,7 @@ See the file COPYING for details.
 #include "macros.h"
 #include "path.h"
 #include "pattern.h"
+#include "priority_queue.h"
 #include "process.h"
 #include "random.h"
 #include "rmonitor.h"
@@ -59,7 +73,9 @@ See the file COPYING for details.
 #include "rmonitor_types.h"
 #include "set.h"
 #include "shell.h"
+#include "string_intern.h"
 #include "stringtools.h"
+#include "timer_wheel.h"
 #include "unlink_recursive.h"
 #include "url_encode.h"
 #include "username.h"
@@ -76,6 +92,7 @@ See the file COPYING for details.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -112,6 +129,24 @@ See the file COPYING for details.
 /* Default value for how frequently to check for tasks that do not fit any worker. */
 #define VINE_LARGE_TASK_CHECK_INTERVAL 180000000 // 3 minutes in usecs
 
+/* Maximum size of messages held for a worker while dispatching tasks. */
+#define VINE_DISPATCH_BUFFER_SIZE (64 * 1024)
+
+/* Size of the buffer that gathers debug messages when all of them are enabled. */
+#define VINE_DEBUG_BUFFER_SIZE (1024 * 1024)
+
+/* Relative error of the task time quantiles used for speculative execution. */
+#define VINE_TASK_TIME_ERROR 0.01
+
+/* Minimum number of completed tasks in a category before its tasks are duplicated. */
+#define VINE_SPECULATIVE_MIN_SAMPLES 10
+
+/* How frequently to look for running tasks to duplicate. */
+#define VINE_SPECULATIVE_CHECK_INTERVAL (5 * ONE_SECOND)
+
+/* Granularity of the timer wheels for task end times and worker keepalives, in usecs. */
+#define VINE_TIMER_RESOLUTION (ONE_SECOND / 10)
+
 /* Default timeout for slow workers to come back to the pool, can be set prior to creating a manager. */
 double vine_option_blocklist_slow_workers_timeout = 900;
 
@@ -126,18 +161,33 @@ static void reset_task_to_state(struct vine_manager *q, struct vine_task *t, vin
 static void count_worker_resources(struct vine_manager *q, struct vine_worker_info *w);
 static vine_result_code_t get_stdout(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, int64_t output_length);
 static vine_result_code_t retrieve_output(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t);
+static vine_result_code_t resume_task_staging(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t);
 
 static void find_max_worker(struct vine_manager *q);
 static void update_max_worker(struct vine_manager *q, struct vine_worker_info *w);
 
 static vine_task_state_t change_task_state(struct vine_manager *q, struct vine_task *t, vine_task_state_t new_state);
 
+static int task_may_be_parked(struct vine_task *t);
+static void park_task_until(struct vine_manager *q, struct vine_task *t, timestamp_t wakeup);
+static void park_task_on_event(struct vine_manager *q, struct vine_task *t, char *key);
+static int unpark_task(struct vine_manager *q, struct vine_task *t);
+static void wake_blocked_tasks_by_name(struct vine_manager *q, const char *kind, const char *name);
+static void wake_deferred_tasks(struct vine_manager *q, timestamp_t now);
+static int ready_task_count(struct vine_manager *q);
+static int ready_list_size(struct vine_manager *q);
+static void remove_from_ready_list(struct vine_manager *q, struct vine_task *t);
+static void insert_task_by_priority(struct vine_manager *q, struct vine_task *t);
+static void enable_fair_share(struct vine_manager *q);
+static void disable_fair_share(struct vine_manager *q);
+
 static int task_state_count(struct vine_manager *q, const char *category, vine_task_state_t state);
+static void unspill_task(struct vine_manager *q, struct vine_task *t);
 static int task_request_count(struct vine_manager *q, const char *category, category_allocation_t request);
 
 static vine_msg_code_t handle_http_request(struct vine_manager *q, struct vine_worker_info *w, const char *path, time_t stoptime);
 static vine_msg_code_t handle_taskvine(struct vine_manager *q, struct vine_worker_info *w, const char *line);
-static vine_msg_code_t handle_manager_status(struct vine_manager *q, struct vine_worker_info *w, const char *line, time_t stoptime);
+static vine_msg_code_t handle_manager_status(struct vine_manager *q, struct vine_worker_info *w, const char *line, int gzip, time_t stoptime);
 static vine_msg_code_t handle_resources(struct vine_manager *q, struct vine_worker_info *w, time_t stoptime);
 static vine_msg_code_t handle_feature(struct vine_manager *q, struct vine_worker_info *w, const char *line);
 static void handle_library_update(struct vine_manager *q, struct vine_worker_info *w, const char *line);
@@ -155,8 +205,9 @@ static void aggregate_workers_resources(
 		struct vine_manager *q, struct vine_resources *rtotal, struct vine_resources *rmin, struct vine_resources *rmax, int64_t *inuse_cache, struct hash_table *features);
 static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout, const char *tag, int task_id);
 static void release_all_workers(struct vine_manager *q);
+static int release_worker(struct vine_manager *q, struct vine_worker_info *w);
 
-static int vine_manager_check_inputs_available(struct vine_manager *q, struct vine_task *t);
+static int vine_manager_check_inputs_available(struct vine_manager *q, struct vine_task *t, struct vine_file **missing);
 static void vine_manager_consider_recovery_task(struct vine_manager *q, struct vine_file *lost_file, struct vine_task *rt);
 
 static void delete_uncacheable_files(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t);
@@ -244,7 +295,14 @@ __attribute__((format(printf, 3, 4))) int vine_manager_send(struct vine_manager
 
 	stoptime = time(0) + q->short_timeout;
 
-	int result = link_putlstring(w->link, buffer_tostring(B), buffer_pos(B), stoptime);
+	int result;
+	if (w->input_stream) {
+		/* The link is busy with the data of an input file, see vine_manager_put.c */
+		vine_manager_put_defer(w, buffer_tostring(B), buffer_pos(B));
+		result = buffer_pos(B);
+	} else {
+		result = link_putlstring(w->link, buffer_tostring(B), buffer_pos(B), stoptime);
+	}
 
 	buffer_free(B);
 
@@ -267,23 +325,34 @@ static vine_msg_code_t handle_name(struct vine_manager *q, struct vine_worker_in
 Handle a timeout request from a worker. Check if the worker has any important data before letting it go.
 */
 
-static void handle_worker_timeout(struct vine_manager *q, struct vine_worker_info *w)
+/* Return the name of a temp file held only by this worker, which would be lost if it left. */
+
+static const char *worker_unique_temp(struct vine_manager *q, struct vine_worker_info *w)
 {
-	// Look at the files and check if any are endangered temps.
 	char *cachename;
 	struct vine_file_replica *replica;
-	// debug(D_VINE, "Handling timeout request");
 	HASH_TABLE_ITERATE(w->current_files, cachename, replica)
 	{
 		if (replica->type == VINE_TEMP) {
 			int c = vine_file_replica_table_count_replicas(q, cachename, VINE_FILE_REPLICA_STATE_READY);
 			if (c == 1) {
-				debug(D_VINE, "Rejecting timeout request from worker %s (%s). Has unique file %s", w->hostname, w->addrport, cachename);
-				return;
+				return cachename;
 			}
 		}
 	}
 
+	return 0;
+}
+
+static void handle_worker_timeout(struct vine_manager *q, struct vine_worker_info *w)
+{
+	// Look at the files and check if any are endangered temps.
+	const char *cachename = worker_unique_temp(q, w);
+	if (cachename) {
+		debug(D_VINE, "Rejecting timeout request from worker %s (%s). Has unique file %s", w->hostname, w->addrport, cachename);
+		return;
+	}
+
 	if (itable_size(w->current_tasks) == 0) {
 		debug(D_VINE, "Accepting timeout request from worker %s (%s).", w->hostname, w->addrport);
 		q->stats->workers_idled_out++;
@@ -293,6 +362,30 @@ static void handle_worker_timeout(struct vine_manager *q, struct vine_worker_inf
 	return;
 }
 
+/*
+An idle worker started with --lend-interval asks to be lent to a busier
+manager of the same project. Unlike an idle timeout, the worker is released
+rather than shut down, so that it connects to the other manager with its cache.
+The request is rejected while this manager has work waiting for workers.
+*/
+
+static void handle_lend_request(struct vine_manager *q, struct vine_worker_info *w, const char *target)
+{
+	if (itable_size(w->current_tasks) > 0 || ready_task_count(q) > 0) {
+		debug(D_VINE, "Rejecting lend request from worker %s (%s) to %s. Tasks are waiting.", w->hostname, w->addrport, target);
+		return;
+	}
+
+	const char *cachename = worker_unique_temp(q, w);
+	if (cachename) {
+		debug(D_VINE, "Rejecting lend request from worker %s (%s) to %s. Has unique file %s", w->hostname, w->addrport, target, cachename);
+		return;
+	}
+
+	debug(D_VINE, "Lending worker %s (%s) to %s.", w->hostname, w->addrport, target);
+	release_worker(q, w);
+}
+
 /* Handle an info message coming from the worker that provides a variety of metrics. */
 
 static vine_msg_code_t handle_info(struct vine_manager *q, struct vine_worker_info *w, char *line)
@@ -309,6 +402,8 @@ static vine_msg_code_t handle_info(struct vine_manager *q, struct vine_worker_in
 		w->dynamic_tasks_running = atoi(value);
 	} else if (string_prefix_is(field, "idle-disconnect-request")) {
 		handle_worker_timeout(q, w);
+	} else if (string_prefix_is(field, "lend-request")) {
+		handle_lend_request(q, w, value);
 	} else if (string_prefix_is(field, "worker-id")) {
 		free(w->workerid);
 		w->workerid = xxstrdup(value);
@@ -319,6 +414,14 @@ static vine_msg_code_t handle_info(struct vine_manager *q, struct vine_worker_in
 		vine_manager_factory_worker_arrive(q, w, value);
 	} else if (string_prefix_is(field, "library-update")) {
 		handle_library_update(q, w, value);
+	} else if (string_prefix_is(field, "usage")) {
+		double cores;
+		int64_t memory;
+		if (sscanf(value, "%lf %" SCNd64, &cores, &memory) == 2) {
+			w->measured_cores = cores;
+			w->measured_memory = memory;
+			w->measured_usage_time = timestamp_get();
+		}
 	}
 
 	// Note we always mark info messages as processed, as they are optional.
@@ -331,59 +434,131 @@ remote transfer or command was successful, and know we know the size
 of the file for the purposes of cache storage management.
 */
 
-static int handle_cache_update(struct vine_manager *q, struct vine_worker_info *w, const char *line)
+static void apply_cache_update(struct vine_manager *q, struct vine_worker_info *w, const char *cachename, int type, int cache_level, int64_t size, int64_t mtime,
+		int64_t transfer_time, int64_t start_time, char *id)
+{
+	struct vine_file_replica *replica = vine_file_replica_table_lookup(w, cachename);
+
+	if (!replica) {
+		/*
+		If an unsolicited cache-update arrives, there are several possibilities:
+		- The worker is telling us about an item from a previous run.
+		- The file was created as an output of a task.
+		*/
+		replica = vine_file_replica_create(type, cache_level, size, mtime);
+		vine_file_replica_table_insert(q, w, cachename, replica);
+	}
+
+	replica->type = type;
+	replica->cache_level = cache_level;
+	replica->size = size;
+	replica->mtime = mtime;
+	replica->transfer_time = transfer_time;
+	replica->state = VINE_FILE_REPLICA_STATE_READY;
+
+	struct vine_worker_info *source_worker = vine_current_transfers_source_worker(q, id);
+	int fetched = vine_current_transfers_exists(q, id);
+	vine_fetch_source_t source = source_worker ? VINE_FETCH_SOURCE_PEER : VINE_FETCH_SOURCE_URL;
+
+	vine_topology_record_transfer(w, source_worker, size, transfer_time);
+
+	vine_current_transfers_set_success(q, id);
+	vine_current_transfers_remove(q, id);
+
+	/* Files created at the worker, or kept from a previous run, were not fetched. */
+	if (fetched) {
+		vine_fetch_stats_record(q, w, cachename, size, source);
+	}
+
+	vine_txn_log_write_cache_update(q, w, size, transfer_time, start_time, cachename, fetched ? vine_fetch_source_string(source) : "LOCAL");
+	if (fetched) {
+		vine_replay_log_write_transfer(q, w, cachename, size, transfer_time);
+	}
+
+	w->resources->disk.inuse += size / 1e6;
+
+	/* If the replica corresponds to a declared file. */
+
+	struct vine_file *f = flat_table_lookup(q->file_table, cachename);
+	if (f) {
+		/* We know it exists and how large it is now. */
+		f->state = VINE_FILE_STATE_CREATED;
+		f->size = size;
+
+		/* And if the file is a newly created temporary, replicate as needed. */
+		if (f->type == VINE_TEMP && *id == 'X' && vine_file_replica_table_replicas_wanted(q, f) > 1) {
+			hash_table_insert(q->temp_files_to_replicate, f->cached_name, NULL);
+		}
+
+		/* Tasks waiting for this file may now be scheduled. */
+		wake_blocked_tasks_by_name(q, "file", f->cached_name);
+	}
+}
+
+/*
+Parse the fields of one cache update, as they follow the cache-update
+keyword or make up one line of a cache-updates message, and apply it.
+Returns false if the fields are malformed.
+*/
+
+static int parse_cache_update(struct vine_manager *q, struct vine_worker_info *w, const char *s)
 {
 	char cachename[VINE_LINE_MAX];
 	int type;
 	int cache_level;
-	long long size;
-	long long mtime;
-	long long transfer_time;
-	long long start_time;
+	int64_t size;
+	int64_t mtime;
+	int64_t transfer_time;
+	int64_t start_time;
 	char id[VINE_LINE_MAX];
 
-	if (sscanf(line, "cache-update %s %d %d %lld %lld %lld %lld %s", cachename, &type, &cache_level, &size, &mtime, &transfer_time, &start_time, id) == 8) {
-		struct vine_file_replica *replica = vine_file_replica_table_lookup(w, cachename);
+	/* Format: cachename type cache_level size mtime transfer_time start_time id */
 
-		if (!replica) {
-			/*
-			If an unsolicited cache-update arrives, there are several possibilities:
-			- The worker is telling us about an item from a previous run.
-			- The file was created as an output of a task.
-			*/
-			replica = vine_file_replica_create(type, cache_level, size, mtime);
-			vine_file_replica_table_insert(q, w, cachename, replica);
-		}
+	if (string_next_word(&s, cachename, sizeof(cachename)) && string_next_int(&s, &type) && string_next_int(&s, &cache_level) && string_next_int64(&s, &size) &&
+			string_next_int64(&s, &mtime) && string_next_int64(&s, &transfer_time) && string_next_int64(&s, &start_time) &&
+			string_next_word(&s, id, sizeof(id))) {
+		apply_cache_update(q, w, cachename, type, cache_level, size, mtime, transfer_time, start_time, id);
+		return 1;
+	}
 
-		replica->type = type;
-		replica->cache_level = cache_level;
-		replica->size = size;
-		replica->mtime = mtime;
-		replica->transfer_time = transfer_time;
-		replica->state = VINE_FILE_REPLICA_STATE_READY;
+	return 0;
+}
+
+static int handle_cache_update(struct vine_manager *q, struct vine_worker_info *w, const char *line)
+{
+	/* Format: cache-update cachename type cache_level size mtime transfer_time start_time id */
+	parse_cache_update(q, w, line + strlen("cache-update"));
 
-		vine_current_transfers_set_success(q, id);
-		vine_current_transfers_remove(q, id);
+	return VINE_MSG_PROCESSED;
+}
 
-		vine_txn_log_write_cache_update(q, w, size, transfer_time, start_time, cachename);
+/*
+A cache-updates message carries several cache updates at once,
+one per following line, as when many transfers complete together
+or a worker reconnects with a cache kept from a previous run.
+*/
 
-		w->resources->disk.inuse += size / 1e6;
+static int handle_cache_updates(struct vine_manager *q, struct vine_worker_info *w, const char *line)
+{
+	int count;
 
-		/* If the replica corresponds to a declared file. */
+	if (sscanf(line, "cache-updates %d", &count) != 1)
+		return VINE_MSG_FAILURE;
 
-		struct vine_file *f = hash_table_lookup(q->file_table, cachename);
-		if (f) {
-			/* We know it exists and how large it is now. */
-			f->state = VINE_FILE_STATE_CREATED;
-			f->size = size;
+	time_t stoptime = time(0) + q->long_timeout;
+	char item[VINE_LINE_MAX];
 
-			/* And if the file is a newly created temporary, replicate as needed. */
-			if (f->type == VINE_TEMP && *id == 'X' && q->temp_replica_count > 1) {
-				hash_table_insert(q->temp_files_to_replicate, f->cached_name, NULL);
-			}
-		}
+	int i;
+	for (i = 0; i < count; i++) {
+		if (link_readline(w->link, item, sizeof(item), stoptime) <= 0)
+			return VINE_MSG_FAILURE;
+
+		if (!parse_cache_update(q, w, item))
+			debug(D_VINE, "%s (%s) sent invalid cache update: %s", w->hostname, w->addrport, item);
 	}
 
+	debug(D_VINE, "%s (%s) updated %d cached items", w->hostname, w->addrport, count);
+
 	return VINE_MSG_PROCESSED;
 }
 
@@ -425,8 +600,10 @@ static int handle_cache_invalid(struct vine_manager *q, struct vine_worker_info
 		free(message);
 
 		/* Remove the replica from our records. */
+		int was_ready = 0;
 		struct vine_file_replica *replica = vine_file_replica_table_remove(q, w, cachename);
 		if (replica) {
+			was_ready = replica->state == VINE_FILE_REPLICA_STATE_READY;
 			vine_file_replica_delete(replica);
 		}
 
@@ -434,9 +611,14 @@ static int handle_cache_invalid(struct vine_manager *q, struct vine_worker_info
 		if (n >= 3) {
 			vine_current_transfers_set_failure(q, transfer_id);
 			vine_current_transfers_remove(q, transfer_id);
-		} else {
-			/* throttle workers that could transfer a file */
+			vine_txn_log_write_cache_invalid(q, w, cachename, "FAILED");
+		} else if (!was_ready) {
+			/* throttle workers that could transfer a file, but not those evicting a file they had. */
 			w->last_failure_time = timestamp_get();
+			vine_txn_log_write_cache_invalid(q, w, cachename, "FAILED");
+		} else {
+			vine_fetch_stats_evict(q, w, cachename);
+			vine_txn_log_write_cache_invalid(q, w, cachename, "EVICTED");
 		}
 
 		/* Successfully processed this message. */
@@ -505,18 +687,24 @@ static vine_result_code_t get_completion_result(struct vine_manager *q, struct v
 	timestamp_t execution_time, start_time, end_time;
 	timestamp_t observed_execution_time;
 
-	// Format: task completion status, exit status (exit code or signal), output length, bytes_sent, execution time,
-	// task_id
-	int n = sscanf(line,
-			"complete %d %d %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 " %" SCNd64 "",
-			&task_status,
-			&exit_status,
-			&output_length,
-			&bytes_sent,
-			&start_time,
-			&end_time,
-			&sandbox_used,
-			&task_id);
+	// Format: task completion status, exit status (exit code or signal), output length, bytes_sent, start time,
+	// end time, sandbox used, task_id
+	int64_t fields[8] = {0};
+	const char *s = line + strlen("complete");
+
+	int n = 0;
+	while (n < 8 && string_next_int64(&s, &fields[n])) {
+		n++;
+	}
+
+	task_status = fields[0];
+	exit_status = fields[1];
+	output_length = fields[2];
+	bytes_sent = fields[3];
+	start_time = fields[4];
+	end_time = fields[5];
+	sandbox_used = fields[6];
+	task_id = fields[7];
 
 	if (n < 7) {
 		debug(D_VINE, "Invalid message from worker %s (%s): %s", w->hostname, w->addrport, line);
@@ -646,15 +834,29 @@ static vine_msg_code_t vine_manager_recv_no_retry(struct vine_manager *q, struct
 	debug(D_VINE, "rx from %s (%s): %s", w->hostname, w->addrport, line);
 
 	char path[length];
+	timestamp_t phase_start = w->last_msg_recv_time;
+	vine_loop_phase_t phase = VINE_LOOP_PHASE_RECV_OTHER;
 
 	// Check for status updates that can be consumed here.
-	if (string_prefix_is(line, "alive")) {
+	// Completions and cache updates are by far the most frequent, so they are checked first.
+	if (string_prefix_is(line, "complete")) {
+		phase = VINE_LOOP_PHASE_RECV_COMPLETE;
+		result = handle_complete(q, w, line);
+	} else if (string_prefix_is(line, "cache-updates")) {
+		phase = VINE_LOOP_PHASE_RECV_CACHE;
+		result = handle_cache_updates(q, w, line);
+	} else if (string_prefix_is(line, "cache-update")) {
+		phase = VINE_LOOP_PHASE_RECV_CACHE;
+		result = handle_cache_update(q, w, line);
+	} else if (string_prefix_is(line, "alive")) {
 		result = VINE_MSG_PROCESSED;
 	} else if (string_prefix_is(line, "taskvine")) {
 		result = handle_taskvine(q, w, line);
 	} else if (string_prefix_is(line, "manager_status") || string_prefix_is(line, "worker_status") || string_prefix_is(line, "task_status") ||
-			string_prefix_is(line, "wable_status") || string_prefix_is(line, "resources_status")) {
-		result = handle_manager_status(q, w, line, stoptime);
+			string_prefix_is(line, "wable_status") || string_prefix_is(line, "resources_status") || string_prefix_is(line, "loop_status") ||
+			string_prefix_is(line, "fetch_status") || string_prefix_is(line, "memory_status")) {
+		phase = VINE_LOOP_PHASE_RECV_STATUS;
+		result = handle_manager_status(q, w, line, 0, stoptime);
 	} else if (string_prefix_is(line, "available_results")) {
 		hash_table_insert(q->workers_with_watched_file_updates, w->hashkey, w);
 		result = VINE_MSG_PROCESSED;
@@ -669,23 +871,25 @@ static vine_msg_code_t vine_manager_recv_no_retry(struct vine_manager *q, struct
 		result = handle_name(q, w, line);
 	} else if (string_prefix_is(line, "info")) {
 		result = handle_info(q, w, line);
-	} else if (string_prefix_is(line, "cache-update")) {
-		result = handle_cache_update(q, w, line);
 	} else if (string_prefix_is(line, "cache-invalid")) {
 		result = handle_cache_invalid(q, w, line);
 	} else if (string_prefix_is(line, "transfer-hostport")) {
 		result = handle_transfer_hostport(q, w, line);
 	} else if (string_prefix_is(line, "transfer-port")) {
 		result = handle_transfer_port(q, w, line);
-	} else if (sscanf(line, "GET %s HTTP/%*d.%*d", path) == 1) {
+	} else if (string_prefix_is(line, "GET ") && sscanf(line, "GET %s HTTP/%*d.%*d", path) == 1) {
+		phase = VINE_LOOP_PHASE_RECV_STATUS;
 		result = handle_http_request(q, w, path, stoptime);
-	} else if (string_prefix_is(line, "complete")) {
-		result = handle_complete(q, w, line);
 	} else {
 		// Message is not a status update: return it to the user.
 		result = VINE_MSG_NOT_PROCESSED;
 	}
 
+	// Messages returned to the caller are timed as part of the phase that reads them.
+	if (result != VINE_MSG_NOT_PROCESSED) {
+		vine_loop_profile_end(q->loop_profile, phase, phase_start);
+	}
+
 	return result;
 }
 
@@ -799,6 +1003,10 @@ static void update_write_catalog(struct vine_manager *q)
 	if (!q->name)
 		return;
 
+	// The status is only built to be printed, so allocate it all in one arena.
+	struct jx_arena *arena = jx_arena_create(0);
+	struct jx_arena *previous_arena = jx_arena_use(arena);
+
 	// Generate the manager status in an jx, and print it to a buffer.
 	struct jx *j = manager_to_jx(q);
 	char *str = jx_print_string(j);
@@ -812,12 +1020,12 @@ static void update_write_catalog(struct vine_manager *q)
 		char *lstr = jx_print_string(lj);
 		catalog_query_send_update(q->catalog_hosts, lstr, CATALOG_UPDATE_BACKGROUND);
 		free(lstr);
-		jx_delete(lj);
 	}
 
 	// Clean up.
 	free(str);
-	jx_delete(j);
+	jx_arena_use(previous_arena);
+	jx_arena_delete(arena);
 }
 
 /* Send and receive updates from the catalog server as needed. */
@@ -833,8 +1041,10 @@ static void update_catalog(struct vine_manager *q, int force_update)
 		q->catalog_hosts = xxstrdup(CATALOG_HOST);
 
 	// Update the catalog.
+	timestamp_t phase_start = timestamp_get();
 	update_write_catalog(q);
 	update_read_catalog(q);
+	vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_CATALOG, phase_start);
 
 	q->catalog_last_update_time = time(0);
 }
@@ -867,7 +1077,7 @@ static void cleanup_worker_files(struct vine_manager *q, struct vine_worker_info
 
 	for (i = 0; i < nfiles; i++) {
 		cached_name = cached_names[i];
-		struct vine_file *f = hash_table_lookup(q->file_table, cached_name);
+		struct vine_file *f = flat_table_lookup(q->file_table, cached_name);
 
 		// check that the manager actually knows about that file, as the file
 		// may correspond to a cache-update of a file that has not been declared
@@ -906,7 +1116,7 @@ static void cleanup_worker(struct vine_manager *q, struct vine_worker_info *w)
 
 		// recreate inputs lost
 		if (q->immediate_recovery) {
-			vine_manager_check_inputs_available(q, t);
+			vine_manager_check_inputs_available(q, t, 0);
 		}
 
 		vine_task_clean(t);
@@ -935,7 +1145,7 @@ static int recover_temp_files(struct vine_manager *q)
 
 	HASH_TABLE_ITERATE_FROM_KEY(q->temp_files_to_replicate, iter_control, iter_count_var, key_start, cached_name, empty_val)
 	{
-		struct vine_file *f = hash_table_lookup(q->file_table, cached_name);
+		struct vine_file *f = flat_table_lookup(q->file_table, cached_name);
 
 		if (f) {
 			int round_replication_count = vine_file_replica_table_replicate(q, f);
@@ -977,7 +1187,7 @@ static void recall_worker_lost_temp_files(struct vine_manager *q, struct vine_wo
 	// Iterate over files we want might want to recover
 	HASH_TABLE_ITERATE(w->current_files, cached_name, info)
 	{
-		struct vine_file *f = hash_table_lookup(q->file_table, cached_name);
+		struct vine_file *f = flat_table_lookup(q->file_table, cached_name);
 
 		if (f && f->type == VINE_TEMP) {
 			hash_table_insert(q->temp_files_to_replicate, cached_name, NULL);
@@ -999,19 +1209,45 @@ void vine_manager_remove_worker(struct vine_manager *q, struct vine_worker_info
 	}
 
 	vine_txn_log_write_worker(q, w, 1, reason);
+	vine_replay_log_write_worker_removed(q, w);
 
 	hash_table_remove(q->worker_table, w->hashkey);
+	vine_topology_remove_worker(q, w);
 	hash_table_remove(q->workers_with_watched_file_updates, w->hashkey);
 	hash_table_remove(q->workers_with_complete_tasks, w->hashkey);
+	hash_table_remove(q->workers_with_output_streams, w->hashkey);
+	hash_table_remove(q->dispatch_workers, w->hashkey);
+	timer_wheel_remove(q->keepalive_timers, (uintptr_t)w);
+
+	vine_manager_abort_output_stream(w);
+	vine_manager_abort_input_stream(w);
 
 	if (q->transfer_temps_recovery) {
 		recall_worker_lost_temp_files(q, w);
 	}
 
+	/* The lost files must be found while the replicas of the worker are known. */
+	struct list *lost_files = 0;
+	if (q->recovery_planning) {
+		lost_files = vine_recovery_plan(q, w);
+	}
+
 	cleanup_worker(q, w);
 
+	if (lost_files) {
+		struct vine_file *f;
+		while ((f = list_pop_head(lost_files))) {
+			vine_manager_consider_recovery_task(q, f, f->recovery_task);
+		}
+		list_delete(lost_files);
+	}
+
 	vine_manager_factory_worker_leave(q, w);
 
+	/* Reaping the tasks of the worker counts its resources again, so it leaves the index after that. */
+	vine_resource_index_remove(q->worker_resource_index, w);
+
+	link_poll_set_remove(q->poll_set, w->link);
 	vine_worker_delete(w);
 
 	/* update the largest worker seen */
@@ -1079,6 +1315,12 @@ static void add_worker(struct vine_manager *q)
 		}
 	}
 
+	if (!link_poll_set_add(q->poll_set, link, LINK_READ)) {
+		debug(D_NOTICE, "Cannot poll connection of worker %s:%d: %s", addr, port, strerror(errno));
+		link_close(link);
+		return;
+	}
+
 	struct vine_worker_info *w = vine_worker_create(link);
 	if (!w) {
 		debug(D_NOTICE, "Cannot allocate memory for worker %s:%d.", addr, port);
@@ -1090,6 +1332,7 @@ static void add_worker(struct vine_manager *q)
 	w->addrport = string_format("%s:%d", addr, port);
 
 	hash_table_insert(q->worker_table, w->hashkey, w);
+	timer_wheel_insert(q->keepalive_timers, (uintptr_t)w, w->start_time, w);
 }
 
 /* Delete a single file on a remote worker except those with greater delete_upto_level cache level */
@@ -1189,22 +1432,21 @@ static void read_measured_resources(struct vine_manager *q, struct vine_task *t)
 	free(summary);
 }
 
-/* Compress old time series files so as to avoid accumulating infinite resource monitoring data. */
+/* Compress the monitor debug log so as to avoid accumulating infinite resource monitoring data.
+ * Time series are already written in the compact binary format, and are kept as they arrive. */
 static void resource_monitor_compress_logs(struct vine_manager *q, struct vine_task *t)
 {
-	char *series = monitor_file_name(q, t, ".series", 1);
 	char *debug_log = monitor_file_name(q, t, ".debug", 1);
 
-	char *command = string_format("gzip -9 -q %s %s", series, debug_log);
+	char *command = string_format("gzip -9 -q %s", debug_log);
 
 	int status;
 	int rc = shellcode(command, NULL, NULL, 0, NULL, NULL, &status);
 
 	if (rc) {
-		debug(D_NOTICE, "Could no successfully compress '%s', and '%s'\n", series, debug_log);
+		debug(D_NOTICE, "Could no successfully compress '%s'\n", debug_log);
 	}
 
-	free(series);
 	free(debug_log);
 	free(command);
 }
@@ -1246,7 +1488,14 @@ void exit_debug_message(struct vine_manager *q, struct vine_worker_info *w, stru
 	return;
 }
 
-static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_info *w, int task_id)
+/*
+Fetch the outputs of a completed task from the worker, and mark it as done.
+Returns 1 if the task was retrieved, 0 if the worker failed and was removed,
+or -1 if an output is still being received in the background, in which case
+handle_output_stream resumes the retrieval once the transfer completes.
+*/
+
+static int fetch_task_outputs(struct vine_manager *q, struct vine_worker_info *w, int task_id)
 {
 	struct vine_task *t;
 	vine_result_code_t result = VINE_SUCCESS;
@@ -1257,7 +1506,10 @@ static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_
 		handle_failure(q, w, t, VINE_WORKER_FAILURE);
 		return 0;
 	}
-	t->time_when_retrieval = timestamp_get();
+
+	if (!t->output_mounts_retrieved) {
+		t->time_when_retrieval = timestamp_get();
+	}
 
 	/* Determine what subset of outputs to retrieve based on status. */
 
@@ -1277,7 +1529,11 @@ static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_
 			result &= retrieve_output(q, w, t);
 			t->output_received = 1;
 		}
-		result &= vine_manager_get_output_files(q, w, t);
+		vine_result_code_t files_result = vine_manager_get_output_files(q, w, t);
+		if (files_result == VINE_RETRIEVAL_PENDING) {
+			return -1;
+		}
+		result &= files_result;
 		break;
 	}
 
@@ -1297,7 +1553,7 @@ static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_
 	if (q->monitor_mode) {
 		read_measured_resources(q, t);
 
-		/* Further, if we got debug and series files, gzip them. */
+		/* Further, if we got a debug file, gzip it. */
 		if (q->monitor_mode & VINE_MON_FULL)
 			resource_monitor_compress_logs(q, t);
 	}
@@ -1343,6 +1599,16 @@ static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_
 	return 1;
 }
 
+/* Fetch the outputs of a task as above, timing the retrieval in the loop profile. */
+
+static int fetch_outputs_from_worker(struct vine_manager *q, struct vine_worker_info *w, int task_id)
+{
+	timestamp_t phase_start = timestamp_get();
+	int result = fetch_task_outputs(q, w, task_id);
+	vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_RETRIEVE, phase_start);
+	return result;
+}
+
 /*
 Consider the set of tasks that are waiting but not running.
 Cancel those that have exceeded their expressed end time,
@@ -1351,23 +1617,24 @@ exceeded the maximum number of retries, or other policy issues.
 
 static int expire_waiting_tasks(struct vine_manager *q)
 {
-	struct vine_task *t;
+	uint64_t task_id;
+	void *unused;
 	int expired = 0;
 
-	int tasks_considered = 0;
-	double current_time = timestamp_get() / ONE_SECOND;
-	while ((t = list_rotate(q->ready_list))) {
-		if (tasks_considered > q->attempt_schedule_depth) {
-			return expired;
+	/* Ready tasks with an end time are kept in a timer wheel, so only those past their end time are visited. */
+	while (timer_wheel_pop_expired(q->task_end_timers, q->loop_time, &task_id, &unused)) {
+		struct vine_task *t = itable_lookup(q->tasks, task_id);
+		if (!t || t->state != VINE_TASK_READY) {
+			continue;
 		}
-		if (t->resources_requested->end > 0 && t->resources_requested->end <= current_time) {
-			vine_task_set_result(t, VINE_RESULT_MAX_END_TIME);
-			list_remove(q->ready_list, t);
-			change_task_state(q, t, VINE_TASK_RETRIEVED);
-			expired++;
+
+		if (!unpark_task(q, t)) {
+			remove_from_ready_list(q, t);
 		}
 
-		tasks_considered++;
+		vine_task_set_result(t, VINE_RESULT_MAX_END_TIME);
+		change_task_state(q, t, VINE_TASK_RETRIEVED);
+		expired++;
 	}
 
 	return expired;
@@ -1383,7 +1650,8 @@ static int enforce_waiting_fixed_locations(struct vine_manager *q)
 	int terminated = 0;
 	int count;
 
-	count = task_state_count(q, NULL, VINE_TASK_READY);
+	/* Tasks with fixed locations are never parked, so they are all in the ready list. */
+	count = list_size(q->ready_list);
 	while (count > 0) {
 		count--;
 
@@ -1397,6 +1665,27 @@ static int enforce_waiting_fixed_locations(struct vine_manager *q)
 		}
 	}
 
+	if (q->fair_share) {
+		struct list *ready;
+		LIST_ITERATE(vine_fair_share_queues(q->fair_share), ready)
+		{
+			count = list_size(ready);
+			while (count > 0) {
+				count--;
+
+				t = list_pop_head(ready);
+				if (t->has_fixed_locations && !vine_schedule_check_fixed_location(q, t)) {
+					vine_task_set_result(t, VINE_RESULT_FIXED_LOCATION_MISSING);
+					change_task_state(q, t, VINE_TASK_RETRIEVED);
+					terminated++;
+				} else {
+					list_push_tail(ready, t);
+				}
+			}
+		}
+		vine_fair_share_refresh(q->fair_share);
+	}
+
 	return terminated;
 }
 
@@ -1493,6 +1782,10 @@ static vine_msg_code_t handle_taskvine(struct vine_manager *q, struct vine_worke
 
 	debug(D_VINE, "%s (%s) running CCTools version %s on %s (operating system) with architecture %s is ready", w->hostname, w->addrport, w->version, w->os, w->arch);
 
+	if (q->worker_usage_interval > 0) {
+		vine_manager_send(q, w, "usage_interval %d\n", q->worker_usage_interval);
+	}
+
 	if (cctools_version_cmp(CCTOOLS_VERSION, w->version) != 0) {
 		debug(D_DEBUG,
 				"Warning: potential worker version mismatch: worker %s (%s) is version %s, and manager is version %s",
@@ -1521,8 +1814,9 @@ static vine_result_code_t get_update(struct vine_manager *q, struct vine_worker_
 	int64_t offset;
 	int64_t length;
 
-	int n = sscanf(line, "update %" PRId64 " %s %" PRId64 " %" PRId64, &task_id, path, &offset, &length);
-	if (n != 4) {
+	const char *s = line + strlen("update");
+
+	if (!string_next_int64(&s, &task_id) || !string_next_word(&s, path, sizeof(path)) || !string_next_int64(&s, &offset) || !string_next_int64(&s, &length)) {
 		debug(D_VINE, "Invalid message from worker %s (%s): %s", w->hostname, w->addrport, line);
 		return VINE_WORKER_FAILURE;
 	}
@@ -1705,6 +1999,11 @@ on watched output files.  Process those results as they come back.
 
 static vine_result_code_t get_available_results(struct vine_manager *q, struct vine_worker_info *w)
 {
+	// The worker cannot answer while a transfer is in progress in the background.
+	if (vine_worker_is_streaming(w)) {
+		return VINE_SUCCESS;
+	}
+
 	// max_count == -1, tells the worker to send all available results.
 	vine_manager_send(q, w, "send_results %d\n", -1);
 	debug(D_VINE, "Reading result(s) from %s (%s)", w->hostname, w->addrport);
@@ -1748,15 +2047,40 @@ static struct rmsummary *total_resources_needed(struct vine_manager *q)
 
 	struct vine_task *t;
 
-	struct rmsummary *total = rmsummary_create(0);
+	/* there may be many waiting tasks, so they are added up as dense vectors. */
+	double sum[RMSUMMARY_VECTOR_SIZE];
+	double v[RMSUMMARY_VECTOR_SIZE];
+	rmsummary_vector_fill(sum, 0);
 
 	/* for waiting tasks, we use what they would request if dispatched right now. */
 	LIST_ITERATE(q->ready_list, t)
 	{
-		const struct rmsummary *s = vine_manager_task_resources_min(q, t);
-		rmsummary_add(total, s);
+		rmsummary_to_vector(vine_manager_task_resources_min(q, t), v);
+		rmsummary_vector_add(sum, v, 1);
+	}
+
+	if (q->fair_share) {
+		struct list *ready;
+		LIST_ITERATE(vine_fair_share_queues(q->fair_share), ready)
+		{
+			LIST_ITERATE(ready, t)
+			{
+				rmsummary_to_vector(vine_manager_task_resources_min(q, t), v);
+				rmsummary_vector_add(sum, v, 1);
+			}
+		}
+	}
+
+	uint64_t task_id;
+	ITABLE_ITERATE(q->ready_parked, task_id, t)
+	{
+		rmsummary_to_vector(vine_manager_task_resources_min(q, t), v);
+		rmsummary_vector_add(sum, v, 1);
 	}
 
+	struct rmsummary *total = rmsummary_create(0);
+	rmsummary_from_vector(total, sum);
+
 	/* for running tasks, we use what they have been allocated already. */
 	char *key;
 	struct vine_worker_info *w;
@@ -2071,6 +2395,8 @@ static struct jx *manager_to_jx(struct vine_manager *q)
 	jx_insert_integer(j, "tasks_done", info.tasks_done);
 	jx_insert_integer(j, "tasks_failed", info.tasks_failed);
 	jx_insert_integer(j, "tasks_cancelled", info.tasks_cancelled);
+	jx_insert_integer(j, "tasks_speculative", info.tasks_speculative);
+	jx_insert_integer(j, "tasks_speculative_won", info.tasks_speculative_won);
 	jx_insert_integer(j, "tasks_exhausted_attempts", info.tasks_exhausted_attempts);
 
 	// tasks_complete is deprecated, but the old vine_status expects it.
@@ -2094,6 +2420,16 @@ static struct jx *manager_to_jx(struct vine_manager *q)
 
 	jx_insert_integer(j, "bytes_sent", info.bytes_sent);
 	jx_insert_integer(j, "bytes_received", info.bytes_received);
+	jx_insert_integer(j, "cache_hits", info.cache_hits);
+	jx_insert_integer(j, "cache_misses", info.cache_misses);
+	jx_insert_integer(j, "fetches", info.fetches);
+	jx_insert_integer(j, "fetch_bytes", info.fetch_bytes);
+	jx_insert_integer(j, "fetch_unique_bytes", info.fetch_unique_bytes);
+	jx_insert_integer(j, "fetch_bytes_manager", info.fetch_bytes_manager);
+	jx_insert_integer(j, "fetch_bytes_peer", info.fetch_bytes_peer);
+	jx_insert_integer(j, "fetch_bytes_url", info.fetch_bytes_url);
+	jx_insert_integer(j, "fetch_duplicates", info.fetch_duplicates);
+	jx_insert_integer(j, "fetch_after_eviction", info.fetch_after_eviction);
 
 	jx_insert_integer(j, "inuse_cache", info.inuse_cache);
 
@@ -2232,6 +2568,10 @@ static void handle_data_index(struct vine_manager *q, struct vine_worker_info *w
 	buffer_printf(&buf, "<li> <a href=\"/task_status\">Task Status</a>\n");
 	buffer_printf(&buf, "<li> <a href=\"/worker_status\">Worker Status</a>\n");
 	buffer_printf(&buf, "<li> <a href=\"/resources_status\">Resources Status</a>\n");
+	buffer_printf(&buf, "<li> <a href=\"/loop_status\">Loop Status</a>\n");
+	buffer_printf(&buf, "<li> <a href=\"/fetch_status\">Fetch Status</a>\n");
+	buffer_printf(&buf, "<li> <a href=\"/memory_status\">Memory Status</a>\n");
+	buffer_printf(&buf, "<li> <a href=\"/metrics\">Metrics</a>\n");
 	buffer_printf(&buf, "</ul>\n");
 
 	vine_manager_send(q, w, buffer_tostring(&buf), buffer_pos(&buf), stoptime);
@@ -2248,11 +2588,14 @@ to the manager to fetch status data.
 static vine_msg_code_t handle_http_request(struct vine_manager *q, struct vine_worker_info *w, const char *path, time_t stoptime)
 {
 	char line[VINE_LINE_MAX];
+	int gzip = 0;
 
-	// Consume (and ignore) the remainder of the headers.
+	// Consume the remainder of the headers, noting whether the client accepts gzip.
 	while (link_readline(w->link, line, VINE_LINE_MAX, stoptime)) {
 		if (line[0] == 0)
 			break;
+		if (!strncasecmp(line, "Accept-Encoding:", 16) && strstr(line, "gzip"))
+			gzip = 1;
 	}
 
 	vine_manager_send(q, w, "HTTP/1.1 200 OK\nConnection: close\n");
@@ -2260,11 +2603,21 @@ static vine_msg_code_t handle_http_request(struct vine_manager *q, struct vine_w
 		// Requests to root get a simple human readable index.
 		vine_manager_send(q, w, "Content-type: text/html\n\n");
 		handle_data_index(q, w, stoptime);
+	} else if (!strcmp(path, "/metrics")) {
+		// Metrics are printed directly in the OpenMetrics text format.
+		buffer_t B;
+		buffer_init(&B);
+		vine_metrics_write(q, &B);
+		vine_manager_send(q, w, "Content-type: " VINE_METRICS_CONTENT_TYPE "\n\n");
+		link_write(w->link, buffer_tostring(&B), buffer_pos(&B), stoptime);
+		buffer_free(&B);
 	} else {
 		// Other requests get raw JSON data.
 		vine_manager_send(q, w, "Access-Control-Allow-Origin: *\n");
+		if (gzip)
+			vine_manager_send(q, w, "Content-Encoding: gzip\n");
 		vine_manager_send(q, w, "Content-type: text/plain\n\n");
-		handle_manager_status(q, w, &path[1], stoptime);
+		handle_manager_status(q, w, &path[1], gzip, stoptime);
 	}
 
 	// Return success but require a disconnect now.
@@ -2313,6 +2666,14 @@ static struct jx *construct_status_message(struct vine_manager *q, const char *r
 	} else if (!strcmp(request, "wable_status") || !strcmp(request, "categories")) {
 		jx_delete(a);
 		a = categories_to_jx(q);
+	} else if (!strcmp(request, "loop_status") || !strcmp(request, "loop")) {
+		jx_array_insert(a, vine_loop_profile_to_jx(q->loop_profile));
+	} else if (!strcmp(request, "fetch_status") || !strcmp(request, "fetches")) {
+		jx_delete(a);
+		a = vine_fetch_stats_to_jx(q);
+	} else if (!strcmp(request, "memory_status") || !strcmp(request, "memory")) {
+		vine_memory_measure(q, 1);
+		jx_array_insert(a, vine_memory_to_jx(q->memory));
 	} else {
 		debug(D_VINE, "Unknown status request: '%s'", request);
 		jx_delete(a);
@@ -2326,7 +2687,7 @@ static struct jx *construct_status_message(struct vine_manager *q, const char *r
 Handle a manager status message by composing a response and sending it.
 */
 
-static vine_msg_code_t handle_manager_status(struct vine_manager *q, struct vine_worker_info *target, const char *line, time_t stoptime)
+static vine_msg_code_t handle_manager_status(struct vine_manager *q, struct vine_worker_info *target, const char *line, int gzip, time_t stoptime)
 {
 	struct link *l = target->link;
 
@@ -2341,7 +2702,11 @@ static vine_msg_code_t handle_manager_status(struct vine_manager *q, struct vine
 		return VINE_MSG_FAILURE;
 	}
 
-	jx_print_link(a, l, stoptime);
+	if (gzip) {
+		jx_print_link_gzip(a, l, stoptime);
+	} else {
+		jx_print_link(a, l, stoptime);
+	}
 	jx_delete(a);
 
 	return VINE_MSG_PROCESSED_DISCONNECT;
@@ -2364,21 +2729,30 @@ static vine_msg_code_t handle_resources(struct vine_manager *q, struct vine_work
 
 		debug(D_VINE, "%s", line);
 
-		if (sscanf(line, "cores %" PRId64, &total)) {
+		char name[VINE_LINE_MAX];
+		const char *s = line;
+
+		if (!string_next_word(&s, name, sizeof(name))) {
+			debug(D_VINE, "unexpected data in resource update!");
+			/* But keep going until we get an "end" */
+		} else if (!strcmp(name, "end")) {
+			/* Stop when we get an end marker. */
+			break;
+		} else if (!string_next_int64(&s, &total)) {
+			debug(D_VINE, "unexpected data in resource update!");
+			/* But keep going until we get an "end" */
+		} else if (!strcmp(name, "cores")) {
 			w->resources->cores.total = total;
-		} else if (sscanf(line, "memory %" PRId64, &total)) {
+		} else if (!strcmp(name, "memory")) {
 			w->resources->memory.total = total;
-		} else if (sscanf(line, "disk %" PRId64, &total)) {
+		} else if (!strcmp(name, "disk")) {
 			w->resources->disk.total = total;
-		} else if (sscanf(line, "gpus %" PRId64, &total)) {
+		} else if (!strcmp(name, "gpus")) {
 			w->resources->gpus.total = total;
-		} else if (sscanf(line, "workers %" PRId64, &total)) {
+		} else if (!strcmp(name, "workers")) {
 			w->resources->workers.total = total;
-		} else if (sscanf(line, "tag %" PRId64, &total)) {
+		} else if (!strcmp(name, "tag")) {
 			w->resources->tag = total;
-		} else if (!strcmp(line, "end")) {
-			/* Stop when we get an end marker. */
-			break;
 		} else {
 			debug(D_VINE, "unexpected data in resource update!");
 			/* But keep going until we get an "end" */
@@ -2388,8 +2762,9 @@ static vine_msg_code_t handle_resources(struct vine_manager *q, struct vine_work
 	/* Update the queue total since one worker changed. */
 	count_worker_resources(q, w);
 
-	/* Record the update into the transaction log. */
+	/* Record the update into the transaction and replay logs. */
 	vine_txn_log_write_worker_resources(q, w);
+	vine_replay_log_write_worker(q, w);
 
 	return VINE_MSG_PROCESSED;
 }
@@ -2418,6 +2793,7 @@ static vine_msg_code_t handle_feature(struct vine_manager *q, struct vine_worker
 	debug(D_VINE, "Feature found: %s\n", fdec);
 
 	hash_table_insert(w->features, fdec, (void **)1);
+	vine_topology_set_feature(w, fdec);
 
 	return VINE_MSG_PROCESSED;
 }
@@ -2428,6 +2804,123 @@ between the link and the vine_worker, then processing on or more
 messages available.
 */
 
+/*
+Advance the output file being received in the background from this worker,
+and once it is complete, resume retrieving the outputs of its task.
+*/
+
+static vine_result_code_t handle_output_stream(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_task *t;
+
+	vine_result_code_t result = vine_manager_get_output_stream(q, w, &t);
+	if (result == VINE_RETRIEVAL_PENDING) {
+		return VINE_SUCCESS;
+	} else if (result == VINE_WORKER_FAILURE) {
+		q->stats->workers_lost++;
+		handle_worker_failure(q, w);
+		return VINE_WORKER_FAILURE;
+	}
+
+	if (t && fetch_outputs_from_worker(q, w, t->task_id) == 1) {
+		/* Retrieve any other tasks that completed in the meantime. */
+		if (w->finished_tasks > 0) {
+			hash_table_insert(q->workers_with_complete_tasks, w->hashkey, w);
+		}
+		vine_manager_factory_worker_prune(q, w);
+	}
+
+	return VINE_SUCCESS;
+}
+
+/*
+Fail the workers whose background output transfer is past its deadline.
+A worker that stalls mid-transfer never makes its link readable again,
+so handle_output_stream alone would wait on it forever.
+*/
+
+static int expire_output_streams(struct vine_manager *q)
+{
+	char *key;
+	struct vine_worker_info *w;
+	int workers_failed = 0;
+	time_t current_time = time(0);
+
+	HASH_TABLE_ITERATE(q->workers_with_output_streams, key, w)
+	{
+		if (vine_manager_output_stream_expired(w, current_time)) {
+			/* handle_worker_failure removes only this entry from the table. */
+			q->stats->workers_lost++;
+			handle_worker_failure(q, w);
+			workers_failed++;
+		}
+	}
+
+	return workers_failed;
+}
+
+/* Watch the link of a worker for writing only while an input is sent in the background. */
+
+static void update_worker_poll_events(struct vine_manager *q, struct vine_worker_info *w)
+{
+	link_poll_set_remove(q->poll_set, w->link);
+	link_poll_set_add(q->poll_set, w->link, w->input_stream ? LINK_READ | LINK_WRITE : LINK_READ);
+}
+
+/*
+Advance the input file being sent in the background to this worker,
+and once it is complete, send the tasks that were waiting on it.
+*/
+
+static vine_result_code_t handle_input_stream(struct vine_manager *q, struct vine_worker_info *w)
+{
+	vine_result_code_t result = vine_manager_put_input_stream(q, w);
+	if (result == VINE_STAGING_PENDING) {
+		return VINE_SUCCESS;
+	} else if (result != VINE_SUCCESS) {
+		q->stats->workers_lost++;
+		handle_worker_failure(q, w);
+		return VINE_WORKER_FAILURE;
+	}
+
+	struct vine_task *t;
+	while (!w->input_stream && (t = list_pop_head(w->staging_tasks))) {
+		result = resume_task_staging(q, w, t);
+		if (result == VINE_STAGING_PENDING) {
+			list_push_head(w->staging_tasks, t);
+		} else if (result != VINE_SUCCESS) {
+			debug(D_VINE, "Failed to send task %d to worker %s (%s).", t->task_id, w->hostname, w->addrport);
+			handle_failure(q, w, t, result);
+			if (result != VINE_APP_FAILURE) {
+				/* The worker was removed. */
+				return VINE_WORKER_FAILURE;
+			}
+		}
+	}
+
+	update_worker_poll_events(q, w);
+
+	/* Retrieve any tasks that completed in the meantime. */
+	if (w->finished_tasks > 0) {
+		hash_table_insert(q->workers_with_complete_tasks, w->hashkey, w);
+	}
+
+	return VINE_SUCCESS;
+}
+
+static vine_result_code_t handle_worker_writable(struct vine_manager *q, struct link *l)
+{
+	char *key = link_to_hash_key(l);
+	struct vine_worker_info *w = hash_table_lookup(q->worker_table, key);
+	free(key);
+
+	if (!w || !w->input_stream) {
+		return VINE_SUCCESS;
+	}
+
+	return handle_input_stream(q, w);
+}
+
 static vine_result_code_t handle_worker(struct vine_manager *q, struct link *l)
 {
 	char line[VINE_LINE_MAX];
@@ -2437,6 +2930,16 @@ static vine_result_code_t handle_worker(struct vine_manager *q, struct link *l)
 	w = hash_table_lookup(q->worker_table, key);
 	free(key);
 
+	// The worker may have been removed while handling messages of another worker.
+	if (!w) {
+		return VINE_SUCCESS;
+	}
+
+	// While an output is received in the background, the link carries only its data.
+	if (w->output_stream) {
+		return handle_output_stream(q, w);
+	}
+
 	vine_msg_code_t mcode;
 	mcode = vine_manager_recv_no_retry(q, w, line, sizeof(line));
 
@@ -2470,58 +2973,9 @@ static vine_result_code_t handle_worker(struct vine_manager *q, struct link *l)
 	return VINE_SUCCESS;
 }
 
-/*
-Construct the table of network links to be considered,
-including the manager's accepting link, and one for
-each active worker.
-*/
-
-static int build_poll_table(struct vine_manager *q)
+static void vine_manager_compute_input_size(struct vine_manager *q, struct vine_task *t)
 {
-	int n = 0;
-	char *key;
-	struct vine_worker_info *w;
-
-	// Allocate a small table, if it hasn't been done yet.
-	if (!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if (!q->poll_table) {
-			// if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
-
-	// The first item in the poll table is the manager link, which accepts new connections.
-	q->poll_table[0].link = q->manager_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
-
-	// For every worker in the hash table, add an item to the poll table
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
-		// If poll table is not large enough, reallocate it
-		if (n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if (q->poll_table == NULL) {
-				// if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
-
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
-	}
-
-	return n;
-}
-
-static void vine_manager_compute_input_size(struct vine_manager *q, struct vine_task *t)
-{
-	t->input_files_size = -1;
+	t->input_files_size = -1;
 
 	int64_t input_size = 0;
 	struct vine_mount *m;
@@ -2718,6 +3172,17 @@ Note that the "infile" and "outfile" components of the task refer to
 files that have already been uploaded into the worker's cache by the manager.
 */
 
+/* Choose the command line sent to the worker, wrapped by the resource monitor if enabled. */
+
+static char *task_command_line(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct rmsummary *limits)
+{
+	if (q->monitor_mode && !t->needs_library && !q->monitor_shared) {
+		return vine_monitor_wrap(q, w, t, limits);
+	} else {
+		return xxstrdup(t->command_line);
+	}
+}
+
 static vine_result_code_t start_one_task(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
 {
 	struct rmsummary *limits = vine_manager_choose_resources_for_task(q, w, t);
@@ -2735,22 +3200,22 @@ static vine_result_code_t start_one_task(struct vine_manager *q, struct vine_wor
 		}
 	}
 
-	char *command_line;
-
-	if (q->monitor_mode && !t->needs_library) {
-		command_line = vine_monitor_wrap(q, w, t, limits);
-	} else {
-		command_line = xxstrdup(t->command_line);
-	}
+	char *command_line = task_command_line(q, w, t, limits);
 
 	vine_result_code_t result = vine_manager_put_task(q, w, t, command_line, limits, 0);
 
 	free(command_line);
 
+	vine_task_ensure_resources(t);
+
 	if (result == VINE_SUCCESS) {
 		t->current_resource_box = limits;
 		rmsummary_merge_override_basic(t->resources_allocated, limits);
 		debug(D_VINE, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
+	} else if (result == VINE_STAGING_PENDING) {
+		/* The resources are held while the inputs are sent, see resume_task_staging. */
+		t->current_resource_box = limits;
+		rmsummary_merge_override_basic(t->resources_allocated, limits);
 	} else {
 		rmsummary_delete(limits);
 	}
@@ -2758,6 +3223,27 @@ static vine_result_code_t start_one_task(struct vine_manager *q, struct vine_wor
 	return result;
 }
 
+/*
+Continue sending a task that was waiting for an input to be sent
+in the background. Its resources were chosen when it was committed.
+*/
+
+static vine_result_code_t resume_task_staging(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+{
+	char *command_line = task_command_line(q, w, t, t->current_resource_box);
+
+	vine_result_code_t result = vine_manager_put_task(q, w, t, command_line, t->current_resource_box, 0);
+
+	free(command_line);
+
+	if (result == VINE_SUCCESS) {
+		t->time_when_commit_end = timestamp_get();
+		debug(D_VINE, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
+	}
+
+	return result;
+}
+
 static void count_worker_resources(struct vine_manager *q, struct vine_worker_info *w)
 {
 	w->resources->cores.inuse = 0;
@@ -2767,10 +3253,20 @@ static void count_worker_resources(struct vine_manager *q, struct vine_worker_in
 
 	update_max_worker(q, w);
 
-	if (w->resources->workers.total < 1) {
+	/*
+	A worker being removed has already left the worker table.  Reaping its
+	tasks counts its resources again, and it must not go back into the
+	index, which would then hold the worker after it is freed.
+	*/
+	if (w->resources->workers.total < 1 || !hash_table_lookup(q->worker_table, w->hashkey)) {
+		vine_resource_index_remove(q->worker_resource_index, w);
 		return;
 	}
 
+	/* Libraries without functions running may be evicted to make room for a task, see check_worker_have_enough_resources. */
+	double idle_library_cores = 0;
+	double idle_library_memory = 0;
+
 	uint64_t task_id;
 	struct vine_task *task;
 
@@ -2783,9 +3279,19 @@ static void count_worker_resources(struct vine_manager *q, struct vine_worker_in
 		w->resources->memory.inuse += box->memory;
 		w->resources->disk.inuse += box->disk;
 		w->resources->gpus.inuse += box->gpus;
+
+		if (task->provides_library && task->function_slots_inuse == 0) {
+			idle_library_cores += box->cores;
+			idle_library_memory += box->memory;
+		}
 	}
 
 	w->resources->disk.inuse += ceil(BYTES_TO_MEGABYTES(w->inuse_cache));
+
+	/* Index the most that a task could find free at this worker. */
+	double free_cores = overcommitted_resource_total(q, w->resources->cores.total) - (w->resources->cores.inuse - idle_library_cores);
+	double free_memory = overcommitted_resource_total(q, w->resources->memory.total) - (w->resources->memory.inuse - idle_library_memory);
+	vine_resource_index_update(q->worker_resource_index, w, free_cores, free_memory);
 }
 
 static void update_max_worker(struct vine_manager *q, struct vine_worker_info *w)
@@ -2861,6 +3367,12 @@ static vine_result_code_t commit_task_to_worker(struct vine_manager *q, struct v
 {
 	vine_result_code_t result = VINE_SUCCESS;
 
+	/* Hold the messages to this worker until the current dispatch is complete. */
+	if (!hash_table_lookup(q->dispatch_workers, w->hashkey)) {
+		link_buffer_output(w->link, VINE_DISPATCH_BUFFER_SIZE);
+		hash_table_insert(q->dispatch_workers, w->hashkey, w);
+	}
+
 	/* Kill unused libraries on this worker to reclaim resources. */
 	/* Matches assumption in vine_schedule.c:check_available_resources() */
 	kill_empty_libraries_on_worker(q, w, t);
@@ -2886,10 +3398,29 @@ static vine_result_code_t commit_task_to_worker(struct vine_manager *q, struct v
 	t->hostname = xxstrdup(w->hostname);
 	t->addrport = xxstrdup(w->addrport);
 
+	if (t->input_mounts) {
+		struct vine_mount *m;
+		LIST_ITERATE(t->input_mounts, m)
+		{
+			if (vine_file_replica_table_lookup(w, m->file->cached_name)) {
+				q->stats->cache_hits++;
+			} else {
+				q->stats->cache_misses++;
+			}
+		}
+	}
+
 	t->time_when_commit_start = timestamp_get();
 	result = start_one_task(q, w, t);
 	t->time_when_commit_end = timestamp_get();
 
+	/* The task is sent once the inputs ahead of it reach the worker, see handle_input_stream. */
+	if (result == VINE_STAGING_PENDING) {
+		list_push_tail(w->staging_tasks, t);
+		update_worker_poll_events(q, w);
+		result = VINE_SUCCESS;
+	}
+
 	itable_insert(w->current_tasks, t->task_id, t);
 	t->worker = w;
 
@@ -3022,6 +3553,9 @@ static void reap_task_from_worker(struct vine_manager *q, struct vine_worker_inf
 	/* Make sure the task and worker agree before changing anything. */
 	assert(t->worker == w);
 
+	vine_manager_release_output_stream(w, t);
+	vine_manager_release_input_stream(w, t);
+
 	w->total_task_time += t->time_workers_execute_last;
 
 	rmsummary_delete(t->current_resource_box);
@@ -3039,6 +3573,10 @@ static void reap_task_from_worker(struct vine_manager *q, struct vine_worker_inf
 		t->library_task->function_slots_inuse = MAX(0, t->library_task->function_slots_inuse - 1);
 	}
 
+	if (new_state == VINE_TASK_RETRIEVED && (t->type == VINE_TASK_TYPE_STANDARD || t->type == VINE_TASK_TYPE_RECOVERY)) {
+		vine_replay_log_write_done(q, w, t);
+	}
+
 	t->worker = 0;
 
 	switch (t->state) {
@@ -3063,6 +3601,7 @@ static void reap_task_from_worker(struct vine_manager *q, struct vine_worker_inf
 	switch (t->type) {
 	case VINE_TASK_TYPE_STANDARD:
 	case VINE_TASK_TYPE_RECOVERY:
+	case VINE_TASK_TYPE_SPECULATIVE:
 		if (new_state != VINE_TASK_RETRIEVED || !resubmit_if_needed(q, w, t)) {
 			change_task_state(q, t, new_state);
 		}
@@ -3089,6 +3628,57 @@ If a file can be fetched from a substitute source,
 this function modifies the file->substitute field to reflect that source.
 */
 
+/*
+Plan a striped peer transfer of a large regular file that several peers hold,
+so that the destination receives a different byte range from each of them at once.
+Returns a substitute file describing the ranges, or null if the file should
+be fetched whole from a single peer.  Peers that turn out to hold a directory
+refuse the ranges, and the destination then fetches the whole object from the first.
+*/
+
+static struct vine_file *vine_manager_plan_stripes(struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f)
+{
+	if (q->peer_stripe_sources < 2)
+		return 0;
+
+	struct vine_worker_info **peers = malloc(q->peer_stripe_sources * sizeof(*peers));
+	int n = vine_file_replica_table_find_workers(q, f->cached_name, w, peers, q->peer_stripe_sources);
+
+	struct vine_file_replica *replica = n > 0 ? vine_file_replica_table_lookup(peers[0], f->cached_name) : 0;
+	int64_t size = replica ? replica->size : 0;
+
+	if (n < 2 || size < q->peer_stripe_min_size) {
+		free(peers);
+		return 0;
+	}
+
+	buffer_t b;
+	buffer_init(&b);
+	buffer_putliteral(&b, "workerstripe://");
+
+	int64_t stripe = size / n;
+	int64_t offset = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		int64_t length = (i == n - 1) ? size - offset : stripe;
+		buffer_printf(&b, "%s%s:%d:%" PRId64 ":%" PRId64, i ? "," : "", peers[i]->transfer_host, peers[i]->transfer_port, offset, length);
+		offset += length;
+	}
+	buffer_printf(&b, "/%s", f->cached_name);
+
+	struct vine_file *sub = vine_file_substitute_url(f, buffer_tostring(&b), peers[0]);
+	sub->stripe_workers = list_create();
+	for (i = 1; i < n; i++) {
+		list_push_tail(sub->stripe_workers, peers[i]);
+	}
+
+	debug(D_VINE, "planned transfer of %s in %d stripes of %" PRId64 " bytes", f->cached_name, n, stripe);
+
+	buffer_free(&b);
+	free(peers);
+	return sub;
+}
+
 static int vine_manager_transfer_capacity_available(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
 {
 	struct vine_mount *m;
@@ -3114,7 +3704,9 @@ static int vine_manager_transfer_capacity_available(struct vine_manager *q, stru
 
 		/* Provide a substitute file object to describe the peer. */
 		if (!(m->file->flags & VINE_PEER_NOSHARE) && (m->file->cache_level > VINE_CACHE_LEVEL_TASK)) {
-			if ((peer = vine_file_replica_table_find_worker(q, m->file->cached_name))) {
+			if ((m->substitute = vine_manager_plan_stripes(q, w, m->file))) {
+				found_match = 1;
+			} else if ((peer = vine_file_replica_table_find_worker(q, m->file->cached_name, w))) {
 				char *peer_source = string_format("%s/%s", peer->transfer_url, m->file->cached_name);
 				m->substitute = vine_file_substitute_url(m->file, peer_source, peer);
 				free(peer_source);
@@ -3174,6 +3766,8 @@ static void vine_manager_create_recovery_tasks(struct vine_manager *q, struct vi
 		return;
 	}
 
+	vine_recovery_set_depth(t);
+
 	LIST_ITERATE(t->output_mounts, m)
 	{
 		if (m->file->type == VINE_TEMP) {
@@ -3230,15 +3824,109 @@ static void vine_manager_consider_recovery_task(struct vine_manager *q, struct v
 	}
 }
 
+/*
+Keep count of the submitted tasks that will produce each temp output of t.
+A task that consumes a temp file may be submitted before its producer completes,
+and waits for the file to be created. When the last producer completes without
+creating the file, the waiting consumers are released so that they fail normally.
+*/
+
+static void vine_manager_count_temp_producers(struct vine_manager *q, struct vine_task *t, int delta)
+{
+	struct vine_mount *m;
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		struct vine_file *f = m->file;
+		if (f->type != VINE_TEMP) {
+			continue;
+		}
+		f->producers = MAX(0, f->producers + delta);
+		if (delta < 0 && f->producers == 0 && f->state == VINE_FILE_STATE_PENDING) {
+			wake_blocked_tasks_by_name(q, "file", f->cached_name);
+		}
+	}
+}
+
+/*
+Drop the replicas of a temp file that no task is waiting on from the workers
+short of disk, keeping as many as would be wanted without consumers.
+*/
+
+static void shed_cold_temp_replicas(struct vine_manager *q, struct vine_file *f)
+{
+	struct set *sources = hash_table_lookup(q->file_worker_table, f->cached_name);
+	if (!sources)
+		return;
+
+	int nready = vine_file_replica_table_count_replicas(q, f->cached_name, VINE_FILE_REPLICA_STATE_READY);
+	int surplus = nready - MAX(1, vine_file_replica_table_replicas_wanted(q, f));
+	if (surplus < 1)
+		return;
+
+	/* Deleting a replica changes the set of sources, so iterate over a copy. */
+	int nsources = set_size(sources);
+	struct vine_worker_info **sources_frozen = (struct vine_worker_info **)set_values(sources);
+
+	int i;
+	for (i = 0; i < nsources && surplus > 0; i++) {
+		struct vine_worker_info *w = sources_frozen[i];
+		struct vine_file_replica *replica = vine_file_replica_table_lookup(w, f->cached_name);
+		if (!replica || replica->state != VINE_FILE_REPLICA_STATE_READY)
+			continue;
+		if (!vine_file_replica_table_disk_pressure(w))
+			continue;
+
+		debug(D_VINE, "dropping surplus replica of %s from %s (%s)", f->cached_name, w->hostname, w->addrport);
+		delete_worker_file(q, w, f->cached_name, 0, 0);
+		surplus--;
+	}
+
+	free(sources_frozen);
+}
+
+/*
+Keep count of the submitted tasks that use each temp input of t, so that
+files waited on by many tasks are replicated more widely. When demand goes up
+for a file already created, it is queued for replication, and when no task
+waits on it anymore, the replicas beyond those wanted may be dropped.
+*/
+
+static void vine_manager_count_temp_consumers(struct vine_manager *q, struct vine_task *t, int delta)
+{
+	struct vine_mount *m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		struct vine_file *f = m->file;
+		if (f->type != VINE_TEMP) {
+			continue;
+		}
+		f->consumers = MAX(0, f->consumers + delta);
+
+		if (q->temp_replica_demand < 1 || f->state != VINE_FILE_STATE_CREATED) {
+			continue;
+		}
+
+		if (delta > 0) {
+			int nreplicas = vine_file_replica_table_count_replicas(q, f->cached_name, VINE_FILE_REPLICA_STATE_READY);
+			if (nreplicas > 0 && vine_file_replica_table_replicas_wanted(q, f) > nreplicas) {
+				hash_table_insert(q->temp_files_to_replicate, f->cached_name, NULL);
+			}
+		} else if (f->consumers == 0) {
+			shed_cold_temp_replicas(q, f);
+		}
+	}
+}
+
 /*
 Determine whether the input files needed for this task are available in some form.
 Most file types (FILE, URL, BUFFER) we can materialize on demand.
 But TEMP files must have been created by a prior task.
+If the producing task has not completed yet, we wait for it.
 If they are no longer present, we cannot run this task,
 and should consider re-creating it via a recovery task.
 */
 
-static int vine_manager_check_inputs_available(struct vine_manager *q, struct vine_task *t)
+static int vine_manager_check_inputs_available(struct vine_manager *q, struct vine_task *t, struct vine_file **missing)
 {
 	struct vine_mount *m;
 	/* all input files are available, if not, consider recovery tasks for them at once */
@@ -3246,9 +3934,17 @@ static int vine_manager_check_inputs_available(struct vine_manager *q, struct vi
 	LIST_ITERATE(t->input_mounts, m)
 	{
 		struct vine_file *f = m->file;
-		if (f->type == VINE_TEMP && f->state == VINE_FILE_STATE_CREATED) {
+		if (f->type == VINE_TEMP && f->state == VINE_FILE_STATE_PENDING && f->producers > 0) {
+			if (all_available && missing) {
+				*missing = f;
+			}
+			all_available = 0;
+		} else if (f->type == VINE_TEMP && f->state == VINE_FILE_STATE_CREATED) {
 			if (!vine_file_replica_table_exists_somewhere(q, f->cached_name)) {
 				vine_manager_consider_recovery_task(q, f, f->recovery_task);
+				if (all_available && missing) {
+					*missing = f;
+				}
 				all_available = 0;
 			}
 		}
@@ -3268,74 +3964,172 @@ static int vine_manager_check_library_for_function_call(struct vine_manager *q,
 }
 
 /*
-Advance the state of the system by selecting one task available
-to run, finding the best worker for that task, and then committing
-the task to the worker.
+Decide whether the task t, just rotated to the tail of the list ready,
+may be dispatched now, and return the best worker for it if so.
+A task that cannot be dispatched for some time is parked instead.
 */
 
-static int send_one_task(struct vine_manager *q)
+static struct vine_worker_info *consider_ready_task(struct vine_manager *q, struct list *ready, struct vine_task *t, timestamp_t now_usecs)
 {
-	struct vine_task *t;
 	struct vine_worker_info *w = NULL;
-
-	int tasks_considered = 0;
-
-	timestamp_t now_usecs = timestamp_get();
 	double now_secs = ((double)now_usecs) / ONE_SECOND;
 
-	int tasks_to_consider = MIN(list_size(q->ready_list), q->attempt_schedule_depth);
+	// Tasks skipped for the reasons below are parked when possible, and so taken
+	// out of the ready list until they could be dispatched. As the task was just
+	// rotated, it is found at the tail of its list.
+	int may_park = task_may_be_parked(t);
 
-	while ((t = list_rotate(q->ready_list))) {
-		if (tasks_considered++ > tasks_to_consider) {
-			return 0;
+	// Skip task if min requested start time not met.
+	if (t->resources_requested->start > now_secs) {
+		if (may_park) {
+			list_pop_tail(ready);
+			park_task_until(q, t, t->resources_requested->start * ONE_SECOND);
 		}
+		return 0;
+	}
 
-		// Skip task if min requested start time not met.
-		if (t->resources_requested->start > now_secs) {
-			continue;
+	// Skip if this task failed recently
+	if (t->time_when_last_failure + q->transient_error_interval > now_usecs) {
+		if (may_park) {
+			list_pop_tail(ready);
+			park_task_until(q, t, t->time_when_last_failure + q->transient_error_interval);
 		}
+		return 0;
+	}
 
-		// Skip if this task failed recently
-		if (t->time_when_last_failure + q->transient_error_interval > now_usecs) {
-			continue;
+	// Skip if category already running maximum allowed tasks
+	struct category *c = vine_category_lookup_or_create(q, t->category);
+	if (c->max_concurrent > -1 && c->max_concurrent < c->vine_stats->tasks_running) {
+		if (may_park) {
+			list_pop_tail(ready);
+			park_task_on_event(q, t, string_format("category:%s", c->name));
 		}
+		return 0;
+	}
 
-		// Skip if category already running maximum allowed tasks
-		struct category *c = vine_category_lookup_or_create(q, t->category);
-		if (c->max_concurrent > -1 && c->max_concurrent < c->vine_stats->tasks_running) {
-			continue;
+	// Skip task if temp input files have not been materialized.
+	struct vine_file *missing = 0;
+	if (!vine_manager_check_inputs_available(q, t, &missing)) {
+		if (may_park) {
+			list_pop_tail(ready);
+			park_task_on_event(q, t, string_format("file:%s", missing->cached_name));
 		}
+		return 0;
+	}
 
-		// Skip task if temp input files have not been materialized.
-		if (!vine_manager_check_inputs_available(q, t)) {
-			continue;
+	// Skip function call task if no suitable library template was installed
+	if (!vine_manager_check_library_for_function_call(q, t)) {
+		if (may_park) {
+			list_pop_tail(ready);
+			park_task_on_event(q, t, string_format("library:%s", t->needs_library));
 		}
+		return 0;
+	}
 
-		// Skip function call task if no suitable library template was installed
-		if (!vine_manager_check_library_for_function_call(q, t)) {
-			continue;
-		}
+	q->stats_measure->time_scheduling = timestamp_get();
 
-		q->stats_measure->time_scheduling = timestamp_get();
+	// Find the best worker for the task
+	w = vine_schedule_task_to_worker(q, t);
+	vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_SCHEDULE, q->stats_measure->time_scheduling);
 
-		// Find the best worker for the task at the head of the list
-		w = vine_schedule_task_to_worker(q, t);
+	if (!w) {
+		return 0;
+	}
 
-		if (!w) {
-			continue;
-		}
+	q->stats->time_scheduling += timestamp_get() - q->stats_measure->time_scheduling;
+
+	// Check if there is transfer capacity available.
+	if (q->peer_transfers_enabled) {
+		if (!vine_manager_transfer_capacity_available(q, w, t))
+			return 0;
+	}
+
+	return w;
+}
+
+/*
+Dispatch one task choosing first the category by fair share, and then
+the task within the queue of the category, in the same way as from the
+ready list. Categories where no task may run now are left for the next.
+*/
+
+static int send_one_task_by_fair_share(struct vine_manager *q, timestamp_t now_usecs)
+{
+	struct vine_task *t;
+	struct vine_worker_info *w;
+	struct list *ready;
+
+	int tasks_considered = 0;
+	int tasks_to_consider = MIN(vine_fair_share_size(q->fair_share), q->attempt_schedule_depth);
+	int categories_to_consider = vine_fair_share_active(q->fair_share);
 
-		q->stats->time_scheduling += timestamp_get() - q->stats_measure->time_scheduling;
+	while (categories_to_consider-- > 0 && (ready = vine_fair_share_next(q->fair_share))) {
+		int count = list_size(ready);
 
-		// Check if there is transfer capacity available.
-		if (q->peer_transfers_enabled) {
-			if (!vine_manager_transfer_capacity_available(q, w, t))
+		while (count-- > 0 && (t = list_rotate(ready))) {
+			if (tasks_considered++ > tasks_to_consider) {
+				vine_fair_share_skip(q->fair_share);
+				return 0;
+			}
+
+			w = consider_ready_task(q, ready, t, now_usecs);
+			if (!w) {
 				continue;
+			}
+
+			list_pop_tail(ready);
+			vine_fair_share_charge(q->fair_share, t->resources_requested->cores);
+			timestamp_t phase_start = timestamp_get();
+			commit_task_to_worker(q, w, t);
+			vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_COMMIT, phase_start);
+			return 1;
+		}
+
+		vine_fair_share_skip(q->fair_share);
+	}
+
+	return 0;
+}
+
+/*
+Advance the state of the system by selecting one task available
+to run, finding the best worker for that task, and then committing
+the task to the worker.
+*/
+
+static int send_one_task(struct vine_manager *q)
+{
+	struct vine_task *t;
+	struct vine_worker_info *w = NULL;
+
+	int tasks_considered = 0;
+
+	timestamp_t now_usecs = q->loop_time;
+
+	// Bring back any parked tasks whose start time has arrived.
+	wake_deferred_tasks(q, now_usecs);
+
+	if (q->fair_share) {
+		return send_one_task_by_fair_share(q, now_usecs);
+	}
+
+	int tasks_to_consider = MIN(list_size(q->ready_list), q->attempt_schedule_depth);
+
+	while ((t = list_rotate(q->ready_list))) {
+		if (tasks_considered++ > tasks_to_consider) {
+			return 0;
+		}
+
+		w = consider_ready_task(q, q->ready_list, t, now_usecs);
+		if (!w) {
+			continue;
 		}
 
 		// Otherwise, remove it from the ready list and start it:
 		list_pop_tail(q->ready_list);
+		timestamp_t phase_start = timestamp_get();
 		commit_task_to_worker(q, w, t);
+		vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_COMMIT, phase_start);
 		return 1;
 	}
 
@@ -3343,6 +4137,43 @@ static int send_one_task(struct vine_manager *q)
 	return 0;
 }
 
+/*
+Dispatch up to dispatch_batch_size tasks in one pass of the main loop.
+Messages to each worker are held while dispatching, so that all the tasks
+sent to the same worker leave in as few writes as possible.
+Returns the number of tasks dispatched.
+*/
+
+static int send_tasks(struct vine_manager *q)
+{
+	int sent = 0;
+
+	while (sent < q->dispatch_batch_size && send_one_task(q)) {
+		sent++;
+	}
+
+	/* Workers removed during the dispatch are no longer in dispatch_workers. */
+	char *key;
+	struct vine_worker_info *w;
+	struct list *failed = list_create();
+
+	HASH_TABLE_ITERATE(q->dispatch_workers, key, w)
+	{
+		if (link_buffer_output(w->link, 0) < 0) {
+			list_push_tail(failed, w);
+		}
+	}
+	hash_table_clear(q->dispatch_workers, 0);
+
+	while ((w = list_pop_head(failed))) {
+		debug(D_VINE, "Failed to send tasks to worker %s (%s).", w->hostname, w->addrport);
+		handle_worker_failure(q, w);
+	}
+	list_delete(failed);
+
+	return sent;
+}
+
 /*
 get available results from a worker. This is typically used for signaling watched files.
 */
@@ -3380,13 +4211,18 @@ static int receive_tasks_from_worker(struct vine_manager *q, struct vine_worker_
 	hash_table_remove(q->workers_with_complete_tasks, w->hashkey);
 	hash_table_firstkey(q->workers_with_complete_tasks);
 
+	/* The worker is busy with a transfer, and is added back when done. */
+	if (vine_worker_is_streaming(w)) {
+		return 0;
+	}
+
 	/* Now consider all tasks assigned to that worker .*/
 	ITABLE_ITERATE(w->current_tasks, task_id, t)
 	{
 		/* If the task is waiting to be retrieved... */
 		if (t->state == VINE_TASK_WAITING_RETRIEVAL) {
 			/* Attempt to fetch it. */
-			if (fetch_outputs_from_worker(q, w, task_id)) {
+			if (fetch_outputs_from_worker(q, w, task_id) == 1) {
 				/* If it was fetched, update stats and keep going. */
 				tasks_received++;
 
@@ -3395,6 +4231,7 @@ static int receive_tasks_from_worker(struct vine_manager *q, struct vine_worker_
 				}
 			} else {
 				/* But if the fetch failed, the worker is no longer vaild, bail out. */
+				/* Or it is sending an output in the background, so come back later. */
 				return tasks_received;
 			}
 		}
@@ -3416,16 +4253,22 @@ static int receive_one_task(struct vine_manager *q)
 {
 	struct vine_task *t;
 
-	if ((t = list_peek_head(q->waiting_retrieval_list))) {
+	LIST_ITERATE(q->waiting_retrieval_list, t)
+	{
 		struct vine_worker_info *w = t->worker;
+		/* Skip workers that are busy with a transfer in the background. */
+		if (vine_worker_is_streaming(w)) {
+			continue;
+		}
 		/* Attempt to fetch from this worker. */
-		if (fetch_outputs_from_worker(q, w, t->task_id)) {
+		if (fetch_outputs_from_worker(q, w, t->task_id) == 1) {
 			/* Consider whether this worker should be removed. */
 			vine_manager_factory_worker_prune(q, w);
 			/* If we got a task, then we are done. */
 			return 1;
 		} else {
 			/* But if not, the worker pointer is no longer valid. */
+			break;
 		}
 	}
 
@@ -3437,55 +4280,76 @@ Sends keepalives to check if connected workers are responsive,
 and ask for updates If not, removes those workers.
 */
 
-static void ask_for_workers_updates(struct vine_manager *q)
+/*
+Check the keepalive state of one worker, sending a check or removing the
+worker as needed. Returns the time at which the worker must be checked
+again, or zero if the worker was removed.
+*/
+
+static timestamp_t check_worker_keepalive(struct vine_manager *q, struct vine_worker_info *w, timestamp_t current_time)
 {
-	struct vine_worker_info *w;
-	char *key;
-	timestamp_t current_time = timestamp_get();
+	/* we have not received taskvine message from worker yet, so we
+	 * simply check again its start_time. */
+	if (!strcmp(w->hostname, "unknown")) {
+		if ((int)((current_time - w->start_time) / 1000000) >= q->keepalive_timeout) {
+			debug(D_VINE, "Removing worker %s (%s): hasn't sent its initialization in more than %d s", w->hostname, w->addrport, q->keepalive_timeout);
+			handle_worker_failure(q, w);
+			return 0;
+		}
+		return MIN(w->start_time + q->keepalive_timeout * ONE_SECOND, current_time + ONE_SECOND);
+	}
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
-	{
+	// send new keepalive check only (1) if we received a response since last keepalive check AND
+	// (2) we are past keepalive interval
+	if (w->last_msg_recv_time > w->last_update_msg_time) {
+		int64_t last_update_elapsed_time = (int64_t)(current_time - w->last_update_msg_time) / 1000000;
+		if (last_update_elapsed_time >= q->keepalive_interval) {
+			if (vine_manager_send(q, w, "check\n") < 0) {
+				debug(D_VINE, "Failed to send keepalive check to worker %s (%s).", w->hostname, w->addrport);
+				handle_worker_failure(q, w);
+				return 0;
+			}
+			debug(D_VINE, "Sent keepalive check to worker %s (%s)", w->hostname, w->addrport);
+			w->last_update_msg_time = current_time;
+		}
+		return w->last_update_msg_time + q->keepalive_interval * ONE_SECOND;
+	}
 
-		if (q->keepalive_interval > 0) {
+	// we haven't received a message from worker since its last keepalive check. Check if
+	// time since we last polled link for responses has exceeded keepalive timeout. If so,
+	// remove worker.
+	if (q->link_poll_end > w->last_update_msg_time) {
+		if ((int)((q->link_poll_end - w->last_update_msg_time) / 1000000) >= q->keepalive_timeout) {
+			debug(D_VINE, "Removing worker %s (%s): hasn't responded to keepalive check for more than %d s", w->hostname, w->addrport, q->keepalive_timeout);
+			handle_worker_failure(q, w);
+			return 0;
+		}
+	}
 
-			/* we have not received taskvine message from worker yet, so we
-			 * simply check again its start_time. */
-			if (!strcmp(w->hostname, "unknown")) {
-				if ((int)((current_time - w->start_time) / 1000000) >= q->keepalive_timeout) {
-					debug(D_VINE, "Removing worker %s (%s): hasn't sent its initialization in more than %d s", w->hostname, w->addrport, q->keepalive_timeout);
-					handle_worker_failure(q, w);
-				}
-				continue;
-			}
+	// a reply may arrive at any moment, so look again shortly
+	return current_time + ONE_SECOND;
+}
 
-			// send new keepalive check only (1) if we received a response since last keepalive check AND
-			// (2) we are past keepalive interval
-			if (w->last_msg_recv_time > w->last_update_msg_time) {
-				int64_t last_update_elapsed_time = (int64_t)(current_time - w->last_update_msg_time) / 1000000;
-				if (last_update_elapsed_time >= q->keepalive_interval) {
-					if (vine_manager_send(q, w, "check\n") < 0) {
-						debug(D_VINE, "Failed to send keepalive check to worker %s (%s).", w->hostname, w->addrport);
-						handle_worker_failure(q, w);
-					} else {
-						debug(D_VINE, "Sent keepalive check to worker %s (%s)", w->hostname, w->addrport);
-						w->last_update_msg_time = current_time;
-					}
-				}
-			} else {
-				// we haven't received a message from worker since its last keepalive check. Check if
-				// time since we last polled link for responses has exceeded keepalive timeout. If so,
-				// remove worker.
-				if (q->link_poll_end > w->last_update_msg_time) {
-					if ((int)((q->link_poll_end - w->last_update_msg_time) / 1000000) >= q->keepalive_timeout) {
-						debug(D_VINE,
-								"Removing worker %s (%s): hasn't responded to keepalive check for more than %d s",
-								w->hostname,
-								w->addrport,
-								q->keepalive_timeout);
-						handle_worker_failure(q, w);
-					}
-				}
-			}
+/*
+Each worker has a timer set for the next moment its keepalive state could
+change, so that only those workers are visited rather than the whole table.
+*/
+
+static void ask_for_workers_updates(struct vine_manager *q)
+{
+	if (q->keepalive_interval <= 0) {
+		return;
+	}
+
+	uint64_t key;
+	void *data;
+
+	/* The next check is always in the future, so a rescheduled worker is not popped again in this pass. */
+	while (timer_wheel_pop_expired(q->keepalive_timers, q->loop_time, &key, &data)) {
+		struct vine_worker_info *w = data;
+		timestamp_t next = check_worker_keepalive(q, w, q->loop_time);
+		if (next) {
+			timer_wheel_insert(q->keepalive_timers, key, next, w);
 		}
 	}
 }
@@ -3535,7 +4399,7 @@ static int disconnect_slow_workers(struct vine_manager *q)
 
 	struct category *c_def = vine_category_lookup_or_create(q, "default");
 
-	timestamp_t current = timestamp_get();
+	timestamp_t current = q->loop_time;
 
 	ITABLE_ITERATE(q->tasks, task_id, t)
 	{
@@ -3668,7 +4532,9 @@ static void reset_task_to_state(struct vine_manager *q, struct vine_task *t, vin
 		break;
 
 	case VINE_TASK_READY:
-		list_remove(q->ready_list, t);
+		if (!unpark_task(q, t)) {
+			remove_from_ready_list(q, t);
+		}
 		change_task_state(q, t, new_state);
 		break;
 
@@ -3784,6 +4650,16 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 		link_address_local(q->manager_link, address, &q->port);
 	}
 
+	// Links are registered once in the poll set, when they are accepted.
+	q->poll_set = link_poll_set_create();
+	if (!q->poll_set || !link_poll_set_add(q->poll_set, q->manager_link, LINK_READ)) {
+		debug(D_NOTICE, "Could not create poll set for manager: %s", strerror(errno));
+		link_poll_set_delete(q->poll_set);
+		link_close(q->manager_link);
+		free(q);
+		return 0;
+	}
+
 	debug(D_VINE, "manager start");
 
 	q->runtime_directory = runtime_dir;
@@ -3812,6 +4688,11 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->fixed_location_in_queue = 0;
 
 	q->ready_list = list_create();
+	q->ready_parked = itable_create(0);
+	q->ready_deferred = priority_queue_create(0);
+	q->ready_blocked = hash_table_create(0, 0);
+	q->task_end_timers = timer_wheel_create(timestamp_get(), VINE_TIMER_RESOLUTION);
+	q->keepalive_timers = timer_wheel_create(timestamp_get(), VINE_TIMER_RESOLUTION);
 	q->running_table = itable_create(0);
 	q->waiting_retrieval_list = list_create();
 	q->retrieved_list = list_create();
@@ -3820,11 +4701,12 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->library_templates = hash_table_create(0, 0);
 
 	q->worker_table = hash_table_create(0, 0);
-	q->file_worker_table = hash_table_create(0, 0);
-	q->temp_files_to_replicate = hash_table_create(0, 0);
+	q->worker_resource_index = vine_resource_index_create();
+	q->file_worker_table = hash_table_create_interned(0, 0);
+	q->temp_files_to_replicate = hash_table_create_interned(0, 0);
 	q->worker_blocklist = hash_table_create(0, 0);
 
-	q->file_table = hash_table_create(0, 0);
+	q->file_table = flat_table_create_borrowed(0, 0);
 
 	q->factory_table = hash_table_create(0, 0);
 	q->current_transfer_table = hash_table_create(0, 0);
@@ -3838,12 +4720,17 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 
 	q->stats = calloc(1, sizeof(struct vine_stats));
 	q->stats_measure = calloc(1, sizeof(struct vine_stats));
+	q->loop_profile = vine_loop_profile_create();
+	q->fetch_stats = vine_fetch_stats_create();
+	q->memory = vine_memory_create();
 
 	q->workers_with_watched_file_updates = hash_table_create(0, 0);
 	q->workers_with_complete_tasks = hash_table_create(0, 0);
+	q->workers_with_output_streams = hash_table_create(0, 0);
+	q->dispatch_workers = hash_table_create(0, 0);
 
 	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
+	// (and resized) as needed by poll_active_workers.
 	q->poll_table_size = 8;
 
 	q->worker_selection_algorithm = VINE_SCHEDULE_FILES;
@@ -3854,6 +4741,8 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 
 	q->stats->time_when_started = timestamp_get();
 	q->time_last_large_tasks_check = timestamp_get();
+	q->time_last_speculative_check = timestamp_get();
+	q->loop_time = timestamp_get();
 	q->task_info_list = list_create();
 
 	q->time_last_wait = 0;
@@ -3871,6 +4760,10 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 
 	q->wait_for_workers = 0;
 	q->attempt_schedule_depth = 100;
+	q->dispatch_batch_size = 1;
+	q->background_retrieval_size = 0;
+	q->background_staging_size = 0;
+	q->chunk_directories = 0;
 
 	q->max_retrievals = 1;
 	q->worker_retrievals = 1;
@@ -3882,7 +4775,7 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 	q->proportional_whole_tasks = 0;
 
 	q->allocation_default_mode = VINE_ALLOCATION_MODE_FIXED;
-	q->categories = hash_table_create(0, 0);
+	q->categories = hash_table_create_interned(0, 0);
 
 	// The value -1 indicates that disconnecting slow workers is inactive by
 	// default
@@ -3895,11 +4788,19 @@ struct vine_manager *vine_ssl_create(int port, const char *key, const char *cert
 
 	q->load_from_shared_fs_enabled = 0;
 
+	q->checksum_cache = vine_checksum_cache_create();
+
 	q->file_source_max_transfers = VINE_FILE_SOURCE_MAX_TRANSFERS;
 	q->worker_source_max_transfers = VINE_WORKER_SOURCE_MAX_TRANSFERS;
+	q->cross_site_max_transfers = 0;
+	q->peer_stripe_sources = 1;
+	q->peer_stripe_min_size = 256 * MEGA;
 	q->perf_log_interval = VINE_PERF_LOG_INTERVAL;
 
 	q->temp_replica_count = 1;
+	q->temp_replica_demand = 0;
+	q->recovery_planning = 0;
+	q->recovery_replicate_depth = 0;
 	q->transfer_temps_recovery = 0;
 	q->transfer_replica_per_cycle = 10;
 
@@ -3956,14 +4857,18 @@ int vine_enable_monitoring(struct vine_manager *q, int watchdog, int series)
 	}
 
 	q->monitor_mode = VINE_MON_DISABLED;
-	char *exe = resource_monitor_locate(NULL);
-	if (!exe) {
-		warn(D_VINE, "Could not find the resource monitor executable. Disabling monitoring.\n");
-		return 0;
-	}
 
-	q->monitor_exe = vine_declare_file(q, exe, VINE_CACHE_LEVEL_WORKFLOW, 0);
-	free(exe);
+	/* with a shared monitor, tasks are measured by the worker itself. */
+	if (!q->monitor_shared) {
+		char *exe = resource_monitor_locate(NULL);
+		if (!exe) {
+			warn(D_VINE, "Could not find the resource monitor executable. Disabling monitoring.\n");
+			return 0;
+		}
+
+		q->monitor_exe = vine_declare_file(q, exe, VINE_CACHE_LEVEL_WORKFLOW, 0);
+		free(exe);
+	}
 
 	if (q->measured_local_resources) {
 		rmsummary_delete(q->measured_local_resources);
@@ -3989,6 +4894,31 @@ int vine_enable_peer_transfers(struct vine_manager *q)
 	return 1;
 }
 
+int vine_enable_checksum_cache(struct vine_manager *q, const char *filename)
+{
+	free(q->checksum_cache_file);
+	q->checksum_cache_file = 0;
+
+	if (!filename) {
+		debug(D_VINE, "checksums will not be kept between runs");
+		return 1;
+	}
+
+	q->checksum_cache_file = xxstrdup(filename);
+	return vine_checksum_cache_load(q->checksum_cache, filename);
+}
+
+int vine_enable_checkpoint(struct vine_manager *q, const char *filename)
+{
+	if (!vine_checkpoint_open(q, filename)) {
+		debug(D_NOTICE | D_VINE, "couldn't open checkpoint %s", filename);
+		return 0;
+	}
+
+	debug(D_VINE, "checkpoint enabled and is being written to %s", filename);
+	return 1;
+}
+
 int vine_disable_peer_transfers(struct vine_manager *q)
 {
 	debug(D_VINE, "Peer Transfers disabled");
@@ -4036,6 +4966,19 @@ int vine_enable_disconnect_slow_workers(struct vine_manager *q, double multiplie
 	return vine_enable_disconnect_slow_workers_category(q, "default", multiplier);
 }
 
+int vine_enable_speculative_execution(struct vine_manager *q, double quantile)
+{
+	if (quantile > 0 && quantile < 1) {
+		debug(D_VINE, "Enabling speculative execution beyond the %.3lf quantile of task times.\n", quantile);
+		q->speculative_quantile = quantile;
+		return 0;
+	} else {
+		debug(D_VINE, "Disabling speculative execution.\n");
+		q->speculative_quantile = 0;
+		return 1;
+	}
+}
+
 int vine_port(struct vine_manager *q)
 {
 	char addr[LINK_ADDRESS_MAX];
@@ -4152,6 +5095,7 @@ void vine_delete(struct vine_manager *q)
 
 	hash_table_clear(q->worker_table, (void *)vine_worker_delete);
 	hash_table_delete(q->worker_table);
+	vine_resource_index_delete(q->worker_resource_index);
 
 	hash_table_clear(q->file_worker_table, (void *)set_delete);
 	hash_table_delete(q->file_worker_table);
@@ -4175,8 +5119,8 @@ void vine_delete(struct vine_manager *q)
 	hash_table_delete(q->library_templates);
 
 	/* delete files after deleting tasks so that rc are correctly updated. */
-	hash_table_clear(q->file_table, (void *)vine_file_delete);
-	hash_table_delete(q->file_table);
+	flat_table_clear(q->file_table, (void *)vine_file_delete);
+	flat_table_delete(q->file_table);
 
 	char *key;
 	struct category *c;
@@ -4187,11 +5131,20 @@ void vine_delete(struct vine_manager *q)
 	hash_table_delete(q->categories);
 
 	list_delete(q->ready_list);
+	vine_fair_share_delete(q->fair_share);
+	itable_delete(q->ready_parked);
+	priority_queue_delete(q->ready_deferred);
+	timer_wheel_delete(q->task_end_timers);
+	timer_wheel_delete(q->keepalive_timers);
+	hash_table_clear(q->ready_blocked, (void *)list_delete);
+	hash_table_delete(q->ready_blocked);
 	itable_delete(q->running_table);
 	list_delete(q->waiting_retrieval_list);
 	list_delete(q->retrieved_list);
 	hash_table_delete(q->workers_with_watched_file_updates);
 	hash_table_delete(q->workers_with_complete_tasks);
+	hash_table_delete(q->workers_with_output_streams);
+	hash_table_delete(q->dispatch_workers);
 
 	list_clear(q->task_info_list, (void *)vine_task_info_delete);
 	list_delete(q->task_info_list);
@@ -4203,6 +5156,14 @@ void vine_delete(struct vine_manager *q)
 	}
 	free(staging);
 
+	if (q->checksum_cache_file) {
+		vine_checksum_cache_save(q->checksum_cache, q->checksum_cache_file);
+		free(q->checksum_cache_file);
+	}
+	vine_checksum_cache_delete(q->checksum_cache);
+
+	vine_checkpoint_close(q);
+
 	free(q->name);
 	free(q->manager_preferred_connection);
 	free(q->uuid);
@@ -4215,6 +5176,7 @@ void vine_delete(struct vine_manager *q)
 	free(q->ssl_key);
 
 	link_close(q->manager_link);
+	link_poll_set_delete(q->poll_set);
 	if (q->perf_logfile) {
 		fclose(q->perf_logfile);
 	}
@@ -4236,9 +5198,16 @@ void vine_delete(struct vine_manager *q)
 		fclose(q->graph_logfile);
 	}
 
+	if (q->replay_logfile) {
+		fclose(q->replay_logfile);
+	}
+
 	free(q->runtime_directory);
 	free(q->stats);
 	free(q->stats_measure);
+	vine_loop_profile_delete(q->loop_profile);
+	vine_fetch_stats_delete(q->fetch_stats);
+	vine_memory_delete(q->memory);
 
 	vine_counters_debug();
 
@@ -4272,7 +5241,9 @@ void vine_disable_monitoring(struct vine_manager *q)
 
 void vine_monitor_add_files(struct vine_manager *q, struct vine_task *t)
 {
-	vine_task_add_input(t, q->monitor_exe, RESOURCE_MONITOR_REMOTE_NAME, VINE_RETRACT_ON_RESET);
+	if (!q->monitor_shared) {
+		vine_task_add_input(t, q->monitor_exe, RESOURCE_MONITOR_REMOTE_NAME, VINE_RETRACT_ON_RESET);
+	}
 
 	char *summary = monitor_file_name(q, t, ".summary", 0);
 	vine_task_add_output(t, vine_declare_file(q, summary, VINE_CACHE_LEVEL_TASK, 0), RESOURCE_MONITOR_REMOTE_NAME ".summary", VINE_RETRACT_ON_RESET);
@@ -4318,6 +5289,11 @@ char *vine_monitor_wrap(struct vine_manager *q, struct vine_worker_info *w, stru
 
 	int extra_files = (q->monitor_mode & VINE_MON_FULL);
 
+	/* series are collected as is, so write them compactly. See rmonitor_series_convert. */
+	if (extra_files) {
+		buffer_printf(&b, " --series-format binary");
+	}
+
 	char *monitor_cmd = resource_monitor_write_command("./" RESOURCE_MONITOR_REMOTE_NAME,
 			RESOURCE_MONITOR_REMOTE_NAME,
 			limits,
@@ -4341,6 +5317,19 @@ static double vine_task_priority(void *item)
 	return t->priority;
 }
 
+/* Insert a task in the ready list according to its priority. A task with a priority of 0 goes at the end. */
+
+static void insert_task_by_priority(struct vine_manager *q, struct vine_task *t)
+{
+	if (q->fair_share) {
+		vine_fair_share_push(q->fair_share, t, 0);
+	} else if (vine_task_priority(t) != 0) {
+		list_push_priority(q->ready_list, vine_task_priority, t);
+	} else {
+		list_push_tail(q->ready_list, t);
+	}
+}
+
 /* Put a given task on the ready list, taking into account the task priority and the manager schedule. */
 
 static void push_task_to_ready_list(struct vine_manager *q, struct vine_task *t)
@@ -4356,12 +5345,9 @@ static void push_task_to_ready_list(struct vine_manager *q, struct vine_task *t)
 	}
 
 	if (by_priority) {
-		/*If a task has a priority of 0 it gets added to the end of the ready list.*/
-		if (vine_task_priority(t) != 0) {
-			list_push_priority(q->ready_list, vine_task_priority, t);
-		} else {
-			list_push_tail(q->ready_list, t);
-		}
+		insert_task_by_priority(q, t);
+	} else if (q->fair_share) {
+		vine_fair_share_push(q->fair_share, t, 1);
 	} else {
 		list_push_head(q->ready_list, t);
 	}
@@ -4370,6 +5356,147 @@ static void push_task_to_ready_list(struct vine_manager *q, struct vine_task *t)
 	vine_task_clean(t);
 }
 
+/*
+A READY task that certainly cannot be dispatched for some time is parked
+outside of the ready list, so that send_one_task only spends its effort on
+tasks that could actually run.  A parked task stays in the READY state and
+is listed in q->ready_parked, so that it is still counted among the waiting tasks.
+Tasks waiting for a start time (either requested, or the end of a failure backoff)
+are kept in the q->ready_deferred heap, ordered by the time they may run.
+Tasks waiting for an event (a temp file to be created, a library to be installed,
+a free slot in their category) are kept in q->ready_blocked under a key naming
+that event, and are woken when the event occurs.
+*/
+
+/*
+Tasks with fixed locations are never parked, so that enforce_waiting_fixed_locations
+sees them on every pass.  Tasks with a deadline may be parked, as expire_waiting_tasks
+finds them through q->task_end_timers wherever they are held.
+*/
+
+static int task_may_be_parked(struct vine_task *t)
+{
+	return !t->has_fixed_locations;
+}
+
+static void park_task_until(struct vine_manager *q, struct vine_task *t, timestamp_t wakeup)
+{
+	priority_queue_push(q->ready_deferred, t, -(double)wakeup);
+	itable_insert(q->ready_parked, t->task_id, t);
+}
+
+/* Park a task until the event named by key occurs. The key is consumed by this function. */
+
+static void park_task_on_event(struct vine_manager *q, struct vine_task *t, char *key)
+{
+	struct list *l = hash_table_lookup(q->ready_blocked, key);
+	if (!l) {
+		l = list_create();
+		hash_table_insert(q->ready_blocked, key, l);
+	}
+
+	debug(D_VINE, "Task %d is waiting for %s", t->task_id, key);
+
+	list_push_tail(l, t);
+	t->ready_blocked_key = key;
+	itable_insert(q->ready_parked, t->task_id, t);
+}
+
+/* Remove a task from whichever parking structure holds it. Returns true if the task was parked. */
+
+static int unpark_task(struct vine_manager *q, struct vine_task *t)
+{
+	if (!itable_remove(q->ready_parked, t->task_id)) {
+		return 0;
+	}
+
+	if (t->ready_blocked_key) {
+		struct list *l = hash_table_lookup(q->ready_blocked, t->ready_blocked_key);
+		if (l) {
+			list_remove(l, t);
+			if (list_size(l) == 0) {
+				hash_table_remove(q->ready_blocked, t->ready_blocked_key);
+				list_delete(l);
+			}
+		}
+		free(t->ready_blocked_key);
+		t->ready_blocked_key = 0;
+	} else {
+		priority_queue_remove(q->ready_deferred, t);
+	}
+
+	return 1;
+}
+
+/* Return to the ready list all the tasks that were waiting for the event named by key. */
+
+static void wake_blocked_tasks(struct vine_manager *q, const char *key)
+{
+	struct list *l = hash_table_remove(q->ready_blocked, key);
+	if (!l) {
+		return;
+	}
+
+	struct vine_task *t;
+	while ((t = list_pop_head(l))) {
+		itable_remove(q->ready_parked, t->task_id);
+		free(t->ready_blocked_key);
+		t->ready_blocked_key = 0;
+		insert_task_by_priority(q, t);
+	}
+
+	list_delete(l);
+}
+
+static void wake_blocked_tasks_by_name(struct vine_manager *q, const char *kind, const char *name)
+{
+	if (hash_table_size(q->ready_blocked) < 1) {
+		return;
+	}
+
+	char *key = string_format("%s:%s", kind, name);
+	wake_blocked_tasks(q, key);
+	free(key);
+}
+
+/* Return to the ready list all the tasks whose start time has arrived. */
+
+static void wake_deferred_tasks(struct vine_manager *q, timestamp_t now)
+{
+	struct vine_task *t;
+	while ((t = priority_queue_peek_top(q->ready_deferred))) {
+		if (-priority_queue_get_top_priority(q->ready_deferred) > now) {
+			break;
+		}
+		priority_queue_pop(q->ready_deferred);
+		itable_remove(q->ready_parked, t->task_id);
+		insert_task_by_priority(q, t);
+	}
+}
+
+static int ready_task_count(struct vine_manager *q)
+{
+	return ready_list_size(q) + itable_size(q->ready_parked);
+}
+
+/* Number of READY tasks not parked, whether in the ready list or in the queues of the fair share. */
+
+static int ready_list_size(struct vine_manager *q)
+{
+	int size = list_size(q->ready_list);
+	if (q->fair_share) {
+		size += vine_fair_share_size(q->fair_share);
+	}
+	return size;
+}
+
+static void remove_from_ready_list(struct vine_manager *q, struct vine_task *t)
+{
+	if (!q->fair_share || !vine_fair_share_remove(q->fair_share, t)) {
+		list_remove(q->ready_list, t);
+	}
+}
+
 /*
 Changes task to a target state, and performs the associated
 accounting needed to log the event and put the task into the
@@ -4384,6 +5511,18 @@ static vine_task_state_t change_task_state(struct vine_manager *q, struct vine_t
 {
 	vine_task_state_t old_state = t->state;
 
+	/* A task leaving the retrieved list takes its output back into memory. */
+	if (old_state == VINE_TASK_RETRIEVED) {
+		unspill_task(q, t);
+	}
+
+	if (old_state != VINE_TASK_INITIAL && old_state != VINE_TASK_DONE) {
+		q->task_state_counts[old_state]--;
+	}
+	if (new_state != VINE_TASK_INITIAL && new_state != VINE_TASK_DONE) {
+		q->task_state_counts[new_state]++;
+	}
+
 	t->state = new_state;
 
 	debug(D_VINE, "Task %d state change: %s (%d) to %s (%d)\n", t->task_id, vine_task_state_to_string(old_state), old_state, vine_task_state_to_string(new_state), new_state);
@@ -4396,9 +5535,13 @@ static vine_task_state_t change_task_state(struct vine_manager *q, struct vine_t
 		break;
 	case VINE_TASK_READY:
 		c->vine_stats->tasks_waiting--;
+		timer_wheel_remove(q->task_end_timers, t->task_id);
 		break;
 	case VINE_TASK_RUNNING:
 		c->vine_stats->tasks_running--;
+		if (c->max_concurrent > -1) {
+			wake_blocked_tasks_by_name(q, "category", c->name);
+		}
 		break;
 	case VINE_TASK_WAITING_RETRIEVAL:
 		c->vine_stats->tasks_with_results--;
@@ -4420,8 +5563,12 @@ static vine_task_state_t change_task_state(struct vine_manager *q, struct vine_t
 		vine_task_set_result(t, VINE_RESULT_UNKNOWN);
 		push_task_to_ready_list(q, t);
 		c->vine_stats->tasks_waiting++;
+		if (t->resources_requested->end > 0) {
+			timer_wheel_insert(q->task_end_timers, t->task_id, t->resources_requested->end * ONE_SECOND, 0);
+		}
 		break;
 	case VINE_TASK_RUNNING:
+		vine_task_ensure_resources(t);
 		itable_insert(q->running_table, t->task_id, t);
 		c->vine_stats->tasks_running++;
 		break;
@@ -4430,6 +5577,12 @@ static vine_task_state_t change_task_state(struct vine_manager *q, struct vine_t
 		c->vine_stats->tasks_with_results++;
 		break;
 	case VINE_TASK_RETRIEVED:
+		/* A task may finish without ever being dispatched, as when cancelled. */
+		vine_task_ensure_resources(t);
+		if (old_state != VINE_TASK_RETRIEVED) {
+			vine_manager_count_temp_producers(q, t, -1);
+			vine_manager_count_temp_consumers(q, t, -1);
+		}
 		/* Library task can be set to RETRIEVED when it failed or was removed intentionally */
 		if (t->type == VINE_TASK_TYPE_LIBRARY_INSTANCE) {
 			vine_task_set_result(t, VINE_RESULT_LIBRARY_EXIT);
@@ -4516,6 +5669,10 @@ const char *vine_result_string(vine_result_t result)
 
 static int task_state_count(struct vine_manager *q, const char *category, vine_task_state_t state)
 {
+	if (!category) {
+		return state == VINE_TASK_INITIAL || state == VINE_TASK_DONE ? 0 : q->task_state_counts[state];
+	}
+
 	struct vine_task *t;
 	uint64_t task_id;
 	int count = 0;
@@ -4571,6 +5728,12 @@ int vine_submit(struct vine_manager *q, struct vine_task *t)
 	/* If the task produces temporary files, create recovery tasks for those. */
 	vine_manager_create_recovery_tasks(q, t);
 
+	/* Tasks consuming its temporary files wait until this task completes. */
+	vine_manager_count_temp_producers(q, t, 1);
+
+	/* Temporary files waited on by many tasks may be replicated more widely. */
+	vine_manager_count_temp_consumers(q, t, 1);
+
 	/* If the task produces watched output files, truncate them. */
 	vine_task_truncate_watched_outputs(t);
 
@@ -4580,11 +5743,18 @@ int vine_submit(struct vine_manager *q, struct vine_task *t)
 	/* Ensure category structure is created. */
 	vine_category_lookup_or_create(q, t->category);
 
-	change_task_state(q, t, VINE_TASK_READY);
+	/* A task completed by an earlier run of the manager is returned without running it again. */
+	if (vine_checkpoint_restore(q, t)) {
+		change_task_state(q, t, VINE_TASK_RETRIEVED);
+	} else {
+		change_task_state(q, t, VINE_TASK_READY);
+	}
 
 	t->time_when_submitted = timestamp_get();
 	q->stats->tasks_submitted++;
 
+	vine_replay_log_write_submit(q, t);
+
 	if (q->monitor_mode != VINE_MON_DISABLED)
 		vine_monitor_add_files(q, t);
 
@@ -4686,6 +5856,9 @@ void vine_manager_install_library(struct vine_manager *q, struct vine_task *t, c
 	vine_task_set_library_provided(t, name);
 	hash_table_insert(q->library_templates, name, t);
 	t->time_when_submitted = timestamp_get();
+
+	/* Function calls waiting for this library may now be scheduled. */
+	wake_blocked_tasks_by_name(q, "library", name);
 }
 
 void vine_manager_remove_library(struct vine_manager *q, const char *name)
@@ -4731,133 +5904,505 @@ void vine_block_host_with_timeout(struct vine_manager *q, const char *hostname,
 	return vine_blocklist_block(q, hostname, timeout);
 }
 
-void vine_block_host(struct vine_manager *q, const char *hostname)
-{
-	vine_blocklist_block(q, hostname, -1);
+void vine_block_host(struct vine_manager *q, const char *hostname)
+{
+	vine_blocklist_block(q, hostname, -1);
+}
+
+void vine_unblock_host(struct vine_manager *q, const char *hostname)
+{
+	vine_blocklist_unblock(q, hostname);
+}
+
+void vine_unblock_all(struct vine_manager *q)
+{
+	vine_blocklist_unblock_all_by_time(q, -1);
+}
+
+static void print_password_warning(struct vine_manager *q)
+{
+	static int did_password_warning = 0;
+
+	if (did_password_warning) {
+		return;
+	}
+
+	if (!q->password && q->name) {
+		debug(D_DEBUG, "warning: this taskvine manager is visible to the public.\n");
+		debug(D_DEBUG, "warning: you should set a password with the --password option.\n");
+	}
+
+	if (!q->ssl_enabled) {
+		debug(D_DEBUG, "warning: using plain-text when communicating with workers.\n");
+		debug(D_DEBUG, "warning: use encryption with a key and cert when creating the manager.\n");
+	}
+
+	did_password_warning = 1;
+}
+
+#define BEGIN_ACCUM_TIME(q, stat) \
+	{ \
+		if (q->stats_measure->stat != 0) { \
+			fatal("Double-counting stat %s. This should not happen, and it is a taskvine bug."); \
+		} else { \
+			q->stats_measure->stat = timestamp_get(); \
+		} \
+	}
+
+#define END_ACCUM_TIME(q, stat) \
+	{ \
+		q->stats->stat += timestamp_get() - q->stats_measure->stat; \
+		q->stats_measure->stat = 0; \
+	}
+
+struct vine_task *vine_wait(struct vine_manager *q, int timeout)
+{
+	return vine_wait_for_tag(q, NULL, timeout);
+}
+
+struct vine_task *vine_wait_for_tag(struct vine_manager *q, const char *tag, int timeout)
+{
+	return vine_wait_internal(q, timeout, tag, -1);
+}
+
+struct vine_task *vine_wait_for_task_id(struct vine_manager *q, int task_id, int timeout)
+{
+	return vine_wait_internal(q, timeout, NULL, task_id);
+}
+
+/* return number of workers that failed */
+static int poll_active_workers(struct vine_manager *q, int stoptime)
+{
+	BEGIN_ACCUM_TIME(q, time_polling);
+
+	// The poll table receives the active links, so it must be able to hold all of them.
+	int n = link_poll_set_size(q->poll_set);
+	if (!q->poll_table || n > q->poll_table_size) {
+		while (n > q->poll_table_size) {
+			q->poll_table_size *= 2;
+		}
+		q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+		if (!q->poll_table) {
+			// if we can't allocate a poll table, we can't do anything else.
+			fatal("allocating memory for poll table failed.");
+		}
+	}
+
+	q->manager_link_ready = 0;
+
+	// We poll in at most small time segments (of a second). This lets
+	// promptly dispatch tasks, while avoiding busy waiting.
+	int msec = q->busy_waiting_flag ? 1000 : 0;
+	if (stoptime) {
+		msec = MIN(msec, (stoptime - time(0)) * 1000);
+	}
+
+	END_ACCUM_TIME(q, time_polling);
+
+	if (msec < 0) {
+		return 0;
+	}
+
+	BEGIN_ACCUM_TIME(q, time_polling);
+
+	// Write out buffered debug messages before waiting for workers.
+	if (msec > 0)
+		debug_flush();
+
+	// Wait for activity on any link. Only the active links are returned in the poll table.
+	timestamp_t phase_start = timestamp_get();
+	n = link_poll_set_wait(q->poll_set, q->poll_table, q->poll_table_size, msec);
+	vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_POLL, phase_start);
+	q->link_poll_end = timestamp_get();
+
+	END_ACCUM_TIME(q, time_polling);
+
+	BEGIN_ACCUM_TIME(q, time_status_msgs);
+
+	int i;
+	int workers_failed = 0;
+	// Then consider all existing active workers
+	for (i = 0; i < n; i++) {
+		if (q->poll_table[i].link == q->manager_link) {
+			q->manager_link_ready = 1;
+		} else if ((q->poll_table[i].revents & LINK_WRITE) && handle_worker_writable(q, q->poll_table[i].link) == VINE_WORKER_FAILURE) {
+			workers_failed++;
+		} else if (q->poll_table[i].revents != LINK_WRITE && handle_worker(q, q->poll_table[i].link) == VINE_WORKER_FAILURE) {
+			workers_failed++;
+		}
+	}
+
+	workers_failed += expire_output_streams(q);
+
+	END_ACCUM_TIME(q, time_status_msgs);
+
+	return workers_failed;
+}
+
+static int connect_new_workers(struct vine_manager *q, int stoptime, int max_new_workers)
+{
+	int new_workers = 0;
+
+	// If the manager link was awake, then accept at most max_new_workers.
+	// Note we are using the information gathered in poll_active_workers, which
+	// is a little ugly.
+	if (q->manager_link_ready) {
+		do {
+			add_worker(q);
+			new_workers++;
+		} while (link_usleep(q->manager_link, 0, 1, 0) && (stoptime >= time(0) && (max_new_workers > new_workers)));
+	}
+
+	return new_workers;
+}
+
+/*
+A duplicate writes its outputs to the same files as the original, so a
+task is only duplicated when its outputs are returned once at the end.
+Watched outputs are appended to while the task runs, and temporary
+outputs are replicas that other tasks may already be reading.
+*/
+
+static int task_can_be_duplicated(struct vine_task *t)
+{
+	struct vine_mount *m;
+
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		if (m->flags & VINE_WATCH || m->file->type == VINE_TEMP) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+Queue a duplicate made by the manager.  Unlike vine_submit, it is not
+counted as a task submitted by the user, nor written to the replay log or
+checked against the checkpoint, and the outputs it shares with the
+original are left alone.
+*/
+
+static void submit_speculative_task(struct vine_manager *q, struct vine_task *d)
+{
+	d->task_id = q->next_task_id++;
+
+	if (d->has_fixed_locations) {
+		q->fixed_location_in_queue++;
+	}
+
+	vine_manager_count_temp_consumers(q, d, 1);
+
+	itable_insert(q->tasks, d->task_id, vine_task_addref(d));
+	change_task_state(q, d, VINE_TASK_READY);
+
+	d->time_when_submitted = timestamp_get();
+
+	if (q->monitor_mode != VINE_MON_DISABLED)
+		vine_monitor_add_files(q, d);
+}
+
+/*
+Speculative execution hedges against tasks stuck on slow workers.
+When no task is waiting to run, so that workers would otherwise sit idle,
+a task that has run for longer than the given quantile of the task times
+of its category is duplicated.  The duplicate runs on a different worker,
+and whichever of the two finishes first is returned to the user, while
+the other is cancelled.  Running tasks are only examined every few seconds.
+*/
+
+static int launch_speculative_tasks(struct vine_manager *q)
+{
+	if (q->speculative_quantile <= 0) {
+		return 0;
+	}
+
+	if (ready_list_size(q) > 0) {
+		return 0;
+	}
+
+	timestamp_t current = timestamp_get();
+	if (current - q->time_last_speculative_check < VINE_SPECULATIVE_CHECK_INTERVAL) {
+		return 0;
+	}
+	q->time_last_speculative_check = current;
+
+	int launched = 0;
+
+	struct vine_task *t;
+	uint64_t task_id;
+
+	ITABLE_ITERATE(q->running_table, task_id, t)
+	{
+		/* Function calls are cheap to rerun on their own library, and are not duplicated. */
+		if (t->type != VINE_TASK_TYPE_STANDARD || t->speculative_copy || t->needs_library || !task_can_be_duplicated(t)) {
+			continue;
+		}
+
+		struct category *c = vine_category_lookup_or_create(q, t->category);
+		if (!c->vine_task_times || quantile_sketch_count(c->vine_task_times) < VINE_SPECULATIVE_MIN_SAMPLES) {
+			continue;
+		}
+
+		timestamp_t threshold = quantile_sketch_quantile(c->vine_task_times, q->speculative_quantile);
+		if (current - t->time_when_commit_start < threshold) {
+			continue;
+		}
+
+		/* The reference from the copy is kept until the duplicate is done. */
+		struct vine_task *d = vine_task_copy(t);
+		/* The copy must not write to the monitor files of the original. */
+		vine_task_reset(d);
+		d->resource_request = t->resource_request;
+		d->type = VINE_TASK_TYPE_SPECULATIVE;
+		d->speculative_original = t;
+		vine_task_set_retries(d, 1);
+		t->speculative_copy = d;
+
+		submit_speculative_task(q, d);
+		q->stats->tasks_speculative++;
+
+		debug(D_VINE,
+				"Task %d has run for %.02lf s, beyond the %.3lf quantile of its category (%.02lf s). Launched task %d as a duplicate.",
+				t->task_id,
+				(current - t->time_when_commit_start) / 1000000.0,
+				q->speculative_quantile,
+				threshold / 1000000.0,
+				d->task_id);
+
+		launched++;
+	}
+
+	return launched;
+}
+
+/* Give the original task the results of the speculative duplicate that finished before it. */
+
+static void take_speculative_results(struct vine_task *t, struct vine_task *d)
+{
+	t->result = d->result;
+	t->exit_code = d->exit_code;
+
+	char *output = t->output;
+	t->output = d->output;
+	d->output = output;
+	t->output_length = d->output_length;
+
+	char *addrport = t->addrport;
+	t->addrport = d->addrport;
+	d->addrport = addrport;
+
+	char *hostname = t->hostname;
+	t->hostname = d->hostname;
+	d->hostname = hostname;
+
+	struct rmsummary *measured = t->resources_measured;
+	t->resources_measured = d->resources_measured;
+	d->resources_measured = measured;
+
+	t->sandbox_measured = d->sandbox_measured;
+
+	t->time_when_retrieval = d->time_when_retrieval;
+	t->time_when_done = d->time_when_done;
+	t->time_workers_execute_last_start = d->time_workers_execute_last_start;
+	t->time_workers_execute_last_end = d->time_workers_execute_last_end;
+	t->time_workers_execute_last = d->time_workers_execute_last;
+	t->time_workers_execute_all += d->time_workers_execute_all;
+
+	t->bytes_received += d->bytes_received;
+	t->bytes_sent += d->bytes_sent;
+	t->bytes_transferred += d->bytes_transferred;
 }
 
-void vine_unblock_host(struct vine_manager *q, const char *hostname)
+/*
+The original task finished first, so stop its duplicate.  Results of
+the duplicate that are waiting at its worker are discarded there, rather
+than fetched over the outputs already returned to the user.
+*/
+
+static void cancel_speculative_task(struct vine_manager *q, struct vine_task *t)
 {
-	vine_blocklist_unblock(q, hostname);
+	struct vine_task *d = t->speculative_copy;
+	struct vine_worker_info *w = d->worker;
+
+	t->speculative_copy = 0;
+	d->speculative_original = 0;
+
+	switch (d->state) {
+	case VINE_TASK_READY:
+		reset_task_to_state(q, d, VINE_TASK_RETRIEVED);
+		vine_task_set_result(d, VINE_RESULT_CANCELLED);
+		break;
+	case VINE_TASK_RUNNING:
+	case VINE_TASK_WAITING_RETRIEVAL:
+		vine_task_set_result(d, VINE_RESULT_CANCELLED);
+		vine_manager_send(q, w, "kill %d\n", d->task_id);
+		delete_worker_files(q, w, d->input_mounts, VINE_CACHE_LEVEL_TASK);
+		delete_worker_files(q, w, d->output_mounts, VINE_CACHE_LEVEL_FOREVER);
+		reap_task_from_worker(q, w, d, VINE_TASK_RETRIEVED);
+		break;
+	default:
+		/* Already retrieved, it is deleted when it comes out of the retrieved list. */
+		break;
+	}
+
+	debug(D_VINE, "Task %d finished before its duplicate %d, which was cancelled.", t->task_id, d->task_id);
 }
 
-void vine_unblock_all(struct vine_manager *q)
+/*
+A retrieved task may wait a long time to be returned by vine_wait, as when
+the application waits only for some tags. Its standard output and measured
+resources are then written to the staging directory and freed, and read
+back when the task leaves the retrieved list.
+*/
+
+static char *spill_path(struct vine_manager *q, struct vine_task *t, const char *suffix)
 {
-	vine_blocklist_unblock_all_by_time(q, -1);
+	char *name = string_format("task-%d.%s", t->task_id, suffix);
+	char *path = vine_get_path_staging(q, name);
+	free(name);
+	return path;
 }
 
-static void print_password_warning(struct vine_manager *q)
+static int spill_task(struct vine_manager *q, struct vine_task *t)
 {
-	static int did_password_warning = 0;
-
-	if (did_password_warning) {
-		return;
+	if (t->output_spilled) {
+		return 1;
 	}
 
-	if (!q->password && q->name) {
-		debug(D_DEBUG, "warning: this taskvine manager is visible to the public.\n");
-		debug(D_DEBUG, "warning: you should set a password with the --password option.\n");
-	}
+	char *output_path = spill_path(q, t, "stdout");
+	char *summary_path = spill_path(q, t, "summary");
+	int ok = 1;
 
-	if (!q->ssl_enabled) {
-		debug(D_DEBUG, "warning: using plain-text when communicating with workers.\n");
-		debug(D_DEBUG, "warning: use encryption with a key and cert when creating the manager.\n");
+	if (t->output) {
+		FILE *file = fopen(output_path, "w");
+		if (file) {
+			ok = fwrite(t->output, 1, t->output_length, file) == (size_t)t->output_length;
+			ok = fclose(file) == 0 && ok;
+		} else {
+			ok = 0;
+		}
 	}
 
-	did_password_warning = 1;
-}
-
-#define BEGIN_ACCUM_TIME(q, stat) \
-	{ \
-		if (q->stats_measure->stat != 0) { \
-			fatal("Double-counting stat %s. This should not happen, and it is a taskvine bug."); \
-		} else { \
-			q->stats_measure->stat = timestamp_get(); \
-		} \
+	if (ok && t->resources_measured) {
+		FILE *file = fopen(summary_path, "w");
+		if (file) {
+			rmsummary_print(file, t->resources_measured, 0, 0);
+			ok = fclose(file) == 0;
+		} else {
+			ok = 0;
+		}
 	}
 
-#define END_ACCUM_TIME(q, stat) \
-	{ \
-		q->stats->stat += timestamp_get() - q->stats_measure->stat; \
-		q->stats_measure->stat = 0; \
+	if (ok) {
+		free(t->output);
+		t->output = 0;
+		rmsummary_delete(t->resources_measured);
+		t->resources_measured = 0;
+		t->output_spilled = 1;
+		q->retrieved_spilled++;
+	} else {
+		debug(D_VINE, "could not spill the output of task %d: %s", t->task_id, strerror(errno));
+		unlink(output_path);
+		unlink(summary_path);
 	}
 
-struct vine_task *vine_wait(struct vine_manager *q, int timeout)
-{
-	return vine_wait_for_tag(q, NULL, timeout);
-}
+	free(output_path);
+	free(summary_path);
 
-struct vine_task *vine_wait_for_tag(struct vine_manager *q, const char *tag, int timeout)
-{
-	return vine_wait_internal(q, timeout, tag, -1);
+	return ok;
 }
 
-struct vine_task *vine_wait_for_task_id(struct vine_manager *q, int task_id, int timeout)
+static void unspill_task(struct vine_manager *q, struct vine_task *t)
 {
-	return vine_wait_internal(q, timeout, NULL, task_id);
-}
+	if (!t->output_spilled) {
+		return;
+	}
 
-/* return number of workers that failed */
-static int poll_active_workers(struct vine_manager *q, int stoptime)
-{
-	BEGIN_ACCUM_TIME(q, time_polling);
+	char *output_path = spill_path(q, t, "stdout");
+	char *summary_path = spill_path(q, t, "summary");
 
-	int n = build_poll_table(q);
+	/* A task without output has no output file. */
+	if (copy_file_to_buffer(output_path, &t->output, 0) < 0) {
+		if (errno != ENOENT) {
+			debug(D_VINE, "could not read back the output of task %d: %s", t->task_id, strerror(errno));
+		}
+		t->output = 0;
+	}
 
-	// We poll in at most small time segments (of a second). This lets
-	// promptly dispatch tasks, while avoiding busy waiting.
-	int msec = q->busy_waiting_flag ? 1000 : 0;
-	if (stoptime) {
-		msec = MIN(msec, (stoptime - time(0)) * 1000);
+	t->resources_measured = rmsummary_parse_file_single(summary_path);
+	if (!t->resources_measured) {
+		t->resources_measured = rmsummary_create(-1);
 	}
 
-	END_ACCUM_TIME(q, time_polling);
+	unlink(output_path);
+	unlink(summary_path);
+	free(output_path);
+	free(summary_path);
 
-	if (msec < 0) {
-		return 0;
-	}
+	t->output_spilled = 0;
+	q->retrieved_spilled--;
+}
 
-	BEGIN_ACCUM_TIME(q, time_polling);
+/*
+Keep in memory the output of at most spill-retrieved-tasks tasks waiting to
+be returned. Tasks are returned from the head of the retrieved list, so the
+tasks further back are spilled.
+*/
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
-	q->link_poll_end = timestamp_get();
+static void spill_retrieved_tasks(struct vine_manager *q)
+{
+	if (q->spill_retrieved_tasks < 1) {
+		return;
+	}
 
-	END_ACCUM_TIME(q, time_polling);
+	if (list_size(q->retrieved_list) - q->retrieved_spilled <= q->spill_retrieved_tasks) {
+		return;
+	}
 
-	BEGIN_ACCUM_TIME(q, time_status_msgs);
+	struct list_cursor *cur = list_cursor_create(q->retrieved_list);
+	struct vine_task *t;
 
-	int i, j = 1;
-	int workers_failed = 0;
-	// Then consider all existing active workers
-	for (i = j; i < n; i++) {
-		if (q->poll_table[i].revents) {
-			if (handle_worker(q, q->poll_table[i].link) == VINE_WORKER_FAILURE) {
-				workers_failed++;
-			}
+	list_seek(cur, q->spill_retrieved_tasks);
+	while (list_size(q->retrieved_list) - q->retrieved_spilled > q->spill_retrieved_tasks && list_get(cur, (void **)&t)) {
+		if (!t->output_spilled && !spill_task(q, t)) {
+			break;
 		}
+		list_next(cur);
 	}
 
-	END_ACCUM_TIME(q, time_status_msgs);
-
-	return workers_failed;
+	list_cursor_destroy(cur);
 }
 
-static int connect_new_workers(struct vine_manager *q, int stoptime, int max_new_workers)
+/*
+A speculative duplicate came out of the retrieved list.  If it succeeded
+while the original task is still running or waiting to run, the original
+is cancelled and takes over the results of the duplicate.  Otherwise the
+original carries on.  Either way the duplicate is deleted.
+*/
+
+static void resolve_speculative_task(struct vine_manager *q, struct vine_task *d)
 {
-	int new_workers = 0;
+	struct vine_task *t = d->speculative_original;
 
-	// If the manager link was awake, then accept at most max_new_workers.
-	// Note we are using the information gathered in poll_active_workers, which
-	// is a little ugly.
-	if (q->poll_table[0].revents) {
-		do {
-			add_worker(q);
-			new_workers++;
-		} while (link_usleep(q->manager_link, 0, 1, 0) && (stoptime >= time(0) && (max_new_workers > new_workers)));
+	/* The results of the duplicate may be taken by the original, so they must be in memory. */
+	unspill_task(q, d);
+
+	if (t) {
+		t->speculative_copy = 0;
+		d->speculative_original = 0;
+
+		if (d->result == VINE_RESULT_SUCCESS && (t->state == VINE_TASK_RUNNING || t->state == VINE_TASK_READY)) {
+			debug(D_VINE, "Duplicate task %d finished before task %d, which was cancelled.", d->task_id, t->task_id);
+			reset_task_to_state(q, t, VINE_TASK_RETRIEVED);
+			take_speculative_results(t, d);
+			q->stats->tasks_speculative_won++;
+		}
 	}
 
-	return new_workers;
+	change_task_state(q, d, VINE_TASK_DONE);
+	vine_task_delete(d);
 }
 
 struct vine_task *find_task_to_return(struct vine_manager *q, const char *tag, int task_id)
@@ -4883,6 +6428,12 @@ struct vine_task *find_task_to_return(struct vine_manager *q, const char *tag, i
 		} else if (task_id >= 0) {
 			// XXX: library tasks are never removed!
 			struct vine_task *temp = itable_lookup(q->tasks, task_id);
+			if (temp && temp->speculative_copy && temp->speculative_copy->state == VINE_TASK_RETRIEVED) {
+				/* The duplicate of this task may have finished first. */
+				struct vine_task *d = temp->speculative_copy;
+				list_remove(q->retrieved_list, d);
+				resolve_speculative_task(q, d);
+			}
 			if (!temp || temp->state != VINE_TASK_RETRIEVED) {
 				break;
 			}
@@ -4897,6 +6448,24 @@ struct vine_task *find_task_to_return(struct vine_manager *q, const char *tag, i
 			return NULL;
 		}
 
+		if (t->type == VINE_TASK_TYPE_SPECULATIVE) {
+			resolve_speculative_task(q, t);
+			continue;
+		}
+
+		if (t->speculative_copy) {
+			cancel_speculative_task(q, t);
+		}
+
+		/* Tasks waiting for the outputs of a recovery task should check again, and reconsider recovery if still missing. */
+		if (t->type == VINE_TASK_TYPE_RECOVERY) {
+			struct vine_mount *m;
+			LIST_ITERATE(t->output_mounts, m)
+			{
+				wake_blocked_tasks_by_name(q, "file", m->file->cached_name);
+			}
+		}
+
 		change_task_state(q, t, VINE_TASK_DONE);
 		if (t->result != VINE_RESULT_SUCCESS) {
 			q->stats->tasks_failed++;
@@ -4905,6 +6474,7 @@ struct vine_task *find_task_to_return(struct vine_manager *q, const char *tag, i
 		switch (t->type) {
 		case VINE_TASK_TYPE_STANDARD:
 			/* if this is a standard task type, then break and return it to the user. */
+			vine_checkpoint_write(q, t);
 			return t;
 			break;
 		case VINE_TASK_TYPE_RECOVERY:
@@ -4917,6 +6487,9 @@ struct vine_task *find_task_to_return(struct vine_manager *q, const char *tag, i
 		case VINE_TASK_TYPE_LIBRARY_TEMPLATE:
 			/* A template shouldn't be scheduled. It's deleted when template table is deleted.*/
 			break;
+		case VINE_TASK_TYPE_SPECULATIVE:
+			/* handled by resolve_speculative_task above. */
+			break;
 		}
 	}
 
@@ -4999,7 +6572,7 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 				END_ACCUM_TIME(q, time_internal);
 			}
 
-			if (t && (!q->prefer_dispatch || list_size(q->ready_list) == 0 || !sent_in_previous_cycle)) {
+			if (t && (!q->prefer_dispatch || ready_list_size(q) == 0 || !sent_in_previous_cycle)) {
 				break;
 			}
 		}
@@ -5013,16 +6586,27 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 			// returning and retrieving tasks.
 		}
 
-		// get updates for watched files.
+		// the poll above is where this loop waits, so read the clock for timeouts once it returns.
+		q->loop_time = timestamp_coarse();
+
+		// get updates for watched files, only from the workers that announced them.
 		if (hash_table_size(q->workers_with_watched_file_updates)) {
 
 			struct vine_worker_info *w;
 			char *key;
-			HASH_TABLE_ITERATE(q->worker_table, key, w)
+			struct list *ready = list_create();
+			HASH_TABLE_ITERATE(q->workers_with_watched_file_updates, key, w)
 			{
-				get_available_results(q, w);
+				if (!vine_worker_is_streaming(w))
+					list_push_tail(ready, w);
+			}
+
+			// a worker may announce more updates while we read these, so the table is not iterated here.
+			while ((w = list_pop_head(ready))) {
 				hash_table_remove(q->workers_with_watched_file_updates, w->hashkey);
+				get_available_results(q, w);
 			}
+			list_delete(ready);
 		}
 
 		q->busy_waiting_flag = 0;
@@ -5053,12 +6637,13 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 				// task to be received
 				break;
 			}
-		} while (q->max_retrievals < 0 || retrieved_this_cycle < q->max_retrievals || !list_size(q->ready_list));
+		} while (q->max_retrievals < 0 || retrieved_this_cycle < q->max_retrievals || !ready_list_size(q));
 		END_ACCUM_TIME(q, time_receive);
 
 		// expired tasks
 		BEGIN_ACCUM_TIME(q, time_internal);
 		result = expire_waiting_tasks(q);
+		spill_retrieved_tasks(q);
 		END_ACCUM_TIME(q, time_internal);
 		if (result > 0) {
 			retrieved_this_cycle += result;
@@ -5088,7 +6673,7 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 			}
 			// tasks waiting to be dispatched?
 			BEGIN_ACCUM_TIME(q, time_send);
-			result = send_one_task(q);
+			result = send_tasks(q);
 			END_ACCUM_TIME(q, time_send);
 			if (result) {
 				// sent at least one task
@@ -5105,6 +6690,7 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 
 		// Kill off slow/drained workers.
 		BEGIN_ACCUM_TIME(q, time_internal);
+		launch_speculative_tasks(q);
 		result = disconnect_slow_workers(q);
 		result += shutdown_drained_workers(q);
 		vine_blocklist_unblock_all_by_time(q, time(0));
@@ -5122,7 +6708,9 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 
 		// Check if any temp files need replication and start replicating
 		BEGIN_ACCUM_TIME(q, time_internal);
+		timestamp_t phase_start = timestamp_get();
 		result = recover_temp_files(q);
+		vine_loop_profile_end(q->loop_profile, VINE_LOOP_PHASE_RECOVERY, phase_start);
 		END_ACCUM_TIME(q, time_internal);
 		if (result) {
 			// recovered at least one temp file
@@ -5146,7 +6734,7 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 		// in this wait.
 		if (events > 0) {
 			BEGIN_ACCUM_TIME(q, time_internal);
-			int done = !list_size(q->ready_list) && !list_size(q->waiting_retrieval_list) && !itable_size(q->running_table);
+			int done = !ready_task_count(q) && !list_size(q->waiting_retrieval_list) && !itable_size(q->running_table);
 			END_ACCUM_TIME(q, time_internal);
 
 			if (done) {
@@ -5178,6 +6766,8 @@ static struct vine_task *vine_wait_internal(struct vine_manager *q, int timeout,
 
 	q->time_last_wait = timestamp_get();
 
+	debug_flush();
+
 	return t;
 }
 
@@ -5244,6 +6834,29 @@ int vine_hungry(struct vine_manager *q)
 		ready_task_gpus += t->resources_requested->gpus;
 	}
 
+	if (q->fair_share) {
+		struct list *ready;
+		LIST_ITERATE(vine_fair_share_queues(q->fair_share), ready)
+		{
+			LIST_ITERATE(ready, t)
+			{
+				ready_task_cores += MAX(1, t->resources_requested->cores);
+				ready_task_memory += t->resources_requested->memory;
+				ready_task_disk += t->resources_requested->disk;
+				ready_task_gpus += t->resources_requested->gpus;
+			}
+		}
+	}
+
+	uint64_t task_id;
+	ITABLE_ITERATE(q->ready_parked, task_id, t)
+	{
+		ready_task_cores += MAX(1, t->resources_requested->cores);
+		ready_task_memory += t->resources_requested->memory;
+		ready_task_disk += t->resources_requested->disk;
+		ready_task_gpus += t->resources_requested->gpus;
+	}
+
 	int count = task_state_count(q, NULL, VINE_TASK_READY);
 
 	int64_t avg_additional_tasks_cores, avg_additional_tasks_memory, avg_additional_tasks_disk, avg_additional_tasks_gpus;
@@ -5468,6 +7081,28 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 	if (!strcmp(name, "attempt-schedule-depth")) {
 		q->attempt_schedule_depth = MAX(1, (int)value);
 
+	} else if (!strcmp(name, "dispatch-batch-size")) {
+		q->dispatch_batch_size = MAX(1, (int)value);
+
+	} else if (!strcmp(name, "spill-retrieved-tasks")) {
+		q->spill_retrieved_tasks = MAX(0, (int)value);
+
+	} else if (!strcmp(name, "fair-share")) {
+		if (value) {
+			enable_fair_share(q);
+		} else {
+			disable_fair_share(q);
+		}
+
+	} else if (!strcmp(name, "background-retrieval-size")) {
+		q->background_retrieval_size = MAX(0, (int64_t)value) * MEGA;
+
+	} else if (!strcmp(name, "background-staging-size")) {
+		q->background_staging_size = MAX(0, (int64_t)value) * MEGA;
+
+	} else if (!strcmp(name, "chunk-directories")) {
+		q->chunk_directories = !!value;
+
 	} else if (!strcmp(name, "category-steady-n-tasks")) {
 		category_tune_bucket_size("category-steady-n-tasks", (int)value);
 
@@ -5505,6 +7140,12 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 		/* 0 means use monitor's default */
 		q->monitor_interval = MAX(0, (int)value);
 
+	} else if (!strcmp(name, "monitor-shared")) {
+		q->monitor_shared = !!((int)value);
+
+	} else if (!strcmp(name, "worker-usage-interval")) {
+		q->worker_usage_interval = MAX(0, (int)value);
+
 	} else if (!strcmp(name, "prefer-dispatch")) {
 		q->prefer_dispatch = !!((int)value);
 
@@ -5524,12 +7165,29 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 	} else if (!strcmp(name, "resource-submit-multiplier") || !strcmp(name, "asynchrony-multiplier")) {
 		q->resource_submit_multiplier = MAX(value, 1.0);
 
+		/* The resource index depends on the overcommitted totals of each worker. */
+		char *key;
+		struct vine_worker_info *w;
+		HASH_TABLE_ITERATE(q->worker_table, key, w)
+		{
+			count_worker_resources(q, w);
+		}
+
+	} else if (!strcmp(name, "recovery-planning")) {
+		q->recovery_planning = !!((int)value);
+
+	} else if (!strcmp(name, "recovery-replicate-depth")) {
+		q->recovery_replicate_depth = MAX(0, (int)value);
+
 	} else if (!strcmp(name, "short-timeout")) {
 		q->short_timeout = MAX(1, (int)value);
 
 	} else if (!strcmp(name, "temp-replica-count")) {
 		q->temp_replica_count = MAX(1, (int)value);
 
+	} else if (!strcmp(name, "temp-replica-demand")) {
+		q->temp_replica_demand = MAX(0, (int)value);
+
 	} else if (!strcmp(name, "transfer-outlier-factor")) {
 		q->transfer_outlier_factor = value;
 
@@ -5558,12 +7216,24 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 	} else if (!strcmp(name, "worker-source-max-transfers")) {
 		q->worker_source_max_transfers = MAX(1, (int)value);
 
+	} else if (!strcmp(name, "cross-site-max-transfers")) {
+		q->cross_site_max_transfers = MAX(0, (int)value);
+
+	} else if (!strcmp(name, "peer-stripe-sources")) {
+		q->peer_stripe_sources = MAX(1, (int)value);
+
+	} else if (!strcmp(name, "peer-stripe-min-size")) {
+		q->peer_stripe_min_size = MAX(1, (int64_t)value) * MEGA;
+
 	} else if (!strcmp(name, "load-from-shared-filesystem")) {
 		q->load_from_shared_fs_enabled = !!((int)value);
 
 	} else if (!strcmp(name, "perf-log-interval")) {
 		q->perf_log_interval = MAX(1, (int)value);
 
+	} else if (!strcmp(name, "memory-stats-interval")) {
+		vine_memory_set_interval(q->memory, MAX(1, (int)value));
+
 	} else if (!strcmp(name, "update-interval")) {
 		q->update_interval = MAX(1, (int)value);
 
@@ -5582,6 +7252,9 @@ int vine_tune(struct vine_manager *q, const char *name, double value)
 	} else if (!strcmp(name, "option-blocklist-slow-workers-timeout")) {
 		q->option_blocklist_slow_workers_timeout = MAX(0, value); /*todo: confirm 0 or 1*/
 
+	} else if (!strcmp(name, "speculative-quantile")) {
+		vine_enable_speculative_execution(q, value);
+
 	} else if (!strcmp(name, "watch-library-logfiles")) {
 		q->watch_library_logfiles = !!((int)value);
 
@@ -5632,7 +7305,7 @@ void vine_get_stats(struct vine_manager *q, struct vine_stats *s)
 	// s->workers_able computed below.
 
 	// info about tasks
-	s->tasks_waiting = list_size(q->ready_list);
+	s->tasks_waiting = ready_task_count(q);
 	s->tasks_with_results = list_size(q->waiting_retrieval_list);
 	s->tasks_running = itable_size(q->running_table);
 	s->tasks_on_workers = s->tasks_with_results + s->tasks_running;
@@ -5657,6 +7330,11 @@ void vine_get_stats(struct vine_manager *q, struct vine_stats *s)
 
 	s->inuse_cache = inuse_cache;
 
+	vine_loop_profile_get(q->loop_profile, s->loop_phases);
+
+	vine_memory_measure(q, 0);
+	vine_memory_get(q->memory, s->memory_bytes);
+
 	s->min_cores = rmin.cores.total;
 	s->max_cores = rmax.cores.total;
 	s->min_memory = rmin.memory.total;
@@ -5768,6 +7446,7 @@ int vine_enable_debug_log(const char *logfile)
 {
 	debug_config("vine_manager");
 	debug_config_file(logfile);
+	debug_config_buffer(VINE_DEBUG_BUFFER_SIZE);
 	debug_flags_set("all");
 	return 1;
 }
@@ -5822,6 +7501,22 @@ int vine_enable_taskgraph_log(struct vine_manager *q, const char *filename)
 	}
 }
 
+int vine_enable_replay_log(struct vine_manager *q, const char *filename)
+{
+	char *logpath = vine_get_path_log(q, filename);
+	q->replay_logfile = fopen(logpath, "w");
+	free(logpath);
+
+	if (q->replay_logfile) {
+		debug(D_VINE, "replay log enabled and is being written to %s\n", filename);
+		vine_replay_log_write_header(q);
+		return 1;
+	} else {
+		debug(D_NOTICE | D_VINE, "couldn't open replay logfile %s: %s\n", filename, strerror(errno));
+		return 0;
+	}
+}
+
 void vine_accumulate_task(struct vine_manager *q, struct vine_task *t)
 {
 	const char *name = t->category ? t->category : "default";
@@ -5850,6 +7545,12 @@ void vine_accumulate_task(struct vine_manager *q, struct vine_task *t)
 		s->time_workers_execute_good += t->time_workers_execute_last;
 		s->time_send_good += t->time_when_commit_end - t->time_when_commit_end;
 		s->time_receive_good += t->time_when_done - t->time_when_retrieval;
+
+		if (!c->vine_task_times) {
+			c->vine_task_times = quantile_sketch_create(VINE_TASK_TIME_ERROR, 0);
+		}
+		/* The same span that speculative execution measures for running tasks. */
+		quantile_sketch_insert(c->vine_task_times, t->time_when_done - t->time_when_commit_start);
 	} else {
 		s->tasks_failed++;
 
@@ -5965,11 +7666,55 @@ int vine_set_category_mode(struct vine_manager *q, const char *category, vine_ca
 	return 1;
 }
 
+/* Move all the ready tasks into the queues of their categories. */
+
+static void enable_fair_share(struct vine_manager *q)
+{
+	if (q->fair_share) {
+		return;
+	}
+
+	q->fair_share = vine_fair_share_create();
+
+	struct vine_task *t;
+	while ((t = list_pop_head(q->ready_list))) {
+		vine_fair_share_push(q->fair_share, t, 0);
+	}
+}
+
+/* Move all the ready tasks back into the single ready list, by priority. */
+
+static void disable_fair_share(struct vine_manager *q)
+{
+	struct vine_fair_share *f = q->fair_share;
+	if (!f) {
+		return;
+	}
+
+	q->fair_share = 0;
+
+	struct vine_task *t;
+	while ((t = vine_fair_share_pop(f))) {
+		insert_task_by_priority(q, t);
+	}
+
+	vine_fair_share_delete(f);
+}
+
+void vine_set_category_share(struct vine_manager *m, const char *category, double share)
+{
+	enable_fair_share(m);
+	vine_fair_share_set_weight(m->fair_share, category, share);
+}
+
 void vine_set_category_max_concurrent(struct vine_manager *m, const char *category, int max_concurrent)
 {
 	struct category *c = vine_category_lookup_or_create(m, category);
 
 	c->max_concurrent = MAX(-1, max_concurrent);
+
+	/* The limit may have been raised, so give waiting tasks another chance. */
+	wake_blocked_tasks_by_name(m, "category", c->name);
 }
 
 int vine_enable_category_resource(struct vine_manager *q, const char *category, const char *resource, int autolabel)
@@ -6112,8 +7857,9 @@ void vine_undeclare_file(struct vine_manager *m, struct vine_file *f)
 	vine_prune_file(m, f);
 
 	/* Then, remove the object from our table and delete a reference. */
-	if (hash_table_lookup(m->file_table, f->cached_name)) {
-		hash_table_remove(m->file_table, f->cached_name);
+	if (flat_table_lookup(m->file_table, f->cached_name)) {
+		vine_fetch_stats_forget(m, f->cached_name);
+		flat_table_remove(m->file_table, f->cached_name);
 		vine_file_delete(f);
 	}
 
@@ -6127,7 +7873,61 @@ void vine_undeclare_file(struct vine_manager *m, struct vine_file *f)
 
 struct vine_file *vine_manager_lookup_file(struct vine_manager *m, const char *cached_name)
 {
-	return hash_table_lookup(m->file_table, cached_name);
+	return flat_table_lookup(m->file_table, cached_name);
+}
+
+/*
+A file declared with VINE_CHECKSUM_ON_TRANSFER has a provisional name until
+its content has been checksummed while sending it to a worker.  Once the
+digest is known, the file takes the name it would have had otherwise, and
+every worker holding a replica under the old name is asked to rename it.
+If another declared file already has that name, the provisional one is kept.
+*/
+
+void vine_manager_finalize_cached_name(struct vine_manager *q, struct vine_file *f, const char *digest)
+{
+	f->checksum_pending = 0;
+
+	char *new_name = string_format("file-md5-%s", digest);
+	struct vine_file *other = vine_manager_lookup_file(q, new_name);
+	if (other && other != f) {
+		debug(D_VINE, "file %s has the same content as another declared file, keeping cached name %s", f->source, f->cached_name);
+		free(new_name);
+		return;
+	}
+
+	char *old_name = f->cached_name;
+	debug(D_VINE, "file %s is renamed from %s to %s", f->source, old_name, new_name);
+
+	char *key;
+	struct vine_worker_info *w;
+	HASH_TABLE_ITERATE(q->worker_table, key, w)
+	{
+		struct vine_file_replica *replica = vine_file_replica_table_remove(q, w, old_name);
+		if (!replica)
+			continue;
+
+		if (vine_file_replica_table_lookup(w, new_name)) {
+			vine_file_replica_delete(replica);
+		} else {
+			vine_file_replica_table_insert(q, w, new_name, replica);
+		}
+
+		vine_manager_send(q, w, "rename %s %s\n", old_name, new_name);
+	}
+
+	/* The file table borrows its key from the file, so update both together. */
+	int declared = vine_manager_lookup_file(q, old_name) == f;
+	if (declared)
+		flat_table_remove(q->file_table, old_name);
+	vine_fetch_stats_forget(q, old_name);
+
+	f->cached_name = (char *)string_intern(new_name);
+	string_intern_release(old_name);
+	free(new_name);
+
+	if (declared)
+		flat_table_insert(q->file_table, f->cached_name, f);
 }
 
 struct vine_file *vine_manager_declare_file(struct vine_manager *m, struct vine_file *f)
@@ -6144,7 +7944,7 @@ struct vine_file *vine_manager_declare_file(struct vine_manager *m, struct vine_
 		f = vine_file_addref(previous);
 	} else {
 		/* Otherwise add it to the table. */
-		hash_table_insert(m->file_table, f->cached_name, f);
+		flat_table_insert(m->file_table, f->cached_name, f);
 	}
 
 	vine_taskgraph_log_write_file(m, f);
@@ -6158,11 +7958,11 @@ struct vine_file *vine_declare_file(struct vine_manager *m, const char *source,
 
 	if (m->load_from_shared_fs_enabled) {
 		char *file_url = vine_file_make_file_url(source);
-		f = vine_file_url(file_url, cache, flags);
+		f = vine_file_url(file_url, cache, flags, m->checksum_cache);
 		free(file_url);
 
 	} else {
-		f = vine_file_local(source, cache, flags);
+		f = vine_file_local(source, cache, flags, m->checksum_cache);
 	}
 
 	return vine_manager_declare_file(m, f);
@@ -6170,7 +7970,7 @@ struct vine_file *vine_declare_file(struct vine_manager *m, const char *source,
 
 struct vine_file *vine_declare_url(struct vine_manager *m, const char *source, vine_cache_level_t cache, vine_file_flags_t flags)
 {
-	struct vine_file *f = vine_file_url(source, cache, flags);
+	struct vine_file *f = vine_file_url(source, cache, flags, m->checksum_cache);
 	return vine_manager_declare_file(m, f);
 }
 
@@ -6250,8 +8050,8 @@ const char *vine_fetch_file(struct vine_manager *m, struct vine_file *f)
 	case VINE_MINI_TASK:
 		/* If the file has been materialized remotely, go get it from a worker. */
 		{
-			struct vine_worker_info *w = vine_file_replica_table_find_worker(m, f->cached_name);
-			if (w)
+			struct vine_worker_info *w = vine_file_replica_table_find_worker(m, f->cached_name, 0);
+			if (w && !vine_worker_is_streaming(w))
 				vine_manager_get_single_file(m, w, f);
 			/* If that succeeded, then f->data is now set, null otherwise. */
 			return f->data;
@@ -6262,6 +8062,25 @@ const char *vine_fetch_file(struct vine_manager *m, struct vine_file *f)
 	return 0;
 }
 
+const char *vine_file_location(struct vine_manager *m, struct vine_file *f)
+{
+	struct set *workers = hash_table_lookup(m->file_worker_table, f->cached_name);
+	if (!workers) {
+		return 0;
+	}
+
+	struct vine_worker_info *w;
+	SET_ITERATE(workers, w)
+	{
+		struct vine_file_replica *replica = vine_file_replica_table_lookup(w, f->cached_name);
+		if (replica && replica->state == VINE_FILE_REPLICA_STATE_READY && w->addrport) {
+			return w->addrport;
+		}
+	}
+
+	return 0;
+}
+
 void vine_log_debug_app(struct vine_manager *m, const char *entry)
 {
 	debug(D_VINE, "APPLICATION %s", entry);
@@ -13,12 +13,17 @@ This module is private to the manager and should not be invoked by the end user.
 */
 
 #include "taskvine.h"
+#include "vine_task.h"
 #include <limits.h>
 
 /*
 The result of a variety of internal operations, indicating whether
 the operation succeeded, or failed due to the fault of the worker,
 the application, or the manager.
+VINE_RETRIEVAL_PENDING indicates that an output file is still
+being received in the background, see vine_manager_get.c.
+VINE_STAGING_PENDING indicates the same for an input file being
+sent, see vine_manager_put.c.
 */
 
 typedef enum {
@@ -27,6 +32,8 @@ typedef enum {
 	VINE_APP_FAILURE,
 	VINE_MGR_FAILURE,
 	VINE_END_OF_LIST,
+	VINE_RETRIEVAL_PENDING,
+	VINE_STAGING_PENDING,
 } vine_result_code_t;
 
 /*
@@ -74,6 +81,7 @@ typedef enum {
 struct vine_worker_info;
 struct vine_task;
 struct vine_file;
+struct vine_checksum_cache;
 
 struct vine_manager {
 
@@ -89,8 +97,10 @@ struct vine_manager {
 	struct hash_table *properties;   /* Set of additional properties to report to catalog server. */
 
 	struct link *manager_link;       /* Listening TCP connection for accepting new workers. */
-	struct link_info *poll_table;    /* Table for polling on all connected workers. */
+	struct link_poll_set *poll_set;  /* Persistent set of the manager link and all connected workers to be polled. */
+	struct link_info *poll_table;    /* Table receiving the links found active in poll_set. */
 	int poll_table_size;             /* Number of entries in poll_table. */
+	int manager_link_ready;          /* Set when the last poll found connections waiting on manager_link. */
 
 	/* Security configuration */
 
@@ -103,9 +113,16 @@ struct vine_manager {
 
 	struct itable *tasks;           /* Maps task_id -> vine_task of all tasks in any state. */
 	struct list   *ready_list;      /* List of vine_task that are waiting to execute. */
+	struct itable *ready_parked;    /* Maps task_id -> vine_task that is READY but held out of ready_list until it may run. */
+	struct vine_fair_share *fair_share;    /* If not null, READY vine_task are kept in a queue per category in place of ready_list. */
+	struct priority_queue *ready_deferred; /* Heap of parked vine_task waiting for a start time, ordered by earliest wakeup. */
+	struct hash_table *ready_blocked;      /* Maps event key -> list of parked vine_task waiting for that event. */
+	struct timer_wheel *task_end_timers;   /* Maps task_id -> end time of READY vine_task with a maximum end time. */
 	struct itable   *running_table;      /* Table of vine_task that are running at workers. */
 	struct list   *waiting_retrieval_list;      /* List of vine_task that are waiting to be retrieved. */
 	struct list   *retrieved_list;      /* List of vine_task that have been retrieved. */
+	int task_state_counts[VINE_TASK_DONE]; /* Number of vine_task in the tasks table in each state, kept by change_task_state. */
+	int retrieved_spilled;              /* Number of vine_task in retrieved_list whose output is kept on disk. */
 	struct list   *task_info_list;  /* List of last N vine_task_infos for computing capacity. */
 	struct hash_table *categories;  /* Maps category_name -> struct category */
 	struct hash_table *library_templates; /* Maps library name -> vine_task of library with that name. */
@@ -113,15 +130,19 @@ struct vine_manager {
 	/* Primary data structures for tracking worker state. */
 
 	struct hash_table *worker_table;     /* Maps link -> vine_worker_info */
+	struct vine_resource_index *worker_resource_index; /* Workers of worker_table bucketed by free cores and memory. */
+	struct timer_wheel *keepalive_timers; /* Maps vine_worker_info -> time its keepalive must next be checked. */
 	struct hash_table *worker_blocklist; /* Maps hostname -> vine_blocklist_info */
 	struct hash_table *factory_table;    /* Maps factory_name -> vine_factory_info */
 	struct hash_table *workers_with_watched_file_updates;  /* Maps link -> vine_worker_info */
 	struct hash_table *workers_with_complete_tasks;  /* Maps link -> vine_worker_info */
+	struct hash_table *workers_with_output_streams;  /* Maps link -> vine_worker_info receiving an output in the background. */
+	struct hash_table *dispatch_workers;  /* Maps link -> vine_worker_info with messages held during the current dispatch, see send_tasks. */
 	struct hash_table *current_transfer_table; 	/* Maps uuid -> struct transfer_pair */
 
 	/* Primary data structures for tracking files. */
 
-	struct hash_table *file_table;      /* Maps fileid -> struct vine_file.* */
+	struct flat_table *file_table;      /* Maps fileid -> struct vine_file, keyed by its own cached_name. */
 	struct hash_table *file_worker_table; /* Maps cachename -> struct set of workers with a replica of the file.* */
 	struct hash_table *temp_files_to_replicate; /* Maps cachename -> NULL. Used as a set of temp files to be replicated */
 
@@ -143,13 +164,18 @@ struct vine_manager {
 
 	struct vine_stats *stats;
 	struct vine_stats *stats_measure;
+	struct vine_loop_profile *loop_profile; /* Times of each phase of the main loop. */
+	struct vine_fetch_stats *fetch_stats;   /* Counts of the fetches of each file to the workers. */
+	struct vine_memory *memory;             /* Estimated memory held by each type of object. */
 
 	/* Time of most recent events for computing various timeouts */
 
 	timestamp_t time_last_wait;
 	timestamp_t time_last_log_stats;
 	timestamp_t time_last_large_tasks_check;
+	timestamp_t time_last_speculative_check;
 	timestamp_t link_poll_end;
+	timestamp_t loop_time;        /* Coarse clock read once per pass of vine_wait, for checking timeouts. */
 	time_t      catalog_last_update_time;
 	time_t      resources_last_update_time;
 
@@ -159,6 +185,7 @@ struct vine_manager {
 	FILE *perf_logfile;        /* Performance logfile for tracking metrics by time. */
 	FILE *txn_logfile;         /* Transaction logfile for recording every event of interest. */
 	FILE *graph_logfile;       /* Graph logfile for visualizing application structure. */
+	FILE *replay_logfile;      /* Replay logfile for recording the workload to replay offline. */
 	int perf_log_interval;	   /* Minimum interval for performance log entries in seconds. */
 	
 	/* Resource monitoring configuration. */
@@ -166,6 +193,8 @@ struct vine_manager {
 	vine_monitoring_mode_t monitor_mode;
 	struct vine_file *monitor_exe;
     int monitor_interval;
+	int monitor_shared;        /* If true, tasks are measured by the worker in a single pass, rather than each wrapped by resource_monitor. */
+	int worker_usage_interval; /* If > 0, workers report the resources used by their running tasks every this many seconds. */
 
 	struct rmsummary *measured_local_resources;
 	struct rmsummary *current_max_worker;
@@ -175,6 +204,9 @@ struct vine_manager {
 	int peer_transfers_enabled;
 	int file_source_max_transfers;
 	int worker_source_max_transfers;
+	int cross_site_max_transfers;   /* maximum number of concurrent peer transfers between sites, 0 for no limit */
+	int peer_stripe_sources;        /* maximum number of peers a single file may be fetched from at once */
+	int64_t peer_stripe_min_size;   /* files of at least this many bytes are fetched in stripes, if several peers have them */
 
 	/* Various performance knobs that can be tuned. */
 	int short_timeout;            /* Timeout in seconds to send/recv a brief message from worker */
@@ -189,10 +221,19 @@ struct vine_manager {
 	int hungry_minimum_factor;    /* queue is hungry if number of waiting tasks is less than hungry_minimum_factor * number of connected workers. */
 	int wait_for_workers;         /* Wait for these many workers to connect before dispatching tasks at start of execution. */
 	int attempt_schedule_depth;   /* number of submitted tasks to attempt scheduling before we continue to retrievals */
+	int dispatch_batch_size;      /* number of tasks to dispatch in one pass of the main loop */
+	int spill_retrieved_tasks;    /* if > 0, retrieved tasks beyond this many not yet returned keep their output on disk */
+	int64_t background_retrieval_size; /* output files of at least this many bytes are received in the background, 0 disables */
+	int64_t background_staging_size;   /* input files of at least this many bytes are sent in the background, 0 disables */
+	int chunk_directories;        /* send input directories as a manifest of chunks, and only the chunks the worker lacks */
 	int max_retrievals;           /* Do at most this number of task retrievals of either receive_one_task or receive_all_tasks_from_worker. If less
                                      than 1, prefer to receive all completed tasks before submitting new tasks. */
 	int worker_retrievals;        /* retrieve all completed tasks from a worker as opposed to recieving one of any completed task*/
 	int prefer_dispatch;          /* try to dispatch tasks even if there are retrieved tasks ready to return  */
+	struct vine_checksum_cache *checksum_cache; /* Remembered checksums of local files, so that unchanged files are not read again. */
+	char *checksum_cache_file;    /* If set, where the checksums of local files are kept between runs. */
+	FILE *checkpoint_file;        /* If set, journal of the tasks completed, kept between runs. */
+	struct hash_table *checkpoint_table; /* Maps the key of each task in the checkpoint journal to its record. */
 	int load_from_shared_fs_enabled;/* Allow worker to load file from shared filesytem instead of through manager */
 
 	int fetch_factory;            /* If true, manager queries catalog for factory configuration. */
@@ -206,6 +247,9 @@ struct vine_manager {
 	int transfer_temps_recovery;  /* If true, attempt to recover temp files from lost worker to reach threshold required */
 	int transfer_replica_per_cycle;  /* Maximum number of replica to request per temp file per iteration */
 	int temp_replica_count;       /* Number of replicas per temp file */
+	int temp_replica_demand;      /* If positive, add a replica of a temp file for each this many consumers waiting on it. */
+	int recovery_planning;        /* If true, plan the recovery of all the temp files lost with a worker at once. */
+	int recovery_replicate_depth; /* If positive, replicate temp files at least this deep in their lineage. */
 
 	double resource_submit_multiplier; /* Factor to permit overcommitment of resources at each worker.  */
 	double bandwidth_limit;            /* Artificial limit on bandwidth of manager<->worker transfers. */
@@ -226,6 +270,7 @@ struct vine_manager {
 
 	timestamp_t large_task_check_interval;	/* How frequently to check for tasks that do not fit any worker. */
 	double option_blocklist_slow_workers_timeout;	/* Default timeout for slow workers to come back to the pool, can be set prior to creating a manager. */
+	double speculative_quantile;	/* If greater than zero, duplicate running tasks slower than this quantile of their category's task times. */
 };
 
 /*
@@ -238,6 +283,12 @@ be called on the manager object by other elements of the manager process.
 struct vine_file *vine_manager_declare_file(struct vine_manager *m, struct vine_file *f);
 struct vine_file *vine_manager_lookup_file(struct vine_manager *q, const char *cached_name);
 
+/* Give a file checksummed while it was sent its permanent cached name, renaming the replicas recorded so far. */
+void vine_manager_finalize_cached_name(struct vine_manager *q, struct vine_file *f, const char *digest);
+
+/* Find the category of the given name, creating it if needed. */
+struct category *vine_category_lookup_or_create(struct vine_manager *q, const char *name);
+
 /* Send a printf-style message to a remote worker. */
 #ifndef SWIG
 __attribute__ (( format(printf,3,4) ))
@@ -15,6 +15,8 @@ See the file COPYING for details.
 
 #include "create_dir.h"
 #include "debug.h"
+#include "flat_table.h"
+#include "full_io.h"
 #include "host_disk_info.h"
 #include "link.h"
 #include "macros.h"
@@ -89,22 +91,38 @@ static vine_result_code_t vine_manager_get_buffer(struct vine_manager *q, struct
 }
 
 /*
-Receive the contents of a single file from a worker.
-The "file" header has already been received, just
-bring back the streaming data within various constraints.
+Output files of at least q->background_retrieval_size bytes are received
+in the background: once the "file" header arrives, the local file is opened
+and the data is consumed by vine_manager_get_output_stream each time the
+worker link becomes readable, so that the manager keeps scheduling and
+talking to other workers while the data arrives.  A worker has at most one
+such transfer in progress, and is not sent further requests until it ends.
 */
 
-static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *local_name, int64_t length, int mode)
-{
-	// If a bandwidth limit is in effect, choose the effective stoptime.
-	timestamp_t effective_stoptime = 0;
-	if (q->bandwidth_limit) {
-		effective_stoptime = (length / q->bandwidth_limit) * 1000000 + timestamp_get();
-	}
+#define VINE_OUTPUT_STREAM_BUFFER_SIZE (1024 * 1024)
 
-	// Choose the actual stoptime.
-	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+struct vine_output_stream {
+	struct vine_task *t;
+	struct vine_mount *m;
+	char *local_name;
+	char *buffer;
+	int fd;
+	int mode;
+	int64_t length;
+	int64_t received;
+	vine_result_code_t result;
+	time_t stoptime;
+	timestamp_t open_time;
+};
+
+/*
+Open the local file that receives an incoming item of the given length,
+creating its parent directories if necessary.
+Returns the file descriptor, or -1 on failure.
+*/
 
+static int open_local_file(struct vine_manager *q, struct vine_worker_info *w, const char *local_name, int64_t length, time_t stoptime)
+{
 	// If necessary, create parent directories of the file.
 	char dirname[VINE_LINE_MAX];
 	path_dirname(local_name, dirname);
@@ -112,7 +130,7 @@ static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q,
 		if (!create_dir(dirname, 0777)) {
 			debug(D_VINE, "Could not create directory - %s (%s)", dirname, strerror(errno));
 			link_soak(w->link, length, stoptime);
-			return VINE_MGR_FAILURE;
+			return -1;
 		}
 	}
 
@@ -122,13 +140,38 @@ static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q,
 	// Check if there is space for incoming file at manager
 	if (!check_disk_space_for_filesize(dirname, length, q->disk_avail_threshold)) {
 		debug(D_VINE, "Could not receive file %s, not enough disk space (%" PRId64 " bytes needed)\n", local_name, length);
-		return VINE_MGR_FAILURE;
+		return -1;
 	}
 
 	int fd = open(local_name, O_WRONLY | O_TRUNC | O_CREAT, 0777);
 	if (fd < 0) {
 		debug(D_NOTICE, "Cannot open file %s for writing: %s", local_name, strerror(errno));
 		link_soak(w->link, length, stoptime);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+Receive the contents of a single file from a worker.
+The "file" header has already been received, just
+bring back the streaming data within various constraints.
+*/
+
+static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *local_name, int64_t length, int mode)
+{
+	// If a bandwidth limit is in effect, choose the effective stoptime.
+	timestamp_t effective_stoptime = 0;
+	if (q->bandwidth_limit) {
+		effective_stoptime = (length / q->bandwidth_limit) * 1000000 + timestamp_get();
+	}
+
+	// Choose the actual stoptime.
+	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+
+	int fd = open_local_file(q, w, local_name, length, stoptime);
+	if (fd < 0) {
 		return VINE_MGR_FAILURE;
 	}
 
@@ -158,6 +201,60 @@ static vine_result_code_t vine_manager_get_file_contents(struct vine_manager *q,
 	return VINE_SUCCESS;
 }
 
+/*
+Decide whether a file of this length should be received in the background.
+A bandwidth limit needs the synchronous path to pace the transfer, and an
+ssl link may hold decrypted data that a poll on the socket would not report.
+*/
+
+static int use_output_stream(struct vine_manager *q, struct vine_worker_info *w, int64_t length)
+{
+	return q->background_retrieval_size > 0 && length >= q->background_retrieval_size && !q->bandwidth_limit && !link_using_ssl(w->link);
+}
+
+/*
+Begin receiving a single file from a worker in the background,
+after the "file" header has already been received.
+*/
+
+static vine_result_code_t vine_manager_start_output_stream(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *local_name, int64_t length, int mode)
+{
+	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+
+	int fd = open_local_file(q, w, local_name, length, stoptime);
+	if (fd < 0) {
+		return VINE_MGR_FAILURE;
+	}
+
+	struct vine_output_stream *s = calloc(1, sizeof(*s));
+	s->t = t;
+	s->local_name = strdup(local_name);
+	s->buffer = malloc(VINE_OUTPUT_STREAM_BUFFER_SIZE);
+	s->fd = fd;
+	s->mode = mode;
+	s->length = length;
+	s->result = VINE_SUCCESS;
+	s->stoptime = stoptime;
+
+	w->output_stream = s;
+	hash_table_insert(q->workers_with_output_streams, w->hashkey, w);
+
+	debug(D_VINE, "Receiving file %s from %s (%s) in the background", local_name, w->addrport, w->hostname);
+
+	return VINE_RETRIEVAL_PENDING;
+}
+
+static void vine_output_stream_delete(struct vine_output_stream *s)
+{
+	if (s->fd >= 0) {
+		close(s->fd);
+		unlink(s->local_name);
+	}
+	free(s->local_name);
+	free(s->buffer);
+	free(s);
+}
+
 /*
 Get the contents of a symlink back from the worker,
 after the "symlink" header has already been received.
@@ -194,11 +291,13 @@ is stored under that filename.  Otherwise, it is placed
 in the directory dirname with the filename given by the
 worker.  This allows this function to handle both the
 top-level case of renamed files as well as interior files
-within a directory.
+within a directory.  If background is set, a large file
+may be left to be received by vine_manager_get_output_stream,
+in which case VINE_RETRIEVAL_PENDING is returned.
 */
 
 static vine_result_code_t vine_manager_get_any(
-		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *dirname, const char *forced_name, int64_t *totalsize)
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *dirname, const char *forced_name, int64_t *totalsize, int background)
 {
 	char line[VINE_LINE_MAX];
 	char name_encoded[VINE_LINE_MAX];
@@ -224,7 +323,11 @@ static vine_result_code_t vine_manager_get_any(
 		} else {
 			subname = string_format("%s/%s", dirname, name);
 		}
-		r = vine_manager_get_file_contents(q, w, t, subname, size, mode);
+		if (background && use_output_stream(q, w, size)) {
+			r = vine_manager_start_output_stream(q, w, t, subname, size, mode);
+		} else {
+			r = vine_manager_get_file_contents(q, w, t, subname, size, mode);
+		}
 		free(subname);
 
 		if (r == VINE_SUCCESS)
@@ -298,7 +401,7 @@ static vine_result_code_t vine_manager_get_dir_contents(struct vine_manager *q,
 	}
 
 	while (1) {
-		int r = vine_manager_get_any(q, w, t, dirname, 0, totalsize);
+		int r = vine_manager_get_any(q, w, t, dirname, 0, totalsize, 0);
 		if (r == VINE_SUCCESS) {
 			// Successfully received one item.
 			continue;
@@ -324,28 +427,19 @@ vine_result_code_t vine_manager_get_single_file(struct vine_manager *q, struct v
 }
 
 /*
-Get a single output file, located at the worker under 'cached_name'.
+Account for an output file once it has been received, and if the
+transfer was successful, make a record of it in the replica table.
 */
 
-vine_result_code_t vine_manager_get_output_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_mount *m, struct vine_file *f)
+static vine_result_code_t vine_manager_finish_output_file(struct vine_manager *q,
+		struct vine_worker_info *w,
+		struct vine_task *t,
+		struct vine_mount *m,
+		struct vine_file *f,
+		vine_result_code_t result,
+		int64_t total_bytes,
+		timestamp_t open_time)
 {
-	int64_t total_bytes = 0;
-	vine_result_code_t result = VINE_SUCCESS; // return success unless something fails below.
-
-	timestamp_t open_time = timestamp_get();
-
-	debug(D_VINE, "%s (%s) sending back %s to %s", w->hostname, w->addrport, f->cached_name, f->source);
-
-	if (f->type == VINE_FILE) {
-		vine_manager_send(q, w, "get %s\n", f->cached_name);
-		result = vine_manager_get_any(q, w, t, 0, f->source, &total_bytes);
-	} else if (f->type == VINE_BUFFER) {
-		vine_manager_send(q, w, "getfile %s\n", f->cached_name);
-		result = vine_manager_get_buffer(q, w, t, f, &total_bytes);
-	} else {
-		result = VINE_APP_FAILURE;
-	}
-
 	timestamp_t close_time = timestamp_get();
 	timestamp_t sum_time = close_time - open_time;
 
@@ -403,19 +497,83 @@ vine_result_code_t vine_manager_get_output_file(struct vine_manager *q, struct v
 	return result;
 }
 
-/* Get all output files produced by a given task on this worker. */
+/*
+Get a single output file, located at the worker under 'cached_name'.
+If background is set, the file may still be in transit when this
+function returns VINE_RETRIEVAL_PENDING.
+*/
+
+static vine_result_code_t get_output_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_mount *m, struct vine_file *f, int background)
+{
+	int64_t total_bytes = 0;
+	vine_result_code_t result = VINE_SUCCESS; // return success unless something fails below.
+
+	timestamp_t open_time = timestamp_get();
+
+	debug(D_VINE, "%s (%s) sending back %s to %s", w->hostname, w->addrport, f->cached_name, f->source);
+
+	if (f->type == VINE_FILE) {
+		vine_manager_send(q, w, "get %s\n", f->cached_name);
+		result = vine_manager_get_any(q, w, t, 0, f->source, &total_bytes, background);
+	} else if (f->type == VINE_BUFFER) {
+		vine_manager_send(q, w, "getfile %s\n", f->cached_name);
+		result = vine_manager_get_buffer(q, w, t, f, &total_bytes);
+	} else {
+		result = VINE_APP_FAILURE;
+	}
+
+	if (result == VINE_RETRIEVAL_PENDING) {
+		w->output_stream->m = m;
+		w->output_stream->open_time = open_time;
+		return result;
+	}
+
+	return vine_manager_finish_output_file(q, w, t, m, f, result, total_bytes, open_time);
+}
+
+vine_result_code_t vine_manager_get_output_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_mount *m, struct vine_file *f)
+{
+	return get_output_file(q, w, t, m, f, 0);
+}
+
+/*
+Combine the result of one output file into the result of all of them:
+worker and manager failures stop the retrieval, while an application
+failure is noted and the remaining files are still retrieved.
+*/
+
+static vine_result_code_t combine_output_results(vine_result_code_t all_files, vine_result_code_t single_file)
+{
+	if (single_file == VINE_WORKER_FAILURE || single_file == VINE_MGR_FAILURE || single_file == VINE_APP_FAILURE) {
+		return single_file;
+	} else {
+		return all_files;
+	}
+}
+
+/*
+Get all output files produced by a given task on this worker.
+If a large file is left to be received in the background, return
+VINE_RETRIEVAL_PENDING, and call again once the transfer is complete
+to continue with the remaining files.
+*/
 
 vine_result_code_t vine_manager_get_output_files(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
 {
 
 	int task_succeeded = (t->result == VINE_RESULT_SUCCESS && t->exit_code == 0);
 
-	vine_result_code_t result_all_files = VINE_SUCCESS;
+	vine_result_code_t result_all_files = t->output_mounts_result;
 
-	if (t->output_mounts) {
+	if (t->output_mounts && result_all_files != VINE_WORKER_FAILURE && result_all_files != VINE_MGR_FAILURE) {
 		struct vine_mount *m;
+		int index = 0;
 		LIST_ITERATE(t->output_mounts, m)
 		{
+			// skip the files handled before a background transfer.
+			if (index++ < t->output_mounts_retrieved)
+				continue;
+
 			// non-file objects are handled by the worker.
 			if (m->file->type != VINE_FILE && m->file->type != VINE_BUFFER && m->file->type != VINE_TEMP)
 				continue;
@@ -431,29 +589,166 @@ vine_result_code_t vine_manager_get_output_files(struct vine_manager *q, struct
 			vine_result_code_t result_single_file = VINE_SUCCESS;
 			if (m->file->type == VINE_TEMP) {
 				// if temp, check that we got a cache update message.
-				struct vine_file *f = hash_table_lookup(q->file_table, m->file->cached_name);
+				struct vine_file *f = flat_table_lookup(q->file_table, m->file->cached_name);
 				if (!f || f->state != VINE_FILE_STATE_CREATED) {
 					result_single_file = VINE_APP_FAILURE;
 				}
 			} else {
 				// otherwise, get the file.
-				result_single_file = vine_manager_get_output_file(q, w, t, m, m->file);
+				result_single_file = get_output_file(q, w, t, m, m->file, 1);
+			}
+
+			// if the file is still arriving, remember where to resume.
+			if (result_single_file == VINE_RETRIEVAL_PENDING) {
+				t->output_mounts_retrieved = index;
+				t->output_mounts_result = result_all_files;
+				return VINE_RETRIEVAL_PENDING;
 			}
 
 			// if success or app-level failure, continue to get other files.
 			// if worker failure, return.
-			if (result_single_file == VINE_WORKER_FAILURE || result_single_file == VINE_MGR_FAILURE) {
-				result_all_files = result_single_file;
+			result_all_files = combine_output_results(result_all_files, result_single_file);
+			if (result_all_files == VINE_WORKER_FAILURE || result_all_files == VINE_MGR_FAILURE) {
 				break;
-			} else if (result_single_file == VINE_APP_FAILURE) {
-				result_all_files = result_single_file;
 			}
 		}
 	}
 
+	t->output_mounts_retrieved = 0;
+	t->output_mounts_result = VINE_SUCCESS;
+
 	return result_all_files;
 }
 
+/*
+Receive the data available on the link for the file that is being
+received in the background from this worker.  Returns VINE_RETRIEVAL_PENDING
+while more data is expected, and VINE_WORKER_FAILURE if the link failed,
+in which case the worker should be removed.  Otherwise the transfer is over,
+its outcome is recorded in the task, which is returned in *t so that the
+remaining outputs can be retrieved.  *t is null if the task was released
+from the worker while the transfer was in progress.
+*/
+
+vine_result_code_t vine_manager_get_output_stream(struct vine_manager *q, struct vine_worker_info *w, struct vine_task **t)
+{
+	struct vine_output_stream *s = w->output_stream;
+
+	*t = 0;
+
+	int64_t chunk = MIN(VINE_OUTPUT_STREAM_BUFFER_SIZE, s->length - s->received);
+	ssize_t actual = link_read_avail(w->link, s->buffer, chunk, s->stoptime);
+	if (actual <= 0) {
+		debug(D_VINE, "Failed to receive file %s from %s (%s) after %" PRId64 " of %" PRId64 " bytes", s->local_name, w->addrport, w->hostname, s->received, s->length);
+		return VINE_WORKER_FAILURE;
+	}
+
+	w->last_msg_recv_time = timestamp_get();
+	s->received += actual;
+
+	if (s->fd >= 0 && full_write(s->fd, s->buffer, actual) != actual) {
+		// Keep consuming the data so that the link stays in sync.
+		warn(D_VINE, "Could not write file %s: %s\n", s->local_name, strerror(errno));
+		close(s->fd);
+		unlink(s->local_name);
+		s->fd = -1;
+		s->result = VINE_MGR_FAILURE;
+	}
+
+	if (s->received < s->length) {
+		if (time(0) > s->stoptime) {
+			debug(D_VINE, "Timed out receiving file %s from %s (%s)", s->local_name, w->addrport, w->hostname);
+			return VINE_WORKER_FAILURE;
+		}
+		return VINE_RETRIEVAL_PENDING;
+	}
+
+	vine_result_code_t result = s->result;
+
+	if (s->fd >= 0) {
+		fchmod(s->fd, s->mode);
+		if (close(s->fd) < 0) {
+			warn(D_VINE, "Could not write file %s: %s\n", s->local_name, strerror(errno));
+			unlink(s->local_name);
+			result = VINE_MGR_FAILURE;
+		}
+		s->fd = -1;
+	}
+
+	if (s->t) {
+		int64_t total_bytes = result == VINE_SUCCESS ? s->length : 0;
+		result = vine_manager_finish_output_file(q, w, s->t, s->m, s->m->file, result, total_bytes, s->open_time);
+		s->t->output_mounts_result = combine_output_results(s->t->output_mounts_result, result);
+		*t = s->t;
+	}
+
+	w->output_stream = 0;
+	hash_table_remove(q->workers_with_output_streams, w->hashkey);
+	vine_output_stream_delete(s);
+
+	return result;
+}
+
+/*
+The task is leaving the worker while its output is still in transit.
+The partial file is discarded, but the rest of the data must still be
+consumed to keep the link in sync.
+*/
+
+void vine_manager_release_output_stream(struct vine_worker_info *w, struct vine_task *t)
+{
+	struct vine_output_stream *s = w->output_stream;
+
+	if (!s || s->t != t)
+		return;
+
+	if (s->fd >= 0) {
+		close(s->fd);
+		unlink(s->local_name);
+		s->fd = -1;
+	}
+
+	s->t = 0;
+	t->output_mounts_retrieved = 0;
+	t->output_mounts_result = VINE_SUCCESS;
+}
+
+/*
+Return true if the transfer in progress from this worker is past its
+deadline.  A stalled worker never makes its link readable, so this is
+checked on every pass rather than only when data arrives.
+*/
+
+int vine_manager_output_stream_expired(struct vine_worker_info *w, time_t current_time)
+{
+	struct vine_output_stream *s = w->output_stream;
+
+	if (!s || current_time <= s->stoptime)
+		return 0;
+
+	debug(D_VINE, "Timed out receiving file %s from %s (%s) after %" PRId64 " of %" PRId64 " bytes", s->local_name, w->addrport, w->hostname, s->received, s->length);
+	return 1;
+}
+
+/* Discard the transfer in progress when the worker is removed. */
+
+void vine_manager_abort_output_stream(struct vine_worker_info *w)
+{
+	struct vine_output_stream *s = w->output_stream;
+
+	if (!s)
+		return;
+
+	debug(D_VINE, "Discarding partial file %s from %s (%s)", s->local_name, w->addrport, w->hostname);
+
+	if (s->t) {
+		vine_manager_release_output_stream(w, s->t);
+	}
+
+	w->output_stream = 0;
+	vine_output_stream_delete(s);
+}
+
 /*
 Get only the resource monitor output file for a given task,
 usually because the task has failed, and we want to know why.
@@ -25,5 +25,10 @@ vine_result_code_t vine_manager_get_output_files( struct vine_manager *q, struct
 vine_result_code_t vine_manager_get_stdout(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t);
 vine_result_code_t vine_manager_get_monitor_output_file( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
 
+vine_result_code_t vine_manager_get_output_stream( struct vine_manager *q, struct vine_worker_info *w, struct vine_task **t );
+void vine_manager_release_output_stream( struct vine_worker_info *w, struct vine_task *t );
+int vine_manager_output_stream_expired( struct vine_worker_info *w, time_t current_time );
+void vine_manager_abort_output_stream( struct vine_worker_info *w );
+
 #endif
 
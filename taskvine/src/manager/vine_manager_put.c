@@ -5,20 +5,27 @@ See the file COPYING for details.
 */
 
 #include "vine_manager_put.h"
+#include "vine_checksum.h"
 #include "vine_current_transfers.h"
+#include "vine_fetch_stats.h"
 #include "vine_file.h"
 #include "vine_file_replica.h"
 #include "vine_file_replica_table.h"
+#include "vine_manifest.h"
 #include "vine_mount.h"
 #include "vine_protocol.h"
 #include "vine_task.h"
 #include "vine_txn_log.h"
 #include "vine_worker_info.h"
 
+#include "buffer.h"
 #include "create_dir.h"
 #include "debug.h"
+#include "full_io.h"
 #include "host_disk_info.h"
 #include "link.h"
+#include "macros.h"
+#include "md5.h"
 #include "path.h"
 #include "rmsummary.h"
 #include "stringtools.h"
@@ -33,6 +40,37 @@ See the file COPYING for details.
 
 char *vine_monitor_wrap(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct rmsummary *limits);
 
+/*
+Input files of at least q->background_staging_size bytes are sent in the
+background: the headers are sent right away, and then the data is written
+by vine_manager_put_input_stream each time the worker link can accept more,
+so that the manager keeps dispatching to other workers meanwhile.
+Nothing else may be written to the link until the transfer ends, so any
+message sent to the worker in the meantime is deferred, and tasks that need
+to send their own inputs wait in w->staging_tasks.
+*/
+
+#define VINE_INPUT_STREAM_BUFFER_SIZE (1024 * 1024)
+
+struct vine_input_stream {
+	struct vine_task *t;
+	struct vine_mount *m;
+	struct vine_file *file;
+	struct vine_file *sent_file;
+	char *buffer;
+	int64_t buffer_start;
+	int64_t buffer_length;
+	int fd;
+	int64_t length;
+	int64_t sent;
+	time_t stoptime;
+	timestamp_t open_time;
+	buffer_t deferred;
+	char *sent_name;
+	struct stat info;
+	md5_context_t *context;
+};
+
 /*
 Send a symbolic link to the remote worker.
 Note that the target of the link is sent
@@ -60,14 +98,49 @@ static int vine_manager_put_symlink(struct vine_manager *q, struct vine_worker_i
 	return VINE_SUCCESS;
 }
 
+/*
+Send the contents of a file like link_stream_from_fd,
+but also add the data to the given checksum on the way.
+*/
+
+static int64_t stream_from_fd_with_checksum(struct link *link, int fd, int64_t length, md5_context_t *context, time_t stoptime)
+{
+	char buffer[65536];
+	int64_t total = 0;
+
+	while (length > 0) {
+		ssize_t ractual = full_read(fd, buffer, MIN((int64_t)sizeof(buffer), length));
+		if (ractual <= 0)
+			break;
+
+		md5_update(context, buffer, ractual);
+
+		ssize_t wactual = link_putlstring(link, buffer, ractual, stoptime);
+		if (wactual != ractual)
+			return -1;
+
+		total += ractual;
+		length -= ractual;
+	}
+
+	return total;
+}
+
 /*
 Send a single file to the remote worker.
 The transfer time is controlled by the size of the file.
 If the transfer takes too long, then cancel it.
+If context is given, the checksum of the file is computed as it is sent.
 */
 
-static int vine_manager_put_file(
-		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, const char *localname, const char *remotename, struct stat info, int64_t *total_bytes)
+static int vine_manager_put_file(struct vine_manager *q,
+		struct vine_worker_info *w,
+		struct vine_task *t,
+		const char *localname,
+		const char *remotename,
+		struct stat info,
+		int64_t *total_bytes,
+		md5_context_t *context)
 {
 	time_t stoptime;
 	timestamp_t effective_stoptime = 0;
@@ -94,7 +167,11 @@ static int vine_manager_put_file(
 
 	stoptime = time(0) + vine_manager_transfer_time(q, w, length);
 	vine_manager_send(q, w, "file %s %" PRId64 " 0%o %lld\n", remotename_encoded, length, mode, (long long)info.st_mtime);
-	actual = link_stream_from_fd(w->link, fd, length, stoptime);
+	if (context) {
+		actual = stream_from_fd_with_checksum(w->link, fd, length, context, stoptime);
+	} else {
+		actual = link_stream_from_fd(w->link, fd, length, stoptime);
+	}
 	close(fd);
 
 	*total_bytes += actual;
@@ -195,7 +272,7 @@ static vine_result_code_t vine_manager_put_file_or_dir(
 		} else if (S_ISLNK(info.st_mode)) {
 			result = vine_manager_put_symlink(q, w, t, localpath, remotepath, total_bytes);
 		} else if (S_ISREG(info.st_mode)) {
-			result = vine_manager_put_file(q, w, t, localpath, remotepath, info, total_bytes);
+			result = vine_manager_put_file(q, w, t, localpath, remotepath, info, total_bytes, 0);
 		} else {
 			debug(D_NOTICE, "skipping unusual file: %s", strerror(errno));
 		}
@@ -214,7 +291,7 @@ may be an estimate at this point and will be updated by return
 message once the object is actually loaded into the cache.
 */
 
-vine_result_code_t vine_manager_put_url_now(struct vine_manager *q, struct vine_worker_info *w, const char *source, struct vine_file *f)
+vine_result_code_t vine_manager_put_url_now(struct vine_manager *q, struct vine_worker_info *w, struct vine_worker_info *source_worker, const char *source, struct vine_file *f)
 {
 	if (vine_file_replica_table_lookup(w, f->cached_name)) {
 		/* do nothing, file already at worker */
@@ -232,7 +309,7 @@ vine_result_code_t vine_manager_put_url_now(struct vine_manager *q, struct vine_
 	url_encode(source, source_encoded, sizeof(source_encoded));
 	url_encode(f->cached_name, cached_name_encoded, sizeof(cached_name_encoded));
 
-	char *transfer_id = vine_current_transfers_add(q, w, f->source_worker, source);
+	char *transfer_id = vine_current_transfers_add(q, w, source_worker, source);
 
 	vine_manager_send(q, w, "puturl_now %s %s %d %lld 0%o %s\n", source_encoded, cached_name_encoded, f->cache_level, (long long)f->size, mode, transfer_id);
 
@@ -270,6 +347,14 @@ vine_result_code_t vine_manager_put_url(struct vine_manager *q, struct vine_work
 
 	char *transfer_id = vine_current_transfers_add(q, w, f->source_worker, f->source);
 
+	if (f->stripe_workers) {
+		struct vine_worker_info *source;
+		LIST_ITERATE(f->stripe_workers, source)
+		{
+			vine_current_transfers_add_source(q, transfer_id, source);
+		}
+	}
+
 	vine_manager_send(q, w, "puturl %s %s %d %lld 0%o %s\n", source_encoded, cached_name_encoded, f->cache_level, (long long)f->size, mode, transfer_id);
 
 	struct vine_file_replica *replica = vine_file_replica_create(f->type, f->cache_level, f->size, f->mtime);
@@ -295,6 +380,254 @@ vine_result_code_t vine_manager_put_buffer(struct vine_manager *q, struct vine_w
 	}
 }
 
+/*
+Once a file with a provisional cached name has been sent as sent_name,
+give it its permanent name from the checksum computed on the way,
+provided that the file did not change while it was being read.
+If the file has been renamed, whether now or by another transfer that
+finished first, the worker is told to rename the copy it just received.
+*/
+
+static void vine_manager_finish_pending_file(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f, const char *sent_name, struct stat *before, md5_context_t *context)
+{
+	if (context && f->checksum_pending) {
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		md5_final(digest, context);
+
+		struct stat after;
+		if (stat(f->source, &after) == 0 && after.st_ino == before->st_ino && after.st_size == before->st_size && after.st_mtime == before->st_mtime) {
+			const char *hash = md5_to_string(digest);
+			vine_checksum_remember(q->checksum_cache, f->source, before, hash);
+			vine_manager_finalize_cached_name(q, f, hash);
+		} else {
+			debug(D_VINE, "file %s changed while being sent, keeping cached name %s", f->source, f->cached_name);
+		}
+	}
+
+	if (strcmp(sent_name, f->cached_name)) {
+		/* The worker keeps only one copy if it already had the permanent name. */
+		struct vine_file_replica *existing = vine_file_replica_table_remove(q, w, f->cached_name);
+		if (existing)
+			vine_file_replica_delete(existing);
+
+		vine_manager_send(q, w, "rename %s %s\n", sent_name, f->cached_name);
+	}
+}
+
+/* Send a file with a provisional cached name, computing its checksum along the way. */
+
+static vine_result_code_t vine_manager_put_pending_file(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_file *f, struct stat info, int64_t *total_bytes)
+{
+	md5_context_t context;
+	md5_init(&context);
+
+	char *sent_name = xxstrdup(f->cached_name);
+
+	vine_result_code_t result = vine_manager_put_file(q, w, t, f->source, sent_name, info, total_bytes, &context);
+	if (result == VINE_SUCCESS) {
+		vine_manager_finish_pending_file(q, w, f, sent_name, &info, &context);
+	}
+
+	free(sent_name);
+	return result;
+}
+
+/*
+Send the chunks of a manifest that the worker asked for, in the order asked.
+The chunks are read from the local files at the offsets found when the
+manifest was made, and the worker checks each one against its hash.
+*/
+
+static vine_result_code_t vine_manager_put_chunks(struct vine_manager *q, struct vine_worker_info *w, struct vine_manifest *manifest, char *missing, int64_t bytes, int64_t *total_bytes)
+{
+	time_t stoptime = time(0) + vine_manager_transfer_time(q, w, bytes);
+	char *buffer = xxmalloc(VINE_MANIFEST_CHUNK_MAX);
+	char *path = 0;
+	int fd = -1;
+
+	vine_result_code_t result = VINE_SUCCESS;
+
+	char *hash = strtok(missing, "\n");
+	for (; hash; hash = strtok(0, "\n")) {
+		struct vine_manifest_chunk *c = vine_manifest_lookup(manifest, hash);
+		if (!c) {
+			debug(D_VINE, "%s (%s) asked for unknown chunk %s", w->hostname, w->addrport, hash);
+			result = VINE_WORKER_FAILURE;
+			break;
+		}
+
+		if (!path || strcmp(path, c->path)) {
+			if (fd >= 0)
+				close(fd);
+			free(path);
+			path = xxstrdup(c->path);
+			fd = open(path, O_RDONLY, 0);
+		}
+
+		if (fd < 0 || full_pread64(fd, buffer, c->length, c->offset) != c->length) {
+			// The file changed underneath us, and the worker expects the full chunk.
+			debug(D_NOTICE, "Cannot read chunk of %s: %s", c->path, fd < 0 ? strerror(errno) : "file is shorter than expected");
+			result = VINE_WORKER_FAILURE;
+			break;
+		}
+
+		if (link_putlstring(w->link, buffer, c->length, stoptime) != c->length) {
+			result = VINE_WORKER_FAILURE;
+			break;
+		}
+
+		*total_bytes += c->length;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	free(buffer);
+
+	return result;
+}
+
+/*
+Send a directory as a manifest of content-defined chunks.
+The worker answers with the hashes of the chunks that it does not find
+in its cache, and then only those chunks are sent.  The manifest is kept
+with the file, so that the directory is read only once for all workers.
+*/
+
+static vine_result_code_t vine_manager_put_manifest(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_file *f, int64_t *total_bytes)
+{
+	if (!f->manifest) {
+		f->manifest = vine_manifest_create(f->source, f->cached_name);
+		if (!f->manifest)
+			return VINE_APP_FAILURE;
+	}
+
+	size_t length;
+	const char *text = vine_manifest_text(f->manifest, &length);
+
+	vine_manager_send(q, w, "putmanifest %s %d %lld %zu\n", f->cached_name, f->cache_level, (long long)f->size, length);
+	if (link_putlstring(w->link, text, length, time(0) + vine_manager_transfer_time(q, w, length)) != (ssize_t)length)
+		return VINE_WORKER_FAILURE;
+
+	*total_bytes += length;
+
+	/* Messages of a dispatch may be held in the output buffer, and the worker must see them before it answers. */
+	if (link_flush_output(w->link) < 0)
+		return VINE_WORKER_FAILURE;
+
+	char line[VINE_LINE_MAX];
+	int64_t count, bytes;
+
+	vine_msg_code_t mcode = vine_manager_recv(q, w, line, sizeof(line));
+	if (mcode != VINE_MSG_NOT_PROCESSED || sscanf(line, "missing %" SCNd64 " %" SCNd64, &count, &bytes) != 2 || bytes < 0)
+		return VINE_WORKER_FAILURE;
+
+	char *missing = xxmalloc(bytes + 1);
+	if (link_read(w->link, missing, bytes, time(0) + vine_manager_transfer_time(q, w, bytes)) != bytes) {
+		free(missing);
+		return VINE_WORKER_FAILURE;
+	}
+	missing[bytes] = 0;
+
+	int64_t sent = *total_bytes;
+	vine_result_code_t result = vine_manager_put_chunks(q, w, f->manifest, missing, count * VINE_MANIFEST_CHUNK_MAX, total_bytes);
+	free(missing);
+
+	debug(D_VINE,
+			"%s (%s) lacked %" PRId64 " of %d chunks of %s, sent %" PRId64 " of %" PRId64 " bytes",
+			w->hostname,
+			w->addrport,
+			count,
+			list_size(vine_manifest_chunks(f->manifest)),
+			f->source,
+			*total_bytes - sent,
+			vine_manifest_size(f->manifest));
+
+	return result;
+}
+
+/*
+Decide whether a top-level input file should be sent in the background.
+As for outputs, bandwidth limits and ssl links use the synchronous path.
+*/
+
+static int use_input_stream(struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f, struct stat *info)
+{
+	if (q->background_staging_size <= 0 || q->bandwidth_limit || link_using_ssl(w->link))
+		return 0;
+
+	if (stat(f->source, info) < 0 || !S_ISREG(info->st_mode))
+		return 0;
+
+	return info->st_size >= q->background_staging_size;
+}
+
+/*
+Begin sending a single input file to the worker in the background.
+The original file m->file is recorded in the replica table once the
+data of f has been sent, as in vine_manager_put_input_file_if_needed.
+*/
+
+static vine_result_code_t vine_manager_start_input_stream(
+		struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t, struct vine_mount *m, struct vine_file *f, struct stat info, timestamp_t open_time)
+{
+	int mode = (info.st_mode | 0x600) & 0777;
+	int64_t length = info.st_size;
+
+	int fd = open(f->source, O_RDONLY, 0);
+	if (fd < 0) {
+		debug(D_NOTICE, "Cannot open file %s: %s", f->source, strerror(errno));
+		return VINE_APP_FAILURE;
+	}
+
+	char remotename_encoded[VINE_LINE_MAX];
+	url_encode(f->cached_name, remotename_encoded, sizeof(remotename_encoded));
+
+	vine_manager_send(q, w, "put %s %d %lld\n", f->cached_name, f->cache_level, (long long)f->size);
+	vine_manager_send(q, w, "file %s %" PRId64 " 0%o %lld\n", remotename_encoded, length, mode, (long long)info.st_mtime);
+
+	struct vine_input_stream *s = calloc(1, sizeof(*s));
+	s->t = t;
+	s->m = m;
+	s->file = vine_file_addref(m->file);
+	s->sent_file = vine_file_addref(f);
+	s->buffer = malloc(VINE_INPUT_STREAM_BUFFER_SIZE);
+	s->fd = fd;
+	s->length = length;
+	s->stoptime = time(0) + vine_manager_transfer_time(q, w, length);
+	s->open_time = open_time;
+	buffer_init(&s->deferred);
+	buffer_abortonfailure(&s->deferred, 1);
+	s->sent_name = xxstrdup(f->cached_name);
+	s->info = info;
+
+	if (f == m->file && f->checksum_pending) {
+		s->context = xxmalloc(sizeof(*s->context));
+		md5_init(s->context);
+	}
+
+	w->input_stream = s;
+
+	debug(D_VINE, "Sending file %s (size: %" PRId64 " bytes) to %s (%s) in the background", f->source, length, w->addrport, w->hostname);
+
+	return VINE_STAGING_PENDING;
+}
+
+static void vine_input_stream_delete(struct vine_input_stream *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	vine_file_delete(s->file);
+	vine_file_delete(s->sent_file);
+	buffer_free(&s->deferred);
+	free(s->buffer);
+	free(s->sent_name);
+	free(s->context);
+	free(s);
+}
+
 /*
 Send a single input file of any type to the given worker, and record the performance.
 If the file has a chained dependency, send that first.
@@ -307,11 +640,24 @@ static vine_result_code_t vine_manager_put_input_file(struct vine_manager *q, st
 
 	timestamp_t open_time = timestamp_get();
 
+	struct stat info;
+
 	switch (f->type) {
 	case VINE_FILE:
 		debug(D_VINE, "%s (%s) needs file %s as %s", w->hostname, w->addrport, f->source, m->remote_name);
+		if (use_input_stream(q, w, f, &info)) {
+			return vine_manager_start_input_stream(q, w, t, m, f, info, open_time);
+		}
+		if (q->chunk_directories && stat(f->source, &info) == 0 && S_ISDIR(info.st_mode)) {
+			result = vine_manager_put_manifest(q, w, t, f, &total_bytes);
+			break;
+		}
 		vine_manager_send(q, w, "put %s %d %lld\n", f->cached_name, f->cache_level, (long long)f->size);
-		result = vine_manager_put_file_or_dir(q, w, t, f->source, f->cached_name, &total_bytes, 1);
+		if (f->checksum_pending && lstat(f->source, &info) == 0 && S_ISREG(info.st_mode)) {
+			result = vine_manager_put_pending_file(q, w, t, f, info, &total_bytes);
+		} else {
+			result = vine_manager_put_file_or_dir(q, w, t, f->source, f->cached_name, &total_bytes, 1);
+		}
 		break;
 
 	case VINE_BUFFER:
@@ -323,6 +669,8 @@ static vine_result_code_t vine_manager_put_input_file(struct vine_manager *q, st
 	case VINE_MINI_TASK:
 		debug(D_VINE, "%s (%s) will produce %s via mini task", w->hostname, w->addrport, m->remote_name);
 		result = vine_manager_put_task(q, w, f->mini_task, 0, 0, f);
+		if (result == VINE_STAGING_PENDING)
+			return result;
 		break;
 
 	case VINE_URL:
@@ -351,6 +699,7 @@ static vine_result_code_t vine_manager_put_input_file(struct vine_manager *q, st
 		// Write to the transaction log.
 		if (f->type == VINE_FILE || f->type == VINE_BUFFER) {
 			vine_txn_log_write_transfer(q, w, t, m, f, total_bytes, elapsed_time, open_time, 1);
+			vine_fetch_stats_record(q, w, f->cached_name, total_bytes, VINE_FETCH_SOURCE_MANAGER);
 		}
 
 		// Avoid division by zero below.
@@ -424,8 +773,17 @@ static vine_result_code_t vine_manager_put_input_file_if_needed(struct vine_mana
 	/* Now send the actual file. */
 	vine_result_code_t result = vine_manager_put_input_file(q, w, t, m, file_to_send);
 
+	/* If it is still being sent, the replica is recorded by vine_manager_put_input_stream. */
+	if (result == VINE_STAGING_PENDING)
+		return result;
+
 	/* If the send succeeded, then record it in the worker */
 	if (result == VINE_SUCCESS) {
+		/* A temp file fetched from a peer counts towards its demand for replicas. */
+		if (f->type == VINE_TEMP && m->substitute) {
+			vine_file_replica_table_record_fetch(f);
+		}
+
 		struct vine_file_replica *replica = vine_file_replica_create(f->type, f->cache_level, f->size, f->mtime);
 		vine_file_replica_table_insert(q, w, f->cached_name, replica);
 
@@ -448,12 +806,20 @@ static vine_result_code_t vine_manager_put_input_file_if_needed(struct vine_mana
 	return result;
 }
 
-/* Send all input files needed by a task to the given worker. */
+/*
+Send all input files needed by a task to the given worker.
+Returns VINE_STAGING_PENDING if an input is being sent in the background,
+in which case the caller must try again once the transfer completes.
+The files already sent are then found in the replica table and skipped.
+*/
 
 vine_result_code_t vine_manager_put_input_files(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
 {
 	struct vine_mount *m;
 
+	if (w->input_stream)
+		return VINE_STAGING_PENDING;
+
 	if (t->input_mounts) {
 		LIST_ITERATE(t->input_mounts, m)
 		{
@@ -513,6 +879,10 @@ vine_result_code_t vine_manager_put_task(
 
 	vine_manager_send(q, w, "category %s\n", t->category);
 
+	if (q->monitor_mode && q->monitor_shared && !t->needs_library && !target) {
+		vine_manager_send(q, w, "monitor %d %d\n", q->monitor_mode, q->monitor_interval);
+	}
+
 	if (limits) {
 		vine_manager_send(q, w, "cores %s\n", rmsummary_resource_to_str("cores", limits->cores, 0));
 		vine_manager_send(q, w, "gpus %s\n", rmsummary_resource_to_str("gpus", limits->gpus, 0));
@@ -520,8 +890,8 @@ vine_result_code_t vine_manager_put_task(
 		vine_manager_send(q, w, "disk %s\n", rmsummary_resource_to_str("disk", limits->disk, 0));
 
 		/* Do not set end, wall_time if running the resource monitor. We let the monitor police these resources.
-		 */
-		if (q->monitor_mode == VINE_MON_DISABLED) {
+		 * The shared monitor of the worker needs them to do so. */
+		if (q->monitor_mode == VINE_MON_DISABLED || q->monitor_shared) {
 			if (limits->end > 0) {
 				vine_manager_send(q, w, "end_time %s\n", rmsummary_resource_to_str("end", limits->end, 0));
 			}
@@ -576,3 +946,148 @@ vine_result_code_t vine_manager_put_task(
 		return VINE_WORKER_FAILURE;
 	}
 }
+
+/*
+Write as much of the input file being sent in the background as the link
+of this worker accepts right now.  Returns VINE_STAGING_PENDING while more
+data remains, VINE_WORKER_FAILURE if the transfer failed, in which case the
+worker should be removed, or VINE_SUCCESS once the file has been sent and
+the messages deferred meanwhile have been delivered.
+*/
+
+vine_result_code_t vine_manager_put_input_stream(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct vine_input_stream *s = w->input_stream;
+
+	while (s->sent < s->length) {
+		if (s->buffer_start >= s->buffer_length) {
+			ssize_t n = full_read(s->fd, s->buffer, MIN(VINE_INPUT_STREAM_BUFFER_SIZE, s->length - s->sent));
+			if (n <= 0) {
+				// The file changed underneath us, and the worker expects the full length.
+				debug(D_NOTICE, "Cannot read file %s: %s", s->sent_file->source, n < 0 ? strerror(errno) : "file is shorter than expected");
+				return VINE_WORKER_FAILURE;
+			}
+			s->buffer_start = 0;
+			s->buffer_length = n;
+			if (s->context)
+				md5_update(s->context, s->buffer, n);
+		}
+
+		int64_t chunk = s->buffer_length - s->buffer_start;
+		ssize_t actual = link_write(w->link, s->buffer + s->buffer_start, chunk, LINK_NOWAIT);
+		if (actual <= 0) {
+			debug(D_VINE, "Failed to send file %s to %s (%s) after %" PRId64 " of %" PRId64 " bytes", s->sent_file->source, w->addrport, w->hostname, s->sent, s->length);
+			return VINE_WORKER_FAILURE;
+		}
+
+		s->buffer_start += actual;
+		s->sent += actual;
+
+		// Stop when the link does not accept any more data for now.
+		if (actual < chunk)
+			break;
+	}
+
+	// The worker does not send messages while receiving a file, so progress counts as a sign of life.
+	w->last_msg_recv_time = timestamp_get();
+
+	if (s->sent < s->length) {
+		if (time(0) > s->stoptime) {
+			debug(D_VINE, "Timed out sending file %s to %s (%s)", s->sent_file->source, w->addrport, w->hostname);
+			return VINE_WORKER_FAILURE;
+		}
+		return VINE_STAGING_PENDING;
+	}
+
+	timestamp_t elapsed_time = timestamp_get() - s->open_time;
+
+	w->total_bytes_transferred += s->length;
+	w->total_transfer_time += elapsed_time;
+	q->stats->bytes_sent += s->length;
+
+	if (s->t) {
+		s->t->bytes_sent += s->length;
+		s->t->bytes_transferred += s->length;
+		vine_txn_log_write_transfer(q, w, s->t, s->m, s->sent_file, s->length, elapsed_time, s->open_time, 1);
+	}
+
+	vine_fetch_stats_record(q, w, s->sent_file->cached_name, s->length, VINE_FETCH_SOURCE_MANAGER);
+
+	if (elapsed_time == 0)
+		elapsed_time = 1;
+
+	debug(D_VINE,
+			"%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
+			w->hostname,
+			w->addrport,
+			s->length / 1000000.0,
+			elapsed_time / 1000000.0,
+			(double)s->length / elapsed_time,
+			(double)w->total_bytes_transferred / w->total_transfer_time);
+
+	/* The data was sent whether or not the task is still around, so record the replica. */
+	struct vine_file *f = s->file;
+	if (f->type == VINE_FILE) {
+		vine_manager_finish_pending_file(q, w, f, s->sent_name, &s->info, s->context);
+	}
+	struct vine_file_replica *replica = vine_file_replica_create(f->type, f->cache_level, f->size, f->mtime);
+	replica->state = VINE_FILE_REPLICA_STATE_READY;
+	vine_file_replica_table_insert(q, w, f->cached_name, replica);
+	f->state = VINE_FILE_STATE_CREATED;
+
+	vine_result_code_t result = VINE_SUCCESS;
+
+	w->input_stream = 0;
+
+	size_t length;
+	const char *deferred = buffer_tolstring(&s->deferred, &length);
+	if (length > 0 && link_putlstring(w->link, deferred, length, time(0) + q->short_timeout) != (ssize_t)length) {
+		result = VINE_WORKER_FAILURE;
+	}
+
+	vine_input_stream_delete(s);
+
+	return result;
+}
+
+/* Hold a message for the worker until the transfer in progress completes. */
+
+void vine_manager_put_defer(struct vine_worker_info *w, const char *data, size_t length)
+{
+	buffer_putlstring(&w->input_stream->deferred, data, length);
+}
+
+/*
+The task is leaving the worker while its input is in transit.
+The data must still be sent to keep the link in sync, but the
+transfer is no longer accounted to the task.
+*/
+
+void vine_manager_release_input_stream(struct vine_worker_info *w, struct vine_task *t)
+{
+	struct vine_input_stream *s = w->input_stream;
+
+	if (s && s->t == t) {
+		s->t = 0;
+		s->m = 0;
+	}
+
+	list_remove(w->staging_tasks, t);
+}
+
+/* Discard the transfer in progress when the worker is removed. */
+
+void vine_manager_abort_input_stream(struct vine_worker_info *w)
+{
+	struct vine_input_stream *s = w->input_stream;
+
+	list_clear(w->staging_tasks, 0);
+
+	if (!s)
+		return;
+
+	debug(D_VINE, "Abandoning transfer of %s to %s (%s)", s->sent_file->source, w->addrport, w->hostname);
+
+	w->input_stream = 0;
+	vine_input_stream_delete(s);
+}
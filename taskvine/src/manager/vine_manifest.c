@@ -0,0 +1,318 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_manifest.h"
+#include "vine_protocol.h"
+
+#include "buffer.h"
+#include "debug.h"
+#include "full_io.h"
+#include "macros.h"
+#include "stringtools.h"
+#include "url_encode.h"
+#include "xxmalloc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Chunk boundaries are found with a gear hash: each byte shifts the hash
+left and adds a random value chosen by the byte, so that the top bits
+of the hash depend on the last 64 bytes only.  A boundary is cut where
+the top bits are all zero, which happens once in 128KB on average past
+the minimum chunk size.  The random values come from a fixed seed, so
+that the same data is cut in the same way by every run of the manager.
+*/
+
+#define VINE_MANIFEST_BOUNDARY_MASK 0xffff800000000000ULL
+
+struct vine_manifest {
+	buffer_t text;
+	struct list *chunks;
+	struct hash_table *by_hash;
+	int64_t size;
+	int64_t bytes;
+};
+
+static uint64_t gear[256];
+static int gear_ready = 0;
+
+static void gear_init()
+{
+	if (gear_ready)
+		return;
+
+	/* splitmix64 */
+	uint64_t x = 0x766696e65ULL;
+	int i;
+	for (i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+
+	gear_ready = 1;
+}
+
+/* Return the length of the chunk at the start of data, of which length bytes are available. */
+
+static int64_t chunk_boundary(const unsigned char *data, int64_t length)
+{
+	if (length <= VINE_MANIFEST_CHUNK_MIN)
+		return length;
+
+	int64_t limit = MIN(length, VINE_MANIFEST_CHUNK_MAX);
+	uint64_t h = 0;
+	int64_t i;
+
+	for (i = VINE_MANIFEST_CHUNK_MIN; i < limit; i++) {
+		h = (h << 1) + gear[data[i]];
+		if (!(h & VINE_MANIFEST_BOUNDARY_MASK))
+			return i + 1;
+	}
+
+	return limit;
+}
+
+struct vine_manifest_chunk *vine_manifest_chunk_create(const char *hash, const char *path, int64_t offset, int64_t length)
+{
+	struct vine_manifest_chunk *c = xxmalloc(sizeof(*c));
+	string_nformat(c->hash, sizeof(c->hash), "%s", hash);
+	c->path = xxstrdup(path);
+	c->offset = offset;
+	c->length = length;
+	return c;
+}
+
+void vine_manifest_chunk_delete(struct vine_manifest_chunk *c)
+{
+	if (!c)
+		return;
+	free(c->path);
+	free(c);
+}
+
+static void add_chunk(struct vine_manifest *m, buffer_t *lines, const unsigned char *data, int64_t length, const char *path, int64_t offset)
+{
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	md5_buffer(data, length, digest);
+
+	struct vine_manifest_chunk *c = vine_manifest_chunk_create(md5_to_string(digest), path, offset, length);
+	list_push_tail(m->chunks, c);
+	/* The chunk and its path, with a list entry and a table entry of about 32 bytes each. */
+	m->bytes += sizeof(*c) + strlen(path) + 1 + 64;
+
+	if (!hash_table_lookup(m->by_hash, c->hash))
+		hash_table_insert(m->by_hash, c->hash, c);
+
+	buffer_printf(lines, "%s %" PRId64 "\n", c->hash, length);
+}
+
+/*
+Cut a regular file into chunks.  The file is read through a window
+that always holds a whole chunk of the largest size, if the file has
+that much left, so that each boundary is found in memory.  The lines
+of the chunks are gathered apart, since their count comes first.
+*/
+
+static int add_file(struct vine_manifest *m, const char *path, const char *name_encoded, struct stat *info)
+{
+	int fd = open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		debug(D_NOTICE, "Cannot open file %s: %s", path, strerror(errno));
+		return 0;
+	}
+
+	buffer_t lines;
+	buffer_init(&lines);
+	buffer_abortonfailure(&lines, 1);
+
+	unsigned char *window = xxmalloc(2 * VINE_MANIFEST_CHUNK_MAX);
+	int64_t start = 0;
+	int64_t end = 0;
+	int64_t offset = 0;
+	int nchunks = 0;
+	int eof = 0;
+	int ok = 1;
+
+	while (1) {
+		if (!eof && end - start < VINE_MANIFEST_CHUNK_MAX) {
+			memmove(window, window + start, end - start);
+			end -= start;
+			start = 0;
+
+			ssize_t n = full_read(fd, window + end, 2 * VINE_MANIFEST_CHUNK_MAX - end);
+			if (n < 0) {
+				debug(D_NOTICE, "Cannot read file %s: %s", path, strerror(errno));
+				ok = 0;
+				break;
+			} else if (n == 0) {
+				eof = 1;
+			}
+			end += n;
+			continue;
+		}
+
+		if (start == end)
+			break;
+
+		int64_t length = chunk_boundary(window + start, end - start);
+		add_chunk(m, &lines, window + start, length, path, offset);
+		start += length;
+		offset += length;
+		nchunks++;
+	}
+
+	free(window);
+	close(fd);
+
+	if (ok && offset != info->st_size) {
+		debug(D_NOTICE, "File %s changed while being read", path);
+		ok = 0;
+	}
+
+	if (ok) {
+		/* Normalize the mode bits as vine_manager_put_file does. */
+		int mode = (info->st_mode | 0x600) & 0777;
+		buffer_printf(&m->text, "file %s %" PRId64 " 0%o %lld %d\n", name_encoded, offset, mode, (long long)info->st_mtime, nchunks);
+		buffer_putlstring(&m->text, buffer_tostring(&lines), buffer_pos(&lines));
+		m->size += offset;
+	}
+
+	buffer_free(&lines);
+
+	return ok;
+}
+
+static int add_any(struct vine_manifest *m, const char *path, const char *name, int follow_links)
+{
+	char name_encoded[VINE_LINE_MAX];
+	url_encode(name, name_encoded, sizeof(name_encoded));
+
+	struct stat info;
+	int result = follow_links ? stat(path, &info) : lstat(path, &info);
+	if (result < 0) {
+		debug(D_NOTICE, "cannot stat file %s: %s", path, strerror(errno));
+		return 0;
+	}
+
+	if (S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(path);
+		if (!dir) {
+			debug(D_NOTICE, "Cannot open dir %s: %s", path, strerror(errno));
+			return 0;
+		}
+
+		buffer_printf(&m->text, "dir %s 0%o %lld\n", name_encoded, info.st_mode & 0777, (long long)info.st_mtime);
+
+		int ok = 1;
+		struct dirent *d;
+		while (ok && (d = readdir(dir))) {
+			if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+				continue;
+
+			char *subpath = string_format("%s/%s", path, d->d_name);
+			ok = add_any(m, subpath, d->d_name, 0);
+			free(subpath);
+		}
+		closedir(dir);
+
+		buffer_printf(&m->text, "end\n");
+		return ok;
+
+	} else if (S_ISLNK(info.st_mode)) {
+		char target[VINE_LINE_MAX];
+		ssize_t length = readlink(path, target, sizeof(target) - 1);
+		if (length < 0) {
+			debug(D_NOTICE, "Cannot read link %s: %s", path, strerror(errno));
+			return 0;
+		}
+		target[length] = 0;
+
+		char target_encoded[VINE_LINE_MAX];
+		url_encode(target, target_encoded, sizeof(target_encoded));
+
+		buffer_printf(&m->text, "symlink %s %s\n", name_encoded, target_encoded);
+		m->size += length;
+		return 1;
+
+	} else if (S_ISREG(info.st_mode)) {
+		return add_file(m, path, name_encoded, &info);
+
+	} else {
+		/* As vine_manager_put_file_or_dir does, skip unusual files. */
+		debug(D_NOTICE, "skipping unusual file: %s", path);
+		return 1;
+	}
+}
+
+struct vine_manifest *vine_manifest_create(const char *path, const char *name)
+{
+	gear_init();
+
+	struct vine_manifest *m = xxmalloc(sizeof(*m));
+	buffer_init(&m->text);
+	buffer_abortonfailure(&m->text, 1);
+	m->chunks = list_create();
+	m->by_hash = hash_table_create(0, 0);
+	m->size = 0;
+	m->bytes = sizeof(*m);
+
+	if (!add_any(m, path, name, 1)) {
+		vine_manifest_delete(m);
+		return 0;
+	}
+
+	debug(D_VINE, "manifest of %s has %d chunks, %d distinct, of %" PRId64 " bytes", path, list_size(m->chunks), hash_table_size(m->by_hash), m->size);
+
+	return m;
+}
+
+void vine_manifest_delete(struct vine_manifest *m)
+{
+	if (!m)
+		return;
+
+	buffer_free(&m->text);
+	list_clear(m->chunks, (void *)vine_manifest_chunk_delete);
+	list_delete(m->chunks);
+	hash_table_delete(m->by_hash);
+	free(m);
+}
+
+const char *vine_manifest_text(struct vine_manifest *m, size_t *length)
+{
+	return buffer_tolstring(&m->text, length);
+}
+
+struct list *vine_manifest_chunks(struct vine_manifest *m)
+{
+	return m->chunks;
+}
+
+struct vine_manifest_chunk *vine_manifest_lookup(struct vine_manifest *m, const char *hash)
+{
+	return hash_table_lookup(m->by_hash, hash);
+}
+
+int64_t vine_manifest_size(struct vine_manifest *m)
+{
+	return m->size;
+}
+
+int64_t vine_manifest_bytes(struct vine_manifest *m)
+{
+	return m->bytes + buffer_pos(&m->text);
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,80 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_MANIFEST_H
+#define VINE_MANIFEST_H
+
+/*
+A manifest describes a directory tree by the content of its files,
+which are cut into chunks at boundaries chosen by a rolling hash of
+the data, so that an edit to a file changes only the chunks around
+it, rather than every chunk after it.  The manager sends the manifest
+of an input directory in place of its data, and the worker answers
+with the chunks that it does not already hold in its cache, so that
+a directory that differs a little from one sent before costs only
+the chunks that differ.
+
+The manifest is text, much like the streaming directory protocol
+of vine_transfer.c, with each file followed by its chunks in order:
+
+dir mydir 0755 1700000000
+file 1.txt 35291 0644 1700000000 1
+4bd2...e1f0 35291
+dir mysubdir 0755 1700000000
+file big.dat 300000 0644 1700000000 3
+77a0...0c4d 131072
+c1d9...993e 102400
+0e3f...5a21 66528
+end
+symlink latest 1.txt
+end
+
+Names and symlink targets are url encoded.
+This module is shared by the manager and the worker.
+*/
+
+#include "md5.h"
+
+#include "hash_table.h"
+#include "list.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Chunks are cut no smaller than this, except at the end of a file, and no larger than the maximum. */
+#define VINE_MANIFEST_CHUNK_MIN (32 * 1024)
+#define VINE_MANIFEST_CHUNK_MAX (512 * 1024)
+
+struct vine_manifest_chunk {
+	char hash[MD5_DIGEST_LENGTH_HEX + 1];
+	char *path;     // Where the data of the chunk is found.
+	int64_t offset; // Offset of the chunk within that file.
+	int64_t length; // Length of the chunk.
+};
+
+struct vine_manifest_chunk *vine_manifest_chunk_create(const char *hash, const char *path, int64_t offset, int64_t length);
+void vine_manifest_chunk_delete(struct vine_manifest_chunk *c);
+
+/* Read the tree at path, to be created as name at the other end. Returns null if it cannot be read. */
+struct vine_manifest *vine_manifest_create(const char *path, const char *name);
+void vine_manifest_delete(struct vine_manifest *m);
+
+/* The text of the manifest, to be sent to the worker. */
+const char *vine_manifest_text(struct vine_manifest *m, size_t *length);
+
+/* The chunks of the manifest in order, each located by the local path of its file. */
+struct list *vine_manifest_chunks(struct vine_manifest *m);
+
+/* Find a chunk by its hash, or return null. */
+struct vine_manifest_chunk *vine_manifest_lookup(struct vine_manifest *m, const char *hash);
+
+/* Total size of the files and symlinks in the tree. */
+int64_t vine_manifest_size(struct vine_manifest *m);
+
+/* Approximate memory held by the manifest. */
+int64_t vine_manifest_bytes(struct vine_manifest *m);
+
+#endif
@@ -0,0 +1,424 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_memory.h"
+#include "vine_file.h"
+#include "vine_file_replica.h"
+#include "vine_manifest.h"
+#include "vine_mount.h"
+#include "vine_resources.h"
+#include "vine_task.h"
+#include "vine_worker_info.h"
+
+#include "debug.h"
+#include "flat_table.h"
+#include "hash_table.h"
+#include "itable.h"
+#include "link.h"
+#include "list.h"
+#include "rmsummary.h"
+#include "set.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Approximate overhead of one entry of a hash table, itable, set, or list. */
+#define VINE_MEMORY_ENTRY 32
+
+/* Number of categories and files listed in the memory_status report. */
+#define VINE_MEMORY_TOP 10
+
+struct vine_memory {
+	int interval;
+	timestamp_t time_measured;
+	timestamp_t time_elapsed;
+	int64_t bytes[VINE_MEMORY_MAX];
+	int64_t count[VINE_MEMORY_MAX];
+	struct jx *categories;
+	struct jx *files;
+};
+
+struct vine_memory_top {
+	const char *name;
+	int64_t bytes;
+	int64_t count;
+};
+
+static const char *type_names[VINE_MEMORY_MAX] = {
+		"tasks",
+		"files",
+		"replicas",
+		"workers",
+		"links",
+};
+
+const char *vine_memory_type_string(vine_memory_type_t type)
+{
+	if (type < 0 || type >= VINE_MEMORY_MAX) {
+		return "unknown";
+	}
+	return type_names[type];
+}
+
+struct vine_memory *vine_memory_create()
+{
+	struct vine_memory *m = xxcalloc(1, sizeof(*m));
+	m->interval = VINE_MEMORY_STATS_INTERVAL;
+	return m;
+}
+
+void vine_memory_delete(struct vine_memory *m)
+{
+	if (!m) {
+		return;
+	}
+
+	jx_delete(m->categories);
+	jx_delete(m->files);
+	free(m);
+}
+
+void vine_memory_set_interval(struct vine_memory *m, int interval)
+{
+	m->interval = interval;
+}
+
+static int64_t string_bytes(const char *s)
+{
+	return s ? strlen(s) + 1 : 0;
+}
+
+static int64_t string_list_bytes(struct list *l)
+{
+	if (!l) {
+		return 0;
+	}
+
+	int64_t bytes = 0;
+	char *s;
+	LIST_ITERATE(l, s)
+	{
+		bytes += VINE_MEMORY_ENTRY + string_bytes(s);
+	}
+	return bytes;
+}
+
+static int64_t mount_list_bytes(struct list *l)
+{
+	if (!l) {
+		return 0;
+	}
+
+	int64_t bytes = 0;
+	struct vine_mount *mnt;
+	LIST_ITERATE(l, mnt)
+	{
+		bytes += VINE_MEMORY_ENTRY + sizeof(*mnt) + string_bytes(mnt->remote_name);
+	}
+	return bytes;
+}
+
+static int64_t rmsummary_bytes(struct rmsummary *r)
+{
+	return r ? sizeof(*r) : 0;
+}
+
+/* The files a task mounts are counted once, with the files. */
+static int64_t task_bytes(struct vine_task *t)
+{
+	if (!t) {
+		return 0;
+	}
+
+	int64_t bytes = sizeof(*t);
+
+	bytes += string_bytes(t->command_line);
+	bytes += string_bytes(t->tag);
+	bytes += string_bytes(t->monitor_output_directory);
+	bytes += string_bytes(t->needs_library);
+	bytes += string_bytes(t->provides_library);
+	bytes += string_bytes(t->library_log_path);
+	bytes += string_bytes(t->ready_blocked_key);
+	bytes += string_bytes(t->addrport);
+	bytes += string_bytes(t->hostname);
+	if (t->output) {
+		bytes += t->output_length + 1;
+	}
+
+	bytes += mount_list_bytes(t->input_mounts);
+	bytes += mount_list_bytes(t->output_mounts);
+	bytes += string_list_bytes(t->env_list);
+	bytes += string_list_bytes(t->feature_list);
+
+	bytes += rmsummary_bytes(t->resources_allocated);
+	bytes += rmsummary_bytes(t->resources_measured);
+	bytes += rmsummary_bytes(t->resources_requested);
+	bytes += rmsummary_bytes(t->current_resource_box);
+
+	return bytes;
+}
+
+/* Mini tasks and recovery tasks are not in the task table, so they are counted with their files. */
+static int64_t file_bytes(struct vine_file *f)
+{
+	int64_t bytes = sizeof(*f);
+
+	bytes += string_bytes(f->source);
+	bytes += string_bytes(f->cached_name);
+	if (f->data) {
+		bytes += f->size;
+	}
+	if (f->stripe_workers) {
+		bytes += list_size(f->stripe_workers) * VINE_MEMORY_ENTRY;
+	}
+	if (f->manifest) {
+		bytes += vine_manifest_bytes(f->manifest);
+	}
+	bytes += task_bytes(f->mini_task);
+	bytes += task_bytes(f->recovery_task);
+
+	return bytes;
+}
+
+static int64_t worker_bytes(struct vine_worker_info *w)
+{
+	int64_t bytes = sizeof(*w);
+
+	bytes += string_bytes(w->hostname);
+	bytes += string_bytes(w->os);
+	bytes += string_bytes(w->arch);
+	bytes += string_bytes(w->version);
+	bytes += string_bytes(w->factory_name);
+	bytes += string_bytes(w->workerid);
+	bytes += string_bytes(w->addrport);
+	bytes += string_bytes(w->hashkey);
+	bytes += string_bytes(w->transfer_url);
+	bytes += string_bytes(w->rack);
+	bytes += string_bytes(w->site);
+
+	if (w->resources) {
+		bytes += sizeof(*w->resources);
+	}
+	if (w->features) {
+		bytes += hash_table_size(w->features) * VINE_MEMORY_ENTRY;
+	}
+	if (w->peer_throughput) {
+		bytes += hash_table_size(w->peer_throughput) * VINE_MEMORY_ENTRY;
+	}
+	if (w->current_tasks) {
+		bytes += itable_size(w->current_tasks) * VINE_MEMORY_ENTRY;
+	}
+	if (w->staging_tasks) {
+		bytes += list_size(w->staging_tasks) * VINE_MEMORY_ENTRY;
+	}
+
+	return bytes;
+}
+
+/* Keep the n largest entries of top, in decreasing order of bytes. */
+static void top_insert(struct vine_memory_top *top, int n, const char *name, int64_t bytes, int64_t count)
+{
+	if (bytes <= top[n - 1].bytes) {
+		return;
+	}
+
+	int i = n - 1;
+	while (i > 0 && top[i - 1].bytes < bytes) {
+		top[i] = top[i - 1];
+		i--;
+	}
+
+	top[i].name = name;
+	top[i].bytes = bytes;
+	top[i].count = count;
+}
+
+static struct jx *top_to_jx(struct vine_memory_top *top, int n, const char *name_key)
+{
+	struct jx *a = jx_array(0);
+
+	int i;
+	for (i = 0; i < n && top[i].name; i++) {
+		struct jx *j = jx_object(0);
+		jx_insert_string(j, name_key, top[i].name);
+		jx_insert_integer(j, "bytes", top[i].bytes);
+		if (top[i].count > 0) {
+			jx_insert_integer(j, "tasks", top[i].count);
+		}
+		jx_array_append(a, j);
+	}
+
+	return a;
+}
+
+static void measure_tasks(struct vine_manager *q, struct vine_memory *m)
+{
+	struct hash_table *categories = hash_table_create(0, 0);
+
+	uint64_t task_id;
+	struct vine_task *t;
+	struct itable_iter iter;
+	ITABLE_ITERATE_WITH(q->tasks, iter, task_id, t)
+	{
+		int64_t bytes = task_bytes(t) + VINE_MEMORY_ENTRY;
+		m->bytes[VINE_MEMORY_TASKS] += bytes;
+		m->count[VINE_MEMORY_TASKS]++;
+
+		const char *category = t->category ? t->category : "default";
+		struct vine_memory_top *c = hash_table_lookup(categories, category);
+		if (!c) {
+			c = xxcalloc(1, sizeof(*c));
+			hash_table_insert(categories, category, c);
+		}
+		c->bytes += bytes;
+		c->count++;
+	}
+
+	struct vine_memory_top top[VINE_MEMORY_TOP];
+	memset(top, 0, sizeof(top));
+
+	char *name;
+	struct vine_memory_top *c;
+	struct hash_table_iter hiter;
+	HASH_TABLE_ITERATE_WITH(categories, hiter, name, c)
+	{
+		top_insert(top, VINE_MEMORY_TOP, name, c->bytes, c->count);
+	}
+
+	jx_delete(m->categories);
+	m->categories = top_to_jx(top, VINE_MEMORY_TOP, "category");
+
+	hash_table_clear(categories, free);
+	hash_table_delete(categories);
+}
+
+static void measure_files(struct vine_manager *q, struct vine_memory *m)
+{
+	struct vine_memory_top top[VINE_MEMORY_TOP];
+	memset(top, 0, sizeof(top));
+
+	char *cachename;
+	struct vine_file *f;
+	FLAT_TABLE_ITERATE(q->file_table, cachename, f)
+	{
+		int64_t bytes = file_bytes(f) + VINE_MEMORY_ENTRY;
+		m->bytes[VINE_MEMORY_FILES] += bytes;
+		m->count[VINE_MEMORY_FILES]++;
+		top_insert(top, VINE_MEMORY_TOP, f->cached_name, bytes, 0);
+	}
+
+	jx_delete(m->files);
+	m->files = top_to_jx(top, VINE_MEMORY_TOP, "cachename");
+
+	/* The sets of workers holding each file are counted with the replicas. */
+	struct set *workers;
+	struct hash_table_iter iter;
+	HASH_TABLE_ITERATE_WITH(q->file_worker_table, iter, cachename, workers)
+	{
+		m->bytes[VINE_MEMORY_REPLICAS] += VINE_MEMORY_ENTRY + string_bytes(cachename) + set_size(workers) * VINE_MEMORY_ENTRY;
+	}
+}
+
+static void measure_workers(struct vine_manager *q, struct vine_memory *m)
+{
+	char *key;
+	struct vine_worker_info *w;
+	struct hash_table_iter iter;
+	HASH_TABLE_ITERATE_WITH(q->worker_table, iter, key, w)
+	{
+		m->bytes[VINE_MEMORY_WORKERS] += worker_bytes(w) + VINE_MEMORY_ENTRY;
+		m->count[VINE_MEMORY_WORKERS]++;
+
+		if (w->link) {
+			m->bytes[VINE_MEMORY_LINKS] += link_memory_usage(w->link);
+			m->count[VINE_MEMORY_LINKS]++;
+		}
+
+		if (w->current_files) {
+			char *cachename;
+			struct vine_file_replica *r;
+			struct hash_table_iter riter;
+			HASH_TABLE_ITERATE_WITH(w->current_files, riter, cachename, r)
+			{
+				m->bytes[VINE_MEMORY_REPLICAS] += sizeof(*r) + VINE_MEMORY_ENTRY + string_bytes(cachename);
+				m->count[VINE_MEMORY_REPLICAS]++;
+			}
+		}
+	}
+
+	if (q->manager_link) {
+		m->bytes[VINE_MEMORY_LINKS] += link_memory_usage(q->manager_link);
+		m->count[VINE_MEMORY_LINKS]++;
+	}
+}
+
+void vine_memory_measure(struct vine_manager *q, int force)
+{
+	struct vine_memory *m = q->memory;
+
+	timestamp_t start = timestamp_get();
+	if (!force && m->time_measured && (start - m->time_measured) < (timestamp_t)m->interval * 1000000) {
+		return;
+	}
+
+	memset(m->bytes, 0, sizeof(m->bytes));
+	memset(m->count, 0, sizeof(m->count));
+
+	measure_tasks(q, m);
+	measure_files(q, m);
+	measure_workers(q, m);
+
+	m->time_measured = timestamp_get();
+	m->time_elapsed = m->time_measured - start;
+
+	int64_t total = 0;
+	int i;
+	for (i = 0; i < VINE_MEMORY_MAX; i++) {
+		total += m->bytes[i];
+	}
+
+	debug(D_VINE,
+			"memory: %" PRId64 " bytes total, tasks %" PRId64 ", files %" PRId64 ", replicas %" PRId64 ", workers %" PRId64 ", links %" PRId64 ", measured in %" PRIu64 "us",
+			total,
+			m->bytes[VINE_MEMORY_TASKS],
+			m->bytes[VINE_MEMORY_FILES],
+			m->bytes[VINE_MEMORY_REPLICAS],
+			m->bytes[VINE_MEMORY_WORKERS],
+			m->bytes[VINE_MEMORY_LINKS],
+			m->time_elapsed);
+}
+
+void vine_memory_get(struct vine_memory *m, int64_t *bytes)
+{
+	memcpy(bytes, m->bytes, sizeof(m->bytes));
+}
+
+struct jx *vine_memory_to_jx(struct vine_memory *m)
+{
+	struct jx *j = jx_object(0);
+
+	int64_t total = 0;
+	int i;
+	for (i = 0; i < VINE_MEMORY_MAX; i++) {
+		struct jx *t = jx_object(0);
+		jx_insert_integer(t, "bytes", m->bytes[i]);
+		jx_insert_integer(t, "count", m->count[i]);
+		jx_insert(j, jx_string(vine_memory_type_string(i)), t);
+		total += m->bytes[i];
+	}
+
+	jx_insert_integer(j, "total_bytes", total);
+	jx_insert_integer(j, "time_measured", m->time_measured);
+	jx_insert_integer(j, "time_elapsed", m->time_elapsed);
+	jx_insert(j, jx_string("largest_categories"), m->categories ? jx_copy(m->categories) : jx_array(0));
+	jx_insert(j, jx_string("largest_files"), m->files ? jx_copy(m->files) : jx_array(0));
+
+	return j;
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_MEMORY_H
+#define VINE_MEMORY_H
+
+/*
+Memory accounting estimates how many bytes the manager holds for each
+type of object: tasks, files, replicas, workers, and links.  Rather than
+tracking every allocation, the manager tables are walked and the size
+of each object is estimated from its structure and the strings and buffers
+it owns.  The walk costs time proportional to the number of objects, so it
+is repeated at most every memory-stats-interval seconds, and the totals are
+reported in vine_stats and the performance log in between.
+The largest categories of tasks and the largest files are available with
+the "memory_status" request.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+
+#include "jx.h"
+
+/* Default number of seconds between measurements. */
+#define VINE_MEMORY_STATS_INTERVAL 60
+
+struct vine_memory *vine_memory_create();
+void vine_memory_delete(struct vine_memory *m);
+
+/* Set the minimum number of seconds between measurements. */
+void vine_memory_set_interval(struct vine_memory *m, int interval);
+
+/* Measure the manager again if the interval has passed since the last measurement, or if forced. */
+void vine_memory_measure(struct vine_manager *q, int force);
+
+/* Fill an array of VINE_MEMORY_MAX byte counts from the last measurement, indexed by type. */
+void vine_memory_get(struct vine_memory *m, int64_t *bytes);
+
+/* The last measurement, with the largest categories of tasks and the largest files. */
+struct jx *vine_memory_to_jx(struct vine_memory *m);
+
+#endif
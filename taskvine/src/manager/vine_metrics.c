@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_metrics.h"
+#include "vine_current_transfers.h"
+
+#include "category.h"
+#include "hash_table.h"
+#include "itable.h"
+#include "list.h"
+#include "timestamp.h"
+
+#include <inttypes.h>
+
+/*
+Each metric family is introduced by its type and help text, and
+followed by its samples.  Counters are named with a _total suffix,
+and times are given in seconds, as OpenMetrics requires.
+*/
+
+static void family(buffer_t *B, const char *name, const char *type, const char *help)
+{
+	buffer_printf(B, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void gauge(buffer_t *B, const char *name, const char *help, int64_t value)
+{
+	family(B, name, "gauge", help);
+	buffer_printf(B, "%s %" PRId64 "\n", name, value);
+}
+
+static void counter(buffer_t *B, const char *name, const char *help, int64_t value)
+{
+	family(B, name, "counter", help);
+	buffer_printf(B, "%s_total %" PRId64 "\n", name, value);
+}
+
+static void seconds_counter(buffer_t *B, const char *name, const char *help, timestamp_t usecs)
+{
+	family(B, name, "counter", help);
+	buffer_printf(B, "%s_total %.6f\n", name, usecs / 1000000.0);
+}
+
+/* Print a label value, escaping the characters that OpenMetrics reserves. */
+
+static void label_value(buffer_t *B, const char *s)
+{
+	buffer_putliteral(B, "\"");
+	for (; *s; s++) {
+		switch (*s) {
+		case '\\':
+			buffer_putliteral(B, "\\\\");
+			break;
+		case '"':
+			buffer_putliteral(B, "\\\"");
+			break;
+		case '\n':
+			buffer_putliteral(B, "\\n");
+			break;
+		default:
+			buffer_putlstring(B, s, 1);
+			break;
+		}
+	}
+	buffer_putliteral(B, "\"");
+}
+
+static void write_workers(buffer_t *B, struct vine_stats *s)
+{
+	family(B, "vine_workers", "gauge", "Number of workers connected to the manager.");
+	buffer_printf(B, "vine_workers{state=\"init\"} %d\n", s->workers_init);
+	buffer_printf(B, "vine_workers{state=\"idle\"} %d\n", s->workers_idle);
+	buffer_printf(B, "vine_workers{state=\"busy\"} %d\n", s->workers_busy);
+
+	counter(B, "vine_workers_joined", "Worker connections established.", s->workers_joined);
+	counter(B, "vine_workers_removed", "Worker connections terminated.", s->workers_removed);
+	counter(B, "vine_workers_lost", "Worker connections unexpectedly lost.", s->workers_lost);
+	counter(B, "vine_workers_idled_out", "Workers disconnected for being idle.", s->workers_idled_out);
+	counter(B, "vine_workers_slow", "Workers disconnected for being too slow.", s->workers_slow);
+}
+
+static void write_tasks(buffer_t *B, struct vine_stats *s)
+{
+	family(B, "vine_tasks", "gauge", "Number of tasks submitted and not yet returned, by state.");
+	buffer_printf(B, "vine_tasks{state=\"waiting\"} %d\n", s->tasks_waiting);
+	buffer_printf(B, "vine_tasks{state=\"running\"} %d\n", s->tasks_running);
+	buffer_printf(B, "vine_tasks{state=\"with_results\"} %d\n", s->tasks_with_results);
+
+	counter(B, "vine_tasks_submitted", "Tasks submitted to the manager.", s->tasks_submitted);
+	counter(B, "vine_tasks_dispatched", "Tasks dispatched to workers.", s->tasks_dispatched);
+	counter(B, "vine_tasks_done", "Tasks returned to the application.", s->tasks_done);
+	counter(B, "vine_tasks_failed", "Tasks returned with a result other than success.", s->tasks_failed);
+	counter(B, "vine_tasks_cancelled", "Tasks cancelled.", s->tasks_cancelled);
+	counter(B, "vine_tasks_exhausted_attempts", "Task executions that exhausted their resources.", s->tasks_exhausted_attempts);
+}
+
+static void write_categories(buffer_t *B, struct vine_manager *q)
+{
+	struct category *c;
+	char *name;
+
+	family(B, "vine_category_tasks", "gauge", "Number of tasks of a category, by state.");
+	HASH_TABLE_ITERATE(q->categories, name, c)
+	{
+		const char *states[] = {"waiting", "running", "with_results"};
+		int counts[] = {c->vine_stats->tasks_waiting, c->vine_stats->tasks_running, c->vine_stats->tasks_with_results};
+		int i;
+		for (i = 0; i < 3; i++) {
+			buffer_putliteral(B, "vine_category_tasks{category=");
+			label_value(B, name);
+			buffer_printf(B, ",state=\"%s\"} %d\n", states[i], counts[i]);
+		}
+	}
+
+	family(B, "vine_category_tasks_done", "counter", "Tasks of a category returned to the application.");
+	HASH_TABLE_ITERATE(q->categories, name, c)
+	{
+		buffer_putliteral(B, "vine_category_tasks_done_total{category=");
+		label_value(B, name);
+		buffer_printf(B, "} %d\n", c->vine_stats->tasks_done);
+	}
+
+	family(B, "vine_category_execute_seconds", "counter", "Time workers spent executing tasks of a category.");
+	HASH_TABLE_ITERATE(q->categories, name, c)
+	{
+		buffer_putliteral(B, "vine_category_execute_seconds_total{category=");
+		label_value(B, name);
+		buffer_printf(B, "} %.6f\n", c->vine_stats->time_workers_execute / 1000000.0);
+	}
+}
+
+static void write_transfers(buffer_t *B, struct vine_stats *s)
+{
+	counter(B, "vine_bytes_sent", "File bytes sent to workers.", s->bytes_sent);
+	counter(B, "vine_bytes_received", "File bytes received from workers.", s->bytes_received);
+	counter(B, "vine_cache_hits", "Task inputs already cached at the worker when the task was dispatched.", s->cache_hits);
+	counter(B, "vine_cache_misses", "Task inputs sent to the worker when the task was dispatched.", s->cache_misses);
+
+	counter(B, "vine_fetches", "Files placed in worker caches by the manager, a peer, or a url.", s->fetches);
+	counter(B, "vine_fetch_duplicates", "Fetches of a file to a host that had fetched it before.", s->fetch_duplicates);
+	counter(B, "vine_fetch_after_eviction", "Fetches of a file to a host that had evicted it.", s->fetch_after_eviction);
+	counter(B, "vine_fetch_unique_bytes", "Total size of the distinct files fetched, counting each file once.", s->fetch_unique_bytes);
+
+	family(B, "vine_fetch_bytes", "counter", "Total size of the files fetched, by source.");
+	buffer_printf(B, "vine_fetch_bytes_total{source=\"manager\"} %" PRId64 "\n", s->fetch_bytes_manager);
+	buffer_printf(B, "vine_fetch_bytes_total{source=\"peer\"} %" PRId64 "\n", s->fetch_bytes_peer);
+	buffer_printf(B, "vine_fetch_bytes_total{source=\"url\"} %" PRId64 "\n", s->fetch_bytes_url);
+
+	family(B, "vine_cache_hit_ratio", "gauge", "Fraction of task inputs already cached at the worker when the task was dispatched.");
+	int64_t inputs = s->cache_hits + s->cache_misses;
+	buffer_printf(B, "vine_cache_hit_ratio %.6f\n", inputs > 0 ? (double)s->cache_hits / inputs : 0.0);
+
+	gauge(B, "vine_cache_inuse_megabytes", "Disk space used by declared files across the connected workers.", s->inuse_cache);
+}
+
+static void write_queues(buffer_t *B, struct vine_manager *q)
+{
+	family(B, "vine_queue_depth", "gauge", "Number of entries in the internal queues of the manager.");
+	buffer_printf(B, "vine_queue_depth{queue=\"ready\"} %d\n", list_size(q->ready_list));
+	buffer_printf(B, "vine_queue_depth{queue=\"parked\"} %d\n", itable_size(q->ready_parked));
+	buffer_printf(B, "vine_queue_depth{queue=\"waiting_retrieval\"} %d\n", list_size(q->waiting_retrieval_list));
+	buffer_printf(B, "vine_queue_depth{queue=\"retrieved\"} %d\n", list_size(q->retrieved_list));
+	buffer_printf(B, "vine_queue_depth{queue=\"transfers\"} %d\n", vine_current_transfers_get_table_size(q));
+}
+
+static void write_loop(buffer_t *B, struct vine_stats *s)
+{
+	seconds_counter(B, "vine_polling_seconds", "Time spent waiting for messages from workers.", s->time_polling);
+	seconds_counter(B, "vine_scheduling_seconds", "Time spent matching tasks to workers.", s->time_scheduling);
+	seconds_counter(B, "vine_application_seconds", "Time spent outside of vine_wait.", s->time_application);
+
+	const char *name = "vine_loop_phase_seconds";
+	family(B, name, "summary", "Time of one run of a phase of the manager loop.");
+
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		struct vine_loop_phase_stats *p = &s->loop_phases[i];
+		const char *phase = vine_loop_phase_string(i);
+		buffer_printf(B, "%s{phase=\"%s\",quantile=\"0.5\"} %.6f\n", name, phase, p->time_p50 / 1000000.0);
+		buffer_printf(B, "%s{phase=\"%s\",quantile=\"0.9\"} %.6f\n", name, phase, p->time_p90 / 1000000.0);
+		buffer_printf(B, "%s{phase=\"%s\",quantile=\"0.99\"} %.6f\n", name, phase, p->time_p99 / 1000000.0);
+		buffer_printf(B, "%s_sum{phase=\"%s\"} %.6f\n", name, phase, p->time_total / 1000000.0);
+		buffer_printf(B, "%s_count{phase=\"%s\"} %" PRId64 "\n", name, phase, p->count);
+	}
+}
+
+static void write_memory(buffer_t *B, struct vine_stats *s)
+{
+	const char *name = "vine_memory_bytes";
+	family(B, name, "gauge", "Estimated memory held by the manager for each type of object.");
+
+	int i;
+	for (i = 0; i < VINE_MEMORY_MAX; i++) {
+		buffer_printf(B, "%s{type=\"%s\"} %" PRId64 "\n", name, vine_memory_type_string(i), s->memory_bytes[i]);
+	}
+}
+
+void vine_metrics_write(struct vine_manager *q, buffer_t *B)
+{
+	struct vine_stats s;
+	vine_get_stats(q, &s);
+
+	write_workers(B, &s);
+	write_tasks(B, &s);
+	write_categories(B, q);
+	write_transfers(B, &s);
+	write_queues(B, q);
+	write_loop(B, &s);
+	write_memory(B, &s);
+
+	buffer_putliteral(B, "# EOF\n");
+}
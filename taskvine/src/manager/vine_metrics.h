@@ -0,0 +1,26 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_METRICS_H
+#define VINE_METRICS_H
+
+/*
+Implementation of the /metrics page of the manager, which describes
+workers, tasks, categories, transfers, and the manager loop in the
+OpenMetrics text format, for collection by Prometheus and the like.
+The page is printed directly into a buffer, without building a jx tree.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+
+#include "buffer.h"
+
+#define VINE_METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+void vine_metrics_write(struct vine_manager *q, buffer_t *B);
+
+#endif
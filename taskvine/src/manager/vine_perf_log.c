@@ -43,9 +43,22 @@ void vine_perf_log_write_header(struct vine_manager *q)
 			" committed_cores committed_memory committed_disk"
 			" max_cores max_memory max_disk"
 			" min_cores min_memory min_disk"
-			" inuse_cache"
-			// end with a newline
-			"\n");
+			" inuse_cache");
+
+	// loop profile:
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		const char *name = vine_loop_phase_string(i);
+		fprintf(q->perf_logfile, " loop_%s_count loop_%s_time loop_%s_p99 loop_%s_max", name, name, name, name);
+	}
+
+	// memory accounting:
+	for (i = 0; i < VINE_MEMORY_MAX; i++) {
+		fprintf(q->perf_logfile, " memory_%s", vine_memory_type_string(i));
+	}
+
+	// end with a newline
+	fprintf(q->perf_logfile, "\n");
 }
 
 void vine_perf_log_write_update(struct vine_manager *q, int force)
@@ -148,6 +161,18 @@ void vine_perf_log_write_update(struct vine_manager *q, int force)
 
 	buffer_printf(&B, " %" PRId64, s.inuse_cache);
 
+	/* Loop profile */
+	int i;
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		struct vine_loop_phase_stats *p = &s.loop_phases[i];
+		buffer_printf(&B, " %" PRId64 " %" PRIu64 " %" PRIu64 " %" PRIu64, p->count, p->time_total, p->time_p99, p->time_max);
+	}
+
+	/* Memory accounting */
+	for (i = 0; i < VINE_MEMORY_MAX; i++) {
+		buffer_printf(&B, " %" PRId64, s.memory_bytes[i]);
+	}
+
 	fprintf(q->perf_logfile, "%s\n", buffer_tostring(&B));
 
 	buffer_free(&B);
@@ -0,0 +1,194 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_recovery.h"
+#include "vine_file.h"
+#include "vine_file_replica.h"
+#include "vine_file_replica_table.h"
+#include "vine_mount.h"
+#include "vine_worker_info.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "itable.h"
+#include "macros.h"
+#include "set.h"
+
+#include <float.h>
+
+void vine_recovery_set_depth(struct vine_task *t)
+{
+	struct vine_mount *m;
+	int depth = 0;
+
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		if (m->file->type == VINE_TEMP)
+			depth = MAX(depth, m->file->recovery_depth);
+	}
+
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		if (m->file->type == VINE_TEMP)
+			m->file->recovery_depth = depth + 1;
+	}
+}
+
+int vine_recovery_replicas_wanted(struct vine_manager *q, struct vine_file *f)
+{
+	if (q->recovery_replicate_depth > 0 && f->recovery_depth >= q->recovery_replicate_depth)
+		return MAX(q->temp_replica_count, 2);
+	return q->temp_replica_count;
+}
+
+/*
+A temp file is lost with w if it was created, and no other worker has a ready replica of it.
+*/
+
+static int file_lost_with(struct vine_manager *q, struct vine_file *f, struct vine_worker_info *w)
+{
+	if (f->type != VINE_TEMP || f->state != VINE_FILE_STATE_CREATED)
+		return 0;
+
+	struct set *sources = hash_table_lookup(q->file_worker_table, f->cached_name);
+	if (!sources)
+		return 1;
+
+	struct vine_worker_info *peer;
+	SET_ITERATE(sources, peer)
+	{
+		if (peer == w)
+			continue;
+		struct vine_file_replica *replica = vine_file_replica_table_lookup(peer, f->cached_name);
+		if (replica && replica->state == VINE_FILE_REPLICA_STATE_READY)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+A recovery task is already on its way if it was submitted and has not completed.
+*/
+
+static int recovery_in_progress(struct vine_task *rt)
+{
+	return rt->state == VINE_TASK_READY || rt->state == VINE_TASK_RUNNING || rt->state == VINE_TASK_WAITING_RETRIEVAL || rt->state == VINE_TASK_RETRIEVED;
+}
+
+/*
+Visit a lost file at the given distance from the tasks that need it,
+and then the lost inputs of the task that produces it, one step further.
+The distance of each recovery task is the longest path found to it.
+*/
+
+static void plan_file(struct vine_manager *q, struct vine_worker_info *w, struct vine_file *f, int distance, struct itable *distances, struct list *files)
+{
+	struct vine_task *rt = f->recovery_task;
+	if (!rt) {
+		debug(D_VINE, "recovery: %s is lost and has no recovery task", f->cached_name);
+		return;
+	}
+
+	if (recovery_in_progress(rt))
+		return;
+
+	/* Distances are stored plus one, since zero means not yet visited. */
+	uintptr_t key = (uintptr_t)rt;
+	int known = (int)(intptr_t)itable_lookup(distances, key);
+	if (known == 0) {
+		list_push_tail(files, f);
+	} else if (known - 1 >= distance) {
+		return;
+	}
+	itable_insert(distances, key, (void *)(intptr_t)(distance + 1));
+
+	struct vine_mount *m;
+	LIST_ITERATE(rt->input_mounts, m)
+	{
+		if (file_lost_with(q, m->file, w))
+			plan_file(q, w, m->file, distance + 1, distances, files);
+	}
+}
+
+struct list *vine_recovery_plan(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct list *files = list_create();
+
+	/* The temp files lost with this worker. */
+	struct set *lost = set_create(0);
+	char *cachename;
+	struct vine_file_replica *replica;
+	HASH_TABLE_ITERATE(w->current_files, cachename, replica)
+	{
+		struct vine_file *f = vine_manager_lookup_file(q, cachename);
+		if (f && file_lost_with(q, f, w))
+			set_insert(lost, f);
+	}
+
+	if (set_size(lost) == 0) {
+		set_delete(lost);
+		return files;
+	}
+
+	/*
+	The lost files needed are the inputs of tasks waiting to run, including
+	those about to be returned from this worker, or all of them if temp files
+	are recovered regardless of need.
+	*/
+	struct set *needed = set_create(0);
+	double top_priority = -DBL_MAX;
+
+	uint64_t task_id;
+	struct vine_task *t;
+	ITABLE_ITERATE(q->tasks, task_id, t)
+	{
+		if (t->state != VINE_TASK_READY && !(t->state == VINE_TASK_RUNNING && t->worker == w))
+			continue;
+
+		top_priority = MAX(top_priority, t->priority);
+
+		struct vine_mount *m;
+		LIST_ITERATE(t->input_mounts, m)
+		{
+			if (set_lookup(lost, m->file))
+				set_insert(needed, m->file);
+		}
+	}
+
+	if (q->transfer_temps_recovery) {
+		set_insert_set(needed, lost);
+	}
+
+	struct itable *distances = itable_create(0);
+	struct vine_file *f;
+	SET_ITERATE(needed, f)
+	{
+		plan_file(q, w, f, 0, distances, files);
+	}
+
+	if (top_priority == -DBL_MAX)
+		top_priority = 0;
+
+	/* Recovery goes ahead of waiting tasks, and the most distant producers go first. */
+	LIST_ITERATE(files, f)
+	{
+		int distance = (int)(intptr_t)itable_lookup(distances, (uintptr_t)f->recovery_task) - 1;
+		f->recovery_task->priority = top_priority + 1 + distance;
+	}
+
+	if (list_size(files) > 0) {
+		debug(D_VINE, "recovery: worker %s lost %d temp files, %d needed, %d recovery tasks planned", w->hostname, set_size(lost), set_size(needed), list_size(files));
+	}
+
+	itable_delete(distances);
+	set_delete(needed);
+	set_delete(lost);
+
+	return files;
+}
+
+/* vim: set noexpandtab tabstop=4: */
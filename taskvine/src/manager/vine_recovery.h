@@ -0,0 +1,46 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_RECOVERY_H
+#define VINE_RECOVERY_H
+
+/*
+Recovery planning for temporary files lost with a worker.
+Without planning, a lost temp file is recreated only when a task that needs
+it is considered for dispatch, and the recovery task that recreates it may
+then find its own inputs lost, so recovery proceeds one file at a time.
+With planning, when a worker is lost the lineage of the lost files still
+needed by waiting tasks is walked back through the recovery tasks of their
+producers, stopping at any file with a replica at another worker, so that
+exactly the producers needed are submitted at once.  They get a priority
+above that of any waiting task, with the most distant producers first.
+
+Separately, the lineage depth of each temp file is kept: the longest chain
+of temp files that would have to be recreated to recover it.  Files at
+least recovery-replicate-depth deep are replicated to a second worker as
+soon as they are created, since losing them would cost the most.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+#include "vine_task.h"
+
+#include "list.h"
+
+/* Record the lineage depth of the temp outputs of a task being submitted. */
+void vine_recovery_set_depth(struct vine_task *t);
+
+/* The number of replicas wanted of this temp file. */
+int vine_recovery_replicas_wanted(struct vine_manager *q, struct vine_file *f);
+
+/*
+Plan the recovery of the temp files lost with worker w, before its replicas are forgotten.
+Returns a list of lost files, one for each recovery task to submit,
+with the priority of each recovery task already raised.
+*/
+struct list *vine_recovery_plan(struct vine_manager *q, struct vine_worker_info *w);
+
+#endif
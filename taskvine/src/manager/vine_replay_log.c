@@ -0,0 +1,168 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_replay_log.h"
+#include "vine_file.h"
+#include "vine_file_replica.h"
+#include "vine_file_replica_table.h"
+#include "vine_mount.h"
+#include "vine_resources.h"
+#include "vine_task.h"
+#include "vine_worker_info.h"
+
+#include "jx.h"
+#include "jx_print.h"
+#include "rmsummary.h"
+
+#include <stdio.h>
+
+#define VINE_REPLAY_LOG_VERSION 1
+
+static const char *file_type_string(vine_file_type_t type)
+{
+	switch (type) {
+	case VINE_FILE:
+		return "file";
+	case VINE_URL:
+		return "url";
+	case VINE_TEMP:
+		return "temp";
+	case VINE_BUFFER:
+		return "buffer";
+	case VINE_MINI_TASK:
+		return "mini_task";
+	}
+	return "unknown";
+}
+
+static struct jx *event_create(const char *name)
+{
+	struct jx *j = jx_object(0);
+	jx_insert_string(j, "event", name);
+	jx_insert_integer(j, "time", timestamp_get());
+	return j;
+}
+
+static void event_write(struct vine_manager *q, struct jx *j)
+{
+	jx_print_stream(j, q->replay_logfile);
+	fputc('\n', q->replay_logfile);
+	jx_delete(j);
+}
+
+void vine_replay_log_write_header(struct vine_manager *q)
+{
+	setvbuf(q->replay_logfile, NULL, _IOLBF, 4096); // line buffered, we don't want incomplete lines
+
+	struct jx *j = event_create("start");
+	jx_insert_integer(j, "version", VINE_REPLAY_LOG_VERSION);
+	event_write(q, j);
+}
+
+void vine_replay_log_write_worker(struct vine_manager *q, struct vine_worker_info *w)
+{
+	if (!q->replay_logfile || w->type != VINE_WORKER_TYPE_WORKER)
+		return;
+
+	struct jx *j = event_create("worker");
+	jx_insert_string(j, "worker", w->hashkey);
+	jx_insert_string(j, "host", w->hostname);
+	jx_insert_integer(j, "cores", w->resources->cores.total);
+	jx_insert_integer(j, "memory", w->resources->memory.total);
+	jx_insert_integer(j, "disk", w->resources->disk.total);
+	jx_insert_integer(j, "gpus", w->resources->gpus.total);
+	event_write(q, j);
+}
+
+void vine_replay_log_write_worker_removed(struct vine_manager *q, struct vine_worker_info *w)
+{
+	if (!q->replay_logfile || w->type != VINE_WORKER_TYPE_WORKER)
+		return;
+
+	struct jx *j = event_create("worker_removed");
+	jx_insert_string(j, "worker", w->hashkey);
+	event_write(q, j);
+}
+
+void vine_replay_log_write_submit(struct vine_manager *q, struct vine_task *t)
+{
+	if (!q->replay_logfile)
+		return;
+
+	struct jx *j = event_create("submit");
+	jx_insert_integer(j, "task", t->task_id);
+	jx_insert_string(j, "category", t->category ? t->category : "default");
+	jx_insert_double(j, "priority", t->priority);
+
+	/* -1 means the resource was not given, and is chosen by the manager. */
+	jx_insert_double(j, "cores", t->resources_requested->cores);
+	jx_insert_double(j, "memory", t->resources_requested->memory);
+	jx_insert_double(j, "disk", t->resources_requested->disk);
+	jx_insert_double(j, "gpus", t->resources_requested->gpus);
+
+	struct vine_mount *m;
+
+	struct jx *inputs = jx_array(0);
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		struct jx *f = jx_object(0);
+		jx_insert_string(f, "name", m->file->cached_name);
+		jx_insert_string(f, "type", file_type_string(m->file->type));
+		jx_insert_integer(f, "size", m->file->size);
+		jx_insert_integer(f, "cache", m->file->cache_level);
+		jx_array_append(inputs, f);
+	}
+	jx_insert(j, jx_string("inputs"), inputs);
+
+	struct jx *outputs = jx_array(0);
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		jx_array_append(outputs, jx_string(m->file->cached_name));
+	}
+	jx_insert(j, jx_string("outputs"), outputs);
+
+	event_write(q, j);
+}
+
+void vine_replay_log_write_done(struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t)
+{
+	if (!q->replay_logfile)
+		return;
+
+	struct jx *j = event_create("done");
+	jx_insert_integer(j, "task", t->task_id);
+	jx_insert_string(j, "worker", w->hashkey);
+	jx_insert_string(j, "result", vine_result_string(t->result));
+	jx_insert_integer(j, "duration", t->time_workers_execute_last);
+
+	/* The size of an output is known from the replica reported by the worker, if any. */
+	struct vine_mount *m;
+	struct jx *outputs = jx_array(0);
+	LIST_ITERATE(t->output_mounts, m)
+	{
+		struct vine_file_replica *replica = vine_file_replica_table_lookup(w, m->file->cached_name);
+		struct jx *f = jx_object(0);
+		jx_insert_string(f, "name", m->file->cached_name);
+		jx_insert_integer(f, "size", replica ? replica->size : (int64_t)m->file->size);
+		jx_array_append(outputs, f);
+	}
+	jx_insert(j, jx_string("outputs"), outputs);
+
+	event_write(q, j);
+}
+
+void vine_replay_log_write_transfer(struct vine_manager *q, struct vine_worker_info *w, const char *cachename, int64_t size, timestamp_t transfer_time)
+{
+	if (!q->replay_logfile)
+		return;
+
+	struct jx *j = event_create("transfer");
+	jx_insert_string(j, "worker", w->hashkey);
+	jx_insert_string(j, "name", cachename);
+	jx_insert_integer(j, "size", size);
+	jx_insert_integer(j, "duration", transfer_time);
+	event_write(q, j);
+}
@@ -0,0 +1,30 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_REPLAY_LOG_H
+#define VINE_REPLAY_LOG_H
+
+/*
+Implementation of the manager's replay log, which records the workload
+of the manager in enough detail to replay it offline with vine_replay:
+the resources of each worker as it arrives and when it leaves, the
+resources and input files of each task as it is submitted, and the
+execution time and output sizes of each task as it completes, along
+with the size and time of each transfer to a worker.
+Each event is written as one JSON object per line.
+This module is private to the manager and should not be invoked by the end user.
+*/
+
+#include "vine_manager.h"
+
+void vine_replay_log_write_header( struct vine_manager *q );
+void vine_replay_log_write_worker( struct vine_manager *q, struct vine_worker_info *w );
+void vine_replay_log_write_worker_removed( struct vine_manager *q, struct vine_worker_info *w );
+void vine_replay_log_write_submit( struct vine_manager *q, struct vine_task *t );
+void vine_replay_log_write_done( struct vine_manager *q, struct vine_worker_info *w, struct vine_task *t );
+void vine_replay_log_write_transfer( struct vine_manager *q, struct vine_worker_info *w, const char *cachename, int64_t size, timestamp_t transfer_time );
+
+#endif
@@ -0,0 +1,192 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_resource_index.h"
+
+#include "macros.h"
+#include "set.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Workers with this many or more free cores share the last bucket. */
+#define CORE_BUCKETS 64
+
+/* Memory buckets are powers of two of MB, which covers up to an exabyte. */
+#define MEMORY_BUCKETS 32
+
+struct vine_resource_index {
+	struct set *cells[CORE_BUCKETS][MEMORY_BUCKETS];
+	int row_size[CORE_BUCKETS];
+	int size;
+
+	/* Iteration state, see vine_resource_index_first. */
+	int first_core;
+	int first_memory;
+	int width;
+	int ncells;
+	int start;
+	int visited;
+	int random_start;
+	int offset;
+	struct set *current;
+};
+
+static int core_bucket(double cores)
+{
+	if (cores < 1) {
+		return 0;
+	}
+	return MIN((int)floor(cores), CORE_BUCKETS - 1);
+}
+
+static int memory_bucket(double memory)
+{
+	if (memory < 1) {
+		return 0;
+	}
+	return MIN(1 + (int)floor(log2(memory)), MEMORY_BUCKETS - 1);
+}
+
+struct vine_resource_index *vine_resource_index_create()
+{
+	struct vine_resource_index *r = malloc(sizeof(*r));
+	if (!r)
+		return 0;
+
+	memset(r, 0, sizeof(*r));
+
+	return r;
+}
+
+void vine_resource_index_delete(struct vine_resource_index *r)
+{
+	if (!r)
+		return;
+
+	int c, m;
+	for (c = 0; c < CORE_BUCKETS; c++) {
+		for (m = 0; m < MEMORY_BUCKETS; m++) {
+			if (r->cells[c][m]) {
+				set_delete(r->cells[c][m]);
+			}
+		}
+	}
+
+	free(r);
+}
+
+void vine_resource_index_remove(struct vine_resource_index *r, struct vine_worker_info *w)
+{
+	if (!w->resource_index_indexed)
+		return;
+
+	int c = w->resource_index_cores;
+	int m = w->resource_index_memory;
+
+	if (set_remove(r->cells[c][m], w)) {
+		r->row_size[c]--;
+		r->size--;
+	}
+
+	w->resource_index_indexed = 0;
+}
+
+void vine_resource_index_update(struct vine_resource_index *r, struct vine_worker_info *w, double free_cores, double free_memory)
+{
+	int c = core_bucket(free_cores);
+	int m = memory_bucket(free_memory);
+
+	if (w->resource_index_indexed) {
+		if (w->resource_index_cores == c && w->resource_index_memory == m) {
+			return;
+		}
+		vine_resource_index_remove(r, w);
+	}
+
+	if (!r->cells[c][m]) {
+		r->cells[c][m] = set_create(0);
+	}
+
+	set_insert(r->cells[c][m], w);
+	r->row_size[c]++;
+	r->size++;
+
+	w->resource_index_cores = c;
+	w->resource_index_memory = m;
+	w->resource_index_indexed = 1;
+}
+
+int vine_resource_index_size(struct vine_resource_index *r)
+{
+	return r->size;
+}
+
+/*
+The eligible cells form a rectangle of the grid, which is walked row by row
+as a linear sequence of ncells, starting at an arbitrary position and
+wrapping around. Rows are a multiple of width, so that empty rows of
+cores can be skipped at once.
+*/
+
+void vine_resource_index_first(struct vine_resource_index *r, double cores, double memory, int random_start)
+{
+	r->first_core = core_bucket(cores);
+	r->first_memory = memory_bucket(memory);
+	r->width = MEMORY_BUCKETS - r->first_memory;
+	r->ncells = (CORE_BUCKETS - r->first_core) * r->width;
+	r->visited = 0;
+	r->current = 0;
+	r->random_start = random_start;
+	r->start = random_start ? random() % r->ncells : 0;
+}
+
+struct vine_worker_info *vine_resource_index_next(struct vine_resource_index *r)
+{
+	struct vine_worker_info *w;
+
+	while (1) {
+		if (r->current) {
+			if (r->random_start) {
+				w = set_next_element_with_offset(r->current, r->offset);
+			} else {
+				w = set_next_element(r->current);
+			}
+			if (w) {
+				return w;
+			}
+			r->current = 0;
+		}
+
+		if (r->visited >= r->ncells) {
+			return 0;
+		}
+
+		int position = (r->start + r->visited) % r->ncells;
+		int c = r->first_core + position / r->width;
+		int m = r->first_memory + position % r->width;
+
+		if (r->row_size[c] < 1) {
+			r->visited += r->width - position % r->width;
+			continue;
+		}
+
+		r->visited++;
+
+		struct set *s = r->cells[c][m];
+		if (s && set_size(s) > 0) {
+			if (r->random_start) {
+				set_random_element(s, &r->offset);
+			} else {
+				set_first_element(s);
+			}
+			r->current = s;
+		}
+	}
+}
+
+/* vim: set noexpandtab tabstop=8: */
@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_RESOURCE_INDEX_H
+#define VINE_RESOURCE_INDEX_H
+
+/*
+The resource index keeps the connected workers bucketed by the amount
+of cores and memory they have free, so that the scheduler only needs to
+consider workers that could possibly fit a given task.
+
+Workers are placed into a two level grid of buckets: the first level by
+whole free cores, and the second level by powers of two of free memory.
+A worker is only skipped when its bucket is strictly below the bucket
+of the request, so the index never hides a worker that could fit.
+Candidates returned may still be too small, and must be checked in full
+by the caller.
+
+The index must be updated with @ref vine_resource_index_update every time
+the resources in use at a worker change, which the manager does in
+count_worker_resources.
+*/
+
+#include "vine_worker_info.h"
+
+struct vine_resource_index *vine_resource_index_create();
+void vine_resource_index_delete(struct vine_resource_index *r);
+
+/* Place w according to its free cores and memory, moving it if it was already indexed. */
+void vine_resource_index_update(struct vine_resource_index *r, struct vine_worker_info *w, double free_cores, double free_memory);
+
+/* Remove w from the index. Workers not in the index are ignored. */
+void vine_resource_index_remove(struct vine_resource_index *r, struct vine_worker_info *w);
+
+/* Number of workers currently in the index. */
+int vine_resource_index_size(struct vine_resource_index *r);
+
+/*
+Begin iterating over the workers that may have at least cores and memory free.
+If random_start is set, the iteration starts at a random bucket and position,
+so that the first candidates are not always the same workers.
+The index must not be updated while it is being iterated.
+*/
+void vine_resource_index_first(struct vine_resource_index *r, double cores, double memory, int random_start);
+struct vine_worker_info *vine_resource_index_next(struct vine_resource_index *r);
+
+#define VINE_RESOURCE_INDEX_ITERATE(r, cores, memory, w) \
+	vine_resource_index_first(r, cores, memory, 0); \
+	while ((w = vine_resource_index_next(r)))
+
+#define VINE_RESOURCE_INDEX_ITERATE_RANDOM_START(r, cores, memory, w) \
+	vine_resource_index_first(r, cores, memory, 1); \
+	while ((w = vine_resource_index_next(r)))
+
+#endif
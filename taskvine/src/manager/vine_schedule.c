@@ -10,6 +10,7 @@ See the file COPYING for details.
 #include "vine_file.h"
 #include "vine_file_replica.h"
 #include "vine_mount.h"
+#include "vine_resource_index.h"
 
 #include "debug.h"
 #include "hash_table.h"
@@ -17,9 +18,11 @@ See the file COPYING for details.
 #include "macros.h"
 #include "rmonitor_types.h"
 #include "rmsummary.h"
+#include "set.h"
 
 #include <limits.h>
 #include <math.h>
+#include <stdlib.h>
 
 /* check whether worker has all fixed locations required for task */
 int check_fixed_location_worker(struct vine_manager *m, struct vine_worker_info *w, struct vine_task *t)
@@ -68,6 +71,37 @@ int vine_schedule_in_ramp_down(struct vine_manager *q)
 	return 0;
 }
 
+/* Check that a task sent beyond the resources the worker has left, as the
+ * resource-submit-multiplier allows, still fits in what the tasks of the
+ * worker actually use, as last reported by the worker. Without a recent
+ * report, the overcommit is allowed as before.
+ * @param q     Manager info structure.
+ * @param w     Worker info structure.
+ * @param r     Resources of the worker, with those of idle libraries already subtracted.
+ * @param tr    Chosen task resources.
+ * @return 1 if the overcommit is safe or cannot be judged, 0 otherwise. */
+static int check_worker_measured_usage(struct vine_manager *q, struct vine_worker_info *w, struct vine_resources *r, struct rmsummary *tr)
+{
+	if (q->worker_usage_interval < 1 || w->measured_usage_time == 0) {
+		return 1;
+	}
+
+	/* a report that missed a few intervals no longer describes the worker. */
+	if (timestamp_get() - w->measured_usage_time > (timestamp_t)3 * q->worker_usage_interval * ONE_SECOND) {
+		return 1;
+	}
+
+	if (r->cores.inuse + tr->cores > r->cores.total && w->measured_cores + tr->cores > r->cores.total) {
+		return 0;
+	}
+
+	if (r->memory.inuse + tr->memory > r->memory.total && w->measured_memory + tr->memory > r->memory.total) {
+		return 0;
+	}
+
+	return 1;
+}
+
 /* Check if worker resources are enough to run the task.
  * Note that empty libraries are not *real* tasks and can be
  * killed as needed to reclaim unused resources and
@@ -129,6 +163,10 @@ int check_worker_have_enough_resources(struct vine_manager *q, struct vine_worke
 	if ((tr->gpus > worker_net_resources->gpus.total) || (worker_net_resources->gpus.inuse + tr->gpus > overcommitted_resource_total(q, worker_net_resources->gpus.total))) {
 		ok = 0;
 	}
+
+	if (ok && !check_worker_measured_usage(q, w, worker_net_resources, tr)) {
+		ok = 0;
+	}
 	vine_resources_delete(worker_net_resources);
 	return ok;
 }
@@ -181,6 +219,11 @@ int check_worker_against_task(struct vine_manager *q, struct vine_worker_info *w
 	if (w->draining) {
 		return 0;
 	}
+
+	/* Don't send tasks while the worker is busy sending an output in the background. */
+	if (w->output_stream) {
+		return 0;
+	}
 	// if worker's end time has not been received
 	if (w->end_time < 0) {
 		return 0;
@@ -191,6 +234,11 @@ int check_worker_against_task(struct vine_manager *q, struct vine_worker_info *w
 		return 0;
 	}
 
+	/* A speculative duplicate must run somewhere other than the task it hedges against. */
+	if (t->type == VINE_TASK_TYPE_SPECULATIVE && t->speculative_original && t->speculative_original->worker == w) {
+		return 0;
+	}
+
 	/* Don't send tasks if the factory is used and has too many connected workers. */
 	if (w->factory_name) {
 		struct vine_factory_info *f = vine_factory_info_lookup(q, w->factory_name);
@@ -322,58 +370,194 @@ static int candidate_has_worse_fit(struct vine_worker_info *current_best, struct
 	return 0;
 }
 
+/*
+Find the least amount of cores and memory that this task could be allocated at
+any worker, as a lower bound to look for candidates in the resource index.
+This mirrors vine_manager_choose_resources_for_task: an explicit request is
+used as is, otherwise the allocation never goes below the category minimum.
+Function calls consume no resources of their own.
+*/
+
+static void task_resources_lower_bound(struct vine_manager *q, struct vine_task *t, double *cores, double *memory)
+{
+	*cores = 0;
+	*memory = 0;
+
+	if (t->needs_library) {
+		return;
+	}
+
+	const struct rmsummary *min = vine_manager_task_resources_min(q, t);
+
+	*cores = t->resources_requested->cores > -1 ? t->resources_requested->cores : MAX(0, min->cores);
+	*memory = t->resources_requested->memory > -1 ? t->resources_requested->memory : MAX(0, min->memory);
+}
+
+static struct vine_worker_info *find_worker_by_worst_fit(struct vine_manager *q, struct vine_task *t);
+
+/* Quantity of data of a task cached at a worker, used to rank workers by locality. */
+
+struct worker_locality {
+	struct vine_worker_info *w;
+	int64_t cached_bytes;
+	int cached_files;
+	int has_all_files;
+};
+
+/* Most cached bytes first. */
+
+static int compare_by_cached_bytes(const void *a, const void *b)
+{
+	const struct worker_locality *x = *(const struct worker_locality **)a;
+	const struct worker_locality *y = *(const struct worker_locality **)b;
+
+	if (x->cached_bytes > y->cached_bytes) {
+		return -1;
+	} else if (x->cached_bytes < y->cached_bytes) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Workers with all the cacheable files first, then most cached bytes. */
+
+static int compare_by_all_files(const void *a, const void *b)
+{
+	const struct worker_locality *x = *(const struct worker_locality **)a;
+	const struct worker_locality *y = *(const struct worker_locality **)b;
+
+	if (x->has_all_files != y->has_all_files) {
+		return y->has_all_files - x->has_all_files;
+	}
+	return compare_by_cached_bytes(a, b);
+}
+
 /*
 Find the worker that has the largest quantity of cached data needed
 by this task, so as to minimize transfer work that must be done
 by the manager.
+
+Rather than looking up every input at every worker, the cached bytes
+are accumulated starting from the replicas of each input as recorded
+in file_worker_table, so only workers holding some input are scored.
+Candidates are then checked for compatibility from best to worst, and
+we stop at the first (or, in ramp down, at the first group of equal
+locality) that fits. If no worker holding an input fits, any worker
+will do.
 */
 
 static struct vine_worker_info *find_worker_by_files(struct vine_manager *q, struct vine_task *t)
 {
-	char *key;
 	struct vine_worker_info *w;
 	struct vine_worker_info *best_worker = 0;
-	int offset_bookkeep;
 	int64_t most_task_cached_bytes = 0;
-	int64_t task_cached_bytes;
-	uint8_t has_all_files;
 	struct vine_file_replica *replica;
 	struct vine_mount *m;
+	struct worker_locality *l;
+	char *key;
+	int required_files = 0;
+	int i;
 
 	int ramp_down = vine_schedule_in_ramp_down(q);
 
-	HASH_TABLE_ITERATE_RANDOM_START(q->worker_table, offset_bookkeep, key, w)
+	struct hash_table *scores = hash_table_create(0, 0);
+
+	LIST_ITERATE(t->input_mounts, m)
 	{
-		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
-		if (check_worker_against_task(q, w, t)) {
-			task_cached_bytes = 0;
-			has_all_files = 1;
+		if (m->file->cache_level > VINE_CACHE_LEVEL_TASK) {
+			required_files++;
+		}
 
-			LIST_ITERATE(t->input_mounts, m)
-			{
-				replica = hash_table_lookup(w->current_files, m->file->cached_name);
+		if (m->file->type != VINE_FILE) {
+			continue;
+		}
 
-				if (replica && m->file->type == VINE_FILE) {
-					task_cached_bytes += replica->size;
-				} else if (m->file->cache_level > VINE_CACHE_LEVEL_TASK) {
-					has_all_files = 0;
-				}
+		struct set *workers = hash_table_lookup(q->file_worker_table, m->file->cached_name);
+		if (!workers) {
+			continue;
+		}
+
+		SET_ITERATE(workers, w)
+		{
+			replica = hash_table_lookup(w->current_files, m->file->cached_name);
+			if (!replica) {
+				continue;
 			}
 
-			/* Return the worker if it was in possession of all cacheable files */
-			if (has_all_files && !ramp_down) {
-				return w;
+			l = hash_table_lookup(scores, w->hashkey);
+			if (!l) {
+				l = calloc(1, sizeof(*l));
+				l->w = w;
+				hash_table_insert(scores, w->hashkey, l);
 			}
 
-			if (!best_worker || task_cached_bytes > most_task_cached_bytes ||
-					(ramp_down && task_cached_bytes == most_task_cached_bytes && candidate_has_worse_fit(best_worker, w))) {
-				best_worker = w;
-				most_task_cached_bytes = task_cached_bytes;
+			l->cached_bytes += replica->size;
+			if (m->file->cache_level > VINE_CACHE_LEVEL_TASK) {
+				l->cached_files++;
 			}
 		}
 	}
 
-	return best_worker;
+	int ncandidates = hash_table_size(scores);
+	struct worker_locality **candidates = malloc(sizeof(*candidates) * MAX(1, ncandidates));
+
+	i = 0;
+	HASH_TABLE_ITERATE(scores, key, l)
+	{
+		l->has_all_files = l->cached_files >= required_files;
+		candidates[i++] = l;
+	}
+
+	qsort(candidates, ncandidates, sizeof(*candidates), ramp_down ? compare_by_cached_bytes : compare_by_all_files);
+
+	for (i = 0; i < ncandidates; i++) {
+		l = candidates[i];
+
+		if (best_worker && (!ramp_down || l->cached_bytes < most_task_cached_bytes)) {
+			break;
+		}
+
+		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
+		if (!check_worker_against_task(q, l->w, t)) {
+			continue;
+		}
+
+		if (!best_worker || candidate_has_worse_fit(best_worker, l->w)) {
+			best_worker = l->w;
+			most_task_cached_bytes = l->cached_bytes;
+		}
+	}
+
+	free(candidates);
+	hash_table_clear(scores, free);
+	hash_table_delete(scores);
+
+	if (best_worker && most_task_cached_bytes > 0) {
+		return best_worker;
+	}
+
+	/* No cached data makes a difference, so consider all the workers. */
+
+	if (ramp_down) {
+		return find_worker_by_worst_fit(q, t);
+	}
+
+	if (best_worker) {
+		return best_worker;
+	}
+
+	double cores, memory;
+	task_resources_lower_bound(q, t, &cores, &memory);
+
+	VINE_RESOURCE_INDEX_ITERATE_RANDOM_START(q->worker_resource_index, cores, memory, w)
+	{
+		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
+		if (check_worker_against_task(q, w, t)) {
+			return w;
+		}
+	}
+
+	return 0;
 }
 
 /*
@@ -384,9 +568,12 @@ this amounts to simply "find the first available worker".
 
 static struct vine_worker_info *find_worker_by_fcfs(struct vine_manager *q, struct vine_task *t)
 {
-	char *key;
 	struct vine_worker_info *w;
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
+
+	double cores, memory;
+	task_resources_lower_bound(q, t, &cores, &memory);
+
+	VINE_RESOURCE_INDEX_ITERATE(q->worker_resource_index, cores, memory, w)
 	{
 		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
 		if (check_worker_against_task(q, w, t)) {
@@ -404,14 +591,16 @@ putting them in a list, and then choosing from the list at random.
 
 static struct vine_worker_info *find_worker_by_random(struct vine_manager *q, struct vine_task *t)
 {
-	char *key;
 	struct vine_worker_info *w = NULL;
 	int random_worker;
 	struct list *valid_workers = list_create();
 
-	// avoid the temptation to use HASH_TABLE_ITERATE_RANDOM_START for this loop.
-	// HASH_TABLE_ITERATE_RANDOM_START would give preference to workers that appear first in a bucket.
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
+	double cores, memory;
+	task_resources_lower_bound(q, t, &cores, &memory);
+
+	// avoid the temptation to use VINE_RESOURCE_INDEX_ITERATE_RANDOM_START for this loop.
+	// A random start would give preference to workers that appear first in a bucket.
+	VINE_RESOURCE_INDEX_ITERATE(q->worker_resource_index, cores, memory, w)
 	{
 		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
 		if (check_worker_against_task(q, w, t)) {
@@ -441,11 +630,13 @@ unused once this task is placed there.
 
 static struct vine_worker_info *find_worker_by_worst_fit(struct vine_manager *q, struct vine_task *t)
 {
-	char *key;
 	struct vine_worker_info *w;
 	struct vine_worker_info *best_worker = NULL;
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
+	double cores, memory;
+	task_resources_lower_bound(q, t, &cores, &memory);
+
+	VINE_RESOURCE_INDEX_ITERATE(q->worker_resource_index, cores, memory, w)
 	{
 		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
 		if (check_worker_against_task(q, w, t)) {
@@ -466,12 +657,14 @@ then pick one FCFS.
 
 static struct vine_worker_info *find_worker_by_time(struct vine_manager *q, struct vine_task *t)
 {
-	char *key;
 	struct vine_worker_info *w;
 	struct vine_worker_info *best_worker = 0;
 	double best_time = HUGE_VAL;
 
-	HASH_TABLE_ITERATE(q->worker_table, key, w)
+	double cores, memory;
+	task_resources_lower_bound(q, t, &cores, &memory);
+
+	VINE_RESOURCE_INDEX_ITERATE(q->worker_resource_index, cores, memory, w)
 	{
 		/* Careful: If check_worker_against task fails, then w may no longer be valid. */
 		if (check_worker_against_task(q, w, t)) {
@@ -16,6 +16,7 @@ See the file COPYING for details.
 #include "macros.h"
 #include "rmonitor.h"
 #include "rmsummary.h"
+#include "string_intern.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
@@ -45,7 +46,7 @@ struct vine_task *vine_task_create(const char *command_line)
 
 	if (command_line)
 		t->command_line = xxstrdup(command_line);
-	t->category = xxstrdup("default");
+	t->category = string_intern("default");
 
 	t->input_mounts = list_create();
 	t->output_mounts = list_create();
@@ -69,19 +70,37 @@ struct vine_task *vine_task_create(const char *command_line)
 
 	/* In the absence of additional information, a task consumes an entire worker. */
 	t->resources_requested = rmsummary_create(-1);
-	t->resources_measured = rmsummary_create(-1);
-	t->resources_allocated = rmsummary_create(-1);
+
+	/* These are only created once the task is dispatched, see vine_task_ensure_resources. */
+	t->resources_measured = 0;
+	t->resources_allocated = 0;
 	t->current_resource_box = 0;
 	t->input_files_size = -1;
 
 	t->refcount = 1;
 	t->output_received = 0;
+	t->output_mounts_retrieved = 0;
+	t->output_mounts_result = 0;
 
 	vine_counters.task.created++;
 
 	return t;
 }
 
+/*
+A task waiting in the queue has nothing allocated or measured yet.
+Creating those summaries only when it is dispatched or completed keeps
+a large queue of waiting tasks much smaller in memory.
+*/
+
+void vine_task_ensure_resources(struct vine_task *t)
+{
+	if (!t->resources_measured)
+		t->resources_measured = rmsummary_create(-1);
+	if (!t->resources_allocated)
+		t->resources_allocated = rmsummary_create(-1);
+}
+
 void vine_task_clean(struct vine_task *t)
 {
 	t->time_when_commit_start = 0;
@@ -105,6 +124,8 @@ void vine_task_clean(struct vine_task *t)
 	t->output = NULL;
 	t->output_length = 0;
 	t->output_received = 0;
+	t->output_mounts_retrieved = 0;
+	t->output_mounts_result = 0;
 
 	free(t->hostname);
 	t->hostname = NULL;
@@ -151,8 +172,8 @@ void vine_task_reset(struct vine_task *t)
 
 	rmsummary_delete(t->resources_measured);
 	rmsummary_delete(t->resources_allocated);
-	t->resources_measured = rmsummary_create(-1);
-	t->resources_allocated = rmsummary_create(-1);
+	t->resources_measured = 0;
+	t->resources_allocated = 0;
 
 	rmsummary_delete(t->current_resource_box);
 	t->current_resource_box = 0;
@@ -437,10 +458,9 @@ void vine_task_set_tag(struct vine_task *t, const char *tag)
 
 void vine_task_set_category(struct vine_task *t, const char *category)
 {
-	if (t->category)
-		free(t->category);
-
-	t->category = xxstrdup(category ? category : "default");
+	const char *old = t->category;
+	t->category = string_intern(category ? category : "default");
+	string_intern_release(old);
 }
 
 void vine_task_add_feature(struct vine_task *t, const char *name)
@@ -560,7 +580,7 @@ int vine_task_add_output(struct vine_task *t, struct vine_file *f, const char *r
 
 int vine_task_add_input_file(struct vine_task *t, const char *local_name, const char *remote_name, vine_mount_flags_t flags)
 {
-	struct vine_file *f = vine_file_local(local_name, VINE_CACHE_LEVEL_TASK, 0);
+	struct vine_file *f = vine_file_local(local_name, VINE_CACHE_LEVEL_TASK, 0, 0);
 	int r = vine_task_add_input(t, f, remote_name, flags);
 	vine_file_delete(f); /* symmetric create/delete needed for reference counting. */
 	return r;
@@ -568,7 +588,7 @@ int vine_task_add_input_file(struct vine_task *t, const char *local_name, const
 
 int vine_task_add_output_file(struct vine_task *t, const char *local_name, const char *remote_name, vine_mount_flags_t flags)
 {
-	struct vine_file *f = vine_file_local(local_name, VINE_CACHE_LEVEL_TASK, 0);
+	struct vine_file *f = vine_file_local(local_name, VINE_CACHE_LEVEL_TASK, 0, 0);
 	int r = vine_task_add_output(t, f, remote_name, flags);
 	vine_file_delete(f); /* symmetric create/delete needed for reference counting. */
 	return r;
@@ -576,7 +596,7 @@ int vine_task_add_output_file(struct vine_task *t, const char *local_name, const
 
 int vine_task_add_input_url(struct vine_task *t, const char *file_url, const char *remote_name, vine_mount_flags_t flags)
 {
-	struct vine_file *f = vine_file_url(file_url, VINE_CACHE_LEVEL_TASK, 0);
+	struct vine_file *f = vine_file_url(file_url, VINE_CACHE_LEVEL_TASK, 0, 0);
 	int r = vine_task_add_input(t, f, remote_name, flags);
 	vine_file_delete(f); /* symmetric create/delete needed for reference counting. */
 	return r;
@@ -719,12 +739,13 @@ void vine_task_delete(struct vine_task *t)
 
 	free(t->command_line);
 	free(t->tag);
-	free(t->category);
+	string_intern_release(t->category);
 
 	free(t->needs_library);
 	free(t->provides_library);
 
 	free(t->monitor_output_directory);
+	free(t->ready_blocked_key);
 
 	list_clear(t->input_mounts, (void *)vine_mount_delete);
 	list_delete(t->input_mounts);
@@ -825,6 +846,8 @@ int64_t vine_task_get_metric(struct vine_task *t, const char *name)
 		return t->resources_##x;
 const struct rmsummary *vine_task_get_resources(struct vine_task *t, const char *name)
 {
+	vine_task_ensure_resources(t);
+
 	RESOURCES(measured);
 	RESOURCES(requested);
 	RESOURCES(allocated);
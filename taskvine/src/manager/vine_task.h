@@ -26,6 +26,7 @@ typedef enum {
       VINE_TASK_TYPE_RECOVERY,    /**< An internally-created recovery task that should not be returned to the user. */
       VINE_TASK_TYPE_LIBRARY_TEMPLATE,     /**< An internally-created library task that should not be returned to the user. */
       VINE_TASK_TYPE_LIBRARY_INSTANCE,     /**< An internally-created library task that should not be returned to the user. */
+      VINE_TASK_TYPE_SPECULATIVE, /**< An internally-created duplicate of a slow task that should not be returned to the user. */
 } vine_task_type_t;
 
 typedef enum {
@@ -44,7 +45,7 @@ struct vine_task {
 	vine_task_type_t type;       /**< The type of the task. */
 	char *command_line;          /**< The program(s) to execute, as a shell command line. */
 	char *tag;                   /**< An optional user-defined logical name for the task. */
-	char *category;              /**< User-provided label for the task. It is expected that all task with the same category will have similar resource usage. See @ref vine_task_set_category. If no explicit category is given, the label "default" is used. **/
+	const char *category;        /**< User-provided label for the task. It is expected that all task with the same category will have similar resource usage. See @ref vine_task_set_category. If no explicit category is given, the label "default" is used. **/
 
 	char *monitor_output_directory;	     /**< Custom output directory for the monitoring output files. If NULL, save to directory from @ref vine_enable_monitoring */
 	struct vine_file *monitor_snapshot_file;  /**< Filename the monitor checks to produce snapshots. */
@@ -80,14 +81,21 @@ struct vine_task {
 	int workers_slow;           /**< Number of times this task has been terminated for running too long. */
 	int function_slots_total;   /**< If a library, the total number of function slots usable. */
 	int function_slots_inuse;   /**< If a library, the number of functions currently running. */
+	char *ready_blocked_key;    /**< If READY but parked by the manager until some event, the key naming that event. */
+	struct vine_task *speculative_copy;     /**< If a duplicate of this task is running to hedge against a slow worker, the duplicate. */
+	struct vine_task *speculative_original; /**< If this is a speculative duplicate, the task it duplicates, or null once that task is done. */
+	int monitor_mode;           /**< At the worker, the @ref vine_monitoring_mode_t flags if the task is measured by the worker itself, otherwise 0. */
 		
 	/***** Results of task once it has reached completion. *****/
 
 	vine_result_t result;          /**< The result of the task (see @ref vine_result_t */
 	int exit_code;               /**< The exit code of the command line. */
 	int output_received;          /**< If the stdout of the task has been received. */
+	int output_mounts_retrieved;   /**< Number of output mounts already handled, when retrieval resumes after a background transfer. */
+	int output_mounts_result;      /**< Combined result of the output mounts already handled. */
 	int64_t output_length;       /**< length of the standard output of a task */
 	char *output;                /**< The standard output of the task. */
+	int output_spilled;          /**< If true, the output and measured resources are kept on disk by the manager until the task is returned. */
 	char *addrport;              /**< The address and port of the host on which it ran. */
 	char *hostname;              /**< The name of the host on which it ran. */
 
@@ -144,6 +152,9 @@ void vine_task_reset( struct vine_task *t );
 /* Soft-reset a not-yet-completed task so that it can be attempted on a different worker. */
 void vine_task_clean( struct vine_task *t );
 
+/* Create the measured and allocated resources of a task, if not yet present. */
+void vine_task_ensure_resources( struct vine_task *t );
+
 int  vine_task_set_result(struct vine_task *t, vine_result_t new_result);
 void vine_task_set_resources(struct vine_task *t, const struct rmsummary *rm);
 
@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_topology.h"
+#include "vine_current_transfers.h"
+
+#include "debug.h"
+#include "hash_table.h"
+#include "stringtools.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Weight of a new throughput measurement against the previous average. */
+#define VINE_TOPOLOGY_THROUGHPUT_ALPHA 0.5
+
+void vine_topology_set_feature(struct vine_worker_info *w, const char *feature)
+{
+	if (string_prefix_is(feature, "rack=")) {
+		free(w->rack);
+		w->rack = strdup(feature + 5);
+	} else if (string_prefix_is(feature, "site=")) {
+		free(w->site);
+		w->site = strdup(feature + 5);
+	}
+}
+
+int vine_topology_is_cross_site(struct vine_worker_info *a, struct vine_worker_info *b)
+{
+	return a->site && b->site && strcmp(a->site, b->site);
+}
+
+vine_topology_distance_t vine_topology_distance(struct vine_worker_info *a, struct vine_worker_info *b)
+{
+	if (!strcmp(a->hostname, b->hostname)) {
+		return VINE_TOPOLOGY_SAME_HOST;
+	} else if (vine_topology_is_cross_site(a, b)) {
+		return VINE_TOPOLOGY_REMOTE_SITE;
+	} else if (a->rack && b->rack && !strcmp(a->rack, b->rack)) {
+		return VINE_TOPOLOGY_SAME_RACK;
+	} else {
+		return VINE_TOPOLOGY_SAME_SITE;
+	}
+}
+
+void vine_topology_record_transfer(struct vine_worker_info *to, struct vine_worker_info *source, int64_t bytes, timestamp_t elapsed)
+{
+	if (!to || !source || bytes <= 0 || elapsed <= 0)
+		return;
+
+	double rate = bytes * 1000000.0 / elapsed;
+
+	double *average = hash_table_lookup(to->peer_throughput, source->addrport);
+	if (average) {
+		*average = VINE_TOPOLOGY_THROUGHPUT_ALPHA * rate + (1 - VINE_TOPOLOGY_THROUGHPUT_ALPHA) * (*average);
+	} else {
+		average = malloc(sizeof(*average));
+		*average = rate;
+		hash_table_insert(to->peer_throughput, source->addrport, average);
+	}
+
+	debug(D_VINE, "throughput from %s to %s is now %.02lf MB/s", source->addrport, to->addrport, *average / 1e6);
+}
+
+void vine_topology_remove_worker(struct vine_manager *q, struct vine_worker_info *w)
+{
+	struct hash_table_iter iter;
+	char *key;
+	struct vine_worker_info *to;
+
+	HASH_TABLE_ITERATE_WITH(q->worker_table, iter, key, to)
+	{
+		if (to != w) {
+			free(hash_table_remove(to->peer_throughput, w->addrport));
+		}
+	}
+}
+
+double vine_topology_throughput(struct vine_worker_info *to, struct vine_worker_info *source)
+{
+	double *average = hash_table_lookup(to->peer_throughput, source->addrport);
+	return average ? *average : 0;
+}
+
+int vine_topology_prefer(struct vine_worker_info *to, struct vine_worker_info *a, struct vine_worker_info *b)
+{
+	if (!b)
+		return 1;
+	if (!to)
+		return 0;
+
+	vine_topology_distance_t da = vine_topology_distance(to, a);
+	vine_topology_distance_t db = vine_topology_distance(to, b);
+
+	if (da != db)
+		return da < db;
+
+	return vine_topology_throughput(to, a) > vine_topology_throughput(to, b);
+}
+
+int vine_topology_cross_site_full(struct vine_manager *q, struct vine_worker_info *to, struct vine_worker_info *source)
+{
+	if (q->cross_site_max_transfers < 1 || !to || !vine_topology_is_cross_site(to, source))
+		return 0;
+
+	return vine_current_transfers_cross_site_in_use(q) >= q->cross_site_max_transfers;
+}
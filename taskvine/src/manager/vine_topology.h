@@ -0,0 +1,59 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_TOPOLOGY_H
+#define VINE_TOPOLOGY_H
+
+/*
+This module keeps an optional model of the network between workers,
+used to prefer nearby peers when choosing the source of a transfer.
+A worker declares its place in the network with the features
+rack=<name> and site=<name>, for example:
+
+vine_worker --feature rack=r12 --feature site=campus ...
+
+In addition, the throughput of every completed peer transfer is
+recorded at the destination worker, so that among equally close
+sources the faster one is chosen.
+*/
+
+#include "vine_manager.h"
+#include "vine_worker_info.h"
+
+#include "timestamp.h"
+
+typedef enum {
+	VINE_TOPOLOGY_SAME_HOST = 0,
+	VINE_TOPOLOGY_SAME_RACK,
+	VINE_TOPOLOGY_SAME_SITE,
+	VINE_TOPOLOGY_REMOTE_SITE,
+} vine_topology_distance_t;
+
+/* Record a rack= or site= label given as a feature of the worker. */
+void vine_topology_set_feature(struct vine_worker_info *w, const char *feature);
+
+/* Distance between two workers. Workers without labels are treated as being in the same site. */
+vine_topology_distance_t vine_topology_distance(struct vine_worker_info *a, struct vine_worker_info *b);
+
+/* True if both workers declare a site, and the sites differ. */
+int vine_topology_is_cross_site(struct vine_worker_info *a, struct vine_worker_info *b);
+
+/* Record the throughput of a completed transfer from source to the worker to. */
+void vine_topology_record_transfer(struct vine_worker_info *to, struct vine_worker_info *source, int64_t bytes, timestamp_t elapsed);
+
+/* Forget the throughput measured from a worker that is leaving, at every other worker. */
+void vine_topology_remove_worker(struct vine_manager *q, struct vine_worker_info *w);
+
+/* Measured throughput in bytes/s from source to the worker to, or zero if never measured. */
+double vine_topology_throughput(struct vine_worker_info *to, struct vine_worker_info *source);
+
+/* True if a is a better source than b for a transfer to the worker to. */
+int vine_topology_prefer(struct vine_worker_info *to, struct vine_worker_info *a, struct vine_worker_info *b);
+
+/* True if a transfer from source to the worker to would exceed the limit of concurrent cross-site transfers. */
+int vine_topology_cross_site_full(struct vine_manager *q, struct vine_worker_info *to, struct vine_worker_info *source);
+
+#endif
@@ -11,6 +11,7 @@ See the file COPYING for details.
 
 #include "buffer.h"
 #include "jx.h"
+#include "jx_arena.h"
 #include "jx_print.h"
 #include "macros.h"
 #include "rmonitor_types.h"
@@ -37,8 +38,9 @@ void vine_txn_log_write_header(struct vine_manager *q)
 	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id CONNECTION host:port\n");
 	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id DISCONNECTION (UNKNOWN|IDLE_OUT|FAST_ABORT|FAILURE|STATUS_WORKER|EXPLICIT|XFER_ERRORS)\n");
 	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id RESOURCES {resources}\n");
-	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id CACHE_UPDATE filename size_in_mb wall_time_us start_time_us\n");
-	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id TRANSFER (INPUT|OUTPUT) filename size_in_mb wall_time_us start_time_us\n");
+	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id CACHE_UPDATE filename size_in_mb wall_time_us start_time_us (PEER|URL|LOCAL)\n");
+	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id CACHE_INVALID filename (EVICTED|FAILED)\n");
+	fprintf(q->txn_logfile, "# time manager_pid WORKER worker_id TRANSFER (INPUT|OUTPUT) filename size_in_mb wall_time_us start_time_us cachename\n");
 	fprintf(q->txn_logfile, "# time manager_pid CATEGORY name MAX {resources_max_per_task}\n");
 	fprintf(q->txn_logfile, "# time manager_pid CATEGORY name MIN {resources_min_per_task_per_worker}\n");
 	fprintf(q->txn_logfile, "# time manager_pid CATEGORY name FIRST (FIXED|MAX|MIN_WASTE|MAX_THROUGHPUT) {resources_requested}\n");
@@ -85,6 +87,20 @@ static struct jx *resources_with_io_report(const struct vine_task *t, const stru
 	return m;
 }
 
+/* The report is only built to be printed, so allocate it in a small arena. */
+
+static void txn_log_print_resources(struct buffer *B, const struct vine_task *t, const struct rmsummary *s)
+{
+	struct jx_arena *arena = jx_arena_create(4096);
+	struct jx_arena *previous_arena = jx_arena_use(arena);
+
+	struct jx *m = resources_with_io_report(t, s);
+	jx_print_buffer(m, B);
+
+	jx_arena_use(previous_arena);
+	jx_arena_delete(arena);
+}
+
 void vine_txn_log_write_task(struct vine_manager *q, struct vine_task *t)
 {
 	if (!q->txn_logfile)
@@ -119,9 +135,7 @@ void vine_txn_log_write_task(struct vine_manager *q, struct vine_task *t)
 			buffer_printf(&B, " {} ");
 		}
 
-		struct jx *m = resources_with_io_report(t, t->resources_measured);
-		jx_print_buffer(m, &B);
-		jx_delete(m);
+		txn_log_print_resources(&B, t, t->resources_measured);
 	} else {
 		struct vine_worker_info *w = t->worker;
 		if (w) {
@@ -130,9 +144,7 @@ void vine_txn_log_write_task(struct vine_manager *q, struct vine_task *t)
 			if (state == VINE_TASK_RUNNING) {
 				const char *allocation = (t->resource_request == CATEGORY_ALLOCATION_FIRST ? "FIRST_RESOURCES" : "MAX_RESOURCES");
 				buffer_printf(&B, " %s ", allocation);
-				struct jx *m = resources_with_io_report(t, t->current_resource_box);
-				jx_print_buffer(m, &B);
-				jx_delete(m);
+				txn_log_print_resources(&B, t, t->current_resource_box);
 			} else if (state == VINE_TASK_WAITING_RETRIEVAL) {
 				/* do not add any info */
 			}
@@ -276,13 +288,14 @@ void vine_txn_log_write_transfer(struct vine_manager *q, struct vine_worker_info
 	buffer_printf(&B, " %lld", (long long)size_in_bytes);
 	buffer_printf(&B, " %llu", (unsigned long long)time_in_usecs);
 	buffer_printf(&B, " %llu", (unsigned long long)start_in_usecs);
+	buffer_printf(&B, " %s", f->cached_name);
 
 	vine_txn_log_write(q, buffer_tostring(&B));
 	buffer_free(&B);
 }
 
 void vine_txn_log_write_cache_update(
-		struct vine_manager *q, struct vine_worker_info *w, size_t size_in_bytes, timestamp_t time_in_usecs, timestamp_t start_in_usecs, const char *name)
+		struct vine_manager *q, struct vine_worker_info *w, size_t size_in_bytes, timestamp_t time_in_usecs, timestamp_t start_in_usecs, const char *name, const char *source)
 {
 	struct buffer B;
 
@@ -292,6 +305,18 @@ void vine_txn_log_write_cache_update(
 	buffer_printf(&B, " %lld", (long long)size_in_bytes);
 	buffer_printf(&B, " %llu", (unsigned long long)time_in_usecs);
 	buffer_printf(&B, " %llu", (unsigned long long)start_in_usecs);
+	buffer_printf(&B, " %s", source);
+
+	vine_txn_log_write(q, buffer_tostring(&B));
+	buffer_free(&B);
+}
+
+void vine_txn_log_write_cache_invalid(struct vine_manager *q, struct vine_worker_info *w, const char *name, const char *reason)
+{
+	struct buffer B;
+
+	buffer_init(&B);
+	buffer_printf(&B, "WORKER %s CACHE_INVALID %s %s", w->workerid, name, reason);
 
 	vine_txn_log_write(q, buffer_tostring(&B));
 	buffer_free(&B);
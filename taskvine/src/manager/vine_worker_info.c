@@ -31,9 +31,11 @@ struct vine_worker_info *vine_worker_create(struct link *lnk)
 
 	w->resources = vine_resources_create();
 	w->features = hash_table_create(4, 0);
+	w->peer_throughput = hash_table_create(0, 0);
 
-	w->current_files = hash_table_create(0, 0);
+	w->current_files = hash_table_create_interned(0, 0);
 	w->current_tasks = itable_create(0);
+	w->staging_tasks = list_create();
 
 	w->start_time = timestamp_get();
 	w->end_time = -1;
@@ -66,9 +68,15 @@ void vine_worker_delete(struct vine_worker_info *w)
 	hash_table_clear(w->features, 0);
 	hash_table_delete(w->features);
 
+	free(w->rack);
+	free(w->site);
+	hash_table_clear(w->peer_throughput, (void *)free);
+	hash_table_delete(w->peer_throughput);
+
 	hash_table_clear(w->current_files, (void *)vine_file_replica_delete);
 	hash_table_delete(w->current_files);
 	itable_delete(w->current_tasks);
+	list_delete(w->staging_tasks);
 
 	free(w);
 
@@ -95,6 +103,11 @@ static void current_tasks_to_jx(struct jx *j, struct vine_worker_info *w)
 	}
 }
 
+int vine_worker_is_streaming(struct vine_worker_info *w)
+{
+	return w->output_stream || w->input_stream;
+}
+
 struct jx *vine_worker_to_jx(struct vine_worker_info *w)
 {
 	struct jx *j = jx_object(0);
@@ -123,6 +136,11 @@ struct jx *vine_worker_to_jx(struct vine_worker_info *w)
 	jx_insert_integer(j, "total_bytes_transferred", w->total_bytes_transferred);
 	jx_insert_integer(j, "total_transfer_time", w->total_transfer_time);
 
+	if (w->measured_usage_time > 0) {
+		jx_insert_double(j, "measured_cores", w->measured_cores);
+		jx_insert_integer(j, "measured_memory", w->measured_memory);
+	}
+
 	jx_insert_integer(j, "start_time", w->start_time);
 	jx_insert_integer(j, "current_time", timestamp_get());
 
@@ -14,6 +14,7 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "link.h"
 #include "itable.h"
+#include "list.h"
 
 typedef enum {
 	VINE_WORKER_TYPE_UNKNOWN = 1,    // connection has not yet identified itself
@@ -59,12 +60,23 @@ struct vine_worker_info {
 	struct vine_resources *resources;
 	struct hash_table     *features;
 
+	/* Place of this worker in the network, and measured throughput from peers. See vine_topology.h */
+	char *rack;
+	char *site;
+	struct hash_table *peer_throughput;
+
 	/* Current files and tasks that have been transfered to this worker */
 	struct hash_table   *current_files;
 	struct itable       *current_tasks;
 
 	/* The number of tasks running last reported by the worker */
 	int         dynamic_tasks_running;
+
+	/* Resources actually used by all the running tasks, as last reported by the worker.
+	 * Only reported when the manager sets worker-usage-interval. */
+	double      measured_cores;
+	int64_t     measured_memory;
+	timestamp_t measured_usage_time;       // 0 if the worker has not reported its usage.
 	
 	/* Accumulated stats about tasks about this worker. */
 	int         finished_tasks;
@@ -92,10 +104,25 @@ struct vine_worker_info {
 	int xfer_total_bad_source_counter;
 	int xfer_total_good_destination_counter;
 	int xfer_total_bad_destination_counter;
+
+	/* Position of this worker in the manager's resource index. See vine_resource_index.h */
+	int resource_index_indexed;
+	int resource_index_cores;
+	int resource_index_memory;
+
+	/* Output file currently being received in the background, if any. See vine_manager_get.c */
+	struct vine_output_stream *output_stream;
+
+	/* Input file currently being sent in the background, if any, and the tasks waiting on it. See vine_manager_put.c */
+	struct vine_input_stream *input_stream;
+	struct list *staging_tasks;
 };
 
 struct vine_worker_info * vine_worker_create( struct link * lnk );
 void vine_worker_delete( struct vine_worker_info *w );
 
+/* True if a file is being sent to or received from the worker in the background, so it cannot answer requests. */
+int vine_worker_is_streaming( struct vine_worker_info *w );
+
 struct jx * vine_worker_to_jx( struct vine_worker_info *w );
 #endif
@@ -83,6 +83,8 @@ void mainloop( struct vine_manager *q )
 {
 	char line[1024];
 	char category[1024];
+	char tune_name[1024];
+	double tune_value;
 
 	int sleep_time, run_time, input_size, output_size, count;
 
@@ -107,6 +109,16 @@ void mainloop( struct vine_manager *q )
 		} else if(sscanf(line, "submit %d %d %d %d %s",&input_size, &run_time, &output_size, &count, category) >= 4) {
 			printf("submitting %d tasks...\n",count);
 			submit_tasks(q,input_size,run_time,output_size,count,category);
+		} else if(sscanf(line, "tune %s %lf", tune_name, &tune_value) == 2) {
+			printf("setting %s to %g...\n", tune_name, tune_value);
+			vine_tune(q, tune_name, tune_value);
+		} else if(!strcmp(line,"stats")) {
+			struct vine_stats stats;
+			vine_get_stats(q, &stats);
+			printf("tasks_submitted %d\n", stats.tasks_submitted);
+			printf("tasks_done %d\n", stats.tasks_done);
+			printf("tasks_speculative %d\n", stats.tasks_speculative);
+			printf("tasks_speculative_won %d\n", stats.tasks_speculative_won);
 		} else if(!strcmp(line,"quit") || !strcmp(line,"exit")) {
 			break;
 		} else if(!strcmp(line,"help")) {
@@ -115,6 +127,8 @@ void mainloop( struct vine_manager *q )
 			printf("wait                    Wait for all submitted tasks to finish.\n");
 			printf("submit <I> <T> <O> <N>  Submit N tasks that read I MB input,\n");
 			printf("                        run for T seconds, and produce O MB of output.\n");
+			printf("tune <name> <value>     Set a tuning parameter of the manager.\n");
+			printf("stats                   Show the counts of tasks.\n");
 			printf("quit, exit              Wait for all tasks to complete, then exit.\n");
 			printf("\n");
 		} else {
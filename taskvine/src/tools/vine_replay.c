@@ -0,0 +1,867 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+vine_replay replays the workload recorded by vine_enable_replay_log
+against simulated workers, using the scheduling policies of the manager
+itself, so that policies can be compared on a production workload
+in a fraction of the time it took to run.
+
+Simulated workers arrive and leave at the times recorded in the trace,
+with the resources they reported.  Tasks are submitted at their recorded
+times, with the resources and inputs they were submitted with, and each
+pass of the simulated manager asks vine_schedule_task_to_worker for a
+worker for each ready task, just as the manager does.  A dispatched task
+first fetches the inputs missing at its worker, at a fixed bandwidth, and
+then runs for the execution time recorded in the trace.  Its outputs are
+then cached at the worker with their recorded sizes, so tasks reading them
+are only ready after the task completes, and the locality of the following
+tasks depends on where the policy ran it.  The tasks of a worker that
+leaves are dispatched again elsewhere.
+
+Time is simulated, so the replay runs as fast as the scheduler can go.
+Some effects are not simulated: transfers do not contend for bandwidth,
+dispatching a task takes no time, temporary files lost with a worker are
+fetched again as any other input rather than recreated by a recovery task,
+and tasks run once, for the duration of their last attempt in the trace.
+*/
+
+#include "taskvine.h"
+#include "vine_file.h"
+#include "vine_file_replica.h"
+#include "vine_file_replica_table.h"
+#include "vine_manager.h"
+#include "vine_mount.h"
+#include "vine_resource_index.h"
+#include "vine_resources.h"
+#include "vine_schedule.h"
+#include "vine_task.h"
+#include "vine_worker_info.h"
+
+#include "cctools.h"
+#include "debug.h"
+#include "get_line.h"
+#include "hash_table.h"
+#include "itable.h"
+#include "jx.h"
+#include "jx_parse.h"
+#include "list.h"
+#include "macros.h"
+#include "path.h"
+#include "priority_queue.h"
+#include "rmsummary.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "unlink_recursive.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Bandwidth to use when the trace recorded no transfers, in bytes per second. */
+#define REPLAY_DEFAULT_BANDWIDTH (100 * MEGABYTE)
+
+typedef enum {
+	REPLAY_WORKER,
+	REPLAY_WORKER_REMOVED,
+	REPLAY_SUBMIT,
+	REPLAY_COMPLETE,
+} replay_event_type_t;
+
+struct replay_event {
+	replay_event_type_t type;
+	timestamp_t time;
+	struct jx *j;
+	struct replay_task *task;
+	int attempt;
+};
+
+struct replay_task {
+	int64_t id;
+	struct jx *submit;
+	struct jx *done;
+	struct vine_task *t;
+	struct vine_worker_info *w;
+	timestamp_t submit_time;
+	timestamp_t dispatch_time;
+	timestamp_t transfer_time;
+	int attempt;
+};
+
+struct replay_stats {
+	int64_t tasks_done;
+	int64_t tasks_dispatched;
+	timestamp_t makespan;
+	timestamp_t wait_total;
+	timestamp_t wait_max;
+	int64_t cache_hits;
+	int64_t cache_misses;
+	int64_t bytes_transferred;
+	int64_t workers_connected;
+	int64_t workers_max;
+	timestamp_t time_scheduling;
+};
+
+struct replay_trace {
+	struct list *events;
+	struct itable *tasks;
+	struct hash_table *outputs;
+	timestamp_t first_submit;
+	timestamp_t last_done;
+	int64_t tasks_submitted;
+	int64_t tasks_done;
+	double bandwidth;
+};
+
+static const char *replay_debug_file = 0;
+
+static struct {
+	const char *name;
+	vine_schedule_t algorithm;
+} replay_schedulers[] = {
+		{"files", VINE_SCHEDULE_FILES},
+		{"time", VINE_SCHEDULE_TIME},
+		{"worst", VINE_SCHEDULE_WORST},
+		{"fcfs", VINE_SCHEDULE_FCFS},
+		{"random", VINE_SCHEDULE_RAND},
+		{0, 0},
+};
+
+/* Numbers are written as doubles, but may be read back as integers. */
+
+static double lookup_number(struct jx *j, const char *key)
+{
+	struct jx *v = jx_lookup(j, key);
+	if (jx_istype(v, JX_INTEGER)) {
+		return v->u.integer_value;
+	} else if (jx_istype(v, JX_DOUBLE)) {
+		return v->u.double_value;
+	}
+	return -1;
+}
+
+static struct replay_event *event_create(replay_event_type_t type, timestamp_t time, struct jx *j, struct replay_task *rt)
+{
+	struct replay_event *e = xxcalloc(1, sizeof(*e));
+	e->type = type;
+	e->time = time;
+	e->j = j;
+	e->task = rt;
+	return e;
+}
+
+/*
+Read the whole trace, keeping the events that drive the replay in order,
+and the last completion of each task, which gives its execution time and
+the sizes of its outputs.  Tasks never completed in the trace are not replayed.
+*/
+
+static struct replay_trace *trace_load(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		fatal("couldn't open %s: %s", filename, strerror(errno));
+	}
+
+	struct replay_trace *trace = xxcalloc(1, sizeof(*trace));
+	trace->events = list_create();
+	trace->tasks = itable_create(0);
+	trace->outputs = hash_table_create(0, 0);
+
+	int64_t transfer_bytes = 0;
+	timestamp_t transfer_time = 0;
+	timestamp_t start = 0;
+	int lineno = 0;
+	char *line;
+
+	while ((line = get_line(file))) {
+		lineno++;
+		struct jx *j = jx_parse_string(line);
+		free(line);
+
+		const char *event = j ? jx_lookup_string(j, "event") : 0;
+		if (!event) {
+			fatal("%s:%d: not an event of a replay log", filename, lineno);
+		}
+
+		timestamp_t time = jx_lookup_integer(j, "time");
+		if (!start) {
+			start = time;
+		}
+		time -= start;
+
+		if (!strcmp(event, "worker")) {
+			list_push_tail(trace->events, event_create(REPLAY_WORKER, time, j, 0));
+		} else if (!strcmp(event, "worker_removed")) {
+			list_push_tail(trace->events, event_create(REPLAY_WORKER_REMOVED, time, j, 0));
+		} else if (!strcmp(event, "submit")) {
+			struct replay_task *rt = xxcalloc(1, sizeof(*rt));
+			rt->id = jx_lookup_integer(j, "task");
+			rt->submit = j;
+			itable_insert(trace->tasks, rt->id, rt);
+			list_push_tail(trace->events, event_create(REPLAY_SUBMIT, time, 0, rt));
+			trace->tasks_submitted++;
+			if (trace->tasks_submitted == 1) {
+				trace->first_submit = time;
+			}
+		} else if (!strcmp(event, "done")) {
+			struct replay_task *rt = itable_lookup(trace->tasks, jx_lookup_integer(j, "task"));
+			if (!rt) {
+				jx_delete(j);
+				continue;
+			}
+			if (!rt->done) {
+				trace->tasks_done++;
+			}
+			jx_delete(rt->done);
+			rt->done = j;
+			trace->last_done = time;
+
+			struct jx *o;
+			for (void *it = 0; (o = jx_iterate_array(jx_lookup(j, "outputs"), &it));) {
+				hash_table_insert(trace->outputs, jx_lookup_string(o, "name"), rt);
+			}
+		} else if (!strcmp(event, "transfer")) {
+			transfer_bytes += jx_lookup_integer(j, "size");
+			transfer_time += jx_lookup_integer(j, "duration");
+			jx_delete(j);
+		} else {
+			jx_delete(j);
+		}
+	}
+
+	fclose(file);
+
+	if (transfer_bytes > 0 && transfer_time > 0) {
+		trace->bandwidth = transfer_bytes / (transfer_time / (double)USECOND);
+	} else {
+		trace->bandwidth = REPLAY_DEFAULT_BANDWIDTH;
+	}
+
+	return trace;
+}
+
+/* The state of one replay of the trace with one scheduling policy. */
+
+struct replay {
+	struct vine_manager *q;
+	struct replay_trace *trace;
+	struct priority_queue *events;
+	struct priority_queue *ready;
+	struct hash_table *blocked;
+	struct hash_table *files;
+	struct hash_table *arrivals;
+	struct replay_stats stats;
+	double bandwidth;
+	timestamp_t now;
+	int64_t sequence;
+};
+
+static void replay_push(struct replay *r, struct replay_event *e)
+{
+	/* Events at the same time are handled in the order they were pushed. */
+	priority_queue_push(r->events, e, -((double)e->time + r->sequence++ * 1e-6));
+}
+
+/* Ready tasks are taken by priority, and then in order of submission. */
+
+static void replay_ready(struct replay *r, struct replay_task *rt)
+{
+	priority_queue_push(r->ready, rt, rt->t->priority - rt->id * 1e-12);
+}
+
+static struct vine_file *replay_file(struct replay *r, struct jx *f)
+{
+	const char *name = jx_lookup_string(f, "name");
+	struct vine_file *file = hash_table_lookup(r->files, name);
+	if (!file) {
+		const char *type = jx_lookup_string(f, "type");
+		vine_file_type_t t = type && !strcmp(type, "temp") ? VINE_TEMP : VINE_FILE;
+		file = vine_file_create(name, name, 0, jx_lookup_integer(f, "size"), t, 0, jx_lookup_integer(f, "cache"), 0, 0);
+		hash_table_insert(r->files, name, file);
+	}
+	return file;
+}
+
+/* Mirrors count_worker_resources in the manager, for a worker with no libraries. */
+
+static void replay_count_worker_resources(struct replay *r, struct vine_worker_info *w)
+{
+	struct vine_manager *q = r->q;
+
+	w->resources->cores.inuse = 0;
+	w->resources->memory.inuse = 0;
+	w->resources->disk.inuse = 0;
+	w->resources->gpus.inuse = 0;
+
+	uint64_t task_id;
+	struct vine_task *t;
+	ITABLE_ITERATE(w->current_tasks, task_id, t)
+	{
+		struct rmsummary *box = t->current_resource_box;
+		w->resources->cores.inuse += box->cores;
+		w->resources->memory.inuse += box->memory;
+		w->resources->disk.inuse += box->disk;
+		w->resources->gpus.inuse += box->gpus;
+	}
+
+	w->resources->disk.inuse += ceil(BYTES_TO_MEGABYTES(w->inuse_cache));
+
+	double free_cores = overcommitted_resource_total(q, w->resources->cores.total) - w->resources->cores.inuse;
+	double free_memory = overcommitted_resource_total(q, w->resources->memory.total) - w->resources->memory.inuse;
+	vine_resource_index_update(q->worker_resource_index, w, free_cores, free_memory);
+}
+
+static void replay_worker(struct replay *r, struct jx *j)
+{
+	struct vine_manager *q = r->q;
+	const char *name = jx_lookup_string(j, "worker");
+
+	struct vine_worker_info *w = hash_table_lookup(q->worker_table, name);
+	if (!w) {
+		w = vine_worker_create(0);
+		w->type = VINE_WORKER_TYPE_WORKER;
+		w->hashkey = xxstrdup(name);
+		w->addrport = xxstrdup(name);
+		free(w->hostname);
+		w->hostname = xxstrdup(jx_lookup_string(j, "host") ? jx_lookup_string(j, "host") : name);
+		w->end_time = 0;
+		hash_table_insert(q->worker_table, name, w);
+		r->stats.workers_connected++;
+		r->stats.workers_max = MAX(r->stats.workers_max, hash_table_size(q->worker_table));
+	}
+
+	w->resources->tag = 0;
+	w->resources->workers.total = 1;
+	w->resources->cores.total = jx_lookup_integer(j, "cores");
+	w->resources->memory.total = jx_lookup_integer(j, "memory");
+	w->resources->disk.total = jx_lookup_integer(j, "disk");
+	w->resources->gpus.total = jx_lookup_integer(j, "gpus");
+
+	q->current_max_worker->cores = MAX(q->current_max_worker->cores, w->resources->cores.total);
+	q->current_max_worker->memory = MAX(q->current_max_worker->memory, w->resources->memory.total);
+	q->current_max_worker->disk = MAX(q->current_max_worker->disk, w->resources->disk.total);
+	q->current_max_worker->gpus = MAX(q->current_max_worker->gpus, w->resources->gpus.total);
+
+	replay_count_worker_resources(r, w);
+}
+
+static void replay_worker_remove(struct replay *r, struct vine_worker_info *w)
+{
+	struct vine_manager *q = r->q;
+
+	uint64_t task_id;
+	struct vine_task *t;
+	ITABLE_ITERATE(w->current_tasks, task_id, t)
+	{
+		struct replay_task *rt = itable_lookup(r->trace->tasks, task_id);
+		rmsummary_delete(t->current_resource_box);
+		t->current_resource_box = 0;
+		rt->w = 0;
+		rt->attempt++;
+		replay_ready(r, rt);
+	}
+	itable_clear(w->current_tasks, 0);
+
+	struct hash_table_iter iter;
+	char *cachename;
+	struct vine_file_replica *replica;
+	HASH_TABLE_ITERATE_WITH(w->current_files, iter, cachename, replica)
+	{
+		vine_file_replica_table_remove(q, w, cachename);
+		vine_file_replica_delete(replica);
+	}
+
+	hash_table_remove(q->worker_table, w->hashkey);
+	vine_resource_index_remove(q->worker_resource_index, w);
+	vine_worker_delete(w);
+}
+
+static void replay_submit(struct replay *r, struct replay_task *rt)
+{
+	struct jx *j = rt->submit;
+	struct vine_task *t = vine_task_create(":");
+
+	t->task_id = rt->id;
+	vine_task_set_category(t, jx_lookup_string(j, "category"));
+	vine_task_set_priority(t, lookup_number(j, "priority"));
+
+	if (lookup_number(j, "cores") > -1)
+		vine_task_set_cores(t, lookup_number(j, "cores"));
+	if (lookup_number(j, "memory") > -1)
+		vine_task_set_memory(t, lookup_number(j, "memory"));
+	if (lookup_number(j, "disk") > -1)
+		vine_task_set_disk(t, lookup_number(j, "disk"));
+	if (lookup_number(j, "gpus") > -1)
+		vine_task_set_gpus(t, lookup_number(j, "gpus"));
+
+	struct jx *f;
+	for (void *it = 0; (f = jx_iterate_array(jx_lookup(j, "inputs"), &it));) {
+		struct vine_file *file = replay_file(r, f);
+		vine_task_add_input(t, file, file->cached_name, 0);
+	}
+
+	rt->t = t;
+	rt->submit_time = r->now;
+	replay_ready(r, rt);
+}
+
+/*
+A task must wait for the temporary files it reads to be produced in the replay.
+As in the manager, such a task is parked on the first missing file, rather than
+considered again at every pass, and is ready again when the file is produced.
+*/
+
+static struct vine_file *replay_missing_input(struct replay *r, struct replay_task *rt)
+{
+	struct vine_mount *m;
+	LIST_ITERATE(rt->t->input_mounts, m)
+	{
+		if (m->file->type == VINE_TEMP && m->file->state != VINE_FILE_STATE_CREATED && hash_table_lookup(r->trace->outputs, m->file->cached_name)) {
+			return m->file;
+		}
+	}
+	return 0;
+}
+
+static void replay_park(struct replay *r, struct replay_task *rt, struct vine_file *f)
+{
+	struct list *l = hash_table_lookup(r->blocked, f->cached_name);
+	if (!l) {
+		l = list_create();
+		hash_table_insert(r->blocked, f->cached_name, l);
+	}
+	list_push_tail(l, rt);
+}
+
+static void replay_unpark(struct replay *r, const char *name)
+{
+	struct list *l = hash_table_remove(r->blocked, name);
+	if (!l) {
+		return;
+	}
+
+	struct replay_task *rt;
+	while ((rt = list_pop_head(l))) {
+		replay_ready(r, rt);
+	}
+	list_delete(l);
+}
+
+/*
+A replica is only usable once its transfer ends, so the time each replica
+arrives at a worker is kept, and a task reading a replica still in flight
+waits for it, as it would at the worker.
+*/
+
+static void replay_set_arrival(struct replay *r, struct vine_worker_info *w, const char *cachename, timestamp_t time)
+{
+	char *key = string_format("%s/%s", w->hashkey, cachename);
+	timestamp_t *arrival = hash_table_lookup(r->arrivals, key);
+	if (!arrival) {
+		arrival = xxmalloc(sizeof(*arrival));
+		hash_table_insert(r->arrivals, key, arrival);
+	}
+	*arrival = time;
+	free(key);
+}
+
+static timestamp_t replay_get_arrival(struct replay *r, struct vine_worker_info *w, const char *cachename)
+{
+	char *key = string_format("%s/%s", w->hashkey, cachename);
+	timestamp_t *arrival = hash_table_lookup(r->arrivals, key);
+	free(key);
+	return arrival ? *arrival : 0;
+}
+
+static void replay_dispatch(struct replay *r, struct replay_task *rt, struct vine_worker_info *w)
+{
+	struct vine_manager *q = r->q;
+	struct vine_task *t = rt->t;
+
+	t->current_resource_box = vine_manager_choose_resources_for_task(q, w, t);
+	itable_insert(w->current_tasks, t->task_id, t);
+
+	/* Inputs missing at the worker are fetched one after the other before the task runs. */
+	int64_t bytes = 0;
+	timestamp_t start = r->now;
+	struct vine_mount *m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		if (vine_file_replica_table_lookup(w, m->file->cached_name)) {
+			r->stats.cache_hits++;
+			start = MAX(start, replay_get_arrival(r, w, m->file->cached_name));
+			continue;
+		}
+
+		r->stats.cache_misses++;
+		bytes += m->file->size;
+
+		struct vine_file_replica *replica = vine_file_replica_create(m->file->type, m->file->cache_level, m->file->size, 0);
+		replica->state = VINE_FILE_REPLICA_STATE_READY;
+		vine_file_replica_table_insert(q, w, m->file->cached_name, replica);
+
+		timestamp_t arrival = r->now + bytes / r->bandwidth * USECOND;
+		replay_set_arrival(r, w, m->file->cached_name, arrival);
+		start = MAX(start, arrival);
+	}
+
+	r->stats.bytes_transferred += bytes;
+	r->stats.tasks_dispatched++;
+
+	timestamp_t wait = r->now - rt->submit_time;
+	r->stats.wait_max = MAX(r->stats.wait_max, wait);
+
+	rt->w = w;
+	rt->dispatch_time = r->now;
+	rt->transfer_time = start - r->now;
+
+	replay_count_worker_resources(r, w);
+
+	debug(D_VINE, "replay: task %" PRId64 " dispatched to %s at %.3f s, fetching %" PRId64 " bytes", rt->id, w->hashkey, r->now / (double)USECOND, bytes);
+
+	timestamp_t duration = jx_lookup_integer(rt->done, "duration");
+	struct replay_event *e = event_create(REPLAY_COMPLETE, start + duration, 0, rt);
+	e->attempt = rt->attempt;
+	replay_push(r, e);
+}
+
+static void replay_complete(struct replay *r, struct replay_task *rt)
+{
+	struct vine_manager *q = r->q;
+	struct vine_task *t = rt->t;
+	struct vine_worker_info *w = rt->w;
+
+	itable_remove(w->current_tasks, t->task_id);
+	rmsummary_delete(t->current_resource_box);
+	t->current_resource_box = 0;
+
+	timestamp_t duration = jx_lookup_integer(rt->done, "duration");
+	w->total_tasks_complete++;
+	w->total_task_time += duration;
+	w->total_transfer_time += rt->transfer_time;
+
+	/* Inputs cached only for the task are removed, as the manager does. */
+	struct vine_mount *m;
+	LIST_ITERATE(t->input_mounts, m)
+	{
+		if (m->file->cache_level <= VINE_CACHE_LEVEL_TASK) {
+			struct vine_file_replica *replica = vine_file_replica_table_remove(q, w, m->file->cached_name);
+			vine_file_replica_delete(replica);
+		}
+	}
+
+	struct jx *o;
+	for (void *it = 0; (o = jx_iterate_array(jx_lookup(rt->done, "outputs"), &it));) {
+		const char *name = jx_lookup_string(o, "name");
+		int64_t size = jx_lookup_integer(o, "size");
+
+		struct vine_file *file = hash_table_lookup(r->files, name);
+		if (file) {
+			file->size = size;
+			file->state = VINE_FILE_STATE_CREATED;
+			replay_unpark(r, name);
+		}
+
+		if (!vine_file_replica_table_lookup(w, name)) {
+			vine_file_type_t type = file ? file->type : VINE_TEMP;
+			vine_cache_level_t level = file ? file->cache_level : VINE_CACHE_LEVEL_WORKFLOW;
+			struct vine_file_replica *replica = vine_file_replica_create(type, level, size, 0);
+			replica->state = VINE_FILE_REPLICA_STATE_READY;
+			vine_file_replica_table_insert(q, w, name, replica);
+			replay_set_arrival(r, w, name, r->now);
+		}
+	}
+
+	r->stats.wait_total += rt->dispatch_time - rt->submit_time;
+	r->stats.tasks_done++;
+	r->stats.makespan = r->now;
+
+	replay_count_worker_resources(r, w);
+
+	rt->w = 0;
+	vine_task_delete(t);
+	rt->t = 0;
+}
+
+/*
+Dispatch the ready tasks in order of priority.  As in the manager, the
+pass gives up after attempt_schedule_depth tasks that found no worker.
+*/
+
+static void replay_schedule(struct replay *r)
+{
+	struct vine_manager *q = r->q;
+
+	if (hash_table_size(q->worker_table) < 1) {
+		return;
+	}
+
+	timestamp_t start = timestamp_get();
+
+	struct list *skipped = list_create();
+	int failures = 0;
+	struct replay_task *rt;
+
+	while (failures <= q->attempt_schedule_depth && (rt = priority_queue_pop(r->ready))) {
+		struct vine_file *missing = replay_missing_input(r, rt);
+		if (missing) {
+			replay_park(r, rt, missing);
+			continue;
+		}
+
+		struct vine_worker_info *w = vine_schedule_task_to_worker(q, rt->t);
+		if (w) {
+			replay_dispatch(r, rt, w);
+		} else {
+			failures++;
+			list_push_tail(skipped, rt);
+		}
+	}
+
+	while ((rt = list_pop_head(skipped))) {
+		replay_ready(r, rt);
+	}
+	list_delete(skipped);
+
+	r->stats.time_scheduling += timestamp_get() - start;
+}
+
+static void replay_run(struct replay_trace *trace, vine_schedule_t algorithm, double bandwidth, struct replay_stats *stats)
+{
+	struct replay r;
+	memset(&r, 0, sizeof(r));
+
+	int64_t flags = debug_flags_clear();
+
+	r.q = vine_create(0);
+	if (!r.q) {
+		fatal("could not create manager: %s", strerror(errno));
+	}
+
+	/* The manager sends all debugging to a log of its own, but only what was asked for is wanted here. */
+	debug_flags_restore(flags);
+	debug_config_file(replay_debug_file);
+	vine_set_scheduler(r.q, algorithm);
+
+	r.trace = trace;
+	r.events = priority_queue_create(0);
+	r.ready = priority_queue_create(0);
+	r.blocked = hash_table_create(0, 0);
+	r.files = hash_table_create(0, 0);
+	r.arrivals = hash_table_create(0, 0);
+	r.bandwidth = bandwidth > 0 ? bandwidth : trace->bandwidth;
+
+	struct replay_event *e;
+	LIST_ITERATE(trace->events, e)
+	{
+		if (e->type == REPLAY_SUBMIT) {
+			if (!e->task->done) {
+				continue;
+			}
+			e->task->attempt = 0;
+		}
+		replay_push(&r, event_create(e->type, e->time, e->j, e->task));
+	}
+
+	while ((e = priority_queue_pop(r.events))) {
+		r.now = e->time;
+
+		switch (e->type) {
+		case REPLAY_WORKER:
+			replay_worker(&r, e->j);
+			break;
+		case REPLAY_WORKER_REMOVED: {
+			struct vine_worker_info *w = hash_table_lookup(r.q->worker_table, jx_lookup_string(e->j, "worker"));
+			if (w) {
+				replay_worker_remove(&r, w);
+			}
+			break;
+		}
+		case REPLAY_SUBMIT:
+			replay_submit(&r, e->task);
+			break;
+		case REPLAY_COMPLETE:
+			/* A completion is stale if the worker left while the task ran. */
+			if (e->attempt == e->task->attempt) {
+				replay_complete(&r, e->task);
+			}
+			break;
+		}
+		free(e);
+
+		/* Schedule once all the events at this time have been handled. */
+		struct replay_event *next = priority_queue_peek_top(r.events);
+		if (!next || next->time > r.now) {
+			replay_schedule(&r);
+		}
+	}
+
+	/* Tasks left over could not be dispatched to any worker. */
+
+	struct hash_table_iter iter;
+	char *name;
+	struct vine_worker_info *w;
+	HASH_TABLE_ITERATE_WITH(r.q->worker_table, iter, name, w)
+	{
+		replay_worker_remove(&r, w);
+	}
+
+	struct list *l;
+	HASH_TABLE_ITERATE_WITH(r.blocked, iter, name, l)
+	{
+		replay_unpark(&r, name);
+	}
+
+	struct replay_task *rt;
+	while ((rt = priority_queue_pop(r.ready))) {
+		vine_task_delete(rt->t);
+		rt->t = 0;
+	}
+
+	struct vine_file *f;
+	HASH_TABLE_ITERATE_WITH(r.files, iter, name, f)
+	{
+		vine_file_delete(f);
+	}
+
+	*stats = r.stats;
+
+	hash_table_delete(r.files);
+	hash_table_clear(r.arrivals, free);
+	hash_table_delete(r.arrivals);
+	hash_table_delete(r.blocked);
+	priority_queue_delete(r.ready);
+	priority_queue_delete(r.events);
+	vine_delete(r.q);
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [options] <replay-log>\n", cmd);
+	printf("Where options are:\n");
+	printf(" %-30s Scheduling policies to compare, separated by commas. (default: files)\n", "-s,--scheduler=<list>");
+	printf(" %-30s One of: files, time, worst, fcfs, random.\n", "");
+	printf(" %-30s Bandwidth of transfers to workers, in bytes per second.\n", "-b,--bandwidth=<bytes>");
+	printf(" %-30s (default: as measured in the log, or 100MB)\n", "");
+	printf(" %-30s Enable debugging for this subsystem.\n", "-d,--debug=<subsystem>");
+	printf(" %-30s Send debugging output to this file.\n", "-o,--debug-file=<file>");
+	printf(" %-30s Show version information.\n", "-v,--version");
+	printf(" %-30s Show this help screen.\n", "-h,--help");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *schedulers = "files";
+	double bandwidth = 0;
+	int c;
+
+	static const struct option long_options[] = {
+			{"scheduler", required_argument, 0, 's'},
+			{"bandwidth", required_argument, 0, 'b'},
+			{"debug", required_argument, 0, 'd'},
+			{"debug-file", required_argument, 0, 'o'},
+			{"version", no_argument, 0, 'v'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}};
+
+	debug_config(argv[0]);
+
+	while ((c = getopt_long(argc, argv, "s:b:d:o:vh", long_options, 0)) != -1) {
+		switch (c) {
+		case 's':
+			schedulers = optarg;
+			break;
+		case 'b':
+			bandwidth = string_metric_parse(optarg);
+			break;
+		case 'd':
+			debug_flags_set(optarg);
+			break;
+		case 'o':
+			replay_debug_file = optarg;
+			debug_config_file(optarg);
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		case 'h':
+			show_help(path_basename(argv[0]));
+			return 0;
+		default:
+			show_help(path_basename(argv[0]));
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		show_help(path_basename(argv[0]));
+		return 1;
+	}
+
+	struct replay_trace *trace = trace_load(argv[optind]);
+
+	/* The manager of each replay writes its logs in a directory removed at the end. */
+	char rundir[] = "/tmp/vine_replay.XXXXXX";
+	if (!mkdtemp(rundir)) {
+		fatal("could not create temporary directory: %s", strerror(errno));
+	}
+	vine_set_runtime_info_path(rundir);
+
+	printf("trace:     %" PRId64 " tasks submitted, %" PRId64 " completed in %.2f s\n",
+			trace->tasks_submitted,
+			trace->tasks_done,
+			(trace->last_done - trace->first_submit) / (double)USECOND);
+	printf("bandwidth: %.1f MB/s\n", (bandwidth > 0 ? bandwidth : trace->bandwidth) / MEGABYTE);
+	printf("%-10s %10s %12s %10s %10s %12s %10s %10s %10s\n", "scheduler", "tasks", "makespan(s)", "wait(s)", "maxwait(s)", "transfer(MB)", "hits", "misses", "sched(s)");
+
+	char *list = xxstrdup(schedulers);
+	char *name = strtok(list, ",");
+	int status = 0;
+
+	while (name) {
+		int i;
+		for (i = 0; replay_schedulers[i].name; i++) {
+			if (!strcmp(replay_schedulers[i].name, name)) {
+				break;
+			}
+		}
+
+		if (!replay_schedulers[i].name) {
+			fprintf(stderr, "%s: unknown scheduler: %s\n", path_basename(argv[0]), name);
+			status = 1;
+			break;
+		}
+
+		struct replay_stats s;
+		replay_run(trace, replay_schedulers[i].algorithm, bandwidth, &s);
+
+		printf("%-10s %10" PRId64 " %12.2f %10.2f %10.2f %12.1f %10" PRId64 " %10" PRId64 " %10.2f\n",
+				name,
+				s.tasks_done,
+				(s.makespan - trace->first_submit) / (double)USECOND,
+				s.tasks_done > 0 ? s.wait_total / (double)s.tasks_done / USECOND : 0,
+				s.wait_max / (double)USECOND,
+				s.bytes_transferred / (double)MEGABYTE,
+				s.cache_hits,
+				s.cache_misses,
+				s.time_scheduling / (double)USECOND);
+
+		name = strtok(0, ",");
+	}
+
+	free(list);
+	unlink_recursive(rundir);
+
+	return status;
+}
+
+/* vim: set noexpandtab tabstop=8: */
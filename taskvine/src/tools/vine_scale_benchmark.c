@@ -0,0 +1,619 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+vine_scale_benchmark measures the scheduling throughput of the manager
+without a cluster.  A handful of processes each connect many simulated
+workers, which speak the real worker protocol but do not run anything:
+a task completes at once, or after the number of seconds given by a
+leading "sleep N" in its command.  Input files are read and discarded,
+and standard output is modeled by a fixed number of bytes per task.
+
+By default the benchmark runs a manager in the same process, submits
+tasks, and reports the dispatch rate, the completion rate, the latency
+of each call to vine_wait, and the memory used by the manager.  With
+--manager, it only connects simulated workers to an existing manager,
+so that any application can be measured.
+*/
+
+#include "taskvine.h"
+#include "vine_protocol.h"
+
+#include "cctools.h"
+#include "debug.h"
+#include "itable.h"
+#include "link.h"
+#include "list.h"
+#include "macros.h"
+#include "path.h"
+#include "priority_queue.h"
+#include "quantile_sketch.h"
+#include "stringtools.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SIM_TIMEOUT 60
+#define SIM_INLINE_OUTPUT_MAX 1024
+
+struct sim_worker {
+	struct link *link;
+	char name[64];
+};
+
+struct sim_task {
+	int64_t task_id;
+	struct sim_worker *worker;
+	timestamp_t start;
+	timestamp_t end;
+};
+
+static int sim_cores = 4;
+static int64_t sim_memory = 16000;
+static int64_t sim_disk = 100000;
+static int64_t sim_output_size = 0;
+
+static struct link_poll_set *sim_poll = 0;
+static struct itable *sim_workers = 0;
+static struct itable *sim_tasks = 0;
+static struct priority_queue *sim_running = 0;
+
+static void sim_send(struct sim_worker *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void sim_send(struct sim_worker *w, const char *fmt, ...)
+{
+	va_list va;
+	va_start(va, fmt);
+	link_vprintf(w->link, time(0) + SIM_TIMEOUT, fmt, va);
+	va_end(va);
+}
+
+static void sim_send_output(struct sim_worker *w, int64_t length)
+{
+	static char block[65536];
+	if (!block[0]) {
+		memset(block, 'x', sizeof(block));
+	}
+
+	while (length > 0) {
+		int64_t chunk = MIN(length, (int64_t)sizeof(block));
+		link_write(w->link, block, chunk, time(0) + SIM_TIMEOUT);
+		length -= chunk;
+	}
+}
+
+static void sim_send_resources(struct sim_worker *w)
+{
+	sim_send(w,
+			"resources\ncores %d\nmemory %" PRId64 "\ndisk %" PRId64 "\ngpus 0\nworkers 1\ntag 0\nend\n",
+			sim_cores,
+			sim_memory,
+			sim_disk);
+}
+
+static struct sim_worker *sim_worker_connect(const char *host, int port, int id)
+{
+	struct link *l = link_connect(host, port, time(0) + SIM_TIMEOUT);
+	if (!l) {
+		debug(D_NOTICE, "simulated worker %d could not connect to %s:%d: %s", id, host, port, strerror(errno));
+		return 0;
+	}
+
+	link_tune(l, LINK_TUNE_INTERACTIVE);
+
+	struct sim_worker *w = xxcalloc(1, sizeof(*w));
+	w->link = l;
+	snprintf(w->name, sizeof(w->name), "sim-%d-%d", (int)getpid(), id);
+
+	sim_send(w, "taskvine %d %s %s %s %s\n", VINE_PROTOCOL_VERSION, w->name, "Linux", "x86_64", CCTOOLS_VERSION);
+	sim_send(w, "info worker-id %s\n", w->name);
+	sim_send(w, "info worker-end-time 0\n");
+	sim_send_resources(w);
+
+	link_poll_set_add(sim_poll, l, LINK_READ);
+	itable_insert(sim_workers, (uintptr_t)l, w);
+	return w;
+}
+
+static void sim_task_delete(struct sim_task *t)
+{
+	itable_remove(sim_tasks, t->task_id);
+	priority_queue_remove(sim_running, t);
+	free(t);
+}
+
+static void sim_worker_remove(struct sim_worker *w)
+{
+	uint64_t task_id;
+	struct sim_task *t;
+
+	/* Collect the tasks of this worker before deleting them, as deletion changes the table. */
+	struct list *orphans = list_create();
+	ITABLE_ITERATE(sim_tasks, task_id, t)
+	{
+		if (t->worker == w) {
+			list_push_tail(orphans, t);
+		}
+	}
+	while ((t = list_pop_head(orphans))) {
+		sim_task_delete(t);
+	}
+	list_delete(orphans);
+
+	itable_remove(sim_workers, (uintptr_t)w->link);
+	link_close(w->link);
+	free(w);
+}
+
+/* A task runs for the time given by a leading "sleep N" in its command, and otherwise completes at once. */
+
+static timestamp_t sim_task_duration(const char *cmd)
+{
+	double seconds;
+	if (sscanf(cmd, "sleep %lf", &seconds) == 1 && seconds > 0) {
+		return seconds * USECOND;
+	}
+	return 0;
+}
+
+static int sim_recv_task(struct sim_worker *w, int64_t task_id)
+{
+	char line[VINE_LINE_MAX];
+	char *cmd = 0;
+	time_t stoptime = time(0) + SIM_TIMEOUT;
+
+	while (link_readline(w->link, line, sizeof(line), stoptime)) {
+		const char *s = line;
+		const char *word;
+		size_t length;
+		int64_t n;
+
+		if (!string_next_slice(&s, &word, &length)) {
+			continue;
+		} else if (string_slice_is(word, length, "end")) {
+			struct sim_task *t = xxcalloc(1, sizeof(*t));
+			t->task_id = task_id;
+			t->worker = w;
+			t->start = timestamp_get();
+			t->end = t->start + sim_task_duration(cmd ? cmd : "");
+			itable_insert(sim_tasks, task_id, t);
+			priority_queue_push(sim_running, t, -(double)t->end);
+			free(cmd);
+			return 1;
+		} else if (string_slice_is(word, length, "cmd") && string_next_int64(&s, &n)) {
+			free(cmd);
+			cmd = xxmalloc(n + 1);
+			if (!link_read(w->link, cmd, n, stoptime)) {
+				break;
+			}
+			cmd[n] = 0;
+		} else if (string_slice_is(word, length, "env") && string_next_int64(&s, &n)) {
+			if (link_soak(w->link, n + 1, stoptime) != n + 1) {
+				break;
+			}
+		}
+	}
+
+	free(cmd);
+	return 0;
+}
+
+/* Discard the file or directory tree sent after a put, and report it as cached. */
+
+static int sim_recv_put(struct sim_worker *w, const char *cachename, int cache_level)
+{
+	char line[VINE_LINE_MAX];
+	char name[VINE_LINE_MAX];
+	time_t stoptime = time(0) + SIM_TIMEOUT;
+	timestamp_t start = timestamp_get();
+	int64_t total = 0;
+	int depth = 0;
+
+	do {
+		if (!link_readline(w->link, line, sizeof(line), stoptime)) {
+			return 0;
+		}
+
+		const char *s = line;
+		const char *word;
+		size_t length;
+		int64_t size;
+
+		if (!string_next_slice(&s, &word, &length)) {
+			return 0;
+		} else if ((string_slice_is(word, length, "file") || string_slice_is(word, length, "symlink")) && string_next_word(&s, name, sizeof(name)) &&
+				string_next_int64(&s, &size)) {
+			if (link_soak(w->link, size, stoptime) != size) {
+				return 0;
+			}
+			total += size;
+		} else if (string_slice_is(word, length, "dir")) {
+			depth++;
+		} else if (string_slice_is(word, length, "end")) {
+			depth--;
+		} else {
+			debug(D_NOTICE, "simulated worker %s cannot handle transfer: %s", w->name, line);
+			return 0;
+		}
+	} while (depth > 0);
+
+	timestamp_t now = timestamp_get();
+	sim_send(w, "cache-update %s %d %d %" PRId64 " %lld %" PRIu64 " %" PRIu64 " X\n", cachename, VINE_FILE, cache_level, total, (long long)time(0), now - start, start);
+	return 1;
+}
+
+static void sim_complete(struct sim_task *t)
+{
+	struct sim_worker *w = t->worker;
+	int64_t inline_length = sim_output_size <= SIM_INLINE_OUTPUT_MAX ? sim_output_size : 0;
+
+	sim_send(w, "complete 0 0 %" PRId64 " %" PRId64 " %" PRIu64 " %" PRIu64 " 0 %" PRId64 "\n", sim_output_size, inline_length, t->start, timestamp_get(), t->task_id);
+	sim_send_output(w, inline_length);
+}
+
+/* Handle one message from the manager. Returns false if the worker should disconnect. */
+
+static int sim_handle_message(struct sim_worker *w)
+{
+	char line[VINE_LINE_MAX];
+	char cachename[VINE_LINE_MAX];
+
+	if (!link_readline(w->link, line, sizeof(line), time(0) + SIM_TIMEOUT)) {
+		return 0;
+	}
+
+	const char *s = line;
+	const char *cmd;
+	size_t cmdlen;
+	int64_t n;
+	int level;
+
+	if (!string_next_slice(&s, &cmd, &cmdlen)) {
+		return 1;
+	}
+
+#define COMMAND_IS(word) string_slice_is(cmd, cmdlen, word)
+
+	if (COMMAND_IS("task") && string_next_int64(&s, &n)) {
+		return sim_recv_task(w, n);
+	} else if (COMMAND_IS("put") && string_next_word(&s, cachename, sizeof(cachename)) && string_next_int(&s, &level)) {
+		return sim_recv_put(w, cachename, level);
+	} else if (COMMAND_IS("kill") && string_next_int64(&s, &n)) {
+		struct sim_task *t = itable_lookup(sim_tasks, n);
+		if (t) {
+			sim_task_delete(t);
+		}
+	} else if (COMMAND_IS("check")) {
+		sim_send(w, "alive\n");
+		sim_send_resources(w);
+	} else if (COMMAND_IS("send_stdout") && string_next_int64(&s, &n)) {
+		sim_send(w, "stdout %" PRId64 " %" PRId64 "\n", n, sim_output_size);
+		sim_send_output(w, sim_output_size);
+	} else if (COMMAND_IS("send_results")) {
+		sim_send(w, "end\n");
+	} else if (COMMAND_IS("release") || COMMAND_IS("exit")) {
+		return 0;
+	} else if (!COMMAND_IS("unlink") && !COMMAND_IS("usage_interval")) {
+		debug(D_NOTICE, "simulated worker %s ignoring message: %s", w->name, line);
+	}
+
+#undef COMMAND_IS
+
+	return 1;
+}
+
+/* Run simulated workers until the manager has disconnected all of them. */
+
+static void sim_run(const char *host, int port, int nworkers, int first_id)
+{
+	sim_poll = link_poll_set_create();
+	sim_workers = itable_create(0);
+	sim_tasks = itable_create(0);
+	sim_running = priority_queue_create(0);
+
+	int i;
+	for (i = 0; i < nworkers; i++) {
+		sim_worker_connect(host, port, first_id + i);
+	}
+
+	struct link_info *active = xxmalloc(sizeof(*active) * MAX(nworkers, 1));
+
+	while (itable_size(sim_workers) > 0) {
+		int msec = 1000;
+		struct sim_task *t = priority_queue_peek_top(sim_running);
+		if (t) {
+			timestamp_t now = timestamp_get();
+			msec = t->end > now ? MIN(msec, (int)((t->end - now + 999) / 1000)) : 0;
+		}
+
+		int n = link_poll_set_wait(sim_poll, active, nworkers, msec);
+		for (i = 0; i < n; i++) {
+			struct sim_worker *w = itable_lookup(sim_workers, (uintptr_t)active[i].link);
+			if (w && !sim_handle_message(w)) {
+				sim_worker_remove(w);
+			}
+		}
+
+		timestamp_t now = timestamp_get();
+		while ((t = priority_queue_peek_top(sim_running)) && t->end <= now) {
+			sim_complete(t);
+			sim_task_delete(t);
+		}
+	}
+
+	free(active);
+}
+
+/* Start simulated workers in a number of child processes, returning their pids. */
+
+static pid_t *sim_start(const char *host, int port, int nworkers, int nprocs)
+{
+	pid_t *pids = xxcalloc(nprocs, sizeof(pid_t));
+
+	int i;
+	int first = 0;
+	for (i = 0; i < nprocs; i++) {
+		int count = nworkers / nprocs + (i < nworkers % nprocs);
+		pid_t pid = fork();
+		if (pid == 0) {
+			sim_run(host, port, count, first);
+			_exit(0);
+		} else if (pid < 0) {
+			fatal("could not start simulated workers: %s", strerror(errno));
+		}
+		pids[i] = pid;
+		first += count;
+	}
+
+	return pids;
+}
+
+static void raise_file_limit()
+{
+	struct rlimit r;
+	if (getrlimit(RLIMIT_NOFILE, &r) == 0 && r.rlim_cur < r.rlim_max) {
+		r.rlim_cur = r.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &r);
+	}
+}
+
+static void run_benchmark(int nworkers, int nprocs, int ntasks, double run_time, int64_t input_size)
+{
+	struct vine_manager *q = vine_create(0);
+	if (!q) {
+		fatal("could not create manager: %s", strerror(errno));
+	}
+
+	vine_disable_peer_transfers(q);
+
+	timestamp_t start = timestamp_get();
+	pid_t *pids = sim_start("127.0.0.1", vine_port(q), nworkers, nprocs);
+
+	struct vine_stats stats;
+	do {
+		vine_wait(q, 1);
+		vine_get_stats(q, &stats);
+	} while (stats.workers_connected < nworkers);
+
+	timestamp_t connected = timestamp_get();
+
+	struct vine_file *input = 0;
+	char *buffer = 0;
+	if (input_size > 0) {
+		buffer = xxcalloc(1, input_size);
+		input = vine_declare_buffer(q, buffer, input_size, VINE_CACHE_LEVEL_WORKFLOW, 0);
+	}
+
+	char command[64];
+	if (run_time > 0) {
+		snprintf(command, sizeof(command), "sleep %g", run_time);
+	} else {
+		snprintf(command, sizeof(command), ":");
+	}
+
+	int i;
+	for (i = 0; i < ntasks; i++) {
+		struct vine_task *t = vine_task_create(command);
+		vine_task_set_cores(t, 1);
+		if (input) {
+			vine_task_add_input(t, input, "infile", 0);
+		}
+		vine_submit(q, t);
+	}
+
+	timestamp_t submitted = timestamp_get();
+
+	struct quantile_sketch *latency = quantile_sketch_create(0.01, 0);
+	double latency_max = 0;
+	int done = 0;
+	while (!vine_empty(q)) {
+		timestamp_t before = timestamp_get();
+		struct vine_task *t = vine_wait(q, 5);
+		double msec = (timestamp_get() - before) / 1000.0;
+		quantile_sketch_insert(latency, msec);
+		latency_max = MAX(latency_max, msec);
+		if (t) {
+			done++;
+			vine_task_delete(t);
+		}
+	}
+
+	timestamp_t finished = timestamp_get();
+	vine_get_stats(q, &stats);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double elapsed = (finished - submitted) / (double)USECOND;
+
+	printf("workers:          %d in %d processes, connected in %.2f s\n", nworkers, nprocs, (connected - start) / (double)USECOND);
+	printf("tasks:            %d submitted in %.2f s, completed in %.2f s\n", ntasks, (submitted - connected) / (double)USECOND, elapsed);
+	printf("dispatch rate:    %.1f tasks/s\n", stats.tasks_dispatched / elapsed);
+	printf("completion rate:  %.1f tasks/s\n", done / elapsed);
+	printf("vine_wait (ms):   p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+			quantile_sketch_quantile(latency, 0.5),
+			quantile_sketch_quantile(latency, 0.9),
+			quantile_sketch_quantile(latency, 0.99),
+			latency_max);
+	printf("manager memory:   %.1f MB maximum resident\n", usage.ru_maxrss / 1024.0);
+
+	printf("%-16s %10s %10s %10s %10s %10s\n", "loop phase (us)", "count", "total", "p50", "p99", "max");
+	for (i = 0; i < VINE_LOOP_PHASE_MAX; i++) {
+		struct vine_loop_phase_stats *p = &stats.loop_phases[i];
+		if (p->count > 0) {
+			printf("%-16s %10" PRId64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+					vine_loop_phase_string(i),
+					p->count,
+					p->time_total,
+					p->time_p50,
+					p->time_p99,
+					p->time_max);
+		}
+	}
+
+	quantile_sketch_delete(latency);
+
+	if (input) {
+		vine_undeclare_file(q, input);
+	}
+	free(buffer);
+
+	/* Deleting the manager releases the workers, which ends the simulating processes. */
+	vine_delete(q);
+
+	for (i = 0; i < nprocs; i++) {
+		waitpid(pids[i], 0, 0);
+	}
+	free(pids);
+}
+
+static void show_help(const char *cmd)
+{
+	printf("Use: %s [options]\n", cmd);
+	printf("Where options are:\n");
+	printf(" %-30s Number of simulated workers. (default: %d)\n", "-w,--workers=<n>", 1000);
+	printf(" %-30s Number of processes simulating the workers. (default: %d)\n", "-P,--processes=<n>", 4);
+	printf(" %-30s Number of tasks to run. (default: %d)\n", "-n,--tasks=<n>", 10000);
+	printf(" %-30s Run time of each task, in seconds. (default: 0)\n", "-t,--run-time=<secs>");
+	printf(" %-30s Size of an input file shared by all tasks, in bytes. (default: 0)\n", "-i,--input-size=<bytes>");
+	printf(" %-30s Size of the standard output of each task, in bytes. (default: 0)\n", "-o,--output-size=<bytes>");
+	printf(" %-30s Cores of each simulated worker. (default: %d)\n", "-c,--cores=<n>", sim_cores);
+	printf(" %-30s Only connect simulated workers to this manager.\n", "-M,--manager=<host:port>");
+	printf(" %-30s Enable debugging for this subsystem.\n", "-d,--debug=<subsystem>");
+	printf(" %-30s Send debugging output to this file.\n", "-D,--debug-file=<file>");
+	printf(" %-30s Show version information.\n", "-v,--version");
+	printf(" %-30s Show this help screen.\n", "-h,--help");
+}
+
+int main(int argc, char *argv[])
+{
+	int nworkers = 1000;
+	int nprocs = 4;
+	int ntasks = 10000;
+	double run_time = 0;
+	int64_t input_size = 0;
+	const char *manager = 0;
+	int c;
+
+	static const struct option long_options[] = {
+			{"workers", required_argument, 0, 'w'},
+			{"processes", required_argument, 0, 'P'},
+			{"tasks", required_argument, 0, 'n'},
+			{"run-time", required_argument, 0, 't'},
+			{"input-size", required_argument, 0, 'i'},
+			{"output-size", required_argument, 0, 'o'},
+			{"cores", required_argument, 0, 'c'},
+			{"manager", required_argument, 0, 'M'},
+			{"debug", required_argument, 0, 'd'},
+			{"debug-file", required_argument, 0, 'D'},
+			{"version", no_argument, 0, 'v'},
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}};
+
+	debug_config(argv[0]);
+
+	while ((c = getopt_long(argc, argv, "w:P:n:t:i:o:c:M:d:D:vh", long_options, 0)) != -1) {
+		switch (c) {
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 'P':
+			nprocs = atoi(optarg);
+			break;
+		case 'n':
+			ntasks = atoi(optarg);
+			break;
+		case 't':
+			run_time = atof(optarg);
+			break;
+		case 'i':
+			input_size = string_metric_parse(optarg);
+			break;
+		case 'o':
+			sim_output_size = string_metric_parse(optarg);
+			break;
+		case 'c':
+			sim_cores = atoi(optarg);
+			break;
+		case 'M':
+			manager = optarg;
+			break;
+		case 'd':
+			debug_flags_set(optarg);
+			break;
+		case 'D':
+			debug_config_file(optarg);
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		case 'h':
+			show_help(path_basename(argv[0]));
+			return 0;
+		default:
+			show_help(path_basename(argv[0]));
+			return 1;
+		}
+	}
+
+	if (nworkers < 1 || nprocs < 1 || ntasks < 0) {
+		show_help(path_basename(argv[0]));
+		return 1;
+	}
+
+	nprocs = MIN(nprocs, nworkers);
+	raise_file_limit();
+	signal(SIGPIPE, SIG_IGN);
+
+	if (manager) {
+		char host[VINE_LINE_MAX];
+		int port;
+		if (sscanf(manager, "%[^:]:%d", host, &port) != 2) {
+			fatal("manager must be given as host:port");
+		}
+		pid_t *pids = sim_start(host, port, nworkers, nprocs);
+		int i;
+		for (i = 0; i < nprocs; i++) {
+			waitpid(pids[i], 0, 0);
+		}
+		free(pids);
+	} else {
+		run_benchmark(nworkers, nprocs, ntasks, run_time, input_size);
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=8: */
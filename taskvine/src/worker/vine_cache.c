@@ -6,28 +6,36 @@ See the file COPYING for details.
 
 #include "vine_cache.h"
 #include "vine_cache_file.h"
+#include "vine_manifest.h"
 #include "vine_mount.h"
 #include "vine_process.h"
 #include "vine_sandbox.h"
+#include "vine_trace.h"
 #include "vine_worker.h"
 
 #include "vine_protocol.h"
 #include "vine_transfer.h"
 
+#include "buffer.h"
 #include "copy_stream.h"
 #include "debug.h"
 #include "domain_name_cache.h"
+#include "full_io.h"
 #include "hash_table.h"
 #include "link.h"
 #include "link_auth.h"
+#include "macros.h"
+#include "md5.h"
 #include "path_disk_size_info.h"
 #include "stringtools.h"
 #include "timestamp.h"
 #include "trash.h"
+#include "url_encode.h"
 #include "xxmalloc.h"
 
 #include <dirent.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/fcntl.h>
@@ -39,8 +47,50 @@ See the file COPYING for details.
 struct vine_cache {
 	struct hash_table *table;
 	char *cache_dir;
+	vine_cache_eviction_t eviction;
+	double inflation;
+	FILE *index;
+	int64_t index_records;
+	int url_streams;
+	int64_t url_part_size;
+	struct vine_cache_stats stats; /* Only the cumulative counters are kept here. */
+	int64_t bytes_ready;		   /* Total size of the objects ready, kept as they come and go. */
+	struct hash_table *chunks;     /* Where to find each chunk of the directories received by manifest. */
 };
 
+/*
+The chunk index maps the hash of each chunk of a directory received by
+manifest to one place where its data is found in the cache: an object,
+a file within it, and an offset.  Each object lists the hashes that
+point into it, so that they are forgotten when it leaves the cache.
+The index is kept only in memory, so a restarted worker receives every
+chunk again, and the data is checked against the hash whenever it is
+read, since nothing else prevents a cached file from being modified.
+*/
+
+struct vine_cache_chunk {
+	char *cachename;
+	char *path;
+	int64_t offset;
+	int64_t length;
+};
+
+/*
+The cache index is an append-only log kept in the cache directory.
+It records each object that becomes ready in the cache or is removed from
+it, so that a restarted worker can reload its cache without reading every
+.meta file.  An object is logged as removed before its data is deleted,
+and as added only once its data is in place, so that the index never names
+an object that is not present, and objects left out of the index are
+deleted when it is loaded.  The index is rewritten compactly when it
+grows much larger than the cache itself.  If it is missing or damaged,
+the cache directory is scanned as before.
+*/
+
+#define VINE_CACHE_INDEX_NAME ".index"
+#define VINE_CACHE_INDEX_HEADER "vine-cache-index 1"
+#define VINE_CACHE_INDEX_SLACK 10000
+
 static void vine_cache_wait_for_file(struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct link *manager);
 
 /*
@@ -52,14 +102,262 @@ struct vine_cache *vine_cache_create(const char *cache_dir)
 	struct vine_cache *c = malloc(sizeof(*c));
 	c->cache_dir = strdup(cache_dir);
 	c->table = hash_table_create(0, 0);
+	c->eviction = VINE_CACHE_EVICTION_NONE;
+	c->inflation = 0;
+	c->index = 0;
+	c->index_records = 0;
+	c->url_streams = 1;
+	c->url_part_size = 64 * MEGABYTE;
+	memset(&c->stats, 0, sizeof(c->stats));
+	c->bytes_ready = 0;
+	c->chunks = hash_table_create(0, 0);
 	return c;
 }
 
+static char *vine_cache_index_path(struct vine_cache *c)
+{
+	return string_format("%s/%s", c->cache_dir, VINE_CACHE_INDEX_NAME);
+}
+
+static void vine_cache_index_add(struct vine_cache *c, const char *cachename, struct vine_cache_file *f)
+{
+	if (!c->index)
+		return;
+
+	char source_encoded[VINE_LINE_MAX];
+	url_encode(f->source ? f->source : "manager", source_encoded, sizeof(source_encoded));
+
+	fprintf(c->index,
+			"add %s %d %d 0%o %lld %lld %lld %lld %s\n",
+			cachename,
+			f->original_type,
+			f->cache_level,
+			f->mode,
+			(long long)f->size,
+			(long long)f->mtime,
+			(long long)f->transfer_time,
+			(long long)f->start_time,
+			source_encoded);
+	fflush(c->index);
+
+	c->index_records++;
+}
+
+static void vine_cache_index_remove(struct vine_cache *c, const char *cachename)
+{
+	if (!c->index)
+		return;
+
+	fprintf(c->index, "remove %s\n", cachename);
+	fflush(c->index);
+
+	c->index_records++;
+}
+
+/*
+Replay the index into the cache table, deleting the objects that were not
+meant to outlive the worker, as vine_cache_load does when scanning.
+Returns false if there is no usable index.
+*/
+
+static int vine_cache_index_load(struct vine_cache *c)
+{
+	char *index_path = vine_cache_index_path(c);
+	FILE *file = fopen(index_path, "r");
+	free(index_path);
+
+	if (!file)
+		return 0;
+
+	char line[VINE_LINE_MAX];
+	if (!fgets(line, sizeof(line), file) || strncmp(line, VINE_CACHE_INDEX_HEADER, strlen(VINE_CACHE_INDEX_HEADER))) {
+		debug(D_VINE, "cache: index is damaged, scanning the cache directory");
+		fclose(file);
+		return 0;
+	}
+
+	struct hash_table *entries = hash_table_create(0, 0);
+	char cachename[VINE_LINE_MAX];
+	char source_encoded[VINE_LINE_MAX];
+	char source[VINE_LINE_MAX];
+	int type, level, mode;
+	long long size, mtime, transfer_time, start_time;
+	int ok = 1;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "add %s %d %d %o %lld %lld %lld %lld %s", cachename, &type, &level, &mode, &size, &mtime, &transfer_time, &start_time, source_encoded) == 9) {
+			url_decode(source_encoded, source, sizeof(source));
+			struct vine_cache_file *f = hash_table_remove(entries, cachename);
+			if (f)
+				vine_cache_file_delete(f);
+			f = vine_cache_file_create(VINE_CACHE_FILE, source, 0);
+			f->original_type = type;
+			f->cache_level = level;
+			f->mode = mode;
+			f->size = size;
+			f->mtime = mtime;
+			f->transfer_time = transfer_time;
+			f->start_time = start_time;
+			hash_table_insert(entries, cachename, f);
+		} else if (sscanf(line, "remove %s", cachename) == 1) {
+			struct vine_cache_file *f = hash_table_remove(entries, cachename);
+			if (f)
+				vine_cache_file_delete(f);
+		} else if (strchr(line, '\n')) {
+			debug(D_VINE, "cache: index is damaged, scanning the cache directory");
+			ok = 0;
+			break;
+		} else {
+			/* A partial last record left by a crash never had its object in place. */
+			break;
+		}
+	}
+
+	fclose(file);
+
+	char *name;
+	struct vine_cache_file *f;
+	HASH_TABLE_ITERATE(entries, name, f)
+	{
+		if (ok && f->cache_level >= VINE_CACHE_LEVEL_FOREVER) {
+			f->status = VINE_CACHE_STATUS_READY;
+			hash_table_insert(c->table, name, f);
+			c->bytes_ready += f->size;
+		} else {
+			if (ok) {
+				debug(D_VINE, "cache: %s has cache-level %d, deleting", name, f->cache_level);
+				char *meta_path = vine_cache_meta_path(c, name);
+				char *data_path = vine_cache_data_path(c, name);
+				trash_file(meta_path);
+				trash_file(data_path);
+				free(meta_path);
+				free(data_path);
+			}
+			vine_cache_file_delete(f);
+		}
+	}
+
+	hash_table_delete(entries);
+
+	if (ok)
+		debug(D_VINE, "cache: loaded %d objects from the cache index", hash_table_size(c->table));
+
+	return ok;
+}
+
+/*
+Write out a compact index of the objects ready in the cache, and keep it
+open to append further changes.
+*/
+
+static void vine_cache_index_rewrite(struct vine_cache *c)
+{
+	if (c->index) {
+		fclose(c->index);
+		c->index = 0;
+	}
+
+	char *index_path = vine_cache_index_path(c);
+	char *tmp_path = string_format("%s.tmp", index_path);
+
+	FILE *file = fopen(tmp_path, "w");
+	if (!file) {
+		debug(D_VINE, "cache: couldn't write index %s: %s", tmp_path, strerror(errno));
+		free(index_path);
+		free(tmp_path);
+		return;
+	}
+
+	fprintf(file, "%s\n", VINE_CACHE_INDEX_HEADER);
+
+	c->index = file;
+	c->index_records = 0;
+
+	char *cachename;
+	struct vine_cache_file *f;
+	HASH_TABLE_ITERATE(c->table, cachename, f)
+	{
+		if (f->status == VINE_CACHE_STATUS_READY)
+			vine_cache_index_add(c, cachename, f);
+	}
+
+	if (rename(tmp_path, index_path) != 0) {
+		debug(D_VINE, "cache: couldn't write index %s: %s", index_path, strerror(errno));
+		fclose(c->index);
+		c->index = 0;
+		unlink(tmp_path);
+	}
+
+	free(index_path);
+	free(tmp_path);
+}
+
+/*
+Rewrite the index once it is mostly made of stale records.
+*/
+
+static void vine_cache_index_compact_if_needed(struct vine_cache *c)
+{
+	if (c->index_records > 4 * (int64_t)hash_table_size(c->table) + VINE_CACHE_INDEX_SLACK) {
+		debug(D_VINE, "cache: compacting index of %" PRId64 " records", c->index_records);
+		vine_cache_index_rewrite(c);
+	}
+}
+
 /*
-Load existing cache directory into cache structure.
+Delete whatever the cache directory holds besides the objects loaded from
+the index, such as an object put in place by a worker that crashed before
+recording it.  Only the names in the directory are read, not the metadata.
+*/
+
+static void vine_cache_reclaim_orphans(struct vine_cache *c)
+{
+	DIR *dir = opendir(c->cache_dir);
+	if (!dir)
+		return;
+
+	int count = 0;
+	struct dirent *d;
+	while ((d = readdir(dir))) {
+		if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+			continue;
+
+		if (!strncmp(d->d_name, VINE_CACHE_INDEX_NAME, strlen(VINE_CACHE_INDEX_NAME)))
+			continue;
+
+		char *cachename = xxstrdup(d->d_name);
+		if (!strcmp(string_back(cachename, 5), ".meta"))
+			cachename[strlen(cachename) - 5] = 0;
+
+		if (!hash_table_lookup(c->table, cachename)) {
+			debug(D_VINE, "cache: %s is not in the cache index, deleting", d->d_name);
+			char *path = string_format("%s/%s", c->cache_dir, d->d_name);
+			trash_file(path);
+			free(path);
+			count++;
+		}
+
+		free(cachename);
+	}
+
+	closedir(dir);
+
+	if (count > 0)
+		debug(D_VINE, "cache: deleted %d entries missing from the cache index", count);
+}
+
+/*
+Load existing cache directory into cache structure,
+from the cache index if there is one.
 */
 void vine_cache_load(struct vine_cache *c)
 {
+	if (vine_cache_index_load(c)) {
+		vine_cache_reclaim_orphans(c);
+		vine_cache_index_rewrite(c);
+		return;
+	}
+
 	DIR *dir = opendir(c->cache_dir);
 	if (dir) {
 		debug(D_VINE, "loading cache at: %s", c->cache_dir);
@@ -75,6 +373,11 @@ void vine_cache_load(struct vine_cache *c)
 				continue;
 			}
 
+			/* Likewise skip the cache index and any partial rewrite of it. */
+			if (!strncmp(d->d_name, VINE_CACHE_INDEX_NAME, strlen(VINE_CACHE_INDEX_NAME))) {
+				continue;
+			}
+
 			char *meta_path = vine_cache_meta_path(c, d->d_name);
 			char *data_path = vine_cache_data_path(c, d->d_name);
 
@@ -91,6 +394,7 @@ void vine_cache_load(struct vine_cache *c)
 					debug(D_VINE, "cache: %s has cache-level %d, keeping", d->d_name, f->cache_level);
 					hash_table_insert(c->table, d->d_name, f);
 					f->status = VINE_CACHE_STATUS_READY;
+					c->bytes_ready += f->size;
 				}
 			} else {
 				debug(D_VINE, "cache: %s has invalid metadata, deleting", d->d_name);
@@ -104,10 +408,14 @@ void vine_cache_load(struct vine_cache *c)
 		}
 	}
 	closedir(dir);
+
+	vine_cache_index_rewrite(c);
 }
 
 /*
-send cache updates to manager from existing cache_directory
+Send the contents of the existing cache directory to the manager.
+The updates are gathered into as few messages as possible by
+vine_worker_send_cache_update, rather than sent one by one.
 */
 
 void vine_cache_scan(struct vine_cache *c, struct link *manager)
@@ -116,8 +424,10 @@ void vine_cache_scan(struct vine_cache *c, struct link *manager)
 	char *cachename;
 	HASH_TABLE_ITERATE(c->table, cachename, f)
 	{
-		vine_worker_send_cache_update(manager, cachename, f->original_type, f->cache_level, f->size, f->mode, f->transfer_time, f->start_time);
+		vine_worker_send_cache_update(manager, cachename, f->original_type, f->cache_level, f->size, f->mtime, f->transfer_time, f->start_time);
 	}
+
+	debug(D_VINE, "cache: reported %d objects to the manager", hash_table_size(c->table));
 }
 
 /*
@@ -154,6 +464,31 @@ static void vine_cache_kill(struct vine_cache *c, struct vine_cache_file *f, con
 	}
 }
 
+static void vine_cache_chunk_delete(struct vine_cache_chunk *k)
+{
+	free(k->cachename);
+	free(k->path);
+	free(k);
+}
+
+/* Forget the chunks that point into an object whose data is going away. */
+
+static void vine_cache_forget_chunks(struct vine_cache *c, struct vine_cache_file *f, const char *cachename)
+{
+	if (!f->chunks)
+		return;
+
+	char *hash;
+	while ((hash = list_pop_head(f->chunks))) {
+		struct vine_cache_chunk *k = hash_table_lookup(c->chunks, hash);
+		if (k && !strcmp(k->cachename, cachename)) {
+			hash_table_remove(c->chunks, hash);
+			vine_cache_chunk_delete(k);
+		}
+		free(hash);
+	}
+}
+
 /*
 Delete the cache manager structure, though not the underlying files.
 */
@@ -167,8 +502,13 @@ void vine_cache_delete(struct vine_cache *c)
 		vine_cache_kill(c, file, cachename, 0);
 	}
 
+	if (c->index)
+		fclose(c->index);
+
 	hash_table_clear(c->table, (void *)vine_cache_file_delete);
 	hash_table_delete(c->table);
+	hash_table_clear(c->chunks, (void *)vine_cache_chunk_delete);
+	hash_table_delete(c->chunks);
 	free(c->cache_dir);
 	free(c);
 }
@@ -224,6 +564,11 @@ int vine_cache_add_file(
 			hash_table_insert(c->table, cachename, f);
 		}
 
+		/* An object already ready is being replaced, so forget its old size and chunks. */
+		if (f->status == VINE_CACHE_STATUS_READY)
+			c->bytes_ready -= f->size;
+		vine_cache_forget_chunks(c, f, cachename);
+
 		/* Fill in the missing metadata. */
 		f->cache_level = level;
 		f->mode = mode;
@@ -231,10 +576,16 @@ int vine_cache_add_file(
 		f->mtime = mtime;
 		f->transfer_time = transfer_time;
 
+		/* Arrival counts as the last access, but not as a use. */
+		f->last_access = timestamp_get();
+
 		/* File has data and is ready to use. */
 		f->status = VINE_CACHE_STATUS_READY;
+		c->bytes_ready += f->size;
 
 		vine_cache_file_save_metadata(f, meta_path);
+		vine_cache_index_add(c, cachename, f);
+		vine_cache_index_compact_if_needed(c);
 
 		result = 1;
 	} else {
@@ -256,6 +607,249 @@ int vine_cache_contains(struct vine_cache *c, const char *cachename)
 	return hash_table_lookup(c->table, cachename) != 0;
 }
 
+/*
+Record that an object was linked into a sandbox, for the eviction policy.
+*/
+
+void vine_cache_access(struct vine_cache *c, const char *cachename)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+	if (!f)
+		return;
+
+	f->last_access = timestamp_get();
+	if (f->access_count > 0)
+		c->stats.reuses++;
+	f->access_count++;
+	f->inflation = c->inflation;
+	c->stats.accesses++;
+}
+
+/*
+Record that an object was produced by a task at this worker.
+It may be the only copy anywhere, so it is never evicted.
+*/
+
+void vine_cache_mark_output(struct vine_cache *c, const char *cachename)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+	if (f)
+		f->task_output = 1;
+}
+
+/*
+Return the total size in bytes of the objects present in the cache.
+This is kept up to date as objects become ready and are removed,
+so that the cache need not be walked.
+*/
+
+int64_t vine_cache_size(struct vine_cache *c)
+{
+	return c->bytes_ready;
+}
+
+/*
+Fill in the statistics of the cache, counting the objects present now.
+*/
+
+void vine_cache_get_stats(struct vine_cache *c, struct vine_cache_stats *s)
+{
+	*s = c->stats;
+
+	char *cachename;
+	struct vine_cache_file *f;
+	HASH_TABLE_ITERATE(c->table, cachename, f)
+	{
+		if (f->status == VINE_CACHE_STATUS_READY) {
+			s->objects++;
+			s->bytes += f->size;
+		} else if (f->status == VINE_CACHE_STATUS_PENDING || f->status == VINE_CACHE_STATUS_PROCESSING || f->status == VINE_CACHE_STATUS_TRANSFERRED) {
+			s->objects_pending++;
+		}
+	}
+}
+
+/*
+Each eviction policy gives a priority to an object in the cache,
+and the objects with the lowest priority are evicted first.
+Ties are broken by evicting the least recently used object.
+*/
+
+static double eviction_priority_lru(struct vine_cache *c, struct vine_cache_file *f)
+{
+	return f->last_access;
+}
+
+static double eviction_priority_lfu(struct vine_cache *c, struct vine_cache_file *f)
+{
+	return f->access_count;
+}
+
+/*
+Greedy-Dual Size-Frequency: the cost of obtaining the object again
+(the time it took to create it) times its use count, per byte, plus the
+value of the cache clock at its last access, which is advanced to the
+priority of each evicted object so that objects not used in a while age.
+*/
+
+static double eviction_priority_gdsf(struct vine_cache *c, struct vine_cache_file *f)
+{
+	double cost = MAX(f->transfer_time, 1) / 1000000.0;
+	double size = MAX(f->size, 1);
+	return f->inflation + f->access_count * cost / size;
+}
+
+static struct {
+	const char *name;
+	double (*priority)(struct vine_cache *c, struct vine_cache_file *f);
+} eviction_policies[] = {
+		[VINE_CACHE_EVICTION_NONE] = {"none", 0},
+		[VINE_CACHE_EVICTION_LRU] = {"lru", eviction_priority_lru},
+		[VINE_CACHE_EVICTION_LFU] = {"lfu", eviction_priority_lfu},
+		[VINE_CACHE_EVICTION_GDSF] = {"gdsf", eviction_priority_gdsf},
+};
+
+/*
+Look up an eviction policy by name, returning true if it exists.
+*/
+
+int vine_cache_eviction_from_string(const char *name, vine_cache_eviction_t *policy)
+{
+	size_t i;
+	for (i = 0; i < sizeof(eviction_policies) / sizeof(eviction_policies[0]); i++) {
+		if (!strcmp(name, eviction_policies[i].name)) {
+			*policy = i;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void vine_cache_set_eviction(struct vine_cache *c, vine_cache_eviction_t policy)
+{
+	c->eviction = policy;
+}
+
+void vine_cache_set_url_streams(struct vine_cache *c, int streams, int64_t part_size)
+{
+	c->url_streams = MAX(streams, 1);
+	c->url_part_size = MAX(part_size, 1);
+}
+
+struct eviction_candidate {
+	char *cachename;
+	double priority;
+	timestamp_t last_access;
+	int64_t size;
+};
+
+static int eviction_candidate_compare(const void *a, const void *b)
+{
+	const struct eviction_candidate *x = a;
+	const struct eviction_candidate *y = b;
+
+	if (x->priority != y->priority)
+		return x->priority < y->priority ? -1 : 1;
+	if (x->last_access != y->last_access)
+		return x->last_access < y->last_access ? -1 : 1;
+	return 0;
+}
+
+/*
+An object may be evicted if it is complete, can be obtained again from
+elsewhere, and is not needed by any task or by a mini task in progress.
+An object that just arrived and was not used yet is kept for a while,
+as the task that needs it is likely on its way from the manager.
+*/
+
+#define VINE_CACHE_EVICTION_GRACE_TIME (60 * 1000000)
+
+static int vine_cache_evictable(struct vine_cache *c, struct vine_cache_file *f, const char *cachename, struct hash_table *in_use)
+{
+	if (f->status != VINE_CACHE_STATUS_READY)
+		return 0;
+	if (f->task_output || f->original_type == VINE_TEMP)
+		return 0;
+	if (f->access_count == 0 && f->last_access + VINE_CACHE_EVICTION_GRACE_TIME > timestamp_get())
+		return 0;
+	if (in_use && hash_table_lookup(in_use, cachename))
+		return 0;
+	return 1;
+}
+
+/*
+Evict objects from the cache according to the eviction policy, until at
+least the given number of bytes has been freed or no candidate remains.
+Objects named in the in_use table are kept.  The manager is told
+of each evicted object so that it may update its records.
+Returns the number of bytes freed.
+*/
+
+int64_t vine_cache_evict(struct vine_cache *c, int64_t bytes, struct hash_table *in_use, struct link *manager)
+{
+	if (c->eviction == VINE_CACHE_EVICTION_NONE || bytes <= 0)
+		return 0;
+
+	/* Inputs of mini tasks in progress are needed too. */
+	struct hash_table *needed = hash_table_create(0, 0);
+
+	char *cachename;
+	struct vine_cache_file *f;
+	HASH_TABLE_ITERATE(c->table, cachename, f)
+	{
+		if (f->status == VINE_CACHE_STATUS_PROCESSING && f->mini_task && f->mini_task->input_mounts) {
+			struct vine_mount *m;
+			LIST_ITERATE(f->mini_task->input_mounts, m)
+			{
+				hash_table_insert(needed, m->file->cached_name, m);
+			}
+		}
+	}
+
+	int ncandidates = 0;
+	struct eviction_candidate *candidates = malloc(sizeof(*candidates) * MAX(hash_table_size(c->table), 1));
+
+	HASH_TABLE_ITERATE(c->table, cachename, f)
+	{
+		if (!vine_cache_evictable(c, f, cachename, in_use) || hash_table_lookup(needed, cachename))
+			continue;
+
+		struct eviction_candidate *e = &candidates[ncandidates++];
+		e->cachename = xxstrdup(cachename);
+		e->priority = eviction_policies[c->eviction].priority(c, f);
+		e->last_access = f->last_access;
+		e->size = f->size;
+	}
+
+	hash_table_delete(needed);
+
+	qsort(candidates, ncandidates, sizeof(*candidates), eviction_candidate_compare);
+
+	int64_t freed = 0;
+	int i;
+	for (i = 0; i < ncandidates; i++) {
+		struct eviction_candidate *e = &candidates[i];
+		if (freed < bytes) {
+			debug(D_VINE, "cache: evicting %s (%" PRId64 " bytes) to free space", e->cachename, e->size);
+			if (c->eviction == VINE_CACHE_EVICTION_GDSF) {
+				c->inflation = MAX(c->inflation, e->priority);
+			}
+			vine_cache_remove(c, e->cachename, manager);
+			if (manager) {
+				vine_worker_send_cache_invalid(manager, e->cachename, "evicted to free disk space");
+			}
+			freed += e->size;
+			c->stats.evictions++;
+			c->stats.bytes_evicted += e->size;
+		}
+		free(e->cachename);
+	}
+
+	free(candidates);
+
+	return freed;
+}
+
 /*
 Queue a remote file transfer to produce a file.
 This entry will be materialized later in vine_cache_ensure.
@@ -341,7 +935,14 @@ int vine_cache_remove(struct vine_cache *c, const char *cachename, struct link *
 	/* Ensure that any child process associated with the entry is stopped. */
 	vine_cache_kill(c, f, cachename, manager);
 
-	/* Then remove the disk state associated with the file. */
+	vine_cache_forget_chunks(c, f, cachename);
+
+	/* Then remove the disk state associated with the file, forgetting it in the index first. */
+	if (f->status == VINE_CACHE_STATUS_READY) {
+		vine_cache_index_remove(c, cachename);
+		c->bytes_ready -= f->size;
+	}
+
 	char *data_path = vine_cache_data_path(c, cachename);
 	char *meta_path = vine_cache_meta_path(c, cachename);
 	trash_file(data_path);
@@ -356,6 +957,134 @@ int vine_cache_remove(struct vine_cache *c, const char *cachename, struct link *
 	return 1;
 }
 
+/*
+Give a file already present in the cache a new name, as when the manager
+has computed the checksum of a file while sending it.  If the cache already
+holds an object under the new name, the copy under the old name is dropped.
+*/
+
+int vine_cache_rename(struct vine_cache *c, const char *old_name, const char *new_name)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, old_name);
+	if (!f || f->status != VINE_CACHE_STATUS_READY)
+		return 0;
+
+	if (hash_table_lookup(c->table, new_name)) {
+		debug(D_VINE, "cache: %s is already present as %s", old_name, new_name);
+		vine_cache_remove(c, old_name, 0);
+		return 1;
+	}
+
+	char *old_data_path = vine_cache_data_path(c, old_name);
+	char *new_data_path = vine_cache_data_path(c, new_name);
+	char *old_meta_path = vine_cache_meta_path(c, old_name);
+	char *new_meta_path = vine_cache_meta_path(c, new_name);
+
+	int result = 0;
+
+	vine_cache_index_remove(c, old_name);
+
+	if (rename(old_data_path, new_data_path) == 0) {
+		trash_file(old_meta_path);
+		vine_cache_file_save_metadata(f, new_meta_path);
+
+		f = hash_table_remove(c->table, old_name);
+		hash_table_insert(c->table, new_name, f);
+		vine_cache_index_add(c, new_name, f);
+
+		if (f->chunks) {
+			char *hash;
+			LIST_ITERATE(f->chunks, hash)
+			{
+				struct vine_cache_chunk *k = hash_table_lookup(c->chunks, hash);
+				if (k && !strcmp(k->cachename, old_name)) {
+					free(k->cachename);
+					k->cachename = xxstrdup(new_name);
+				}
+			}
+		}
+
+		debug(D_VINE, "cache: renamed %s to %s", old_name, new_name);
+		result = 1;
+	} else {
+		debug(D_VINE, "cache: couldn't rename %s to %s: %s", old_name, new_name, strerror(errno));
+		vine_cache_index_add(c, old_name, f);
+	}
+
+	free(old_data_path);
+	free(new_data_path);
+	free(old_meta_path);
+	free(new_meta_path);
+
+	return result;
+}
+
+/*
+Index the chunks of a directory just added to the cache as cachename,
+each located by its path within the directory.  A chunk already found
+elsewhere in the cache keeps its place.  Takes ownership of the chunks.
+*/
+
+void vine_cache_add_chunks(struct vine_cache *c, const char *cachename, struct list *chunks)
+{
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+
+	struct vine_manifest_chunk *chunk;
+	while ((chunk = list_pop_head(chunks))) {
+		if (f && !hash_table_lookup(c->chunks, chunk->hash)) {
+			struct vine_cache_chunk *k = xxmalloc(sizeof(*k));
+			k->cachename = xxstrdup(cachename);
+			k->path = xxstrdup(chunk->path);
+			k->offset = chunk->offset;
+			k->length = chunk->length;
+			hash_table_insert(c->chunks, chunk->hash, k);
+
+			if (!f->chunks)
+				f->chunks = list_create();
+			list_push_tail(f->chunks, xxstrdup(chunk->hash));
+		}
+		vine_manifest_chunk_delete(chunk);
+	}
+}
+
+/*
+Read the data of a chunk with the given hash and length from wherever
+the cache holds it.  Returns true only if the data read matches the hash.
+A chunk that no longer matches is forgotten.
+*/
+
+int vine_cache_read_chunk(struct vine_cache *c, const char *hash, int64_t length, char *data)
+{
+	struct vine_cache_chunk *k = hash_table_lookup(c->chunks, hash);
+	if (!k || k->length != length)
+		return 0;
+
+	char *object_path = vine_cache_data_path(c, k->cachename);
+	char *path = string_format("%s/%s", object_path, k->path);
+
+	int ok = 0;
+	int fd = open(path, O_RDONLY, 0);
+	if (fd >= 0) {
+		if (full_pread64(fd, data, length, k->offset) == length) {
+			unsigned char digest[MD5_DIGEST_LENGTH];
+			md5_buffer(data, length, digest);
+			ok = !strcmp(md5_to_string(digest), hash);
+		}
+		close(fd);
+	}
+
+	if (!ok) {
+		debug(D_VINE, "cache: chunk %s is no longer at %s", hash, path);
+		hash_table_remove(c->chunks, hash);
+		vine_cache_chunk_delete(k);
+	}
+
+	free(object_path);
+	free(path);
+
+	return ok;
+}
+
 /*
 Execute a shell command via popen and capture its output.
 On success, return true.
@@ -399,8 +1128,19 @@ Transfer a single input file from a url to the local transfer path via curl.
 --stderr Send errors to /dev/stdout so that they are observed by popen.
 */
 
+static int do_curl_ranges_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *transfer_path, char **error_message);
+
 static int do_curl_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *transfer_path, const char *cache_path, char **error_message)
 {
+	if (c->url_streams > 1 && (int64_t)f->size >= 2 * c->url_part_size && (!strncmp(f->source, "http://", 7) || !strncmp(f->source, "https://", 8))) {
+		if (do_curl_ranges_transfer(c, f, transfer_path, error_message)) {
+			return 1;
+		}
+		debug(D_VINE, "cache: fetching %s as a single stream instead", f->source);
+		free(*error_message);
+		*error_message = 0;
+	}
+
 	char *command = string_format("curl -sSL --stderr /dev/stdout -o \"%s\" \"%s\"", transfer_path, f->source);
 	int result = do_internal_command(c, command, error_message);
 	free(command);
@@ -408,6 +1148,83 @@ static int do_curl_transfer(struct vine_cache *c, struct vine_cache_file *f, con
 	return result;
 }
 
+/*
+Transfer a large url of known size as byte ranges fetched in parallel by a
+single curl, which can be much faster than one stream from a distant server.
+Each range goes to its own part file; the parts are checked and joined into
+the transfer path.  Returns zero if any range fails, so that the caller can
+fall back to fetching the url as one stream, as for a server without ranges.
+*/
+
+static int do_curl_ranges_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *transfer_path, char **error_message)
+{
+	int64_t nparts = (f->size + c->url_part_size - 1) / c->url_part_size;
+	int64_t i;
+	int result = 0;
+
+	buffer_t command;
+	buffer_init(&command);
+	buffer_printf(&command, "curl --parallel --parallel-max %d --no-progress-meter", c->url_streams);
+	for (i = 0; i < nparts; i++) {
+		int64_t start = i * c->url_part_size;
+		int64_t end = MIN(start + c->url_part_size, (int64_t)f->size) - 1;
+		buffer_printf(&command, "%s -sSL --fail --stderr /dev/stdout -r %" PRId64 "-%" PRId64 " -o \"%s.part%" PRId64 "\" \"%s\"", i > 0 ? " --next" : "", start, end, transfer_path, i, f->source);
+	}
+
+	debug(D_VINE, "cache: fetching %s as %" PRId64 " ranges of %" PRId64 " bytes", f->source, nparts, c->url_part_size);
+
+	if (do_internal_command(c, buffer_tostring(&command), error_message)) {
+		int out = open(transfer_path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+		result = out >= 0;
+		for (i = 0; i < nparts && result; i++) {
+			char *part = string_format("%s.part%" PRId64, transfer_path, i);
+			int64_t length = MIN(c->url_part_size, (int64_t)f->size - i * c->url_part_size);
+			struct stat info;
+			int in = open(part, O_RDONLY);
+			if (in < 0 || fstat(in, &info) < 0 || info.st_size != length || copy_fd_to_fd(in, out) != length) {
+				*error_message = string_format("couldn't fetch range %" PRId64 " of %s", i, f->source);
+				result = 0;
+			}
+			if (in >= 0)
+				close(in);
+			free(part);
+		}
+		if (out >= 0)
+			close(out);
+	}
+
+	for (i = 0; i < nparts; i++) {
+		char *part = string_format("%s.part%" PRId64, transfer_path, i);
+		unlink(part);
+		free(part);
+	}
+
+	buffer_free(&command);
+	return result;
+}
+
+/*
+Transfer a single regular file from a file:// url by copying it directly,
+which lets the kernel copy or clone its data without going through curl.
+Returns -1 if the source is not a plain local file, so that curl handles it.
+*/
+
+static int do_local_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *transfer_path, char **error_message)
+{
+	const char *path = f->source + 7;
+	struct stat info;
+
+	if (strchr(path, '%') || stat(path, &info) < 0 || !S_ISREG(info.st_mode))
+		return -1;
+
+	if (copy_file_to_file(path, transfer_path) != info.st_size) {
+		*error_message = string_format("couldn't copy %s: %s", path, strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
 /*
 Create a file by executing a mini_task, which should produce the desired cachename.
 The mini_task uses all the normal machinery to run a task synchronously,
@@ -454,22 +1271,12 @@ static int rewrite_source_to_ip(struct vine_cache_file *f, char **error_message)
 }
 
 /*
-Transfer a single input file from a worker url to a local file name.
+Connect to the transfer server of a peer worker and authenticate if needed.
 */
-static int do_worker_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *cachename, char **error_message)
-{
-	int port_num;
-	char addr[VINE_LINE_MAX], source_path[VINE_LINE_MAX];
-	int stoptime;
-	struct link *worker_link;
-
-	// expect the form: workerip://host:port/path/to/file
-	sscanf(f->source, "workerip://%256[^:]:%d/%s", addr, &port_num, source_path);
 
-	debug(D_VINE, "cache: setting up worker transfer file %s", f->source);
-
-	stoptime = time(0) + 15;
-	worker_link = link_connect(addr, port_num, stoptime);
+static struct link *connect_to_peer(const char *addr, int port_num, char **error_message)
+{
+	struct link *worker_link = link_connect(addr, port_num, time(0) + 15);
 
 	if (worker_link == NULL) {
 		*error_message = string_format("Could not establish connection with worker at: %s:%d", addr, port_num);
@@ -484,16 +1291,28 @@ static int do_worker_transfer(struct vine_cache *c, struct vine_cache_file *f, c
 		}
 	}
 
+	return worker_link;
+}
+
+/*
+Transfer a whole cached object from a peer worker into the transfer directory.
+*/
+
+static int do_worker_transfer_from(struct vine_cache *c, const char *addr, int port_num, const char *source_path, char **error_message)
+{
+	struct link *worker_link = connect_to_peer(addr, port_num, error_message);
+	if (!worker_link)
+		return 0;
+
 	/* XXX A fixed timeout of 900 certainly can't be right! */
 
 	char *transfer_dir = vine_cache_transfer_path(c, ".");
 	int64_t totalsize;
 	int mode, mtime;
 
-	if (!vine_transfer_request_any(worker_link, source_path, transfer_dir, &totalsize, &mode, &mtime, time(0) + 900)) {
-		*error_message = string_format("Could not transfer file from %s", f->source);
-		link_close(worker_link);
-		return 0;
+	int result = vine_transfer_request_any(worker_link, source_path, transfer_dir, &totalsize, &mode, &mtime, time(0) + 900);
+	if (!result) {
+		*error_message = string_format("Could not transfer file from workerip://%s:%d/%s", addr, port_num, source_path);
 	}
 
 	free(transfer_dir);
@@ -502,7 +1321,162 @@ static int do_worker_transfer(struct vine_cache *c, struct vine_cache_file *f, c
 
 	link_close(worker_link);
 
-	return 1;
+	return result;
+}
+
+/*
+Transfer a single input file from a worker url to a local file name.
+*/
+static int do_worker_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *cachename, char **error_message)
+{
+	int port_num;
+	char addr[VINE_LINE_MAX], source_path[VINE_LINE_MAX];
+
+	// expect the form: workerip://host:port/path/to/file
+	sscanf(f->source, "workerip://%256[^:]:%d/%s", addr, &port_num, source_path);
+
+	debug(D_VINE, "cache: setting up worker transfer file %s", f->source);
+
+	return do_worker_transfer_from(c, addr, port_num, source_path, error_message);
+}
+
+/*
+Fetch one byte range of a striped transfer into the already created
+transfer file.  Runs in its own process, so that every range is
+received in parallel from a different peer.
+*/
+
+static int do_stripe_range(const char *transfer_path, const char *addr, int port_num, const char *source_path, int64_t offset, int64_t length)
+{
+	char *error_message = 0;
+
+	int fd = open(transfer_path, O_WRONLY);
+	if (fd < 0) {
+		debug(D_VINE, "cache: could not open %s: %s", transfer_path, strerror(errno));
+		return 0;
+	}
+
+	int result = 0;
+	struct link *worker_link = connect_to_peer(addr, port_num, &error_message);
+	if (worker_link) {
+		result = vine_transfer_request_range(worker_link, source_path, fd, offset, length, time(0) + 900);
+		link_close(worker_link);
+	} else {
+		debug(D_VINE, "cache: %s", error_message);
+		free(error_message);
+	}
+
+	if (close(fd) < 0)
+		result = 0;
+
+	return result;
+}
+
+/*
+Transfer a regular file by fetching byte ranges from several peer workers at once.
+The manager plans the ranges, and gives them in the form:
+workerstripe://host:port:offset:length,host:port:offset:length,.../path/to/file
+If any range fails, fall back to fetching the whole file from the first peer.
+*/
+
+static int do_worker_stripe_transfer(struct vine_cache *c, struct vine_cache_file *f, const char *cachename, char **error_message)
+{
+	char *ranges = xxstrdup(f->source + 15);
+	char *path = strchr(ranges, '/');
+	if (!path) {
+		*error_message = string_format("Invalid striped source %s", f->source);
+		free(ranges);
+		return 0;
+	}
+	*path++ = 0;
+
+	char *transfer_path = vine_cache_transfer_path(c, cachename);
+	char first_addr[VINE_LINE_MAX];
+	int first_port = 0;
+	int64_t total_length = 0;
+	int nranges = 0;
+	int failed = 0;
+
+	int fd = open(transfer_path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+	if (fd < 0) {
+		*error_message = string_format("Could not create %s: %s", transfer_path, strerror(errno));
+		free(transfer_path);
+		free(ranges);
+		return 0;
+	}
+	close(fd);
+
+	debug(D_VINE, "cache: setting up striped transfer of %s", path);
+
+	/* Keep the pids so that only our own stripes are reaped, not other children of the worker. */
+	int maxranges = 1;
+	const char *s;
+	for (s = ranges; *s; s++) {
+		if (*s == ',')
+			maxranges++;
+	}
+	pid_t *pids = xxmalloc(maxranges * sizeof(pid_t));
+
+	char *saveptr;
+	char *range;
+	for (range = strtok_r(ranges, ",", &saveptr); range; range = strtok_r(0, ",", &saveptr)) {
+		char addr[VINE_LINE_MAX];
+		int port_num;
+		int64_t offset, length;
+
+		if (sscanf(range, "%256[^:]:%d:%" SCNd64 ":%" SCNd64, addr, &port_num, &offset, &length) != 4) {
+			failed = 1;
+			break;
+		}
+
+		if (!nranges) {
+			strcpy(first_addr, addr);
+			first_port = port_num;
+		}
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			_exit(!do_stripe_range(transfer_path, addr, port_num, path, offset, length));
+		} else if (pid < 0) {
+			failed = 1;
+			break;
+		}
+
+		pids[nranges++] = pid;
+		total_length += length;
+	}
+
+	int i;
+	for (i = 0; i < nranges; i++) {
+		int status;
+		pid_t waited;
+		do {
+			waited = waitpid(pids[i], &status, 0);
+		} while (waited < 0 && errno == EINTR);
+		if (waited < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+
+	free(pids);
+
+	if (!failed && nranges > 0) {
+		debug(D_VINE, "cache: received %" PRId64 " bytes of %s in %d stripes", total_length, path, nranges);
+	}
+
+	int result = !failed && nranges > 0;
+	if (!result && first_port) {
+		debug(D_VINE, "cache: striped transfer of %s failed, fetching it whole from %s:%d", path, first_addr, first_port);
+		unlink(transfer_path);
+		result = do_worker_transfer_from(c, first_addr, first_port, path, error_message);
+	} else if (!result) {
+		*error_message = string_format("Invalid striped source %s", f->source);
+	}
+
+	free(transfer_path);
+	free(ranges);
+
+	return result;
 }
 
 /*
@@ -521,13 +1495,21 @@ static int do_transfer(struct vine_cache *c, struct vine_cache_file *f, const ch
 
 	if (strncmp(f->source, "workerip://", 11) == 0) {
 		result = do_worker_transfer(c, f, cachename, error_message);
+	} else if (strncmp(f->source, "workerstripe://", 15) == 0) {
+		result = do_worker_stripe_transfer(c, f, cachename, error_message);
 	} else if (strncmp(f->source, "worker://", 9) == 0) {
 		result = rewrite_source_to_ip(f, error_message);
 		if (result) {
 			result = do_worker_transfer(c, f, cachename, error_message);
 		}
 	} else {
-		result = do_curl_transfer(c, f, transfer_path, cache_path, error_message);
+		result = -1;
+		if (strncmp(f->source, "file://", 7) == 0) {
+			result = do_local_transfer(c, f, transfer_path, error_message);
+		}
+		if (result < 0) {
+			result = do_curl_transfer(c, f, transfer_path, cache_path, error_message);
+		}
 	}
 
 	if (!result)
@@ -584,6 +1566,22 @@ static void vine_cache_worker_process(struct vine_cache_file *f, struct vine_cac
 	exit(result == 0);
 }
 
+/*
+Return the status of a cached entry without starting to materialize it.
+*/
+
+vine_cache_status_t vine_cache_status(struct vine_cache *c, const char *cachename)
+{
+	if (!strcmp(cachename, "0"))
+		return VINE_CACHE_STATUS_READY;
+
+	struct vine_cache_file *f = hash_table_lookup(c->table, cachename);
+	if (!f)
+		return VINE_CACHE_STATUS_UNKNOWN;
+
+	return f->status;
+}
+
 /*
 Ensure that a given cached entry is fully materialized in the cache,
 downloading files or executing commands as needed.  If complete, return
@@ -736,6 +1734,22 @@ static void vine_cache_check_outputs(struct vine_cache *c, struct vine_cache_fil
 		f->status = VINE_CACHE_STATUS_FAILED;
 	}
 
+	if (f->status == VINE_CACHE_STATUS_READY) {
+		c->stats.transfers++;
+		c->stats.bytes_transferred += f->size;
+		c->stats.transfer_time += transfer_time;
+	} else {
+		c->stats.transfers_failed++;
+	}
+
+	if (vine_trace_enabled()) {
+		struct jx *args = jx_objectv("cachename", jx_string(cachename), "status", jx_string(f->status == VINE_CACHE_STATUS_READY ? "ready" : "failed"), NULL);
+		if (f->status == VINE_CACHE_STATUS_READY) {
+			jx_insert_integer(args, "size", f->size);
+		}
+		vine_trace_span(f->cache_type == VINE_CACHE_MINI_TASK ? "mini_task" : "transfer", VINE_TRACE_CACHE_TRACK, f->start_time, f->stop_time, args);
+	}
+
 	/* Finally send a cache update message one way or the other. */
 	/* Note that manager could be null if we are in a shutdown situation. */
 
@@ -22,7 +22,9 @@ for file transfers to occur asynchronously of the manager.
 
 #include "vine_file.h"
 
+#include "hash_table.h"
 #include "link.h"
+#include "list.h"
 
 typedef enum {
 	VINE_CACHE_FILE,               /**< A normal file provided by the manager. */
@@ -44,6 +46,29 @@ typedef enum {
 	VINE_CACHE_STATUS_UNKNOWN,      /**< File is not known at all to the cache manager. */
 } vine_cache_status_t;
 
+typedef enum {
+	VINE_CACHE_EVICTION_NONE,       /**< Never evict objects to free space. */
+	VINE_CACHE_EVICTION_LRU,        /**< Evict the least recently used objects first. */
+	VINE_CACHE_EVICTION_LFU,        /**< Evict the least frequently used objects first. */
+	VINE_CACHE_EVICTION_GDSF,       /**< Evict objects that are rarely used, large, and quick to obtain again first. */
+} vine_cache_eviction_t;
+
+/* Counts of the objects in a cache, and of the work done on them since the cache was created. */
+
+struct vine_cache_stats {
+	int64_t objects;           /* Objects present and ready to use. */
+	int64_t bytes;             /* Total size of the objects ready to use. */
+	int64_t objects_pending;   /* Objects known but not yet present. */
+	int64_t transfers;         /* Objects created by a transfer or mini task. */
+	int64_t transfers_failed;  /* Transfers or mini tasks that failed. */
+	int64_t bytes_transferred; /* Total size of the objects created by a transfer or mini task. */
+	timestamp_t transfer_time; /* Total time spent creating objects by a transfer or mini task. */
+	int64_t accesses;          /* Uses of an object by a task. */
+	int64_t reuses;            /* Uses of an object already used by an earlier task. */
+	int64_t evictions;         /* Objects evicted to free space. */
+	int64_t bytes_evicted;     /* Total size of the objects evicted. */
+};
+
 struct vine_cache * vine_cache_create( const char *cachedir );
 void vine_cache_delete( struct vine_cache *c );
 void vine_cache_load( struct vine_cache *c );
@@ -60,8 +85,23 @@ int vine_cache_add_transfer( struct vine_cache *c, const char *cachename, const
 int vine_cache_add_mini_task( struct vine_cache *c, const char *cachename, const char *source, struct vine_task *mini_task, vine_cache_level_t level, int mode, uint64_t size );
 
 vine_cache_status_t vine_cache_ensure( struct vine_cache *c, const char *cachename);
+vine_cache_status_t vine_cache_status( struct vine_cache *c, const char *cachename );
 int vine_cache_remove( struct vine_cache *c, const char *cachename, struct link *manager );
+int vine_cache_rename( struct vine_cache *c, const char *old_name, const char *new_name );
 int vine_cache_contains( struct vine_cache *c, const char *cachename );
+
+void vine_cache_add_chunks( struct vine_cache *c, const char *cachename, struct list *chunks );
+int vine_cache_read_chunk( struct vine_cache *c, const char *hash, int64_t length, char *data );
+
+void vine_cache_access( struct vine_cache *c, const char *cachename );
+void vine_cache_mark_output( struct vine_cache *c, const char *cachename );
+int64_t vine_cache_size( struct vine_cache *c );
+void vine_cache_get_stats( struct vine_cache *c, struct vine_cache_stats *s );
+
+int vine_cache_eviction_from_string( const char *name, vine_cache_eviction_t *policy );
+void vine_cache_set_eviction( struct vine_cache *c, vine_cache_eviction_t policy );
+void vine_cache_set_url_streams( struct vine_cache *c, int streams, int64_t part_size );
+int64_t vine_cache_evict( struct vine_cache *c, int64_t bytes, struct hash_table *in_use, struct link *manager );
 int vine_cache_wait( struct vine_cache *c, struct link *manager );
 
 #endif
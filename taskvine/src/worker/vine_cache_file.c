@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "vine_protocol.h"
 
 #include "debug.h"
+#include "list.h"
 #include "path_disk_size_info.h"
 #include "xxmalloc.h"
 
@@ -38,6 +39,10 @@ void vine_cache_file_delete(struct vine_cache_file *f)
 	if (f->process) {
 		vine_process_delete(f->process);
 	}
+	if (f->chunks) {
+		list_clear(f->chunks, free);
+		list_delete(f->chunks);
+	}
 	free(f->source);
 	free(f);
 }
@@ -35,6 +35,15 @@ struct vine_cache_file {
 	uint64_t size;                  // summed size of the file or dir tree in bytes
 	time_t mtime;                   // source mtime of original object
 	timestamp_t transfer_time;      // time to transfer (or create) the object
+
+	/* Usage tracked in memory to choose files to evict. */
+	timestamp_t last_access;        // last time the object was linked into a sandbox
+	int64_t access_count;           // number of times the object was linked into a sandbox
+	double inflation;               // eviction clock of the cache at the last access, for GDSF
+	int task_output;                // produced by a task here, and so cannot be obtained again
+
+	/* Hashes of the chunks found in this object by the chunk index of the cache. */
+	struct list *chunks;
 };
 
 struct vine_cache_file *vine_cache_file_create( vine_cache_type_t type, const char *source, struct vine_task *mini_task);
@@ -7,25 +7,78 @@ See the file COPYING for details.
 #include "vine_gpus.h"
 #include "buffer.h"
 #include "debug.h"
+#include "gpu_info.h"
+#include "list.h"
+#include "macros.h"
+#include "stringtools.h"
 
-/* Array tracks which task is assigned to each GPU. */
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Each GPU device is divided into a number of slots, which are the
+unit of GPUs reported to the manager and requested by tasks. With
+one slot per device, a task holds whole GPUs. With more, several
+small tasks share a device, as under NVIDIA MPS.
+*/
+
+/* Array tracks which task is assigned to each GPU slot. */
 static int *gpu_to_task = 0;
 
-/* Total number of initialized gpus */
+/* Total number of initialized gpu slots */
 static int gpu_count = 0;
 
+/* Number of slots into which each device is divided. */
+static int slots_per_device = 1;
+
+/* Names of the devices, as given in CUDA_VISIBLE_DEVICES. */
+static char **device_names = 0;
+
+/* Total number of devices */
+static int device_count = 0;
+
 /*
-Initialize the GPU tracking state.
+Initialize the GPU tracking state, with ngpus devices divided
+into slots each, and return the number of slots.
+If MIG partitions are configured and detect_mig is true,
+each partition is a device in place of the whole gpus.
 Note that this may be called many times,
 but should only initialized once.
 */
 
-void vine_gpus_init(int ngpus)
+int vine_gpus_init(int ngpus, int slots, int detect_mig)
 {
-	if (!gpu_to_task) {
-		gpu_to_task = calloc(ngpus, sizeof(int));
-		gpu_count = ngpus;
+	if (gpu_to_task)
+		return gpu_count;
+
+	slots_per_device = MAX(slots, 1);
+
+	struct list *mig_uuids = detect_mig && ngpus > 0 ? gpu_mig_uuids_get() : list_create();
+
+	if (list_size(mig_uuids) > 0) {
+		device_count = list_size(mig_uuids);
+		device_names = calloc(device_count, sizeof(char *));
+		int i = 0;
+		char *uuid;
+		while ((uuid = list_pop_head(mig_uuids))) {
+			device_names[i++] = uuid;
+		}
+		debug(D_VINE, "using %d MIG partitions as gpus", device_count);
+	} else {
+		device_count = MAX(ngpus, 0);
+		device_names = calloc(device_count, sizeof(char *));
+		int i;
+		for (i = 0; i < device_count; i++) {
+			device_names[i] = string_format("%d", i);
+		}
 	}
+
+	list_delete(mig_uuids);
+
+	gpu_count = device_count * slots_per_device;
+	gpu_to_task = calloc(MAX(gpu_count, 1), sizeof(int));
+
+	return gpu_count;
 }
 
 /*
@@ -39,6 +92,9 @@ void vine_gpus_debug()
 	buffer_putfstring(&b, "GPUs Assigned to Tasks: [ ");
 	int i;
 	for (i = 0; i < gpu_count; i++) {
+		if (slots_per_device > 1 && i > 0 && i % slots_per_device == 0) {
+			buffer_putfstring(&b, "| ");
+		}
 		buffer_putfstring(&b, "%d ", gpu_to_task[i]);
 	}
 	buffer_putfstring(&b, " ]");
@@ -60,8 +116,51 @@ void vine_gpus_free(int task_id)
 	}
 }
 
+static int device_free_slots(int d)
+{
+	int free_slots = 0;
+	int i;
+	for (i = d * slots_per_device; i < (d + 1) * slots_per_device; i++) {
+		if (gpu_to_task[i] == 0) {
+			free_slots++;
+		}
+	}
+	return free_slots;
+}
+
+/*
+Choose the device for the next slots of a request of n slots.
+Among the devices with room for all of them, take the fullest one,
+so that small tasks are packed together and whole devices are left
+for large tasks. If none has room for all, take the emptiest one,
+so that the request is spread over as few devices as possible.
+*/
+
+static int choose_device(int n)
+{
+	int best = -1;
+	int best_free = 0;
+	int best_fits = 0;
+
+	int d;
+	for (d = 0; d < device_count; d++) {
+		int free_slots = device_free_slots(d);
+		if (free_slots == 0)
+			continue;
+
+		int fits = free_slots >= n;
+		if (best < 0 || (fits && !best_fits) || (fits && free_slots < best_free) || (!fits && !best_fits && free_slots > best_free)) {
+			best = d;
+			best_free = free_slots;
+			best_fits = fits;
+		}
+	}
+
+	return best;
+}
+
 /*
-Allocate n specific GPUs to the given task.
+Allocate n specific GPU slots to the given task.
 This assumes the total number of GPUs has been
 accurately tracked: this function will fatal()
 if not enough are available.
@@ -69,11 +168,17 @@ if not enough are available.
 
 void vine_gpus_allocate(int n, int task)
 {
-	int i;
-	for (i = 0; i < gpu_count && n > 0; i++) {
-		if (gpu_to_task[i] == 0) {
-			gpu_to_task[i] = task;
-			n--;
+	while (n > 0) {
+		int d = choose_device(n);
+		if (d < 0)
+			break;
+
+		int i;
+		for (i = d * slots_per_device; i < (d + 1) * slots_per_device && n > 0; i++) {
+			if (gpu_to_task[i] == 0) {
+				gpu_to_task[i] = task;
+				n--;
+			}
 		}
 	}
 
@@ -84,28 +189,61 @@ void vine_gpus_allocate(int n, int task)
 }
 
 /*
-Return a string representing the GPUs allocated to task_id.
+Return a string representing the GPU devices allocated to task_id.
 For example, if GPUs 1 and 3 are allocated, return "1,3"
 This string must be freed after use.
 */
 
 char *vine_gpus_to_string(int task_id)
 {
-	int i;
+	int d, i;
 	int first = 1;
 	buffer_t b;
 	buffer_init(&b);
-	for (i = 0; i < gpu_count; i++) {
-		if (gpu_to_task[i] == task_id) {
-			if (first) {
-				first = 0;
-			} else {
-				buffer_putfstring(&b, ",");
+	for (d = 0; d < device_count; d++) {
+		for (i = d * slots_per_device; i < (d + 1) * slots_per_device; i++) {
+			if (gpu_to_task[i] == task_id) {
+				if (first) {
+					first = 0;
+				} else {
+					buffer_putfstring(&b, ",");
+				}
+				buffer_putfstring(&b, "%s", device_names[d]);
+				break;
 			}
-			buffer_putfstring(&b, "%d", i);
 		}
 	}
 	char *str = strdup(buffer_tostring(&b));
 	buffer_free(&b);
 	return str;
 }
+
+/*
+Return the percent of a device that task_id may use, as given
+by the most slots it holds on any one device.
+*/
+
+int vine_gpus_share(int task_id)
+{
+	int most = 0;
+	int d, i;
+	for (d = 0; d < device_count; d++) {
+		int held = 0;
+		for (i = d * slots_per_device; i < (d + 1) * slots_per_device; i++) {
+			if (gpu_to_task[i] == task_id) {
+				held++;
+			}
+		}
+		most = MAX(most, held);
+	}
+	return 100 * most / slots_per_device;
+}
+
+/*
+Return the number of slots into which each device is divided.
+*/
+
+int vine_gpus_slots_per_device()
+{
+	return slots_per_device;
+}
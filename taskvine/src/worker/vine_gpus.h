@@ -7,10 +7,12 @@ See the file COPYING for details.
 #ifndef VINE_GPUS_H
 #define VINE_GPUS_H
 
-void vine_gpus_init( int ngpus );
+int vine_gpus_init( int ngpus, int slots, int detect_mig );
 void vine_gpus_debug();
 void vine_gpus_free( int task_id );
 void vine_gpus_allocate( int n, int task );
 char *vine_gpus_to_string( int task_id );
+int vine_gpus_share( int task_id );
+int vine_gpus_slots_per_device();
 
 #endif
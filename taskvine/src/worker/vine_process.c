@@ -15,7 +15,9 @@ See the file COPYING for details.
 #include "vine_worker.h"
 #include "vine_cache.h"
 
+#include "buffer.h"
 #include "change_process_title.h"
+#include "cpu_allocator.h"
 #include "create_dir.h"
 #include "debug.h"
 #include "domain_name.h"
@@ -38,6 +40,7 @@ See the file COPYING for details.
 #include <fcntl.h>
 #include <math.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,6 +53,7 @@ See the file COPYING for details.
 #include <sys/wait.h>
 
 extern struct vine_cache *cache_manager;
+extern struct cpu_allocator *worker_cpus;
 
 /*
 Give the letter code used for the process sandbox dir.
@@ -93,6 +97,7 @@ struct vine_process *vine_process_create(struct vine_task *task, vine_process_ty
 	p->tmpdir = string_format("%s/.taskvine.tmp", p->sandbox);
 	p->output_file_name = string_format("%s/.taskvine.stdout", p->sandbox);
 	p->output_length = 0;
+	p->disk_fs_used = -1;
 
 	p->functions_running = 0;
 	p->library_ready = 0;
@@ -129,6 +134,8 @@ void vine_process_delete(struct vine_process *p)
 	if (p->tmpdir)
 		free(p->tmpdir);
 
+	free(p->cpus);
+
 	free(p);
 }
 
@@ -169,40 +176,229 @@ static void export_environment(struct vine_process *p)
 	}
 }
 
-static void set_integer_env_var(struct vine_process *p, const char *name, int64_t value)
+static void set_integer_env_var(struct list *env_list, const char *name, int64_t value)
 {
-	char *value_str = string_format("%" PRId64, value);
-	vine_task_set_env_var(p->task, name, value_str);
-	free(value_str);
+	list_push_tail(env_list, string_format("%s=%" PRId64, name, value));
 }
 
-static void set_resources_vars(struct vine_process *p)
+/*
+Convert a list of cpus such as 0-3,8 into the OpenMP places {0}:4,{8},
+so that the threads of an OpenMP task are bound to the cpus of the task.
+*/
+
+static char *cpus_to_omp_places(const char *cpus)
+{
+	buffer_t b;
+	buffer_init(&b);
+
+	const char *s = cpus;
+	while (*s) {
+		char *end;
+		long first = strtol(s, &end, 10);
+		long last = first;
+		s = end;
+		if (*s == '-') {
+			last = strtol(s + 1, &end, 10);
+			s = end;
+		}
+		if (buffer_pos(&b) > 0)
+			buffer_putliteral(&b, ",");
+		if (last > first)
+			buffer_printf(&b, "{%ld}:%ld", first, last - first + 1);
+		else
+			buffer_printf(&b, "{%ld}", first);
+		if (*s != ',')
+			break;
+		s++;
+	}
+
+	char *result = xxstrdup(buffer_tostring(&b));
+	buffer_free(&b);
+	return result;
+}
+
+/* Append the variables describing the resources of the task to env_list. */
+
+static void set_resources_vars(struct vine_process *p, struct list *env_list)
 {
 	if (p->task->resources_requested->cores > 0) {
-		set_integer_env_var(p, "CORES", p->task->resources_requested->cores);
-		set_integer_env_var(p, "OMP_NUM_THREADS", p->task->resources_requested->cores);
-		set_integer_env_var(p, "OPENBLAS_NUM_THREADS", p->task->resources_requested->cores);
-		set_integer_env_var(p, "VECLIB_NUM_THREADS", p->task->resources_requested->cores);
-		set_integer_env_var(p, "MKL_NUM_THREADS", p->task->resources_requested->cores);
-		set_integer_env_var(p, "NUMEXPR_NUM_THREADS", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "CORES", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "OMP_NUM_THREADS", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "OPENBLAS_NUM_THREADS", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "VECLIB_NUM_THREADS", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "MKL_NUM_THREADS", p->task->resources_requested->cores);
+		set_integer_env_var(env_list, "NUMEXPR_NUM_THREADS", p->task->resources_requested->cores);
 	}
 
 	if (p->task->resources_requested->memory > 0) {
-		set_integer_env_var(p, "MEMORY", p->task->resources_requested->memory);
+		set_integer_env_var(env_list, "MEMORY", p->task->resources_requested->memory);
 	}
 
 	if (p->task->resources_requested->disk > 0) {
-		set_integer_env_var(p, "DISK", p->task->resources_requested->disk);
+		set_integer_env_var(env_list, "DISK", p->task->resources_requested->disk);
 	}
 
 	if (p->task->resources_requested->gpus > 0) {
-		set_integer_env_var(p, "GPUS", p->task->resources_requested->gpus);
+		set_integer_env_var(env_list, "GPUS", p->task->resources_requested->gpus);
 		char *str = vine_gpus_to_string(p->task->task_id);
-		vine_task_set_env_var(p->task, "CUDA_VISIBLE_DEVICES", str);
+		list_push_tail(env_list, string_format("CUDA_VISIBLE_DEVICES=%s", str));
 		free(str);
+		/* A task holding part of a shared device is limited to its share under MPS. */
+		if (vine_gpus_slots_per_device() > 1) {
+			list_push_tail(env_list, string_format("CUDA_MPS_ACTIVE_THREAD_PERCENTAGE=%d", vine_gpus_share(p->task->task_id)));
+		}
+	}
+
+	if (p->cpus) {
+		char *places = cpus_to_omp_places(p->cpus);
+		list_push_tail(env_list, string_format("OMP_PLACES=%s", places));
+		free(places);
+	}
+}
+
+#ifdef HAS_POSIX_SPAWN_ADDCHDIR
+
+/*
+Set or, given a name without =, remove one variable
+in a null-terminated environment array of length *count.
+*/
+
+static char **environment_apply(char **env, int *count, const char *spec)
+{
+	const char *equals = strchr(spec, '=');
+	size_t namelen = equals ? (size_t)(equals - spec) : strlen(spec);
+
+	int i;
+	for (i = 0; i < *count; i++) {
+		if (!strncmp(env[i], spec, namelen) && env[i][namelen] == '=') {
+			free(env[i]);
+			if (equals) {
+				env[i] = xxstrdup(spec);
+			} else {
+				env[i] = env[*count - 1];
+				env[*count - 1] = 0;
+				(*count)--;
+			}
+			return env;
+		}
+	}
+
+	if (equals) {
+		env = xxrealloc(env, (*count + 2) * sizeof(char *));
+		env[(*count)++] = xxstrdup(spec);
+		env[*count] = 0;
+	}
+
+	return env;
+}
+
+/*
+Build the environment of a task without touching the environment of the worker,
+with the same result as clear_environment, set_resources_vars, and export_environment
+give in a forked child.  The result must be freed with environment_free.
+*/
+
+static char **environment_create(struct vine_process *p)
+{
+	extern char **environ;
+
+	int count = 0;
+	while (environ[count])
+		count++;
+
+	char **env = xxmalloc((count + 1) * sizeof(char *));
+	int i;
+	for (i = 0; i < count; i++)
+		env[i] = xxstrdup(environ[i]);
+	env[count] = 0;
+
+	env = environment_apply(env, &count, "DISPLAY");
+
+	struct list *resources_list = list_create();
+	set_resources_vars(p, resources_list);
+
+	char *spec;
+	LIST_ITERATE(p->task->env_list, spec)
+	{
+		env = environment_apply(env, &count, spec);
+	}
+	LIST_ITERATE(resources_list, spec)
+	{
+		env = environment_apply(env, &count, spec);
 	}
+	list_clear(resources_list, free);
+	list_delete(resources_list);
+
+	if (p->tmpdir) {
+		const char *names[] = {"TMPDIR", "TEMP", "TMP"};
+		for (i = 0; i < 3; i++) {
+			char *tmpspec = string_format("%s=%s", names[i], p->tmpdir);
+			env = environment_apply(env, &count, tmpspec);
+			free(tmpspec);
+		}
+	}
+
+	return env;
+}
+
+static void environment_free(char **env)
+{
+	int i;
+	for (i = 0; env[i]; i++)
+		free(env[i]);
+	free(env);
 }
 
+/*
+Start an ordinary task with posix_spawn instead of fork.
+The C library creates the child without copying the page
+tables of the worker, which are large with a big cache.
+The child is set up in the same way as in vine_process_execute.
+*/
+
+static int vine_process_spawn(struct vine_process *p, int stdin_fd, int stdout_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addchdir_np(&actions, p->sandbox);
+	posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDERR_FILENO);
+	posix_spawn_file_actions_addclose(&actions, stdin_fd);
+	posix_spawn_file_actions_addclose(&actions, stdout_fd);
+
+	/* Make the child the leader of its own process group, as kill_task expects. */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+
+	char **env = environment_create(p);
+	char *argv[] = {"sh", "-c", p->task->command_line, 0};
+
+	p->execution_start = timestamp_get();
+	int result = posix_spawn(&p->pid, "/bin/sh", &actions, &attr, argv, env);
+
+	environment_free(env);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	close(stdin_fd);
+	close(stdout_fd);
+
+	if (result != 0) {
+		debug(D_VINE, "couldn't spawn new process: %s\n", strerror(result));
+		return 0;
+	}
+
+	debug(D_VINE, "spawned task %d pid %d: %s", p->task->task_id, p->pid, p->task->command_line);
+
+	return 1;
+}
+
+#endif
+
 /*
 After a process exit has been observed, record the completion in the process structure.
 */
@@ -211,6 +407,7 @@ static void vine_process_complete(struct vine_process *p, int status)
 {
 	if (!WIFEXITED(status)) {
 		p->exit_code = WTERMSIG(status);
+		p->exit_signal = WTERMSIG(status);
 		debug(D_VINE, "task %d (pid %d) exited abnormally with signal %d", p->task->task_id, p->pid, p->exit_code);
 	} else {
 		p->exit_code = WEXITSTATUS(status);
@@ -306,6 +503,14 @@ int vine_process_execute(struct vine_process *p)
 	}
 	stderr_fd = stdout_fd;
 
+#ifdef HAS_POSIX_SPAWN_ADDCHDIR
+	/* A library needs its pipes and the worker pid, so it is always forked.
+	 * So is a task bound to cpus, as posix_spawn cannot set the affinity of the child. */
+	if (options->task_launch == VINE_TASK_LAUNCH_SPAWN && p->type != VINE_PROCESS_TYPE_LIBRARY && !p->cpus) {
+		return vine_process_spawn(p, stdin_fd, stdout_fd);
+	}
+#endif
+
 	/* Start the performance clock just prior to forking the task. */
 	p->execution_start = timestamp_get();
 	p->pid = fork();
@@ -379,11 +584,16 @@ int vine_process_execute(struct vine_process *p)
 			close(pipe_out[0]);
 		}
 
+		/* Restrict the task to its own cpus, and prefer the memory of their numa node. */
+		if (p->cpus) {
+			cpu_allocator_bind(worker_cpus, p->cpus);
+		}
+
 		/* Remove undesired things from the environment. */
 		clear_environment();
 
 		/* Overwrite CORES, MEMORY, or DISK variables, if the task used set_* */
-		set_resources_vars(p);
+		set_resources_vars(p, p->task->env_list);
 
 		/* Finally, add things that were explicitly given in the task description. */
 		export_environment(p);
@@ -394,6 +604,12 @@ int vine_process_execute(struct vine_process *p)
 		if (p->type != VINE_PROCESS_TYPE_LIBRARY) {
 			execl("/bin/sh", "sh", "-c", p->task->command_line, (char *)0);
 		} else {
+			/* Libraries started with --zygote leave a process after their imports
+			 * here, to start later instances of the same library on this worker. */
+			char *zygote_dir = string_format("%s/zygotes", workspace->workspace_dir);
+			setenv("VINE_LIBRARY_ZYGOTE_DIR", zygote_dir, 1);
+			free(zygote_dir);
+
 			char *final_command = string_format("%s --in-pipe-fd %d --out-pipe-fd %d --task-id %d --library-cores %d --function-slots %d --worker-pid %d",
 					p->task->command_line,
 					in_pipe_fd,
@@ -37,11 +37,16 @@ struct vine_process {
 	pid_t pid;                /* If running, the Unix process ID. */
 	vine_result_t result;     /* If complete, the TaskVine result. */
 	int exit_code;            /* If successful, the Unix exit code. */
+	int exit_signal;          /* If complete and killed by a signal, the signal number, otherwise 0. */
 
 	struct rusage rusage;        /* If complete, the resources consumed. */
 	timestamp_t execution_start; /* Start time in microseconds. */
 	timestamp_t execution_end;   /* Stop time in microseconds. */
 
+	timestamp_t time_received;     /* When the task was received from the manager. */
+	timestamp_t time_inputs_ready; /* When all of the inputs were first found in the cache. */
+	timestamp_t time_reaped;       /* When the process ended and its outputs were staged out. */
+
 	char *sandbox;           /* The private sandbox directory to run in. */
 	char *tmpdir; 	         /* A temp dir inside the private sandbox. */
 	char *output_file_name;	 /* The intended standard output location. */
@@ -62,6 +67,9 @@ struct vine_process {
 	/* If this is a library process, whether the library is ready to execute functions. */
 	int library_ready;
 
+	/* With --core-affinity, the cpus the process is bound to, as a list such as 0-3,8. */
+	char *cpus;
+
 	/* expected disk usage by the process. If no cache is used, it is the same as in task. */
 	int64_t disk;
 
@@ -74,6 +82,10 @@ struct vine_process {
 
 	/* state between complete disk measurements. */
 	struct path_disk_size_info *disk_measurement_state;
+
+	/* bytes used in the workspace filesystem, and the time, at the last complete disk measurement. */
+	int64_t disk_fs_used;
+	time_t disk_measured_time;
 };
 
 struct vine_process * vine_process_create( struct vine_task *task, vine_process_type_t type );
@@ -35,14 +35,19 @@ Return VINE_STATUS_PROCESSING if some are not ready.
 Return VINE_STATUS_FAILED if some have definitely failed.
 */
 
-vine_cache_status_t vine_sandbox_ensure(struct vine_process *p, struct vine_cache *cache, struct link *manager)
+static vine_cache_status_t vine_sandbox_inputs_status(struct vine_process *p, struct vine_cache *cache, int fetch)
 {
 	int processing = 0;
 
 	struct vine_mount *m;
 	LIST_ITERATE(p->task->input_mounts, m)
 	{
-		vine_cache_status_t cache_status = vine_cache_ensure(cache, m->file->cached_name);
+		vine_cache_status_t cache_status;
+		if (fetch) {
+			cache_status = vine_cache_ensure(cache, m->file->cached_name);
+		} else {
+			cache_status = vine_cache_status(cache, m->file->cached_name);
+		}
 
 		switch (cache_status) {
 		case VINE_CACHE_STATUS_PENDING:
@@ -65,6 +70,20 @@ vine_cache_status_t vine_sandbox_ensure(struct vine_process *p, struct vine_cach
 	}
 }
 
+vine_cache_status_t vine_sandbox_ensure(struct vine_process *p, struct vine_cache *cache, struct link *manager)
+{
+	return vine_sandbox_inputs_status(p, cache, 1);
+}
+
+/*
+As vine_sandbox_ensure, but without starting to fetch any missing inputs.
+*/
+
+vine_cache_status_t vine_sandbox_check(struct vine_process *p, struct vine_cache *cache)
+{
+	return vine_sandbox_inputs_status(p, cache, 0);
+}
+
 /*
 Ensure that a given input file/dir/object is present in the cache,
 (which should have occurred from a prior transfer)
@@ -83,18 +102,24 @@ static int stage_input_file(struct vine_process *p, struct vine_mount *m, struct
 	if (status == VINE_CACHE_STATUS_READY) {
 		create_dir_parents(sandbox_path, 0777);
 		debug(D_VINE, "input: link %s -> %s", cache_path, sandbox_path);
-		if (m->flags & VINE_MOUNT_SYMLINK) {
+		if (m->flags & VINE_MOUNT_SYMLINK || options->stagein_mode == VINE_STAGEIN_SYMLINK) {
 			/* If the user has requested a symlink, just do that b/c it is faster for large dirs. */
 			result = symlink(cache_path, sandbox_path);
 			/* Change sense of Unix result to true/false. */
 			result = !result;
+		} else if (options->stagein_mode == VINE_STAGEIN_CLONE) {
+			/* Clone the object so the task may modify it without touching the cache. */
+			result = file_clone_recursive(cache_path, sandbox_path, 1);
 		} else {
 			/* Otherwise recursively hard-link the object into the sandbox. */
 			result = file_link_recursive(cache_path, sandbox_path, 1);
 		}
 
-		if (!result)
+		if (result) {
+			vine_cache_access(cache, f->cached_name);
+		} else {
 			debug(D_VINE, "couldn't link %s into sandbox as %s: %s", cache_path, sandbox_path, strerror(errno));
+		}
 	} else {
 		debug(D_VINE, "input: %s is not ready in the cache!", f->cached_name);
 		result = 0;
@@ -180,6 +205,7 @@ static int stage_output_file(struct vine_process *p, struct vine_mount *m, struc
 		debug(D_VINE, "output: moving %s to %s", sandbox_path, cache_path);
 		if (vine_cache_add_file(cache, f->cached_name, sandbox_path, f->cache_level, mode, size, mtime, transfer_time)) {
 			f->size = size;
+			vine_cache_mark_output(cache, f->cached_name);
 			vine_worker_send_cache_update(manager, f->cached_name, f->type, f->cache_level, f->size, mode, transfer_time, p->execution_start);
 			result = 1;
 		} else {
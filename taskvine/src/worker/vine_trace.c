@@ -0,0 +1,118 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "vine_trace.h"
+
+#include "debug.h"
+#include "jx_print.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static FILE *trace_file = 0;
+static pid_t trace_pid = 0;
+
+/*
+Events are written in the JSON array form of the trace format,
+one event per line.  The closing bracket is optional in that form,
+so that a trace cut short by a crash of the worker can still be read.
+Each event is flushed at once, so that no buffered events are
+duplicated by the exit of a process forked by the worker.
+*/
+
+static void write_event(struct jx *event)
+{
+	jx_print_stream(event, trace_file);
+	fprintf(trace_file, ",\n");
+	fflush(trace_file);
+	jx_delete(event);
+}
+
+static struct jx *metadata_event(const char *kind, int track, const char *name)
+{
+	struct jx *e = jx_object(0);
+	jx_insert_string(e, "name", kind);
+	jx_insert_string(e, "ph", "M");
+	jx_insert_integer(e, "pid", trace_pid);
+	jx_insert_integer(e, "tid", track);
+	jx_insert(e, jx_string("args"), jx_objectv("name", jx_string(name), NULL));
+	return e;
+}
+
+int vine_trace_open(const char *path, const char *worker_id)
+{
+	trace_file = fopen(path, "w");
+	if (!trace_file) {
+		debug(D_NOTICE, "could not open trace file %s: %s", path, strerror(errno));
+		return 0;
+	}
+
+	trace_pid = getpid();
+
+	fprintf(trace_file, "[\n");
+
+	struct jx *e = metadata_event("process_name", 0, "vine_worker");
+	jx_insert(jx_lookup(e, "args"), jx_string("worker_id"), jx_string(worker_id));
+	write_event(e);
+
+	vine_trace_track(VINE_TRACE_CACHE_TRACK, "cache");
+
+	return 1;
+}
+
+void vine_trace_close()
+{
+	if (!trace_file) {
+		return;
+	}
+
+	/* Replace the separator after the last event with the closing bracket. */
+	fseek(trace_file, -2, SEEK_END);
+	fprintf(trace_file, "\n]\n");
+	fclose(trace_file);
+	trace_file = 0;
+}
+
+int vine_trace_enabled()
+{
+	return trace_file != 0;
+}
+
+void vine_trace_track(int track, const char *name)
+{
+	if (!trace_file) {
+		return;
+	}
+
+	write_event(metadata_event("thread_name", track, name));
+}
+
+void vine_trace_span(const char *name, int track, timestamp_t start, timestamp_t end, struct jx *args)
+{
+	if (!trace_file) {
+		jx_delete(args);
+		return;
+	}
+
+	struct jx *e = jx_object(0);
+	jx_insert_string(e, "name", name);
+	jx_insert_string(e, "cat", track == VINE_TRACE_CACHE_TRACK ? "cache" : "task");
+	jx_insert_string(e, "ph", "X");
+	jx_insert_integer(e, "ts", start);
+	jx_insert_integer(e, "dur", end > start ? end - start : 0);
+	jx_insert_integer(e, "pid", trace_pid);
+	jx_insert_integer(e, "tid", track);
+	if (args) {
+		jx_insert(e, jx_string("args"), args);
+	}
+
+	write_event(e);
+}
+
+/* vim: set noexpandtab tabstop=8: */
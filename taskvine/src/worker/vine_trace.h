@@ -0,0 +1,37 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef VINE_TRACE_H
+#define VINE_TRACE_H
+
+/*
+Span tracing of the worker, enabled with --trace-file.
+Each step in the life of a task (receive, wait_inputs, wait_resources,
+stagein, start, execute, stageout, report) is written as one complete
+event in the Chrome trace event format, on a track named after the task,
+and each object created in the cache is written on a separate cache track.
+Times are absolute microseconds of the worker clock, so that the file can
+be merged with the transactions log of the manager by vine_trace_merge,
+or opened as it is in chrome://tracing or Perfetto.
+*/
+
+#include "jx.h"
+#include "timestamp.h"
+
+/* The track of the spans of the cache.  Tasks use their task_id as track. */
+#define VINE_TRACE_CACHE_TRACK 0
+
+int vine_trace_open(const char *path, const char *worker_id);
+void vine_trace_close();
+int vine_trace_enabled();
+
+/* Name the track of a task, or of the cache. */
+void vine_trace_track(int track, const char *name);
+
+/* Write a span from start to end on a track. The args object, if any, is consumed. */
+void vine_trace_span(const char *name, int track, timestamp_t start, timestamp_t end, struct jx *args);
+
+#endif
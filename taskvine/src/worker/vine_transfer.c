@@ -5,16 +5,22 @@ See the file COPYING for details.
 */
 
 #include "vine_transfer.h"
+#include "vine_manifest.h"
 #include "vine_protocol.h"
 
+#include "buffer.h"
 #include "debug.h"
+#include "full_io.h"
 #include "host_disk_info.h"
 #include "link.h"
+#include "list.h"
+#include "md5.h"
 #include "path.h"
 #include "stringtools.h"
 #include "trash.h"
 #include "unlink_recursive.h"
 #include "url_encode.h"
+#include "xxmalloc.h"
 
 #include <dirent.h>
 #include <errno.h>
@@ -169,6 +175,57 @@ int vine_transfer_put_any(struct link *lnk, struct vine_cache *cache, const char
 	return r;
 }
 
+/*
+Send one byte range of a cached regular file, as requested by a peer
+that is fetching different parts of the file from several sources.
+The range is preceded by an ordinary file header giving its length.
+*/
+
+int vine_transfer_put_range(struct link *lnk, struct vine_cache *cache, const char *filename, int64_t offset, int64_t length, time_t stoptime)
+{
+	char filename_encoded[VINE_LINE_MAX];
+	url_encode(path_basename(filename), filename_encoded, sizeof(filename_encoded));
+
+	char *cached_path = vine_cache_data_path(cache, filename);
+
+	struct stat info;
+	int fd = -1;
+
+	if (stat(cached_path, &info) != 0) {
+		goto access_failure;
+	} else if (!S_ISREG(info.st_mode)) {
+		errno = S_ISDIR(info.st_mode) ? EISDIR : EINVAL;
+		goto access_failure;
+	} else if (offset < 0 || length < 0 || offset + length > info.st_size) {
+		errno = ERANGE;
+		goto access_failure;
+	}
+
+	fd = open(cached_path, O_RDONLY, 0);
+	if (fd < 0 || lseek(fd, offset, SEEK_SET) != offset) {
+		goto access_failure;
+	}
+
+	send_message(lnk, "file %s %" PRId64 " 0%o %lld\n", filename_encoded, length, info.st_mode & 0777, (long long)info.st_mtime);
+	int64_t actual = link_stream_from_fd(lnk, fd, length, stoptime);
+	close(fd);
+	free(cached_path);
+
+	if (actual != length) {
+		debug(D_VINE, "Sending range of %s failed: bytes to send = %" PRId64 " and bytes actually sent = %" PRId64 ".", filename, length, actual);
+		return 0;
+	}
+
+	return 1;
+
+access_failure:
+	send_message(lnk, "error %s %d\n", filename_encoded, errno);
+	if (fd >= 0)
+		close(fd);
+	free(cached_path);
+	return 1;
+}
+
 /*
 Handle an incoming symbolic link inside the recursive protocol.
 The filename of the symlink was already given in the message,
@@ -351,3 +408,355 @@ int vine_transfer_request_any(struct link *lnk, const char *request_path, const
 	send_message(lnk, "get %s\n", request_path);
 	return vine_transfer_get_any(lnk, dirname, totalsize, mode, mtime, stoptime);
 }
+
+int vine_transfer_request_range(struct link *lnk, const char *request_path, int fd, int64_t offset, int64_t length, time_t stoptime)
+{
+	char line[VINE_LINE_MAX];
+	char name_encoded[VINE_LINE_MAX];
+	int64_t size;
+	int mode, mtime, errornum;
+
+	send_message(lnk, "getrange %s %" PRId64 " %" PRId64 "\n", request_path, offset, length);
+
+	if (!recv_message(lnk, line, sizeof(line), stoptime))
+		return 0;
+
+	if (sscanf(line, "file %s %" SCNd64 " %o %d", name_encoded, &size, &mode, &mtime) == 4) {
+		if (size != length) {
+			debug(D_VINE, "peer sent %" PRId64 " bytes of %s instead of the %" PRId64 " requested", size, request_path, length);
+			return 0;
+		}
+		if (lseek(fd, offset, SEEK_SET) != offset) {
+			debug(D_VINE, "Could not seek to offset %" PRId64 " of %s: %s", offset, request_path, strerror(errno));
+			return 0;
+		}
+		return link_stream_to_fd(lnk, fd, length, stoptime) == length;
+	} else if (sscanf(line, "error %s %d", name_encoded, &errornum) == 2) {
+		debug(D_VINE, "unable to transfer range of %s: %s", name_encoded, strerror(errornum));
+	}
+
+	return 0;
+}
+
+/*
+Receive a directory sent as a manifest of chunks, as described in
+vine_manifest.h.  The whole tree is created first, with each file at
+its full length, and each chunk that the cache already holds is copied
+into place.  The hashes of the other chunks are then sent back to the
+manager in a "missing" message, and their data follows in the same
+order.  Files and directories are given their modes once complete.
+*/
+
+struct manifest_mode {
+	char *path;
+	int mode;
+};
+
+struct manifest_receiver {
+	struct vine_cache *cache;
+	const char *root;
+	struct list *chunks;
+	struct list *modes;
+	struct hash_table *missing;
+	struct list *missing_order;
+	char *buffer;
+	int64_t totalsize;
+};
+
+static char *manifest_next_line(char **text)
+{
+	char *line = *text;
+	if (!line || !*line)
+		return 0;
+
+	char *newline = strchr(line, '\n');
+	if (newline) {
+		*newline = 0;
+		*text = newline + 1;
+	} else {
+		*text = line + strlen(line);
+	}
+
+	return line;
+}
+
+static char *manifest_join(const char *relpath, const char *name)
+{
+	return relpath[0] ? string_format("%s/%s", relpath, name) : xxstrdup(name);
+}
+
+static void manifest_set_mode(struct manifest_receiver *r, const char *path, int mode)
+{
+	struct manifest_mode *m = xxmalloc(sizeof(*m));
+	m->path = xxstrdup(path);
+	m->mode = mode & 0777;
+	list_push_tail(r->modes, m);
+}
+
+static int manifest_write_chunk(struct manifest_receiver *r, struct vine_manifest_chunk *c, const char *data)
+{
+	char *path = string_format("%s/%s", r->root, c->path);
+
+	int ok = 0;
+	int fd = open(path, O_WRONLY, 0);
+	if (fd >= 0) {
+		ok = full_pwrite64(fd, data, c->length, c->offset) == c->length;
+		if (close(fd) < 0)
+			ok = 0;
+	}
+
+	if (!ok)
+		debug(D_VINE, "Could not write chunk of %s: %s", path, strerror(errno));
+
+	free(path);
+	return ok;
+}
+
+/* Copy a chunk from the cache, or else add it to those to ask the manager for. */
+
+static int manifest_place_chunk(struct manifest_receiver *r, struct vine_manifest_chunk *c)
+{
+	struct list *waiting = hash_table_lookup(r->missing, c->hash);
+	if (waiting) {
+		list_push_tail(waiting, c);
+		return 1;
+	}
+
+	if (vine_cache_read_chunk(r->cache, c->hash, c->length, r->buffer))
+		return manifest_write_chunk(r, c, r->buffer);
+
+	waiting = list_create();
+	list_push_tail(waiting, c);
+	hash_table_insert(r->missing, c->hash, waiting);
+	list_push_tail(r->missing_order, waiting);
+
+	return 1;
+}
+
+static int manifest_get_file(struct manifest_receiver *r, char **text, const char *relpath, int64_t size, int mode, int nchunks)
+{
+	if (!check_disk_space_for_filesize(".", size, 0)) {
+		debug(D_VINE, "Could not put file %s, not enough disk space (%" PRId64 " bytes needed)\n", relpath, size);
+		return 0;
+	}
+
+	char *path = string_format("%s/%s", r->root, relpath);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		debug(D_VINE, "Could not create %s: %s", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		free(path);
+		return 0;
+	}
+	close(fd);
+	free(path);
+
+	manifest_set_mode(r, relpath, mode);
+
+	int64_t offset = 0;
+	int i;
+	for (i = 0; i < nchunks; i++) {
+		char hash[VINE_LINE_MAX];
+		int64_t length;
+
+		char *line = manifest_next_line(text);
+		if (!line || sscanf(line, "%s %" SCNd64, hash, &length) != 2 || strlen(hash) != MD5_DIGEST_LENGTH_HEX || length <= 0 || length > VINE_MANIFEST_CHUNK_MAX) {
+			debug(D_VINE, "invalid chunk of %s in manifest", relpath);
+			return 0;
+		}
+
+		struct vine_manifest_chunk *c = vine_manifest_chunk_create(hash, relpath, offset, length);
+		list_push_tail(r->chunks, c);
+		if (!manifest_place_chunk(r, c))
+			return 0;
+
+		offset += length;
+	}
+
+	if (offset != size) {
+		debug(D_VINE, "chunks of %s in manifest do not add up to its size", relpath);
+		return 0;
+	}
+
+	r->totalsize += size;
+	return 1;
+}
+
+static int manifest_get_dir(struct manifest_receiver *r, char **text, const char *relpath)
+{
+	char *line;
+	while ((line = manifest_next_line(text))) {
+		char name_encoded[VINE_LINE_MAX];
+		char name[VINE_LINE_MAX];
+		char target_encoded[VINE_LINE_MAX];
+		char target[VINE_LINE_MAX];
+		int64_t size;
+		int mode, mtime, nchunks;
+		int ok = 0;
+
+		if (!strcmp(line, "end")) {
+			return 1;
+		} else if (sscanf(line, "file %s %" SCNd64 " %o %d %d", name_encoded, &size, &mode, &mtime, &nchunks) == 5) {
+			url_decode(name_encoded, name, sizeof(name));
+			char *subpath = manifest_join(relpath, name);
+			ok = manifest_get_file(r, text, subpath, size, mode, nchunks);
+			free(subpath);
+		} else if (sscanf(line, "dir %s %o %d", name_encoded, &mode, &mtime) == 3) {
+			url_decode(name_encoded, name, sizeof(name));
+			char *subpath = manifest_join(relpath, name);
+			char *path = string_format("%s/%s", r->root, subpath);
+			if (mkdir(path, 0700) == 0) {
+				manifest_set_mode(r, subpath, mode);
+				ok = manifest_get_dir(r, text, subpath);
+			} else {
+				debug(D_VINE, "unable to create %s: %s", path, strerror(errno));
+			}
+			free(path);
+			free(subpath);
+		} else if (sscanf(line, "symlink %s %s", name_encoded, target_encoded) == 2) {
+			url_decode(name_encoded, name, sizeof(name));
+			url_decode(target_encoded, target, sizeof(target));
+			char *subpath = manifest_join(relpath, name);
+			char *path = string_format("%s/%s", r->root, subpath);
+			ok = symlink(target, path) == 0;
+			if (!ok)
+				debug(D_VINE, "could not create symlink %s: %s", path, strerror(errno));
+			free(path);
+			free(subpath);
+			r->totalsize += strlen(target);
+		} else {
+			debug(D_VINE, "invalid line in manifest: %s", line);
+		}
+
+		if (!ok)
+			return 0;
+	}
+
+	debug(D_VINE, "manifest ended without end of directory");
+	return 0;
+}
+
+/* Receive the data of the missing chunks, each written to every place that needs it. */
+
+static int manifest_get_missing(struct manifest_receiver *r, struct link *lnk, time_t stoptime)
+{
+	struct list *waiting;
+	LIST_ITERATE(r->missing_order, waiting)
+	{
+		struct vine_manifest_chunk *c = list_peek_head(waiting);
+
+		if (link_read(lnk, r->buffer, c->length, stoptime) != c->length)
+			return 0;
+
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		md5_buffer(r->buffer, c->length, digest);
+		if (strcmp(md5_to_string(digest), c->hash)) {
+			debug(D_VINE, "chunk of %s does not match its hash %s", c->path, c->hash);
+			return 0;
+		}
+
+		LIST_ITERATE(waiting, c)
+		{
+			if (!manifest_write_chunk(r, c, r->buffer))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+int vine_transfer_get_manifest(struct link *lnk, struct vine_cache *cache, const char *dirname, int64_t length, int64_t *totalsize, int *mode, int *mtime, struct list *chunks, time_t stoptime)
+{
+	char *text = malloc(length + 1);
+	if (!text || link_read(lnk, text, length, stoptime) != length) {
+		free(text);
+		return 0;
+	}
+	text[length] = 0;
+
+	struct manifest_receiver r;
+	r.cache = cache;
+	r.root = 0;
+	r.chunks = chunks;
+	r.modes = list_create();
+	r.missing = hash_table_create(0, 0);
+	r.missing_order = list_create();
+	r.buffer = xxmalloc(VINE_MANIFEST_CHUNK_MAX);
+	r.totalsize = 0;
+
+	int ok = 0;
+	char *cursor = text;
+	char *line = manifest_next_line(&cursor);
+	char name_encoded[VINE_LINE_MAX];
+	char name[VINE_LINE_MAX];
+	char *root = 0;
+
+	if (line && sscanf(line, "dir %s %o %d", name_encoded, mode, mtime) == 3) {
+		url_decode(name_encoded, name, sizeof(name));
+		root = string_format("%s/%s", dirname, name);
+		r.root = root;
+		*mode &= 0777;
+		if (mkdir(root, 0700) == 0) {
+			ok = manifest_get_dir(&r, &cursor, "");
+		} else {
+			debug(D_VINE, "unable to create %s: %s", root, strerror(errno));
+		}
+	} else {
+		debug(D_VINE, "manifest does not begin with a directory");
+	}
+
+	/* The manager waits for an answer, so a failure is reported by breaking the link. */
+
+	if (ok) {
+		buffer_t B;
+		buffer_init(&B);
+		buffer_abortonfailure(&B, 1);
+
+		struct list *waiting;
+		LIST_ITERATE(r.missing_order, waiting)
+		{
+			struct vine_manifest_chunk *c = list_peek_head(waiting);
+			buffer_printf(&B, "%s\n", c->hash);
+		}
+
+		debug(D_VINE, "manifest of %s has %d chunks, %d missing", name, list_size(chunks), list_size(r.missing_order));
+
+		send_message(lnk, "missing %d %zu\n", list_size(r.missing_order), buffer_pos(&B));
+		ok = link_putlstring(lnk, buffer_tostring(&B), buffer_pos(&B), stoptime) == (ssize_t)buffer_pos(&B);
+		buffer_free(&B);
+	}
+
+	if (ok) {
+		ok = manifest_get_missing(&r, lnk, stoptime);
+	}
+
+	struct manifest_mode *m;
+	while ((m = list_pop_tail(r.modes))) {
+		if (ok) {
+			char *path = string_format("%s/%s", root, m->path);
+			chmod(path, m->mode);
+			free(path);
+		}
+		free(m->path);
+		free(m);
+	}
+
+	if (ok) {
+		chmod(root, *mode);
+		*totalsize += r.totalsize;
+	}
+
+	struct list *waiting;
+	while ((waiting = list_pop_head(r.missing_order))) {
+		list_delete(waiting);
+	}
+	list_delete(r.missing_order);
+	hash_table_delete(r.missing);
+	list_delete(r.modes);
+	free(r.buffer);
+	free(root);
+	free(text);
+
+	return ok;
+}
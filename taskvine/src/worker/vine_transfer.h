@@ -19,6 +19,10 @@ typedef enum {
 
 int vine_transfer_put_any( struct link *lnk, struct vine_cache *cache, const char *filename, vine_transfer_mode_t mode, time_t stoptime );
 
+/* Send a byte range of a cached regular file along the connection to a remote party. */
+
+int vine_transfer_put_range( struct link *lnk, struct vine_cache *cache, const char *filename, int64_t offset, int64_t length, time_t stoptime );
+
 /* Receive a named file/dir from the connection to a local transfer path. */
 
 int vine_transfer_get_any(struct link *lnk, const char *dirname, int64_t *totalsize, int *mode, int *mtime, time_t stoptime);
@@ -27,4 +31,16 @@ int vine_transfer_get_any(struct link *lnk, const char *dirname, int64_t *totals
 
 int vine_transfer_request_any(struct link *lnk, const char *request_name, const char *dirname, int64_t *totalsize, int *mode, int *mtime, time_t stoptime);
 
+/*
+Receive a directory sent as a manifest of chunks into dirname, copying the chunks
+found in the cache and asking the peer for the rest.  The chunks of the new tree
+are appended to chunks, located by their paths within it.
+*/
+
+int vine_transfer_get_manifest(struct link *lnk, struct vine_cache *cache, const char *dirname, int64_t length, int64_t *totalsize, int *mode, int *mtime, struct list *chunks, time_t stoptime);
+
+/* Request a byte range of a regular file by name, and write it at the same offset of fd. */
+
+int vine_transfer_request_range(struct link *lnk, const char *request_name, int fd, int64_t offset, int64_t length, time_t stoptime);
+
 #endif
@@ -11,12 +11,17 @@ See the file COPYING for details.
 
 #include "change_process_title.h"
 #include "debug.h"
+#include "itable.h"
 #include "link.h"
 #include "link_auth.h"
+#include "list.h"
 #include "process.h"
 #include "url_encode.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -36,67 +41,176 @@ pid_t transfer_server_pid = 0;
 /* Specific port for the transfer server to listen on.  Zero means choose any available. */
 int vine_transfer_server_port = 0;
 
-/* Handle a single request for a transfer request from a peer. */
+/* An established connection is closed if no requests arrive for this long. */
+static int idle_timeout = 60;
 
-static void vine_transfer_handler(struct link *lnk, struct vine_cache *cache)
+/* A connection from a peer, which may carry many requests in sequence. */
+
+struct vine_transfer_connection {
+	struct link *link;
+	time_t last_request_time;
+};
+
+/*
+Handle one request from a peer.  Returns true if the connection
+is still usable for further requests, false if it should be closed.
+*/
+
+static int vine_transfer_handler(struct link *lnk, struct vine_cache *cache)
 {
 	char line[VINE_LINE_MAX];
 	char filename_encoded[VINE_LINE_MAX];
 	char filename[VINE_LINE_MAX];
+	int64_t offset, length;
 
-	change_process_title("vine_worker [transfer]");
+	if (!link_readline(lnk, line, sizeof(line), time(0) + command_timeout)) {
+		return 0;
+	}
+
+	if (sscanf(line, "getrange %s %" SCNd64 " %" SCNd64, filename_encoded, &offset, &length) == 3) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		return vine_transfer_put_range(lnk, cache, filename, offset, length, time(0) + transfer_timeout);
+	} else if (sscanf(line, "get %s", filename_encoded) == 1) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		return vine_transfer_put_any(lnk, cache, filename, VINE_TRANSFER_MODE_ANY, time(0) + transfer_timeout);
+	} else {
+		debug(D_VINE, "invalid peer transfer message: %s\n", line);
+		return 0;
+	}
+}
+
+static void vine_transfer_connection_close(struct itable *connections, struct link_poll_set *set, struct vine_transfer_connection *c)
+{
+	itable_remove(connections, (uintptr_t)c->link);
+	link_poll_set_remove(set, c->link);
+	link_close(c->link);
+	free(c);
+}
+
+/*
+Accept a new connection from a peer and authenticate it once,
+so that later requests on the same connection pay no further cost.
+*/
+
+static void vine_transfer_accept(struct itable *connections, struct link_poll_set *set)
+{
+	struct link *lnk = link_accept(transfer_link, LINK_NOWAIT);
+	if (!lnk)
+		return;
 
 	if (options->password) {
 		if (!link_auth_password(lnk, options->password, time(0) + command_timeout)) {
 			debug(D_VINE, "transfer server: could not authenticate peer worker via password!");
+			link_close(lnk);
 			return;
 		}
 	}
 
-	if (link_readline(lnk, line, sizeof(line), time(0) + command_timeout)) {
-		if (sscanf(line, "get %s", filename_encoded) == 1) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			vine_transfer_put_any(lnk, cache, filename, VINE_TRANSFER_MODE_ANY, time(0) + transfer_timeout);
-		} else {
-			debug(D_VINE, "invalid peer transfer message: %s\n", line);
-		}
-	}
+	struct vine_transfer_connection *c = malloc(sizeof(*c));
+	c->link = lnk;
+	c->last_request_time = time(0);
+
+	itable_insert(connections, (uintptr_t)lnk, c);
+	link_poll_set_add(set, lnk, LINK_READ);
 }
 
-static void vine_transfer_process(struct vine_cache *cache)
+/*
+Each serving process waits on the listening link and on all of
+the connections that it has accepted so far.  A connection stays
+open after a request is served, and any requests already sent by
+the peer are answered in order before waiting again.
+*/
+
+static void vine_transfer_process(struct vine_cache *cache, pid_t supervisor_pid)
 {
-	static int child_count = 0;
-
-	/*
-	If link is real, fork. Check if we are at the max
-	child count. If we are over, or link_accept timed out,
-	do a blocking wait on an exited child. If we are under
-	the limit, collect all exited tasks and return to recv
-	*/
-	while (1) {
-		struct link *lnk = link_accept(transfer_link, time(0) + 10);
-
-		child_count++;
-		pid_t p = fork();
-		if (p == 0) {
-			if (lnk) {
-				vine_transfer_handler(lnk, cache);
-				link_close(lnk);
+	struct link_info info[VINE_TRANSFER_PROC_MAX_EVENTS];
+	struct itable *connections = itable_create(0);
+	struct link_poll_set *set = link_poll_set_create();
+
+	change_process_title("vine_worker [transfer]");
+
+	link_poll_set_add(set, transfer_link, LINK_READ);
+
+	while (getppid() == supervisor_pid) {
+		int n = link_poll_set_wait(set, info, VINE_TRANSFER_PROC_MAX_EVENTS, 5000);
+
+		int i;
+		for (i = 0; i < n; i++) {
+			if (info[i].link == transfer_link) {
+				vine_transfer_accept(connections, set);
+				continue;
 			}
-			_exit(0);
-		} else {
-			if (child_count < VINE_TRANSFER_PROC_MAX_CHILD) {
-				while (waitpid(-1, NULL, WNOHANG) > 0) {
-					child_count--;
-				}
+
+			struct vine_transfer_connection *c = itable_lookup(connections, (uintptr_t)info[i].link);
+			if (!c)
 				continue;
+
+			if (vine_transfer_handler(c->link, cache)) {
+				c->last_request_time = time(0);
+			} else {
+				vine_transfer_connection_close(connections, set, c);
+			}
+		}
+
+		time_t idle_stoptime = time(0) - idle_timeout;
+		struct list *idle = list_create();
+		uint64_t key;
+		struct vine_transfer_connection *c;
+		ITABLE_ITERATE(connections, key, c)
+		{
+			if (c->last_request_time < idle_stoptime) {
+				list_push_tail(idle, c);
 			}
 		}
+		while ((c = list_pop_head(idle))) {
+			vine_transfer_connection_close(connections, set, c);
+		}
+		list_delete(idle);
+	}
+
+	_exit(0);
+}
+
+static pid_t vine_transfer_process_start(struct vine_cache *cache, pid_t supervisor_pid)
+{
+	pid_t pid = fork();
+	if (pid == 0) {
+		vine_transfer_process(cache, supervisor_pid);
+	} else if (pid < 0) {
+		debug(D_VINE, "transfer server: unable to fork serving process: %s", strerror(errno));
+	}
+	return pid;
+}
+
+/*
+The supervisor keeps a fixed pool of long-lived serving processes,
+replacing any that exit, rather than forking one per connection.
+*/
+
+static void vine_transfer_supervisor(struct vine_cache *cache)
+{
+	pid_t supervisor_pid = getpid();
+	int child_count = 0;
+	int i;
+
+	for (i = 0; i < VINE_TRANSFER_PROC_MAX_CHILD; i++) {
+		if (vine_transfer_process_start(cache, supervisor_pid) > 0) {
+			child_count++;
+		}
+	}
 
-		debug(D_VINE, "Transfer Server: waiting on exited child. Reached %d", child_count);
+	while (1) {
 		if (waitpid(-1, NULL, 0) > 0) {
 			child_count--;
 		}
+
+		if (child_count < VINE_TRANSFER_PROC_MAX_CHILD) {
+			debug(D_VINE, "transfer server: restarting serving process, %d running", child_count);
+			sleep(1);
+			if (vine_transfer_process_start(cache, supervisor_pid) > 0) {
+				child_count++;
+			}
+		}
 	}
 }
 
@@ -111,10 +225,12 @@ void vine_transfer_server_start(struct vine_cache *cache, int port_min, int port
 	transfer_server_pid = fork();
 	if (transfer_server_pid == 0) {
 		// consider closing additional resources here?
+		setpgid(0, 0);
 		change_process_title("vine_worker [transfer server]");
-		vine_transfer_process(cache);
+		vine_transfer_supervisor(cache);
 		_exit(0);
 	} else if (transfer_server_pid > 0) {
+		setpgid(transfer_server_pid, transfer_server_pid);
 		char addr[LINK_ADDRESS_MAX];
 		int port;
 		vine_transfer_server_address(addr, &port);
@@ -132,7 +248,7 @@ void vine_transfer_server_stop()
 	debug(D_VINE, "stopping transfer server pid %d", transfer_server_pid);
 
 	link_close(transfer_link);
-	kill(transfer_server_pid, SIGKILL);
+	kill(-transfer_server_pid, SIGKILL);
 	waitpid(transfer_server_pid, &status, 0);
 
 	transfer_server_pid = 0;
@@ -10,8 +10,12 @@ See the file COPYING for details.
 #include "vine_cache.h"
 #include "link.h"
 
+/* Number of long-lived processes serving peer connections. */
 #define VINE_TRANSFER_PROC_MAX_CHILD 8
 
+/* Maximum number of ready connections handled per wakeup of a serving process. */
+#define VINE_TRANSFER_PROC_MAX_EVENTS 64
+
 void vine_transfer_server_start( struct vine_cache *cache, int port_min, int port_max );
 void vine_transfer_server_stop();
 void vine_transfer_server_address( char *addr, int *port );
@@ -10,9 +10,15 @@ See the file COPYING for details.
 #include "vine_process.h"
 
 #include "debug.h"
+#include "hash_table.h"
+#include "itable.h"
 #include "link.h"
 #include "list.h"
+#include "macros.h"
+#include "path.h"
 #include "stringtools.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -22,15 +28,37 @@ See the file COPYING for details.
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/inotify.h>
+#endif
+
 /*
 The watcher keeps a linked list of files that must be watched.
 For each one, it tracks the path and size (obviously) but also
 the task_id and logical path, so that it can send back enough
 info for the manager to match the updates up with the right file.
+
+Where inotify is available, the directory holding each watched file
+is watched, and the events only mark the file as changed, so that any
+number of writes between two updates are sent as one.  A file whose
+directory cannot be watched (it does not exist yet, or inotify is not
+available) is checked with stat on each pass, as before.
+
+The updates of each task are sent at most once every
+VINE_WATCHER_SEND_INTERVAL, and at most VINE_WATCHER_SEND_BYTES at a
+time, so that a task writing quickly to its logs cannot hold the
+connection to the manager.  The rest is sent in later updates.
 */
 
+#define VINE_WATCHER_SEND_INTERVAL (USECOND / 2)
+#define VINE_WATCHER_SEND_BYTES (1 * MEGABYTE)
+
 struct vine_watcher {
 	struct list *watchlist;
+	struct hash_table *watched_names; /* Maps "wd/name" of a watched file to its entry. */
+	struct itable *tasks;			  /* Maps task_id to the struct task_rate of the task. */
+	int inotify_fd;
+	int notified; /* The manager was told of changes it has not yet asked for. */
 };
 
 struct entry {
@@ -39,12 +67,20 @@ struct entry {
 	char *logical_path;
 	int64_t size;
 	int do_not_watch;
+	int changed;
+	int wd;
+	char *watched_name;
+};
+
+struct task_rate {
+	timestamp_t last_send;
 };
 
 static void entry_delete(struct entry *e)
 {
 	free(e->physical_path);
 	free(e->logical_path);
+	free(e->watched_name);
 	free(e);
 }
 
@@ -56,6 +92,9 @@ static struct entry *entry_create(int64_t task_id, char *physical_path, char *lo
 	e->logical_path = logical_path;
 	e->size = 0;
 	e->do_not_watch = 0;
+	e->changed = 0;
+	e->wd = -1;
+	e->watched_name = 0;
 	return e;
 }
 
@@ -63,6 +102,18 @@ struct vine_watcher *vine_watcher_create()
 {
 	struct vine_watcher *w = malloc(sizeof(*w));
 	w->watchlist = list_create();
+	w->watched_names = hash_table_create(0, 0);
+	w->tasks = itable_create(0);
+	w->notified = 0;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	w->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->inotify_fd < 0)
+		debug(D_VINE, "watcher: inotify not available, watched files will be polled: %s", strerror(errno));
+#else
+	w->inotify_fd = -1;
+#endif
+
 	return w;
 }
 
@@ -75,9 +126,68 @@ void vine_watcher_delete(struct vine_watcher *w)
 		entry_delete(e);
 	}
 	list_delete(w->watchlist);
+	hash_table_delete(w->watched_names);
+
+	itable_clear(w->tasks, free);
+	itable_delete(w->tasks);
+
+	if (w->inotify_fd >= 0)
+		close(w->inotify_fd);
+
 	free(w);
 }
 
+/*
+Watch the directory holding the file of this entry, if possible.
+Otherwise the entry is left to be polled.  Returns true on success.
+*/
+
+static int entry_watch(struct vine_watcher *w, struct entry *e)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if (w->inotify_fd < 0)
+		return 0;
+
+	char *dir = xxstrdup(e->physical_path);
+	path_dirname(e->physical_path, dir);
+
+	e->wd = inotify_add_watch(w->inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO);
+	if (e->wd >= 0) {
+		e->watched_name = string_format("%d/%s", e->wd, path_basename(e->physical_path));
+		hash_table_insert(w->watched_names, e->watched_name, e);
+	}
+
+	free(dir);
+	return e->wd >= 0;
+#else
+	return 0;
+#endif
+}
+
+/*
+Stop watching the directory of this entry, unless another entry shares it.
+*/
+
+static void entry_unwatch(struct vine_watcher *w, struct entry *e)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if (e->wd < 0)
+		return;
+
+	hash_table_remove(w->watched_names, e->watched_name);
+
+	struct entry *other;
+	LIST_ITERATE(w->watchlist, other)
+	{
+		if (other != e && other->wd == e->wd)
+			return;
+	}
+
+	/* The watch is already gone if the directory was deleted, which is harmless. */
+	inotify_rm_watch(w->inotify_fd, e->wd);
+#endif
+}
+
 /*
 For each watched file in this process, add an entry to the watcher list.
 If the process has no watched files, then nothing is kept.
@@ -98,6 +208,13 @@ void vine_watcher_add_process(struct vine_watcher *w, struct vine_process *p)
 			e = entry_create(p->task->task_id, string_format("%s/%s", p->sandbox, m->remote_name), strdup(m->remote_name));
 
 			list_push_tail(w->watchlist, e);
+			if (!entry_watch(w, e))
+				debug(D_VINE, "watcher: %s will be polled for changes", e->physical_path);
+
+			if (!itable_lookup(w->tasks, e->task_id)) {
+				struct task_rate *r = calloc(1, sizeof(*r));
+				itable_insert(w->tasks, e->task_id, r);
+			}
 		}
 	}
 }
@@ -115,17 +232,88 @@ void vine_watcher_remove_process(struct vine_watcher *w, struct vine_process *p)
 	for (i = 0; i < size; i++) {
 		e = list_pop_head(w->watchlist);
 		if (e->task_id == p->task->task_id) {
+			entry_unwatch(w, e);
 			entry_delete(e);
 		} else {
 			list_push_tail(w->watchlist, e);
 		}
 	}
+
+	free(itable_remove(w->tasks, p->task->task_id));
+
+	if (list_size(w->watchlist) == 0)
+		w->notified = 0;
 }
 
 /*
-Check to see if any watched files have changed since the last look.
-If any one file has changed, it is not necessary to look for any more,
-since the files will be rescanned in vine_watcher_send_results.
+Return the number of files being watched.
+*/
+
+int vine_watcher_size(struct vine_watcher *w)
+{
+	return list_size(w->watchlist);
+}
+
+/*
+Read all pending inotify events, and mark the watched files they name
+as changed.  Repeated events for the same file are coalesced.
+*/
+
+static void read_events(struct vine_watcher *w)
+{
+#ifdef CCTOOLS_OPSYS_LINUX
+	if (w->inotify_fd < 0)
+		return;
+
+	char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	while (1) {
+		ssize_t length = read(w->inotify_fd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		char *ptr = buffer;
+		while (ptr < buffer + length) {
+			struct inotify_event *event = (struct inotify_event *)ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				/* Some events were lost, so any file may have changed. */
+				struct entry *e;
+				LIST_ITERATE(w->watchlist, e)
+				{
+					e->changed = 1;
+				}
+				continue;
+			}
+
+			if (event->len == 0)
+				continue;
+
+			char *name = string_format("%d/%s", event->wd, event->name);
+			struct entry *e = hash_table_lookup(w->watched_names, name);
+			if (e)
+				e->changed = 1;
+			free(name);
+		}
+	}
+#endif
+}
+
+/*
+A task may send updates if its last updates were sent long enough ago.
+*/
+
+static int task_may_send(struct vine_watcher *w, int64_t task_id, timestamp_t now)
+{
+	struct task_rate *r = itable_lookup(w->tasks, task_id);
+	return !r || now - r->last_send >= VINE_WATCHER_SEND_INTERVAL;
+}
+
+/*
+Check to see if any watched files have changed since the last look,
+and their tasks may send updates now.  The manager is told only once
+of the changes, until it asks for them in vine_watcher_send_changes.
 Also, note that the debug message does not print the specific file;
 we don't want the user to be thrown off by missing messages about
 files not examined.
@@ -135,16 +323,29 @@ int vine_watcher_check(struct vine_watcher *w)
 {
 	struct entry *e;
 
+	read_events(w);
+
+	if (w->notified)
+		return 0;
+
+	timestamp_t now = timestamp_get();
+
 	LIST_ITERATE(w->watchlist, e)
 	{
-		struct stat info;
 		if (e->do_not_watch)
 			continue;
-		if (stat(e->physical_path, &info) == 0) {
-			if (info.st_size != e->size) {
-				debug(D_VINE, "watched files have changed");
-				return 1;
-			}
+		/* The directory of a file may only be created by the task once it runs. */
+		if (e->wd < 0 && entry_watch(w, e))
+			e->changed = 1;
+		if (e->wd < 0 && !e->changed) {
+			struct stat info;
+			if (stat(e->physical_path, &info) == 0 && info.st_size != e->size)
+				e->changed = 1;
+		}
+		if (e->changed && task_may_send(w, e->task_id, now)) {
+			debug(D_VINE, "watched files have changed");
+			w->notified = 1;
+			return 1;
 		}
 	}
 
@@ -152,7 +353,7 @@ int vine_watcher_check(struct vine_watcher *w)
 }
 
 /*
-Scan over all watched files, and send back any changes since the last check.
+Scan over the changed watched files, and send back any changes since the last check.
 This feature is designed to work with files that are accessed append-only.
 If the file has shrunk since the last measurement, then we mark the file
 as non-append and stop watching it.
@@ -167,37 +368,78 @@ int vine_watcher_send_changes(struct vine_watcher *w, struct link *manager, time
 {
 	struct entry *e;
 
+	w->notified = 0;
+
+	read_events(w);
+
+	timestamp_t now = timestamp_get();
+
+	/* Bytes sent by each task in this batch. */
+	struct itable *sent = itable_create(0);
+
 	LIST_ITERATE(w->watchlist, e)
 	{
 		struct stat info;
-		if (e->do_not_watch)
+		/* Files without a watch are always examined, as they are polled. */
+		if (e->do_not_watch || (!e->changed && e->wd >= 0))
+			continue;
+		if (!task_may_send(w, e->task_id, now))
+			continue;
+
+		int64_t task_sent = (int64_t)(intptr_t)itable_lookup(sent, e->task_id);
+		if (task_sent >= VINE_WATCHER_SEND_BYTES)
 			continue;
-		if (stat(e->physical_path, &info) == 0) {
-			if (info.st_size > e->size) {
-				int64_t offset = e->size;
-				int64_t length = info.st_size - e->size;
-				debug(D_VINE, "%s increased from %" PRId64 " to %" PRId64 " bytes", e->physical_path, offset, offset + length);
-				int fd = open(e->physical_path, O_RDONLY);
-				if (fd < 0) {
-					debug(D_VINE, "unable to open %s: %s", e->physical_path, strerror(errno));
-					continue;
-				}
 
-				lseek(fd, offset, SEEK_SET);
-				link_printf(manager, stoptime, "update %" PRId64 " %s %" PRId64 " %" PRId64 "\n", e->task_id, e->logical_path, offset, length);
-				int actual = link_stream_from_fd(manager, fd, length, stoptime);
-				close(fd);
-				if (actual != length)
-					return 0;
-				e->size = info.st_size;
-			} else if (info.st_size < e->size) {
-				debug(D_VINE, "%s unexpectedly shrank from %" PRId64 " to %" PRId64 " bytes", e->physical_path, (int64_t)e->size, (int64_t)info.st_size);
-				debug(D_VINE, "%s will no longer be watched for changes", e->physical_path);
-				e->do_not_watch = 1;
+		if (stat(e->physical_path, &info) != 0) {
+			e->changed = 0;
+			continue;
+		}
+
+		if (info.st_size > e->size) {
+			int64_t offset = e->size;
+			int64_t length = MIN(info.st_size - e->size, VINE_WATCHER_SEND_BYTES - task_sent);
+			debug(D_VINE, "%s increased from %" PRId64 " to %" PRId64 " bytes", e->physical_path, offset, (int64_t)info.st_size);
+			int fd = open(e->physical_path, O_RDONLY);
+			if (fd < 0) {
+				debug(D_VINE, "unable to open %s: %s", e->physical_path, strerror(errno));
+				continue;
 			}
+
+			lseek(fd, offset, SEEK_SET);
+			link_printf(manager, stoptime, "update %" PRId64 " %s %" PRId64 " %" PRId64 "\n", e->task_id, e->logical_path, offset, length);
+			int actual = link_stream_from_fd(manager, fd, length, stoptime);
+			close(fd);
+			if (actual != length) {
+				itable_delete(sent);
+				return 0;
+			}
+			e->size += length;
+
+			/* Whatever is left over is sent in a later update. */
+			e->changed = e->size < info.st_size;
+			itable_insert(sent, e->task_id, (void *)(intptr_t)(task_sent + length));
+		} else if (info.st_size < e->size) {
+			debug(D_VINE, "%s unexpectedly shrank from %" PRId64 " to %" PRId64 " bytes", e->physical_path, (int64_t)e->size, (int64_t)info.st_size);
+			debug(D_VINE, "%s will no longer be watched for changes", e->physical_path);
+			e->do_not_watch = 1;
+			e->changed = 0;
+		} else {
+			e->changed = 0;
 		}
 	}
 
+	/* The tasks that sent anything now wait for the next interval. */
+	uint64_t task_id;
+	void *dummy;
+	ITABLE_ITERATE(sent, task_id, dummy)
+	{
+		struct task_rate *r = itable_lookup(w->tasks, task_id);
+		if (r)
+			r->last_send = now;
+	}
+
+	itable_delete(sent);
+
 	return 1;
 }
 
@@ -9,21 +9,25 @@ See the file COPYING for details.
 #include "vine_file.h"
 #include "vine_gpus.h"
 #include "vine_manager.h"
+#include "vine_manifest.h"
 #include "vine_mount.h"
 #include "vine_process.h"
 #include "vine_protocol.h"
 #include "vine_resources.h"
 #include "vine_sandbox.h"
+#include "vine_trace.h"
 #include "vine_transfer.h"
 #include "vine_transfer_server.h"
 #include "vine_watcher.h"
 #include "vine_worker_options.h"
 #include "vine_workspace.h"
 
+#include "buffer.h"
 #include "catalog_query.h"
 #include "cctools.h"
 #include "change_process_title.h"
 #include "copy_stream.h"
+#include "cpu_allocator.h"
 #include "create_dir.h"
 #include "debug.h"
 #include "domain_name_cache.h"
@@ -49,6 +53,8 @@ See the file COPYING for details.
 #include "path_disk_size_info.h"
 #include "pattern.h"
 #include "process.h"
+#include "rmonitor_node.h"
+#include "rmonitor_types.h"
 #include "random.h"
 #include "stringtools.h"
 #include "trash.h"
@@ -98,16 +104,38 @@ static struct list *procs_waiting = NULL;
 /* List of asynchronous messages pending to be sent to the manager */
 static struct list *pending_async_messages = NULL;
 
+/* Cache updates not yet queued, to be sent together in one message, leaving room for the cache-updates header. */
+#define VINE_CACHE_UPDATES_MAX (VINE_LINE_MAX - 32)
+static char pending_cache_updates[VINE_CACHE_UPDATES_MAX];
+static int pending_cache_updates_length = 0;
+static int pending_cache_updates_count = 0;
+
 /* Table of all processes with results to be sent back, indexed by task_id. */
 /* These are additional pointers into procs_table and should not be deleted */
 static struct itable *procs_complete = NULL;
 
+/* Measures the process trees of the tasks that the manager asks the worker to monitor, all in one pass. */
+static struct rmonitor_node *task_monitor = NULL;
+
+/* Seconds between measurements of the monitored tasks, as given by the manager. */
+#define TASK_MONITOR_DEFAULT_INTERVAL 5
+static int task_monitor_interval = TASK_MONITOR_DEFAULT_INTERVAL;
+
+/* Seconds between reports to the manager of the resources used by all running tasks. If 0, no reports are sent. */
+static int usage_report_interval = 0;
+
 /* Table of current transfers and their id. */
 static struct hash_table *current_transfers = NULL;
 
 /* The cache manager object keeping track of files stored by the worker. */
 struct vine_cache *cache_manager = 0;
 
+/* With --core-affinity, the allocator of the cpus to which tasks are bound. */
+struct cpu_allocator *worker_cpus = 0;
+
+/* Optional endpoint serving the /metrics page of the worker (--metrics-port). */
+static struct link *metrics_server = 0;
+
 /* The watcher object is responsible for periodically checking whether */
 /* files marked with VINE_WATCH have been modified and should be streamed back. */
 static struct vine_watcher *watcher = 0;
@@ -162,6 +190,9 @@ static int sigchld_received_flag = 0;
 /* True if manager sent explicit message to release worker from its service. */
 static int released_by_manager = 0;
 
+/* The catalog entry of a busier manager that the current manager was asked to lend this worker to. */
+static struct jx *lend_target = 0;
+
 /***************************************************************/
 /*       Accumulated Statistics Tracked by Worker              */
 /***************************************************************/
@@ -226,8 +257,32 @@ should a buffered message not overflow the the window, it is sent. Otherwise,
 we break once a message would overflow the window.
 */
 
+/*
+Queue the cache updates gathered so far as one asynchronous message.
+A single update is sent in the ordinary cache-update form.
+*/
+
+static void flush_cache_updates()
+{
+	if (pending_cache_updates_count == 0)
+		return;
+
+	char *message = malloc(VINE_LINE_MAX);
+	if (pending_cache_updates_count == 1) {
+		snprintf(message, VINE_LINE_MAX, "cache-update %s", pending_cache_updates);
+	} else {
+		snprintf(message, VINE_LINE_MAX, "cache-updates %d\n%s", pending_cache_updates_count, pending_cache_updates);
+	}
+	list_push_tail(pending_async_messages, message);
+
+	pending_cache_updates_length = 0;
+	pending_cache_updates_count = 0;
+}
+
 void deliver_async_messages(struct link *l)
 {
+	flush_cache_updates();
+
 	int recv_window;
 	int send_window;
 	link_window_get(l, &send_window, &recv_window);
@@ -258,6 +313,9 @@ void deliver_async_messages(struct link *l)
 
 void send_async_message(struct link *l, const char *fmt, ...)
 {
+	/* Keep any cache updates gathered so far ahead of this message. */
+	flush_cache_updates();
+
 	va_list va;
 	char *message = malloc(VINE_LINE_MAX);
 	va_start(va, fmt);
@@ -277,6 +335,9 @@ void send_complete_tasks(struct link *l)
 	struct vine_process *p;
 	for (visited = 0; visited < size; visited++) {
 		p = itable_pop(procs_complete);
+		if (p->time_reaped) {
+			vine_trace_span("report", p->task->task_id, p->time_reaped, timestamp_get(), 0);
+		}
 		if (p->output_length <= 1024 && p->output_length > 0) {
 
 			char *output;
@@ -341,40 +402,47 @@ static void reset_idle_timer()
 }
 
 /*
-Measure the disk used by the worker. We only manually measure the cache directory, as processes measure themselves.
+Measure the disk used by the worker: the objects in the cache, plus the
+sandboxes of the processes as last measured by each of them. The cache keeps
+the size of its objects as they are added and removed, so the cache directory
+is only walked every disk_verify_interval seconds, a bounded piece at a time,
+to correct the accounting for what it does not see, such as metadata files.
 */
 
 static int64_t measure_worker_disk()
 {
 	static struct path_disk_size_info *state = NULL;
+	static time_t last_verification = 0;
+	static int64_t correction = 0;
 
 	if (!cache_manager)
 		return 0;
 
-	char *cache_dir = vine_cache_data_path(cache_manager, ".");
-	path_disk_size_info_get_r(cache_dir, options->max_time_on_measurement, &state, NULL);
-	free(cache_dir);
-
-	int64_t disk_measured = 0;
-	if (state->last_byte_size_complete >= 0) {
-		disk_measured = (int64_t)ceil(state->last_byte_size_complete / (1.0 * MEGA));
+	int verifying = state && state->current_dirs;
+	if (verifying || time(0) >= last_verification + options->disk_verify_interval) {
+		char *cache_dir = vine_cache_data_path(cache_manager, ".");
+		path_disk_size_info_get_r(cache_dir, options->max_time_on_measurement, &state, NULL);
+		free(cache_dir);
+
+		if (state->complete_measurement && state->last_byte_size_complete >= 0) {
+			int64_t accounted = vine_cache_size(cache_manager);
+			correction = state->last_byte_size_complete - accounted;
+			files_counted = state->last_file_count_complete;
+			last_verification = time(0);
+			debug(D_VINE, "cache: walk found %" PRId64 " bytes in %" PRId64 " files, %" PRId64 " bytes accounted", state->last_byte_size_complete, files_counted, accounted);
+		}
 	}
 
-	files_counted = state->last_file_count_complete;
+	int64_t cache_bytes = MAX(vine_cache_size(cache_manager) + correction, 0);
+	int64_t disk_measured = (int64_t)ceil(cache_bytes / (1.0 * MEGA));
 
-	if (state->complete_measurement) {
-		/* if a complete measurement has been done, then update
-		 * for the found value, and add the known values of the processes. */
-
-		struct vine_process *p;
-		uint64_t task_id;
+	struct vine_process *p;
+	uint64_t task_id;
 
-		ITABLE_ITERATE(procs_table, task_id, p)
-		{
-			if (p->sandbox_size > 0) {
-				disk_measured += p->sandbox_size;
-				files_counted += p->sandbox_file_count;
-			}
+	ITABLE_ITERATE(procs_table, task_id, p)
+	{
+		if (p->sandbox_size > 0) {
+			disk_measured += p->sandbox_size;
 		}
 	}
 
@@ -420,7 +488,8 @@ static void measure_worker_resources()
 	r->disk.inuse = measure_worker_disk();
 	r->tag = last_task_received;
 
-	vine_gpus_init(r->gpus.total);
+	/* The gpus reported are the slots into which the devices are divided. */
+	r->gpus.total = vine_gpus_init(r->gpus.total, options->gpu_slots, options->gpus_total < 0);
 
 	last_resources_measurement = time(0);
 }
@@ -481,7 +550,8 @@ static int send_keepalive(struct link *manager, int force_resources)
 
 /*
 Send an asynchronmous message to the manager indicating that an item was successfully loaded into the cache, along with
-its size in bytes and transfer time in usec.
+its size in bytes and transfer time in usec.  Updates are gathered and sent together, as many as fit in one message,
+the next time that messages are delivered or any other message is sent.
 */
 
 void vine_worker_send_cache_update(struct link *manager, const char *cachename, vine_file_type_t type, vine_cache_level_t cache_level, int64_t size, time_t mtime,
@@ -492,8 +562,10 @@ void vine_worker_send_cache_update(struct link *manager, const char *cachename,
 		transfer_id = xxstrdup("X");
 	}
 
-	send_async_message(manager,
-			"cache-update %s %d %d %lld %lld %lld %lld %s\n",
+	char line[VINE_CACHE_UPDATES_MAX];
+	int length = snprintf(line,
+			sizeof(line),
+			"%s %d %d %lld %lld %lld %lld %s\n",
 			cachename,
 			type,
 			cache_level,
@@ -504,6 +576,18 @@ void vine_worker_send_cache_update(struct link *manager, const char *cachename,
 			transfer_id);
 
 	free(transfer_id);
+
+	if (length >= VINE_CACHE_UPDATES_MAX) {
+		debug(D_VINE, "cache update for %s is too long to send", cachename);
+		return;
+	}
+
+	if (pending_cache_updates_length + length >= VINE_CACHE_UPDATES_MAX)
+		flush_cache_updates();
+
+	memcpy(pending_cache_updates + pending_cache_updates_length, line, length + 1);
+	pending_cache_updates_length += length;
+	pending_cache_updates_count++;
 }
 
 /*
@@ -586,6 +670,35 @@ static void report_worker_ready(struct link *manager)
 	send_keepalive(manager, 1);
 }
 
+/*
+With --core-affinity, bind a process to as many cpus of its own as the cores
+it asked for, preferably within one numa node. A function runs within the
+cpus of its library, and a process that does not fit runs on any cpu.
+*/
+
+static void allocate_process_cpus(struct vine_process *p)
+{
+	double cores = p->task->resources_requested->cores;
+	if (!worker_cpus || p->type == VINE_PROCESS_TYPE_FUNCTION || cores <= 0)
+		return;
+
+	p->cpus = cpu_allocator_alloc(worker_cpus, ceil(cores));
+	if (p->cpus) {
+		debug(D_VINE, "task %d is bound to cpus %s", p->task->task_id, p->cpus);
+	} else {
+		debug(D_VINE, "only %d of %d cpus are free, so task %d will not be bound to %d of them", cpu_allocator_available(worker_cpus), cpu_allocator_total(worker_cpus), p->task->task_id, (int)ceil(cores));
+	}
+}
+
+static void release_process_cpus(struct vine_process *p)
+{
+	if (p->cpus) {
+		cpu_allocator_release(worker_cpus, p->cpus);
+		free(p->cpus);
+		p->cpus = 0;
+	}
+}
+
 /*
 Start executing the given process on the local host,
 accounting for the resources as necessary.
@@ -595,16 +708,25 @@ Should maintain parallel structure to reap_process() above.
 static int start_process(struct vine_process *p, struct link *manager)
 {
 	struct vine_task *t = p->task;
+	timestamp_t stagein_start = timestamp_get();
+
+	if (p->time_inputs_ready) {
+		vine_trace_span("wait_resources", t->task_id, p->time_inputs_ready, stagein_start, 0);
+	}
 
 	/* Create the sandbox environment for the task. */
 	if (!vine_sandbox_stagein(p, cache_manager)) {
-		p->execution_start = p->execution_end = timestamp_get();
+		p->execution_start = p->execution_end = p->time_reaped = timestamp_get();
 		p->result = VINE_RESULT_FORSAKEN;
 		p->exit_code = 1;
 		itable_insert(procs_complete, p->task->task_id, p);
+		vine_trace_span("stagein", t->task_id, stagein_start, p->time_reaped, jx_objectv("result", jx_string("failed"), NULL));
 		return 0;
 	}
 
+	timestamp_t start_start = timestamp_get();
+	vine_trace_span("stagein", t->task_id, stagein_start, start_start, 0);
+
 	/* Mark the resources claimed by this task as in use. */
 	cores_allocated += t->resources_requested->cores;
 	memory_allocated += t->resources_requested->memory;
@@ -613,6 +735,7 @@ static int start_process(struct vine_process *p, struct link *manager)
 	if (t->resources_requested->gpus > 0) {
 		vine_gpus_allocate(t->resources_requested->gpus, t->task_id);
 	}
+	allocate_process_cpus(p);
 
 	/* Now start the process (or function) running. */
 	if (vine_process_execute(p)) {
@@ -633,11 +756,72 @@ static int start_process(struct vine_process *p, struct link *manager)
 		fatal("unable to start task_id %d!", p->task->task_id);
 	}
 
+	vine_trace_span("start", t->task_id, start_start, timestamp_get(), 0);
+
 	itable_insert(procs_running, p->task->task_id, p);
 
+	if ((t->monitor_mode || usage_report_interval > 0) && p->type == VINE_PROCESS_TYPE_STANDARD) {
+		if (!task_monitor) {
+			task_monitor = rmonitor_node_create();
+		}
+		rmonitor_node_add(task_monitor, t->task_id, p->pid);
+	}
+
 	return 1;
 }
 
+/*
+Write the resource summary of a monitored task into its sandbox, under the
+same name and with the same fields as the one written by resource_monitor,
+so that it is returned to the manager as an output file of the task.
+*/
+
+static void write_monitor_summary(struct vine_process *p)
+{
+	struct vine_task *t = p->task;
+
+	struct rmsummary *s = rmonitor_node_remove(task_monitor, t->task_id, &p->rusage);
+	if (!s) {
+		return;
+	}
+
+	s->command = xxstrdup(t->command_line);
+	s->category = xxstrdup(t->category);
+	s->taskid = string_format("%d", t->task_id);
+
+	if (p->exit_signal) {
+		s->exit_type = xxstrdup("signal");
+		s->signal = p->exit_signal;
+		s->exit_status = 128 + p->exit_signal;
+	} else {
+		s->exit_type = xxstrdup("normal");
+		s->exit_status = p->exit_code;
+	}
+
+	if (s->limits_exceeded) {
+		free(s->exit_type);
+		s->exit_type = xxstrdup("limits");
+
+		/* as resource_monitor, report the overflow to the manager through the exit code. */
+		if (t->monitor_mode & VINE_MON_WATCHDOG) {
+			s->exit_status = 128 + SIGTERM;
+			p->exit_code = RM_OVERFLOW;
+		}
+	}
+
+	char *path = string_format("%s/%s.summary", p->sandbox, RESOURCE_MONITOR_REMOTE_NAME);
+	FILE *file = fopen(path, "w");
+	if (file) {
+		rmsummary_print(file, s, /* pprint */ 0, /* verbatim */ NULL);
+		fclose(file);
+	} else {
+		debug(D_VINE, "could not write resource summary %s: %s", path, strerror(errno));
+	}
+
+	free(path);
+	rmsummary_delete(s);
+}
+
 /*
 This process has ended so mark it complete and
 account for the resources as necessary.
@@ -654,7 +838,26 @@ static void reap_process(struct vine_process *p, struct link *manager)
 	gpus_allocated -= p->task->resources_requested->gpus;
 
 	vine_gpus_free(p->task->task_id);
+	release_process_cpus(p);
+
+	if (p->task->monitor_mode && task_monitor) {
+		write_monitor_summary(p);
+	} else if (task_monitor) {
+		rmsummary_delete(rmonitor_node_remove(task_monitor, p->task->task_id, NULL));
+	}
+
+	timestamp_t stageout_start = timestamp_get();
 	vine_sandbox_stageout(p, cache_manager, manager);
+	p->time_reaped = timestamp_get();
+
+	if (vine_trace_enabled()) {
+		struct jx *args = jx_objectv("exit_code", jx_integer(p->exit_code), NULL);
+		if (p->exit_signal) {
+			jx_insert_integer(args, "exit_signal", p->exit_signal);
+		}
+		vine_trace_span("execute", p->task->task_id, p->execution_start, p->execution_end, args);
+		vine_trace_span("stageout", p->task->task_id, stageout_start, p->time_reaped, 0);
+	}
 
 	if (p->type == VINE_PROCESS_TYPE_FUNCTION) {
 		p->library_process->functions_running--;
@@ -873,6 +1076,9 @@ static struct vine_task *do_task_body(struct link *manager, int task_id, time_t
 			url_decode(taskname_encoded, taskname, VINE_LINE_MAX);
 			vine_hack_do_not_compute_cached_name = 1;
 			vine_task_add_output_file(task, localname, taskname, flags);
+		} else if (sscanf(line, "monitor %d %d", &flags, &length) == 2) {
+			task->monitor_mode = flags;
+			task_monitor_interval = length > 0 ? length : TASK_MONITOR_DEFAULT_INTERVAL;
 		} else if (sscanf(line, "cores %" PRId64, &n)) {
 			vine_task_set_cores(task, n);
 		} else if (sscanf(line, "memory %" PRId64, &n)) {
@@ -910,6 +1116,8 @@ static struct vine_task *do_task_body(struct link *manager, int task_id, time_t
 
 static int do_task(struct link *manager, int task_id, time_t stoptime)
 {
+	timestamp_t receive_start = timestamp_get();
+
 	struct vine_task *task = do_task_body(manager, task_id, stoptime);
 	if (!task)
 		return 0;
@@ -930,6 +1138,15 @@ static int do_task(struct link *manager, int task_id, time_t stoptime)
 	if (!p)
 		return 0;
 
+	p->time_received = timestamp_get();
+
+	if (vine_trace_enabled()) {
+		char *name = string_format("task %d", task_id);
+		vine_trace_track(task_id, name);
+		free(name);
+		vine_trace_span("receive", task_id, receive_start, p->time_received, jx_objectv("category", jx_string(task->category ? task->category : "default"), NULL));
+	}
+
 	itable_insert(procs_table, task_id, p);
 
 	normalize_resources(p);
@@ -973,6 +1190,41 @@ static int do_put(struct link *manager, const char *cachename, vine_cache_level_
 	return r;
 }
 
+/*
+Handle a request to put a directory given by a manifest of chunks,
+assembling it in the transfer path from the chunks already cached
+and those the manager sends, and then index its chunks for later
+versions of the directory.
+*/
+
+static int do_put_manifest(struct link *manager, const char *cachename, vine_cache_level_t cache_level, int64_t expected_size, int64_t length)
+{
+	int64_t actual_size = 0;
+	int mode = 0;
+	int mtime = 0;
+
+	char *transfer_dir = vine_cache_transfer_path(cache_manager, ".");
+	char *transfer_path = vine_cache_transfer_path(cache_manager, cachename);
+	struct list *chunks = list_create();
+
+	timestamp_t start = timestamp_get();
+	int r = vine_transfer_get_manifest(manager, cache_manager, transfer_dir, length, &actual_size, &mode, &mtime, chunks, time(0) + options->active_timeout);
+	timestamp_t stop = timestamp_get();
+
+	if (r && vine_cache_add_file(cache_manager, cachename, transfer_path, cache_level, mode, actual_size, mtime, stop - start)) {
+		vine_cache_add_chunks(cache_manager, cachename, chunks);
+	} else {
+		trash_file(transfer_path);
+	}
+
+	list_clear(chunks, (void *)vine_manifest_chunk_delete);
+	list_delete(chunks);
+	free(transfer_path);
+	free(transfer_dir);
+
+	return r;
+}
+
 /*
 Accept a url specification and queue it for later transfer.
 */
@@ -1031,6 +1283,19 @@ static int do_unlink(struct link *manager, const char *path)
 	return result;
 }
 
+/*
+Rename an object in the cache, once the manager has settled on its permanent name.
+If that fails, the manager is told that the object is not available under the new name.
+*/
+
+static int do_rename(struct link *manager, const char *old_name, const char *new_name)
+{
+	if (!vine_cache_rename(cache_manager, old_name, new_name)) {
+		vine_worker_send_cache_invalid(manager, new_name, "couldn't rename cached file");
+	}
+	return 1;
+}
+
 /*
 do_kill removes a process currently known by the worker.
 Note that a kill message from the manager is used for every case
@@ -1058,11 +1323,16 @@ static int do_kill(int task_id)
 		disk_allocated -= p->task->resources_requested->disk;
 		gpus_allocated -= p->task->resources_requested->gpus;
 		vine_gpus_free(task_id);
+		release_process_cpus(p);
 	}
 
 	itable_remove(procs_complete, p->task->task_id);
 	list_remove(procs_waiting, p);
 
+	if (task_monitor) {
+		rmsummary_delete(rmonitor_node_remove(task_monitor, task_id, NULL));
+	}
+
 	vine_watcher_remove_process(watcher, p);
 
 	vine_process_delete(p);
@@ -1100,15 +1370,34 @@ static void kill_all_tasks()
 	debug(D_VINE, "all data structures are clean");
 }
 
-/* Check whether a given process is still within the various limits imposed on it. */
+/*
+Check whether a given process is still within the various limits imposed on it.
+fs_used is the number of bytes now used in the workspace filesystem, or -1 if unknown.
+*/
 
-static int enforce_process_sanbox_limits(struct vine_process *p)
+static int enforce_process_sanbox_limits(struct vine_process *p, int64_t fs_used)
 {
 	/* If the task did not set disk usage, return right away. */
 	if (p->task->resources_requested->disk < 1)
 		return 1;
 
+	/*
+	A sandbox cannot grow by more than the filesystem that holds it, so there is
+	no need to walk the sandbox while the growth of the filesystem since its last
+	complete measurement still leaves the task within its limit.
+	*/
+	if (fs_used >= 0 && p->disk_fs_used >= 0 && time(0) < p->disk_measured_time + options->disk_verify_interval) {
+		int64_t growth = (int64_t)ceil(MAX(fs_used - p->disk_fs_used, 0) / (1.0 * MEGA));
+		if (p->sandbox_size + growth <= p->task->resources_requested->disk)
+			return 1;
+	}
+
 	vine_process_measure_disk(p, options->max_time_on_measurement);
+	if (p->disk_measurement_state->complete_measurement) {
+		p->disk_fs_used = fs_used;
+		p->disk_measured_time = time(0);
+	}
+
 	if (p->sandbox_size > p->task->resources_requested->disk) {
 		debug(D_VINE,
 				"Task %d went over its disk size limit: %s > %s\n",
@@ -1136,9 +1425,14 @@ static int enforce_processes_sandbox_limits()
 	if ((time(0) - last_check_time) < options->check_resources_interval)
 		return 1;
 
+	UINT64_T avail, total;
+	int64_t fs_used = -1;
+	if (host_disk_info_get(workspace->workspace_dir, &avail, &total) == 0)
+		fs_used = total - avail;
+
 	ITABLE_ITERATE(procs_running, task_id, p)
 	{
-		if (!enforce_process_sanbox_limits(p)) {
+		if (!enforce_process_sanbox_limits(p, fs_used)) {
 			finish_running_task(p, VINE_RESULT_SANDBOX_EXHAUSTION);
 			trash_file(p->sandbox);
 
@@ -1170,6 +1464,10 @@ static void enforce_processes_max_running_time()
 		if (p->task->resources_requested->wall_time < 1)
 			continue;
 
+		/* The shared monitor polices the wall time of monitored tasks, as resource_monitor would. */
+		if (p->task->monitor_mode)
+			continue;
+
 		if (now > p->execution_start + (1e6 * p->task->resources_requested->wall_time)) {
 			debug(D_VINE,
 					"Task %d went over its running time limit: %s > %s\n",
@@ -1184,6 +1482,88 @@ static void enforce_processes_max_running_time()
 	return;
 }
 
+/*
+Send the manager the resources currently used by all the running tasks
+together, so that it may schedule according to what the tasks use rather
+than what they requested.
+*/
+
+static void send_usage_report(struct link *manager)
+{
+	double cores = 0;
+	int64_t memory = 0;
+	int measured = 0;
+
+	struct vine_process *p;
+	uint64_t task_id;
+
+	ITABLE_ITERATE(procs_running, task_id, p)
+	{
+		const struct rmsummary *s = rmonitor_node_current(task_monitor, task_id);
+		if (!s)
+			continue;
+
+		cores += MAX(0, s->cores);
+		memory += MAX(0, s->memory);
+		measured++;
+	}
+
+	send_message(manager, "info usage %.2lf %" PRId64 " %d\n", cores, memory, measured);
+}
+
+/* Seconds between passes over the monitored tasks. */
+
+static int monitor_poll_interval()
+{
+	if (usage_report_interval > 0) {
+		return MIN(task_monitor_interval, usage_report_interval);
+	}
+	return task_monitor_interval;
+}
+
+/*
+Measure all the monitored tasks in a single pass, and if the manager asked
+for it, kill the tasks that went over their limits. Their summaries record
+the limits exceeded when the tasks are reaped. If the manager asked for
+usage reports, send one every usage_report_interval.
+*/
+
+static void monitor_processes(struct link *manager)
+{
+	static time_t last_check_time = 0;
+	static time_t last_report_time = 0;
+
+	if (!task_monitor || (time(0) - last_check_time) < monitor_poll_interval())
+		return;
+
+	rmonitor_node_poll(task_monitor);
+
+	struct vine_process *p;
+	uint64_t task_id;
+
+	ITABLE_ITERATE(procs_running, task_id, p)
+	{
+		if (!(p->task->monitor_mode & VINE_MON_WATCHDOG))
+			continue;
+
+		const struct rmsummary *s = rmonitor_node_summary(task_monitor, task_id);
+		if (!s || s->limits_exceeded)
+			continue;
+
+		if (!rmonitor_node_check_limits(task_monitor, task_id, p->task->resources_requested)) {
+			debug(D_VINE, "Task %d went over its resource limits.\n", p->task->task_id);
+			vine_process_kill(p);
+		}
+	}
+
+	last_check_time = time(0);
+
+	if (usage_report_interval > 0 && (last_check_time - last_report_time) >= usage_report_interval) {
+		send_usage_report(manager);
+		last_report_time = last_check_time;
+	}
+}
+
 /* Handle a release message from the manager, asking the worker to cleanly exit. */
 
 static int do_release()
@@ -1193,6 +1573,83 @@ static int do_release()
 	return 0;
 }
 
+/* Return true if this catalog entry describes the manager the worker is connected to. */
+
+static int is_current_manager(struct jx *j)
+{
+	const char *addr = jx_lookup_string(j, "address");
+	const char *name = jx_lookup_string(j, "name");
+
+	if (jx_lookup_integer(j, "port") != current_manager_address->port)
+		return 0;
+
+	return (addr && (!strcmp(addr, current_manager_address->host) || !strcmp(addr, current_manager_address->addr))) ||
+	       (name && !strcmp(name, current_manager_address->host));
+}
+
+/*
+With --lend-interval, a worker without work for that long looks in the
+catalog for the matching manager with the most tasks waiting per worker,
+and asks its current manager to lend it there. If the manager has nothing
+waiting, it answers with a release, and the worker connects to the busier
+manager keeping its cache. Otherwise the request is simply ignored.
+*/
+
+static void check_lend_request(struct link *manager)
+{
+	static time_t last_check = 0;
+
+	if (!options->lend_interval || !options->project_regex)
+		return;
+
+	/* A worker given work since the last request stays with its manager. */
+	if (list_size(procs_waiting) > 0 || itable_size(procs_table) > 0 || itable_size(procs_complete) > 0) {
+		jx_delete(lend_target);
+		lend_target = 0;
+		return;
+	}
+
+	time_t now = time(0);
+	time_t idle_since = options->idle_stoptime - options->idle_timeout;
+	if (now - idle_since < options->lend_interval || now - last_check < options->lend_interval)
+		return;
+
+	last_check = now;
+
+	struct list *managers_list = vine_catalog_query(options->catalog_hosts, -1, options->project_regex);
+	if (!managers_list)
+		return;
+
+	struct jx *best = 0;
+	double best_backlog = 0;
+
+	struct jx *j;
+	LIST_ITERATE(managers_list, j)
+	{
+		if (is_current_manager(j))
+			continue;
+
+		int64_t waiting = jx_lookup_integer(j, "tasks_waiting");
+		double backlog = (double)waiting / (jx_lookup_integer(j, "workers") + 1);
+		if (waiting > 0 && backlog > best_backlog) {
+			best = j;
+			best_backlog = backlog;
+		}
+	}
+
+	if (best) {
+		jx_delete(lend_target);
+		lend_target = jx_copy(best);
+
+		const char *project = jx_lookup_string(best, "project");
+		debug(D_VINE, "asking to be lent to manager %s at %s:%d with %.1lf tasks waiting per worker", project, jx_lookup_string(best, "address"), (int)jx_lookup_integer(best, "port"), best_backlog);
+		send_message(manager, "info lend-request %s\n", project ? project : "unknown");
+	}
+
+	list_clear(managers_list, (void *)jx_delete);
+	list_delete(managers_list);
+}
+
 /* Handle an unexpected disconnection by the current manager, and clean up everything. */
 
 static void disconnect_manager(struct link *manager)
@@ -1203,6 +1660,9 @@ static void disconnect_manager(struct link *manager)
 	debug(D_VINE, "killing all outstanding tasks");
 	kill_all_tasks();
 
+	/* the next manager asks again for usage reports if it wants them. */
+	usage_report_interval = 0;
+
 	if (released_by_manager) {
 		released_by_manager = 0;
 	} else if (abort_flag) {
@@ -1248,77 +1708,109 @@ static int handle_manager(struct link *manager)
 	char source_encoded[VINE_LINE_MAX];
 	char source[VINE_LINE_MAX];
 	char transfer_id[VINE_LINE_MAX];
-	int64_t length;
+	int64_t length, manifest_length;
 	int64_t task_id = 0;
 	int mode, n;
 	int r = 0;
 	int cache_level;
 
-	if (recv_message(manager, line, sizeof(line), options->idle_stoptime)) {
-		if (sscanf(line, "task %" SCNd64, &task_id) == 1) {
-			r = do_task(manager, task_id, time(0) + options->active_timeout);
-		} else if (sscanf(line, "put %s %d %" SCNd64, filename_encoded, &cache_level, &length) == 3) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			r = do_put(manager, filename, cache_level, length);
-			reset_idle_timer();
-		} else if (sscanf(line, "puturl %s %s %d %" SCNd64 " %o %s", source_encoded, filename_encoded, &cache_level, &length, &mode, transfer_id) == 6) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			url_decode(source_encoded, source, sizeof(source));
+	if (!recv_message(manager, line, sizeof(line), options->idle_stoptime)) {
+		debug(D_VINE, "Failed to read from manager.\n");
+		return 0;
+	}
+
+	/*
+	Dispatch once on the leading command word, then decode only the
+	fields that command carries, instead of trying each sscanf format
+	against the whole line in turn.
+	*/
+
+	const char *s = line;
+	const char *cmd;
+	size_t cmdlen;
+
+	if (!string_next_slice(&s, &cmd, &cmdlen)) {
+		cmd = line;
+		cmdlen = 0;
+	}
+
+#define COMMAND_IS(word) string_slice_is(cmd, cmdlen, word)
+
+	if (COMMAND_IS("task") && string_next_int64(&s, &task_id)) {
+		r = do_task(manager, task_id, time(0) + options->active_timeout);
+	} else if (COMMAND_IS("put") && string_next_word(&s, filename_encoded, sizeof(filename_encoded)) && string_next_int(&s, &cache_level) && string_next_int64(&s, &length)) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = do_put(manager, filename, cache_level, length);
+		reset_idle_timer();
+	} else if (COMMAND_IS("putmanifest") && string_next_word(&s, filename_encoded, sizeof(filename_encoded)) && string_next_int(&s, &cache_level) &&
+			string_next_int64(&s, &length) && string_next_int64(&s, &manifest_length)) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = do_put_manifest(manager, filename, cache_level, length, manifest_length);
+		reset_idle_timer();
+	} else if ((COMMAND_IS("puturl") || COMMAND_IS("puturl_now")) && string_next_word(&s, source_encoded, sizeof(source_encoded)) &&
+			string_next_word(&s, filename_encoded, sizeof(filename_encoded)) && string_next_int(&s, &cache_level) && string_next_int64(&s, &length) &&
+			string_next_octal(&s, &mode) && string_next_word(&s, transfer_id, sizeof(transfer_id))) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		url_decode(source_encoded, source, sizeof(source));
+		if (COMMAND_IS("puturl")) {
 			r = do_put_url(filename, cache_level, length, mode, source);
-			reset_idle_timer();
-			hash_table_insert(current_transfers, filename, strdup(transfer_id));
-		} else if (sscanf(line, "puturl_now %s %s %d %" SCNd64 " %o %s", source_encoded, filename_encoded, &cache_level, &length, &mode, transfer_id) == 6) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			url_decode(source_encoded, source, sizeof(source));
+		} else {
 			r = do_put_url_now(filename, cache_level, length, mode, source);
-			reset_idle_timer();
-			hash_table_insert(current_transfers, filename, strdup(transfer_id));
-		} else if (sscanf(line, "mini_task %s %s %d %" SCNd64 " %o", source_encoded, filename_encoded, &cache_level, &length, &mode) == 5) {
-			url_decode(source_encoded, source, sizeof(source));
-			url_decode(filename_encoded, filename, sizeof(filename));
-			r = do_put_mini_task(manager, time(0) + options->active_timeout, filename, cache_level, length, mode, source);
-			reset_idle_timer();
-		} else if (sscanf(line, "unlink %s", filename_encoded) == 1) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			r = do_unlink(manager, filename);
-		} else if (sscanf(line, "getfile %s", filename_encoded) == 1) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			r = vine_transfer_put_any(manager, cache_manager, filename, VINE_TRANSFER_MODE_FILE_ONLY, time(0) + options->active_timeout);
-		} else if (sscanf(line, "get %s", filename_encoded) == 1) {
-			url_decode(filename_encoded, filename, sizeof(filename));
-			r = vine_transfer_put_any(manager, cache_manager, filename, VINE_TRANSFER_MODE_ANY, time(0) + options->active_timeout);
-		} else if (sscanf(line, "kill %" SCNd64, &task_id) == 1) {
-			if (task_id >= 0) {
-				r = do_kill(task_id);
-			} else {
-				kill_all_tasks();
-				r = 1;
-			}
-		} else if (!strncmp(line, "release", 8)) {
-			r = do_release();
-		} else if (!strncmp(line, "exit", 5)) {
-			abort_flag = 1;
-			r = 1;
-		} else if (!strncmp(line, "check", 6)) {
-			r = send_keepalive(manager, 0);
-		} else if (!strncmp(line, "auth", 4)) {
-			fprintf(stderr, "vine_worker: this manager requires a password. (use the -P option)\n");
-			r = 0;
-		} else if (sscanf(line, "send_results %d", &n) == 1) {
-			report_changes(manager);
-			r = 1;
-		} else if (sscanf(line, "send_stdout %" SCNd64 "", &task_id) == 1) {
-			send_stdout(manager, task_id);
-			r = 1;
+		}
+		reset_idle_timer();
+		hash_table_insert(current_transfers, filename, strdup(transfer_id));
+	} else if (COMMAND_IS("mini_task") && string_next_word(&s, source_encoded, sizeof(source_encoded)) && string_next_word(&s, filename_encoded, sizeof(filename_encoded)) &&
+			string_next_int(&s, &cache_level) && string_next_int64(&s, &length) && string_next_octal(&s, &mode)) {
+		url_decode(source_encoded, source, sizeof(source));
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = do_put_mini_task(manager, time(0) + options->active_timeout, filename, cache_level, length, mode, source);
+		reset_idle_timer();
+	} else if (COMMAND_IS("unlink") && string_next_word(&s, filename_encoded, sizeof(filename_encoded))) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = do_unlink(manager, filename);
+	} else if (COMMAND_IS("rename") && string_next_word(&s, filename_encoded, sizeof(filename_encoded)) && string_next_word(&s, source_encoded, sizeof(source_encoded))) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		url_decode(source_encoded, source, sizeof(source));
+		r = do_rename(manager, filename, source);
+	} else if (COMMAND_IS("getfile") && string_next_word(&s, filename_encoded, sizeof(filename_encoded))) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = vine_transfer_put_any(manager, cache_manager, filename, VINE_TRANSFER_MODE_FILE_ONLY, time(0) + options->active_timeout);
+	} else if (COMMAND_IS("get") && string_next_word(&s, filename_encoded, sizeof(filename_encoded))) {
+		url_decode(filename_encoded, filename, sizeof(filename));
+		r = vine_transfer_put_any(manager, cache_manager, filename, VINE_TRANSFER_MODE_ANY, time(0) + options->active_timeout);
+	} else if (COMMAND_IS("kill") && string_next_int64(&s, &task_id)) {
+		if (task_id >= 0) {
+			r = do_kill(task_id);
 		} else {
-			debug(D_VINE, "Unrecognized manager message: %s.\n", line);
-			r = 0;
+			kill_all_tasks();
+			r = 1;
 		}
+	} else if (!strcmp(line, "release")) {
+		r = do_release();
+	} else if (!strcmp(line, "exit")) {
+		abort_flag = 1;
+		r = 1;
+	} else if (!strcmp(line, "check")) {
+		r = send_keepalive(manager, 0);
+	} else if (string_prefix_is(line, "auth")) {
+		fprintf(stderr, "vine_worker: this manager requires a password. (use the -P option)\n");
+		r = 0;
+	} else if (COMMAND_IS("send_results") && string_next_int(&s, &n)) {
+		report_changes(manager);
+		r = 1;
+	} else if (COMMAND_IS("send_stdout") && string_next_int64(&s, &task_id)) {
+		send_stdout(manager, task_id);
+		r = 1;
+	} else if (COMMAND_IS("usage_interval") && string_next_int(&s, &n)) {
+		usage_report_interval = MAX(0, n);
+		r = 1;
 	} else {
-		debug(D_VINE, "Failed to read from manager.\n");
+		debug(D_VINE, "Unrecognized manager message: %s.\n", line);
 		r = 0;
 	}
 
+#undef COMMAND_IS
+
 	return r;
 }
 
@@ -1371,6 +1863,30 @@ static struct vine_process *find_running_library_for_function(const char *librar
 	return 0;
 }
 
+/*
+Note the first time that all the inputs of a process are found in the cache,
+and trace the wait for them along with the inputs waited for.
+*/
+
+static void note_inputs_ready(struct vine_process *p, vine_cache_status_t status)
+{
+	if (status != VINE_CACHE_STATUS_READY || p->time_inputs_ready) {
+		return;
+	}
+
+	p->time_inputs_ready = timestamp_get();
+
+	if (vine_trace_enabled()) {
+		struct jx *inputs = jx_array(0);
+		struct vine_mount *m;
+		LIST_ITERATE(p->task->input_mounts, m)
+		{
+			jx_array_append(inputs, jx_string(m->file->cached_name));
+		}
+		vine_trace_span("wait_inputs", p->task->task_id, p->time_received, p->time_inputs_ready, jx_objectv("inputs", inputs, NULL));
+	}
+}
+
 /*
 Return true if this process is ready to run at this moment, and match to a library process if needed.
 */
@@ -1388,6 +1904,7 @@ static int process_ready_to_run_now(struct vine_process *p, struct vine_cache *c
 	}
 
 	vine_cache_status_t status = vine_sandbox_ensure(p, cache, manager);
+	note_inputs_ready(p, status);
 	if (status == VINE_CACHE_STATUS_PROCESSING)
 		return 0;
 
@@ -1414,9 +1931,10 @@ static struct vine_process *find_future_library_for_function(const char *library
 
 /*
 Return true if this process can run eventually, supposing that other processes will complete.
+If prefetch is true, start fetching its missing inputs so they are ready by the time it can run.
 */
 
-static int process_can_run_eventually(struct vine_process *p, struct vine_cache *cache, struct link *manager)
+static int process_can_run_eventually(struct vine_process *p, struct vine_cache *cache, struct link *manager, int prefetch)
 {
 	if (!task_resources_fit_eventually(p->task))
 		return 0;
@@ -1428,7 +1946,15 @@ static int process_can_run_eventually(struct vine_process *p, struct vine_cache
 			return 0;
 	}
 
-	vine_cache_status_t status = vine_sandbox_ensure(p, cache, manager);
+	vine_cache_status_t status;
+	if (prefetch) {
+		status = vine_sandbox_ensure(p, cache, manager);
+	} else {
+		status = vine_sandbox_check(p, cache);
+	}
+
+	note_inputs_ready(p, status);
+
 	switch (status) {
 	case VINE_CACHE_STATUS_FAILED:
 	case VINE_CACHE_STATUS_UNKNOWN:
@@ -1452,6 +1978,47 @@ void forsake_waiting_process(struct link *manager, struct vine_process *p)
 	send_keepalive(manager, 1);
 }
 
+/*
+If the cache together with the disk allocated to tasks grows above the high
+watermark of the worker disk, evict cached files that no task needs until
+the usage falls below the low watermark.  The cache size is accounted
+directly, as the periodic disk measurement lags behind evictions.
+*/
+
+static void evict_cache_if_needed(struct link *manager)
+{
+	if (options->cache_eviction == VINE_CACHE_EVICTION_NONE)
+		return;
+
+	int64_t capacity = total_resources->disk.total * MEGA;
+	if (capacity <= 0)
+		return;
+
+	int64_t usage = vine_cache_size(cache_manager) + disk_allocated * MEGA;
+	if (usage <= capacity / 100 * options->cache_high_watermark)
+		return;
+
+	int64_t target = capacity / 100 * MIN(options->cache_low_watermark, options->cache_high_watermark);
+
+	struct hash_table *in_use = hash_table_create(0, 0);
+
+	uint64_t task_id;
+	struct vine_process *p;
+	ITABLE_ITERATE(procs_table, task_id, p)
+	{
+		struct vine_mount *m;
+		LIST_ITERATE(p->task->input_mounts, m)
+		{
+			hash_table_insert(in_use, m->file->cached_name, m);
+		}
+	}
+
+	int64_t freed = vine_cache_evict(cache_manager, usage - target, in_use, manager);
+	debug(D_VINE, "cache usage %" PRId64 " MB above %d%% of %" PRId64 " MB, evicted %" PRId64 " MB", usage / MEGA, options->cache_high_watermark, capacity / MEGA, freed / MEGA);
+
+	hash_table_delete(in_use);
+}
+
 /*
 If 0, the worker is using more resources than promised. 1 if resource usage holds that promise.
 */
@@ -1548,9 +2115,17 @@ static int check_library_startup(struct vine_process *p)
 	const char *name = jx_lookup_string(response, "name");
 
 	int ok = 0;
-	if (!strcmp(name, p->task->provides_library)) {
+	if (name && !strcmp(name, p->task->provides_library)) {
 		ok = 1;
 	}
+
+	/* A library may run fewer functions at once than it was given slots, e.g. when it runs them in its own process. */
+	int64_t slots = jx_lookup_integer(response, "function_slots");
+	if (ok && slots > 0 && slots < p->task->function_slots_total) {
+		debug(D_VINE, "Library %s runs at most %" PRId64 " functions at once.", p->task->provides_library, slots);
+		p->task->function_slots_total = slots;
+	}
+
 	if (response) {
 		jx_delete(response);
 	}
@@ -1602,6 +2177,79 @@ static void check_libraries_ready(struct link *manager)
 	}
 }
 
+/*
+Describe the worker and its cache in the OpenMetrics text format.
+Transfers served to peers are counted by the transfer server processes,
+and so are not visible here.
+*/
+
+static void write_metrics(buffer_t *B)
+{
+	struct vine_cache_stats c;
+	memset(&c, 0, sizeof(c));
+	if (cache_manager) {
+		vine_cache_get_stats(cache_manager, &c);
+	}
+
+	buffer_printf(B, "# TYPE vine_worker_tasks_running gauge\nvine_worker_tasks_running %d\n", itable_size(procs_running));
+	buffer_printf(B, "# TYPE vine_worker_tasks_executed counter\nvine_worker_tasks_executed_total %d\n", total_tasks_executed);
+	buffer_printf(B, "# TYPE vine_worker_execute_seconds counter\nvine_worker_execute_seconds_total %.6f\n", total_task_execution_time / 1000000.0);
+	buffer_printf(B, "# TYPE vine_worker_uptime_seconds gauge\nvine_worker_uptime_seconds %.6f\n", (timestamp_get() - worker_start_time) / 1000000.0);
+
+	buffer_printf(B, "# TYPE vine_worker_cache_objects gauge\nvine_worker_cache_objects %" PRId64 "\n", c.objects);
+	buffer_printf(B, "# TYPE vine_worker_cache_bytes gauge\nvine_worker_cache_bytes %" PRId64 "\n", c.bytes);
+	buffer_printf(B, "# TYPE vine_worker_cache_objects_pending gauge\nvine_worker_cache_objects_pending %" PRId64 "\n", c.objects_pending);
+	buffer_printf(B, "# TYPE vine_worker_cache_transfers counter\nvine_worker_cache_transfers_total %" PRId64 "\n", c.transfers);
+	buffer_printf(B, "# TYPE vine_worker_cache_transfers_failed counter\nvine_worker_cache_transfers_failed_total %" PRId64 "\n", c.transfers_failed);
+	buffer_printf(B, "# TYPE vine_worker_cache_transfer_bytes counter\nvine_worker_cache_transfer_bytes_total %" PRId64 "\n", c.bytes_transferred);
+	buffer_printf(B, "# TYPE vine_worker_cache_transfer_seconds counter\nvine_worker_cache_transfer_seconds_total %.6f\n", c.transfer_time / 1000000.0);
+	buffer_printf(B, "# TYPE vine_worker_cache_accesses counter\nvine_worker_cache_accesses_total %" PRId64 "\n", c.accesses);
+	buffer_printf(B, "# TYPE vine_worker_cache_reuses counter\nvine_worker_cache_reuses_total %" PRId64 "\n", c.reuses);
+	buffer_printf(B, "# TYPE vine_worker_cache_evictions counter\nvine_worker_cache_evictions_total %" PRId64 "\n", c.evictions);
+	buffer_printf(B, "# TYPE vine_worker_cache_evicted_bytes counter\nvine_worker_cache_evicted_bytes_total %" PRId64 "\n", c.bytes_evicted);
+
+	buffer_putliteral(B, "# EOF\n");
+}
+
+/*
+Answer any pending requests on the metrics endpoint.
+Each request is read and answered with a short timeout,
+so that a slow client cannot hold up the worker.
+*/
+
+static void handle_metrics_requests()
+{
+	struct link *l;
+
+	while (metrics_server && (l = link_accept(metrics_server, LINK_NOWAIT))) {
+		time_t stoptime = time(0) + 5;
+		char line[VINE_LINE_MAX];
+		char path[VINE_LINE_MAX];
+
+		if (link_readline(l, line, sizeof(line), stoptime) && sscanf(line, "GET %s HTTP/%*d.%*d", path) == 1) {
+			/* Consume the headers up to the blank line. */
+			while (link_readline(l, line, sizeof(line), stoptime) && line[0]) {
+			}
+
+			if (!strcmp(path, "/metrics")) {
+				buffer_t B;
+				buffer_init(&B);
+				write_metrics(&B);
+				link_printf(l,
+						stoptime,
+						"HTTP/1.1 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+						buffer_pos(&B));
+				link_write(l, buffer_tostring(&B), buffer_pos(&B), stoptime);
+				buffer_free(&B);
+			} else {
+				link_printf(l, stoptime, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			}
+		}
+
+		link_close(l);
+	}
+}
+
 /* Start working for the (newly connected) manager on this given link. */
 
 static void vine_worker_serve_manager(struct link *manager)
@@ -1634,6 +2282,8 @@ static void vine_worker_serve_manager(struct link *manager)
 			reset_idle_timer();
 		}
 
+		check_lend_request(manager);
+
 		if (options->initial_ppid != 0 && getppid() != options->initial_ppid) {
 			debug(D_NOTICE, "parent process exited, shutting down\n");
 			break;
@@ -1653,6 +2303,21 @@ static void vine_worker_serve_manager(struct link *manager)
 
 		int wait_msec = 5000;
 
+		/* wake up in time for the next pass over the monitored tasks. */
+		if (task_monitor && itable_size(procs_running) > 0) {
+			wait_msec = MIN(wait_msec, 1000 * monitor_poll_interval());
+		}
+
+		/* wake up often enough to answer metrics requests promptly. */
+		if (metrics_server) {
+			wait_msec = MIN(wait_msec, 1000);
+		}
+
+		/* wake up often enough to send changes to watched files promptly. */
+		if (vine_watcher_size(watcher) > 0) {
+			wait_msec = MIN(wait_msec, 1000);
+		}
+
 		if (sigchld_received_flag) {
 			wait_msec = 0;
 			sigchld_received_flag = 0;
@@ -1672,8 +2337,12 @@ static void vine_worker_serve_manager(struct link *manager)
 		ok &= handle_completed_tasks(manager);
 		ok &= vine_cache_wait(cache_manager, manager);
 
+		handle_metrics_requests();
+
 		measure_worker_resources();
 
+		evict_cache_if_needed(manager);
+
 		if (!enforce_worker_promises(manager)) {
 			finish_running_tasks(VINE_RESULT_FORSAKEN);
 			abort_flag = 1;
@@ -1682,6 +2351,9 @@ static void vine_worker_serve_manager(struct link *manager)
 
 		enforce_processes_max_running_time();
 
+		/* measure the tasks monitored by the worker, and end those above their limits. */
+		monitor_processes(manager);
+
 		/* end a running processes if goes above its declared limits.
 		 * Mark offending process as RESOURCE_EXHASTION. */
 		enforce_processes_sandbox_limits();
@@ -1706,14 +2378,19 @@ static void vine_worker_serve_manager(struct link *manager)
 			int visited;
 			int waiting = list_size(procs_waiting);
 
+			/* Inputs are fetched ahead only for the first prefetch_tasks processes that must wait. */
+			int prefetched = 0;
+
 			for (visited = 0; visited < waiting; visited++) {
 				p = list_pop_head(procs_waiting);
+				int prefetch = options->prefetch_tasks < 0 || prefetched < options->prefetch_tasks;
 				if (!p) {
 					break;
 				} else if (process_ready_to_run_now(p, cache_manager, manager)) {
 					start_process(p, manager);
 					task_event++;
-				} else if (process_can_run_eventually(p, cache_manager, manager)) {
+				} else if (process_can_run_eventually(p, cache_manager, manager, prefetch)) {
+					prefetched++;
 					list_push_tail(procs_waiting, p);
 				} else {
 					debug(D_VINE, "No suitable library found for task %d", p->task->task_id);
@@ -1831,6 +2508,8 @@ static int vine_worker_serve_manager_by_hostport(const char *host, int port, con
 
 	/* Start the cache manager and scan for existing files. */
 	cache_manager = vine_cache_create(workspace->cache_dir);
+	vine_cache_set_eviction(cache_manager, options->cache_eviction);
+	vine_cache_set_url_streams(cache_manager, options->url_streams, options->url_part_size);
 	vine_cache_load(cache_manager);
 
 	/* Start the transfer server, which serves up the cache directory. */
@@ -1849,6 +2528,13 @@ static int vine_worker_serve_manager_by_hostport(const char *host, int port, con
 	last_task_received = 0;
 	results_to_be_sent_msg = 0;
 
+	/* A worker released after asking to be lent keeps its cache for the busier manager. */
+	int lent = lend_target && released_by_manager;
+	if (!lent) {
+		jx_delete(lend_target);
+		lend_target = 0;
+	}
+
 	disconnect_manager(manager);
 	printf("disconnected from manager %s:%d\n", host, port);
 
@@ -1857,8 +2543,10 @@ static int vine_worker_serve_manager_by_hostport(const char *host, int port, con
 	/* Stop the transfer server from serving the cache directory. */
 	vine_transfer_server_stop();
 
-	/* Remove all cached files of workflow or less. */
-	vine_cache_prune(cache_manager, VINE_CACHE_LEVEL_WORKFLOW);
+	/* Remove all cached files of workflow or less, unless lent to another manager. */
+	if (!lent) {
+		vine_cache_prune(cache_manager, VINE_CACHE_LEVEL_WORKFLOW);
+	}
 
 	/* Stop the cache manager. */
 	vine_cache_delete(cache_manager);
@@ -1943,11 +2631,11 @@ static int vine_worker_serve_manager_by_name(const char *catalog_hosts, const ch
 
 	debug(D_VINE, "project name %s matches %d managers", project_regex, list_size(managers_list));
 
-	if (list_size(managers_list) == 0)
+	if (list_size(managers_list) == 0 && !lend_target)
 		return 0;
 
 	// shuffle the list by r items to distribute the load across managers
-	int r = rand() % list_size(managers_list);
+	int r = list_size(managers_list) > 0 ? rand() % list_size(managers_list) : 0;
 	int i;
 	for (i = 0; i < r; i++) {
 		list_push_tail(managers_list, list_pop_head(managers_list));
@@ -1956,7 +2644,8 @@ static int vine_worker_serve_manager_by_name(const char *catalog_hosts, const ch
 	static struct manager_address *last_addr = NULL;
 
 	while (1) {
-		struct jx *jx = list_peek_head(managers_list);
+		/* A worker lent by its last manager goes to the busier manager first. */
+		struct jx *jx = lend_target ? lend_target : list_peek_head(managers_list);
 
 		const char *project = jx_lookup_string(jx, "project");
 		const char *name = jx_lookup_string(jx, "name");
@@ -1971,7 +2660,7 @@ static int vine_worker_serve_manager_by_name(const char *catalog_hosts, const ch
 			pref = options->preferred_connection;
 		}
 
-		if (last_addr) {
+		if (last_addr && !lend_target) {
 			if (time(0) > options->idle_stoptime && strcmp(addr, last_addr->host) == 0 && port == last_addr->port) {
 				if (list_size(managers_list) < 2) {
 					free(last_addr);
@@ -2003,6 +2692,10 @@ static int vine_worker_serve_manager_by_name(const char *catalog_hosts, const ch
 			manager_addresses = interfaces_to_list(addr, port, host_aliases);
 		}
 
+		/* The entry of the busier manager is used up, and serving it may set another. */
+		struct jx *lent_to = lend_target;
+		lend_target = 0;
+
 		result = vine_worker_serve_manager_by_hostport_list(manager_addresses, use_ssl);
 
 		struct manager_address *m;
@@ -2019,6 +2712,8 @@ static int vine_worker_serve_manager_by_name(const char *catalog_hosts, const ch
 			last_addr->port = port;
 		}
 
+		jx_delete(lent_to);
+
 		return result;
 	}
 }
@@ -2244,6 +2939,12 @@ int main(int argc, char *argv[])
 	signal(SIGUSR2, handle_abort);
 	signal(SIGCHLD, handle_sigchld);
 
+	/* Open the trace file before moving into the workspace, so that a relative path is taken from here. */
+	if (options->trace_file && !vine_trace_open(options->trace_file, worker_id)) {
+		fprintf(stderr, "vine_worker: couldn't open trace file %s: %s\n", options->trace_file, strerror(errno));
+		exit(1);
+	}
+
 	/* Create the workspace directory and move there. */
 	workspace = vine_workspace_create(options->workspace_dir);
 	if (!workspace) {
@@ -2266,6 +2967,17 @@ int main(int argc, char *argv[])
 
 	options->connect_stoptime = time(0) + options->connect_timeout;
 
+	if (options->core_affinity != VINE_CORE_AFFINITY_NONE) {
+		worker_cpus = cpu_allocator_create();
+		if (!worker_cpus) {
+			fprintf(stderr, "vine_worker: couldn't find the cpus of this host for --core-affinity.\n");
+			exit(1);
+		}
+		if (options->core_affinity == VINE_CORE_AFFINITY_SPREAD) {
+			cpu_allocator_set_policy(worker_cpus, CPU_ALLOCATOR_SPREAD);
+		}
+	}
+
 	/* Display the available resources once at startup. */
 	measure_worker_resources();
 	printf("vine_worker: using %" PRId64 " cores, %" PRId64 " MB memory, %" PRId64 " MB disk, %" PRId64 " gpus\n",
@@ -2282,11 +2994,30 @@ int main(int argc, char *argv[])
 		free(gpu_name);
 	}
 
+	if (options->metrics_port > 0) {
+		metrics_server = link_serve(options->metrics_port);
+		if (!metrics_server) {
+			fprintf(stderr, "vine_worker: couldn't serve metrics on port %d: %s\n", options->metrics_port, strerror(errno));
+			exit(1);
+		}
+		printf("vine_worker: serving metrics on port %d\n", options->metrics_port);
+	}
+
 	/* MAIN LOOP: get to work */
 	vine_worker_serve_managers();
 
 	/* Clean up data structures to satisfy valgrind at process exit. */
 
+	if (metrics_server) {
+		link_close(metrics_server);
+		metrics_server = 0;
+	}
+
+	vine_trace_close();
+
+	cpu_allocator_delete(worker_cpus);
+	worker_cpus = 0;
+
 	vine_workspace_delete(workspace);
 	workspace = 0;
 	vine_worker_delete_structures();
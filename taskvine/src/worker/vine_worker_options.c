@@ -29,6 +29,7 @@ struct vine_worker_options *vine_worker_options_create()
 	memset(self, 0, sizeof(*self));
 
 	self->gpus_total = -1;
+	self->gpu_slots = 1;
 	self->idle_timeout = 900;
 	self->connect_timeout = 900;
 	self->active_timeout = 3600;
@@ -38,6 +39,7 @@ struct vine_worker_options *vine_worker_options_create()
 
 	self->check_resources_interval = 5;
 	self->max_time_on_measurement = 3;
+	self->disk_verify_interval = 300;
 
 	self->features = hash_table_create(0, 0);
 
@@ -49,6 +51,17 @@ struct vine_worker_options *vine_worker_options_create()
 	self->catalog_hosts = xxstrdup(CATALOG_HOST);
 	self->disk_percent = 50;
 
+	self->cache_eviction = VINE_CACHE_EVICTION_NONE;
+	self->cache_high_watermark = 90;
+	self->cache_low_watermark = 80;
+
+	self->stagein_mode = VINE_STAGEIN_LINK;
+	self->prefetch_tasks = -1;
+	self->task_launch = VINE_TASK_LAUNCH_FORK;
+	self->core_affinity = VINE_CORE_AFFINITY_NONE;
+	self->url_streams = 4;
+	self->url_part_size = 64 * MEGABYTE;
+
 	self->initial_ppid = 0;
 
 	self->tls_sni = NULL;
@@ -58,6 +71,10 @@ struct vine_worker_options *vine_worker_options_create()
 
 	self->reported_transfer_host = 0;
 
+	self->metrics_port = 0;
+
+	self->trace_file = 0;
+
 	return self;
 }
 
@@ -76,6 +93,8 @@ void vine_worker_options_delete(struct vine_worker_options *self)
 		free(self->factory_name);
 	if (self->reported_transfer_host)
 		free(self->reported_transfer_host);
+	if (self->trace_file)
+		free(self->trace_file);
 
 	hash_table_delete(self->features);
 	free(self);
@@ -102,6 +121,7 @@ void vine_worker_options_show_help(const char *cmd, struct vine_worker_options *
 	printf(" %-30s Set both --idle-timeout and --connect-timeout.\n", "-t,--timeout=<time>");
 	printf(" %-30s Disconnect after this time if manager sends no work. (default=%ds)\n", "   --idle-timeout=<time>", options->idle_timeout);
 	printf(" %-30s Abort after this time if no managers are available. (default=%ds)\n", "   --connect-timeout=<time>", options->idle_timeout);
+	printf(" %-30s With -M, after this time without work, offer to serve a busier manager. (default=off)\n", "--lend-interval=<time>");
 	printf(" %-30s Exit if parent process dies.\n", "--parent-death");
 	printf(" %-30s Set TCP window size.\n", "-w,--tcp-window-size=<size>");
 	printf(" %-30s Set initial value for backoff interval when worker fails to connect\n", "-i,--min-backoff=<time>");
@@ -120,6 +140,9 @@ void vine_worker_options_show_help(const char *cmd, struct vine_worker_options *
 	printf(" %-30s Set the number of GPUs reported by this worker. If not given, or less than 0,\n", "--gpus=<n>");
 	printf(" %-30s then try to detect gpus available.\n", "");
 
+	printf(" %-30s Divide each GPU into this many slots, to be shared by tasks under MPS.\n", "--gpu-slots=<n>");
+	printf(" %-30s Defaults to %d.\n", "", options->gpu_slots);
+
 	printf(" %-30s Manually set the amount of memory (in MB) reported by this worker.\n", "--memory=<mb>");
 	printf(" %-30s If not given, or less than 1, then try to detect memory available.\n", "");
 
@@ -128,6 +151,27 @@ void vine_worker_options_show_help(const char *cmd, struct vine_worker_options *
 
 	printf(" %-30s Set the conservative disk reporting percent when --disk is unspecified.\n", "--disk-percent=<percent>");
 	printf(" %-30s Defaults to %d.\n", "", options->disk_percent);
+	printf(" %-30s Walk the cache and task sandboxes to verify disk usage this often.\n", "--disk-verify-interval=<secs>");
+	printf(" %-30s Defaults to %d.\n", "", options->disk_verify_interval);
+
+	printf(" %-30s Evict cached files to keep within the worker disk: none, lru, lfu, or gdsf.\n", "--cache-eviction=<policy>");
+	printf(" %-30s Defaults to none.\n", "");
+	printf(" %-30s Start evicting cached files above this percent of the worker disk.\n", "--cache-high-watermark=<percent>");
+	printf(" %-30s Defaults to %d.\n", "", options->cache_high_watermark);
+	printf(" %-30s Stop evicting cached files below this percent of the worker disk.\n", "--cache-low-watermark=<percent>");
+	printf(" %-30s Defaults to %d.\n", "", options->cache_low_watermark);
+	printf(" %-30s Place inputs in task sandboxes by hard link, clone (copy-on-write), or symlink.\n", "--stagein-mode=<mode>");
+	printf(" %-30s Defaults to link.\n", "");
+	printf(" %-30s Fetch inputs ahead for this many waiting tasks (-1 for all).\n", "--prefetch-tasks=<n>");
+	printf(" %-30s Defaults to %d.\n", "", options->prefetch_tasks);
+	printf(" %-30s Start tasks with fork or posix spawn (spawn is faster for a large worker).\n", "--task-launch=<fork|spawn>");
+	printf(" %-30s Defaults to fork.\n", "");
+	printf(" %-30s Bind each task to cpus of its own, packed into numa nodes or spread across them.\n", "--core-affinity=<none|compact|spread>");
+	printf(" %-30s Defaults to none.\n", "");
+	printf(" %-30s Fetch large urls as this many ranges at once (1 to disable).\n", "--url-streams=<n>");
+	printf(" %-30s Defaults to %d.\n", "", options->url_streams);
+	printf(" %-30s Size of each range of a large url, in MB.\n", "--url-part-size=<mb>");
+	printf(" %-30s Defaults to %d.\n", "", (int)(options->url_part_size / MEGABYTE));
 
 	printf(" %-30s Use loop devices for task sandboxes (default=disabled, requires root access).\n", "--disk-allocation");
 	printf(" %-30s Specifies a user-defined feature the worker provides. May be specified several times.\n", "--feature");
@@ -140,6 +184,8 @@ void vine_worker_options_show_help(const char *cmd, struct vine_worker_options *
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf(" %-30s Listening port for worker-worker transfers. Either port or port_min:port_max (default: any)\n", "--transfer-port");
 	printf(" %-30s Explicit contact host:port for worker-worker transfers, e.g., when routing is used. (default: :<transfer_port>)\n", "--contact-hostport");
+	printf(" %-30s Serve cache and transfer metrics in OpenMetrics format at http://<host>:<port>/metrics. (default: off)\n", "--metrics-port=<port>");
+	printf(" %-30s Write the steps of each task in Chrome trace format to this file. (default: off)\n", "--trace-file=<file>");
 
 	printf(" %-30s Enable tls connection to manager (manager should support it).\n", "--ssl");
 	printf(" %-30s SNI domain name if different from manager hostname. Implies --ssl.\n", "--tls-sni=<domain name>");
@@ -153,9 +199,21 @@ enum {
 	LONG_OPT_MEMORY,
 	LONG_OPT_DISK,
 	LONG_OPT_DISK_PERCENT,
+	LONG_OPT_DISK_VERIFY_INTERVAL,
+	LONG_OPT_CACHE_EVICTION,
+	LONG_OPT_CACHE_HIGH_WATERMARK,
+	LONG_OPT_CACHE_LOW_WATERMARK,
+	LONG_OPT_STAGEIN_MODE,
+	LONG_OPT_PREFETCH_TASKS,
+	LONG_OPT_TASK_LAUNCH,
+	LONG_OPT_CORE_AFFINITY,
+	LONG_OPT_URL_STREAMS,
+	LONG_OPT_URL_PART_SIZE,
 	LONG_OPT_GPUS,
+	LONG_OPT_GPU_SLOTS,
 	LONG_OPT_OPTIONS_IDLE_TIMEOUT,
 	LONG_OPT_CONNECT_TIMEOUT,
+	LONG_OPT_LEND_INTERVAL,
 	LONG_OPT_SINGLE_SHOT,
 	LONG_OPT_WALL_TIME,
 	LONG_OPT_MEMORY_THRESHOLD,
@@ -168,6 +226,8 @@ enum {
 	LONG_OPT_FROM_FACTORY,
 	LONG_OPT_TRANSFER_PORT,
 	LONG_OPT_CONTACT_HOSTPORT,
+	LONG_OPT_METRICS_PORT,
+	LONG_OPT_TRACE_FILE,
 	LONG_OPT_WORKSPACE,
 	LONG_OPT_KEEP_WORKSPACE,
 };
@@ -183,6 +243,7 @@ static const struct option long_options[] = {{"advertise", no_argument, 0, 'a'},
 		{"timeout", required_argument, 0, 't'},
 		{"idle-timeout", required_argument, 0, LONG_OPT_OPTIONS_IDLE_TIMEOUT},
 		{"connect-timeout", required_argument, 0, LONG_OPT_CONNECT_TIMEOUT},
+		{"lend-interval", required_argument, 0, LONG_OPT_LEND_INTERVAL},
 		{"tcp-window-size", required_argument, 0, 'w'},
 		{"min-backoff", required_argument, 0, 'i'},
 		{"max-backoff", required_argument, 0, 'b'},
@@ -199,7 +260,18 @@ static const struct option long_options[] = {{"advertise", no_argument, 0, 'a'},
 		{"memory", required_argument, 0, LONG_OPT_MEMORY},
 		{"disk", required_argument, 0, LONG_OPT_DISK},
 		{"disk-percent", required_argument, 0, LONG_OPT_DISK_PERCENT},
+		{"disk-verify-interval", required_argument, 0, LONG_OPT_DISK_VERIFY_INTERVAL},
+		{"cache-eviction", required_argument, 0, LONG_OPT_CACHE_EVICTION},
+		{"cache-high-watermark", required_argument, 0, LONG_OPT_CACHE_HIGH_WATERMARK},
+		{"cache-low-watermark", required_argument, 0, LONG_OPT_CACHE_LOW_WATERMARK},
+		{"stagein-mode", required_argument, 0, LONG_OPT_STAGEIN_MODE},
+		{"prefetch-tasks", required_argument, 0, LONG_OPT_PREFETCH_TASKS},
+		{"task-launch", required_argument, 0, LONG_OPT_TASK_LAUNCH},
+		{"core-affinity", required_argument, 0, LONG_OPT_CORE_AFFINITY},
+		{"url-streams", required_argument, 0, LONG_OPT_URL_STREAMS},
+		{"url-part-size", required_argument, 0, LONG_OPT_URL_PART_SIZE},
 		{"gpus", required_argument, 0, LONG_OPT_GPUS},
+		{"gpu-slots", required_argument, 0, LONG_OPT_GPU_SLOTS},
 		{"wall-time", required_argument, 0, LONG_OPT_WALL_TIME},
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'v'},
@@ -211,6 +283,8 @@ static const struct option long_options[] = {{"advertise", no_argument, 0, 'a'},
 		{"from-factory", required_argument, 0, LONG_OPT_FROM_FACTORY},
 		{"transfer-port", required_argument, 0, LONG_OPT_TRANSFER_PORT},
 		{"contact-hostport", required_argument, 0, LONG_OPT_CONTACT_HOSTPORT},
+		{"metrics-port", required_argument, 0, LONG_OPT_METRICS_PORT},
+		{"trace-file", required_argument, 0, LONG_OPT_TRACE_FILE},
 		{0, 0, 0, 0}};
 
 static void vine_worker_options_get_env(const char *name, int64_t *manual_option)
@@ -318,6 +392,9 @@ void vine_worker_options_get(struct vine_worker_options *options, int argc, char
 		case LONG_OPT_CONNECT_TIMEOUT:
 			options->connect_timeout = string_time_parse(optarg);
 			break;
+		case LONG_OPT_LEND_INTERVAL:
+			options->lend_interval = MAX(string_time_parse(optarg), 0);
+			break;
 		case 'o':
 			debug_config_file(optarg);
 			break;
@@ -406,6 +483,69 @@ void vine_worker_options_get(struct vine_worker_options *options, int argc, char
 				options->disk_percent = MIN(100, MAX(atoi(optarg), 0));
 			}
 			break;
+		case LONG_OPT_DISK_VERIFY_INTERVAL:
+			options->disk_verify_interval = MAX(atoi(optarg), 0);
+			break;
+		case LONG_OPT_CACHE_EVICTION:
+			if (!vine_cache_eviction_from_string(optarg, &options->cache_eviction)) {
+				fprintf(stderr, "vine_worker: unknown cache eviction policy: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case LONG_OPT_CACHE_HIGH_WATERMARK:
+			options->cache_high_watermark = MIN(100, MAX(atoi(optarg), 1));
+			break;
+		case LONG_OPT_CACHE_LOW_WATERMARK:
+			options->cache_low_watermark = MIN(100, MAX(atoi(optarg), 0));
+			break;
+		case LONG_OPT_STAGEIN_MODE:
+			if (!strcmp(optarg, "link")) {
+				options->stagein_mode = VINE_STAGEIN_LINK;
+			} else if (!strcmp(optarg, "clone")) {
+				options->stagein_mode = VINE_STAGEIN_CLONE;
+			} else if (!strcmp(optarg, "symlink")) {
+				options->stagein_mode = VINE_STAGEIN_SYMLINK;
+			} else {
+				fprintf(stderr, "vine_worker: unknown stagein mode: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case LONG_OPT_PREFETCH_TASKS:
+			options->prefetch_tasks = MAX(atoi(optarg), -1);
+			break;
+		case LONG_OPT_TASK_LAUNCH:
+			if (!strcmp(optarg, "fork")) {
+				options->task_launch = VINE_TASK_LAUNCH_FORK;
+			} else if (!strcmp(optarg, "spawn")) {
+#ifdef HAS_POSIX_SPAWN_ADDCHDIR
+				options->task_launch = VINE_TASK_LAUNCH_SPAWN;
+#else
+				fprintf(stderr, "vine_worker: --task-launch=spawn is not supported on this platform.\n");
+				exit(1);
+#endif
+			} else {
+				fprintf(stderr, "vine_worker: unknown task launch method: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case LONG_OPT_CORE_AFFINITY:
+			if (!strcmp(optarg, "none")) {
+				options->core_affinity = VINE_CORE_AFFINITY_NONE;
+			} else if (!strcmp(optarg, "compact")) {
+				options->core_affinity = VINE_CORE_AFFINITY_COMPACT;
+			} else if (!strcmp(optarg, "spread")) {
+				options->core_affinity = VINE_CORE_AFFINITY_SPREAD;
+			} else {
+				fprintf(stderr, "vine_worker: unknown core affinity: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case LONG_OPT_URL_STREAMS:
+			options->url_streams = MAX(atoi(optarg), 1);
+			break;
+		case LONG_OPT_URL_PART_SIZE:
+			options->url_part_size = MAX(atoll(optarg), 1) * MEGABYTE;
+			break;
 		case LONG_OPT_GPUS:
 			if (!strncmp(optarg, "all", 3)) {
 				options->gpus_total = -1;
@@ -413,6 +553,9 @@ void vine_worker_options_get(struct vine_worker_options *options, int argc, char
 				options->gpus_total = atoi(optarg);
 			}
 			break;
+		case LONG_OPT_GPU_SLOTS:
+			options->gpu_slots = MAX(atoi(optarg), 1);
+			break;
 		case LONG_OPT_WALL_TIME:
 			options->manual_wall_time_option = atoi(optarg);
 			if (options->manual_wall_time_option < 1) {
@@ -458,6 +601,13 @@ void vine_worker_options_get(struct vine_worker_options *options, int argc, char
 		case LONG_OPT_CONTACT_HOSTPORT:
 			set_transfer_host(options, optarg);
 			break;
+		case LONG_OPT_METRICS_PORT:
+			options->metrics_port = atoi(optarg);
+			break;
+		case LONG_OPT_TRACE_FILE:
+			free(options->trace_file);
+			options->trace_file = xxstrdup(optarg);
+			break;
 		default:
 			vine_worker_options_show_help(argv[0], options);
 			exit(1);
@@ -7,6 +7,27 @@
 
 #include "hash_table.h"
 #include "timestamp.h"
+#include "vine_cache.h"
+
+/* How cached inputs are placed into task sandboxes. */
+typedef enum {
+	VINE_STAGEIN_LINK,    /* Hard link each file, as the default. */
+	VINE_STAGEIN_CLONE,   /* Clone each file copy-on-write where the filesystem allows, else hard link it. */
+	VINE_STAGEIN_SYMLINK, /* Symlink each input as a whole, even a directory. */
+} vine_stagein_mode_t;
+
+/* How tasks are bound to the cpus of the worker. */
+typedef enum {
+	VINE_CORE_AFFINITY_NONE,    /* Tasks run on any cpu, as the default. */
+	VINE_CORE_AFFINITY_COMPACT, /* Pack tasks into the fullest numa node with room for them. */
+	VINE_CORE_AFFINITY_SPREAD,  /* Place each task in the emptiest numa node with room for it. */
+} vine_core_affinity_t;
+
+/* How task processes are started. */
+typedef enum {
+	VINE_TASK_LAUNCH_FORK,  /* Fork the worker and exec the task, as the default. */
+	VINE_TASK_LAUNCH_SPAWN, /* Use posix_spawn, which avoids copying the page tables of the worker. */
+} vine_task_launch_t;
 
 struct vine_worker_options {
 	
@@ -19,6 +40,9 @@ struct vine_worker_options {
 	/* -1 means not given as a command line option. */
 	int64_t gpus_total;
 
+	/* Number of slots into which each gpu is divided, each reported as one gpu. */
+	int gpu_slots;
+
 	/* In single shot mode, immediately quit when disconnected. Useful for accelerating the test suite. */
 	int single_shot_mode;
 
@@ -34,6 +58,10 @@ struct vine_worker_options {
 	/* Maximum time to attempt connecting to all available managers before giving up. */
 	int connect_timeout;
 
+	/* With a project name, time without work after which the worker offers to
+	 * serve the busiest matching manager instead. Zero disables lending. */
+	int lend_interval;
+
 	/* Maximum time to attempt sending/receiving any given file or message. */
 	int active_timeout;
 
@@ -79,6 +107,11 @@ struct vine_worker_options {
 	/* Maximum number of seconds to spend on each resource management. */
 	int max_time_on_measurement;
 
+	/* The disk used by the cache is accounted as objects come and go, and the
+	 * disk used by sandboxes is bounded by the growth of the filesystem. The
+	 * cache directory and the sandboxes are walked to verify these only this often. */
+	int disk_verify_interval;
+
 	/* Name of worker architecture and operating system */
 	char *arch_name;
 	char *os_name;
@@ -98,6 +131,31 @@ struct vine_worker_options {
 	 * Defaults to 90%. */
 	int disk_percent;
 
+	/* Policy to evict cached files when the cache and the task sandboxes exceed
+	 * cache_high_watermark percent of the worker disk, until they are below
+	 * cache_low_watermark percent. Defaults to no eviction. */
+	vine_cache_eviction_t cache_eviction;
+	int cache_high_watermark;
+	int cache_low_watermark;
+
+	/* How cached inputs are placed into task sandboxes. Defaults to hard links. */
+	vine_stagein_mode_t stagein_mode;
+
+	/* Number of waiting tasks, in order of arrival, whose inputs are fetched
+	 * before they can run. Defaults to -1, for all waiting tasks. */
+	int prefetch_tasks;
+
+	/* How task processes are started. Defaults to fork. */
+	vine_task_launch_t task_launch;
+
+	/* How tasks are bound to cpus of their own. Defaults to none. */
+	vine_core_affinity_t core_affinity;
+
+	/* Number of ranges of a large url fetched at once, and the size of each range in bytes.
+	 * Defaults to 4 ranges of 64MB. */
+	int url_streams;
+	int64_t url_part_size;
+
 	/* The parent process pid, to detect when the parent has exited. */
 	pid_t initial_ppid;
 
@@ -108,6 +166,12 @@ struct vine_worker_options {
   /* Explicit contact host (address or hostname) for transfers bewteen workers. */
   char *reported_transfer_host;
   int reported_transfer_port;
+
+	/* Port on which to serve metrics over HTTP, or zero for none. */
+	int metrics_port;
+
+	/* File to which spans of the life of each task are written, or null for none. */
+	char *trace_file;
 };
 
 struct vine_worker_options * vine_worker_options_create();
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+import_config_val CCTOOLS_PYTHON_TEST_EXEC
+
+LOG=analyze.transactions
+OUT=analyze.out
+
+check_needed()
+{
+	[ -n "${CCTOOLS_PYTHON_TEST_EXEC}" ] || return 1
+}
+
+prepare()
+{
+	# One file fetched from the manager and then from a peer,
+	# one url fetched twice to the same host around an eviction,
+	# and one file created at the worker.
+	cat > $LOG <<EOF_LOG
+100 1 MANAGER 1 START 0
+110 1 WORKER worker-a CONNECTION 10.0.0.1:1234
+120 1 WORKER worker-b CONNECTION 10.0.0.2:1234
+130 1 WORKER worker-a TRANSFER INPUT in.dat 1000 5 125 file-meta-in
+140 1 WORKER worker-b CACHE_UPDATE file-meta-in 1000 5 135 PEER
+150 1 WORKER worker-a CACHE_UPDATE url-meta-u 5000 5 145 URL
+160 1 WORKER worker-a CACHE_INVALID url-meta-u EVICTED
+170 1 WORKER worker-a CACHE_UPDATE url-meta-u 5000 5 165 URL
+175 1 WORKER worker-a CACHE_UPDATE temp-rnd-x 300 5 165 LOCAL
+180 1 WORKER worker-a TRANSFER OUTPUT out.dat 50 5 175 file-rnd-out
+EOF_LOG
+}
+
+run()
+{
+	${CCTOOLS_PYTHON_TEST_EXEC} ../src/tools/vine_analyze_transfers --json $LOG > $OUT || return 1
+	cat $OUT
+
+	${CCTOOLS_PYTHON_TEST_EXEC} - $OUT <<EOF_CHECK
+import json, sys
+s = json.load(open(sys.argv[1]))
+assert s["fetches"] == 4, s
+assert s["bytes_moved"] == 12000, s
+assert s["bytes_unique"] == 6000, s
+assert s["bytes_by_source"] == {"MANAGER": 1000, "PEER": 1000, "URL": 10000}, s
+assert s["duplicates"] == 1, s
+assert s["after_eviction"] == 1, s
+assert s["local_files"] == 1, s
+assert s["output_bytes"] == 50, s
+EOF_CHECK
+}
+
+clean()
+{
+	rm -f $LOG $OUT
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+trace=vine_replay.trace
+
+prepare()
+{
+	# Two workers of 4 cores, and three tasks reading a 100MB file, of which
+	# one also reads the output of another.  The transfer recorded gives a
+	# bandwidth of 10^8 bytes per second.
+	cat > $trace <<EOF2
+{"event":"start","time":1000000000,"version":1}
+{"event":"worker","time":1000000000,"worker":"w1","host":"a","cores":4,"memory":4000,"disk":10000,"gpus":0}
+{"event":"worker","time":1000000000,"worker":"w2","host":"b","cores":4,"memory":4000,"disk":10000,"gpus":0}
+{"event":"submit","time":1001000000,"task":1,"category":"default","priority":0,"cores":1,"memory":-1,"disk":-1,"gpus":-1,"inputs":[{"name":"data","type":"file","size":100000000,"cache":1}],"outputs":["temp-1"]}
+{"event":"submit","time":1001000000,"task":2,"category":"default","priority":0,"cores":1,"memory":-1,"disk":-1,"gpus":-1,"inputs":[{"name":"data","type":"file","size":100000000,"cache":1},{"name":"temp-1","type":"temp","size":0,"cache":1}],"outputs":[]}
+{"event":"submit","time":1001000000,"task":3,"category":"default","priority":0,"cores":1,"memory":-1,"disk":-1,"gpus":-1,"inputs":[{"name":"data","type":"file","size":100000000,"cache":1}],"outputs":[]}
+{"event":"transfer","time":1002000000,"worker":"w1","name":"data","size":100000000,"duration":1000000}
+{"event":"done","time":1005000000,"task":1,"worker":"w1","result":"SUCCESS","duration":3000000,"outputs":[{"name":"temp-1","size":5000000}]}
+{"event":"done","time":1005000000,"task":3,"worker":"w1","result":"SUCCESS","duration":3000000,"outputs":[]}
+{"event":"done","time":1008000000,"task":2,"worker":"w1","result":"SUCCESS","duration":3000000,"outputs":[]}
+EOF2
+	return 0
+}
+
+run()
+{
+	../src/tools/vine_replay -s files,fcfs,random $trace > replay.out || return 1
+	cat replay.out
+
+	grep -q "3 tasks submitted, 3 completed" replay.out || return 1
+
+	# Every policy replays all tasks, and the reader of temp-1 waits
+	# for it, so no run can be shorter than 1s of transfer and 6s of execution.
+	for policy in files fcfs random
+	do
+		awk -v p=$policy '$1 == p && $2 == 3 && $3 >= 7.0 { found = 1 } END { exit !found }' replay.out || return 1
+	done
+
+	# Nothing is read twice from the manager when all tasks go where the data is.
+	awk '$1 == "files" && $6 == 95.4 { found = 1 } END { exit !found }' replay.out
+}
+
+clean()
+{
+	rm -f $trace replay.out
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
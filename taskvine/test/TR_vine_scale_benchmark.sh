@@ -0,0 +1,26 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+prepare()
+{
+	return 0
+}
+
+run()
+{
+	# A small run keeps the simulated workers in step with the manager protocol.
+	../src/tools/vine_scale_benchmark -w 20 -P 2 -n 200 -t 0.01 -i 64K -o 2K > benchmark.out || return 1
+	cat benchmark.out
+
+	grep -q "200 submitted" benchmark.out
+}
+
+clean()
+{
+	rm -rf vine-run-info benchmark.out
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
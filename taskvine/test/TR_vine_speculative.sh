@@ -0,0 +1,72 @@
+#!/bin/sh
+
+# A task running far longer than the others of its category is duplicated
+# on a second worker.  The duplicate is internal to the manager, so it is
+# not counted among the tasks submitted or returned to the user.
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src/tools:../src/worker:$PATH
+
+prepare()
+{
+	rm -f manager.port manager.out
+	return 0
+}
+
+run()
+{
+	cat > manager.script << EOF
+tune speculative-quantile 0.5
+submit 0 0 0 10
+wait
+submit 0 12 0 1
+wait
+stats
+quit
+EOF
+
+	echo "starting manager"
+	../src/tools/vine_benchmark -Z manager.port < manager.script > manager.out &
+	manager=$!
+
+	wait_for_file_creation manager.port 5 || return 1
+	port=`cat manager.port`
+
+	echo "starting workers"
+	workers=""
+	for i in 1 2
+	do
+		../src/worker/vine_worker -o worker.$i.log -d all --timeout 30 --cores 1 --memory 250 --disk 2000 localhost $port &
+		workers="$workers $!"
+	done
+
+	wait $manager
+	status=$?
+	kill $workers 2>/dev/null
+
+	cat manager.out
+	[ $status -eq 0 ] || return 1
+
+	grep -q "tasks_submitted 11$" manager.out || return 1
+	grep -q "tasks_done 11$" manager.out || return 1
+	grep -q "tasks_speculative 1$" manager.out || return 1
+
+	i=0
+	while [ $i -lt 11 ]
+	do
+		[ -f output.$i ] || { echo "output.$i is missing"; return 1; }
+		i=$((i+1))
+	done
+
+	return 0
+}
+
+clean()
+{
+	rm -rf manager.script manager.port manager.out vine_benchmark_info worker.*.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
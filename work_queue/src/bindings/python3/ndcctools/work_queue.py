@@ -465,6 +465,16 @@ class Task(object):
     def specify_snapshot_file(self, filename):
         return work_queue_specify_snapshot_file(self._task, filename)
 
+    ##
+    # Write the standard output of the task to a local file as it is
+    # received, rather than keeping it in memory. The output property is
+    # then empty.
+    #
+    # @param self           Reference to the current task object.
+    # @param filename       The name of the local file.
+    def specify_stdout_file(self, filename):
+        return work_queue_task_specify_stdout_file(self._task, filename)
+
     ##
     # Indicate the number of times the task should be retried. If 0 (the
     # default), the task is tried indefinitely. A task that did not succeed
@@ -607,6 +617,18 @@ class Task(object):
     def output(self):
         return self._task.output
 
+    ##
+    # Get the name of the local file with the standard output of the task,
+    # if one was given with @ref specify_stdout_file, or if the output was
+    # larger than the "stdout-memory-limit" of the queue. Must be called
+    # only after the task completes execution.
+    # @code
+    # >>> print(t.stdout_file)
+    # @endcode
+    @property
+    def stdout_file(self):
+        return self._task.stdout_file
+
     ##
     # Get the task id number. Must be called only after the task was submitted.
     # @code
@@ -1442,7 +1464,10 @@ class WorkQueue(object):
     # @param self       Reference to the current work queue object.
     # @param name       Name of the category.
     # @param multiplier The multiplier of the average task time at which point to abort; if zero, deacticate for the category, negative (the default), use the one for the "default" category (see @ref ndcctools.work_queue.WorkQueue.activate_fast_abort)
-    def activate_fast_abort_category(self, name, multiplier):
+    # @param quantile   If given, compare running times to this quantile of the task times of the category (e.g. 0.95) rather than to the average.
+    def activate_fast_abort_category(self, name, multiplier, quantile=None):
+        if quantile is not None:
+            return work_queue_activate_fast_abort_category_quantile(self._work_queue, name, multiplier, quantile)
         return work_queue_activate_fast_abort_category(self._work_queue, name, multiplier)
 
     ##
@@ -1588,8 +1613,12 @@ class WorkQueue(object):
     #
     # @param self     Reference to the current work queue object.
     # @param logfile  Filename.
-    def specify_transactions_log(self, logfile):
-        work_queue_specify_transactions_log(self._work_queue, logfile)
+    # @param binary   If true, write the log in the compact binary form read by work_queue_txlog_dump.
+    def specify_transactions_log(self, logfile, binary=False):
+        if binary:
+            work_queue_specify_transactions_log_binary(self._work_queue, logfile)
+        else:
+            work_queue_specify_transactions_log(self._work_queue, logfile)
 
     ##
     # Add a mandatory password that each worker must present.
@@ -1870,6 +1899,7 @@ class WorkQueue(object):
     # - "transfer-outlier-factor" Transfer that are this many times slower than the average will be aborted.  (default=10x)
     # - "default-transfer-rate" The assumed network bandwidth used until sufficient data has been collected.  (1MB/s)
     # - "fast-abort-multiplier" Set the multiplier of the average task time at which point to abort; if negative or zero fast_abort is deactivated. (default=0)
+    # - "fast-abort-quantile" Compare running times to this quantile of task times (e.g. 0.95) rather than to the average, for categories that use the default multiplier. (default=0, use the average)
     # - "keepalive-interval" Set the minimum number of seconds to wait before sending new keepalive checks to workers. (default=300)
     # - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
     # - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
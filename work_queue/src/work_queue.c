@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "work_queue_protocol.h"
 #include "work_queue_internal.h"
 #include "work_queue_resources.h"
+#include "work_queue_txlog.h"
 
 #include "cctools.h"
 #include "int_sizes.h"
@@ -44,6 +45,7 @@ See the file COPYING for details.
 #include "pattern.h"
 #include "tlq_config.h"
 #include "host_disk_info.h"
+#include "full_io.h"
 
 #include <unistd.h>
 #include <dirent.h>
@@ -83,6 +85,9 @@ See the file COPYING for details.
 
 #define MAX_TASK_STDOUT_STORAGE (1*GIGABYTE)
 
+// Size of the chunks in which the stdout of a task is received.
+#define WORK_QUEUE_STDOUT_CHUNK (64*1024)
+
 #define MAX_NEW_WORKERS 10
 
 // Result codes for signaling the completion of operations in WQ
@@ -137,6 +142,9 @@ static uint64_t disk_avail_threshold = 100;
 /* default timeout for slow workers to come back to the pool */
 double wq_option_blocklist_slow_workers_timeout = 900;
 
+/* relative error of the task time quantiles used by fast abort */
+#define WORK_QUEUE_TASK_TIME_ERROR 0.01
+
 /* Internal use: when the worker uses the client library, do not recompute cached names. */
 int wq_hack_do_not_compute_cached_name = 0;
 
@@ -154,8 +162,10 @@ struct work_queue {
 	char workingdir[PATH_MAX];
 
 	struct link      *manager_link;   // incoming tcp connection for workers.
-	struct link_info *poll_table;
+	struct link_poll_set *poll_set;   // manager link, foreman uplink, and worker links, registered once.
+	struct link_info *poll_table;     // active links returned by link_poll_set_wait.
 	int poll_table_size;
+	int manager_link_ready;           // manager link had a new connection in the last poll.
 
 	struct itable *tasks;           // taskid -> task
 	struct itable *task_state_map;  // taskid -> state
@@ -170,10 +180,14 @@ struct work_queue {
 	struct hash_table *categories;
 
 	struct hash_table *workers_with_available_results;
+	struct hash_table *workers_with_capacity;	// workers that have some resource free, by hashkey.
 
 	struct work_queue_stats *stats;
 	struct work_queue_stats *stats_measure;
 	struct work_queue_stats *stats_disconnected_workers;
+	struct work_queue_stats *stats_connected_workers;    // sum of the stats reported by the connected workers.
+	struct work_queue_resources *workers_resources;      // sum of the resources of the connected workers.
+	int workers_resources_extremes_valid;                // 0 if the smallest and largest of workers_resources are out of date.
 	timestamp_t time_last_wait;
 	timestamp_t time_last_log_stats;
 	timestamp_t time_last_large_tasks_check;
@@ -203,6 +217,10 @@ struct work_queue {
 
 	int hungry_minimum_factor;       /* queue is hungry if number of waiting tasks is less than hungry_minimum_factor * number of connected workers. */
 
+	int64_t stdout_memory_limit;     /* stdout of a task larger than this is spilled to disk. */
+
+	int target_makespan;             /* if > 0, seconds in which the tasks in the queue should complete. Used to predict hunger and the workers needed. */
+
 	int wait_for_workers;             /* wait for these many workers before dispatching tasks at start of execution. */
 	int attempt_schedule_depth;		  /* number of submitted tasks to attempt scheduling before we continue to retrievals */
 
@@ -210,6 +228,7 @@ struct work_queue {
 
 	FILE *logfile;
 	FILE *transactions_logfile;
+	struct work_queue_txlog *transactions_txlog;
 	int keepalive_interval;
 	int keepalive_timeout;
 	timestamp_t link_poll_end;	//tracks when we poll link; used to timeout unacknowledged keepalive checks
@@ -341,6 +360,8 @@ static void commit_task_to_worker(struct work_queue *q, struct work_queue_worker
 static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, work_queue_task_state_t new_state);
 static int cancel_task_on_worker(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
 static void count_worker_resources(struct work_queue *q, struct work_queue_worker *w);
+static void record_connected_worker_stats(struct work_queue *q, struct work_queue_worker *w, int sign);
+static void record_connected_worker_resources(struct work_queue *q, struct work_queue_worker *w, int sign);
 
 static void find_max_worker(struct work_queue *q);
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w);
@@ -675,6 +696,42 @@ work_queue_msg_code_t advertise_tlq_url(struct work_queue *q, struct work_queue_
 	return MSG_PROCESSED;
 }
 
+/*
+Set the stat of the worker that an info message updates, and return 0 if it
+is not a stat. Foremen send only the stats that changed since their last
+update, so each name has to match exactly one stat.
+*/
+
+#define set_stat_by_name(s, name, field, value) if(!strcmp((name), #field)) { (s)->field = (value); return 1; }
+
+static int set_reported_worker_stat(struct work_queue_stats *s, const char *field, int64_t value)
+{
+	set_stat_by_name(s, field, workers_joined, value);
+	set_stat_by_name(s, field, workers_removed, value);
+	set_stat_by_name(s, field, workers_idled_out, value);
+	set_stat_by_name(s, field, workers_fast_aborted, value);
+	set_stat_by_name(s, field, workers_lost, value);
+	set_stat_by_name(s, field, time_send, value);
+	set_stat_by_name(s, field, time_receive, value);
+	set_stat_by_name(s, field, time_send_good, value);
+	set_stat_by_name(s, field, time_receive_good, value);
+	set_stat_by_name(s, field, time_workers_execute, value);
+	set_stat_by_name(s, field, time_workers_execute_good, value);
+	set_stat_by_name(s, field, time_workers_execute_exhaustion, value);
+	set_stat_by_name(s, field, bytes_sent, value);
+	set_stat_by_name(s, field, bytes_received, value);
+	set_stat_by_name(s, field, tasks_waiting, value);
+	set_stat_by_name(s, field, tasks_running, value);
+
+	/* name used by older foremen */
+	if(!strcmp(field, "time_execute")) {
+		s->time_workers_execute = value;
+		return 1;
+	}
+
+	return 0;
+}
+
 work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worker *w, char *line)
 {
 	char field[WORK_QUEUE_LINE_MAX];
@@ -685,25 +742,15 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 	if(n != 2)
 		return MSG_FAILURE;
 
-	if(string_prefix_is(field, "workers_joined")) {
-		w->stats->workers_joined = atoll(value);
-	} else if(string_prefix_is(field, "workers_removed")) {
-		w->stats->workers_removed = atoll(value);
-	} else if(string_prefix_is(field, "time_send")) {
-		w->stats->time_send = atoll(value);
-	} else if(string_prefix_is(field, "time_receive")) {
-		w->stats->time_receive = atoll(value);
-	} else if(string_prefix_is(field, "time_execute")) {
-		w->stats->time_workers_execute = atoll(value);
-	} else if(string_prefix_is(field, "bytes_sent")) {
-		w->stats->bytes_sent = atoll(value);
-	} else if(string_prefix_is(field, "bytes_received")) {
-		w->stats->bytes_received = atoll(value);
-	} else if(string_prefix_is(field, "tasks_waiting")) {
-		w->stats->tasks_waiting = atoll(value);
-	} else if(string_prefix_is(field, "tasks_running")) {
-		w->stats->tasks_running = atoll(value);
-	} else if(string_prefix_is(field, "idle-disconnecting")) {
+	/* take the worker's stats out of the sum while one of them changes. */
+	record_connected_worker_stats(q, w, -1);
+	int is_stat = set_reported_worker_stat(w->stats, field, atoll(value));
+	record_connected_worker_stats(q, w, 1);
+
+	if(is_stat)
+		return MSG_PROCESSED;
+
+	if(string_prefix_is(field, "idle-disconnecting")) {
 		remove_worker(q, w, WORKER_DISCONNECT_IDLE_OUT);
 		q->stats->workers_idled_out++;
 	} else if(string_prefix_is(field, "end_of_resource_update")) {
@@ -739,6 +786,9 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 A cache-update message coming from the worker means that a requested
 remote transfer or command was successful, and know we know the size
 of the file for the purposes of cache storage management.
+A worker with a persistent cache also advertises the files it already
+has when it connects, which are noted with an mtime of zero until
+a task needs them and they are checked against the local file.
 */
 
 int process_cache_update( struct work_queue *q, struct work_queue_worker *w, const char *line )
@@ -752,6 +802,9 @@ int process_cache_update( struct work_queue *q, struct work_queue_worker *w, con
 		if(remote_info) {
 			remote_info->size = size;
 			remote_info->transfer_time = transfer_time;
+		} else {
+			remote_info = remote_file_info_create(WORK_QUEUE_FILE,size,0);
+			hash_table_insert(w->current_files,cachename,remote_info);
 		}
 	}
 	
@@ -1152,6 +1205,13 @@ static void clean_task_state(struct work_queue_task *t, int full_clean) {
 		free(t->output);
 		t->output = NULL;
 
+		if(t->stdout_spilled) {
+			unlink(t->stdout_file);
+			free(t->stdout_file);
+			t->stdout_file = NULL;
+			t->stdout_spilled = 0;
+		}
+
 		free(t->hostname);
 		t->hostname = NULL;
 
@@ -1245,6 +1305,76 @@ static void record_removed_worker_stats(struct work_queue *q, struct work_queue_
 	qs->workers_removed = ws->workers_joined;
 }
 
+#define accumulate_signed_stat(qs, ws, field, sign) (qs)->field += (sign) * (ws)->field
+
+/*
+Add (sign = 1) or remove (sign = -1) the stats reported by a worker from the
+sum over the connected workers, so that work_queue_get_stats_hierarchy does
+not have to visit every worker. Only foremen report the stats of their own
+workers.
+*/
+
+static void record_connected_worker_stats(struct work_queue *q, struct work_queue_worker *w, int sign)
+{
+	struct work_queue_stats *qs = q->stats_connected_workers;
+	struct work_queue_stats *ws = w->stats;
+
+	if(w->type == WORKER_TYPE_FOREMAN) {
+		accumulate_signed_stat(qs, ws, workers_joined, sign);
+		accumulate_signed_stat(qs, ws, workers_removed, sign);
+		accumulate_signed_stat(qs, ws, workers_idled_out, sign);
+		accumulate_signed_stat(qs, ws, workers_fast_aborted, sign);
+		accumulate_signed_stat(qs, ws, workers_lost, sign);
+
+		accumulate_signed_stat(qs, ws, time_send, sign);
+		accumulate_signed_stat(qs, ws, time_receive, sign);
+		accumulate_signed_stat(qs, ws, time_send_good, sign);
+		accumulate_signed_stat(qs, ws, time_receive_good, sign);
+
+		accumulate_signed_stat(qs, ws, time_workers_execute, sign);
+		accumulate_signed_stat(qs, ws, time_workers_execute_good, sign);
+		accumulate_signed_stat(qs, ws, time_workers_execute_exhaustion, sign);
+
+		accumulate_signed_stat(qs, ws, bytes_sent, sign);
+		accumulate_signed_stat(qs, ws, bytes_received, sign);
+	}
+
+	accumulate_signed_stat(qs, ws, tasks_waiting, sign);
+	accumulate_signed_stat(qs, ws, tasks_running, sign);
+}
+
+/*
+Likewise, keep the sum of the resources of the workers, counting only the
+workers that have reported their resources. The smallest and largest values
+are computed again from all the workers by aggregate_workers_resources only
+when the last worker at one of them departs.
+*/
+
+static void record_connected_worker_resources(struct work_queue *q, struct work_queue_worker *w, int sign)
+{
+	if(w->resources->tag < 0)
+		return;
+
+	if(sign > 0) {
+		work_queue_resources_add(q->workers_resources, w->resources);
+	} else if(!work_queue_resources_subtract(q->workers_resources, w->resources)) {
+		q->workers_resources_extremes_valid = 0;
+	}
+}
+
+/* When only the resources in use by a worker change, only their sums need to follow. */
+
+static void record_connected_worker_inuse(struct work_queue *q, struct work_queue_worker *w, int sign)
+{
+	if(w->resources->tag < 0)
+		return;
+
+	q->workers_resources->cores.inuse  += sign * w->resources->cores.inuse;
+	q->workers_resources->memory.inuse += sign * w->resources->memory.inuse;
+	q->workers_resources->disk.inuse   += sign * w->resources->disk.inuse;
+	q->workers_resources->gpus.inuse   += sign * w->resources->gpus.inuse;
+}
+
 static void remove_worker(struct work_queue *q, struct work_queue_worker *w, worker_disconnect_reason reason)
 {
 	if(!q || !w) return;
@@ -1259,8 +1389,12 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w, wor
 
 	cleanup_worker(q, w);
 
+	record_connected_worker_resources(q, w, -1);
+	record_connected_worker_stats(q, w, -1);
+
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
+	hash_table_remove(q->workers_with_capacity, w->hashkey);
 
 	record_removed_worker_stats(q, w);
 
@@ -1355,6 +1489,12 @@ static void add_worker(struct work_queue *q)
 		}
 	}
 
+	if(!link_poll_set_add(q->poll_set, link, LINK_READ)) {
+		debug(D_NOTICE, "Cannot poll connection of worker %s:%d: %s", addr, port, strerror(errno));
+		link_close(link);
+		return;
+	}
+
 	w = malloc(sizeof(*w));
 	if(!w) {
 		debug(D_NOTICE, "Cannot allocate memory for worker %s:%d.", addr, port);
@@ -2087,12 +2227,14 @@ static work_queue_msg_code_t process_workqueue(struct work_queue *q, struct work
 	w->arch     = strdup(items[2]);
 	w->version  = strdup(items[3]);
 
+	record_connected_worker_stats(q, w, -1);
 	if(!strcmp(w->os, "foreman"))
 	{
 		w->type = WORKER_TYPE_FOREMAN;
 	} else {
 		w->type = WORKER_TYPE_WORKER;
 	}
+	record_connected_worker_stats(q, w, 1);
 
 	q->stats->workers_joined++;
 	debug(D_WQ, "%d workers are connected in total now", count_workers(q, WORKER_TYPE_WORKER | WORKER_TYPE_FOREMAN));
@@ -2180,6 +2322,105 @@ static work_queue_result_code_t get_update( struct work_queue *q, struct work_qu
 Failure to store result is treated as success so we continue to retrieve the
 output files of the task.
 */
+/*
+Receive the standard output of a task from its worker in bounded chunks.
+If the task has a stdout file, the output is written there and not kept
+in memory.  Otherwise it is kept in t->output, unless it is larger than
+stdout_memory_limit: then all of it is spilled to a file in the working
+directory, named in t->stdout_file, and t->output keeps only its beginning.
+Sets stdout_missing if the output could not be kept whole in t->output or
+in the stdout file given by the user.
+*/
+
+static work_queue_result_code_t receive_task_stdout(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int64_t length, int *stdout_missing)
+{
+	int64_t keep = t->stdout_file ? 0 : length;
+	int spilled = 0;
+	int fd = -1;
+
+	if(!t->stdout_file && length > q->stdout_memory_limit) {
+		keep = q->stdout_memory_limit;
+		t->stdout_file = string_format("%s/wq-%d-task-%d.stdout", q->workingdir, (int) getpid(), t->taskid);
+		t->stdout_spilled = 1;
+		spilled = 1;
+		fprintf(stderr, "warning: stdout of task %d is %"PRId64" bytes, which exceeds the limit of %"PRId64" bytes kept in memory. The full stdout is written to %s.\n", t->taskid, length, keep, t->stdout_file);
+		*stdout_missing = 1;
+	}
+
+	if(t->stdout_file) {
+		fd = open(t->stdout_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if(fd < 0) {
+			fprintf(stderr, "warning: cannot write stdout of task %d to %s: %s\n", t->taskid, t->stdout_file, strerror(errno));
+			*stdout_missing = 1;
+		}
+	}
+
+	if(!t->stdout_file || spilled) {
+		t->output = malloc(keep + 1);
+		if(!t->output) {
+			fprintf(stderr, "error: allocating memory of size %"PRId64" bytes failed for storing stdout of task %d.\n", keep, t->taskid);
+			*stdout_missing = 1;
+			keep = 0;
+		}
+	}
+
+	if(length > 0) {
+		debug(D_WQ, "Receiving stdout of task %d (size: %"PRId64" bytes) from %s (%s) ...", t->taskid, length, w->addrport, w->hostname);
+	}
+
+	time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
+
+	char buffer[WORK_QUEUE_STDOUT_CHUNK];
+	int64_t received = 0;
+
+	while(received < length) {
+		int64_t actual = link_read(w->link, buffer, MIN((int64_t) sizeof(buffer), length - received), stoptime);
+		if(actual <= 0) {
+			break;
+		}
+
+		if(received < keep) {
+			memcpy(t->output + received, buffer, MIN(actual, keep - received));
+		}
+
+		if(fd >= 0 && full_write(fd, buffer, actual) != actual) {
+			fprintf(stderr, "warning: cannot write stdout of task %d to %s: %s\n", t->taskid, t->stdout_file, strerror(errno));
+			*stdout_missing = 1;
+			close(fd);
+			fd = -1;
+		}
+
+		received += actual;
+	}
+
+	if(t->output) {
+		t->output[MIN(received, keep)] = '\0';
+	}
+
+	if(fd >= 0) {
+		close(fd);
+	}
+
+	if(received != length) {
+		debug(D_WQ, "Failure: actual received stdout size (%"PRId64" bytes) is different from expected (%"PRId64" bytes).", received, length);
+		return WQ_WORKER_FAILURE;
+	}
+
+	debug(D_WQ, "Retrieved %"PRId64" bytes from %s (%s)", received, w->hostname, w->addrport);
+
+	//overwrite the last few bytes of the kept output to signal where the rest is.
+	if(spilled && t->output) {
+		char *truncate_msg = string_format("\n>>>>>> WORK QUEUE HAS TRUNCATED THE STDOUT AFTER THIS POINT.\n>>>>>> MAXIMUM OF %"PRId64" BYTES REACHED, THE FULL STDOUT IS IN %s", keep, t->stdout_file);
+		size_t n = strlen(truncate_msg);
+		if((int64_t) n < keep) {
+			memcpy(t->output + keep - n, truncate_msg, n);
+		}
+		free(truncate_msg);
+	}
+
+	return WQ_SUCCESS;
+}
+
 static work_queue_result_code_t get_result(struct work_queue *q, struct work_queue_worker *w, const char *line) {
 
 	if(!q || !w || !line) 
@@ -2189,11 +2430,9 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 
 	int task_status, exit_status;
 	uint64_t taskid;
-	int64_t output_length, retrieved_output_length;
+	int64_t output_length;
 	timestamp_t execution_time;
 
-	int64_t actual;
-
 	timestamp_t observed_execution_time;
 	timestamp_t effective_stoptime = 0;
 	time_t stoptime;
@@ -2247,64 +2486,23 @@ static work_queue_result_code_t get_result(struct work_queue *q, struct work_que
 		effective_stoptime = (output_length/q->bandwidth)*1000000 + timestamp_get();
 	}
 
-	if(output_length <= MAX_TASK_STDOUT_STORAGE) {
-		retrieved_output_length = output_length;
-	} else {
-		retrieved_output_length = MAX_TASK_STDOUT_STORAGE;
-		fprintf(stderr, "warning: stdout of task %"PRId64" requires %2.2lf GB of storage. This exceeds maximum supported size of %d GB. Only %d GB will be retrieved.\n", taskid, ((double) output_length)/MAX_TASK_STDOUT_STORAGE, MAX_TASK_STDOUT_STORAGE/GIGABYTE, MAX_TASK_STDOUT_STORAGE/GIGABYTE);
-		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
-	}
-
-	t->output = malloc(retrieved_output_length+1);
-	if(t->output == NULL) {
-		fprintf(stderr, "error: allocating memory of size %"PRId64" bytes failed for storing stdout of task %"PRId64".\n", retrieved_output_length, taskid);
-		//drop the entire length of stdout on the link
-		stoptime = time(0) + get_transfer_wait_time(q, w, t, output_length);
-		link_soak(w->link, output_length, stoptime);
-		retrieved_output_length = 0;
-		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
+	int stdout_missing = 0;
+	if(receive_task_stdout(q, w, t, output_length, &stdout_missing) != WQ_SUCCESS) {
+		return WQ_WORKER_FAILURE;
 	}
 
-	if(retrieved_output_length > 0) {
-		debug(D_WQ, "Receiving stdout of task %"PRId64" (size: %"PRId64" bytes) from %s (%s) ...", taskid, retrieved_output_length, w->addrport, w->hostname);
-
-		//First read the bytes we keep.
-		stoptime = time(0) + get_transfer_wait_time(q, w, t, retrieved_output_length);
-		actual = link_read(w->link, t->output, retrieved_output_length, stoptime);
-		if(actual != retrieved_output_length) {
-			debug(D_WQ, "Failure: actual received stdout size (%"PRId64" bytes) is different from expected (%"PRId64" bytes).", actual, retrieved_output_length);
-			t->output[actual] = '\0';
-			return WQ_WORKER_FAILURE;
-		}
-		debug(D_WQ, "Retrieved %"PRId64" bytes from %s (%s)", actual, w->hostname, w->addrport);
-
-		//Then read the bytes we need to throw away.
-		if(output_length > retrieved_output_length) {
-			debug(D_WQ, "Dropping the remaining %"PRId64" bytes of the stdout of task %"PRId64" since stdout length is limited to %d bytes.\n", (output_length-MAX_TASK_STDOUT_STORAGE), taskid, MAX_TASK_STDOUT_STORAGE);
-			stoptime = time(0) + get_transfer_wait_time(q, w, t, (output_length-retrieved_output_length));
-			link_soak(w->link, (output_length-retrieved_output_length), stoptime);
-
-			//overwrite the last few bytes of buffer to signal truncated stdout.
-			char *truncate_msg = string_format("\n>>>>>> WORK QUEUE HAS TRUNCATED THE STDOUT AFTER THIS POINT.\n>>>>>> MAXIMUM OF %d BYTES REACHED, %" PRId64 " BYTES TRUNCATED.", MAX_TASK_STDOUT_STORAGE, output_length - retrieved_output_length);
-			memcpy(t->output + MAX_TASK_STDOUT_STORAGE - strlen(truncate_msg) - 1, truncate_msg, strlen(truncate_msg));
-			*(t->output + MAX_TASK_STDOUT_STORAGE - 1) = '\0';
-			free(truncate_msg);
-		}
-
-		timestamp_t current_time = timestamp_get();
-		if(effective_stoptime && effective_stoptime > current_time) {
-			usleep(effective_stoptime - current_time);
-		}
-	} else {
-		actual = 0;
+	timestamp_t current_time = timestamp_get();
+	if(effective_stoptime && effective_stoptime > current_time) {
+		usleep(effective_stoptime - current_time);
 	}
 
-	if(t->output)
-		t->output[actual] = 0;
-
 	t->result        = task_status;
 	t->return_status = exit_status;
 
+	if(stdout_missing) {
+		update_task_result(t, WORK_QUEUE_RESULT_STDOUT_MISSING);
+	}
+
 	q->stats->time_workers_execute += t->time_workers_execute_last;
 
 	w->finished_tasks++;
@@ -2441,6 +2639,130 @@ static struct rmsummary  *total_resources_needed(struct work_queue *q) {
 	return total;
 }
 
+/*
+Estimate the execution time of a task from the successful tasks of its
+category, or from all the successful tasks of the queue if its category
+has not completed any yet. Returns 0 if nothing is known.
+*/
+
+static timestamp_t predicted_task_time(struct work_queue *q, struct work_queue_task *t) {
+	struct category *c = work_queue_category_lookup_or_create(q, t->category);
+
+	if(c->wq_stats->tasks_done > 0) {
+		return c->wq_stats->time_workers_execute_good / c->wq_stats->tasks_done;
+	}
+
+	int64_t done = q->stats->tasks_done - q->stats->tasks_failed;
+	if(done > 0) {
+		return q->stats->time_workers_execute_good / done;
+	}
+
+	return 0;
+}
+
+/*
+Predict the core-seconds of work left in the queue. Waiting tasks count
+their predicted execution time times the cores they would request, and
+running tasks count what is left of their predicted time on the cores they
+were given. largest_task is set to the cores of the largest task, which is
+a lower bound on the cores needed. Returns -1 if there is nothing to base
+the prediction on yet.
+*/
+
+static double predicted_work_left(struct work_queue *q, int64_t *largest_task) {
+	struct work_queue_task *t;
+	double work = 0;
+	int known = 0;
+
+	*largest_task = 0;
+
+	list_first_item(q->ready_list);
+	while((t = list_next_item(q->ready_list))) {
+		timestamp_t time = predicted_task_time(q, t);
+		if(time < 1) {
+			continue;
+		}
+
+		int64_t cores = MAX(1, task_min_resources(q, t)->cores);
+		work += cores * ((double) time / ONE_SECOND);
+		*largest_task = MAX(*largest_task, cores);
+		known = 1;
+	}
+
+	timestamp_t now = timestamp_get();
+
+	char *key;
+	uint64_t taskid;
+	struct work_queue_worker *w;
+	hash_table_firstkey(q->worker_table);
+	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		itable_firstkey(w->current_tasks);
+		while(itable_nextkey(w->current_tasks, &taskid, (void **) &t)) {
+			timestamp_t time = predicted_task_time(q, t);
+			if(time < 1) {
+				continue;
+			}
+
+			int64_t cores = MAX(1, t->resources_allocated->cores);
+			timestamp_t elapsed = now > t->time_when_commit_end ? now - t->time_when_commit_end : 0;
+			if(time > elapsed) {
+				work += cores * ((double) (time - elapsed) / ONE_SECOND);
+			}
+			*largest_task = MAX(*largest_task, cores);
+			known = 1;
+		}
+	}
+
+	return known ? work : -1;
+}
+
+/*
+Predict how many seconds the tasks in the queue need to complete on the
+given number of connected cores, and how many cores would complete them
+within the target makespan. Either is -1 when it cannot be predicted.
+*/
+
+static void predict_demand(struct work_queue *q, int64_t total_cores, int64_t *drain_time, int64_t *cores_needed) {
+	*drain_time = -1;
+	*cores_needed = -1;
+
+	int64_t largest_task;
+	double work = predicted_work_left(q, &largest_task);
+	if(work < 0) {
+		return;
+	}
+
+	if(total_cores > 0) {
+		*drain_time = (int64_t) ceil(work / total_cores);
+	}
+
+	if(q->target_makespan > 0) {
+		*cores_needed = MAX(largest_task, (int64_t) ceil(work / q->target_makespan));
+	}
+}
+
+/*
+Add the predicted drain time and cores needed, when known, so that
+work_queue_factory can size the pool to the target makespan.
+*/
+
+static void demand_to_jx(struct work_queue *q, const struct work_queue_stats *info, struct jx *j) {
+	int64_t drain_time, cores_needed;
+	predict_demand(q, info->total_cores, &drain_time, &cores_needed);
+
+	if(drain_time >= 0) {
+		jx_insert_integer(j, "tasks_drain_time", drain_time);
+	}
+
+	if(q->target_makespan > 0) {
+		jx_insert_integer(j, "target_makespan", q->target_makespan);
+	}
+
+	if(cores_needed >= 0) {
+		jx_insert_integer(j, "tasks_needed_cores", cores_needed);
+	}
+}
+
 static const struct rmsummary *largest_seen_resources(struct work_queue *q, const char *category) {
 	char *key;
 	struct category *c;
@@ -2609,6 +2931,12 @@ static struct jx * category_to_jx(struct work_queue *q, const char *category) {
 	jx_insert_integer(j, "first_allocation_count", task_request_count(q, c->name, CATEGORY_ALLOCATION_FIRST));
 	jx_insert_integer(j, "max_allocation_count",   task_request_count(q, c->name, CATEGORY_ALLOCATION_MAX));
 
+	if(c->wq_task_times) {
+		jx_insert_integer(j, "task_time_p50", quantile_sketch_quantile(c->wq_task_times, 0.50));
+		jx_insert_integer(j, "task_time_p95", quantile_sketch_quantile(c->wq_task_times, 0.95));
+		jx_insert_integer(j, "task_time_p99", quantile_sketch_quantile(c->wq_task_times, 0.99));
+	}
+
 	return j;
 }
 
@@ -2774,6 +3102,8 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"tasks_total_gpus",total->gpus);
 	rmsummary_delete(total);
 
+	demand_to_jx(q, &info, j);
+
 	return j;
 }
 
@@ -2847,6 +3177,9 @@ static struct jx * queue_lean_to_jx( struct work_queue *q, struct link *foreman_
 	jx_insert_integer(j,"tasks_total_disk",total->disk);
 	jx_insert_integer(j,"tasks_total_gpus",total->gpus);
 
+	//predictions the factory uses to scale to the target makespan
+	demand_to_jx(q, &info, j);
+
 	//worker information for general work_queue_status report
 	jx_insert_integer(j,"workers",info.workers_connected);
 	jx_insert_integer(j,"workers_connected",info.workers_connected);
@@ -3127,9 +3460,12 @@ static work_queue_msg_code_t process_resource( struct work_queue *q, struct work
 {
 	char resource_name[WORK_QUEUE_LINE_MAX];
 	struct work_queue_resource r;
+	memset(&r, 0, sizeof(r));
 
 	int n = sscanf(line, "resource %s %"PRId64" %"PRId64" %"PRId64, resource_name, &r.total, &r.smallest, &r.largest);
 
+	record_connected_worker_resources(q, w, -1);
+
 	if(n == 2 && !strcmp(resource_name,"tag"))
 	{
 		/* Shortcut, total has the tag, as "resources tag" only sends one value */
@@ -3170,9 +3506,12 @@ static work_queue_msg_code_t process_resource( struct work_queue *q, struct work
 			w->coprocess_resources->gpus = r;
 		}
 	} else {
+		record_connected_worker_resources(q, w, 1);
 		return MSG_FAILURE;
 	}
 
+	record_connected_worker_resources(q, w, 1);
+
 	return MSG_PROCESSED;
 }
 
@@ -3208,6 +3547,11 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 	link_to_hash_key(l, key);
 	w = hash_table_lookup(q->worker_table, key);
 
+	// The worker may have been removed while handling messages of another worker.
+	if(!w) {
+		return WQ_SUCCESS;
+	}
+
 	work_queue_msg_code_t mcode;
 	mcode = recv_worker_msg(q, w, line, sizeof(line));
 
@@ -3241,57 +3585,6 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 	return WQ_SUCCESS;
 }
 
-static int build_poll_table(struct work_queue *q, struct link *manager)
-{
-	int n = 0;
-	char *key;
-	struct work_queue_worker *w;
-
-	// Allocate a small table, if it hasn't been done yet.
-	if(!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if(!q->poll_table) {
-			//if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
-
-	// The first item in the poll table is the manager link, which accepts new connections.
-	q->poll_table[0].link = q->manager_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
-
-	if(manager) {
-		/* foreman uplink */
-		q->poll_table[1].link = manager;
-		q->poll_table[1].events = LINK_READ;
-		q->poll_table[1].revents = 0;
-		n++;
-	}
-
-	// For every worker in the hash table, add an item to the poll table
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		// If poll table is not large enough, reallocate it
-		if(n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if(q->poll_table == NULL) {
-				//if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
-
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
-	}
-
-	return n;
-}
-
 /*
 Send a symbolic link to the remote worker.
 Note that the target of the link is sent
@@ -3487,6 +3780,19 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 
 	struct remote_file_info *remote_info = hash_table_lookup(w->current_files, tf->cached_name);
 
+	/* A file advertised by the worker is taken if its size matches, and otherwise sent again. */
+	if(remote_info && remote_info->mtime == 0) {
+		if(remote_info->size == local_info.st_size) {
+			remote_info->type = tf->type;
+			remote_info->mtime = local_info.st_mtime;
+		} else {
+			debug(D_WQ, "%s (%s) has a different %s, sending it again", w->hostname, w->addrport, tf->cached_name);
+			hash_table_remove(w->current_files, tf->cached_name);
+			remote_file_info_delete(remote_info);
+			remote_info = 0;
+		}
+	}
+
 	if(remote_info && (remote_info->mtime != local_info.st_mtime || remote_info->size != local_info.st_size)) {
 		debug(D_NOTICE|D_WQ, "File %s changed locally. Task %d will be executed with an older version.", expanded_local_name, t->taskid);
 		return WQ_SUCCESS;
@@ -3770,6 +4076,17 @@ static struct rmsummary *task_worker_box_size(struct work_queue *q, struct work_
 
 	struct rmsummary *limits = rmsummary_create(-1);
 
+	/* A function call takes one whole instance of the worker's coprocess pool. */
+	struct work_queue_resources *c = w->coprocess_resources;
+	if(t->coprocess && c->cores.largest > 0) {
+		limits->cores  = c->cores.largest;
+		limits->memory = c->memory.largest;
+		limits->disk   = c->disk.largest;
+		limits->gpus   = c->gpus.largest;
+		rmsummary_merge_max(limits, min);
+		return limits;
+	}
+
 	rmsummary_merge_override_basic(limits, max);
 
 	int use_whole_worker = 1;
@@ -4248,8 +4565,8 @@ static struct work_queue_worker *find_worker_by_files(struct work_queue *q, stru
 	struct remote_file_info *remote_info;
 	struct work_queue_file *tf;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	hash_table_firstkey(q->workers_with_capacity);
+	while(hash_table_nextkey(q->workers_with_capacity, &key, (void **) &w)) {
 		if( check_hand_against_task(q, w, t) ) {
 			task_cached_bytes = 0;
 			list_first_item(t->input_files);
@@ -4276,8 +4593,8 @@ static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struc
 {
 	char *key;
 	struct work_queue_worker *w;
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+	hash_table_firstkey(q->workers_with_capacity);
+	while(hash_table_nextkey(q->workers_with_capacity, &key, (void**)&w)) {
 		if( check_hand_against_task(q, w, t) ) {
 			return w;
 		}
@@ -4292,8 +4609,8 @@ static struct work_queue_worker *find_worker_by_random(struct work_queue *q, str
 	int random_worker;
 	struct list *valid_workers = list_create();
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
+	hash_table_firstkey(q->workers_with_capacity);
+	while(hash_table_nextkey(q->workers_with_capacity, &key, (void**)&w)) {
 		if(check_hand_against_task(q, w, t)) {
 			list_push_tail(valid_workers, w);
 		}
@@ -4319,8 +4636,8 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = NULL;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	hash_table_firstkey(q->workers_with_capacity);
+	while(hash_table_nextkey(q->workers_with_capacity, &key, (void **) &w)) {
 		if( check_hand_against_task(q, w, t) ) {
 			if(!best_worker || candidate_has_worse_fit(best_worker, w))
 			{
@@ -4339,8 +4656,8 @@ static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struc
 	struct work_queue_worker *best_worker = 0;
 	double best_time = HUGE_VAL;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+	hash_table_firstkey(q->workers_with_capacity);
+	while(hash_table_nextkey(q->workers_with_capacity, &key, (void **) &w)) {
 		if(check_hand_against_task(q, w, t)) {
 			if(w->total_tasks_complete > 0) {
 				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
@@ -4447,11 +4764,50 @@ static struct work_queue_worker *find_best_worker(struct work_queue *q, struct w
 	}
 }
 
+/*
+Return true if the worker has some resource that is not fully in use,
+following the same accounting as check_hand_against_task.  A worker that
+has nothing free cannot take any task, so it does not need to be considered
+by the scheduler until a task finishes or its resources are updated.
+*/
+
+static int worker_has_capacity(struct work_queue *q, struct work_queue_worker *w, struct work_queue_resources *r)
+{
+	return r->cores.inuse < overcommitted_resource_total(q, r->cores.total)
+		|| r->memory.inuse < overcommitted_resource_total(q, r->memory.total)
+		|| r->gpus.inuse < overcommitted_resource_total(q, r->gpus.total)
+		|| r->disk.inuse < r->disk.total;
+}
+
+/*
+Keep the workers_with_capacity table up to date for this worker.
+It is kept in count_worker_resources, which is called whenever the resources
+of a worker or the tasks committed to it change, so that find_best_worker only
+walks the workers that could accept a task, rather than every connected worker.
+*/
+
+static void update_worker_capacity(struct work_queue *q, struct work_queue_worker *w)
+{
+	int available = w->resources->tag >= 0
+		&& w->resources->workers.total > 0
+		&& (worker_has_capacity(q, w, w->resources) || worker_has_capacity(q, w, w->coprocess_resources));
+
+	if(available) {
+		if(!hash_table_lookup(q->workers_with_capacity, w->hashkey)) {
+			hash_table_insert(q->workers_with_capacity, w->hashkey, w);
+		}
+	} else {
+		hash_table_remove(q->workers_with_capacity, w->hashkey);
+	}
+}
+
 static void count_worker_resources(struct work_queue *q, struct work_queue_worker *w)
 {
 	struct rmsummary *box;
 	uint64_t taskid;
 
+	record_connected_worker_inuse(q, w, -1);
+
 	w->resources->cores.inuse  = 0;
 	w->resources->memory.inuse = 0;
 	w->resources->disk.inuse   = 0;
@@ -4466,6 +4822,8 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 
 	if(w->resources->workers.total < 1)
 	{
+		record_connected_worker_inuse(q, w, 1);
+		update_worker_capacity(q, w);
 		return;
 	}
 
@@ -4485,6 +4843,10 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 			w->resources->gpus.inuse      += box->gpus;
 		}
 	}
+
+	record_connected_worker_inuse(q, w, 1);
+
+	update_worker_capacity(q, w);
 }
 
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w) {
@@ -4588,6 +4950,11 @@ static int send_one_task( struct work_queue *q )
 	int tasks_considered = 0;
 	timestamp_t now = timestamp_get();
 
+	// No task can be placed until some worker has capacity.
+	if(hash_table_size(q->workers_with_capacity) == 0) {
+		return 0;
+	}
+
 	while( (t = list_rotate(q->ready_list)) ) {
 		if(tasks_considered++ > q->attempt_schedule_depth) {
 			return 0;
@@ -4777,6 +5144,8 @@ static int abort_slow_workers(struct work_queue *q)
 
 	int removed = 0;
 
+	struct category *c_def = work_queue_category_lookup_or_create(q, "default");
+
 	/* optimization. If no category has a fast abort multiplier, simply return. */
 	int fast_abort_flag = 0;
 
@@ -4790,11 +5159,20 @@ static int abort_slow_workers(struct work_queue *q)
 
 		if(stats->tasks_done < 10) {
 			c->average_task_time = 0;
+			c->quantile_task_time = 0;
 			continue;
 		}
 
 		c->average_task_time = (stats->time_workers_execute_good + stats->time_send_good + stats->time_receive_good) / stats->tasks_done;
 
+		/* A category that uses the default multiplier also uses its quantile. */
+		double quantile = c->fast_abort > 0 ? c->fast_abort_quantile : c_def->fast_abort_quantile;
+		if(quantile > 0 && c->wq_task_times) {
+			c->quantile_task_time = quantile_sketch_quantile(c->wq_task_times, quantile);
+		} else {
+			c->quantile_task_time = 0;
+		}
+
 		if(c->fast_abort > 0)
 			fast_abort_flag = 1;
 	}
@@ -4802,8 +5180,6 @@ static int abort_slow_workers(struct work_queue *q)
 	if(!fast_abort_flag)
 		return 0;
 
-	struct category *c_def = work_queue_category_lookup_or_create(q, "default");
-
 	timestamp_t current = timestamp_get();
 
 	itable_firstkey(q->tasks);
@@ -4814,7 +5190,7 @@ static int abort_slow_workers(struct work_queue *q)
 			continue;
 
 		timestamp_t runtime = current - t->time_when_commit_start;
-		timestamp_t average_task_time = c->average_task_time;
+		timestamp_t average_task_time = c->quantile_task_time > 0 ? c->quantile_task_time : c->average_task_time;
 
 		/* Not enough samples, skip the task. */
 		if(average_task_time < 1)
@@ -5061,6 +5437,10 @@ struct work_queue_task *work_queue_task_clone(const struct work_queue_task *task
 		work_queue_specify_snapshot_file(new, task->monitor_snapshot_file);
 	}
 
+	if(task->stdout_file && !task->stdout_spilled) {
+		work_queue_task_specify_stdout_file(new, task->stdout_file);
+	}
+
 	new->input_files  = work_queue_task_file_list_clone(task->input_files);
 	new->output_files = work_queue_task_file_list_clone(task->output_files);
 	new->env_list     = work_queue_task_env_list_clone(task->env_list);
@@ -5652,6 +6032,13 @@ int work_queue_task_specify_file_command(struct work_queue_task *t, const char *
 	return 1;
 }
 
+int work_queue_task_specify_stdout_file(struct work_queue_task *t, const char *stdout_file) {
+	free(t->stdout_file);
+	t->stdout_file = stdout_file ? xxstrdup(stdout_file) : NULL;
+	t->stdout_spilled = 0;
+	return 1;
+}
+
 int work_queue_specify_snapshot_file(struct work_queue_task *t, const char *monitor_snapshot_file) {
 
 	assert(monitor_snapshot_file);
@@ -5791,6 +6178,11 @@ void work_queue_task_delete(struct work_queue_task *t)
 
 		free(t->monitor_output_directory);
 		free(t->monitor_snapshot_file);
+
+		if(t->stdout_spilled) {
+			unlink(t->stdout_file);
+		}
+		free(t->stdout_file);
 		free(t);
 	}
 }
@@ -5867,6 +6259,16 @@ struct work_queue *work_queue_ssl_create(int port, const char *key, const char *
 		link_address_local(q->manager_link, address, &q->port);
 	}
 
+	// Links are registered once in the poll set, when they are accepted.
+	q->poll_set = link_poll_set_create();
+	if(!q->poll_set || !link_poll_set_add(q->poll_set, q->manager_link, LINK_READ)) {
+		debug(D_NOTICE, "Could not create poll set for work_queue: %s", strerror(errno));
+		link_poll_set_delete(q->poll_set);
+		link_close(q->manager_link);
+		free(q);
+		return 0;
+	}
+
 	q->ssl_key = key ? strdup(key) : 0;
 	q->ssl_cert = cert ? strdup(cert) : 0;
 
@@ -5894,12 +6296,17 @@ struct work_queue *work_queue_ssl_create(int port, const char *key, const char *
 
 	q->stats                      = calloc(1, sizeof(struct work_queue_stats));
 	q->stats_disconnected_workers = calloc(1, sizeof(struct work_queue_stats));
+	q->stats_connected_workers    = calloc(1, sizeof(struct work_queue_stats));
 	q->stats_measure              = calloc(1, sizeof(struct work_queue_stats));
 
+	q->workers_resources = work_queue_resources_create();
+	q->workers_resources_extremes_valid = 1;
+
 	q->workers_with_available_results = hash_table_create(0, 0);
+	q->workers_with_capacity = hash_table_create(0, 0);
 
 	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
+	// (and resized) as needed by poll_active_workers.
 	q->poll_table_size = 8;
 
 	q->worker_selection_algorithm = WORK_QUEUE_SCHEDULE_TIME;
@@ -5923,6 +6330,7 @@ struct work_queue *work_queue_ssl_create(int port, const char *key, const char *
 	q->monitor_mode = MON_DISABLED;
 
 	q->hungry_minimum = 10;
+	q->stdout_memory_limit = MAX_TASK_STDOUT_STORAGE;
 	q->hungry_minimum_factor = 2;
 
 	q->wait_for_workers = 0;
@@ -6056,6 +6464,21 @@ int work_queue_activate_fast_abort(struct work_queue *q, double multiplier)
 	return work_queue_activate_fast_abort_category(q, "default", multiplier);
 }
 
+int work_queue_activate_fast_abort_category_quantile(struct work_queue *q, const char *category, double multiplier, double quantile)
+{
+	struct category *c = work_queue_category_lookup_or_create(q, category);
+
+	if(quantile > 0 && quantile <= 1) {
+		debug(D_WQ, "Fast abort for '%s' uses the %.3lf quantile of task times.\n", category, quantile);
+		c->fast_abort_quantile = quantile;
+	} else {
+		debug(D_WQ, "Fast abort for '%s' uses the average task time.\n", category);
+		c->fast_abort_quantile = 0;
+	}
+
+	return work_queue_activate_fast_abort_category(q, category, multiplier);
+}
+
 int work_queue_port(struct work_queue *q)
 {
 	char addr[LINK_ADDRESS_MAX];
@@ -6219,6 +6642,7 @@ void work_queue_delete(struct work_queue *q)
 		itable_delete(q->task_state_map);
 
 		hash_table_delete(q->workers_with_available_results);
+		hash_table_delete(q->workers_with_capacity);
 
 		struct work_queue_task_report *tr;
 		list_first_item(q->task_reports);
@@ -6229,7 +6653,9 @@ void work_queue_delete(struct work_queue *q)
 
 		free(q->stats);
 		free(q->stats_disconnected_workers);
+		free(q->stats_connected_workers);
 		free(q->stats_measure);
+		work_queue_resources_delete(q->workers_resources);
 
 		if(q->name)
 			free(q->name);
@@ -6242,6 +6668,7 @@ void work_queue_delete(struct work_queue *q)
 		free(q->ssl_key);
 
 		link_close(q->manager_link);
+		link_poll_set_delete(q->poll_set);
 		if(q->logfile) {
 			fclose(q->logfile);
 		}
@@ -6254,6 +6681,14 @@ void work_queue_delete(struct work_queue *q)
 			}
 		}
 
+		if(q->transactions_txlog) {
+			write_transaction(q, "MANAGER END");
+
+			if(work_queue_txlog_close(q->transactions_txlog) != 0) {
+				debug(D_WQ, "unable to write transactions log: %s\n", strerror(errno));
+			}
+		}
+
 		rmsummary_delete(q->measured_local_resources);
 		rmsummary_delete(q->current_max_worker);
 		rmsummary_delete(q->max_task_resources_requested);
@@ -6866,7 +7301,25 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 {
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	int n = build_poll_table(q, foreman_uplink);
+	// The foreman uplink stays in the poll set until it is closed.
+	if(foreman_uplink) {
+		link_poll_set_add(q->poll_set, foreman_uplink, LINK_READ);
+	}
+
+	// The poll table receives the active links, so it must be able to hold all of them.
+	int n = link_poll_set_size(q->poll_set);
+	if(!q->poll_table || n > q->poll_table_size) {
+		while(n > q->poll_table_size) {
+			q->poll_table_size *= 2;
+		}
+		q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+		if(!q->poll_table) {
+			//if we can't allocate a poll table, we can't do anything else.
+			fatal("allocating memory for poll table failed.");
+		}
+	}
+
+	q->manager_link_ready = 0;
 
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
@@ -6883,32 +7336,28 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Wait for activity on any link. Only the active links are returned in the poll table.
+	n = link_poll_set_wait(q->poll_set, q->poll_table, q->poll_table_size, msec);
 	q->link_poll_end = timestamp_get();
 
-	int i, j = 1;
-	// Consider the foreman_uplink passed into the function and disregard if inactive.
 	if(foreman_uplink) {
-		if(q->poll_table[1].revents) {
-			*foreman_uplink_active = 1; //signal that the manager link saw activity
-		} else {
-			*foreman_uplink_active = 0;
-		}
-		j++;
+		*foreman_uplink_active = 0;
 	}
 
 	END_ACCUM_TIME(q, time_polling);
 
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
+	int i;
 	int workers_failed = 0;
 	// Then consider all existing active workers
-	for(i = j; i < n; i++) {
-		if(q->poll_table[i].revents) {
-			if(handle_worker(q, q->poll_table[i].link) == WQ_WORKER_FAILURE) {
-				workers_failed++;
-			}
+	for(i = 0; i < n; i++) {
+		if(q->poll_table[i].link == q->manager_link) {
+			q->manager_link_ready = 1;
+		} else if(foreman_uplink && q->poll_table[i].link == foreman_uplink) {
+			*foreman_uplink_active = 1; //signal that the manager link saw activity
+		} else if(handle_worker(q, q->poll_table[i].link) == WQ_WORKER_FAILURE) {
+			workers_failed++;
 		}
 	}
 
@@ -6936,7 +7385,7 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 	// If the manager link was awake, then accept at most max_new_workers.
 	// Note we are using the information gathered in poll_active_workers, which
 	// is a little ugly.
-	if(q->poll_table[0].revents) {
+	if(q->manager_link_ready) {
 		do {
 			add_worker(q);
 			new_workers++;
@@ -7147,6 +7596,9 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 		log_queue_stats(q, 0);
 	}
 
+	if(q->transactions_txlog) {
+		work_queue_txlog_sync(q->transactions_txlog);
+	}
 
 	q->time_last_wait = timestamp_get();
 
@@ -7173,6 +7625,16 @@ int work_queue_hungry(struct work_queue *q)
 		return 1;
 	}
 
+	//with a target makespan, the queue is hungry while the work it has is
+	//predicted to complete sooner than the target on the connected cores
+	if(q->target_makespan > 0) {
+		int64_t drain_time, cores_needed;
+		predict_demand(q, qstats.total_cores, &drain_time, &cores_needed);
+		if(drain_time >= 0) {
+			return drain_time < q->target_makespan;
+		}
+	}
+
 	//get total available resources consumption (cores, memory, disk, gpus) of all workers of this manager
 	//available = total (all) - committed (actual in use)
 	int64_t workers_total_avail_cores 	= 0;
@@ -7180,10 +7642,10 @@ int work_queue_hungry(struct work_queue *q)
 	int64_t workers_total_avail_disk 	= 0;
 	int64_t workers_total_avail_gpus 	= 0;
 
-	workers_total_avail_cores 	= overcommitted_resource_total(q, q->stats->total_cores) - q->stats->committed_cores;
-	workers_total_avail_memory 	= overcommitted_resource_total(q, q->stats->total_memory) - q->stats->committed_memory;
-	workers_total_avail_gpus	= overcommitted_resource_total(q, q->stats->total_gpus) - q->stats->committed_gpus;
-	workers_total_avail_disk 	= q->stats->total_disk - q->stats->committed_disk; //never overcommit disk
+	workers_total_avail_cores 	= overcommitted_resource_total(q, qstats.total_cores) - qstats.committed_cores;
+	workers_total_avail_memory 	= overcommitted_resource_total(q, qstats.total_memory) - qstats.committed_memory;
+	workers_total_avail_gpus	= overcommitted_resource_total(q, qstats.total_gpus) - qstats.committed_gpus;
+	workers_total_avail_disk 	= qstats.total_disk - qstats.committed_disk; //never overcommit disk
 
 	//get required resources (cores, memory, disk, gpus) of one waiting task
 	int64_t ready_task_cores 	= 0;
@@ -7417,6 +7879,14 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	if(!strcmp(name, "resource-submit-multiplier") || !strcmp(name, "asynchrony-multiplier")) {
 		q->resource_submit_multiplier = MAX(value, 1.0);
 
+		// The multiplier changes which workers have capacity left.
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->worker_table);
+		while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+			update_worker_capacity(q, w);
+		}
+
 	} else if(!strcmp(name, "min-transfer-timeout")) {
 		q->minimum_transfer_timeout = (int)value;
 
@@ -7432,6 +7902,10 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "fast-abort-multiplier")) {
 		work_queue_activate_fast_abort(q, value);
 
+	} else if(!strcmp(name, "fast-abort-quantile")) {
+		struct category *c = work_queue_category_lookup_or_create(q, "default");
+		c->fast_abort_quantile = (value > 0 && value <= 1) ? value : 0;
+
 	} else if(!strcmp(name, "keepalive-interval")) {
 		q->keepalive_interval = MAX(0, (int)value);
 
@@ -7453,6 +7927,12 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "hungry-minimum-factor")) {
 		q->hungry_minimum_factor = MAX(1, (int)value);
 
+	} else if(!strcmp(name, "target-makespan")) {
+		q->target_makespan = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "stdout-memory-limit")) {
+		q->stdout_memory_limit = MAX(1, value) * MEGABYTE;
+
 	} else if(!strcmp(name, "wait-for-workers")) {
 		q->wait_for_workers = MAX(0, (int)value);
 
@@ -7592,19 +8072,11 @@ void work_queue_get_stats(struct work_queue *q, struct work_queue_stats *s)
 	s->tasks_with_results = waiting_tasks;
 	s->tasks_on_workers   = running_tasks + s->tasks_with_results;
 
-	{
-		//accumulate tasks running, from workers:
-		char *key;
-		struct work_queue_worker *w;
-		s->tasks_running = 0;
-		hash_table_firstkey(q->worker_table);
-		while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-			accumulate_stat(s, w->stats, tasks_running);
-		}
-		/* (see work_queue_get_stats_hierarchy for an explanation on the
-		 * following line) */
-		s->tasks_running = MIN(s->tasks_running, s->tasks_on_workers);
-	}
+	//tasks running, as reported by the workers:
+	s->tasks_running = q->stats_connected_workers->tasks_running;
+	/* (see work_queue_get_stats_hierarchy for an explanation on the
+	 * following line) */
+	s->tasks_running = MIN(s->tasks_running, s->tasks_on_workers);
 
 	compute_capacity(q, s);
 
@@ -7641,39 +8113,33 @@ void work_queue_get_stats_hierarchy(struct work_queue *q, struct work_queue_stat
 {
 	work_queue_get_stats(q, s);
 
-	char *key;
-	struct work_queue_worker *w;
+	/* Consider running only if reported by some hand. The stats of the
+	 * connected workers are kept summed as they report them. */
+	struct work_queue_stats *ws = q->stats_connected_workers;
 
-	/* Consider running only if reported by some hand. */
 	s->tasks_running = 0;
 	s->workers_connected = 0;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if(w->type == WORKER_TYPE_FOREMAN)
-		{
-			accumulate_stat(s, w->stats, workers_joined);
-			accumulate_stat(s, w->stats, workers_removed);
-			accumulate_stat(s, w->stats, workers_idled_out);
-			accumulate_stat(s, w->stats, workers_fast_aborted);
-			accumulate_stat(s, w->stats, workers_lost);
+	accumulate_stat(s, ws, workers_joined);
+	accumulate_stat(s, ws, workers_removed);
+	accumulate_stat(s, ws, workers_idled_out);
+	accumulate_stat(s, ws, workers_fast_aborted);
+	accumulate_stat(s, ws, workers_lost);
 
-			accumulate_stat(s, w->stats, time_send);
-			accumulate_stat(s, w->stats, time_receive);
-			accumulate_stat(s, w->stats, time_send_good);
-			accumulate_stat(s, w->stats, time_receive_good);
+	accumulate_stat(s, ws, time_send);
+	accumulate_stat(s, ws, time_receive);
+	accumulate_stat(s, ws, time_send_good);
+	accumulate_stat(s, ws, time_receive_good);
 
-			accumulate_stat(s, w->stats, time_workers_execute);
-			accumulate_stat(s, w->stats, time_workers_execute_good);
-			accumulate_stat(s, w->stats, time_workers_execute_exhaustion);
+	accumulate_stat(s, ws, time_workers_execute);
+	accumulate_stat(s, ws, time_workers_execute_good);
+	accumulate_stat(s, ws, time_workers_execute_exhaustion);
 
-			accumulate_stat(s, w->stats, bytes_sent);
-			accumulate_stat(s, w->stats, bytes_received);
-		}
+	accumulate_stat(s, ws, bytes_sent);
+	accumulate_stat(s, ws, bytes_received);
 
-		accumulate_stat(s, w->stats, tasks_waiting);
-		accumulate_stat(s, w->stats, tasks_running);
-	}
+	accumulate_stat(s, ws, tasks_waiting);
+	accumulate_stat(s, ws, tasks_running);
 
 	/* we rely on workers messages to update tasks_running. such data are
 	 * attached to keepalive messages, thus tasks_running is not always
@@ -7739,25 +8205,41 @@ void aggregate_workers_resources( struct work_queue *q, struct work_queue_resour
 		return;
 	}
 
-	if(features) {
-		hash_table_clear(features,0);
+	/* The sums are kept as workers come and go. Only the smallest and
+	 * largest values may need all the workers again. */
+	if(!q->workers_resources_extremes_valid) {
+		bzero(q->workers_resources, sizeof(struct work_queue_resources));
+
+		hash_table_firstkey(q->worker_table);
+		while(hash_table_nextkey(q->worker_table,&key,(void**)&w)) {
+			if(w->resources->tag < 0)
+				continue;
+			work_queue_resources_add(q->workers_resources,w->resources);
+		}
+
+		q->workers_resources_extremes_valid = 1;
+	}
+
+	memcpy(total, q->workers_resources, sizeof(struct work_queue_resources));
+	total->tag = 0;
+
+	if(!features) {
+		return;
 	}
 
+	hash_table_clear(features,0);
+
 	hash_table_firstkey(q->worker_table);
 	while(hash_table_nextkey(q->worker_table,&key,(void**)&w)) {
 		if(w->resources->tag < 0)
 			continue;
 
-		work_queue_resources_add(total,w->resources);
-
-		if(features) {
-			if(w->features) {
-				char *key;
-				void *dummy;
-				hash_table_firstkey(w->features);
-				while(hash_table_nextkey(w->features, &key, &dummy)) {
-					hash_table_insert(features, key, (void **) 1);
-				}
+		if(w->features) {
+			char *key;
+			void *dummy;
+			hash_table_firstkey(w->features);
+			while(hash_table_nextkey(w->features, &key, &dummy)) {
+				hash_table_insert(features, key, (void **) 1);
 			}
 		}
 	}
@@ -7806,6 +8288,11 @@ int work_queue_specify_log(struct work_queue *q, const char *logfile)
 }
 
 static void write_transaction(struct work_queue *q, const char *str) {
+	if(q->transactions_txlog) {
+		work_queue_txlog_write(q->transactions_txlog, timestamp_get(), getpid(), str);
+		return;
+	}
+
 	if(!q->transactions_logfile)
 		return;
 
@@ -7814,7 +8301,7 @@ static void write_transaction(struct work_queue *q, const char *str) {
 }
 
 static void write_transaction_task(struct work_queue *q, struct work_queue_task *t) {
-	if(!q->transactions_logfile)
+	if(!q->transactions_logfile && !q->transactions_txlog)
 		return;
 
 	struct buffer B;
@@ -7882,7 +8369,7 @@ static void write_transaction_task(struct work_queue *q, struct work_queue_task
 
 static void write_transaction_category(struct work_queue *q, struct category *c) {
 
-	if(!q->transactions_logfile)
+	if(!q->transactions_logfile && !q->transactions_txlog)
 		return;
 
 	if(!c)
@@ -8041,6 +8528,20 @@ int work_queue_specify_transactions_log(struct work_queue *q, const char *logfil
 	}
 }
 
+int work_queue_specify_transactions_log_binary(struct work_queue *q, const char *logfile) {
+	q->transactions_txlog = work_queue_txlog_open(logfile);
+	if(q->transactions_txlog) {
+		debug(D_WQ, "binary transactions log enabled and is being written to %s\n", logfile);
+		write_transaction(q, "MANAGER START");
+		return 1;
+	}
+	else
+	{
+		debug(D_NOTICE | D_WQ, "couldn't open transactions logfile %s: %s\n", logfile, strerror(errno));
+		return 0;
+	}
+}
+
 void work_queue_accumulate_task(struct work_queue *q, struct work_queue_task *t) {
 	const char *name   = t->category ? t->category : "default";
 	struct category *c = work_queue_category_lookup_or_create(q, name);
@@ -8067,6 +8568,12 @@ void work_queue_accumulate_task(struct work_queue *q, struct work_queue_task *t)
 
 		s->tasks_done++;
 		s->time_workers_execute_good += t->time_workers_execute_last;
+
+		if(!c->wq_task_times) {
+			c->wq_task_times = quantile_sketch_create(WORK_QUEUE_TASK_TIME_ERROR, 0);
+		}
+		/* the same span that fast abort measures for running tasks. */
+		quantile_sketch_insert(c->wq_task_times, t->time_when_done - t->time_when_commit_start);
 		s->time_send_good            += t->time_when_commit_end - t->time_when_commit_end;
 		s->time_receive_good         += t->time_when_done - t->time_when_retrieval;
 	} else {
@@ -190,6 +190,9 @@ struct work_queue_task {
 	char *monitor_snapshot_file;                          /**< Filename the monitor checks to produce snapshots. */
 	struct list *features;                                /**< User-defined features this task requires. (See work_queue_worker's --feature option.) */
 
+	char *stdout_file;                                    /**< If set, the standard output is written to this file instead of kept in output. See @ref work_queue_task_specify_stdout_file. */
+	int stdout_spilled;                                   /**< Non-zero if the standard output was larger than the "stdout-memory-limit", and so stdout_file was chosen by the manager. */
+
 	/* deprecated fields */
 	//int total_submissions;                                 /**< @deprecated Use try_count. */
 
@@ -672,6 +675,18 @@ For more information, consult the manual of the resource_monitor.
 
 int work_queue_specify_snapshot_file(struct work_queue_task *t, const char *monitor_snapshot_file);
 
+/** Write the standard output of the task to a local file.
+The output is received from the worker in bounded chunks and written
+to the file as it arrives, so that a task with a very large output
+does not have to be held in the memory of the manager.  The output field
+of the task is then left empty.
+@param t A work queue task object.
+@param stdout_file The name of the local file, or NULL to keep the output in memory.
+@return 1 always.
+*/
+
+int work_queue_task_specify_stdout_file(struct work_queue_task *t, const char *stdout_file);
+
 
 //@}
 
@@ -938,6 +953,19 @@ multiplier.  The value specified here applies only to tasks in the given categor
 */
 int work_queue_activate_fast_abort_category(struct work_queue *q, const char *category, double multiplier);
 
+/** Turn on or off fast abort functionality for a given category, comparing
+running times to a quantile of the times of the tasks of the category rather
+than to their average. A high quantile, such as 0.95 or 0.99, is not skewed by
+a few very long tasks the way the average is, so that stragglers on slow
+workers are aborted sooner.
+@param q A work queue object.
+@param category A category name.
+@param multiplier The multiplier of the quantile task time at which point to abort, as in @ref work_queue_activate_fast_abort_category.
+@param quantile The quantile of task times, greater than 0 and at most 1. Any other value uses the average task time.
+@returns 0 if activated, 1 if deactivated.
+*/
+int work_queue_activate_fast_abort_category_quantile(struct work_queue *q, const char *category, double multiplier, double quantile);
+
 
 /** Set the draining mode per worker hostname.
 	If drain_flag is 0, workers at hostname receive tasks as usual.
@@ -1079,6 +1107,15 @@ int work_queue_specify_log(struct work_queue *q, const char *logfile);
 */
 int work_queue_specify_transactions_log(struct work_queue *q, const char *logfile);
 
+/** Add a log file that records the states of the connected workers and tasks in a compact binary form.
+The log has the same transactions as @ref work_queue_specify_transactions_log, but is
+written in blocks rather than a line at a time. Use work_queue_txlog_dump to recover the text form.
+@param q A work queue object.
+@param logfile The filename.
+@return 1 if logfile was opened, 0 otherwise.
+*/
+int work_queue_specify_transactions_log_binary(struct work_queue *q, const char *logfile);
+
 /** Add a mandatory password that each worker must present.
 @param q A work queue object.
 @param password The password to require.
@@ -1122,12 +1159,15 @@ void work_queue_manager_preferred_connection(struct work_queue *q, const char *p
  - "transfer-outlier-factor" Transfer that are this many times slower than the average will be aborted.  (default=10x)
  - "default-transfer-rate" The assumed network bandwidth used until sufficient data has been collected.  (1MB/s)
  - "fast-abort-multiplier" Set the multiplier of the average task time at which point to abort; if negative or zero fast_abort is deactivated. (default=0)
+ - "fast-abort-quantile" Compare running times to this quantile of task times (e.g. 0.95) rather than to the average, for categories that use the default multiplier. (default=0, use the average)
  - "keepalive-interval" Set the minimum number of seconds to wait before sending new keepalive checks to workers. (default=300)
  - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
  - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
  - "long-timeout" Set the minimum timeout when sending a brief message to a foreman. (default=1h)
  - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
  - "hungry-minimum" Mimimum number of tasks to consider queue not hungry. (default=10)
+ - "stdout-memory-limit" Largest standard output of a task, in MB, kept in memory. A larger output is written to a file in the working directory, named in the stdout_file field of the task, the output field keeps only its beginning, and the result of the task is WORK_QUEUE_RESULT_STDOUT_MISSING. The file is removed when the task is deleted or submitted again. (default=1024)
+ - "target-makespan" Seconds in which the tasks in the queue should complete. When set, @ref work_queue_hungry and the cores needed reported to the catalog are predicted from the execution time of each category. (default=0, disabled)
  - "wait-for-workers" Mimimum number of workers to connect before starting dispatching tasks. (default=0)
  - "attempt-schedule-depth" The amount of tasks to attempt scheduling on each pass of send_one_task in the main loop. (default=100)
  - "wait_retrieve_many" Parameter to alter how work_queue_wait works. If set to 0, work_queue_wait breaks out of the while loop whenever a task changes to WORK_QUEUE_TASK_DONE (wait_retrieve_one mode). If set to 1, work_queue_wait does not break, but continues recieving and dispatching tasks. This occurs until no task is sent or recieved, at which case it breaks out of the while loop (wait_retrieve_many mode). (default=0)
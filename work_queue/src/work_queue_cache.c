@@ -1,25 +1,57 @@
-
 #include "work_queue_cache.h"
 
 #include "xxmalloc.h"
 #include "hash_table.h"
+#include "list.h"
 #include "debug.h"
 #include "stringtools.h"
 #include "trash.h"
 #include "link.h"
 #include "timestamp.h"
 #include "copy_stream.h"
+#include "macros.h"
+#include "url_encode.h"
+#include "unlink_recursive.h"
 
 #include <sys/types.h>
 #include <sys/fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
 
 struct work_queue_cache {
 	struct hash_table *table;
 	char *cache_dir;
+
+	/* cachenames of transfers and commands not yet started, in order of arrival. */
+	struct list *fetch_queue;
+	/* cachename -> cache_file of transfers and commands running now. */
+	struct hash_table *fetching;
+	/* source -> number of fetches running from it. */
+	struct hash_table *fetches_by_source;
+
+	int max_fetches;
+	int max_fetches_per_source;
+
+	/* Total size of the objects present, and the size beyond which the least recently used are evicted. */
+	int64_t size;
+	int64_t max_size;
+	/* cachename -> number of tasks on the worker using it, which may not be evicted. */
+	struct hash_table *held;
+
+	/* If persistent, the index of the objects is saved in the cache directory, which is locked. */
+	int persistent;
+	int index_dirty;
+	time_t index_saved;
+	int lock_fd;
 };
 
 struct cache_file {
@@ -29,6 +61,14 @@ struct cache_file {
 	int64_t actual_size;
 	int mode;
 	int present;
+	int failed;
+
+	pid_t fetch_pid;
+	char *fetch_output;
+	timestamp_t fetch_start;
+	int fetch_result;
+
+	timestamp_t last_used;
 };
 
 struct cache_file * cache_file_create( work_queue_cache_type_t type, const char *source, int64_t expected_size, int64_t actual_size, int mode, int present )
@@ -40,15 +80,39 @@ struct cache_file * cache_file_create( work_queue_cache_type_t type, const char
 	f->actual_size = actual_size;
 	f->mode = mode;
 	f->present = present;
+	f->failed = 0;
+	f->fetch_pid = 0;
+	f->fetch_output = 0;
+	f->fetch_start = 0;
+	f->fetch_result = 0;
+	f->last_used = timestamp_get();
 	return f;
 }
 
 void cache_file_delete( struct cache_file *f )
 {
 	free(f->source);
+	free(f->fetch_output);
 	free(f);
 }
 
+static void cache_fetch_abort( struct work_queue_cache *c, const char *cachename, struct cache_file *f );
+static int cache_save_index( struct work_queue_cache *c );
+
+/*
+A persistent cache may be on another filesystem than the trash
+of the workspace, so its files are removed in place.
+*/
+
+static void cache_discard( struct work_queue_cache *c, const char *path )
+{
+	if(c->persistent) {
+		unlink_recursive(path);
+	} else {
+		trash_file(path);
+	}
+}
+
 /*
 Create the cache manager structure for a given cache directory.
 */
@@ -58,17 +122,69 @@ struct work_queue_cache * work_queue_cache_create( const char *cache_dir )
 	struct work_queue_cache *c = malloc(sizeof(*c));
 	c->cache_dir = strdup(cache_dir);
 	c->table = hash_table_create(0,0);
+	c->fetch_queue = list_create();
+	c->fetching = hash_table_create(0,0);
+	c->fetches_by_source = hash_table_create(0,0);
+	c->max_fetches = WORK_QUEUE_CACHE_MAX_FETCHES;
+	c->max_fetches_per_source = WORK_QUEUE_CACHE_MAX_FETCHES_PER_SOURCE;
+	c->size = 0;
+	c->max_size = 0;
+	c->held = hash_table_create(0,0);
+	c->persistent = 0;
+	c->index_dirty = 0;
+	c->index_saved = 0;
+	c->lock_fd = -1;
 	return c;
 }
 
+/*
+Set how many transfers and commands may run at once,
+and how many of those may come from the same source.
+*/
+
+void work_queue_cache_set_fetch_limits( struct work_queue_cache *c, int max_fetches, int max_fetches_per_source )
+{
+	c->max_fetches = MAX(1,max_fetches);
+	c->max_fetches_per_source = MAX(1,max_fetches_per_source);
+}
+
+/*
+Set the total size in bytes of the objects kept in the cache.
+Beyond it, the objects least recently used and not needed by
+any task are evicted.  If zero, the cache is not bounded.
+*/
+
+void work_queue_cache_set_max_size( struct work_queue_cache *c, int64_t max_size )
+{
+	c->max_size = MAX(0,max_size);
+}
+
 /*
 Delete the cache manager structure, though not the underlying files.
+Fetches still running are stopped, and a persistent index is saved.
 */
 
 void work_queue_cache_delete( struct work_queue_cache *c )
 {
+	char *cachename;
+	struct cache_file *f;
+
+	HASH_TABLE_ITERATE(c->table,cachename,f) {
+		cache_fetch_abort(c,cachename,f);
+	}
+
+	if(c->persistent) {
+		cache_save_index(c);
+		close(c->lock_fd);
+	}
+
 	hash_table_clear(c->table,(void*)cache_file_delete);
+	hash_table_delete(c->held);
 	hash_table_delete(c->table);
+	list_clear(c->fetch_queue,free);
+	list_delete(c->fetch_queue);
+	hash_table_delete(c->fetching);
+	hash_table_delete(c->fetches_by_source);
 	free(c->cache_dir);
 	free(c);
 }
@@ -82,7 +198,7 @@ char * work_queue_cache_full_path( struct work_queue_cache *c, const char *cache
 {
 	return string_format("%s/%s",c->cache_dir,cachename);
 }
-	
+
 
 /*
 Add a file to the cache manager (already created in the proper place) and note its size.
@@ -90,20 +206,44 @@ Add a file to the cache manager (already created in the proper place) and note i
 
 int work_queue_cache_addfile( struct work_queue_cache *c, int64_t size, const char *cachename )
 {
-	struct cache_file *f = cache_file_create(WORK_QUEUE_CACHE_FILE,"manager",size,size,0777,1);
+	/* The manager may send again an object it does not trust, which replaces the old one. */
+	struct cache_file *f = hash_table_remove(c->table,cachename);
+	if(f) {
+		cache_fetch_abort(c,cachename,f);
+		if(f->present) c->size -= f->actual_size;
+		cache_file_delete(f);
+	}
+
+	f = cache_file_create(WORK_QUEUE_CACHE_FILE,"manager",size,size,0777,1);
 	hash_table_insert(c->table,cachename,f);
+	c->size += size;
+	c->index_dirty = 1;
 	return 1;
 }
 
 /*
 Queue a remote file transfer or command execution to produce a file.
-This entry will be materialized later in work_queue_cache_ensure.
+It is started by work_queue_cache_check when the fetch limits allow,
+or at the latest when needed by work_queue_cache_ensure.
+The same request for an object already queued or in flight is ignored,
+so that an object is fetched once.
 */
 
 int work_queue_cache_queue( struct work_queue_cache *c, work_queue_cache_type_t type, const char *source, const char *cachename, int64_t size, int mode )
 {
-	struct cache_file *f = cache_file_create(type,source,size,0,mode,0);
+	struct cache_file *f = hash_table_lookup(c->table,cachename);
+	if(f && f->type==type && !strcmp(f->source,source) && !f->failed) {
+		debug(D_WQ,"cache: %s is already %s",cachename,f->present ? "present" : "queued");
+		return 1;
+	}
+
+	if(f) {
+		work_queue_cache_remove(c,cachename);
+	}
+
+	f = cache_file_create(type,source,size,0,mode,0);
 	hash_table_insert(c->table,cachename,f);
+	list_push_tail(c->fetch_queue,xxstrdup(cachename));
 	return 1;
 }
 
@@ -115,51 +255,57 @@ int work_queue_cache_remove( struct work_queue_cache *c, const char *cachename )
 {
 	struct cache_file *f = hash_table_remove(c->table,cachename);
 	if(!f) return 0;
-	
+
+	cache_fetch_abort(c,cachename,f);
+
 	char *cache_path = work_queue_cache_full_path(c,cachename);
-	trash_file(cache_path);
+	cache_discard(c,cache_path);
 	free(cache_path);
 
+	if(f->present) c->size -= f->actual_size;
+	c->index_dirty = 1;
+
 	cache_file_delete(f);
-	
+
 	return 1;
 
 }
 
 /*
-Execute a shell command via popen and capture its output.
-On success, return true.
-On failure, return false with the string error_message filled in.
+The source of a fetch, which limits how many fetches may load one server.
+For a url this is the scheme and host, and all commands share one source.
+This result must be freed.
 */
 
-
-static int do_internal_command( struct work_queue_cache *c, const char *command, char **error_message )
+static char * fetch_source( struct cache_file *f )
 {
-	int result = 0;
-	*error_message = 0;
-	
-	debug(D_WQ,"executing: %s",command);
-		
-	FILE *stream = popen(command,"r");
-	if(stream) {
-		copy_stream_to_buffer(stream,error_message,0);
-	  	int exit_status = pclose(stream);
-		if(exit_status==0) {
-			if(*error_message) {
-				free(*error_message);
-				*error_message = 0;
-			}
-			result = 1;
-		} else {
-			debug(D_WQ,"command failed with output: %s",*error_message);
-			result = 0;
-		}
-	} else {
-		*error_message = string_format("couldn't execute \"%s\": %s",command,strerror(errno));
-		result = 0;
+	if(f->type==WORK_QUEUE_CACHE_COMMAND) {
+		return xxstrdup("command");
 	}
 
-	return result;
+	const char *host = strstr(f->source,"://");
+	host = host ? host+3 : f->source;
+
+	return string_format("%.*s",(int)(host - f->source + strcspn(host,"/")),f->source);
+}
+
+static void fetch_source_count( struct work_queue_cache *c, struct cache_file *f, int delta )
+{
+	char *source = fetch_source(f);
+	intptr_t count = (intptr_t)hash_table_remove(c->fetches_by_source,source) + delta;
+	if(count>0) hash_table_insert(c->fetches_by_source,source,(void*)count);
+	free(source);
+}
+
+static int fetch_allowed( struct work_queue_cache *c, struct cache_file *f )
+{
+	if(hash_table_size(c->fetching) >= c->max_fetches) return 0;
+
+	char *source = fetch_source(f);
+	intptr_t count = (intptr_t)hash_table_lookup(c->fetches_by_source,source);
+	free(source);
+
+	return count < c->max_fetches_per_source;
 }
 
 /*
@@ -167,35 +313,122 @@ Transfer a single input file from a url to a local filename by using /usr/bin/cu
 -s Do not show progress bar.  (Also disables errors.)
 -S Show errors.
 -L Follow redirects as needed.
---stderr Send errors to /dev/stdout so that they are observed by popen.
+--stderr Send errors to /dev/stdout so that they are captured with the output.
+
+A command should contain %% which indicates the path of the cache file to be created.
+*/
+
+static char * fetch_command( struct cache_file *f, const char *cache_path )
+{
+	if(f->type==WORK_QUEUE_CACHE_TRANSFER) {
+		return string_format("curl -sSL --stderr /dev/stdout -o \"%s\" \"%s\"",cache_path,f->source);
+	} else {
+		return string_replace_percents(f->source,cache_path);
+	}
+}
+
+/*
+Start the transfer or command that creates a cached object, without
+waiting for it.  Its output is captured in a file in the cache directory,
+so that it can be sent to the manager if the fetch fails.
 */
 
-static int do_transfer( struct work_queue_cache *c, const char *source_url, const char *cache_path, char **error_message )
+static int cache_fetch_start( struct work_queue_cache *c, const char *cachename, struct cache_file *f )
 {
-	char * command = string_format("curl -sSL --stderr /dev/stdout -o \"%s\" \"%s\"",cache_path,source_url);
-	int result = do_internal_command(c,command,error_message);
+	if(f->type==WORK_QUEUE_CACHE_TRANSFER) {
+		debug(D_WQ,"cache: transferring %s to %s",f->source,cachename);
+	} else {
+		debug(D_WQ,"cache: creating %s via shell command",cachename);
+	}
+
+	char *output = string_format("%s/.fetch.XXXXXX",c->cache_dir);
+	int fd = mkstemp(output);
+	if(fd<0) {
+		debug(D_WQ,"cache: couldn't create %s: %s",output,strerror(errno));
+		free(output);
+		return 0;
+	}
+
+	char *cache_path = work_queue_cache_full_path(c,cachename);
+	char *command = fetch_command(f,cache_path);
+	free(cache_path);
+
+	debug(D_WQ,"executing: %s",command);
+
+	pid_t pid = fork();
+	if(pid==0) {
+		setpgid(0,0);
+		dup2(fd,STDOUT_FILENO);
+		close(fd);
+		execl("/bin/sh","sh","-c",command,(char*)0);
+		_exit(127);
+	}
+
+	close(fd);
 	free(command);
-	return result;
+
+	if(pid<0) {
+		debug(D_WQ,"cache: couldn't fork to create %s: %s",cachename,strerror(errno));
+		unlink(output);
+		free(output);
+		return 0;
+	}
+
+	f->fetch_pid = pid;
+	f->fetch_output = output;
+	f->fetch_start = timestamp_get();
+	hash_table_insert(c->fetching,cachename,f);
+	fetch_source_count(c,f,1);
+
+	return 1;
 }
 
 /*
-Create a file by executing a shell command.
-The command should contain %% which indicates the path of the cache file to be created.
+Check whether a fetch has ended, waiting for it if block is set.
 */
 
-static int do_command( struct work_queue_cache *c, const char *command, const char *cache_path, char **error_message )
+static int cache_fetch_wait( struct cache_file *f, int block )
 {
-	char *full_command = string_replace_percents(command,cache_path);
-	int result = do_internal_command(c,full_command,error_message);
-	free(full_command);
-	return result;
+	int status;
+	pid_t pid;
+
+	do {
+		pid = waitpid(f->fetch_pid,&status,block ? 0 : WNOHANG);
+	} while(pid<0 && errno==EINTR);
+
+	if(pid==0) return 0;
+
+	f->fetch_result = pid>0 && WIFEXITED(status) && WEXITSTATUS(status)==0;
+	return 1;
+}
+
+static void cache_fetch_release( struct work_queue_cache *c, const char *cachename, struct cache_file *f )
+{
+	hash_table_remove(c->fetching,cachename);
+	fetch_source_count(c,f,-1);
+
+	unlink(f->fetch_output);
+	free(f->fetch_output);
+	f->fetch_output = 0;
+	f->fetch_pid = 0;
 }
 
 /*
-Ensure that a given cached entry is fully materialized in the cache,
-downloading files or executing commands as needed.  If present, return
-true, otherwise return false.
+Stop a fetch that is no longer wanted, along with anything it started.
+*/
+
+static void cache_fetch_abort( struct work_queue_cache *c, const char *cachename, struct cache_file *f )
+{
+	if(!f->fetch_pid) return;
 
+	debug(D_WQ,"cache: stopping the creation of %s",cachename);
+	kill(-f->fetch_pid,SIGKILL);
+	kill(f->fetch_pid,SIGKILL);
+	cache_fetch_wait(f,1);
+	cache_fetch_release(c,cachename,f);
+}
+
+/*
 It is a little odd that the manager link is passed as an argument here,
 but it is needed in order to send back the necessary update/invalid messages.
 */
@@ -203,60 +436,39 @@ but it is needed in order to send back the necessary update/invalid messages.
 int send_cache_update( struct link *manager, const char *cachename, int64_t size, timestamp_t transfer_time );
 int send_cache_invalid( struct link *manager, const char *cachename, const char *message );
 
-int work_queue_cache_ensure( struct work_queue_cache *c, const char *cachename, struct link *manager )
-{
-	struct cache_file *f = hash_table_lookup(c->table,cachename);
-	if(!f) {
-		debug(D_WQ,"cache: %s is unknown, perhaps it failed to transfer earlier?",cachename);
-		return 0;
-	}
+/*
+Finish a fetch that has ended: set the permissions of the object and
+check that it is actually present, even if the command succeeded, then
+tell the manager whether the object is now valid.
+*/
 
-	if(f->present) {
-		debug(D_WQ,"cache: %s is already present.",cachename);
-		return 1;
-	}
-	
+static int cache_fetch_end( struct work_queue_cache *c, const char *cachename, struct cache_file *f, struct link *manager )
+{
 	char *cache_path = work_queue_cache_full_path(c,cachename);
 	char *error_message = 0;
 
-	int result = 0;
+	timestamp_t transfer_time = timestamp_get() - f->fetch_start;
+	int result = f->fetch_result;
 
-	timestamp_t transfer_start = timestamp_get();
-	
-	switch(f->type) {
-		case WORK_QUEUE_CACHE_FILE:
-			debug(D_WQ,"error: file %s should already be present!",cachename);
-			result = 0;
-			break;
-		  
-		case WORK_QUEUE_CACHE_TRANSFER:
-			debug(D_WQ,"cache: transferring %s to %s",f->source,cachename);
-			result = do_transfer(c,f->source,cache_path,&error_message);
-			break;
-
-		case WORK_QUEUE_CACHE_COMMAND:
-			debug(D_WQ,"cache: creating %s via shell command",cachename);
-			result = do_command(c,f->source,cache_path,&error_message);
-			break;
+	if(!result) {
+		copy_file_to_buffer(f->fetch_output,&error_message,0);
+		debug(D_WQ,"command failed with output: %s",error_message ? error_message : "");
 	}
 
-	// Set the permissions as originally indicated.	
+	cache_fetch_release(c,cachename,f);
+
+	// Set the permissions as originally indicated.
 	chmod(cache_path,f->mode);
 
-	timestamp_t transfer_end = timestamp_get();
-	timestamp_t transfer_time = transfer_end - transfer_start;
-	
-	/*
-	Although the prior command may have succeeded, check the actual desired
-	file in the cache to make sure that it is present.
-	*/
-	
 	if(result) {
 		struct stat info;
 		if(stat(cache_path,&info)==0) {
 			f->actual_size = info.st_size;
 			f->expected_size = f->actual_size;
 			f->present = 1;
+			f->last_used = timestamp_get();
+			c->size += f->actual_size;
+			c->index_dirty = 1;
 			debug(D_WQ,"cache: created %s with size %lld in %lld usec",cachename,(long long)f->actual_size,(long long)transfer_time);
 			send_cache_update(manager,cachename,f->actual_size,transfer_time);
 			result = 1;
@@ -273,18 +485,356 @@ int work_queue_cache_ensure( struct work_queue_cache *c, const char *cachename,
 	If we failed to create the cached file for any reason,
 	then destroy any partial remaining file, and inform
 	the manager that the cached object is invalid.
-	This task will fail in the sandbox setup stage.
+	A task that needs it will fail in the sandbox setup stage.
 	*/
-	
+
 	if(!result) {
-		trash_file(cache_path);
+		f->failed = 1;
+		cache_discard(c,cache_path);
+		if(!error_message) error_message = string_format("couldn't create %s",cachename);
 		send_cache_invalid(manager,cachename,error_message);
 	}
-	
-	if(error_message) free(error_message);
+
+	free(error_message);
 	free(cache_path);
 	return result;
 }
 
+/*
+Note that an object is needed by a task which the worker holds, from the
+time the task is received to the time it is removed, so that the object
+is not evicted in between.  An object may be held before it exists, as
+the output of a task.
+*/
 
+void work_queue_cache_hold( struct work_queue_cache *c, const char *cachename )
+{
+	intptr_t count = (intptr_t)hash_table_remove(c->held,cachename) + 1;
+	hash_table_insert(c->held,cachename,(void*)count);
 
+	struct cache_file *f = hash_table_lookup(c->table,cachename);
+	if(f) f->last_used = timestamp_get();
+}
+
+void work_queue_cache_release( struct work_queue_cache *c, const char *cachename )
+{
+	intptr_t count = (intptr_t)hash_table_remove(c->held,cachename) - 1;
+	if(count>0) hash_table_insert(c->held,cachename,(void*)count);
+}
+
+struct cache_victim {
+	char *cachename;
+	timestamp_t last_used;
+};
+
+static int cache_victim_compare( const void *a, const void *b )
+{
+	const struct cache_victim *x = a;
+	const struct cache_victim *y = b;
+	if(x->last_used < y->last_used) return -1;
+	if(x->last_used > y->last_used) return 1;
+	return 0;
+}
+
+/*
+Remove the objects least recently used until the cache is back within
+its size, skipping those held by tasks or still being fetched.  The
+manager is told that each is no longer present, so that it sends it
+again when needed.
+*/
+
+static void cache_evict( struct work_queue_cache *c, struct link *manager )
+{
+	struct cache_victim *victims = malloc(hash_table_size(c->table)*sizeof(*victims));
+	int n = 0;
+
+	char *cachename;
+	struct cache_file *f;
+	HASH_TABLE_ITERATE(c->table,cachename,f) {
+		if(!f->present || f->fetch_pid || hash_table_lookup(c->held,cachename)) continue;
+		victims[n].cachename = xxstrdup(cachename);
+		victims[n].last_used = f->last_used;
+		n++;
+	}
+
+	qsort(victims,n,sizeof(*victims),cache_victim_compare);
+
+	int i;
+	for(i=0;i<n;i++) {
+		if(c->size>c->max_size) {
+			debug(D_WQ,"cache: evicting %s to keep the cache within %lld bytes",victims[i].cachename,(long long)c->max_size);
+			work_queue_cache_remove(c,victims[i].cachename);
+			send_cache_invalid(manager,victims[i].cachename,"evicted from the cache");
+		}
+		free(victims[i].cachename);
+	}
+
+	free(victims);
+
+	if(c->size>c->max_size) {
+		debug(D_WQ,"cache: %lld bytes are in use by tasks, beyond the limit of %lld bytes",(long long)c->size,(long long)c->max_size);
+	}
+}
+
+/*
+Only the objects which the manager names for caching, as "file-0-..."
+rather than with a count of files, keep the same name in later runs,
+so only those are kept in the index.
+*/
+
+static int cache_name_is_lasting( const char *cachename )
+{
+	const char *dash = strchr(cachename,'-');
+	return dash && !strncmp(dash,"-0-",3);
+}
+
+/*
+Write the index of the objects present, one per line, to a new file
+which then replaces the old one, so that the index is never partial.
+*/
+
+static int cache_save_index( struct work_queue_cache *c )
+{
+	char *index_path = work_queue_cache_full_path(c,WORK_QUEUE_CACHE_INDEX);
+	char *tmp_path = string_format("%s.tmp",index_path);
+
+	FILE *file = fopen(tmp_path,"w");
+	if(!file) {
+		debug(D_WQ,"cache: couldn't write %s: %s",tmp_path,strerror(errno));
+		free(index_path);
+		free(tmp_path);
+		return 0;
+	}
+
+	char *cachename;
+	struct cache_file *f;
+	HASH_TABLE_ITERATE(c->table,cachename,f) {
+		if(!f->present || !cache_name_is_lasting(cachename)) continue;
+		int length = strlen(f->source)*3+1;
+		char *source = malloc(length);
+		url_encode(f->source,source,length);
+		fprintf(file,"%d %lld %o %llu %s %s\n",f->type,(long long)f->actual_size,f->mode,(unsigned long long)f->last_used,cachename,source);
+		free(source);
+	}
+
+	int result = fclose(file)==0 && rename(tmp_path,index_path)==0;
+	if(result) {
+		c->index_dirty = 0;
+		c->index_saved = time(0);
+	} else {
+		debug(D_WQ,"cache: couldn't write %s: %s",index_path,strerror(errno));
+		unlink(tmp_path);
+	}
+
+	free(index_path);
+	free(tmp_path);
+	return result;
+}
+
+/*
+Remove the files in the cache directory which are not in the table,
+as left by a worker that did not exit cleanly.
+*/
+
+static void cache_remove_strays( struct work_queue_cache *c )
+{
+	DIR *dir = opendir(c->cache_dir);
+	if(!dir) return;
+
+	struct dirent *d;
+	while((d=readdir(dir))) {
+		if(!strcmp(d->d_name,".") || !strcmp(d->d_name,"..")) continue;
+		if(!strcmp(d->d_name,WORK_QUEUE_CACHE_INDEX) || !strcmp(d->d_name,WORK_QUEUE_CACHE_LOCK)) continue;
+		if(hash_table_lookup(c->table,d->d_name)) continue;
+
+		debug(D_WQ,"cache: removing stray %s",d->d_name);
+		char *path = work_queue_cache_full_path(c,d->d_name);
+		cache_discard(c,path);
+		free(path);
+	}
+
+	closedir(dir);
+}
+
+/*
+Keep the cache directory and an index of its objects from one run of the
+worker to the next.  The directory is locked, as it may not be shared by
+two workers at once.  Each object in the index is kept if it is still
+present with the same size.  Returns false if the directory is locked.
+*/
+
+int work_queue_cache_load( struct work_queue_cache *c )
+{
+	char *lock_path = work_queue_cache_full_path(c,WORK_QUEUE_CACHE_LOCK);
+	c->lock_fd = open(lock_path,O_WRONLY|O_CREAT,0666);
+	free(lock_path);
+
+	if(c->lock_fd<0 || flock(c->lock_fd,LOCK_EX|LOCK_NB)<0) {
+		debug(D_WQ,"cache: couldn't lock %s: %s",c->cache_dir,strerror(errno));
+		if(c->lock_fd>=0) close(c->lock_fd);
+		c->lock_fd = -1;
+		return 0;
+	}
+
+	c->persistent = 1;
+
+	char *index_path = work_queue_cache_full_path(c,WORK_QUEUE_CACHE_INDEX);
+	FILE *file = fopen(index_path,"r");
+	free(index_path);
+
+	if(file) {
+		char *line = 0;
+		size_t length = 0;
+
+		while(getline(&line,&length,file)>0) {
+			int type, mode;
+			long long size;
+			unsigned long long last_used;
+			char *cachename = malloc(strlen(line)+1);
+			char *source_encoded = malloc(strlen(line)+1);
+
+			if(sscanf(line,"%d %lld %o %llu %s %s",&type,&size,&mode,&last_used,cachename,source_encoded)==6 && cache_name_is_lasting(cachename) && !hash_table_lookup(c->table,cachename)) {
+				char *path = work_queue_cache_full_path(c,cachename);
+				struct stat info;
+				if(stat(path,&info)==0 && (S_ISDIR(info.st_mode) || info.st_size==size)) {
+					char *source = malloc(strlen(source_encoded)+1);
+					url_decode(source_encoded,source,strlen(source_encoded)+1);
+					struct cache_file *f = cache_file_create(type,source,size,size,mode,1);
+					f->last_used = last_used;
+					hash_table_insert(c->table,cachename,f);
+					c->size += size;
+					free(source);
+				}
+				free(path);
+			}
+
+			free(cachename);
+			free(source_encoded);
+		}
+
+		free(line);
+		fclose(file);
+	}
+
+	cache_remove_strays(c);
+
+	debug(D_WQ,"cache: loaded %d objects with %lld bytes from %s",hash_table_size(c->table),(long long)c->size,c->cache_dir);
+
+	c->index_dirty = 1;
+	return 1;
+}
+
+/*
+Tell a newly connected manager about the objects already in the cache,
+so that it does not send them again.
+*/
+
+void work_queue_cache_advertise( struct work_queue_cache *c, struct link *manager )
+{
+	char *cachename;
+	struct cache_file *f;
+	HASH_TABLE_ITERATE(c->table,cachename,f) {
+		if(f->present && cache_name_is_lasting(cachename)) {
+			send_cache_update(manager,cachename,f->actual_size,0);
+		}
+	}
+}
+
+/*
+Collect the fetches that have ended, and start those queued as the limits
+allow.  The worker calls this on every pass of its main loop, so that objects
+are fetched concurrently while it waits on the manager, rather than one at
+a time when a task is about to run.
+*/
+
+void work_queue_cache_check( struct work_queue_cache *c, struct link *manager )
+{
+	char *cachename;
+	struct cache_file *f;
+
+	if(hash_table_size(c->fetching)>0) {
+		struct list *ended = list_create();
+
+		HASH_TABLE_ITERATE(c->fetching,cachename,f) {
+			if(cache_fetch_wait(f,0)) list_push_tail(ended,xxstrdup(cachename));
+		}
+
+		while((cachename = list_pop_head(ended))) {
+			f = hash_table_lookup(c->table,cachename);
+			cache_fetch_end(c,cachename,f,manager);
+			free(cachename);
+		}
+
+		list_delete(ended);
+	}
+
+	if(c->max_size>0 && c->size>c->max_size) {
+		cache_evict(c,manager);
+	}
+
+	if(c->persistent && c->index_dirty && time(0)-c->index_saved >= WORK_QUEUE_CACHE_INDEX_INTERVAL) {
+		cache_save_index(c);
+	}
+
+	/* Start queued fetches in order, keeping those held back by their source. */
+	int n = list_size(c->fetch_queue);
+	while(n-- > 0 && hash_table_size(c->fetching) < c->max_fetches) {
+		cachename = list_pop_head(c->fetch_queue);
+		f = hash_table_lookup(c->table,cachename);
+
+		if(!f || f->present || f->failed || f->fetch_pid) {
+			free(cachename);
+		} else if(!fetch_allowed(c,f)) {
+			list_push_tail(c->fetch_queue,cachename);
+		} else {
+			if(!cache_fetch_start(c,cachename,f)) {
+				f->failed = 1;
+				send_cache_invalid(manager,cachename,"couldn't start fetch");
+			}
+			free(cachename);
+		}
+	}
+}
+
+/*
+Ensure that a given cached entry is fully materialized in the cache,
+downloading files or executing commands as needed.  If present, return
+true, otherwise return false.  Other queued fetches are started first,
+so that they proceed while waiting for this one.
+*/
+
+int work_queue_cache_ensure( struct work_queue_cache *c, const char *cachename, struct link *manager )
+{
+	struct cache_file *f = hash_table_lookup(c->table,cachename);
+	if(!f) {
+		debug(D_WQ,"cache: %s is unknown, perhaps it failed to transfer earlier?",cachename);
+		return 0;
+	}
+
+	f->last_used = timestamp_get();
+
+	if(f->present) {
+		debug(D_WQ,"cache: %s is already present.",cachename);
+		return 1;
+	}
+
+	if(f->type==WORK_QUEUE_CACHE_FILE) {
+		debug(D_WQ,"error: file %s should already be present!",cachename);
+		return 0;
+	}
+
+	work_queue_cache_check(c,manager);
+
+	if(f->present) {
+		return 1;
+	}
+
+	if(!f->fetch_pid && !cache_fetch_start(c,cachename,f)) {
+		send_cache_invalid(manager,cachename,"couldn't start fetch");
+		return 0;
+	}
+
+	cache_fetch_wait(f,1);
+
+	return cache_fetch_end(c,cachename,f,manager);
+}
@@ -6,10 +6,18 @@ The cache module keeps track of the intention and state of objects
 in the worker cache.  This includes plain files which have been
 sent directly by the manager, as well as requests to create files
 by transferring urls or executing Unix commands.  Requests for
-transfers or commands are queued and not executed immediately.
+transfers or commands are queued and started in the background by
+work_queue_cache_check, a bounded number at a time and from each source.
 When a task is about to be executed, each input file is checked
-via work_queue_cache_ensure and downloaded if needed.  This allow
-for file transfers to occur asynchronously of the manager.
+via work_queue_cache_ensure, which waits for it to be fetched if needed.
+This allow for file transfers to occur asynchronously of the manager.
+
+The cache may be bounded in size, in which case the objects least
+recently used are evicted, except those needed by the tasks held by the
+worker, and the manager is told with a cache-invalid message.  With
+work_queue_cache_load, the cache directory is kept with an index of its
+objects from one run of the worker to the next, and the objects are
+advertised to each manager on connection.
 */
 
 
@@ -17,6 +25,14 @@ for file transfers to occur asynchronously of the manager.
 
 struct link;
 
+#define WORK_QUEUE_CACHE_MAX_FETCHES 8
+#define WORK_QUEUE_CACHE_MAX_FETCHES_PER_SOURCE 4
+
+/* Files kept in a persistent cache directory, and the seconds between saves of the index. */
+#define WORK_QUEUE_CACHE_INDEX ".index"
+#define WORK_QUEUE_CACHE_LOCK ".lock"
+#define WORK_QUEUE_CACHE_INDEX_INTERVAL 10
+
 typedef enum {
 	WORK_QUEUE_CACHE_FILE,
 	WORK_QUEUE_CACHE_TRANSFER,
@@ -25,12 +41,19 @@ typedef enum {
 
 struct work_queue_cache * work_queue_cache_create( const char *cachedir );
 void work_queue_cache_delete( struct work_queue_cache *c );
+void work_queue_cache_set_fetch_limits( struct work_queue_cache *c, int max_fetches, int max_fetches_per_source );
+void work_queue_cache_set_max_size( struct work_queue_cache *c, int64_t max_size );
+int work_queue_cache_load( struct work_queue_cache *c );
+void work_queue_cache_advertise( struct work_queue_cache *c, struct link *manager );
 
 char *work_queue_cache_full_path( struct work_queue_cache *c, const char *cachename );
 
 int work_queue_cache_addfile( struct work_queue_cache *c, int64_t size, const char *cachename );
 int work_queue_cache_queue( struct work_queue_cache *c, work_queue_cache_type_t, const char *source, const char *cachename, int64_t size, int mode );
 int work_queue_cache_ensure( struct work_queue_cache *c, const char *cachename, struct link *manager );
+void work_queue_cache_check( struct work_queue_cache *c, struct link *manager );
 int work_queue_cache_remove( struct work_queue_cache *c, const char *cachename );
+void work_queue_cache_hold( struct work_queue_cache *c, const char *cachename );
+void work_queue_cache_release( struct work_queue_cache *c, const char *cachename );
 
 #endif
@@ -6,8 +6,11 @@ See the file COPYING for details.
 
 #include <errno.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "work_queue_coprocess.h"
 #include "work_queue_resources.h"
@@ -22,12 +25,12 @@ See the file COPYING for details.
 #include "jx_print.h"
 #include "link.h"
 #include "timestamp.h"
-#include "process.h"
 #include "stringtools.h"
 #include "xxmalloc.h"
 
 static time_t coprocess_connect_timeout = 60;   // max time to connect, one minute
 static time_t coprocess_execute_timeout = 3600; // max time to execute, one hour
+static time_t coprocess_kill_timeout = 30;      // max time to exit after SIGTERM
 
 /* Read back a fixed size message consisting of a length header, then the data itself. */
 
@@ -61,7 +64,8 @@ int work_queue_coprocess_setup(struct work_queue_coprocess *coprocess)
 
 	char * buffer = work_queue_coprocess_read_message(coprocess->read_link,time(0)+coprocess_connect_timeout);
 	if(!buffer) {
-		fatal("Unable to get information from coprocess\n");
+		debug(D_WQ, "Unable to get information from coprocess %s\n", coprocess->command);
+		return -1;
 	}
 
 	struct jx *item, *coprocess_json = jx_parse_string(buffer);
@@ -93,6 +97,7 @@ int work_queue_coprocess_setup(struct work_queue_coprocess *coprocess)
 		fatal("couldn't find \"name\" in coprocess configuration\n");
     }
 
+	free(coprocess->name);
 	coprocess->name = name;
 
 	free(buffer);
@@ -108,12 +113,13 @@ char *work_queue_coprocess_start(struct work_queue_coprocess *coprocess) {
 	if(coprocess->pid > 0) {
 		coprocess->read_link = link_attach_to_fd(coprocess->pipe_out[0]);
 		coprocess->write_link = link_attach_to_fd(coprocess->pipe_in[1]);
-		if (work_queue_coprocess_setup(coprocess)) {
-			fatal("Unable to setup coprocess");
-		}
 		if (close(coprocess->pipe_in[0]) || close(coprocess->pipe_out[1])) {
 			fatal("coprocess error parent: %s\n", strerror(errno));
 		}
+		if (work_queue_coprocess_setup(coprocess)) {
+			work_queue_coprocess_terminate(coprocess);
+			return NULL;
+		}
 		debug(D_WQ, "coprocess running command %s\n", coprocess->command);
 		coprocess->state = WORK_QUEUE_COPROCESS_READY;
         return coprocess->name;
@@ -140,8 +146,33 @@ char *work_queue_coprocess_start(struct work_queue_coprocess *coprocess) {
     return NULL;
 }
 
+/*
+Wait only for the coprocess itself, and not with process_waitpid, which
+would also collect the tasks the worker is waiting for.
+*/
+
+static int coprocess_waitpid(struct work_queue_coprocess *coprocess, int *status, int timeout)
+{
+	time_t stoptime = time(0) + timeout;
+
+	while(1) {
+		int result = waitpid(coprocess->pid, status, WNOHANG);
+		if(result != 0 || time(0) >= stoptime) {
+			return result;
+		}
+		usleep(10000);
+	}
+}
+
 void work_queue_coprocess_terminate(struct work_queue_coprocess *coprocess) {
-    process_kill_waitpid(coprocess->pid, 30);
+	int status;
+
+	if (coprocess->state != WORK_QUEUE_COPROCESS_DEAD && coprocess->pid > 0 && kill(coprocess->pid, SIGTERM) == 0) {
+		if (coprocess_waitpid(coprocess, &status, coprocess_kill_timeout) == 0) {
+			kill(coprocess->pid, SIGKILL);
+			waitpid(coprocess->pid, &status, 0);
+		}
+	}
 	coprocess->state = WORK_QUEUE_COPROCESS_DEAD;
 }
 
@@ -151,15 +182,27 @@ void work_queue_coprocess_shutdown(struct work_queue_coprocess *coprocess_info,
 	}
 }
 
+/* Return true if the coprocess has exited, and report how it did so. */
+
 int work_queue_coprocess_check(struct work_queue_coprocess *coprocess)
 {
-	struct process_info *p = process_waitpid(coprocess->pid, 0);
-	if (!p) {
-        return 0;
+	if (coprocess->state == WORK_QUEUE_COPROCESS_DEAD || coprocess->state == WORK_QUEUE_COPROCESS_UNINITIALIZED) {
+		return 0;
+	}
+
+	int status;
+	int result = coprocess_waitpid(coprocess, &status, 0);
+	if (result == 0) {
+		return 0;
+	} else if (result < 0) {
+		debug(D_WQ, "Waiting on coprocess with pid %d returned an error: %s", coprocess->pid, strerror(errno));
+	} else if (!WIFEXITED(status)) {
+		debug(D_WQ, "Coprocess %s (pid %d) exited abnormally with signal %d", coprocess->name, coprocess->pid, WTERMSIG(status));
+	} else {
+		debug(D_WQ, "Coprocess %s (pid %d) exited normally with exit code %d", coprocess->name, coprocess->pid, WEXITSTATUS(status));
 	}
 
-    free(p);
-    return 1;
+	return 1;
 }
 
 /* Invoke a function by connecting, sending the invocation, and reading back the result. */
@@ -211,10 +254,16 @@ struct work_queue_coprocess *work_queue_coprocess_initialize_all_coprocesses(int
 	int coprocess_disk_normalized   = ( (coprocess_disk > 0)   ? coprocess_disk   : total_resources->disk.total);
 	int coprocess_gpus_normalized   = ( (coprocess_gpus > 0)   ? coprocess_gpus   : total_resources->gpus.total);
 
-	coprocess_resources->cores.total = coprocess_cores_normalized;
-	coprocess_resources->memory.total = coprocess_memory_normalized;
-	coprocess_resources->disk.total = coprocess_disk_normalized;
-	coprocess_resources->gpus.total = coprocess_gpus_normalized;
+	/* The manager sees the pool as a whole, with each instance as the largest function it can run. */
+	coprocess_resources->cores.total  = coprocess_cores_normalized  * number_of_coprocess_instances;
+	coprocess_resources->memory.total = coprocess_memory_normalized * number_of_coprocess_instances;
+	coprocess_resources->disk.total   = coprocess_disk_normalized   * number_of_coprocess_instances;
+	coprocess_resources->gpus.total   = coprocess_gpus_normalized   * number_of_coprocess_instances;
+
+	coprocess_resources->cores.smallest  = coprocess_resources->cores.largest  = coprocess_cores_normalized;
+	coprocess_resources->memory.smallest = coprocess_resources->memory.largest = coprocess_memory_normalized;
+	coprocess_resources->disk.smallest   = coprocess_resources->disk.largest   = coprocess_disk_normalized;
+	coprocess_resources->gpus.smallest   = coprocess_resources->gpus.largest   = coprocess_gpus_normalized;
 
 	struct work_queue_coprocess * coprocess_info = malloc(sizeof(struct work_queue_coprocess) * number_of_coprocess_instances);
 	memset(coprocess_info, 0, sizeof(struct work_queue_coprocess) * number_of_coprocess_instances);
@@ -227,7 +276,9 @@ struct work_queue_coprocess *work_queue_coprocess_initialize_all_coprocesses(int
 		curr_coprocess->coprocess_resources->memory.total = coprocess_memory_normalized;
 		curr_coprocess->coprocess_resources->disk.total   = coprocess_disk_normalized;
 		curr_coprocess->coprocess_resources->gpus.total   = coprocess_gpus_normalized;
-		work_queue_coprocess_start(curr_coprocess);
+		if (!work_queue_coprocess_start(curr_coprocess)) {
+			fatal("Unable to setup coprocess %s", coprocess_command);
+		}
 	}
 	return coprocess_info;
 }
@@ -290,38 +341,49 @@ int work_queue_coprocess_enforce_limit(struct work_queue_coprocess *coprocess) {
 	}
 }
 
+/* Close the pipes to a coprocess that has exited, so that it can be started again. */
+
+static void coprocess_cleanup(struct work_queue_coprocess *coprocess)
+{
+	link_detach(coprocess->read_link);
+	link_detach(coprocess->write_link);
+	link_detach(coprocess->network_link);
+	coprocess->read_link = coprocess->write_link = coprocess->network_link = NULL;
+
+	if (close(coprocess->pipe_in[1]) || close(coprocess->pipe_out[0])) {
+		debug(D_WQ, "Unable to close pipes from dead coprocess: %s\n", strerror(errno));
+	}
+	coprocess->pipe_in[1] = coprocess->pipe_out[0] = -1;
+}
+
+/*
+Check that every instance of the pool is still running, and start again
+those that have exited or were killed, up to a limit of restarts each.
+A task that was running in an instance when it exited fails on its own,
+as its connection to the instance is broken.
+*/
+
 void work_queue_coprocess_update_state(struct work_queue_coprocess *coprocess_info, int number_of_coprocesses) {
 	for (int i = 0; i < number_of_coprocesses; i++) {
-		if (work_queue_coprocess_check(coprocess_info + i)) {
-			int status;
-			int result = waitpid(coprocess_info[i].pid, &status, 0);
-			if(result==0) {
-				fatal("Coprocess instace %d has both terminated and not terminated\n", i);
-			} else if(result<0) {
-				debug(D_WQ, "Waiting on coprocess with pid %d returned an error: %s", coprocess_info[i].pid, strerror(errno));
-			} else if(result>0) {
-				if (!WIFEXITED(status)){
-					debug(D_WQ, "Coprocess instance %d (pid %d) exited abnormally with signal %d", i, coprocess_info[i].pid, WTERMSIG(status));
-				}
-				else {
-					debug(D_WQ, "Coprocess instance %d (pid %d) exited normally with exit code %d", i, coprocess_info[i].pid, WEXITSTATUS(status));
-				}
-			}
-			coprocess_info[i].state = WORK_QUEUE_COPROCESS_DEAD;
+		struct work_queue_coprocess *coprocess = coprocess_info + i;
+
+		if (work_queue_coprocess_check(coprocess)) {
+			coprocess->state = WORK_QUEUE_COPROCESS_DEAD;
 		}
-	}
-	for (int i = 0; i < number_of_coprocesses; i++)
-	{
-		if (coprocess_info[i].state == WORK_QUEUE_COPROCESS_DEAD) {
-			if (coprocess_info[i].num_restart_attempts >= 10) {
-				debug(D_WQ, "Coprocess instance %d has died more than 10 times, no longer attempting to restart\n", i);
-			}
-			if (close(coprocess_info[i].pipe_in[1]) || close(coprocess_info[i].pipe_out[0])) {
-				fatal("Unable to close pipes from dead coprocess: %s\n", strerror(errno));
-			}
-			debug(D_WQ, "Attempting to restart coprocess instance %d\n", i);
-			work_queue_coprocess_start(coprocess_info + i);
-			coprocess_info[i].num_restart_attempts++;
+
+		if (coprocess->state != WORK_QUEUE_COPROCESS_DEAD || coprocess->pipe_out[0] < 0) {
+			continue;
 		}
+
+		coprocess_cleanup(coprocess);
+
+		if (coprocess->num_restart_attempts >= WORK_QUEUE_COPROCESS_MAX_RESTARTS) {
+			debug(D_WQ|D_NOTICE, "Coprocess instance %d has died more than %d times, no longer attempting to restart\n", i, WORK_QUEUE_COPROCESS_MAX_RESTARTS);
+			continue;
+		}
+
+		debug(D_WQ, "Attempting to restart coprocess instance %d\n", i);
+		coprocess->num_restart_attempts++;
+		work_queue_coprocess_start(coprocess);
 	}
 }
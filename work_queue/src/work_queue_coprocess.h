@@ -9,6 +9,9 @@ See the file COPYING for details.
 #include "link.h"
 #include "work_queue_resources.h"
 
+/* Number of times an instance is started again after it exits, before giving up on it. */
+#define WORK_QUEUE_COPROCESS_MAX_RESTARTS 10
+
 typedef enum {
 	WORK_QUEUE_COPROCESS_UNINITIALIZED, /**< worker has not yet created coprocess instance **/
 	WORK_QUEUE_COPROCESS_READY,         /**< coprocess is ready to receive and run a RemoteTask **/
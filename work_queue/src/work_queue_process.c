@@ -295,9 +295,11 @@ pid_t work_queue_process_execute(struct work_queue_process *p )
 			// write data to output file
 			if(output) {
 				full_write(p->output_fd, output, strlen(output));
+				exit(0);
 			}
-			
-			exit(0);
+
+			// the coprocess instance could not run the function, e.g. because it exited
+			exit(1);
 		}
 
 		close(p->output_fd);
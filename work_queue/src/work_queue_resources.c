@@ -115,12 +115,30 @@ void work_queue_resources_clear( struct work_queue_resources *r )
 	memset(r,0,sizeof(*r));
 }
 
+/*
+The smallest and largest values of a sum start from zero, and count how
+many of the resources added are at them, so that taking one away only
+invalidates them when it was the last.
+*/
+
 static void work_queue_resource_add( struct work_queue_resource *total, struct work_queue_resource *r )
 {
 	total->inuse += r->inuse;
 	total->total += r->total;
-	total->smallest = MIN(total->smallest,r->smallest);
-	total->largest = MAX(total->largest,r->largest);
+
+	if(r->smallest < total->smallest) {
+		total->smallest = r->smallest;
+		total->smallest_count = 1;
+	} else if(r->smallest == total->smallest) {
+		total->smallest_count++;
+	}
+
+	if(r->largest > total->largest) {
+		total->largest = r->largest;
+		total->largest_count = 1;
+	} else if(r->largest == total->largest) {
+		total->largest_count++;
+	}
 }
 
 void work_queue_resources_add( struct work_queue_resources *total, struct work_queue_resources *r )
@@ -132,6 +150,39 @@ void work_queue_resources_add( struct work_queue_resources *total, struct work_q
 	work_queue_resource_add(&total->cores,   &r->cores);
 }
 
+/* Return 0 if r was the last at the smallest or largest of total, which may no longer hold. */
+static int work_queue_resource_subtract( struct work_queue_resource *total, struct work_queue_resource *r )
+{
+	int ok = 1;
+
+	total->inuse -= r->inuse;
+	total->total -= r->total;
+
+	/* A count of zero at zero is the starting value, which still holds. */
+	if(r->smallest == total->smallest && total->smallest_count > 0) {
+		if(--total->smallest_count == 0 && total->smallest != 0)
+			ok = 0;
+	}
+
+	if(r->largest == total->largest && total->largest_count > 0) {
+		if(--total->largest_count == 0 && total->largest != 0)
+			ok = 0;
+	}
+
+	return ok;
+}
+
+int work_queue_resources_subtract( struct work_queue_resources *total, struct work_queue_resources *r )
+{
+	int ok = 1;
+	ok &= work_queue_resource_subtract(&total->workers, &r->workers);
+	ok &= work_queue_resource_subtract(&total->memory,  &r->memory);
+	ok &= work_queue_resource_subtract(&total->disk,    &r->disk);
+	ok &= work_queue_resource_subtract(&total->gpus,    &r->gpus);
+	ok &= work_queue_resource_subtract(&total->cores,   &r->cores);
+	return ok;
+}
+
 void work_queue_resources_add_to_jx( struct work_queue_resources *r, struct jx *nv )
 {
 	jx_insert_integer(nv, "workers_inuse",   r->workers.inuse);
@@ -15,6 +15,8 @@ struct work_queue_resource {
 	int64_t total;
 	int64_t smallest;
 	int64_t largest;
+	int smallest_count;                // In a sum of resources, the number of those at the smallest value.
+	int largest_count;                 // In a sum of resources, the number of those at the largest value.
 };
 
 struct work_queue_resources {
@@ -34,6 +36,8 @@ void work_queue_resources_send( struct link *manager, struct work_queue_resource
 void work_queue_coprocess_resources_send( struct link *manager, struct work_queue_resources *r, time_t stoptime );
 void work_queue_resources_clear( struct work_queue_resources *r );
 void work_queue_resources_add( struct work_queue_resources *total, struct work_queue_resources *r );
+/* Undo work_queue_resources_add. Returns 0 if the last resource at the smallest or largest value of total was taken away, so that it has to be computed again. */
+int work_queue_resources_subtract( struct work_queue_resources *total, struct work_queue_resources *r );
 void work_queue_resources_add_to_jx( struct work_queue_resources *r, struct jx *j );
 
 #endif
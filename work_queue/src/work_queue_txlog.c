@@ -0,0 +1,738 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_txlog.h"
+
+#include "buffer.h"
+#include "debug.h"
+#include "hash_table.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+The log is a sequence of records, each a four byte tag, a four byte
+little endian length, and a payload of that length.  Every open of the
+log for writing starts with a HEADER record.  DATA records hold the
+transactions of a block, INDEX records list the data blocks written since
+the previous index, and a TRAILER at the end of a cleanly closed log
+gives the position of the last index.
+
+All numbers in a payload are unsigned varints, seven bits per byte with
+the high bit set on all bytes but the last.  Signed values are zigzag
+encoded.  A data block payload is:
+
+  pid nrecords first_time last_time ndict times_length counts_length
+  ndict x (length bytes)
+  times:  nrecords x zigzag(time - previous time)
+  counts: nrecords x number of words
+  words:  (zigzag(integer) << 1) | 1  or  (dictionary index << 1)
+
+The text of a transaction is split on single spaces, so that the text
+is recovered exactly.  The last_time of a block is the latest time in it,
+which is not that of its last transaction if the clock went backwards.  An index payload is:
+
+  previous_index+1 complete nentries nentries x (offset first_time last_time nrecords)
+
+where complete is zero if some blocks before this index are not reachable
+through the chain, for example because an earlier writer did not close the log.
+*/
+
+#define TXLOG_HEADER "WQTH"
+#define TXLOG_DATA "WQTB"
+#define TXLOG_INDEX "WQTI"
+#define TXLOG_TRAILER "WQTE"
+
+#define TXLOG_VERSION 1
+
+/* Integers of up to this many digits are stored as numbers. */
+#define TXLOG_MAX_DIGITS 18
+
+struct work_queue_txlog {
+	FILE *file;
+	int failed;
+
+	/* The block being gathered. */
+	int pid;
+	int records;
+	timestamp_t first_time;
+	timestamp_t last_time;
+	timestamp_t previous_time;
+	timestamp_t started;
+	struct hash_table *words;
+	int nwords;
+	buffer_t dictionary;
+	buffer_t times;
+	buffer_t counts;
+	buffer_t tokens;
+	buffer_t scratch;
+
+	/* The entries of the next index block. */
+	buffer_t index;
+	int index_entries;
+	uint64_t last_index;
+	int complete;
+};
+
+struct txlog_word {
+	const char *data;
+	size_t length;
+};
+
+struct work_queue_txlog_reader {
+	FILE *file;
+
+	char *block;
+	size_t block_alloc;
+	const unsigned char *end;
+
+	const unsigned char *times;
+	const unsigned char *counts;
+	const unsigned char *tokens;
+	struct txlog_word *dict;
+	int ndict;
+	int dict_alloc;
+
+	int remaining;
+	int pid;
+	timestamp_t time;
+	buffer_t text;
+};
+
+static void put_varint(buffer_t *b, uint64_t v)
+{
+	unsigned char bytes[10];
+	int n = 0;
+
+	while(v >= 0x80) {
+		bytes[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	bytes[n++] = v;
+
+	buffer_putlstring(b, (const char *) bytes, n);
+}
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+	uint64_t result = 0;
+	int shift = 0;
+
+	while(*p < end && shift < 64) {
+		unsigned char c = *(*p)++;
+		result |= ((uint64_t) (c & 0x7f)) << shift;
+		if(!(c & 0x80)) {
+			*v = result;
+			return 1;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+	return (uint64_t) get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+}
+
+/* Only the canonical form of an integer is stored as a number, so that it prints back the same. */
+static int is_integer(const char *s, size_t length, int64_t *value)
+{
+	const char *p = s;
+	const char *end = s + length;
+	int negative = 0;
+
+	if(p < end && *p == '-') {
+		negative = 1;
+		p++;
+	}
+
+	size_t digits = end - p;
+	if(digits < 1 || digits > TXLOG_MAX_DIGITS)
+		return 0;
+	if(*p == '0' && (digits > 1 || negative))
+		return 0;
+
+	int64_t v = 0;
+	for(; p < end; p++) {
+		if(*p < '0' || *p > '9')
+			return 0;
+		v = v * 10 + (*p - '0');
+	}
+
+	*value = negative ? -v : v;
+	return 1;
+}
+
+static int write_record(struct work_queue_txlog *l, const char *tag, buffer_t *payload, off_t *offset)
+{
+	size_t length;
+	const char *data = buffer_tolstring(payload, &length);
+	unsigned char header[8];
+
+	memcpy(header, tag, 4);
+	put_u32(header + 4, length);
+
+	if(fseeko(l->file, 0, SEEK_END) < 0)
+		goto failure;
+	if(offset)
+		*offset = ftello(l->file);
+	if(fwrite(header, sizeof(header), 1, l->file) != 1)
+		goto failure;
+	if(length > 0 && fwrite(data, length, 1, l->file) != 1)
+		goto failure;
+
+	return 1;
+
+failure:
+	if(!l->failed)
+		debug(D_NOTICE, "could not write to binary transactions log: %s", strerror(errno));
+	l->failed = 1;
+	return 0;
+}
+
+static void write_index(struct work_queue_txlog *l)
+{
+	buffer_t payload;
+	buffer_init(&payload);
+
+	put_varint(&payload, l->last_index);
+	put_varint(&payload, l->complete);
+	put_varint(&payload, l->index_entries);
+
+	size_t length;
+	const char *entries = buffer_tolstring(&l->index, &length);
+	buffer_putlstring(&payload, entries, length);
+
+	off_t offset;
+	if(write_record(l, TXLOG_INDEX, &payload, &offset))
+		l->last_index = offset + 1;
+
+	buffer_free(&payload);
+
+	buffer_rewind(&l->index, 0);
+	l->index_entries = 0;
+}
+
+static void flush_block(struct work_queue_txlog *l)
+{
+	if(l->records == 0)
+		return;
+
+	buffer_t payload;
+	buffer_init(&payload);
+
+	size_t dictionary_length, times_length, counts_length, tokens_length;
+	const char *dictionary = buffer_tolstring(&l->dictionary, &dictionary_length);
+	const char *times = buffer_tolstring(&l->times, &times_length);
+	const char *counts = buffer_tolstring(&l->counts, &counts_length);
+	const char *tokens = buffer_tolstring(&l->tokens, &tokens_length);
+
+	put_varint(&payload, l->pid);
+	put_varint(&payload, l->records);
+	put_varint(&payload, l->first_time);
+	put_varint(&payload, l->last_time);
+	put_varint(&payload, l->nwords);
+	put_varint(&payload, times_length);
+	put_varint(&payload, counts_length);
+	buffer_putlstring(&payload, dictionary, dictionary_length);
+	buffer_putlstring(&payload, times, times_length);
+	buffer_putlstring(&payload, counts, counts_length);
+	buffer_putlstring(&payload, tokens, tokens_length);
+
+	off_t offset;
+	if(write_record(l, TXLOG_DATA, &payload, &offset)) {
+		put_varint(&l->index, offset);
+		put_varint(&l->index, l->first_time);
+		put_varint(&l->index, l->last_time);
+		put_varint(&l->index, l->records);
+		l->index_entries++;
+	}
+
+	buffer_free(&payload);
+
+	if(l->index_entries >= WORK_QUEUE_TXLOG_INDEX_BLOCKS)
+		write_index(l);
+
+	fflush(l->file);
+
+	hash_table_clear(l->words, 0);
+	l->nwords = 0;
+	l->records = 0;
+	buffer_rewind(&l->dictionary, 0);
+	buffer_rewind(&l->times, 0);
+	buffer_rewind(&l->counts, 0);
+	buffer_rewind(&l->tokens, 0);
+}
+
+/*
+If the log was closed cleanly, continue its index chain, and inherit
+whether the chain is complete.  Otherwise, the blocks already in the log
+cannot be found through the index, and the chain starts incomplete.
+*/
+
+static void read_previous_index(struct work_queue_txlog *l)
+{
+	unsigned char trailer[16];
+
+	if(fseeko(l->file, 0, SEEK_END) < 0 || ftello(l->file) == 0)
+		return;
+
+	l->complete = 0;
+
+	if(fseeko(l->file, -(off_t) sizeof(trailer), SEEK_END) < 0)
+		return;
+	if(fread(trailer, sizeof(trailer), 1, l->file) != 1)
+		return;
+	if(memcmp(trailer, TXLOG_TRAILER, 4) || get_u32(trailer + 4) != 8)
+		return;
+
+	uint64_t offset = get_u64(trailer + 8);
+
+	unsigned char index[32];
+	if(fseeko(l->file, offset, SEEK_SET) < 0)
+		return;
+	size_t n = fread(index, 1, sizeof(index), l->file);
+	if(n < 8 || memcmp(index, TXLOG_INDEX, 4))
+		return;
+
+	const unsigned char *p = index + 8;
+	uint64_t previous, complete;
+	if(!get_varint(&p, index + n, &previous) || !get_varint(&p, index + n, &complete))
+		return;
+
+	l->last_index = offset + 1;
+	l->complete = complete;
+}
+
+struct work_queue_txlog *work_queue_txlog_open(const char *path)
+{
+	FILE *file = fopen(path, "a+");
+	if(!file)
+		return 0;
+
+	struct work_queue_txlog *l = xxcalloc(1, sizeof(*l));
+	l->file = file;
+	l->complete = 1;
+	l->words = hash_table_create(0, 0);
+
+	buffer_init(&l->dictionary);
+	buffer_init(&l->times);
+	buffer_init(&l->counts);
+	buffer_init(&l->tokens);
+	buffer_init(&l->scratch);
+	buffer_init(&l->index);
+
+	read_previous_index(l);
+
+	buffer_t payload;
+	buffer_init(&payload);
+	put_varint(&payload, TXLOG_VERSION);
+	write_record(l, TXLOG_HEADER, &payload, 0);
+	buffer_free(&payload);
+
+	fflush(l->file);
+
+	return l;
+}
+
+static void write_word(struct work_queue_txlog *l, const char *word, size_t length)
+{
+	int64_t value;
+
+	if(is_integer(word, length, &value)) {
+		put_varint(&l->tokens, (zigzag(value) << 1) | 1);
+		return;
+	}
+
+	buffer_rewind(&l->scratch, 0);
+	buffer_putlstring(&l->scratch, word, length);
+	const char *key = buffer_tostring(&l->scratch);
+
+	uintptr_t id = (uintptr_t) hash_table_lookup(l->words, key);
+	if(!id) {
+		id = ++l->nwords;
+		hash_table_insert(l->words, key, (void *) id);
+		put_varint(&l->dictionary, length);
+		buffer_putlstring(&l->dictionary, word, length);
+	}
+
+	put_varint(&l->tokens, (uint64_t) (id - 1) << 1);
+}
+
+void work_queue_txlog_write(struct work_queue_txlog *l, timestamp_t time, int pid, const char *text)
+{
+	if(l->records > 0 && (pid != l->pid || l->records >= WORK_QUEUE_TXLOG_BLOCK_RECORDS))
+		flush_block(l);
+
+	if(l->records == 0) {
+		l->pid = pid;
+		l->first_time = time;
+		l->last_time = time;
+		l->previous_time = time;
+		l->started = timestamp_get();
+	}
+
+	put_varint(&l->times, zigzag((int64_t) (time - l->previous_time)));
+	l->previous_time = time;
+	if(time > l->last_time)
+		l->last_time = time;
+
+	uint64_t count = 0;
+	const char *word = text;
+	while(1) {
+		const char *space = strchr(word, ' ');
+		size_t length = space ? (size_t) (space - word) : strlen(word);
+		write_word(l, word, length);
+		count++;
+		if(!space)
+			break;
+		word = space + 1;
+	}
+
+	put_varint(&l->counts, count);
+	l->records++;
+
+	work_queue_txlog_sync(l);
+}
+
+void work_queue_txlog_sync(struct work_queue_txlog *l)
+{
+	if(l->records > 0 && timestamp_get() - l->started >= WORK_QUEUE_TXLOG_BLOCK_AGE)
+		flush_block(l);
+}
+
+int work_queue_txlog_close(struct work_queue_txlog *l)
+{
+	flush_block(l);
+
+	if(l->index_entries > 0)
+		write_index(l);
+
+	if(l->last_index) {
+		buffer_t payload;
+		buffer_init(&payload);
+
+		unsigned char offset[8];
+		put_u32(offset, (l->last_index - 1) & 0xffffffff);
+		put_u32(offset + 4, (l->last_index - 1) >> 32);
+		buffer_putlstring(&payload, (const char *) offset, sizeof(offset));
+
+		write_record(l, TXLOG_TRAILER, &payload, 0);
+		buffer_free(&payload);
+	}
+
+	int failed = l->failed;
+	if(fclose(l->file) != 0)
+		failed = 1;
+
+	hash_table_delete(l->words);
+	buffer_free(&l->dictionary);
+	buffer_free(&l->times);
+	buffer_free(&l->counts);
+	buffer_free(&l->tokens);
+	buffer_free(&l->scratch);
+	buffer_free(&l->index);
+	free(l);
+
+	return failed ? -1 : 0;
+}
+
+struct work_queue_txlog_reader *work_queue_txlog_reader_open(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if(!file)
+		return 0;
+
+	unsigned char header[8];
+	if(fread(header, sizeof(header), 1, file) != 1 || memcmp(header, TXLOG_HEADER, 4)) {
+		fclose(file);
+		errno = EINVAL;
+		return 0;
+	}
+	rewind(file);
+
+	struct work_queue_txlog_reader *r = xxcalloc(1, sizeof(*r));
+	r->file = file;
+	buffer_init(&r->text);
+
+	return r;
+}
+
+/* Read the next record into the block buffer. */
+static int read_record(struct work_queue_txlog_reader *r, char *tag, size_t *length)
+{
+	unsigned char header[8];
+
+	size_t n = fread(header, 1, sizeof(header), r->file);
+	if(n == 0)
+		return 0;
+	if(n != sizeof(header))
+		return -1;
+
+	memcpy(tag, header, 4);
+	*length = get_u32(header + 4);
+
+	if(*length > r->block_alloc) {
+		r->block = xxrealloc(r->block, *length);
+		r->block_alloc = *length;
+	}
+
+	if(*length > 0 && fread(r->block, *length, 1, r->file) != 1)
+		return -1;
+
+	return 1;
+}
+
+static int load_block(struct work_queue_txlog_reader *r, size_t length)
+{
+	const unsigned char *p = (const unsigned char *) r->block;
+	const unsigned char *end = p + length;
+	uint64_t pid, records, first_time, last_time, ndict, times_length, counts_length;
+
+	if(!get_varint(&p, end, &pid) || !get_varint(&p, end, &records) || !get_varint(&p, end, &first_time) || !get_varint(&p, end, &last_time) || !get_varint(&p, end, &ndict) || !get_varint(&p, end, &times_length) || !get_varint(&p, end, &counts_length))
+		return 0;
+
+	if(ndict > length)
+		return 0;
+
+	if((int) ndict > r->dict_alloc) {
+		r->dict = xxrealloc(r->dict, ndict * sizeof(*r->dict));
+		r->dict_alloc = ndict;
+	}
+
+	uint64_t i;
+	for(i = 0; i < ndict; i++) {
+		uint64_t word_length;
+		if(!get_varint(&p, end, &word_length) || word_length > (uint64_t) (end - p))
+			return 0;
+		r->dict[i].data = (const char *) p;
+		r->dict[i].length = word_length;
+		p += word_length;
+	}
+
+	if(times_length > (uint64_t) (end - p) || counts_length > (uint64_t) (end - p - times_length))
+		return 0;
+
+	r->ndict = ndict;
+	r->times = p;
+	r->counts = p + times_length;
+	r->tokens = p + times_length + counts_length;
+	r->end = end;
+	r->remaining = records;
+	r->pid = pid;
+	r->time = first_time;
+
+	return 1;
+}
+
+int work_queue_txlog_reader_next(struct work_queue_txlog_reader *r, timestamp_t *time, int *pid, const char **text)
+{
+	while(r->remaining == 0) {
+		char tag[4];
+		size_t length;
+
+		int result = read_record(r, tag, &length);
+		if(result <= 0)
+			return result;
+
+		if(!memcmp(tag, TXLOG_DATA, 4) && !load_block(r, length))
+			return -1;
+	}
+
+	uint64_t delta, count;
+	if(!get_varint(&r->times, r->counts, &delta) || !get_varint(&r->counts, r->tokens, &count))
+		return -1;
+
+	r->time += unzigzag(delta);
+
+	buffer_rewind(&r->text, 0);
+
+	uint64_t i;
+	for(i = 0; i < count; i++) {
+		uint64_t token;
+		if(!get_varint(&r->tokens, r->end, &token))
+			return -1;
+
+		if(i > 0)
+			buffer_putlstring(&r->text, " ", 1);
+
+		if(token & 1) {
+			buffer_printf(&r->text, "%" PRId64, unzigzag(token >> 1));
+		} else {
+			uint64_t id = token >> 1;
+			if(id >= (uint64_t) r->ndict)
+				return -1;
+			buffer_putlstring(&r->text, r->dict[id].data, r->dict[id].length);
+		}
+	}
+
+	r->remaining--;
+
+	*time = r->time;
+	*pid = r->pid;
+	*text = buffer_tostring(&r->text);
+
+	return 1;
+}
+
+/* Read only the first bytes of the record at the current position, and leave the file after the record. */
+static int peek_record(struct work_queue_txlog_reader *r, char *tag, unsigned char *prefix, size_t *prefix_length)
+{
+	unsigned char header[8];
+
+	if(fread(header, sizeof(header), 1, r->file) != 1)
+		return 0;
+
+	memcpy(tag, header, 4);
+	size_t length = get_u32(header + 4);
+
+	size_t n = length < *prefix_length ? length : *prefix_length;
+	if(n > 0 && fread(prefix, n, 1, r->file) != 1)
+		return 0;
+	*prefix_length = n;
+
+	if(fseeko(r->file, length - n, SEEK_CUR) < 0)
+		return 0;
+
+	return 1;
+}
+
+static int seek_by_scan(struct work_queue_txlog_reader *r, timestamp_t time)
+{
+	if(fseeko(r->file, 0, SEEK_SET) < 0)
+		return 0;
+
+	while(1) {
+		off_t offset = ftello(r->file);
+		char tag[4];
+		unsigned char prefix[64];
+		size_t n = sizeof(prefix);
+
+		if(!peek_record(r, tag, prefix, &n))
+			return 1;
+
+		if(memcmp(tag, TXLOG_DATA, 4))
+			continue;
+
+		const unsigned char *p = prefix;
+		uint64_t pid, records, first_time, last_time;
+		if(!get_varint(&p, prefix + n, &pid) || !get_varint(&p, prefix + n, &records) || !get_varint(&p, prefix + n, &first_time) || !get_varint(&p, prefix + n, &last_time))
+			return 0;
+
+		if(last_time >= time)
+			return fseeko(r->file, offset, SEEK_SET) == 0;
+	}
+}
+
+static int seek_by_index(struct work_queue_txlog_reader *r, timestamp_t time)
+{
+	unsigned char trailer[16];
+
+	if(fseeko(r->file, -(off_t) sizeof(trailer), SEEK_END) < 0)
+		return 0;
+	if(fread(trailer, sizeof(trailer), 1, r->file) != 1)
+		return 0;
+	if(memcmp(trailer, TXLOG_TRAILER, 4) || get_u32(trailer + 4) != 8)
+		return 0;
+
+	off_t end = ftello(r->file);
+	uint64_t index = get_u64(trailer + 8) + 1;
+	uint64_t target = 0;
+	int newest = 1;
+
+	/* Walk back from the newest index until one has no block that reaches the time. */
+	while(index) {
+		char tag[4];
+		size_t length;
+
+		if(fseeko(r->file, index - 1, SEEK_SET) < 0 || read_record(r, tag, &length) <= 0 || memcmp(tag, TXLOG_INDEX, 4))
+			return 0;
+
+		const unsigned char *p = (const unsigned char *) r->block;
+		const unsigned char *block_end = p + length;
+		uint64_t previous, complete, entries;
+		if(!get_varint(&p, block_end, &previous) || !get_varint(&p, block_end, &complete) || !get_varint(&p, block_end, &entries))
+			return 0;
+
+		if(newest && !complete)
+			return 0;
+		newest = 0;
+
+		int reaches = 0;
+		uint64_t i;
+		for(i = 0; i < entries; i++) {
+			uint64_t offset, first_time, last_time, records;
+			if(!get_varint(&p, block_end, &offset) || !get_varint(&p, block_end, &first_time) || !get_varint(&p, block_end, &last_time) || !get_varint(&p, block_end, &records))
+				return 0;
+			if(last_time >= time) {
+				if(!reaches)
+					target = offset + 1;
+				reaches = 1;
+			}
+		}
+
+		if(!reaches)
+			break;
+
+		index = previous;
+	}
+
+	if(fseeko(r->file, target ? (off_t) (target - 1) : end, SEEK_SET) < 0)
+		return 0;
+
+	return 1;
+}
+
+int work_queue_txlog_reader_seek(struct work_queue_txlog_reader *r, timestamp_t time)
+{
+	r->remaining = 0;
+
+	if(seek_by_index(r, time))
+		return 1;
+
+	return seek_by_scan(r, time);
+}
+
+void work_queue_txlog_reader_close(struct work_queue_txlog_reader *r)
+{
+	fclose(r->file);
+	buffer_free(&r->text);
+	free(r->block);
+	free(r->dict);
+	free(r);
+}
+
+/* vim: set noexpandtab tabstop=4: */
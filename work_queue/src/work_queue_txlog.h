@@ -0,0 +1,99 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_TXLOG_H
+#define WORK_QUEUE_TXLOG_H
+
+/** @file work_queue_txlog.h
+A compact binary form of the Work Queue transactions log.
+
+Each transaction has the same content as a line of the text log:
+a time, the pid of the manager, and the text of the transaction.
+Transactions are gathered into blocks, and each block is stored by columns:
+the times as deltas, then the number of words of each transaction, then
+the words themselves, where integers are stored as numbers and every other
+word, such as a host or category name, is an index into a dictionary kept
+with the block.  Each block can be decoded on its own.
+
+Periodic index blocks list the time range and position of the data blocks,
+and are chained together, so that a reader can find the transactions of a given
+time without decoding the whole log.  The text form of any binary log can
+be recovered with work_queue_txlog_dump, so that existing scripts that read
+the text log can read a binary log through it.
+*/
+
+#include "timestamp.h"
+
+#include <stdio.h>
+
+/** Maximum number of transactions in a data block. */
+#define WORK_QUEUE_TXLOG_BLOCK_RECORDS 4096
+
+/** Data blocks are written when they become older than this, in usecs. */
+#define WORK_QUEUE_TXLOG_BLOCK_AGE 1000000
+
+/** An index block is written after this many data blocks. */
+#define WORK_QUEUE_TXLOG_INDEX_BLOCKS 64
+
+struct work_queue_txlog;
+struct work_queue_txlog_reader;
+
+/** Open a binary transactions log to append to.
+@param path The name of the log file.
+@return A log to write, or null with errno set on failure.
+*/
+struct work_queue_txlog *work_queue_txlog_open(const char *path);
+
+/** Add a transaction to the log.
+@param l The log.
+@param time The time of the transaction.
+@param pid The pid of the manager.
+@param text The text of the transaction, as in the text log.
+*/
+void work_queue_txlog_write(struct work_queue_txlog *l, timestamp_t time, int pid, const char *text);
+
+/** Write the pending transactions if they have waited longer than @ref WORK_QUEUE_TXLOG_BLOCK_AGE.
+@param l The log.
+*/
+void work_queue_txlog_sync(struct work_queue_txlog *l);
+
+/** Write all pending transactions and the final index, and close the log.
+@param l The log.
+@return 0 on success, -1 if the log could not be written.
+*/
+int work_queue_txlog_close(struct work_queue_txlog *l);
+
+/** Open a binary transactions log to read.
+@param path The name of the log file.
+@return A reader, or null with errno set on failure.
+*/
+struct work_queue_txlog_reader *work_queue_txlog_reader_open(const char *path);
+
+/** Read the next transaction.
+The text is valid until the next call on the reader.
+@param r The reader.
+@param time Set to the time of the transaction.
+@param pid Set to the pid of the manager.
+@param text Set to the text of the transaction.
+@return 1 if a transaction was read, 0 at the end of the log, -1 if the log is corrupt.
+*/
+int work_queue_txlog_reader_next(struct work_queue_txlog_reader *r, timestamp_t *time, int *pid, const char **text);
+
+/** Move the reader to the first block that may contain transactions at or after a given time.
+The index blocks are used when the log has a complete index, otherwise
+the block headers are scanned from the start.
+@param r The reader.
+@param time The earliest time of interest.
+@return 1 on success, 0 on failure.
+*/
+int work_queue_txlog_reader_seek(struct work_queue_txlog_reader *r, timestamp_t time);
+
+/** Close a reader.
+@param r The reader.
+*/
+void work_queue_txlog_reader_close(struct work_queue_txlog_reader *r);
+
+#endif
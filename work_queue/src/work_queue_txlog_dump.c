@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+/*
+Print a binary transactions log in the form of the text transactions log,
+so that scripts that read the text log can read a binary log from a pipe.
+*/
+
+#include "work_queue_txlog.h"
+
+#include "cctools.h"
+#include "getopt.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void show_help(const char *progname)
+{
+	fprintf(stdout, "usage: %s [options] <logfile>\n", progname);
+	fprintf(stdout, "Print a binary Work Queue transactions log as text.\n");
+	fprintf(stdout, "Options:\n");
+	fprintf(stdout, " %-30s Only print transactions at or after this time, in usecs.\n", "-s,--start=<time>");
+	fprintf(stdout, " %-30s Only print transactions before this time, in usecs.\n", "-e,--end=<time>");
+	fprintf(stdout, " %-30s Show version string.\n", "-v,--version");
+	fprintf(stdout, " %-30s This message.\n", "-h,--help");
+}
+
+int main(int argc, char *argv[])
+{
+	timestamp_t start = 0;
+	timestamp_t end = 0;
+
+	static const struct option long_options[] = {
+		{"start", required_argument, 0, 's'},
+		{"end", required_argument, 0, 'e'},
+		{"version", no_argument, 0, 'v'},
+		{"help", no_argument, 0, 'h'},
+		{0,0,0,0}};
+
+	signed int c;
+	while((c = getopt_long(argc, argv, "s:e:vh", long_options, NULL)) > -1) {
+		switch (c) {
+		case 's':
+			start = strtoull(optarg, 0, 10);
+			break;
+		case 'e':
+			end = strtoull(optarg, 0, 10);
+			break;
+		case 'v':
+			cctools_version_print(stdout, argv[0]);
+			return 0;
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		default:
+			show_help(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc - 1) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	const char *logfile = argv[optind];
+
+	struct work_queue_txlog_reader *r = work_queue_txlog_reader_open(logfile);
+	if(!r) {
+		fprintf(stderr, "%s: couldn't open %s: %s\n", argv[0], logfile, strerror(errno));
+		return 1;
+	}
+
+	if(start > 0 && !work_queue_txlog_reader_seek(r, start)) {
+		fprintf(stderr, "%s: couldn't seek in %s\n", argv[0], logfile);
+		work_queue_txlog_reader_close(r);
+		return 1;
+	}
+
+	timestamp_t time;
+	int pid;
+	const char *text;
+	int result;
+
+	while((result = work_queue_txlog_reader_next(r, &time, &pid, &text)) > 0) {
+		if(time < start)
+			continue;
+		if(end > 0 && time >= end)
+			break;
+		fprintf(stdout, "%" PRIu64 " %d %s\n", time, pid, text);
+	}
+
+	work_queue_txlog_reader_close(r);
+
+	if(result < 0) {
+		fprintf(stderr, "%s: %s is corrupt\n", argv[0], logfile);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
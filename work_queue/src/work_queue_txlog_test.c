@@ -0,0 +1,121 @@
+/*
+Copyright (C) 2022 The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_txlog.h"
+
+#include "stringtools.h"
+#include "test_fail.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORDS 20000
+
+static char *transaction(int i)
+{
+	switch(i % 6) {
+	case 0:
+		return string_format("TASK %d WAITING default FIRST_RESOURCES {\"cores\":[1,\"cores\"],\"memory\":[%d,\"MB\"]}", i, i % 1000);
+	case 1:
+		return string_format("TASK %d RUNNING 10.0.0.%d:9123  FIRST_RESOURCES {\"cores\":[1,\"cores\"]}", i, i % 250);
+	case 2:
+		return string_format("TRANSFER INPUT %d 1 %f %f input-%d.txt", i, i / 7.0, i / 11.0, i);
+	case 3:
+		return string_format("TASK %d DONE SUCCESS  0  {} {} -%d 007 -0 %d123456789012345678", i, i, i);
+	case 4:
+		return string_format("WORKER worker-%d 10.0.0.%d:51234 CONNECTION", i % 40, i % 40);
+	default:
+		return string_format(" MANAGER  %s", i % 12 ? "START" : "END ");
+	}
+}
+
+static timestamp_t transaction_time(int i)
+{
+	/* Times go backwards now and then, as the clock may. */
+	return 1700000000000000ULL + (timestamp_t) i * 1000 - (i % 97 == 0 ? 5000 : 0);
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "work_queue_txlog_test.XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+		FAIL("could not create a temporary file");
+	close(fd);
+	unlink(path);
+
+	/* Write the log in two sessions, as if the manager was restarted. */
+	int i;
+	int session;
+	for(session = 0; session < 2; session++) {
+		struct work_queue_txlog *l = work_queue_txlog_open(path);
+		if(!l)
+			FAIL("could not open the log");
+		for(i = session * RECORDS / 2; i < (session + 1) * RECORDS / 2; i++) {
+			char *text = transaction(i);
+			work_queue_txlog_write(l, transaction_time(i), 100 + session, text);
+			free(text);
+		}
+		if(work_queue_txlog_close(l) != 0)
+			FAIL("could not close the log");
+	}
+
+	/* Every transaction reads back exactly. */
+	struct work_queue_txlog_reader *r = work_queue_txlog_reader_open(path);
+	if(!r)
+		FAIL("could not open the log to read");
+
+	timestamp_t time;
+	int pid;
+	const char *text;
+	for(i = 0; i < RECORDS; i++) {
+		if(work_queue_txlog_reader_next(r, &time, &pid, &text) != 1)
+			FAIL("log ended at transaction %d", i);
+		char *expected = transaction(i);
+		if(strcmp(text, expected) || time != transaction_time(i) || pid != 100 + i / (RECORDS / 2))
+			FAIL("transaction %d read as '%s' instead of '%s'", i, text, expected);
+		free(expected);
+	}
+	if(work_queue_txlog_reader_next(r, &time, &pid, &text) != 0)
+		FAIL("log did not end after the last transaction");
+
+	/* Seeking lands on a block at or before the first transaction at the time. */
+	int targets[] = {0, 1, 4095, 4096, 9999, 10000, 15000, RECORDS - 1};
+	int t;
+	for(t = 0; t < (int) (sizeof(targets) / sizeof(targets[0])); t++) {
+		timestamp_t target = transaction_time(targets[t]) + 1;
+		if(!work_queue_txlog_reader_seek(r, target))
+			FAIL("could not seek to transaction %d", targets[t]);
+		int found = 0;
+		int skipped = 0;
+		while(work_queue_txlog_reader_next(r, &time, &pid, &text) == 1) {
+			if(time >= target) {
+				found = 1;
+				break;
+			}
+			skipped++;
+		}
+		if(!found && targets[t] != RECORDS - 1)
+			FAIL("seek to transaction %d passed it", targets[t]);
+		if(skipped > WORK_QUEUE_TXLOG_BLOCK_RECORDS)
+			FAIL("seek to transaction %d did not use the blocks", targets[t]);
+	}
+
+	if(!work_queue_txlog_reader_seek(r, transaction_time(RECORDS) + 1000000))
+		FAIL("could not seek past the end");
+	if(work_queue_txlog_reader_next(r, &time, &pid, &text) != 0)
+		FAIL("seek past the end found a transaction");
+
+	work_queue_txlog_reader_close(r);
+	unlink(path);
+
+	fprintf(stdout, "work queue transactions log is correct\n");
+	return 0;
+}
+
+/* vim: set noexpandtab tabstop=4: */
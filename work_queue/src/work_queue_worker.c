@@ -243,6 +243,16 @@ static char *factory_name = NULL;
 
 struct work_queue_cache *global_cache = 0;
 
+// Limits on the url transfers and commands run at once to fill the cache.
+static int max_fetches = WORK_QUEUE_CACHE_MAX_FETCHES;
+static int max_fetches_per_source = WORK_QUEUE_CACHE_MAX_FETCHES_PER_SOURCE;
+
+// Size of the cache in MB beyond which files are evicted, if not zero.
+static int64_t cache_limit = 0;
+
+// If set, the cache is kept in this directory from one run of the worker to the next.
+static char *persistent_cache_dir = 0;
+
 extern int wq_hack_do_not_compute_cached_name;
 
 __attribute__ (( format(printf,2,3) ))
@@ -429,37 +439,58 @@ static void send_resource_update(struct link *manager)
 Send a message to the manager with my current statistics information.
 */
 
+/*
+The stats a foreman last sent to its manager. Only the stats that changed
+are sent again, so that a large foreman does not send its whole set of
+stats with each keepalive.
+*/
+
+static struct work_queue_stats stats_last_sent;
+static int stats_last_sent_valid = 0;
+
+#define send_stat_update(manager, s, field) \
+	do { \
+		if(!stats_last_sent_valid || (s).field != stats_last_sent.field) { \
+			send_manager_message(manager, "info " #field " %lld\n", (long long) (s).field); \
+		} \
+	} while(0)
+
 static void send_stats_update(struct link *manager)
 {
 	if(worker_mode == WORKER_MODE_FOREMAN) {
 		struct work_queue_stats s;
 		work_queue_get_stats_hierarchy(foreman_q, &s);
 
-		send_manager_message(manager, "info workers_joined %lld\n", (long long) s.workers_joined);
-		send_manager_message(manager, "info workers_removed %lld\n", (long long) s.workers_removed);
-		send_manager_message(manager, "info workers_released %lld\n", (long long) s.workers_released);
-		send_manager_message(manager, "info workers_idled_out %lld\n", (long long) s.workers_idled_out);
-		send_manager_message(manager, "info workers_fast_aborted %lld\n", (long long) s.workers_fast_aborted);
-		send_manager_message(manager, "info workers_blacklisted %lld\n", (long long) s.workers_blacklisted);
-		send_manager_message(manager, "info workers_lost %lld\n", (long long) s.workers_lost);
+		/* the tasks waiting are those at the foreman itself. */
+		s.tasks_waiting = list_size(procs_waiting);
+
+		send_stat_update(manager, s, workers_joined);
+		send_stat_update(manager, s, workers_removed);
+		send_stat_update(manager, s, workers_released);
+		send_stat_update(manager, s, workers_idled_out);
+		send_stat_update(manager, s, workers_fast_aborted);
+		send_stat_update(manager, s, workers_blacklisted);
+		send_stat_update(manager, s, workers_lost);
 
-		send_manager_message(manager, "info tasks_waiting %lld\n", (long long) s.tasks_waiting);
-		send_manager_message(manager, "info tasks_on_workers %lld\n", (long long) s.tasks_on_workers);
-		send_manager_message(manager, "info tasks_running %lld\n", (long long) s.tasks_running);
-		send_manager_message(manager, "info tasks_waiting %lld\n", (long long) list_size(procs_waiting));
-		send_manager_message(manager, "info tasks_with_results %lld\n", (long long) s.tasks_with_results);
+		send_stat_update(manager, s, tasks_waiting);
+		send_stat_update(manager, s, tasks_on_workers);
+		send_stat_update(manager, s, tasks_running);
+		send_stat_update(manager, s, tasks_with_results);
 
-		send_manager_message(manager, "info time_send %lld\n", (long long) s.time_send);
-		send_manager_message(manager, "info time_receive %lld\n", (long long) s.time_receive);
-		send_manager_message(manager, "info time_send_good %lld\n", (long long) s.time_send_good);
-		send_manager_message(manager, "info time_receive_good %lld\n", (long long) s.time_receive_good);
+		send_stat_update(manager, s, time_send);
+		send_stat_update(manager, s, time_receive);
+		send_stat_update(manager, s, time_send_good);
+		send_stat_update(manager, s, time_receive_good);
 
-		send_manager_message(manager, "info time_workers_execute %lld\n", (long long) s.time_workers_execute);
-		send_manager_message(manager, "info time_workers_execute_good %lld\n", (long long) s.time_workers_execute_good);
-		send_manager_message(manager, "info time_workers_execute_exhaustion %lld\n", (long long) s.time_workers_execute_exhaustion);
+		send_stat_update(manager, s, time_workers_execute);
+		send_stat_update(manager, s, time_workers_execute_good);
+		send_stat_update(manager, s, time_workers_execute_exhaustion);
 
-		send_manager_message(manager, "info bytes_sent %lld\n", (long long) s.bytes_sent);
-		send_manager_message(manager, "info bytes_received %lld\n", (long long) s.bytes_received);
+		send_stat_update(manager, s, bytes_sent);
+		send_stat_update(manager, s, bytes_received);
+
+		stats_last_sent = s;
+		stats_last_sent_valid = 1;
 	}
 	else {
 		send_manager_message(manager, "info tasks_running %lld\n", (long long) itable_size(procs_running));
@@ -571,6 +602,8 @@ static void report_worker_ready( struct link *manager )
 	send_manager_message(manager, "info worker-id %s\n", worker_id);
 	send_features(manager);
 	send_tlq_config(manager);
+	/* a new manager has to get all the stats. */
+	stats_last_sent_valid = 0;
 	send_keepalive(manager, 1);
 	send_manager_message(manager, "info worker-end-time %" PRId64 "\n", (int64_t) DIV_INT_ROUND_UP(end_time, USECOND));
 	if (factory_name)
@@ -597,13 +630,16 @@ static int start_process( struct work_queue_process *p, struct link *manager )
 		return 0;
 	}
 	
-	cores_allocated += t->resources_requested->cores;
-	memory_allocated += t->resources_requested->memory;
-	disk_allocated += t->resources_requested->disk;
-	gpus_allocated += t->resources_requested->gpus;
+	/* a function call runs within the resources of its coprocess instance. */
+	if(!t->coprocess) {
+		cores_allocated += t->resources_requested->cores;
+		memory_allocated += t->resources_requested->memory;
+		disk_allocated += t->resources_requested->disk;
+		gpus_allocated += t->resources_requested->gpus;
 
-	if(t->resources_requested->gpus>0) {
-		work_queue_gpus_allocate(t->resources_requested->gpus,t->taskid);
+		if(t->resources_requested->gpus>0) {
+			work_queue_gpus_allocate(t->resources_requested->gpus,t->taskid);
+		}
 	}
 
 	pid = work_queue_process_execute(p);
@@ -624,12 +660,14 @@ static void reap_process( struct work_queue_process *p )
 {
 	p->execution_end = timestamp_get();
 
-	cores_allocated  -= p->task->resources_requested->cores;
-	memory_allocated -= p->task->resources_requested->memory;
-	disk_allocated   -= p->task->resources_requested->disk;
-	gpus_allocated   -= p->task->resources_requested->gpus;
+	if(!p->task->coprocess) {
+		cores_allocated  -= p->task->resources_requested->cores;
+		memory_allocated -= p->task->resources_requested->memory;
+		disk_allocated   -= p->task->resources_requested->disk;
+		gpus_allocated   -= p->task->resources_requested->gpus;
 
-	work_queue_gpus_free(p->task->taskid);
+		work_queue_gpus_free(p->task->taskid);
+	}
 
 	if(!work_queue_sandbox_stageout(p,global_cache)) {
 		p->task_status = WORK_QUEUE_RESULT_OUTPUT_MISSING;
@@ -782,7 +820,9 @@ static int handle_completed_tasks(struct link *manager)
 			
 			if (p->coprocess != NULL) {
 				struct work_queue_coprocess *cop= (struct work_queue_coprocess *) p->coprocess;
-				cop->state = WORK_QUEUE_COPROCESS_READY;
+				if (cop->state == WORK_QUEUE_COPROCESS_RUNNING) {
+					cop->state = WORK_QUEUE_COPROCESS_READY;
+				}
 			}
 			
 			/* collect the resources associated with the process */
@@ -915,6 +955,54 @@ static void normalize_resources( struct work_queue_process *p )
 	}
 }
 
+/*
+Add a file to a task under the name that it has in the cache.
+A foreman passes the task on to its own workers, so the file must be
+found at its path in the cache of the foreman, and is given the same
+cached name on the workers below.  In this way, an input crosses the
+link from the manager once for each foreman, and is then sent from the
+cache of the foreman to each of its workers, which cache it in turn.
+*/
+
+static void task_specify_cached_file( struct work_queue_task *task, const char *cachename, const char *taskname, work_queue_file_type_t type, int flags )
+{
+	wq_hack_do_not_compute_cached_name = 1;
+	int result = work_queue_task_specify_file(task, cachename, taskname, type, flags);
+
+	if(result && worker_mode==WORKER_MODE_FOREMAN) {
+		struct list *files = type==WORK_QUEUE_INPUT ? task->input_files : task->output_files;
+		struct work_queue_file *f = list_peek_tail(files);
+		if(f) {
+			free(f->payload);
+			f->payload = work_queue_cache_full_path(global_cache, cachename);
+			f->length = strlen(f->payload);
+		}
+	}
+}
+
+/*
+Hold or release the cached files of a task, so that those in use
+by a task known to the worker are not evicted from the cache.
+*/
+
+static void task_hold_cached_files( struct work_queue_task *task, int hold )
+{
+	struct list *lists[] = { task->input_files, task->output_files };
+	struct work_queue_file *f;
+	int i;
+
+	for(i=0;i<2;i++) {
+		if(!lists[i]) continue;
+		LIST_ITERATE(lists[i],f) {
+			if(hold) {
+				work_queue_cache_hold(global_cache,f->cached_name);
+			} else {
+				work_queue_cache_release(global_cache,f->cached_name);
+			}
+		}
+	}
+}
+
 /*
 Handle an incoming task message from the manager.
 Generate a work_queue_process wrapped around a work_queue_task,
@@ -958,12 +1046,10 @@ static int do_task( struct link *manager, int taskid, time_t stoptime )
 			free(cmd);
 		} else if(sscanf(line,"infile %s %s %d", localname, taskname_encoded, &flags)) {
 			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
-			wq_hack_do_not_compute_cached_name = 1;
-			work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_INPUT, flags );
+			task_specify_cached_file(task, localname, taskname, WORK_QUEUE_INPUT, flags);
 		} else if(sscanf(line,"outfile %s %s %d", localname, taskname_encoded, &flags)) {
 			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
-			wq_hack_do_not_compute_cached_name = 1;
-			work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_OUTPUT, flags );
+			task_specify_cached_file(task, localname, taskname, WORK_QUEUE_OUTPUT, flags);
 		} else if(sscanf(line, "dir %s", filename)) {
 			work_queue_task_specify_directory(task, filename, filename, WORK_QUEUE_INPUT, 0700, 0);
 		} else if(sscanf(line,"cores %" PRId64,&n)) {
@@ -1000,6 +1086,8 @@ static int do_task( struct link *manager, int taskid, time_t stoptime )
 	struct work_queue_process *p = work_queue_process_create(task, disk_allocation);
 	if(!p) return 0;
 
+	task_hold_cached_files(task, 1);
+
 	// Every received task goes into procs_table.
 	itable_insert(procs_table,taskid,p);
 
@@ -1247,11 +1335,13 @@ static int do_unlink(const char *path)
   
 	int result = 0;
 	
-	if(path_within_dir(cached_path, workspace)) {
+	const char *cache_root = persistent_cache_dir ? persistent_cache_dir : workspace;
+
+	if(path_within_dir(cached_path, cache_root)) {
 		work_queue_cache_remove(global_cache,path);
 		result = 1;
 	} else {
-		debug(D_WQ, "%s is not within workspace %s",cached_path,workspace);
+		debug(D_WQ, "%s is not within %s",cached_path,cache_root);
 		result = 0;
 	}
 
@@ -1289,11 +1379,13 @@ static int do_kill(int taskid)
 	} else {
 		if(itable_remove(procs_running, p->pid)) {
 			work_queue_process_kill(p);
-			cores_allocated -= p->task->resources_requested->cores;
-			memory_allocated -= p->task->resources_requested->memory;
-			disk_allocated -= p->task->resources_requested->disk;
-			gpus_allocated -= p->task->resources_requested->gpus;
-			work_queue_gpus_free(taskid);
+			if(!p->task->coprocess) {
+				cores_allocated -= p->task->resources_requested->cores;
+				memory_allocated -= p->task->resources_requested->memory;
+				disk_allocated -= p->task->resources_requested->disk;
+				gpus_allocated -= p->task->resources_requested->gpus;
+				work_queue_gpus_free(taskid);
+			}
 		}
 	}
 
@@ -1302,6 +1394,8 @@ static int do_kill(int taskid)
 
 	work_queue_watcher_remove_process(watcher,p);
 
+	task_hold_cached_files(p->task, 0);
+
 	work_queue_process_delete(p);
 
 	return 1;
@@ -1737,6 +1831,8 @@ static void work_for_manager(struct link *manager)
 			ok &= handle_manager(manager);
 		}
 
+		work_queue_cache_check(global_cache, manager);
+
 		expire_procs_running();
 
 		ok &= handle_completed_tasks(manager);
@@ -1763,6 +1859,11 @@ static void work_for_manager(struct link *manager)
 			break;
 		}
 
+		/* start again the coprocess instances that have exited. */
+		if(coprocess_info) {
+			work_queue_coprocess_update_state(coprocess_info, number_of_coprocess_instances);
+		}
+
 		int task_event = 0;
 		if(ok) {
 			struct work_queue_process *p;
@@ -1772,16 +1873,21 @@ static void work_for_manager(struct link *manager)
 				p = list_pop_head(procs_waiting);
 				if(!p) {
 					break;
-				} else if(task_resources_fit_now(p->task)) {
-					if (p->task->coprocess) {
-						struct work_queue_coprocess *ready_coprocess = work_queue_coprocess_find_state(coprocess_info, number_of_coprocess_instances, WORK_QUEUE_COPROCESS_READY);
-						if (ready_coprocess == NULL) {
-							list_push_tail(procs_waiting, p);
-							continue;
-						}
-						p->coprocess = ready_coprocess;
-						ready_coprocess->state = WORK_QUEUE_COPROCESS_RUNNING;
+				} else if(p->task->coprocess && !coprocess_info) {
+					forsake_waiting_process(manager, p);
+					task_event++;
+				} else if(p->task->coprocess) {
+					/* function calls are dispatched to any idle instance of the coprocess pool. */
+					struct work_queue_coprocess *ready_coprocess = work_queue_coprocess_find_state(coprocess_info, number_of_coprocess_instances, WORK_QUEUE_COPROCESS_READY);
+					if (ready_coprocess == NULL) {
+						list_push_tail(procs_waiting, p);
+						continue;
 					}
+					p->coprocess = ready_coprocess;
+					ready_coprocess->state = WORK_QUEUE_COPROCESS_RUNNING;
+					start_process(p,manager);
+					task_event++;
+				} else if(task_resources_fit_now(p->task)) {
 					start_process(p,manager);
 					task_event++;
 				} else if(task_resources_fit_eventually(p->task)) {
@@ -1949,9 +2055,14 @@ static int workspace_prepare()
 {
 	debug(D_WQ,"preparing workspace %s",workspace);
 
-	char *cachedir = string_format("%s/cache",workspace);
+	char *cachedir = persistent_cache_dir ? xxstrdup(persistent_cache_dir) : string_format("%s/cache",workspace);
 	int result = create_dir(cachedir,0777);
 	global_cache = work_queue_cache_create(cachedir);
+	work_queue_cache_set_fetch_limits(global_cache, max_fetches, max_fetches_per_source);
+	work_queue_cache_set_max_size(global_cache, cache_limit*MEGA);
+	if(persistent_cache_dir && !work_queue_cache_load(global_cache)) {
+		fatal("cache directory %s is in use by another worker", persistent_cache_dir);
+	}
 	free(cachedir);
 
 	char *tmp_name = string_format("%s/cache/tmp", workspace);
@@ -2000,6 +2111,7 @@ XXX the cleanup of internal data structures doesn't quite belong here.
 static void workspace_delete()
 {
 	if(user_specified_workdir) free(user_specified_workdir);
+	if(persistent_cache_dir) free(persistent_cache_dir);
 	if(os_name) free(os_name);
 	if(arch_name) free(arch_name);
 
@@ -2102,6 +2214,8 @@ static int serve_manager_by_hostport( const char *host, int port, const char *ve
 
 	report_worker_ready(manager);
 
+	work_queue_cache_advertise(global_cache, manager);
+
 	if(worker_mode == WORKER_MODE_FOREMAN) {
 		foreman_for_manager(manager);
 	} else {
@@ -2408,6 +2522,10 @@ static void show_help(const char *cmd)
 	printf( " %-30s One of by_ip, by_hostname, or by_apparent_ip. Default is set by manager.\n", "");
 
 	printf( " %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
+	printf( " %-30s Maximum url transfers and commands run at once to fill the cache. (default=%d)\n", "--max-fetches=<n>", WORK_QUEUE_CACHE_MAX_FETCHES);
+	printf( " %-30s Maximum of those that may come from the same server. (default=%d)\n", "--max-fetches-per-source=<n>", WORK_QUEUE_CACHE_MAX_FETCHES_PER_SOURCE);
+	printf( " %-30s Evict the least recently used files when the cache exceeds this size. (in MB, default=unlimited)\n", "--cache-limit=<mb>");
+	printf( " %-30s Keep the cache in this directory when the worker exits, to reuse it on restart.\n", "--cache-dir=<dir>");
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf( " %-30s Set the percent chance per minute that the worker will shut down (simulates worker failures, for testing only).\n", "--volatility=<chance>");
 	printf( " %-30s Set the port used to lookup the worker's TLQ URL (-d and -o options also required).\n", "--tlq=<port>");
@@ -2423,7 +2541,8 @@ enum {LONG_OPT_DEBUG_FILESIZE = 256, LONG_OPT_VOLATILITY, LONG_OPT_BANDWIDTH,
 	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_TLQ, LONG_OPT_PARENT_DEATH, LONG_OPT_CONN_MODE,
 	  LONG_OPT_USE_SSL, LONG_OPT_PYTHON_FUNCTION, LONG_OPT_FROM_FACTORY, LONG_OPT_COPROCESS,
 	  LONG_OPT_NUM_COPROCESS, LONG_OPT_COPROCESS_CORES,
-	  LONG_OPT_COPROCESS_MEMORY, LONG_OPT_COPROCESS_DISK, LONG_OPT_COPROCESS_GPUS};
+	  LONG_OPT_COPROCESS_MEMORY, LONG_OPT_COPROCESS_DISK, LONG_OPT_COPROCESS_GPUS,
+	  LONG_OPT_MAX_FETCHES, LONG_OPT_MAX_FETCHES_PER_SOURCE, LONG_OPT_CACHE_LIMIT, LONG_OPT_CACHE_DIR};
 
 static const struct option long_options[] = {
 	{"advertise",           no_argument,        0,  'a'},
@@ -2476,6 +2595,10 @@ static const struct option long_options[] = {
 	{"coprocess-disk",      required_argument,  0,  LONG_OPT_COPROCESS_DISK},
 	{"coprocess-gpus",      required_argument,  0,  LONG_OPT_COPROCESS_GPUS},
 	{"from-factory",        required_argument,  0,  LONG_OPT_FROM_FACTORY},
+	{"max-fetches",         required_argument,  0,  LONG_OPT_MAX_FETCHES},
+	{"max-fetches-per-source", required_argument,  0,  LONG_OPT_MAX_FETCHES_PER_SOURCE},
+	{"cache-limit",         required_argument,  0,  LONG_OPT_CACHE_LIMIT},
+	{"cache-dir",           required_argument,  0,  LONG_OPT_CACHE_DIR},
 	{0,0,0,0}
 };
 
@@ -2757,6 +2880,23 @@ int main(int argc, char *argv[])
 			if (factory_name) free(factory_name);
 			factory_name = xxstrdup(optarg);
 			break;
+		case LONG_OPT_MAX_FETCHES:
+			max_fetches = atoi(optarg);
+			break;
+		case LONG_OPT_MAX_FETCHES_PER_SOURCE:
+			max_fetches_per_source = atoi(optarg);
+			break;
+		case LONG_OPT_CACHE_LIMIT:
+			cache_limit = atoll(optarg);
+			break;
+		case LONG_OPT_CACHE_DIR:
+		{
+			char temp_abs_path[PATH_MAX];
+			path_absolute(optarg, temp_abs_path, 0);
+			if(persistent_cache_dir) free(persistent_cache_dir);
+			persistent_cache_dir = xxstrdup(temp_abs_path);
+			break;
+		}
 		default:
 			show_help(argv[0]);
 			return 1;
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+export PATH=../src:$PATH
+
+TASKS=10
+
+prepare()
+{
+	echo "nothing to do"
+}
+
+run()
+{
+	cat > master.script << EOF2
+submit 1 0 1 $TASKS
+wait
+quit
+EOF2
+
+	echo "starting master"
+	work_queue_test -d all -o master.log -Z master.port < master.script &
+
+	echo "waiting for master to get ready"
+	wait_for_file_creation master.port 5
+
+	port=`cat master.port`
+
+	echo "starting foreman"
+	work_queue_worker --foreman -Z foreman.port -d all -o foreman.log localhost $port --timeout 5 &
+	wait_for_file_creation foreman.port 5
+
+	echo "starting worker"
+	work_queue_worker -d all -o worker.log localhost `cat foreman.port` --timeout 20 --cores 2 --memory 50 --single-shot
+
+	wait
+
+	echo "checking for output"
+	i=0
+	while [ $i -lt $TASKS ]
+	do
+		if [ ! -f output.$i ]
+		then
+			echo "output.$i is missing!"
+			cat foreman.log
+			return 1
+		fi
+		i=$((i+1))
+	done
+
+	echo "checking that the shared input was sent once to the foreman"
+	if [ "`grep -c 'rx: put .*input.0' foreman.log`" != 1 ]
+	then
+		cat foreman.log
+		return 1
+	fi
+
+	echo "all output present"
+	return 0
+}
+
+clean()
+{
+	rm -f master.script master.log master.port foreman.port foreman.log worker.log output.* input.*
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: